@@ -19,12 +19,17 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
 
   BOOST_PYTHON_MODULE(dials_algorithms_background_glm_ext) {
     class_<RobustPoissonMean>("RobustPoissonMean", no_init)
-      .def(init<const af::const_ref<double>&, double, double, double, std::size_t>(
-        (arg("Y"),
-         arg("mean0"),
-         arg("c") = 1.345,
-         arg("tolerance") = 1e-3,
-         arg("max_iter") = 100)))
+      .def(init<const af::const_ref<double>&,
+                double,
+                double,
+                double,
+                std::size_t,
+                bool>((arg("Y"),
+                       arg("mean0"),
+                       arg("c") = 1.345,
+                       arg("tolerance") = 1e-3,
+                       arg("max_iter") = 100,
+                       arg("sorted") = false)))
       .def("mean", &RobustPoissonMean::mean)
       .def("niter", &RobustPoissonMean::niter)
       .def("error", &RobustPoissonMean::error)
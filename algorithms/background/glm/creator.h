@@ -12,6 +12,10 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_GLM_CREATOR_H
 #define DIALS_ALGORITHMS_BACKGROUND_GLM_CREATOR_H
 
+#include <algorithm>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/tss.hpp>
 #include <scitbx/glmtbx/robust_glm.h>
 #include <dials/algorithms/background/glm/robust_poisson_mean.h>
 #include <dials/array_family/reflection_table.h>
@@ -39,6 +43,47 @@ namespace dials { namespace algorithms {
       return temp[temp.size() / 2];
     }
 
+    /**
+     * The arrays used to fit the background of a shoebox. They are only ever
+     * grown so, once the largest shoebox has been seen, fitting a shoebox
+     * does not allocate any memory.
+     */
+    struct GLMWorkspace {
+      std::vector<double> X;
+      std::vector<double> Y;
+      std::vector<double> T;
+
+      /**
+       * Resize the arrays for a model
+       * @param nobs The number of observations
+       * @param ncoef The number of model coefficients
+       */
+      void resize(std::size_t nobs, std::size_t ncoef) {
+        X.resize(nobs * ncoef);
+        Y.resize(nobs);
+      }
+
+      af::const_ref<double, af::c_grid<2> > design_matrix() const {
+        std::size_t nobs = Y.size();
+        return af::const_ref<double, af::c_grid<2> >(
+          &X[0], af::c_grid<2>(nobs, nobs == 0 ? 0 : X.size() / nobs));
+      }
+
+      af::const_ref<double> observations() const {
+        return af::const_ref<double>(&Y[0], Y.size());
+      }
+
+      /**
+       * @returns The median of the observations, leaving them in place
+       */
+      double median() {
+        DIALS_ASSERT(Y.size() > 0);
+        T.assign(Y.begin(), Y.end());
+        std::nth_element(T.begin(), T.begin() + T.size() / 2, T.end());
+        return T[T.size() / 2];
+      }
+    };
+
   }  // namespace detail
 
   /**
@@ -64,7 +109,8 @@ namespace dials { namespace algorithms {
         : model_(model),
           tuning_constant_(tuning_constant),
           max_iter_(max_iter),
-          min_pixels_(min_pixels) {
+          min_pixels_(min_pixels),
+          workspace_(new boost::thread_specific_ptr<detail::GLMWorkspace>()) {
       DIALS_ASSERT(tuning_constant > 0);
       DIALS_ASSERT(max_iter > 0);
       DIALS_ASSERT(min_pixels > 0);
@@ -142,6 +188,33 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * @returns The workspace of the calling thread
+     */
+    detail::GLMWorkspace &workspace() const {
+      if (workspace_->get() == NULL) {
+        workspace_->reset(new detail::GLMWorkspace());
+      }
+      return *workspace_->get();
+    }
+
+    /**
+     * Compute the robust mean of the observations in the workspace. The
+     * observations are sorted so the median comes for free and the mean can
+     * be computed from cumulative sums.
+     */
+    double robust_mean(detail::GLMWorkspace &ws) const {
+      std::sort(ws.Y.begin(), ws.Y.end());
+      double median = ws.Y[ws.Y.size() / 2];
+      if (median == 0) {
+        median = 1.0;
+      }
+      RobustPoissonMean result(
+        ws.observations(), median, tuning_constant_, 1e-3, max_iter_, true);
+      DIALS_ASSERT(result.converged());
+      return result.mean();
+    }
+
     /**
      * Compute the background values for a single shoebox
      * @param sbox The shoebox
@@ -190,8 +263,10 @@ namespace dials { namespace algorithms {
         }
         DIALS_ASSERT(num_background >= min_pixels_);
 
-        // Allocate some arrays
-        af::shared<double> Y(num_background, 0);
+        // Fill the observations
+        detail::GLMWorkspace &ws = workspace();
+        ws.resize(num_background, 0);
+        std::vector<double> &Y = ws.Y;
         std::size_t l = 0;
         for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
           for (std::size_t i = 0; i < data.accessor()[2]; ++i) {
@@ -205,19 +280,8 @@ namespace dials { namespace algorithms {
         }
         DIALS_ASSERT(l == Y.size());
 
-        // Compute the median value for the starting value
-        double median = detail::median(Y.const_ref());
-        if (median == 0) {
-          median = 1.0;
-        }
-
-        // Compute the result
-        RobustPoissonMean result(
-          Y.const_ref(), median, tuning_constant_, 1e-3, max_iter_);
-        DIALS_ASSERT(result.converged());
-
         // Compute the background
-        double mean_background = result.mean();
+        double mean_background = robust_mean(ws);
 
         // Fill in the background shoebox values
         for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
@@ -250,8 +314,10 @@ namespace dials { namespace algorithms {
       }
       DIALS_ASSERT(num_background >= min_pixels_);
 
-      // Allocate some arrays
-      af::shared<double> Y(num_background, 0);
+      // Fill the observations
+      detail::GLMWorkspace &ws = workspace();
+      ws.resize(num_background, 0);
+      std::vector<double> &Y = ws.Y;
       std::size_t j = 0;
       for (std::size_t i = 0; i < mask.size(); ++i) {
         if ((mask[i] & mask_code) == mask_code && ((mask[i] & Overlapped) == 0)) {
@@ -262,19 +328,8 @@ namespace dials { namespace algorithms {
       }
       DIALS_ASSERT(j == Y.size());
 
-      // Compute the median value for the starting value
-      double median = detail::median(Y.const_ref());
-      if (median == 0) {
-        median = 1.0;
-      }
-
-      // Compute the result
-      RobustPoissonMean result(
-        Y.const_ref(), median, tuning_constant_, 1e-3, max_iter_);
-      DIALS_ASSERT(result.converged());
-
       // Compute the background
-      double mean_background = result.mean();
+      double mean_background = robust_mean(ws);
 
       // Fill in the background shoebox values
       for (std::size_t i = 0; i < background.size(); ++i) {
@@ -307,9 +362,11 @@ namespace dials { namespace algorithms {
         }
         DIALS_ASSERT(num_background >= min_pixels_);
 
-        // Allocate some arrays
-        af::versa<double, af::c_grid<2> > X(af::c_grid<2>(num_background, 3), 0);
-        af::shared<double> Y(num_background, 0);
+        // Fill the design matrix and observations
+        detail::GLMWorkspace &ws = workspace();
+        ws.resize(num_background, 3);
+        af::ref<double, af::c_grid<2> > X(&ws.X[0], af::c_grid<2>(num_background, 3));
+        std::vector<double> &Y = ws.Y;
         std::size_t l = 0;
         for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
           for (std::size_t i = 0; i < data.accessor()[2]; ++i) {
@@ -341,7 +398,7 @@ namespace dials { namespace algorithms {
         DIALS_ASSERT(countx > 0 && county > 0);
 
         // Compute the median value for the starting value
-        double median = detail::median(Y.const_ref());
+        double median = ws.median();
         if (median == 0) {
           median = 1.0;
         }
@@ -353,8 +410,8 @@ namespace dials { namespace algorithms {
         B[2] = 0.0;
 
         // Compute the result
-        scitbx::glmtbx::robust_glm<scitbx::glmtbx::poisson> result(X.const_ref(),
-                                                                   Y.const_ref(),
+        scitbx::glmtbx::robust_glm<scitbx::glmtbx::poisson> result(ws.design_matrix(),
+                                                                   ws.observations(),
                                                                    B.const_ref(),
                                                                    tuning_constant_,
                                                                    1e-3,
@@ -409,9 +466,11 @@ namespace dials { namespace algorithms {
       }
       DIALS_ASSERT(num_background >= min_pixels_);
 
-      // Allocate some arrays
-      af::versa<double, af::c_grid<2> > X(af::c_grid<2>(num_background, 4), 0);
-      af::shared<double> Y(num_background, 0);
+      // Fill the design matrix and observations
+      detail::GLMWorkspace &ws = workspace();
+      ws.resize(num_background, 4);
+      af::ref<double, af::c_grid<2> > X(&ws.X[0], af::c_grid<2>(num_background, 4));
+      std::vector<double> &Y = ws.Y;
       std::size_t l = 0;
       for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
         for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
@@ -450,7 +509,7 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(countx > 0 && county > 0 && countz > 0);
 
       // Compute the median value for the starting value
-      double median = detail::median(Y.const_ref());
+      double median = ws.median();
       if (median == 0) {
         median = 1.0;
       }
@@ -463,8 +522,12 @@ namespace dials { namespace algorithms {
       B[3] = 0.0;
 
       // Compute the result
-      scitbx::glmtbx::robust_glm<scitbx::glmtbx::poisson> result(
-        X.const_ref(), Y.const_ref(), B.const_ref(), tuning_constant_, 1e-3, max_iter_);
+      scitbx::glmtbx::robust_glm<scitbx::glmtbx::poisson> result(ws.design_matrix(),
+                                                                 ws.observations(),
+                                                                 B.const_ref(),
+                                                                 tuning_constant_,
+                                                                 1e-3,
+                                                                 max_iter_);
       DIALS_ASSERT(result.converged());
 
       // Compute the background
@@ -498,6 +561,7 @@ namespace dials { namespace algorithms {
     double tuning_constant_;
     std::size_t max_iter_;
     std::size_t min_pixels_;
+    boost::shared_ptr<boost::thread_specific_ptr<detail::GLMWorkspace> > workspace_;
   };
 
 }}  // namespace dials::algorithms
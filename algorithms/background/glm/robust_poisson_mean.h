@@ -11,6 +11,8 @@
 #ifndef SCITBX_GLMTBX_ROBUST_POISSON_MEAN_H
 #define SCITBX_GLMTBX_ROBUST_POISSON_MEAN_H
 
+#include <algorithm>
+#include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/matrix/inversion.h>
 #include <scitbx/matrix/multiply.h>
@@ -24,6 +26,11 @@ namespace dials { namespace algorithms {
    * An algorithm to do robust generalized linear model as described in
    * Cantoni and Rochetti (2001) "Robust Inference for Generalized Linear
    * Models"
+   *
+   * If the observations are sorted in ascending order each iteration is
+   * computed from cumulative sums of the observations: those whose residual
+   * is clipped by the huber function only need to be counted, so finding the
+   * clipped ranges by bisection replaces the loop over the observations.
    */
   class RobustPoissonMean {
     typedef scitbx::glmtbx::poisson family;
@@ -40,12 +47,14 @@ namespace dials { namespace algorithms {
      * @param c The huber tuning constant
      * @param tolerance The stopping critera
      * @param max_iter The maximum number of iterations
+     * @param sorted The observations are sorted in ascending order
      */
     RobustPoissonMean(const af::const_ref<double> &Y,
                       double mean0,
                       double c,
                       double tolerance,
-                      std::size_t max_iter)
+                      std::size_t max_iter,
+                      bool sorted = false)
         : niter_(0), error_(0), c_(c), tolerance_(tolerance), max_iter_(max_iter) {
       SCITBX_ASSERT(Y.size() > 0);
       SCITBX_ASSERT(mean0 > 0);
@@ -53,7 +62,11 @@ namespace dials { namespace algorithms {
       SCITBX_ASSERT(tolerance > 0);
       SCITBX_ASSERT(max_iter > 0);
       beta_ = std::log(mean0);
-      compute(Y);
+      if (sorted) {
+        compute_sorted(Y);
+      } else {
+        compute(Y);
+      }
     }
 
     /**
@@ -144,6 +157,60 @@ namespace dials { namespace algorithms {
       }
     }
 
+    void compute_sorted(const af::const_ref<double> &Y) {
+      // Number of observations and their cumulative sums
+      std::size_t n_obs = Y.size();
+      std::vector<double> sum(n_obs + 1, 0);
+      for (std::size_t i = 0; i < n_obs; ++i) {
+        SCITBX_ASSERT(i == 0 || Y[i] >= Y[i - 1]);
+        sum[i + 1] = sum[i] + Y[i];
+      }
+
+      // Loop until we reach the maximum number of iterations
+      for (niter_ = 0; niter_ < max_iter_; ++niter_) {
+        double w = 1.0;
+        double eta = beta_;
+        double mu = family::linkinv(eta);
+        double var = family::variance(mu);
+        double dmu = family::dmu_deta(eta);
+        double phi = family::dispersion();
+        SCITBX_ASSERT(phi > 0);
+        SCITBX_ASSERT(var > 0);
+        double svar = std::sqrt(phi * var);
+
+        // Compute expectation values
+        scitbx::glmtbx::expectation<family> epsi(mu, svar, c_);
+
+        // The value of the b diagonal parts
+        double b = epsi.epsi2 * w * dmu * dmu / svar;
+
+        // The observations below lo and from hi have their residuals clipped
+        // to -c and c; the residuals in between are used as they are
+        const double *lo = std::upper_bound(Y.begin(), Y.end(), mu - c_ * svar);
+        const double *hi = std::lower_bound(lo, Y.end(), mu + c_ * svar);
+        std::size_t ilo = lo - Y.begin();
+        std::size_t ihi = hi - Y.begin();
+        double psi = c_ * ((double)(n_obs - ihi) - (double)ilo)
+                     + (sum[ihi] - sum[ilo] - (ihi - ilo) * mu) / svar;
+        double U = (psi - n_obs * epsi.epsi1) * w * dmu / svar;
+        double H = n_obs * b;
+
+        // Compute delta = H^-1 U
+        U = U / H;
+
+        // Compute the relative error in the parameters and update
+        double sum_delta_sq = U * U;
+        double sum_beta_sq = beta_ * beta_;
+        beta_ += U;
+
+        // If error is within tolerance then break
+        error_ = std::sqrt(sum_delta_sq / std::max(1e-10, sum_beta_sq));
+        if (error_ < tolerance_) {
+          break;
+        }
+      }
+    }
+
     double beta_;
     std::size_t niter_;
     double error_;
@@ -7,6 +7,8 @@
     "BackgroundAlgorithm",
     "BackgroundModel",
     "Creator",
+    "is_mapped_background_model",
+    "MappedBackgroundModel",
     "PolarTransform",
     "PolarTransformResult",
     "StaticBackgroundModel",
@@ -23,9 +23,17 @@ def get(self, name):
         try:
             model = self.model[name]
         except KeyError:
-            with open(name, "rb") as infile:
-                model = pickle.load(infile)
-                self.model[name] = model
+            from dials.algorithms.background.gmodel import (
+                is_mapped_background_model,
+                MappedBackgroundModel,
+            )
+
+            if is_mapped_background_model(name):
+                model = MappedBackgroundModel(name)
+            else:
+                with open(name, "rb") as infile:
+                    model = pickle.load(infile)
+            self.model[name] = model
         return model
 
 
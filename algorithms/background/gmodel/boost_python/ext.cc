@@ -38,18 +38,30 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
     }
   };
 
+  struct MappedBackgroundModelPickleSuite : boost::python::pickle_suite {
+    static boost::python::tuple getinitargs(const MappedBackgroundModel &obj) {
+      return boost::python::make_tuple(obj.filename());
+    }
+  };
+
   BOOST_PYTHON_MODULE(dials_algorithms_background_gmodel_ext) {
     class_<PolarTransformResult>("PolarTransformResult", no_init)
       .def("data", &PolarTransformResult::data)
       .def("mask", &PolarTransformResult::mask);
 
     class_<PolarTransform>("PolarTransform", no_init)
-      .def(init<const BeamBase &, const Panel &, const Goniometer &>())
+      .def(init<const BeamBase &, const Panel &, const Goniometer &, std::size_t>(
+        (arg("beam"), arg("panel"), arg("goniometer"), arg("nthreads") = 1)))
       .def("image_xmap", &PolarTransform::image_xmap)
       .def("image_ymap", &PolarTransform::image_ymap)
       .def("discontinuity", &PolarTransform::discontinuity)
-      .def("to_polar", &PolarTransform::to_polar)
-      .def("from_polar", &PolarTransform::from_polar);
+      .def("num_matrix_elements", &PolarTransform::num_matrix_elements)
+      .def("to_polar",
+           &PolarTransform::to_polar,
+           (arg("data"), arg("mask"), arg("nthreads") = 1))
+      .def("from_polar",
+           &PolarTransform::from_polar,
+           (arg("data"), arg("mask"), arg("nthreads") = 1));
 
     class_<BackgroundModel, boost::noncopyable, boost::shared_ptr<BackgroundModel> >(
       "BackgroundModel", no_init)
@@ -59,8 +71,19 @@ namespace dials { namespace algorithms { namespace background { namespace boost_
       .def("add", &StaticBackgroundModel::add)
       .def("__len__", &StaticBackgroundModel::size)
       .def("data", &StaticBackgroundModel::data)
+      .def("as_mapped_file", &write_mapped_background_model)
       .def_pickle(StaticBackgroundModelPickleSuite());
 
+    class_<MappedBackgroundModel, bases<BackgroundModel> >("MappedBackgroundModel",
+                                                          no_init)
+      .def(init<std::string>())
+      .def("__len__", &MappedBackgroundModel::size)
+      .def("data", &MappedBackgroundModel::data)
+      .def("filename", &MappedBackgroundModel::filename)
+      .def_pickle(MappedBackgroundModelPickleSuite());
+
+    def("is_mapped_background_model", &is_mapped_background_model);
+
     class_<GModelBackgroundCreator> creator("Creator", no_init);
     creator
       .def(init<boost::shared_ptr<BackgroundModel>, bool, std::size_t>(
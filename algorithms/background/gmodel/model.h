@@ -12,6 +12,14 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_GLM_MODEL_H
 #define DIALS_ALGORITHMS_BACKGROUND_GLM_MODEL_H
 
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/shared_ptr.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
@@ -26,29 +34,23 @@ namespace dials { namespace algorithms {
 
     virtual af::versa<double, af::c_grid<3> > extract(std::size_t panel,
                                                       int6 bbox) const = 0;
-  };
-
-  /**
-   * A simple static background model
-   */
-  class StaticBackgroundModel : public BackgroundModel {
-  public:
-    StaticBackgroundModel() {}
 
+  protected:
     /**
-     * Extract a shoebox
+     * Extract a shoebox from the model image of a panel. The model is the
+     * same on every frame of the shoebox and is zero off the panel.
+     * @param data The model image of the panel
      * @param bbox The bounding box
      * @returns The model data
      */
-    virtual af::versa<double, af::c_grid<3> > extract(std::size_t panel,
-                                                      int6 bbox) const {
-      DIALS_ASSERT(panel < data_.size());
+    static af::versa<double, af::c_grid<3> > extract_from(
+      const af::const_ref<double, af::c_grid<2> > &data,
+      int6 bbox) {
       DIALS_ASSERT(bbox[1] > bbox[0]);
       DIALS_ASSERT(bbox[3] > bbox[2]);
       DIALS_ASSERT(bbox[5] > bbox[4]);
       af::c_grid<3> grid(bbox[5] - bbox[4], bbox[3] - bbox[2], bbox[1] - bbox[0]);
       af::versa<double, af::c_grid<3> > result(grid, 0);
-      af::const_ref<double, af::c_grid<2> > data = data_[panel].const_ref();
       for (std::size_t j = 0; j < result.accessor()[1]; ++j) {
         for (std::size_t i = 0; i < result.accessor()[2]; ++i) {
           int ii = bbox[0] + i;
@@ -64,6 +66,25 @@ namespace dials { namespace algorithms {
       }
       return result;
     }
+  };
+
+  /**
+   * A simple static background model
+   */
+  class StaticBackgroundModel : public BackgroundModel {
+  public:
+    StaticBackgroundModel() {}
+
+    /**
+     * Extract a shoebox
+     * @param bbox The bounding box
+     * @returns The model data
+     */
+    virtual af::versa<double, af::c_grid<3> > extract(std::size_t panel,
+                                                      int6 bbox) const {
+      DIALS_ASSERT(panel < data_.size());
+      return extract_from(data_[panel].const_ref(), bbox);
+    }
 
     /**
      * Add the background model
@@ -95,6 +116,188 @@ namespace dials { namespace algorithms {
     af::shared<af::versa<double, af::c_grid<2> > > data_;
   };
 
+  namespace mapped_background_detail {
+
+    /**
+     * The magic bytes at the start of the file
+     */
+    inline const char *magic() {
+      return "DIALSBGM";
+    }
+
+    /**
+     * The file layout version
+     */
+    inline boost::uint64_t version() {
+      return 1;
+    }
+
+    /**
+     * The alignment of the start of each panel image in the file
+     */
+    inline std::size_t align(std::size_t offset) {
+      return ((offset + 63) / 64) * 64;
+    }
+
+    /**
+     * The size of the header for a number of panels
+     */
+    inline std::size_t header_size(std::size_t num_panels) {
+      return align(8 + 2 * sizeof(boost::uint64_t)
+                   + 3 * num_panels * sizeof(boost::uint64_t));
+    }
+
+  }  // namespace mapped_background_detail
+
+  /**
+   * Write a background model to a file which can be memory mapped by
+   * MappedBackgroundModel. The layout of the file is:
+   *
+   *  magic     8 bytes "DIALSBGM"
+   *  version   64 bit unsigned
+   *  npanels   64 bit unsigned
+   *  panels    64 bit unsigned height, width and offset of each panel image
+   *  images    the panel images as doubles, each aligned to 64 bytes
+   *
+   * Data are written in the native byte order.
+   * @param model The background model
+   * @param filename The filename
+   */
+  inline void write_mapped_background_model(const StaticBackgroundModel &model,
+                                            const std::string &filename) {
+    using namespace mapped_background_detail;
+    std::vector<boost::uint64_t> header;
+    header.push_back(version());
+    header.push_back(model.size());
+    std::size_t offset = header_size(model.size());
+    for (std::size_t i = 0; i < model.size(); ++i) {
+      af::c_grid<2> grid = model.data(i).accessor();
+      header.push_back(grid[0]);
+      header.push_back(grid[1]);
+      header.push_back(offset);
+      offset = align(offset + grid[0] * grid[1] * sizeof(double));
+    }
+
+    std::ofstream outfile(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!outfile) {
+      throw DIALS_ERROR("Unable to open " + filename + " for writing");
+    }
+    std::string padding(64, '\0');
+    outfile.write(magic(), 8);
+    outfile.write(reinterpret_cast<const char *>(&header[0]),
+                  header.size() * sizeof(boost::uint64_t));
+    std::size_t position = 8 + header.size() * sizeof(boost::uint64_t);
+    for (std::size_t i = 0; i < model.size(); ++i) {
+      std::size_t start = header[2 + 3 * i + 2];
+      outfile.write(padding.c_str(), start - position);
+      af::versa<double, af::c_grid<2> > data = model.data(i);
+      outfile.write(reinterpret_cast<const char *>(data.begin()),
+                    data.size() * sizeof(double));
+      position = start + data.size() * sizeof(double);
+    }
+    if (!outfile) {
+      throw DIALS_ERROR("Error writing " + filename);
+    }
+  }
+
+  /**
+   * Check if the file is a memory mapped background model
+   * @param filename The filename
+   * @returns True/False
+   */
+  inline bool is_mapped_background_model(const std::string &filename) {
+    std::ifstream infile(filename.c_str(), std::ios::in | std::ios::binary);
+    char buffer[8];
+    infile.read(buffer, 8);
+    return infile && std::memcmp(buffer, mapped_background_detail::magic(), 8) == 0;
+  }
+
+  /**
+   * A static background model read from a memory mapped file. The file is
+   * mapped read only and shoeboxes are extracted directly from the mapped
+   * panel images, so processes using the same model file share a single
+   * copy of it through the page cache and nothing is read up front.
+   */
+  class MappedBackgroundModel : public BackgroundModel {
+  public:
+    /**
+     * Map the file
+     * @param filename The filename
+     */
+    MappedBackgroundModel(const std::string &filename) : filename_(filename) {
+      using namespace boost::interprocess;
+      using namespace mapped_background_detail;
+      if (!is_mapped_background_model(filename)) {
+        throw DIALS_ERROR(filename + " is not a mapped background model");
+      }
+      file_mapping mapping(filename.c_str(), read_only);
+      region_.reset(new mapped_region(mapping, read_only));
+      const char *data = static_cast<const char *>(region_->get_address());
+      std::size_t size = region_->get_size();
+
+      // Read the header
+      boost::uint64_t header[2];
+      DIALS_ASSERT(size >= 8 + sizeof(header));
+      std::memcpy(header, data + 8, sizeof(header));
+      if (header[0] != version()) {
+        throw DIALS_ERROR("Mapped background model has unknown version");
+      }
+      std::size_t num_panels = header[1];
+      DIALS_ASSERT(header_size(num_panels) <= size);
+      for (std::size_t i = 0; i < num_panels; ++i) {
+        boost::uint64_t panel[3];
+        std::size_t position = 8 + sizeof(header) + i * sizeof(panel);
+        std::memcpy(panel, data + position, sizeof(panel));
+        af::c_grid<2> grid(panel[0], panel[1]);
+        DIALS_ASSERT(panel[2] % sizeof(double) == 0);
+        DIALS_ASSERT(panel[2] + grid.size_1d() * sizeof(double) <= size);
+        panels_.push_back(af::const_ref<double, af::c_grid<2> >(
+          reinterpret_cast<const double *>(data + panel[2]), grid));
+      }
+    }
+
+    /**
+     * Extract a shoebox
+     * @param bbox The bounding box
+     * @returns The model data
+     */
+    virtual af::versa<double, af::c_grid<3> > extract(std::size_t panel,
+                                                      int6 bbox) const {
+      DIALS_ASSERT(panel < panels_.size());
+      return extract_from(panels_[panel], bbox);
+    }
+
+    /**
+     * The number of panels
+     */
+    std::size_t size() const {
+      return panels_.size();
+    }
+
+    /**
+     * Get a copy of the data array
+     * @returns The data array
+     */
+    af::versa<double, af::c_grid<2> > data(std::size_t panel) const {
+      DIALS_ASSERT(panel < size());
+      af::versa<double, af::c_grid<2> > result(panels_[panel].accessor());
+      std::copy(panels_[panel].begin(), panels_[panel].end(), result.begin());
+      return result;
+    }
+
+    /**
+     * @returns The filename
+     */
+    std::string filename() const {
+      return filename_;
+    }
+
+  private:
+    std::string filename_;
+    boost::shared_ptr<boost::interprocess::mapped_region> region_;
+    std::vector<af::const_ref<double, af::c_grid<2> > > panels_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_BACKGROUND_GLM_MODEL_H
@@ -12,10 +12,12 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_GMODEL_POLAR_TRANSFORM_H
 #define DIALS_ALGORITHMS_BACKGROUND_GMODEL_POLAR_TRANSFORM_H
 
+#include <vector>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/goniometer.h>
 #include <dials/algorithms/polygon/spatial_interpolation.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
@@ -35,6 +37,120 @@ namespace dials { namespace algorithms {
     int sign(T val) {
       return (T(0) < val) - (val < T(0));
     }
+
+    /**
+     * Find the overlaps of the pixels of a band of image rows with the polar
+     * grid, in both directions of the transform
+     */
+    struct PolarMatchBand {
+      af::const_ref<double, af::c_grid<2> > xmap;
+      af::const_ref<double, af::c_grid<2> > ymap;
+      af::const_ref<bool, af::c_grid<2> > discontinuity;
+      af::c_grid<2> polar_grid;
+      std::vector<std::vector<Match> > &to_polar;
+      std::vector<std::vector<Match> > &from_polar;
+
+      PolarMatchBand(const af::const_ref<double, af::c_grid<2> > &xmap_,
+                     const af::const_ref<double, af::c_grid<2> > &ymap_,
+                     const af::const_ref<bool, af::c_grid<2> > &discontinuity_,
+                     af::c_grid<2> polar_grid_,
+                     std::vector<std::vector<Match> > &to_polar_,
+                     std::vector<std::vector<Match> > &from_polar_)
+          : xmap(xmap_),
+            ymap(ymap_),
+            discontinuity(discontinuity_),
+            polar_grid(polar_grid_),
+            to_polar(to_polar_),
+            from_polar(from_polar_) {}
+
+      vec2<double> gc(std::size_t j, std::size_t i) const {
+        return vec2<double>(xmap(j, i), ymap(j, i));
+      }
+
+      void operator()(int j0, int j1) const {
+        std::size_t width = xmap.accessor()[1] - 1;
+        int polar_size = (int)(polar_grid[0] * polar_grid[1]);
+        for (int j = j0; j < j1; ++j) {
+          for (std::size_t i = 0; i < width; ++i) {
+            // FIXME - Discarding pixels where the angle wraps round. Need to
+            // handle this better
+            if (discontinuity(j, i)) {
+              continue;
+            }
+            int index = (int)(j * width + i);
+            vert4 input(gc(j, i), gc(j, i + 1), gc(j + 1, i + 1), gc(j + 1, i));
+            af::shared<Match> to = quad_to_grid(input, polar_grid, index);
+            af::shared<Match> from = grid_to_quad(input, polar_grid, index);
+            for (std::size_t m = 0; m < to.size(); ++m) {
+              DIALS_ASSERT(to[m].out >= 0 && to[m].out < polar_size);
+              to_polar[j].push_back(to[m]);
+            }
+            for (std::size_t m = 0; m < from.size(); ++m) {
+              DIALS_ASSERT(from[m].in >= 0 && from[m].in < polar_size);
+              from_polar[j].push_back(from[m]);
+            }
+          }
+        }
+      }
+    };
+
+    /**
+     * Apply a sparse transform matrix to a band of rows of the output image.
+     * Each output pixel is the sum of the fractions of its input pixels in
+     * the order they were matched. Once an input pixel is masked the output
+     * pixel is masked and no more values are added, as in the original
+     * transform.
+     */
+    struct SparseTransformBand {
+      af::const_ref<std::size_t> row;
+      af::const_ref<int> col;
+      af::const_ref<double> value;
+      af::const_ref<double> data;
+      af::const_ref<bool> mask;
+      std::size_t width;
+      af::ref<double> data_out;
+      af::ref<bool> mask_out;
+      af::ref<bool> contributed;
+
+      SparseTransformBand(const af::const_ref<std::size_t> &row_,
+                          const af::const_ref<int> &col_,
+                          const af::const_ref<double> &value_,
+                          const af::const_ref<double> &data_,
+                          const af::const_ref<bool> &mask_,
+                          std::size_t width_,
+                          af::ref<double> data_out_,
+                          af::ref<bool> mask_out_,
+                          af::ref<bool> contributed_)
+          : row(row_),
+            col(col_),
+            value(value_),
+            data(data_),
+            mask(mask_),
+            width(width_),
+            data_out(data_out_),
+            mask_out(mask_out_),
+            contributed(contributed_) {}
+
+      void operator()(int j0, int j1) const {
+        for (std::size_t k = j0 * width; k < j1 * width; ++k) {
+          double sum = 0;
+          bool valid = mask_out[k];
+          bool added = false;
+          for (std::size_t n = row[k]; valid && n < row[k + 1]; ++n) {
+            if (mask[col[n]]) {
+              sum += data[col[n]] * value[n];
+              added = true;
+            } else {
+              valid = false;
+            }
+          }
+          data_out[k] = sum;
+          mask_out[k] = valid;
+          contributed[k] = added;
+        }
+      }
+    };
+
   }  // namespace detail
 
   class PolarTransformResult {
@@ -57,7 +173,10 @@ namespace dials { namespace algorithms {
   };
 
   /**
-   * A class to do a polar transform along resolution
+   * A class to do a polar transform along resolution. The overlaps of the
+   * image pixels with the polar grid are found once on construction and held
+   * as sparse matrices in each direction, so the transform of each image is
+   * a sparse matrix vector product which can be split over threads.
    */
   class PolarTransform {
   public:
@@ -66,10 +185,12 @@ namespace dials { namespace algorithms {
      * @param beam The beam model
      * @param panel The panel model
      * @param goniometer The goniometer model
+     * @param nthreads The number of threads to use
      */
     PolarTransform(const BeamBase &beam,
                    const Panel &panel,
-                   const Goniometer &goniometer) {
+                   const Goniometer &goniometer,
+                   std::size_t nthreads = 1) {
       // Set some image sizes
       vec2<std::size_t> image_size = panel.get_image_size();
       DIALS_ASSERT(image_size[0] > 0);
@@ -188,6 +309,9 @@ namespace dials { namespace algorithms {
           image_ymap_(j, i) = pj;
         }
       }
+
+      // Compute the transform matrices
+      compute_matrices(nthreads);
     }
 
     /**
@@ -229,11 +353,12 @@ namespace dials { namespace algorithms {
      * transform to polar
      * @param data The image data
      * @param mask The image mask
+     * @param nthreads The number of threads to use
      * @returns The transformed data
      */
-    PolarTransformResult to_polar(
-      const af::const_ref<double, af::c_grid<2> > &data,
-      const af::const_ref<bool, af::c_grid<2> > &mask) const {
+    PolarTransformResult to_polar(const af::const_ref<double, af::c_grid<2> > &data,
+                                  const af::const_ref<bool, af::c_grid<2> > &mask,
+                                  std::size_t nthreads = 1) const {
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(data.accessor().all_eq(image_grid_));
       DIALS_ASSERT(data.accessor()[0] + 1 == discontinuity_.accessor()[0]);
@@ -241,33 +366,17 @@ namespace dials { namespace algorithms {
       af::versa<double, af::c_grid<2> > data_out(polar_grid_, 0);
       af::versa<bool, af::c_grid<2> > mask_out(polar_grid_, true);
       af::versa<bool, af::c_grid<2> > mask_tmp(polar_grid_, false);
-
-      for (std::size_t j = 0; j < image_grid_[0]; ++j) {
-        for (std::size_t i = 0; i < image_grid_[1]; ++i) {
-          // FIXME - Discarding pixels where the angle wraps round. Need to
-          // handle this better
-
-          if (discontinuity_(j, i)) {
-            continue;
-          }
-          vert4 input(gc(j, i), gc(j, i + 1), gc(j + 1, i + 1), gc(j + 1, i));
-          af::shared<Match> matches = quad_to_grid(input, polar_grid_, 0);
-          for (int m = 0; m < matches.size(); ++m) {
-            double fraction = matches[m].fraction;
-            int index = matches[m].out;
-            int ii = index % polar_grid_[1];
-            int jj = index / polar_grid_[1];
-            DIALS_ASSERT(jj >= 0 && jj < polar_grid_[0]);
-            DIALS_ASSERT(ii >= 0 && ii < polar_grid_[1]);
-            if (mask_out(jj, ii) && mask(j, i)) {
-              data_out(jj, ii) += data(j, i) * fraction;
-              mask_tmp(jj, ii) = true;
-            } else {
-              mask_out(jj, ii) = false;
-            }
-          }
-        }
-      }
+      for_each_band(detail::SparseTransformBand(to_polar_row_.const_ref(),
+                                                to_polar_col_.const_ref(),
+                                                to_polar_value_.const_ref(),
+                                                data.as_1d(),
+                                                mask.as_1d(),
+                                                polar_grid_[1],
+                                                data_out.ref().as_1d(),
+                                                mask_out.ref().as_1d(),
+                                                mask_tmp.ref().as_1d()),
+                    (int)polar_grid_[0],
+                    nthreads);
 
       // Apply both masks
       for (std::size_t i = 0; i < mask_out.size(); ++i) {
@@ -285,53 +394,128 @@ namespace dials { namespace algorithms {
      * transform from polar
      * @param data The polar data
      * @param mask The polar mask
+     * @param nthreads The number of threads to use
      * @returns The transformed data
      */
-    PolarTransformResult from_polar(
-      const af::const_ref<double, af::c_grid<2> > &data,
-      const af::const_ref<bool, af::c_grid<2> > &mask) const {
+    PolarTransformResult from_polar(const af::const_ref<double, af::c_grid<2> > &data,
+                                    const af::const_ref<bool, af::c_grid<2> > &mask,
+                                    std::size_t nthreads = 1) const {
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(data.accessor().all_eq(polar_grid_));
       af::versa<double, af::c_grid<2> > data_out(image_grid_, 0);
       af::versa<bool, af::c_grid<2> > mask_out(image_grid_, true);
+      af::versa<bool, af::c_grid<2> > contributed(image_grid_, false);
+
+      // FIXME - Discarding pixels where the angle wraps round. Need to
+      // handle this better
       for (std::size_t j = 0; j < image_grid_[0]; ++j) {
         for (std::size_t i = 0; i < image_grid_[1]; ++i) {
-          // FIXME - Discarding pixels where the angle wraps round. Need to
-          // handle this better
-
           if (discontinuity_(j, i)) {
             mask_out(j, i) = false;
-            continue;
-          }
-          vert4 input(gc(j, i), gc(j, i + 1), gc(j + 1, i + 1), gc(j + 1, i));
-          af::shared<Match> matches = grid_to_quad(input, polar_grid_, 0);
-          for (int m = 0; m < matches.size(); ++m) {
-            double fraction = matches[m].fraction;
-            int index = matches[m].in;
-            int ii = index % polar_grid_[1];
-            int jj = index / polar_grid_[1];
-            DIALS_ASSERT(ii < polar_grid_[1]);
-            DIALS_ASSERT(jj < polar_grid_[0]);
-            DIALS_ASSERT(ii >= 0);
-            DIALS_ASSERT(jj >= 0);
-            if (mask_out(j, i) && mask(jj, ii)) {
-              data_out(j, i) += data(jj, ii) * fraction;
-            } else {
-              mask_out(j, i) = false;
-            }
           }
         }
       }
+      for_each_band(detail::SparseTransformBand(from_polar_row_.const_ref(),
+                                                from_polar_col_.const_ref(),
+                                                from_polar_value_.const_ref(),
+                                                data.as_1d(),
+                                                mask.as_1d(),
+                                                image_grid_[1],
+                                                data_out.ref().as_1d(),
+                                                mask_out.ref().as_1d(),
+                                                contributed.ref().as_1d()),
+                    (int)image_grid_[0],
+                    nthreads);
 
       return PolarTransformResult(data_out, mask_out);
     }
 
+    /**
+     * @returns The number of elements of the sparse transform matrices
+     */
+    std::size_t num_matrix_elements() const {
+      return to_polar_value_.size() + from_polar_value_.size();
+    }
+
   protected:
+    /**
+     * Compute the sparse matrices of the transform to and from the polar
+     * grid. The rows of each matrix are the pixels of the output image and
+     * the elements of each row are in the order of the input pixels, so the
+     * sums are done in the same order as a pixel by pixel transform.
+     * @param nthreads The number of threads to use
+     */
+    void compute_matrices(std::size_t nthreads) {
+      std::size_t image_size = image_grid_[0] * image_grid_[1];
+      std::size_t polar_size = polar_grid_[0] * polar_grid_[1];
+      std::vector<std::vector<Match> > to_polar(image_grid_[0]);
+      std::vector<std::vector<Match> > from_polar(image_grid_[0]);
+      for_each_band(detail::PolarMatchBand(image_xmap_.const_ref(),
+                                           image_ymap_.const_ref(),
+                                           discontinuity_.const_ref(),
+                                           polar_grid_,
+                                           to_polar,
+                                           from_polar),
+                    (int)image_grid_[0],
+                    nthreads);
+
+      // The matrix to polar has a row for each polar pixel, so count the
+      // elements of each row and fill them in the order of the image pixels
+      to_polar_row_ = af::shared<std::size_t>(polar_size + 1, 0);
+      for (std::size_t j = 0; j < to_polar.size(); ++j) {
+        for (std::size_t m = 0; m < to_polar[j].size(); ++m) {
+          to_polar_row_[to_polar[j][m].out + 1]++;
+        }
+      }
+      for (std::size_t k = 0; k < polar_size; ++k) {
+        to_polar_row_[k + 1] += to_polar_row_[k];
+      }
+      to_polar_col_ = af::shared<int>(to_polar_row_.back(), 0);
+      to_polar_value_ = af::shared<double>(to_polar_row_.back(), 0);
+      std::vector<std::size_t> next(to_polar_row_.begin(), to_polar_row_.end() - 1);
+      for (std::size_t j = 0; j < to_polar.size(); ++j) {
+        for (std::size_t m = 0; m < to_polar[j].size(); ++m) {
+          const Match &match = to_polar[j][m];
+          std::size_t n = next[match.out]++;
+          to_polar_col_[n] = match.in;
+          to_polar_value_[n] = match.fraction;
+        }
+        std::vector<Match>().swap(to_polar[j]);
+      }
+
+      // The matrix from polar has a row for each image pixel so the elements
+      // are already in order
+      from_polar_row_ = af::shared<std::size_t>(image_size + 1, 0);
+      for (std::size_t j = 0; j < from_polar.size(); ++j) {
+        for (std::size_t m = 0; m < from_polar[j].size(); ++m) {
+          from_polar_row_[from_polar[j][m].out + 1]++;
+        }
+      }
+      for (std::size_t k = 0; k < image_size; ++k) {
+        from_polar_row_[k + 1] += from_polar_row_[k];
+      }
+      from_polar_col_.reserve(from_polar_row_.back());
+      from_polar_value_.reserve(from_polar_row_.back());
+      for (std::size_t j = 0; j < from_polar.size(); ++j) {
+        for (std::size_t m = 0; m < from_polar[j].size(); ++m) {
+          from_polar_col_.push_back(from_polar[j][m].in);
+          from_polar_value_.push_back(from_polar[j][m].fraction);
+        }
+        std::vector<Match>().swap(from_polar[j]);
+      }
+    }
+
     af::c_grid<2> image_grid_;
     af::c_grid<2> polar_grid_;
     af::versa<double, af::c_grid<2> > image_xmap_;
     af::versa<double, af::c_grid<2> > image_ymap_;
     af::versa<bool, af::c_grid<2> > discontinuity_;
+    af::shared<std::size_t> to_polar_row_;
+    af::shared<int> to_polar_col_;
+    af::shared<double> to_polar_value_;
+    af::shared<std::size_t> from_polar_row_;
+    af::shared<int> from_polar_col_;
+    af::shared<double> from_polar_value_;
   };
 
 }}  // namespace dials::algorithms
@@ -11,6 +11,12 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_GMODEL_ROBUST_ESTIMATOR_H
 #define DIALS_ALGORITHMS_BACKGROUND_GMODEL_ROBUST_ESTIMATOR_H
 
+#include <map>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <scitbx/vec2.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/matrix/multiply.h>
 #include <scitbx/glmtbx/family.h>
@@ -19,36 +25,53 @@
 
 namespace dials { namespace algorithms {
 
+  /**
+   * A table of the expected values of the huber function of the residuals,
+   * and of their derivative, for Poisson distributed observations with a
+   * given tuning constant. The values are computed at fixed steps of the mean
+   * when the table is made and linearly interpolated between them; means
+   * outside the table are computed directly. The table is never changed once
+   * made so it can be shared between threads.
+   */
   class ExpectationTable {
   public:
-    ExpectationTable()
-        : c_(-1), max_(1000), div_(100), size_(max_ * div_), epsi_table_(size_) {}
-
-    void set_c(double c) {
+    /**
+     * @param c The huber tuning constant
+     */
+    ExpectationTable(double c)
+        : c_(c), max_(1000), div_(100), size_(max_ * div_ + 1), epsi_table_(size_) {
       DIALS_ASSERT(c > 0);
-      if (c_ <= 0 || std::abs(c - c_) > 1e-3) {
-        c_ = c;
-        for (std::size_t i = 0; i < size_; ++i) {
-          epsi_table_[i] = calculate((double)i / (double)div_);
-        }
+      for (std::size_t i = 1; i < size_; ++i) {
+        epsi_table_[i] = calculate((double)i / (double)div_);
       }
     }
 
-    vec2<double> get(double mu) {
-      return mu < max_ ? interpolate(mu) : calculate(mu);
+    /**
+     * @returns The tuning constant
+     */
+    double c() const {
+      return c_;
+    }
+
+    /**
+     * @param mu The mean
+     * @returns The expected values
+     */
+    vec2<double> get(double mu) const {
+      double x = mu * div_;
+      return x >= 1 && x < size_ - 1 ? interpolate(x) : calculate(mu);
     }
 
   private:
-    vec2<double> interpolate(double mu) const {
-      DIALS_ASSERT(mu >= 0);
-      std::size_t index = (std::size_t)std::floor(mu * div_);
-      DIALS_ASSERT(index < epsi_table_.size());
-      return epsi_table_[index];
+    vec2<double> interpolate(double x) const {
+      std::size_t index = (std::size_t)x;
+      DIALS_ASSERT(index + 1 < epsi_table_.size());
+      double t = x - index;
+      return epsi_table_[index] * (1.0 - t) + epsi_table_[index + 1] * t;
     }
 
     vec2<double> calculate(double mu) const {
       DIALS_ASSERT(mu > 0);
-      DIALS_ASSERT(c_ > 0);
       scitbx::glmtbx::expectation<scitbx::glmtbx::poisson> e(mu, std::sqrt(mu), c_);
       return vec2<double>(e.epsi1, e.epsi2);
     }
@@ -57,13 +80,28 @@ namespace dials { namespace algorithms {
     int max_;
     int div_;
     std::size_t size_;
-    af::shared<vec2<double> > epsi_table_;
+    std::vector<vec2<double> > epsi_table_;
   };
 
-  inline ExpectationTable get_expectation_table(double c) {
-    static ExpectationTable table;
-    table.set_c(c);
-    return table;
+  /**
+   * Get the expectation table for a tuning constant. The tables are made the
+   * first time they are asked for and then shared by all callers.
+   * @param c The huber tuning constant
+   * @returns The table
+   */
+  inline boost::shared_ptr<const ExpectationTable> get_expectation_table(double c) {
+    typedef std::map<double, boost::shared_ptr<const ExpectationTable> > map_type;
+    static boost::mutex mutex;
+    static map_type tables;
+    boost::lock_guard<boost::mutex> lock(mutex);
+    map_type::iterator it = tables.find(c);
+    if (it == tables.end()) {
+      it = tables
+             .insert(map_type::value_type(
+               c, boost::shared_ptr<const ExpectationTable>(new ExpectationTable(c))))
+             .first;
+    }
+    return it->second;
   }
 
   /**
@@ -158,7 +196,10 @@ namespace dials { namespace algorithms {
       double H = 0;
 
       // Get the expectation table
-      ExpectationTable expectation = get_expectation_table(c_);
+      boost::shared_ptr<const ExpectationTable> table = get_expectation_table(c_);
+      const ExpectationTable &expectation = *table;
+      const double *x = X.begin();
+      const double *y = Y.begin();
 
       // Loop until we reach the maximum number of iterations
       for (niter_ = 0; niter_ < max_iter_; ++niter_) {
@@ -168,15 +209,16 @@ namespace dials { namespace algorithms {
         // Build the matrices from the observations
         for (std::size_t i = 0; i < n_obs; ++i) {
           // Compute the values for eta
-          double eta = X[i] * beta_;
+          double eta = x[i] * beta_;
 
-          // Compute some required values
+          // Compute some required values. With the log link the derivative
+          // of mu is mu itself so only one exponential is needed.
           double mu = family::linkinv(eta);
           double var = mu;
-          double dmu = family::dmu_deta(eta);
+          double dmu = mu;
           SCITBX_ASSERT(var > 0);
           double svar = std::sqrt(var);
-          double res = (Y[i] - mu) / svar;
+          double res = (y[i] - mu) / svar;
 
           // Compute expectation values
           vec2<double> epsi = expectation.get(mu);
@@ -192,8 +234,8 @@ namespace dials { namespace algorithms {
           double b = epsi2 * dmu * dmu / svar;
 
           // Update the BX = B * X and U matrices
-          U += q * X[i];
-          H += X[i] * b * X[i];
+          U += q * x[i];
+          H += x[i] * b * x[i];
         }
 
         // Compute delta = H^-1 U
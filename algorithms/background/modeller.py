@@ -24,13 +24,16 @@ class FinalizeModel(object):
     A class to finalize the background model
     """
 
-    def __init__(self, experiments, filter_type="median", kernel_size=10, niter=100):
+    def __init__(
+        self, experiments, filter_type="median", kernel_size=10, niter=100, nproc=1
+    ):
         """
         Initialize the finalizer
 
         :param experiments: The experiment list
         :param kernel_size: The median filter kernel size
         :param niter: The number of iterations for filling holes
+        :param nproc: The number of threads for the polar transform
         """
         from dials.algorithms.background.gmodel import PolarTransform
 
@@ -38,6 +41,7 @@ def __init__(self, experiments, filter_type="median", kernel_size=10, niter=100)
         self.filter_type = filter_type
         self.kernel_size = kernel_size
         self.niter = niter
+        self.nproc = nproc
 
         # Check the input
         assert len(experiments) == 1
@@ -49,7 +53,10 @@ def __init__(self, experiments, filter_type="median", kernel_size=10, niter=100)
 
         # Create the transform object
         self.transform = PolarTransform(
-            experiment.beam, experiment.detector[0], experiment.goniometer
+            experiment.beam,
+            experiment.detector[0],
+            experiment.goniometer,
+            nthreads=nproc,
         )
 
     def finalize(self, data, mask):
@@ -73,7 +80,7 @@ def finalize(self, data, mask):
 
         # Transform to polar
         logger.info("Transforming image data to polar grid")
-        result = self.transform.to_polar(data, mask)
+        result = self.transform.to_polar(data, mask, nthreads=self.nproc)
         data = result.data()
         mask = result.mask()
         sub_data = data.as_1d().select(mask.as_1d())
@@ -122,7 +129,7 @@ def finalize(self, data, mask):
 
         # Transform back
         logger.info("Transforming image data from polar grid")
-        result = self.transform.from_polar(data, mask)
+        result = self.transform.from_polar(data, mask, nthreads=self.nproc)
         data = result.data()
         mask = result.mask()
         sub_data = data.as_1d().select(mask.as_1d())
@@ -188,6 +195,7 @@ def __init__(self, experiments, params):
             filter_type=params.modeller.filter_type,
             kernel_size=params.modeller.kernel_size,
             niter=params.modeller.niter,
+            nproc=params.modeller.nproc,
         )
         self.result = None
 
@@ -211,6 +219,42 @@ def process(self, image_volume, experiments, reflections):
         # Compute the sum, sum^2 and the number of contributing pixels
         return MultiPanelBackgroundStatistics(image_volume)
 
+    def process_frames(self, frame0, frame1, frame_volumes, experiments, reflections):
+        """
+        Process the frames one at a time. The mask of each pixel only depends
+        on the reflections whose shoeboxes include it, so computing the
+        statistics from each frame and the reflections touching it gives the
+        same result as processing the whole block, while only holding one
+        frame of the volume in memory.
+
+        :param frame0: The first frame
+        :param frame1: The last frame
+        :param frame_volumes: The image volume and reflections of each frame
+        :param experiments: The experiments
+        :param reflections: The reflections
+        """
+        from dials.algorithms.integration.processor import job
+
+        # Write some output
+        logger.info(
+            " Background modelling; job: %d; frames: %d -> %d; # Reflections: %d"
+            % (job.index, frame0, frame1, len(reflections))
+        )
+
+        # Compute the sum, sum^2 and the number of contributing pixels
+        result = None
+        for image_volume, frame_reflections in frame_volumes:
+            if len(frame_reflections) > 0:
+                frame_reflections.compute_mask(
+                    experiments=experiments, image_volume=image_volume
+                )
+            statistics = MultiPanelBackgroundStatistics(image_volume)
+            if result is None:
+                result = statistics
+            else:
+                result += statistics
+        return result
+
     def accumulate(self, index, data):
         if self.result is None:
             self.result = data
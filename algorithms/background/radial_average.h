@@ -11,8 +11,11 @@
 #ifndef DIALS_ALGORITHMS_BACKGROUND_RADIAL_AVERAGE_H
 #define DIALS_ALGORITHMS_BACKGROUND_RADIAL_AVERAGE_H
 
+#include <cmath>
+#include <vector>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -21,6 +24,14 @@ namespace dials { namespace algorithms {
   using dxtbx::model::Detector;
   using dxtbx::model::Panel;
 
+  /**
+   * Compute the radial average of the images of a detector in bins of
+   * 1/d^2. The bin of each pixel of each panel is computed once on
+   * construction, so adding an image is a single pass over its pixels.
+   * The images are added panel by panel in order and, after the last panel,
+   * the next image starts again at the first, so the average can be
+   * accumulated over all the frames of a scan.
+   */
   class RadialAverage {
   public:
     RadialAverage(boost::shared_ptr<BeamBase> beam,
@@ -42,31 +53,26 @@ namespace dials { namespace algorithms {
       for (std::size_t i = 0; i < inv_d2_.size(); ++i) {
         inv_d2_[i] = vmin + i * (vmax - vmin) / num_bins_;
       }
+      DIALS_ASSERT(detector_.size() > 0);
+      for (std::size_t p = 0; p < detector_.size(); ++p) {
+        bins_.push_back(compute_bins(detector_[p]));
+      }
     }
 
     void add(const af::const_ref<double, af::c_grid<2> > &data,
              const af::const_ref<bool, af::c_grid<2> > &mask) {
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-      vec3<double> s0 = beam_->get_s0();
-      const Panel &panel = detector_[current_++];
+      const Panel &panel = detector_[current_];
+      const af::shared<int> &bins = bins_[current_];
+      current_ = (current_ + 1) % detector_.size();
       std::size_t height = panel.get_image_size()[1];
       std::size_t width = panel.get_image_size()[0];
       DIALS_ASSERT(data.accessor()[0] == height);
       DIALS_ASSERT(data.accessor()[1] == width);
-      for (std::size_t j = 0; j < height; ++j) {
-        for (std::size_t i = 0; i < width; ++i) {
-          if (mask(j, i)) {
-            double d = panel.get_resolution_at_pixel(s0, vec2<double>(i, j));
-            double d2 = (1.0 / (d * d));
-            if (d2 >= vmin_ && d2 < vmax_) {
-              double b = vmin_;
-              double a = (vmax_ - vmin_) / num_bins_;
-              int index = std::floor((d2 - b) / a);
-              DIALS_ASSERT(index >= 0 && index < num_bins_);
-              sum_[index] += data(j, i);
-              weight_[index] += 1.0;
-            }
-          }
+      for (std::size_t k = 0; k < bins.size(); ++k) {
+        if (mask[k] && bins[k] >= 0) {
+          sum_[bins[k]] += data[k];
+          weight_[bins[k]] += 1.0;
         }
       }
     }
@@ -92,6 +98,32 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Compute the bin of each pixel of a panel
+     * @param panel The panel
+     * @returns The bins, or -1 for pixels outside the range
+     */
+    af::shared<int> compute_bins(const Panel &panel) const {
+      vec3<double> s0 = beam_->get_s0();
+      std::size_t height = panel.get_image_size()[1];
+      std::size_t width = panel.get_image_size()[0];
+      af::shared<int> bins(width * height, -1);
+      for (std::size_t j = 0; j < height; ++j) {
+        for (std::size_t i = 0; i < width; ++i) {
+          double d = panel.get_resolution_at_pixel(s0, vec2<double>(i, j));
+          double d2 = (1.0 / (d * d));
+          if (d2 >= vmin_ && d2 < vmax_) {
+            double b = vmin_;
+            double a = (vmax_ - vmin_) / num_bins_;
+            int index = std::floor((d2 - b) / a);
+            DIALS_ASSERT(index >= 0 && index < num_bins_);
+            bins[j * width + i] = index;
+          }
+        }
+      }
+      return bins;
+    }
+
     boost::shared_ptr<BeamBase> beam_;
     Detector detector_;
     af::shared<double> sum_;
@@ -101,6 +133,7 @@ namespace dials { namespace algorithms {
     double vmax_;
     std::size_t num_bins_;
     std::size_t current_;
+    std::vector<af::shared<int> > bins_;
   };
 
 }}  // namespace dials::algorithms
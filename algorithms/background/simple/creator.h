@@ -13,11 +13,15 @@
 
 #include <omptbx/omp_or_stubs.h>
 #include <cmath>
+#include <vector>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/tss.hpp>
+#include <scitbx/math/mean_and_variance.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/background/simple/outlier_rejector.h>
 #include <dials/algorithms/background/simple/modeller.h>
+#include <dials/algorithms/background/simple/nsigma_outlier_rejector.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/model/data/image_volume.h>
 #include <dials/error.h>
@@ -34,6 +38,12 @@ namespace dials { namespace algorithms { namespace background {
 
   /**
    * Class to create background shoebox
+   *
+   * The default combination of an n sigma outlier rejector, or none, with a
+   * constant background model is computed in a single fused pass: the pixels
+   * are marked as used while the sums for the model and the statistics are
+   * accumulated, using a scratch buffer kept for each thread. The results
+   * are the same as calling the rejector and modeller in turn.
    */
   class SimpleBackgroundCreator {
   public:
@@ -43,9 +53,12 @@ namespace dials { namespace algorithms { namespace background {
      */
     SimpleBackgroundCreator(boost::shared_ptr<Modeller> modeller,
                             std::size_t min_pixels)
-        : modeller_(modeller), min_pixels_(min_pixels) {
+        : modeller_(modeller),
+          min_pixels_(min_pixels),
+          scratch_(new boost::thread_specific_ptr<std::vector<double> >()) {
       DIALS_ASSERT(modeller != NULL);
       DIALS_ASSERT(min_pixels > 0);
+      init_fused();
     }
 
     /**
@@ -56,9 +69,13 @@ namespace dials { namespace algorithms { namespace background {
     SimpleBackgroundCreator(boost::shared_ptr<Modeller> modeller,
                             boost::shared_ptr<OutlierRejector> rejector,
                             std::size_t min_pixels)
-        : modeller_(modeller), rejector_(rejector), min_pixels_(min_pixels) {
+        : modeller_(modeller),
+          rejector_(rejector),
+          min_pixels_(min_pixels),
+          scratch_(new boost::thread_specific_ptr<std::vector<double> >()) {
       DIALS_ASSERT(modeller != NULL);
       DIALS_ASSERT(min_pixels > 0);
+      init_fused();
     }
 
     /**
@@ -151,6 +168,10 @@ namespace dials { namespace algorithms { namespace background {
       const af::const_ref<FloatType, af::c_grid<3> > &data_in,
       af::ref<int, af::c_grid<3> > mask,
       af::ref<FloatType, af::c_grid<3> > background) const {
+      if (fused_) {
+        return compute_fused(data_in, mask, background);
+      }
+
       // Copy the array to a double
       af::versa<double, af::c_grid<3> > data(data_in.accessor());
       std::copy(data_in.begin(), data_in.end(), data.begin());
@@ -212,9 +233,125 @@ namespace dials { namespace algorithms { namespace background {
     }
 
   private:
+    /**
+     * Check if the rejector and modeller can be computed in the fused pass
+     */
+    void init_fused() {
+      constant2d_ = dynamic_cast<Constant2dModeller *>(modeller_.get()) != NULL;
+      bool constant3d = dynamic_cast<Constant3dModeller *>(modeller_.get()) != NULL;
+      nsigma_ = dynamic_cast<NSigmaOutlierRejector *>(rejector_.get());
+      fused_ = (constant2d_ || constant3d) && (!rejector_ || nsigma_ != NULL);
+    }
+
+    /**
+     * @returns The scratch buffer of the calling thread
+     */
+    std::vector<double> &scratch() const {
+      if (scratch_->get() == NULL) {
+        scratch_->reset(new std::vector<double>());
+      }
+      return *scratch_->get();
+    }
+
+    /**
+     * Compute the n sigma rejection and a constant model in one pass over
+     * the pixels
+     */
+    template <typename FloatType>
+    af::tiny<FloatType, 2> compute_fused(
+      const af::const_ref<FloatType, af::c_grid<3> > &data,
+      af::ref<int, af::c_grid<3> > mask,
+      af::ref<FloatType, af::c_grid<3> > background) const {
+      const int mask_code = Valid | Background;
+      std::size_t nz = data.accessor()[0];
+      std::size_t nxy = data.accessor()[1] * data.accessor()[2];
+      DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(data.accessor().all_eq(background.accessor()));
+
+      // Get the range of values accepted by the outlier rejector
+      double p0 = 0.0;
+      double p1 = 0.0;
+      if (nsigma_ != NULL) {
+        std::vector<double> &values = scratch();
+        values.clear();
+        for (std::size_t i = 0; i < data.size(); ++i) {
+          if ((mask[i] & mask_code) == mask_code && (mask[i] & Overlapped) == 0) {
+            values.push_back(data[i]);
+          }
+        }
+        DIALS_ASSERT(values.size() > 1);
+        scitbx::math::mean_and_variance<double> mv(
+          af::const_ref<double>(&values[0], values.size()));
+        double mean = mv.mean();
+        double sigma = mv.unweighted_sample_standard_deviation();
+        p0 = mean - nsigma_->lower() * sigma;
+        p1 = mean + nsigma_->upper() * sigma;
+      }
+
+      // Mark the pixels as used and accumulate the model and statistics. The
+      // constant model is the mean of the used pixels on each frame, or on
+      // all frames for the 3d model.
+      double sum1 = 0.0;
+      double sum2 = 0.0;
+      std::size_t count = 0;
+      std::vector<double> &model = scratch();
+      model.assign(constant2d_ ? nz : 1, 0.0);
+      for (std::size_t k = 0, i = 0; k < nz; ++k) {
+        double model_sum = 0.0;
+        std::size_t model_count = 0;
+        for (std::size_t l = 0; l < nxy; ++l, ++i) {
+          double value = data[i];
+          if ((mask[i] & mask_code) == mask_code && (mask[i] & Overlapped) == 0
+              && (nsigma_ == NULL || (p0 <= value && value <= p1))) {
+            mask[i] |= BackgroundUsed;
+          }
+          if (mask[i] & BackgroundUsed) {
+            model_sum += value;
+            model_count++;
+            sum1 += value;
+            sum2 += value * value;
+            count++;
+          }
+        }
+        if (constant2d_) {
+          DIALS_ASSERT(model_count > 1);
+          model[k] = model_sum / model_count;
+        }
+      }
+      if (!constant2d_) {
+        DIALS_ASSERT(count > 1);
+        model[0] = sum1 / count;
+      }
+
+      // Populate the background shoebox
+      double mse = 0.0;
+      for (std::size_t k = 0, i = 0; k < nz; ++k) {
+        double value = model[constant2d_ ? k : 0];
+        for (std::size_t l = 0; l < nxy; ++l, ++i) {
+          background[i] = value;
+          if (mask[i] & BackgroundUsed) {
+            double tmp = ((double)background[i] - (double)data[i]);
+            mse += tmp * tmp;
+          }
+        }
+      }
+      DIALS_ASSERT(count >= min_pixels_);
+      double mean = sum1 / count;
+      double var = sum2 / count - mean * mean;
+      DIALS_ASSERT(mean >= 0);
+      DIALS_ASSERT(var >= 0);
+      double dispersion = mean > 0 ? var / mean : 0;
+      mse /= count;
+      return af::tiny<FloatType, 2>(mse, dispersion);
+    }
+
     boost::shared_ptr<Modeller> modeller_;
     boost::shared_ptr<OutlierRejector> rejector_;
     std::size_t min_pixels_;
+    boost::shared_ptr<boost::thread_specific_ptr<std::vector<double> > > scratch_;
+    bool fused_;
+    bool constant2d_;
+    const NSigmaOutlierRejector *nsigma_;
   };
 
 }}}  // namespace dials::algorithms::background
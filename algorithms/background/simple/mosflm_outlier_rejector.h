@@ -110,9 +110,12 @@ namespace dials { namespace algorithms { namespace background {
         }
       }
       DIALS_ASSERT(index.size() > 0);
-      std::sort(index.begin(), index.end(), compare_pixel_value(data.as_1d()));
       std::size_t nactive = (std::size_t)std::floor(fraction_ * index.size() + 0.5);
       DIALS_ASSERT(nactive > 0 && nactive <= index.size());
+      std::nth_element(index.begin(),
+                       index.begin() + (nactive - 1),
+                       index.end(),
+                       compare_pixel_value(data.as_1d()));
       for (std::size_t i = 0; i < nactive; ++i) {
         mask[index[i]] |= BackgroundUsed;
       }
@@ -35,6 +35,20 @@ namespace dials { namespace algorithms { namespace background {
       DIALS_ASSERT(0 <= upper);
     }
 
+    /**
+     * @returns The lower n sigma
+     */
+    double lower() const {
+      return lower_;
+    }
+
+    /**
+     * @returns The upper n sigma
+     */
+    double upper() const {
+      return upper_;
+    }
+
     /**
      * @params shoebox The shoebox profile
      * @params mask The shoebox mask
@@ -21,7 +21,7 @@
 
 namespace dials { namespace algorithms { namespace background {
 
-  using dials::af::sort_index;
+  using dials::af::nth_element_index;
 
   /**
    * Remove top and bottom n% of pixels to use in background
@@ -58,17 +58,21 @@ namespace dials { namespace algorithms { namespace background {
         }
       }
 
-      // Sort the pixels into ascending intensity order
-      sort_index(indices.begin(), indices.end(), shoebox.begin());
-      af::shared<double> pixels(indices.size(), af::init_functor_null<double>());
-      for (std::size_t i = 0; i < indices.size(); ++i) {
-        pixels[i] = (double)shoebox[indices[i]];
-      }
-
-      // Set rejected pixels as 'not background'
+      // Select the pixels between the truncated fractions of the ascending
+      // intensity order. Only the two cut points are needed so the pixels
+      // are partitioned around them rather than sorted.
       std::size_t num_data = indices.size();
       std::size_t i0 = (std::size_t)(lower_ * num_data / 2.0);
       std::size_t i1 = num_data - (std::size_t)(upper_ * num_data / 2.0);
+      if (i0 >= i1) {
+        return;
+      }
+      nth_element_index(
+        indices.begin(), indices.begin() + i0, indices.end(), shoebox.begin());
+      nth_element_index(
+        indices.begin() + i0, indices.begin() + i1, indices.end(), shoebox.begin());
+
+      // Set rejected pixels as 'not background'
       for (std::size_t i = i0; i < i1; ++i) {
         mask[indices[i]] |= shoebox::BackgroundUsed;
       }
@@ -20,6 +20,7 @@
 namespace dials { namespace algorithms {
 
   using dials::model::Centroid;
+  using dials::model::centroid_masked;
   using dials::model::ImageVolume;
   using dials::model::MultiPanelImageVolume;
   using dials::model::Shoebox;
@@ -88,7 +89,7 @@ namespace dials { namespace algorithms {
       scan_.push_back(scan);
     }
 
-    void shoebox(af::reflection_table reflections) const {
+    void shoebox(af::reflection_table reflections, std::size_t nthreads = 1) const {
       // Check stuff
       DIALS_ASSERT(reflections.is_consistent());
       DIALS_ASSERT(reflections.size() > 0);
@@ -104,9 +105,12 @@ namespace dials { namespace algorithms {
       af::ref<vec3<double> > xyzobs_px_variance = reflections["xyzobs.px.variance"];
       af::ref<vec3<double> > xyzobs_mm_value = reflections["xyzobs.mm.value"];
       af::ref<vec3<double> > xyzobs_mm_variance = reflections["xyzobs.mm.variance"];
+
+      // Compute the pixel centroids
+      af::shared<Centroid> centroids =
+        centroid_masked(shoebox, Valid | Foreground, true, nthreads);
       for (std::size_t i = 0; i < shoebox.size(); ++i) {
-        // Compute the pixel centroid
-        Centroid centroid = shoebox[i].centroid_foreground_minus_background();
+        Centroid centroid = centroids[i];
 
         // Get the panel
         DIALS_ASSERT(id[i] >= 0);
@@ -0,0 +1,40 @@
+/*
+ * clustering_ext.cc
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/clustering/unit_cell.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  void export_unit_cell() {
+    def("pairwise_ncdist", &pairwise_ncdist, (arg("g6"), arg("nthreads") = 1));
+
+    class_<NCDistNearestNeighbours>("NCDistNearestNeighbours", no_init)
+      .def(init<af::const_ref<double> const &, std::size_t, std::size_t>(
+        (arg("g6"), arg("k"), arg("nthreads") = 1)))
+      .def("index_a", &NCDistNearestNeighbours::index_a)
+      .def("index_b", &NCDistNearestNeighbours::index_b)
+      .def("distances", &NCDistNearestNeighbours::distances);
+
+    def("ncdist_single_linkage",
+        &ncdist_single_linkage,
+        (arg("g6"),
+         arg("index_a"),
+         arg("index_b"),
+         arg("distances"),
+         arg("nthreads") = 1));
+  }
+
+  BOOST_PYTHON_MODULE(dials_algorithms_clustering_ext) {
+    export_unit_cell();
+  }
+
+}}}  // namespace dials::algorithms::boost_python
@@ -2,10 +2,20 @@
 
 import random
 
+import pytest
+import scipy.cluster.hierarchy as hcluster
+
 from cctbx import sgtbx
+from cctbx.uctbx.determine_unit_cell import NCDist
 from scitbx.array_family import flex
+from xfel.clustering.singleframe import SingleFrame
 
 from dials.algorithms.clustering.unit_cell import UnitCellCluster
+from dials_algorithms_clustering_ext import (
+    NCDistNearestNeighbours,
+    ncdist_single_linkage,
+    pairwise_ncdist,
+)
 
 
 def test_unit_cell():
@@ -20,3 +30,74 @@ def test_unit_cell():
         crystal_symmetries, lattice_ids=lattice_ids
     )
     clusters, dendrogram, _ = ucs.ab_cluster(write_file_lists=False, doplot=False)
+
+
+
+def random_g6(n, volume):
+    sgi = sgtbx.space_group_info("P1")
+    return [
+        SingleFrame.make_g6(
+            sgi.any_compatible_crystal_symmetry(
+                volume=random.uniform(volume - 10, volume + 10)
+            ).unit_cell()
+        )
+        for i in range(n)
+    ]
+
+
+def test_pairwise_ncdist():
+    g6 = random_g6(10, 1000)
+    expected = [
+        NCDist(g6[i], g6[j]) for i in range(len(g6)) for j in range(i + 1, len(g6))
+    ]
+    flat = flex.double([x for g in g6 for x in g])
+    for nthreads in (1, 3):
+        assert list(pairwise_ncdist(flat, nthreads=nthreads)) == pytest.approx(expected)
+
+
+def test_ncdist_single_linkage():
+    g6 = random_g6(10, 1000) + random_g6(10, 2000)
+    flat = flex.double([x for g in g6 for x in g])
+    exact = hcluster.linkage(pairwise_ncdist(flat).as_numpy_array(), method="single")
+
+    # With all the neighbours of each cell the tree matches the exact one
+    neighbours = NCDistNearestNeighbours(flat, len(g6) - 1, nthreads=2)
+    assert len(neighbours.distances()) == len(g6) * (len(g6) - 1) // 2
+    linkage = ncdist_single_linkage(
+        flat, neighbours.index_a(), neighbours.index_b(), neighbours.distances()
+    )
+    linkage = linkage.as_numpy_array().reshape(-1, 4)
+    assert list(linkage[:, 2]) == pytest.approx(list(exact[:, 2]))
+    assert list(hcluster.fcluster(linkage, 2, criterion="maxclust")) == list(
+        hcluster.fcluster(exact, 2, criterion="maxclust")
+    )
+
+    # With few neighbours the components are still joined into one tree
+    neighbours = NCDistNearestNeighbours(flat, 1)
+    linkage = ncdist_single_linkage(
+        flat, neighbours.index_a(), neighbours.index_b(), neighbours.distances()
+    )
+    linkage = linkage.as_numpy_array().reshape(-1, 4)
+    assert linkage.shape == (len(g6) - 1, 4)
+    assert linkage[-1, 3] == len(g6)
+    assert all(linkage[1:, 2] >= linkage[:-1, 2])
+
+
+def test_unit_cell_nearest_neighbours():
+    sgi = sgtbx.space_group_info("P1")
+    crystal_symmetries = [
+        sgi.any_compatible_crystal_symmetry(volume=random.uniform(990, 1010))
+        for i in range(10)
+    ]
+    ucs = UnitCellCluster.from_crystal_symmetries(crystal_symmetries)
+    clusters, dendrogram, _ = ucs.ab_cluster(
+        write_file_lists=False, doplot=False, nproc=2, n_nearest_neighbours=3
+    )
+    assert sum(len(c.members) for c in clusters) == len(crystal_symmetries)
+    with pytest.raises(ValueError):
+        ucs.ab_cluster(
+            write_file_lists=False,
+            doplot=False,
+            linkage_method="average",
+            n_nearest_neighbours=3,
+        )
@@ -0,0 +1,485 @@
+/*
+ * unit_cell.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_CLUSTERING_UNIT_CELL_H
+#define DIALS_ALGORITHMS_CLUSTERING_UNIT_CELL_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+#include <cctbx/uctbx/determine_unit_cell/NCDist.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  namespace detail {
+
+    /**
+     * The Andrews-Bernstein distance between two G6 vectors. NCDist takes
+     * non-const arguments, so the vectors are copied first.
+     */
+    inline double ncdist(const double *a, const double *b) {
+      double g1[6];
+      double g2[6];
+      std::copy(a, a + 6, g1);
+      std::copy(b, b + 6, g2);
+      return ::NCDist(g1, g2);
+    }
+
+    /**
+     * The Euclidean distance between two G6 vectors
+     */
+    inline double g6_distance(const double *a, const double *b) {
+      double d2 = 0;
+      for (std::size_t i = 0; i < 6; ++i) {
+        d2 += (a[i] - b[i]) * (a[i] - b[i]);
+      }
+      return std::sqrt(d2);
+    }
+
+    /**
+     * Check an array of G6 vectors, one after another
+     * @returns The number of vectors
+     */
+    inline std::size_t g6_size(const af::const_ref<double> &g6) {
+      DIALS_ASSERT(g6.size() % 6 == 0);
+      return g6.size() / 6;
+    }
+
+    /**
+     * Compute the rows of the condensed distance matrix for a band of pairs
+     * of rows. Band r holds rows r and n - 1 - r, so that each band has about
+     * the same number of distances to compute.
+     */
+    struct PairwiseNCDistBand {
+      af::const_ref<double> g6;
+      std::size_t n;
+      af::ref<double> result;
+
+      PairwiseNCDistBand(const af::const_ref<double> &g6_,
+                         std::size_t n_,
+                         af::ref<double> result_)
+          : g6(g6_), n(n_), result(result_) {}
+
+      void row(std::size_t i) const {
+        std::size_t offset = n * i - i * (i + 1) / 2;
+        for (std::size_t j = i + 1; j < n; ++j) {
+          result[offset + j - i - 1] = ncdist(&g6[6 * i], &g6[6 * j]);
+        }
+      }
+
+      void operator()(int r0, int r1) const {
+        for (int r = r0; r < r1; ++r) {
+          row(r);
+          if (n - 1 - r != (std::size_t)r) {
+            row(n - 1 - r);
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the Andrews-Bernstein distances between all pairs of a set of G6
+   * vectors, as a condensed distance matrix in the order used by
+   * scipy.spatial.distance.pdist.
+   * @param g6 The G6 vectors, one after another
+   * @param nthreads The number of threads to use
+   * @returns The distances between each pair i < j
+   */
+  inline af::shared<double> pairwise_ncdist(const af::const_ref<double> &g6,
+                                            std::size_t nthreads = 1) {
+    std::size_t n = detail::g6_size(g6);
+    af::shared<double> result(n > 1 ? n * (n - 1) / 2 : 0);
+    for_each_band(
+      detail::PairwiseNCDistBand(g6, n, result.ref()), (int)(n + 1) / 2, nthreads);
+    return result;
+  }
+
+  /**
+   * A vantage point tree of a set of G6 vectors for finding the nearest
+   * neighbours of each vector by Euclidean distance. Each node splits the
+   * points below it about the median distance from its vantage point, and
+   * the search visits the far side of a split only if it could hold a point
+   * closer than those already found.
+   */
+  class G6VantagePointTree {
+  public:
+    typedef std::pair<double, std::size_t> neighbour_type;
+
+    /**
+     * @param g6 The G6 vectors, one after another
+     */
+    G6VantagePointTree(const af::const_ref<double> &g6)
+        : g6_(g6.begin(), g6.end()), index_(detail::g6_size(g6)) {
+      for (std::size_t i = 0; i < index_.size(); ++i) {
+        index_[i] = i;
+      }
+      nodes_.reserve(index_.size());
+      build(0, index_.size());
+    }
+
+    /** @returns The number of vectors */
+    std::size_t size() const {
+      return index_.size();
+    }
+
+    /**
+     * Find the nearest neighbours of one of the vectors
+     * @param i The vector
+     * @param k The number of neighbours to find, not counting i itself
+     * @param result The distance and index of each neighbour, nearest first
+     */
+    void nearest(std::size_t i,
+                 std::size_t k,
+                 std::vector<neighbour_type> &result) const {
+      DIALS_ASSERT(i < size());
+      heap_type heap;
+      if (k > 0 && !nodes_.empty()) {
+        search(0, i, k, heap);
+      }
+      result.resize(heap.size());
+      for (std::size_t j = result.size(); j > 0; --j) {
+        result[j - 1] = heap.top();
+        heap.pop();
+      }
+    }
+
+  private:
+    typedef std::priority_queue<neighbour_type> heap_type;
+
+    struct Node {
+      std::size_t point;
+      double threshold;
+      int inside;
+      int outside;
+    };
+
+    /**
+     * Order points by distance from a vantage point
+     */
+    struct DistanceFrom {
+      const G6VantagePointTree &tree;
+      std::size_t point;
+
+      DistanceFrom(const G6VantagePointTree &tree_, std::size_t point_)
+          : tree(tree_), point(point_) {}
+
+      bool operator()(std::size_t a, std::size_t b) const {
+        return tree.distance(point, a) < tree.distance(point, b);
+      }
+    };
+
+    double distance(std::size_t a, std::size_t b) const {
+      return detail::g6_distance(&g6_[6 * a], &g6_[6 * b]);
+    }
+
+    int build(std::size_t lo, std::size_t hi) {
+      if (lo == hi) {
+        return -1;
+      }
+      int node = (int)nodes_.size();
+      nodes_.push_back(Node());
+      nodes_[node].point = index_[lo];
+      nodes_[node].threshold = 0;
+      nodes_[node].inside = -1;
+      nodes_[node].outside = -1;
+      if (hi - lo > 1) {
+        std::size_t mid = (lo + 1 + hi) / 2;
+        std::nth_element(index_.begin() + lo + 1,
+                         index_.begin() + mid,
+                         index_.begin() + hi,
+                         DistanceFrom(*this, index_[lo]));
+        nodes_[node].threshold = distance(index_[lo], index_[mid]);
+        int inside = build(lo + 1, mid);
+        int outside = build(mid, hi);
+        nodes_[node].inside = inside;
+        nodes_[node].outside = outside;
+      }
+      return node;
+    }
+
+    void search(int node, std::size_t query, std::size_t k, heap_type &heap) const {
+      if (node < 0) {
+        return;
+      }
+      const Node &n = nodes_[node];
+      double d = distance(query, n.point);
+      if (n.point != query) {
+        if (heap.size() < k) {
+          heap.push(neighbour_type(d, n.point));
+        } else if (d < heap.top().first) {
+          heap.pop();
+          heap.push(neighbour_type(d, n.point));
+        }
+      }
+      if (d < n.threshold) {
+        search(n.inside, query, k, heap);
+        if (heap.size() < k || d + heap.top().first >= n.threshold) {
+          search(n.outside, query, k, heap);
+        }
+      } else {
+        search(n.outside, query, k, heap);
+        if (heap.size() < k || d - heap.top().first <= n.threshold) {
+          search(n.inside, query, k, heap);
+        }
+      }
+    }
+
+    af::shared<double> g6_;
+    std::vector<std::size_t> index_;
+    std::vector<Node> nodes_;
+  };
+
+  /**
+   * A sparse graph of the Andrews-Bernstein distances between each of a set
+   * of G6 vectors and its nearest neighbours. The neighbours are found by
+   * Euclidean distance in G6 space with a vantage point tree, which is an
+   * approximation since the Andrews-Bernstein distance can be shorter, and
+   * the searches and distances are computed in bands across threads. Each
+   * pair appears once, with the lower index first.
+   */
+  class NCDistNearestNeighbours {
+  public:
+    /**
+     * @param g6 The G6 vectors, one after another
+     * @param k The number of neighbours of each vector
+     * @param nthreads The number of threads to use
+     */
+    NCDistNearestNeighbours(const af::const_ref<double> &g6,
+                            std::size_t k,
+                            std::size_t nthreads = 1) {
+      G6VantagePointTree tree(g6);
+      std::vector<std::vector<Edge> > edges(tree.size());
+      for_each_band(NeighboursBand(g6, tree, k, edges), (int)tree.size(), nthreads);
+      std::vector<Edge> all;
+      for (std::size_t i = 0; i < edges.size(); ++i) {
+        all.insert(all.end(), edges[i].begin(), edges[i].end());
+      }
+      std::sort(all.begin(), all.end());
+      all.erase(std::unique(all.begin(), all.end()), all.end());
+      for (std::size_t i = 0; i < all.size(); ++i) {
+        index_a_.push_back(all[i].a);
+        index_b_.push_back(all[i].b);
+        distances_.push_back(all[i].distance);
+      }
+    }
+
+    /** @returns The first vector of each pair */
+    af::shared<std::size_t> index_a() const {
+      return index_a_;
+    }
+
+    /** @returns The second vector of each pair */
+    af::shared<std::size_t> index_b() const {
+      return index_b_;
+    }
+
+    /** @returns The Andrews-Bernstein distance of each pair */
+    af::shared<double> distances() const {
+      return distances_;
+    }
+
+  private:
+    struct Edge {
+      std::size_t a;
+      std::size_t b;
+      double distance;
+
+      Edge(std::size_t a_, std::size_t b_, double distance_)
+          : a(a_), b(b_), distance(distance_) {}
+
+      bool operator<(const Edge &other) const {
+        return a < other.a || (a == other.a && b < other.b);
+      }
+
+      bool operator==(const Edge &other) const {
+        return a == other.a && b == other.b;
+      }
+    };
+
+    /**
+     * Find the neighbours of a band of vectors
+     */
+    struct NeighboursBand {
+      af::const_ref<double> g6;
+      const G6VantagePointTree &tree;
+      std::size_t k;
+      std::vector<std::vector<Edge> > &edges;
+
+      NeighboursBand(const af::const_ref<double> &g6_,
+                     const G6VantagePointTree &tree_,
+                     std::size_t k_,
+                     std::vector<std::vector<Edge> > &edges_)
+          : g6(g6_), tree(tree_), k(k_), edges(edges_) {}
+
+      void operator()(int i0, int i1) const {
+        std::vector<G6VantagePointTree::neighbour_type> neighbours;
+        for (int i = i0; i < i1; ++i) {
+          tree.nearest(i, k, neighbours);
+          for (std::size_t j = 0; j < neighbours.size(); ++j) {
+            std::size_t a = std::min((std::size_t)i, neighbours[j].second);
+            std::size_t b = std::max((std::size_t)i, neighbours[j].second);
+            edges[i].push_back(Edge(a, b, detail::ncdist(&g6[6 * a], &g6[6 * b])));
+          }
+        }
+      }
+    };
+
+    af::shared<std::size_t> index_a_;
+    af::shared<std::size_t> index_b_;
+    af::shared<double> distances_;
+  };
+
+  namespace detail {
+
+    /**
+     * Build a single linkage tree by merging clusters along the shortest
+     * edges first, recording each merge in the scipy linkage matrix format
+     */
+    class SingleLinkageBuilder {
+    public:
+      SingleLinkageBuilder(std::size_t n)
+          : parent_(n), label_(n), size_(n, 1), last_(0) {
+        for (std::size_t i = 0; i < n; ++i) {
+          parent_[i] = i;
+          label_[i] = i;
+        }
+      }
+
+      std::size_t find(std::size_t i) {
+        while (parent_[i] != i) {
+          parent_[i] = parent_[parent_[i]];
+          i = parent_[i];
+        }
+        return i;
+      }
+
+      void merge(const af::const_ref<std::size_t> &a,
+                 const af::const_ref<std::size_t> &b,
+                 const af::const_ref<double> &d) {
+        std::vector<std::size_t> order(d.size());
+        for (std::size_t i = 0; i < order.size(); ++i) {
+          order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), ByDistance(d));
+        for (std::size_t i = 0; i < order.size(); ++i) {
+          std::size_t ra = find(a[order[i]]);
+          std::size_t rb = find(b[order[i]]);
+          if (ra == rb) {
+            continue;
+          }
+
+          // Keep the heights monotonic when joining left over components
+          last_ = std::max(last_, d[order[i]]);
+          std::size_t la = std::min(label_[ra], label_[rb]);
+          std::size_t lb = std::max(label_[ra], label_[rb]);
+          linkage_.push_back(la);
+          linkage_.push_back(lb);
+          linkage_.push_back(last_);
+          linkage_.push_back(size_[ra] + size_[rb]);
+          parent_[rb] = ra;
+          size_[ra] += size_[rb];
+          label_[ra] = parent_.size() + linkage_.size() / 4 - 1;
+        }
+      }
+
+      std::vector<std::size_t> roots() {
+        std::vector<std::size_t> result;
+        for (std::size_t i = 0; i < parent_.size(); ++i) {
+          if (find(i) == i) {
+            result.push_back(i);
+          }
+        }
+        return result;
+      }
+
+      af::shared<double> linkage() const {
+        return linkage_;
+      }
+
+    private:
+      struct ByDistance {
+        af::const_ref<double> d;
+
+        ByDistance(const af::const_ref<double> &d_) : d(d_) {}
+
+        bool operator()(std::size_t a, std::size_t b) const {
+          return d[a] < d[b];
+        }
+      };
+
+      std::vector<std::size_t> parent_;
+      std::vector<std::size_t> label_;
+      std::vector<std::size_t> size_;
+      double last_;
+      af::shared<double> linkage_;
+    };
+
+  }  // namespace detail
+
+  /**
+   * Build the single linkage tree of a set of G6 vectors from a sparse graph
+   * of the distances between them, such as that of NCDistNearestNeighbours.
+   * The components that are left unconnected by the graph are joined using
+   * the Andrews-Bernstein distances between one vector of each.
+   * @param g6 The G6 vectors, one after another
+   * @param index_a The first vector of each edge of the graph
+   * @param index_b The second vector of each edge of the graph
+   * @param distances The distance of each edge of the graph
+   * @param nthreads The number of threads to use
+   * @returns The linkage matrix in the format of scipy.cluster.hierarchy,
+   *          with n - 1 rows of 4 values one after another
+   */
+  inline af::shared<double> ncdist_single_linkage(
+    const af::const_ref<double> &g6,
+    const af::const_ref<std::size_t> &index_a,
+    const af::const_ref<std::size_t> &index_b,
+    const af::const_ref<double> &distances,
+    std::size_t nthreads = 1) {
+    std::size_t n = detail::g6_size(g6);
+    DIALS_ASSERT(index_b.size() == index_a.size());
+    DIALS_ASSERT(distances.size() == index_a.size());
+    for (std::size_t i = 0; i < index_a.size(); ++i) {
+      DIALS_ASSERT(index_a[i] < n && index_b[i] < n);
+    }
+    detail::SingleLinkageBuilder builder(n);
+    builder.merge(index_a, index_b, distances);
+
+    // Join the components that the graph does not connect
+    std::vector<std::size_t> roots = builder.roots();
+    if (roots.size() > 1) {
+      af::shared<double> root_g6;
+      for (std::size_t i = 0; i < roots.size(); ++i) {
+        for (std::size_t j = 0; j < 6; ++j) {
+          root_g6.push_back(g6[6 * roots[i] + j]);
+        }
+      }
+      af::shared<double> d = pairwise_ncdist(root_g6.const_ref(), nthreads);
+      af::shared<std::size_t> a;
+      af::shared<std::size_t> b;
+      for (std::size_t i = 0; i < roots.size(); ++i) {
+        for (std::size_t j = i + 1; j < roots.size(); ++j) {
+          a.push_back(roots[i]);
+          b.push_back(roots[j]);
+        }
+      }
+      builder.merge(a.const_ref(), b.const_ref(), d.const_ref());
+    }
+    return builder.linkage();
+  }
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_CLUSTERING_UNIT_CELL_H
@@ -5,6 +5,13 @@
 # modified version of the ab_cluster function so we can access the scipy dendrogram object
 from xfel.clustering.cluster import Cluster
 
+from dials.array_family import flex
+from dials_algorithms_clustering_ext import (
+    NCDistNearestNeighbours,
+    ncdist_single_linkage,
+    pairwise_ncdist,
+)
+
 logger = logging.getLogger(__name__)
 
 
@@ -20,6 +27,8 @@ def ab_cluster(
         schnell=False,
         doplot=True,
         labels="default",
+        nproc=1,
+        n_nearest_neighbours=None,
     ):
         """
         Hierarchical clustering using the unit cell dimentions.
@@ -37,6 +46,12 @@ def ab_cluster(
                        Runs faster if switched off.
         :param labels: 'default' will not display any labels for more than 100 images, but will display
                        file names for fewer. This can be manually overidden with a boolean flag.
+        :param nproc: the number of threads to use for the Andrews-Bernstein distances.
+        :param n_nearest_neighbours: if set, only compute the Andrews-Bernstein
+                    distances from each cell to this many nearest neighbours in G6
+                    space, and build the tree from these. This avoids computing all
+                    pairwise distances for very large numbers of cells, but
+                    requires single linkage.
         :return: A list of Clusters ordered by largest Cluster to smallest
 
         .. note::
@@ -46,7 +61,6 @@ def ab_cluster(
 
         import numpy as np
 
-        from cctbx.uctbx.determine_unit_cell import NCDist
         from xfel.clustering.singleframe import SingleFrame
 
         logger.info("Hierarchical clustering of unit cells")
@@ -57,26 +71,50 @@ def ab_cluster(
         g6_cells = np.array([SingleFrame.make_g6(image.uc) for image in self.members])
 
         # 2. Do hierarchichal clustering, using the find_distance method above.
+        if len(g6_cells) < 2:
+            logger.debug("No distances were calculated. Aborting clustering.")
+            return [], None
         if schnell:
             logger.info("Using Euclidean distance")
-            metric = "euclidean"
+            pair_distances = dist.pdist(g6_cells, metric="euclidean")
+            logger.info("Distances have been calculated")
+            this_linkage = hcluster.linkage(pair_distances, method=linkage_method)
         else:
             logger.info(
                 "Using Andrews-Bernstein distance from Andrews & Bernstein "
                 "J Appl Cryst 47:346 (2014)"
             )
-            metric = NCDist
-        pair_distances = dist.pdist(g6_cells, metric=metric)
-        if len(pair_distances) > 0:
-            logger.info("Distances have been calculated")
-            this_linkage = hcluster.linkage(
-                pair_distances, method=linkage_method, metric=metric
-            )
-            cluster_ids = hcluster.fcluster(this_linkage, threshold, criterion=method)
-            logger.debug("Clusters have been calculated")
-        else:
-            logger.debug("No distances were calculated. Aborting clustering.")
-            return [], None
+            g6 = flex.double(g6_cells.ravel().tolist())
+            if n_nearest_neighbours:
+                if linkage_method != "single":
+                    raise ValueError(
+                        "n_nearest_neighbours requires single linkage, not %s"
+                        % linkage_method
+                    )
+                logger.info(
+                    "Using the %d nearest neighbours of each cell in G6 space",
+                    n_nearest_neighbours,
+                )
+                neighbours = NCDistNearestNeighbours(
+                    g6, n_nearest_neighbours, nthreads=nproc
+                )
+                logger.info("Distances have been calculated")
+                this_linkage = ncdist_single_linkage(
+                    g6,
+                    neighbours.index_a(),
+                    neighbours.index_b(),
+                    neighbours.distances(),
+                    nthreads=nproc,
+                )
+                this_linkage = this_linkage.as_numpy_array().reshape(-1, 4)
+            else:
+                pair_distances = pairwise_ncdist(g6, nthreads=nproc)
+                logger.info("Distances have been calculated")
+                this_linkage = hcluster.linkage(
+                    pair_distances.as_numpy_array(), method=linkage_method
+                )
+        cluster_ids = hcluster.fcluster(this_linkage, threshold, criterion=method)
+        logger.debug("Clusters have been calculated")
 
         # 3. Create an array of sub-cluster objects from the clustering
         sub_clusters = []
@@ -76,12 +76,30 @@ namespace dials { namespace algorithms { namespace filter { namespace boost_pyth
         (arg("g"), arg("b"), arg("s1"), arg("delta_m")));
   }
 
+  void export_beam_vector_filter() {
+    class_<BeamVectorFilter>("BeamVectorFilter", no_init)
+      .def(init<const Goniometer &, const BeamBase &>((arg("g"), arg("b"))))
+      .def("set_min_zeta", &BeamVectorFilter::set_min_zeta, (arg("min_zeta")))
+      .def("set_xds_small_angle",
+           &BeamVectorFilter::set_xds_small_angle,
+           (arg("delta_m")))
+      .def("set_xds_angle", &BeamVectorFilter::set_xds_angle, (arg("delta_m")))
+      .def("is_valid", &BeamVectorFilter::is_valid, (arg("s1")))
+      .def("__call__",
+           &BeamVectorFilter::operator(),
+           (arg("s1"), arg("nthreads") = 1));
+  }
+
   void export_filter_list() {
-    def("by_zeta", &by_zeta, (arg("g"), arg("b"), arg("r"), arg("min_zeta")));
+    def("by_zeta",
+        &by_zeta,
+        (arg("g"), arg("b"), arg("r"), arg("min_zeta"), arg("nthreads") = 1));
     def("by_xds_small_angle",
         &by_xds_small_angle,
-        (arg("g"), arg("b"), arg("r"), arg("delta_m")));
-    def("by_xds_angle", &by_xds_angle, (arg("g"), arg("b"), arg("r"), arg("delta_m")));
+        (arg("g"), arg("b"), arg("r"), arg("delta_m"), arg("nthreads") = 1));
+    def("by_xds_angle",
+        &by_xds_angle,
+        (arg("g"), arg("b"), arg("r"), arg("delta_m"), arg("nthreads") = 1));
     def(
       "by_bbox_volume",
       (af::shared<bool>(*)(const af::const_ref<int6> &, std::size_t)) & by_bbox_volume,
@@ -105,6 +123,7 @@ namespace dials { namespace algorithms { namespace filter { namespace boost_pyth
     export_is_zeta_valid();
     export_is_xds_small_angle_valid();
     export_is_xds_angle_valid();
+    export_beam_vector_filter();
     export_filter_list();
   }
 
@@ -23,6 +23,7 @@
 #include <dials/model/data/shoebox.h>
 #include <dials/algorithms/image/threshold/unimodal.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 
 namespace dials { namespace algorithms { namespace filter {
 
@@ -235,6 +236,145 @@ namespace dials { namespace algorithms { namespace filter {
     return is_xds_angle_valid(g.get_rotation_axis(), b.get_s0(), s1, delta_m);
   }
 
+  /**
+   * Filter reflections by several checks of their diffracted beam vectors in
+   * one pass. The local coordinate axes of each reflection are calculated
+   * once and shared by the checks which are switched on, giving the same
+   * results as the is_zeta_valid, is_xds_small_angle_valid and
+   * is_xds_angle_valid functions combined.
+   */
+  class BeamVectorFilter {
+  public:
+    /**
+     * @param g The goniometer
+     * @param b The beam
+     */
+    BeamVectorFilter(const Goniometer &g, const BeamBase &b)
+        : m2_(g.get_rotation_axis()),
+          s0_(b.get_s0()),
+          use_zeta_(false),
+          use_xds_small_angle_(false),
+          use_xds_angle_(false),
+          min_zeta_(0),
+          small_angle_delta_m_(0),
+          angle_delta_m_(0) {}
+
+    /**
+     * Check that the absolute value of zeta is above the minimum
+     * @param min_zeta The minimum zeta value
+     */
+    void set_min_zeta(double min_zeta) {
+      use_zeta_ = true;
+      min_zeta_ = min_zeta;
+    }
+
+    /**
+     * Check that the XDS small angle approximation holds
+     * @param delta_m The mosaicity * n_sigma
+     */
+    void set_xds_small_angle(double delta_m) {
+      use_xds_small_angle_ = true;
+      small_angle_delta_m_ = delta_m;
+    }
+
+    /**
+     * Check that the angle can be mapped to the local coordinate system
+     * @param delta_m The mosaicity * n_sigma
+     */
+    void set_xds_angle(double delta_m) {
+      use_xds_angle_ = true;
+      angle_delta_m_ = delta_m;
+    }
+
+    /**
+     * @param s1 The diffracted beam vector
+     * @returns True/False, the reflection passes all the checks
+     */
+    bool is_valid(vec3<double> s1) const {
+      vec3<double> e1 = s1.cross(s0_);
+      if (use_zeta_) {
+        DIALS_ASSERT(e1.length() > 0);
+      }
+      e1 = e1.normalize();
+      double m2e1 = m2_ * e1;
+      if (use_zeta_ && !(std::abs(m2e1) >= min_zeta_)) {
+        return false;
+      }
+      if (!use_xds_small_angle_ && !use_xds_angle_) {
+        return true;
+      }
+      vec3<double> ps = (s1 - s0_).normalize();
+      vec3<double> e3 = (s1 + s0_).normalize();
+      double m2e3 = m2_ * e3;
+      double m2ps = m2_ * ps;
+      if (use_xds_small_angle_) {
+        double c3 = -std::abs(small_angle_delta_m_);
+        if (!((m2e1 * m2e1 + 2.0 * c3 * m2e3 * m2ps - c3 * c3) >= 0.0)) {
+          return false;
+        }
+      }
+      if (use_xds_angle_) {
+        double m2e3_m2ps = m2e3 * m2ps;
+        if (m2e1 == 0) {
+          return false;
+        }
+        double rt = std::sqrt(m2e1 * m2e1 + m2e3_m2ps * m2e3_m2ps);
+        double dphi0 = 2.0 * std::atan((m2e3_m2ps + rt) / m2e1);
+        double dphi1 = 2.0 * std::atan((m2e3_m2ps - rt) / m2e1);
+        if (dphi0 > dphi1) {
+          std::swap(dphi0, dphi1);
+        }
+        double delta_m = std::abs(angle_delta_m_);
+        if (!(dphi0 <= -delta_m && dphi1 >= delta_m)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /**
+     * @param s1 The list of beam vectors
+     * @param nthreads The number of threads to use
+     * @returns The mask of reflections passing all the checks
+     */
+    af::shared<bool> operator()(const af::const_ref<vec3<double> > &s1,
+                                std::size_t nthreads = 1) const {
+      af::shared<bool> result(s1.size(), true);
+      for_each_band(Band(*this, s1, result.ref()), (int)s1.size(), nthreads);
+      return result;
+    }
+
+  private:
+    /**
+     * Check a band of reflections
+     */
+    struct Band {
+      const BeamVectorFilter &filter;
+      af::const_ref<vec3<double> > s1;
+      af::ref<bool> result;
+
+      Band(const BeamVectorFilter &filter_,
+           const af::const_ref<vec3<double> > &s1_,
+           af::ref<bool> result_)
+          : filter(filter_), s1(s1_), result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          result[i] = filter.is_valid(s1[i]);
+        }
+      }
+    };
+
+    vec3<double> m2_;
+    vec3<double> s0_;
+    bool use_zeta_;
+    bool use_xds_small_angle_;
+    bool use_xds_angle_;
+    double min_zeta_;
+    double small_angle_delta_m_;
+    double angle_delta_m_;
+  };
+
   /**
    * Filter the reflection list by the value of zeta. Set any reflections
    * below the value to invalid.
@@ -242,18 +382,16 @@ namespace dials { namespace algorithms { namespace filter {
    * @param b The beam
    * @param s1 The list of beam vectors
    * @param min_zeta The minimum zeta value
+   * @param nthreads The number of threads to use
    */
   inline af::shared<bool> by_zeta(const Goniometer &g,
                                   const BeamBase &b,
                                   const af::const_ref<vec3<double> > &s1,
-                                  double min_zeta) {
-    af::shared<bool> result(s1.size(), true);
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      if (!is_zeta_valid(g, b, s1[i], min_zeta)) {
-        result[i] = false;
-      }
-    }
-    return result;
+                                  double min_zeta,
+                                  std::size_t nthreads = 1) {
+    BeamVectorFilter filter(g, b);
+    filter.set_min_zeta(min_zeta);
+    return filter(s1, nthreads);
   }
 
   /**
@@ -263,18 +401,16 @@ namespace dials { namespace algorithms { namespace filter {
    * @param b The beam
    * @param s1 The list of beam vector
    * @param delta_m The mosaicity * n_sigma
+   * @param nthreads The number of threads to use
    */
   inline af::shared<bool> by_xds_small_angle(const Goniometer &g,
                                              const BeamBase &b,
                                              const af::const_ref<vec3<double> > s1,
-                                             double delta_m) {
-    af::shared<bool> result(s1.size(), true);
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      if (!is_xds_small_angle_valid(g, b, s1[i], delta_m)) {
-        result[i] = false;
-      }
-    }
-    return result;
+                                             double delta_m,
+                                             std::size_t nthreads = 1) {
+    BeamVectorFilter filter(g, b);
+    filter.set_xds_small_angle(delta_m);
+    return filter(s1, nthreads);
   }
 
   /**
@@ -284,18 +420,16 @@ namespace dials { namespace algorithms { namespace filter {
    * @param b The beam
    * @param s1 The list of beam vectors
    * @param delta_m The mosaicity * n_sigma
+   * @param nthreads The number of threads to use
    */
   inline af::shared<bool> by_xds_angle(const Goniometer &g,
                                        const BeamBase &b,
                                        const af::const_ref<vec3<double> > s1,
-                                       double delta_m) {
-    af::shared<bool> result(s1.size(), true);
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      if (!is_xds_angle_valid(g, b, s1[i], delta_m)) {
-        result[i] = false;
-      }
-    }
-    return result;
+                                       double delta_m,
+                                       std::size_t nthreads = 1) {
+    BeamVectorFilter filter(g, b);
+    filter.set_xds_angle(delta_m);
+    return filter(s1, nthreads);
   }
 
   /**
@@ -102,6 +102,97 @@ namespace dials { namespace algorithms {
     }
   };
 
+  namespace detail {
+
+    /**
+     * Select the pixels of an image where a boolean mask is set
+     */
+    template <typename FloatType>
+    struct MaskedPixels {
+      af::const_ref<FloatType, af::c_grid<3> > image;
+      af::const_ref<bool, af::c_grid<3> > mask;
+
+      MaskedPixels(const af::const_ref<FloatType, af::c_grid<3> > &image_,
+                   const af::const_ref<bool, af::c_grid<3> > &mask_)
+          : image(image_), mask(mask_) {
+        DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
+        DIALS_ASSERT(image.accessor().all_gt(0));
+      }
+
+      bool operator()(std::size_t index, FloatType &value) const {
+        value = image[index];
+        return mask[index];
+      }
+    };
+
+    /**
+     * Compute the centroid sums of the pixels of a 3D image chosen by a
+     * selector. The selector is called as select(index, value) and returns
+     * whether the pixel at that index is used, setting its value. The sums
+     * are accumulated directly in two passes over the image, the second pass
+     * computing the moments about the mean found in the first, so no lists
+     * of pixels or coordinates are needed.
+     * @param size The size of the image
+     * @param select The pixel selector
+     * @returns The centroid sums
+     */
+    template <typename FloatType, typename CoordType, typename Selector>
+    CentroidSums<typename CoordType::value_type, CoordType> centroid_sums_3d(
+      const af::c_grid<3> &size,
+      const Selector &select) {
+      typedef typename CoordType::value_type value_type;
+      CentroidSums<value_type, CoordType> sums;
+
+      // Accumulate the sums of the pixels and pixels * coords
+      FloatType sum_pixels = 0;
+      FloatType sum_pixels_sq = 0;
+      FloatType value = 0;
+      std::size_t index = 0;
+      for (std::size_t k = 0; k < size[0]; ++k) {
+        for (std::size_t j = 0; j < size[1]; ++j) {
+          for (std::size_t i = 0; i < size[2]; ++i, ++index) {
+            if (select(index, value)) {
+              sum_pixels += value;
+              sum_pixels_sq += value * value;
+              sums.sum_pixels_coords +=
+                (value_type)value * CoordType(i + 0.5, j + 0.5, k + 0.5);
+              sums.count++;
+            }
+          }
+        }
+      }
+      sums.sum_pixels = (value_type)sum_pixels;
+      sums.sum_pixels_sq = (value_type)sum_pixels_sq;
+      if (sums.count == 0 || !(sums.sum_pixels > 0)) {
+        return sums;
+      }
+
+      // Accumulate the sums of pixels * (coord - mean)**2 and the cross terms
+      CoordType m = sums.sum_pixels_coords / sums.sum_pixels;
+      index = 0;
+      for (std::size_t k = 0; k < size[0]; ++k) {
+        for (std::size_t j = 0; j < size[1]; ++j) {
+          for (std::size_t i = 0; i < size[2]; ++i, ++index) {
+            if (select(index, value)) {
+              value_type p = (value_type)value;
+              value_type dx = (i + 0.5) - m[0];
+              value_type dy = (j + 0.5) - m[1];
+              value_type dz = (k + 0.5) - m[2];
+              sums.sum_pixels_delta_sq[0] += p * (dx * dx);
+              sums.sum_pixels_delta_sq[1] += p * (dy * dy);
+              sums.sum_pixels_delta_sq[2] += p * (dz * dz);
+              sums.sum_pixels_delta_cross[0] += p * dx * dy;
+              sums.sum_pixels_delta_cross[1] += p * dx * dz;
+              sums.sum_pixels_delta_cross[2] += p * dy * dz;
+            }
+          }
+        }
+      }
+      return sums;
+    }
+
+  }  // namespace detail
+
   /**
    * A class to calculate the centroid of a 3D image.
    */
@@ -121,64 +212,20 @@ namespace dials { namespace algorithms {
      */
     CentroidMaskedImage3d(const af::const_ref<FloatType, af::c_grid<3> > &image,
                           const af::const_ref<bool, af::c_grid<3> > &mask)
-        : centroid_algorithm_type(select_pixels(image, mask).const_ref(),
-                                  generate_coords(image, mask).const_ref()) {}
-
-  private:
-    /**
-     * Get the mask indices.
-     * @param size The size of the image
-     */
-    af::shared<FloatType> select_pixels(
-      const af::const_ref<FloatType, af::c_grid<3> > &image,
-      const af::const_ref<bool, af::c_grid<3> > &mask) {
-      // Check the sizes
-      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
-      DIALS_ASSERT(image.accessor().all_gt(0));
-
-      // Put all the image coordinates into the array
-      af::shared<FloatType> pixels(image.size(), af::init_functor_null<FloatType>());
-      std::size_t count = 0;
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        if (mask[i]) {
-          pixels[count++] = image[i];
-        }
-      }
-      pixels.resize(count);
-
-      // Return the array
-      return pixels;
-    }
+        : centroid_algorithm_type(detail::centroid_sums_3d<FloatType, CoordType>(
+            image.accessor(),
+            detail::MaskedPixels<FloatType>(image, mask))) {}
 
     /**
-     * Generate coordinates.
+     * Initialise the algorithm from the pixels chosen by a selector, called
+     * as select(index, value), which avoids having to build the masked image.
      * @param size The size of the image
+     * @param select The pixel selector
      */
-    af::shared<coord_type> generate_coords(
-      const af::const_ref<FloatType, af::c_grid<3> > &image,
-      const af::const_ref<bool, af::c_grid<3> > &mask) {
-      // Check the sizes
-      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
-      DIALS_ASSERT(image.accessor().all_gt(0));
-
-      // Put all the image coordinates into the array
-      af::shared<coord_type> coords(image.size(), af::init_functor_null<coord_type>());
-      std::size_t count = 0;
-      for (std::size_t k = 0; k < image.accessor()[0]; ++k) {
-        for (std::size_t j = 0; j < image.accessor()[1]; ++j) {
-          for (std::size_t i = 0; i < image.accessor()[2]; ++i) {
-            if (mask(k, j, i)) {
-              coords[count++] = coord_type(i + 0.5, j + 0.5, k + 0.5);
-            }
-          }
-        }
-      }
-
-      coords.resize(count);
-
-      // Return the array
-      return coords;
-    }
+    template <typename Selector>
+    CentroidMaskedImage3d(const af::c_grid<3> &size, const Selector &select)
+        : centroid_algorithm_type(
+            detail::centroid_sums_3d<FloatType, CoordType>(size, select)) {}
   };
 
 }}  // namespace dials::algorithms
@@ -30,6 +30,27 @@ namespace dials { namespace algorithms {
   using scitbx::af::tiny;
   using scitbx::fn::pow2;
 
+  /**
+   * The sums needed to compute the centroid of a list of points
+   */
+  template <typename ValueType, typename CoordType>
+  struct CentroidSums {
+    std::size_t count;
+    ValueType sum_pixels;
+    ValueType sum_pixels_sq;
+    CoordType sum_pixels_coords;
+    CoordType sum_pixels_delta_sq;
+    CoordType sum_pixels_delta_cross;
+
+    CentroidSums()
+        : count(0),
+          sum_pixels(0),
+          sum_pixels_sq(0),
+          sum_pixels_coords(0.0),
+          sum_pixels_delta_sq(0.0),
+          sum_pixels_delta_cross(0.0) {}
+  };
+
   /**
    * Class to calculate the centroid of a list of coordinates
    */
@@ -188,6 +209,22 @@ namespace dials { namespace algorithms {
       return matrix;
     }
 
+  protected:
+    /**
+     * Initialise from sums already computed from the points
+     * @param sums The sums
+     */
+    CentroidPoints(const CentroidSums<value_type, coord_type> &sums)
+        : sum_pixels_(sums.sum_pixels),
+          sum_pixels_sq_(sums.sum_pixels_sq),
+          sum_pixels_coords_(sums.sum_pixels_coords),
+          sum_pixels_delta_sq_(sums.sum_pixels_delta_sq),
+          sum_pixels_delta_cross_(sums.sum_pixels_delta_cross) {
+      DIALS_ASSERT(DIM > 1);
+      DIALS_ASSERT(sums.count > 0);
+      DIALS_ASSERT(sum_pixels_ > 0);
+    }
+
   private:
     coord_type pow2c(const coord_type &x) const {
       coord_type r;
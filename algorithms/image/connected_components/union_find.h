@@ -0,0 +1,112 @@
+/*
+ * union_find.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_CONNECTED_COMPONENTS_UNION_FIND_H
+#define DIALS_ALGORITHMS_IMAGE_CONNECTED_COMPONENTS_UNION_FIND_H
+
+#include <cstddef>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * A disjoint set forest for connected component labelling. The root of each
+   * set is always the smallest element in the set, so the labels are numbered
+   * in the same order as the first element of each component, which is the
+   * same as the numbering given by boost::connected_components.
+   */
+  class UnionFind {
+  public:
+    /**
+     * Initialise with no elements
+     */
+    UnionFind() {}
+
+    /**
+     * Initialise with each element in its own set
+     * @param size The number of elements
+     */
+    UnionFind(std::size_t size) {
+      resize(size);
+    }
+
+    /**
+     * @returns The number of elements
+     */
+    std::size_t size() const {
+      return parent_.size();
+    }
+
+    /**
+     * Add new elements, each in their own set
+     * @param size The new number of elements
+     */
+    void resize(std::size_t size) {
+      DIALS_ASSERT(size >= parent_.size());
+      parent_.reserve(size);
+      for (std::size_t i = parent_.size(); i < size; ++i) {
+        parent_.push_back(i);
+      }
+    }
+
+    /**
+     * Find the root of the set containing the element. Path halving is used
+     * to keep the trees shallow.
+     * @param i The element
+     * @returns The root of the set
+     */
+    std::size_t find(std::size_t i) {
+      DIALS_ASSERT(i < parent_.size());
+      while (parent_[i] != i) {
+        parent_[i] = parent_[parent_[i]];
+        i = parent_[i];
+      }
+      return i;
+    }
+
+    /**
+     * Merge the sets containing the two elements
+     * @param a The first element
+     * @param b The second element
+     * @returns The root of the merged set
+     */
+    std::size_t join(std::size_t a, std::size_t b) {
+      a = find(a);
+      b = find(b);
+      if (a < b) {
+        parent_[b] = a;
+        return a;
+      }
+      parent_[a] = b;
+      return b;
+    }
+
+    /**
+     * Compute the labels of all the elements. The labels are numbered
+     * consecutively from zero in the order of the smallest element of each set.
+     * @returns The list of labels
+     */
+    af::shared<int> labels() {
+      af::shared<int> result(parent_.size(), af::init_functor_null<int>());
+      int num = 0;
+      for (std::size_t i = 0; i < parent_.size(); ++i) {
+        std::size_t root = find(i);
+        result[i] = (root == i) ? num++ : result[root];
+      }
+      return result;
+    }
+
+  private:
+    std::vector<std::size_t> parent_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_IMAGE_CONNECTED_COMPONENTS_UNION_FIND_H
@@ -11,9 +11,11 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_FILL_HOLES_SIMPLE_H
 #define DIALS_ALGORITHMS_IMAGE_FILL_HOLES_SIMPLE_H
 
+#include <algorithm>
 #include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/image/filter/distance.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -21,84 +23,177 @@ namespace dials { namespace algorithms {
   namespace detail {
 
     /**
-     * Struct to provide a pixel node
+     * Fill the pixels of a band of holes. The pixels of each hole are filled
+     * in order of distance from the edge of the hole, each from the mean of
+     * its neighbours which are valid or already filled. No pixel of a hole is
+     * next to a pixel of another hole, so the holes can be filled at the same
+     * time.
      */
-    struct SimpleFillNode {
-      std::size_t j;
-      std::size_t i;
-      int d;
-      SimpleFillNode(std::size_t j_, std::size_t i_, int d_) : j(j_), i(i_), d(d_) {}
+    struct SimpleFillBand {
+      const std::vector<std::size_t> &pixels;
+      const std::vector<std::size_t> &offset;
+      std::size_t height;
+      std::size_t width;
+      af::ref<int, af::c_grid<2> > distance;
+      af::ref<double, af::c_grid<2> > result;
+
+      SimpleFillBand(const std::vector<std::size_t> &pixels_,
+                     const std::vector<std::size_t> &offset_,
+                     af::ref<int, af::c_grid<2> > distance_,
+                     af::ref<double, af::c_grid<2> > result_)
+          : pixels(pixels_),
+            offset(offset_),
+            height(distance_.accessor()[0]),
+            width(distance_.accessor()[1]),
+            distance(distance_),
+            result(result_) {}
+
+      void operator()(int r0, int r1) const {
+        for (std::size_t k = offset[r0]; k < offset[r1]; ++k) {
+          std::size_t j = pixels[k] / width;
+          std::size_t i = pixels[k] % width;
+          double sum = 0.0;
+          std::size_t num = 0;
+          if (j > 0 && distance(j - 1, i) == 0) {
+            sum += result(j - 1, i);
+            num += 1;
+          }
+          if (i > 0 && distance(j, i - 1) == 0) {
+            sum += result(j, i - 1);
+            num += 1;
+          }
+          if (j < height - 1 && distance(j + 1, i) == 0) {
+            sum += result(j + 1, i);
+            num += 1;
+          }
+          if (i < width - 1 && distance(j, i + 1) == 0) {
+            sum += result(j, i + 1);
+            num += 1;
+          }
+          DIALS_ASSERT(num > 0);
+          result(j, i) = sum / (double)num;
+          distance(j, i) = 0;
+        }
+      }
     };
 
     /**
-     * Struct to provide pixel node comparison
+     * Get the pixels to fill, grouped by hole and in order of distance
+     * within each hole. The pixels are bucketed by distance, and then by
+     * hole, with a counting sort, keeping the raster order of pixels at the
+     * same distance.
+     * @param distance The distance of each pixel from a valid pixel
+     * @param pixels The indices of the pixels to fill
+     * @param offset The offset of the pixels of each hole
      */
-    struct CompareSimpleFillNode {
-      bool operator()(const SimpleFillNode &a, const SimpleFillNode &b) const {
-        return a.d < b.d;
+    inline void simple_fill_order(const af::const_ref<int, af::c_grid<2> > &distance,
+                                  std::vector<std::size_t> &pixels,
+                                  std::vector<std::size_t> &offset) {
+      std::size_t height = distance.accessor()[0];
+      std::size_t width = distance.accessor()[1];
+
+      // Label the 4-connected holes
+      const std::size_t none = (std::size_t)-1;
+      std::vector<std::size_t> label(distance.size(), none);
+      std::vector<std::size_t> stack;
+      std::vector<std::size_t> count;
+      int max_distance = 0;
+      for (std::size_t k = 0; k < distance.size(); ++k) {
+        max_distance = std::max(max_distance, distance[k]);
+        if (distance[k] <= 0 || label[k] != none) {
+          continue;
+        }
+        std::size_t region = count.size();
+        count.push_back(0);
+        label[k] = region;
+        stack.push_back(k);
+        while (!stack.empty()) {
+          std::size_t p = stack.back();
+          std::size_t j = p / width;
+          std::size_t i = p % width;
+          stack.pop_back();
+          count[region]++;
+          std::size_t neighbours[4] = {
+            j > 0 ? p - width : none,
+            i > 0 ? p - 1 : none,
+            j < height - 1 ? p + width : none,
+            i < width - 1 ? p + 1 : none,
+          };
+          for (std::size_t n = 0; n < 4; ++n) {
+            std::size_t q = neighbours[n];
+            if (q != none && distance[q] > 0 && label[q] == none) {
+              label[q] = region;
+              stack.push_back(q);
+            }
+          }
+        }
       }
-    };
+
+      // Bucket the pixels by distance
+      std::vector<std::size_t> bucket(max_distance + 2, 0);
+      for (std::size_t k = 0; k < distance.size(); ++k) {
+        if (distance[k] > 0) {
+          bucket[distance[k] + 1]++;
+        }
+      }
+      for (std::size_t d = 1; d < bucket.size(); ++d) {
+        bucket[d] += bucket[d - 1];
+      }
+      std::vector<std::size_t> by_distance(bucket.back());
+      for (std::size_t k = 0; k < distance.size(); ++k) {
+        if (distance[k] > 0) {
+          by_distance[bucket[distance[k]]++] = k;
+        }
+      }
+
+      // Then by hole, keeping the order of distance
+      offset.assign(count.size() + 1, 0);
+      for (std::size_t r = 0; r < count.size(); ++r) {
+        offset[r + 1] = offset[r] + count[r];
+      }
+      std::vector<std::size_t> next(offset.begin(), offset.end() - 1);
+      pixels.resize(by_distance.size());
+      for (std::size_t k = 0; k < by_distance.size(); ++k) {
+        pixels[next[label[by_distance[k]]]++] = by_distance[k];
+      }
+    }
+
   }  // namespace detail
 
   /**
-   * A simple function to fill holes in images
+   * A simple function to fill holes in images. Each pixel is filled from the
+   * mean of its neighbours which are valid or already filled, in order of
+   * distance from the edge of its hole; pixels at the same distance are
+   * filled in raster order. Separate holes are filled in parallel.
    * @param data The data array
    * @param mask The mask array
+   * @param nthreads The number of threads to use
    * @returns The filled image
    */
   inline af::versa<double, af::c_grid<2> > simple_fill(
     const af::const_ref<double, af::c_grid<2> > &data,
-    const af::const_ref<bool, af::c_grid<2> > &mask) {
+    const af::const_ref<bool, af::c_grid<2> > &mask,
+    std::size_t nthreads = 1) {
     // Check the input
     DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-    std::size_t height = data.accessor()[0];
-    std::size_t width = data.accessor()[1];
+    DIALS_ASSERT(nthreads > 0);
 
     // Compute the manhattan distance transform of the mask
     af::versa<int, af::c_grid<2> > distance(mask.accessor());
     manhattan_distance(mask, true, distance.ref());
 
-    // Get a list of the pixels to fill
-    std::vector<detail::SimpleFillNode> pixels;
-    for (std::size_t j = 0; j < height; ++j) {
-      for (std::size_t i = 0; i < width; ++i) {
-        if (distance(j, i) > 0) {
-          pixels.push_back(detail::SimpleFillNode(j, i, distance(j, i)));
-        }
-      }
-    }
-
-    // Sort in order of distance
-    std::sort(pixels.begin(), pixels.end(), detail::CompareSimpleFillNode());
+    // Get the pixels to fill, grouped by hole
+    std::vector<std::size_t> pixels;
+    std::vector<std::size_t> offset;
+    detail::simple_fill_order(distance.const_ref(), pixels, offset);
 
     // Fill in pixels
     af::versa<double, af::c_grid<2> > result(data.accessor());
     std::copy(data.begin(), data.end(), result.begin());
-    for (std::size_t k = 0; k < pixels.size(); ++k) {
-      std::size_t j = pixels[k].j;
-      std::size_t i = pixels[k].i;
-      double sum = 0.0;
-      std::size_t num = 0;
-      if (j > 0 && distance(j - 1, i) == 0) {
-        sum += result(j - 1, i);
-        num += 1;
-      }
-      if (i > 0 && distance(j, i - 1) == 0) {
-        sum += result(j, i - 1);
-        num += 1;
-      }
-      if (j < height - 1 && distance(j + 1, i) == 0) {
-        sum += result(j + 1, i);
-        num += 1;
-      }
-      if (i < width - 1 && distance(j, i + 1) == 0) {
-        sum += result(j, i + 1);
-        num += 1;
-      }
-      DIALS_ASSERT(num > 0);
-      result(j, i) = sum / (double)num;
-      distance(j, i) = 0;
-    }
+    int nholes = (int)offset.size() - 1;
+    for_each_band(detail::SimpleFillBand(pixels, offset, distance.ref(), result.ref()),
+                  nholes,
+                  nthreads);
 
     // Ensure every pixel has been used
     DIALS_ASSERT(distance.all_eq(0));
@@ -15,7 +15,12 @@
     "chebyshev_distance",
     "convolve",
     "convolve_col",
+    "convolve_direct",
+    "convolve_fft",
     "convolve_row",
+    "convolve_separable",
+    "euclidean_distance",
+    "euclidean_distance_sq",
     "index_of_dispersion_filter",
     "manhattan_distance",
     "mean_and_variance_filter",
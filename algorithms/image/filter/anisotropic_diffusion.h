@@ -11,78 +11,171 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_FILTER_ANISOTROPIC_DIFFUSION_H
 #define DIALS_ALGORITHMS_IMAGE_FILTER_ANISOTROPIC_DIFFUSION_H
 
+#include <algorithm>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
+  namespace detail {
+
+    /**
+     * One iteration of anisotropic diffusion for a band of rows. The new image
+     * is written to a second buffer so that the buffers can be swapped after
+     * each iteration. The loop along each row has no branches so that it can
+     * be vectorised; masked neighbours are replaced by the centre pixel with
+     * a select.
+     */
+    template <typename FloatType>
+    struct AnisotropicDiffusionStep {
+      af::const_ref<FloatType, af::c_grid<2> > A;
+      af::ref<FloatType, af::c_grid<2> > B;
+      const af::const_ref<bool, af::c_grid<2> > *mask;
+      FloatType kappa_inv2;
+      FloatType gamma;
+
+      AnisotropicDiffusionStep(const af::const_ref<FloatType, af::c_grid<2> > &A_,
+                               af::ref<FloatType, af::c_grid<2> > B_,
+                               const af::const_ref<bool, af::c_grid<2> > *mask_,
+                               FloatType kappa_inv2_,
+                               FloatType gamma_)
+          : A(A_), B(B_), mask(mask_), kappa_inv2(kappa_inv2_), gamma(gamma_) {}
+
+      /**
+       * Update the interior rows j0 + 1 to j1
+       */
+      void operator()(int j0, int j1) const {
+        std::size_t width = A.accessor()[1];
+        for (int j = j0 + 1; j <= j1; ++j) {
+          const FloatType *a0 = &A(j - 1, 0);
+          const FloatType *a1 = &A(j, 0);
+          const FloatType *a2 = &A(j + 1, 0);
+          FloatType *b = &B(j, 0);
+          if (mask == NULL) {
+            for (std::size_t i = 1; i < width - 1; ++i) {
+              b[i] = a1[i] + update(a1[i], a0[i], a2[i], a1[i - 1], a1[i + 1]);
+            }
+          } else {
+            const bool *m0 = &(*mask)(j - 1, 0);
+            const bool *m1 = &(*mask)(j, 0);
+            const bool *m2 = &(*mask)(j + 1, 0);
+            for (std::size_t i = 1; i < width - 1; ++i) {
+              FloatType AP = a1[i];
+              FloatType AN = m0[i] ? a0[i] : AP;
+              FloatType AS = m2[i] ? a2[i] : AP;
+              FloatType AE = m1[i - 1] ? a1[i - 1] : AP;
+              FloatType AW = m1[i + 1] ? a1[i + 1] : AP;
+              FloatType D = update(AP, AN, AS, AE, AW);
+              b[i] = AP + (m1[i] ? D : FloatType(0));
+            }
+          }
+        }
+      }
+
+      /**
+       * @returns The change in the centre pixel from its neighbours
+       */
+      FloatType update(FloatType AP,
+                       FloatType AN,
+                       FloatType AS,
+                       FloatType AE,
+                       FloatType AW) const {
+        // Gradients
+        FloatType DN = AP - AN;
+        FloatType DE = AP - AE;
+        FloatType DS = AS - AP;
+        FloatType DW = AW - AP;
+
+        // Diffusion stuff
+        // double CN = std::exp(-(DN*DN*kappa_inv2));
+        // double CE = std::exp(-(DE*DE*kappa_inv2));
+        // double CS = std::exp(-(DS*DS*kappa_inv2));
+        // double CW = std::exp(-(DW*DW*kappa_inv2));
+        FloatType CN = 1 / (1 + (DN * DN * kappa_inv2));
+        FloatType CE = 1 / (1 + (DE * DE * kappa_inv2));
+        FloatType CS = 1 / (1 + (DS * DS * kappa_inv2));
+        FloatType CW = 1 / (1 + (DW * DW * kappa_inv2));
+
+        // Components
+        FloatType N = CN * DN;
+        FloatType E = CE * DE;
+        FloatType S = CS * DS;
+        FloatType W = CW * DW;
+
+        // Update image
+        return gamma * (S - N + W - E);
+      }
+    };
+
+    /**
+     * Iterate anisotropic diffusion, swapping between two buffers. The edge
+     * pixels are not changed so are copied into both buffers at the start.
+     */
+    template <typename FloatType>
+    af::versa<FloatType, af::c_grid<2> > anisotropic_diffusion(
+      const af::const_ref<FloatType, af::c_grid<2> > &data,
+      const af::const_ref<bool, af::c_grid<2> > *mask,
+      std::size_t niter,
+      double kappa,
+      double gamma,
+      std::size_t nthreads) {
+      // Check input
+      DIALS_ASSERT(niter > 0);
+      DIALS_ASSERT(kappa > 0);
+      DIALS_ASSERT(gamma > 0);
+
+      // Initialise the buffers
+      std::size_t height = data.accessor()[0];
+      std::size_t width = data.accessor()[1];
+      af::versa<FloatType, af::c_grid<2> > AA(data.accessor(),
+                                              af::init_functor_null<FloatType>());
+      af::versa<FloatType, af::c_grid<2> > BB(data.accessor(),
+                                              af::init_functor_null<FloatType>());
+      std::copy(data.begin(), data.end(), AA.begin());
+      std::copy(data.begin(), data.end(), BB.begin());
+      if (height < 3 || width < 3) {
+        return AA;
+      }
+
+      // Compute inv of kappa
+      FloatType kappa_inv2 = 1.0 / (kappa * kappa);
+
+      // Iterate
+      af::versa<FloatType, af::c_grid<2> > *A = &AA;
+      af::versa<FloatType, af::c_grid<2> > *B = &BB;
+      for (std::size_t iter = 0; iter < niter; ++iter) {
+        for_each_band(AnisotropicDiffusionStep<FloatType>(
+                        A->const_ref(), B->ref(), mask, kappa_inv2, (FloatType)gamma),
+                      (int)height - 2,
+                      nthreads);
+        std::swap(A, B);
+      }
+
+      // Return filtered image
+      return *A;
+    }
+
+  }  // namespace detail
+
   /**
    * Do anisotropic filtering on an image
    * @param data The image
    * @param niter The number of iterations
    * @param kappa The diffusion parameter, small values stop diffusion across edges
    * @param gamma The step for each iteration (0 < gamma < 1.0)
+   * @param nthreads The number of threads to use
    * @return The filtered image
    */
-  inline af::versa<double, af::c_grid<2> > anisotropic_diffusion(
-    const af::const_ref<double, af::c_grid<2> > &data,
+  template <typename FloatType>
+  af::versa<FloatType, af::c_grid<2> > anisotropic_diffusion(
+    const af::const_ref<FloatType, af::c_grid<2> > &data,
     std::size_t niter,
     double kappa,
-    double gamma) {
-    // Check input
-    DIALS_ASSERT(niter > 0);
-    DIALS_ASSERT(kappa > 0);
-    DIALS_ASSERT(gamma > 0);
-
-    // Initialise stuff
-    std::size_t height = data.accessor()[0];
-    std::size_t width = data.accessor()[1];
-    af::versa<double, af::c_grid<2> > AA(data.accessor());
-    af::versa<double, af::c_grid<2> > BB(data.accessor(), 0);
-    af::ref<double, af::c_grid<2> > A = AA.ref();
-    af::ref<double, af::c_grid<2> > B = BB.ref();
-    std::copy(data.begin(), data.end(), A.begin());
-
-    // Compute inv of kappa
-    double kappa_inv2 = 1.0 / (kappa * kappa);
-
-    // Iterate
-    for (std::size_t iter = 0; iter < niter; ++iter) {
-      for (std::size_t j = 1; j < height - 1; ++j) {
-        for (std::size_t i = 1; i < width - 1; ++i) {
-          // Gradients
-          double DN = A(j, i) - A(j - 1, i);
-          double DE = A(j, i) - A(j, i - 1);
-          double DS = A(j + 1, i) - A(j, i);
-          double DW = A(j, i + 1) - A(j, i);
-
-          // Diffusion stuff
-          // double CN = std::exp(-(DN*DN*kappa_inv2));
-          // double CE = std::exp(-(DE*DE*kappa_inv2));
-          // double CS = std::exp(-(DS*DS*kappa_inv2));
-          // double CW = std::exp(-(DW*DW*kappa_inv2));
-          double CN = 1.0 / (1.0 + (DN * DN * kappa_inv2));
-          double CE = 1.0 / (1.0 + (DE * DE * kappa_inv2));
-          double CS = 1.0 / (1.0 + (DS * DS * kappa_inv2));
-          double CW = 1.0 / (1.0 + (DW * DW * kappa_inv2));
-
-          // Components
-          double N = CN * DN;
-          double E = CE * DE;
-          double S = CS * DS;
-          double W = CW * DW;
-
-          // Update image
-          B(j, i) = gamma * (S - N + W - E);
-        }
-      }
-      for (std::size_t i = 0; i < B.size(); ++i) {
-        A[i] += B[i];
-      }
-    }
-
-    // Return filtered image
-    return AA;
+    double gamma,
+    std::size_t nthreads = 1) {
+    return detail::anisotropic_diffusion<FloatType>(
+      data, NULL, niter, kappa, gamma, nthreads);
   }
 
   /**
@@ -92,79 +185,20 @@ namespace dials { namespace algorithms {
    * @param niter The number of iterations
    * @param kappa The diffusion parameter, small values stop diffusion across edges
    * @param gamma The step for each iteration (0 < gamma < 1.0)
+   * @param nthreads The number of threads to use
    * @return The filtered image
    */
-  inline af::versa<double, af::c_grid<2> > masked_anisotropic_diffusion(
-    const af::const_ref<double, af::c_grid<2> > &data,
+  template <typename FloatType>
+  af::versa<FloatType, af::c_grid<2> > masked_anisotropic_diffusion(
+    const af::const_ref<FloatType, af::c_grid<2> > &data,
     const af::const_ref<bool, af::c_grid<2> > &mask,
     std::size_t niter,
     double kappa,
-    double gamma) {
-    // Check input
-    DIALS_ASSERT(niter > 0);
-    DIALS_ASSERT(kappa > 0);
-    DIALS_ASSERT(gamma > 0);
-
-    // Initialise stuff
-    std::size_t height = data.accessor()[0];
-    std::size_t width = data.accessor()[1];
-    af::versa<double, af::c_grid<2> > AA(data.accessor());
-    af::versa<double, af::c_grid<2> > BB(data.accessor(), 0);
-    af::ref<double, af::c_grid<2> > A = AA.ref();
-    af::ref<double, af::c_grid<2> > B = BB.ref();
-    std::copy(data.begin(), data.end(), A.begin());
-
-    // Compute inv of kappa
-    double kappa_inv2 = 1.0 / (kappa * kappa);
-
-    // Iterate
-    for (std::size_t iter = 0; iter < niter; ++iter) {
-      for (std::size_t j = 1; j < height - 1; ++j) {
-        for (std::size_t i = 1; i < width - 1; ++i) {
-          if (mask(j, i)) {
-            // Points
-            double AP = A(j, i);
-            double AN = mask(j - 1, i) ? A(j - 1, i) : AP;
-            double AS = mask(j + 1, i) ? A(j + 1, i) : AP;
-            double AE = mask(j, i - 1) ? A(j, i - 1) : AP;
-            double AW = mask(j, i + 1) ? A(j, i + 1) : AP;
-
-            // Gradients
-            double DN = AP - AN;
-            double DE = AP - AE;
-            double DS = AS - AP;
-            double DW = AW - AP;
-
-            // Diffusion stuff
-            // double CN = std::exp(-(DN*DN*kappa_inv2));
-            // double CE = std::exp(-(DE*DE*kappa_inv2));
-            // double CS = std::exp(-(DS*DS*kappa_inv2));
-            // double CW = std::exp(-(DW*DW*kappa_inv2));
-            double CN = 1.0 / (1.0 + (DN * DN * kappa_inv2));
-            double CE = 1.0 / (1.0 + (DE * DE * kappa_inv2));
-            double CS = 1.0 / (1.0 + (DS * DS * kappa_inv2));
-            double CW = 1.0 / (1.0 + (DW * DW * kappa_inv2));
-
-            // Components
-            double N = CN * DN;
-            double E = CE * DE;
-            double S = CS * DS;
-            double W = CW * DW;
-
-            // Update image
-            B(j, i) = gamma * (S - N + W - E);
-          } else {
-            B(j, i) = 0;
-          }
-        }
-      }
-      for (std::size_t i = 0; i < B.size(); ++i) {
-        A[i] += B[i];
-      }
-    }
-
-    // Return filtered image
-    return AA;
+    double gamma,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(mask.accessor().all_eq(data.accessor()));
+    return detail::anisotropic_diffusion<FloatType>(
+      data, &mask, niter, kappa, gamma, nthreads);
   }
 
 }}  // namespace dials::algorithms
@@ -16,18 +16,29 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
-  void export_anisotropic_diffusion() {
+  template <typename FloatType>
+  void anisotropic_diffusion_suite() {
     def("anisotropic_diffusion",
-        &anisotropic_diffusion,
-        (arg("data"), arg("niter") = 1, arg("kappa") = 50, arg("gamma") = 0.1));
+        &anisotropic_diffusion<FloatType>,
+        (arg("data"),
+         arg("niter") = 1,
+         arg("kappa") = 50,
+         arg("gamma") = 0.1,
+         arg("nthreads") = 1));
 
     def("anisotropic_diffusion",
-        &masked_anisotropic_diffusion,
+        &masked_anisotropic_diffusion<FloatType>,
         (arg("data"),
          arg("mask"),
          arg("niter") = 1,
          arg("kappa") = 50,
-         arg("gamma") = 0.1));
+         arg("gamma") = 0.1,
+         arg("nthreads") = 1));
+  }
+
+  void export_anisotropic_diffusion() {
+    anisotropic_diffusion_suite<float>();
+    anisotropic_diffusion_suite<double>();
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -20,6 +20,14 @@ namespace dials { namespace algorithms { namespace boost_python {
   void convolve_suite() {
     def("convolve", &convolve<FloatType>, (arg("image"), arg("kernel")));
 
+    def("convolve_direct", &convolve_direct<FloatType>, (arg("image"), arg("kernel")));
+
+    def("convolve_fft", &convolve_fft<FloatType>, (arg("image"), arg("kernel")));
+
+    def("convolve_separable",
+        &convolve_separable<FloatType>,
+        (arg("image"), arg("col"), arg("row")));
+
     def("convolve_row", &convolve_row<FloatType>, (arg("image"), arg("kernel")));
 
     def("convolve_col", &convolve_col<FloatType>, (arg("image"), arg("kernel")));
@@ -21,8 +21,8 @@ namespace dials { namespace algorithms { namespace boost_python {
     typedef IndexOfDispersionFilter<FloatType> IndexOfDispersionFilterType;
 
     class_<IndexOfDispersionFilterType>(name, no_init)
-      .def(init<const af::const_ref<FloatType, af::c_grid<2> > &, int2>(
-        (arg("image"), arg("size"))))
+      .def(init<const af::const_ref<FloatType, af::c_grid<2> > &, int2, std::size_t>(
+        (arg("image"), arg("size"), arg("nthreads") = 1)))
       .def("index_of_dispersion", &IndexOfDispersionFilterType::index_of_dispersion)
       .def("mean", &IndexOfDispersionFilterType::mean)
       .def("sample_variance", &IndexOfDispersionFilterType::sample_variance);
@@ -36,7 +36,12 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<const af::const_ref<FloatType, af::c_grid<2> > &,
                 const af::const_ref<int, af::c_grid<2> > &,
                 int2,
-                int>((arg("image"), arg("mask"), arg("size"), arg("min_count"))))
+                int,
+                std::size_t>((arg("image"),
+                              arg("mask"),
+                              arg("size"),
+                              arg("min_count"),
+                              arg("nthreads") = 1)))
       .def("index_of_dispersion", &IndexOfDispersionFilterType::index_of_dispersion)
       .def("mean", &IndexOfDispersionFilterType::mean)
       .def("sample_variance", &IndexOfDispersionFilterType::sample_variance)
@@ -47,8 +52,9 @@ namespace dials { namespace algorithms { namespace boost_python {
   template <typename FloatType>
   IndexOfDispersionFilter<FloatType> make_index_of_dispersion_filter(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
-    int2 size) {
-    return IndexOfDispersionFilter<FloatType>(image, size);
+    int2 size,
+    std::size_t nthreads) {
+    return IndexOfDispersionFilter<FloatType>(image, size, nthreads);
   }
 
   template <typename FloatType>
@@ -56,19 +62,25 @@ namespace dials { namespace algorithms { namespace boost_python {
     const af::const_ref<FloatType, af::c_grid<2> > &image,
     const af::const_ref<int, af::c_grid<2> > &mask,
     int2 size,
-    int min_size) {
-    return IndexOfDispersionFilterMasked<FloatType>(image, mask, size, min_size);
+    int min_size,
+    std::size_t nthreads) {
+    return IndexOfDispersionFilterMasked<FloatType>(
+      image, mask, size, min_size, nthreads);
   }
 
   template <typename FloatType>
   void index_of_dispersion_filter_suite() {
     def("index_of_dispersion_filter",
         &make_index_of_dispersion_filter<FloatType>,
-        (arg("image"), arg("kernel")));
+        (arg("image"), arg("kernel"), arg("nthreads") = 1));
 
     def("index_of_dispersion_filter",
         &make_index_of_dispersion_filter_masked<FloatType>,
-        (arg("image"), arg("mask"), arg("kernel"), arg("min_count")));
+        (arg("image"),
+         arg("mask"),
+         arg("kernel"),
+         arg("min_count"),
+         arg("nthreads") = 1));
   }
 
   void export_index_of_dispersion_filter() {
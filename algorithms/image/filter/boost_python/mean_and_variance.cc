@@ -16,39 +16,61 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
+  /**
+   * Add the methods to get the filtered images, either as new arrays or
+   * written into a given array
+   */
+  template <typename FilterType, typename ClassType>
+  void def_filtered_images(ClassType &cls) {
+    typedef typename FilterType::value_type FloatType;
+    typedef af::versa<FloatType, af::c_grid<2> > (FilterType::*result_type)() const;
+    typedef void (FilterType::*output_type)(af::ref<FloatType, af::c_grid<2> >) const;
+    cls.def("mean", (result_type)&FilterType::mean)
+      .def("mean", (output_type)&FilterType::mean, (arg("result")))
+      .def("variance", (result_type)&FilterType::variance)
+      .def("variance", (output_type)&FilterType::variance, (arg("result")))
+      .def("sample_variance", (result_type)&FilterType::sample_variance)
+      .def("sample_variance",
+           (output_type)&FilterType::sample_variance,
+           (arg("result")));
+  }
+
   template <typename FloatType>
   void mean_and_variance_filter_wrapper(const char *name) {
     typedef MeanAndVarianceFilter<FloatType> MeanAndVarianceFilterType;
 
-    class_<MeanAndVarianceFilterType>(name, no_init)
-      .def(init<const af::const_ref<FloatType, af::c_grid<2> > &, int2>(
-        (arg("image"), arg("size"))))
-      .def("mean", &MeanAndVarianceFilterType::mean)
-      .def("variance", &MeanAndVarianceFilterType::variance)
-      .def("sample_variance", &MeanAndVarianceFilterType::sample_variance);
+    class_<MeanAndVarianceFilterType> cls(name, no_init);
+    cls.def(init<const af::const_ref<FloatType, af::c_grid<2> > &, int2, std::size_t>(
+      (arg("image"), arg("size"), arg("nthreads") = 1)));
+    def_filtered_images<MeanAndVarianceFilterType>(cls);
   }
 
   template <typename FloatType>
   void mean_and_variance_filter_masked_wrapper(const char *name) {
     typedef MeanAndVarianceFilterMasked<FloatType> MeanAndVarianceFilterType;
 
-    class_<MeanAndVarianceFilterType>(name, no_init)
+    class_<MeanAndVarianceFilterType> cls(name, no_init);
+    cls
       .def(init<const af::const_ref<FloatType, af::c_grid<2> > &,
                 const af::const_ref<int, af::c_grid<2> > &,
                 int2,
-                int>((arg("image"), arg("mask"), arg("size"), arg("min_size"))))
-      .def("mean", &MeanAndVarianceFilterType::mean)
-      .def("variance", &MeanAndVarianceFilterType::variance)
-      .def("sample_variance", &MeanAndVarianceFilterType::sample_variance)
+                int,
+                std::size_t>((arg("image"),
+                              arg("mask"),
+                              arg("size"),
+                              arg("min_size"),
+                              arg("nthreads") = 1)))
       .def("mask", &MeanAndVarianceFilterType::mask)
       .def("count", &MeanAndVarianceFilterType::count);
+    def_filtered_images<MeanAndVarianceFilterType>(cls);
   }
 
   template <typename FloatType>
   MeanAndVarianceFilter<FloatType> make_mean_and_variance_filter(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
-    int2 size) {
-    return MeanAndVarianceFilter<FloatType>(image, size);
+    int2 size,
+    std::size_t nthreads) {
+    return MeanAndVarianceFilter<FloatType>(image, size, nthreads);
   }
 
   template <typename FloatType>
@@ -56,13 +78,17 @@ namespace dials { namespace algorithms { namespace boost_python {
     const af::const_ref<FloatType, af::c_grid<2> > &image,
     const af::const_ref<int, af::c_grid<2> > &mask,
     int2 size,
-    int min_size) {
-    return MeanAndVarianceFilterMasked<FloatType>(image, mask, size, min_size);
+    int min_size,
+    std::size_t nthreads) {
+    return MeanAndVarianceFilterMasked<FloatType>(
+      image, mask, size, min_size, nthreads);
   }
 
   template <typename FloatType>
   void mean_and_variance_filter_suite() {
-    def("mean_filter", &mean_filter<FloatType>, (arg("image"), arg("size")));
+    def("mean_filter",
+        &mean_filter<FloatType>,
+        (arg("image"), arg("size"), arg("nthreads") = 1));
 
     def("mean_filter",
         &mean_filter_masked<FloatType>,
@@ -70,15 +96,20 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("mask"),
          arg("size"),
          arg("min_count"),
-         arg("ignore_masked") = true));
+         arg("ignore_masked") = true,
+         arg("nthreads") = 1));
 
     def("mean_and_variance_filter",
         &make_mean_and_variance_filter<FloatType>,
-        (arg("image"), arg("kernel")));
+        (arg("image"), arg("kernel"), arg("nthreads") = 1));
 
     def("mean_and_variance_filter",
         &make_mean_and_variance_filter_masked<FloatType>,
-        (arg("image"), arg("mask"), arg("kernel"), arg("min_count")));
+        (arg("image"),
+         arg("mask"),
+         arg("kernel"),
+         arg("min_count"),
+         arg("nthreads") = 1));
   }
 
   void export_mean_and_variance() {
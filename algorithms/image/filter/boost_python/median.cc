@@ -25,8 +25,27 @@ namespace dials { namespace algorithms { namespace boost_python {
         (arg("image"), arg("mask"), arg("kernel"), arg("periodic") = false));
   }
 
+  /**
+   * Integer images use the histogram median filter, which gives the same
+   * result as the generic filter.
+   */
+  template <typename T>
+  void histogram_median_filter_suite() {
+    def("median_filter",
+        &histogram_median_filter<T>,
+        (arg("image"), arg("kernel"), arg("nthreads") = 1));
+
+    def("median_filter",
+        &histogram_median_filter_masked<T>,
+        (arg("image"),
+         arg("mask"),
+         arg("kernel"),
+         arg("periodic") = false,
+         arg("nthreads") = 1));
+  }
+
   void export_median() {
-    median_filter_suite<int>();
+    histogram_median_filter_suite<int>();
     median_filter_suite<float>();
     median_filter_suite<double>();
   }
@@ -15,8 +15,11 @@
 
 #include <algorithm>
 #include <cmath>
+#include <complex>
+#include <vector>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
+#include <scitbx/fftpack/complex_to_complex_2d.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
@@ -24,14 +27,160 @@ namespace dials { namespace algorithms {
 
   using scitbx::af::int2;
 
+  namespace detail {
+
+    /**
+     * Clamp an index to the range 0 to n - 1
+     */
+    inline int clamp_index(int i, int n) {
+      return i < 0 ? 0 : (i >= n ? n - 1 : i);
+    }
+
+    /**
+     * Convolve a row, extended at either end by repeating the end values,
+     * with a kernel. The kernel loop is outermost so that the inner loop is
+     * a contiguous multiply and add which the compiler can vectorise.
+     * @param input The input row
+     * @param size The length of the row
+     * @param kernel The kernel
+     * @param buffer Workspace for the extended row
+     * @param output The output row
+     */
+    template <typename FloatType>
+    void convolve_line(const FloatType *input,
+                       std::size_t size,
+                       const af::const_ref<FloatType> &kernel,
+                       std::vector<FloatType> &buffer,
+                       FloatType *output) {
+      int mid = (int)kernel.size() / 2;
+      buffer.resize(size + kernel.size() - 1);
+      for (std::size_t i = 0; i < buffer.size(); ++i) {
+        buffer[i] = input[clamp_index((int)i - mid, (int)size)];
+      }
+      std::fill(output, output + size, FloatType(0));
+      for (std::size_t k = 0; k < kernel.size(); ++k) {
+        const FloatType *b = &buffer[k];
+        FloatType w = kernel[k];
+        for (std::size_t i = 0; i < size; ++i) {
+          output[i] += b[i] * w;
+        }
+      }
+    }
+
+    /**
+     * Convolve the columns of an image with a kernel. Whole rows are
+     * combined at a time so that the image is read in memory order.
+     */
+    template <typename FloatType>
+    void convolve_columns(const af::const_ref<FloatType, af::c_grid<2> > &image,
+                          const af::const_ref<FloatType> &kernel,
+                          af::ref<FloatType, af::c_grid<2> > result) {
+      int ysize = (int)image.accessor()[0];
+      std::size_t xsize = image.accessor()[1];
+      int mid = (int)kernel.size() / 2;
+      for (int j = 0; j < ysize; ++j) {
+        FloatType *output = &result(j, 0);
+        std::fill(output, output + xsize, FloatType(0));
+        for (std::size_t k = 0; k < kernel.size(); ++k) {
+          const FloatType *input = &image(clamp_index(j + (int)k - mid, ysize), 0);
+          FloatType w = kernel[k];
+          for (std::size_t i = 0; i < xsize; ++i) {
+            output[i] += input[i] * w;
+          }
+        }
+      }
+    }
+
+    /**
+     * @returns The smallest size, not less than n, with only factors of 2, 3
+     * and 5
+     */
+    inline int fft_size(int n) {
+      for (;; ++n) {
+        int m = n;
+        while (m % 2 == 0) {
+          m /= 2;
+        }
+        while (m % 3 == 0) {
+          m /= 3;
+        }
+        while (m % 5 == 0) {
+          m /= 5;
+        }
+        if (m == 1) {
+          return n;
+        }
+      }
+    }
+
+    /**
+     * The kernel size above which a kernel which is not separable is applied
+     * using an FFT
+     */
+    const std::size_t convolve_fft_min_kernel_size = 15 * 15;
+
+  }  // namespace detail
+
+  /**
+   * Find whether a kernel is separable, i.e. it is the outer product of a
+   * column and a row kernel, to within a relative tolerance.
+   * @param kernel The kernel
+   * @param col The column kernel
+   * @param row The row kernel
+   * @param tolerance The tolerance relative to the largest kernel value
+   * @returns True/False the kernel is separable
+   */
+  template <typename FloatType>
+  bool separable_kernel(const af::const_ref<FloatType, af::c_grid<2> > &kernel,
+                        af::shared<FloatType> &col,
+                        af::shared<FloatType> &row,
+                        double tolerance = 1e-6) {
+    std::size_t ysize = kernel.accessor()[0];
+    std::size_t xsize = kernel.accessor()[1];
+
+    // Factor the kernel about its largest value
+    std::size_t imax = 0;
+    for (std::size_t i = 1; i < kernel.size(); ++i) {
+      if (std::abs(kernel[i]) > std::abs(kernel[imax])) {
+        imax = i;
+      }
+    }
+    double kmax = kernel[imax];
+    if (kmax == 0) {
+      return false;
+    }
+    std::size_t p = imax / xsize;
+    std::size_t q = imax % xsize;
+    col = af::shared<FloatType>(ysize);
+    row = af::shared<FloatType>(xsize);
+    for (std::size_t j = 0; j < ysize; ++j) {
+      col[j] = kernel(j, q);
+    }
+    for (std::size_t i = 0; i < xsize; ++i) {
+      row[i] = (FloatType)(kernel(p, i) / kmax);
+    }
+
+    // Check the outer product reproduces the kernel
+    double eps = tolerance * std::abs(kmax);
+    for (std::size_t j = 0; j < ysize; ++j) {
+      for (std::size_t i = 0; i < xsize; ++i) {
+        if (std::abs(kernel(j, i) - (double)col[j] * (double)row[i]) > eps) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
   /**
-   * Perform a simple convolution between an image and kernel
+   * Perform a simple convolution between an image and kernel by summing over
+   * the kernel at each pixel.
    * @param image The image to filter
    * @param kernel The kernel to convolve with
    * @returns The convolved image
    */
   template <typename FloatType>
-  af::versa<FloatType, af::c_grid<2> > convolve(
+  af::versa<FloatType, af::c_grid<2> > convolve_direct(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
     const af::const_ref<FloatType, af::c_grid<2> > &kernel) {
     // Only allow odd-sized kernel sizes
@@ -44,26 +193,24 @@ namespace dials { namespace algorithms {
     int2 mid(ksz[0] / 2, ksz[1] / 2);
 
     // Create the output
-    af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
-                                                af::init_functor_null<FloatType>());
+    af::versa<FloatType, af::c_grid<2> > result(image.accessor(), FloatType(0));
 
-    // Convolve the image with the kernel
+    // Accumulate each row of the kernel along the image rows; each kernel
+    // row is applied as a contiguous multiply and add over an extended row
+    std::vector<FloatType> buffer(isz[1] + ksz[1] - 1);
     for (int j = 0; j < isz[0]; ++j) {
-      for (int i = 0; i < isz[1]; ++i) {
-        result(j, i) = 0.0;
-        for (int jj = 0; jj < ksz[0]; ++jj) {
-          for (int ii = 0; ii < ksz[1]; ++ii) {
-            int jjj = j + jj - mid[0];
-            int iii = i + ii - mid[1];
-            if (jjj < 0)
-              jjj = 0;
-            else if (jjj >= isz[0])
-              jjj = isz[0] - 1;
-            if (iii < 0)
-              iii = 0;
-            else if (iii >= isz[1])
-              iii = isz[1] - 1;
-            result(j, i) += image(jjj, iii) * kernel(jj, ii);
+      FloatType *output = &result(j, 0);
+      for (int jj = 0; jj < ksz[0]; ++jj) {
+        const FloatType *input =
+          &image(detail::clamp_index(j + jj - mid[0], isz[0]), 0);
+        for (std::size_t i = 0; i < buffer.size(); ++i) {
+          buffer[i] = input[detail::clamp_index((int)i - mid[1], isz[1])];
+        }
+        for (int ii = 0; ii < ksz[1]; ++ii) {
+          const FloatType *b = &buffer[ii];
+          FloatType w = kernel(jj, ii);
+          for (int i = 0; i < isz[1]; ++i) {
+            output[i] += b[i] * w;
           }
         }
       }
@@ -74,41 +221,97 @@ namespace dials { namespace algorithms {
   }
 
   /**
-   * Perform a seperable row convolution between an image and kernel
+   * Perform a convolution between an image and kernel using an FFT. The
+   * image is extended at its edges by repeating the edge values, so the
+   * result is the same as from convolve_direct to within rounding.
    * @param image The image to filter
    * @param kernel The kernel to convolve with
    * @returns The convolved image
    */
   template <typename FloatType>
-  af::versa<FloatType, af::c_grid<2> > convolve_row(
+  af::versa<FloatType, af::c_grid<2> > convolve_fft(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
-    const af::const_ref<FloatType> &kernel) {
+    const af::const_ref<FloatType, af::c_grid<2> > &kernel) {
+    typedef std::complex<double> complex_type;
+
     // Only allow odd-sized kernel sizes
-    DIALS_ASSERT(kernel.size() & 1);
+    DIALS_ASSERT(kernel.accessor()[0] & 1);
+    DIALS_ASSERT(kernel.accessor()[1] & 1);
 
     // The image sizes and mid-point
     int2 isz = image.accessor();
-    std::size_t ksz = kernel.size();
-    std::size_t mid = ksz / 2;
+    int2 ksz = kernel.accessor();
+    int2 mid(ksz[0] / 2, ksz[1] / 2);
 
-    // Create the output
+    // The transform must hold the extended image without wrapping around
+    int2 n(detail::fft_size(isz[0] + ksz[0] - 1),
+           detail::fft_size(isz[1] + ksz[1] - 1));
+    af::c_grid<2> grid(n[0], n[1]);
+
+    // The extended image
+    af::versa<complex_type, af::c_grid<2> > a(grid, complex_type(0, 0));
+    for (int j = 0; j < n[0]; ++j) {
+      int jj = detail::clamp_index(j - mid[0], isz[0]);
+      for (int i = 0; i < n[1]; ++i) {
+        a(j, i) = image(jj, detail::clamp_index(i - mid[1], isz[1]));
+      }
+    }
+
+    // The kernel reflected about the origin, with its centre at the origin
+    af::versa<complex_type, af::c_grid<2> > b(grid, complex_type(0, 0));
+    for (int jj = 0; jj < ksz[0]; ++jj) {
+      int j = (mid[0] - jj + n[0]) % n[0];
+      for (int ii = 0; ii < ksz[1]; ++ii) {
+        int i = (mid[1] - ii + n[1]) % n[1];
+        b(j, i) = kernel(jj, ii);
+      }
+    }
+
+    // Multiply the transforms
+    scitbx::fftpack::complex_to_complex_2d<double> fft(n);
+    fft.forward(a.ref());
+    fft.forward(b.ref());
+    for (std::size_t i = 0; i < a.size(); ++i) {
+      a[i] *= b[i];
+    }
+    fft.backward(a.ref());
+
+    // Extract the result for the original image
+    double scale = 1.0 / ((double)n[0] * (double)n[1]);
     af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
                                                 af::init_functor_null<FloatType>());
-
-    // Convolve the image with the kernel
     for (int j = 0; j < isz[0]; ++j) {
       for (int i = 0; i < isz[1]; ++i) {
-        result(j, i) = 0.0;
-        for (int ii = 0; ii < ksz; ++ii) {
-          int iii = i + ii - mid;
-          if (iii < 0)
-            iii = 0;
-          else if (iii >= isz[1])
-            iii = isz[1] - 1;
-          result(j, i) += image(j, iii) * kernel[ii];
-        }
+        result(j, i) = (FloatType)(a(j + mid[0], i + mid[1]).real() * scale);
       }
     }
+    return result;
+  }
+
+  /**
+   * Perform a seperable row convolution between an image and kernel
+   * @param image The image to filter
+   * @param kernel The kernel to convolve with
+   * @returns The convolved image
+   */
+  template <typename FloatType>
+  af::versa<FloatType, af::c_grid<2> > convolve_row(
+    const af::const_ref<FloatType, af::c_grid<2> > &image,
+    const af::const_ref<FloatType> &kernel) {
+    // Only allow odd-sized kernel sizes
+    DIALS_ASSERT(kernel.size() & 1);
+
+    // Create the output
+    af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
+                                                af::init_functor_null<FloatType>());
+
+    // Convolve each row of the image with the kernel
+    std::size_t ysize = image.accessor()[0];
+    std::size_t xsize = image.accessor()[1];
+    std::vector<FloatType> buffer;
+    for (std::size_t j = 0; j < ysize; ++j) {
+      detail::convolve_line(&image(j, 0), xsize, kernel, buffer, &result(j, 0));
+    }
 
     // Return the result
     return result;
@@ -127,34 +330,60 @@ namespace dials { namespace algorithms {
     // Only allow odd-sized kernel sizes
     DIALS_ASSERT(kernel.size() & 1);
 
-    // The image sizes and mid-point
-    int2 isz = image.accessor();
-    std::size_t ksz = kernel.size();
-    std::size_t mid = ksz / 2;
-
     // Create the output
     af::versa<FloatType, af::c_grid<2> > result(image.accessor(),
                                                 af::init_functor_null<FloatType>());
 
     // Convolve the image with the kernel
-    for (int j = 0; j < isz[0]; ++j) {
-      for (int i = 0; i < isz[1]; ++i) {
-        result(j, i) = 0.0;
-        for (int jj = 0; jj < ksz; ++jj) {
-          int jjj = j + jj - mid;
-          if (jjj < 0)
-            jjj = 0;
-          else if (jjj >= isz[0])
-            jjj = isz[0] - 1;
-          result(j, i) += image(jjj, i) * kernel[jj];
-        }
-      }
-    }
+    detail::convolve_columns(image, kernel, result.ref());
 
     // Return the result
     return result;
   }
 
+  /**
+   * Perform a convolution with a separable kernel as a row convolution
+   * followed by a column convolution.
+   * @param image The image to filter
+   * @param col The column kernel
+   * @param row The row kernel
+   * @returns The convolved image
+   */
+  template <typename FloatType>
+  af::versa<FloatType, af::c_grid<2> > convolve_separable(
+    const af::const_ref<FloatType, af::c_grid<2> > &image,
+    const af::const_ref<FloatType> &col,
+    const af::const_ref<FloatType> &row) {
+    af::versa<FloatType, af::c_grid<2> > temp = convolve_row(image, row);
+    return convolve_col(temp.const_ref(), col);
+  }
+
+  /**
+   * Perform a convolution between an image and kernel. The image is extended
+   * at its edges by repeating the edge values. A separable kernel is applied
+   * as a row and a column convolution, a large kernel which is not separable
+   * is applied using an FFT and otherwise the kernel is applied directly.
+   * @param image The image to filter
+   * @param kernel The kernel to convolve with
+   * @returns The convolved image
+   */
+  template <typename FloatType>
+  af::versa<FloatType, af::c_grid<2> > convolve(
+    const af::const_ref<FloatType, af::c_grid<2> > &image,
+    const af::const_ref<FloatType, af::c_grid<2> > &kernel) {
+    // Only allow odd-sized kernel sizes
+    DIALS_ASSERT(kernel.accessor()[0] & 1);
+    DIALS_ASSERT(kernel.accessor()[1] & 1);
+    af::shared<FloatType> col, row;
+    if (kernel.size() > 1 && separable_kernel(kernel, col, row)) {
+      return convolve_separable(image, col.const_ref(), row.const_ref());
+    }
+    if (kernel.size() >= detail::convolve_fft_min_kernel_size) {
+      return convolve_fft(image, kernel);
+    }
+    return convolve_direct(image, kernel);
+  }
+
 }}  // namespace dials::algorithms
 
 #endif /* DIALS_ALGORITHMS_IMAGE_FILTER_CONVOLVE_H */
@@ -11,6 +11,11 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_FILTER_DISTANCE_H
 #define DIALS_ALGORITHMS_IMAGE_FILTER_DISTANCE_H
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
@@ -102,6 +107,177 @@ namespace dials { namespace algorithms {
       }
     }
   }
+
+  namespace detail {
+
+    /**
+     * Compute the distance along each column to the nearest pixel with the
+     * given value, for a band of columns. The sweeps go down and up the
+     * image a row at a time so the loop along each row can be vectorised.
+     */
+    template <typename InputType>
+    struct EuclideanDistanceColumns {
+      af::const_ref<InputType, af::c_grid<2> > src;
+      InputType value;
+      af::ref<double, af::c_grid<2> > dst;
+      double max_distance;
+
+      EuclideanDistanceColumns(const af::const_ref<InputType, af::c_grid<2> > &src_,
+                               InputType value_,
+                               af::ref<double, af::c_grid<2> > dst_,
+                               double max_distance_)
+          : src(src_), value(value_), dst(dst_), max_distance(max_distance_) {}
+
+      void operator()(int i0, int i1) const {
+        std::size_t height = src.accessor()[0];
+        for (std::size_t j = 0; j < height; ++j) {
+          const InputType *s = &src(j, 0);
+          double *d = &dst(j, 0);
+          const double *prev = j > 0 ? &dst(j - 1, 0) : NULL;
+          for (int i = i0; i < i1; ++i) {
+            double above = prev != NULL ? prev[i] + 1 : max_distance;
+            d[i] = s[i] == value ? 0 : std::min(above, max_distance);
+          }
+        }
+        for (std::size_t j = height - 1; j > 0; --j) {
+          double *d = &dst(j - 1, 0);
+          const double *next = &dst(j, 0);
+          for (int i = i0; i < i1; ++i) {
+            d[i] = std::min(d[i], next[i] + 1);
+          }
+        }
+      }
+    };
+
+    /**
+     * Compute the squared Euclidean distance transform along each row, for a
+     * band of rows, from the distances along the columns. This is the lower
+     * envelope of the parabolas (x - i)^2 + g(i)^2 as described by
+     * Felzenszwalb and Huttenlocher, "Distance Transforms of Sampled
+     * Functions", Theory of Computing 8 (2012).
+     */
+    template <typename OutputType>
+    struct EuclideanDistanceRows {
+      af::const_ref<double, af::c_grid<2> > columns;
+      af::ref<OutputType, af::c_grid<2> > dst;
+      bool squared;
+
+      EuclideanDistanceRows(const af::const_ref<double, af::c_grid<2> > &columns_,
+                            af::ref<OutputType, af::c_grid<2> > dst_,
+                            bool squared_)
+          : columns(columns_), dst(dst_), squared(squared_) {}
+
+      void operator()(int j0, int j1) const {
+        std::size_t width = columns.accessor()[1];
+        std::vector<double> f(width);
+        std::vector<int> v(width);
+        std::vector<double> z(width + 1);
+        for (int j = j0; j < j1; ++j) {
+          const double *g = &columns(j, 0);
+          for (std::size_t i = 0; i < width; ++i) {
+            f[i] = g[i] * g[i];
+          }
+
+          // Find the parabolas in the lower envelope and the points at
+          // which each one becomes the lowest
+          int k = 0;
+          v[0] = 0;
+          z[0] = -std::numeric_limits<double>::infinity();
+          z[1] = std::numeric_limits<double>::infinity();
+          for (int q = 1; q < (int)width; ++q) {
+            double s = intersection(f, v[k], q);
+            while (s <= z[k]) {
+              k--;
+              s = intersection(f, v[k], q);
+            }
+            k++;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = std::numeric_limits<double>::infinity();
+          }
+
+          // Evaluate the lower envelope at each pixel
+          k = 0;
+          for (int q = 0; q < (int)width; ++q) {
+            while (z[k + 1] < q) {
+              k++;
+            }
+            double d = (q - v[k]) * (q - v[k]) + f[v[k]];
+            dst(j, q) = (OutputType)(squared ? d : std::sqrt(d));
+          }
+        }
+      }
+
+      /**
+       * The position at which the parabola from q becomes lower than that from p
+       */
+      static double intersection(const std::vector<double> &f, int p, int q) {
+        return ((f[q] + q * q) - (f[p] + p * p)) / (2.0 * (q - p));
+      }
+    };
+
+    template <typename InputType, typename OutputType>
+    void euclidean_distance(const af::const_ref<InputType, af::c_grid<2> > &src,
+                            InputType value,
+                            af::ref<OutputType, af::c_grid<2> > dst,
+                            bool squared,
+                            std::size_t nthreads) {
+      DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      std::size_t height = src.accessor()[0];
+      std::size_t width = src.accessor()[1];
+      if (height == 0 || width == 0) {
+        return;
+      }
+      af::versa<double, af::c_grid<2> > columns(src.accessor(),
+                                                af::init_functor_null<double>());
+      for_each_band(EuclideanDistanceColumns<InputType>(
+                      src, value, columns.ref(), (double)(height + width)),
+                    (int)width,
+                    nthreads);
+      for_each_band(
+        EuclideanDistanceRows<OutputType>(columns.const_ref(), dst, squared),
+        (int)height,
+        nthreads);
+    }
+
+  }  // namespace detail
+
+  /**
+   * Compute the squared Euclidean distance to the nearest pixel with the
+   * given value. The exact transform is computed in linear time by first
+   * finding the distance along each column and then the lower envelope of
+   * parabolas along each row. Each of these passes is split into bands
+   * processed in separate threads. A pixel in a column with no pixels of
+   * the given value is treated as being height + width pixels from one.
+   * @param src: The src array
+   * @param value: The value to compute the distance to
+   * @param dst: The destination array
+   * @param nthreads The number of threads to use
+   */
+  template <typename InputType, typename OutputType>
+  void euclidean_distance_sq(const af::const_ref<InputType, af::c_grid<2> > &src,
+                             InputType value,
+                             af::ref<OutputType, af::c_grid<2> > dst,
+                             std::size_t nthreads = 1) {
+    detail::euclidean_distance(src, value, dst, true, nthreads);
+  }
+
+  /**
+   * Compute the Euclidean distance to the nearest pixel with the given value.
+   * See euclidean_distance_sq.
+   * @param src: The src array
+   * @param value: The value to compute the distance to
+   * @param dst: The destination array
+   * @param nthreads The number of threads to use
+   */
+  template <typename InputType, typename OutputType>
+  void euclidean_distance(const af::const_ref<InputType, af::c_grid<2> > &src,
+                          InputType value,
+                          af::ref<OutputType, af::c_grid<2> > dst,
+                          std::size_t nthreads = 1) {
+    detail::euclidean_distance(src, value, dst, false, nthreads);
+  }
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_IMAGE_FILTER_DISTANCE_H
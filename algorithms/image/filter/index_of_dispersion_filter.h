@@ -38,16 +38,20 @@ namespace dials { namespace algorithms {
      * var/mean) for each pixel.
      * @param image The image to filter
      * @param size Size of the filter kernel (2 * size + 1)
+     * @param nthreads The number of threads to use
      */
     IndexOfDispersionFilter(const af::const_ref<FloatType, af::c_grid<2> > &image,
-                            int2 size) {
+                            int2 size,
+                            std::size_t nthreads = 1)
+        : index_of_dispersion_(image.accessor(), af::init_functor_null<FloatType>()),
+          mean_(image.accessor(), af::init_functor_null<FloatType>()),
+          var_(image.accessor(), af::init_functor_null<FloatType>()) {
       // Get the mean and variance maps
-      MeanAndVarianceFilter<FloatType> filter(image, size);
-      mean_ = filter.mean();
-      var_ = filter.sample_variance();
+      MeanAndVarianceFilter<FloatType> filter(image, size, nthreads);
+      filter.mean(mean_.ref());
+      filter.sample_variance(var_.ref());
 
       // Calculate the filtered image
-      index_of_dispersion_ = af::versa<FloatType, af::c_grid<2> >(var_.accessor(), 0);
       for (std::size_t i = 0; i < var_.size(); ++i) {
         if (mean_[i] > 0) {
           index_of_dispersion_[i] = var_[i] / mean_[i];
@@ -104,20 +108,25 @@ namespace dials { namespace algorithms {
      * @param mask The mask to use
      * @param size Size of the filter kernel (2 * size + 1)
      * @param min_count The minimum counts under the filter to include the pixel
+     * @param nthreads The number of threads to use
      */
     IndexOfDispersionFilterMasked(const af::const_ref<FloatType, af::c_grid<2> > &image,
                                   const af::const_ref<int, af::c_grid<2> > &mask,
                                   int2 size,
-                                  int min_count) {
+                                  int min_count,
+                                  std::size_t nthreads = 1)
+        : index_of_dispersion_(image.accessor(), af::init_functor_null<FloatType>()),
+          mean_(image.accessor(), af::init_functor_null<FloatType>()),
+          var_(image.accessor(), af::init_functor_null<FloatType>()) {
       // Get the mean and variance maps
-      MeanAndVarianceFilterMasked<FloatType> filter(image, mask, size, min_count);
-      mean_ = filter.mean();
-      var_ = filter.sample_variance();
+      MeanAndVarianceFilterMasked<FloatType> filter(
+        image, mask, size, min_count, nthreads);
+      filter.mean(mean_.ref());
+      filter.sample_variance(var_.ref());
       mask_ = filter.mask();
       count_ = filter.count();
 
       // Calculate the filtered image.
-      index_of_dispersion_ = af::versa<FloatType, af::c_grid<2> >(var_.accessor(), 0);
       for (std::size_t i = 0; i < var_.size(); ++i) {
         if (mask_[i] && mean_[i] > 0) {
           index_of_dispersion_[i] = var_[i] / mean_[i];
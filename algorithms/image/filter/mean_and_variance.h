@@ -15,6 +15,7 @@
 #include <cmath>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 #include "summed_area.h"
 
@@ -26,18 +27,21 @@ namespace dials { namespace algorithms {
    * Calculate the mean box filtered image.
    * @param image The image to filter
    * @param size The size of the filter kernel (2 * size + 1)
+   * @param nthreads The number of threads to use
    * @returns The filtered image
    */
   template <typename FloatType>
   af::versa<FloatType, af::c_grid<2> > mean_filter(
     const af::const_ref<FloatType, af::c_grid<2> > &image,
-    int2 size) {
+    int2 size,
+    std::size_t nthreads = 1) {
     // Check the input is valid
     DIALS_ASSERT(size.all_gt(0));
     DIALS_ASSERT(image.accessor().all_gt(0));
 
     // Get the summed area image
-    af::versa<FloatType, af::c_grid<2> > mean = summed_area<FloatType>(image, size);
+    af::versa<FloatType, af::c_grid<2> > mean =
+      summed_area<FloatType>(image, size, nthreads);
     FloatType inv_count = 1.0 / ((FloatType)(2 * size[0] + 1) * (2 * size[1] + 1));
 
     // Calculate the mean at each point
@@ -64,6 +68,7 @@ namespace dials { namespace algorithms {
    * @param size The size of the filter kernel (2 * size + 1)
    * @param min_count The minimum counts to use
    * @param ignore_masked Ignore and set mean to zero if masked
+   * @param nthreads The number of threads to use
    * @returns The filtered image
    */
   template <typename FloatType>
@@ -72,7 +77,8 @@ namespace dials { namespace algorithms {
     af::ref<int, af::c_grid<2> > mask,
     int2 size,
     int min_count,
-    bool ignore_masked = true) {
+    bool ignore_masked = true,
+    std::size_t nthreads = 1) {
     // Check the input is valid
     DIALS_ASSERT(size.all_ge(0));
     DIALS_ASSERT(image.accessor().all_gt(0));
@@ -86,7 +92,8 @@ namespace dials { namespace algorithms {
     }
 
     // Calculate the summed area under the mask
-    af::versa<int, af::c_grid<2> > summed_mask = summed_area<int>(mask, size);
+    af::versa<int, af::c_grid<2> > summed_mask =
+      summed_area<int>(mask, size, nthreads);
 
     // Ensure that all masked pixels are zero in the image and update the mask
     af::versa<FloatType, af::c_grid<2> > temp(image.accessor(),
@@ -98,7 +105,7 @@ namespace dials { namespace algorithms {
 
     // Calculate the summed area under the image
     af::versa<FloatType, af::c_grid<2> > summed_image =
-      summed_area<FloatType>(temp.const_ref(), size);
+      summed_area<FloatType>(temp.const_ref(), size, nthreads);
 
     // Calculate the mean filtered image
     for (std::size_t i = 0; i < image.size(); ++i) {
@@ -114,7 +121,10 @@ namespace dials { namespace algorithms {
   }
 
   /**
-   * A class to calculate the mean and variance filtered images.
+   * A class to calculate the mean and variance filtered images. The box sums
+   * are computed in bands of rows which may be processed in separate
+   * threads. The filtered images can either be returned as new arrays or
+   * written into arrays given by the caller.
    */
   template <typename FloatType = double>
   class MeanAndVarianceFilter {
@@ -125,28 +135,32 @@ namespace dials { namespace algorithms {
      * Initialise the algorithm.
      * @params image The image to filter
      * @param size The size of the filter kernel (2 * size + 1)
+     * @param nthreads The number of threads to use
      */
     MeanAndVarianceFilter(const af::const_ref<FloatType, af::c_grid<2> > &image,
-                          int2 size) {
+                          int2 size,
+                          std::size_t nthreads = 1)
+        : sum_(image.accessor(), af::init_functor_null<FloatType>()),
+          sq_sum_(image.accessor(), af::init_functor_null<FloatType>()) {
       // Check the input is valid
       DIALS_ASSERT(size.all_gt(0));
       DIALS_ASSERT(image.accessor().all_gt(0));
 
-      // Calculate the squared image
-      af::versa<FloatType, af::c_grid<2> > image_sq(image.accessor(),
-                                                    af::init_functor_null<FloatType>());
-      for (std::size_t i = 0; i < image.size(); ++i) {
-        image_sq[i] = image[i] * image[i];
-      }
-
       // Inverse of counts to avoid excessive division
       int count = (2 * size[0] + 1) * (2 * size[1] + 1);
       inv_count_ = 1.0 / count;
       inv_countm1_ = 1.0 / (count - 1);
 
       // Calculate the summed area under the image and image**2
-      sum_ = summed_area<FloatType>(image, size);
-      sq_sum_ = summed_area<FloatType>(image_sq.const_ref(), size);
+      for_each_band(
+        detail::BoxSumBand<FloatType>(image,
+                                      NULL,
+                                      size,
+                                      af::ref<int, af::c_grid<2> >(0, af::c_grid<2>()),
+                                      sum_.ref(),
+                                      sq_sum_.ref()),
+        (int)image.accessor()[0],
+        nthreads);
     }
 
     /**
@@ -156,10 +170,19 @@ namespace dials { namespace algorithms {
     af::versa<FloatType, af::c_grid<2> > mean() const {
       af::versa<FloatType, af::c_grid<2> > m(sum_.accessor(),
                                              af::init_functor_null<FloatType>());
+      mean(m.ref());
+      return m;
+    }
+
+    /**
+     * Calculate the mean filtered image
+     * @param m The array to hold the mean filtered image
+     */
+    void mean(af::ref<FloatType, af::c_grid<2> > m) const {
+      DIALS_ASSERT(m.accessor().all_eq(sum_.accessor()));
       for (std::size_t i = 0; i < sum_.size(); ++i) {
         m[i] = sum_[i] * inv_count_;
       }
-      return m;
     }
 
     /**
@@ -169,10 +192,19 @@ namespace dials { namespace algorithms {
     af::versa<FloatType, af::c_grid<2> > variance() const {
       af::versa<FloatType, af::c_grid<2> > v(sum_.accessor(),
                                              af::init_functor_null<FloatType>());
+      variance(v.ref());
+      return v;
+    }
+
+    /**
+     * Calculate the variance filtered image
+     * @param v The array to hold the variance filtered image
+     */
+    void variance(af::ref<FloatType, af::c_grid<2> > v) const {
+      DIALS_ASSERT(v.accessor().all_eq(sum_.accessor()));
       for (std::size_t i = 0; i < sum_.size(); ++i) {
         v[i] = (sq_sum_[i] - (sum_[i] * sum_[i] * inv_count_)) * (inv_count_);
       }
-      return v;
     }
 
     /**
@@ -182,10 +214,19 @@ namespace dials { namespace algorithms {
     af::versa<FloatType, af::c_grid<2> > sample_variance() const {
       af::versa<FloatType, af::c_grid<2> > v(sum_.accessor(),
                                              af::init_functor_null<FloatType>());
+      sample_variance(v.ref());
+      return v;
+    }
+
+    /**
+     * Calculate the sample variance filtered image
+     * @param v The array to hold the sample variance filtered image
+     */
+    void sample_variance(af::ref<FloatType, af::c_grid<2> > v) const {
+      DIALS_ASSERT(v.accessor().all_eq(sum_.accessor()));
       for (std::size_t i = 0; i < sum_.size(); ++i) {
         v[i] = (sq_sum_[i] - (sum_[i] * sum_[i] * inv_count_)) * (inv_countm1_);
       }
-      return v;
     }
 
   private:
@@ -208,6 +249,10 @@ namespace dials { namespace algorithms {
    *
    * If min_count is set to 1 then a call to sample_variance will result
    * in an exception.
+   *
+   * As for MeanAndVarianceFilter, the box sums may be computed in several
+   * threads and the filtered images may be written into arrays given by the
+   * caller.
    */
   template <typename FloatType = double>
   class MeanAndVarianceFilterMasked {
@@ -220,12 +265,18 @@ namespace dials { namespace algorithms {
      * @param mask The mask to use (0 = off, 1 == on)
      * @param size The size of the filter kernel (2 * size + 1)
      * @param min_count The minimum counts to use
+     * @param nthreads The number of threads to use
      */
     MeanAndVarianceFilterMasked(const af::const_ref<FloatType, af::c_grid<2> > &image,
                                 const af::const_ref<int, af::c_grid<2> > &mask,
                                 int2 size,
-                                int min_count)
-        : min_count_(min_count), mask_(mask.accessor()) {
+                                int min_count,
+                                std::size_t nthreads = 1)
+        : min_count_(min_count),
+          mask_(mask.accessor()),
+          summed_mask_(mask.accessor(), af::init_functor_null<int>()),
+          summed_image_(image.accessor(), af::init_functor_null<FloatType>()),
+          summed_image_sq_(image.accessor(), af::init_functor_null<FloatType>()) {
       const FloatType BIG = (1 << 24);  // About 1.6m counts
 
       // Check the input is valid
@@ -233,11 +284,6 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(image.accessor().all_gt(0));
       DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
 
-      // Copy the mask array
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        mask_[i] = mask[i] && image[i] < BIG;
-      }
-
       // Ensure the min counts are valid
       if (min_count_ <= 0) {
         min_count_ = (2 * size[0] + 1) * (2 * size[1] + 1);
@@ -246,69 +292,106 @@ namespace dials { namespace algorithms {
                      && min_count_ > 1);
       }
 
-      // Calculate the summed area under the mask
-      summed_mask_ = summed_area<int>(mask, size);
-
-      // Ensure that all masked pixels are zero in the image and update the mask
-      af::versa<FloatType, af::c_grid<2> > temp(image.accessor(),
-                                                af::init_functor_null<FloatType>());
-      af::versa<FloatType, af::c_grid<2> > image_sq(image.accessor(),
-                                                    af::init_functor_null<FloatType>());
-      for (std::size_t i = 0; i < image.size(); ++i) {
-        temp[i] = image[i] * (mask[i] != 0);
-        mask_[i] *= (summed_mask_[i] >= min_count_);
-        image_sq[i] = temp[i] * temp[i];
+      // Calculate the summed mask, image and image**2, with the masked
+      // pixels set to zero in the image
+      for_each_band(detail::BoxSumBand<FloatType>(image,
+                                                  &mask,
+                                                  size,
+                                                  summed_mask_.ref(),
+                                                  summed_image_.ref(),
+                                                  summed_image_sq_.ref()),
+                    (int)image.accessor()[0],
+                    nthreads);
+
+      // Update the mask
+      for (std::size_t i = 0; i < mask.size(); ++i) {
+        mask_[i] = mask[i] && image[i] < BIG && summed_mask_[i] >= min_count_;
       }
-
-      // Calculate the summed image and the summed image**2
-      summed_image_ = summed_area<FloatType>(temp.const_ref(), size);
-      summed_image_sq_ = summed_area<FloatType>(image_sq.const_ref(), size);
     }
 
     /**
      * @returns The mean filtered image
      */
     af::versa<FloatType, af::c_grid<2> > mean() const {
-      af::versa<FloatType, af::c_grid<2> > m(summed_image_.accessor(), 0);
+      af::versa<FloatType, af::c_grid<2> > m(summed_image_.accessor(),
+                                             af::init_functor_null<FloatType>());
+      mean(m.ref());
+      return m;
+    }
+
+    /**
+     * Calculate the mean filtered image. Pixels which are not filtered are
+     * set to zero.
+     * @param m The array to hold the mean filtered image
+     */
+    void mean(af::ref<FloatType, af::c_grid<2> > m) const {
+      DIALS_ASSERT(m.accessor().all_eq(summed_image_.accessor()));
       for (std::size_t i = 0; i < summed_image_.size(); ++i) {
         if (mask_[i]) {
           m[i] = summed_image_[i] / summed_mask_[i];
+        } else {
+          m[i] = 0;
         }
       }
-      return m;
     }
 
     /**
      * @returns The variance filtered image
      */
     af::versa<FloatType, af::c_grid<2> > variance() const {
-      af::versa<FloatType, af::c_grid<2> > v(summed_image_.accessor(), 0);
+      af::versa<FloatType, af::c_grid<2> > v(summed_image_.accessor(),
+                                             af::init_functor_null<FloatType>());
+      variance(v.ref());
+      return v;
+    }
+
+    /**
+     * Calculate the variance filtered image. Pixels which are not filtered
+     * are set to zero.
+     * @param v The array to hold the variance filtered image
+     */
+    void variance(af::ref<FloatType, af::c_grid<2> > v) const {
+      DIALS_ASSERT(v.accessor().all_eq(summed_image_.accessor()));
       for (std::size_t i = 0; i < summed_image_.size(); ++i) {
         if (mask_[i]) {
           int c = summed_mask_[i];
           double s = summed_image_[i];
           double s2 = summed_image_sq_[i];
           v[i] = (s2 - (s * s / c)) / (c);
+        } else {
+          v[i] = 0;
         }
       }
-      return v;
     }
 
     /**
      * @returns The sample variance filtered image.
      */
     af::versa<FloatType, af::c_grid<2> > sample_variance() const {
+      af::versa<FloatType, af::c_grid<2> > v(summed_image_.accessor(),
+                                             af::init_functor_null<FloatType>());
+      sample_variance(v.ref());
+      return v;
+    }
+
+    /**
+     * Calculate the sample variance filtered image. Pixels which are not
+     * filtered are set to zero.
+     * @param v The array to hold the sample variance filtered image
+     */
+    void sample_variance(af::ref<FloatType, af::c_grid<2> > v) const {
       DIALS_ASSERT(min_count_ > 1);
-      af::versa<FloatType, af::c_grid<2> > v(summed_image_.accessor(), 0);
+      DIALS_ASSERT(v.accessor().all_eq(summed_image_.accessor()));
       for (std::size_t i = 0; i < summed_image_.size(); ++i) {
         if (mask_[i]) {
           int c = summed_mask_[i];
           FloatType s = summed_image_[i];
           FloatType s2 = summed_image_sq_[i];
           v[i] = (s2 - (s * s / c)) / (c - 1);
+        } else {
+          v[i] = 0;
         }
       }
-      return v;
     }
 
     /**
@@ -12,8 +12,12 @@
 #define DIALS_ALGORITHMS_IMAGE_FILTER_MEDIAN_H
 
 #include <algorithm>
+#include <vector>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_integral.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -99,8 +103,8 @@ namespace dials { namespace algorithms {
         for (int jj = j - size[0]; jj <= j + size[0]; ++jj) {
           for (int ii = i - size[1]; ii <= i + size[1]; ++ii) {
             if (periodic) {
-              std::size_t jjj = (jj % ysize + ysize) % ysize;
-              std::size_t iii = (ii % xsize + xsize) % xsize;
+              std::size_t jjj = (jj % (int)ysize + (int)ysize) % (int)ysize;
+              std::size_t iii = (ii % (int)xsize + (int)xsize) % (int)xsize;
               DIALS_ASSERT(jjj >= 0 && iii >= 0 && jjj < ysize && iii < xsize);
               if (mask(jjj, iii)) {
                 DIALS_ASSERT(npix < pixels.size());
@@ -128,6 +132,239 @@ namespace dials { namespace algorithms {
     return median;
   }
 
+  namespace detail {
+
+    /**
+     * A histogram of the integer values in a sliding window which tracks the
+     * median of the window. The median is found from the previous median by
+     * counting the values below it, so it only moves as far as the median of
+     * the window changes as the window slides.
+     */
+    class SlidingHistogramMedian {
+    public:
+      /**
+       * @param nbins The number of distinct values
+       */
+      SlidingHistogramMedian(std::size_t nbins)
+          : hist_(nbins, 0), count_(0), below_(0), median_(0) {}
+
+      /** Add a value to the window */
+      void add(std::size_t bin) {
+        hist_[bin]++;
+        count_++;
+        if (bin < median_) {
+          below_++;
+        }
+      }
+
+      /** Remove a value from the window */
+      void remove(std::size_t bin) {
+        hist_[bin]--;
+        count_--;
+        if (bin < median_) {
+          below_--;
+        }
+      }
+
+      /** @returns The number of values in the window */
+      std::size_t size() const {
+        return count_;
+      }
+
+      /**
+       * Find the bin of the median. This is the value at position n / 2 of
+       * the sorted window so is the same as given by std::nth_element.
+       */
+      std::size_t median() {
+        std::size_t n = count_ / 2;
+        while (below_ > n) {
+          median_--;
+          below_ -= hist_[median_];
+        }
+        while (below_ + hist_[median_] <= n) {
+          below_ += hist_[median_];
+          median_++;
+        }
+        return median_;
+      }
+
+    private:
+      std::vector<std::size_t> hist_;
+      std::size_t count_;
+      std::size_t below_;
+      std::size_t median_;
+    };
+
+    /**
+     * Apply the histogram median filter to bands of rows of an integer image
+     */
+    template <typename T>
+    class HistogramMedianFilter {
+    public:
+      HistogramMedianFilter(const af::const_ref<T, af::c_grid<2> > &image,
+                            const af::const_ref<bool, af::c_grid<2> > *mask,
+                            int2 size,
+                            bool periodic,
+                            T vmin,
+                            std::size_t nbins,
+                            af::ref<T, af::c_grid<2> > median)
+          : image_(image),
+            mask_(mask),
+            size_(size),
+            periodic_(periodic),
+            vmin_(vmin),
+            nbins_(nbins),
+            median_(median) {}
+
+      /**
+       * Filter the rows j0 to j1. The window is moved along each row by
+       * removing the column leaving it and adding the column entering it.
+       */
+      void operator()(int j0, int j1) const {
+        int xsize = (int)image_.accessor()[1];
+        SlidingHistogramMedian histogram(nbins_);
+        for (int j = j0; j < j1; ++j) {
+          for (int x = -size_[1]; x <= size_[1]; ++x) {
+            column(histogram, x, j, true);
+          }
+          for (int i = 0; i < xsize; ++i) {
+            if (histogram.size() > 0) {
+              median_(j, i) = (T)(vmin_ + (T)histogram.median());
+            }
+            column(histogram, i - size_[1], j, false);
+            column(histogram, i + size_[1] + 1, j, true);
+          }
+          for (int x = xsize - size_[1]; x <= xsize + size_[1]; ++x) {
+            column(histogram, x, j, false);
+          }
+        }
+      }
+
+    private:
+      void column(SlidingHistogramMedian &histogram, int x, int j, bool add) const {
+        int ysize = (int)image_.accessor()[0];
+        int xsize = (int)image_.accessor()[1];
+        int jj0 = j - size_[0];
+        int jj1 = j + size_[0];
+        if (periodic_) {
+          x = (x % xsize + xsize) % xsize;
+        } else {
+          if (x < 0 || x >= xsize) {
+            return;
+          }
+          jj0 = std::max(jj0, 0);
+          jj1 = std::min(jj1, ysize - 1);
+        }
+        for (int jj = jj0; jj <= jj1; ++jj) {
+          int y = periodic_ ? (jj % ysize + ysize) % ysize : jj;
+          if (mask_ == NULL || (*mask_)(y, x)) {
+            std::size_t bin = (std::size_t)(image_(y, x) - vmin_);
+            if (add) {
+              histogram.add(bin);
+            } else {
+              histogram.remove(bin);
+            }
+          }
+        }
+      }
+
+      af::const_ref<T, af::c_grid<2> > image_;
+      const af::const_ref<bool, af::c_grid<2> > *mask_;
+      int2 size_;
+      bool periodic_;
+      T vmin_;
+      std::size_t nbins_;
+      af::ref<T, af::c_grid<2> > median_;
+    };
+
+    /**
+     * The largest range of values for which the histogram is used
+     */
+    const double histogram_median_max_bins = 1 << 20;
+
+  }  // namespace detail
+
+  /**
+   * Apply a median filter to an integer image. The median of each window is
+   * found from a histogram of the window which is updated as the window
+   * slides along a row, so the cost per pixel is proportional to the kernel
+   * size rather than its area. The rows are split into bands which are
+   * filtered in separate threads. Images whose values span too large a range
+   * for a histogram are filtered with median_filter. The result is the same
+   * as from median_filter.
+   * @param image The image to filter
+   * @param size The size of the filter kernel
+   * @param nthreads The number of threads to use
+   * @returns The filtered image
+   */
+  template <typename T>
+  af::versa<T, af::c_grid<2> > histogram_median_filter(
+    const af::const_ref<T, af::c_grid<2> > &image,
+    int2 size,
+    std::size_t nthreads) {
+    BOOST_STATIC_ASSERT(boost::is_integral<T>::value);
+    DIALS_ASSERT(size.all_ge(0));
+    DIALS_ASSERT(image.accessor().all_gt(0));
+    T vmin = *std::min_element(image.begin(), image.end());
+    T vmax = *std::max_element(image.begin(), image.end());
+    if ((double)vmax - (double)vmin >= detail::histogram_median_max_bins) {
+      return median_filter(image, size);
+    }
+    af::versa<T, af::c_grid<2> > median(image.accessor(), T(0));
+    for_each_band(
+      detail::HistogramMedianFilter<T>(image,
+                                       NULL,
+                                       size,
+                                       false,
+                                       vmin,
+                                       (std::size_t)(vmax - vmin) + 1,
+                                       median.ref()),
+      (int)image.accessor()[0],
+      nthreads);
+    return median;
+  }
+
+  /**
+   * Apply a median filter to an integer image with a mask. As for
+   * histogram_median_filter, the result is the same as from
+   * median_filter_masked.
+   * @param image The image to filter
+   * @param mask The image mask
+   * @param size The size of the filter kernel
+   * @param periodic Wrap the filter
+   * @param nthreads The number of threads to use
+   * @returns The filtered image
+   */
+  template <typename T>
+  af::versa<T, af::c_grid<2> > histogram_median_filter_masked(
+    const af::const_ref<T, af::c_grid<2> > &image,
+    const af::const_ref<bool, af::c_grid<2> > &mask,
+    int2 size,
+    bool periodic,
+    std::size_t nthreads) {
+    BOOST_STATIC_ASSERT(boost::is_integral<T>::value);
+    DIALS_ASSERT(size.all_ge(0));
+    DIALS_ASSERT(image.accessor().all_gt(0));
+    DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
+    T vmin = *std::min_element(image.begin(), image.end());
+    T vmax = *std::max_element(image.begin(), image.end());
+    if ((double)vmax - (double)vmin >= detail::histogram_median_max_bins) {
+      return median_filter_masked(image, mask, size, periodic);
+    }
+    af::versa<T, af::c_grid<2> > median(image.accessor(), T(0));
+    for_each_band(
+      detail::HistogramMedianFilter<T>(image,
+                                       &mask,
+                                       size,
+                                       periodic,
+                                       vmin,
+                                       (std::size_t)(vmax - vmin) + 1,
+                                       median.ref()),
+      (int)image.accessor()[0],
+      nthreads);
+    return median;
+  }
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_IMAGE_FILTER_MEDIAN_H
@@ -0,0 +1,104 @@
+/*
+ * parallel_bands.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_FILTER_PARALLEL_BANDS_H
+#define DIALS_ALGORITHMS_IMAGE_FILTER_PARALLEL_BANDS_H
+
+#include <algorithm>
+#include <exception>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread.hpp>
+#include <dials/error.h>
+#include <dials/util/thread_limit.h>
+
+namespace dials { namespace algorithms {
+
+  namespace detail {
+
+    /**
+     * Call the function for a band, keeping any exception so that it can be
+     * raised on the calling thread once all the bands are done
+     */
+    template <typename Function>
+    struct BandRunner {
+      const Function &function;
+      std::vector<dials::error> &errors;
+      std::vector<char> &failed;
+
+      BandRunner(const Function &function_,
+                 std::vector<dials::error> &errors_,
+                 std::vector<char> &failed_)
+          : function(function_), errors(errors_), failed(failed_) {}
+
+      void operator()(std::size_t index, int j0, int j1) const {
+        try {
+          function(j0, j1);
+        } catch (const dials::error &e) {
+          errors[index] = e;
+          failed[index] = 1;
+        } catch (const std::exception &e) {
+          errors[index] = dials::error(e.what());
+          failed[index] = 1;
+        } catch (...) {
+          errors[index] = dials::error("Unknown exception");
+          failed[index] = 1;
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Split the rows (or columns) of an image into contiguous bands and process
+   * each band in its own thread. The function is called as function(j0, j1)
+   * for the rows j0 to j1 - 1 of each band. With a single thread the function
+   * is called once on the calling thread for all the rows. Otherwise, if the
+   * function throws in any band, all the bands are still waited for and the
+   * exception from the first failing band is raised as a dials::error. The
+   * threads, including the calling thread, are reserved from the thread
+   * limit of the extension, so there may be fewer bands than threads requested.
+   * @param function The function to process a band of rows
+   * @param ysize The number of rows
+   * @param nthreads The number of threads to use
+   */
+  template <typename Function>
+  void for_each_band(const Function &function, int ysize, std::size_t nthreads) {
+    DIALS_ASSERT(nthreads > 0);
+    DIALS_ASSERT(ysize >= 0);
+    nthreads = std::min(nthreads, (std::size_t)std::max(ysize, 1));
+    dials::util::ThreadReservation reservation(nthreads);
+    nthreads = reservation.size();
+    if (nthreads <= 1) {
+      function(0, ysize);
+      return;
+    }
+    int band = (ysize + (int)nthreads - 1) / (int)nthreads;
+    std::size_t nbands = (ysize + band - 1) / band;
+    std::vector<dials::error> errors(nbands, dials::error(""));
+    std::vector<char> failed(nbands, 0);
+    detail::BandRunner<Function> runner(function, errors, failed);
+    boost::thread_group threads;
+    for (std::size_t i = 1; i < nbands; ++i) {
+      int j0 = (int)i * band;
+      threads.create_thread(
+        boost::bind<void>(boost::cref(runner), i, j0, std::min(j0 + band, ysize)));
+    }
+    runner(0, 0, std::min(band, ysize));
+    threads.join_all();
+    for (std::size_t i = 0; i < nbands; ++i) {
+      if (failed[i]) {
+        throw errors[i];
+      }
+    }
+  }
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_IMAGE_FILTER_PARALLEL_BANDS_H
@@ -13,97 +13,306 @@
 
 #include <algorithm>
 #include <cmath>
+#include <vector>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
   using scitbx::af::int2;
 
+  namespace detail {
+
+    /**
+     * Replace each row of a table with its prefix sums
+     */
+    template <typename T>
+    struct PrefixSumRows {
+      af::ref<T, af::c_grid<2> > table;
+
+      PrefixSumRows(af::ref<T, af::c_grid<2> > table_) : table(table_) {}
+
+      void operator()(int j0, int j1) const {
+        std::size_t xsize = table.accessor()[1];
+        for (int j = j0; j < j1; ++j) {
+          T *row = &table(j, 0);
+          for (std::size_t i = 1; i < xsize; ++i) {
+            row[i] += row[i - 1];
+          }
+        }
+      }
+    };
+
+    /**
+     * Add each row of a table to the following row, for the columns i0 to
+     * i1 - 1. The inner loop is along a row so it can be vectorised.
+     */
+    template <typename T>
+    struct AccumulateColumns {
+      af::ref<T, af::c_grid<2> > table;
+
+      AccumulateColumns(af::ref<T, af::c_grid<2> > table_) : table(table_) {}
+
+      void operator()(int i0, int i1) const {
+        std::size_t ysize = table.accessor()[0];
+        for (std::size_t j = 1; j < ysize; ++j) {
+          const T *prev = &table(j - 1, 0);
+          T *row = &table(j, 0);
+          for (int i = i0; i < i1; ++i) {
+            row[i] += prev[i];
+          }
+        }
+      }
+    };
+
+    /**
+     * Compute the sum over the (2 * size + 1) box around each pixel from a
+     * summed area table, for a band of rows of the image
+     */
+    template <typename T>
+    struct BoxSumFromTable {
+      af::const_ref<T, af::c_grid<2> > I;
+      af::ref<T, af::c_grid<2> > sum;
+      int2 size;
+
+      BoxSumFromTable(const af::const_ref<T, af::c_grid<2> > &I_,
+                      af::ref<T, af::c_grid<2> > sum_,
+                      int2 size_)
+          : I(I_), sum(sum_), size(size_) {}
+
+      void operator()(int jj0, int jj1) const {
+        int ysize = (int)I.accessor()[0];
+        int xsize = (int)I.accessor()[1];
+        for (int j = jj0; j < jj1; ++j) {
+          for (int i = 0; i < xsize; ++i) {
+            int i0 = i - size[1] - 1, i1 = i + size[1];
+            int j0 = j - size[0] - 1, j1 = j + size[0];
+            i1 = i1 < xsize ? i1 : xsize - 1;
+            j1 = j1 < ysize ? j1 : ysize - 1;
+
+            double I00 = 0, I10 = 0, I01 = 0, I11 = 0;
+            if (i0 >= 0 && j0 >= 0) {
+              I00 = I(j0, i0);
+              I10 = I(j1, i0);
+              I01 = I(j0, i1);
+            } else if (i0 >= 0) {
+              I10 = I(j1, i0);
+            } else if (j0 >= 0) {
+              I01 = I(j0, i1);
+            }
+            I11 = I(j1, i1);
+
+            sum(j, i) = (I11 + I00 - I01 - I10);
+          }
+        }
+      }
+    };
+
+    /**
+     * Compute the sums of the pixel values, the squared pixel values and
+     * optionally the mask values in a (2 * size + 1) box around each pixel,
+     * for a band of rows. Masked pixels contribute zero to the value sums.
+     *
+     * The box sums are the same as from summed_area but are found with
+     * running sums rather than a summed area table, so no table the size of
+     * the image is needed and each band of rows can be computed
+     * independently. The sums along each row are found
+     * first and then a running sum of these over the rows of the box is
+     * moved down the band. The running sums are accumulated in double
+     * precision.
+     */
+    template <typename FloatType>
+    class BoxSumBand {
+    public:
+      /**
+       * @param image The image
+       * @param mask The mask or NULL
+       * @param size The size of the box (2 * size + 1)
+       * @param count The summed mask, used if mask is not NULL
+       * @param sum The summed image
+       * @param sq_sum The summed squared image
+       */
+      BoxSumBand(const af::const_ref<FloatType, af::c_grid<2> > &image,
+                 const af::const_ref<int, af::c_grid<2> > *mask,
+                 int2 size,
+                 af::ref<int, af::c_grid<2> > count,
+                 af::ref<FloatType, af::c_grid<2> > sum,
+                 af::ref<FloatType, af::c_grid<2> > sq_sum)
+          : image_(image),
+            mask_(mask),
+            size_(size),
+            count_(count),
+            sum_(sum),
+            sq_sum_(sq_sum) {
+        DIALS_ASSERT(size.all_ge(0));
+        DIALS_ASSERT(sum.accessor().all_eq(image.accessor()));
+        DIALS_ASSERT(sq_sum.accessor().all_eq(image.accessor()));
+        if (mask != NULL) {
+          DIALS_ASSERT(mask->accessor().all_eq(image.accessor()));
+          DIALS_ASSERT(count.accessor().all_eq(image.accessor()));
+        }
+      }
+
+      /**
+       * Compute the box sums for the rows j0 to j1 - 1
+       */
+      void operator()(int j0, int j1) const {
+        int ysize = (int)image_.accessor()[0];
+        std::size_t xsize = image_.accessor()[1];
+        Rows box(xsize), row(xsize);
+        int y0 = std::max(j0 - size_[0], 0);
+        int y1 = std::min(j0 + size_[0], ysize - 1);
+        for (int y = y0; y <= y1; ++y) {
+          row_sums(y, row);
+          box.add(row, 1);
+        }
+        for (int j = j0; j < j1; ++j) {
+          for (std::size_t i = 0; i < xsize; ++i) {
+            sum_(j, i) = (FloatType)box.sum[i];
+            sq_sum_(j, i) = (FloatType)box.sq_sum[i];
+          }
+          if (mask_ != NULL) {
+            std::copy(box.count.begin(), box.count.end(), &count_(j, 0));
+          }
+          if (j + 1 >= j1) {
+            break;
+          }
+          if (j - size_[0] >= 0) {
+            row_sums(j - size_[0], row);
+            box.add(row, -1);
+          }
+          if (j + size_[0] + 1 < ysize) {
+            row_sums(j + size_[0] + 1, row);
+            box.add(row, 1);
+          }
+        }
+      }
+
+    private:
+      struct Rows {
+        std::vector<int> count;
+        std::vector<double> sum;
+        std::vector<double> sq_sum;
+
+        Rows(std::size_t n) : count(n, 0), sum(n, 0), sq_sum(n, 0) {}
+
+        void add(const Rows &other, int sign) {
+          for (std::size_t i = 0; i < sum.size(); ++i) {
+            count[i] += sign * other.count[i];
+            sum[i] += sign * other.sum[i];
+            sq_sum[i] += sign * other.sq_sum[i];
+          }
+        }
+      };
+
+      /**
+       * Compute the sums along a row of the image over the width of the box
+       */
+      void row_sums(int y, Rows &row) const {
+        int xsize = (int)image_.accessor()[1];
+        int c = 0;
+        double s = 0, s2 = 0;
+        for (int i = 0; i < std::min(size_[1], xsize); ++i) {
+          add_pixel(y, i, 1, c, s, s2);
+        }
+        for (int i = 0; i < xsize; ++i) {
+          if (i + size_[1] < xsize) {
+            add_pixel(y, i + size_[1], 1, c, s, s2);
+          }
+          if (i - size_[1] - 1 >= 0) {
+            add_pixel(y, i - size_[1] - 1, -1, c, s, s2);
+          }
+          row.count[i] = c;
+          row.sum[i] = s;
+          row.sq_sum[i] = s2;
+        }
+      }
+
+      void add_pixel(int y, int x, int sign, int &c, double &s, double &s2) const {
+        double v = image_(y, x);
+        if (mask_ != NULL) {
+          int m = (*mask_)(y, x);
+          c += sign * m;
+          if (m == 0) {
+            v = 0;
+          }
+        }
+        s += sign * v;
+        s2 += sign * v * v;
+      }
+
+      af::const_ref<FloatType, af::c_grid<2> > image_;
+      const af::const_ref<int, af::c_grid<2> > *mask_;
+      int2 size_;
+      af::ref<int, af::c_grid<2> > count_;
+      af::ref<FloatType, af::c_grid<2> > sum_;
+      af::ref<FloatType, af::c_grid<2> > sq_sum_;
+    };
+
+  }  // namespace detail
+
+  /**
+   * Turn a table holding the values of an image into the summed area table of
+   * the image. The table is built in two passes: the prefix sums along each
+   * row are computed in bands of rows and then the rows are accumulated down
+   * the table in bands of columns, with each band processed in its own
+   * thread. The element type only needs to support +=, so a single table can
+   * hold several sums for each pixel.
+   * @param table The table
+   * @param nthreads The number of threads to use
+   */
+  template <typename T>
+  void summed_area_table_in_place(af::ref<T, af::c_grid<2> > table,
+                                  std::size_t nthreads = 1) {
+    for_each_band(
+      detail::PrefixSumRows<T>(table), (int)table.accessor()[0], nthreads);
+    for_each_band(
+      detail::AccumulateColumns<T>(table), (int)table.accessor()[1], nthreads);
+  }
+
   /**
    * Calculate the summed area table from the image.
    * @param image The image array
+   * @param nthreads The number of threads to use
    * @returns The summed area table
    */
   template <typename T>
   af::versa<T, af::c_grid<2> > summed_area_table(
-    const af::const_ref<T, af::c_grid<2> > &image) {
-    // Allocate the table
-    af::versa<T, af::c_grid<2> > table_arr(image.accessor(),
-                                           af::init_functor_null<T>());
-    af::ref<T, af::c_grid<2> > table = table_arr.ref();
-
-    // Get the size of the image
-    std::size_t ysize = image.accessor()[0];
-    std::size_t xsize = image.accessor()[1];
-
-    // Create the summed area table
-    for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-      for (std::size_t i = 0; i < xsize; ++i, ++k) {
-        T I10 = j > 0 ? table[k - xsize] : 0;
-        T I01 = i > 0 ? table[k - 1] : 0;
-        T I11 = j > 0 && i > 0 ? table[k - xsize - 1] : 0;
-        table[k] = image[k] + I10 + I01 - I11;
-      }
-    }
-
-    // Return the summed area table
-    return table_arr;
+    const af::const_ref<T, af::c_grid<2> > &image,
+    std::size_t nthreads = 1) {
+    af::versa<T, af::c_grid<2> > table(image.accessor(), af::init_functor_null<T>());
+    std::copy(image.begin(), image.end(), table.begin());
+    summed_area_table_in_place(table.ref(), nthreads);
+    return table;
   }
 
   /**
    * Calculate the summed area under each point of the image
    * @param image The image array
    * @param size The size of the rectangle (2 * size + 1)
+   * @param nthreads The number of threads to use
    * @returns The summed area
    */
   template <typename T>
   af::versa<T, af::c_grid<2> > summed_area(
     const af::const_ref<T, af::c_grid<2> > &image,
-    int2 size) {
+    int2 size,
+    std::size_t nthreads = 1) {
     // Check the sizes are valid
     DIALS_ASSERT(size.all_ge(0));
 
     // Calculate the summed area table
-    af::versa<T, af::c_grid<2> > I_arr = summed_area_table<T>(image);
-    af::const_ref<T, af::c_grid<2> > I = I_arr.const_ref();
-
-    // Allocate the filtered image
-    af::versa<T, af::c_grid<2> > sum_arr(image.accessor(), af::init_functor_null<T>());
-    af::ref<T, af::c_grid<2> > sum = sum_arr.ref();
-
-    // Get the size of the image
-    std::size_t ysize = image.accessor()[0];
-    std::size_t xsize = image.accessor()[1];
-
-    // Calculate the local mean at every point
-    for (std::size_t j = 0; j < ysize; ++j) {
-      for (std::size_t i = 0; i < xsize; ++i) {
-        int i0 = i - size[1] - 1, i1 = i + size[1];
-        int j0 = j - size[0] - 1, j1 = j + size[0];
-        i1 = i1 < xsize ? i1 : xsize - 1;
-        j1 = j1 < ysize ? j1 : ysize - 1;
-
-        double I00 = 0, I10 = 0, I01 = 0, I11 = 0;
-        if (i0 >= 0 && j0 >= 0) {
-          I00 = I(j0, i0);
-          I10 = I(j1, i0);
-          I01 = I(j0, i1);
-        } else if (i0 >= 0) {
-          I10 = I(j1, i0);
-        } else if (j0 >= 0) {
-          I01 = I(j0, i1);
-        }
-        I11 = I(j1, i1);
-
-        sum(j, i) = (I11 + I00 - I01 - I10);
-      }
-    }
+    af::versa<T, af::c_grid<2> > I = summed_area_table<T>(image, nthreads);
 
-    // Return the summed area image
-    return sum_arr;
+    // Calculate the local sum at every point
+    af::versa<T, af::c_grid<2> > sum(image.accessor(), af::init_functor_null<T>());
+    for_each_band(detail::BoxSumFromTable<T>(I.const_ref(), sum.ref(), size),
+                  (int)image.accessor()[0],
+                  nthreads);
+    return sum;
   }
 
 }}  // namespace dials::algorithms
@@ -7,6 +7,8 @@
     "DispersionExtendedThresholdDebug",
     "DispersionThreshold",
     "DispersionThresholdDebug",
+    "TiledDispersionExtendedThreshold",
+    "TiledDispersionThreshold",
     "dispersion",
     "dispersion_w_gain",
     "gain",
@@ -0,0 +1,82 @@
+/*
+ * cuda_ext.cc
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <boost/shared_ptr.hpp>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/threshold/cuda/dispersion_extended.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+  using scitbx::af::int2;
+
+  /**
+   * Wrap the CUDA extended dispersion threshold with the same interface as the
+   * CPU implementation.
+   */
+  class CudaDispersionExtendedThreshold {
+  public:
+    CudaDispersionExtendedThreshold(int2 image_size,
+                                    int2 kernel_size,
+                                    double nsig_b,
+                                    double nsig_s,
+                                    double threshold,
+                                    int min_count)
+        : image_size_(image_size),
+          impl_(new cuda::DispersionExtendedThreshold(image_size[1],
+                                                      image_size[0],
+                                                      kernel_size[1],
+                                                      kernel_size[0],
+                                                      nsig_b,
+                                                      nsig_s,
+                                                      threshold,
+                                                      min_count)) {}
+
+    void threshold(const af::const_ref<double, af::c_grid<2> > &src,
+                   const af::const_ref<bool, af::c_grid<2> > &mask,
+                   af::ref<bool, af::c_grid<2> > dst) {
+      check_size(src.accessor(), mask.accessor(), dst.accessor());
+      impl_->threshold(src.begin(), mask.begin(), NULL, dst.begin());
+    }
+
+    void threshold_w_gain(const af::const_ref<double, af::c_grid<2> > &src,
+                          const af::const_ref<bool, af::c_grid<2> > &mask,
+                          const af::const_ref<double, af::c_grid<2> > &gain,
+                          af::ref<bool, af::c_grid<2> > dst) {
+      check_size(src.accessor(), mask.accessor(), dst.accessor());
+      DIALS_ASSERT(gain.accessor().all_eq(image_size_));
+      impl_->threshold(src.begin(), mask.begin(), gain.begin(), dst.begin());
+    }
+
+  private:
+    void check_size(const af::c_grid<2> &src,
+                    const af::c_grid<2> &mask,
+                    const af::c_grid<2> &dst) const {
+      DIALS_ASSERT(src.all_eq(image_size_));
+      DIALS_ASSERT(mask.all_eq(image_size_));
+      DIALS_ASSERT(dst.all_eq(image_size_));
+    }
+
+    int2 image_size_;
+    boost::shared_ptr<cuda::DispersionExtendedThreshold> impl_;
+  };
+
+  BOOST_PYTHON_MODULE(dials_algorithms_image_threshold_cuda_ext) {
+    def("is_available", &cuda::is_available);
+
+    class_<CudaDispersionExtendedThreshold>("DispersionExtendedThreshold", no_init)
+      .def(init<int2, int2, double, double, double, int>())
+      .def("__call__", &CudaDispersionExtendedThreshold::threshold)
+      .def("__call__", &CudaDispersionExtendedThreshold::threshold_w_gain);
+  }
+
+}}}  // namespace dials::algorithms::boost_python
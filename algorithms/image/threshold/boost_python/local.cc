@@ -11,6 +11,8 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/image/threshold/local.h>
+#include <dials/algorithms/image/threshold/tiled.h>
+#include <dials/util/python_gil.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -60,16 +62,92 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("min_count")));
   }
 
+  /**
+   * Threshold a multi panel image given as tuples of arrays. The GIL is
+   * released once the arrays have been extracted.
+   */
+  template <typename Algorithm, typename T>
+  void TiledThreshold_multi_panel(const TiledThreshold<Algorithm> &self,
+                                  tuple src,
+                                  tuple mask,
+                                  tuple dst) {
+    DIALS_ASSERT(len(src) == len(mask));
+    DIALS_ASSERT(len(src) == len(dst));
+    std::vector<af::const_ref<T, af::c_grid<2> > > src_list;
+    std::vector<af::const_ref<bool, af::c_grid<2> > > mask_list;
+    std::vector<af::ref<bool, af::c_grid<2> > > dst_list;
+    for (std::size_t i = 0; i < len(src); ++i) {
+      src_list.push_back(extract<af::const_ref<T, af::c_grid<2> > >(src[i])());
+      mask_list.push_back(extract<af::const_ref<bool, af::c_grid<2> > >(mask[i])());
+      dst_list.push_back(extract<af::ref<bool, af::c_grid<2> > >(dst[i])());
+    }
+    dials::util::ScopedGILRelease release_gil;
+    self.threshold_multi_panel(src_list, mask_list, dst_list);
+  }
+
+  /**
+   * Threshold an image with the GIL released, so that images can be
+   * thresholded concurrently from python threads. Each thread must use its own
+   * algorithm since its workspace is reused between calls.
+   */
+  template <typename Algorithm, typename T>
+  void threshold_nogil(Algorithm &self,
+                       const af::const_ref<T, af::c_grid<2> > &src,
+                       const af::const_ref<bool, af::c_grid<2> > &mask,
+                       af::ref<bool, af::c_grid<2> > dst) {
+    dials::util::ScopedGILRelease release_gil;
+    self.threshold(src, mask, dst);
+  }
+
+  /**
+   * Threshold an image with a gain map with the GIL released
+   */
+  template <typename Algorithm, typename T>
+  void threshold_w_gain_nogil(Algorithm &self,
+                              const af::const_ref<T, af::c_grid<2> > &src,
+                              const af::const_ref<bool, af::c_grid<2> > &mask,
+                              const af::const_ref<double, af::c_grid<2> > &gain,
+                              af::ref<bool, af::c_grid<2> > dst) {
+    dials::util::ScopedGILRelease release_gil;
+    self.threshold_w_gain(src, mask, gain, dst);
+  }
+
+  template <typename Algorithm>
+  class_<TiledThreshold<Algorithm> > tiled_threshold_wrapper(const char *name) {
+    typedef TiledThreshold<Algorithm> threshold_type;
+
+    return class_<threshold_type>(name, no_init)
+      .def(init<int2, int2, double, double, double, int, int2, std::size_t>(
+        (arg("kernel_size"),
+         arg("n_sigma_b"),
+         arg("n_sigma_s"),
+         arg("threshold"),
+         arg("min_count"),
+         arg("tile_size") = int2(256, 256),
+         arg("nthreads") = 1)))
+      .def("__call__", &threshold_nogil<threshold_type, double>)
+      .def("__call__", &threshold_w_gain_nogil<threshold_type, double>)
+      .def("__call__", &TiledThreshold_multi_panel<Algorithm, double>);
+  }
+
   void export_local() {
     local_threshold_suite<float>();
     local_threshold_suite<double>();
 
     class_<DispersionThreshold>("DispersionThreshold", no_init)
       .def(init<int2, int2, double, double, double, int>())
-      .def("__call__", &DispersionThreshold::threshold<int>)
-      .def("__call__", &DispersionThreshold::threshold<double>)
-      .def("__call__", &DispersionThreshold::threshold_w_gain<int>)
-      .def("__call__", &DispersionThreshold::threshold_w_gain<double>);
+      .add_property("vectorise",
+                    &DispersionThreshold::get_vectorise,
+                    &DispersionThreshold::set_vectorise)
+      .add_property("streaming",
+                    &DispersionThreshold::get_streaming,
+                    &DispersionThreshold::set_streaming)
+      .def("__call__", &threshold_nogil<DispersionThreshold, int>)
+      .def("__call__", &threshold_nogil<DispersionThreshold, float>)
+      .def("__call__", &threshold_nogil<DispersionThreshold, double>)
+      .def("__call__", &threshold_w_gain_nogil<DispersionThreshold, int>)
+      .def("__call__", &threshold_w_gain_nogil<DispersionThreshold, float>)
+      .def("__call__", &threshold_w_gain_nogil<DispersionThreshold, double>);
 
     class_<DispersionThresholdDebug>("DispersionThresholdDebug", no_init)
       .def(init<const af::const_ref<double, af::c_grid<2> > &,
@@ -78,13 +156,15 @@ namespace dials { namespace algorithms { namespace boost_python {
                 double,
                 double,
                 double,
-                int>((arg("image"),
+                int,
+                std::size_t>((arg("image"),
                       arg("mask"),
                       arg("size"),
                       arg("n_sigma_b"),
                       arg("n_sigma_s"),
                       arg("threshold"),
-                      arg("min_count"))))
+                      arg("min_count"),
+                      arg("nthreads") = 1)))
       .def(init<const af::const_ref<double, af::c_grid<2> > &,
                 const af::const_ref<bool, af::c_grid<2> > &,
                 const af::const_ref<double, af::c_grid<2> > &,
@@ -92,14 +172,16 @@ namespace dials { namespace algorithms { namespace boost_python {
                 double,
                 double,
                 double,
-                int>((arg("image"),
+                int,
+                std::size_t>((arg("image"),
                       arg("mask"),
                       arg("gain"),
                       arg("size"),
                       arg("n_sigma_b"),
                       arg("n_sigma_s"),
                       arg("threshold"),
-                      arg("min_count"))))
+                      arg("min_count"),
+                      arg("nthreads") = 1)))
       .def("mean", &DispersionThresholdDebug::mean)
       .def("variance", &DispersionThresholdDebug::variance)
       .def("index_of_dispersion", &DispersionThresholdDebug::index_of_dispersion)
@@ -116,13 +198,15 @@ namespace dials { namespace algorithms { namespace boost_python {
                 double,
                 double,
                 double,
-                int>((arg("image"),
+                int,
+                std::size_t>((arg("image"),
                       arg("mask"),
                       arg("size"),
                       arg("n_sigma_b"),
                       arg("n_sigma_s"),
                       arg("threshold"),
-                      arg("min_count"))))
+                      arg("min_count"),
+                      arg("nthreads") = 1)))
       .def(init<const af::const_ref<double, af::c_grid<2> > &,
                 const af::const_ref<bool, af::c_grid<2> > &,
                 const af::const_ref<double, af::c_grid<2> > &,
@@ -130,14 +214,16 @@ namespace dials { namespace algorithms { namespace boost_python {
                 double,
                 double,
                 double,
-                int>((arg("image"),
+                int,
+                std::size_t>((arg("image"),
                       arg("mask"),
                       arg("gain"),
                       arg("size"),
                       arg("n_sigma_b"),
                       arg("n_sigma_s"),
                       arg("threshold"),
-                      arg("min_count"))))
+                      arg("min_count"),
+                      arg("nthreads") = 1)))
       .def("mean", &DispersionExtendedThresholdDebug::mean)
       .def("variance", &DispersionExtendedThresholdDebug::variance)
       .def("index_of_dispersion",
@@ -150,9 +236,22 @@ namespace dials { namespace algorithms { namespace boost_python {
     class_<DispersionExtendedThreshold>("DispersionExtendedThreshold", no_init)
       .def(init<int2, int2, double, double, double, int>())
       /* .def("__call__", &DispersionExtendedThreshold::threshold<int>) */
-      .def("__call__", &DispersionExtendedThreshold::threshold<double>)
+      .def("__call__", &threshold_nogil<DispersionExtendedThreshold, double>)
       /* .def("__call__", &DispersionExtendedThreshold::threshold_w_gain<int>) */
-      .def("__call__", &DispersionExtendedThreshold::threshold_w_gain<double>);
+      .def("__call__",
+           &threshold_w_gain_nogil<DispersionExtendedThreshold, double>);
+
+    tiled_threshold_wrapper<DispersionThreshold>("TiledDispersionThreshold")
+      .def("__call__", &threshold_nogil<TiledThreshold<DispersionThreshold>, int>)
+      .def("__call__", &threshold_nogil<TiledThreshold<DispersionThreshold>, float>)
+      .def("__call__",
+           &threshold_w_gain_nogil<TiledThreshold<DispersionThreshold>, int>)
+      .def("__call__",
+           &threshold_w_gain_nogil<TiledThreshold<DispersionThreshold>, float>)
+      .def("__call__", &TiledThreshold_multi_panel<DispersionThreshold, int>)
+      .def("__call__", &TiledThreshold_multi_panel<DispersionThreshold, float>);
+    tiled_threshold_wrapper<DispersionExtendedThreshold>(
+      "TiledDispersionExtendedThreshold");
   }
 
 }}}  // namespace dials::algorithms::boost_python
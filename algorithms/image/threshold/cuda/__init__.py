@@ -0,0 +1,5 @@
+from __future__ import absolute_import, division, print_function
+
+from dials_algorithms_image_threshold_cuda_ext import *  # noqa: F403; lgtm
+
+__all__ = ("DispersionExtendedThreshold", "is_available")  # noqa: F405
@@ -0,0 +1,178 @@
+/*
+ * dispersion_extended.cu
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <string>
+#include <cuda_runtime.h>
+#include <dials/algorithms/image/threshold/cuda/dispersion_extended.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms { namespace cuda {
+
+  namespace {
+
+    /**
+     * Raise an exception if a CUDA call fails
+     */
+    void check_error(cudaError_t status) {
+      if (status != cudaSuccess) {
+        throw DIALS_ERROR(std::string("CUDA error: ") + cudaGetErrorString(status));
+      }
+    }
+
+    /**
+     * Allocate a device buffer
+     */
+    template <typename T>
+    T *device_alloc(std::size_t size) {
+      void *ptr = 0;
+      check_error(cudaMalloc(&ptr, size * sizeof(T)));
+      return static_cast<T *>(ptr);
+    }
+
+    __global__ void dispersion_kernel(DispersionExtendedParameters p,
+                                      const double *src,
+                                      const bool *mask,
+                                      const double *gain,
+                                      bool *dispersion) {
+      int i = blockIdx.x * blockDim.x + threadIdx.x;
+      int j = blockIdx.y * blockDim.y + threadIdx.y;
+      if (i < p.xsize && j < p.ysize) {
+        dispersion[j * p.xsize + i] = dispersion_pixel(p, src, mask, gain, i, j);
+      }
+    }
+
+    __global__ void erode_kernel(DispersionExtendedParameters p,
+                                 const bool *mask,
+                                 const bool *dispersion,
+                                 bool *background) {
+      int i = blockIdx.x * blockDim.x + threadIdx.x;
+      int j = blockIdx.y * blockDim.y + threadIdx.y;
+      if (i < p.xsize && j < p.ysize) {
+        background[j * p.xsize + i] = erode_pixel(p, mask, dispersion, i, j);
+      }
+    }
+
+    __global__ void final_kernel(DispersionExtendedParameters p,
+                                 const double *src,
+                                 const bool *mask,
+                                 const double *gain,
+                                 const bool *background,
+                                 bool *dst) {
+      int i = blockIdx.x * blockDim.x + threadIdx.x;
+      int j = blockIdx.y * blockDim.y + threadIdx.y;
+      if (i < p.xsize && j < p.ysize) {
+        dst[j * p.xsize + i] = final_pixel(p, src, mask, gain, background, i, j);
+      }
+    }
+
+  }  // namespace
+
+  DispersionExtendedThreshold::DispersionExtendedThreshold(int xsize,
+                                                           int ysize,
+                                                           int kxsize,
+                                                           int kysize,
+                                                           double nsig_b,
+                                                           double nsig_s,
+                                                           double threshold,
+                                                           int min_count)
+      : size_(0),
+        src_(0),
+        mask_(0),
+        gain_(0),
+        dispersion_(0),
+        background_(0),
+        dst_(0) {
+    DIALS_ASSERT(xsize > 0 && ysize > 0);
+    DIALS_ASSERT(kxsize > 0 && kysize > 0);
+    DIALS_ASSERT(nsig_b >= 0 && nsig_s >= 0);
+    DIALS_ASSERT(threshold >= 0);
+
+    // Set the minimum count in the same way as the CPU implementation
+    int num_kernel = (2 * kxsize + 1) * (2 * kysize + 1);
+    if (min_count <= 0) {
+      min_count = num_kernel;
+    } else {
+      DIALS_ASSERT(min_count <= num_kernel && min_count > 1);
+    }
+
+    params_.xsize = xsize;
+    params_.ysize = ysize;
+    params_.kxsize = kxsize;
+    params_.kysize = kysize;
+    params_.nsig_b = nsig_b;
+    params_.nsig_s = nsig_s;
+    params_.threshold = threshold;
+    params_.min_count = min_count;
+    size_ = (std::size_t)xsize * (std::size_t)ysize;
+
+    try {
+      src_ = device_alloc<double>(size_);
+      mask_ = device_alloc<bool>(size_);
+      gain_ = device_alloc<double>(size_);
+      dispersion_ = device_alloc<bool>(size_);
+      background_ = device_alloc<bool>(size_);
+      dst_ = device_alloc<bool>(size_);
+    } catch (...) {
+      free_buffers();
+      throw;
+    }
+  }
+
+  DispersionExtendedThreshold::~DispersionExtendedThreshold() {
+    free_buffers();
+  }
+
+  void DispersionExtendedThreshold::free_buffers() {
+    cudaFree(src_);
+    cudaFree(mask_);
+    cudaFree(gain_);
+    cudaFree(dispersion_);
+    cudaFree(background_);
+    cudaFree(dst_);
+  }
+
+  void DispersionExtendedThreshold::threshold(const double *src,
+                                              const bool *mask,
+                                              const double *gain,
+                                              bool *dst) {
+    DIALS_ASSERT(src != 0 && mask != 0 && dst != 0);
+
+    // Copy the input to the device
+    check_error(
+      cudaMemcpy(src_, src, size_ * sizeof(double), cudaMemcpyHostToDevice));
+    check_error(
+      cudaMemcpy(mask_, mask, size_ * sizeof(bool), cudaMemcpyHostToDevice));
+    const double *device_gain = 0;
+    if (gain != 0) {
+      check_error(
+        cudaMemcpy(gain_, gain, size_ * sizeof(double), cudaMemcpyHostToDevice));
+      device_gain = gain_;
+    }
+
+    // Run the three passes of the algorithm
+    dim3 block(16, 16);
+    dim3 grid((params_.xsize + block.x - 1) / block.x,
+              (params_.ysize + block.y - 1) / block.y);
+    dispersion_kernel<<<grid, block>>>(params_, src_, mask_, device_gain, dispersion_);
+    check_error(cudaGetLastError());
+    erode_kernel<<<grid, block>>>(params_, mask_, dispersion_, background_);
+    check_error(cudaGetLastError());
+    final_kernel<<<grid, block>>>(
+      params_, src_, mask_, device_gain, background_, dst_);
+    check_error(cudaGetLastError());
+
+    // Copy the result back to the host
+    check_error(cudaMemcpy(dst, dst_, size_ * sizeof(bool), cudaMemcpyDeviceToHost));
+  }
+
+  bool is_available() {
+    int count = 0;
+    return cudaGetDeviceCount(&count) == cudaSuccess && count > 0;
+  }
+
+}}}  // namespace dials::algorithms::cuda
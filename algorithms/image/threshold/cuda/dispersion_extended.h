@@ -0,0 +1,90 @@
+/*
+ * dispersion_extended.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_CUDA_DISPERSION_EXTENDED_H
+#define DIALS_ALGORITHMS_IMAGE_THRESHOLD_CUDA_DISPERSION_EXTENDED_H
+
+#include <cstddef>
+#include <dials/algorithms/image/threshold/cuda/dispersion_extended_kernels.h>
+
+namespace dials { namespace algorithms { namespace cuda {
+
+  /**
+   * A class to compute the extended dispersion threshold on the GPU. The
+   * algorithm is the same as DispersionExtendedThreshold. The interface uses
+   * plain pointers so that the header can be included by code which is not
+   * compiled with nvcc.
+   */
+  class DispersionExtendedThreshold {
+  public:
+    /**
+     * Allocate the device buffers
+     * @param xsize The image width
+     * @param ysize The image height
+     * @param kxsize The half width of the kernel
+     * @param kysize The half height of the kernel
+     * @param nsig_b The background threshold.
+     * @param nsig_s The strong pixel threshold
+     * @param threshold The global threshold value
+     * @param min_count The minimum number of pixels in the local area
+     */
+    DispersionExtendedThreshold(int xsize,
+                                int ysize,
+                                int kxsize,
+                                int kysize,
+                                double nsig_b,
+                                double nsig_s,
+                                double threshold,
+                                int min_count);
+
+    /**
+     * Free the device buffers
+     */
+    ~DispersionExtendedThreshold();
+
+    /**
+     * Compute the threshold
+     * @param src The input image (ysize * xsize)
+     * @param mask The input mask
+     * @param gain The gain map (or NULL to use a gain of 1)
+     * @param dst The output mask
+     */
+    void threshold(const double *src, const bool *mask, const double *gain, bool *dst);
+
+    /**
+     * @returns The parameters of the algorithm
+     */
+    const DispersionExtendedParameters &parameters() const {
+      return params_;
+    }
+
+  private:
+    // Non copyable
+    DispersionExtendedThreshold(const DispersionExtendedThreshold &);
+    DispersionExtendedThreshold &operator=(const DispersionExtendedThreshold &);
+
+    void free_buffers();
+
+    DispersionExtendedParameters params_;
+    std::size_t size_;
+    double *src_;
+    bool *mask_;
+    double *gain_;
+    bool *dispersion_;
+    bool *background_;
+    bool *dst_;
+  };
+
+  /**
+   * @returns True if a CUDA device is available
+   */
+  bool is_available();
+
+}}}  // namespace dials::algorithms::cuda
+
+#endif  // DIALS_ALGORITHMS_IMAGE_THRESHOLD_CUDA_DISPERSION_EXTENDED_H
@@ -0,0 +1,181 @@
+/*
+ * dispersion_extended_kernels.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_CUDA_DISPERSION_EXTENDED_KERNELS_H
+#define DIALS_ALGORITHMS_IMAGE_THRESHOLD_CUDA_DISPERSION_EXTENDED_KERNELS_H
+
+#include <cmath>
+
+#ifdef __CUDACC__
+#define DIALS_HOST_DEVICE __host__ __device__
+#else
+#define DIALS_HOST_DEVICE
+#endif
+
+namespace dials { namespace algorithms { namespace cuda {
+
+  /**
+   * The parameters of the extended dispersion threshold
+   */
+  struct DispersionExtendedParameters {
+    int xsize;
+    int ysize;
+    int kxsize;
+    int kysize;
+    double nsig_b;
+    double nsig_s;
+    double threshold;
+    int min_count;
+  };
+
+  /**
+   * Compute the number of valid points, the sum of the pixel values and the
+   * sum of the squared pixel values in the local area around a pixel. The
+   * local area is clipped at the image edges in the same way as the summed
+   * area table in DispersionExtendedThreshold. A pixel is valid if the mask is
+   * set and its value is below the same large value cut off. For integer
+   * valued images the sums are exact so the results are identical to the
+   * summed area table.
+   */
+  DIALS_HOST_DEVICE inline void local_sums(const double *src,
+                                           const bool *mask,
+                                           int xsize,
+                                           int ysize,
+                                           int i,
+                                           int j,
+                                           int kxsize,
+                                           int kysize,
+                                           int &m,
+                                           double &x,
+                                           double &y) {
+    const double BIG = (1 << 24);  // About 16m counts
+    int j0 = j - kysize > 0 ? j - kysize : 0;
+    int j1 = j + kysize < ysize - 1 ? j + kysize : ysize - 1;
+    int i0 = i - kxsize > 0 ? i - kxsize : 0;
+    int i1 = i + kxsize < xsize - 1 ? i + kxsize : xsize - 1;
+    m = 0;
+    x = 0;
+    y = 0;
+    for (int jj = j0; jj <= j1; ++jj) {
+      for (int ii = i0; ii <= i1; ++ii) {
+        int k = jj * xsize + ii;
+        if (mask[k] && src[k] < BIG) {
+          m += 1;
+          x += src[k];
+          y += src[k] * src[k];
+        }
+      }
+    }
+  }
+
+  /**
+   * Compute the dispersion mask for a pixel. The result is true if the pixel
+   * is above the dispersion threshold.
+   */
+  DIALS_HOST_DEVICE inline bool dispersion_pixel(
+    const DispersionExtendedParameters &p,
+    const double *src,
+    const bool *mask,
+    const double *gain,
+    int i,
+    int j) {
+    int k = j * p.xsize + i;
+    int mi = 0;
+    double x = 0;
+    double y = 0;
+    local_sums(src, mask, p.xsize, p.ysize, i, j, p.kxsize, p.kysize, mi, x, y);
+    double m = mi;
+    if (mask[k] && m >= p.min_count && x >= 0) {
+      if (gain == 0) {
+        double a = m * y - x * x - x * (m - 1);
+        double c = x * p.nsig_b * std::sqrt(2 * (m - 1));
+        return a > c;
+      } else {
+        double a = m * y - x * x;
+        double c = gain[k] * x * (m - 1 + p.nsig_b * std::sqrt(2 * (m - 1)));
+        return a > c;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Erode the dispersion mask at a pixel. The pixel remains part of the
+   * dispersion mask only if no pixel outside the dispersion mask is closer
+   * than the erosion distance (in the chebyshev metric). The result is true
+   * if the pixel is valid background.
+   */
+  DIALS_HOST_DEVICE inline bool erode_pixel(const DispersionExtendedParameters &p,
+                                            const bool *mask,
+                                            const bool *dispersion,
+                                            int i,
+                                            int j) {
+    int k = j * p.xsize + i;
+    if (!mask[k]) {
+      return false;
+    }
+    if (!dispersion[k]) {
+      return true;
+    }
+    int distance = p.kxsize < p.kysize ? p.kxsize : p.kysize;
+    int r = distance - 1;
+    int j0 = j - r > 0 ? j - r : 0;
+    int j1 = j + r < p.ysize - 1 ? j + r : p.ysize - 1;
+    int i0 = i - r > 0 ? i - r : 0;
+    int i1 = i + r < p.xsize - 1 ? i + r : p.xsize - 1;
+    for (int jj = j0; jj <= j1; ++jj) {
+      for (int ii = i0; ii <= i1; ++ii) {
+        if (!dispersion[jj * p.xsize + ii]) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Compute the final threshold for a pixel using the local mean of the
+   * valid background pixels in the extended kernel.
+   */
+  DIALS_HOST_DEVICE inline bool final_pixel(const DispersionExtendedParameters &p,
+                                            const double *src,
+                                            const bool *mask,
+                                            const double *gain,
+                                            const bool *background,
+                                            int i,
+                                            int j) {
+    int k = j * p.xsize + i;
+    int mi = 0;
+    double x = 0;
+    double y = 0;
+    local_sums(src,
+               background,
+               p.xsize,
+               p.ysize,
+               i,
+               j,
+               p.kxsize + 2,
+               p.kysize + 2,
+               mi,
+               x,
+               y);
+    double m = mi;
+    if (mask[k] && m >= 0 && x >= 0) {
+      bool dispersion_mask = !background[k];
+      bool global_mask = src[k] > p.threshold;
+      double mean = (m >= 2 ? (x / m) : 0);
+      double variance = (gain == 0 ? mean : gain[k] * mean);
+      bool local_mask = src[k] >= (mean + p.nsig_s * std::sqrt(variance));
+      return dispersion_mask && global_mask && local_mask;
+    }
+    return false;
+  }
+
+}}}  // namespace dials::algorithms::cuda
+
+#endif  // DIALS_ALGORITHMS_IMAGE_THRESHOLD_CUDA_DISPERSION_EXTENDED_KERNELS_H
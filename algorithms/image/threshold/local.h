@@ -11,15 +11,18 @@
 #ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H
 #define DIALS_ALGORITHMS_IMAGE_THRESHOLD_UNIMODAL_H
 
+#include <algorithm>
 #include <cmath>
 #include <vector>
 #include <iostream>
+#include <boost/cstdint.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <dials/error.h>
 #include <dials/algorithms/image/filter/mean_and_variance.h>
 #include <dials/algorithms/image/filter/index_of_dispersion_filter.h>
 #include <dials/algorithms/image/filter/distance.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 
 namespace dials { namespace algorithms {
 
@@ -344,6 +347,37 @@ namespace dials { namespace algorithms {
     return result;
   }
 
+  /**
+   * The types used to accumulate the sum and the sum of squares in the summed
+   * area table for each type of input image. Integer images are summed exactly
+   * in 64 bit integers, with the squares summed in double precision, so raw
+   * detector frames can be thresholded without first converting the whole
+   * image to double.
+   */
+  template <typename T>
+  struct DispersionSumTraits {
+    typedef T sum_type;
+    typedef T sum_sq_type;
+  };
+
+  template <>
+  struct DispersionSumTraits<int> {
+    typedef boost::int64_t sum_type;
+    typedef double sum_sq_type;
+  };
+
+  template <>
+  struct DispersionSumTraits<unsigned short> {
+    typedef boost::int64_t sum_type;
+    typedef double sum_sq_type;
+  };
+
+  template <>
+  struct DispersionSumTraits<float> {
+    typedef double sum_type;
+    typedef double sum_sq_type;
+  };
+
   /**
    * A class to compute the threshold using index of dispersion
    */
@@ -355,9 +389,18 @@ namespace dials { namespace algorithms {
      */
     template <typename T>
     struct Data {
+      typedef typename DispersionSumTraits<T>::sum_type sum_type;
+      typedef typename DispersionSumTraits<T>::sum_sq_type sum_sq_type;
       int m;
-      T x;
-      T y;
+      sum_type x;
+      sum_sq_type y;
+
+      Data &operator+=(const Data &other) {
+        m += other.m;
+        x += other.x;
+        y += other.y;
+        return *this;
+      }
     };
 
     DispersionThreshold(int2 image_size,
@@ -371,7 +414,9 @@ namespace dials { namespace algorithms {
           nsig_b_(nsig_b),
           nsig_s_(nsig_s),
           threshold_(threshold),
-          min_count_(min_count) {
+          min_count_(min_count),
+          vectorise_(true),
+          streaming_(false) {
       // Check the input
       DIALS_ASSERT(threshold_ >= 0);
       DIALS_ASSERT(nsig_b >= 0 && nsig_s >= 0);
@@ -386,9 +431,56 @@ namespace dials { namespace algorithms {
         DIALS_ASSERT(min_count_ <= num_kernel && min_count_ > 1);
       }
 
-      // Allocate the buffer
-      std::size_t element_size = sizeof(Data<double>);
-      buffer_.resize(element_size * image_size[0] * image_size[1]);
+      // Allocate the row and column buffers. The summed area table buffer
+      // is allocated when first needed so that it is not allocated at all
+      // when streaming.
+      row_m_.resize(image_size[1]);
+      row_x_.resize(image_size[1]);
+      row_y_.resize(image_size[1]);
+      col_m_.resize(image_size[1]);
+      col_x_.resize(image_size[1]);
+      col_y_.resize(image_size[1]);
+    }
+
+    /**
+     * The number of pixels around a region of the image which are needed to
+     * compute the threshold for the region identically to the full image.
+     * @param kernel_size The kernel size
+     * @returns The size of the border
+     */
+    static int2 halo(int2 kernel_size) {
+      return kernel_size;
+    }
+
+    /**
+     * Set whether to use the row based kernel or the pixel by pixel kernel
+     * @param vectorise True/False use the row based kernel
+     */
+    void set_vectorise(bool vectorise) {
+      vectorise_ = vectorise;
+    }
+
+    /**
+     * @returns True/False use the row based kernel
+     */
+    bool get_vectorise() const {
+      return vectorise_;
+    }
+
+    /**
+     * Set whether to compute the local sums from running column sums rather
+     * than from a summed area table of the whole image
+     * @param streaming True/False use the running column sums
+     */
+    void set_streaming(bool streaming) {
+      streaming_ = streaming;
+    }
+
+    /**
+     * @returns True/False use the running column sums
+     */
+    bool get_streaming() const {
+      return streaming_;
     }
 
     /**
@@ -400,47 +492,38 @@ namespace dials { namespace algorithms {
     void compute_sat(af::ref<Data<T> > table,
                      const af::const_ref<T, af::c_grid<2> > &src,
                      const af::const_ref<bool, af::c_grid<2> > &mask) {
+      typedef typename Data<T>::sum_type sum_type;
+      typedef typename Data<T>::sum_sq_type sum_sq_type;
+
       // Largest value to consider
-      const T BIG = (1 << 24);  // About 16m counts
+      const double BIG = (1 << 24);  // About 16m counts
 
       // Get the size of the image
       std::size_t ysize = src.accessor()[0];
       std::size_t xsize = src.accessor()[1];
 
-      // Create the summed area table
-      for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-        int m = 0;
-        T x = 0;
-        T y = 0;
-        for (std::size_t i = 0; i < xsize; ++i, ++k) {
-          int mm = (mask[k] && src[k] < BIG) ? 1 : 0;
-          m += mm;
-          x += mm * src[k];
-          y += mm * src[k] * src[k];
-          if (j == 0) {
-            table[k].m = m;
-            table[k].x = x;
-            table[k].y = y;
-          } else {
-            table[k].m = table[k - xsize].m + m;
-            table[k].x = table[k - xsize].x + x;
-            table[k].y = table[k - xsize].y + y;
-          }
-        }
+      // Fill the table with the masked values and make the summed area table
+      for (std::size_t k = 0; k < ysize * xsize; ++k) {
+        int mm = (mask[k] && src[k] < BIG) ? 1 : 0;
+        table[k].m = mm;
+        table[k].x = mm * (sum_type)src[k];
+        table[k].y = mm * (sum_sq_type)src[k] * src[k];
       }
+      summed_area_table_in_place(
+        af::ref<Data<T>, af::c_grid<2> >(&table[0], af::c_grid<2>(ysize, xsize)));
     }
 
     /**
-     * Compute the threshold
+     * Compute the threshold one pixel at a time
      * @param src - The input array
      * @param mask - The mask array
      * @param dst The output array
      */
     template <typename T>
-    void compute_threshold(af::ref<Data<T> > table,
-                           const af::const_ref<T, af::c_grid<2> > &src,
-                           const af::const_ref<bool, af::c_grid<2> > &mask,
-                           af::ref<bool, af::c_grid<2> > dst) {
+    void compute_threshold_scalar(af::ref<Data<T> > table,
+                                  const af::const_ref<T, af::c_grid<2> > &src,
+                                  const af::const_ref<bool, af::c_grid<2> > &mask,
+                                  af::ref<bool, af::c_grid<2> > dst) {
       // Get the size of the image
       std::size_t ysize = src.accessor()[0];
       std::size_t xsize = src.accessor()[1];
@@ -502,18 +585,18 @@ namespace dials { namespace algorithms {
     }
 
     /**
-     * Compute the threshold
+     * Compute the threshold one pixel at a time
      * @param src - The input array
      * @param mask - The mask array
      * @param gain - The gain array
      * @param dst The output array
      */
     template <typename T>
-    void compute_threshold(af::ref<Data<T> > table,
-                           const af::const_ref<T, af::c_grid<2> > &src,
-                           const af::const_ref<bool, af::c_grid<2> > &mask,
-                           const af::const_ref<double, af::c_grid<2> > &gain,
-                           af::ref<bool, af::c_grid<2> > dst) {
+    void compute_threshold_scalar(af::ref<Data<T> > table,
+                                  const af::const_ref<T, af::c_grid<2> > &src,
+                                  const af::const_ref<bool, af::c_grid<2> > &mask,
+                                  const af::const_ref<double, af::c_grid<2> > &gain,
+                                  af::ref<bool, af::c_grid<2> > dst) {
       // Get the size of the image
       std::size_t ysize = src.accessor()[0];
       std::size_t xsize = src.accessor()[1];
@@ -574,6 +657,373 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Compute the number of valid points, the sum of the pixel values and the
+     * sum of the squared pixel values in the local area for each pixel in a
+     * row. Pixels whose kernel lies entirely within the image need no bounds
+     * checks so are computed in a branch free loop which the compiler can
+     * vectorise. The remaining pixels are computed in the same way as the
+     * scalar code.
+     * @param table The summed area table
+     * @param j The row index
+     * @param xsize The number of columns
+     * @param ysize The number of rows
+     * @param m The number of valid points
+     * @param x The sum of the pixel values
+     * @param y The sum of the squared pixel values
+     */
+    template <typename T>
+    void compute_local_sums(const af::ref<Data<T> > &table,
+                            int j,
+                            int xsize,
+                            int ysize,
+                            double *m,
+                            double *x,
+                            double *y) const {
+      // The kernel size
+      int kxsize = kernel_size_[1];
+      int kysize = kernel_size_[0];
+
+      // The rows of the summed area table
+      int j0 = j - kysize - 1;
+      int j1 = std::min(j + kysize, ysize - 1);
+      int k0 = j0 * xsize;
+      int k1 = j1 * xsize;
+
+      // The range of pixels with no clipping in x
+      int ilow = kxsize + 1;
+      int ihigh = xsize - kxsize;
+      if (j0 < 0 || ihigh <= ilow) {
+        ilow = ihigh = xsize;
+      }
+
+      // The interior of the row. The pointers are only formed when there is an
+      // interior, at the corners of the kernel of its first pixel, so that they
+      // always point into the table.
+      if (ilow < ihigh) {
+        int n = ihigh - ilow;
+        const Data<T> *d00 = &table[k0 + ilow - kxsize - 1];
+        const Data<T> *d01 = &table[k0 + ilow + kxsize];
+        const Data<T> *d10 = &table[k1 + ilow - kxsize - 1];
+        const Data<T> *d11 = &table[k1 + ilow + kxsize];
+        double *mi = m + ilow;
+        double *xi = x + ilow;
+        double *yi = y + ilow;
+        for (int i = 0; i < n; ++i) {
+          mi[i] = (double)(d00[i].m - (d10[i].m + d01[i].m)) + d11[i].m;
+          xi[i] = (double)(d00[i].x - (d10[i].x + d01[i].x)) + d11[i].x;
+          yi[i] = (double)(d00[i].y - (d10[i].y + d01[i].y)) + d11[i].y;
+        }
+      }
+
+      // The borders of the row
+      for (int i = 0; i < xsize; ++i) {
+        if (i == ilow) {
+          i = ihigh;
+          if (i >= xsize) {
+            break;
+          }
+        }
+        int i0 = i - kxsize - 1;
+        int i1 = std::min(i + kxsize, xsize - 1);
+        double mm = 0;
+        double xx = 0;
+        double yy = 0;
+        if (i0 >= 0 && j0 >= 0) {
+          const Data<T> &e00 = table[k0 + i0];
+          const Data<T> &e10 = table[k1 + i0];
+          const Data<T> &e01 = table[k0 + i1];
+          mm += e00.m - (e10.m + e01.m);
+          xx += e00.x - (e10.x + e01.x);
+          yy += e00.y - (e10.y + e01.y);
+        } else if (i0 >= 0) {
+          const Data<T> &e10 = table[k1 + i0];
+          mm -= e10.m;
+          xx -= e10.x;
+          yy -= e10.y;
+        } else if (j0 >= 0) {
+          const Data<T> &e01 = table[k0 + i1];
+          mm -= e01.m;
+          xx -= e01.x;
+          yy -= e01.y;
+        }
+        const Data<T> &e11 = table[k1 + i1];
+        m[i] = mm + e11.m;
+        x[i] = xx + e11.x;
+        y[i] = yy + e11.y;
+      }
+    }
+
+    /**
+     * Compute the threshold for a row of pixels from the local sums
+     * @param xsize The number of pixels in the row
+     * @param m The number of valid points
+     * @param x The sum of the pixel values
+     * @param y The sum of the squared pixel values
+     * @param src The row of the input array
+     * @param mask The row of the mask array
+     * @param dst The row of the output array
+     */
+    template <typename T>
+    void compute_row_threshold(int xsize,
+                               const double *m,
+                               const double *x,
+                               const double *y,
+                               const T *src,
+                               const bool *mask,
+                               bool *dst) const {
+      for (int i = 0; i < xsize; ++i) {
+        bool valid = mask[i] & (m[i] >= min_count_) & (x[i] >= 0)
+                     & (src[i] > threshold_);
+        double a = m[i] * y[i] - x[i] * x[i] - x[i] * (m[i] - 1);
+        double b = m[i] * src[i] - x[i];
+        double c = x[i] * nsig_b_ * std::sqrt(2 * (m[i] - 1));
+        double d = nsig_s_ * std::sqrt(x[i] * m[i]);
+        dst[i] = valid & (a > c) & (b > d);
+      }
+    }
+
+    /**
+     * Compute the threshold for a row of pixels from the local sums
+     * @param xsize The number of pixels in the row
+     * @param m The number of valid points
+     * @param x The sum of the pixel values
+     * @param y The sum of the squared pixel values
+     * @param src The row of the input array
+     * @param mask The row of the mask array
+     * @param gain The row of the gain array
+     * @param dst The row of the output array
+     */
+    template <typename T>
+    void compute_row_threshold(int xsize,
+                               const double *m,
+                               const double *x,
+                               const double *y,
+                               const T *src,
+                               const bool *mask,
+                               const double *gain,
+                               bool *dst) const {
+      for (int i = 0; i < xsize; ++i) {
+        bool valid = mask[i] & (m[i] >= min_count_) & (x[i] >= 0)
+                     & (src[i] > threshold_);
+        double a = m[i] * y[i] - x[i] * x[i];
+        double b = m[i] * src[i] - x[i];
+        double c = gain[i] * x[i] * (m[i] - 1 + nsig_b_ * std::sqrt(2 * (m[i] - 1)));
+        double d = nsig_s_ * std::sqrt(gain[i] * x[i] * m[i]);
+        dst[i] = valid & (a > c) & (b > d);
+      }
+    }
+
+    /**
+     * Compute the threshold a row at a time
+     * @param src - The input array
+     * @param mask - The mask array
+     * @param dst The output array
+     */
+    template <typename T>
+    void compute_threshold_vectorised(af::ref<Data<T> > table,
+                                      const af::const_ref<T, af::c_grid<2> > &src,
+                                      const af::const_ref<bool, af::c_grid<2> > &mask,
+                                      af::ref<bool, af::c_grid<2> > dst) {
+      int ysize = src.accessor()[0];
+      int xsize = src.accessor()[1];
+      for (int j = 0; j < ysize; ++j) {
+        compute_local_sums(table, j, xsize, ysize, &row_m_[0], &row_x_[0], &row_y_[0]);
+        compute_row_threshold(xsize,
+                              &row_m_[0],
+                              &row_x_[0],
+                              &row_y_[0],
+                              &src[j * xsize],
+                              &mask[j * xsize],
+                              &dst[j * xsize]);
+      }
+    }
+
+    /**
+     * Compute the threshold a row at a time
+     * @param src - The input array
+     * @param mask - The mask array
+     * @param gain - The gain array
+     * @param dst The output array
+     */
+    template <typename T>
+    void compute_threshold_vectorised(af::ref<Data<T> > table,
+                                      const af::const_ref<T, af::c_grid<2> > &src,
+                                      const af::const_ref<bool, af::c_grid<2> > &mask,
+                                      const af::const_ref<double, af::c_grid<2> > &gain,
+                                      af::ref<bool, af::c_grid<2> > dst) {
+      int ysize = src.accessor()[0];
+      int xsize = src.accessor()[1];
+      for (int j = 0; j < ysize; ++j) {
+        compute_local_sums(table, j, xsize, ysize, &row_m_[0], &row_x_[0], &row_y_[0]);
+        compute_row_threshold(xsize,
+                              &row_m_[0],
+                              &row_x_[0],
+                              &row_y_[0],
+                              &src[j * xsize],
+                              &mask[j * xsize],
+                              &gain[j * xsize],
+                              &dst[j * xsize]);
+      }
+    }
+
+    /**
+     * Add or subtract a row of the image to the running column sums
+     * @param src - The input array
+     * @param mask - The mask array
+     * @param j The row index
+     * @param sign +1 to add the row or -1 to subtract it
+     */
+    template <typename T>
+    void update_column_sums(const af::const_ref<T, af::c_grid<2> > &src,
+                            const af::const_ref<bool, af::c_grid<2> > &mask,
+                            int j,
+                            int sign) {
+      // Largest value to consider
+      const double BIG = (1 << 24);  // About 16m counts
+
+      int xsize = src.accessor()[1];
+      const T *s = &src[j * xsize];
+      const bool *msk = &mask[j * xsize];
+      for (int i = 0; i < xsize; ++i) {
+        int mm = (msk[i] && s[i] < BIG) ? sign : 0;
+        double xx = mm * (double)s[i];
+        col_m_[i] += mm;
+        col_x_[i] += xx;
+        col_y_[i] += xx * s[i];
+      }
+    }
+
+    /**
+     * Compute the local sums for each pixel in a row by sliding the kernel
+     * along the running column sums.
+     * @param xsize The number of columns
+     */
+    void compute_row_sums_from_columns(int xsize) {
+      int kxsize = kernel_size_[1];
+      int m = 0;
+      double x = 0;
+      double y = 0;
+      for (int i = 0; i < std::min(kxsize, xsize); ++i) {
+        m += col_m_[i];
+        x += col_x_[i];
+        y += col_y_[i];
+      }
+      for (int i = 0; i < xsize; ++i) {
+        int i1 = i + kxsize;
+        int i0 = i - kxsize - 1;
+        if (i1 < xsize) {
+          m += col_m_[i1];
+          x += col_x_[i1];
+          y += col_y_[i1];
+        }
+        if (i0 >= 0) {
+          m -= col_m_[i0];
+          x -= col_x_[i0];
+          y -= col_y_[i0];
+        }
+        row_m_[i] = m;
+        row_x_[i] = x;
+        row_y_[i] = y;
+      }
+    }
+
+    /**
+     * Compute the threshold without a summed area table. Running sums of the
+     * rows under the kernel are kept for each column and updated as the
+     * kernel moves down the image, so only O(width) memory is needed.
+     * @param src - The input array
+     * @param mask - The mask array
+     * @param gain - The gain array (or NULL)
+     * @param dst The output array
+     */
+    template <typename T>
+    void compute_threshold_streaming(const af::const_ref<T, af::c_grid<2> > &src,
+                                     const af::const_ref<bool, af::c_grid<2> > &mask,
+                                     const double *gain,
+                                     af::ref<bool, af::c_grid<2> > dst) {
+      int ysize = src.accessor()[0];
+      int xsize = src.accessor()[1];
+      int kysize = kernel_size_[0];
+
+      // Initialise the column sums with the rows above the first pixel
+      std::fill(col_m_.begin(), col_m_.end(), 0);
+      std::fill(col_x_.begin(), col_x_.end(), 0);
+      std::fill(col_y_.begin(), col_y_.end(), 0);
+      for (int j = 0; j < std::min(kysize, ysize); ++j) {
+        update_column_sums(src, mask, j, 1);
+      }
+
+      // Move the kernel down the image
+      for (int j = 0; j < ysize; ++j) {
+        int j1 = j + kysize;
+        int j0 = j - kysize - 1;
+        if (j1 < ysize) {
+          update_column_sums(src, mask, j1, 1);
+        }
+        if (j0 >= 0) {
+          update_column_sums(src, mask, j0, -1);
+        }
+        compute_row_sums_from_columns(xsize);
+        if (gain == NULL) {
+          compute_row_threshold(xsize,
+                                &row_m_[0],
+                                &row_x_[0],
+                                &row_y_[0],
+                                &src[j * xsize],
+                                &mask[j * xsize],
+                                &dst[j * xsize]);
+        } else {
+          compute_row_threshold(xsize,
+                                &row_m_[0],
+                                &row_x_[0],
+                                &row_y_[0],
+                                &src[j * xsize],
+                                &mask[j * xsize],
+                                &gain[j * xsize],
+                                &dst[j * xsize]);
+        }
+      }
+    }
+
+    /**
+     * Compute the threshold
+     * @param src - The input array
+     * @param mask - The mask array
+     * @param dst The output array
+     */
+    template <typename T>
+    void compute_threshold(af::ref<Data<T> > table,
+                           const af::const_ref<T, af::c_grid<2> > &src,
+                           const af::const_ref<bool, af::c_grid<2> > &mask,
+                           af::ref<bool, af::c_grid<2> > dst) {
+      if (vectorise_) {
+        compute_threshold_vectorised(table, src, mask, dst);
+      } else {
+        compute_threshold_scalar(table, src, mask, dst);
+      }
+    }
+
+    /**
+     * Compute the threshold
+     * @param src - The input array
+     * @param mask - The mask array
+     * @param gain - The gain array
+     * @param dst The output array
+     */
+    template <typename T>
+    void compute_threshold(af::ref<Data<T> > table,
+                           const af::const_ref<T, af::c_grid<2> > &src,
+                           const af::const_ref<bool, af::c_grid<2> > &mask,
+                           const af::const_ref<double, af::c_grid<2> > &gain,
+                           af::ref<bool, af::c_grid<2> > dst) {
+      if (vectorise_) {
+        compute_threshold_vectorised(table, src, mask, gain, dst);
+      } else {
+        compute_threshold_scalar(table, src, mask, gain, dst);
+      }
+    }
+
     /**
      * Compute the threshold for the given image and mask.
      * @param src - The input image array.
@@ -589,10 +1039,17 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
       DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
 
+      // Compute the threshold without the summed area table
+      if (streaming_) {
+        compute_threshold_streaming(src, mask, (const double *)NULL, dst);
+        return;
+      }
+
       // Get the table
-      DIALS_ASSERT(sizeof(T) <= sizeof(double));
+      DIALS_ASSERT(sizeof(Data<T>) <= sizeof(Data<double>));
 
       // Cast the buffer to the table type
+      allocate_buffer();
       af::ref<Data<T> > table(reinterpret_cast<Data<T> *>(&buffer_[0]), buffer_.size());
 
       // compute the summed area table
@@ -620,10 +1077,17 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(src.accessor().all_eq(gain.accessor()));
       DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
 
+      // Compute the threshold without the summed area table
+      if (streaming_) {
+        compute_threshold_streaming(src, mask, &gain[0], dst);
+        return;
+      }
+
       // Get the table
-      DIALS_ASSERT(sizeof(T) <= sizeof(double));
+      DIALS_ASSERT(sizeof(Data<T>) <= sizeof(Data<double>));
 
       // Cast the buffer to the table type
+      allocate_buffer();
       af::ref<Data<T> > table((Data<T> *)&buffer_[0], buffer_.size());
 
       // compute the summed area table
@@ -634,15 +1098,244 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Allocate the summed area table buffer if it is not already allocated
+     */
+    void allocate_buffer() {
+      if (buffer_.empty()) {
+        std::size_t element_size = sizeof(Data<double>);
+        buffer_.resize(element_size * image_size_[0] * image_size_[1]);
+      }
+    }
+
     int2 image_size_;
     int2 kernel_size_;
     double nsig_b_;
     double nsig_s_;
     double threshold_;
     int min_count_;
+    bool vectorise_;
+    bool streaming_;
     std::vector<char> buffer_;
+    std::vector<double> row_m_;
+    std::vector<double> row_x_;
+    std::vector<double> row_y_;
+    std::vector<int> col_m_;
+    std::vector<double> col_x_;
+    std::vector<double> col_y_;
   };
 
+  namespace detail {
+
+    /**
+     * Compute the maps of the dispersion threshold debug classes for a band
+     * of rows. The masked box sums of the image are found with the same
+     * running sums as the mean and variance filter, written into the mean
+     * and variance maps, and then turned into the mean, sample variance and
+     * index of dispersion maps and the threshold masks in the same pass over
+     * the band, so the maps are only visited once while they are still in
+     * the cache.
+     */
+    class DispersionDebugBand {
+    public:
+      DispersionDebugBand(const af::const_ref<double, af::c_grid<2> > &image_,
+                          const af::const_ref<int, af::c_grid<2> > &mask_,
+                          const double *gain_,
+                          int2 size_,
+                          int min_count_,
+                          double nsig_b_,
+                          double nsig_s_,
+                          double threshold_,
+                          bool value_threshold_,
+                          af::ref<int, af::c_grid<2> > count_,
+                          af::ref<double, af::c_grid<2> > mean_,
+                          af::ref<double, af::c_grid<2> > variance_,
+                          af::ref<double, af::c_grid<2> > cv_,
+                          af::ref<int, af::c_grid<2> > valid_,
+                          af::ref<bool, af::c_grid<2> > cv_mask_,
+                          af::ref<bool, af::c_grid<2> > global_mask_,
+                          af::ref<bool, af::c_grid<2> > value_mask_,
+                          af::ref<bool, af::c_grid<2> > final_mask_)
+          : image(image_),
+            mask(mask_),
+            gain(gain_),
+            size(size_),
+            min_count(min_count_),
+            nsig_b(nsig_b_),
+            nsig_s(nsig_s_),
+            threshold(threshold_),
+            value_threshold(value_threshold_),
+            count(count_),
+            mean(mean_),
+            variance(variance_),
+            cv(cv_),
+            valid(valid_),
+            cv_mask(cv_mask_),
+            global_mask(global_mask_),
+            value_mask(value_mask_),
+            final_mask(final_mask_) {}
+
+      void operator()(int j0, int j1) const {
+        const double BIG = (1 << 24);  // About 1.6m counts
+
+        // The box sums go into the mean and variance maps
+        BoxSumBand<double>(image, &mask, size, count, mean, variance)(j0, j1);
+
+        std::size_t xsize = image.accessor()[1];
+        for (std::size_t i = j0 * xsize; i < j1 * xsize; ++i) {
+          int c = count[i];
+          bool ok = mask[i] && image[i] < BIG && c >= min_count;
+          if (ok) {
+            double s = mean[i];
+            double s2 = variance[i];
+            mean[i] = s / c;
+            variance[i] = (s2 - (s * s / c)) / (c - 1);
+          } else {
+            mean[i] = 0;
+            variance[i] = 0;
+          }
+          if (ok && mean[i] > 0) {
+            cv[i] = variance[i] / mean[i];
+          } else {
+            cv[i] = 1.0;
+            ok = false;
+          }
+          valid[i] = ok;
+          if (ok) {
+            double g = gain != NULL ? gain[i] : 1.0;
+            double bnd_b = g + nsig_b * g * std::sqrt(2.0 / (c - 1));
+            cv_mask[i] = cv[i] > bnd_b;
+            global_mask[i] = image[i] > threshold;
+            if (value_threshold) {
+              double bnd_s = mean[i] + nsig_s * std::sqrt(g * mean[i]);
+              value_mask[i] = image[i] > bnd_s;
+              final_mask[i] = cv_mask[i] && value_mask[i] & global_mask[i];
+            }
+          }
+        }
+      }
+
+    private:
+      af::const_ref<double, af::c_grid<2> > image;
+      af::const_ref<int, af::c_grid<2> > mask;
+      const double *gain;
+      int2 size;
+      int min_count;
+      double nsig_b;
+      double nsig_s;
+      double threshold;
+      bool value_threshold;
+      af::ref<int, af::c_grid<2> > count;
+      af::ref<double, af::c_grid<2> > mean;
+      af::ref<double, af::c_grid<2> > variance;
+      af::ref<double, af::c_grid<2> > cv;
+      af::ref<int, af::c_grid<2> > valid;
+      af::ref<bool, af::c_grid<2> > cv_mask;
+      af::ref<bool, af::c_grid<2> > global_mask;
+      af::ref<bool, af::c_grid<2> > value_mask;
+      af::ref<bool, af::c_grid<2> > final_mask;
+    };
+
+    /**
+     * Compute the maps of the dispersion threshold debug classes
+     * @param image The image array
+     * @param mask The mask array
+     * @param gain The gain array, or NULL for a gain of 1
+     * @param size The size of the local window
+     * @param nsig_b The background threshold.
+     * @param nsig_s The strong pixel threshold
+     * @param threshold The global threshold value
+     * @param min_count The minimum number of pixels in the local area
+     * @param value_threshold Whether to compute the value and final masks
+     * @param nthreads The number of threads to use
+     * @param mean The mean map
+     * @param variance The variance map
+     * @param cv The index of dispersion map
+     * @param valid The pixels with a valid index of dispersion
+     * @param count The number of pixels in the local area
+     * @param cv_mask The thresholded index of dispersion mask
+     * @param global_mask The global mask
+     * @param value_mask The thresholded value mask
+     * @param final_mask The final mask of strong pixels
+     */
+    inline void dispersion_debug_maps(
+      const af::const_ref<double, af::c_grid<2> > &image,
+      const af::const_ref<bool, af::c_grid<2> > &mask,
+      const double *gain,
+      int2 size,
+      double nsig_b,
+      double nsig_s,
+      double threshold,
+      int min_count,
+      bool value_threshold,
+      std::size_t nthreads,
+      af::versa<double, af::c_grid<2> > &mean,
+      af::versa<double, af::c_grid<2> > &variance,
+      af::versa<double, af::c_grid<2> > &cv,
+      af::versa<int, af::c_grid<2> > &valid,
+      af::versa<int, af::c_grid<2> > &count,
+      af::versa<bool, af::c_grid<2> > &cv_mask,
+      af::versa<bool, af::c_grid<2> > &global_mask,
+      af::versa<bool, af::c_grid<2> > &value_mask,
+      af::versa<bool, af::c_grid<2> > &final_mask) {
+      // Check the input
+      DIALS_ASSERT(threshold >= 0);
+      DIALS_ASSERT(nsig_b >= 0 && nsig_s >= 0);
+      DIALS_ASSERT(size.all_gt(0));
+      DIALS_ASSERT(image.accessor().all_gt(0));
+      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
+      DIALS_ASSERT(nthreads > 0);
+
+      // Ensure the min counts are valid
+      int num_kernel = (2 * size[0] + 1) * (2 * size[1] + 1);
+      if (min_count <= 0) {
+        min_count = num_kernel;
+      } else {
+        DIALS_ASSERT(min_count <= num_kernel && min_count > 1);
+      }
+
+      // Copy the mask into a temp variable
+      af::versa<int, af::c_grid<2> > temp(mask.accessor());
+      for (std::size_t i = 0; i < temp.size(); ++i) {
+        temp[i] = mask[i] ? 1 : 0;
+      }
+
+      // Allocate the maps and compute them a band of rows at a time
+      af::c_grid<2> grid = image.accessor();
+      mean = af::versa<double, af::c_grid<2> >(grid, af::init_functor_null<double>());
+      variance =
+        af::versa<double, af::c_grid<2> >(grid, af::init_functor_null<double>());
+      cv = af::versa<double, af::c_grid<2> >(grid, af::init_functor_null<double>());
+      valid = af::versa<int, af::c_grid<2> >(grid, af::init_functor_null<int>());
+      count = af::versa<int, af::c_grid<2> >(grid, af::init_functor_null<int>());
+      cv_mask = af::versa<bool, af::c_grid<2> >(grid, false);
+      global_mask = af::versa<bool, af::c_grid<2> >(grid, false);
+      value_mask = af::versa<bool, af::c_grid<2> >(grid, false);
+      final_mask = af::versa<bool, af::c_grid<2> >(grid, false);
+      for_each_band(DispersionDebugBand(image,
+                                        temp.const_ref(),
+                                        gain,
+                                        size,
+                                        min_count,
+                                        nsig_b,
+                                        nsig_s,
+                                        threshold,
+                                        value_threshold,
+                                        count.ref(),
+                                        mean.ref(),
+                                        variance.ref(),
+                                        cv.ref(),
+                                        valid.ref(),
+                                        cv_mask.ref(),
+                                        global_mask.ref(),
+                                        value_mask.ref(),
+                                        final_mask.ref()),
+                    (int)grid[0],
+                    nthreads);
+    }
+
+  }  // namespace detail
+
   /**
    * A class to help debug spot finding by exposing the results of various bits
    * of processing.
@@ -658,6 +1351,7 @@ namespace dials { namespace algorithms {
      * @param nsig_s The strong pixel threshold
      * @param threshold The global threshold value
      * @param min_count The minimum number of pixels in the local area
+     * @param nthreads The number of threads to use
      */
     DispersionThresholdDebug(const af::const_ref<double, af::c_grid<2> > &image,
                              const af::const_ref<bool, af::c_grid<2> > &mask,
@@ -665,9 +1359,9 @@ namespace dials { namespace algorithms {
                              double nsig_b,
                              double nsig_s,
                              double threshold,
-                             int min_count) {
-      af::versa<double, af::c_grid<2> > gain(image.accessor(), 1.0);
-      init(image, mask, gain.const_ref(), size, nsig_b, nsig_s, threshold, min_count);
+                             int min_count,
+                             std::size_t nthreads = 1) {
+      init(image, mask, NULL, size, nsig_b, nsig_s, threshold, min_count, nthreads);
     }
 
     /**
@@ -679,6 +1373,7 @@ namespace dials { namespace algorithms {
      * @param nsig_s The strong pixel threshold
      * @param threshold The global threshold value
      * @param min_count The minimum number of pixels in the local area
+     * @param nthreads The number of threads to use
      */
     DispersionThresholdDebug(const af::const_ref<double, af::c_grid<2> > &image,
                              const af::const_ref<bool, af::c_grid<2> > &mask,
@@ -687,8 +1382,10 @@ namespace dials { namespace algorithms {
                              double nsig_b,
                              double nsig_s,
                              double threshold,
-                             int min_count) {
-      init(image, mask, gain, size, nsig_b, nsig_s, threshold, min_count);
+                             int min_count,
+                             std::size_t nthreads = 1) {
+      DIALS_ASSERT(image.accessor().all_eq(gain.accessor()));
+      init(image, mask, &gain[0], size, nsig_b, nsig_s, threshold, min_count, nthreads);
     }
 
     /** @returns The mean map */
@@ -729,48 +1426,35 @@ namespace dials { namespace algorithms {
   private:
     void init(const af::const_ref<double, af::c_grid<2> > &image,
               const af::const_ref<bool, af::c_grid<2> > &mask,
-              const af::const_ref<double, af::c_grid<2> > &gain,
+              const double *gain,
               int2 size,
               double nsig_b,
               double nsig_s,
               double threshold,
-              int min_count) {
-      // Check the input
-      DIALS_ASSERT(threshold >= 0);
-      DIALS_ASSERT(nsig_b >= 0 && nsig_s >= 0);
-      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
-      DIALS_ASSERT(image.accessor().all_eq(gain.accessor()));
-
-      // Copy the mask into a temp variable
-      af::versa<int, af::c_grid<2> > temp(mask.accessor());
-      for (std::size_t i = 0; i < temp.size(); ++i) {
-        temp[i] = mask[i] ? 1 : 0;
-      }
-
-      // Calculate the masked index_of_dispersion filtered image
-      IndexOfDispersionFilterMasked<double> filter(
-        image, temp.const_ref(), size, min_count);
-      mean_ = filter.mean();
-      variance_ = filter.sample_variance();
-      cv_ = filter.index_of_dispersion();
-      af::versa<int, af::c_grid<2> > count = filter.count();
-      temp = filter.mask();
-
-      // Assign pixels to object or background
-      cv_mask_ = af::versa<bool, af::c_grid<2> >(image.accessor(), false);
-      value_mask_ = af::versa<bool, af::c_grid<2> >(image.accessor(), false);
-      final_mask_ = af::versa<bool, af::c_grid<2> >(image.accessor(), false);
-      global_mask_ = af::versa<bool, af::c_grid<2> >(image.accessor(), false);
-      for (std::size_t i = 0; i < image.size(); ++i) {
-        if (temp[i]) {
-          double bnd_b = gain[i] + nsig_b * gain[i] * std::sqrt(2.0 / (count[i] - 1));
-          double bnd_s = mean_[i] + nsig_s * std::sqrt(gain[i] * mean_[i]);
-          cv_mask_[i] = cv_[i] > bnd_b;
-          global_mask_[i] = image[i] > threshold;
-          value_mask_[i] = image[i] > bnd_s;
-          final_mask_[i] = cv_mask_[i] && value_mask_[i] & global_mask_[i];
-        }
-      }
+              int min_count,
+              std::size_t nthreads) {
+      // Compute all the maps and masks in one pass over the image
+      af::versa<int, af::c_grid<2> > valid;
+      af::versa<int, af::c_grid<2> > count;
+      detail::dispersion_debug_maps(image,
+                                    mask,
+                                    gain,
+                                    size,
+                                    nsig_b,
+                                    nsig_s,
+                                    threshold,
+                                    min_count,
+                                    true,
+                                    nthreads,
+                                    mean_,
+                                    variance_,
+                                    cv_,
+                                    valid,
+                                    count,
+                                    cv_mask_,
+                                    global_mask_,
+                                    value_mask_,
+                                    final_mask_);
     }
 
     af::versa<double, af::c_grid<2> > mean_;
@@ -797,6 +1481,7 @@ namespace dials { namespace algorithms {
      * @param nsig_s The strong pixel threshold
      * @param threshold The global threshold value
      * @param min_count The minimum number of pixels in the local area
+     * @param nthreads The number of threads to use
      */
     DispersionExtendedThresholdDebug(const af::const_ref<double, af::c_grid<2> > &image,
                                      const af::const_ref<bool, af::c_grid<2> > &mask,
@@ -804,9 +1489,9 @@ namespace dials { namespace algorithms {
                                      double nsig_b,
                                      double nsig_s,
                                      double threshold,
-                                     int min_count) {
-      af::versa<double, af::c_grid<2> > gain(image.accessor(), 1.0);
-      init(image, mask, gain.const_ref(), size, nsig_b, nsig_s, threshold, min_count);
+                                     int min_count,
+                                     std::size_t nthreads = 1) {
+      init(image, mask, NULL, size, nsig_b, nsig_s, threshold, min_count, nthreads);
     }
 
     /**
@@ -818,6 +1503,7 @@ namespace dials { namespace algorithms {
      * @param nsig_s The strong pixel threshold
      * @param threshold The global threshold value
      * @param min_count The minimum number of pixels in the local area
+     * @param nthreads The number of threads to use
      */
     DispersionExtendedThresholdDebug(const af::const_ref<double, af::c_grid<2> > &image,
                                      const af::const_ref<bool, af::c_grid<2> > &mask,
@@ -826,8 +1512,10 @@ namespace dials { namespace algorithms {
                                      double nsig_b,
                                      double nsig_s,
                                      double threshold,
-                                     int min_count) {
-      init(image, mask, gain, size, nsig_b, nsig_s, threshold, min_count);
+                                     int min_count,
+                                     std::size_t nthreads = 1) {
+      DIALS_ASSERT(image.accessor().all_eq(gain.accessor()));
+      init(image, mask, &gain[0], size, nsig_b, nsig_s, threshold, min_count, nthreads);
     }
 
     /** @returns The mean map */
@@ -868,45 +1556,36 @@ namespace dials { namespace algorithms {
   private:
     void init(const af::const_ref<double, af::c_grid<2> > &image,
               const af::const_ref<bool, af::c_grid<2> > &mask,
-              const af::const_ref<double, af::c_grid<2> > &gain,
+              const double *gain,
               int2 size,
               double nsig_b,
               double nsig_s,
               double threshold,
-              int min_count) {
-      // Check the input
-      DIALS_ASSERT(threshold >= 0);
-      DIALS_ASSERT(nsig_b >= 0 && nsig_s >= 0);
-      DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
-      DIALS_ASSERT(image.accessor().all_eq(gain.accessor()));
-
-      // Copy the mask into a temp variable
-      af::versa<int, af::c_grid<2> > temp(mask.accessor());
-      for (std::size_t i = 0; i < temp.size(); ++i) {
-        temp[i] = mask[i] ? 1 : 0;
-      }
-
-      // Calculate the masked index_of_dispersion filtered image
-      IndexOfDispersionFilterMasked<double> filter(
-        image, temp.const_ref(), size, min_count);
-      mean_ = filter.mean();
-      variance_ = filter.sample_variance();
-      cv_ = filter.index_of_dispersion();
-      af::versa<int, af::c_grid<2> > count = filter.count();
-      temp = filter.mask();
-
-      // Assign pixels to object or background
-      cv_mask_ = af::versa<bool, af::c_grid<2> >(image.accessor(), false);
-      value_mask_ = af::versa<bool, af::c_grid<2> >(image.accessor(), false);
-      final_mask_ = af::versa<bool, af::c_grid<2> >(image.accessor(), false);
-      global_mask_ = af::versa<bool, af::c_grid<2> >(image.accessor(), false);
-      for (std::size_t i = 0; i < image.size(); ++i) {
-        if (temp[i]) {
-          double bnd_b = gain[i] + nsig_b * gain[i] * std::sqrt(2.0 / (count[i] - 1));
-          cv_mask_[i] = cv_[i] > bnd_b;
-          global_mask_[i] = image[i] > threshold;
-        }
-      }
+              int min_count,
+              std::size_t nthreads) {
+      // Compute the maps, and the index of dispersion and global masks, in one
+      // pass over the image
+      af::versa<int, af::c_grid<2> > temp;
+      af::versa<int, af::c_grid<2> > count;
+      detail::dispersion_debug_maps(image,
+                                    mask,
+                                    gain,
+                                    size,
+                                    nsig_b,
+                                    nsig_s,
+                                    threshold,
+                                    min_count,
+                                    false,
+                                    nthreads,
+                                    mean_,
+                                    variance_,
+                                    cv_,
+                                    temp,
+                                    count,
+                                    cv_mask_,
+                                    global_mask_,
+                                    value_mask_,
+                                    final_mask_);
 
       // Compute the chebyshev distance to the background (for morphological erosion)
       af::versa<int, af::c_grid<2> > distance(image.accessor(), 0);
@@ -925,12 +1604,13 @@ namespace dials { namespace algorithms {
       // Widen the kernel slightly and compute the mean image without strong pixels
       size[0] += 2;
       size[1] += 2;
-      mean2_ = mean_filter_masked(image, temp_mask.ref(), size, 2, false);
+      mean2_ = mean_filter_masked(image, temp_mask.ref(), size, 2, false, nthreads);
 
       // Compute the final thresholds
       for (std::size_t i = 0; i < image.size(); ++i) {
         if (mask[i]) {
-          double bnd_s = mean2_[i] + nsig_s * std::sqrt(gain[i] * mean2_[i]);
+          double g = gain != NULL ? gain[i] : 1.0;
+          double bnd_s = mean2_[i] + nsig_s * std::sqrt(g * mean2_[i]);
           value_mask_[i] = (distance[i] >= erosion_distance) && (image[i] >= bnd_s);
           final_mask_[i] = cv_mask_[i] && value_mask_[i] && global_mask_[i];
         }
@@ -962,6 +1642,13 @@ namespace dials { namespace algorithms {
       int m;
       T x;
       T y;
+
+      Data &operator+=(const Data &other) {
+        m += other.m;
+        x += other.x;
+        y += other.y;
+        return *this;
+      }
     };
 
     DispersionExtendedThreshold(int2 image_size,
@@ -995,6 +1682,20 @@ namespace dials { namespace algorithms {
       buffer_.resize(element_size * image_size[0] * image_size[1]);
     }
 
+    /**
+     * The number of pixels around a region of the image which are needed to
+     * compute the threshold for the region identically to the full image. This
+     * is the kernel for the dispersion mask, the erosion distance and the
+     * extended kernel for the final threshold.
+     * @param kernel_size The kernel size
+     * @returns The size of the border
+     */
+    static int2 halo(int2 kernel_size) {
+      int erosion_distance = std::min(kernel_size[0], kernel_size[1]);
+      return int2(2 * kernel_size[0] + 2 + erosion_distance,
+                  2 * kernel_size[1] + 2 + erosion_distance);
+    }
+
     /**
      * Compute the summed area tables for the mask, src and src^2.
      * @param src The input array
@@ -1011,27 +1712,15 @@ namespace dials { namespace algorithms {
       std::size_t ysize = src.accessor()[0];
       std::size_t xsize = src.accessor()[1];
 
-      // Create the summed area table
-      for (std::size_t j = 0, k = 0; j < ysize; ++j) {
-        int m = 0;
-        T x = 0;
-        T y = 0;
-        for (std::size_t i = 0; i < xsize; ++i, ++k) {
-          int mm = (mask[k] && src[k] < BIG) ? 1 : 0;
-          m += mm;
-          x += mm * src[k];
-          y += mm * src[k] * src[k];
-          if (j == 0) {
-            table[k].m = m;
-            table[k].x = x;
-            table[k].y = y;
-          } else {
-            table[k].m = table[k - xsize].m + m;
-            table[k].x = table[k - xsize].x + x;
-            table[k].y = table[k - xsize].y + y;
-          }
-        }
+      // Fill the table with the masked values and make the summed area table
+      for (std::size_t k = 0; k < ysize * xsize; ++k) {
+        int mm = (mask[k] && src[k] < BIG) ? 1 : 0;
+        table[k].m = mm;
+        table[k].x = mm * src[k];
+        table[k].y = mm * src[k] * src[k];
       }
+      summed_area_table_in_place(
+        af::ref<Data<T>, af::c_grid<2> >(&table[0], af::c_grid<2>(ysize, xsize)));
     }
 
     /**
@@ -0,0 +1,289 @@
+/*
+ * tiled.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_IMAGE_THRESHOLD_TILED_H
+#define DIALS_ALGORITHMS_IMAGE_THRESHOLD_TILED_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/util/thread_pool.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::af::int2;
+
+  /**
+   * A class to threshold a single image by splitting it into tiles which are
+   * processed in parallel. Each tile is extended by a border large enough that
+   * the threshold of the pixels in the tile is the same as for the whole image.
+   * The algorithm must have the same constructor as DispersionThreshold and a
+   * static halo(kernel_size) method giving the size of the border.
+   */
+  template <typename Algorithm>
+  class TiledThreshold {
+  public:
+    /**
+     * Initialise the threshold
+     * @param kernel_size The kernel size
+     * @param nsig_b The number of standard deviations for the background
+     * @param nsig_s The number of standard deviations for the strong pixels
+     * @param threshold The global threshold
+     * @param min_count The minimum number of pixels in the kernel
+     * @param tile_size The size of each tile (<= 0 to use the whole image)
+     * @param nthreads The number of threads
+     */
+    TiledThreshold(int2 kernel_size,
+                   double nsig_b,
+                   double nsig_s,
+                   double threshold,
+                   int min_count,
+                   int2 tile_size,
+                   std::size_t nthreads)
+        : kernel_size_(kernel_size),
+          halo_(Algorithm::halo(kernel_size)),
+          nsig_b_(nsig_b),
+          nsig_s_(nsig_s),
+          threshold_(threshold),
+          min_count_(min_count),
+          tile_size_(tile_size),
+          nthreads_(nthreads) {
+      DIALS_ASSERT(kernel_size.all_gt(0));
+      DIALS_ASSERT(nthreads > 0);
+    }
+
+    /**
+     * Compute the threshold for the given image and mask.
+     * @param src - The input image array.
+     * @param mask - The mask array.
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold(const af::const_ref<T, af::c_grid<2> > &src,
+                   const af::const_ref<bool, af::c_grid<2> > &mask,
+                   af::ref<bool, af::c_grid<2> > dst) const {
+      std::vector<Panel<T> > panels(1, Panel<T>(src, mask, dst));
+      process(panels);
+    }
+
+    /**
+     * Compute the threshold for the given image and mask.
+     * @param src - The input image array.
+     * @param mask - The mask array.
+     * @param gain - The gain array
+     * @param dst - The destination array.
+     */
+    template <typename T>
+    void threshold_w_gain(const af::const_ref<T, af::c_grid<2> > &src,
+                          const af::const_ref<bool, af::c_grid<2> > &mask,
+                          const af::const_ref<double, af::c_grid<2> > &gain,
+                          af::ref<bool, af::c_grid<2> > dst) const {
+      DIALS_ASSERT(src.accessor().all_eq(gain.accessor()));
+      std::vector<Panel<T> > panels(1, Panel<T>(src, mask, gain, dst));
+      process(panels);
+    }
+
+    /**
+     * Compute the threshold for all the panels of a multi panel image. The
+     * tiles from all panels are processed by the same pool of threads.
+     * @param src - The input image arrays.
+     * @param mask - The mask arrays.
+     * @param dst - The destination arrays.
+     */
+    template <typename T>
+    void threshold_multi_panel(
+      const std::vector<af::const_ref<T, af::c_grid<2> > > &src,
+      const std::vector<af::const_ref<bool, af::c_grid<2> > > &mask,
+      const std::vector<af::ref<bool, af::c_grid<2> > > &dst) const {
+      DIALS_ASSERT(src.size() == mask.size());
+      DIALS_ASSERT(src.size() == dst.size());
+      std::vector<Panel<T> > panels;
+      for (std::size_t i = 0; i < src.size(); ++i) {
+        panels.push_back(Panel<T>(src[i], mask[i], dst[i]));
+      }
+      process(panels);
+    }
+
+  protected:
+    /**
+     * The data for a single panel
+     */
+    template <typename T>
+    struct Panel {
+      af::const_ref<T, af::c_grid<2> > src;
+      af::const_ref<bool, af::c_grid<2> > mask;
+      af::const_ref<double, af::c_grid<2> > gain;
+      af::ref<bool, af::c_grid<2> > dst;
+      bool use_gain;
+
+      Panel(const af::const_ref<T, af::c_grid<2> > &src_,
+            const af::const_ref<bool, af::c_grid<2> > &mask_,
+            af::ref<bool, af::c_grid<2> > dst_)
+          : src(src_), mask(mask_), dst(dst_), use_gain(false) {
+        DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+        DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      }
+
+      Panel(const af::const_ref<T, af::c_grid<2> > &src_,
+            const af::const_ref<bool, af::c_grid<2> > &mask_,
+            const af::const_ref<double, af::c_grid<2> > &gain_,
+            af::ref<bool, af::c_grid<2> > dst_)
+          : src(src_), mask(mask_), gain(gain_), dst(dst_), use_gain(true) {
+        DIALS_ASSERT(src.accessor().all_eq(mask.accessor()));
+        DIALS_ASSERT(src.accessor().all_eq(dst.accessor()));
+      }
+    };
+
+    /**
+     * A tile of a panel. The tile is given by the range [y0, y1), [x0, x1)
+     * and is extended by the halo when it is thresholded.
+     */
+    struct Tile {
+      std::size_t panel;
+      int y0, y1, x0, x1;
+
+      Tile(std::size_t panel_, int y0_, int y1_, int x0_, int x1_)
+          : panel(panel_), y0(y0_), y1(y1_), x0(x0_), x1(x1_) {}
+    };
+
+    /**
+     * Split the panels into tiles and threshold them in parallel
+     * @param panels The list of panels
+     */
+    template <typename T>
+    void process(const std::vector<Panel<T> > &panels) const {
+      // Compute the tiles
+      std::vector<Tile> tiles;
+      for (std::size_t p = 0; p < panels.size(); ++p) {
+        int ysize = panels[p].src.accessor()[0];
+        int xsize = panels[p].src.accessor()[1];
+        int ytile = tile_size_[0] > 0 ? std::min(tile_size_[0], ysize) : ysize;
+        int xtile = tile_size_[1] > 0 ? std::min(tile_size_[1], xsize) : xsize;
+        for (int y0 = 0; y0 < ysize; y0 += ytile) {
+          for (int x0 = 0; x0 < xsize; x0 += xtile) {
+            tiles.push_back(Tile(
+              p, y0, std::min(y0 + ytile, ysize), x0, std::min(x0 + xtile, xsize)));
+          }
+        }
+      }
+
+      // Process the tiles
+      std::string error;
+      boost::mutex error_mutex;
+      if (nthreads_ == 1 || tiles.size() == 1) {
+        for (std::size_t i = 0; i < tiles.size(); ++i) {
+          process_tile(panels, tiles[i], &error, &error_mutex);
+        }
+      } else {
+        dials::util::WorkStealingThreadPool pool(std::min(nthreads_, tiles.size()));
+        for (std::size_t i = 0; i < tiles.size(); ++i) {
+          pool.post(boost::bind(&TiledThreshold::process_tile<T>,
+                                this,
+                                boost::cref(panels),
+                                tiles[i],
+                                &error,
+                                &error_mutex));
+        }
+        pool.wait();
+      }
+
+      // Report any errors from the threads
+      if (!error.empty()) {
+        throw DIALS_ERROR(error);
+      }
+    }
+
+    /**
+     * Threshold a single tile. Exceptions are caught and saved so that they
+     * can be reported from the calling thread.
+     * @param panels The list of panels
+     * @param tile The tile
+     * @param error The error message
+     * @param error_mutex The mutex for the error message
+     */
+    template <typename T>
+    void process_tile(const std::vector<Panel<T> > &panels,
+                      Tile tile,
+                      std::string *error,
+                      boost::mutex *error_mutex) const {
+      try {
+        const Panel<T> &panel = panels[tile.panel];
+        int ysize = panel.src.accessor()[0];
+        int xsize = panel.src.accessor()[1];
+
+        // The tile extended by the halo
+        int y0 = std::max(tile.y0 - halo_[0], 0);
+        int y1 = std::min(tile.y1 + halo_[0], ysize);
+        int x0 = std::max(tile.x0 - halo_[1], 0);
+        int x1 = std::min(tile.x1 + halo_[1], xsize);
+        af::c_grid<2> grid(y1 - y0, x1 - x0);
+
+        // Copy the data for the extended tile
+        af::versa<T, af::c_grid<2> > src(grid);
+        af::versa<bool, af::c_grid<2> > mask(grid);
+        af::versa<double, af::c_grid<2> > gain;
+        af::versa<bool, af::c_grid<2> > dst(grid);
+        if (panel.use_gain) {
+          gain = af::versa<double, af::c_grid<2> >(grid);
+        }
+        for (int j = y0; j < y1; ++j) {
+          for (int i = x0; i < x1; ++i) {
+            src(j - y0, i - x0) = panel.src(j, i);
+            mask(j - y0, i - x0) = panel.mask(j, i);
+            if (panel.use_gain) {
+              gain(j - y0, i - x0) = panel.gain(j, i);
+            }
+          }
+        }
+
+        // Threshold the extended tile
+        Algorithm algorithm(int2(grid[0], grid[1]),
+                            kernel_size_,
+                            nsig_b_,
+                            nsig_s_,
+                            threshold_,
+                            min_count_);
+        if (panel.use_gain) {
+          algorithm.threshold_w_gain(
+            src.const_ref(), mask.const_ref(), gain.const_ref(), dst.ref());
+        } else {
+          algorithm.threshold(src.const_ref(), mask.const_ref(), dst.ref());
+        }
+
+        // Copy the result for the tile itself
+        for (int j = tile.y0; j < tile.y1; ++j) {
+          for (int i = tile.x0; i < tile.x1; ++i) {
+            panel.dst(j, i) = dst(j - y0, i - x0);
+          }
+        }
+      } catch (const std::exception &e) {
+        boost::lock_guard<boost::mutex> lock(*error_mutex);
+        if (error->empty()) {
+          *error = e.what();
+        }
+      }
+    }
+
+    int2 kernel_size_;
+    int2 halo_;
+    double nsig_b_;
+    double nsig_s_;
+    double threshold_;
+    int min_count_;
+    int2 tile_size_;
+    std::size_t nthreads_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_IMAGE_THRESHOLD_TILED_H
@@ -15,9 +15,10 @@ def __call__(self, reciprocal_lattice_vectors):
 
 
 class AssignIndicesGlobal(AssignIndicesStrategy):
-    def __init__(self, tolerance=0.3):
+    def __init__(self, tolerance=0.3, nproc=1):
         super(AssignIndicesGlobal, self).__init__()
         self._tolerance = tolerance
+        self._nproc = nproc
 
     def __call__(self, reflections, experiments, d_min=None):
         reciprocal_lattice_points = reflections["rlp"]
@@ -44,6 +45,7 @@ def __call__(self, reflections, experiments, d_min=None):
                 phi.select(sel_imgset),
                 UB_matrices,
                 tolerance=self._tolerance,
+                nthreads=self._nproc,
             )
 
             miller_indices = result.miller_indices()
@@ -71,13 +73,20 @@ def __call__(self, reflections, experiments, d_min=None):
 
 class AssignIndicesLocal(AssignIndicesStrategy):
     def __init__(
-        self, d_min=None, epsilon=0.05, delta=8, l_min=0.8, nearest_neighbours=20
+        self,
+        d_min=None,
+        epsilon=0.05,
+        delta=8,
+        l_min=0.8,
+        nearest_neighbours=20,
+        nproc=1,
     ):
         super(AssignIndicesLocal, self).__init__()
         self._epsilon = epsilon
         self._delta = delta
         self._l_min = l_min
         self._nearest_neighbours = nearest_neighbours
+        self._nproc = nproc
 
     def __call__(self, reflections, experiments, d_min=None):
         from libtbx.math_utils import nearest_integer as nint
@@ -113,6 +122,7 @@ def __call__(self, reflections, experiments, d_min=None):
             delta=self._delta,
             l_min=self._l_min,
             nearest_neighbours=self._nearest_neighbours,
+            nthreads=self._nproc,
         )
         miller_indices = result.miller_indices()
         crystal_ids = result.crystal_ids()
@@ -34,6 +34,27 @@
     n_points = 256
         .type = int(value_min=0)
         .expert_level = 1
+    single_precision = False
+        .type = bool
+        .help = "Compute the FFT of the grid in single precision, halving the"
+                "memory used by the transform."
+        .expert_level = 2
+    gridding = *nearest gaussian
+        .type = choice
+        .help = "How the reciprocal lattice points are put on the grid. Either"
+                "each point is assigned to its nearest grid point, or points"
+                "are spread over nearby grid points with a Gaussian kernel"
+                "that is then divided out of the transform, as for a"
+                "non-uniform FFT. The gaussian gridding keeps the exact"
+                "positions of the points, so that peaks for long real space"
+                "vectors are not smeared, which allows coarser grids to be"
+                "used for large unit cells."
+        .expert_level = 2
+    gaussian_sigma = 0.5
+        .type = float(value_min=0)
+        .help = "The width in grid points of the Gaussian kernel used for"
+                "gaussian gridding."
+        .expert_level = 3
     d_min = Auto
         .type = float(value_min=0)
         .help = "The high resolution limit in Angstrom for spots to include in "
@@ -52,7 +73,7 @@ class FFT3D(Strategy):
 
     phil_scope = phil.parse(fft3d_phil_str)
 
-    def __init__(self, max_cell, min_cell=3, params=None, *args, **kwargs):
+    def __init__(self, max_cell, min_cell=3, params=None, nproc=1, *args, **kwargs):
         """Construct an FFT3D object.
 
         Args:
@@ -72,6 +93,7 @@ def __init__(self, max_cell, min_cell=3, params=None, *args, **kwargs):
                 map.
             min_cell (float): A conservative lower bound on the minimum possible
                 primitive unit cell dimension.
+            nproc (int): The number of threads to use for the FFT.
         """
         super(FFT3D, self).__init__(max_cell, params=params, *args, **kwargs)
         n_points = self._params.reciprocal_space_grid.n_points
@@ -80,6 +102,7 @@ def __init__(self, max_cell, min_cell=3, params=None, *args, **kwargs):
         )
         self._n_points = self._gridding[0]
         self._min_cell = min_cell
+        self._nproc = nproc
 
     def find_basis_vectors(self, reciprocal_lattice_vectors):
         """Find a list of likely basis vectors.
@@ -188,27 +211,32 @@ def _fft(self, reciprocal_lattice_vectors, d_min):
             reciprocal_lattice_vectors, d_min
         )
 
-        logger.info(
-            "Number of centroids used: %i" % ((reciprocal_space_grid > 0).count(True))
-        )
+        gaussian = self._params.reciprocal_space_grid.gridding == "gaussian"
+        if gaussian:
+            n_used = used_in_indexing.count(True)
+        else:
+            n_used = (reciprocal_space_grid > 0).count(True)
+        logger.info("Number of centroids used: %i" % n_used)
 
+        # The grid is real, so only half of its transform is computed and
+        # stored, as (n_points**2)*(n_points+2) reals of 8 bytes, or 4 bytes in
+        # single precision, rather than n_points**3 complex values of 16 bytes
         # gb_to_bytes = 1073741824
         # bytes_to_gb = 1/gb_to_bytes
-        # (128**3)*8*2*bytes_to_gb
-        # 0.03125
         # (256**3)*8*2*bytes_to_gb
         # 0.25
-        # (512**3)*8*2*bytes_to_gb
-        # 2.0
+        # (256**2)*258*8*bytes_to_gb
+        # 0.126
 
-        fft = fftpack.complex_to_complex_3d(self._gridding)
-        grid_complex = flex.complex_double(
-            reals=reciprocal_space_grid,
-            imags=flex.double(reciprocal_space_grid.size(), 0),
+        grid_real = dials_algorithms_indexing_ext.fft3d_real_part_squared(
+            reciprocal_space_grid,
+            nthreads=self._nproc,
+            single_precision=self._params.reciprocal_space_grid.single_precision,
         )
-        grid_transformed = fft.forward(grid_complex)
-        grid_real = flex.pow2(flex.real(grid_transformed))
-        del grid_transformed
+        if gaussian:
+            dials_algorithms_indexing_ext.deconvolve_gaussian_spreading(
+                grid_real, sigma=self._params.reciprocal_space_grid.gaussian_sigma
+            )
 
         return grid_real, used_in_indexing
 
@@ -223,13 +251,23 @@ def _map_centroids_to_reciprocal_space_grid(
             self._params.b_iso = -4 * d_min ** 2 * math.log(0.05)
             logger.debug("Setting b_iso = %.1f" % self._params.b_iso)
         used_in_indexing = flex.bool(reciprocal_lattice_vectors.size(), True)
-        dials_algorithms_indexing_ext.map_centroids_to_reciprocal_space_grid(
-            grid,
-            reciprocal_lattice_vectors,
-            used_in_indexing,  # do we really need this?
-            d_min,
-            b_iso=self._params.b_iso,
-        )
+        if self._params.reciprocal_space_grid.gridding == "gaussian":
+            dials_algorithms_indexing_ext.spread_centroids_to_reciprocal_space_grid(
+                grid,
+                reciprocal_lattice_vectors,
+                used_in_indexing,
+                d_min,
+                b_iso=self._params.b_iso,
+                sigma=self._params.reciprocal_space_grid.gaussian_sigma,
+            )
+        else:
+            dials_algorithms_indexing_ext.map_centroids_to_reciprocal_space_grid(
+                grid,
+                reciprocal_lattice_vectors,
+                used_in_indexing,  # do we really need this?
+                d_min,
+                b_iso=self._params.b_iso,
+            )
         return grid, used_in_indexing
 
     def _find_peaks(self, grid_real, d_min):
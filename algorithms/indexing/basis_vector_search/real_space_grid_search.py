@@ -10,6 +10,7 @@
 from rstbx.dps_core import SimpleSamplerTool
 from scitbx import matrix
 
+import dials_algorithms_indexing_ext
 from dials.algorithms.indexing import DialsIndexError
 
 from .strategy import Strategy
@@ -36,13 +37,16 @@ class RealSpaceGridSearch(Strategy):
 
     phil_scope = phil.parse(real_space_grid_search_phil_str)
 
-    def __init__(self, max_cell, target_unit_cell, params=None, *args, **kwargs):
+    def __init__(
+        self, max_cell, target_unit_cell, params=None, nproc=1, *args, **kwargs
+    ):
         """Construct a real_space_grid_search object.
 
         Args:
             max_cell (float): An estimate of the maximum cell dimension of the primitive
                 cell.
             target_unit_cell (cctbx.uctbx.unit_cell): The target unit cell.
+            nproc (int): The number of threads to use to score the search vectors.
         """
         super(RealSpaceGridSearch, self).__init__(
             max_cell, params=params, *args, **kwargs
@@ -52,6 +56,7 @@ def __init__(self, max_cell, target_unit_cell, params=None, *args, **kwargs):
                 "Target unit cell must be provided for real_space_grid_search"
             )
         self._target_unit_cell = target_unit_cell
+        self._nproc = nproc
 
     @property
     def search_directions(self):
@@ -97,12 +102,10 @@ def score_vectors(self, reciprocal_lattice_vectors):
         Returns:
             A tuple containing the list of search vectors and their scores.
         """
-        vectors = flex.vec3_double()
-        scores = flex.double()
-        for i, v in enumerate(self.search_vectors):
-            f = self.compute_functional(v.elems, reciprocal_lattice_vectors)
-            vectors.append(v.elems)
-            scores.append(f)
+        vectors = flex.vec3_double([v.elems for v in self.search_vectors])
+        scores = dials_algorithms_indexing_ext.real_space_grid_search_scores(
+            vectors, reciprocal_lattice_vectors, nthreads=self._nproc
+        )
         return vectors, scores
 
     def find_basis_vectors(self, reciprocal_lattice_vectors):
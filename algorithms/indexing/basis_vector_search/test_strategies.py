@@ -27,6 +27,22 @@ def test_fft3d(self, setup_rlp):
         basis_vectors, used = strategy.find_basis_vectors(setup_rlp["rlp"])
         self.check_results(setup_rlp["crystal_symmetry"].unit_cell(), basis_vectors)
 
+    def test_fft3d_threaded_single_precision(self, setup_rlp):
+        max_cell = 1.3 * max(setup_rlp["crystal_symmetry"].unit_cell().parameters()[:3])
+        params = FFT3D.phil_scope.extract()
+        params.reciprocal_space_grid.single_precision = True
+        strategy = FFT3D(max_cell, params=params, nproc=3)
+        basis_vectors, used = strategy.find_basis_vectors(setup_rlp["rlp"])
+        self.check_results(setup_rlp["crystal_symmetry"].unit_cell(), basis_vectors)
+
+    def test_fft3d_gaussian_gridding(self, setup_rlp):
+        max_cell = 1.3 * max(setup_rlp["crystal_symmetry"].unit_cell().parameters()[:3])
+        params = FFT3D.phil_scope.extract()
+        params.reciprocal_space_grid.gridding = "gaussian"
+        strategy = FFT3D(max_cell, params=params)
+        basis_vectors, used = strategy.find_basis_vectors(setup_rlp["rlp"])
+        self.check_results(setup_rlp["crystal_symmetry"].unit_cell(), basis_vectors)
+
     def test_real_space_grid_search(self, setup_rlp):
         max_cell = 1.3 * max(setup_rlp["crystal_symmetry"].unit_cell().parameters()[:3])
         strategy = RealSpaceGridSearch(
@@ -34,3 +50,48 @@ def test_real_space_grid_search(self, setup_rlp):
         )
         basis_vectors, used = strategy.find_basis_vectors(setup_rlp["rlp"])
         self.check_results(setup_rlp["crystal_symmetry"].unit_cell(), basis_vectors)
+
+
+@pytest.mark.parametrize("gridding", [(8, 8, 8), (6, 10, 9)])
+def test_fft3d_real_part_squared(gridding):
+    from scitbx import fftpack
+    from scitbx.array_family import flex
+
+    import dials_algorithms_indexing_ext
+
+    grid = flex.random_double(gridding[0] * gridding[1] * gridding[2])
+    grid.reshape(flex.grid(gridding))
+
+    fft = fftpack.complex_to_complex_3d(gridding)
+    expected = flex.pow2(
+        flex.real(
+            fft.forward(flex.complex_double(reals=grid, imags=flex.double(grid.size())))
+        )
+    )
+    for nthreads in (1, 4):
+        result = dials_algorithms_indexing_ext.fft3d_real_part_squared(
+            grid, nthreads=nthreads
+        )
+        assert result.all() == gridding
+        assert list(result) == pytest.approx(list(expected))
+        result = dials_algorithms_indexing_ext.fft3d_real_part_squared(
+            grid, nthreads=nthreads, single_precision=True
+        )
+        assert list(result) == pytest.approx(list(expected), rel=1e-4, abs=1e-3)
+
+
+def test_real_space_grid_search_scores(setup_rlp):
+    import dials_algorithms_indexing_ext
+
+    unit_cell = setup_rlp["crystal_symmetry"].unit_cell()
+    max_cell = 1.3 * max(unit_cell.parameters()[:3])
+    strategy = RealSpaceGridSearch(max_cell, target_unit_cell=unit_cell)
+    vectors, scores = strategy.score_vectors(setup_rlp["rlp"])
+    expected = [
+        RealSpaceGridSearch.compute_functional(v, setup_rlp["rlp"]) for v in vectors
+    ]
+    assert list(scores) == pytest.approx(expected)
+    threaded = dials_algorithms_indexing_ext.real_space_grid_search_scores(
+        vectors, setup_rlp["rlp"], nthreads=4
+    )
+    assert list(threaded) == list(scores)
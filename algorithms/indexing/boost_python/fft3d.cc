@@ -16,6 +16,16 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
+  af::versa<double, af::c_grid<3> > fft3d_real_part_squared_wrapper(
+    af::const_ref<double, af::c_grid<3> > const& grid,
+    std::size_t nthreads,
+    bool single_precision) {
+    if (single_precision) {
+      return fft3d_real_part_squared<float>(grid, nthreads);
+    }
+    return fft3d_real_part_squared<double>(grid, nthreads);
+  }
+
   void export_fft3d() {
     def("sampling_volume_map",
         &sampling_volume_map,
@@ -25,7 +35,8 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("m2"),
          arg("rl_grid_spacing"),
          arg("d_min"),
-         arg("b_iso")));
+         arg("b_iso"),
+         arg("nthreads") = 1));
 
     def("clean_3d",
         &clean_3d,
@@ -38,6 +49,23 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("selection"),
          arg("d_min"),
          arg("b_iso") = 0));
+
+    def("spread_centroids_to_reciprocal_space_grid",
+        &spread_centroids_to_reciprocal_space_grid,
+        (arg("grid"),
+         arg("reciprocal_space_vectors"),
+         arg("selection"),
+         arg("d_min"),
+         arg("b_iso") = 0,
+         arg("sigma") = 0.5));
+
+    def("deconvolve_gaussian_spreading",
+        &deconvolve_gaussian_spreading,
+        (arg("grid_real"), arg("sigma") = 0.5, arg("max_fraction") = 0.8));
+
+    def("fft3d_real_part_squared",
+        &fft3d_real_part_squared_wrapper,
+        (arg("grid"), arg("nthreads") = 1, arg("single_precision") = false));
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -11,6 +11,7 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/indexing/index.h>
+#include <dials/algorithms/indexing/low_res_spot_match.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -25,10 +26,12 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<af::const_ref<scitbx::vec3<double> > const &,
                 af::const_ref<double> const &,
                 af::const_ref<scitbx::mat3<double> > const &,
-                double>((arg("reciprocal_space_points"),
-                         arg("phi"),
-                         arg("UB_matrices"),
-                         arg("tolerance") = 0.3)))
+                double,
+                std::size_t>((arg("reciprocal_space_points"),
+                              arg("phi"),
+                              arg("UB_matrices"),
+                              arg("tolerance") = 0.3,
+                              arg("nthreads") = 1)))
       .def("miller_indices", &w_t::miller_indices)
       .def("crystal_ids", &w_t::crystal_ids);
   }
@@ -42,21 +45,75 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const double,
                 const double,
                 const double,
-                const int>((arg("reciprocal_space_points"),
-                            arg("phi"),
-                            arg("UB_matrices"),
-                            arg("epsilon") = 0.05,
-                            arg("delta") = 8,
-                            arg("l_min") = 0.8,
-                            arg("nearest_neighbours") = 20)))
+                const int,
+                std::size_t>((arg("reciprocal_space_points"),
+                              arg("phi"),
+                              arg("UB_matrices"),
+                              arg("epsilon") = 0.05,
+                              arg("delta") = 8,
+                              arg("l_min") = 0.8,
+                              arg("nearest_neighbours") = 20,
+                              arg("nthreads") = 1)))
       .def("miller_indices", &w_t::miller_indices)
       .def("crystal_ids", &w_t::crystal_ids);
   }
 
+  void export_real_space_grid_search() {
+    def("real_space_grid_search_scores",
+        &real_space_grid_search_scores,
+        (arg("vectors"), arg("reciprocal_lattice_vectors"), arg("nthreads") = 1));
+  }
+
+  boost::python::tuple low_res_spot_match_pairs_with_seeds(
+    const LowResSpotMatchStems &self,
+    const af::const_ref<std::size_t> &seed_spot_ids,
+    const af::const_ref<double> &seed_clock_angles,
+    const af::const_ref<scitbx::vec3<double> > &seed_rlp_datums,
+    std::size_t nthreads) {
+    af::shared<std::size_t> seed_index;
+    af::shared<std::size_t> stem_index;
+    af::shared<double> residual;
+    self.pairs_with_seeds(seed_spot_ids,
+                          seed_clock_angles,
+                          seed_rlp_datums,
+                          seed_index,
+                          stem_index,
+                          residual,
+                          nthreads);
+    return boost::python::make_tuple(seed_index, stem_index, residual);
+  }
+
+  void export_low_res_spot_match() {
+    typedef LowResSpotMatchStems w_t;
+    class_<w_t>("LowResSpotMatchStems", no_init)
+      .def(init<af::const_ref<scitbx::vec3<double> > const &,
+                af::const_ref<double> const &,
+                af::const_ref<std::size_t> const &,
+                af::const_ref<double> const &,
+                af::const_ref<scitbx::vec3<double> > const &>(
+        (arg("spot_rlps"),
+         arg("spot_d_star_band2"),
+         arg("stem_spot_ids"),
+         arg("stem_clock_angles"),
+         arg("stem_rlp_datums"))))
+      .def("__len__", &w_t::size)
+      .def("pairs_with_seeds",
+           &low_res_spot_match_pairs_with_seeds,
+           (arg("seed_spot_ids"),
+            arg("seed_clock_angles"),
+            arg("seed_rlp_datums"),
+            arg("nthreads") = 1))
+      .def("extend_candidates",
+           &w_t::extend_candidates,
+           (arg("vertex_spot_ids"), arg("vertex_rlp_datums")));
+  }
+
   BOOST_PYTHON_MODULE(dials_algorithms_indexing_ext) {
     export_fft3d();
     export_assign_indices();
     export_assign_indices_local();
+    export_real_space_grid_search();
+    export_low_res_spot_match();
   }
 
 }}}  // namespace dials::algorithms::boost_python
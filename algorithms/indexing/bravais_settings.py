@@ -242,17 +242,34 @@ def refined_settings_from_refined_triclinic(experiments, reflections, params):
             constrain_orient, space_group
         )
 
-    with concurrent.futures.ProcessPoolExecutor(max_workers=params.nproc) as pool:
-        for i, result in enumerate(
-            pool.map(
-                refine_subgroup,
+    # There is no point starting more processes than there are settings, and
+    # with a single process the settings are refined in this one, avoiding the
+    # cost of starting a process and pickling the reflections for each setting
+    nproc = min(params.nproc, len(refined_settings))
+    if nproc > 1:
+        with concurrent.futures.ProcessPoolExecutor(max_workers=nproc) as pool:
+            for i, result in enumerate(
+                pool.map(
+                    refine_subgroup,
+                    (
+                        (params, subgroup, used_reflections, experiments)
+                        for subgroup in refined_settings
+                    ),
+                )
+            ):
+                refined_settings[i] = result
+    else:
+        for i, subgroup in enumerate(refined_settings):
+            # refine_subgroup modifies its parameters and experiments, which
+            # are otherwise copies made by pickling
+            refined_settings[i] = refine_subgroup(
                 (
-                    (params, subgroup, used_reflections, experiments)
-                    for subgroup in refined_settings
-                ),
+                    copy.deepcopy(params),
+                    subgroup,
+                    used_reflections,
+                    copy.deepcopy(experiments),
+                )
             )
-        ):
-            refined_settings[i] = result
 
     identify_likely_solutions(refined_settings)
     return refined_settings
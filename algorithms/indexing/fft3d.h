@@ -16,10 +16,17 @@
 #include <scitbx/vec2.h>
 #include <scitbx/array_family/flex_types.h>
 #include <scitbx/math/utils.h>
+#include <scitbx/constants.h>
 
+#include <algorithm>
+#include <complex>
 #include <cstdlib>
+#include <vector>
 #include <scitbx/array_family/versa_matrix.h>
+#include <scitbx/fftpack/complex_to_complex.h>
+#include <scitbx/fftpack/real_to_complex.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/algorithms/spot_prediction/rotation_angles.h>
 #include <dxtbx/model/scan_helpers.h>
 
@@ -41,58 +48,101 @@ namespace dials { namespace algorithms {
     return false;
   }
 
-  // compute a map of the sampling volume of a scan
+  namespace detail {
+
+    /**
+     * Compute the sampling volume map for a band of the slowest axis
+     */
+    struct SamplingVolumeBand {
+      af::ref<double, af::c_grid<3> > data;
+      af::ref<vec2<double> > angle_ranges;
+      vec3<double> s0;
+      vec3<double> m2;
+      double rl_grid_spacing;
+      double d_min;
+      double b_iso;
+
+      SamplingVolumeBand(af::ref<double, af::c_grid<3> > const& data_,
+                         af::ref<vec2<double> > const& angle_ranges_,
+                         vec3<double> s0_,
+                         vec3<double> m2_,
+                         double rl_grid_spacing_,
+                         double d_min_,
+                         double b_iso_)
+          : data(data_),
+            angle_ranges(angle_ranges_),
+            s0(s0_),
+            m2(m2_),
+            rl_grid_spacing(rl_grid_spacing_),
+            d_min(d_min_),
+            b_iso(b_iso_) {}
+
+      void operator()(int i0, int i1) const {
+        typedef af::c_grid<3>::index_type index_t;
+        index_t const gridding_n_real = index_t(data.accessor());
+
+        RotationAngles calculate_rotation_angles_(s0, m2);
+
+        double one_over_d_sq_min = 1 / (d_min * d_min);
+
+        for (int i = i0; i < i1; i++) {
+          double i_rl =
+            (double(i) - double(gridding_n_real[0] / 2.0)) * rl_grid_spacing;
+          double i_rl_sq = i_rl * i_rl;
+          for (std::size_t j = 0; j < gridding_n_real[1]; j++) {
+            double j_rl =
+              (double(j) - double(gridding_n_real[1] / 2.0)) * rl_grid_spacing;
+            double j_rl_sq = j_rl * j_rl;
+            for (std::size_t k = 0; k < gridding_n_real[2]; k++) {
+              double k_rl =
+                (double(k) - double(gridding_n_real[2] / 2.0)) * rl_grid_spacing;
+              double k_rl_sq = k_rl * k_rl;
+              double reciprocal_length_sq = (i_rl_sq + j_rl_sq + k_rl_sq);
+              if (reciprocal_length_sq > one_over_d_sq_min) {
+                continue;
+              }
+              vec3<double> pstar0(i_rl, j_rl, k_rl);
+
+              // Try to calculate the diffracting rotation angles
+              vec2<double> phi;
+              try {
+                phi = calculate_rotation_angles_(pstar0);
+              } catch (error) {
+                continue;
+              }
+
+              // Check that the angles are within the rotation range
+              if (are_angles_in_range(angle_ranges, phi)) {
+                double T;
+                if (b_iso != 0) {
+                  T = std::exp(-b_iso * reciprocal_length_sq / 4);
+                } else {
+                  T = 1;
+                }
+                data(i, j, k) = T;
+              }
+            }
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  // compute a map of the sampling volume of a scan, with the planes of the
+  // slowest axis split into bands across threads
   void sampling_volume_map(af::ref<double, af::c_grid<3> > const& data,
                            af::ref<vec2<double> > const& angle_ranges,
                            vec3<double> s0,
                            vec3<double> m2,
                            double const& rl_grid_spacing,
                            double d_min,
-                           double b_iso) {
-    typedef af::c_grid<3>::index_type index_t;
-    index_t const gridding_n_real = index_t(data.accessor());
-
-    RotationAngles calculate_rotation_angles_(s0, m2);
-
-    double one_over_d_sq_min = 1 / (d_min * d_min);
-
-    for (std::size_t i = 0; i < gridding_n_real[0]; i++) {
-      double i_rl = (double(i) - double(gridding_n_real[0] / 2.0)) * rl_grid_spacing;
-      double i_rl_sq = i_rl * i_rl;
-      for (std::size_t j = 0; j < gridding_n_real[1]; j++) {
-        double j_rl = (double(j) - double(gridding_n_real[1] / 2.0)) * rl_grid_spacing;
-        double j_rl_sq = j_rl * j_rl;
-        for (std::size_t k = 0; k < gridding_n_real[2]; k++) {
-          double k_rl =
-            (double(k) - double(gridding_n_real[2] / 2.0)) * rl_grid_spacing;
-          double k_rl_sq = k_rl * k_rl;
-          double reciprocal_length_sq = (i_rl_sq + j_rl_sq + k_rl_sq);
-          if (reciprocal_length_sq > one_over_d_sq_min) {
-            continue;
-          }
-          vec3<double> pstar0(i_rl, j_rl, k_rl);
-
-          // Try to calculate the diffracting rotation angles
-          vec2<double> phi;
-          try {
-            phi = calculate_rotation_angles_(pstar0);
-          } catch (error) {
-            continue;
-          }
-
-          // Check that the angles are within the rotation range
-          if (are_angles_in_range(angle_ranges, phi)) {
-            double T;
-            if (b_iso != 0) {
-              T = std::exp(-b_iso * reciprocal_length_sq / 4);
-            } else {
-              T = 1;
-            }
-            data(i, j, k) = T;
-          }
-        }
-      }
-    }
+                           double b_iso,
+                           std::size_t nthreads = 1) {
+    for_each_band(detail::SamplingVolumeBand(
+                    data, angle_ranges, s0, m2, rl_grid_spacing, d_min, b_iso),
+                  (int)data.accessor()[0],
+                  nthreads);
   }
 
   /*
@@ -221,6 +271,312 @@ namespace dials { namespace algorithms {
     }
   }
 
+  /**
+   * Spread the reciprocal lattice points onto a grid with a Gaussian kernel,
+   * as for the gridding step of a non-uniform FFT, rather than assigning each
+   * point to its nearest grid point as map_centroids_to_reciprocal_space_grid
+   * does. The transform of the grid is then that of the points at their exact
+   * positions, multiplied by the transform of the kernel, which
+   * deconvolve_gaussian_spreading divides out. Peaks for long real space
+   * vectors are therefore not smeared by rounding the points to the grid.
+   * @param grid The grid, with points accumulated periodically
+   * @param reciprocal_space_vectors The reciprocal lattice points
+   * @param selection The points to use, unset for those that are not used
+   * @param d_min The resolution limit
+   * @param b_iso The isotropic B factor used to weight the points
+   * @param sigma The width of the Gaussian kernel in grid points
+   */
+  inline void spread_centroids_to_reciprocal_space_grid(
+    af::ref<double, af::c_grid<3> > const& grid,
+    af::const_ref<vec3<double> > const& reciprocal_space_vectors,
+    af::ref<bool> const& selection,
+    double d_min,
+    double b_iso = 0,
+    double sigma = 0.5) {
+    typedef af::c_grid<3>::index_type index_t;
+    index_t const gridding_n_real = index_t(grid.accessor());
+    DIALS_ASSERT(d_min > 0);
+    DIALS_ASSERT(sigma > 0);
+    DIALS_ASSERT(selection.size() == reciprocal_space_vectors.size());
+    DIALS_ASSERT(gridding_n_real[0] == gridding_n_real[1]);
+    DIALS_ASSERT(gridding_n_real[0] == gridding_n_real[2]);
+
+    const int n_points = gridding_n_real[0];
+    const double rlgrid = 2 / (d_min * n_points);
+    const double one_over_rlgrid = 1 / rlgrid;
+    const int half_n_points = n_points / 2;
+    const int half_width = std::min((int)std::ceil(3 * sigma), (n_points - 1) / 2);
+    const double one_over_two_sigma_sq = 1 / (2 * sigma * sigma);
+
+    std::vector<double> weights[3];
+    for (int j = 0; j < 3; j++) {
+      weights[j].resize(2 * half_width + 1);
+    }
+    for (int i = 0; i < reciprocal_space_vectors.size(); i++) {
+      if (!selection[i]) {
+        continue;
+      }
+      const vec3<double> v = reciprocal_space_vectors[i];
+      const double v_length = v.length();
+      const double d_spacing = 1 / v_length;
+      if (d_spacing < d_min) {
+        selection[i] = false;
+        continue;
+      }
+      vec3<double> position;
+      vec3<int> coord;
+      for (int j = 0; j < 3; j++) {
+        position[j] = v[j] * one_over_rlgrid + half_n_points;
+        coord[j] = scitbx::math::iround(position[j]);
+      }
+      if ((coord.max() >= n_points) || coord.min() < 0) {
+        selection[i] = false;
+        continue;
+      }
+      double T;
+      if (b_iso != 0) {
+        T = std::exp(-b_iso * v_length * v_length / 4.0);
+      } else {
+        T = 1;
+      }
+
+      // the kernel is separable, so find its weights along each axis
+      for (int j = 0; j < 3; j++) {
+        for (int d = -half_width; d <= half_width; d++) {
+          double x = coord[j] + d - position[j];
+          weights[j][d + half_width] = std::exp(-x * x * one_over_two_sigma_sq);
+        }
+      }
+      for (int di = -half_width; di <= half_width; di++) {
+        int gi = (coord[0] + di + n_points) % n_points;
+        double wi = T * weights[0][di + half_width];
+        for (int dj = -half_width; dj <= half_width; dj++) {
+          int gj = (coord[1] + dj + n_points) % n_points;
+          double wij = wi * weights[1][dj + half_width];
+          for (int dk = -half_width; dk <= half_width; dk++) {
+            int gk = (coord[2] + dk + n_points) % n_points;
+            grid(gi, gj, gk) += wij * weights[2][dk + half_width];
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Divide the squared transform of a grid filled by
+   * spread_centroids_to_reciprocal_space_grid by the squared transform of the
+   * Gaussian kernel. The correction grows towards the edges of the map, where
+   * aliasing of the kernel makes it unreliable, so it is held at its value at
+   * a fraction of the half width of the map beyond that.
+   * @param grid_real The squared real part of the transform, origin first
+   * @param sigma The width of the Gaussian kernel in grid points
+   * @param max_fraction The fraction of the half width of the map within
+   *                     which the correction is made in full
+   */
+  inline void deconvolve_gaussian_spreading(af::ref<double, af::c_grid<3> > grid_real,
+                                            double sigma = 0.5,
+                                            double max_fraction = 0.8) {
+    typedef af::c_grid<3>::index_type index_t;
+    index_t const n = index_t(grid_real.accessor());
+    DIALS_ASSERT(sigma > 0);
+    DIALS_ASSERT(max_fraction > 0 && max_fraction <= 1);
+
+    // the transform of the kernel is exp(-2 pi^2 sigma^2 (u / n)^2) along each
+    // axis, for the index u from the origin, and the map is of its square
+    const double pi = scitbx::constants::pi;
+    const double scale = 4 * pi * pi * sigma * sigma;
+    const double max_t_sq = 0.25 * max_fraction * max_fraction;
+    std::vector<double> t_sq[3];
+    for (int j = 0; j < 3; j++) {
+      t_sq[j].resize(n[j]);
+      for (int u = 0; u < n[j]; u++) {
+        double t = double(2 * u <= (int)n[j] ? u : u - (int)n[j]) / n[j];
+        t_sq[j][u] = t * t;
+      }
+    }
+    for (std::size_t i = 0; i < n[0]; i++) {
+      for (std::size_t j = 0; j < n[1]; j++) {
+        for (std::size_t k = 0; k < n[2]; k++) {
+          double r_sq = std::min(t_sq[0][i] + t_sq[1][j] + t_sq[2][k], max_t_sq);
+          grid_real(i, j, k) *= std::exp(scale * r_sq);
+        }
+      }
+    }
+  }
+
+  namespace detail {
+
+    /**
+     * Transform each line of the fastest axis of a padded real grid in place
+     * into the first half of its complex transform, for a band of the slowest
+     * axis
+     */
+    template <typename FloatType>
+    struct RealToComplexLinesBand {
+      FloatType* data;
+      int n1;
+      int n2;
+      int m2;
+
+      RealToComplexLinesBand(FloatType* data_, int n1_, int n2_, int m2_)
+          : data(data_), n1(n1_), n2(n2_), m2(m2_) {}
+
+      void operator()(int i0, int i1) const {
+        scitbx::fftpack::real_to_complex<FloatType> fft(n2);
+        for (int i = i0; i < i1; i++) {
+          for (int j = 0; j < n1; j++) {
+            fft.forward(data + ((std::size_t)i * n1 + j) * m2);
+          }
+        }
+      }
+    };
+
+    /**
+     * Transform the lines of a grid of complex values along the axis with
+     * the given stride, for a band of the lines starting at first(i) for the
+     * lines i in the band. Each line is gathered into a buffer, transformed
+     * and scattered back.
+     */
+    template <typename FloatType>
+    struct ComplexToComplexLinesBand {
+      std::complex<FloatType>* data;
+      int n;
+      std::size_t stride;
+      int nk;
+      std::size_t band_stride;
+
+      ComplexToComplexLinesBand(std::complex<FloatType>* data_,
+                                int n_,
+                                std::size_t stride_,
+                                int nk_,
+                                std::size_t band_stride_)
+          : data(data_),
+            n(n_),
+            stride(stride_),
+            nk(nk_),
+            band_stride(band_stride_) {}
+
+      void operator()(int i0, int i1) const {
+        scitbx::fftpack::complex_to_complex<FloatType> fft(n);
+        std::vector<std::complex<FloatType> > line(n);
+        for (int i = i0; i < i1; i++) {
+          for (int k = 0; k < nk; k++) {
+            std::complex<FloatType>* first = data + i * band_stride + k;
+            for (int j = 0; j < n; j++) {
+              line[j] = first[j * stride];
+            }
+            fft.forward(&line[0]);
+            for (int j = 0; j < n; j++) {
+              first[j * stride] = line[j];
+            }
+          }
+        }
+      }
+    };
+
+    /**
+     * Expand the real part squared of the half transform of a real grid into
+     * the full grid, for a band of the slowest axis, using the symmetry
+     * F(-h) = F(h)* of the transform of real data
+     */
+    template <typename FloatType>
+    struct RealPartSquaredBand {
+      const std::complex<FloatType>* data;
+      int n0;
+      int n1;
+      int n2;
+      int nc;
+      af::ref<double, af::c_grid<3> > result;
+
+      RealPartSquaredBand(const std::complex<FloatType>* data_,
+                          int n0_,
+                          int n1_,
+                          int n2_,
+                          int nc_,
+                          af::ref<double, af::c_grid<3> > result_)
+          : data(data_), n0(n0_), n1(n1_), n2(n2_), nc(nc_), result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; i++) {
+          int i_inv = (n0 - i) % n0;
+          for (int j = 0; j < n1; j++) {
+            int j_inv = (n1 - j) % n1;
+            const std::complex<FloatType>* line =
+              data + ((std::size_t)i * n1 + j) * nc;
+            const std::complex<FloatType>* line_inv =
+              data + ((std::size_t)i_inv * n1 + j_inv) * nc;
+            for (int k = 0; k < n2; k++) {
+              double re = k < nc ? line[k].real() : line_inv[n2 - k].real();
+              result(i, j, k) = re * re;
+            }
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the squared real part of the forward 3D FFT of a real grid, as
+   * used for the basis vector search. The grid is transformed with a real to
+   * complex FFT, which only finds and stores half of the transform, in a
+   * padded copy of the grid in the given precision. The 1D transforms along
+   * each axis are split into bands across threads, and the full grid is
+   * expanded from the half transform using its Hermitian symmetry.
+   * @param grid The real grid
+   * @param nthreads The number of threads to use
+   * @returns The squared real part of the transform of the grid
+   */
+  template <typename FloatType>
+  af::versa<double, af::c_grid<3> > fft3d_real_part_squared(
+    af::const_ref<double, af::c_grid<3> > const& grid,
+    std::size_t nthreads = 1) {
+    typedef af::c_grid<3>::index_type index_t;
+    index_t const n = index_t(grid.accessor());
+    DIALS_ASSERT(n[0] > 0 && n[1] > 0 && n[2] > 0);
+    const int n0 = n[0];
+    const int n1 = n[1];
+    const int n2 = n[2];
+    const int nc = n2 / 2 + 1;
+    const int m2 = 2 * nc;
+
+    // copy the grid into the padded array, in place of which the half
+    // transform is computed
+    std::vector<FloatType> padded((std::size_t)n0 * n1 * m2, 0);
+    for (int i = 0; i < n0; i++) {
+      for (int j = 0; j < n1; j++) {
+        FloatType* line = &padded[((std::size_t)i * n1 + j) * m2];
+        for (int k = 0; k < n2; k++) {
+          line[k] = (FloatType)grid(i, j, k);
+        }
+      }
+    }
+    std::complex<FloatType>* data =
+      reinterpret_cast<std::complex<FloatType>*>(&padded[0]);
+
+    // transform along the fastest axis, then the middle axis for each plane
+    // of the slowest axis, then the slowest axis for each plane of the middle
+    // axis
+    for_each_band(
+      detail::RealToComplexLinesBand<FloatType>(&padded[0], n1, n2, m2), n0, nthreads);
+    for_each_band(detail::ComplexToComplexLinesBand<FloatType>(
+                    data, n1, nc, nc, (std::size_t)n1 * nc),
+                  n0,
+                  nthreads);
+    for_each_band(detail::ComplexToComplexLinesBand<FloatType>(
+                    data, n0, (std::size_t)n1 * nc, nc, nc),
+                  n1,
+                  nthreads);
+
+    af::versa<double, af::c_grid<3> > result(af::c_grid<3>(n),
+                                             af::init_functor_null<double>());
+    for_each_band(
+      detail::RealPartSquaredBand<FloatType>(data, n0, n1, n2, nc, result.ref()),
+      n0,
+      nthreads);
+    return result;
+  }
+
 }}  // namespace dials::algorithms
 
 #endif
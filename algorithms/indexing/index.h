@@ -10,8 +10,10 @@
  */
 #ifndef DIALS_ALGORITHMS_INDEXING_H
 #define DIALS_ALGORITHMS_INDEXING_H
+#include <cmath>
 #include <vector>
 #include <map>
+#include <set>
 #include <algorithm>
 #include <scitbx/array_family/flex_types.h>
 #include <scitbx/vec3.h>
@@ -20,6 +22,7 @@
 #include <cctbx/miller.h>
 #include <scitbx/constants.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/prim_minimum_spanning_tree.hpp>
@@ -30,70 +33,54 @@
 
 namespace dials { namespace algorithms {
 
+  /**
+   * Assign to each reflection the Miller index of the nearest lattice point
+   * of the candidate UB matrices. The fractional Miller indices of each
+   * reflection are found for every lattice in a single pass over the
+   * reflections, split into bands across threads, keeping only the closest.
+   * If more than one reflection of a lattice is given the same Miller index
+   * within pi / 4 in phi, only the closest of them keeps it.
+   */
   class AssignIndices {
   public:
     AssignIndices(af::const_ref<scitbx::vec3<double> > const& reciprocal_space_points,
                   af::const_ref<double> const& phi,
                   af::const_ref<scitbx::mat3<double> > const& UB_matrices,
-                  double tolerance = 0.3)
+                  double tolerance = 0.3,
+                  std::size_t nthreads = 1)
         : miller_indices_(reciprocal_space_points.size(),
                           cctbx::miller::index<>(0, 0, 0)),
           crystal_ids_(reciprocal_space_points.size(), -1) {
       DIALS_ASSERT(reciprocal_space_points.size() == phi.size());
+      DIALS_ASSERT(nthreads > 0);
 
       typedef std::pair<const cctbx::miller::index<>, const std::size_t> pair_t;
       typedef std::multimap<cctbx::miller::index<>, std::size_t> map_t;
 
       map_t hkl_to_rlp_map;
 
-      std::vector<af::shared<cctbx::miller::index<> > > hkl_ints;
-      std::vector<af::shared<double> > lengths_sq;
-
       const double pi_4 = scitbx::constants::pi / 4;
 
-      // loop over crystals and assign one hkl per crystal per reflection
-      for (int i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
-        scitbx::mat3<double> A = UB_matrices[i_lattice];
-        scitbx::mat3<double> A_inv = A.inverse();
-        af::shared<cctbx::miller::index<> > hkl_ints_(
-          af::reserve(reciprocal_space_points.size()));
-        af::shared<double> lengths_sq_(af::reserve(reciprocal_space_points.size()));
-        for (int i_ref = 0; i_ref < reciprocal_space_points.size(); i_ref++) {
-          scitbx::vec3<double> rlp = reciprocal_space_points[i_ref];
-          scitbx::vec3<double> hkl_f = A_inv * rlp;
-          cctbx::miller::index<> hkl_i;
-          for (std::size_t j = 0; j < 3; j++) {
-            hkl_i[j] = scitbx::math::iround(hkl_f[j]);
-          }
-          scitbx::vec3<double> diff = hkl_f - scitbx::vec3<double>(hkl_i);
-          hkl_ints_.push_back(hkl_i);
-          lengths_sq_.push_back(diff.length_sq());
-        }
-        hkl_ints.push_back(hkl_ints_);
-        lengths_sq.push_back(lengths_sq_);
+      // the inverse of each UB matrix, shared by all the reflections
+      std::vector<scitbx::mat3<double> > A_inv;
+      for (std::size_t i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
+        A_inv.push_back(UB_matrices[i_lattice].inverse());
       }
 
-      // loop over all reflections and choose the best hkl (and consequently
-      // crystal) for each reflection
-      double tolerance_sq = tolerance * tolerance;
-      for (int i_ref = 0; i_ref < reciprocal_space_points.size(); i_ref++) {
-        af::shared<double> n;
-        af::shared<cctbx::miller::index<> > potential_hkls;
-        for (int i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
-          n.push_back(lengths_sq[i_lattice][i_ref]);
-          potential_hkls.push_back(hkl_ints[i_lattice][i_ref]);
-        }
-        int i_best_lattice = af::min_index(n.const_ref());
-        if (n[i_best_lattice] > tolerance_sq) {
-          continue;
+      // choose the best hkl (and consequently crystal) for each reflection
+      af::shared<double> lengths_sq(reciprocal_space_points.size(), 0);
+      for_each_band(AssignBand(reciprocal_space_points,
+                               A_inv,
+                               tolerance * tolerance,
+                               miller_indices_.ref(),
+                               crystal_ids_.ref(),
+                               lengths_sq.ref()),
+                    (int)reciprocal_space_points.size(),
+                    nthreads);
+      for (std::size_t i_ref = 0; i_ref < reciprocal_space_points.size(); i_ref++) {
+        if (crystal_ids_[i_ref] != -1) {
+          hkl_to_rlp_map.insert(pair_t(miller_indices_[i_ref], i_ref));
         }
-        cctbx::miller::index<> hkl = potential_hkls[i_best_lattice];
-        if (hkl[0] == 0 && hkl[1] == 0 && hkl[2] == 0) {
-          continue;
-        }
-        miller_indices_[i_ref] = hkl;
-        hkl_to_rlp_map.insert(pair_t(hkl, i_ref));
-        crystal_ids_[i_ref] = i_best_lattice;
       }
 
       cctbx::miller::index<> curr_hkl(0, 0, 0);
@@ -123,7 +110,7 @@ namespace dials { namespace algorithms {
                 if (std::abs(phi_i - phi_j) > pi_4) {
                   continue;
                 }
-                if (lengths_sq[crystal_j][j_ref] < lengths_sq[crystal_i][i_ref]) {
+                if (lengths_sq[j_ref] < lengths_sq[i_ref]) {
                   miller_indices_[i_ref] = cctbx::miller::index<>(0, 0, 0);
                   crystal_ids_[i_ref] = -1;
                 } else {
@@ -149,10 +136,121 @@ namespace dials { namespace algorithms {
     }
 
   private:
+    /**
+     * Find the closest lattice point of all the lattices for a band of
+     * reflections, recording the squared distance in fractional Miller
+     * indices, and assign it if it is within the tolerance and not (0, 0, 0)
+     */
+    struct AssignBand {
+      af::const_ref<scitbx::vec3<double> > rlps;
+      const std::vector<scitbx::mat3<double> >& A_inv;
+      double tolerance_sq;
+      af::ref<cctbx::miller::index<> > miller_indices;
+      af::ref<int> crystal_ids;
+      af::ref<double> lengths_sq;
+
+      AssignBand(af::const_ref<scitbx::vec3<double> > const& rlps_,
+                 const std::vector<scitbx::mat3<double> >& A_inv_,
+                 double tolerance_sq_,
+                 af::ref<cctbx::miller::index<> > miller_indices_,
+                 af::ref<int> crystal_ids_,
+                 af::ref<double> lengths_sq_)
+          : rlps(rlps_),
+            A_inv(A_inv_),
+            tolerance_sq(tolerance_sq_),
+            miller_indices(miller_indices_),
+            crystal_ids(crystal_ids_),
+            lengths_sq(lengths_sq_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i_ref = i0; i_ref < i1; i_ref++) {
+          int i_best_lattice = -1;
+          double best_length_sq = 0;
+          cctbx::miller::index<> best_hkl(0, 0, 0);
+          for (std::size_t i_lattice = 0; i_lattice < A_inv.size(); i_lattice++) {
+            scitbx::vec3<double> hkl_f = A_inv[i_lattice] * rlps[i_ref];
+            cctbx::miller::index<> hkl_i;
+            for (std::size_t j = 0; j < 3; j++) {
+              hkl_i[j] = scitbx::math::iround(hkl_f[j]);
+            }
+            double length_sq = (hkl_f - scitbx::vec3<double>(hkl_i)).length_sq();
+            if (i_best_lattice == -1 || length_sq < best_length_sq) {
+              i_best_lattice = i_lattice;
+              best_length_sq = length_sq;
+              best_hkl = hkl_i;
+            }
+          }
+          lengths_sq[i_ref] = best_length_sq;
+          if (i_best_lattice == -1 || best_length_sq > tolerance_sq) {
+            continue;
+          }
+          if (best_hkl[0] == 0 && best_hkl[1] == 0 && best_hkl[2] == 0) {
+            continue;
+          }
+          miller_indices[i_ref] = best_hkl;
+          crystal_ids[i_ref] = i_best_lattice;
+        }
+      }
+    };
+
     af::shared<cctbx::miller::index<> > miller_indices_;
     af::shared<int> crystal_ids_;
   };
 
+  /**
+   * Compute the real space grid search functional for a band of vectors
+   */
+  struct RealSpaceGridSearchBand {
+    af::const_ref<scitbx::vec3<double> > vectors;
+    af::const_ref<scitbx::vec3<double> > rlps;
+    af::ref<double> scores;
+
+    RealSpaceGridSearchBand(af::const_ref<scitbx::vec3<double> > const& vectors_,
+                            af::const_ref<scitbx::vec3<double> > const& rlps_,
+                            af::ref<double> scores_)
+        : vectors(vectors_), rlps(rlps_), scores(scores_) {}
+
+    void operator()(int i0, int i1) const {
+      const double two_pi = scitbx::constants::two_pi;
+      for (int i = i0; i < i1; i++) {
+        const scitbx::vec3<double> v = vectors[i] * two_pi;
+        double f = 0;
+        for (std::size_t j = 0; j < rlps.size(); j++) {
+          f += std::cos(rlps[j] * v);
+        }
+        scores[i] = f;
+      }
+    }
+  };
+
+  /**
+   * Score the search vectors of a real space grid search by the functional
+   *
+   *  f(v) = sum_i cos(2 pi r_i . v)
+   *
+   * over the reciprocal lattice vectors r_i, which is largest for vectors
+   * that are close to real space lattice vectors. The vectors are split into
+   * bands across threads, with each score summed over the reciprocal lattice
+   * vectors in order so that the result does not depend on the number of
+   * threads.
+   * @param vectors The search vectors
+   * @param reciprocal_lattice_vectors The reciprocal lattice vectors
+   * @param nthreads The number of threads to use
+   * @returns The score of each search vector
+   */
+  inline af::shared<double> real_space_grid_search_scores(
+    af::const_ref<scitbx::vec3<double> > const& vectors,
+    af::const_ref<scitbx::vec3<double> > const& reciprocal_lattice_vectors,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(nthreads > 0);
+    af::shared<double> scores(vectors.size(), 0);
+    for_each_band(
+      RealSpaceGridSearchBand(vectors, reciprocal_lattice_vectors, scores.ref()),
+      (int)vectors.size(),
+      nthreads);
+    return scores;
+  }
+
   typedef struct edge_ {
     std::size_t i;
     std::size_t j;
@@ -171,6 +269,15 @@ namespace dials { namespace algorithms {
     std::vector<Edge>& edges;
   };
 
+  /**
+   * Assign Miller indices to the reflections using the local index
+   * assignment method of Gildea et al. (2014). The Miller index differences
+   * between each reflection and its nearest neighbours in reciprocal space
+   * are weighted, and the indices of the largest subtree of the minimum
+   * spanning tree of those differences are kept. The neighbour search is
+   * done once and shared by all the lattices, which are then processed in
+   * parallel before their assignments are combined in turn.
+   */
   class AssignIndicesLocal {
   public:
     AssignIndicesLocal(
@@ -180,19 +287,15 @@ namespace dials { namespace algorithms {
       const double epsilon = 0.05,
       const double delta = 5,
       const double l_min = 0.8,
-      const int nearest_neighbours = 20)
+      const int nearest_neighbours = 20,
+      std::size_t nthreads = 1)
         : miller_indices_(reciprocal_space_points.size(),
                           cctbx::miller::index<>(0, 0, 0)),
           crystal_ids_(reciprocal_space_points.size(), -1) {
       DIALS_ASSERT(reciprocal_space_points.size() == phi.size());
+      DIALS_ASSERT(nthreads > 0);
 
       using annlib_adaptbx::AnnAdaptor;
-      using namespace boost;
-
-      typedef adjacency_list<vecS, vecS, undirectedS, no_property, MyEdge> Graph;
-
-      typedef Graph::vertex_descriptor Vertex;
-      typedef graph_traits<Graph>::edge_descriptor Edge;
 
       // convert into a single array for input to AnnAdaptor
       // based on flex.vec_3.as_double()
@@ -208,26 +311,122 @@ namespace dials { namespace algorithms {
 
       AnnAdaptor ann = AnnAdaptor(rlps_double, 3, nearest_neighbours);
       ann.query(rlps_double);
+      std::vector<std::size_t> nn(ann.nn.begin(), ann.nn.end());
+
+      // find the largest subtree of each lattice
+      std::size_t n_lattices = UB_matrices.size();
+      std::vector<std::vector<char> > in_largest_subtree(n_lattices);
+      std::vector<std::vector<cctbx::miller::index<> > > hkl_ints(n_lattices);
+      for_each_band(LatticeBand(reciprocal_space_points,
+                                UB_matrices,
+                                nn,
+                                nearest_neighbours,
+                                epsilon,
+                                delta,
+                                l_min,
+                                in_largest_subtree,
+                                hkl_ints),
+                    (int)n_lattices,
+                    nthreads);
+
+      // assign one hkl per reflection, rejecting reflections that are in the
+      // largest subtree of more than one lattice
+      for (std::size_t i_lattice = 0; i_lattice < n_lattices; i_lattice++) {
+        for (std::size_t i = 0; i < reciprocal_space_points.size(); i++) {
+          if (!in_largest_subtree[i_lattice][i]) {
+            continue;
+          } else if (crystal_ids_[i] == -2) {
+            continue;
+          } else if (crystal_ids_[i] == -1) {
+            miller_indices_[i] = hkl_ints[i_lattice][i];
+            crystal_ids_[i] = i_lattice;
+          } else {
+            crystal_ids_[i] = -2;
+            miller_indices_[i] = cctbx::miller::index<>(0, 0, 0);
+          }
+        }
+      }
+    }
+
+    af::shared<cctbx::miller::index<> > miller_indices() {
+      return miller_indices_;
+    }
+
+    af::shared<int> crystal_ids() {
+      return crystal_ids_;
+    }
 
-      const double one_over_epsilon = 1.0 / epsilon;
+  private:
+    typedef boost::adjacency_list<boost::vecS,
+                                  boost::vecS,
+                                  boost::undirectedS,
+                                  boost::no_property,
+                                  MyEdge>
+      Graph;
+
+    /**
+     * Find the largest subtree of the minimum spanning tree, and the Miller
+     * indices of the reflections relative to its root, for a band of lattices
+     */
+    struct LatticeBand {
+      af::const_ref<scitbx::vec3<double> > rlps;
+      af::const_ref<scitbx::mat3<double> > UB_matrices;
+      const std::vector<std::size_t>& nn;
+      std::size_t nearest_neighbours;
+      double epsilon;
+      double delta;
+      double l_min;
+      std::vector<std::vector<char> >& in_largest_subtree;
+      std::vector<std::vector<cctbx::miller::index<> > >& hkl_ints;
+
+      LatticeBand(af::const_ref<scitbx::vec3<double> > const& rlps_,
+                  af::const_ref<scitbx::mat3<double> > const& UB_matrices_,
+                  const std::vector<std::size_t>& nn_,
+                  std::size_t nearest_neighbours_,
+                  double epsilon_,
+                  double delta_,
+                  double l_min_,
+                  std::vector<std::vector<char> >& in_largest_subtree_,
+                  std::vector<std::vector<cctbx::miller::index<> > >& hkl_ints_)
+          : rlps(rlps_),
+            UB_matrices(UB_matrices_),
+            nn(nn_),
+            nearest_neighbours(nearest_neighbours_),
+            epsilon(epsilon_),
+            delta(delta_),
+            l_min(l_min_),
+            in_largest_subtree(in_largest_subtree_),
+            hkl_ints(hkl_ints_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i_lattice = i0; i_lattice < i1; i_lattice++) {
+          largest_subtree(UB_matrices[i_lattice].inverse(),
+                          in_largest_subtree[i_lattice],
+                          hkl_ints[i_lattice]);
+        }
+      }
 
-      // loop over crystals and assign one hkl per crystal per reflection
-      for (int i_lattice = 0; i_lattice < UB_matrices.size(); i_lattice++) {
-        scitbx::mat3<double> const& A = UB_matrices[i_lattice];
-        scitbx::mat3<double> const& A_inv = A.inverse();
+      void largest_subtree(scitbx::mat3<double> const& A_inv,
+                           std::vector<char>& in_subtree,
+                           std::vector<cctbx::miller::index<> >& hkl_ints_) const {
+        using namespace boost;
 
-        Graph G(reciprocal_space_points.size());
+        typedef Graph::vertex_descriptor Vertex;
+        typedef graph_traits<Graph>::edge_descriptor Edge;
 
-        for (std::size_t i = 0; i < reciprocal_space_points.size(); i++) {
+        const double one_over_epsilon = 1.0 / epsilon;
+
+        Graph G(rlps.size());
+
+        for (std::size_t i = 0; i < rlps.size(); i++) {
           std::size_t i_k = i * nearest_neighbours;
           for (std::size_t i_ann = 0; i_ann < nearest_neighbours; i_ann++) {
             std::size_t i_k_plus_i_ann = i_k + i_ann;
-            std::size_t j = ann.nn[i_k_plus_i_ann];
+            std::size_t j = nn[i_k_plus_i_ann];
             if (boost::edge(i, j, G).second) {
               continue;
             }
-            scitbx::vec3<double> d_r =
-              reciprocal_space_points[i] - reciprocal_space_points[j];
+            scitbx::vec3<double> d_r = rlps[i] - rlps[j];
             scitbx::vec3<double> h_f = A_inv * d_r;
             scitbx::vec3<double> h_ij;
             for (std::size_t ii = 0; ii < 3; ii++) {
@@ -266,7 +465,7 @@ namespace dials { namespace algorithms {
           G, &p[0], boost::weight_map(boost::get(&MyEdge::l_ij, G)));
 
         // create a graph for the MST
-        Graph MST(reciprocal_space_points.size());
+        Graph MST(rlps.size());
 
         // add all the edges to the MST
         for (size_t i = 0; i < p.size(); ++i) {
@@ -304,8 +503,8 @@ namespace dials { namespace algorithms {
         // edge weight l_ij >= l_min, or if we start a new component
         std::size_t next_subtree = 0;
         int last_component = -1;
-        af::shared<std::size_t> subtree_ids_(reciprocal_space_points.size(), 0);
-        af::shared<cctbx::miller::index<> > hkl_ints_(reciprocal_space_points.size());
+        std::vector<std::size_t> subtree_ids_(rlps.size(), 0);
+        hkl_ints_.assign(rlps.size(), cctbx::miller::index<>(0, 0, 0));
 
         for (std::vector<Edge>::iterator it = ordered_edges.begin();
              it != ordered_edges.end();
@@ -347,33 +546,14 @@ namespace dials { namespace algorithms {
           }
         }
 
-        for (std::size_t i = 0; i < reciprocal_space_points.size(); i++) {
-          if (subtree_ids_[i] != largest_subtree_id) {
-            continue;
-          } else if (crystal_ids_[i] == -2) {
-            continue;
-          } else if (crystal_ids_[i] == -1) {
-            miller_indices_[i] = hkl_ints_[i];
-            crystal_ids_[i] = i_lattice;
-          } else {
-            crystal_ids_[i] = -2;
-            miller_indices_[i] = cctbx::miller::index<>(0, 0, 0);
-          }
+        in_subtree.assign(rlps.size(), 0);
+        for (std::size_t i = 0; i < rlps.size(); i++) {
+          in_subtree[i] = subtree_ids_[i] == largest_subtree_id;
         }
       }
-    }
+    };
 
-    af::shared<cctbx::miller::index<> > miller_indices() {
-      return miller_indices_;
-    }
-
-    af::shared<int> crystal_ids() {
-      return crystal_ids_;
-    }
-
-  private:
     af::shared<cctbx::miller::index<> > miller_indices_;
-    af::shared<std::size_t> subtree_ids_;
     af::shared<int> crystal_ids_;
   };
 
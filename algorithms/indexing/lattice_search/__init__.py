@@ -123,6 +123,7 @@ def __init__(self, reflections, experiments, params=None):
                 target_symmetry_primitive=self._symmetry_handler.target_symmetry_primitive,
                 max_lattices=self.params.basis_vector_combinations.max_refine,
                 params=getattr(self.params, entry_point.name),
+                nproc=self.params.nproc,
             )
         else:
             self._lattice_search_strategy = None
@@ -324,6 +325,7 @@ def __init__(self, reflections, experiments, params=None):
             min_cell=self.params.min_cell,
             target_unit_cell=target_unit_cell,
             params=getattr(self.params, entry_point.name),
+            nproc=self.params.nproc,
         )
 
     def find_candidate_basis_vectors(self):
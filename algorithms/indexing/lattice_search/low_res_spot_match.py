@@ -13,13 +13,13 @@
 
 from dials.algorithms.indexing import DialsIndexError
 from dials.array_family import flex
+from dials_algorithms_indexing_ext import LowResSpotMatchStems
 
 from .strategy import Strategy
 
 logger = logging.getLogger(__name__)
 
 TWO_PI = 2.0 * math.pi
-FIVE_DEG = TWO_PI * 5.0 / 360.0
 
 
 class CompleteGraph(object):
@@ -124,7 +124,13 @@ class LowResSpotMatch(Strategy):
     phil_scope = libtbx.phil.parse(low_res_spot_match_phil_str)
 
     def __init__(
-        self, target_symmetry_primitive, max_lattices, params=None, *args, **kwargs
+        self,
+        target_symmetry_primitive,
+        max_lattices,
+        params=None,
+        nproc=1,
+        *args,
+        **kwargs
     ):
         """Construct a LowResSpotMatch object.
 
@@ -133,10 +139,13 @@ def __init__(
                 crystal symmetry and unit cell
 
             max_lattices (int): The maximum number of lattice models to find
+
+            nproc (int): The number of threads to use when matching seeds
         """
         super(LowResSpotMatch, self).__init__(params=params, *args, **kwargs)
         self._target_symmetry_primitive = target_symmetry_primitive
         self._max_lattices = max_lattices
+        self._nproc = nproc
 
         if target_symmetry_primitive is None:
             raise DialsIndexError(
@@ -177,9 +186,7 @@ def find_crystal_models(self, reflections, experiments):
         # Second search: match seed spots with another spot from a different
         # reciprocal lattice row, such that the observed reciprocal space distances
         # are within tolerances
-        pairs = []
-        for seed in seeds:
-            pairs.extend(self._pairs_with_seed(seed))
+        pairs = self._pairs_with_seeds(seeds)
         logger.info("Found {0} pairs".format(len(pairs)))
         pairs = list(set(pairs))  # filter duplicates
 
@@ -397,43 +404,39 @@ def _calc_seeds_and_stems(self):
 
         self.stems.sort(key=operator.itemgetter("residual_d_star"))
 
-    def _pairs_with_seed(self, seed):
-        seed_rlp = matrix.col(self.spots[seed["spot_id"]]["rlp"])
-
-        result = []
-        for cand in self.stems:
-            # Don't check the seed spot itself
-            if cand["spot_id"] == seed["spot_id"]:
-                continue
-
-            # Skip spots at a very similar clock angle, which probably belong to the
-            # same line of indices from the origin
-            angle_diff = cand["clock_angle"] - seed["clock_angle"]
-            angle_diff = abs(((angle_diff + math.pi) % TWO_PI) - math.pi)
-            if angle_diff < FIVE_DEG:
-                continue
+        # Hold the stems in C++ for the distance tests of the later searches
+        spot_ids, clock_angles, rlp_datums = self._as_arrays(self.stems)
+        self._stem_tests = LowResSpotMatchStems(
+            self.spots["rlp"],
+            self.spots["d_star_band2"],
+            spot_ids,
+            clock_angles,
+            rlp_datums,
+        )
 
-            # Calculate the plane normal for the plane containing the seed and stem.
-            # Skip pairs of Miller indices that belong to the same line
-            seed_vec = seed["rlp_datum"]
-            cand_vec = cand["rlp_datum"]
-            try:
-                seed_vec.cross(cand_vec).normalize()
-            except ZeroDivisionError:
-                continue
+    @staticmethod
+    def _as_arrays(candidates):
+        # The spot ids, clock angles and expected relps of a list of seeds or stems
+        spot_ids = flex.size_t([c["spot_id"] for c in candidates])
+        clock_angles = flex.double([c["clock_angle"] for c in candidates])
+        rlp_datums = flex.vec3_double([c["rlp_datum"] for c in candidates])
+        return spot_ids, clock_angles, rlp_datums
+
+    def _pairs_with_seeds(self, seeds):
+        # Match each seed with the stems that are not at a similar clock angle
+        # or on the same line of indices, and for which the observed reciprocal
+        # space distance agrees with the expected distance to within the sum in
+        # quadrature of the tolerated d* bands. The tests over all seeds and
+        # stems are done in C++
+        spot_ids, clock_angles, rlp_datums = self._as_arrays(seeds)
+        seed_index, stem_index, residual = self._stem_tests.pairs_with_seeds(
+            spot_ids, clock_angles, rlp_datums, nthreads=self._nproc
+        )
 
-            # Compare expected reciprocal space distance with observed distance
-            cand_rlp = matrix.col(self.spots[cand["spot_id"]]["rlp"])
-            obs_dist = (cand_rlp - seed_rlp).length()
-            exp_dist = (seed_vec - cand_vec).length()
-            r_dist = abs(obs_dist - exp_dist)
-
-            # If the distance difference is larger than the sum in quadrature of the
-            # tolerated d* bands then reject the candidate
-            sq_band1 = self.spots[seed["spot_id"]]["d_star_band2"]
-            sq_band2 = self.spots[cand["spot_id"]]["d_star_band2"]
-            if r_dist > math.sqrt(sq_band1 + sq_band2):
-                continue
+        result = []
+        for i, j, r_dist in zip(seed_index, stem_index, residual):
+            seed = seeds[i]
+            cand = self.stems[j]
 
             # Store the seed-stem match as a 2-node graph
             g = CompleteGraph(
@@ -462,12 +465,15 @@ def _extend_by_candidates(self, graph):
 
         result = []
 
-        for cand in self.stems:
-            # Don't check spots already matched
-            if cand["spot_id"] in existing_ids:
-                continue
+        # Reject stems for spots already matched, or for which any of the
+        # differences between observed and expected reciprocal space distances is
+        # larger than the sum in quadrature of the tolerated d* bands
+        accepted = self._stem_tests.extend_candidates(
+            flex.size_t(existing_ids), flex.vec3_double(exp_relps)
+        )
 
-            # Compare expected reciprocal space distances with observed distances
+        for k in accepted:
+            cand = self.stems[k]
             cand_rlp = matrix.col(self.spots[cand["spot_id"]]["rlp"])
             cand_vec = cand["rlp_datum"]
 
@@ -476,18 +482,6 @@ def _extend_by_candidates(self, graph):
 
             residual_dist = [abs(a - b) for (a, b) in zip(obs_dists, exp_dists)]
 
-            # If any of the distance differences is larger than the sum in quadrature
-            # of the tolerated d* bands then reject the candidate
-            sq_candidate_band = self.spots[cand["spot_id"]]["d_star_band2"]
-            bad_candidate = False
-            for r_dist, spot_id in zip(residual_dist, existing_ids):
-                sq_relp_band = self.spots[spot_id]["d_star_band2"]
-                if r_dist > math.sqrt(sq_relp_band + sq_candidate_band):
-                    bad_candidate = True
-                    break
-            if bad_candidate:
-                continue
-
             # Calculate co-planarity of the relps, including the origin
             points = flex.vec3_double(exp_relps + [cand_vec, (0.0, 0.0, 0.0)])
             plane = least_squares_plane(points)
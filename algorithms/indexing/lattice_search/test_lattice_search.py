@@ -1,16 +1,21 @@
 from __future__ import absolute_import, division, print_function
 
+import math
+import random
+
 import py.path
 import pytest
 
 from cctbx import sgtbx, uctbx
 from dxtbx.imageset import ImageSet
 from dxtbx.serialize import load
+from scitbx import matrix
 
 from dials.algorithms.indexing import lattice_search, stills_indexer
 from dials.array_family import flex
 from dials.command_line.index import phil_scope
 from dials.command_line.slice_sequence import slice_experiments, slice_reflections
+from dials_algorithms_indexing_ext import LowResSpotMatchStems
 
 
 @pytest.fixture
@@ -105,3 +110,66 @@ def test_stills_indexer_methods_i04_weak_data(
     assert indexed_experiments[0].crystal.get_unit_cell().parameters() == pytest.approx(
         (57.752, 57.776, 150.013, 90.0101, 89.976, 90.008), rel=1e-2
     )
+
+
+def test_low_res_spot_match_stems():
+    random.seed(42)
+    nspots, nstems = 10, 40
+    spot_rlps = flex.vec3_double(
+        [tuple(random.uniform(-0.1, 0.1) for _ in range(3)) for _ in range(nspots)]
+    )
+    band2 = flex.double([random.uniform(0, 1e-4) for _ in range(nspots)])
+    spot_ids = flex.size_t([random.randrange(nspots) for _ in range(nstems)])
+    clock_angles = flex.double([random.uniform(0, 2 * math.pi) for _ in range(nspots)])
+    stem_angles = clock_angles.select(spot_ids)
+    rlp_datums = flex.vec3_double(
+        [
+            (matrix.col(spot_rlps[i]) + matrix.col([random.gauss(0, 0.005)] * 3)).elems
+            for i in spot_ids
+        ]
+    )
+    stems = LowResSpotMatchStems(spot_rlps, band2, spot_ids, stem_angles, rlp_datums)
+    assert len(stems) == nstems
+
+    def accept(i, k):
+        # The distance test between the spot and expected relp of stems i and k
+        obs = matrix.col(spot_rlps[spot_ids[k]]) - matrix.col(spot_rlps[spot_ids[i]])
+        exp = matrix.col(rlp_datums[i]) - matrix.col(rlp_datums[k])
+        r_dist = abs(obs.length() - exp.length())
+        return r_dist, r_dist <= math.sqrt(band2[spot_ids[i]] + band2[spot_ids[k]])
+
+    # Use every stem as a seed and compare with the tests done in Python
+    expected = []
+    for i in range(nstems):
+        for k in range(nstems):
+            if spot_ids[k] == spot_ids[i]:
+                continue
+            angle_diff = stem_angles[k] - stem_angles[i] + math.pi
+            if abs((angle_diff % (2 * math.pi)) - math.pi) < math.radians(5):
+                continue
+            if matrix.col(rlp_datums[i]).cross(matrix.col(rlp_datums[k])).length() == 0:
+                continue
+            r_dist, ok = accept(i, k)
+            if ok:
+                expected.append((i, k, r_dist))
+    for nthreads in (1, 4):
+        seed_index, stem_index, residual = stems.pairs_with_seeds(
+            spot_ids, stem_angles, rlp_datums, nthreads=nthreads
+        )
+        assert list(zip(seed_index, stem_index)) == [e[:2] for e in expected]
+        assert list(residual) == pytest.approx([e[2] for e in expected])
+    assert expected
+
+    # Extend a graph of the first pair
+    i, k, _ = expected[0]
+    accepted = stems.extend_candidates(
+        flex.size_t([spot_ids[i], spot_ids[k]]),
+        flex.vec3_double([rlp_datums[i], rlp_datums[k]]),
+    )
+    assert list(accepted) == [
+        j
+        for j in range(nstems)
+        if spot_ids[j] not in (spot_ids[i], spot_ids[k])
+        and accept(i, j)[1]
+        and accept(k, j)[1]
+    ]
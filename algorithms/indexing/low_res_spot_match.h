@@ -0,0 +1,232 @@
+/*
+ * low_res_spot_match.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INDEXING_LOW_RES_SPOT_MATCH_H
+#define DIALS_ALGORITHMS_INDEXING_LOW_RES_SPOT_MATCH_H
+
+#include <cmath>
+#include <vector>
+#include <scitbx/vec3.h>
+#include <scitbx/constants.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * The candidate matches of observed low resolution spots to Miller indices
+   * (the "stems") used by the low_res_spot_match lattice search, with the
+   * tests that compare the observed reciprocal space distances between spots
+   * with those expected from the matched indices. The tests for each seed or
+   * graph are done over all the stems in one pass, leaving only the accepted
+   * candidates to be turned into graphs.
+   */
+  class LowResSpotMatchStems {
+  public:
+    /**
+     * @param spot_rlps The reciprocal lattice point of each spot
+     * @param spot_d_star_band2 The squared width of the d* band of each spot
+     * @param stem_spot_ids The spot of each stem
+     * @param stem_clock_angles The clock angle of the spot of each stem
+     * @param stem_rlp_datums The reciprocal lattice point of the Miller index
+     *                        of each stem in the target cell
+     */
+    LowResSpotMatchStems(const af::const_ref<scitbx::vec3<double> > &spot_rlps,
+                         const af::const_ref<double> &spot_d_star_band2,
+                         const af::const_ref<std::size_t> &stem_spot_ids,
+                         const af::const_ref<double> &stem_clock_angles,
+                         const af::const_ref<scitbx::vec3<double> > &stem_rlp_datums)
+        : spot_rlps_(spot_rlps.begin(), spot_rlps.end()),
+          spot_d_star_band2_(spot_d_star_band2.begin(), spot_d_star_band2.end()),
+          stem_spot_ids_(stem_spot_ids.begin(), stem_spot_ids.end()),
+          stem_clock_angles_(stem_clock_angles.begin(), stem_clock_angles.end()),
+          stem_rlp_datums_(stem_rlp_datums.begin(), stem_rlp_datums.end()) {
+      DIALS_ASSERT(spot_d_star_band2.size() == spot_rlps.size());
+      DIALS_ASSERT(stem_clock_angles.size() == stem_spot_ids.size());
+      DIALS_ASSERT(stem_rlp_datums.size() == stem_spot_ids.size());
+      for (std::size_t i = 0; i < stem_spot_ids.size(); ++i) {
+        DIALS_ASSERT(stem_spot_ids[i] < spot_rlps.size());
+      }
+    }
+
+    /** @returns The number of stems */
+    std::size_t size() const {
+      return stem_spot_ids_.size();
+    }
+
+    /**
+     * Find the stems that pair with each of a set of seeds. A stem is
+     * rejected if it is for the spot of the seed, if its spot is within five
+     * degrees of the seed spot on the clock face, if its Miller index is on
+     * the same line as that of the seed, or if the observed and expected
+     * distances between the two differ by more than the sum in quadrature of
+     * their d* bands. The seeds are split into bands across threads, and the
+     * pairs are returned in order of seed, then stem.
+     * @param seed_spot_ids The spot of each seed
+     * @param seed_clock_angles The clock angle of the spot of each seed
+     * @param seed_rlp_datums The expected reciprocal lattice point of each seed
+     * @param seed_index The seed of each pair
+     * @param stem_index The stem of each pair
+     * @param residual The difference of observed and expected distances of
+     *                 each pair
+     * @param nthreads The number of threads to use
+     */
+    void pairs_with_seeds(const af::const_ref<std::size_t> &seed_spot_ids,
+                          const af::const_ref<double> &seed_clock_angles,
+                          const af::const_ref<scitbx::vec3<double> > &seed_rlp_datums,
+                          af::shared<std::size_t> seed_index,
+                          af::shared<std::size_t> stem_index,
+                          af::shared<double> residual,
+                          std::size_t nthreads = 1) const {
+      DIALS_ASSERT(seed_clock_angles.size() == seed_spot_ids.size());
+      DIALS_ASSERT(seed_rlp_datums.size() == seed_spot_ids.size());
+      for (std::size_t i = 0; i < seed_spot_ids.size(); ++i) {
+        DIALS_ASSERT(seed_spot_ids[i] < spot_rlps_.size());
+      }
+      std::vector<std::vector<Pair> > pairs(seed_spot_ids.size());
+      for_each_band(
+        PairsBand(*this, seed_spot_ids, seed_clock_angles, seed_rlp_datums, pairs),
+        (int)seed_spot_ids.size(),
+        nthreads);
+      for (std::size_t i = 0; i < pairs.size(); ++i) {
+        for (std::size_t j = 0; j < pairs[i].size(); ++j) {
+          seed_index.push_back(i);
+          stem_index.push_back(pairs[i][j].stem);
+          residual.push_back(pairs[i][j].residual);
+        }
+      }
+    }
+
+    /**
+     * Find the stems that could extend a graph of matched spots. A stem is
+     * rejected if its spot is already in the graph, or if the observed and
+     * expected distances to any spot of the graph differ by more than the sum
+     * in quadrature of their d* bands.
+     * @param vertex_spot_ids The spot of each vertex of the graph
+     * @param vertex_rlp_datums The expected reciprocal lattice point of each
+     *                          vertex of the graph
+     * @returns The indices of the accepted stems
+     */
+    af::shared<std::size_t> extend_candidates(
+      const af::const_ref<std::size_t> &vertex_spot_ids,
+      const af::const_ref<scitbx::vec3<double> > &vertex_rlp_datums) const {
+      DIALS_ASSERT(vertex_rlp_datums.size() == vertex_spot_ids.size());
+      for (std::size_t i = 0; i < vertex_spot_ids.size(); ++i) {
+        DIALS_ASSERT(vertex_spot_ids[i] < spot_rlps_.size());
+      }
+      af::shared<std::size_t> result;
+      for (std::size_t k = 0; k < stem_spot_ids_.size(); ++k) {
+        std::size_t spot = stem_spot_ids_[k];
+        bool accept = true;
+        for (std::size_t i = 0; i < vertex_spot_ids.size() && accept; ++i) {
+          accept = spot != vertex_spot_ids[i];
+        }
+        const scitbx::vec3<double> &cand_rlp = spot_rlps_[spot];
+        const scitbx::vec3<double> &cand_vec = stem_rlp_datums_[k];
+        for (std::size_t i = 0; i < vertex_spot_ids.size() && accept; ++i) {
+          double obs_dist = (cand_rlp - spot_rlps_[vertex_spot_ids[i]]).length();
+          double exp_dist = (vertex_rlp_datums[i] - cand_vec).length();
+          double r_dist = std::abs(obs_dist - exp_dist);
+          accept = !(r_dist > std::sqrt(spot_d_star_band2_[vertex_spot_ids[i]]
+                                        + spot_d_star_band2_[spot]));
+        }
+        if (accept) {
+          result.push_back(k);
+        }
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * An accepted stem for a seed
+     */
+    struct Pair {
+      std::size_t stem;
+      double residual;
+
+      Pair(std::size_t stem_, double residual_) : stem(stem_), residual(residual_) {}
+    };
+
+    /**
+     * Find the pairs for a band of seeds
+     */
+    struct PairsBand {
+      const LowResSpotMatchStems &parent;
+      af::const_ref<std::size_t> seed_spot_ids;
+      af::const_ref<double> seed_clock_angles;
+      af::const_ref<scitbx::vec3<double> > seed_rlp_datums;
+      std::vector<std::vector<Pair> > &pairs;
+
+      PairsBand(const LowResSpotMatchStems &parent_,
+                const af::const_ref<std::size_t> &seed_spot_ids_,
+                const af::const_ref<double> &seed_clock_angles_,
+                const af::const_ref<scitbx::vec3<double> > &seed_rlp_datums_,
+                std::vector<std::vector<Pair> > &pairs_)
+          : parent(parent_),
+            seed_spot_ids(seed_spot_ids_),
+            seed_clock_angles(seed_clock_angles_),
+            seed_rlp_datums(seed_rlp_datums_),
+            pairs(pairs_) {}
+
+      void operator()(int i0, int i1) const {
+        const double pi = scitbx::constants::pi;
+        const double two_pi = scitbx::constants::two_pi;
+        const double five_deg = two_pi * 5.0 / 360.0;
+        for (int i = i0; i < i1; ++i) {
+          std::size_t seed_spot = seed_spot_ids[i];
+          const scitbx::vec3<double> &seed_rlp = parent.spot_rlps_[seed_spot];
+          const scitbx::vec3<double> &seed_vec = seed_rlp_datums[i];
+          for (std::size_t k = 0; k < parent.stem_spot_ids_.size(); ++k) {
+            // Don't check the seed spot itself
+            std::size_t spot = parent.stem_spot_ids_[k];
+            if (spot == seed_spot) {
+              continue;
+            }
+
+            // Skip spots at a very similar clock angle
+            double angle_diff = std::fmod(
+              parent.stem_clock_angles_[k] - seed_clock_angles[i] + pi, two_pi);
+            if (angle_diff < 0) {
+              angle_diff += two_pi;
+            }
+            if (std::abs(angle_diff - pi) < five_deg) {
+              continue;
+            }
+
+            // Skip pairs of Miller indices that belong to the same line
+            const scitbx::vec3<double> &cand_vec = parent.stem_rlp_datums_[k];
+            if (seed_vec.cross(cand_vec).length() == 0) {
+              continue;
+            }
+
+            // Compare expected reciprocal space distance with observed distance
+            double obs_dist = (parent.spot_rlps_[spot] - seed_rlp).length();
+            double exp_dist = (seed_vec - cand_vec).length();
+            double r_dist = std::abs(obs_dist - exp_dist);
+            if (r_dist > std::sqrt(parent.spot_d_star_band2_[seed_spot]
+                                   + parent.spot_d_star_band2_[spot])) {
+              continue;
+            }
+            pairs[i].push_back(Pair(k, r_dist));
+          }
+        }
+      }
+    };
+
+    af::shared<scitbx::vec3<double> > spot_rlps_;
+    af::shared<double> spot_d_star_band2_;
+    af::shared<std::size_t> stem_spot_ids_;
+    af::shared<double> stem_clock_angles_;
+    af::shared<scitbx::vec3<double> > stem_rlp_datums_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INDEXING_LOW_RES_SPOT_MATCH_H
@@ -244,3 +244,39 @@ def test_index_reflections(dials_regression):
     assert "miller_index" in reflections
     counts = reflections["id"].counts()
     assert dict(counts) == {-1: 1390, 0: 114692}
+
+
+@pytest.mark.parametrize("method", ["global", "local"])
+def test_assign_indices_nthreads(method):
+    import dials_algorithms_indexing_ext as ext
+
+    # reciprocal lattice points of two lattices, with some noise
+    UB_matrices = flex.mat3_double()
+    rlps = flex.vec3_double()
+    for i_lattice in range(2):
+        A = matrix.sqr(random_rotation()) * matrix.diag([0.02, 0.025, 0.03])
+        UB_matrices.append(A.elems)
+        for h in range(-8, 9):
+            for k in range(-8, 9):
+                for l in range(-4, 5):
+                    rlps.append((A * matrix.col((h, k, l))).elems)
+    rlps += flex.vec3_double(
+        flex.random_double(len(rlps)) * 1e-3,
+        flex.random_double(len(rlps)) * 1e-3,
+        flex.random_double(len(rlps)) * 1e-3,
+    )
+    phi = flex.random_double(len(rlps))
+
+    if method == "global":
+        results = [
+            ext.AssignIndices(rlps, phi, UB_matrices, nthreads=nthreads)
+            for nthreads in (1, 3)
+        ]
+    else:
+        results = [
+            ext.AssignIndicesLocal(rlps, phi, UB_matrices, nthreads=nthreads)
+            for nthreads in (1, 3)
+        ]
+    assert results[0].crystal_ids().count(-1) < len(rlps)
+    assert list(results[1].crystal_ids()) == list(results[0].crystal_ids())
+    assert list(results[1].miller_indices()) == list(results[0].miller_indices())
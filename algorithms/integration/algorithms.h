@@ -13,7 +13,11 @@
 #define DIALS_ALGORITHMS_INTEGRATION_ALGORITHMS_H
 
 #include <numeric>
+#include <string>
+#include <vector>
 
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
@@ -922,7 +926,152 @@ namespace dials { namespace algorithms {
   };
 
   /**
-   * A class implementing reference profile formation algorithm
+   * A set of profile modellers for each thread adding reference profiles.
+   *
+   * The first time a thread adds a profile it is given its own modeller for
+   * each experiment, so profiles are added without any locking. The modellers
+   * of all the threads are merged with a parallel tree reduction: at each
+   * level pairs of modellers are accumulated on separate threads, halving the
+   * number left, until a single set remains which is then accumulated into
+   * the result. The thread modellers are then released; threads adding
+   * profiles afterwards are given new ones.
+   *
+   * Profiles may be added from any number of threads at once but the reduction
+   * must not run at the same time as an add.
+   */
+  class ThreadLocalEmpiricalProfileModellers : public boost::noncopyable {
+  public:
+    /**
+     * @param prototype The modellers for each experiment to copy the sizes of
+     */
+    ThreadLocalEmpiricalProfileModellers(
+      const af::const_ref<ThreadSafeEmpiricalProfileModeller> &prototype)
+        : generation_(0) {
+      for (std::size_t i = 0; i < prototype.size(); ++i) {
+        size_.push_back(prototype[i].size());
+        datasize_.push_back(prototype[i].datasize());
+        threshold_.push_back(prototype[i].threshold());
+      }
+    }
+
+    /**
+     * Add a profile to the calling thread's modeller for an experiment
+     * @param experiment_id The experiment
+     * @param index The index of the profile to add to
+     * @param weight The weight to give the profile
+     * @param profile The profile data
+     */
+    void add_single(std::size_t experiment_id,
+                    std::size_t index,
+                    double weight,
+                    EmpiricalProfileModeller::data_const_reference profile) {
+      slot_type &modellers = local();
+      DIALS_ASSERT(experiment_id < modellers.size());
+      modellers[experiment_id].add_single(index, weight, profile);
+    }
+
+    /**
+     * Merge the thread modellers and accumulate them into the result
+     * @param result The modellers for each experiment
+     */
+    void reduce(af::ref<ThreadSafeEmpiricalProfileModeller> result) {
+      DIALS_ASSERT(result.size() == size_.size());
+      for (std::size_t stride = 1; stride < slots_.size(); stride *= 2) {
+        std::string error;
+        boost::mutex error_mutex;
+        boost::thread_group threads;
+        for (std::size_t i = 0; i + stride < slots_.size(); i += 2 * stride) {
+          threads.create_thread(boost::bind(&accumulate_slot,
+                                            slots_[i].get(),
+                                            slots_[i + stride].get(),
+                                            &error,
+                                            &error_mutex));
+        }
+        threads.join_all();
+        if (!error.empty()) {
+          throw DIALS_ERROR(error);
+        }
+      }
+      if (!slots_.empty()) {
+        for (std::size_t i = 0; i < result.size(); ++i) {
+          result[i].accumulate_raw_pointer(&(*slots_[0])[i]);
+        }
+      }
+      slots_.clear();
+      generation_++;
+    }
+
+    /**
+     * @returns True/False whether there are no profiles waiting to be reduced
+     */
+    bool empty() const {
+      return slots_.empty();
+    }
+
+  private:
+    typedef std::vector<EmpiricalProfileModeller> slot_type;
+
+    /**
+     * The slot held by a thread and the generation it was given in
+     */
+    struct SlotRef {
+      std::size_t generation;
+      slot_type *slot;
+      SlotRef(std::size_t generation_, slot_type *slot_)
+          : generation(generation_), slot(slot_) {}
+    };
+
+    /**
+     * @returns The modellers of the calling thread
+     */
+    slot_type &local() {
+      SlotRef *ref = slot_ref_.get();
+      if (ref == NULL || ref->generation != generation_) {
+        boost::shared_ptr<slot_type> slot(new slot_type());
+        for (std::size_t i = 0; i < size_.size(); ++i) {
+          slot->push_back(
+            EmpiricalProfileModeller(size_[i], datasize_[i], threshold_[i]));
+        }
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        slots_.push_back(slot);
+        slot_ref_.reset(new SlotRef(generation_, slot.get()));
+        ref = slot_ref_.get();
+      }
+      return *ref->slot;
+    }
+
+    /**
+     * Accumulate one set of thread modellers into another
+     */
+    static void accumulate_slot(slot_type *result,
+                                const slot_type *other,
+                                std::string *error,
+                                boost::mutex *error_mutex) {
+      try {
+        DIALS_ASSERT(result->size() == other->size());
+        for (std::size_t i = 0; i < result->size(); ++i) {
+          (*result)[i].accumulate_raw_pointer(&(*other)[i]);
+        }
+      } catch (std::exception const &e) {
+        boost::lock_guard<boost::mutex> lock(*error_mutex);
+        *error = e.what();
+      }
+    }
+
+    std::vector<std::size_t> size_;
+    std::vector<int3> datasize_;
+    std::vector<double> threshold_;
+    std::vector<boost::shared_ptr<slot_type> > slots_;
+    boost::thread_specific_ptr<SlotRef> slot_ref_;
+    boost::mutex mutex_;
+    std::size_t generation_;
+  };
+
+  /**
+   * A class implementing reference profile formation algorithm. Each thread
+   * adds profiles to its own modellers (see ThreadLocalEmpiricalProfileModellers)
+   * which are merged into the result by finalize, once all the threads have
+   * finished adding profiles.
    */
   class GaussianRSReferenceCalculator : public ReferenceCalculatorIface {
   public:
@@ -930,7 +1079,8 @@ namespace dials { namespace algorithms {
                                   const af::const_ref<TransformSpec> &spec)
         : sampler_(sampler),
           spec_(spec.begin(), spec.end()),
-          modeller_(init_modeller(sampler, spec)) {}
+          modeller_(init_modeller(sampler, spec)),
+          local_(new ThreadLocalEmpiricalProfileModellers(modeller_.const_ref())) {}
 
     GaussianRSReferenceCalculator(
       boost::shared_ptr<SamplerIface> sampler,
@@ -938,7 +1088,17 @@ namespace dials { namespace algorithms {
       const af::const_ref<ThreadSafeEmpiricalProfileModeller> &modeller)
         : sampler_(sampler),
           spec_(spec.begin(), spec.end()),
-          modeller_(modeller.begin(), modeller.end()) {}
+          modeller_(modeller.begin(), modeller.end()),
+          local_(new ThreadLocalEmpiricalProfileModellers(modeller_.const_ref())) {}
+
+    /**
+     * Copy a finalized calculator. The copy starts with no thread modellers.
+     */
+    GaussianRSReferenceCalculator(const GaussianRSReferenceCalculator &other)
+        : sampler_(other.sampler_),
+          spec_(other.spec_),
+          modeller_(other.modeller()),
+          local_(new ThreadLocalEmpiricalProfileModellers(modeller_.const_ref())) {}
 
     ~GaussianRSReferenceCalculator() {}
 
@@ -950,7 +1110,20 @@ namespace dials { namespace algorithms {
       return spec_;
     }
 
+    /**
+     * Merge the profiles added by each thread into the modellers. This must be
+     * called once the threads have finished adding profiles and before the
+     * modellers are used.
+     */
+    void finalize() {
+      local_->reduce(modeller_.ref());
+    }
+
+    /**
+     * @returns The modellers, which must have been finalized
+     */
     af::shared<ThreadSafeEmpiricalProfileModeller> modeller() const {
+      DIALS_ASSERT(local_->empty());
       return modeller_;
     }
 
@@ -1019,14 +1192,12 @@ namespace dials { namespace algorithms {
                                            mask.const_ref());
 
         // Get the indices and weights of the profiles
-        af::shared<std::size_t> indices = sampler_->nearest_n(sbox.panel, xyzpx);
+        af::shared<std::size_t> indices;
+        af::shared<double> weights;
+        sampler_->nearest_n_weights(sbox.panel, xyzpx, indices, weights);
         for (std::size_t j = 0; j < indices.size(); ++j) {
-          // Get the weighting
-          double weight = sampler_->weight(indices[j], sbox.panel, xyzpx);
-
-          // Add the profile
-          modeller_[experiment_id].add_single(
-            indices[j], weight, transform.profile().const_ref());
+          local_->add_single(
+            experiment_id, indices[j], weights[j], transform.profile().const_ref());
         }
 
         // Set the flags
@@ -1042,9 +1213,11 @@ namespace dials { namespace algorithms {
      * @param other The other reference calculator
      */
     void accumulate(const GaussianRSReferenceCalculator &other) {
-      DIALS_ASSERT(modeller_.size() == other.modeller_.size());
+      af::shared<ThreadSafeEmpiricalProfileModeller> other_modeller = other.modeller();
+      finalize();
+      DIALS_ASSERT(modeller_.size() == other_modeller.size());
       for (std::size_t i = 0; i < modeller_.size(); ++i) {
-        modeller_[i].accumulate_raw_pointer(&other.modeller_[i]);
+        modeller_[i].accumulate_raw_pointer(&other_modeller[i]);
       }
     }
 
@@ -1054,6 +1227,7 @@ namespace dials { namespace algorithms {
      */
     GaussianRSMultiCrystalReferenceProfileData reference_profiles() {
       GaussianRSMultiCrystalReferenceProfileData result;
+      finalize();
       DIALS_ASSERT(modeller_.size() == spec_.size());
       for (std::size_t i = 0; i < spec_.size(); ++i) {
         modeller_[i].finalize();
@@ -1133,6 +1307,7 @@ namespace dials { namespace algorithms {
     boost::shared_ptr<SamplerIface> sampler_;
     af::shared<TransformSpec> spec_;
     af::shared<ThreadSafeEmpiricalProfileModeller> modeller_;
+    boost::shared_ptr<ThreadLocalEmpiricalProfileModellers> local_;
   };
 
 }}  // namespace dials::algorithms
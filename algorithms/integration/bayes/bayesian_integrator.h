@@ -75,17 +75,14 @@ namespace dials { namespace algorithms {
      * @returns The reflection intensity
      */
     FloatType intensity() const {
-      using boost::math::gamma_q;
-      double C = sum_p_;
-      double B = sum_b_;
-      return gamma_q(C + 1, B) * ((C + 1) * gamma_q(C + 1, B) - B * gamma_q(C + 1, B));
+      return intensity_;
     }
 
     /**
      * @returns the variance on the integrated intensity
      */
     FloatType variance() const {
-      FloatType Is = intensity();
+      FloatType Is = intensity_;
       FloatType Ib = sum_b_;
       FloatType m_n =
         n_background_ > 0 ? (FloatType)n_signal_ / (FloatType)n_background_ : 0.0;
@@ -143,28 +140,49 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(signal.size() == background.size());
       DIALS_ASSERT(signal.size() == mask.size());
 
-      // Calculate the signal and background intensity
+      // Calculate the signal and background intensity. The sums are kept in
+      // local variables so that they can stay in registers in the loop.
       int bg_code = Valid | Background | BackgroundUsed;
-      success_ = true;
-      sum_p_ = 0;
-      sum_b_ = 0;
-      n_signal_ = 0;
-      n_background_ = 0;
+      bool success = true;
+      FloatType sum_p = 0;
+      FloatType sum_b = 0;
+      std::size_t n_signal = 0;
+      std::size_t n_background = 0;
       for (std::size_t i = 0; i < signal.size(); ++i) {
         if ((mask[i] & Foreground) == Foreground) {
           if ((mask[i] & Valid) == Valid) {
-            sum_p_ += signal[i];
-            sum_b_ += background[i];
-            n_signal_++;
+            sum_p += signal[i];
+            sum_b += background[i];
+            n_signal++;
           } else {
-            success_ = false;
+            success = false;
           }
         } else if ((mask[i] & bg_code) == bg_code) {
-          n_background_++;
+          n_background++;
         }
       }
+      success_ = success;
+      sum_p_ = sum_p;
+      sum_b_ = sum_b;
+      n_signal_ = n_signal;
+      n_background_ = n_background;
+
+      // The incomplete gamma function is the expensive part so evaluate it
+      // once here rather than each time the intensity is needed. It is only
+      // defined for a total above -1 and a non-negative background, otherwise
+      // the reflection is marked as failed rather than throwing.
+      double C = sum_p_;
+      double B = sum_b_;
+      intensity_ = 0;
+      if (C + 1 > 0 && B >= 0) {
+        double q = boost::math::gamma_q(C + 1, B);
+        intensity_ = q * ((C + 1) * q - B * q);
+      } else {
+        success_ = false;
+      }
     }
 
+    FloatType intensity_;
     FloatType sum_p_;
     FloatType sum_b_;
     std::size_t n_background_;
@@ -134,6 +134,71 @@ namespace dials { namespace algorithms { namespace boost_python {
       data, "partial_id", indices.const_ref());
   }
 
+  /**
+   * A class to find the peak memory needed for the shoeboxes of a job, where
+   * each shoebox is allocated on its first frame and freed after its last.
+   */
+  class ShoeboxMemoryProfile {
+  public:
+    /**
+     * @param frames The frames of the job
+     * @param flatten Are the shoeboxes flattened
+     */
+    ShoeboxMemoryProfile(tiny<int, 2> frames, bool flatten)
+        : frame0_(frames[0]),
+          flatten_(flatten),
+          memory_to_alloc_(frames[1] - frames[0], 0),
+          memory_to_free_(frames[1] - frames[0], 0) {
+      DIALS_ASSERT(frames[1] > frames[0]);
+    }
+
+    /**
+     * Add a shoebox to the profile
+     * @param b The bounding box, which must be within the frames of the job
+     */
+    void add(int6 b) {
+      DIALS_ASSERT(b[4] >= frame0_);
+      DIALS_ASSERT(b[5] <= frame0_ + (int)memory_to_alloc_.size());
+      DIALS_ASSERT(b[5] > b[4]);
+      DIALS_ASSERT(b[3] > b[2]);
+      DIALS_ASSERT(b[1] > b[0]);
+      std::size_t xsize = b[1] - b[0];
+      std::size_t ysize = b[3] - b[2];
+      std::size_t zsize = b[5] - b[4];
+      std::size_t size = xsize * ysize;
+      if (!flatten_) {
+        size *= zsize;
+      }
+      std::size_t nbytes = size
+                           * (sizeof(Shoebox<>::float_type)
+                              + sizeof(Shoebox<>::float_type) + sizeof(int));
+      memory_to_alloc_[b[4] - frame0_] += nbytes;
+      memory_to_free_[b[5] - frame0_ - 1] += nbytes;
+    }
+
+    /**
+     * @returns The peak memory in bytes
+     */
+    std::size_t peak() const {
+      std::size_t max_memory_usage = 0;
+      std::size_t cur_memory_usage = 0;
+      for (std::size_t j = 0; j < memory_to_alloc_.size(); ++j) {
+        cur_memory_usage += memory_to_alloc_[j];
+        DIALS_ASSERT(memory_to_free_[j] <= cur_memory_usage);
+        max_memory_usage = std::max(max_memory_usage, cur_memory_usage);
+        cur_memory_usage -= memory_to_free_[j];
+      }
+      DIALS_ASSERT(cur_memory_usage == 0);
+      return max_memory_usage;
+    }
+
+  private:
+    int frame0_;
+    bool flatten_;
+    std::vector<std::size_t> memory_to_alloc_;
+    std::vector<std::size_t> memory_to_free_;
+  };
+
   /**
    * Compute the memory for each job
    */
@@ -167,50 +232,147 @@ namespace dials { namespace algorithms { namespace boost_python {
     // Compute the memory for each job
     af::shared<std::size_t> result(lookup.size());
     for (std::size_t i = 0; i < result.size(); ++i) {
-      int frame0 = lookup.job(i).frames()[0];
-      int frame1 = lookup.job(i).frames()[1];
-      DIALS_ASSERT(frame1 > frame0);
+      ShoeboxMemoryProfile profile(lookup.job(i).frames(), flatten);
       af::const_ref<std::size_t> indices = lookup.indices(i);
-      af::shared<std::size_t> memory_to_alloc(frame1 - frame0, 0);
-      af::shared<std::size_t> memory_to_free(frame1 - frame0, 0);
       for (std::size_t j = 0; j < indices.size(); ++j) {
         DIALS_ASSERT(indices[j] < bbox.size());
-        int6 b = bbox[indices[j]];
-        DIALS_ASSERT(b[4] >= frame0);
-        DIALS_ASSERT(b[5] <= frame1);
-        DIALS_ASSERT(b[5] > b[4]);
-        DIALS_ASSERT(b[3] > b[2]);
-        DIALS_ASSERT(b[1] > b[0]);
-        std::size_t xsize = b[1] - b[0];
-        std::size_t ysize = b[3] - b[2];
-        std::size_t zsize = b[5] - b[4];
-        std::size_t size = xsize * ysize;
-        if (!flatten) {
-          size *= zsize;
-        }
-        std::size_t nbytes = size
-                             * (sizeof(Shoebox<>::float_type)
-                                + sizeof(Shoebox<>::float_type) + sizeof(int));
-        memory_to_alloc[b[4] - frame0] += nbytes;
-        memory_to_free[b[5] - frame0 - 1] += nbytes;
+        profile.add(bbox[indices[j]]);
       }
-      std::size_t max_memory_usage = 0;
-      std::size_t cur_memory_usage = 0;
-      for (int frame = frame0; frame < frame1; ++frame) {
-        std::size_t j = frame - frame0;
-        cur_memory_usage += memory_to_alloc[j];
-        DIALS_ASSERT(memory_to_free[j] <= cur_memory_usage);
-        max_memory_usage = std::max(max_memory_usage, cur_memory_usage);
-        cur_memory_usage -= memory_to_free[j];
-      }
-      DIALS_ASSERT(cur_memory_usage == 0);
-      result[i] = max_memory_usage;
+      result[i] = profile.peak();
     }
 
     // Return the result
     return result;
   }
 
+  /**
+   * Estimate the memory for each job before the reflections have been split
+   * at the job boundaries. Each reflection is counted in every job it
+   * overlaps, clipped to the frames of the job, so the estimate is an upper
+   * bound on the memory needed once the reflections have been split. This
+   * allows the effect of a different block size to be checked without
+   * splitting the reflections.
+   */
+  af::shared<std::size_t> job_list_shoebox_memory_estimate(const JobList &self,
+                                                           af::reflection_table data,
+                                                           bool flatten) {
+    // Check the input
+    DIALS_ASSERT(data.is_consistent());
+    DIALS_ASSERT(data.contains("bbox"));
+    DIALS_ASSERT(data.contains("id"));
+    DIALS_ASSERT(data.contains("flags"));
+    DIALS_ASSERT(self.size() > 0);
+
+    // Get the bounding boxes
+    af::const_ref<int6> bbox = data["bbox"];
+    af::const_ref<int> id = data["id"];
+    af::const_ref<std::size_t> flags = data["flags"];
+
+    // Get the group of each experiment
+    const GroupList groups = self.groups();
+    std::vector<std::size_t> group_of_expr;
+    for (std::size_t i = 0; i < groups.size(); ++i) {
+      for (int j = groups[i].expr()[0]; j < groups[i].expr()[1]; ++j) {
+        group_of_expr.push_back(i);
+      }
+    }
+
+    // Add each reflection to each job it overlaps
+    JobRangeLookup lookup(self);
+    std::vector<ShoeboxMemoryProfile> profile;
+    profile.reserve(self.size());
+    for (std::size_t i = 0; i < self.size(); ++i) {
+      profile.push_back(ShoeboxMemoryProfile(self[i].frames(), flatten));
+    }
+    for (std::size_t i = 0; i < bbox.size(); ++i) {
+      if (flags[i] & af::DontIntegrate) {
+        continue;
+      }
+      DIALS_ASSERT(id[i] >= 0 && (std::size_t)id[i] < group_of_expr.size());
+      tiny<int, 2> range = groups[group_of_expr[id[i]]].frames();
+      int z0 = std::max(bbox[i][4], range[0]);
+      int z1 = std::min(bbox[i][5], range[1]);
+      if (z1 <= z0) {
+        continue;
+      }
+      std::size_t j0 = lookup.first(id[i], z0);
+      std::size_t j1 = lookup.last(id[i], z1 - 1);
+      DIALS_ASSERT(j0 <= j1 && j1 < self.size());
+      for (std::size_t j = j0; j <= j1; ++j) {
+        int6 b = bbox[i];
+        b[4] = std::max(z0, self[j].frames()[0]);
+        b[5] = std::min(z1, self[j].frames()[1]);
+        if (b[5] > b[4]) {
+          profile[j].add(b);
+        }
+      }
+    }
+
+    // Return the peak memory of each job
+    af::shared<std::size_t> result(self.size());
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      result[i] = profile[i].peak();
+    }
+    return result;
+  }
+
+  /**
+   * Compute the number of shoebox pixels on each frame for the reflections of
+   * a range of experiments, to use as the work for each frame when splitting
+   * the frames into jobs. This counts both the number of reflections on
+   * each frame and the size of their shoeboxes.
+   * @param data The reflections
+   * @param expr The range of experiments
+   * @param range The range of frames
+   * @returns The number of pixels on each frame
+   */
+  af::shared<double> shoebox_pixels_per_frame(af::reflection_table data,
+                                              tiny<int, 2> expr,
+                                              tiny<int, 2> range) {
+    DIALS_ASSERT(data.is_consistent());
+    DIALS_ASSERT(data.contains("bbox"));
+    DIALS_ASSERT(data.contains("id"));
+    DIALS_ASSERT(data.contains("flags"));
+    DIALS_ASSERT(range[1] > range[0]);
+    af::const_ref<int6> bbox = data["bbox"];
+    af::const_ref<int> id = data["id"];
+    af::const_ref<std::size_t> flags = data["flags"];
+    af::shared<double> result(range[1] - range[0], 0);
+    for (std::size_t i = 0; i < bbox.size(); ++i) {
+      if (id[i] < expr[0] || id[i] >= expr[1] || (flags[i] & af::DontIntegrate)) {
+        continue;
+      }
+      const int6 &b = bbox[i];
+      DIALS_ASSERT(b[1] > b[0]);
+      DIALS_ASSERT(b[3] > b[2]);
+      double area = (double)(b[1] - b[0]) * (double)(b[3] - b[2]);
+      int z0 = std::max(b[4], range[0]);
+      int z1 = std::min(b[5], range[1]);
+      for (int z = z0; z < z1; ++z) {
+        result[z - range[0]] += area;
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Process all the images in an imageset, with an optional tuple of masks to
+   * apply to each panel.
+   */
+  inline void shoebox_processor_process(ShoeboxProcessor &self,
+                                        dxtbx::ImageSet &imageset,
+                                        Executor &executor,
+                                        object lookup_mask,
+                                        std::size_t num_prefetch) {
+    af::shared<af::versa<bool, af::c_grid<2> > > mask;
+    if (!lookup_mask.is_none()) {
+      for (long i = 0; i < len(lookup_mask); ++i) {
+        mask.push_back(extract<af::versa<bool, af::c_grid<2> > >(lookup_mask[i])());
+      }
+    }
+    self.process(imageset, executor, mask.const_ref(), num_prefetch);
+  }
+
   /**
    * Wrapper class to allow python function to inherit
    */
@@ -240,13 +402,25 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("frames", &JobList::Job::frames)
       .def("nframes", &JobList::Job::nframes);
 
+    def("shoebox_pixels_per_frame",
+        &shoebox_pixels_per_frame,
+        (arg("data"), arg("expr"), arg("range")));
+
     class_<JobList>("JobList")
       .def(init<tiny<int, 2>, const af::const_ref<tiny<int, 2> > &>())
       .def("add", &JobList::add)
+      .def("add_balanced",
+           &JobList::add_balanced,
+           (arg("expr"),
+            arg("range"),
+            arg("work"),
+            arg("njobs"),
+            arg("block_overlap_size")))
       .def("__len__", &JobList::size)
       .def("__getitem__", &JobList::operator[], return_internal_reference<>())
       .def("split", &job_list_split)
-      .def("shoebox_memory", &job_list_shoebox_memory);
+      .def("shoebox_memory", &job_list_shoebox_memory)
+      .def("shoebox_memory_estimate", &job_list_shoebox_memory_estimate);
 
     class_<ReflectionManager>("ReflectionManager", no_init)
       .def(init<const JobList &, af::reflection_table>((arg("jobs"), arg("data"))))
@@ -276,6 +450,12 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<af::reflection_table, std::size_t, int, int, bool>())
       .def("next", &ShoeboxProcessor::next<double>)
       .def("next", &ShoeboxProcessor::next<int>)
+      .def("process",
+           &shoebox_processor_process,
+           (arg("imageset"),
+            arg("executor"),
+            arg("lookup_mask") = object(),
+            arg("num_prefetch") = 2))
       .def("frame0", &ShoeboxProcessor::frame0)
       .def("frame1", &ShoeboxProcessor::frame1)
       .def("frame", &ShoeboxProcessor::frame)
@@ -283,7 +463,10 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("npanels", &ShoeboxProcessor::npanels)
       .def("finished", &ShoeboxProcessor::finished)
       .def("extract_time", &ShoeboxProcessor::extract_time)
-      .def("process_time", &ShoeboxProcessor::process_time);
+      .def("process_time", &ShoeboxProcessor::process_time)
+      .def("read_time", &ShoeboxProcessor::read_time)
+      .def("stall_time", &ShoeboxProcessor::stall_time)
+      .def("num_stalls", &ShoeboxProcessor::num_stalls);
   }
 
 }}}  // namespace dials::algorithms::boost_python
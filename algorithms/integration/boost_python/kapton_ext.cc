@@ -2,21 +2,50 @@
 #include <boost/python/class.hpp>
 #include <boost/python/def.hpp>
 #include <boost/python/list.hpp>
+#include <boost/python/tuple.hpp>
+#include <boost/python/make_constructor.hpp>
+#include <boost/shared_ptr.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/flex_types.h>
 #include <scitbx/array_family/shared.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/panel.h>
+#include <dials/algorithms/integration/kapton.h>
 #include <math.h>
 #include <vector>
 
 namespace kapton {
 
+using dials::algorithms::KaptonTapeBox;
+using dials::algorithms::KaptonTapeSlab;
+using dials::model::Shoebox;
 using dxtbx::model::Detector;
 using scitbx::vec2;
 using scitbx::vec3;
 
+/**
+ * Add the faces of the kapton tape, given by a list of single panel detectors
+ */
+void add_kapton_faces(KaptonTapeBox &tape, boost::python::list kapton_faces) {
+  for (std::size_t i = 0; i < boost::python::len(kapton_faces); ++i) {
+    Detector detector = boost::python::extract<Detector>(kapton_faces[i]);
+    DIALS_ASSERT(detector.size() == 1);
+    tape.add_face(detector[0]);
+  }
+}
+
+/**
+ * Create the box model of the kapton tape from its faces
+ */
+boost::shared_ptr<KaptonTapeBox> make_kapton_tape_box(
+  boost::python::list kapton_faces,
+  double abs_coeff) {
+  boost::shared_ptr<KaptonTapeBox> tape(new KaptonTapeBox(abs_coeff));
+  add_kapton_faces(*tape, kapton_faces);
+  return tape;
+}
+
 /**
  * Implementing a c++ version of the get_kapton_path function. Significant speedups
  * observed
@@ -25,71 +54,92 @@ using scitbx::vec3;
 scitbx::af::shared<double> get_kapton_path_cpp(
   boost::python::list kapton_faces,
   scitbx::af::const_ref<vec3<double> > s1_flex) {
-  scitbx::af::shared<double> kapton_path_mm;
-  int nfaces = boost::python::len(kapton_faces);
-  std::vector<Detector> all_kapton_faces;
-  // Store all the detectors ahead of time to avoid making expensive extract calls every
-  // time
-  for (std::size_t i = 0; i < nfaces; ++i) {
-    all_kapton_faces.push_back(boost::python::extract<Detector>(kapton_faces[i]));
+  KaptonTapeBox tape(0.0);
+  add_kapton_faces(tape, kapton_faces);
+  scitbx::af::shared<double> kapton_path_mm(s1_flex.size());
+  std::vector<vec3<double> > points;
+  for (std::size_t i = 0; i < s1_flex.size(); ++i) {
+    kapton_path_mm[i] = tape.path_length(s1_flex[i], points);
   }
-  for (scitbx::af::const_ref<vec3<double> >::const_iterator it = s1_flex.begin();
-       it != s1_flex.end();
-       ++it) {
-    double max_d2 = -999.9;
-    scitbx::af::shared<vec3<double> > intersection_xy_list;
-    // Find out intersection points of s1 vector with all faces of kapton volume
-    for (std::size_t j = 0; j < nfaces; ++j) {
-      Detector detector = all_kapton_faces.at(j);
-      try {
-        vec2<double> px = detector[0].get_ray_intersection_px(*it);
-        if (px[0] > 0.0 && px[1] > 0.0 && px[0] < detector[0].get_image_size()[0]
-            && px[1] < detector[0].get_image_size()[1]) {
-          intersection_xy_list.push_back(
-            detector[0].get_lab_coord(detector[0].get_ray_intersection(*it)));
-        }
-      } catch (dxtbx::error) {
-        // Do nothing
-      }
-    }  // kapton faces
-    /*
-     * Now find out the maximum path length through the kapton. That is the path
-     * traversed by s1 vector if no intersection or intersects with only one face then
-     * path length is set to 0.0
-     */
-    if (intersection_xy_list.size() == 0) {
-      kapton_path_mm.push_back(0.0);
-    } else if (intersection_xy_list.size() == 1) {
-      kapton_path_mm.push_back(0.0);
-    } else {
-      double d2 = 0.0;
-      for (std::size_t k1 = 0; k1 < intersection_xy_list.size() - 1; ++k1) {
-        for (std::size_t k2 = k1 + 1; k2 < intersection_xy_list.size(); ++k2) {
-          vec3<double> pt1 = intersection_xy_list[k1];
-          vec3<double> pt2 = intersection_xy_list[k2];
-          d2 = (pt1[0] - pt2[0]) * (pt1[0] - pt2[0])
-               + (pt1[1] - pt2[1]) * (pt1[1] - pt2[1])
-               + (pt1[2] - pt2[2]) * (pt1[2] - pt2[2]);
-          if (d2 > max_d2) {
-            max_d2 = d2;
-          }
-        }
-      }
-      double d = sqrt(max_d2);
-      kapton_path_mm.push_back(d);
-    }
-  }  // s1
   return kapton_path_mm;
 }
+
+/**
+ * Compute the absorption correction of each ray
+ */
+template <typename Tape>
+scitbx::af::shared<double> absorption_correction(
+  const Tape &self,
+  const scitbx::af::const_ref<vec3<double> > &s1,
+  std::size_t nthreads) {
+  return dials::algorithms::kapton_absorption_correction(self, s1, nthreads);
+}
+
+/**
+ * Compute the mean and standard deviation of the absorption correction over
+ * the foreground pixels of each shoebox
+ * @returns A tuple of the means and standard deviations
+ */
+template <typename Tape>
+boost::python::tuple spot_absorption_correction(
+  const Tape &self,
+  const Detector &detector,
+  const scitbx::af::const_ref<Shoebox<> > &shoeboxes,
+  double pixel_offset,
+  std::size_t nthreads) {
+  scitbx::af::shared<double> mean(shoeboxes.size(), 0);
+  scitbx::af::shared<double> sigma(shoeboxes.size(), 0);
+  dials::algorithms::kapton_spot_absorption_correction(
+    self, detector, shoeboxes, pixel_offset, mean.ref(), sigma.ref(), nthreads);
+  return boost::python::make_tuple(mean, sigma);
+}
+
 }  // namespace kapton
 
 using namespace boost::python;
 namespace kapton { namespace boost_python { namespace {
 
+  template <typename Tape>
+  void kapton_tape_methods(class_<Tape> &cls) {
+    cls
+      .def("abs_coeff", &Tape::abs_coeff)
+      .def("absorption_correction",
+           &absorption_correction<Tape>,
+           (arg("s1"), arg("nthreads") = 1))
+      .def("spot_absorption_correction",
+           &spot_absorption_correction<Tape>,
+           (arg("detector"),
+            arg("shoeboxes"),
+            arg("pixel_offset") = 0.5,
+            arg("nthreads") = 1));
+  }
+
   void kapton_init_module() {
     using namespace boost::python;
 
     def("get_kapton_path_cpp", &kapton::get_kapton_path_cpp);
+
+    class_<KaptonTapeBox> box("KaptonTapeBox", no_init);
+    box.def("__init__",
+            make_constructor(&make_kapton_tape_box,
+                             default_call_policies(),
+                             (arg("faces"), arg("abs_coeff"))))
+      .def("num_faces", &KaptonTapeBox::num_faces);
+    kapton_tape_methods(box);
+
+    class_<KaptonTapeSlab> slab("KaptonTapeSlab", no_init);
+    slab.def(init<const vec3<double> &,
+                  const vec3<double> &,
+                  double,
+                  double,
+                  double,
+                  double>((arg("surface_normal"),
+                           arg("edge_normal"),
+                           arg("sn1"),
+                           arg("sn2"),
+                           arg("sn3"),
+                           arg("abs_coeff"))));
+    kapton_tape_methods(slab);
   }
 
 }}}  // namespace kapton::boost_python::
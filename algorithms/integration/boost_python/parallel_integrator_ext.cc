@@ -359,6 +359,7 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const af::const_ref<ThreadSafeEmpiricalProfileModeller> &>())
       .def("__init__", make_constructor(&GaussianRSReferenceCalculator_init))
       .def("__init__", make_constructor(&GaussianRSReferenceCalculator_init2))
+      .def("finalize", &GaussianRSReferenceCalculator::finalize)
       .def("accumulate", &GaussianRSReferenceCalculator::accumulate)
       .def("reference_profiles", &GaussianRSReferenceCalculator::reference_profiles)
       .def_pickle(GaussianRSReferenceCalculatorPickleSuite());
@@ -368,6 +369,31 @@ namespace dials { namespace algorithms { namespace boost_python {
    * Export integrator
    */
   void export_integrator() {
+    class_<IntegrationProfile,
+           boost::shared_ptr<IntegrationProfile>,
+           boost::noncopyable>("IntegrationProfile", no_init)
+      .def("stage_name", &IntegrationProfile::stage_name)
+      .staticmethod("stage_name")
+      .def("stage_time", &IntegrationProfile::stage_time)
+      .def("cost_histogram", &IntegrationProfile::cost_histogram)
+      .def("num_reflections", &IntegrationProfile::num_reflections)
+      .def("num_background_failed", &IntegrationProfile::num_background_failed)
+      .def("num_profile_fitting_failed",
+           &IntegrationProfile::num_profile_fitting_failed)
+      .def("num_threads", &IntegrationProfile::num_threads)
+      .def("queue_depth", &IntegrationProfile::queue_depth)
+      .def("image_read_time", &IntegrationProfile::image_read_time)
+      .def("image_wait_time", &IntegrationProfile::image_wait_time)
+      .def("num_image_waits", &IntegrationProfile::num_image_waits)
+      .def("reader_wait_time", &IntegrationProfile::reader_wait_time)
+      .def("buffer_copy_time", &IntegrationProfile::buffer_copy_time)
+      .def("buffer_wait_time", &IntegrationProfile::buffer_wait_time)
+      .def("num_buffer_waits", &IntegrationProfile::num_buffer_waits)
+      .def("post_time", &IntegrationProfile::post_time)
+      .def("buffer_bytes", &IntegrationProfile::buffer_bytes)
+      .def("shoebox_bytes", &IntegrationProfile::shoebox_bytes)
+      .def("summary", &IntegrationProfile::summary);
+
     class_<ParallelIntegrator>("MultiThreadedIntegrator", no_init)
       .def(init<const af::reflection_table &,
                 ImageSequence,
@@ -378,6 +404,10 @@ namespace dials { namespace algorithms { namespace boost_python {
                 std::size_t,
                 std::size_t,
                 bool,
+                bool,
+                const std::string &,
+                std::size_t,
+                std::size_t,
                 bool>((arg("reflections"),
                        arg("imageset"),
                        arg("compute_mask"),
@@ -387,11 +417,21 @@ namespace dials { namespace algorithms { namespace boost_python {
                        arg("nthreads") = 1,
                        arg("buffer_size") = 0,
                        arg("use_dynamic_mask") = true,
-                       arg("debug") = false)))
+                       arg("debug") = false,
+                       arg("shared_buffer_name") = "",
+                       arg("num_prefetch") = 2,
+                       arg("batch_size") = 1,
+                       arg("numa") = false)))
       .def("reflections", &ParallelIntegrator::reflections)
+      .def("profile", &ParallelIntegrator::profile)
       .def("compute_required_memory",
-           &ParallelIntegrator::compute_required_memory,
-           (arg("imageset")))
+           (std::size_t(*)(ImageSequence, std::size_t))
+             & ParallelIntegrator::compute_required_memory,
+           (arg("imageset"), arg("block_size")))
+      .def("compute_required_memory",
+           (std::size_t(*)(ImageSequence, std::size_t, af::reflection_table))
+             & ParallelIntegrator::compute_required_memory,
+           (arg("imageset"), arg("block_size"), arg("reflections")))
       .def("compute_max_block_size",
            &ParallelIntegrator::compute_max_block_size,
            (arg("imageset"), arg("max_memory_usage")))
@@ -408,6 +448,7 @@ namespace dials { namespace algorithms { namespace boost_python {
                 std::size_t,
                 std::size_t,
                 bool,
+                bool,
                 bool>((arg("reflections"),
                        arg("imageset"),
                        arg("compute_mask"),
@@ -417,8 +458,11 @@ namespace dials { namespace algorithms { namespace boost_python {
                        arg("nthreads") = 1,
                        arg("buffer_size") = 0,
                        arg("use_dynamic_mask") = true,
-                       arg("debug") = false)))
+                       arg("debug") = false,
+                       arg("preserve_shoeboxes") = false)))
       .def("reflections", &ParallelReferenceProfiler::reflections)
+      .def("shoebox_pool", &ParallelReferenceProfiler::shoebox_pool)
+      .def("shoebox_index", &ParallelReferenceProfiler::shoebox_index)
       .def("compute_required_memory",
            &ParallelReferenceProfiler::compute_required_memory,
            (arg("imageset")))
@@ -428,6 +472,18 @@ namespace dials { namespace algorithms { namespace boost_python {
       .staticmethod("compute_required_memory")
       .staticmethod("compute_max_block_size");
 
+    class_<ShoeboxPoolIntegrator>("MultiThreadedShoeboxPoolIntegrator", no_init)
+      .def(init<const af::reflection_table &,
+                const ShoeboxPool<> &,
+                const af::const_ref<int> &,
+                const IntensityCalculatorIface &,
+                std::size_t>((arg("reflections"),
+                              arg("shoebox_pool"),
+                              arg("shoebox_index"),
+                              arg("compute_intensity"),
+                              arg("nthreads") = 1)))
+      .def("reflections", &ShoeboxPoolIntegrator::reflections);
+
     class_<Logger>("Logger", no_init).def(init<boost::python::object>());
 
     class_<SimpleBlockList>("SimpleBlockList", no_init)
@@ -18,6 +18,7 @@
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/goniometer.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -103,7 +104,9 @@ namespace dials { namespace algorithms {
   }
 
   /**
-   * A class to perform corrections to the intensities.
+   * A class to perform corrections to the intensities. The quantities which
+   * depend only on the models, such as the beam vector length and the panel
+   * normals, are computed once on construction rather than per reflection.
    */
   class Corrections {
   public:
@@ -117,6 +120,7 @@ namespace dials { namespace algorithms {
           pf_(beam.get_polarization_fraction()),
           m2_(goniometer.get_rotation_axis()) {
       // Deprecated constructor
+      init_beam();
     }
 
     /**
@@ -130,8 +134,10 @@ namespace dials { namespace algorithms {
         : s0_(beam.get_s0()),
           pn_(beam.get_polarization_normal()),
           pf_(beam.get_polarization_fraction()),
-          m2_(goniometer.get_rotation_axis()),
-          det_(detector) {}
+          m2_(goniometer.get_rotation_axis()) {
+      init_beam();
+      init_detector(detector);
+    }
 
     /**
      * @param beam The beam model.
@@ -142,8 +148,10 @@ namespace dials { namespace algorithms {
         : s0_(beam.get_s0()),
           pn_(beam.get_polarization_normal()),
           pf_(beam.get_polarization_fraction()),
-          m2_(0, 0, 0),
-          det_(detector) {}
+          m2_(0, 0, 0) {
+      init_beam();
+      init_detector(detector);
+    }
 
     /**
      * Perform the LP correction. If no rotation axis is specified then do the
@@ -152,11 +160,19 @@ namespace dials { namespace algorithms {
      * @returns L / P The correction
      */
     double lp(vec3<double> s1) const {
-      if (m2_.length() > 0) {
-        return lp_correction(s0_, pn_, pf_, m2_, s1);
-      } else {
-        return stills_lp_correction(s0_, pn_, pf_, s1);
+      double s1_length = s1.length();
+      DIALS_ASSERT(s1_length > 0 && s0_length_ > 0);
+      double P1 = ((pn_ * s1) / s1_length);
+      double P2 = (1.0 - 2.0 * pf_) * (1.0 - P1 * P1);
+      double P3 = (s1 * s0_ / (s1_length * s0_length_));
+      double P4 = pf_ * (1.0 + P3 * P3);
+      double P = P2 + P4;
+      DIALS_ASSERT(P != 0);
+      if (rotation_) {
+        double L = std::abs(s1 * m2_cross_s0_) / (s0_length_ * s1_length);
+        return L / P;
       }
+      return 1.0 / P;
     }
 
     /**
@@ -166,18 +182,95 @@ namespace dials { namespace algorithms {
      * @returns QE term which needs to be divided by (i.e. is efficiency)
      */
     double qe(vec3<double> s1, size_t p) const {
-      return qe_correction(
-        det_[p].get_mu(), det_[p].get_thickness(), s1, det_[p].get_normal());
+      DIALS_ASSERT(p < normal_.size());
+      DIALS_ASSERT(mu_[p] >= 0);
+      DIALS_ASSERT(t0_[p] >= 0);
+      double cos_angle = std::abs(normal_[p] * s1) / s1.length();
+      double t = t0_[p] / cos_angle;
+      return 1.0 - exp(-mu_[p] * t);
     }
 
   private:
+    void init_beam() {
+      s0_length_ = s0_.length();
+      rotation_ = m2_.length() > 0;
+      m2_cross_s0_ = m2_.cross(s0_);
+    }
+
+    void init_detector(const Detector &detector) {
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        mu_.push_back(detector[i].get_mu());
+        t0_.push_back(detector[i].get_thickness());
+        normal_.push_back(detector[i].get_normal().normalize());
+      }
+    }
+
     vec3<double> s0_;
     vec3<double> pn_;
     double pf_;
     vec3<double> m2_;
-    Detector det_;
+    double s0_length_;
+    bool rotation_;
+    vec3<double> m2_cross_s0_;
+    std::vector<double> mu_;
+    std::vector<double> t0_;
+    std::vector<vec3<double> > normal_;
   };
 
+  namespace detail {
+
+    /**
+     * Compute the LP correction for a band of reflections
+     */
+    struct LpCorrectionBand {
+      const std::vector<Corrections> &compute;
+      af::const_ref<int> id;
+      af::const_ref<vec3<double> > s1;
+      af::ref<double> result;
+
+      LpCorrectionBand(const std::vector<Corrections> &compute_,
+                       const af::const_ref<int> &id_,
+                       const af::const_ref<vec3<double> > &s1_,
+                       af::ref<double> result_)
+          : compute(compute_), id(id_), s1(s1_), result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          DIALS_ASSERT(id[i] >= 0);
+          DIALS_ASSERT((std::size_t)id[i] < compute.size());
+          result[i] = compute[id[i]].lp(s1[i]);
+        }
+      }
+    };
+
+    /**
+     * Compute the QE correction for a band of reflections
+     */
+    struct QeCorrectionBand {
+      const std::vector<Corrections> &compute;
+      af::const_ref<int> id;
+      af::const_ref<vec3<double> > s1;
+      af::const_ref<std::size_t> p;
+      af::ref<double> result;
+
+      QeCorrectionBand(const std::vector<Corrections> &compute_,
+                       const af::const_ref<int> &id_,
+                       const af::const_ref<vec3<double> > &s1_,
+                       const af::const_ref<std::size_t> &p_,
+                       af::ref<double> result_)
+          : compute(compute_), id(id_), s1(s1_), p(p_), result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          DIALS_ASSERT(id[i] >= 0);
+          DIALS_ASSERT((std::size_t)id[i] < compute.size());
+          result[i] = compute[id[i]].qe(s1[i], p[i]);
+        }
+      }
+    };
+
+  }  // namespace detail
+
   /**
    * A class to perform corrections for multiple experiments
    */
@@ -202,16 +295,16 @@ namespace dials { namespace algorithms {
      * Perform the LP correction.
      * @param id The list of experiments ids
      * @param s1 The list of incident beam vectors
+     * @param nthreads The number of threads to use
      */
     af::shared<double> lp(const af::const_ref<int> &id,
-                          const af::const_ref<vec3<double> > &s1) const {
+                          const af::const_ref<vec3<double> > &s1,
+                          std::size_t nthreads = 1) const {
       DIALS_ASSERT(id.size() == s1.size());
       af::shared<double> result(id.size(), 0);
-      for (std::size_t i = 0; i < id.size(); ++i) {
-        DIALS_ASSERT(id[i] >= 0);
-        DIALS_ASSERT(id[i] < compute_.size());
-        result[i] = compute_[id[i]].lp(s1[i]);
-      }
+      for_each_band(detail::LpCorrectionBand(compute_, id, s1, result.ref()),
+                    (int)id.size(),
+                    nthreads);
       return result;
     }
 
@@ -220,18 +313,18 @@ namespace dials { namespace algorithms {
      * @param id The list of experiments ids
      * @param s1 The list of incident beam vectors
      * @param p The list of panels
+     * @param nthreads The number of threads to use
      */
     af::shared<double> qe(const af::const_ref<int> &id,
                           const af::const_ref<vec3<double> > &s1,
-                          const af::const_ref<std::size_t> &p) const {
+                          const af::const_ref<std::size_t> &p,
+                          std::size_t nthreads = 1) const {
       DIALS_ASSERT(id.size() == s1.size());
       DIALS_ASSERT(id.size() == p.size());
       af::shared<double> result(id.size(), 0);
-      for (std::size_t i = 0; i < id.size(); ++i) {
-        DIALS_ASSERT(id[i] >= 0);
-        DIALS_ASSERT(id[i] < compute_.size());
-        result[i] = compute_[id[i]].qe(s1[i], p[i]);
-      }
+      for_each_band(detail::QeCorrectionBand(compute_, id, s1, p, result.ref()),
+                    (int)id.size(),
+                    nthreads);
       return result;
     }
 
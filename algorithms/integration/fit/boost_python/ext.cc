@@ -31,14 +31,51 @@ namespace dials { namespace algorithms { namespace boost_python {
     ;
   }
 
+  template <typename FloatType>
+  void batch_profile_fitter_wrapper(const char *name) {
+    typedef BatchProfileFitter<FloatType> BatchProfileFitterType;
+
+    class_<BatchProfileFitterType>(name, no_init)
+      .def(init<const af::const_ref<FloatType, af::c_grid<2> > &,
+                const af::const_ref<FloatType, af::c_grid<2> > &,
+                const af::const_ref<bool, af::c_grid<2> > &,
+                const af::const_ref<FloatType> &,
+                double,
+                std::size_t>((arg("data"),
+                              arg("background"),
+                              arg("mask"),
+                              arg("profile"),
+                              arg("eps") = 1e-3,
+                              arg("maxiter") = 10)))
+      .def("intensity", &BatchProfileFitterType::intensity)
+      .def("variance", &BatchProfileFitterType::variance)
+      .def("correlation", &BatchProfileFitterType::correlation)
+      .def("niter", &BatchProfileFitterType::niter)
+      .def("maxiter", &BatchProfileFitterType::maxiter)
+      .def("success", &BatchProfileFitterType::success);
+  }
+
+  /**
+   * @returns The starting intensity or none if the argument is None
+   */
+  inline boost::optional<double> get_start(boost::python::object start) {
+    if (start.is_none()) {
+      return boost::none;
+    }
+    return boost::python::extract<double>(start)();
+  }
+
   template <typename FloatType>
   ProfileFitter<FloatType> make_profile_fitter_1d_1(const af::const_ref<FloatType> &d,
                                                     const af::const_ref<FloatType> &b,
                                                     const af::const_ref<bool> &m,
                                                     const af::const_ref<FloatType> &p,
                                                     double eps,
-                                                    std::size_t maxiter) {
-    return ProfileFitter<FloatType>(d, b, m, p, eps, maxiter);
+                                                    std::size_t maxiter,
+                                                    double sigma_tolerance,
+                                                    boost::python::object start) {
+    return ProfileFitter<FloatType>(
+      d, b, m, p, eps, maxiter, sigma_tolerance, get_start(start));
   }
 
   template <typename FloatType>
@@ -48,8 +85,11 @@ namespace dials { namespace algorithms { namespace boost_python {
     const af::const_ref<bool, af::c_grid<2> > &m,
     const af::const_ref<FloatType, af::c_grid<2> > &p,
     double eps,
-    std::size_t maxiter) {
-    return ProfileFitter<FloatType>(d, b, m, p, eps, maxiter);
+    std::size_t maxiter,
+    double sigma_tolerance,
+    boost::python::object start) {
+    return ProfileFitter<FloatType>(
+      d, b, m, p, eps, maxiter, sigma_tolerance, get_start(start));
   }
 
   template <typename FloatType>
@@ -59,8 +99,11 @@ namespace dials { namespace algorithms { namespace boost_python {
     const af::const_ref<bool, af::c_grid<3> > &m,
     const af::const_ref<FloatType, af::c_grid<3> > &p,
     double eps,
-    std::size_t maxiter) {
-    return ProfileFitter<FloatType>(d, b, m, p, eps, maxiter);
+    std::size_t maxiter,
+    double sigma_tolerance,
+    boost::python::object start) {
+    return ProfileFitter<FloatType>(
+      d, b, m, p, eps, maxiter, sigma_tolerance, get_start(start));
   }
 
   template <typename FloatType>
@@ -108,20 +151,36 @@ namespace dials { namespace algorithms { namespace boost_python {
          arg("maxiter") = 10));
   }
 
+  template <typename Func>
+  void def_make_profile_fitter_single(Func func) {
+    def("ProfileFitter",
+        func,
+        (arg("data"),
+         arg("background"),
+         arg("mask"),
+         arg("profile"),
+         arg("eps") = 1e-3,
+         arg("maxiter") = 10,
+         arg("sigma_tolerance") = 0,
+         arg("start") = boost::python::object()));
+  }
+
   BOOST_PYTHON_MODULE(dials_algorithms_integration_fit_ext) {
     profile_fitter_wrapper<float>("ProfileFitterFloat");
     profile_fitter_wrapper<double>("ProfileFitterDouble");
+    batch_profile_fitter_wrapper<float>("BatchProfileFitterFloat");
+    batch_profile_fitter_wrapper<double>("BatchProfileFitterDouble");
 
-    def_make_profile_fitter(&make_profile_fitter_1d_1<float>);
-    def_make_profile_fitter(&make_profile_fitter_2d_1<float>);
-    def_make_profile_fitter(&make_profile_fitter_2d_1<float>);
+    def_make_profile_fitter_single(&make_profile_fitter_1d_1<float>);
+    def_make_profile_fitter_single(&make_profile_fitter_2d_1<float>);
+    def_make_profile_fitter_single(&make_profile_fitter_2d_1<float>);
     def_make_profile_fitter(&make_profile_fitter_1d_n<float>);
     def_make_profile_fitter(&make_profile_fitter_2d_n<float>);
     def_make_profile_fitter(&make_profile_fitter_3d_n<float>);
 
-    def_make_profile_fitter(&make_profile_fitter_1d_1<double>);
-    def_make_profile_fitter(&make_profile_fitter_2d_1<double>);
-    def_make_profile_fitter(&make_profile_fitter_3d_1<double>);
+    def_make_profile_fitter_single(&make_profile_fitter_1d_1<double>);
+    def_make_profile_fitter_single(&make_profile_fitter_2d_1<double>);
+    def_make_profile_fitter_single(&make_profile_fitter_3d_1<double>);
     def_make_profile_fitter(&make_profile_fitter_1d_n<double>);
     def_make_profile_fitter(&make_profile_fitter_2d_n<double>);
     def_make_profile_fitter(&make_profile_fitter_3d_n<double>);
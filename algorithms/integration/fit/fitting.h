@@ -13,6 +13,7 @@
 
 #include <algorithm>
 #include <vector>
+#include <boost/optional.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/tiny_algebra.h>
@@ -60,14 +61,21 @@ namespace dials { namespace algorithms {
 
     /**
      * Profile fit a single reflection
+     *
+     * The iteration stops once the change in intensity is less than eps or
+     * less than sigma_tolerance times the estimated standard deviation of the
+     * intensity. It starts from the given intensity if there is one and from
+     * the summation intensity otherwise.
      */
     ProfileFitter(const af::const_ref<T> &d,
                   const af::const_ref<T> &b,
                   const af::const_ref<bool> &m,
                   const af::const_ref<T> &p,
                   double eps = 1e-3,
-                  std::size_t maxiter = 10) {
-      fit(d, b, m, p, eps, maxiter);
+                  std::size_t maxiter = 10,
+                  double sigma_tolerance = 0,
+                  boost::optional<double> start = boost::none) {
+      fit(d, b, m, p, eps, maxiter, sigma_tolerance, start);
     }
 
     /**
@@ -90,8 +98,17 @@ namespace dials { namespace algorithms {
                   const af::const_ref<bool, af::c_grid<2> > &m,
                   const af::const_ref<T, af::c_grid<2> > &p,
                   double eps = 1e-3,
-                  std::size_t maxiter = 10) {
-      fit(d.as_1d(), b.as_1d(), m.as_1d(), p.as_1d(), eps, maxiter);
+                  std::size_t maxiter = 10,
+                  double sigma_tolerance = 0,
+                  boost::optional<double> start = boost::none) {
+      fit(d.as_1d(),
+          b.as_1d(),
+          m.as_1d(),
+          p.as_1d(),
+          eps,
+          maxiter,
+          sigma_tolerance,
+          start);
     }
 
     /**
@@ -102,8 +119,17 @@ namespace dials { namespace algorithms {
                   const af::const_ref<bool, af::c_grid<3> > &m,
                   const af::const_ref<T, af::c_grid<3> > &p,
                   double eps = 1e-3,
-                  std::size_t maxiter = 10) {
-      fit(d.as_1d(), b.as_1d(), m.as_1d(), p.as_1d(), eps, maxiter);
+                  std::size_t maxiter = 10,
+                  double sigma_tolerance = 0,
+                  boost::optional<double> start = boost::none) {
+      fit(d.as_1d(),
+          b.as_1d(),
+          m.as_1d(),
+          p.as_1d(),
+          eps,
+          maxiter,
+          sigma_tolerance,
+          start);
     }
 
     /**
@@ -184,13 +210,17 @@ namespace dials { namespace algorithms {
      * @param p The profile array
      * @param eps The tolerance
      * @param maxiter The maximum number of iterations
+     * @param sigma_tolerance The tolerance as a fraction of the sigma
+     * @param start The starting intensity
      */
     void fit(const af::const_ref<T> &d,
              const af::const_ref<T> &b,
              const af::const_ref<bool> &m,
              const af::const_ref<T> &p,
              double eps,
-             std::size_t maxiter) {
+             std::size_t maxiter,
+             double sigma_tolerance,
+             boost::optional<double> start) {
       // Save the max iter
       maxiter_ = maxiter;
 
@@ -200,6 +230,7 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(d.size() == p.size());
       DIALS_ASSERT(eps > 0.0);
       DIALS_ASSERT(maxiter >= 1);
+      DIALS_ASSERT(sigma_tolerance >= 0.0);
 
       // Compute the sums of the background and foreground
       double sumd = 0;
@@ -219,7 +250,7 @@ namespace dials { namespace algorithms {
 
       // Iterate to calculate the intensity. Exit if intensity goes less
       // than zero or if the tolerance or number of iteration is reached.
-      double I0 = sumd - sumb;
+      double I0 = start ? *start : sumd - sumb;
       double I = 0.0;
       double V = 0.0;
       for (niter_ = 0; niter_ < maxiter; ++niter_) {
@@ -236,7 +267,8 @@ namespace dials { namespace algorithms {
         DIALS_ASSERT(sum2 > 0);
         I = sum1 / sum2;
         V = std::abs(I) + std::abs(sumb);
-        if ((error_ = std::abs(I - I0)) < eps) {
+        double tolerance = std::max(eps, sigma_tolerance * std::sqrt(V));
+        if ((error_ = std::abs(I - I0)) < tolerance) {
           break;
         }
         I0 = I;
@@ -475,6 +507,264 @@ namespace dials { namespace algorithms {
     double error_;
   };
 
+  /**
+   * A class to profile fit a batch of reflections against the same profile.
+   *
+   * Each reflection is fitted as by the single reflection ProfileFitter and
+   * gives the same result. The reflections are iterated in lockstep: the
+   * pixel values are stored with the reflection index innermost so that one
+   * pass over the profile updates the sums of every reflection with a
+   * contiguous, vectorisable loop, and pixels where the profile is zero are
+   * skipped for the whole batch. Reflections which have converged keep their
+   * result while the others carry on. A reflection which cannot be fitted is
+   * flagged as unsuccessful rather than raising an error.
+   */
+  template <typename T = double>
+  class BatchProfileFitter {
+  public:
+    typedef T float_type;
+
+    /**
+     * Profile fit the reflections
+     * @param d The data array (num reflections, num pixels)
+     * @param b The background array (num reflections, num pixels)
+     * @param m The mask array (num reflections, num pixels)
+     * @param p The profile (num pixels)
+     * @param eps The tolerance
+     * @param maxiter The maximum number of iterations
+     */
+    BatchProfileFitter(const af::const_ref<T, af::c_grid<2> > &d,
+                       const af::const_ref<T, af::c_grid<2> > &b,
+                       const af::const_ref<bool, af::c_grid<2> > &m,
+                       const af::const_ref<T> &p,
+                       double eps = 1e-3,
+                       std::size_t maxiter = 10)
+        : intensity_(d.accessor()[0], 0.0),
+          variance_(d.accessor()[0], 0.0),
+          correlation_(d.accessor()[0], 0.0),
+          niter_(d.accessor()[0], 0),
+          success_(d.accessor()[0], false),
+          maxiter_(maxiter) {
+      DIALS_ASSERT(d.accessor().all_eq(b.accessor()));
+      DIALS_ASSERT(d.accessor().all_eq(m.accessor()));
+      DIALS_ASSERT(d.accessor()[1] == p.size());
+      DIALS_ASSERT(eps > 0.0);
+      DIALS_ASSERT(maxiter >= 1);
+      fit(d, b, m, p, eps, maxiter);
+    }
+
+    /**
+     * @returns The intensity of each reflection
+     */
+    af::shared<double> intensity() const {
+      return intensity_;
+    }
+
+    /**
+     * @returns The variance of each reflection
+     */
+    af::shared<double> variance() const {
+      return variance_;
+    }
+
+    /**
+     * @returns The correlation of each reflection
+     */
+    af::shared<double> correlation() const {
+      return correlation_;
+    }
+
+    /**
+     * @returns The number of iterations for each reflection
+     */
+    af::shared<std::size_t> niter() const {
+      return niter_;
+    }
+
+    /**
+     * @returns Whether each reflection was fitted
+     */
+    af::shared<bool> success() const {
+      return success_;
+    }
+
+    /**
+     * @returns The maximum number of iterations
+     */
+    std::size_t maxiter() const {
+      return maxiter_;
+    }
+
+  protected:
+    void fit(const af::const_ref<T, af::c_grid<2> > &d,
+             const af::const_ref<T, af::c_grid<2> > &b,
+             const af::const_ref<bool, af::c_grid<2> > &m,
+             const af::const_ref<T> &p,
+             double eps,
+             std::size_t maxiter) {
+      std::size_t N = d.accessor()[0];
+      std::size_t P = d.accessor()[1];
+
+      // Compute the sums of the background and foreground. A masked pixel
+      // with a negative profile value makes the reflection fail, as it does
+      // in the single reflection fitter.
+      std::vector<double> sumd(N, 0);
+      std::vector<double> sumb(N, 0);
+      std::vector<bool> active(N, true);
+      for (std::size_t r = 0; r < N; ++r) {
+        double sump = 0;
+        for (std::size_t i = 0; i < P; ++i) {
+          if (m(r, i)) {
+            if (p[i] < 0) {
+              active[r] = false;
+            }
+            sumd[r] += d(r, i);
+            sumb[r] += b(r, i);
+            sump += p[i];
+          }
+        }
+        if (!(sumb[r] >= 0 && sumd[r] >= 0 && sump > 0)) {
+          active[r] = false;
+        }
+      }
+
+      // Store the pixels which contribute to the fit with the reflection index
+      // innermost. The weight is one where a pixel is used and zero elsewhere.
+      std::vector<std::size_t> pixels;
+      for (std::size_t i = 0; i < P; ++i) {
+        if (p[i] > 0) {
+          pixels.push_back(i);
+        }
+      }
+      std::vector<double> dt(pixels.size() * N);
+      std::vector<double> bt(pixels.size() * N);
+      std::vector<double> wt(pixels.size() * N);
+      for (std::size_t k = 0; k < pixels.size(); ++k) {
+        for (std::size_t r = 0; r < N; ++r) {
+          dt[k * N + r] = d(r, pixels[k]);
+          bt[k * N + r] = b(r, pixels[k]);
+          wt[k * N + r] = m(r, pixels[k]) ? 1.0 : 0.0;
+        }
+      }
+
+      // Iterate to calculate the intensities. Exit for each reflection if the
+      // tolerance or number of iterations is reached.
+      std::vector<double> I0(N);
+      std::vector<double> sum1(N);
+      std::vector<double> sum2(N);
+      std::size_t num_active = 0;
+      for (std::size_t r = 0; r < N; ++r) {
+        I0[r] = sumd[r] - sumb[r];
+        num_active += active[r] ? 1 : 0;
+      }
+      std::vector<bool> converged(N, false);
+      for (std::size_t iter = 0; iter < maxiter && num_active > 0; ++iter) {
+        std::fill(sum1.begin(), sum1.end(), 0.0);
+        std::fill(sum2.begin(), sum2.end(), 0.0);
+        for (std::size_t k = 0; k < pixels.size(); ++k) {
+          double pk = p[pixels[k]];
+          const double *dk = &dt[k * N];
+          const double *bk = &bt[k * N];
+          const double *wk = &wt[k * N];
+          for (std::size_t r = 0; r < N; ++r) {
+            double v = 1e-10 + std::abs(bk[r]) + std::abs(I0[r] * pk);
+            sum1[r] += wk[r] * ((dk[r] - bk[r]) * pk / v);
+            sum2[r] += wk[r] * (pk * pk / v);
+          }
+        }
+        for (std::size_t r = 0; r < N; ++r) {
+          if (!active[r]) {
+            continue;
+          }
+          niter_[r] = iter;
+          if (!(sum2[r] > 0)) {
+            active[r] = false;
+            num_active--;
+            continue;
+          }
+          double I = sum1[r] / sum2[r];
+          if (std::abs(I - I0[r]) < eps) {
+            intensity_[r] = I;
+            converged[r] = true;
+            active[r] = false;
+            num_active--;
+            continue;
+          }
+          I0[r] = I;
+        }
+      }
+
+      // Set the results. If the iterations did not converge the summation
+      // results are used.
+      for (std::size_t r = 0; r < N; ++r) {
+        if (active[r]) {
+          niter_[r] = maxiter;
+          intensity_[r] = sumd[r] - sumb[r];
+          converged[r] = true;
+        }
+        if (!converged[r]) {
+          continue;
+        }
+        double I = intensity_[r];
+        double V = std::abs(I) + std::abs(sumb[r]);
+        variance_[r] = V;
+        correlation_[r] = compute_correlation(d, b, m, p, r);
+        success_[r] = true;
+      }
+    }
+
+    /**
+     * Compute the correlation for one reflection
+     */
+    double compute_correlation(const af::const_ref<T, af::c_grid<2> > &d,
+                               const af::const_ref<T, af::c_grid<2> > &b,
+                               const af::const_ref<bool, af::c_grid<2> > &m,
+                               const af::const_ref<T> &p,
+                               std::size_t r) const {
+      double I = intensity_[r];
+
+      // Compute the mean observed and predicted
+      double xb = 0.0, yb = 0.0;
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < p.size(); ++i) {
+        if (m(r, i)) {
+          xb += I * p[i] + b(r, i);
+          yb += d(r, i);
+          count++;
+        }
+      }
+      DIALS_ASSERT(count > 0);
+      xb /= count;
+      yb /= count;
+
+      // Compute the variance
+      double sdxdy = 0.0, sdx2 = 0.0, sdy2 = 0.0;
+      for (std::size_t i = 0; i < p.size(); ++i) {
+        if (m(r, i)) {
+          double dx = (I * p[i] + b(r, i)) - xb;
+          double dy = d(r, i) - yb;
+          sdxdy += dx * dy;
+          sdx2 += dx * dx;
+          sdy2 += dy * dy;
+        }
+      }
+
+      // Compute the correlation
+      double result = 0.0;
+      if (sdx2 > 0.0 && sdy2 > 0.0) {
+        result = sdxdy / (std::sqrt(sdx2) * std::sqrt(sdy2));
+      }
+      return result;
+    }
+
+    af::shared<double> intensity_;
+    af::shared<double> variance_;
+    af::shared<double> correlation_;
+    af::shared<std::size_t> niter_;
+    af::shared<bool> success_;
+    std::size_t maxiter_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif /* DIALS_ALGORITHMS_INTEGRATION_FIT_FITTING_H */
@@ -68,6 +68,9 @@ def process(self):
             )
             mp_nproc = 1
         assert mp_nproc > 0, "Invalid number of processors"
+        self.manager.nthreads = max(
+            1, self.manager.params.integration.mp.nproc // mp_nproc
+        )
         logger.info(self.manager.summary())
         logger.info(" Using %s with %d parallel job(s)\n" % (mp_method, mp_nproc))
         if mp_nproc > 1:
@@ -111,7 +114,9 @@ class Task(object):
     A class to perform a null task.
     """
 
-    def __init__(self, index, frames, reflections, experiments, params, executor):
+    def __init__(
+        self, index, frames, reflections, experiments, params, executor, nthreads=1
+    ):
         """
         Initialise the task
 
@@ -121,6 +126,7 @@ def __init__(self, index, frames, reflections, experiments, params, executor):
         :param reflections: The list of reflections
         :param params The processing parameters
         :param executor: The executor class
+        :param nthreads: The number of threads used to set the panels of an image
         """
         self.index = index
         self.frames = frames
@@ -128,6 +134,7 @@ def __init__(self, index, frames, reflections, experiments, params, executor):
         self.reflections = reflections
         self.params = params
         self.executor = executor
+        self.nthreads = nthreads
 
     def __call__(self):
         """
@@ -173,40 +180,34 @@ def __call__(self):
         except Exception:
             frame0, frame1 = (0, len(imageset))
 
-        # Initialise the dataset
-        image_volume = MultiPanelImageVolume()
-        for panel in self.experiments[0].detector:
-            image_volume.add(
-                ImageVolume(
-                    frame0, frame1, panel.get_image_size()[1], panel.get_image_size()[0]
-                )
-            )
-
-        # Read all the images into a block of data
-        read_time = 0.0
-        for i in range(len(imageset)):
+        # If the executor can process the frames one at a time, only hold the
+        # frame being processed and the reflections touching it, otherwise
+        # read all the images into a block of data
+        self.read_time = 0.0
+        if hasattr(self.executor, "process_frames"):
             st = time()
-            image = imageset.get_corrected_data(i)
-            mask = imageset.get_mask(i)
-            if self.params.integration.lookup.mask is not None:
-                assert len(mask) == len(
-                    self.params.lookup.mask
-                ), "Mask/Image are incorrect size %d %d" % (
-                    len(mask),
-                    len(self.params.integration.lookup.mask),
-                )
-                mask = tuple(
-                    m1 & m2 for m1, m2 in zip(self.params.integration.lookup.mask, mask)
+            data = self.executor.process_frames(
+                frame0,
+                frame1,
+                self._frame_volumes(imageset, frame0),
+                self.experiments,
+                self.reflections,
+            )
+            process_time = time() - st - self.read_time
+        else:
+            image_volume = self._image_volume(frame0, frame1)
+            for i in range(len(imageset)):
+                image_volume.set_image(
+                    frame0 + i, self._read_image(imageset, i), nthreads=self.nthreads
                 )
-            image_volume.set_image(frame0 + i, make_image(image, mask))
-            read_time += time() - st
-            del image
-            del mask
 
-        # Process the data
-        st = time()
-        data = self.executor.process(image_volume, self.experiments, self.reflections)
-        process_time = time() - st
+            # Process the data
+            st = time()
+            data = self.executor.process(
+                image_volume, self.experiments, self.reflections
+            )
+            process_time = time() - st
+        read_time = self.read_time
 
         # Set the result values
         return dials.algorithms.integration.Result(
@@ -220,6 +221,57 @@ def __call__(self):
         )
 
 
+    def _image_volume(self, frame0, frame1):
+        """
+        Create an image volume for all the panels of the detector.
+        """
+        image_volume = MultiPanelImageVolume()
+        for panel in self.experiments[0].detector:
+            image_volume.add(
+                ImageVolume(
+                    frame0, frame1, panel.get_image_size()[1], panel.get_image_size()[0]
+                )
+            )
+        return image_volume
+
+    def _read_image(self, imageset, i):
+        """
+        Read an image and its mask, adding its time to the read time.
+        """
+        st = time()
+        image = imageset.get_corrected_data(i)
+        mask = imageset.get_mask(i)
+        if self.params.integration.lookup.mask is not None:
+            assert len(mask) == len(
+                self.params.lookup.mask
+            ), "Mask/Image are incorrect size %d %d" % (
+                len(mask),
+                len(self.params.integration.lookup.mask),
+            )
+            mask = tuple(
+                m1 & m2 for m1, m2 in zip(self.params.integration.lookup.mask, mask)
+            )
+        result = make_image(image, mask)
+        self.read_time += time() - st
+        return result
+
+    def _frame_volumes(self, imageset, frame0):
+        """
+        Iterate through the frames, yielding a single frame image volume and
+        the reflections whose bounding boxes include the frame.
+        """
+        z0, z1 = self.reflections["bbox"].parts()[4:6]
+        for i in range(len(imageset)):
+            frame = frame0 + i
+            image = self._read_image(imageset, i)
+            st = time()
+            image_volume = self._image_volume(frame, frame + 1)
+            image_volume.set_image(frame, image, nthreads=self.nthreads)
+            self.read_time += time() - st
+            del image
+            yield image_volume, self.reflections.select((z0 <= frame) & (z1 > frame))
+
+
 class ManagerImage(object):
     """
     A class to manage processing book-keeping
@@ -236,6 +288,9 @@ def __init__(self, experiments, reflections, params):
         # Initialise the callbacks
         self.executor = None
 
+        # The number of threads each task uses to set the panels of an image
+        self.nthreads = 1
+
         # Save some data
         self.experiments = experiments
         self.reflections = reflections
@@ -287,6 +342,7 @@ def task(self, index):
             experiments=self.experiments,
             params=self.params,
             executor=self.executor,
+            nthreads=self.nthreads,
         )
 
     def tasks(self):
@@ -0,0 +1,343 @@
+/*
+ * image_prefetcher.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_IMAGE_PREFETCHER_H
+#define DIALS_ALGORITHMS_INTEGRATION_IMAGE_PREFETCHER_H
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/python.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <dxtbx/imageset.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/shoebox/run_length_mask.h>
+#include <dials/error.h>
+#include <dials/util/python_gil.h>
+
+namespace dials { namespace algorithms {
+
+  namespace detail {
+
+    using dials::util::ScopedGILAcquire;
+    using dials::util::ScopedGILRelease;
+
+    /**
+     * Get the message for the current python error and clear the error. The
+     * GIL must be held.
+     */
+    inline std::string python_error_message() {
+      std::string message = "Unknown python error reading image";
+      PyObject *type = NULL, *value = NULL, *traceback = NULL;
+      PyErr_Fetch(&type, &value, &traceback);
+      if (value != NULL) {
+        PyObject *str = PyObject_Str(value);
+        if (str != NULL) {
+          boost::python::extract<std::string> text(str);
+          if (text.check()) {
+            message = text();
+          }
+          Py_DECREF(str);
+        }
+      }
+      Py_XDECREF(type);
+      Py_XDECREF(value);
+      Py_XDECREF(traceback);
+      PyErr_Clear();
+      return message;
+    }
+
+    /**
+     * @returns The elapsed time in seconds since the given time
+     */
+    inline double seconds_since(const boost::posix_time::ptime &start) {
+      return (boost::posix_time::microsec_clock::universal_time() - start)
+               .total_microseconds()
+             / 1e6;
+    }
+
+  }  // namespace detail
+
+  /**
+   * A class to read the images from an imageset ahead of when they are needed
+   * so that reading and decoding the images overlaps with integration. The
+   * images are read in order by a dedicated thread into a queue holding up to
+   * num_prefetch images. The reader thread holds the python GIL while reading
+   * an image so the thread calling next must not hold the GIL when waiting for
+   * an image; all other python calls must acquire the GIL themselves.
+   *
+   * The image data is copied into new arrays by the reader thread so that no
+   * array reference counts are shared between threads with the imageset. A
+   * dynamic mask read as runs is encoded straight from the imageset arrays.
+   *
+   * If num_prefetch is zero then no thread is started and the images are read
+   * by the calling thread in next.
+   */
+  class ImagePrefetcher : public boost::noncopyable {
+  public:
+    /**
+     * The mask to read with each image: none, the dynamic mask only, the
+     * full mask including the static mask and trusted range, or the dynamic
+     * mask as runs of masked pixels
+     */
+    enum MaskMode { NoMask, DynamicMask, FullMask, DynamicMaskRuns };
+
+    /**
+     * The data for a single image
+     */
+    struct Frame {
+      dxtbx::format::Image<double> data;
+      dxtbx::format::Image<bool> mask;
+      std::vector<shoebox::RunLengthMask> mask_runs;
+      bool rejected;
+      bool skipped;
+      Frame() : rejected(false), skipped(false) {}
+    };
+
+    typedef boost::shared_ptr<Frame> frame_pointer;
+    typedef boost::function<bool(std::size_t)> skip_function;
+
+    /**
+     * Start reading the images
+     * @param imageset The imageset (must outlive the prefetcher)
+     * @param mask_mode The mask to read with each image
+     * @param num_prefetch The maximum number of images to read ahead
+     * @param skip A function returning true if an image need not be read
+     */
+    ImagePrefetcher(dxtbx::ImageSet &imageset,
+                    MaskMode mask_mode,
+                    std::size_t num_prefetch,
+                    skip_function skip = skip_function())
+        : imageset_(imageset),
+          mask_mode_(mask_mode),
+          num_prefetch_(num_prefetch),
+          skip_(skip),
+          num_images_(imageset.size()),
+          next_index_(0),
+          stop_(false),
+          num_stalls_(0),
+          stall_time_(0),
+          read_time_(0),
+          reader_wait_time_(0) {
+#if PY_VERSION_HEX < 0x03070000
+      PyEval_InitThreads();
+#endif
+      if (num_prefetch_ > 0) {
+        thread_ = boost::thread(&ImagePrefetcher::run, this);
+      }
+    }
+
+    /**
+     * Stop the reader thread. The calling thread must not hold the GIL.
+     */
+    ~ImagePrefetcher() {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      condition_.notify_all();
+      if (thread_.joinable()) {
+        thread_.join();
+      }
+    }
+
+    /**
+     * Get the next image, waiting for it to be read if necessary. The calling
+     * thread must not hold the GIL.
+     * @returns The image data
+     */
+    frame_pointer next() {
+      DIALS_ASSERT(next_index_ < num_images_);
+      if (num_prefetch_ == 0) {
+        boost::posix_time::ptime start =
+          boost::posix_time::microsec_clock::universal_time();
+        std::string error;
+        frame_pointer frame = read(next_index_++, error);
+        double elapsed = detail::seconds_since(start);
+        num_stalls_++;
+        stall_time_ += elapsed;
+        read_time_ += elapsed;
+        if (!error.empty()) {
+          throw DIALS_ERROR(error);
+        }
+        return frame;
+      }
+      boost::unique_lock<boost::mutex> lock(mutex_);
+      if (queue_.empty() && error_.empty()) {
+        boost::posix_time::ptime start =
+          boost::posix_time::microsec_clock::universal_time();
+        while (queue_.empty() && error_.empty()) {
+          condition_.wait(lock);
+        }
+        num_stalls_++;
+        stall_time_ += detail::seconds_since(start);
+      }
+      if (queue_.empty()) {
+        throw DIALS_ERROR(error_);
+      }
+      frame_pointer frame = queue_.front();
+      queue_.pop_front();
+      next_index_++;
+      lock.unlock();
+      condition_.notify_all();
+      return frame;
+    }
+
+    /**
+     * @returns The number of times an image was not ready when needed
+     */
+    std::size_t num_stalls() const {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return num_stalls_;
+    }
+
+    /**
+     * @returns The total time (seconds) spent waiting for images
+     */
+    double stall_time() const {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return stall_time_;
+    }
+
+    /**
+     * @returns The total time (seconds) spent reading images
+     */
+    double read_time() const {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return read_time_;
+    }
+
+    /**
+     * @returns The total time (seconds) the reader waited for space in the queue
+     */
+    double reader_wait_time() const {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return reader_wait_time_;
+    }
+
+  protected:
+    /**
+     * Read the images in order into the queue
+     */
+    void run() {
+      for (std::size_t index = 0; index < num_images_; ++index) {
+        // Wait for space in the queue
+        {
+          boost::unique_lock<boost::mutex> lock(mutex_);
+          if (!stop_ && queue_.size() >= num_prefetch_) {
+            boost::posix_time::ptime start =
+              boost::posix_time::microsec_clock::universal_time();
+            while (!stop_ && queue_.size() >= num_prefetch_) {
+              condition_.wait(lock);
+            }
+            reader_wait_time_ += detail::seconds_since(start);
+          }
+          if (stop_) {
+            return;
+          }
+        }
+
+        // Read the image
+        boost::posix_time::ptime start =
+          boost::posix_time::microsec_clock::universal_time();
+        std::string error;
+        frame_pointer frame = read(index, error);
+        double elapsed = detail::seconds_since(start);
+
+        // Add the image to the queue or stop on error
+        {
+          boost::lock_guard<boost::mutex> lock(mutex_);
+          read_time_ += elapsed;
+          if (error.empty()) {
+            queue_.push_back(frame);
+          } else {
+            error_ = error;
+          }
+        }
+        condition_.notify_all();
+        if (!error.empty()) {
+          return;
+        }
+      }
+    }
+
+    /**
+     * Read a single image while holding the GIL
+     * @param index The image index
+     * @param error The error message if reading failed
+     * @returns The image data
+     */
+    frame_pointer read(std::size_t index, std::string &error) {
+      frame_pointer frame(new Frame());
+      if (skip_ && skip_(index)) {
+        frame->skipped = true;
+        return frame;
+      }
+      detail::ScopedGILAcquire gil;
+      try {
+        frame->rejected = imageset_.is_marked_for_rejection(index);
+        frame->data = copy_image(imageset_.get_corrected_data(index));
+        if (!frame->rejected && mask_mode_ == DynamicMask) {
+          frame->mask = copy_image(imageset_.get_dynamic_mask(index));
+        } else if (!frame->rejected && mask_mode_ == FullMask) {
+          frame->mask = copy_image(imageset_.get_mask(index));
+        } else if (!frame->rejected && mask_mode_ == DynamicMaskRuns) {
+          frame->mask_runs =
+            shoebox::run_length_encode(imageset_.get_dynamic_mask(index));
+        }
+      } catch (const boost::python::error_already_set &) {
+        error = detail::python_error_message();
+      } catch (const std::exception &e) {
+        error = e.what();
+      }
+      return frame;
+    }
+
+    /**
+     * Copy an image into new arrays
+     * @param image The image
+     * @returns The copy of the image
+     */
+    template <typename T>
+    static dxtbx::format::Image<T> copy_image(const dxtbx::format::Image<T> &image) {
+      dxtbx::format::Image<T> result;
+      for (std::size_t i = 0; i < image.n_tiles(); ++i) {
+        af::const_ref<T, af::c_grid<2> > src = image.tile(i).data().const_ref();
+        af::versa<T, af::c_grid<2> > dst(src.accessor());
+        std::copy(src.begin(), src.end(), dst.begin());
+        result.push_back(dxtbx::format::ImageTile<T>(dst));
+      }
+      return result;
+    }
+
+    dxtbx::ImageSet &imageset_;
+    MaskMode mask_mode_;
+    std::size_t num_prefetch_;
+    skip_function skip_;
+    std::size_t num_images_;
+    std::size_t next_index_;
+    bool stop_;
+    std::string error_;
+    std::deque<frame_pointer> queue_;
+    std::size_t num_stalls_;
+    double stall_time_;
+    double read_time_;
+    double reader_wait_time_;
+    mutable boost::mutex mutex_;
+    boost::condition_variable condition_;
+    boost::thread thread_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_IMAGE_PREFETCHER_H
@@ -0,0 +1,468 @@
+/*
+ * integration_profile.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_INTEGRATION_PROFILE_H
+#define DIALS_ALGORITHMS_INTEGRATION_INTEGRATION_PROFILE_H
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * The time spent in each stage of integrating the reflections, together
+   * with counters of the image reading and the job queue, for the report of
+   * the parallel integrator. Each worker thread accumulates into its own slot
+   * so that timing the reflections adds no contention between the threads,
+   * and the slots are merged when the results are asked for, once the
+   * workers have finished. The stages of the main thread are only written
+   * by the main thread.
+   */
+  class IntegrationProfile : public boost::noncopyable {
+  public:
+    /**
+     * The stages of integrating a reflection
+     */
+    enum Stage {
+      GetReflection,
+      Extract,
+      Mask,
+      Background,
+      Centroid,
+      Summation,
+      ProfileFitting,
+      Finalize,
+      SetReflection,
+      NumStages
+    };
+
+    /**
+     * The number of bins of the histogram of the time to integrate each
+     * reflection. Bin i counts the reflections taking less than 2^i
+     * microseconds and at least half that; the last bin counts the rest.
+     */
+    static const std::size_t num_cost_bins = 24;
+
+  private:
+    struct Slot;
+
+  public:
+    /**
+     * Time the stages of one reflection on a worker thread. Each call to
+     * stage adds the time since the previous call, or since construction, to
+     * the stage, and the total time is added to the histogram when the timer
+     * is destroyed, however the integration of the reflection ends.
+     */
+    class Timer : public boost::noncopyable {
+    public:
+      Timer(IntegrationProfile *profile)
+          : profile_(profile), slot_(profile != NULL ? &profile->local() : NULL) {
+        if (slot_ != NULL) {
+          start_ = last_ = now();
+        }
+      }
+
+      ~Timer() {
+        if (slot_ != NULL) {
+          slot_->add_cost((now() - start_).total_microseconds());
+          profile_->finished();
+        }
+      }
+
+      /**
+       * Add the time since the last stage to this stage
+       * @param stage The stage which has just finished
+       */
+      void stage(Stage stage) {
+        if (slot_ != NULL) {
+          boost::posix_time::ptime t = now();
+          slot_->time[stage] += (t - last_).total_microseconds();
+          last_ = t;
+        }
+      }
+
+      /**
+       * Record the memory held for the shoeboxes of this thread
+       * @param nbytes The number of bytes
+       */
+      void shoebox_memory(std::size_t nbytes) {
+        if (slot_ != NULL) {
+          slot_->shoebox_bytes = std::max(slot_->shoebox_bytes, nbytes);
+        }
+      }
+
+      /**
+       * Count a reflection whose background could not be computed
+       */
+      void background_failed() {
+        if (slot_ != NULL) {
+          slot_->num_background_failed++;
+        }
+      }
+
+      /**
+       * Count a reflection whose profile fitting failed
+       */
+      void profile_fitting_failed() {
+        if (slot_ != NULL) {
+          slot_->num_profile_fitting_failed++;
+        }
+      }
+
+    private:
+      static boost::posix_time::ptime now() {
+        return boost::posix_time::microsec_clock::universal_time();
+      }
+
+      IntegrationProfile *profile_;
+      Slot *slot_;
+      boost::posix_time::ptime start_;
+      boost::posix_time::ptime last_;
+    };
+
+    IntegrationProfile()
+        : local_(&IntegrationProfile::no_cleanup),
+          num_finished_(0),
+          image_read_time_(0),
+          image_wait_time_(0),
+          num_image_waits_(0),
+          reader_wait_time_(0),
+          buffer_copy_time_(0),
+          buffer_wait_time_(0),
+          num_buffer_waits_(0),
+          buffer_bytes_(0),
+          post_time_(0) {}
+
+    /**
+     * Count a reflection as finished, so that the main thread can see how
+     * many reflections are queued
+     */
+    void finished() {
+      num_finished_.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Record the number of reflections posted but not yet finished when the
+     * reflections of an image are posted
+     * @param num_posted The number of reflections posted so far
+     */
+    void sample_queue_depth(std::size_t num_posted) {
+      std::size_t finished = num_finished_.load(boost::memory_order_relaxed);
+      queue_depth_.push_back(num_posted > finished ? num_posted - finished : 0);
+    }
+
+    /**
+     * Set the counters of the image reading
+     * @param read_time The time spent reading images
+     * @param wait_time The time the integration waited for images
+     * @param num_waits The number of images the integration waited for
+     * @param reader_wait_time The time the reader waited for queue space
+     */
+    void set_image_reading(double read_time,
+                           double wait_time,
+                           std::size_t num_waits,
+                           double reader_wait_time) {
+      image_read_time_ = read_time;
+      image_wait_time_ = wait_time;
+      num_image_waits_ = num_waits;
+      reader_wait_time_ = reader_wait_time;
+    }
+
+    /**
+     * Set the counters of the image buffer
+     * @param copy_time The time spent copying images into the buffer
+     * @param wait_time The time spent waiting for space in the buffer
+     * @param num_waits The number of times the buffer was full
+     */
+    void set_buffer(double copy_time, double wait_time, std::size_t num_waits) {
+      buffer_copy_time_ = copy_time;
+      buffer_wait_time_ = wait_time;
+      num_buffer_waits_ = num_waits;
+    }
+
+    /**
+     * Set the size of the image buffer
+     * @param nbytes The number of bytes
+     */
+    void set_buffer_bytes(std::size_t nbytes) {
+      buffer_bytes_ = nbytes;
+    }
+
+    /**
+     * Add the time spent posting jobs to the thread pool
+     */
+    void add_post_time(double seconds) {
+      post_time_ += seconds;
+    }
+
+    /**
+     * @returns The name of a stage
+     */
+    static std::string stage_name(std::size_t stage) {
+      static const char *names[NumStages] = {"get reflection",
+                                             "extract shoebox",
+                                             "mask",
+                                             "background",
+                                             "centroid",
+                                             "summation",
+                                             "profile fitting",
+                                             "finalize",
+                                             "set reflection"};
+      DIALS_ASSERT(stage < NumStages);
+      return names[stage];
+    }
+
+    /**
+     * @returns The time (seconds) spent in each stage summed over the threads
+     */
+    af::shared<double> stage_time() const {
+      af::shared<double> result(NumStages, 0.0);
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      for (std::size_t i = 0; i < slots_.size(); ++i) {
+        for (std::size_t j = 0; j < NumStages; ++j) {
+          result[j] += slots_[i]->time[j] * 1e-6;
+        }
+      }
+      return result;
+    }
+
+    /**
+     * @returns The histogram of the time to integrate each reflection
+     */
+    af::shared<std::size_t> cost_histogram() const {
+      af::shared<std::size_t> result(num_cost_bins, 0);
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      for (std::size_t i = 0; i < slots_.size(); ++i) {
+        for (std::size_t j = 0; j < num_cost_bins; ++j) {
+          result[j] += slots_[i]->cost[j];
+        }
+      }
+      return result;
+    }
+
+    /**
+     * @returns The number of reflections integrated
+     */
+    std::size_t num_reflections() const {
+      return sum(&Slot::num_reflections);
+    }
+
+    /**
+     * @returns The number of reflections whose background failed
+     */
+    std::size_t num_background_failed() const {
+      return sum(&Slot::num_background_failed);
+    }
+
+    /**
+     * @returns The number of reflections whose profile fitting failed
+     */
+    std::size_t num_profile_fitting_failed() const {
+      return sum(&Slot::num_profile_fitting_failed);
+    }
+
+    /**
+     * @returns The number of threads which integrated reflections
+     */
+    std::size_t num_threads() const {
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      return slots_.size();
+    }
+
+    /**
+     * @returns The number of reflections queued as each image was posted
+     */
+    af::shared<std::size_t> queue_depth() const {
+      return af::shared<std::size_t>(queue_depth_.begin(), queue_depth_.end());
+    }
+
+    double image_read_time() const {
+      return image_read_time_;
+    }
+
+    double image_wait_time() const {
+      return image_wait_time_;
+    }
+
+    std::size_t num_image_waits() const {
+      return num_image_waits_;
+    }
+
+    double reader_wait_time() const {
+      return reader_wait_time_;
+    }
+
+    double buffer_copy_time() const {
+      return buffer_copy_time_;
+    }
+
+    double buffer_wait_time() const {
+      return buffer_wait_time_;
+    }
+
+    std::size_t num_buffer_waits() const {
+      return num_buffer_waits_;
+    }
+
+    double post_time() const {
+      return post_time_;
+    }
+
+    std::size_t buffer_bytes() const {
+      return buffer_bytes_;
+    }
+
+    /**
+     * @returns The sum over the threads of the most memory held for shoeboxes
+     */
+    std::size_t shoebox_bytes() const {
+      return sum(&Slot::shoebox_bytes);
+    }
+
+    /**
+     * @returns A table of the timings for the log
+     */
+    std::string summary() const {
+      af::shared<double> time = stage_time();
+      double total = 0;
+      for (std::size_t i = 0; i < time.size(); ++i) {
+        total += time[i];
+      }
+      std::size_t nref = num_reflections();
+      std::ostringstream ss;
+      ss << std::fixed << std::setprecision(2);
+      ss << "Time integrating " << nref << " reflections on " << num_threads()
+         << " threads:\n";
+      for (std::size_t i = 0; i < time.size(); ++i) {
+        ss << "  " << std::left << std::setw(16) << stage_name(i) << std::right
+           << std::setw(10) << time[i] << " s" << std::setw(8)
+           << (total > 0 ? 100.0 * time[i] / total : 0.0) << " %\n";
+      }
+      if (nref > 0) {
+        ss << "  mean " << std::setprecision(1) << 1e6 * total / nref
+           << " us per reflection" << std::setprecision(2) << "\n";
+      }
+      ss << "Background failed for " << num_background_failed()
+         << " and profile fitting for " << num_profile_fitting_failed()
+         << " reflections\n";
+      std::size_t max_depth = 0;
+      double mean_depth = 0;
+      for (std::size_t i = 0; i < queue_depth_.size(); ++i) {
+        max_depth = std::max(max_depth, queue_depth_[i]);
+        mean_depth += queue_depth_[i];
+      }
+      if (!queue_depth_.empty()) {
+        mean_depth /= queue_depth_.size();
+      }
+      ss << "Queued reflections per image: mean " << std::setprecision(1)
+         << mean_depth << ", max " << max_depth << std::setprecision(2) << "\n";
+      ss << "Main thread: image read " << image_read_time_ << " s, waited "
+         << image_wait_time_ << " s for " << num_image_waits_ << " images, copy "
+         << buffer_copy_time_ << " s, buffer full " << num_buffer_waits_
+         << " times for " << buffer_wait_time_ << " s, post " << post_time_ << " s\n";
+      ss << "Memory: image buffer " << std::setprecision(1) << buffer_bytes_ / 1e6
+         << " MB, shoeboxes " << shoebox_bytes() / 1e6 << " MB";
+      return ss.str();
+    }
+
+  private:
+    /**
+     * The counters of a worker thread, padded so that the slots of different
+     * threads are not on the same cache line
+     */
+    struct Slot {
+      boost::int64_t time[NumStages];
+      std::size_t cost[num_cost_bins];
+      std::size_t num_reflections;
+      std::size_t num_background_failed;
+      std::size_t num_profile_fitting_failed;
+      std::size_t shoebox_bytes;
+      char padding[64];
+
+      Slot()
+          : num_reflections(0),
+            num_background_failed(0),
+            num_profile_fitting_failed(0),
+            shoebox_bytes(0) {
+        std::fill(time, time + NumStages, 0);
+        std::fill(cost, cost + num_cost_bins, 0);
+      }
+
+      void add_cost(boost::int64_t microseconds) {
+        std::size_t bin = 0;
+        while (bin + 1 < num_cost_bins && (boost::int64_t(1) << bin) <= microseconds) {
+          bin++;
+        }
+        cost[bin]++;
+        num_reflections++;
+      }
+    };
+
+    friend class Timer;
+
+    /**
+     * @returns The slot of the calling thread
+     */
+    Slot &local() {
+      Slot *slot = local_.get();
+      if (slot == NULL) {
+        boost::shared_ptr<Slot> created(new Slot());
+        {
+          boost::lock_guard<boost::mutex> guard(mutex_);
+          slots_.push_back(created);
+        }
+        local_.reset(created.get());
+        slot = created.get();
+      }
+      return *slot;
+    }
+
+    std::size_t sum(std::size_t Slot::*member) const {
+      std::size_t result = 0;
+      boost::lock_guard<boost::mutex> guard(mutex_);
+      for (std::size_t i = 0; i < slots_.size(); ++i) {
+        result += (*slots_[i]).*member;
+      }
+      return result;
+    }
+
+    /**
+     * The slots are owned by the profile, not by the threads
+     */
+    static void no_cleanup(Slot *) {}
+
+    boost::thread_specific_ptr<Slot> local_;
+    std::vector<boost::shared_ptr<Slot> > slots_;
+    mutable boost::mutex mutex_;
+    boost::atomic<std::size_t> num_finished_;
+    std::vector<std::size_t> queue_depth_;
+    double image_read_time_;
+    double image_wait_time_;
+    std::size_t num_image_waits_;
+    double reader_wait_time_;
+    double buffer_copy_time_;
+    double buffer_wait_time_;
+    std::size_t num_buffer_waits_;
+    std::size_t buffer_bytes_;
+    double post_time_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_INTEGRATION_PROFILE_H
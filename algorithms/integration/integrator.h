@@ -195,6 +195,31 @@ namespace dials { namespace algorithms {
       groups_.add(int2(j0, j1), expr, range);
     }
 
+    /**
+     * Add a new group of jobs covering a range of experiments, with the frames
+     * split so that each job has a similar amount of work rather than a
+     * similar number of frames. Neighbouring jobs overlap by
+     * block_overlap_size frames and each job has at least
+     * block_overlap_size + 1 frames of its own, so fewer jobs may be added if
+     * there are not enough frames.
+     * @param expr The range of experiments
+     * @param range The range of frames
+     * @param work The work for each frame in the range
+     * @param njobs The number of jobs
+     * @param block_overlap_size The overlap between neighbouring jobs
+     */
+    void add_balanced(tiny<int, 2> expr,
+                      tiny<int, 2> range,
+                      const af::const_ref<double> &work,
+                      std::size_t njobs,
+                      int block_overlap_size) {
+      std::size_t j0 = size();
+      add_balanced_jobs(
+        groups_.size(), expr, range, work, njobs, block_overlap_size);
+      std::size_t j1 = size();
+      groups_.add(int2(j0, j1), expr, range);
+    }
+
     /**
      * @returns The requested job
      */
@@ -257,6 +282,59 @@ namespace dials { namespace algorithms {
       }
     }
 
+    void add_balanced_jobs(std::size_t index,
+                           tiny<int, 2> expr,
+                           tiny<int, 2> range,
+                           const af::const_ref<double> &work,
+                           std::size_t njobs,
+                           int block_overlap_size) {
+      int frame0 = range[0];
+      int frame1 = range[1];
+      DIALS_ASSERT(frame1 > frame0);
+      int nframes = frame1 - frame0;
+      DIALS_ASSERT(work.size() == (std::size_t)nframes);
+      DIALS_ASSERT(njobs > 0);
+      DIALS_ASSERT(block_overlap_size >= 0);
+
+      // Each job needs some frames which are not shared with the next job
+      int width = block_overlap_size + 1;
+      int nblocks = (int)std::min(njobs, (std::size_t)std::max(nframes / width, 1));
+
+      // Compute the cumulative work over the frames
+      std::vector<double> cumulative(nframes + 1, 0);
+      for (int i = 0; i < nframes; ++i) {
+        DIALS_ASSERT(work[i] >= 0);
+        cumulative[i + 1] = cumulative[i] + work[i];
+      }
+      double total = cumulative.back();
+
+      // Start each job where the cumulative work reaches its share, keeping
+      // enough frames for the jobs either side
+      std::vector<int> start(nblocks, 0);
+      for (int k = 1; k < nblocks; ++k) {
+        int f = (nframes * k) / nblocks;
+        if (total > 0) {
+          double target = total * k / nblocks;
+          f = std::lower_bound(cumulative.begin(), cumulative.end(), target)
+              - cumulative.begin();
+        }
+        f = std::max(f, start[k - 1] + width);
+        f = std::min(f, nframes - (nblocks - k) * width);
+        start[k] = f;
+      }
+
+      // Add the jobs, extending each into the next by the overlap
+      for (int k = 0; k < nblocks; ++k) {
+        int i1 = frame0 + start[k];
+        int i2 = frame1;
+        if (k + 1 < nblocks) {
+          i2 = std::min(frame0 + start[k + 1] + block_overlap_size, frame1);
+        }
+        DIALS_ASSERT(i2 > i1);
+        jobs_.push_back(Job(index, expr, tiny<int, 2>(i1, i2)));
+      }
+    }
+
     std::vector<Job> jobs_;
     GroupList groups_;
   };
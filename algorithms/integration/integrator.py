@@ -5,6 +5,7 @@
 import logging
 import math
 import random
+import sys
 
 import six
 import six.moves.cPickle as pickle
@@ -15,6 +16,7 @@
 from dials.algorithms.integration.parallel_integrator import (
     IntegratorProcessor,
     ReferenceCalculatorProcessor,
+    SinglePassIntegratorProcessor,
 )
 from dials.algorithms.integration.processor import (
     Processor2D,
@@ -43,6 +45,11 @@
     ReflectionManager,
 )
 
+try:
+    import resource
+except ImportError:
+    resource = None
+
 logger = logging.getLogger(__name__)
 
 __all__ = [
@@ -69,11 +76,35 @@
     "generate_phil_scope",
     "hist",
     "job",
+    "log_memory_usage",
     "nframes_hist",
     "phil_scope",
 ]
 
 
+def log_memory_usage(stage, reflections=None):
+    """
+    Log the peak memory used by the process and, if given, the memory used by
+    each column of the reflection table. This is only done at debug level.
+
+    :param stage: The stage of the integration
+    :param reflections: The reflection table
+    """
+    if not logger.isEnabledFor(logging.DEBUG):
+        return
+    logger.debug("")
+    if resource is not None:
+        # The peak memory is in kilobytes on Linux and bytes on macOS
+        max_rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+        if sys.platform != "darwin":
+            max_rss *= 1024
+        logger.debug(" Peak memory %s: %.1f MB" % (stage, max_rss / 1e6))
+    if reflections is not None:
+        logger.debug(" Memory used by the reflections %s:" % stage)
+        logger.debug(reflections.memory_report(prefix=" "))
+    logger.debug("")
+
+
 def generate_phil_scope():
     """
     Generate the integration phil scope.
@@ -116,6 +147,35 @@ def generate_phil_scope():
           .help = "The maximum percentage of available memory to use for"
                   "allocating shoebox arrays."
 
+        memory_limit = None
+          .type = float(value_min=0.0)
+          .help = "An upper limit on the memory (in GB) to use for allocating"
+                  "shoebox arrays in all processes, applied as well as"
+                  "max_memory_usage. The block size and the number of"
+                  "processes are reduced so that the estimated shoebox memory"
+                  "fits within the limit."
+
+        shared_memory = None
+          .type = str
+          .help = "If set then the image data for each block is held in a named"
+                  "shared memory segment so that processes on the same node"
+                  "integrating the same images share a single decoded copy."
+                  "The images for the whole block are held in memory."
+
+        balance = False
+          .type = bool
+          .help = "For block size auto, split the frames so that each block"
+                  "has a similar number of shoebox pixels, from the bounding"
+                  "boxes of the reflections, rather than a similar number of"
+                  "frames. Jobs over frames with many reflections then take"
+                  "about as long as the others."
+
+        prefetch = 2
+          .type = int(value_min=0)
+          .help = "The number of images to read and decode ahead of"
+                  "integration by a separate thread. If 0 then images are read"
+                  "only when needed."
+
       }
 
       use_dynamic_mask = True
@@ -175,6 +235,14 @@ def generate_phil_scope():
 
       }
 
+      checkpoint = None
+        .type = path
+        .help = "If set, the reflections of each processing job are appended to"
+                "this file as the job finishes, so that the results of a long"
+                "run are kept if it fails. The file can be read with"
+                "flex.reflection_table.from_file."
+        .expert_level = 2
+
       integrator = *auto 3d flat3d 2d single2d stills 3d_threaded
         .type = choice
         .help = "The integrator to use."
@@ -186,6 +254,14 @@ def generate_phil_scope():
           .type = bool
           .help = "Use profile fitting if available"
 
+        single_pass = False
+          .type = bool
+          .help = "Model the reference profiles and integrate the reflections "
+                  "with one read of the images, keeping the shoeboxes of all "
+                  "the reflections in memory for the profile fitting. This "
+                  "is only used by the threaded integrator with mp.njobs=1."
+          .expert_level = 2
+
         sigma_b_multiplier = 2.0
           .type = float(value_min=1.0)
           .help = "Background box expansion factor"
@@ -233,6 +309,19 @@ def generate_phil_scope():
         nproc = 1
           .type = int(value_min=1)
           .help = "The number of processes to use per cluster job"
+
+        batch_size = 16
+          .type = int(value_min=1)
+          .help = "For the threaded integrator, the number of neighbouring"
+                  "reflections on the same panel integrated together by a"
+                  "thread. If 1 then each reflection is a separate job."
+
+        numa = False
+          .type = bool
+          .help = "For the threaded integrator on Linux, pin the threads to"
+                  "CPUs spread over the NUMA nodes and place each part of the"
+                  "image buffer on the node of the thread that mostly reads it."
+                  "The number of shoeboxes read from another node is reported."
       }
 
       summation {
@@ -392,6 +481,9 @@ def from_phil(params):
         block.threshold = params.block.threshold
         block.force = params.block.force
         block.max_memory_usage = params.block.max_memory_usage
+        block.memory_limit = params.block.memory_limit
+        block.prefetch = params.block.prefetch
+        block.balance = params.block.balance
 
         # Set the modelling processor parameters
         result.modelling.mp = mp
@@ -448,7 +540,9 @@ def _initialize_rotation(experiments, params, reflections):
     reflections.compute_zeta_multi(experiments)
     reflections.compute_d(experiments)
     reflections.compute_bbox(
-        experiments, sigma_b_multiplier=params.profile.sigma_b_multiplier
+        experiments,
+        sigma_b_multiplier=params.profile.sigma_b_multiplier,
+        nthreads=params.integration.mp.nproc,
     )
 
     # Filter the reflections by zeta
@@ -469,7 +563,9 @@ def _initialize_stills(experiments, params, reflections):
     # Compute some reflection properties
     reflections.compute_d(experiments)
     reflections.compute_bbox(
-        experiments, sigma_b_multiplier=params.profile.sigma_b_multiplier
+        experiments,
+        sigma_b_multiplier=params.profile.sigma_b_multiplier,
+        nthreads=params.integration.mp.nproc,
     )
 
     # Check the bounding boxes are all 1 frame in width
@@ -510,7 +606,7 @@ def _finalize_rotation(reflections, experiments, params):
     reflections, experiments = _finalize(reflections, experiments, params)
 
     # Compute the corrections
-    reflections.compute_corrections(experiments)
+    reflections.compute_corrections(experiments, nthreads=params.integration.mp.nproc)
     return reflections, experiments
 
 
@@ -985,6 +1081,7 @@ def integrate(self):
 
         # Initialize the reflections
         self.initialize_reflections(self.experiments, self.params, self.reflections)
+        log_memory_usage("after initialisation", self.reflections)
 
         # Check if we want to do some profile fitting
         fitting_class = [e.profile.fitting_class() for e in self.experiments]
@@ -1156,6 +1253,7 @@ def integrate(self):
 
                 # Set to the finalized fitter
                 profile_fitter = finalized_profile_fitter
+                log_memory_usage("after profile modelling")
 
         logger.info("=" * 80)
         logger.info("")
@@ -1175,10 +1273,13 @@ def integrate(self):
         # Process the reflections
         self.reflections, _, time_info = processor.process()
 
+        log_memory_usage("after integration", self.reflections)
+
         # Finalize the reflections
         self.reflections, self.experiments = self.finalize_reflections(
             self.reflections, self.experiments, self.params
         )
+        log_memory_usage("after finalisation", self.reflections)
 
         # Create the integration report
         self.integration_report = IntegrationReport(self.experiments, self.reflections)
@@ -1331,7 +1432,9 @@ def finalise(self):
         """
 
         # Compute the corrections
-        self.reflections.compute_corrections(self.experiments)
+        self.reflections.compute_corrections(
+            self.experiments, nthreads=self.params.integration.mp.nproc
+        )
 
     def integrate(self):
         """
@@ -1376,44 +1479,73 @@ def integrate(self):
 
         # Do the initialisation
         self.initialise()
+        log_memory_usage("after initialisation", self.reflections)
 
-        # Do profile modelling
-        if self.params.integration.profile.fitting:
+        # Check if the profiles are to be modelled and the reflections
+        # integrated with one read of the images
+        profile = self.params.integration.profile
+        single_pass = profile.fitting and profile.single_pass
+        if single_pass and self.params.integration.mp.njobs > 1:
+            logger.warning("Profile modelling in a single pass needs mp.njobs=1")
+            single_pass = False
+
+        if single_pass:
 
             logger.info("=" * 80)
             logger.info("")
-            logger.info(heading("Modelling reflection profiles"))
+            logger.info(heading("Modelling and integrating reflections"))
             logger.info("")
 
-            # Compute the reference profiles
-            reference_calculator = ReferenceCalculatorProcessor(
+            # Compute the reference profiles and integrate the reflections
+            integrator = SinglePassIntegratorProcessor(
                 experiments=self.experiments,
                 reflections=self.reflections,
                 params=self.params,
             )
+            self.reference_profiles = integrator.profiles()
 
-            # Get the reference profiles
-            self.reference_profiles = reference_calculator.profiles()
         else:
-            self.reference_profiles = None
 
-        logger.info("=" * 80)
-        logger.info("")
-        logger.info(heading("Integrating reflections"))
-        logger.info("")
+            # Do profile modelling
+            if self.params.integration.profile.fitting:
 
-        integrator = IntegratorProcessor(
-            experiments=self.experiments,
-            reflections=self.reflections,
-            reference=self.reference_profiles,
-            params=self.params,
-        )
+                logger.info("=" * 80)
+                logger.info("")
+                logger.info(heading("Modelling reflection profiles"))
+                logger.info("")
+
+                # Compute the reference profiles
+                reference_calculator = ReferenceCalculatorProcessor(
+                    experiments=self.experiments,
+                    reflections=self.reflections,
+                    params=self.params,
+                )
+
+                # Get the reference profiles
+                self.reference_profiles = reference_calculator.profiles()
+                log_memory_usage("after profile modelling")
+            else:
+                self.reference_profiles = None
+
+            logger.info("=" * 80)
+            logger.info("")
+            logger.info(heading("Integrating reflections"))
+            logger.info("")
+
+            integrator = IntegratorProcessor(
+                experiments=self.experiments,
+                reflections=self.reflections,
+                reference=self.reference_profiles,
+                params=self.params,
+            )
 
         # Process the reflections
         self.reflections = integrator.reflections()
+        log_memory_usage("after integration", self.reflections)
 
         # Do the finalisation
         self.finalise()
+        log_memory_usage("after finalisation", self.reflections)
 
         # Create the integration report
         self.integration_report = IntegrationReport(self.experiments, self.reflections)
@@ -21,7 +21,7 @@ def __init__(self, params, experiments, reference, extractor=None):
         n_sigma = params.integration.shoebox.n_sigma
         assert n_sigma > 0
         self._mask_profiles = shoebox.MaskerEmpirical(
-            experiments[0], reference=reference
+            experiments[0], reference=reference, nproc=params.integration.mp.nproc
         )
 
     def integrate(self):
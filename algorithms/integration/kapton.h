@@ -0,0 +1,360 @@
+/*
+ * kapton.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ALGORITHMS_INTEGRATION_KAPTON_H
+#define DIALS_ALGORITHMS_INTEGRATION_KAPTON_H
+
+#include <cmath>
+#include <vector>
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <scitbx/mat3.h>
+#include <dxtbx/model/detector.h>
+#include <dxtbx/model/panel.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::Foreground;
+  using dials::model::Shoebox;
+  using dials::model::Valid;
+  using dxtbx::model::Detector;
+  using dxtbx::model::Panel;
+  using scitbx::mat3;
+  using scitbx::vec2;
+  using scitbx::vec3;
+
+  /**
+   * The kapton tape of kapton_2019_correction, as a box whose faces are given
+   * by dxtbx panels. The geometry of each face is extracted once on
+   * construction, so finding the intersections of a ray does not need the
+   * panel models. The faces must use the simple pixel to millimeter mapping,
+   * as the faces created by KaptonTape_2019 do.
+   */
+  class KaptonTapeBox {
+  public:
+    /**
+     * @param abs_coeff The absorption coefficient of kapton (mm^-1)
+     */
+    KaptonTapeBox(double abs_coeff) : abs_coeff_(abs_coeff) {}
+
+    /**
+     * Add a face of the tape
+     * @param panel The panel giving the plane and extent of the face
+     */
+    void add_face(const Panel &panel) {
+      Face face;
+      face.D = panel.get_D_matrix();
+      face.d = panel.get_d_matrix();
+      face.pixel_size = panel.get_pixel_size();
+      face.image_size = vec2<double>(panel.get_image_size()[0],
+                                     panel.get_image_size()[1]);
+      faces_.push_back(face);
+    }
+
+    /** @returns The number of faces */
+    std::size_t num_faces() const {
+      return faces_.size();
+    }
+
+    /** @returns The absorption coefficient */
+    double abs_coeff() const {
+      return abs_coeff_;
+    }
+
+    /**
+     * The path length through the tape of a ray from the origin. This is the
+     * largest distance between the intersections of the ray with the faces,
+     * or zero if the ray intersects fewer than two faces.
+     * @param s1 The direction of the ray
+     * @param points Workspace for the intersection points
+     * @returns The path length (mm)
+     */
+    double path_length(const vec3<double> &s1,
+                       std::vector<vec3<double> > &points) const {
+      points.clear();
+      for (std::size_t j = 0; j < faces_.size(); ++j) {
+        const Face &face = faces_[j];
+        vec3<double> v = face.D * s1;
+        if (!(v[2] > 0)) {
+          continue;
+        }
+        vec2<double> mm(v[0] / v[2], v[1] / v[2]);
+        vec2<double> px(mm[0] / face.pixel_size[0], mm[1] / face.pixel_size[1]);
+        if (px[0] > 0.0 && px[1] > 0.0 && px[0] < face.image_size[0]
+            && px[1] < face.image_size[1]) {
+          points.push_back(face.d * vec3<double>(mm[0], mm[1], 1.0));
+        }
+      }
+      if (points.size() < 2) {
+        return 0.0;
+      }
+      double max_d2 = -999.9;
+      for (std::size_t k1 = 0; k1 < points.size() - 1; ++k1) {
+        for (std::size_t k2 = k1 + 1; k2 < points.size(); ++k2) {
+          const vec3<double> &pt1 = points[k1];
+          const vec3<double> &pt2 = points[k2];
+          double d2 = (pt1[0] - pt2[0]) * (pt1[0] - pt2[0])
+                      + (pt1[1] - pt2[1]) * (pt1[1] - pt2[1])
+                      + (pt1[2] - pt2[2]) * (pt1[2] - pt2[2]);
+          if (d2 > max_d2) {
+            max_d2 = d2;
+          }
+        }
+      }
+      return std::sqrt(max_d2);
+    }
+
+    /**
+     * The absorption correction of a ray from the origin
+     * @param s1 The direction of the ray
+     * @param points Workspace for the intersection points
+     * @returns The correction (>= 1)
+     */
+    double absorption_correction(const vec3<double> &s1,
+                                 std::vector<vec3<double> > &points) const {
+      return 1.0 / std::exp(-abs_coeff_ * path_length(s1, points));
+    }
+
+  private:
+    struct Face {
+      mat3<double> D;
+      mat3<double> d;
+      vec2<double> pixel_size;
+      vec2<double> image_size;
+    };
+
+    double abs_coeff_;
+    std::vector<Face> faces_;
+  };
+
+  /**
+   * The kapton tape of kapton_correction (fuller_kapton), as a slab bounded by
+   * two surfaces and the edge of the tape. The planes are given by their
+   * normals and the values of the normal dotted with a point on the plane.
+   */
+  class KaptonTapeSlab {
+  public:
+    /**
+     * @param surface_normal The normal of the surfaces of the tape
+     * @param edge_normal The normal of the edge of the tape
+     * @param sn1 The first surface dotted with its normal
+     * @param sn2 The second surface dotted with its normal
+     * @param sn3 The edge dotted with its normal
+     * @param abs_coeff The absorption coefficient of kapton (mm^-1)
+     */
+    KaptonTapeSlab(const vec3<double> &surface_normal,
+                   const vec3<double> &edge_normal,
+                   double sn1,
+                   double sn2,
+                   double sn3,
+                   double abs_coeff)
+        : surface_normal_(surface_normal),
+          edge_normal_(edge_normal),
+          sn1_(sn1),
+          sn2_(sn2),
+          sn3_(sn3),
+          abs_coeff_(abs_coeff) {}
+
+    /** @returns The absorption coefficient */
+    double abs_coeff() const {
+      return abs_coeff_;
+    }
+
+    /**
+     * The path length through the tape of a ray from the origin
+     * @param s1 The unit direction of the ray
+     * @returns The path length (mm)
+     */
+    double path_length(const vec3<double> &s1) const {
+      double dsurf1 = 0;
+      double dsurf2 = 0;
+      double dot_product = s1 * surface_normal_;
+      if (dot_product != 0) {
+        dsurf1 = sn1_ / dot_product;
+        dsurf2 = sn2_ / dot_product;
+      }
+      double dsurf3 = sn3_ / (s1 * edge_normal_);
+      bool unshadowed = (dsurf3 < dsurf1) || (dsurf1 < 0);
+      if (unshadowed) {
+        return 0.0;
+      } else if (dsurf3 < dsurf2) {
+        return dsurf3 - dsurf1;
+      } else if (dsurf3 >= dsurf2) {
+        return dsurf2 - dsurf1;
+      }
+      return 0.0;
+    }
+
+    /**
+     * The absorption correction of a ray from the origin
+     * @param s1 The unit direction of the ray
+     * @returns The correction (>= 1)
+     */
+    double absorption_correction(const vec3<double> &s1,
+                                 std::vector<vec3<double> > &) const {
+      return 1.0 / std::exp(-abs_coeff_ * path_length(s1));
+    }
+
+  private:
+    vec3<double> surface_normal_;
+    vec3<double> edge_normal_;
+    double sn1_;
+    double sn2_;
+    double sn3_;
+    double abs_coeff_;
+  };
+
+  namespace detail {
+
+    /**
+     * Compute the kapton absorption correction for a band of rays
+     */
+    template <typename Tape>
+    struct KaptonCorrectionBand {
+      const Tape &tape;
+      af::const_ref<vec3<double> > s1;
+      af::ref<double> result;
+
+      KaptonCorrectionBand(const Tape &tape_,
+                           const af::const_ref<vec3<double> > &s1_,
+                           af::ref<double> result_)
+          : tape(tape_), s1(s1_), result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        std::vector<vec3<double> > points;
+        for (int i = i0; i < i1; ++i) {
+          result[i] = tape.absorption_correction(s1[i], points);
+        }
+      }
+    };
+
+    /**
+     * Compute the mean and standard deviation of the kapton absorption
+     * correction over the foreground pixels of a band of shoeboxes
+     */
+    template <typename Tape>
+    struct KaptonSpotCorrectionBand {
+      const Tape &tape;
+      const Detector &detector;
+      af::const_ref<Shoebox<> > shoeboxes;
+      double pixel_offset;
+      af::ref<double> mean;
+      af::ref<double> sigma;
+
+      KaptonSpotCorrectionBand(const Tape &tape_,
+                               const Detector &detector_,
+                               const af::const_ref<Shoebox<> > &shoeboxes_,
+                               double pixel_offset_,
+                               af::ref<double> mean_,
+                               af::ref<double> sigma_)
+          : tape(tape_),
+            detector(detector_),
+            shoeboxes(shoeboxes_),
+            pixel_offset(pixel_offset_),
+            mean(mean_),
+            sigma(sigma_) {}
+
+      void operator()(int i0, int i1) const {
+        const int mask_code = Foreground | Valid;
+        std::vector<vec3<double> > points;
+        std::vector<double> corrections;
+        for (int i = i0; i < i1; ++i) {
+          const Shoebox<> &sbox = shoeboxes[i];
+          DIALS_ASSERT(sbox.is_consistent());
+          DIALS_ASSERT(sbox.panel < detector.size());
+          const Panel &panel = detector[sbox.panel];
+          af::c_grid<3> accessor = sbox.mask.accessor();
+          corrections.clear();
+          for (std::size_t k = 0; k < accessor[0]; ++k) {
+            for (std::size_t j = 0; j < accessor[1]; ++j) {
+              for (std::size_t l = 0; l < accessor[2]; ++l) {
+                if ((sbox.mask(k, j, l) & mask_code) != mask_code) {
+                  continue;
+                }
+                vec2<double> px(l + sbox.xoffset() + pixel_offset,
+                                j + sbox.yoffset() + pixel_offset);
+                vec3<double> s1 =
+                  panel.get_lab_coord(panel.pixel_to_millimeter(px)).normalize();
+                corrections.push_back(tape.absorption_correction(s1, points));
+              }
+            }
+          }
+          DIALS_ASSERT(corrections.size() > 0);
+          double sum = 0;
+          for (std::size_t n = 0; n < corrections.size(); ++n) {
+            sum += corrections[n];
+          }
+          mean[i] = sum / corrections.size();
+          sigma[i] = 0;
+          if (corrections.size() > 1) {
+            double sum_sq = 0;
+            for (std::size_t n = 0; n < corrections.size(); ++n) {
+              sum_sq += (corrections[n] - mean[i]) * (corrections[n] - mean[i]);
+            }
+            sigma[i] = std::sqrt(sum_sq / (corrections.size() - 1));
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the kapton absorption correction for a list of rays
+   * @param tape The model of the kapton tape
+   * @param s1 The unit directions of the rays from the sample
+   * @param nthreads The number of threads to use
+   * @returns The correction of each ray
+   */
+  template <typename Tape>
+  af::shared<double> kapton_absorption_correction(
+    const Tape &tape,
+    const af::const_ref<vec3<double> > &s1,
+    std::size_t nthreads = 1) {
+    af::shared<double> result(s1.size(), 0);
+    for_each_band(detail::KaptonCorrectionBand<Tape>(tape, s1, result.ref()),
+                  (int)s1.size(),
+                  nthreads);
+    return result;
+  }
+
+  /**
+   * Compute the mean and standard deviation of the kapton absorption
+   * correction over the foreground pixels of each shoebox
+   * @param tape The model of the kapton tape
+   * @param detector The detector model
+   * @param shoeboxes The shoeboxes
+   * @param pixel_offset The position within each pixel of its ray
+   * @param mean The mean correction of each shoebox
+   * @param sigma The standard deviation of the correction of each shoebox
+   * @param nthreads The number of threads to use
+   */
+  template <typename Tape>
+  void kapton_spot_absorption_correction(const Tape &tape,
+                                         const Detector &detector,
+                                         const af::const_ref<Shoebox<> > &shoeboxes,
+                                         double pixel_offset,
+                                         af::ref<double> mean,
+                                         af::ref<double> sigma,
+                                         std::size_t nthreads = 1) {
+    DIALS_ASSERT(mean.size() == shoeboxes.size());
+    DIALS_ASSERT(sigma.size() == shoeboxes.size());
+    for_each_band(detail::KaptonSpotCorrectionBand<Tape>(
+                    tape, detector, shoeboxes, pixel_offset, mean, sigma),
+                  (int)shoeboxes.size(),
+                  nthreads);
+  }
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_KAPTON_H
@@ -5,8 +5,8 @@
 
 from scitbx.matrix import col
 
+from dials.algorithms.integration import KaptonTapeBox
 from dials.algorithms.integration.kapton_correction import get_absorption_correction
-from dials.algorithms.shoebox import MaskCode
 from dials.array_family import flex
 
 logging.basicConfig()
@@ -137,6 +137,7 @@ def create_kapton_face(ori, fast, slow, image_size, pixel_size, name):
         faces.append(create_kapton_face(ori, fast, slow, image_size, pixel_size, "xz1"))
         #
         self.faces = faces
+        self.tape = KaptonTapeBox(faces, self.abs_coeff)
 
     def get_kapton_path_mm(self, s1):
         """Get kapton path length traversed by an s1 vecto. If no kapton intersection or just touches the edge,
@@ -189,23 +190,17 @@ def abs_correction(self, s1):
             )  # unitless, >=1
         return absorption_correction
 
-    def abs_correction_flex(self, s1_flex):
+    def abs_correction_flex(self, s1_flex, nthreads=1):
         """Compute the absorption correction using beers law. Takes in a flex array of s1 vectors, determines path lengths for each
         and then determines absorption correction for each s1 vector"""
-        kapton_faces = self.faces
-        from dials.algorithms.integration import get_kapton_path_cpp
-
-        # new style, much faster
-        kapton_path_mm = get_kapton_path_cpp(kapton_faces, s1_flex)
-        # old style, really slow
-        # for s1 in s1_flex:
-        #  kapton_path_mm.append(self.get_kapton_path_mm(s1))
-        # determine absorption correction
-        if kapton_path_mm is not None:
-            absorption_correction = 1 / flex.exp(
-                -self.abs_coeff * kapton_path_mm
-            )  # unitless, >=1
-        return absorption_correction
+        return self.tape.absorption_correction(s1_flex, nthreads=nthreads)
+
+    def abs_correction_spots(self, detector, shoeboxes, nthreads=1):
+        """Compute the mean and standard deviation of the absorption correction over the foreground pixels of
+        each shoebox, taking the ray of each pixel through its centre"""
+        return self.tape.spot_absorption_correction(
+            detector, shoeboxes, pixel_offset=0.5, nthreads=nthreads
+        )
 
     def distance_of_point_from_line(self, r0, r1, r2):
         """Evaluates distance between point and a line between two points
@@ -480,49 +475,17 @@ def correction_and_within_spot_sigma(params_version, variance_within_spot=True):
             # *map(float, self.panel_size_px)) #
             detector = self.expt.detector
 
-            absorption_corrections = flex.double()
-            absorption_sigmas = (
-                flex.double()
-            )  # std dev of corrections for pixels within a spot, default sigma
-
             if variance_within_spot:
-                mask_code = MaskCode.Foreground | MaskCode.Valid
-                for iref in range(len(self.reflections_sele)):
-                    kapton_correction_vector = flex.double()
-                    # foreground: integration mask
-                    shoebox = self.reflections_sele[iref]["shoebox"]
-                    foreground = (
-                        (shoebox.mask.as_1d() & mask_code) == mask_code
-                    ).iselection()
-                    f_absolute, s_absolute, z_absolute = (
-                        shoebox.coords().select(foreground).parts()
-                    )
-                    panel_number = self.reflections_sele[iref]["panel"]
-                    lab_coords = detector[panel_number].get_lab_coord(
-                        detector[panel_number].pixel_to_millimeter(
-                            flex.vec2_double(f_absolute, s_absolute)
-                        )
-                    )
-                    s1 = lab_coords.each_normalize()
-                    # Real step right here
-                    kapton_correction_vector.extend(absorption.abs_correction_flex(s1))
-                    #
-                    average_kapton_correction = flex.mean(kapton_correction_vector)
-                    absorption_corrections.append(average_kapton_correction)
-                    try:
-                        spot_px_stddev = flex.mean_and_variance(
-                            kapton_correction_vector
-                        ).unweighted_sample_standard_deviation()
-                    except Exception:
-                        assert (
-                            len(kapton_correction_vector) == 1
-                        ), "stddev could not be calculated"
-                        spot_px_stddev = 0
-                    absorption_sigmas.append(spot_px_stddev)
-                return absorption_corrections, absorption_sigmas
+                return absorption.abs_correction_spots(
+                    detector,
+                    self.reflections_sele["shoebox"],
+                    nthreads=self.params.nproc,
+                )
             else:
                 s1_flex = self.reflections_sele["s1"].each_normalize()
-                absorption_corrections = absorption.abs_correction_flex(s1_flex)
+                absorption_corrections = absorption.abs_correction_flex(
+                    s1_flex, nthreads=self.params.nproc
+                )
                 return absorption_corrections, None
 
         # loop through modified Kapton parameters to get alternative corrections and estimate sigmas as
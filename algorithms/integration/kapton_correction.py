@@ -5,7 +5,7 @@
 from iotbx import phil
 from scitbx import matrix
 
-from dials.algorithms.shoebox import MaskCode
+from dials.algorithms.integration import KaptonTapeSlab
 from dials.array_family import flex
 
 absorption_defs = """
@@ -55,6 +55,9 @@
         .type = bool
         .help = calculate initial per-spot sigmas based on variance across pixels in the spot.
         .help = turn this off to get a major speed-up
+      nproc = 1
+        .type = int(value_min=1)
+        .help = number of threads used to compute the corrections
     }
   }"""
 
@@ -247,6 +250,14 @@ def __init__(
         self.sn1 = self.surface1_point_mm.dot(self.surface_normal)
         self.sn2 = self.surface2_point_mm.dot(self.surface_normal)
         self.sn3 = self.surface3_point_mm.dot(self.edge_of_tape_normal)
+        self.tape = KaptonTapeSlab(
+            self.surface_normal.elems,
+            self.edge_of_tape_normal.elems,
+            self.sn1,
+            self.sn2,
+            self.sn3,
+            self.abs_coeff,
+        )
 
     def abs_correction(self, s1):
         try:
@@ -271,32 +282,19 @@ def abs_correction(self, s1):
         except ZeroDivisionError:
             return 0
 
-    def abs_correction_flex(self, s1_flex):
-        s1_flex_length = len(s1_flex)
-        surface_normal = flex.vec3_double(s1_flex_length, self.surface_normal)
-        edge_of_tape_normal = flex.vec3_double(s1_flex_length, self.edge_of_tape_normal)
-
-        dsurf1 = flex.double(len(s1_flex), 0)
-        dsurf2 = flex.double(len(s1_flex), 0)
-        dot_product = s1_flex.dot(surface_normal)
-        sel = dot_product != 0
-        dsurf1.set_selected(sel, self.sn1 / dot_product.select(sel))
-        dsurf2.set_selected(sel, self.sn2 / dot_product.select(sel))
-        dsurf3 = self.sn3 / (s1_flex.dot(edge_of_tape_normal))
-
-        # determine path length through kapton tape
-        kapton_path_mm = flex.double(s1_flex_length, 0)
-        unshadowed_sel = (dsurf3 < dsurf1) | (dsurf1 < 0)
-        nearsel = ~unshadowed_sel & (dsurf3 < dsurf2)
-        kapton_path_mm.set_selected(nearsel, (dsurf3 - dsurf1).select(nearsel))
-        farsel = ~unshadowed_sel & (dsurf3 >= dsurf2)
-        kapton_path_mm.set_selected(farsel, (dsurf2 - dsurf1).select(farsel))
-
-        # determine absorption correction
-        absorption_correction = 1 / flex.exp(
-            -self.abs_coeff * kapton_path_mm
-        )  # unitless, >=1
-        return absorption_correction
+    def abs_correction_flex(self, s1_flex, nthreads=1):
+        """The absorption correction of each of a list of unit s1 vectors"""
+        return self.tape.absorption_correction(s1_flex, nthreads=nthreads)
+
+    def abs_correction_spots(self, detector, shoeboxes, nthreads=1):
+        """
+        The mean and standard deviation of the absorption correction over the
+        foreground pixels of each shoebox, taking the ray of each pixel through
+        its corner.
+        """
+        return self.tape.spot_absorption_correction(
+            detector, shoeboxes, pixel_offset=0, nthreads=nthreads
+        )
 
     def abs_bounding_lines(self, as_xy_ints=False):
         if not hasattr(
@@ -493,50 +491,17 @@ def correction_and_within_spot_sigma(params_version, variance_within_spot=True):
             detector = self.expt.detector
             # y_max = int(detector[0].millimeter_to_pixel(detector[0].get_image_size())[1])
 
-            absorption_corrections = flex.double()
-            absorption_sigmas = (
-                flex.double()
-            )  # std dev of corrections for pixels within a spot, default sigma
-
             if variance_within_spot:
-                mask_code = MaskCode.Foreground | MaskCode.Valid
-                for iref in range(len(self.reflections_sele)):
-                    kapton_correction_vector = flex.double()
-                    # foreground: integration mask
-                    shoebox = self.reflections_sele[iref]["shoebox"]
-                    foreground = (
-                        (shoebox.mask.as_1d() & mask_code) == mask_code
-                    ).iselection()
-                    width = shoebox.xsize()
-                    fast_coords = (foreground % width).as_int()  # within spot
-                    slow_coords = (foreground / width).as_int()  # within spot
-                    f_absolute = fast_coords + shoebox.bbox[0]  # relative to detector
-                    s_absolute = slow_coords + shoebox.bbox[2]  # relative to detector
-                    lab_coords = detector[0].get_lab_coord(
-                        detector[0].pixel_to_millimeter(
-                            flex.vec2_double(
-                                f_absolute.as_double(), s_absolute.as_double()
-                            )
-                        )
-                    )
-                    s1 = lab_coords.each_normalize()
-                    kapton_correction_vector.extend(absorption.abs_correction_flex(s1))
-                    average_kapton_correction = flex.mean(kapton_correction_vector)
-                    absorption_corrections.append(average_kapton_correction)
-                    try:
-                        spot_px_stddev = flex.mean_and_variance(
-                            kapton_correction_vector
-                        ).unweighted_sample_standard_deviation()
-                    except Exception:
-                        assert (
-                            len(kapton_correction_vector) == 1
-                        ), "stddev could not be calculated"
-                        spot_px_stddev = 0
-                    absorption_sigmas.append(spot_px_stddev)
-                return absorption_corrections, absorption_sigmas
+                return absorption.abs_correction_spots(
+                    detector,
+                    self.reflections_sele["shoebox"],
+                    nthreads=self.params.nproc,
+                )
             else:
                 s1_flex = self.reflections_sele["s1"].each_normalize()
-                absorption_corrections = absorption.abs_correction_flex(s1_flex)
+                absorption_corrections = absorption.abs_correction_flex(
+                    s1_flex, nthreads=self.params.nproc
+                )
                 return absorption_corrections, None
 
         # loop through modified Kapton parameters to get alternative corrections and estimate sigmas as
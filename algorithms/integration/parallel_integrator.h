@@ -12,7 +12,8 @@
 #ifndef DIALS_ALGORITHMS_INTEGRATION_PARALLEL_INTEGRATOR_H
 #define DIALS_ALGORITHMS_INTEGRATION_PARALLEL_INTEGRATOR_H
 
-#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/scan.h>
@@ -21,14 +22,21 @@
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/reflection.h>
 #include <dials/error.h>
+#include <dials/util/numa.h>
 #include <dials/util/thread_pool.h>
-#include <dials/algorithms/shoebox/find_overlapping.h>
+#include <dials/algorithms/shoebox/overlap_index.h>
+#include <dials/algorithms/shoebox/overload_checker.h>
+#include <dials/algorithms/shoebox/run_length_mask.h>
 #include <dials/algorithms/integration/sum/summation.h>
 #include <dials/algorithms/centroid/centroid.h>
 #include <dials/array_family/boost_python/flex_table_suite.h>
 #include <map>
 
 #include <dials/algorithms/integration/interfaces.h>
+#include <dials/algorithms/integration/image_prefetcher.h>
+#include <dials/algorithms/integration/integration_profile.h>
+#include <dials/algorithms/integration/shared_image_buffer.h>
+#include <dials/algorithms/integration/shoebox_arena.h>
 
 namespace dials { namespace algorithms {
 
@@ -38,11 +46,15 @@ namespace dials { namespace algorithms {
   using dxtbx::model::Panel;
   using dxtbx::model::Scan;
 
+  using scitbx::af::int4;
+
   using dxtbx::ImageSequence;
   using dxtbx::format::Image;
   using dxtbx::format::ImageTile;
 
-  using dials::model::AdjacencyList;
+  using dials::algorithms::shoebox::OverlapIndex;
+  using dials::algorithms::shoebox::OverloadBitmap;
+  using dials::algorithms::shoebox::RunLengthMask;
   using dials::model::Shoebox;
 
   /**
@@ -53,10 +65,12 @@ namespace dials { namespace algorithms {
     Logger(boost::python::object obj) : obj_(obj) {}
 
     void info(const char *str) const {
+      detail::ScopedGILAcquire gil;
       obj_.attr("info")(str);
     }
 
     void debug(const char *str) const {
+      detail::ScopedGILAcquire gil;
       obj_.attr("debug")(str);
     }
 
@@ -65,11 +79,24 @@ namespace dials { namespace algorithms {
   };
 
   /**
-   * A class to store the image data buffer
+   * A class to store the image data buffer. The buffer is either allocated in
+   * process local memory or held in a named shared memory segment so that it
+   * can be shared by several processes on the same node. When the buffer is
+   * shared, an image which has already been copied to the buffer by another
+   * process is not copied again.
+   *
+   * A local buffer may hold only a region of each panel, given as (x0, x1, y0,
+   * y1), so that memory is not allocated for parts of the panels which no
+   * reflection needs.
+   *
+   * The static mask and dynamic masks given as runs of masked pixels are
+   * applied run by run, so that masking an image costs time in proportion to
+   * the number of masked pixels rather than the number of pixels.
    */
   class BufferBase {
   public:
     typedef Shoebox<>::float_type float_type;
+    typedef SharedImageBuffer<float_type> shared_buffer_type;
 
     /**
      * Initialise the the size of the panels
@@ -83,31 +110,96 @@ namespace dials { namespace algorithms {
                float_type mask_value,
                const Image<bool> &external_mask)
         : mask_value_(mask_value) {
+      std::vector<int4> region;
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        int xsize = detector[i].get_image_size()[0];
+        int ysize = detector[i].get_image_size()[1];
+        region.push_back(int4(0, xsize, 0, ysize));
+      }
+      init_data(detector, num_images, region);
+      init_static_mask(detector, external_mask);
+    }
+
+    /**
+     * Initialise the buffer to hold a region of each panel
+     * @param detector The detector model
+     * @param num_images The number of images
+     * @param mask_value The value of masked pixels in the buffer
+     * @param external_mask The external mask
+     * @param region The (x0, x1, y0, y1) region of each panel
+     * @param initialise If false then leave the memory untouched (see first_touch)
+     */
+    BufferBase(const Detector &detector,
+               std::size_t num_images,
+               float_type mask_value,
+               const Image<bool> &external_mask,
+               const std::vector<int4> &region,
+               bool initialise = true)
+        : mask_value_(mask_value) {
+      init_data(detector, num_images, region, initialise);
+      init_static_mask(detector, external_mask);
+    }
+
+    /**
+     * Initialise the buffer in a named shared memory segment
+     * @param detector The detector model
+     * @param num_images The number of images
+     * @param mask_value The value of masked pixels in the buffer
+     * @param external_mask The external mask
+     * @param shared_name The name of the shared memory segment
+     * @param first_image The first image in the buffer
+     */
+    BufferBase(const Detector &detector,
+               std::size_t num_images,
+               float_type mask_value,
+               const Image<bool> &external_mask,
+               const std::string &shared_name,
+               int first_image)
+        : mask_value_(mask_value) {
       std::size_t zsize = num_images;
       DIALS_ASSERT(zsize > 0);
+      std::vector<std::size_t> panel_size;
       for (std::size_t i = 0; i < detector.size(); ++i) {
         std::size_t xsize = detector[i].get_image_size()[0];
         std::size_t ysize = detector[i].get_image_size()[1];
         DIALS_ASSERT(xsize > 0);
         DIALS_ASSERT(ysize > 0);
-
-        // Allocate all the data buffers
-        data_.push_back(
-          af::versa<float_type, af::c_grid<3> >(af::c_grid<3>(zsize, ysize, xsize)));
-
-        // Allocate the static mask buffer
-        static_mask_.push_back(
-          af::versa<bool, af::c_grid<2> >(af::c_grid<2>(ysize, xsize), true));
+        panel_size.push_back(ysize);
+        panel_size.push_back(xsize);
       }
 
-      // Set the external mask
-      if (!external_mask.empty()) {
-        DIALS_ASSERT(external_mask.n_tiles() == static_mask_.size());
-        for (std::size_t i = 0; i < external_mask.n_tiles(); ++i) {
-          set_external_mask_for_panel(external_mask.tile(i).data().const_ref(),
-                                      static_mask_[i].ref());
-        }
+      // Attach to the shared memory and get the data buffers
+      shared_.reset(
+        new shared_buffer_type(shared_name, first_image, zsize, panel_size));
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        data_ref_.push_back(af::ref<float_type, af::c_grid<3> >(
+          shared_->data(i),
+          af::c_grid<3>(zsize, panel_size[2 * i], panel_size[2 * i + 1])));
+        region_.push_back(int4(0, panel_size[2 * i + 1], 0, panel_size[2 * i]));
       }
+      init_static_mask(detector, external_mask);
+    }
+
+    /**
+     * @returns True/False the buffer is in shared memory
+     */
+    bool is_shared() const {
+      return shared_.get() != NULL;
+    }
+
+    /**
+     * @returns The number of panels
+     */
+    std::size_t num_panels() const {
+      return data_ref_.size();
+    }
+
+    /**
+     * @param index The image index
+     * @returns True/False the image has been copied to a shared buffer
+     */
+    bool is_loaded(std::size_t index) const {
+      return shared_.get() != NULL && shared_->is_ready(index);
     }
 
     /**
@@ -116,10 +208,14 @@ namespace dials { namespace algorithms {
      * @param index The image index
      */
     void copy(const Image<double> &data, std::size_t index) {
-      DIALS_ASSERT(data.n_tiles() == data_.size());
-      for (std::size_t i = 0; i < data.n_tiles(); ++i) {
-        copy(data.tile(i).data().const_ref(), data_[i].ref(), index);
-        apply_mask(static_mask_[i].const_ref(), data_[i].ref(), index);
+      DIALS_ASSERT(data.n_tiles() == data_ref_.size());
+      LoadGuard guard(shared_.get(), index);
+      if (guard.required()) {
+        for (std::size_t i = 0; i < data.n_tiles(); ++i) {
+          copy(data.tile(i).data().const_ref(), data_ref_[i], index, region_[i]);
+          apply_mask(static_runs_[i], data_ref_[i], index, region_[i]);
+        }
+        guard.release();
       }
     }
 
@@ -129,12 +225,16 @@ namespace dials { namespace algorithms {
      * @param index The image index
      */
     void copy(const Image<double> &data, bool mask, std::size_t index) {
-      DIALS_ASSERT(data.n_tiles() == data_.size());
+      DIALS_ASSERT(data.n_tiles() == data_ref_.size());
       if (mask) {
         copy(data, index);
       } else {
-        for (std::size_t i = 0; i < data.n_tiles(); ++i) {
-          apply_mask_to_all_pixels(data_[i].ref(), index);
+        LoadGuard guard(shared_.get(), index);
+        if (guard.required()) {
+          for (std::size_t i = 0; i < data.n_tiles(); ++i) {
+            apply_mask_to_all_pixels(data_ref_[i], index);
+          }
+          guard.release();
         }
       }
     }
@@ -147,11 +247,37 @@ namespace dials { namespace algorithms {
      */
     void copy(const Image<double> &data, const Image<bool> &mask, std::size_t index) {
       DIALS_ASSERT(data.n_tiles() == mask.n_tiles());
-      DIALS_ASSERT(data.n_tiles() == data_.size());
-      for (std::size_t i = 0; i < data.n_tiles(); ++i) {
-        copy(data.tile(i).data().const_ref(), data_[i].ref(), index);
-        apply_mask(mask.tile(i).data().const_ref(), data_[i].ref(), index);
-        apply_mask(static_mask_[i].const_ref(), data_[i].ref(), index);
+      DIALS_ASSERT(data.n_tiles() == data_ref_.size());
+      LoadGuard guard(shared_.get(), index);
+      if (guard.required()) {
+        for (std::size_t i = 0; i < data.n_tiles(); ++i) {
+          copy(data.tile(i).data().const_ref(), data_ref_[i], index, region_[i]);
+          apply_mask(mask.tile(i).data().const_ref(), data_ref_[i], index, region_[i]);
+          apply_mask(static_runs_[i], data_ref_[i], index, region_[i]);
+        }
+        guard.release();
+      }
+    }
+
+    /**
+     * Copy an image to the buffer
+     * @param data The image data
+     * @param mask The runs of masked pixels of each panel
+     * @param index The image index
+     */
+    void copy(const Image<double> &data,
+              const std::vector<RunLengthMask> &mask,
+              std::size_t index) {
+      DIALS_ASSERT(data.n_tiles() == mask.size());
+      DIALS_ASSERT(data.n_tiles() == data_ref_.size());
+      LoadGuard guard(shared_.get(), index);
+      if (guard.required()) {
+        for (std::size_t i = 0; i < data.n_tiles(); ++i) {
+          copy(data.tile(i).data().const_ref(), data_ref_[i], index, region_[i]);
+          apply_mask(mask[i], data_ref_[i], index, region_[i]);
+          apply_mask(static_runs_[i], data_ref_[i], index, region_[i]);
+        }
+        guard.release();
       }
     }
 
@@ -160,8 +286,8 @@ namespace dials { namespace algorithms {
      * @returns The buffer for the panel
      */
     af::const_ref<float_type, af::c_grid<3> > data(std::size_t panel) const {
-      DIALS_ASSERT(panel < data_.size());
-      return data_[panel].const_ref();
+      DIALS_ASSERT(panel < data_ref_.size());
+      return data_ref_[panel];
     }
 
     /**
@@ -173,24 +299,188 @@ namespace dials { namespace algorithms {
       return static_mask_[panel].const_ref();
     }
 
+    /**
+     * @param The panel number
+     * @returns The (x0, x1, y0, y1) region of the panel held in the buffer
+     */
+    int4 region(std::size_t panel) const {
+      DIALS_ASSERT(panel < region_.size());
+      return region_[panel];
+    }
+
+    /**
+     * @returns The number of bytes of the image data and the static mask
+     */
+    std::size_t nbytes() const {
+      std::size_t result = 0;
+      for (std::size_t i = 0; i < data_ref_.size(); ++i) {
+        result += data_ref_[i].size() * sizeof(float_type);
+      }
+      for (std::size_t i = 0; i < static_mask_.size(); ++i) {
+        result += static_mask_[i].size() * sizeof(bool);
+        result += static_runs_[i].nbytes();
+      }
+      return result;
+    }
+
+    /**
+     * Zero one horizontal stripe of rows of every image and panel. The kernel
+     * places a page on the NUMA node of the thread which first writes to it,
+     * so calling this from each worker thread for an uninitialised buffer puts
+     * each stripe on the node of the thread which mostly reads it.
+     * @param part The stripe number
+     * @param num_parts The number of stripes
+     */
+    void first_touch(std::size_t part, std::size_t num_parts) {
+      DIALS_ASSERT(part < num_parts);
+      for (std::size_t i = 0; i < data_ref_.size(); ++i) {
+        af::ref<float_type, af::c_grid<3> > data = data_ref_[i];
+        std::size_t ysize = data.accessor()[1];
+        std::size_t xsize = data.accessor()[2];
+        std::size_t y0 = (ysize * part) / num_parts;
+        std::size_t y1 = (ysize * (part + 1)) / num_parts;
+        if (ysize * xsize == 0) {
+          continue;
+        }
+        for (std::size_t k = 0; k < data.accessor()[0]; ++k) {
+          float_type *first = &data[(k * ysize + y0) * xsize];
+          std::fill(first, first + (y1 - y0) * xsize, float_type(0));
+        }
+      }
+    }
+
   protected:
     /**
-     * Copy the data from 1 panel
+     * A helper to acquire an image in a shared buffer for loading. If the
+     * image is not released, e.g. because an exception was thrown, then it is
+     * abandoned so that another process can load it.
+     */
+    class LoadGuard {
+    public:
+      LoadGuard(shared_buffer_type *shared, std::size_t index)
+          : shared_(shared),
+            index_(index),
+            required_(shared == NULL || shared->acquire(index)),
+            released_(false) {}
+
+      ~LoadGuard() {
+        if (shared_ != NULL && required_ && !released_) {
+          shared_->abandon(index_);
+        }
+      }
+
+      bool required() const {
+        return required_;
+      }
+
+      void release() {
+        if (shared_ != NULL && required_) {
+          shared_->release(index_);
+        }
+        released_ = true;
+      }
+
+    private:
+      shared_buffer_type *shared_;
+      std::size_t index_;
+      bool required_;
+      bool released_;
+    };
+
+    /**
+     * Allocate the data buffers for the panel regions
+     * @param detector The detector model
+     * @param num_images The number of images
+     * @param region The (x0, x1, y0, y1) region of each panel
+     * @param initialise Zero the memory
+     */
+    void init_data(const Detector &detector,
+                   std::size_t num_images,
+                   const std::vector<int4> &region,
+                   bool initialise = true) {
+      std::size_t zsize = num_images;
+      DIALS_ASSERT(zsize > 0);
+      DIALS_ASSERT(region.size() == detector.size());
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        int image_xsize = detector[i].get_image_size()[0];
+        int image_ysize = detector[i].get_image_size()[1];
+        DIALS_ASSERT(image_xsize > 0);
+        DIALS_ASSERT(image_ysize > 0);
+        DIALS_ASSERT(region[i][0] >= 0 && region[i][1] <= image_xsize);
+        DIALS_ASSERT(region[i][2] >= 0 && region[i][3] <= image_ysize);
+        DIALS_ASSERT(region[i][1] >= region[i][0]);
+        DIALS_ASSERT(region[i][3] >= region[i][2]);
+
+        // Allocate all the data buffers
+        std::size_t ysize = region[i][3] - region[i][2];
+        std::size_t xsize = region[i][1] - region[i][0];
+        af::c_grid<3> accessor(zsize, ysize, xsize);
+        if (initialise) {
+          data_.push_back(af::versa<float_type, af::c_grid<3> >(accessor));
+        } else {
+          data_.push_back(af::versa<float_type, af::c_grid<3> >(
+            accessor, af::init_functor_null<float_type>()));
+        }
+        data_ref_.push_back(data_.back().ref());
+        region_.push_back(region[i]);
+      }
+    }
+
+    /**
+     * Initialise the static mask from the external mask
+     * @param detector The detector model
+     * @param external_mask The external mask
+     */
+    void init_static_mask(const Detector &detector, const Image<bool> &external_mask) {
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        std::size_t xsize = detector[i].get_image_size()[0];
+        std::size_t ysize = detector[i].get_image_size()[1];
+
+        // Allocate the static mask buffer
+        static_mask_.push_back(
+          af::versa<bool, af::c_grid<2> >(af::c_grid<2>(ysize, xsize), true));
+      }
+
+      // Set the external mask
+      if (!external_mask.empty()) {
+        DIALS_ASSERT(external_mask.n_tiles() == static_mask_.size());
+        for (std::size_t i = 0; i < external_mask.n_tiles(); ++i) {
+          set_external_mask_for_panel(external_mask.tile(i).data().const_ref(),
+                                      static_mask_[i].ref());
+        }
+      }
+
+      // Encode the static mask as runs to apply to each image
+      for (std::size_t i = 0; i < static_mask_.size(); ++i) {
+        static_runs_.push_back(RunLengthMask(static_mask_[i].const_ref()));
+      }
+    }
+
+    /**
+     * Copy the data from the region of 1 panel
      * @param src The source
      * @param dst The destination
      * @param index The image index
+     * @param region The region of the panel
      */
     template <typename InputType, typename OutputType>
     void copy(af::const_ref<InputType, af::c_grid<2> > src,
               af::ref<OutputType, af::c_grid<3> > dst,
-              std::size_t index) {
-      std::size_t ysize = src.accessor()[0];
-      std::size_t xsize = src.accessor()[1];
+              std::size_t index,
+              const int4 &region) {
+      std::size_t ysize = dst.accessor()[1];
+      std::size_t xsize = dst.accessor()[2];
       DIALS_ASSERT(index < dst.accessor()[0]);
-      DIALS_ASSERT(src.accessor()[0] == dst.accessor()[1]);
-      DIALS_ASSERT(src.accessor()[1] == dst.accessor()[2]);
-      for (std::size_t j = 0; j < ysize * xsize; ++j) {
-        dst[index * (xsize * ysize) + j] = src[j];
+      DIALS_ASSERT(region[3] <= (int)src.accessor()[0]);
+      DIALS_ASSERT(region[1] <= (int)src.accessor()[1]);
+      DIALS_ASSERT(region[3] - region[2] == (int)ysize);
+      DIALS_ASSERT(region[1] - region[0] == (int)xsize);
+      for (std::size_t j = 0; j < ysize; ++j) {
+        const InputType *src_row = &src(region[2] + j, region[0]);
+        OutputType *dst_row = &dst[(index * ysize + j) * xsize];
+        for (std::size_t i = 0; i < xsize; ++i) {
+          dst_row[i] = src_row[i];
+        }
       }
     }
 
@@ -211,27 +501,62 @@ namespace dials { namespace algorithms {
     }
 
     /**
-     * Apply the static mask to the dynamic mask
+     * Apply the mask to the region of 1 panel
      * @param src The source
      * @param dst The destination
      * @param index The image index
+     * @param region The region of the panel
      */
     template <typename OutputType>
     void apply_mask(af::const_ref<bool, af::c_grid<2> > src,
                     af::ref<OutputType, af::c_grid<3> > dst,
-                    std::size_t index) {
-      std::size_t ysize = src.accessor()[0];
-      std::size_t xsize = src.accessor()[1];
+                    std::size_t index,
+                    const int4 &region) {
+      std::size_t ysize = dst.accessor()[1];
+      std::size_t xsize = dst.accessor()[2];
       DIALS_ASSERT(index < dst.accessor()[0]);
-      DIALS_ASSERT(src.accessor()[0] == dst.accessor()[1]);
-      DIALS_ASSERT(src.accessor()[1] == dst.accessor()[2]);
-      for (std::size_t j = 0; j < ysize * xsize; ++j) {
-        if (!src[j]) {
-          dst[index * (xsize * ysize) + j] = mask_value_;
+      DIALS_ASSERT(region[3] <= (int)src.accessor()[0]);
+      DIALS_ASSERT(region[1] <= (int)src.accessor()[1]);
+      DIALS_ASSERT(region[3] - region[2] == (int)ysize);
+      DIALS_ASSERT(region[1] - region[0] == (int)xsize);
+      for (std::size_t j = 0; j < ysize; ++j) {
+        const bool *src_row = &src(region[2] + j, region[0]);
+        OutputType *dst_row = &dst[(index * ysize + j) * xsize];
+        for (std::size_t i = 0; i < xsize; ++i) {
+          if (!src_row[i]) {
+            dst_row[i] = mask_value_;
+          }
         }
       }
     }
 
+    /**
+     * Apply runs of masked pixels to the region of 1 panel
+     * @param src The runs of masked pixels of the panel
+     * @param dst The destination
+     * @param index The image index
+     * @param region The region of the panel
+     */
+    template <typename OutputType>
+    void apply_mask(const RunLengthMask &src,
+                    af::ref<OutputType, af::c_grid<3> > dst,
+                    std::size_t index,
+                    const int4 &region) {
+      std::size_t ysize = dst.accessor()[1];
+      std::size_t xsize = dst.accessor()[2];
+      DIALS_ASSERT(index < dst.accessor()[0]);
+      DIALS_ASSERT(region[3] <= (int)src.ysize());
+      DIALS_ASSERT(region[1] <= (int)src.xsize());
+      DIALS_ASSERT(region[3] - region[2] == (int)ysize);
+      DIALS_ASSERT(region[1] - region[0] == (int)xsize);
+      if (ysize * xsize == 0) {
+        return;
+      }
+      af::ref<OutputType, af::c_grid<2> > dst_image(
+        &dst[index * ysize * xsize], af::c_grid<2>(ysize, xsize));
+      src.apply(dst_image, region[0], region[2], (OutputType)mask_value_);
+    }
+
     /**
      * Set the static mask for a panel
      * @param panel The panel
@@ -247,7 +572,11 @@ namespace dials { namespace algorithms {
     }
 
     std::vector<af::versa<float_type, af::c_grid<3> > > data_;
+    std::vector<af::ref<float_type, af::c_grid<3> > > data_ref_;
+    std::vector<int4> region_;
     std::vector<af::versa<bool, af::c_grid<2> > > static_mask_;
+    std::vector<RunLengthMask> static_runs_;
+    boost::shared_ptr<shared_buffer_type> shared_;
     float_type mask_value_;
   };
 
@@ -273,11 +602,130 @@ namespace dials { namespace algorithms {
         : buffer_base_(detector, num_buffer, mask_value, external_mask),
           num_images_(num_images),
           num_buffer_(num_buffer),
-          buffer_range_(0, num_buffer) {
+          buffer_range_(0, num_buffer),
+          overload_(0) {
       DIALS_ASSERT(num_buffer > 0);
       DIALS_ASSERT(num_images >= num_buffer);
     }
 
+    /**
+     * Initialise the buffer to hold a region of each panel
+     * @param detector The detector model
+     * @param num_images The number of images
+     * @param mask_value The value of masked pixels in the buffer
+     * @param external_mask The external mask
+     * @param region The (x0, x1, y0, y1) region of each panel
+     * @param initialise If false then leave the memory untouched (see first_touch)
+     */
+    Buffer(const Detector &detector,
+           std::size_t num_images,
+           std::size_t num_buffer,
+           float_type mask_value,
+           const Image<bool> &external_mask,
+           const std::vector<int4> &region,
+           bool initialise = true)
+        : buffer_base_(detector,
+                       num_buffer,
+                       mask_value,
+                       external_mask,
+                       region,
+                       initialise),
+          num_images_(num_images),
+          num_buffer_(num_buffer),
+          buffer_range_(0, num_buffer),
+          overload_(0) {
+      DIALS_ASSERT(num_buffer > 0);
+      DIALS_ASSERT(num_images >= num_buffer);
+    }
+
+    /**
+     * Initialise the buffer in a named shared memory segment. Images are never
+     * removed from a shared buffer, so the buffer holds all the images.
+     * @param detector The detector model
+     * @param num_images The number of images
+     * @param mask_value The value of masked pixels in the buffer
+     * @param external_mask The external mask
+     * @param shared_name The name of the shared memory segment
+     * @param first_image The first image number
+     */
+    Buffer(const Detector &detector,
+           std::size_t num_images,
+           float_type mask_value,
+           const Image<bool> &external_mask,
+           const std::string &shared_name,
+           int first_image)
+        : buffer_base_(detector,
+                       num_images,
+                       mask_value,
+                       external_mask,
+                       shared_name,
+                       first_image),
+          num_images_(num_images),
+          num_buffer_(num_images),
+          buffer_range_(0, num_images),
+          overload_(0) {
+      DIALS_ASSERT(num_images > 0);
+    }
+
+    /**
+     * Keep a bitmap of the overloaded pixels of each buffered image, filled as
+     * the images are copied, so that a reflection can be checked for overloads
+     * without looking at its pixels. This must be called before any images are
+     * copied and is not available for a shared buffer, whose images may be
+     * copied by another process.
+     * @param overload The overload value
+     */
+    void enable_overload_map(double overload) {
+      DIALS_ASSERT(!buffer_base_.is_shared());
+      overload_ = overload;
+      overload_map_.resize(num_buffer_ * buffer_base_.num_panels());
+    }
+
+    /**
+     * @returns True/False the buffer keeps a bitmap of the overloaded pixels
+     */
+    bool has_overload_map() const {
+      return !overload_map_.empty();
+    }
+
+    /**
+     * @returns The number of bytes of the buffered images and overload maps
+     */
+    std::size_t nbytes() const {
+      std::size_t result = buffer_base_.nbytes();
+      for (std::size_t i = 0; i < overload_map_.size(); ++i) {
+        result += overload_map_[i].nbytes();
+      }
+      return result;
+    }
+
+    /**
+     * Check the bitmaps for any overloaded pixel in a bounding box
+     * @param panel The panel number
+     * @param bbox The bounding box
+     * @param zstart The first image number
+     * @returns True/False the bounding box contains an overloaded pixel
+     */
+    bool is_overloaded(std::size_t panel, const int6 &bbox, int zstart) const {
+      DIALS_ASSERT(has_overload_map());
+      DIALS_ASSERT(panel < buffer_base_.num_panels());
+      int4 r = region(panel);
+      for (int z = bbox[4]; z < bbox[5]; ++z) {
+        int k = z - zstart;
+        if (k < 0 || k >= (int)num_images_) {
+          continue;
+        }
+        DIALS_ASSERT(k >= buffer_range_[0] && k < buffer_range_[1]);
+        const OverloadBitmap &bitmap =
+          overload_map_[(k % num_buffer_) * buffer_base_.num_panels() + panel];
+        if (bitmap.count(bbox[0] - r[0], bbox[1] - r[0], bbox[2] - r[2], bbox[3] - r[2])
+            > 0) {
+          return true;
+        }
+      }
+      return false;
+    }
+
     /**
      * @returns The number of images
      */
@@ -299,6 +747,32 @@ namespace dials { namespace algorithms {
       return buffer_range_;
     }
 
+    /**
+     * @param index The image index
+     * @returns True/False the image is in a shared buffer loaded by any process
+     */
+    bool is_loaded(std::size_t index) const {
+      DIALS_ASSERT(index < num_images_);
+      return buffer_base_.is_loaded(index);
+    }
+
+    /**
+     * @param panel The panel number
+     * @returns The (x0, x1, y0, y1) region of the panel held in the buffer
+     */
+    int4 region(std::size_t panel) const {
+      return buffer_base_.region(panel);
+    }
+
+    /**
+     * Zero one horizontal stripe of the buffer
+     * @param part The stripe number
+     * @param num_parts The number of stripes
+     */
+    void first_touch(std::size_t part, std::size_t num_parts) {
+      buffer_base_.first_touch(part, num_parts);
+    }
+
     /**
      * Copy an image to the buffer
      * @param data The image data
@@ -317,6 +791,7 @@ namespace dials { namespace algorithms {
         buffer_range_[1]++;
       }
       buffer_base_.copy(data, index % num_buffer_);
+      update_overload_map(index);
     }
 
     /**
@@ -338,6 +813,7 @@ namespace dials { namespace algorithms {
         buffer_range_[1]++;
       }
       buffer_base_.copy(data, mask, index % num_buffer_);
+      update_overload_map(index);
     }
 
     /**
@@ -359,6 +835,31 @@ namespace dials { namespace algorithms {
         buffer_range_[1]++;
       }
       buffer_base_.copy(data, mask, index % num_buffer_);
+      update_overload_map(index);
+    }
+
+    /**
+     * Copy an image to the buffer
+     * @param data The image data
+     * @param mask The runs of masked pixels of each panel
+     * @param index The image index
+     */
+    void copy(const Image<double> &data,
+              const std::vector<RunLengthMask> &mask,
+              std::size_t index) {
+      DIALS_ASSERT(index < num_images_);
+      DIALS_ASSERT(index >= buffer_range_[0]);
+      DIALS_ASSERT(index <= buffer_range_[1]);
+      DIALS_ASSERT(buffer_range_[0] >= 0);
+      DIALS_ASSERT(buffer_range_[1] <= num_images_);
+      DIALS_ASSERT(buffer_range_[1] > buffer_range_[0]);
+      DIALS_ASSERT(buffer_range_[1] - buffer_range_[0] == num_buffer_);
+      if (index == buffer_range_[1]) {
+        buffer_range_[0]++;
+        buffer_range_[1]++;
+      }
+      buffer_base_.copy(data, mask, index % num_buffer_);
+      update_overload_map(index);
     }
 
     /**
@@ -378,8 +879,8 @@ namespace dials { namespace algorithms {
       std::size_t ysize = data_buffer.accessor()[1];
       std::size_t xsize = data_buffer.accessor()[2];
       std::size_t offset = (index % num_buffer_) * (ysize * xsize);
-      DIALS_ASSERT(offset < data_buffer.size());
-      return af::const_ref<float_type, af::c_grid<2> >(&data_buffer[offset],
+      DIALS_ASSERT(offset < data_buffer.size() || ysize * xsize == 0);
+      return af::const_ref<float_type, af::c_grid<2> >(data_buffer.begin() + offset,
                                                        af::c_grid<2>(ysize, xsize));
     }
 
@@ -392,10 +893,89 @@ namespace dials { namespace algorithms {
     }
 
   protected:
+    /**
+     * Fill the overload bitmaps of an image which has just been copied
+     * @param index The image index
+     */
+    void update_overload_map(std::size_t index) {
+      std::size_t num_panels = buffer_base_.num_panels();
+      for (std::size_t i = 0; i < overload_map_.size() / num_buffer_; ++i) {
+        overload_map_[(index % num_buffer_) * num_panels + i].set(data(i, index),
+                                                                  overload_);
+      }
+    }
+
     BufferBase buffer_base_;
     std::size_t num_images_;
     std::size_t num_buffer_;
     tiny<int, 2> buffer_range_;
+    double overload_;
+    std::vector<OverloadBitmap> overload_map_;
+  };
+
+  /**
+   * Handles to the columns which the mask and intensity calculators read from
+   * the adjacent reflections; the integrator sets the bounding box and
+   * shoebox. The columns are looked up once for all the adjacent reflections
+   * of a reflection, and each adjacent reflection is given only these columns
+   * rather than the whole row. The handles must be made and used while the
+   * caller has the lock on the reflection columns.
+   */
+  class AdjacentReflectionColumns {
+  public:
+    typedef scitbx::vec3<double> vec3_double;
+
+    /**
+     * @param columns The reflection columns
+     */
+    AdjacentReflectionColumns(const af::ReflectionColumns &columns) {
+      init_column(columns, "id", id_);
+      init_column(columns, "panel", panel_);
+      init_column(columns, "s1", s1_);
+      init_column(columns, "xyzcal.mm", xyzcal_mm_);
+      init_column(columns, "xyzcal.px", xyzcal_px_);
+    }
+
+    /**
+     * @param index The index of the adjacent reflection
+     * @returns The adjacent reflection
+     */
+    af::Reflection get(std::size_t index) const {
+      af::Reflection result;
+      set_item(result, "id", id_, index);
+      set_item(result, "panel", panel_, index);
+      set_item(result, "s1", s1_, index);
+      set_item(result, "xyzcal.mm", xyzcal_mm_, index);
+      set_item(result, "xyzcal.px", xyzcal_px_, index);
+      return result;
+    }
+
+  private:
+    template <typename T>
+    static void init_column(const af::ReflectionColumns &columns,
+                            const char *key,
+                            af::flex_table_column<T> &column) {
+      if (columns.contains(key)) {
+        column = columns.column<T>(key);
+      }
+    }
+
+    template <typename T>
+    static void set_item(af::Reflection &reflection,
+                         const char *key,
+                         const af::flex_table_column<T> &column,
+                         std::size_t index) {
+      if (column.is_valid()) {
+        DIALS_ASSERT(index < column.size());
+        reflection[key] = column.const_ref()[index];
+      }
+    }
+
+    af::flex_table_column<int> id_;
+    af::flex_table_column<std::size_t> panel_;
+    af::flex_table_column<vec3_double> s1_;
+    af::flex_table_column<vec3_double> xyzcal_mm_;
+    af::flex_table_column<vec3_double> xyzcal_px_;
   };
 
   /**
@@ -412,6 +992,9 @@ namespace dials { namespace algorithms {
      * @param zstart The first image index
      * @param underload The underload value
      * @param overload The overload value
+     * @param debug Keep the shoeboxes
+     * @param count_numa Count the shoeboxes read from memory on another node
+     * @param profile The timings of the stages, or NULL not to time them
      */
     ReflectionIntegrator(const MaskCalculatorIface &compute_mask,
                          const BackgroundCalculatorIface &compute_background,
@@ -420,7 +1003,9 @@ namespace dials { namespace algorithms {
                          int zstart,
                          double underload,
                          double overload,
-                         bool debug)
+                         bool debug,
+                         bool count_numa = false,
+                         IntegrationProfile *profile = NULL)
         : compute_mask_(compute_mask),
           compute_background_(compute_background),
           compute_intensity_(compute_intensity),
@@ -428,12 +1013,30 @@ namespace dials { namespace algorithms {
           zstart_(zstart),
           underload_(underload),
           overload_(overload),
-          debug_(debug) {}
+          debug_(debug),
+          count_numa_(count_numa),
+          profile_(profile),
+          num_local_(0),
+          num_remote_(0) {}
+
+    /**
+     * @returns The number of shoeboxes read from memory on the same node
+     */
+    std::size_t num_local() const {
+      return num_local_;
+    }
+
+    /**
+     * @returns The number of shoeboxes read from memory on another node
+     */
+    std::size_t num_remote() const {
+      return num_remote_;
+    }
 
     /**
      * Integrate a reflection using the following procedure:
      *
-     * 1. Extract the buffered image data into a shoebox
+     * 1. Extract the buffered image data into a shoebox from the thread arena
      * 2. Compute the mask for the reflection
      * 3. Compute the mask for adjacent reflections
      * 4. Compute the reflection background
@@ -447,17 +1050,24 @@ namespace dials { namespace algorithms {
      */
 
     void operator()(std::size_t index,
-                    af::ref<af::Reflection> reflection_list,
-                    const AdjacencyList &adjacency_list) const {
+                    af::ReflectionColumns &reflection_list,
+                    const OverlapIndex &overlaps) const {
+      IntegrationProfile::Timer timer(profile_);
       af::Reflection reflection;
       std::vector<af::Reflection> adjacent_reflections;
 
       // Get the reflection data
       get_reflection(
-        index, reflection_list, adjacency_list, reflection, adjacent_reflections);
+        index, reflection_list, overlaps, reflection, adjacent_reflections);
+      timer.stage(IntegrationProfile::GetReflection);
 
       // Extract the shoebox data
       extract_shoebox(buffer_, reflection, zstart_, underload_, overload_);
+      if (count_numa_) {
+        count_numa_access(reflection);
+      }
+      timer.shoebox_memory(ShoeboxArena::local().nbytes());
+      timer.stage(IntegrationProfile::Extract);
 
       // Compute the mask
       compute_mask_(reflection);
@@ -469,20 +1079,27 @@ namespace dials { namespace algorithms {
         adjacent_reflections[i]["shoebox"] = reflection.get<Shoebox<> >("shoebox");
         compute_mask_(adjacent_reflections[i], true);
       }
+      timer.stage(IntegrationProfile::Mask);
 
       // Compute the background
       try {
         compute_background_(reflection);
       } catch (dials::error) {
+        timer.stage(IntegrationProfile::Background);
+        timer.background_failed();
         finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
+        timer.stage(IntegrationProfile::Finalize);
         return;
       }
+      timer.stage(IntegrationProfile::Background);
 
       // Compute the centroid
       compute_centroid(reflection);
+      timer.stage(IntegrationProfile::Centroid);
 
       // Compute the summed intensity
       compute_summed_intensity(reflection);
+      timer.stage(IntegrationProfile::Summation);
 
       // Compute the profile fitted intensity
       try {
@@ -491,13 +1108,17 @@ namespace dials { namespace algorithms {
         std::size_t flags = reflection.get<std::size_t>("flags");
         flags |= af::FailedDuringProfileFitting;
         reflection["flags"] = flags;
+        timer.profile_fitting_failed();
       }
+      timer.stage(IntegrationProfile::ProfileFitting);
 
       // Erase the shoebox
       finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
+      timer.stage(IntegrationProfile::Finalize);
 
       // Set the reflection data
       set_reflection(index, reflection_list, reflection);
+      timer.stage(IntegrationProfile::SetReflection);
     }
 
   protected:
@@ -505,30 +1126,36 @@ namespace dials { namespace algorithms {
      * Get the reflection data in a thread safe manner
      * @param index The reflection index
      * @param reflection_list The reflection list
-     * @param adjacency_list The adjacency list
+     * @param overlaps The index of overlapping reflections
      * @param reflection The reflection data
      * @param adjacent_reflections The adjacent reflections
      */
     void get_reflection(std::size_t index,
-                        const af::const_ref<af::Reflection> &reflection_list,
-                        const AdjacencyList &adjacency_list,
+                        const af::ReflectionColumns &reflection_list,
+                        const OverlapIndex &overlaps,
                         af::Reflection &reflection,
                         std::vector<af::Reflection> &adjacent_reflections) const {
       DIALS_ASSERT(index < reflection_list.size());
 
+      // Find the adjacent reflections. The index is immutable so this does
+      // not need the lock.
+      std::vector<std::size_t> adjacent;
+      overlaps.find(index, adjacent);
+
       // Get the lock
       boost::lock_guard<boost::mutex> guard(mutex_);
 
       // Get the reflection
-      reflection = reflection_list[index];
+      reflection = reflection_list.get(index);
 
       // Get the adjacent reflections
-      adjacent_reflections.reserve(adjacency_list.vertex_num_edges(index));
-      AdjacencyList::edge_iterator_range edges = adjacency_list.edges(index);
-      for (AdjacencyList::edge_iterator it = edges.first; it != edges.second; ++it) {
-        DIALS_ASSERT(it->first == index);
-        DIALS_ASSERT(it->second < reflection_list.size());
-        adjacent_reflections.push_back(reflection_list[it->second]);
+      if (!adjacent.empty()) {
+        AdjacentReflectionColumns adjacent_columns(reflection_list);
+        adjacent_reflections.reserve(adjacent.size());
+        for (std::size_t i = 0; i < adjacent.size(); ++i) {
+          DIALS_ASSERT(adjacent[i] < reflection_list.size());
+          adjacent_reflections.push_back(adjacent_columns.get(adjacent[i]));
+        }
       }
     }
 
@@ -539,11 +1166,11 @@ namespace dials { namespace algorithms {
      * @param reflection The reflection data
      */
     void set_reflection(std::size_t index,
-                        af::ref<af::Reflection> reflection_list,
+                        af::ReflectionColumns &reflection_list,
                         const af::Reflection &reflection) const {
       DIALS_ASSERT(index < reflection_list.size());
       boost::lock_guard<boost::mutex> guard(mutex_);
-      reflection_list[index] = reflection;
+      reflection_list.set(index, reflection);
     }
 
     /**
@@ -580,6 +1207,13 @@ namespace dials { namespace algorithms {
       af::const_ref<int, af::c_grid<3> > mask = sbox.mask.const_ref();
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
 
+      // Use the overload bitmaps of the buffer if it has them, otherwise
+      // check each pixel
+      bool check_overload = !buffer_.has_overload_map();
+      if (!check_overload && buffer_.is_overloaded(sbox.panel, sbox.bbox, zstart_)) {
+        flags |= af::Overloaded;
+      }
+
       // Check pixel values
       std::size_t n_valid = 0;
       std::size_t n_background = 0;
@@ -593,7 +1227,7 @@ namespace dials { namespace algorithms {
         double d = data[i];
         int m = mask[i];
 
-        if (d >= overload) {
+        if (check_overload && d >= overload) {
           flags |= af::Overloaded;
         }
 
@@ -654,6 +1288,35 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Check whether the first buffer row of the shoebox is on the same NUMA
+     * node as the calling thread
+     */
+    void count_numa_access(const af::Reflection &reflection) const {
+      std::size_t panel = reflection.get<std::size_t>("panel");
+      int6 bbox = reflection.get<int6>("bbox");
+      int4 region = buffer_.region(panel);
+      int kk = bbox[4] - zstart_;
+      int jj = std::max(bbox[2], region[2]) - region[2];
+      int ii = std::max(bbox[0], region[0]) - region[0];
+      if (kk < 0 || kk >= buffer_.num_images()) {
+        return;
+      }
+      af::const_ref<Buffer::float_type, af::c_grid<2> > data = buffer_.data(panel, kk);
+      if (jj >= data.accessor()[0] || ii >= data.accessor()[1]) {
+        return;
+      }
+      int page = util::numa::page_node(&data(jj, ii));
+      int node = util::numa::current_node();
+      if (page >= 0 && node >= 0) {
+        if (page == node) {
+          num_local_++;
+        } else {
+          num_remote_++;
+        }
+      }
+    }
+
     /**
      * Extract the shoebox data from the buffer
      */
@@ -666,7 +1329,7 @@ namespace dials { namespace algorithms {
       std::size_t panel = reflection.get<std::size_t>("panel");
       int6 bbox = reflection.get<int6>("bbox");
       Shoebox<> shoebox(panel, bbox);
-      shoebox.allocate();
+      ShoeboxArena::local().allocate(shoebox);
       af::ref<float, af::c_grid<3> > data = shoebox.data.ref();
       af::ref<int, af::c_grid<3> > mask = shoebox.mask.ref();
       int x0 = bbox[0];
@@ -685,6 +1348,7 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(ysize == data.accessor()[1]);
       DIALS_ASSERT(xsize == data.accessor()[2]);
       DIALS_ASSERT(shoebox.is_consistent());
+      int4 region = buffer.region(panel);
       for (std::size_t k = 0; k < zsize; ++k) {
         int kk = z0 + k - zstart;
         if (kk < 0 || kk >= buffer.num_images()) {
@@ -693,8 +1357,8 @@ namespace dials { namespace algorithms {
         data_buffer_type data_buffer = buffer.data(panel, kk);
         for (std::size_t j = 0; j < ysize; ++j) {
           for (std::size_t i = 0; i < xsize; ++i) {
-            int jj = y0 + j;
-            int ii = x0 + i;
+            int jj = y0 + j - region[2];
+            int ii = x0 + i - region[0];
             if (jj >= 0 && ii >= 0 && jj < data_buffer.accessor()[0]
                 && ii < data_buffer.accessor()[1]) {
               double d = data_buffer(jj, ii);
@@ -764,6 +1428,10 @@ namespace dials { namespace algorithms {
     double underload_;
     double overload_;
     bool debug_;
+    bool count_numa_;
+    IntegrationProfile *profile_;
+    mutable boost::atomic<std::size_t> num_local_;
+    mutable boost::atomic<std::size_t> num_remote_;
     mutable boost::mutex mutex_;
   };
 
@@ -853,7 +1521,9 @@ namespace dials { namespace algorithms {
         : buffer_(buffer),
           notifier_(bbox, flags, first_image, buffer.num_images(), buffer.num_buffer()),
           first_image_(first_image),
-          max_images_(buffer.num_buffer()) {}
+          max_images_(buffer.num_buffer()),
+          wait_time_(0),
+          num_waits_(0) {}
 
     /**
      * Copy the image to the buffer when we are able to accept more images
@@ -861,10 +1531,7 @@ namespace dials { namespace algorithms {
      * @param index The image index
      */
     void copy_when_ready(const Image<double> &data, std::size_t index) {
-      if (index >= max_images_) {
-        while (!notifier_.complete(buffer_.buffer_range()[0]))
-          ;
-      }
+      wait_for_space(index);
       buffer_.copy(data, index);
     }
 
@@ -875,10 +1542,7 @@ namespace dials { namespace algorithms {
      * @param index The image index
      */
     void copy_when_ready(const Image<double> &data, bool mask, std::size_t index) {
-      if (index >= max_images_) {
-        while (!notifier_.complete(buffer_.buffer_range()[0]))
-          ;
-      }
+      wait_for_space(index);
       buffer_.copy(data, mask, index);
     }
 
@@ -891,13 +1555,37 @@ namespace dials { namespace algorithms {
     void copy_when_ready(const Image<double> &data,
                          const Image<bool> &mask,
                          std::size_t index) {
-      if (index >= max_images_) {
-        while (!notifier_.complete(buffer_.buffer_range()[0]))
-          ;
-      }
+      wait_for_space(index);
+      buffer_.copy(data, mask, index);
+    }
+
+    /**
+     * Copy the image to the buffer when we are able to accept more images
+     * @param data The image data
+     * @param mask The runs of masked pixels of each panel
+     * @param index The image index
+     */
+    void copy_when_ready(const Image<double> &data,
+                         const std::vector<RunLengthMask> &mask,
+                         std::size_t index) {
+      wait_for_space(index);
       buffer_.copy(data, mask, index);
     }
 
+    /**
+     * @returns The total time (seconds) spent waiting for space in the buffer
+     */
+    double wait_time() const {
+      return wait_time_;
+    }
+
+    /**
+     * @returns The number of times the buffer was full when an image came
+     */
+    std::size_t num_waits() const {
+      return num_waits_;
+    }
+
     /**
      * Post the job to the pool
      * @param pool The thread pool
@@ -911,6 +1599,42 @@ namespace dials { namespace algorithms {
         JobWrapper<Function>(function, notifier_, bbox_first_image - first_image_));
     }
 
+    /**
+     * Post a batch of jobs to the pool. If the group size is greater than 1
+     * then consecutive functions are grouped together and each group is run
+     * as a single job by one thread.
+     * @param pool The thread pool
+     * @param functions The functions to post
+     * @param bbox_first_image The image index of each function
+     * @param group_size The number of functions in each job
+     */
+    template <typename ThreadPoolType, typename Function>
+    void post_batch(ThreadPoolType &pool,
+                    const std::vector<Function> &functions,
+                    const std::vector<int> &bbox_first_image,
+                    std::size_t group_size = 1) {
+      DIALS_ASSERT(functions.size() == bbox_first_image.size());
+      std::vector<JobWrapper<Function> > jobs;
+      jobs.reserve(functions.size());
+      for (std::size_t i = 0; i < functions.size(); ++i) {
+        DIALS_ASSERT(bbox_first_image[i] >= first_image_);
+        jobs.push_back(JobWrapper<Function>(
+          functions[i], notifier_, bbox_first_image[i] - first_image_));
+      }
+      if (group_size <= 1) {
+        pool.post_batch(jobs.begin(), jobs.end());
+      } else {
+        std::vector<JobGroup<Function> > groups;
+        groups.reserve(jobs.size() / group_size + 1);
+        for (std::size_t i = 0; i < jobs.size(); i += group_size) {
+          std::size_t n = std::min(group_size, jobs.size() - i);
+          groups.push_back(
+            JobGroup<Function>(jobs.begin() + i, jobs.begin() + i + n));
+        }
+        pool.post_batch(groups.begin(), groups.end());
+      }
+    }
+
     /**
      * Wait and check all are complete
      * @param pool The thread pool
@@ -922,11 +1646,32 @@ namespace dials { namespace algorithms {
     }
 
   protected:
+    /**
+     * If the buffer is full then wait until all the reflections needing the
+     * oldest image are finished
+     * @param index The image index
+     */
+    void wait_for_space(std::size_t index) {
+      if (index >= max_images_ && !notifier_.complete(buffer_.buffer_range()[0])) {
+        boost::posix_time::ptime start =
+          boost::posix_time::microsec_clock::universal_time();
+        notifier_.wait(buffer_.buffer_range()[0]);
+        wait_time_ += detail::seconds_since(start);
+        num_waits_++;
+      }
+    }
+
     /**
      * A class to notify the buffer manager when all jobs that need to access an
      * image have completed so that the image can be deleted.
+     *
+     * The counters are held in a single array with each counter padded to a
+     * cache line, so that the worker threads finishing reflections on
+     * neighbouring images do not contend for the same line. A thread waiting
+     * for an image to complete blocks on a condition variable which is only
+     * signalled when a counter reaches zero.
      */
-    class Notifier {
+    class Notifier : public boost::noncopyable {
     public:
       /**
        * Init the counters
@@ -940,15 +1685,12 @@ namespace dials { namespace algorithms {
                int first_image,
                std::size_t num_images,
                std::size_t max_images)
-          : first_image_(first_image) {
+          : first_image_(first_image),
+            num_images_(num_images),
+            counter_(new Counter[num_images]) {
         DIALS_ASSERT(bbox.size() == flags.size());
         DIALS_ASSERT(num_images > 0);
 
-        // Initialise the vector of atomic ints
-        for (std::size_t i = 0; i < num_images; ++i) {
-          counter_.push_back(new boost::atomic<int>(0));
-        }
-
         // Increment the counter for each image
         int last_image = first_image + num_images;
         for (std::size_t j = 0; j < bbox.size(); ++j) {
@@ -960,29 +1702,39 @@ namespace dials { namespace algorithms {
             DIALS_ASSERT(z1 - z0 <= max_images);
             int i = z0 - first_image_;
             DIALS_ASSERT(i >= 0);
-            DIALS_ASSERT(i < counter_.size());
-            counter_[i]++;
+            DIALS_ASSERT(i < num_images_);
+            counter_[i].value.fetch_add(1, boost::memory_order_relaxed);
           }
         }
       }
 
       /**
        * Notify about a reflection using this image is finished.
-       * Reduce the atomic counter for the image
+       * Reduce the atomic counter for the image and wake any waiting thread
+       * if it was the last one.
        * @param image_index The image index
        */
       void notify(std::size_t index) {
-        DIALS_ASSERT(index < counter_.size());
-        counter_[index]--;
+        DIALS_ASSERT(index < num_images_);
+        int count = counter_[index].value.fetch_sub(1, boost::memory_order_acq_rel);
+        DIALS_ASSERT(count > 0);
+        if (count == 1) {
+          // Take the lock so the wake up cannot be missed by a thread which has
+          // checked the counter but not yet started waiting
+          {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+          }
+          condition_.notify_all();
+        }
       }
 
       /**
        * @param image_index The image index
        * @returns The value of the counter
        */
-      int counter(std::size_t index) {
-        DIALS_ASSERT(index < counter_.size());
-        return counter_[index];
+      int counter(std::size_t index) const {
+        DIALS_ASSERT(index < num_images_);
+        return counter_[index].value.load(boost::memory_order_acquire);
       }
 
       /**
@@ -992,8 +1744,18 @@ namespace dials { namespace algorithms {
        * @returns True/False complete
        */
       bool complete(std::size_t index) const {
-        DIALS_ASSERT(index < counter_.size());
-        return counter_[index] == 0;
+        return counter(index) == 0;
+      }
+
+      /**
+       * Wait until all reflections needing this image are finished
+       * @param index The image index
+       */
+      void wait(std::size_t index) {
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        while (!complete(index)) {
+          condition_.wait(lock);
+        }
       }
 
       /**
@@ -1001,8 +1763,8 @@ namespace dials { namespace algorithms {
        * @returns True/False complete
        */
       bool all_complete() const {
-        for (std::size_t i = 0; i < counter_.size(); ++i) {
-          if (counter_[i] != 0) {
+        for (std::size_t i = 0; i < num_images_; ++i) {
+          if (!complete(i)) {
             return false;
           }
         }
@@ -1010,8 +1772,20 @@ namespace dials { namespace algorithms {
       }
 
     protected:
+      /**
+       * An atomic counter padded to fill a cache line
+       */
+      struct Counter {
+        boost::atomic<int> value;
+        char padding[64 - sizeof(boost::atomic<int>)];
+        Counter() : value(0) {}
+      };
+
       int first_image_;
-      boost::ptr_vector<boost::atomic<int> > counter_;
+      std::size_t num_images_;
+      boost::scoped_array<Counter> counter_;
+      boost::mutex mutex_;
+      boost::condition_variable condition_;
     };
 
     /**
@@ -1042,10 +1816,38 @@ namespace dials { namespace algorithms {
       std::size_t index_;
     };
 
+    /**
+     * A wrapper to call a group of jobs in order on a single thread
+     */
+    template <typename Function>
+    class JobGroup {
+    public:
+      /**
+       * Construct
+       * @param first The first job
+       * @param last The end of the jobs
+       */
+      template <typename Iterator>
+      JobGroup(Iterator first, Iterator last) : jobs_(first, last) {}
+
+      /**
+       * Call the jobs
+       */
+      void operator()() {
+        for (std::size_t i = 0; i < jobs_.size(); ++i) {
+          jobs_[i]();
+        }
+      }
+
+      std::vector<JobWrapper<Function> > jobs_;
+    };
+
     Buffer &buffer_;
     Notifier notifier_;
     int first_image_;
     std::size_t max_images_;
+    double wait_time_;
+    std::size_t num_waits_;
   };
 
   /**
@@ -1065,6 +1867,10 @@ namespace dials { namespace algorithms {
      * @param buffer_size The buffer_size
      * @param use_dynamic_mask Use the dynamic mask if present
      * @param debug Add debug output
+     * @param shared_buffer_name The name of a shared memory image buffer
+     * @param num_prefetch The number of images to read ahead
+     * @param batch_size The number of neighbouring reflections in each job
+     * @param numa Pin the threads and place the buffer on the NUMA nodes
      */
     ParallelIntegrator(af::reflection_table reflections,
                        ImageSequence imageset,
@@ -1075,11 +1881,15 @@ namespace dials { namespace algorithms {
                        std::size_t nthreads,
                        std::size_t buffer_size,
                        bool use_dynamic_mask,
-                       bool debug) {
-      using dials::algorithms::shoebox::find_overlapping_multi_panel;
+                       bool debug,
+                       const std::string &shared_buffer_name = "",
+                       std::size_t num_prefetch = 2,
+                       std::size_t batch_size = 1,
+                       bool numa = false) {
 
       // Check the input
       DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(batch_size > 0);
 
       // Check the models
       DIALS_ASSERT(imageset.get_detector() != NULL);
@@ -1113,26 +1923,60 @@ namespace dials { namespace algorithms {
       // Reset the flags
       reset_flags(flags);
 
-      // Find the overlapping reflections
-      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel);
+      // Index the bounding boxes so that the overlapping reflections can be
+      // found when each reflection is integrated
+      OverlapIndex overlaps(bbox, panel);
+
+      // Allocate the array for the image data. If a shared buffer is requested
+      // then the buffer holds all the images and is shared with any other
+      // process integrating the same images with the same name. Otherwise only
+      // the region of each panel covered by the reflections is allocated.
+      // If NUMA placement is requested then the worker threads are pinned and
+      // each one first touches the part of the buffer it will mostly read.
+      std::vector<int> cpus;
+      if (numa) {
+        cpus = util::numa::interleaved_cpus();
+      }
+      boost::shared_ptr<Buffer> buffer_ptr;
+      if (shared_buffer_name.empty()) {
+        std::vector<int4> region = compute_buffer_regions(detector, bbox, panel, flags);
+        buffer_ptr.reset(new Buffer(detector,
+                                    zsize,
+                                    buffer_size,
+                                    underload,
+                                    imageset.get_static_mask(),
+                                    region,
+                                    cpus.empty()));
+        if (!cpus.empty()) {
+          first_touch(*buffer_ptr, nthreads, cpus);
+        }
+      } else {
+        buffer_ptr.reset(new Buffer(detector,
+                                    zsize,
+                                    underload,
+                                    imageset.get_static_mask(),
+                                    shared_buffer_name,
+                                    zstart));
+      }
+      Buffer &buffer = *buffer_ptr;
 
-      // Allocate the array for the image data
-      Buffer buffer(
-        detector, zsize, buffer_size, underload, imageset.get_static_mask());
+      // The overloads are found as the images are copied to a local buffer
+      if (shared_buffer_name.empty()) {
+        buffer.enable_overload_map(overload);
+      }
 
       // If we have shoeboxes then delete
       if (reflections.contains("shoebox")) {
         reflections.erase("shoebox");
       }
 
-      // Transform reflection data from column major to row major. The
-      // reason for doing this is because we want to process each reflection
-      // in parallel. Therefore passing a reflection object is better than
-      // passing the whole table. Additionally, because the reflection table
-      // uses a std::map, it may not be thread safe, so we want to avoid
-      // accessing this across multiple threads.
-      af::shared<af::Reflection> reflection_array =
-        reflection_table_to_array(reflections);
+      // Create a view of the reflection table columns. Each reflection is
+      // processed in parallel, so a reflection object is extracted from the
+      // columns when the job runs and written back to the columns when it is
+      // done. The columns are looked up once here so that the workers neither
+      // search the table's std::map nor need a row major copy of the whole
+      // table. Access to the view is serialised by the integrator.
+      af::ReflectionColumns reflection_columns(reflections);
 
       // The lookup class gives the indices of reflections whose bounding boxes
       // are complete at a given image. This is used to submit reflections for
@@ -1140,7 +1984,9 @@ namespace dials { namespace algorithms {
       Lookup lookup(bbox, zstart, zsize);
 
       // Create the reflection integrator. This class is called for each
-      // reflection to integrate the data
+      // reflection to integrate the data and times each stage
+      profile_.reset(new IntegrationProfile());
+      profile_->set_buffer_bytes(buffer.nbytes());
       ReflectionIntegrator integrator(compute_mask,
                                       compute_background,
                                       compute_intensity,
@@ -1148,23 +1994,40 @@ namespace dials { namespace algorithms {
                                       zstart,
                                       underload,
                                       overload,
-                                      debug);
+                                      debug,
+                                      !cpus.empty(),
+                                      profile_.get());
 
       // Do the integration
       process(lookup,
               integrator,
               buffer,
-              reflection_array.ref(),
+              reflection_columns,
               overlaps,
               imageset,
               bbox,
+              panel,
               flags,
               nthreads,
               use_dynamic_mask,
+              num_prefetch,
+              batch_size,
+              cpus,
+              *profile_,
               logger);
+      logger.debug(profile_->summary().c_str());
 
-      // Transform the row major reflection array to the reflection table
-      reflections_ = reflection_table_from_array(reflection_array.const_ref());
+      // Report how many shoeboxes were read from memory on another node
+      if (!cpus.empty()) {
+        std::ostringstream ss;
+        ss << "NUMA: " << integrator.num_remote() << " of "
+           << integrator.num_local() + integrator.num_remote()
+           << " shoeboxes were read from memory on another node";
+        logger.info(ss.str().c_str());
+      }
+
+      // The results have been written into the reflection table
+      reflections_ = reflection_columns.table();
     }
 
     /**
@@ -1174,6 +2037,13 @@ namespace dials { namespace algorithms {
       return reflections_;
     }
 
+    /**
+     * @returns The timings of the stages of the integration
+     */
+    boost::shared_ptr<IntegrationProfile> profile() const {
+      return profile_;
+    }
+
     /**
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
@@ -1196,6 +2066,82 @@ namespace dials { namespace algorithms {
       return nbytes;
     }
 
+    /**
+     * Static method to get the memory in bytes needed when only the regions of
+     * the panels covered by the reflections are allocated
+     * @param imageset the imageset class
+     * @param block_size The number of images in the buffer
+     * @param reflections The reflections to integrate
+     */
+    static std::size_t compute_required_memory(ImageSequence imageset,
+                                               std::size_t block_size,
+                                               af::reflection_table reflections) {
+      DIALS_ASSERT(imageset.get_detector() != NULL);
+      DIALS_ASSERT(imageset.get_scan() != NULL);
+      Detector detector = *imageset.get_detector();
+      Scan scan = *imageset.get_scan();
+      block_size = std::min(block_size, (std::size_t)scan.get_num_images());
+      std::vector<int4> region =
+        compute_buffer_regions(detector,
+                               reflections.get<int6>("bbox").const_ref(),
+                               reflections.get<std::size_t>("panel").const_ref(),
+                               reflections.get<std::size_t>("flags").const_ref());
+      std::size_t nelements = 0;
+      for (std::size_t i = 0; i < region.size(); ++i) {
+        nelements += (region[i][1] - region[i][0]) * (region[i][3] - region[i][2]);
+      }
+      nelements *= block_size;
+      std::size_t nbytes = nelements * sizeof(Buffer::float_type);
+      return nbytes;
+    }
+
+    /**
+     * Compute the region of each panel covered by the bounding boxes of the
+     * reflections to be integrated. The regions are clipped to the panels and
+     * a panel with no reflections has an empty region.
+     * @param detector The detector model
+     * @param bbox The reflection bounding boxes
+     * @param panel The reflection panels
+     * @param flags The reflection flags
+     * @returns The (x0, x1, y0, y1) region of each panel
+     */
+    static std::vector<int4> compute_buffer_regions(
+      const Detector &detector,
+      af::const_ref<int6> bbox,
+      af::const_ref<std::size_t> panel,
+      af::const_ref<std::size_t> flags) {
+      DIALS_ASSERT(bbox.size() == panel.size());
+      DIALS_ASSERT(bbox.size() == flags.size());
+      std::vector<int4> region(detector.size(), int4(0, 0, 0, 0));
+      std::vector<bool> empty(detector.size(), true);
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        if ((flags[i] & af::DontIntegrate) != 0) {
+          continue;
+        }
+        std::size_t p = panel[i];
+        DIALS_ASSERT(p < detector.size());
+        int xsize = detector[p].get_image_size()[0];
+        int ysize = detector[p].get_image_size()[1];
+        int x0 = std::max(bbox[i][0], 0);
+        int x1 = std::min(bbox[i][1], xsize);
+        int y0 = std::max(bbox[i][2], 0);
+        int y1 = std::min(bbox[i][3], ysize);
+        if (x1 <= x0 || y1 <= y0) {
+          continue;
+        }
+        if (empty[p]) {
+          region[p] = int4(x0, x1, y0, y1);
+          empty[p] = false;
+        } else {
+          region[p][0] = std::min(region[p][0], x0);
+          region[p][1] = std::max(region[p][1], x1);
+          region[p][2] = std::min(region[p][2], y0);
+          region[p][3] = std::max(region[p][3], y1);
+        }
+      }
+      return region;
+    }
+
     /**
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
@@ -1229,6 +2175,61 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Zero the buffer from threads pinned in the same way as the workers of
+     * the thread pool, thread i zeroing the i'th stripe of the images
+     */
+    static void first_touch(Buffer &buffer,
+                            std::size_t nthreads,
+                            const std::vector<int> &cpus) {
+      DIALS_ASSERT(!cpus.empty());
+      boost::thread_group threads;
+      for (std::size_t i = 0; i < nthreads; ++i) {
+        threads.create_thread(boost::bind(&first_touch_part,
+                                          boost::ref(buffer),
+                                          i,
+                                          nthreads,
+                                          cpus[i % cpus.size()]));
+      }
+      threads.join_all();
+    }
+
+    static void first_touch_part(Buffer &buffer,
+                                 std::size_t part,
+                                 std::size_t num_parts,
+                                 int cpu) {
+      util::numa::pin_current_thread(cpu);
+      buffer.first_touch(part, num_parts);
+    }
+
+    /**
+     * Helper function to sort reflections by panel and then by the tile of
+     * the panel containing the corner of the bounding box
+     */
+    struct sort_by_locality {
+      af::const_ref<int6> bbox_;
+      af::const_ref<std::size_t> panel_;
+      sort_by_locality(af::const_ref<int6> bbox, af::const_ref<std::size_t> panel)
+          : bbox_(bbox), panel_(panel) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        const int tile_size = 64;
+        if (panel_[a] != panel_[b]) {
+          return panel_[a] < panel_[b];
+        }
+        int ya = std::max(bbox_[a][2], 0) / tile_size;
+        int yb = std::max(bbox_[b][2], 0) / tile_size;
+        if (ya != yb) {
+          return ya < yb;
+        }
+        int xa = std::max(bbox_[a][0], 0) / tile_size;
+        int xb = std::max(bbox_[b][0], 0) / tile_size;
+        if (xa != xb) {
+          return xa < xb;
+        }
+        return a < b;
+      }
+    };
+
     /**
      * Do the processing by the following procedure.
      *
@@ -1242,18 +2243,23 @@ namespace dials { namespace algorithms {
     void process(const Lookup &lookup,
                  const ReflectionIntegrator &integrator,
                  Buffer &buffer,
-                 af::ref<af::Reflection> reflections,
-                 const AdjacencyList &overlaps,
+                 af::ReflectionColumns &reflections,
+                 const OverlapIndex &overlaps,
                  ImageSequence imageset,
                  af::const_ref<int6> bbox,
+                 af::const_ref<std::size_t> panel,
                  af::const_ref<std::size_t> flags,
                  std::size_t nthreads,
                  bool use_dynamic_mask,
+                 std::size_t num_prefetch,
+                 std::size_t batch_size,
+                 const std::vector<int> &cpus,
+                 IntegrationProfile &profile,
                  const Logger &logger) const {
-      using dials::util::ThreadPool;
+      using dials::util::WorkStealingThreadPool;
 
       // Create the thread pool
-      ThreadPool pool(nthreads);
+      WorkStealingThreadPool pool(nthreads, cpus);
 
       // Get the size of the array
       int zstart = imageset.get_scan()->get_array_range()[0];
@@ -1262,51 +2268,94 @@ namespace dials { namespace algorithms {
       // Create the buffer manager
       BufferManager bm(buffer, bbox, flags, zstart);
 
+      // Release the GIL so that the images can be read by the prefetcher while
+      // the reflections are integrated. Images already in a shared buffer are
+      // not read.
+      detail::ScopedGILRelease release_gil;
+      ImagePrefetcher prefetcher(
+        imageset,
+        use_dynamic_mask ? ImagePrefetcher::DynamicMaskRuns : ImagePrefetcher::NoMask,
+        num_prefetch,
+        boost::bind(&Buffer::is_loaded, &buffer, _1));
+
       // Loop through all the images
+      double copy_time = 0;
+      std::size_t num_posted = 0;
       for (std::size_t i = 0; i < zsize; ++i) {
         // Copy the image to the buffer. If the image number is greater than the
         // buffer size (i.e. we are now deleting old images) then wait for the
         // threads to finish so that we don't end up reading the wrong data
-        if (imageset.is_marked_for_rejection(i)) {
-          bm.copy_when_ready(imageset.get_corrected_data(i), false, i);
+        ImagePrefetcher::frame_pointer frame = prefetcher.next();
+        boost::posix_time::ptime copy_start =
+          boost::posix_time::microsec_clock::universal_time();
+        if (frame->skipped) {
+          // The image has already been loaded into the shared buffer by
+          // another process so there is no need to decode it again
+        } else if (frame->rejected) {
+          bm.copy_when_ready(frame->data, false, i);
         } else if (use_dynamic_mask) {
-          bm.copy_when_ready(
-            imageset.get_corrected_data(i), imageset.get_dynamic_mask(i), i);
+          bm.copy_when_ready(frame->data, frame->mask_runs, i);
         } else {
-          bm.copy_when_ready(imageset.get_corrected_data(i), i);
+          bm.copy_when_ready(frame->data, i);
         }
+        frame.reset();
+        copy_time += detail::seconds_since(copy_start);
 
         // Get the reflections recorded at this point
-        af::const_ref<std::size_t> indices = lookup.indices(i);
+        af::const_ref<std::size_t> frame_indices = lookup.indices(i);
 
-        // Iterate through the reflection indices
-        std::size_t count = 0;
-        for (std::size_t j = 0; j < indices.size(); ++j) {
+        // Sort the reflections so that reflections which are close to each
+        // other on the same panel are next to each other in the batch
+        std::vector<std::size_t> indices;
+        indices.reserve(frame_indices.size());
+        for (std::size_t j = 0; j < frame_indices.size(); ++j) {
           // Get the reflection index
-          std::size_t k = indices[j];
+          std::size_t k = frame_indices[j];
 
           // Check that the reflection bounding box is within the range of
           // images that have been read
           DIALS_ASSERT(bbox[k][5] <= zstart + i + 1);
 
           // Ignore if we're not integrating this reflection
-          if (flags[k] & af::DontIntegrate) {
-            continue;
-          } else {
-            count++;
+          if ((flags[k] & af::DontIntegrate) == 0) {
+            indices.push_back(k);
           }
+        }
+        if (batch_size > 1) {
+          std::sort(indices.begin(), indices.end(), sort_by_locality(bbox, panel));
+        }
 
-          // Post the integration job
-          bm.post(
-            pool,
+        // Iterate through the reflection indices
+        std::vector<WorkStealingThreadPool::job_type> jobs;
+        std::vector<int> jobs_first_image;
+        jobs.reserve(indices.size());
+        jobs_first_image.reserve(indices.size());
+        std::size_t count = indices.size();
+        for (std::size_t j = 0; j < indices.size(); ++j) {
+          std::size_t k = indices[j];
+
+          // Add the integration job to the batch
+          jobs.push_back(
             boost::bind(&ReflectionIntegrator::operator(),
                         boost::ref(integrator),
                         k,
-                        af::ref<af::Reflection>(&reflections[0], reflections.size()),
-                        boost::ref(overlaps)),
-            bbox[k][4]);
+                        boost::ref(reflections),
+                        boost::ref(overlaps)));
+          jobs_first_image.push_back(bbox[k][4]);
         }
 
+        // Post all the integration jobs for this image at once. Neighbouring
+        // reflections are grouped so that each thread works on one part of
+        // the image, but the groups are kept small enough that every thread
+        // has some work.
+        boost::posix_time::ptime post_start =
+          boost::posix_time::microsec_clock::universal_time();
+        std::size_t group_size = std::min(batch_size, count / nthreads + 1);
+        bm.post_batch(pool, jobs, jobs_first_image, group_size);
+        profile.add_post_time(detail::seconds_since(post_start));
+        num_posted += count;
+        profile.sample_queue_depth(num_posted);
+
         // Print some output
         std::ostringstream ss;
         ss << "Integrating " << std::setw(5) << count << " reflections on image "
@@ -1316,9 +2365,29 @@ namespace dials { namespace algorithms {
 
       // Wait for all the integration jobs to complete
       bm.wait(pool);
+
+      // The time spent waiting for space in the buffer is counted separately
+      // from the time spent copying the images
+      profile.set_image_reading(prefetcher.read_time(),
+                                prefetcher.stall_time(),
+                                prefetcher.num_stalls(),
+                                prefetcher.reader_wait_time());
+      profile.set_buffer(
+        std::max(copy_time - bm.wait_time(), 0.0), bm.wait_time(), bm.num_waits());
+
+      // Print the statistics on waiting for images so that the number of
+      // images to prefetch and the buffer size can be tuned
+      std::ostringstream ss;
+      ss << std::fixed << std::setprecision(2) << "Read " << zsize
+         << " images in " << prefetcher.read_time() << " s; integration waited for "
+         << prefetcher.num_stalls() << " images (" << prefetcher.stall_time()
+         << " s) and for space in the image buffer for " << bm.wait_time()
+         << " s; image reading waited for " << prefetcher.reader_wait_time() << " s";
+      logger.info(ss.str().c_str());
     }
 
     af::reflection_table reflections_;
+    boost::shared_ptr<IntegrationProfile> profile_;
   };
 
   /**
@@ -1,7 +1,9 @@
 from __future__ import absolute_import, division, print_function
 
+import hashlib
 import logging
 import math
+from time import time
 
 import psutil
 
@@ -25,9 +27,11 @@
     GaussianRSReferenceCalculator,
     GaussianRSReferenceProfileData,
     GLMBackgroundCalculator,
+    IntegrationProfile,
     Logger,
     MultiThreadedIntegrator,
     MultiThreadedReferenceProfiler,
+    MultiThreadedShoeboxPoolIntegrator,
     ReferenceProfileData,
     SimpleBackgroundCalculator,
     SimpleBlockList,
@@ -45,12 +49,14 @@
     "GaussianRSReferenceProfileData",
     "IntegrationJob",
     "IntegrationManager",
+    "IntegrationProfile",
     "IntegratorProcessor",
     "IntensityCalculatorFactory",
     "Logger",
     "MaskCalculatorFactory",
     "MultiThreadedIntegrator",
     "MultiThreadedReferenceProfiler",
+    "MultiThreadedShoeboxPoolIntegrator",
     "ReferenceCalculatorFactory",
     "ReferenceCalculatorJob",
     "ReferenceCalculatorManager",
@@ -59,6 +65,7 @@
     "SimpleBackgroundCalculator",
     "SimpleBlockList",
     "SimpleReflectionManager",
+    "SinglePassIntegratorProcessor",
 ]
 
 logger = logging.getLogger(__name__)
@@ -280,6 +287,22 @@ def create(experiments, params=None):
         return algorithm
 
 
+def shared_buffer_name(name, imageset):
+    """
+    Get the name of the shared memory image buffer for an imageset. The name
+    includes a hash of the image paths so that only processes integrating the
+    same images share a buffer.
+
+    :param name: The base name given by the user
+    :param imageset: The imageset to integrate
+    :return: The name of the buffer, or an empty string if no name is given
+    """
+    if not name:
+        return ""
+    paths = "\n".join(imageset.paths())
+    return "%s_%s" % (name, hashlib.sha1(paths.encode("utf-8")).hexdigest()[:16])
+
+
 def _assert_enough_memory(required_memory, max_memory_usage):
     """
     Check there is enough memory available or fail
@@ -345,6 +368,7 @@ def __init__(self, index, job, experiments, reflections, reference, params=None)
         self.reflections = reflections
         self.reference = reference
         self.params = params
+        self.profile = None
 
     def __call__(self):
         """
@@ -389,28 +413,41 @@ def __call__(self):
         )
 
         # Integrate
+        start_time = time()
         self.integrate(imageset)
+        total_time = time() - start_time
 
         # Write some debug files
         self.write_debug_files()
 
-        # Return the result
+        # Return the result with the times summed over the threads
+        stage_time = self.profile.stage_time()
+        stage_time = {
+            self.profile.stage_name(i): t for i, t in enumerate(stage_time)
+        }
         return dials.algorithms.integration.Result(
             index=self.index,
             reflections=self.reflections,
             data=None,
-            read_time=0,
-            extract_time=0,
-            process_time=0,
-            total_time=0,
+            read_time=self.profile.image_read_time(),
+            extract_time=stage_time["extract shoebox"],
+            process_time=sum(stage_time.values()),
+            total_time=total_time,
         )
 
     def compute_required_memory(self, imageset):
         """
         Compute the required memory
         """
+        block_size = self.params.integration.block.size
+        if self.params.integration.block.shared_memory:
+            # A shared buffer holds all the images of the whole panels
+            return MultiThreadedIntegrator.compute_required_memory(
+                imageset, len(imageset)
+            )
+        # Otherwise only the region of each panel covered by the reflections
         return MultiThreadedIntegrator.compute_required_memory(
-            imageset, self.params.integration.block.size
+            imageset, block_size, self.reflections
         )
 
     def integrate(self, imageset):
@@ -420,7 +457,9 @@ def integrate(self, imageset):
         from dials.algorithms.integration.integrator import frame_hist
 
         # Compute the partiality
-        self.reflections.compute_partiality(self.experiments)
+        self.reflections.compute_partiality(
+            self.experiments, nthreads=self.params.integration.mp.nproc
+        )
 
         # Get some info
         EPS = 1e-7
@@ -487,10 +526,17 @@ def integrate(self, imageset):
             buffer_size=self.params.integration.block.size,
             use_dynamic_mask=self.params.integration.use_dynamic_mask,
             debug=self.params.integration.debug.output,
+            shared_buffer_name=shared_buffer_name(
+                self.params.integration.block.shared_memory, imageset
+            ),
+            num_prefetch=self.params.integration.block.prefetch,
+            batch_size=self.params.integration.mp.batch_size,
+            numa=self.params.integration.mp.numa,
         )
 
-        # Assign the reflections
+        # Assign the reflections and keep the timings for the report
         self.reflections = integrator.reflections()
+        self.profile = integrator.profile()
 
     def write_debug_files(self):
         """
@@ -770,7 +816,15 @@ class ReferenceCalculatorJob(object):
     A class to represent an integration job
     """
 
-    def __init__(self, index, job, experiments, reflections, params=None):
+    def __init__(
+        self,
+        index,
+        job,
+        experiments,
+        reflections,
+        params=None,
+        preserve_shoeboxes=False,
+    ):
         """
         Initialise the task.
 
@@ -779,8 +833,7 @@ def __init__(self, index, job, experiments, reflections, params=None):
         :param reflections: The list of reflections
         :param params: The processing parameters
         :param job: The frames to integrate
-        :param flatten: Flatten the shoeboxes
-        :param executor: The executor class
+        :param preserve_shoeboxes: Keep the shoeboxes for profile fitting
         """
 
         # Get the parameters
@@ -801,6 +854,9 @@ def __init__(self, index, job, experiments, reflections, params=None):
         self.experiments = experiments
         self.reflections = reflections
         self.params = params
+        self.preserve_shoeboxes = preserve_shoeboxes
+        self.shoebox_pool = None
+        self.shoebox_index = None
 
     def __call__(self):
         """
@@ -873,7 +929,9 @@ def compute_reference_profiles(self, imageset):
         from dials.algorithms.integration.integrator import frame_hist
 
         # Compute the partiality
-        self.reflections.compute_partiality(self.experiments)
+        self.reflections.compute_partiality(
+            self.experiments, nthreads=self.params.integration.mp.nproc
+        )
 
         # Get some info
         EPS = 1e-7
@@ -940,11 +998,24 @@ def compute_reference_profiles(self, imageset):
             buffer_size=self.params.integration.block.size,
             use_dynamic_mask=self.params.integration.use_dynamic_mask,
             debug=self.params.integration.debug.output,
+            preserve_shoeboxes=self.preserve_shoeboxes,
         )
 
         # Assign the reflections
         self.reflections = reference_calculator.reflections()
 
+        # Merge the profiles accumulated by each thread
+        compute_reference.finalize()
+
+        # Keep the shoeboxes for the profile fitting
+        if self.preserve_shoeboxes:
+            self.shoebox_pool = reference_calculator.shoebox_pool()
+            self.shoebox_index = reference_calculator.shoebox_index()
+            logger.info(
+                " Keeping %.1f MB of shoeboxes for profile fitting"
+                % (self.shoebox_pool.nbytes() / 1e6)
+            )
+
         # Assign the reference profiles
         self.reference = compute_reference
 
@@ -984,19 +1055,58 @@ def write_debug_files(self):
         if debug.separate_files or not debug.output:
             del self.reflections["shoebox"]
 
+    def integrate_preserved(self, reference):
+        """
+        Profile fit the reflections from the kept shoeboxes
+
+        :param reference: The complete reference profiles
+        :return: The integrated reflections
+        """
+        assert self.shoebox_pool is not None, "No shoeboxes were kept"
+
+        # Construct the intensity algorithm
+        compute_intensity = IntensityCalculatorFactory.create(
+            self.experiments, reference, self.params
+        )
+
+        # Fit the reflections and release the shoeboxes
+        integrator = MultiThreadedShoeboxPoolIntegrator(
+            reflections=self.reflections,
+            shoebox_pool=self.shoebox_pool,
+            shoebox_index=self.shoebox_index,
+            compute_intensity=compute_intensity,
+            nthreads=self.params.integration.mp.nproc,
+        )
+        self.reflections = integrator.reflections()
+        self.shoebox_pool = None
+        self.shoebox_index = None
+
+        # Return the result
+        return dials.algorithms.integration.Result(
+            index=self.index,
+            reflections=self.reflections,
+            data=None,
+            read_time=0,
+            extract_time=0,
+            process_time=0,
+            total_time=0,
+        )
+
 
 class ReferenceCalculatorManager(object):
     """
     A class to manage processing book-keeping
     """
 
-    def __init__(self, experiments, reflections, params):
+    def __init__(self, experiments, reflections, params, preserve_shoeboxes=False):
         """
         Initialise the manager.
 
         :param experiments: The list of experiments
         :param reflections: The list of reflections
         :param params: The phil parameters
+        :param preserve_shoeboxes: Process all the reflections and keep their
+                                   shoeboxes for the profile fitting
         """
 
         # Save some data
@@ -1006,6 +1116,7 @@ def __init__(self, experiments, reflections, params):
 
         # Save some parameters
         self.params = params
+        self.preserve_shoeboxes = preserve_shoeboxes
 
         # Set the finalized flag to False
         self.finalized = False
@@ -1022,11 +1133,13 @@ def initialize(self):
         # Ensure the reflections contain bounding boxes
         assert "bbox" in self.reflections, "Reflections have no bbox"
 
-        # Select only those reflections used in refinement
+        # Select only those reflections used in refinement, unless all the
+        # reflections are to be integrated in the same pass
         selection = self.reflections.get_flags(self.reflections.flags.reference_spot)
         if selection.count(True) == 0:
             raise RuntimeError("No reference reflections given")
-        self.reflections = self.reflections.select(selection)
+        if not self.preserve_shoeboxes:
+            self.reflections = self.reflections.select(selection)
 
         # Compute the block size and jobs
         self.compute_blocks()
@@ -1062,6 +1175,7 @@ def task(self, index):
                 experiments=experiments,
                 reflections=reflections,
                 params=self.params,
+                preserve_shoeboxes=self.preserve_shoeboxes,
             )
         return task
 
@@ -1323,6 +1437,59 @@ def profiles(self):
         return self._profiles
 
 
+class SinglePassIntegratorProcessor(object):
+    """
+    Model the reference profiles and integrate the reflections with one read
+    of the images. The shoeboxes of all the reflections are kept from the
+    modelling pass and profile fitted once the reference profiles are
+    complete, so the jobs are run one after another in this process.
+    """
+
+    def __init__(self, experiments, reflections, params=None):
+
+        # Create the reference manager
+        reference_manager = ReferenceCalculatorManager(
+            experiments, reflections, params, preserve_shoeboxes=True
+        )
+
+        # Print some output
+        logger.info(reference_manager.summary())
+
+        # Execute each task, keeping them for the profile fitting
+        tasks = []
+        for task in reference_manager.tasks():
+            result = task()
+            reference_manager.accumulate(result)
+            tasks.append(task)
+
+        # Finalize the processing
+        reference_manager.finalize()
+        self._profiles = reference_manager.reference
+
+        # Fit the reflections of each task from the kept shoeboxes
+        logger.info("")
+        logger.info(" Profile fitting reflections from the kept shoeboxes")
+        manager = SimpleReflectionManager(
+            reference_manager.blocks,
+            reference_manager.reflections,
+            params.integration.mp.njobs,
+        )
+        for task in tasks:
+            if isinstance(task, ReferenceCalculatorJob):
+                result = task.integrate_preserved(self._profiles)
+            else:
+                result = task()
+            manager.accumulate(result.index, result.reflections)
+        assert manager.finished(), "Manager is not finished"
+        self._reflections = manager.data()
+
+    def reflections(self):
+        return self._reflections
+
+    def profiles(self):
+        return self._profiles
+
+
 class IntegratorProcessor(object):
     def __init__(self, experiments, reflections, reference=None, params=None):
 
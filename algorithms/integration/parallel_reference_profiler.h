@@ -21,10 +21,12 @@
 #include <dials/array_family/reflection.h>
 #include <dials/error.h>
 #include <dials/util/thread_pool.h>
-#include <dials/algorithms/shoebox/find_overlapping.h>
+#include <dials/algorithms/shoebox/overlap_index.h>
 #include <dials/algorithms/integration/parallel_integrator.h>
 #include <dials/algorithms/integration/sum/summation.h>
 #include <dials/algorithms/centroid/centroid.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/model/data/shoebox_pool.h>
 #include <dials/array_family/boost_python/flex_table_suite.h>
 #include <map>
 
@@ -42,8 +44,9 @@ namespace dials { namespace algorithms {
   using dxtbx::format::Image;
   using dxtbx::format::ImageTile;
 
-  using dials::model::AdjacencyList;
+  using dials::algorithms::shoebox::OverlapIndex;
   using dials::model::Shoebox;
+  using dials::model::ShoeboxPool;
 
   /**
    * A class to integrate a single reflection
@@ -59,6 +62,12 @@ namespace dials { namespace algorithms {
      * @param zstart The first image index
      * @param underload The underload value
      * @param overload The overload value
+     * @param debug Keep the shoeboxes
+     * @param shoebox_pool If not NULL, the pool to copy the pixels of each
+     *                     processed shoebox into for profile fitting later
+     * @param shoebox_index The index in the pool of each reflection, or -1 if
+     *                      it has none. This is set to -1 for reflections
+     *                      whose processing fails.
      */
     ReflectionReferenceProfiler(const MaskCalculatorIface &compute_mask,
                                 const BackgroundCalculatorIface &compute_background,
@@ -67,7 +76,9 @@ namespace dials { namespace algorithms {
                                 int zstart,
                                 double underload,
                                 double overload,
-                                bool debug)
+                                bool debug,
+                                ShoeboxPool<> *shoebox_pool = NULL,
+                                af::ref<int> shoebox_index = af::ref<int>(0, 0))
         : compute_mask_(compute_mask),
           compute_background_(compute_background),
           compute_reference_(compute_reference),
@@ -75,7 +86,9 @@ namespace dials { namespace algorithms {
           zstart_(zstart),
           underload_(underload),
           overload_(overload),
-          debug_(debug) {}
+          debug_(debug),
+          shoebox_pool_(shoebox_pool),
+          shoebox_index_(shoebox_index) {}
 
     /**
      * Integrate a reflection using the following procedure:
@@ -86,21 +99,22 @@ namespace dials { namespace algorithms {
      * 4. Compute the reflection background
      * 5. Compute the reflection centroid
      * 6. Compute the summed intensity
-     * 7. Compute the profile fitted intensity
-     * 8. Delete the shoebox unless debuf has been set
+     * 7. Add reference spots to the reference profiles
+     * 8. Copy the shoebox into the pool if one is given
+     * 9. Delete the shoebox unless debug has been set
      *
      * @param reflection The reflection object
      * @param adjacent_reflections The list of adjacent reflections
      */
     void operator()(std::size_t index,
-                    af::ref<af::Reflection> reflection_list,
-                    const AdjacencyList &adjacency_list) const {
+                    af::ReflectionColumns &reflection_list,
+                    const OverlapIndex &overlaps) const {
       af::Reflection reflection;
       std::vector<af::Reflection> adjacent_reflections;
 
       // Get the reflection data
       get_reflection(
-        index, reflection_list, adjacency_list, reflection, adjacent_reflections);
+        index, reflection_list, overlaps, reflection, adjacent_reflections);
 
       // Extract the shoebox data
       extract_shoebox(buffer_, reflection, zstart_, underload_, overload_);
@@ -120,6 +134,9 @@ namespace dials { namespace algorithms {
       try {
         compute_background_(reflection);
       } catch (dials::error) {
+        if (shoebox_pool_ != NULL) {
+          shoebox_index_[index] = -1;
+        }
         finalize_shoebox(reflection, adjacent_reflections, underload_, overload_);
         return;
       }
@@ -130,11 +147,22 @@ namespace dials { namespace algorithms {
       // Compute the summed intensity
       compute_summed_intensity(reflection);
 
-      // Compute the profile fitted intensity
-      try {
-        compute_reference_(reflection);
-      } catch (dials::error) {
-        // pass
+      // Add the reflection to the reference profiles. When the shoeboxes are
+      // kept for profile fitting all the reflections are processed here, so
+      // only the reference spots are used.
+      if (reflection.get<std::size_t>("flags") & af::ReferenceSpot) {
+        try {
+          compute_reference_(reflection);
+        } catch (dials::error) {
+          // pass
+        }
+      }
+
+      // Keep the pixels for profile fitting. Each reflection is processed by
+      // one thread and has its own part of the pool so this needs no lock.
+      if (shoebox_pool_ != NULL && shoebox_index_[index] >= 0) {
+        shoebox_pool_->set(shoebox_index_[index],
+                           reflection.get<Shoebox<> >("shoebox"));
       }
 
       // Erase the shoebox
@@ -149,30 +177,36 @@ namespace dials { namespace algorithms {
      * Get the reflection data in a thread safe manner
      * @param index The reflection index
      * @param reflection_list The reflection list
-     * @param adjacency_list The adjacency list
+     * @param overlaps The index of overlapping reflections
      * @param reflection The reflection data
      * @param adjacent_reflections The adjacent reflections
      */
     void get_reflection(std::size_t index,
-                        const af::const_ref<af::Reflection> &reflection_list,
-                        const AdjacencyList &adjacency_list,
+                        const af::ReflectionColumns &reflection_list,
+                        const OverlapIndex &overlaps,
                         af::Reflection &reflection,
                         std::vector<af::Reflection> &adjacent_reflections) const {
       DIALS_ASSERT(index < reflection_list.size());
 
+      // Find the adjacent reflections. The index is immutable so this does
+      // not need the lock.
+      std::vector<std::size_t> adjacent;
+      overlaps.find(index, adjacent);
+
       // Get the lock
       boost::lock_guard<boost::mutex> guard(mutex_);
 
       // Get the reflection
-      reflection = reflection_list[index];
+      reflection = reflection_list.get(index);
 
       // Get the adjacent reflections
-      adjacent_reflections.reserve(adjacency_list.vertex_num_edges(index));
-      AdjacencyList::edge_iterator_range edges = adjacency_list.edges(index);
-      for (AdjacencyList::edge_iterator it = edges.first; it != edges.second; ++it) {
-        DIALS_ASSERT(it->first == index);
-        DIALS_ASSERT(it->second < reflection_list.size());
-        adjacent_reflections.push_back(reflection_list[it->second]);
+      if (!adjacent.empty()) {
+        AdjacentReflectionColumns adjacent_columns(reflection_list);
+        adjacent_reflections.reserve(adjacent.size());
+        for (std::size_t i = 0; i < adjacent.size(); ++i) {
+          DIALS_ASSERT(adjacent[i] < reflection_list.size());
+          adjacent_reflections.push_back(adjacent_columns.get(adjacent[i]));
+        }
       }
     }
 
@@ -183,11 +217,11 @@ namespace dials { namespace algorithms {
      * @param reflection The reflection data
      */
     void set_reflection(std::size_t index,
-                        af::ref<af::Reflection> reflection_list,
+                        af::ReflectionColumns &reflection_list,
                         const af::Reflection &reflection) const {
       DIALS_ASSERT(index < reflection_list.size());
       boost::lock_guard<boost::mutex> guard(mutex_);
-      reflection_list[index] = reflection;
+      reflection_list.set(index, reflection);
     }
 
     /**
@@ -224,6 +258,13 @@ namespace dials { namespace algorithms {
       af::const_ref<int, af::c_grid<3> > mask = sbox.mask.const_ref();
       DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
 
+      // Use the overload bitmaps of the buffer if it has them, otherwise
+      // check each pixel
+      bool check_overload = !buffer_.has_overload_map();
+      if (!check_overload && buffer_.is_overloaded(sbox.panel, sbox.bbox, zstart_)) {
+        flags |= af::Overloaded;
+      }
+
       // Check pixel values
       std::size_t n_valid = 0;
       std::size_t n_background = 0;
@@ -237,7 +278,7 @@ namespace dials { namespace algorithms {
         double d = data[i];
         int m = mask[i];
 
-        if (d >= overload) {
+        if (check_overload && d >= overload) {
           flags |= af::Overloaded;
         }
 
@@ -310,7 +351,7 @@ namespace dials { namespace algorithms {
       std::size_t panel = reflection.get<std::size_t>("panel");
       int6 bbox = reflection.get<int6>("bbox");
       Shoebox<> shoebox(panel, bbox);
-      shoebox.allocate();
+      ShoeboxArena::local().allocate(shoebox);
       af::ref<float, af::c_grid<3> > data = shoebox.data.ref();
       af::ref<int, af::c_grid<3> > mask = shoebox.mask.ref();
       int x0 = bbox[0];
@@ -408,6 +449,8 @@ namespace dials { namespace algorithms {
     double underload_;
     double overload_;
     bool debug_;
+    ShoeboxPool<> *shoebox_pool_;
+    af::ref<int> shoebox_index_;
     mutable boost::mutex mutex_;
   };
 
@@ -428,6 +471,9 @@ namespace dials { namespace algorithms {
      * @param buffer_size The buffer_size
      * @param use_dynamic_mask Use the dynamic mask if present
      * @param debug Add debug output
+     * @param preserve_shoeboxes Keep the pixels of the processed shoeboxes in
+     *                           a pool so the reflections can be profile
+     *                           fitted without reading the images again
      */
     ParallelReferenceProfiler(af::reflection_table reflections,
                               ImageSequence imageset,
@@ -438,8 +484,8 @@ namespace dials { namespace algorithms {
                               std::size_t nthreads,
                               std::size_t buffer_size,
                               bool use_dynamic_mask,
-                              bool debug) {
-      using dials::algorithms::shoebox::find_overlapping_multi_panel;
+                              bool debug,
+                              bool preserve_shoeboxes = false) {
 
       // Check the input
       DIALS_ASSERT(nthreads > 0);
@@ -476,26 +522,29 @@ namespace dials { namespace algorithms {
       // Reset the flags
       reset_flags(flags);
 
-      // Find the overlapping reflections
-      AdjacencyList overlaps = find_overlapping_multi_panel(bbox, panel);
+      // Allocate the pool for the shoeboxes of the reflections to integrate
+      shoebox_index_ = af::shared<int>(bbox.size(), -1);
+      if (preserve_shoeboxes) {
+        allocate_shoebox_pool(panel, bbox, flags);
+      }
+
+      // Index the bounding boxes so that the overlapping reflections can be
+      // found when each reflection is integrated
+      OverlapIndex overlaps(bbox, panel);
 
       // Allocate the array for the image data
       Buffer buffer(
         detector, zsize, buffer_size, underload, imageset.get_static_mask());
+      buffer.enable_overload_map(overload);
 
       // If we have shoeboxes then delete
       if (reflections.contains("shoebox")) {
         reflections.erase("shoebox");
       }
 
-      // Transform reflection data from column major to row major. The
-      // reason for doing this is because we want to process each reflection
-      // in parallel. Therefore passing a reflection object is better than
-      // passing the whole table. Additionally, because the reflection table
-      // uses a std::map, it may not be thread safe, so we want to avoid
-      // accessing this across multiple threads.
-      af::shared<af::Reflection> reflection_array =
-        reflection_table_to_array(reflections);
+      // The reflections are read from and written back to the table columns
+      // by the worker threads as they are processed (see ParallelIntegrator)
+      af::ReflectionColumns reflection_columns(reflections);
 
       // The lookup class gives the indices of reflections whose bounding boxes
       // are complete at a given image. This is used to submit reflections for
@@ -511,13 +560,17 @@ namespace dials { namespace algorithms {
                                                               zstart,
                                                               underload,
                                                               overload,
-                                                              debug);
+                                                              debug,
+                                                              preserve_shoeboxes
+                                                                ? &shoebox_pool_
+                                                                : NULL,
+                                                              shoebox_index_.ref());
 
       // Do the integration
       process(lookup,
               parallel_reference_profiler,
               buffer,
-              reflection_array.ref(),
+              reflection_columns,
               overlaps,
               imageset,
               bbox,
@@ -526,8 +579,8 @@ namespace dials { namespace algorithms {
               use_dynamic_mask,
               logger);
 
-      // Transform the row major reflection array to the reflection table
-      reflections_ = reflection_table_from_array(reflection_array.const_ref());
+      // The results have been written into the reflection table
+      reflections_ = reflection_columns.table();
     }
 
     /**
@@ -537,6 +590,21 @@ namespace dials { namespace algorithms {
       return reflections_;
     }
 
+    /**
+     * @returns The pool of kept shoeboxes, empty unless they were preserved
+     */
+    ShoeboxPool<> shoebox_pool() const {
+      return shoebox_pool_;
+    }
+
+    /**
+     * @returns The index in the pool of the kept shoebox of each reflection,
+     *          or -1 if the reflection has none
+     */
+    af::shared<int> shoebox_index() const {
+      return shoebox_index_;
+    }
+
     /**
      * Static method to get the memory in bytes needed
      * @param imageset the imageset class
@@ -593,6 +661,26 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Allocate the pool with a shoebox for every reflection to integrate
+     */
+    void allocate_shoebox_pool(af::const_ref<std::size_t> panel,
+                               af::const_ref<int6> bbox,
+                               af::const_ref<std::size_t> flags) {
+      af::shared<std::size_t> pool_panel;
+      af::shared<int6> pool_bbox;
+      for (std::size_t i = 0; i < bbox.size(); ++i) {
+        if (!(flags[i] & af::DontIntegrate)) {
+          shoebox_index_[i] = pool_bbox.size();
+          pool_panel.push_back(panel[i]);
+          pool_bbox.push_back(bbox[i]);
+        }
+      }
+      shoebox_pool_ =
+        ShoeboxPool<>(pool_panel.const_ref(), pool_bbox.const_ref(), false);
+      shoebox_pool_.allocate();
+    }
+
     /**
      * Do the processing by the following procedure.
      *
@@ -606,18 +694,18 @@ namespace dials { namespace algorithms {
     void process(const Lookup &lookup,
                  const ReflectionReferenceProfiler &parallel_reference_profiler,
                  Buffer &buffer,
-                 af::ref<af::Reflection> reflections,
-                 const AdjacencyList &overlaps,
+                 af::ReflectionColumns &reflections,
+                 const OverlapIndex &overlaps,
                  ImageSequence imageset,
                  af::const_ref<int6> bbox,
                  af::const_ref<std::size_t> flags,
                  std::size_t nthreads,
                  bool use_dynamic_mask,
                  const Logger &logger) const {
-      using dials::util::ThreadPool;
+      using dials::util::WorkStealingThreadPool;
 
       // Create the thread pool
-      ThreadPool pool(nthreads);
+      WorkStealingThreadPool pool(nthreads);
 
       // Get the size of the array
       int zstart = imageset.get_scan()->get_array_range()[0];
@@ -626,24 +714,38 @@ namespace dials { namespace algorithms {
       // Create the buffer manager
       BufferManager bm(buffer, bbox, flags, zstart);
 
+      // Release the GIL while the reflections are modelled. The images are
+      // still read on this thread, by the prefetcher taking the GIL back, so
+      // that no more images are held than before.
+      detail::ScopedGILRelease release_gil;
+      ImagePrefetcher prefetcher(
+        imageset,
+        use_dynamic_mask ? ImagePrefetcher::DynamicMaskRuns : ImagePrefetcher::NoMask,
+        0);
+
       // Loop through all the images
       for (std::size_t i = 0; i < zsize; ++i) {
         // Copy the image to the buffer. If the image number is greater than the
         // buffer size (i.e. we are now deleting old images) then wait for the
         // threads to finish so that we don't end up reading the wrong data
-        if (imageset.is_marked_for_rejection(i)) {
-          bm.copy_when_ready(imageset.get_corrected_data(i), false, i);
+        ImagePrefetcher::frame_pointer frame = prefetcher.next();
+        if (frame->rejected) {
+          bm.copy_when_ready(frame->data, false, i);
         } else if (use_dynamic_mask) {
-          bm.copy_when_ready(
-            imageset.get_corrected_data(i), imageset.get_dynamic_mask(i), i);
+          bm.copy_when_ready(frame->data, frame->mask_runs, i);
         } else {
-          bm.copy_when_ready(imageset.get_corrected_data(i), i);
+          bm.copy_when_ready(frame->data, i);
         }
+        frame.reset();
 
         // Get the reflections recorded at this point
         af::const_ref<std::size_t> indices = lookup.indices(i);
 
         // Iterate through the reflection indices
+        std::vector<WorkStealingThreadPool::job_type> jobs;
+        std::vector<int> jobs_first_image;
+        jobs.reserve(indices.size());
+        jobs_first_image.reserve(indices.size());
         std::size_t count = 0;
         for (std::size_t j = 0; j < indices.size(); ++j) {
           // Get the reflection index
@@ -660,17 +762,19 @@ namespace dials { namespace algorithms {
             count++;
           }
 
-          // Post the integration job
-          bm.post(
-            pool,
+          // Add the modelling job to the batch
+          jobs.push_back(
             boost::bind(&ReflectionReferenceProfiler::operator(),
                         boost::ref(parallel_reference_profiler),
                         k,
-                        af::ref<af::Reflection>(&reflections[0], reflections.size()),
-                        boost::ref(overlaps)),
-            bbox[k][4]);
+                        boost::ref(reflections),
+                        boost::ref(overlaps)));
+          jobs_first_image.push_back(bbox[k][4]);
         }
 
+        // Post all the modelling jobs for this image at once
+        bm.post_batch(pool, jobs, jobs_first_image);
+
         // Print some output
         std::ostringstream ss;
         ss << "Modelling " << std::setw(5) << count << " reflections on image "
@@ -682,6 +786,144 @@ namespace dials { namespace algorithms {
       bm.wait(pool);
     }
 
+    af::reflection_table reflections_;
+    ShoeboxPool<> shoebox_pool_;
+    af::shared<int> shoebox_index_;
+  };
+
+  /**
+   * A class to do the profile fitting of reflections from the shoeboxes kept
+   * by the ParallelReferenceProfiler once the reference profiles are
+   * complete, so that the images do not need to be read and the masks and
+   * backgrounds computed a second time. The kept masks already include the
+   * adjacent reflections, so each reflection is fitted exactly as it would
+   * be by the ParallelIntegrator. The reflections are split into bands
+   * across threads.
+   */
+  class ShoeboxPoolIntegrator {
+  public:
+    /**
+     * Do the profile fitting
+     * @param reflections The reflection table
+     * @param shoebox_pool The pool of kept shoeboxes
+     * @param shoebox_index The index in the pool of each reflection, or -1
+     *                      if the reflection is not to be fitted
+     * @param compute_intensity The intensity calculation function
+     * @param nthreads The number of parallel threads
+     */
+    ShoeboxPoolIntegrator(af::reflection_table reflections,
+                          const ShoeboxPool<> &shoebox_pool,
+                          const af::const_ref<int> &shoebox_index,
+                          const IntensityCalculatorIface &compute_intensity,
+                          std::size_t nthreads) {
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(shoebox_index.size() == reflections.size());
+      for (std::size_t i = 0; i < shoebox_index.size(); ++i) {
+        DIALS_ASSERT(shoebox_index[i] < (int)shoebox_pool.size());
+        DIALS_ASSERT(shoebox_index[i] < 0 || shoebox_pool.is_allocated());
+      }
+
+      // Index the bounding boxes to find the adjacent reflections
+      af::const_ref<std::size_t> panel =
+        reflections.get<std::size_t>("panel").const_ref();
+      af::const_ref<int6> bbox = reflections.get<int6>("bbox").const_ref();
+      OverlapIndex overlaps(bbox, panel);
+
+      // Fit the reflections, writing the results back to the table columns
+      af::ReflectionColumns reflection_columns(reflections);
+      boost::mutex mutex;
+      for_each_band(FitBand(shoebox_pool,
+                            shoebox_index,
+                            compute_intensity,
+                            overlaps,
+                            reflection_columns,
+                            mutex),
+                    (int)shoebox_index.size(),
+                    nthreads);
+      reflections_ = reflection_columns.table();
+    }
+
+    /**
+     * @returns The integrated reflections
+     */
+    af::reflection_table reflections() const {
+      return reflections_;
+    }
+
+  protected:
+    /**
+     * Fit a band of reflections
+     */
+    struct FitBand {
+      const ShoeboxPool<> &shoebox_pool;
+      af::const_ref<int> shoebox_index;
+      const IntensityCalculatorIface &compute_intensity;
+      const OverlapIndex &overlaps;
+      af::ReflectionColumns &reflection_list;
+      boost::mutex &mutex;
+
+      FitBand(const ShoeboxPool<> &shoebox_pool_,
+              const af::const_ref<int> &shoebox_index_,
+              const IntensityCalculatorIface &compute_intensity_,
+              const OverlapIndex &overlaps_,
+              af::ReflectionColumns &reflection_list_,
+              boost::mutex &mutex_)
+          : shoebox_pool(shoebox_pool_),
+            shoebox_index(shoebox_index_),
+            compute_intensity(compute_intensity_),
+            overlaps(overlaps_),
+            reflection_list(reflection_list_),
+            mutex(mutex_) {}
+
+      void operator()(int i0, int i1) const {
+        std::vector<std::size_t> adjacent;
+        for (int index = i0; index < i1; ++index) {
+          if (shoebox_index[index] < 0) {
+            continue;
+          }
+
+          // Get the reflection and the adjacent reflections
+          af::Reflection reflection;
+          std::vector<af::Reflection> adjacent_reflections;
+          adjacent.clear();
+          overlaps.find(index, adjacent);
+          {
+            boost::lock_guard<boost::mutex> guard(mutex);
+            reflection = reflection_list.get(index);
+            if (!adjacent.empty()) {
+              AdjacentReflectionColumns adjacent_columns(reflection_list);
+              adjacent_reflections.reserve(adjacent.size());
+              for (std::size_t i = 0; i < adjacent.size(); ++i) {
+                adjacent_reflections.push_back(adjacent_columns.get(adjacent[i]));
+              }
+            }
+          }
+
+          // Give the reflections the kept shoebox
+          reflection["shoebox"] = shoebox_pool.shoebox(shoebox_index[index]);
+          for (std::size_t i = 0; i < adjacent_reflections.size(); ++i) {
+            adjacent_reflections[i]["bbox"] = reflection.get<int6>("bbox");
+            adjacent_reflections[i]["shoebox"] =
+              reflection.get<Shoebox<> >("shoebox");
+          }
+
+          // Compute the profile fitted intensity
+          try {
+            compute_intensity(reflection, adjacent_reflections);
+          } catch (dials::error) {
+            std::size_t flags = reflection.get<std::size_t>("flags");
+            flags |= af::FailedDuringProfileFitting;
+            reflection["flags"] = flags;
+          }
+
+          // Set the reflection data without the shoebox
+          reflection.erase("shoebox");
+          boost::lock_guard<boost::mutex> guard(mutex);
+          reflection_list.set(index, reflection);
+        }
+      }
+    };
+
     af::reflection_table reflections_;
   };
 
@@ -19,11 +19,13 @@
 #include <numeric>
 #include <list>
 #include <vector>
-#include <ctime>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <dxtbx/imageset.h>
 #include <dials/model/data/image.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/boost_python/flex_table_suite.h>
+#include <dials/algorithms/integration/image_prefetcher.h>
 
 namespace dials { namespace algorithms {
 
@@ -33,11 +35,16 @@ namespace dials { namespace algorithms {
 
   /**
    * The cctbx build system is too messed up to figure out how to build
-   * boost::system need by boost::chrono. Therefore just use system clock
-   * to get a timestamp in ms
+   * boost::system need by boost::chrono. Therefore use the header only
+   * posix_time clock to get a wall clock timestamp in seconds. The processor
+   * clock cannot be used as it counts the time of all threads, including the
+   * thread reading the images.
    */
-  double timestamp() {
-    return ((double)clock()) / ((double)CLOCKS_PER_SEC);
+  inline double timestamp() {
+    static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return (boost::posix_time::microsec_clock::universal_time() - epoch)
+             .total_microseconds()
+           / 1e6;
   }
 
   /**
@@ -66,6 +73,9 @@ namespace dials { namespace algorithms {
         : data_(data),
           extract_time_(0.0),
           process_time_(0.0),
+          read_time_(0.0),
+          stall_time_(0.0),
+          num_stalls_(0),
           save_(save),
           npanels_(npanels),
           frame0_(frame0),
@@ -112,13 +122,132 @@ namespace dials { namespace algorithms {
 
     /**
      * Extract the pixels from the image and copy to the relevant shoeboxes.
+     * The reflections whose last frame is this image are then passed to the
+     * executor.
      * @param image The image to process
-     * @param frame The current image frame
+     * @param executor The executor to process the complete reflections
      */
     template <typename T>
     void next(const Image<T>& image, Executor& executor) {
-      using dials::af::boost_python::flex_table_suite::select_rows_index;
-      using dials::af::boost_python::flex_table_suite::set_selected_rows_index;
+      af::shared<std::size_t> process_indices = extract(image);
+      process_reflections(process_indices.const_ref(), executor);
+      frame_++;
+    }
+
+    /**
+     * Extract the pixels from all the images in the imageset and process the
+     * reflections as they are completed. The images are read and decoded by a
+     * separate thread up to num_prefetch images ahead of the image being
+     * extracted, so reading the next images overlaps with extracting the
+     * pixels of the current image. Reading an image and running the executor
+     * both need the python GIL, so this overlap is only with the extraction.
+     * The calling thread must hold the GIL.
+     * @param imageset The imageset for the frames of the processor
+     * @param executor The executor to process the complete reflections
+     * @param lookup_mask A mask to apply to each image (or empty)
+     * @param num_prefetch The number of images to read ahead
+     */
+    void process(dxtbx::ImageSet& imageset,
+                 Executor& executor,
+                 const af::const_ref<af::versa<bool, af::c_grid<2> > >& lookup_mask,
+                 std::size_t num_prefetch) {
+      DIALS_ASSERT(frame_ == frame0_);
+      DIALS_ASSERT(imageset.size() == nframes_);
+      DIALS_ASSERT(lookup_mask.size() == 0 || lookup_mask.size() == npanels_);
+
+      // Release the GIL while extracting so the images can be read. The
+      // prefetcher is destroyed before the GIL is restored.
+      detail::ScopedGILRelease release_gil;
+      ImagePrefetcher prefetcher(
+        imageset, ImagePrefetcher::FullMask, num_prefetch);
+      for (std::size_t i = 0; i < nframes_; ++i) {
+        af::shared<std::size_t> process_indices =
+          extract(frame_image(*prefetcher.next(), lookup_mask));
+        detail::ScopedGILAcquire gil;
+        process_reflections(process_indices.const_ref(), executor);
+        frame_++;
+      }
+      read_time_ += prefetcher.read_time();
+      stall_time_ += prefetcher.stall_time();
+      num_stalls_ += prefetcher.num_stalls();
+    }
+
+    /** @returns The first frame.  */
+    int frame0() const {
+      return frame0_;
+    }
+
+    /** @returns The last frame */
+    int frame1() const {
+      return frame1_;
+    }
+
+    /** @returns The current frame. */
+    int frame() const {
+      return frame_;
+    }
+
+    /** @returns The number of frames  */
+    std::size_t nframes() const {
+      return nframes_;
+    }
+
+    /** @returns The number of panels */
+    std::size_t npanels() const {
+      return npanels_;
+    }
+
+    /**
+     * @returns Is the extraction finished.
+     */
+    bool finished() const {
+      return frame_ == frame1_;
+    }
+
+    /**
+     * @returns The extract time
+     */
+    double extract_time() const {
+      return extract_time_;
+    }
+
+    /**
+     * @returns The process time
+     */
+    double process_time() const {
+      return process_time_;
+    }
+
+    /**
+     * @returns The time spent reading images in process
+     */
+    double read_time() const {
+      return read_time_;
+    }
+
+    /**
+     * @returns The time spent waiting for images to be read in process
+     */
+    double stall_time() const {
+      return stall_time_;
+    }
+
+    /**
+     * @returns The number of images which were not read when needed in process
+     */
+    std::size_t num_stalls() const {
+      return num_stalls_;
+    }
+
+  private:
+    /**
+     * Extract the pixels from the image and copy to the relevant shoeboxes,
+     * allocating the shoeboxes on their first frame.
+     * @param image The image to process
+     * @returns The indices of the reflections whose last frame is this image
+     */
+    template <typename T>
+    af::shared<std::size_t> extract(const Image<T>& image) {
       typedef Shoebox<>::float_type float_type;
       typedef af::ref<float_type, af::c_grid<3> > sbox_data_type;
       typedef af::ref<int, af::c_grid<3> > sbox_mask_type;
@@ -200,14 +329,25 @@ namespace dials { namespace algorithms {
       double end_time = timestamp();
       extract_time_ += end_time - start_time;
 
-      // Process all the reflections and set the reflections
-      if (process_indices.size() > 0) {
+      return process_indices;
+    }
+
+    /**
+     * Pass the reflections to the executor and copy back the results
+     * @param ind The indices of the reflections to process
+     * @param executor The executor
+     */
+    void process_reflections(const af::const_ref<std::size_t>& ind,
+                             Executor& executor) {
+      using dials::af::boost_python::flex_table_suite::select_rows_index;
+      using dials::af::boost_python::flex_table_suite::set_selected_rows_index;
+      if (ind.size() > 0) {
         double start_time = timestamp();
-        af::const_ref<std::size_t> ind = process_indices.const_ref();
         af::reflection_table reflections = select_rows_index(data_, ind);
         executor.process(frame_, reflections);
         set_selected_rows_index(data_, ind, reflections);
         if (!save_) {
+          af::ref<Shoebox<> > shoebox = data_["shoebox"];
           for (std::size_t i = 0; i < ind.size(); ++i) {
             shoebox[ind[i]].deallocate();
           }
@@ -215,58 +355,46 @@ namespace dials { namespace algorithms {
         double end_time = timestamp();
         process_time_ += end_time - start_time;
       }
-
-      // Update the frame counter
-      frame_++;
-    }
-
-    /** @returns The first frame.  */
-    int frame0() const {
-      return frame0_;
-    }
-
-    /** @returns The last frame */
-    int frame1() const {
-      return frame1_;
-    }
-
-    /** @returns The current frame. */
-    int frame() const {
-      return frame_;
-    }
-
-    /** @returns The number of frames  */
-    std::size_t nframes() const {
-      return nframes_;
-    }
-
-    /** @returns The number of panels */
-    std::size_t npanels() const {
-      return npanels_;
-    }
-
-    /**
-     * @returns Is the extraction finished.
-     */
-    bool finished() const {
-      return frame_ == frame1_;
-    }
-
-    /**
-     * @returns The extract time
-     */
-    double extract_time() const {
-      return extract_time_;
     }
 
     /**
-     * @returns The process time
+     * Make the image to extract from an image read by the prefetcher. The
+     * mask of a rejected image is false everywhere.
+     * @param frame The image data and mask
+     * @param lookup_mask A mask to apply to each panel (or empty)
+     * @returns The image
      */
-    double process_time() const {
-      return process_time_;
+    static Image<double> frame_image(
+      const ImagePrefetcher::Frame& frame,
+      const af::const_ref<af::versa<bool, af::c_grid<2> > >& lookup_mask) {
+      typedef af::versa<double, af::c_grid<2> > data_type;
+      typedef af::versa<bool, af::c_grid<2> > mask_type;
+      af::shared<data_type> data;
+      af::shared<mask_type> mask;
+      for (std::size_t p = 0; p < frame.data.n_tiles(); ++p) {
+        data_type d = frame.data.tile(p).data();
+        mask_type m;
+        if (frame.rejected) {
+          m = mask_type(d.accessor(), false);
+        } else {
+          DIALS_ASSERT(p < frame.mask.n_tiles());
+          m = frame.mask.tile(p).data();
+        }
+        if (lookup_mask.size() > 0) {
+          DIALS_ASSERT(p < lookup_mask.size());
+          DIALS_ASSERT(lookup_mask[p].accessor().all_eq(m.accessor()));
+          mask_type combined(m.accessor());
+          for (std::size_t i = 0; i < m.size(); ++i) {
+            combined[i] = lookup_mask[p][i] && m[i];
+          }
+          m = combined;
+        }
+        data.push_back(d);
+        mask.push_back(m);
+      }
+      return Image<double>(data.const_ref(), mask.const_ref());
     }
 
-  private:
     /**
      * Get an index array specifying which reflections are recorded on a given
      * frame and panel.
@@ -290,6 +418,9 @@ namespace dials { namespace algorithms {
     af::reflection_table data_;
     double extract_time_;
     double process_time_;
+    double read_time_;
+    double stall_time_;
+    std::size_t num_stalls_;
     bool flatten_;
     bool save_;
     std::size_t npanels_;
@@ -16,7 +16,6 @@
 import dials.algorithms.integration
 import dials.util
 from dials.array_family import flex
-from dials.model.data import make_image
 from dials.util import tabulate
 from dials.util.mp import multi_node_parallel_map
 from dials_algorithms_integration_integrator_ext import (
@@ -28,6 +27,7 @@
     ReflectionManager,
     ReflectionManagerPerImage,
     ShoeboxProcessor,
+    shoebox_pixels_per_frame,
 )
 
 try:
@@ -135,6 +135,9 @@ def __init__(self):
         self.threshold = 0.99
         self.force = False
         self.max_memory_usage = 0.90
+        self.memory_limit = None
+        self.prefetch = 2
+        self.balance = False
 
     def update(self, other):
         self.size = other.size
@@ -142,6 +145,9 @@ def update(self, other):
         self.threshold = other.threshold
         self.force = other.force
         self.max_memory_usage = other.max_memory_usage
+        self.memory_limit = other.memory_limit
+        self.prefetch = other.prefetch
+        self.balance = other.balance
 
 
 class Shoebox(object):
@@ -461,31 +467,22 @@ def __call__(self):
             self.params.debug.output,
         )
 
-        # Loop through the imageset, extract pixels and process reflections
-        read_time = 0.0
-        for i in range(len(imageset)):
-            st = time()
-            image = imageset.get_corrected_data(i)
-            if imageset.is_marked_for_rejection(i):
-                mask = tuple(flex.bool(im.accessor(), False) for im in image)
-            else:
-                mask = imageset.get_mask(i)
-                if self.params.lookup.mask is not None:
-                    assert len(mask) == len(
-                        self.params.lookup.mask
-                    ), "Mask/Image are incorrect size %d %d" % (
-                        len(mask),
-                        len(self.params.lookup.mask),
-                    )
-                    mask = tuple(
-                        m1 & m2 for m1, m2 in zip(self.params.lookup.mask, mask)
-                    )
-
-            read_time += time() - st
-            processor.next(make_image(image, mask), self.executor)
-            del image
-            del mask
+        # Loop through the imageset, extract pixels and process reflections.
+        # The images are read ahead on a separate thread while the pixels of
+        # the current image are extracted.
+        processor.process(
+            imageset,
+            self.executor,
+            lookup_mask=self.params.lookup.mask,
+            num_prefetch=self.params.block.prefetch,
+        )
         assert processor.finished(), "Data processor is not finished"
+        logger.debug(
+            "Waited for %d images (%.2f seconds) while reading %d images",
+            processor.num_stalls(),
+            processor.stall_time(),
+            len(imageset),
+        )
 
         # Optionally save the shoeboxes
         if self.params.debug.output and self.params.debug.separate_files:
@@ -512,7 +509,7 @@ def __call__(self):
             index=self.index,
             reflections=self.reflections,
             data=self.executor.data(),
-            read_time=read_time,
+            read_time=processor.read_time(),
             extract_time=processor.extract_time(),
             process_time=processor.process_time(),
             total_time=time() - start_time,
@@ -564,12 +561,18 @@ def initialize(self):
 
         # Compute the block size and processors
         self.compute_jobs()
+        self.limit_block_size()
         self.split_reflections()
         self.compute_processors()
 
         # Create the reflection manager
         self.manager = ReflectionManager(self.jobs, self.reflections)
 
+        # Open the file to save the results of each job as it finishes
+        self.checkpoint = None
+        if self.params.checkpoint is not None:
+            self.checkpoint = flex.reflection_table_file_writer(self.params.checkpoint)
+
         # Parallel reading of HDF5 from the same handle is not allowed. Python
         # multiprocessing is a bit messed up and used fork on linux so need to
         # close and reopen file.
@@ -616,6 +619,8 @@ def tasks(self):
     def accumulate(self, result):
         """Accumulate the results."""
         self.data[result.index] = result.data
+        if self.checkpoint is not None:
+            self.checkpoint.append(result.reflections)
         self.manager.accumulate(result.index, result.reflections)
         self.time.read += result.read_time
         self.time.extract += result.extract_time
@@ -632,6 +637,11 @@ def finalize(self):
         # Check manager is finished
         assert self.manager.finished(), "Manager is not finished"
 
+        # Close the file of the results of each job
+        if self.checkpoint is not None:
+            self.checkpoint.close()
+            self.checkpoint = None
+
         # Update the time and finalized flag
         self.time.finalize = time() - start_time
         self.finalized = True
@@ -661,9 +671,11 @@ def __len__(self):
         """
         return len(self.manager)
 
-    def compute_jobs(self):
+    def compute_jobs(self, max_block_size=None):
         """
         Sets up a JobList() object in self.jobs
+
+        :param max_block_size: The maximum number of frames in a block
         """
 
         if self.params.block.size == libtbx.Auto:
@@ -683,6 +695,7 @@ def compute_jobs(self):
             frames_per_refl = sorted([b[5] - b[4] for b in self.reflections["bbox"]])
             cutoff = int(self.params.block.threshold * len(frames_per_refl))
             block_overlap = frames_per_refl[cutoff]
+        self._block_overlap = block_overlap
 
         groups = itertools.groupby(
             range(len(self.experiments)),
@@ -715,6 +728,16 @@ def compute_jobs(self):
                 # increase the block size to be at least twice the overlap, in
                 # case the overlap is large e.g. if high mosaicity.
                 block_size_frames = max(block_size, 2 * block_overlap)
+                if self.params.block.balance and max_block_size is None:
+                    # split the frames so each block has a similar number of
+                    # shoebox pixels rather than a similar number of frames
+                    work = shoebox_pixels_per_frame(
+                        self.reflections, (i0, i1), array_range
+                    )
+                    self.jobs.add_balanced(
+                        (i0, i1), array_range, work, nblocks, block_overlap
+                    )
+                    continue
             elif self.params.block.units == "radians":
                 _, dphi = scan.get_oscillation(deg=False)
                 block_size_frames = int(math.ceil(self.params.block.size / dphi))
@@ -734,6 +757,9 @@ def compute_jobs(self):
                 raise RuntimeError(
                     "Unknown block_size units %r" % self.params.block.units
                 )
+            if max_block_size is not None and block_size_frames > max_block_size:
+                block_size_frames = max_block_size
+                block_overlap = min(block_overlap, int(block_size_frames // 2))
             self.jobs.add(
                 (i0, i1),
                 array_range,
@@ -742,6 +768,48 @@ def compute_jobs(self):
             )
         assert len(self.jobs) > 0, "Invalid number of jobs"
 
+    def limit_block_size(self):
+        """
+        Reduce the block size if the shoeboxes of the largest job would not fit
+        in the memory available. If the block size is determined automatically
+        it is reduced until one job can run on each processor, but not below
+        twice the block overlap. In any case it is then reduced until a single
+        job fits, and the number of processors is reduced later if needed.
+        """
+        _, memory_limit, _ = self._memory_limits()
+
+        def memory_required():
+            return flex.max(
+                self.jobs.shoebox_memory_estimate(
+                    self.reflections, self.params.shoebox.flatten
+                )
+            )
+
+        nproc = 1
+        if self.params.mp.method == "multiprocessing":
+            nproc = self.params.mp.nproc
+        targets = [(memory_limit, 1)]
+        if self.params.block.size in (None, libtbx.Auto) and nproc > 1:
+            min_frames = max(1, 2 * self._block_overlap)
+            targets.insert(0, (memory_limit / nproc, min_frames))
+
+        initial_frames = max(job.nframes() for job in self.jobs)
+        block_frames = initial_frames
+        memory = memory_required()
+        for target, min_frames in targets:
+            while memory > target and block_frames > min_frames:
+                block_frames = max(min_frames, block_frames // 2)
+                self.compute_jobs(max_block_size=block_frames)
+                memory = memory_required()
+        if block_frames < initial_frames:
+            logger.warning(
+                "Reducing the block size from %d to %d frames due to memory"
+                " constraints (%.1f GB estimated per process)\n",
+                initial_frames,
+                block_frames,
+                memory / 1e9,
+            )
+
     def split_reflections(self):
         """
         Split the reflections into partials or over job boundaries
@@ -771,18 +839,18 @@ def split_reflections(self):
                 )
 
         # Compute the partiality
-        self.reflections.compute_partiality(self.experiments)
+        self.reflections.compute_partiality(
+            self.experiments, nthreads=self.params.mp.nproc
+        )
 
-    def compute_processors(self):
+    def _memory_limits(self):
         """
-        Compute the number of processors
-        """
-
-        # Get the maximum shoebox memory to estimate memory use for one process
-        memory_required_per_process = flex.max(
-            self.jobs.shoebox_memory(self.reflections, self.params.shoebox.flatten)
-        )
+        Find the memory available for processing, from the system memory, any
+        ulimit and the memory limit in the parameters.
 
+        :return: A report on the memory, the memory limit excluding swap and the
+                 memory limit including swap in bytes
+        """
         # Obtain information about system memory
         available_memory = psutil.virtual_memory().available
         available_swap = psutil.swap_memory().free
@@ -811,7 +879,6 @@ def _report(description, value):
             "Maximum memory for processing (excluding swap)",
             available_immediate_limit / 1e9,
         )
-        _report("Memory required per process", memory_required_per_process / 1e9)
 
         # Check if a ulimit applies
         # Note that resource may be None on non-Linux platforms.
@@ -850,6 +917,32 @@ def _report(description, value):
                     "Could not obtain ulimit values due to %s", str(e), exc_info=True
                 )
 
+        # Apply the user memory limit
+        available_limit = available_incl_swap * self.params.block.max_memory_usage
+        if self.params.block.memory_limit is not None:
+            memory_limit = self.params.block.memory_limit * 1e9
+            _report("Memory limit requested", memory_limit / 1e9)
+            available_limit = min(available_limit, memory_limit)
+            available_immediate_limit = min(available_immediate_limit, memory_limit)
+
+        return report, available_immediate_limit, available_limit
+
+    def compute_processors(self):
+        """
+        Compute the number of processors
+        """
+
+        # Get the maximum shoebox memory to estimate memory use for one process
+        memory_required_per_process = flex.max(
+            self.jobs.shoebox_memory(self.reflections, self.params.shoebox.flatten)
+        )
+
+        report, available_immediate_limit, available_limit = self._memory_limits()
+        report.append(
+            "  %-50s:%5.1f GB"
+            % ("Memory required per process", memory_required_per_process / 1e9)
+        )
+
         output_level = logging.INFO
 
         # Limit the number of parallel processes by amount of available memory
@@ -868,10 +961,7 @@ def _report(description, value):
                     % (self.params.mp.nproc, int(njobs))
                 )
                 self.params.mp.nproc = int(njobs)
-            elif (
-                available_incl_swap * self.params.block.max_memory_usage
-                >= memory_required_per_process
-            ):
+            elif available_limit >= memory_required_per_process:
                 # There is enough memory to run, but only if we count swap.
                 output_level = logging.WARNING
                 report.append(
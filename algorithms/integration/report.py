@@ -288,9 +288,23 @@ def select(data, indices):
     # Create the report binned by image
     image = binned_report(frame_binner, data["xyzcal.px"].parts()[2], data)
 
+    # Count the number of profile fitting iterations
+    niter = collections.OrderedDict()
+    if "profile.niter" in reflections:
+        counts = collections.Counter(
+            reflections["profile.niter"].select(data["prf"])
+        )
+        for key in sorted(counts):
+            niter[key] = counts[key]
+
     # Return the report
     return collections.OrderedDict(
-        [("summary", summary), ("resolution", resolution), ("image", image)]
+        [
+            ("summary", summary),
+            ("resolution", resolution),
+            ("image", image),
+            ("niter", niter),
+        ]
     )
 
 
@@ -439,6 +453,19 @@ def __init__(self, experiments, reflections):
                 )
             self.add_table(table)
 
+        # Construct the table of profile fitting iterations
+        table = Table()
+        table.name = "integration.profile.iterations"
+        table.title = "Profile fitting iterations"
+        table.cols.append(("id", "ID"))
+        table.cols.append(("niter", "# iterations"))
+        table.cols.append(("n_prf", "# prf"))
+        for j, report in enumerate(report_list):
+            for niter, count in six.iteritems(report["niter"]):
+                table.rows.append(["%d" % j, "%d" % niter, "%d" % count])
+        if table.rows:
+            self.add_table(table)
+
 
 class ProfileModelReport(Report):
     """
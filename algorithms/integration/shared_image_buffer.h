@@ -0,0 +1,315 @@
+/*
+ * shared_image_buffer.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_SHARED_IMAGE_BUFFER_H
+#define DIALS_ALGORITHMS_INTEGRATION_SHARED_IMAGE_BUFFER_H
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+#endif
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/sync/interprocess_condition.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/noncopyable.hpp>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * A block of image data held in a named POSIX shared memory segment so that
+   * several integration processes on the same node can share the decoded
+   * images. The first process to need an image decodes it into the segment and
+   * the other processes then use it without decoding it again.
+   *
+   * The segment contains a header with the process shared mutex, a state for
+   * each image and the data array for each panel. The segment is created by
+   * the first process to attach to it and removed when the last process
+   * detaches. All the processes must use the same images, detector and masks.
+   * The caller gives a name which is unique to the imageset, the image range
+   * is added to it and the detector geometry is checked when attaching.
+   *
+   * The process loading an image is recorded with its state. A process waiting
+   * for an image checks every second whether that process is still running,
+   * and if it has died the image is loaded again, so a crashed process does
+   * not leave the others waiting forever.
+   */
+  template <typename FloatType>
+  class SharedImageBuffer : public boost::noncopyable {
+  public:
+    typedef FloatType float_type;
+
+    /**
+     * The state of an image in the buffer
+     */
+    enum State { Empty = 0, Loading = 1, Ready = 2 };
+
+    /**
+     * Create or attach to the shared memory segment
+     * @param name The base name of the segment
+     * @param first_image The first image in the buffer
+     * @param num_images The number of images
+     * @param panel_size The (ysize, xsize) of each panel
+     */
+    SharedImageBuffer(const std::string &name,
+                      int first_image,
+                      std::size_t num_images,
+                      const std::vector<std::size_t> &panel_size)
+        : name_(segment_name(name, first_image, num_images)),
+          num_images_(num_images),
+          header_(NULL) {
+      using namespace boost::interprocess;
+      DIALS_ASSERT(!name.empty());
+      DIALS_ASSERT(num_images > 0);
+      DIALS_ASSERT(panel_size.size() > 0 && panel_size.size() % 2 == 0);
+
+      // Compute the size of the segment with some room for the allocator
+      std::size_t num_panels = panel_size.size() / 2;
+      std::size_t nbytes = 65536 + sizeof(Header);
+      nbytes += num_images * sizeof(int) + panel_size.size() * sizeof(std::size_t);
+      for (std::size_t i = 0; i < num_panels; ++i) {
+        nbytes += num_images * panel_size[2 * i] * panel_size[2 * i + 1]
+                    * sizeof(float_type)
+                  + 1024;
+      }
+
+      // Create or open the segment and find the objects within it
+      segment_ = managed_shared_memory(open_or_create, name_.c_str(), nbytes);
+      header_ = segment_.find_or_construct<Header>("header")();
+      state_ = segment_.find_or_construct<int>("state")[num_images](Empty);
+      owner_ = segment_.find_or_construct<long>("owner")[num_images](0);
+      std::size_t *geometry =
+        segment_.find_or_construct<std::size_t>("geometry")[panel_size.size()](0);
+
+      // Register this process and check the geometry
+      bool valid = false;
+      {
+        scoped_lock<interprocess_mutex> lock(header_->mutex);
+        header_->num_users++;
+        valid = segment_.find<std::size_t>("geometry").second == panel_size.size();
+        if (valid && geometry[0] == 0) {
+          std::copy(panel_size.begin(), panel_size.end(), geometry);
+        }
+        valid = valid && std::equal(panel_size.begin(), panel_size.end(), geometry);
+      }
+      if (!valid) {
+        detach();
+        throw DIALS_ERROR("Shared image buffer " + name_ + " has a different detector");
+      }
+
+      // Get the panel data arrays
+      for (std::size_t i = 0; i < num_panels; ++i) {
+        std::ostringstream data_name;
+        data_name << "data_" << i;
+        std::size_t size = num_images * panel_size[2 * i] * panel_size[2 * i + 1];
+        data_.push_back(
+          segment_.find_or_construct<float_type>(data_name.str().c_str())[size](0));
+      }
+    }
+
+    /**
+     * Detach from the segment. The segment is removed when the last process
+     * detaches.
+     */
+    ~SharedImageBuffer() {
+      detach();
+    }
+
+    /**
+     * @returns The name of the shared memory segment
+     */
+    const std::string &name() const {
+      return name_;
+    }
+
+    /**
+     * @returns The number of images
+     */
+    std::size_t num_images() const {
+      return num_images_;
+    }
+
+    /**
+     * @param panel The panel number
+     * @returns A pointer to the data for the panel
+     */
+    float_type *data(std::size_t panel) const {
+      DIALS_ASSERT(panel < data_.size());
+      return data_[panel];
+    }
+
+    /**
+     * @param index The image index
+     * @returns True/False the image has been loaded
+     */
+    bool is_ready(std::size_t index) const {
+      using namespace boost::interprocess;
+      DIALS_ASSERT(index < num_images_);
+      scoped_lock<interprocess_mutex> lock(header_->mutex);
+      return state_[index] == Ready;
+    }
+
+    /**
+     * Acquire an image for loading. If the image is being loaded by another
+     * process then wait for it to finish. If that process has died without
+     * finishing then the image is acquired by this process instead.
+     * @param index The image index
+     * @returns True if the caller must load the image, False if it is ready
+     */
+    bool acquire(std::size_t index) {
+      using namespace boost::interprocess;
+      DIALS_ASSERT(index < num_images_);
+      scoped_lock<interprocess_mutex> lock(header_->mutex);
+      while (state_[index] == Loading) {
+        boost::posix_time::ptime timeout =
+          boost::posix_time::microsec_clock::universal_time()
+          + boost::posix_time::seconds(1);
+        if (!header_->condition.timed_wait(lock, timeout)
+            && state_[index] == Loading && !is_running(owner_[index])) {
+          state_[index] = Empty;
+        }
+      }
+      if (state_[index] == Ready) {
+        return false;
+      }
+      state_[index] = Loading;
+      owner_[index] = current_process();
+      return true;
+    }
+
+    /**
+     * Mark an acquired image as loaded
+     * @param index The image index
+     */
+    void release(std::size_t index) {
+      set_state(index, Ready);
+    }
+
+    /**
+     * Give up loading an acquired image so that another process can load it
+     * @param index The image index
+     */
+    void abandon(std::size_t index) {
+      set_state(index, Empty);
+    }
+
+    /**
+     * Remove a segment left behind by processes which did not exit cleanly
+     * @param name The base name of the segment
+     * @param first_image The first image in the buffer
+     * @param num_images The number of images
+     */
+    static bool remove(const std::string &name,
+                       int first_image,
+                       std::size_t num_images) {
+      return boost::interprocess::shared_memory_object::remove(
+        segment_name(name, first_image, num_images).c_str());
+    }
+
+  protected:
+    /**
+     * The header at the start of the segment
+     */
+    struct Header {
+      boost::interprocess::interprocess_mutex mutex;
+      boost::interprocess::interprocess_condition condition;
+      std::size_t num_users;
+      Header() : num_users(0) {}
+    };
+
+    /**
+     * @returns The segment name for the image range
+     */
+    static std::string segment_name(const std::string &name,
+                                    int first_image,
+                                    std::size_t num_images) {
+      std::ostringstream result;
+      result << name << "_" << first_image << "_" << num_images;
+      return result.str();
+    }
+
+    /**
+     * @returns The id of this process
+     */
+    static long current_process() {
+#ifdef _WIN32
+      return (long)GetCurrentProcessId();
+#else
+      return (long)getpid();
+#endif
+    }
+
+    /**
+     * @param pid The id of a process
+     * @returns True/False the process is running
+     */
+    static bool is_running(long pid) {
+#ifdef _WIN32
+      HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+      if (process == NULL) {
+        return false;
+      }
+      bool running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+      CloseHandle(process);
+      return running;
+#else
+      return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+    }
+
+    void set_state(std::size_t index, State state) {
+      using namespace boost::interprocess;
+      DIALS_ASSERT(index < num_images_);
+      {
+        scoped_lock<interprocess_mutex> lock(header_->mutex);
+        DIALS_ASSERT(state_[index] == Loading);
+        state_[index] = state;
+        owner_[index] = 0;
+      }
+      header_->condition.notify_all();
+    }
+
+    void detach() {
+      using namespace boost::interprocess;
+      if (header_ == NULL) {
+        return;
+      }
+      bool last = false;
+      {
+        scoped_lock<interprocess_mutex> lock(header_->mutex);
+        DIALS_ASSERT(header_->num_users > 0);
+        last = (--header_->num_users == 0);
+      }
+      header_ = NULL;
+      if (last) {
+        shared_memory_object::remove(name_.c_str());
+      }
+    }
+
+    std::string name_;
+    std::size_t num_images_;
+    boost::interprocess::managed_shared_memory segment_;
+    Header *header_;
+    int *state_;
+    long *owner_;
+    std::vector<float_type *> data_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_SHARED_IMAGE_BUFFER_H
@@ -0,0 +1,127 @@
+/*
+ * shoebox_arena.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_INTEGRATION_SHOEBOX_ARENA_H
+#define DIALS_ALGORITHMS_INTEGRATION_SHOEBOX_ARENA_H
+
+#include <algorithm>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/tss.hpp>
+#include <dials/model/data/shoebox.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dials::model::Shoebox;
+
+  /**
+   * Scratch storage for the shoebox arrays of the reflections integrated by a
+   * single thread. The arrays handed out to a shoebox share their memory with
+   * the arena; once the job has finished with the shoebox and dropped all
+   * references to it, the memory is reused for the next shoebox rather than
+   * being returned to the global allocator. If a shoebox is kept (e.g. for
+   * debugging) then the arena simply allocates new arrays for the next one.
+   *
+   * An arena must only be used by one thread; use ShoeboxArena::local() to get
+   * the arena for the calling thread.
+   */
+  class ShoeboxArena : public boost::noncopyable {
+  public:
+    typedef Shoebox<>::float_type float_type;
+
+    ShoeboxArena()
+        : data_(af::c_grid<3>(0, 0, 0)),
+          mask_(af::c_grid<3>(0, 0, 0)),
+          background_(af::c_grid<3>(0, 0, 0)),
+          num_allocated_(0),
+          num_reused_(0) {}
+
+    /**
+     * @returns The arena for the calling thread
+     */
+    static ShoeboxArena &local() {
+      static boost::thread_specific_ptr<ShoeboxArena> arena;
+      if (arena.get() == NULL) {
+        arena.reset(new ShoeboxArena());
+      }
+      return *arena;
+    }
+
+    /**
+     * Allocate the shoebox arrays from the bounding box with all values set to
+     * zero. This is equivalent to Shoebox::allocate.
+     * @param sbox The shoebox
+     */
+    void allocate(Shoebox<> &sbox) {
+      std::size_t zs = sbox.flat ? 1 : sbox.zsize();
+      af::c_grid<3> accessor(zs, sbox.ysize(), sbox.xsize());
+      bool reused = acquire(data_, accessor, sbox.data);
+      reused &= acquire(mask_, accessor, sbox.mask);
+      reused &= acquire(background_, accessor, sbox.background);
+      if (reused) {
+        num_reused_++;
+      } else {
+        num_allocated_++;
+      }
+    }
+
+    /**
+     * @returns The number of shoeboxes which needed new memory
+     */
+    std::size_t num_allocated() const {
+      return num_allocated_;
+    }
+
+    /**
+     * @returns The number of shoeboxes which reused the arena memory
+     */
+    std::size_t num_reused() const {
+      return num_reused_;
+    }
+
+    /**
+     * @returns The number of bytes held by the arena
+     */
+    std::size_t nbytes() const {
+      return data_.capacity() * sizeof(float_type) + mask_.capacity() * sizeof(int)
+             + background_.capacity() * sizeof(float_type);
+    }
+
+  protected:
+    /**
+     * Size an array for the shoebox, reusing the arena memory if nothing else
+     * refers to it and it is large enough.
+     * @param store The arena array
+     * @param accessor The size of the shoebox
+     * @param result The array for the shoebox
+     * @returns True if the memory was reused
+     */
+    template <typename T>
+    static bool acquire(af::versa<T, af::c_grid<3> > &store,
+                        const af::c_grid<3> &accessor,
+                        af::versa<T, af::c_grid<3> > &result) {
+      bool reused = store.use_count() == 1 && store.capacity() >= accessor.size_1d();
+      if (store.use_count() != 1) {
+        store = af::versa<T, af::c_grid<3> >(accessor);
+      }
+      store.resize(accessor);
+      std::fill(store.begin(), store.end(), T(0));
+      result = store;
+      return reused;
+    }
+
+    af::versa<float_type, af::c_grid<3> > data_;
+    af::versa<int, af::c_grid<3> > mask_;
+    af::versa<float_type, af::c_grid<3> > background_;
+    std::size_t num_allocated_;
+    std::size_t num_reused_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_INTEGRATION_SHOEBOX_ARENA_H
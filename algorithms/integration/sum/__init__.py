@@ -3,35 +3,46 @@
 import typing
 
 from dials_algorithms_integration_sum_ext import *  # noqa: F403; lgtm
-from dials_algorithms_integration_sum_ext import sum_image_volume
+from dials_algorithms_integration_sum_ext import sum_image_volume, sum_shoebox_pool
 
 __all__ = (  # noqa: F405
     "SummationDouble",
     "SummationFloat",
     "integrate_by_summation",
     "sum_image_volume",
+    "sum_shoebox_pool",
     "sum_integrate_and_update_table",
 )
 
 if typing.TYPE_CHECKING:
     from dials.array_family.flex import reflection_table
-    from dials.model.data import MultiPanelImageVolume
+    from dials.model.data import MultiPanelImageVolume, ShoeboxPool
 
 
-def sum_integrate_and_update_table(reflections, image_volume=None):
-    # type: (reflection_table, MultiPanelImageVolume) -> reflection_table
+def sum_integrate_and_update_table(
+    reflections, image_volume=None, shoebox_pool=None, nthreads=1
+):
+    # type: (reflection_table, MultiPanelImageVolume, ShoeboxPool, int) -> reflection_table
     """Perform 3D summation integration and update a reflection table.
 
     Arguments:
         reflections: The reflections to integrate
+        image_volume: The image volume holding the pixels, if any
+        shoebox_pool: A shoebox pool holding the pixels of the reflections,
+            which are then summed in place and written directly to the table
+        nthreads: The number of threads to use
 
     Returns:
         The integrated reflections
     """
 
     # Integrate and return the reflections
+    if shoebox_pool is not None:
+        success = sum_shoebox_pool(shoebox_pool, reflections, nthreads=nthreads)
+        reflections.set_flags(success, reflections.flags.integrated_sum)
+        return success
     if image_volume is None:
-        intensity = reflections["shoebox"].summed_intensity()
+        intensity = reflections["shoebox"].summed_intensity(nthreads=nthreads)
     else:
         intensity = sum_image_volume(reflections, image_volume)
     reflections["intensity.sum.value"] = intensity.observed_value()
@@ -13,6 +13,7 @@
 #include <dials/algorithms/integration/sum/summation.h>
 #include <dials/algorithms/integration/sum/sum_image_volume.h>
 #include <dials/algorithms/shoebox/mask_code.h>
+#include <dials/array_family/reflection_table.h>
 
 using namespace boost::python;
 
@@ -93,6 +94,28 @@ namespace dials { namespace algorithms { namespace boost_python {
          boost::python::arg("mask")));
   }
 
+  /**
+   * Integrate the shoeboxes in a pool and write the intensity.sum and
+   * background.sum columns of the reflection table
+   * @returns Was the summation successful for each reflection
+   */
+  template <typename FloatType>
+  af::shared<bool> sum_shoebox_pool_and_update_table(
+    const model::ShoeboxPool<FloatType> &pool,
+    af::reflection_table reflections,
+    std::size_t nthreads) {
+    DIALS_ASSERT(reflections.nrows() == pool.size());
+    af::shared<bool> success(pool.size(), false);
+    sum_shoebox_pool(pool,
+                     reflections.get<double>("intensity.sum.value").ref(),
+                     reflections.get<double>("intensity.sum.variance").ref(),
+                     reflections.get<double>("background.sum.value").ref(),
+                     reflections.get<double>("background.sum.variance").ref(),
+                     success.ref(),
+                     nthreads);
+    return success;
+  }
+
   void export_summation() {
     summation_wrapper<float>("SummationFloat");
     summation_wrapper<double>("SummationDouble");
@@ -101,6 +124,12 @@ namespace dials { namespace algorithms { namespace boost_python {
     summation_suite<double>();
 
     def("sum_image_volume", &sum_multi_panel_image_volume<float>);
+
+    def("sum_shoebox_pool",
+        &sum_shoebox_pool_and_update_table<ProfileFloatType>,
+        (boost::python::arg("pool"),
+         boost::python::arg("reflections"),
+         boost::python::arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
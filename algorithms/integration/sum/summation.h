@@ -15,7 +15,9 @@
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/tiny_algebra.h>
 #include <dials/model/data/mask_code.h>
+#include <dials/model/data/shoebox_pool.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -169,6 +171,114 @@ namespace dials { namespace algorithms {
     bool success_;
   };
 
+  namespace detail {
+
+    /**
+     * Sum the intensity of a band of the shoeboxes in a pool, giving the same
+     * results as Summation. The mask tests are done without branches so the
+     * loop over the pixels of each shoebox can be vectorised by the compiler.
+     * The sums are accumulated in the same order as in Summation so the
+     * results are identical.
+     */
+    template <typename FloatType>
+    struct SumShoeboxPoolBand {
+      const model::ShoeboxPool<FloatType> &pool;
+      af::ref<double> value;
+      af::ref<double> variance;
+      af::ref<double> background;
+      af::ref<double> background_variance;
+      af::ref<bool> success;
+
+      SumShoeboxPoolBand(const model::ShoeboxPool<FloatType> &pool_,
+                         af::ref<double> value_,
+                         af::ref<double> variance_,
+                         af::ref<double> background_,
+                         af::ref<double> background_variance_,
+                         af::ref<bool> success_)
+          : pool(pool_),
+            value(value_),
+            variance(variance_),
+            background(background_),
+            background_variance(background_variance_),
+            success(success_) {}
+
+      void operator()(int i0, int i1) const {
+        const int bg_code = Valid | Background | BackgroundUsed;
+        const int fg_code = Valid | Foreground | Overlapped;
+        const FloatType *data = pool.data().begin();
+        const FloatType *bgrd = pool.background().begin();
+        const typename model::ShoeboxPool<FloatType>::mask_type *mask =
+          pool.mask().begin();
+        for (int i = i0; i < i1; ++i) {
+          std::size_t k0 = pool.offset(i);
+          std::size_t k1 = pool.offset(i + 1);
+          FloatType sum_p = 0;
+          FloatType sum_b = 0;
+          std::size_t n_signal = 0;
+          std::size_t n_background = 0;
+          std::size_t n_bad = 0;
+          for (std::size_t k = k0; k < k1; ++k) {
+            int m = mask[k];
+            bool fg = (m & Foreground) != 0;
+            bool good = (m & fg_code) == (Valid | Foreground);
+            bool bg = !fg && (m & bg_code) == bg_code;
+            sum_p += good ? data[k] : FloatType(0);
+            sum_b += good ? bgrd[k] : FloatType(0);
+            n_signal += good;
+            n_bad += fg && !good;
+            n_background += bg;
+          }
+          FloatType m_n =
+            n_background > 0 ? (FloatType)n_signal / (FloatType)n_background : 0.0;
+          FloatType Is = sum_p - sum_b;
+          FloatType Vs = std::abs(Is) + std::abs(sum_b) * (1.0 + m_n);
+          FloatType Vb = std::abs(sum_b) * (1.0 + m_n);
+          value[i] = Is;
+          variance[i] = Vs;
+          background[i] = sum_b;
+          background_variance[i] = Vb;
+          success[i] = n_bad == 0;
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Perform summation integration of all the shoeboxes in a pool, writing
+   * the results directly into the given arrays rather than creating a
+   * Summation object for each shoebox.
+   * @param pool The shoebox pool
+   * @param value The summed intensity
+   * @param variance The variance of the summed intensity
+   * @param background The summed background
+   * @param background_variance The variance of the summed background
+   * @param success Was the summation successful
+   * @param nthreads The number of threads to use
+   */
+  template <typename FloatType>
+  void sum_shoebox_pool(const model::ShoeboxPool<FloatType> &pool,
+                        af::ref<double> value,
+                        af::ref<double> variance,
+                        af::ref<double> background,
+                        af::ref<double> background_variance,
+                        af::ref<bool> success,
+                        std::size_t nthreads = 1) {
+    DIALS_ASSERT(value.size() == pool.size());
+    DIALS_ASSERT(variance.size() == pool.size());
+    DIALS_ASSERT(background.size() == pool.size());
+    DIALS_ASSERT(background_variance.size() == pool.size());
+    DIALS_ASSERT(success.size() == pool.size());
+    if (pool.size() == 0) {
+      return;
+    }
+    DIALS_ASSERT(pool.is_allocated());
+    for_each_band(detail::SumShoeboxPoolBand<FloatType>(
+                    pool, value, variance, background, background_variance, success),
+                  (int)pool.size(),
+                  nthreads);
+  }
+
 }}  // namespace dials::algorithms
 
 #endif /* DIALS_ALGORITHMS_INTEGRATION_SUMMATION_H */
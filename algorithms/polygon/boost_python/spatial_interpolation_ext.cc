@@ -31,6 +31,17 @@ namespace dials { namespace algorithms { namespace polygon {
 
       def("regrid_irregular_grid_to_grid", &regrid_irregular_grid_to_grid);
       def("regrid_grid_to_irregular_grid", &regrid_grid_to_irregular_grid);
+
+      class_<RegridMatrix>("RegridMatrix", no_init)
+        .def("apply", &RegridMatrix::apply, (arg("input"), arg("nthreads") = 1))
+        .def("__len__", &RegridMatrix::size);
+
+      def("irregular_grid_to_grid_matrix",
+          &irregular_grid_to_grid_matrix,
+          (arg("inputxy"), arg("output_size"), arg("nthreads") = 1));
+      def("grid_to_irregular_grid_matrix",
+          &grid_to_irregular_grid_matrix,
+          (arg("outputxy"), arg("input_size"), arg("nthreads") = 1));
     }
 
     BOOST_PYTHON_MODULE(dials_algorithms_polygon_spatial_interpolation_ext) {
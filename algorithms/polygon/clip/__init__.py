@@ -5,6 +5,9 @@
 __all__ = (  # noqa: F405
     "line_with_rect",
     "quad_with_convex_quad",
+    "quad_with_grid_area",
+    "quad_with_rect",
+    "quad_with_rect_area",
     "quad_with_triangle",
     "simple_with_convex",
     "simple_with_rect",
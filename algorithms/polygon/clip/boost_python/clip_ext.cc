@@ -34,6 +34,11 @@ namespace dials { namespace algorithms { namespace polygon { namespace clip {
       def("quad_with_convex_quad",
           &quad_with_convex_quad,
           (arg("subject"), arg("target")));
+      def("quad_with_rect", &quad_with_rect, (arg("subject"), arg("rect")));
+      def("quad_with_rect_area", &quad_with_rect_area, (arg("subject"), arg("rect")));
+      def("quad_with_grid_area",
+          &quad_with_grid_area,
+          (arg("subject"), arg("x0"), arg("x1"), arg("y0"), arg("y1")));
       def("line_with_rect", &line_with_rect, (arg("line"), arg("rect")));
     }
 
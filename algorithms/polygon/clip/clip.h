@@ -16,6 +16,7 @@
 #include <scitbx/array_family/small.h>
 #include <dials/algorithms/polygon/clip/cohen_sutherland.h>
 #include <dials/algorithms/polygon/clip/sutherland_hodgman.h>
+#include <dials/algorithms/polygon/area.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 
 namespace dials { namespace algorithms { namespace polygon { namespace clip {
@@ -101,6 +102,106 @@ namespace dials { namespace algorithms { namespace polygon { namespace clip {
     return sutherland_hodgman_simple_convex<vert4, vert4, vert8, 8>(subject, target);
   }
 
+  /**
+   * Clip a quad with the strip y0 <= y <= y1. Each side of the strip adds at
+   * most one vertex, so the result is held in a fixed size polygon.
+   * @param subject The subject polygon
+   * @param y0 The bottom of the strip
+   * @param y1 The top of the strip
+   * @returns The intersecting polygon
+   */
+  inline vert6 quad_with_y_range(const vert4 &subject, double y0, double y1) {
+    vert2 rect(vec2<double>(0, y0), vec2<double>(0, y1));
+    vert6 poly(subject.begin(), subject.end());
+    vert6 result;
+    sutherland_hodgman_rect_line<BOTTOM>(result, poly, rect);
+    poly.clear();
+    sutherland_hodgman_rect_line<TOP>(poly, result, rect);
+    return poly;
+  }
+
+  /**
+   * Clip a polygon of up to six vertices, such as a quad clipped by
+   * quad_with_y_range, with the strip x0 <= x <= x1.
+   * @param subject The subject polygon
+   * @param x0 The left of the strip
+   * @param x1 The right of the strip
+   * @returns The intersecting polygon
+   */
+  inline vert8 hexagon_with_x_range(const vert6 &subject, double x0, double x1) {
+    vert2 rect(vec2<double>(x0, 0), vec2<double>(x1, 0));
+    vert8 poly(subject.begin(), subject.end());
+    vert8 result;
+    sutherland_hodgman_rect_line<LEFT>(result, poly, rect);
+    poly.clear();
+    sutherland_hodgman_rect_line<RIGHT>(poly, result, rect);
+    return poly;
+  }
+
+  /**
+   * Clip a quad with an axis aligned rectangle using the sutherland_hodman
+   * algorithm. Unlike simple_with_rect, no memory is allocated.
+   * @param subject The subject polygon
+   * @param rect The clip rectangle (min, max)
+   * @returns The intersecting polygon
+   */
+  inline vert8 quad_with_rect(const vert4 &subject, const vert2 &rect) {
+    return hexagon_with_x_range(
+      quad_with_y_range(subject, rect[0][1], rect[1][1]), rect[0][0], rect[1][0]);
+  }
+
+  /**
+   * Get the signed area of a clipped polygon, which is zero if there is no
+   * intersection.
+   * @param poly The polygon
+   * @returns The area
+   */
+  template <typename PolygonType>
+  double clipped_area(const PolygonType &poly) {
+    return poly.size() < 3 ? 0.0 : simple_area(poly);
+  }
+
+  /**
+   * Get the area of the intersection of a quad with an axis aligned
+   * rectangle.
+   * @param subject The subject polygon
+   * @param rect The clip rectangle (min, max)
+   * @returns The signed area, positive if the quad is anticlockwise
+   */
+  inline double quad_with_rect_area(const vert4 &subject, const vert2 &rect) {
+    return clipped_area(quad_with_rect(subject, rect));
+  }
+
+  /**
+   * Get the areas of the intersections of a quad with each of the unit
+   * squares of a grid. The quad is clipped to each row once, and each row
+   * polygon is then clipped to each column.
+   * @param subject The subject polygon
+   * @param x0 The first column
+   * @param x1 The end column
+   * @param y0 The first row
+   * @param y1 The end row
+   * @returns The signed areas on a (y1 - y0, x1 - x0) grid
+   */
+  inline af::versa<double, af::c_grid<2> > quad_with_grid_area(const vert4 &subject,
+                                                               int x0,
+                                                               int x1,
+                                                               int y0,
+                                                               int y1) {
+    DIALS_ASSERT(x0 <= x1 && y0 <= y1);
+    af::versa<double, af::c_grid<2> > result(af::c_grid<2>(y1 - y0, x1 - x0), 0);
+    for (int j = y0; j < y1; ++j) {
+      vert6 row = quad_with_y_range(subject, j, j + 1);
+      if (row.size() < 3) {
+        continue;
+      }
+      for (int i = x0; i < x1; ++i) {
+        result(j - y0, i - x0) = clipped_area(hexagon_with_x_range(row, i, i + 1));
+      }
+    }
+    return result;
+  }
+
   /**
    * Clip a line with an axis aligned bounding box.
    * @param line The line to clip
@@ -12,21 +12,27 @@
 #define DIALS_ALGORITHMS_POLYGON_SPATIAL_INTERPOLATION_H
 
 #include <cmath>
+#include <vector>
 #include <scitbx/vec2.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <scitbx/array_family/simple_io.h>
 #include <dials/algorithms/polygon/clip/clip.h>
 #include <dials/algorithms/polygon/area.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms { namespace polygon {
   namespace spatial_interpolation {
 
     using dials::algorithms::polygon::simple_area;
-    using dials::algorithms::polygon::clip::quad_with_convex_quad;
+    using dials::algorithms::polygon::clip::clipped_area;
+    using dials::algorithms::polygon::clip::hexagon_with_x_range;
+    using dials::algorithms::polygon::clip::quad_with_rect_area;
+    using dials::algorithms::polygon::clip::quad_with_y_range;
+    using dials::algorithms::polygon::clip::vert2;
     using dials::algorithms::polygon::clip::vert4;
-    using dials::algorithms::polygon::clip::vert8;
+    using dials::algorithms::polygon::clip::vert6;
     using scitbx::vec2;
     using scitbx::af::double4;
     using scitbx::af::int2;
@@ -94,11 +100,8 @@ namespace dials { namespace algorithms { namespace polygon {
      * @returns The area
      */
     inline double quad_grid_intersection_area(const vert4 &a, int i, int j) {
-      vert4 b(vec2<double>(i, j),
-              vec2<double>(i + 1, j),
-              vec2<double>(i + 1, j + 1),
-              vec2<double>(i, j + 1));
-      return simple_area(quad_with_convex_quad(a, b));
+      return quad_with_rect_area(
+        a, vert2(vec2<double>(i, j), vec2<double>(i + 1, j + 1)));
     }
 
     /**
@@ -116,8 +119,10 @@ namespace dials { namespace algorithms { namespace polygon {
       if (range[0] >= range[1] || range[2] >= range[3]) return matches;
       double target_area = reverse_quad_inplace_if_backward(input);
       for (std::size_t jj = range[2]; jj < range[3]; ++jj) {
+        vert6 row = quad_with_y_range(input, jj, jj + 1);
+        if (row.size() < 3) continue;
         for (std::size_t ii = range[0]; ii < range[1]; ++ii) {
-          double result_area = quad_grid_intersection_area(input, ii, jj);
+          double result_area = clipped_area(hexagon_with_x_range(row, ii, ii + 1));
           if (result_area > 0) {
             double fraction = result_area / target_area;
             matches.push_back(Match(index, ii + jj * output_size[1], fraction));
@@ -142,8 +147,10 @@ namespace dials { namespace algorithms { namespace polygon {
       if (range[0] >= range[1] || range[2] >= range[3]) return matches;
       reverse_quad_inplace_if_backward(output);
       for (std::size_t jj = range[2]; jj < range[3]; ++jj) {
+        vert6 row = quad_with_y_range(output, jj, jj + 1);
+        if (row.size() < 3) continue;
         for (std::size_t ii = range[0]; ii < range[1]; ++ii) {
-          double result_area = quad_grid_intersection_area(output, ii, jj);
+          double result_area = clipped_area(hexagon_with_x_range(row, ii, ii + 1));
           if (result_area > 0) {
             double fraction = result_area;
             matches.push_back(Match(ii + jj * input_size[1], index, fraction));
@@ -243,6 +250,208 @@ namespace dials { namespace algorithms { namespace polygon {
       return result;
     }
 
+    /**
+     * A sparse matrix of the fractions of each input grid point that go to
+     * each output grid point, held with the matches for each output point
+     * together. Computing the matches once lets many images with the same
+     * geometry be regridded with a sparse matrix vector product each, which
+     * gives the same result as regrid_irregular_grid_to_grid or
+     * regrid_grid_to_irregular_grid.
+     */
+    class RegridMatrix {
+    public:
+      /**
+       * @param matches The matches between grid points
+       * @param input_size The size of the input grid
+       * @param output_size The size of the output grid
+       */
+      RegridMatrix(const af::const_ref<Match> &matches,
+                   af::c_grid<2> input_size,
+                   af::c_grid<2> output_size)
+          : input_size_(input_size),
+            output_size_(output_size),
+            first_(output_size.size_1d() + 1, 0),
+            in_(matches.size()),
+            fraction_(matches.size()) {
+        for (std::size_t i = 0; i < matches.size(); ++i) {
+          DIALS_ASSERT(matches[i].in >= 0);
+          DIALS_ASSERT(matches[i].out >= 0);
+          DIALS_ASSERT((std::size_t)matches[i].in < input_size.size_1d());
+          DIALS_ASSERT((std::size_t)matches[i].out < output_size.size_1d());
+          first_[matches[i].out + 1]++;
+        }
+        for (std::size_t i = 1; i < first_.size(); ++i) {
+          first_[i] += first_[i - 1];
+        }
+        std::vector<std::size_t> next(first_.begin(), first_.end() - 1);
+        for (std::size_t i = 0; i < matches.size(); ++i) {
+          std::size_t k = next[matches[i].out]++;
+          in_[k] = matches[i].in;
+          fraction_[k] = matches[i].fraction;
+        }
+      }
+
+      /** @returns The size of the input grid */
+      af::c_grid<2> input_size() const {
+        return input_size_;
+      }
+
+      /** @returns The size of the output grid */
+      af::c_grid<2> output_size() const {
+        return output_size_;
+      }
+
+      /** @returns The number of matches */
+      std::size_t size() const {
+        return in_.size();
+      }
+
+      /**
+       * Regrid an input grid. The output grid is split into bands of rows
+       * across threads.
+       * @param input The input grid
+       * @param nthreads The number of threads to use
+       * @returns The output grid
+       */
+      af::versa<double, af::c_grid<2> > apply(
+        const af::const_ref<double, af::c_grid<2> > &input,
+        std::size_t nthreads = 1) const {
+        DIALS_ASSERT(input.accessor().all_eq(input_size_));
+        af::versa<double, af::c_grid<2> > result(output_size_, 0.0);
+        for_each_band(ApplyBand(*this, input.begin(), result.begin()),
+                      (int)output_size_[0],
+                      nthreads);
+        return result;
+      }
+
+    private:
+      /**
+       * Compute the output grid points for a band of rows
+       */
+      struct ApplyBand {
+        const RegridMatrix &matrix;
+        const double *input;
+        double *result;
+
+        ApplyBand(const RegridMatrix &matrix_, const double *input_, double *result_)
+            : matrix(matrix_), input(input_), result(result_) {}
+
+        void operator()(int j0, int j1) const {
+          std::size_t width = matrix.output_size_[1];
+          for (std::size_t i = j0 * width; i < j1 * width; ++i) {
+            double sum = 0.0;
+            for (std::size_t k = matrix.first_[i]; k < matrix.first_[i + 1]; ++k) {
+              sum += input[matrix.in_[k]] * matrix.fraction_[k];
+            }
+            result[i] = sum;
+          }
+        }
+      };
+
+      af::c_grid<2> input_size_;
+      af::c_grid<2> output_size_;
+      std::vector<std::size_t> first_;
+      std::vector<int> in_;
+      std::vector<double> fraction_;
+    };
+
+    namespace detail {
+
+      /**
+       * Find the matches for a band of rows of quads of an irregular grid,
+       * either mapping the quads to a regular grid or a regular grid to the
+       * quads.
+       */
+      struct IrregularGridMatchesBand {
+        af::const_ref<vec2<double>, af::c_grid<2> > gridxy;
+        af::c_grid<2> size;
+        bool to_grid;
+        std::vector<std::vector<Match> > &rows;
+
+        IrregularGridMatchesBand(
+          const af::const_ref<vec2<double>, af::c_grid<2> > &gridxy_,
+          af::c_grid<2> size_,
+          bool to_grid_,
+          std::vector<std::vector<Match> > &rows_)
+            : gridxy(gridxy_), size(size_), to_grid(to_grid_), rows(rows_) {}
+
+        void operator()(int j0, int j1) const {
+          std::size_t width = gridxy.accessor()[1] - 1;
+          for (std::size_t j = j0; j < j1; ++j) {
+            for (std::size_t i = 0; i < width; ++i) {
+              vert4 quad(
+                gridxy(j, i), gridxy(j, i + 1), gridxy(j + 1, i + 1), gridxy(j + 1, i));
+              int k = j * width + i;
+              af::shared<Match> temp =
+                to_grid ? quad_to_grid(quad, size, k) : grid_to_quad(quad, size, k);
+              rows[j].insert(rows[j].end(), temp.begin(), temp.end());
+            }
+          }
+        }
+      };
+
+      /**
+       * Find the matches of an irregular grid in bands of rows across threads
+       * and join them in row order.
+       */
+      inline af::shared<Match> irregular_grid_matches(
+        const af::const_ref<vec2<double>, af::c_grid<2> > &gridxy,
+        af::c_grid<2> size,
+        bool to_grid,
+        std::size_t nthreads) {
+        DIALS_ASSERT(gridxy.accessor().all_gt(0) && size.all_gt(0));
+        std::vector<std::vector<Match> > rows(gridxy.accessor()[0] - 1);
+        for_each_band(IrregularGridMatchesBand(gridxy, size, to_grid, rows),
+                      (int)rows.size(),
+                      nthreads);
+        af::shared<Match> matches;
+        for (std::size_t j = 0; j < rows.size(); ++j) {
+          for (std::size_t i = 0; i < rows[j].size(); ++i) {
+            matches.push_back(rows[j][i]);
+          }
+        }
+        return matches;
+      }
+
+    }  // namespace detail
+
+    /**
+     * Compute the matrix to regrid an input irregular grid onto a regular
+     * grid.
+     * @param inputxy The input x/y coordinates
+     * @param output_size The size of the output grid
+     * @param nthreads The number of threads to use
+     * @returns The regrid matrix
+     */
+    inline RegridMatrix irregular_grid_to_grid_matrix(
+      const af::const_ref<vec2<double>, af::c_grid<2> > &inputxy,
+      af::tiny<std::size_t, 2> output_size,
+      std::size_t nthreads = 1) {
+      af::shared<Match> matches =
+        detail::irregular_grid_matches(inputxy, output_size, true, nthreads);
+      af::c_grid<2> input_size(inputxy.accessor()[0] - 1, inputxy.accessor()[1] - 1);
+      return RegridMatrix(matches.const_ref(), input_size, output_size);
+    }
+
+    /**
+     * Compute the matrix to regrid an input regular grid onto an irregular
+     * grid.
+     * @param outputxy The output x/y coordinates
+     * @param input_size The size of the input grid
+     * @param nthreads The number of threads to use
+     * @returns The regrid matrix
+     */
+    inline RegridMatrix grid_to_irregular_grid_matrix(
+      const af::const_ref<vec2<double>, af::c_grid<2> > &outputxy,
+      af::tiny<std::size_t, 2> input_size,
+      std::size_t nthreads = 1) {
+      af::shared<Match> matches =
+        detail::irregular_grid_matches(outputxy, input_size, false, nthreads);
+      af::c_grid<2> output_size(outputxy.accessor()[0] - 1,
+                                outputxy.accessor()[1] - 1);
+      return RegridMatrix(matches.const_ref(), input_size, output_size);
+    }
+
 }}}}  // namespace dials::algorithms::polygon::spatial_interpolation
 
 #endif /* DIALS_ALGORITHMS_POLYGON_SPATIAL_INTERPOLATION_H */
@@ -4,8 +4,11 @@
 
 __all__ = (  # noqa: F405
     "Match",
+    "RegridMatrix",
     "grid_to_irregular_grid",
+    "grid_to_irregular_grid_matrix",
     "irregular_grid_to_grid",
+    "irregular_grid_to_grid_matrix",
     "regrid_grid_to_irregular_grid",
     "regrid_irregular_grid_to_grid",
 )
@@ -9,6 +9,7 @@
     BBoxMultiCalculator,
     CoordinateSystem,
     CoordinateSystem2d,
+    CoordinateSystemTable,
     GaussianRSProfileModeller,
     MaskCalculator2D,
     MaskCalculator3D,
@@ -31,6 +32,7 @@
     "BBoxMultiCalculator",
     "CoordinateSystem",
     "CoordinateSystem2d",
+    "CoordinateSystemTable",
     "GaussianRSProfileModeller",
     "MaskCalculator",
     "MaskCalculator2D",
@@ -1,5 +1,9 @@
 from __future__ import absolute_import, division, print_function
 
+import logging
+
+logger = logging.getLogger(__name__)
+
 
 class GaussianRSMaskCalculatorFactory(object):
     """
@@ -113,6 +117,10 @@ def create(experiments, grid_size=5, scan_step=5, grid_method="circular_grid"):
                 experiment.profile.n_sigma() * 1.5,
                 grid_size,
             )
+            logger.debug(
+                "Transform spec caches %d bytes of detector geometry",
+                spec.cache_nbytes(),
+            )
 
             spec_list.append(spec)
 
@@ -11,8 +11,12 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_BBOX_CALCULATOR_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_BBOX_CALCULATOR_H
 
+#include <algorithm>
 #include <cmath>
+#include <string>
+#include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <scitbx/constants.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
@@ -23,6 +27,8 @@
 #include <dxtbx/model/scan.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/util/thread_pool.h>
+#include <dials/error.h>
 
 namespace dials {
   namespace algorithms {
@@ -57,6 +63,78 @@ namespace dials {
     virtual af::shared<int6> array(const af::const_ref<vec3<double> > &s1,
                                    const af::const_ref<double> &frame,
                                    const af::const_ref<std::size_t> &panel) const = 0;
+
+    /**
+     * Calculate the bounding boxes of a reflection table's columns using
+     * several threads. The reflections are split into blocks which are
+     * shared between the threads; the result is the same as from array.
+     * @param s1 The array of diffracted beam vectors
+     * @param frame The array of frame numbers
+     * @param panel The array of panel numbers
+     * @param nthreads The number of threads to use
+     * @returns The bounding box of each reflection
+     */
+    af::shared<int6> parallel_array(const af::const_ref<vec3<double> > &s1,
+                                    const af::const_ref<double> &frame,
+                                    const af::const_ref<std::size_t> &panel,
+                                    std::size_t nthreads) const {
+      DIALS_ASSERT(s1.size() == frame.size());
+      DIALS_ASSERT(s1.size() == panel.size());
+      DIALS_ASSERT(nthreads > 0);
+      const std::size_t block_size = 1024;
+      if (nthreads == 1 || s1.size() <= block_size) {
+        return array(s1, frame, panel);
+      }
+      af::shared<int6> result(s1.size(), af::init_functor_null<int6>());
+      std::string error;
+      boost::mutex error_mutex;
+      {
+        std::size_t num_blocks = (s1.size() + block_size - 1) / block_size;
+        dials::util::WorkStealingThreadPool pool(std::min(nthreads, num_blocks));
+        for (std::size_t first = 0; first < s1.size(); first += block_size) {
+          std::size_t num = std::min(block_size, s1.size() - first);
+          pool.post(boost::bind(&BBoxCalculatorIface::compute_block,
+                                this,
+                                &s1[first],
+                                &frame[first],
+                                &panel[first],
+                                &result[first],
+                                num,
+                                &error,
+                                &error_mutex));
+        }
+        pool.wait();
+      }
+      if (!error.empty()) {
+        throw DIALS_ERROR(error);
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Compute a block of bounding boxes in a worker thread. Exceptions are
+     * caught and saved so that they can be reported from the calling thread.
+     */
+    static void compute_block(const BBoxCalculatorIface *compute,
+                              const vec3<double> *s1,
+                              const double *frame,
+                              const std::size_t *panel,
+                              int6 *result,
+                              std::size_t num,
+                              std::string *error,
+                              boost::mutex *error_mutex) {
+      try {
+        for (std::size_t i = 0; i < num; ++i) {
+          result[i] = compute->single(s1[i], frame[i], panel[i]);
+        }
+      } catch (const std::exception &e) {
+        boost::lock_guard<boost::mutex> lock(*error_mutex);
+        if (error->empty()) {
+          *error = e.what();
+        }
+      }
+    }
   };
 
   /** Calculate the bounding box for each reflection */
@@ -141,8 +219,17 @@ namespace dials {
       double phi = scan_.get_angle_from_array_index(frame);
 
       // Create the coordinate system for the reflection
-      CoordinateSystem xcs(m2_, s0_, s1, phi);
+      return single(CoordinateSystem(m2_, s0_, s1, phi), frame, panel);
+    }
 
+    /**
+     * Calculate the bbox on the detector image volume for the reflection
+     * given its coordinate system, e.g. a row of coordinate_systems().
+     * @param xcs The coordinate system of the reflection
+     * @param frame The predicted frame number
+     * @returns A 6 element array: (minx, maxx, miny, maxy, minz, maxz)
+     */
+    int6 single(const CoordinateSystem &xcs, double frame, std::size_t panel) const {
       // Get the divergence and mosaicity for this point
       double delta_d = 0.0;
       double delta_m = 0.0;
@@ -233,6 +320,46 @@ namespace dials {
       return result;
     }
 
+    /**
+     * Compute the coordinate systems of an array of reflections once so
+     * that they can be shared with the other calculators of the experiment.
+     * @param s1 The array of diffracted beam vectors
+     * @param frame The array of frame numbers
+     * @param nthreads The number of threads to use
+     * @returns The coordinate system of each reflection
+     */
+    CoordinateSystemTable coordinate_systems(const af::const_ref<vec3<double> > &s1,
+                                             const af::const_ref<double> &frame,
+                                             std::size_t nthreads) const {
+      DIALS_ASSERT(s1.size() == frame.size());
+      af::shared<double> phi(frame.size(), af::init_functor_null<double>());
+      for (std::size_t i = 0; i < frame.size(); ++i) {
+        DIALS_ASSERT(s1[i].length_sq() > 0);
+        phi[i] = scan_.get_angle_from_array_index(frame[i]);
+      }
+      return CoordinateSystemTable(m2_, s0_, s1, phi.const_ref(), nthreads);
+    }
+
+    /**
+     * Calculate the rois for an array of reflections given by their
+     * coordinate systems, computed by coordinate_systems().
+     * @param cs The coordinate systems of the reflections
+     * @param frame The array of frame numbers.
+     * @param panel The array of panel numbers
+     */
+    af::shared<int6> array(const CoordinateSystemTable &cs,
+                           const af::const_ref<double> &frame,
+                           const af::const_ref<std::size_t> &panel) const {
+      DIALS_ASSERT(cs.size() == frame.size());
+      DIALS_ASSERT(cs.size() == panel.size());
+      DIALS_ASSERT(cs.m2() == m2_.normalize() && cs.s0() == s0_);
+      af::shared<int6> result(cs.size(), af::init_functor_null<int6>());
+      for (std::size_t i = 0; i < cs.size(); ++i) {
+        result[i] = single(cs[i], frame[i], panel[i]);
+      }
+      return result;
+    }
+
   private:
     vec3<double> s0_;
     vec3<double> m2_;
@@ -73,7 +73,10 @@ namespace dials {
                                          obj.num_scan_points(),
                                          obj.threshold(),
                                          obj.grid_method(),
-                                         obj.fit_method());
+                                         obj.fit_method(),
+                                         obj.warm_start(),
+                                         obj.sigma_tolerance(),
+                                         obj.single_precision());
       }
 
       static boost::python::tuple getstate(const GaussianRSProfileModeller& obj) {
@@ -142,8 +145,12 @@ namespace dials {
                   std::size_t,
                   double,
                   int,
-                  int>())
+                  int,
+                  optional<bool, double, bool> >())
         .def("coord", &GaussianRSProfileModeller::coord)
+        .def("warm_start", &GaussianRSProfileModeller::warm_start)
+        .def("sigma_tolerance", &GaussianRSProfileModeller::sigma_tolerance)
+        .def("single_precision", &GaussianRSProfileModeller::single_precision)
         .def_pickle(GaussianRSProfileModellerPickleSuite());
 
       scope in_modeller = result;
@@ -173,7 +180,10 @@ namespace dials {
              (arg("s1"), arg("frame"), arg("panel")))
         .def("__call__",
              &BBoxCalculatorIface::array,
-             (arg("s1"), arg("frame"), arg("panel")));
+             (arg("s1"), arg("frame"), arg("panel")))
+        .def("__call__",
+             &BBoxCalculatorIface::parallel_array,
+             (arg("s1"), arg("frame"), arg("panel"), arg("nthreads")));
 
       class_<BBoxCalculator3D, bases<BBoxCalculatorIface> >("BBoxCalculator3D", no_init)
         .def(init<const BeamBase&,
@@ -197,7 +207,17 @@ namespace dials {
                                                  arg("goniometer"),
                                                  arg("scan"),
                                                  arg("delta_divergence"),
-                                                 arg("delta_mosaicity"))));
+                                                 arg("delta_mosaicity"))))
+        .def("coordinate_systems",
+             &BBoxCalculator3D::coordinate_systems,
+             (arg("s1"), arg("frame"), arg("nthreads") = 1))
+        .def("from_coordinate_systems",
+             (af::shared<int6>(BBoxCalculator3D::*)(
+               const CoordinateSystemTable&,
+               const af::const_ref<double>&,
+               const af::const_ref<std::size_t>&) const) &
+               BBoxCalculator3D::array,
+             (arg("cs"), arg("frame"), arg("panel")));
 
       class_<BBoxCalculator2D, bases<BBoxCalculatorIface> >("BBoxCalculator2D", no_init)
         .def(init<const BeamBase&, const Detector&, double, double>(
@@ -229,7 +249,10 @@ namespace dials {
              (arg("s1"), arg("frame"), arg("bbox")))
         .def("__call__",
              &PartialityCalculatorIface::array,
-             (arg("s1"), arg("frame"), arg("bbox")));
+             (arg("s1"), arg("frame"), arg("bbox")))
+        .def("__call__",
+             &PartialityCalculatorIface::parallel_array,
+             (arg("s1"), arg("frame"), arg("bbox"), arg("nthreads")));
 
       class_<PartialityCalculator3D, bases<PartialityCalculatorIface> >(
         "PartialityCalculator3D", no_init)
@@ -239,7 +262,14 @@ namespace dials {
                   const Goniometer&,
                   const Scan&,
                   const af::const_ref<double>&>(
-          (arg("beam"), arg("goniometer"), arg("scan"), arg("delta_m"))));
+          (arg("beam"), arg("goniometer"), arg("scan"), arg("delta_m"))))
+        .def("from_coordinate_systems",
+             (af::shared<double>(PartialityCalculator3D::*)(
+               const CoordinateSystemTable&,
+               const af::const_ref<double>&,
+               const af::const_ref<int6>&) const) &
+               PartialityCalculator3D::array,
+             (arg("cs"), arg("frame"), arg("bbox")));
 
       class_<PartialityCalculator2D, bases<PartialityCalculatorIface> >(
         "PartialityCalculator2D", no_init)
@@ -340,6 +370,26 @@ namespace dials {
         .def("to_beam_vector_and_rotation_angle",
              &CoordinateSystem::to_beam_vector_and_rotation_angle);
 
+      // Export coordinate system table
+      class_<CoordinateSystemTable>("CoordinateSystemTable", no_init)
+        .def(init<vec3<double>,
+                  vec3<double>,
+                  const af::const_ref<vec3<double> >&,
+                  const af::const_ref<double>&,
+                  std::size_t>(
+          (arg("m2"), arg("s0"), arg("s1"), arg("phi"), arg("nthreads") = 1)))
+        .def("__len__", &CoordinateSystemTable::size)
+        .def("__getitem__", &CoordinateSystemTable::operator[])
+        .def("m2", &CoordinateSystemTable::m2)
+        .def("s0", &CoordinateSystemTable::s0)
+        .def("s1", &CoordinateSystemTable::s1)
+        .def("phi", &CoordinateSystemTable::phi)
+        .def("p_star", &CoordinateSystemTable::p_star)
+        .def("e1_axis", &CoordinateSystemTable::e1_axis)
+        .def("e2_axis", &CoordinateSystemTable::e2_axis)
+        .def("e3_axis", &CoordinateSystemTable::e3_axis)
+        .def("zeta", &CoordinateSystemTable::zeta);
+
       boost_adaptbx::std_pair_conversions::to_tuple<vec3<double>, double>();
     }
 
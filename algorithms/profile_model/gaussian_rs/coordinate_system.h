@@ -15,6 +15,8 @@
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
 #include <dxtbx/model/panel.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials {
@@ -163,6 +165,38 @@ namespace dials {
           e3_((s1 + s0).normalize()),
           zeta_(zeta_factor(m2_, e1_)) {}
 
+    /**
+     * Initialise the coordinate system from precomputed axes, e.g. those of
+     * a row of a CoordinateSystemTable. Nothing is recomputed or checked.
+     * @param m2 The normalized rotation axis
+     * @param s0 The incident beam vector
+     * @param s1 The diffracted beam vector
+     * @param phi The rotation angle
+     * @param p_star The rotated reciprocal space vector
+     * @param e1 The e1 axis
+     * @param e2 The e2 axis
+     * @param e3 The e3 axis
+     * @param zeta The path length correction factor
+     */
+    CoordinateSystem(vec3<double> m2,
+                     vec3<double> s0,
+                     vec3<double> s1,
+                     double phi,
+                     vec3<double> p_star,
+                     vec3<double> e1,
+                     vec3<double> e2,
+                     vec3<double> e3,
+                     double zeta)
+        : m2_(m2),
+          s0_(s0),
+          s1_(s1),
+          phi_(phi),
+          p_star_(p_star),
+          e1_(e1),
+          e2_(e2),
+          e3_(e3),
+          zeta_(zeta) {}
+
     /** @returns The rotation axis */
     vec3<double> m2() const {
       return m2_;
@@ -374,6 +408,133 @@ namespace dials {
     double zeta_;
   };
 
+  /**
+   * The coordinate systems of a block of reflections as one array per axis.
+   * The axes are computed once, in parallel, and then shared by the kernels
+   * (bounding box, partiality, ...) which would otherwise each construct the
+   * CoordinateSystem of every reflection again. Each row is identical to the
+   * CoordinateSystem constructed from the same m2, s0, s1 and phi.
+   */
+  class CoordinateSystemTable {
+  public:
+    /**
+     * Compute the coordinate system of each reflection
+     * @param m2 The rotation axis
+     * @param s0 The incident beam vector
+     * @param s1 The diffracted beam vector of each reflection
+     * @param phi The rotation angle of each reflection
+     * @param nthreads The number of threads to use
+     */
+    CoordinateSystemTable(vec3<double> m2,
+                          vec3<double> s0,
+                          const af::const_ref<vec3<double> > &s1,
+                          const af::const_ref<double> &phi,
+                          std::size_t nthreads = 1)
+        : m2_(m2.normalize()),
+          s0_(s0),
+          s1_(s1.begin(), s1.end()),
+          phi_(phi.begin(), phi.end()),
+          p_star_(s1.size(), af::init_functor_null<vec3<double> >()),
+          e1_(s1.size(), af::init_functor_null<vec3<double> >()),
+          e2_(s1.size(), af::init_functor_null<vec3<double> >()),
+          e3_(s1.size(), af::init_functor_null<vec3<double> >()),
+          zeta_(s1.size(), af::init_functor_null<double>()) {
+      DIALS_ASSERT(s1.size() == phi.size());
+      for_each_band(AxesBand(*this), (int)s1.size(), nthreads);
+    }
+
+    /** @returns The number of reflections */
+    std::size_t size() const {
+      return s1_.size();
+    }
+
+    /** @returns The normalized rotation axis */
+    vec3<double> m2() const {
+      return m2_;
+    }
+
+    /** @returns The incident beam vector */
+    vec3<double> s0() const {
+      return s0_;
+    }
+
+    /** @returns The diffracted beam vectors */
+    af::shared<vec3<double> > s1() const {
+      return s1_;
+    }
+
+    /** @returns The rotation angles */
+    af::shared<double> phi() const {
+      return phi_;
+    }
+
+    /** @returns The rotated reciprocal space vectors */
+    af::shared<vec3<double> > p_star() const {
+      return p_star_;
+    }
+
+    /** @returns The e1 axes */
+    af::shared<vec3<double> > e1_axis() const {
+      return e1_;
+    }
+
+    /** @returns The e2 axes */
+    af::shared<vec3<double> > e2_axis() const {
+      return e2_;
+    }
+
+    /** @returns The e3 axes */
+    af::shared<vec3<double> > e3_axis() const {
+      return e3_;
+    }
+
+    /** @returns The zeta factors */
+    af::shared<double> zeta() const {
+      return zeta_;
+    }
+
+    /** @returns The coordinate system of a reflection */
+    CoordinateSystem operator[](std::size_t i) const {
+      DIALS_ASSERT(i < s1_.size());
+      return CoordinateSystem(
+        m2_, s0_, s1_[i], phi_[i], p_star_[i], e1_[i], e2_[i], e3_[i], zeta_[i]);
+    }
+
+  private:
+    /**
+     * Compute the axes of a band of reflections
+     */
+    struct AxesBand {
+      CoordinateSystemTable &table;
+
+      AxesBand(CoordinateSystemTable &table_) : table(table_) {}
+
+      void operator()(int i0, int i1) const {
+        vec3<double> m2 = table.m2_;
+        vec3<double> s0 = table.s0_;
+        for (int i = i0; i < i1; ++i) {
+          vec3<double> s1 = table.s1_[i];
+          vec3<double> e1 = s1.cross(s0).normalize();
+          table.p_star_[i] = s1 - s0;
+          table.e1_[i] = e1;
+          table.e2_[i] = s1.cross(e1).normalize();
+          table.e3_[i] = (s1 + s0).normalize();
+          table.zeta_[i] = zeta_factor(m2, e1);
+        }
+      }
+    };
+
+    vec3<double> m2_;
+    vec3<double> s0_;
+    af::shared<vec3<double> > s1_;
+    af::shared<double> phi_;
+    af::shared<vec3<double> > p_star_;
+    af::shared<vec3<double> > e1_;
+    af::shared<vec3<double> > e2_;
+    af::shared<vec3<double> > e3_;
+    af::shared<double> zeta_;
+  };
+
 }}}}  // namespace dials::algorithms::profile_model::gaussian_rs
 
 #endif  // DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_COORDINATE_SYSTEM_H
@@ -21,6 +21,7 @@
 #include <dials/model/data/shoebox.h>
 #include <dials/model/data/image_volume.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/algorithms/profile_model/gaussian_rs/pixel_corner_grid.h>
 #include <dials/algorithms/shoebox/mask_code.h>
 #include <dials/error.h>
 
@@ -97,7 +98,8 @@ namespace dials {
           phi0_(scan.get_oscillation()[0]),
           dphi_(scan.get_oscillation()[1]),
           index0_(scan.get_array_range()[0]),
-          index1_(scan.get_array_range()[1]) {
+          index1_(scan.get_array_range()[1]),
+          corners_(detector) {
       DIALS_ASSERT(delta_b > 0.0);
       DIALS_ASSERT(delta_m > 0.0);
       delta_b_r_.resize(1);
@@ -127,7 +129,8 @@ namespace dials {
           phi0_(scan.get_oscillation()[0]),
           dphi_(scan.get_oscillation()[1]),
           index0_(scan.get_array_range()[0]),
-          index1_(scan.get_array_range()[1]) {
+          index1_(scan.get_array_range()[1]),
+          corners_(detector) {
       DIALS_ASSERT(delta_b.all_gt(0.0));
       DIALS_ASSERT(delta_m.all_gt(0.0));
       DIALS_ASSERT(delta_m.size() == scan.get_num_images());
@@ -261,14 +264,8 @@ namespace dials {
       // Background.
 
       af::versa<double, af::c_grid<2> > dxy_array(af::c_grid<2>(ysize + 1, xsize + 1));
-      for (int j = 0; j <= ysize; ++j) {
-        for (int i = 0; i <= xsize; ++i) {
-          vec2<double> gxy = cs.from_beam_vector(
-            panel.get_pixel_lab_coord(vec2<double>(x0 + i, y0 + j)).normalize()
-            * s0_length);
-          dxy_array(j, i) = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
-        }
-      }
+      corners_.distance(
+        panel, panel_number, cs, s0_length, delta_b_r2, x0, y0, dxy_array.ref());
 
       int num1 = 0;
       int num2 = 0;
@@ -365,40 +362,59 @@ namespace dials {
       double attenuation_length = panel.attenuation_length(shoebox_centroid_px);
 
       af::versa<double, af::c_grid<2> > dxy_array(af::c_grid<2>(ysize + 1, xsize + 1));
-      for (int j = 0; j <= ysize; ++j) {
-        for (int i = 0; i <= xsize; ++i) {
-          vec2<double> gxy = cs.from_beam_vector(
-            panel.get_pixel_lab_coord(vec2<double>(x0 + i, y0 + j), attenuation_length)
-              .normalize()
-            * s0_length);
-          dxy_array(j, i) = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
-        }
-      }
-
+      corners_.distance(panel,
+                        panel_number,
+                        cs,
+                        s0_length,
+                        delta_b_r2,
+                        x0,
+                        y0,
+                        attenuation_length,
+                        dxy_array.ref());
+
+      // The smallest distance over the corners of each pixel. This is the same
+      // for every frame so compute it once and reuse it for each image.
+      af::versa<double, af::c_grid<2> > dxy_min(af::c_grid<2>(ysize, xsize));
       for (int j = 0; j < ysize; ++j) {
         for (int i = 0; i < xsize; ++i) {
           double dxy1 = dxy_array(j, i);
           double dxy2 = dxy_array(j + 1, i);
           double dxy3 = dxy_array(j, i + 1);
           double dxy4 = dxy_array(j + 1, i + 1);
-          double dxy = std::min(std::min(dxy1, dxy2), std::min(dxy3, dxy4));
-          for (std::size_t k = 0; k < zsize; ++k) {
-            if (z0 + (int)k >= index0_ && z0 + (int)k < index1_) {
-              double gz1 =
-                cs.from_rotation_angle_fast(phi0_ + (z0 + k - index0_) * dphi_);
-              double gz2 =
-                cs.from_rotation_angle_fast(phi0_ + (z0 + k + 1 - index0_) * dphi_);
-              double gz = std::abs(gz1) < std::abs(gz2) ? gz1 : gz2;
-              double gzc2 = gz * gz * delta_m_r2;
-              /* int mask_value = (dxy + gzc2 <= 1.0) ? Foreground : Background; */
-              if (!adjacent) {
-                int mask_value = (dxy <= 1.0) ? Foreground : Background;
-                mask(k, j, i) |= mask_value;
-              } else {
-                if (dxy + gzc2 <= 1.0) {
-                  mask(k, j, i) |= Overlapped;
-                }
-              }
+          dxy_min(j, i) = std::min(std::min(dxy1, dxy2), std::min(dxy3, dxy4));
+        }
+      }
+
+      // Only frames within the scan are masked
+      int k0 = std::max(index0_ - z0, 0);
+      int k1 = std::min(index1_ - z0, zsize);
+
+      // Fill the mask a frame at a time so that each image is written in order.
+      // The rotation distance only depends on the frame so is computed once per
+      // frame from the angles at the frame edges.
+      const double *dxy = dxy_min.begin();
+      std::size_t npixels = (std::size_t)xsize * (std::size_t)ysize;
+      if (npixels == 0 || k0 >= k1) {
+        return;
+      }
+      if (!adjacent) {
+        for (int k = k0; k < k1; ++k) {
+          int *m = &mask(k, 0, 0);
+          for (std::size_t p = 0; p < npixels; ++p) {
+            m[p] |= (dxy[p] <= 1.0) ? Foreground : Background;
+          }
+        }
+      } else {
+        double gz2 = cs.from_rotation_angle_fast(phi0_ + (z0 + k0 - index0_) * dphi_);
+        for (int k = k0; k < k1; ++k) {
+          double gz1 = gz2;
+          gz2 = cs.from_rotation_angle_fast(phi0_ + (z0 + k + 1 - index0_) * dphi_);
+          double gz = std::abs(gz1) < std::abs(gz2) ? gz1 : gz2;
+          double gzc2 = gz * gz * delta_m_r2;
+          int *m = &mask(k, 0, 0);
+          for (std::size_t p = 0; p < npixels; ++p) {
+            if (dxy[p] + gzc2 <= 1.0) {
+              m[p] |= Overlapped;
             }
           }
         }
@@ -469,14 +485,8 @@ namespace dials {
       // Mark those points within as Foreground and those without as
       // Background.
       af::versa<double, af::c_grid<2> > dxy_array(af::c_grid<2>(ysize + 1, xsize + 1));
-      for (int j = 0; j <= ysize; ++j) {
-        for (int i = 0; i <= xsize; ++i) {
-          vec2<double> gxy = cs.from_beam_vector(
-            panel.get_pixel_lab_coord(vec2<double>(x0 + i, y0 + j)).normalize()
-            * s0_length);
-          dxy_array(j, i) = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
-        }
-      }
+      corners_.distance(
+        panel, panel_number, cs, s0_length, delta_b_r2, x0, y0, dxy_array.ref());
       for (int j = 0; j < ysize; ++j) {
         for (int i = 0; i < xsize; ++i) {
           double dxy1 = dxy_array(j, i);
@@ -499,6 +509,7 @@ namespace dials {
     int index1_;
     af::shared<double> delta_b_r_;
     af::shared<double> delta_m_r_;
+    PixelCornerGrid corners_;
   };
 
   /**
@@ -519,7 +530,7 @@ namespace dials {
                      const Detector &detector,
                      double delta_b,
                      double delta_m)
-        : detector_(detector), s0_(beam.get_s0()) {
+        : detector_(detector), s0_(beam.get_s0()), corners_(detector) {
       DIALS_ASSERT(delta_b > 0.0);
       DIALS_ASSERT(delta_m >= 0.0);
       delta_b_r_ = 1.0 / delta_b;
@@ -573,14 +584,8 @@ namespace dials {
       // Mark those points within as Foreground and those without as
       // Background.
       af::versa<double, af::c_grid<2> > dxy_array(af::c_grid<2>(ysize + 1, xsize + 1));
-      for (int j = 0; j <= ysize; ++j) {
-        for (int i = 0; i <= xsize; ++i) {
-          vec2<double> gxy = cs.from_beam_vector(
-            panel.get_pixel_lab_coord(vec2<double>(x0 + i, y0 + j)).normalize()
-            * s0_length);
-          dxy_array(j, i) = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
-        }
-      }
+      corners_.distance(
+        panel, panel_number, cs, s0_length, delta_b_r2, x0, y0, dxy_array.ref());
       for (int j = 0; j < ysize; ++j) {
         for (int i = 0; i < xsize; ++i) {
           double dxy1 = dxy_array(j, i);
@@ -674,14 +679,8 @@ namespace dials {
       // Mark those points within as Foreground and those without as
       // Background.
       af::versa<double, af::c_grid<2> > dxy_array(af::c_grid<2>(ysize + 1, xsize + 1));
-      for (int j = 0; j <= ysize; ++j) {
-        for (int i = 0; i <= xsize; ++i) {
-          vec2<double> gxy = cs.from_beam_vector(
-            panel.get_pixel_lab_coord(vec2<double>(x0 + i, y0 + j)).normalize()
-            * s0_length);
-          dxy_array(j, i) = (gxy[0] * gxy[0] + gxy[1] * gxy[1]) * delta_b_r2;
-        }
-      }
+      corners_.distance(
+        panel, panel_number, cs, s0_length, delta_b_r2, x0, y0, dxy_array.ref());
       int num1 = 0;
       int num2 = 0;
       for (int j = 0; j < ysize; ++j) {
@@ -711,6 +710,7 @@ namespace dials {
     vec3<double> s0_;
     double delta_b_r_;
     /*double delta_m_r_;*/
+    PixelCornerGrid corners_;
   };
 
   /**
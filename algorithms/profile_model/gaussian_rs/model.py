@@ -83,6 +83,23 @@
         .type = choice
         .help = "The fitting method"
 
+      warm_start = False
+        .type = bool
+        .help = "Start the profile fitting iterations from the summation"
+                "intensity rather than the summed counts in the fitting mask"
+
+      sigma_tolerance = 0
+        .type = float(value_min=0)
+        .help = "Also stop the profile fitting iterations once the change in"
+                "intensity is below this fraction of its estimated sigma."
+                "This lets weak reflections converge in fewer iterations."
+
+      single_precision = False
+        .type = bool
+        .help = "Store the reference profiles in single precision once they"
+                "have been formed, halving the memory they use. The profiles"
+                "are still accumulated and normalised in double precision."
+
       detector_space {
 
         deconvolution = False
@@ -415,6 +432,7 @@ def predict_reflections(
         margin=1,
         force_static=False,
         padding=0,
+        nthreads=1,
         **kwargs
     ):
         """
@@ -446,11 +464,20 @@ def predict_reflections(
             margin=margin,
             force_static=force_static,
             padding=padding,
+            nthreads=nthreads,
         )
         return predict()
 
     def compute_partiality(
-        self, reflections, crystal, beam, detector, goniometer=None, scan=None, **kwargs
+        self,
+        reflections,
+        crystal,
+        beam,
+        detector,
+        goniometer=None,
+        scan=None,
+        nthreads=1,
+        **kwargs
     ):
         """
         Given an experiment and list of reflections, compute the partiality of the
@@ -462,6 +489,7 @@ def compute_partiality(
         :param detector: The detector model
         :param goniometer: The goniometer model
         :param scan: The scan model
+        :param nthreads: The number of threads to use
         """
         from dials.algorithms.profile_model.gaussian_rs import PartialityCalculator
 
@@ -472,7 +500,10 @@ def compute_partiality(
 
         # Compute the partiality
         partiality = calculate(
-            reflections["s1"], reflections["xyzcal.px"].parts()[2], reflections["bbox"]
+            reflections["s1"],
+            reflections["xyzcal.px"].parts()[2],
+            reflections["bbox"],
+            nthreads,
         )
 
         # Return the partiality
@@ -487,6 +518,7 @@ def compute_bbox(
         goniometer=None,
         scan=None,
         sigma_b_multiplier=2.0,
+        nthreads=1,
         **kwargs
     ):
         """Given an experiment and list of reflections, compute the
@@ -498,6 +530,7 @@ def compute_bbox(
         :param detector: The detector model
         :param goniometer: The goniometer model
         :param scan: The scan model
+        :param nthreads: The number of threads to use
         """
         from dials.algorithms.profile_model.gaussian_rs import BBoxCalculator
 
@@ -516,7 +549,10 @@ def compute_bbox(
 
         # Calculate the bounding boxes of all the reflections
         bbox = calculate(
-            reflections["s1"], reflections["xyzcal.px"].parts()[2], reflections["panel"]
+            reflections["s1"],
+            reflections["xyzcal.px"].parts()[2],
+            reflections["panel"],
+            nthreads,
         )
 
         # Return the bounding boxes
@@ -644,6 +680,9 @@ def wrapper(experiment):
                 self.params.gaussian_rs.fitting.threshold,
                 grid_method,
                 fit_method,
+                self.params.gaussian_rs.fitting.warm_start,
+                self.params.gaussian_rs.fitting.sigma_tolerance,
+                self.params.gaussian_rs.fitting.single_precision,
             )
 
         # Return the wrapper function
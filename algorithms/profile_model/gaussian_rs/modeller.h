@@ -168,6 +168,10 @@ namespace dials { namespace algorithms {
      * @param num_scan_points The number of phi scan points
      * @param threshold The modelling threshold value
      * @param grid_method The gridding method
+     * @param fit_method The fitting method
+     * @param warm_start Start fitting from the summation intensity
+     * @param sigma_tolerance The fitting tolerance as a fraction of sigma
+     * @param single_precision Store the finalized profiles as float
      */
     GaussianRSProfileModeller(boost::shared_ptr<BeamBase> beam,
                               const Detector &detector,
@@ -180,7 +184,10 @@ namespace dials { namespace algorithms {
                               std::size_t num_scan_points,
                               double threshold,
                               int grid_method,
-                              int fit_method)
+                              int fit_method,
+                              bool warm_start = false,
+                              double sigma_tolerance = 0,
+                              bool single_precision = false)
         : GaussianRSProfileModellerBase(beam,
                                         detector,
                                         goniometer,
@@ -195,7 +202,8 @@ namespace dials { namespace algorithms {
           EmpiricalProfileModeller(
             sampler_->size(),
             int3(2 * grid_size + 1, 2 * grid_size + 1, 2 * grid_size + 1),
-            threshold),
+            threshold,
+            single_precision),
           spec_(beam,
                 detector,
                 goniometer,
@@ -203,8 +211,11 @@ namespace dials { namespace algorithms {
                 sigma_b,
                 sigma_m,
                 n_sigma,
-                grid_size) {
+                grid_size),
+          warm_start_(warm_start),
+          sigma_tolerance_(sigma_tolerance) {
       DIALS_ASSERT(sampler_ != 0);
+      DIALS_ASSERT(sigma_tolerance >= 0);
     }
 
     boost::shared_ptr<BeamBase> beam() const {
@@ -255,6 +266,14 @@ namespace dials { namespace algorithms {
       return fit_method_;
     }
 
+    bool warm_start() const {
+      return warm_start_;
+    }
+
+    double sigma_tolerance() const {
+      return sigma_tolerance_;
+    }
+
     vec3<double> coord(std::size_t index) const {
       return sampler_->coord(index);
     }
@@ -312,12 +331,9 @@ namespace dials { namespace algorithms {
             spec_, cs, sbox[i].bbox, sbox[i].panel, data.const_ref(), mask.const_ref());
 
           // Get the indices and weights of the profiles
-          af::shared<std::size_t> indices =
-            sampler_->nearest_n(sbox[i].panel, xyzpx[i]);
-          af::shared<double> weights(indices.size());
-          for (std::size_t j = 0; j < indices.size(); ++j) {
-            weights[j] = sampler_->weight(indices[j], sbox[i].panel, xyzpx[i]);
-          }
+          af::shared<std::size_t> indices;
+          af::shared<double> weights;
+          sampler_->nearest_n_weights(sbox[i].panel, xyzpx[i], indices, weights);
 
           // Add the profile
           add(
@@ -388,6 +404,8 @@ namespace dials { namespace algorithms {
       af::ref<double> intensity_val = reflections["intensity.prf.value"];
       af::ref<double> intensity_var = reflections["intensity.prf.variance"];
       af::ref<double> reference_cor = reflections["profile.correlation"];
+      af::ref<int> niter = reflections["profile.niter"];
+      af::const_ref<double> intensity_sum = get_intensity_sum(reflections);
       // af::ref<double> reference_rmsd = reflections["profile.rmsd"];
 
       // Loop through all the reflections and process them
@@ -399,6 +417,7 @@ namespace dials { namespace algorithms {
         intensity_val[i] = 0.0;
         intensity_var[i] = -1.0;
         reference_cor[i] = 0.0;
+        niter[i] = -1;
         // reference_rmsd[i] = 0.0;
         flags[i] &= ~af::IntegratedPrf;
 
@@ -407,7 +426,8 @@ namespace dials { namespace algorithms {
           try {
             // Get the reference profiles
             std::size_t index = sampler_->nearest(sbox[i].panel, xyzpx[i]);
-            data_const_reference p = data(index).const_ref();
+            data_type profile = data(index);
+            data_const_reference p = profile.const_ref();
             mask_const_reference mask1 = mask(index).const_ref();
 
             // Create the coordinate system
@@ -451,13 +471,21 @@ namespace dials { namespace algorithms {
             }
 
             // Do the profile fitting
-            ProfileFitter<double> fit(c, b, m.const_ref(), p, 1e-3, 100);
+            ProfileFitter<double> fit(c,
+                                      b,
+                                      m.const_ref(),
+                                      p,
+                                      1e-3,
+                                      100,
+                                      sigma_tolerance_,
+                                      fit_start(intensity_sum, flags[i], i));
             // DIALS_ASSERT(fit.niter() < 100);
 
             // Set the data in the reflection
             intensity_val[i] = fit.intensity()[0];
             intensity_var[i] = fit.variance()[0];
             reference_cor[i] = fit.correlation();
+            niter[i] = fit.niter();
             // reference_rmsd[i] = fit.rmsd();
 
             // Set the integrated flag
@@ -496,6 +524,8 @@ namespace dials { namespace algorithms {
       af::ref<double> intensity_val = reflections["intensity.prf.value"];
       af::ref<double> intensity_var = reflections["intensity.prf.variance"];
       af::ref<double> reference_cor = reflections["profile.correlation"];
+      af::ref<int> niter = reflections["profile.niter"];
+      af::const_ref<double> intensity_sum = get_intensity_sum(reflections);
 
       // Loop through all the reflections and process them
       af::shared<bool> success(reflections.size(), false);
@@ -506,6 +536,7 @@ namespace dials { namespace algorithms {
         intensity_val[i] = 0.0;
         intensity_var[i] = -1.0;
         reference_cor[i] = 0.0;
+        niter[i] = -1;
         flags[i] &= ~af::IntegratedPrf;
 
         // Check if we want to use this reflection
@@ -513,7 +544,8 @@ namespace dials { namespace algorithms {
           try {
             // Get the reference profiles
             std::size_t index = sampler_->nearest(sbox[i].panel, xyzpx[i]);
-            data_const_reference d = data(index).const_ref();
+            data_type profile = data(index);
+            data_const_reference d = profile.const_ref();
 
             // Create the coordinate system
             vec3<double> m2 = spec_.goniometer().get_rotation_axis();
@@ -543,14 +575,21 @@ namespace dials { namespace algorithms {
                            detail::check_mask_code(Valid | Foreground));
 
             // Do the profile fitting
-            ProfileFitter<double> fit(
-              c.const_ref(), b.const_ref(), m.const_ref(), p, 1e-3, 100);
+            ProfileFitter<double> fit(c.const_ref(),
+                                      b.const_ref(),
+                                      m.const_ref(),
+                                      p,
+                                      1e-3,
+                                      100,
+                                      sigma_tolerance_,
+                                      fit_start(intensity_sum, flags[i], i));
             // DIALS_ASSERT(fit.niter() < 100);
 
             // Set the data in the reflection
             intensity_val[i] = fit.intensity()[0];
             intensity_var[i] = fit.variance()[0];
             reference_cor[i] = fit.correlation();
+            niter[i] = fit.niter();
 
             // Set the integrated flag
             flags[i] |= af::IntegratedPrf;
@@ -579,14 +618,25 @@ namespace dials { namespace algorithms {
                                        num_scan_points_,
                                        threshold_,
                                        grid_method_,
-                                       fit_method_);
+                                       fit_method_,
+                                       warm_start_,
+                                       sigma_tolerance_,
+                                       single_precision_);
       result.finalized_ = finalized_;
       result.n_reflections_.assign(n_reflections_.begin(), n_reflections_.end());
       for (std::size_t i = 0; i < data_.size(); ++i) {
         if (data_[i].size() > 0) {
           result.data_[i] = data_type(accessor_, 0);
-          result.mask_[i] = mask_type(accessor_, true);
           std::copy(data_[i].begin(), data_[i].end(), result.data_[i].begin());
+        }
+        if (float_data_[i].size() > 0) {
+          result.float_data_[i] = float_data_type(accessor_, 0);
+          std::copy(float_data_[i].begin(),
+                    float_data_[i].end(),
+                    result.float_data_[i].begin());
+        }
+        if (mask_[i].size() > 0) {
+          result.mask_[i] = mask_type(accessor_, true);
           std::copy(mask_[i].begin(), mask_[i].end(), result.mask_[i].begin());
         }
       }
@@ -676,7 +726,31 @@ namespace dials { namespace algorithms {
       return integrate && bbox_valid;
     }
 
+    /**
+     * @returns The summation intensities if fitting is to start from them
+     */
+    af::const_ref<double> get_intensity_sum(af::reflection_table reflections) const {
+      if (warm_start_ && reflections.contains("intensity.sum.value")) {
+        return reflections["intensity.sum.value"];
+      }
+      return af::const_ref<double>();
+    }
+
+    /**
+     * @returns The intensity to start fitting from, if any
+     */
+    boost::optional<double> fit_start(const af::const_ref<double> &intensity_sum,
+                                      std::size_t flags,
+                                      std::size_t index) const {
+      if (intensity_sum.size() > 0 && (flags & af::IntegratedSum)) {
+        return intensity_sum[index];
+      }
+      return boost::none;
+    }
+
     TransformSpec spec_;
+    bool warm_start_;
+    double sigma_tolerance_;
   };
 
 }}  // namespace dials::algorithms
@@ -11,8 +11,12 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_PARTIALITY_CALCULATOR_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_PARTIALITY_CALCULATOR_H
 
+#include <algorithm>
 #include <cmath>
+#include <string>
+#include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/math/special_functions/erf.hpp>
 #include <scitbx/constants.h>
 #include <scitbx/vec3.h>
@@ -24,6 +28,8 @@
 #include <dxtbx/model/scan.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/util/thread_pool.h>
+#include <dials/error.h>
 
 namespace dials {
   namespace algorithms {
@@ -59,6 +65,78 @@ namespace dials {
     virtual af::shared<double> array(const af::const_ref<vec3<double> > &s1,
                                      const af::const_ref<double> &frame,
                                      const af::const_ref<int6> &bbox) const = 0;
+
+    /**
+     * Calculate the partialities of a reflection table's columns using
+     * several threads. The reflections are split into blocks which are
+     * shared between the threads; the result is the same as from array.
+     * @param s1 The array of diffracted beam vectors
+     * @param frame The array of frame numbers
+     * @param bbox The array of bounding boxes
+     * @param nthreads The number of threads to use
+     * @returns The partiality of each reflection
+     */
+    af::shared<double> parallel_array(const af::const_ref<vec3<double> > &s1,
+                                      const af::const_ref<double> &frame,
+                                      const af::const_ref<int6> &bbox,
+                                      std::size_t nthreads) const {
+      DIALS_ASSERT(s1.size() == frame.size());
+      DIALS_ASSERT(s1.size() == bbox.size());
+      DIALS_ASSERT(nthreads > 0);
+      const std::size_t block_size = 1024;
+      if (nthreads == 1 || s1.size() <= block_size) {
+        return array(s1, frame, bbox);
+      }
+      af::shared<double> result(s1.size(), af::init_functor_null<double>());
+      std::string error;
+      boost::mutex error_mutex;
+      {
+        std::size_t num_blocks = (s1.size() + block_size - 1) / block_size;
+        dials::util::WorkStealingThreadPool pool(std::min(nthreads, num_blocks));
+        for (std::size_t first = 0; first < s1.size(); first += block_size) {
+          std::size_t num = std::min(block_size, s1.size() - first);
+          pool.post(boost::bind(&PartialityCalculatorIface::compute_block,
+                                this,
+                                &s1[first],
+                                &frame[first],
+                                &bbox[first],
+                                &result[first],
+                                num,
+                                &error,
+                                &error_mutex));
+        }
+        pool.wait();
+      }
+      if (!error.empty()) {
+        throw DIALS_ERROR(error);
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Compute a block of partialities in a worker thread. Exceptions are
+     * caught and saved so that they can be reported from the calling thread.
+     */
+    static void compute_block(const PartialityCalculatorIface *compute,
+                              const vec3<double> *s1,
+                              const double *frame,
+                              const int6 *bbox,
+                              double *result,
+                              std::size_t num,
+                              std::string *error,
+                              boost::mutex *error_mutex) {
+      try {
+        for (std::size_t i = 0; i < num; ++i) {
+          result[i] = compute->single(s1[i], frame[i], bbox[i]);
+        }
+      } catch (const std::exception &e) {
+        boost::lock_guard<boost::mutex> lock(*error_mutex);
+        if (error->empty()) {
+          *error = e.what();
+        }
+      }
+    }
   };
 
   /** Calculate the partiality for each reflection */
@@ -76,7 +154,7 @@ namespace dials {
                            const Scan &scan,
                            double sigma_m)
         : s0_(beam.get_s0()),
-          m2_(gonio.get_rotation_axis()),
+          m2_(gonio.get_rotation_axis().normalize()),
           scan_(scan),
           sigma_m_(1, sigma_m) {
       DIALS_ASSERT(sigma_m > 0.0);
@@ -94,7 +172,7 @@ namespace dials {
                            const Scan &scan,
                            const af::const_ref<double> &sigma_m)
         : s0_(beam.get_s0()),
-          m2_(gonio.get_rotation_axis()),
+          m2_(gonio.get_rotation_axis().normalize()),
           scan_(scan),
           sigma_m_(sigma_m.begin(), sigma_m.end()) {
       DIALS_ASSERT(sigma_m.all_gt(0.0));
@@ -113,6 +191,69 @@ namespace dials {
     virtual double single(vec3<double> s1, double frame, int6 bbox) const {
       // Ensure our values are ok
       DIALS_ASSERT(s1.length_sq() > 0);
+      double phi = scan_.get_angle_from_array_index(frame);
+      double zeta = profile_model::gaussian_rs::zeta_factor(m2_, s0_, s1);
+      return partiality(zeta, phi, frame, bbox);
+    }
+
+    /**
+     * Calculate the Partiality of the reflection given its coordinate
+     * system, e.g. a row of a table computed by the bbox calculator.
+     *
+     * @param cs The coordinate system of the reflection
+     * @param frame The frame number
+     * @param bbox The bounding box
+     * @returns The partiality as a fraction of the total phi extent
+     */
+    double single(const CoordinateSystem &cs, double frame, int6 bbox) const {
+      return partiality(cs.zeta(), cs.phi(), frame, bbox);
+    }
+
+    /**
+     * Calculate the partiality for an array of reflections given by their
+     * coordinate systems.
+     * @param cs The coordinate systems of the reflections
+     * @param frame The array of frame numbers.
+     * @param bbox The array of bboxes
+     */
+    af::shared<double> array(const CoordinateSystemTable &cs,
+                             const af::const_ref<double> &frame,
+                             const af::const_ref<int6> &bbox) const {
+      DIALS_ASSERT(cs.size() == frame.size());
+      DIALS_ASSERT(cs.size() == bbox.size());
+      DIALS_ASSERT(cs.m2() == m2_ && cs.s0() == s0_);
+      af::shared<double> zeta = cs.zeta();
+      af::shared<double> phi = cs.phi();
+      af::shared<double> result(cs.size(), af::init_functor_null<double>());
+      for (std::size_t i = 0; i < cs.size(); ++i) {
+        result[i] = partiality(zeta[i], phi[i], frame[i], bbox[i]);
+      }
+      return result;
+    }
+
+    /**
+     * Calculate the partiality for an array of reflections
+     * @param s1 The array of diffracted beam vectors
+     * @param frame The array of frame numbers.
+     * @param bbox The array of bboxes
+     */
+    virtual af::shared<double> array(const af::const_ref<vec3<double> > &s1,
+                                     const af::const_ref<double> &frame,
+                                     const af::const_ref<int6> &bbox) const {
+      DIALS_ASSERT(s1.size() == frame.size());
+      DIALS_ASSERT(s1.size() == bbox.size());
+      af::shared<double> result(s1.size(), af::init_functor_null<double>());
+      for (std::size_t i = 0; i < s1.size(); ++i) {
+        result[i] = single(s1[i], frame[i], bbox[i]);
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Calculate the partiality from the zeta factor and rotation angle
+     */
+    double partiality(double zeta, double phi, double frame, int6 bbox) const {
       DIALS_ASSERT(bbox[4] < bbox[5]);
 
       // Get the mosaicity at this point
@@ -131,40 +272,19 @@ namespace dials {
         }
       }
 
-      // Get the rotation angle
-      double phi = scan_.get_angle_from_array_index(frame);
+      // Get the rotation angles at the ends of the bbox
       double phia = scan_.get_angle_from_array_index(bbox[4]);
       double phib = scan_.get_angle_from_array_index(bbox[5]);
 
       // Compute the partiality
-      double zeta = profile_model::gaussian_rs::zeta_factor(m2_.normalize(), s0_, s1);
       double c = std::abs(zeta) / (sqrt(2.0) * sigma_m);
       double p = 0.5 * (erf(c * (phib - phi)) - erf(c * (phia - phi)));
       DIALS_ASSERT(p >= 0.0 && p <= 1.0);
       return p;
     }
 
-    /**
-     * Calculate the partiality for an array of reflections
-     * @param s1 The array of diffracted beam vectors
-     * @param frame The array of frame numbers.
-     * @param bbox The array of bboxes
-     */
-    virtual af::shared<double> array(const af::const_ref<vec3<double> > &s1,
-                                     const af::const_ref<double> &frame,
-                                     const af::const_ref<int6> &bbox) const {
-      DIALS_ASSERT(s1.size() == frame.size());
-      DIALS_ASSERT(s1.size() == bbox.size());
-      af::shared<double> result(s1.size(), af::init_functor_null<double>());
-      for (std::size_t i = 0; i < s1.size(); ++i) {
-        result[i] = single(s1[i], frame[i], bbox[i]);
-      }
-      return result;
-    }
-
-  private:
     vec3<double> s0_;
-    vec3<double> m2_;
+    vec3<double> m2_;  ///< The normalized rotation axis
     Scan scan_;
     af::shared<double> sigma_m_;
   };
@@ -190,6 +310,69 @@ namespace dials {
     virtual double single(vec3<double> s1, double frame, int6 bbox) const {
       // Ensure our values are ok
       DIALS_ASSERT(s1.length_sq() > 0);
+      double phi = scan_.get_angle_from_array_index(frame);
+      double zeta = profile_model::gaussian_rs::zeta_factor(m2_, s0_, s1);
+      return partiality(zeta, phi, frame, bbox);
+    }
+
+    /**
+     * Calculate the Partiality of the reflection given its coordinate
+     * system, e.g. a row of a table computed by the bbox calculator.
+     *
+     * @param cs The coordinate system of the reflection
+     * @param frame The frame number
+     * @param bbox The bounding box
+     * @returns The partiality as a fraction of the total phi extent
+     */
+    double single(const CoordinateSystem &cs, double frame, int6 bbox) const {
+      return partiality(cs.zeta(), cs.phi(), frame, bbox);
+    }
+
+    /**
+     * Calculate the partiality for an array of reflections given by their
+     * coordinate systems.
+     * @param cs The coordinate systems of the reflections
+     * @param frame The array of frame numbers.
+     * @param bbox The array of bboxes
+     */
+    af::shared<double> array(const CoordinateSystemTable &cs,
+                             const af::const_ref<double> &frame,
+                             const af::const_ref<int6> &bbox) const {
+      DIALS_ASSERT(cs.size() == frame.size());
+      DIALS_ASSERT(cs.size() == bbox.size());
+      DIALS_ASSERT(cs.m2() == m2_ && cs.s0() == s0_);
+      af::shared<double> zeta = cs.zeta();
+      af::shared<double> phi = cs.phi();
+      af::shared<double> result(cs.size(), af::init_functor_null<double>());
+      for (std::size_t i = 0; i < cs.size(); ++i) {
+        result[i] = partiality(zeta[i], phi[i], frame[i], bbox[i]);
+      }
+      return result;
+    }
+
+    /**
+     * Calculate the partiality for an array of reflections
+     * @param s1 The array of diffracted beam vectors
+     * @param frame The array of frame numbers.
+     * @param bbox The array of bboxes
+     */
+    virtual af::shared<double> array(const af::const_ref<vec3<double> > &s1,
+                                     const af::const_ref<double> &frame,
+                                     const af::const_ref<int6> &bbox) const {
+      DIALS_ASSERT(s1.size() == frame.size());
+      DIALS_ASSERT(s1.size() == bbox.size());
+      af::shared<double> result(s1.size(), af::init_functor_null<double>());
+      for (std::size_t i = 0; i < s1.size(); ++i) {
+        result[i] = single(s1[i], frame[i], bbox[i]);
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Calculate the partiality from the zeta factor and rotation angle
+     */
+    double partiality(double zeta, double phi, double frame, int6 bbox) const {
       DIALS_ASSERT(bbox[4] < bbox[5]);
 
       // FIXME This is a placeholder
@@ -0,0 +1,282 @@
+/*
+ * pixel_corner_grid.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_PIXEL_CORNER_GRID_H
+#define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_PIXEL_CORNER_GRID_H
+
+#include <string>
+#include <vector>
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <dxtbx/model/detector.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials {
+  namespace algorithms {
+    namespace profile_model {
+      namespace gaussian_rs {
+
+  using dxtbx::model::Detector;
+  using dxtbx::model::Panel;
+  using scitbx::vec2;
+  using scitbx::vec3;
+
+  /**
+   * The geometry of the pixel corners of each panel of a detector, used to
+   * project the corners of a shoebox onto the e1/e2 axes of the reflection's
+   * reciprocal space coordinate system.
+   *
+   * For a panel using the simple pixel to millimetre conversion, the lab
+   * coordinate of a pixel corner is the panel origin plus a step along the
+   * fast and slow axes for each pixel. These steps are stored once for the
+   * detector. The projections of a row of corners are then stepped along the
+   * row and only need a normalisation per corner. Other conversions, such as
+   * the parallax correction, depend on the attenuation length of the
+   * reflection, so the corners of those panels are converted one at a time
+   * through the panel model.
+   *
+   * The grid is immutable once built so it can be shared between threads.
+   */
+  class PixelCornerGrid {
+  public:
+    PixelCornerGrid() {}
+
+    /**
+     * @param detector The detector model
+     */
+    PixelCornerGrid(const Detector &detector) : panels_(detector.size()) {
+      for (std::size_t i = 0; i < detector.size(); ++i) {
+        const Panel &panel = detector[i];
+        PanelGeometry &geometry = panels_[i];
+        geometry.linear = panel.get_px_mm_strategy()->name() == "SimplePxMmStrategy";
+        geometry.origin = panel.get_origin();
+        geometry.dx = panel.get_fast_axis() * panel.get_pixel_size()[0];
+        geometry.dy = panel.get_slow_axis() * panel.get_pixel_size()[1];
+      }
+    }
+
+    /**
+     * @returns The number of bytes used by the grid
+     */
+    std::size_t nbytes() const {
+      return sizeof(*this) + panels_.capacity() * sizeof(PanelGeometry);
+    }
+
+    /**
+     * Project the corners of a shoebox onto the e1/e2 axes. For a corner
+     * with lab coordinate r this is e1.(r' - s1), e2.(r' - s1) where r' is
+     * r scaled to the given length.
+     * @param panel The panel
+     * @param panel_number The panel number
+     * @param s1 The diffracted beam vector
+     * @param e1 The e1 axis, already scaled as required
+     * @param e2 The e2 axis, already scaled as required
+     * @param length The length to scale the corner directions to
+     * @param x0 The first pixel along x
+     * @param y0 The first pixel along y
+     * @param attenuation_length The attenuation length
+     * @param coords The projection of each corner
+     */
+    void coordinates(const Panel &panel,
+                     std::size_t panel_number,
+                     const vec3<double> &s1,
+                     const vec3<double> &e1,
+                     const vec3<double> &e2,
+                     double length,
+                     int x0,
+                     int y0,
+                     double attenuation_length,
+                     af::ref<vec2<double>, af::c_grid<2> > coords) const {
+      compute(panel_number,
+              s1,
+              e1,
+              e2,
+              length,
+              x0,
+              y0,
+              attenuated_lab_coord(panel, attenuation_length),
+              coordinate_output(coords));
+    }
+
+    /**
+     * Compute the scaled squared e1/e2 distance of each corner of a shoebox
+     * @param panel The panel
+     * @param panel_number The panel number
+     * @param cs The reciprocal space coordinate system of the reflection
+     * @param s0_length The length of the incident beam vector
+     * @param delta_b_r2 The squared reciprocal of the beam divergence
+     * @param x0 The first pixel along x
+     * @param y0 The first pixel along y
+     * @param dxy The distance of each corner from the beam vector
+     */
+    template <typename CoordinateSystemType>
+    void distance(const Panel &panel,
+                  std::size_t panel_number,
+                  const CoordinateSystemType &cs,
+                  double s0_length,
+                  double delta_b_r2,
+                  int x0,
+                  int y0,
+                  af::ref<double, af::c_grid<2> > dxy) const {
+      double s1_length = cs.s1().length();
+      DIALS_ASSERT(s1_length > 0);
+      compute(panel_number,
+              cs.s1(),
+              cs.e1_axis() / s1_length,
+              cs.e2_axis() / s1_length,
+              s0_length,
+              x0,
+              y0,
+              lab_coord(panel),
+              distance_output(dxy, delta_b_r2));
+    }
+
+    /**
+     * Compute the scaled squared e1/e2 distance of each corner of a shoebox,
+     * with a fixed attenuation length used in the conversion of the corners
+     * @param panel The panel
+     * @param panel_number The panel number
+     * @param cs The reciprocal space coordinate system of the reflection
+     * @param s0_length The length of the incident beam vector
+     * @param delta_b_r2 The squared reciprocal of the beam divergence
+     * @param x0 The first pixel along x
+     * @param y0 The first pixel along y
+     * @param attenuation_length The attenuation length
+     * @param dxy The distance of each corner from the beam vector
+     */
+    template <typename CoordinateSystemType>
+    void distance(const Panel &panel,
+                  std::size_t panel_number,
+                  const CoordinateSystemType &cs,
+                  double s0_length,
+                  double delta_b_r2,
+                  int x0,
+                  int y0,
+                  double attenuation_length,
+                  af::ref<double, af::c_grid<2> > dxy) const {
+      double s1_length = cs.s1().length();
+      DIALS_ASSERT(s1_length > 0);
+      compute(panel_number,
+              cs.s1(),
+              cs.e1_axis() / s1_length,
+              cs.e2_axis() / s1_length,
+              s0_length,
+              x0,
+              y0,
+              attenuated_lab_coord(panel, attenuation_length),
+              distance_output(dxy, delta_b_r2));
+    }
+
+  private:
+    struct PanelGeometry {
+      bool linear;
+      vec3<double> origin;
+      vec3<double> dx;
+      vec3<double> dy;
+      PanelGeometry() : linear(false) {}
+    };
+
+    struct lab_coord {
+      const Panel &panel;
+      lab_coord(const Panel &panel_) : panel(panel_) {}
+      vec3<double> operator()(vec2<double> xy) const {
+        return panel.get_pixel_lab_coord(xy);
+      }
+    };
+
+    struct attenuated_lab_coord {
+      const Panel &panel;
+      double attenuation_length;
+      attenuated_lab_coord(const Panel &panel_, double attenuation_length_)
+          : panel(panel_), attenuation_length(attenuation_length_) {}
+      vec3<double> operator()(vec2<double> xy) const {
+        return panel.get_pixel_lab_coord(xy, attenuation_length);
+      }
+    };
+
+    struct coordinate_output {
+      af::ref<vec2<double>, af::c_grid<2> > coords;
+      coordinate_output(af::ref<vec2<double>, af::c_grid<2> > coords_)
+          : coords(coords_) {}
+      af::c_grid<2> accessor() const {
+        return coords.accessor();
+      }
+      void operator()(std::size_t j, std::size_t i, double g1, double g2) const {
+        coords(j, i) = vec2<double>(g1, g2);
+      }
+    };
+
+    struct distance_output {
+      af::ref<double, af::c_grid<2> > dxy;
+      double delta_b_r2;
+      distance_output(af::ref<double, af::c_grid<2> > dxy_, double delta_b_r2_)
+          : dxy(dxy_), delta_b_r2(delta_b_r2_) {}
+      af::c_grid<2> accessor() const {
+        return dxy.accessor();
+      }
+      void operator()(std::size_t j, std::size_t i, double g1, double g2) const {
+        dxy(j, i) = (g1 * g1 + g2 * g2) * delta_b_r2;
+      }
+    };
+
+    template <typename LabCoord, typename Output>
+    void compute(std::size_t panel_number,
+                 const vec3<double> &s1,
+                 const vec3<double> &e1,
+                 const vec3<double> &e2,
+                 double length,
+                 int x0,
+                 int y0,
+                 const LabCoord &get_lab_coord,
+                 const Output &output) const {
+      DIALS_ASSERT(panel_number < panels_.size());
+      std::size_t ysize = output.accessor()[0];
+      std::size_t xsize = output.accessor()[1];
+      const PanelGeometry &geometry = panels_[panel_number];
+      if (!geometry.linear) {
+        for (std::size_t j = 0; j < ysize; ++j) {
+          for (std::size_t i = 0; i < xsize; ++i) {
+            vec3<double> ds =
+              get_lab_coord(vec2<double>(x0 + (int)i, y0 + (int)j)).normalize()
+                * length
+              - s1;
+            output(j, i, e1 * ds, e2 * ds);
+          }
+        }
+        return;
+      }
+
+      // The e1/e2 components are linear in the lab coordinate so are stepped
+      // along each row; only the length of the lab coordinate is needed per
+      // corner.
+      double c1 = e1 * s1;
+      double c2 = e2 * s1;
+      double e1dx = e1 * geometry.dx;
+      double e2dx = e2 * geometry.dx;
+      for (std::size_t j = 0; j < ysize; ++j) {
+        vec3<double> r0 = geometry.origin + geometry.dx * (double)x0
+                          + geometry.dy * (double)(y0 + (int)j);
+        double e1r0 = e1 * r0;
+        double e2r0 = e2 * r0;
+        for (std::size_t i = 0; i < xsize; ++i) {
+          vec3<double> r = r0 + geometry.dx * (double)i;
+          double scale = length / r.length();
+          double g1 = (e1r0 + e1dx * (double)i) * scale - c1;
+          double g2 = (e2r0 + e2dx * (double)i) * scale - c2;
+          output(j, i, g1, g2);
+        }
+      }
+    }
+
+    std::vector<PanelGeometry> panels_;
+  };
+
+}}}}  // namespace dials::algorithms::profile_model::gaussian_rs
+
+#endif  // DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_PIXEL_CORNER_GRID_H
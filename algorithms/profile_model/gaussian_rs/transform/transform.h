@@ -11,6 +11,8 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_TRANSFORM_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_GAUSSIAN_RS_TRANSFORM_H
 
+#include <algorithm>
+#include <vector>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny_types.h>
@@ -20,6 +22,7 @@
 #include <dxtbx/model/scan.h>
 #include <dials/algorithms/polygon/spatial_interpolation.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
+#include <dials/algorithms/profile_model/gaussian_rs/pixel_corner_grid.h>
 #include <dials/algorithms/profile_model/gaussian_rs/transform/map_frames.h>
 #include <dials/algorithms/profile_model/gaussian_rs/transform/beam_vector_map.h>
 #include <dials/model/data/shoebox.h>
@@ -31,8 +34,11 @@ namespace dials {
   namespace transform {
 
     using dials::algorithms::polygon::simple_area;
-    using dials::algorithms::polygon::clip::quad_with_convex_quad;
+    using dials::algorithms::polygon::clip::clipped_area;
+    using dials::algorithms::polygon::clip::hexagon_with_x_range;
+    using dials::algorithms::polygon::clip::quad_with_y_range;
     using dials::algorithms::polygon::clip::vert4;
+    using dials::algorithms::polygon::clip::vert6;
     using dials::algorithms::polygon::clip::vert8;
     using dials::algorithms::polygon::spatial_interpolation::Match;
     using dials::algorithms::polygon::spatial_interpolation::quad_to_grid;
@@ -64,7 +70,9 @@ namespace dials {
 
     /**
      * A class to construct the specification for the transform. Once instantiated
-     * this object can be reused to transform lots of reflections.
+     * this object can be reused to transform lots of reflections. The geometry of
+     * the detector pixel corners is worked out once here and is only read by the
+     * transforms, so a spec can be shared between threads.
      */
     class TransformSpec {
     public:
@@ -99,7 +107,8 @@ namespace dials {
             step_size_(sigma_m_ * n_sigma_ / (grid_size + 0.5),
                        sigma_b_ * n_sigma_ / (grid_size + 0.5),
                        sigma_b_ * n_sigma_ / (grid_size + 0.5)),
-            grid_centre_(grid_size + 0.5, grid_size + 0.5, grid_size + 0.5) {
+            grid_centre_(grid_size + 0.5, grid_size + 0.5, grid_size + 0.5),
+            pixel_corners_(detector) {
         DIALS_ASSERT(sigma_m_ > 0);
         DIALS_ASSERT(sigma_b_ > 0);
         DIALS_ASSERT(n_sigma_ > 0);
@@ -163,6 +172,19 @@ namespace dials {
         return grid_centre_;
       }
 
+      /** @returns the pixel corner geometry of the detector */
+      const PixelCornerGrid &pixel_corners() const {
+        return pixel_corners_;
+      }
+
+      /**
+       * @returns The number of bytes of detector geometry cached by the spec
+       * and shared by every transform made with it
+       */
+      std::size_t cache_nbytes() const {
+        return pixel_corners_.nbytes();
+      }
+
     private:
       boost::shared_ptr<BeamBase> beam_;
       Detector detector_;
@@ -175,6 +197,7 @@ namespace dials {
       int3 grid_size_;
       double3 step_size_;
       double3 grid_centre_;
+      PixelCornerGrid pixel_corners_;
     };
 
     /**
@@ -204,7 +227,7 @@ namespace dials {
                        const af::const_ref<FloatType, af::c_grid<3> > &image,
                        const af::const_ref<bool, af::c_grid<3> > &mask) {
         init(spec, cs, bbox, panel);
-        call(spec.detector()[panel], image, mask);
+        call(spec, panel, image, mask);
       }
 
       TransformForward(const TransformSpec &spec,
@@ -215,7 +238,7 @@ namespace dials {
                        const af::const_ref<FloatType, af::c_grid<3> > &bkgrd,
                        const af::const_ref<bool, af::c_grid<3> > &mask) {
         init(spec, cs, bbox, panel);
-        call(spec.detector()[panel], image, bkgrd, mask);
+        call(spec, panel, image, bkgrd, mask);
       }
 
       /** @returns The transformed profile */
@@ -282,77 +305,15 @@ namespace dials {
        * @param image The image to transform
        * @param mask The mask accompanying the image
        */
-      void call(const Panel &panel,
+      void call(const TransformSpec &spec,
+                std::size_t panel,
                 const af::const_ref<FloatType, af::c_grid<3> > &image,
                 const af::const_ref<bool, af::c_grid<3> > &mask) {
         // Check the input
         DIALS_ASSERT(image.accessor().all_eq(shoebox_size_));
         DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
-
-        af::const_ref<FloatType, af::c_grid<2> > zfraction = zfraction_arr_.const_ref();
-        af::const_ref<FloatType, af::c_grid<2> > efraction = efraction_arr_.const_ref();
-
-        // Initialise the profile arrays
-        af::c_grid<3> accessor(grid_size_);
-        profile_ = af::versa<FloatType, af::c_grid<3> >(accessor, 0.0);
-        mask_ = af::versa<bool, af::c_grid<3> >(accessor, 0.0);
-
-        // Compute the mask
-        for (std::size_t kk = 0; kk < grid_size_[0]; ++kk) {
-          double sumk = 0;
-          for (std::size_t k = 0; k < shoebox_size_[0]; ++k) {
-            sumk += efraction(kk, k);
-          }
-          if (sumk > 0.99) {
-            for (std::size_t j = 0; j < grid_size_[1]; ++j) {
-              for (std::size_t i = 0; i < grid_size_[2]; ++i) {
-                mask_(kk, j, i) = true;
-              }
-            }
-          }
-        }
-
-        vec2<double> shoebox_centroid_px = panel.get_ray_intersection_px(s1_);
-        double attenuation_length = panel.attenuation_length(shoebox_centroid_px);
-
-        af::versa<vec2<double>, af::c_grid<2> > gc_array(
-          af::c_grid<2>(shoebox_size_[1] + 1, shoebox_size_[2] + 1));
-        for (int j = 0; j <= shoebox_size_[1]; ++j) {
-          for (int i = 0; i <= shoebox_size_[2]; ++i) {
-            gc_array(j, i) = gc(panel, j, i, attenuation_length);
-          }
-        }
-
-        // Loop through all the points in the shoebox. Calculate the polygon
-        // formed by the pixel in the local coordinate system. Find the points
-        // on the grid which intersect with the polygon and the fraction of the
-        // pixel area shared with each grid point. For each intersection, loop
-        // through the frames, mapping the fraction of the pixel value in each
-        // frame to the grid point.
-        af::c_grid<2> grid_size2(grid_size_[1], grid_size_[2]);
-        for (std::size_t j = 0; j < shoebox_size_[1]; ++j) {
-          for (std::size_t i = 0; i < shoebox_size_[2]; ++i) {
-            vert4 input(gc_array(j, i),
-                        gc_array(j, i + 1),
-                        gc_array(j + 1, i + 1),
-                        gc_array(j + 1, i));
-            af::shared<Match> matches = quad_to_grid(input, grid_size2, 0);
-            for (int m = 0; m < matches.size(); ++m) {
-              FloatType fraction = matches[m].fraction;
-              int index = matches[m].out;
-              int ii = index % grid_size_[2];
-              int jj = index / grid_size_[2];
-              for (int k = 0; k < shoebox_size_[0]; ++k) {
-                if (mask(k, j, i)) {
-                  FloatType value = image(k, j, i) * fraction;
-                  for (int kk = 0; kk < grid_size_[0]; ++kk) {
-                    profile_(kk, jj, ii) += value * zfraction(k, kk);
-                  }
-                }
-              }
-            }
-          }
-        }
+        af::versa<FloatType, af::c_grid<3> > bkgrd;
+        map_pixels(spec, panel, image, bkgrd.const_ref(), mask);
       }
 
       /**
@@ -361,7 +322,8 @@ namespace dials {
        * @param bkgrd The background image to transform
        * @param mask The mask accompanying the image
        */
-      void call(const Panel &panel,
+      void call(const TransformSpec &spec,
+                std::size_t panel,
                 const af::const_ref<FloatType, af::c_grid<3> > &image,
                 const af::const_ref<FloatType, af::c_grid<3> > &bkgrd,
                 const af::const_ref<bool, af::c_grid<3> > &mask) {
@@ -369,6 +331,30 @@ namespace dials {
         DIALS_ASSERT(image.accessor().all_eq(shoebox_size_));
         DIALS_ASSERT(image.accessor().all_eq(mask.accessor()));
         DIALS_ASSERT(image.accessor().all_eq(bkgrd.accessor()));
+        map_pixels(spec, panel, image, bkgrd, mask);
+      }
+
+      /**
+       * Map the pixel values, and the background values if given, to the grid.
+       *
+       * Each pixel's values are first spread over the grid frames, summing
+       * over the frames of the shoebox, giving a column of values for the
+       * pixel. Each grid point overlapping the pixel then receives the column
+       * scaled by the overlap fraction. This is the same sum as mapping each
+       * frame separately but the work for a match no longer depends on the
+       * number of frames. The grid is accumulated with the frame index
+       * innermost so that each column is added with a contiguous, vectorisable
+       * loop, and is reordered into the profile at the end.
+       * @param image The image to transform
+       * @param bkgrd The background image to transform or an empty array
+       * @param mask The mask accompanying the image
+       */
+      void map_pixels(const TransformSpec &spec,
+                      std::size_t panel_number,
+                      const af::const_ref<FloatType, af::c_grid<3> > &image,
+                      const af::const_ref<FloatType, af::c_grid<3> > &bkgrd,
+                      const af::const_ref<bool, af::c_grid<3> > &mask) {
+        bool use_background = bkgrd.size() > 0;
 
         af::const_ref<FloatType, af::c_grid<2> > zfraction = zfraction_arr_.const_ref();
         af::const_ref<FloatType, af::c_grid<2> > efraction = efraction_arr_.const_ref();
@@ -376,7 +362,9 @@ namespace dials {
         // Initialise the profile arrays
         af::c_grid<3> accessor(grid_size_);
         profile_ = af::versa<FloatType, af::c_grid<3> >(accessor, 0.0);
-        background_ = af::versa<FloatType, af::c_grid<3> >(accessor, 0.0);
+        if (use_background) {
+          background_ = af::versa<FloatType, af::c_grid<3> >(accessor, 0.0);
+        }
         mask_ = af::versa<bool, af::c_grid<3> >(accessor, 0.0);
 
         // Compute the mask
@@ -394,26 +382,69 @@ namespace dials {
           }
         }
 
+        const Panel &panel = spec.detector()[panel_number];
         vec2<double> shoebox_centroid_px = panel.get_ray_intersection_px(s1_);
         double attenuation_length = panel.attenuation_length(shoebox_centroid_px);
 
+        // The grid coordinates of the pixel corners
         af::versa<vec2<double>, af::c_grid<2> > gc_array(
           af::c_grid<2>(shoebox_size_[1] + 1, shoebox_size_[2] + 1));
-        for (int j = 0; j <= shoebox_size_[1]; ++j) {
-          for (int i = 0; i <= shoebox_size_[2]; ++i) {
-            gc_array(j, i) = gc(panel, j, i, attenuation_length);
-          }
+        spec.pixel_corners().coordinates(panel,
+                                         panel_number,
+                                         s1_,
+                                         e1_,
+                                         e2_,
+                                         s1_.length(),
+                                         x0_,
+                                         y0_,
+                                         attenuation_length,
+                                         gc_array.ref());
+        for (std::size_t p = 0; p < gc_array.size(); ++p) {
+          gc_array[p] = vec2<double>(grid_cent_[2] + gc_array[p][0] / step_size_[2],
+                                     grid_cent_[1] + gc_array[p][1] / step_size_[1]);
         }
 
+        // The grid with the frame index innermost and the columns of a pixel
+        std::size_t nz = grid_size_[0];
+        std::size_t nxy = grid_size_[1] * grid_size_[2];
+        std::vector<FloatType> igrid(nxy * nz, 0);
+        std::vector<FloatType> bgrid(use_background ? nxy * nz : 0, 0);
+        std::vector<FloatType> icolumn(nz);
+        std::vector<FloatType> bcolumn(nz);
+
         // Loop through all the points in the shoebox. Calculate the polygon
         // formed by the pixel in the local coordinate system. Find the points
         // on the grid which intersect with the polygon and the fraction of the
-        // pixel area shared with each grid point. For each intersection, loop
-        // through the frames, mapping the fraction of the pixel value in each
-        // frame to the grid point.
+        // pixel area shared with each grid point. For each intersection, add
+        // the fraction of the pixel's frame-mapped values to the grid point.
         af::c_grid<2> grid_size2(grid_size_[1], grid_size_[2]);
         for (std::size_t j = 0; j < shoebox_size_[1]; ++j) {
           for (std::size_t i = 0; i < shoebox_size_[2]; ++i) {
+            // Map the frames of the pixel to the grid frames
+            bool any_valid = false;
+            std::fill(icolumn.begin(), icolumn.end(), FloatType(0));
+            std::fill(bcolumn.begin(), bcolumn.end(), FloatType(0));
+            for (std::size_t k = 0; k < shoebox_size_[0]; ++k) {
+              if (mask(k, j, i)) {
+                any_valid = true;
+                const FloatType *zf = &zfraction(k, 0);
+                FloatType ivalue = image(k, j, i);
+                for (std::size_t kk = 0; kk < nz; ++kk) {
+                  icolumn[kk] += ivalue * zf[kk];
+                }
+                if (use_background) {
+                  FloatType bvalue = bkgrd(k, j, i);
+                  for (std::size_t kk = 0; kk < nz; ++kk) {
+                    bcolumn[kk] += bvalue * zf[kk];
+                  }
+                }
+              }
+            }
+            if (!any_valid) {
+              continue;
+            }
+
+            // Spread the column over the grid points covered by the pixel
             vert4 input(gc_array(j, i),
                         gc_array(j, i + 1),
                         gc_array(j + 1, i + 1),
@@ -421,47 +452,34 @@ namespace dials {
             af::shared<Match> matches = quad_to_grid(input, grid_size2, 0);
             for (int m = 0; m < matches.size(); ++m) {
               FloatType fraction = matches[m].fraction;
-              int index = matches[m].out;
-              int jj = index / grid_size_[2];
-              int ii = index % grid_size_[2];
-              for (int k = 0; k < shoebox_size_[0]; ++k) {
-                if (mask(k, j, i)) {
-                  FloatType ivalue = image(k, j, i) * fraction;
-                  FloatType bvalue = bkgrd(k, j, i) * fraction;
-                  for (int kk = 0; kk < grid_size_[0]; ++kk) {
-                    FloatType zf = zfraction(k, kk);
-                    profile_(kk, jj, ii) += ivalue * zf;
-                    background_(kk, jj, ii) += bvalue * zf;
-                  }
+              std::size_t offset = matches[m].out * nz;
+              FloatType *iout = &igrid[offset];
+              for (std::size_t kk = 0; kk < nz; ++kk) {
+                iout[kk] += fraction * icolumn[kk];
+              }
+              if (use_background) {
+                FloatType *bout = &bgrid[offset];
+                for (std::size_t kk = 0; kk < nz; ++kk) {
+                  bout[kk] += fraction * bcolumn[kk];
                 }
               }
             }
           }
         }
-      }
-
-      /**
-       * Get a grid coordinate from an image coordinate
-       * @param j The y index
-       * @param i The x index
-       * @returns The grid (c1, c2) index
-       */
-      vec2<double> gc(const Panel &panel, std::size_t j, std::size_t i) const {
-        vec3<double> sp = panel.get_pixel_lab_coord(vec2<double>(x0_ + i, y0_ + j));
-        vec3<double> ds = sp.normalize() * s1_.length() - s1_;
-        return vec2<double>(grid_cent_[2] + (e1_ * ds) / step_size_[2],
-                            grid_cent_[1] + (e2_ * ds) / step_size_[1]);
-      }
 
-      vec2<double> gc(const Panel &panel,
-                      std::size_t j,
-                      std::size_t i,
-                      double attenuation_length) const {
-        vec3<double> sp =
-          panel.get_pixel_lab_coord(vec2<double>(x0_ + i, y0_ + j), attenuation_length);
-        vec3<double> ds = sp.normalize() * s1_.length() - s1_;
-        return vec2<double>(grid_cent_[2] + (e1_ * ds) / step_size_[2],
-                            grid_cent_[1] + (e2_ * ds) / step_size_[1]);
+        // Reorder the grid into the profile
+        for (std::size_t kk = 0; kk < nz; ++kk) {
+          for (std::size_t p = 0; p < nxy; ++p) {
+            profile_[kk * nxy + p] = igrid[p * nz + kk];
+          }
+        }
+        if (use_background) {
+          for (std::size_t kk = 0; kk < nz; ++kk) {
+            for (std::size_t p = 0; p < nxy; ++p) {
+              background_[kk * nxy + p] = bgrid[p * nz + kk];
+            }
+          }
+        }
       }
 
       int x0_, y0_;
@@ -604,15 +622,10 @@ namespace dials {
             vert4 p1(xy00, xy01, xy11, xy10);
             reverse_quad_inplace_if_backward(p1);
             for (std::size_t jj = y0; jj < y1; ++jj) {
+              vert6 row = quad_with_y_range(p1, jj, jj + 1);
               for (std::size_t ii = x0; ii < x1; ++ii) {
-                vec2<double> xy200(ii, jj);
-                vec2<double> xy201(ii, jj + 1);
-                vec2<double> xy211(ii + 1, jj + 1);
-                vec2<double> xy210(ii + 1, jj);
-                vert4 p2(xy200, xy201, xy211, xy210);
-                reverse_quad_inplace_if_backward(p2);
-                vert8 p3 = quad_with_convex_quad(p1, p2);
-                double area = simple_area(p3);
+                vert8 p3 = hexagon_with_x_range(row, ii, ii + 1);
+                double area = clipped_area(p3);
                 const double EPS = 1e-7;
                 if (area < 0.0) {
                   DIALS_ASSERT(area > -EPS);
@@ -755,15 +768,10 @@ namespace dials {
             DIALS_ASSERT(p1_area > 0);
             reverse_quad_inplace_if_backward(p1);
             for (std::size_t jj = y0; jj < y1; ++jj) {
+              vert6 row = quad_with_y_range(p1, jj, jj + 1);
               for (std::size_t ii = x0; ii < x1; ++ii) {
-                vec2<double> xy200(ii, jj);
-                vec2<double> xy201(ii, jj + 1);
-                vec2<double> xy211(ii + 1, jj + 1);
-                vec2<double> xy210(ii + 1, jj);
-                vert4 p2(xy200, xy201, xy211, xy210);
-                reverse_quad_inplace_if_backward(p2);
-                vert8 p3 = quad_with_convex_quad(p1, p2);
-                double area = simple_area(p3);
+                vert8 p3 = hexagon_with_x_range(row, ii, ii + 1);
+                double area = clipped_area(p3);
                 area /= p1_area;
                 const double EPS = 1e-7;
                 if (area < 0.0) {
@@ -915,15 +923,10 @@ namespace dials {
             DIALS_ASSERT(p1_area > 0);
             reverse_quad_inplace_if_backward(p1);
             for (std::size_t jj = y0; jj < y1; ++jj) {
+              vert6 row = quad_with_y_range(p1, jj, jj + 1);
               for (std::size_t ii = x0; ii < x1; ++ii) {
-                vec2<double> xy200(ii, jj);
-                vec2<double> xy201(ii, jj + 1);
-                vec2<double> xy211(ii + 1, jj + 1);
-                vec2<double> xy210(ii + 1, jj);
-                vert4 p2(xy200, xy201, xy211, xy210);
-                reverse_quad_inplace_if_backward(p2);
-                vert8 p3 = quad_with_convex_quad(p1, p2);
-                double area = simple_area(p3);
+                vert8 p3 = hexagon_with_x_range(row, ii, ii + 1);
+                double area = clipped_area(p3);
                 area /= p1_area;
                 const double EPS = 1e-7;
                 if (area < 0.0) {
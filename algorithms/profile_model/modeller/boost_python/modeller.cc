@@ -68,8 +68,11 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   struct EmpiricalProfileModellerWrapper : EmpiricalProfileModeller,
                                            wrapper<EmpiricalProfileModeller> {
-    EmpiricalProfileModellerWrapper(std::size_t n, int3 accessor, double threshold)
-        : EmpiricalProfileModeller(n, accessor, threshold) {}
+    EmpiricalProfileModellerWrapper(std::size_t n,
+                                    int3 accessor,
+                                    double threshold,
+                                    bool single_precision = false)
+        : EmpiricalProfileModeller(n, accessor, threshold, single_precision) {}
 
     void model(af::reflection_table reflections) {
       this->get_override("model")(reflections);
@@ -127,10 +130,11 @@ namespace dials { namespace algorithms { namespace boost_python {
     class_<EmpiricalProfileModellerWrapper,
            boost::noncopyable,
            bases<ProfileModellerIface> >("EmpiricalProfileModeller", no_init)
-      .def(init<std::size_t, int3, double>())
+      .def(init<std::size_t, int3, double, optional<bool> >())
       .def("add", &EmpiricalProfileModeller::add)
       .def("valid", &EmpiricalProfileModeller::valid)
-      .def("n_reflections", &EmpiricalProfileModeller::n_reflections);
+      .def("n_reflections", &EmpiricalProfileModeller::n_reflections)
+      .def("single_precision", &EmpiricalProfileModeller::single_precision);
 
     class_<MultiExpProfileModeller>("MultiExpProfileModeller")
       .def("add", &MultiExpProfileModeller::add)
@@ -73,6 +73,15 @@ namespace dials { namespace algorithms { namespace boost_python {
     }
   };
 
+  boost::python::tuple nearest_n_weights(const SamplerIface &self,
+                                         std::size_t panel,
+                                         double3 xyz) {
+    af::shared<std::size_t> indices;
+    af::shared<double> weights;
+    self.nearest_n_weights(panel, xyz, indices, weights);
+    return boost::python::make_tuple(indices, weights);
+  }
+
   void export_sampler() {
     class_<SamplerIfaceWrapper, boost::noncopyable>("SamplerIface")
       .def("size", pure_virtual(&SamplerIface::size))
@@ -81,6 +90,8 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("weight", pure_virtual(&SamplerIface::weight))
       .def("coord", pure_virtual(&SamplerIface::coord))
       .def("neighbours", pure_virtual(&SamplerIface::neighbours))
+      .def("nearest_n_weights", &nearest_n_weights)
+      .def("nearest_batch", &SamplerIface::nearest_batch)
       .def("__len__", &SamplerIface::size);
 
     class_<SingleSampler, bases<SamplerIface> >("SingleSampler", no_init)
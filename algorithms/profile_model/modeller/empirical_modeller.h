@@ -12,6 +12,7 @@
 #ifndef DIALS_ALGORITHMS_PROFILE_MODEL_MODELLER_EMPIRICAL_MODELLER_H
 #define DIALS_ALGORITHMS_PROFILE_MODEL_MODELLER_EMPIRICAL_MODELLER_H
 
+#include <algorithm>
 #include <vector>
 #include <boost/pointer_cast.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
@@ -21,21 +22,34 @@ namespace dials { namespace algorithms {
 
   /**
    * A class to do empirical profile modelling
+   *
+   * The profiles are accumulated and normalised in double precision. With
+   * single precision storage they are converted to float once finalized,
+   * halving the memory used to hold them while they are read for fitting.
+   * The data accessor then returns a double precision copy of the profile.
    */
   class EmpiricalProfileModeller : public ProfileModellerIface {
   public:
+    typedef af::versa<float, af::c_grid<3> > float_data_type;
+
     /**
      * Initialise the modeller
      * @param n The number of profiles
      * @param accessor The size of the profiles
      * @param threshold The threshold for counts
+     * @param single_precision Store the finalized profiles as float
      */
-    EmpiricalProfileModeller(std::size_t n, int3 datasize, double threshold)
+    EmpiricalProfileModeller(std::size_t n,
+                             int3 datasize,
+                             double threshold,
+                             bool single_precision = false)
         : data_(n),
+          float_data_(n),
           mask_(n),
           n_reflections_(n, 0),
           accessor_(af::c_grid<3>(datasize[0], datasize[1], datasize[2])),
           threshold_(threshold),
+          single_precision_(single_precision),
           finalized_(false) {
       DIALS_ASSERT(n > 0);
       DIALS_ASSERT(datasize.all_gt(0));
@@ -133,14 +147,15 @@ namespace dials { namespace algorithms {
       // add the pixel values from the other modeller to this
       for (std::size_t i = 0; i < data_.size(); ++i) {
         n_reflections_[i] += other->n_reflections_[i];
-        if (other->data_[i].size() != 0) {
+        if (other->valid(i)) {
           if (data_[i].size() == 0) {
             data_[i] = data_type(accessor_, 0);
             mask_[i] = mask_type(accessor_, true);
           }
+          data_type other_data = other->data(i);
           data_reference d1 = data_[i].ref();
           mask_reference m1 = mask_[i].ref();
-          data_const_reference d2 = other->data_[i].const_ref();
+          data_const_reference d2 = other_data.const_ref();
           mask_const_reference m2 = other->mask_[i].const_ref();
           DIALS_ASSERT(d1.accessor().all_eq(d2.accessor()));
           DIALS_ASSERT(m1.accessor().all_eq(m2.accessor()));
@@ -163,6 +178,11 @@ namespace dials { namespace algorithms {
         }
       }
       finalized_ = true;
+      if (single_precision_) {
+        for (std::size_t i = 0; i < data_.size(); ++i) {
+          compact(i);
+        }
+      }
     }
 
     /**
@@ -177,6 +197,11 @@ namespace dials { namespace algorithms {
      */
     void set_finalized(bool finalized) {
       finalized_ = finalized;
+      if (finalized_ && single_precision_) {
+        for (std::size_t i = 0; i < data_.size(); ++i) {
+          compact(i);
+        }
+      }
     }
 
     /**
@@ -186,6 +211,10 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(index < data_.size());
       DIALS_ASSERT(value.size() == 0 || value.accessor().all_eq(accessor_));
       data_[index] = value;
+      float_data_[index] = float_data_type();
+      if (finalized_ && single_precision_) {
+        compact(index);
+      }
     }
 
     /**
@@ -207,6 +236,11 @@ namespace dials { namespace algorithms {
      */
     data_type data(std::size_t index) const {
       DIALS_ASSERT(index < data_.size());
+      if (float_data_[index].size() != 0) {
+        data_type result(accessor_);
+        std::copy(float_data_[index].begin(), float_data_[index].end(), result.begin());
+        return result;
+      }
       DIALS_ASSERT(data_[index].size() != 0);
       return data_[index];
     }
@@ -241,6 +275,13 @@ namespace dials { namespace algorithms {
       return threshold_;
     }
 
+    /**
+     * @return Are the finalized profiles stored as float
+     */
+    bool single_precision() const {
+      return single_precision_;
+    }
+
     /**
      * @return Is the profile valid
      */
@@ -320,11 +361,26 @@ namespace dials { namespace algorithms {
       }
     }
 
+    /**
+     * Convert a profile to single precision and release the double copy
+     * @param index The index of the profile
+     */
+    void compact(std::size_t index) {
+      if (data_[index].size() != 0) {
+        float_data_[index] = float_data_type(accessor_);
+        std::copy(
+          data_[index].begin(), data_[index].end(), float_data_[index].begin());
+        data_[index] = data_type();
+      }
+    }
+
     af::shared<data_type> data_;
+    af::shared<float_data_type> float_data_;
     af::shared<mask_type> mask_;
     af::shared<std::size_t> n_reflections_;
     af::c_grid<3> accessor_;
     double threshold_;
+    bool single_precision_;
     bool finalized_;
   };
 
@@ -113,6 +113,11 @@ namespace dials { namespace algorithms {
       double tot_area = 2 * two_pi;
       double area_one = tot_area / af::sum(num1_.const_ref());
       std::size_t num_image = af::sum(num1_.const_ref());
+      num_image_ = num_image;
+      offset1_ = af::shared<std::size_t>(num1_.size(), 0);
+      for (std::size_t i = 1; i < num1_.size(); ++i) {
+        offset1_[i] = offset1_[i - 1] + num1_[i - 1];
+      }
       step1_ = af::shared<double>(4);
       step2_ = af::shared<double>(4);
       coord_ = af::shared<double3>(num_image * num_phi_);
@@ -208,7 +213,7 @@ namespace dials { namespace algorithms {
      * @returns The total number of grid points
      */
     std::size_t size() const {
-      return af::sum(num1_.const_ref()) * num_phi_;
+      return num_image_ * num_phi_;
     }
 
     /**
@@ -217,31 +222,9 @@ namespace dials { namespace algorithms {
      * @returns The index of the reference profile
      */
     std::size_t nearest(std::size_t panel, double3 xyz) const {
-      vec3<double> s1 =
-        detector_[panel].get_pixel_lab_coord(vec2<double>(xyz[0], xyz[1])).normalize();
-      xyz[2] -= scan_range_[0];
-      double z = s1 * zaxis_;
-      double y = s1 * yaxis_;
-      double x = s1 * xaxis_;
-      double a = std::acos(z);
-      double b = std::atan2(y, x);
-      int iz = (int)floor(xyz[2] / step_phi_);
-      if (iz < 0) iz = 0;
-      if (iz >= num_phi_) iz = num_phi_ - 1;
-      int ix = num1_.size() - 1;
-      for (std::size_t i = 0; i < num1_.size(); ++i) {
-        if (a < step1_[i]) {
-          ix = i;
-          break;
-        }
-      }
-      if (ix < 0) ix = 0;
-      if (ix >= num1_.size()) ix = num1_.size() - 1;
-      if (b < 0) b += two_pi;
-      int iy = (int)floor(b / step2_[ix]);
-      if (iy < 0) iy = 0;
-      if (iy >= num1_[ix]) iy = num1_[ix] - 1;
-      return index(ix, iy, iz);
+      double a, b;
+      sphere_coord(panel, xyz, a, b);
+      return nearest_at(a, b, xyz[2]);
     }
 
     /**
@@ -262,6 +245,27 @@ namespace dials { namespace algorithms {
       return result;
     }
 
+    /**
+     * Find the nearest n reference profiles and their weights, projecting the
+     * point onto the Ewald sphere once for all of the profiles.
+     * @param panel The panel
+     * @param xyz The coordinate
+     * @param indices The reference profile indices
+     * @param weights The weight of each reference profile
+     */
+    void nearest_n_weights(std::size_t panel,
+                           double3 xyz,
+                           af::shared<std::size_t> &indices,
+                           af::shared<double> &weights) const {
+      double a, b;
+      sphere_coord(panel, xyz, a, b);
+      indices = nearest_n_index(nearest_at(a, b, xyz[2]));
+      weights = af::shared<double>(indices.size());
+      for (std::size_t j = 0; j < indices.size(); ++j) {
+        weights[j] = weight_at(indices[j], a, b);
+      }
+    }
+
     /**
      * Get the weight for the given profile at the given coordinate.
      * @param index The profile index
@@ -269,25 +273,9 @@ namespace dials { namespace algorithms {
      * @returns The weight (between 1.0 and 0.0)
      */
     double weight(std::size_t index, std::size_t panel, double3 xyz) const {
-      vec3<double> s1 =
-        detector_[panel].get_pixel_lab_coord(vec2<double>(xyz[0], xyz[1])).normalize();
-      xyz[2] -= scan_range_[0];
-      double z = s1 * zaxis_;
-      double y = s1 * yaxis_;
-      double x = s1 * xaxis_;
-      double p1 = pi / 2 - std::acos(z);
-      double l1 = std::atan2(y, x);
-      double3 c = coord_[index];
-      double p2 = pi / 2 - c[0];
-      double l2 = c[1];
-      double q = std::sin(p1) * std::sin(p2)
-                 + std::cos(p1) * std::cos(p2) * std::cos(std::abs(l1 - l2));
-      if (q > 1) q = 1;
-      if (q < -1) q = -1;
-      std::size_t idx = indx1_[index];
-      double step = (idx == 0 ? 2 * step1_[idx] : step1_[idx] - step1_[idx - 1]);
-      double d = std::acos(q) / step;
-      return std::exp(-4.0 * d * d * std::log(2.0));
+      double a, b;
+      sphere_coord(panel, xyz, a, b);
+      return weight_at(index, a, b);
     }
 
     /**
@@ -332,12 +320,61 @@ namespace dials { namespace algorithms {
 
   private:
     std::size_t index(std::size_t ix, std::size_t iy, std::size_t iz) const {
-      int tot_sum = af::sum(num1_.const_ref());
-      int par_sum = 0;
-      for (std::size_t i = 0; i < ix; ++i) {
-        par_sum += num1_[i];
+      return offset1_[ix] + iy + iz * num_image_;
+    }
+
+    /**
+     * Get the angle from the beam and the azimuth of a point on the Ewald sphere
+     */
+    void sphere_coord(std::size_t panel, double3 xyz, double &a, double &b) const {
+      vec3<double> s1 =
+        detector_[panel].get_pixel_lab_coord(vec2<double>(xyz[0], xyz[1])).normalize();
+      a = std::acos(s1 * zaxis_);
+      b = std::atan2(s1 * yaxis_, s1 * xaxis_);
+    }
+
+    /**
+     * Find the nearest profile from the position on the Ewald sphere and the
+     * frame number
+     */
+    std::size_t nearest_at(double a, double b, double z) const {
+      z -= scan_range_[0];
+      int iz = (int)floor(z / step_phi_);
+      if (iz < 0) iz = 0;
+      if (iz >= num_phi_) iz = num_phi_ - 1;
+      int ix = num1_.size() - 1;
+      for (std::size_t i = 0; i < num1_.size(); ++i) {
+        if (a < step1_[i]) {
+          ix = i;
+          break;
+        }
       }
-      return par_sum + iy + iz * tot_sum;
+      if (ix < 0) ix = 0;
+      if (ix >= num1_.size()) ix = num1_.size() - 1;
+      if (b < 0) b += two_pi;
+      int iy = (int)floor(b / step2_[ix]);
+      if (iy < 0) iy = 0;
+      if (iy >= num1_[ix]) iy = num1_[ix] - 1;
+      return index(ix, iy, iz);
+    }
+
+    /**
+     * Get the weight of a profile from the position on the Ewald sphere
+     */
+    double weight_at(std::size_t index, double a, double b) const {
+      double p1 = pi / 2 - a;
+      double l1 = b;
+      double3 c = coord_[index];
+      double p2 = pi / 2 - c[0];
+      double l2 = c[1];
+      double q = std::sin(p1) * std::sin(p2)
+                 + std::cos(p1) * std::cos(p2) * std::cos(std::abs(l1 - l2));
+      if (q > 1) q = 1;
+      if (q < -1) q = -1;
+      std::size_t idx = indx1_[index];
+      double step = (idx == 0 ? 2 * step1_[idx] : step1_[idx] - step1_[idx - 1]);
+      double d = std::acos(q) / step;
+      return std::exp(-4.0 * d * d * std::log(2.0));
     }
 
     boost::shared_ptr<BeamBase> beam_;
@@ -350,6 +387,8 @@ namespace dials { namespace algorithms {
     vec3<double> zaxis_;
     double max_angle_;
     af::shared<std::size_t> num1_;
+    af::shared<std::size_t> offset1_;
+    std::size_t num_image_;
     af::shared<double> step1_;
     af::shared<double> step2_;
     af::shared<double3> coord_;
@@ -13,6 +13,7 @@
 
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
@@ -68,6 +69,43 @@ namespace dials { namespace algorithms {
      * Return the neighbouring grid points.
      */
     virtual af::shared<std::size_t> neighbours(std::size_t index) const = 0;
+
+    /**
+     * Find the nearest n reference profiles to the given point together with
+     * their weights. This gives the same result as calling nearest_n and then
+     * weight for each profile; samplers which do expensive work to place the
+     * point in their sampling can override it to do that work once.
+     * @param panel The panel
+     * @param xyz The coordinate
+     * @param indices The reference profile indices
+     * @param weights The weight of each reference profile
+     */
+    virtual void nearest_n_weights(std::size_t panel,
+                                   double3 xyz,
+                                   af::shared<std::size_t> &indices,
+                                   af::shared<double> &weights) const {
+      indices = nearest_n(panel, xyz);
+      weights = af::shared<double>(indices.size());
+      for (std::size_t j = 0; j < indices.size(); ++j) {
+        weights[j] = weight(indices[j], panel, xyz);
+      }
+    }
+
+    /**
+     * Find the nearest reference profile to each of a list of points
+     * @param panel The panel of each point
+     * @param xyz The coordinate of each point
+     * @returns The index of the reference profile for each point
+     */
+    af::shared<std::size_t> nearest_batch(const af::const_ref<std::size_t> &panel,
+                                          const af::const_ref<double3> &xyz) const {
+      DIALS_ASSERT(panel.size() == xyz.size());
+      af::shared<std::size_t> result(xyz.size());
+      for (std::size_t i = 0; i < xyz.size(); ++i) {
+        result[i] = nearest(panel[i], xyz[i]);
+      }
+      return result;
+    }
   };
 
 }}  // namespace dials::algorithms
@@ -8,6 +8,7 @@
 from scitbx.math.periodogram import Periodogram
 
 from dials.array_family import flex
+from dials_refinement_helpers_ext import PhiBlocks
 
 RAD2DEG = 180.0 / math.pi
 
@@ -21,6 +22,12 @@ def __init__(self, reflections, av_callback=flex.mean, debug=False):
 
         self._av_callback = av_callback
 
+        # Keep only the columns used in the analysis, so that the selections
+        # below do not copy every column of the reflection table
+        keys = ["miller_index", "id", "xyzobs.mm.value", "xyzcal.mm"]
+        keys.extend(k for k in ["x_resid", "y_resid", "phi_resid"] if k in reflections)
+        reflections = reflections.select(tuple(keys))
+
         # Remove invalid reflections
         reflections = reflections.select(~(reflections["miller_index"] == (0, 0, 0)))
         x, y, z = reflections["xyzcal.mm"].parts()
@@ -45,8 +52,10 @@ def __init__(self, reflections, av_callback=flex.mean, debug=False):
             reflections["y_resid"] = y_cal - y_obs
             reflections["phi_resid"] = phi_cal - phi_obs
 
-        # create empty results list
+        # create empty results list, and the blocks of each experiment, which
+        # are kept to average the residuals
         self._results = []
+        self._blocks = []
 
         # first, just determine a suitable block size for analysis
         for iexp in range(self._nexp):
@@ -54,6 +63,7 @@ def __init__(self, reflections, av_callback=flex.mean, debug=False):
             if len(ref_this_exp) == 0:
                 # can't do anything, just keep an empty dictionary
                 self._results.append({})
+                self._blocks.append(None)
                 continue
             phi_obs_deg = ref_this_exp["xyzobs.mm.value"].parts()[2] * RAD2DEG
             phi_range = flex.min(phi_obs_deg), flex.max(phi_obs_deg)
@@ -66,19 +76,10 @@ def __init__(self, reflections, av_callback=flex.mean, debug=False):
                     nblocks -= 1
                 nblocks = max(nblocks, 1)
                 block_size = phi_width / nblocks
-                nr = flex.int()
-                for i in range(nblocks - 1):
-                    blk_start = phi_range[0] + i * block_size
-                    blk_end = blk_start + block_size
-                    sel = (phi_obs_deg >= blk_start) & (phi_obs_deg < blk_end)
-                    nref_in_block = sel.count(True)
-                    nr.append(nref_in_block)
-                # include max phi in the final block
-                blk_start = phi_range[0] + (nblocks - 1) * block_size
-                blk_end = phi_range[1]
-                sel = (phi_obs_deg >= blk_start) & (phi_obs_deg <= blk_end)
-                nref_in_block = sel.count(True)
-                nr.append(nref_in_block)
+                # assign the reflections to blocks in one pass, with the max phi
+                # included in the final block
+                blocks = PhiBlocks(phi_obs_deg, phi_range[0], block_size, nblocks)
+                nr = blocks.count()
                 # Break if there are enough reflections, otherwise increase block size,
                 # unless only one block remains
                 if nblocks == 1:
@@ -94,6 +95,7 @@ def __init__(self, reflections, av_callback=flex.mean, debug=False):
                 old_nblocks = nblocks
 
             # collect the basic data for this experiment
+            self._blocks.append(blocks)
             self._results.append(
                 {
                     "block_size": block_size,
@@ -127,30 +129,24 @@ def __call__(
                 block_size = results_this_exp.get("block_size")
                 if block_size is None:
                     continue
-                phi_range = results_this_exp["phi_range"]
                 nblocks = results_this_exp["nblocks"]
                 ref_this_exp = self._reflections.select(self._reflections["id"] == iexp)
-                x_resid = ref_this_exp["x_resid"]
-                y_resid = ref_this_exp["y_resid"]
-                phi_resid = ref_this_exp["phi_resid"]
-                phi_obs_deg = ref_this_exp["xyzobs.mm.value"].parts()[2] * RAD2DEG
+
+                # group the residuals by block, so that each block is a slice
+                blocks = self._blocks[iexp]
+                perm = blocks.permutation()
+                x_resid = ref_this_exp["x_resid"].select(perm)
+                y_resid = ref_this_exp["y_resid"].select(perm)
+                phi_resid = ref_this_exp["phi_resid"].select(perm)
                 xr_per_blk = flex.double()
                 yr_per_blk = flex.double()
                 pr_per_blk = flex.double()
-                for i in range(nblocks - 1):
-                    blk_start = phi_range[0] + i * block_size
-                    blk_end = blk_start + block_size
-                    sel = (phi_obs_deg >= blk_start) & (phi_obs_deg < blk_end)
-                    xr_per_blk.append(self._av_callback(x_resid.select(sel)))
-                    yr_per_blk.append(self._av_callback(y_resid.select(sel)))
-                    pr_per_blk.append(self._av_callback(phi_resid.select(sel)))
-                # include max phi in the final block
-                blk_start = phi_range[0] + (nblocks - 1) * block_size
-                blk_end = phi_range[1]
-                sel = (phi_obs_deg >= blk_start) & (phi_obs_deg <= blk_end)
-                xr_per_blk.append(self._av_callback(x_resid.select(sel)))
-                yr_per_blk.append(self._av_callback(y_resid.select(sel)))
-                pr_per_blk.append(self._av_callback(phi_resid.select(sel)))
+                blk_end = 0
+                for nref_in_block in blocks.count():
+                    blk_start, blk_end = blk_end, blk_end + nref_in_block
+                    xr_per_blk.append(self._av_callback(x_resid[blk_start:blk_end]))
+                    yr_per_blk.append(self._av_callback(y_resid[blk_start:blk_end]))
+                    pr_per_blk.append(self._av_callback(phi_resid[blk_start:blk_end]))
                 # the first and last block of average residuals (especially those in
                 # phi) are usually bad because rocking curves are truncated at the
                 # edges of the scan. When we have enough blocks and they are narrow,
@@ -0,0 +1,37 @@
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include "../outlier_detection/fast_mcd.h"
+
+using namespace boost::python;
+
+namespace dials { namespace refinement { namespace boost_python {
+
+  void export_fast_mcd() {
+    class_<MCDTrials>("MCDTrials")
+      .def(init<std::size_t, std::size_t>((arg("ntrials"), arg("p"))))
+      .def("__len__", &MCDTrials::size)
+      .def("num_params", &MCDTrials::num_params)
+      .def("det", &MCDTrials::det)
+      .def("location", &MCDTrials::location)
+      .def("covariance", &MCDTrials::covariance)
+      .def("select", &MCDTrials::select)
+      .def("extend", &MCDTrials::extend);
+
+    class_<MCDConcentration>("MCDConcentration", no_init)
+      .def(init<const af::const_ref<double, af::c_grid<2> > &, std::size_t>(
+        (arg("obs"), arg("h"))))
+      .def("num_obs", &MCDConcentration::num_obs)
+      .def("num_params", &MCDConcentration::num_params)
+      .def("h", &MCDConcentration::h)
+      .def("initial_trials",
+           &MCDConcentration::initial_trials,
+           (arg("permutations"), arg("nsteps"), arg("nthreads") = 1))
+      .def("iterate",
+           &MCDConcentration::iterate,
+           (arg("trials"),
+            arg("max_steps"),
+            arg("stop_on_convergence") = false,
+            arg("nthreads") = 1));
+  }
+
+}}}  // namespace dials::refinement::boost_python
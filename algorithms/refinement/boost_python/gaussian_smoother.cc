@@ -27,7 +27,10 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("spacing", &GaussianSmoother::spacing)
       .def("positions", &GaussianSmoother::positions)
       .def("value_weight", &GaussianSmoother::value_weight)
-      .def("multi_value_weight", &GaussianSmoother::multi_value_weight);
+      .def("multi_value_weight", &GaussianSmoother::multi_value_weight)
+      .def("cached_weights",
+           &GaussianSmoother::cached_weights,
+           (arg("x"), arg("nthreads") = 1));
 
     class_<SingleValueWeights>("SingleValueWeights", no_init)
       .def("get_value", &SingleValueWeights::get_value)
@@ -38,6 +41,19 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("get_value", &MultiValueWeights::get_value)
       .def("get_weight", &MultiValueWeights::get_weight)
       .def("get_sumweight", &MultiValueWeights::get_sumweight);
+
+    class_<SmootherWeights>("SmootherWeights", no_init)
+      .def("num_points", &SmootherWeights::num_points)
+      .def("num_values", &SmootherWeights::num_values)
+      .def("sumweight", &SmootherWeights::sumweight)
+      .def("weight", &SmootherWeights::weight, (arg("nthreads") = 1))
+      .def("normalised_weight",
+           &SmootherWeights::normalised_weight,
+           (arg("nthreads") = 1))
+      .def("value", &SmootherWeights::value, (arg("values"), arg("nthreads") = 1))
+      .def("multi_value_weight",
+           &SmootherWeights::multi_value_weight,
+           (arg("values"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::refinement::boost_python
@@ -26,7 +26,10 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("x_positions", &GaussianSmoother2D::x_positions)
       .def("y_positions", &GaussianSmoother2D::y_positions)
       .def("value_weight", &GaussianSmoother2D::value_weight)
-      .def("multi_value_weight", &GaussianSmoother2D::multi_value_weight);
+      .def("multi_value_weight", &GaussianSmoother2D::multi_value_weight)
+      .def("cached_weights",
+           &GaussianSmoother2D::cached_weights,
+           (arg("x"), arg("y"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::refinement::boost_python
@@ -61,6 +61,17 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("dU_dphi2", &CrystalOrientationCompose::dU_dphi2)
       .def("dU_dphi3", &CrystalOrientationCompose::dU_dphi3);
 
+    class_<MultiCrystalOrientationCompose>("MultiCrystalOrientationCompose", no_init)
+      .def(init<const af::const_ref<mat3<double> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<vec3<double> > &,
+                std::size_t>(
+        (arg("U0"), arg("phi"), arg("phi_axes"), arg("nthreads") = 1)))
+      .def("U", &MultiCrystalOrientationCompose::U)
+      .def("dU_dphi1", &MultiCrystalOrientationCompose::dU_dphi1)
+      .def("dU_dphi2", &MultiCrystalOrientationCompose::dU_dphi2)
+      .def("dU_dphi3", &MultiCrystalOrientationCompose::dU_dphi3);
+
     class_<PanelGroupCompose>("PanelGroupCompose", no_init)
       .def(init<vec3<double>,
                 vec3<double>,
@@ -77,6 +88,33 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("d2", &PanelGroupCompose::d2)
       .def("origin", &PanelGroupCompose::origin)
       .def("derivatives_for_panel", &PanelGroupCompose::derivatives_for_panel);
+
+    class_<MultiPanelGroupCompose>("MultiPanelGroupCompose", no_init)
+      .def(init<const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<std::size_t> &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                std::size_t>((arg("initial_d1s"),
+                              arg("initial_d2s"),
+                              arg("initial_dns"),
+                              arg("initial_gp_offsets"),
+                              arg("param_vals"),
+                              arg("param_axes"),
+                              arg("group_offset"),
+                              arg("offsets"),
+                              arg("dir1s"),
+                              arg("dir2s"),
+                              arg("nthreads") = 1)))
+      .def("d1", &MultiPanelGroupCompose::d1)
+      .def("d2", &MultiPanelGroupCompose::d2)
+      .def("origin", &MultiPanelGroupCompose::origin)
+      .def("derivatives", &MultiPanelGroupCompose::derivatives);
   }
 
 }}}  // namespace dials::refinement::boost_python
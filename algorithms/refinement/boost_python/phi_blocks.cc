@@ -0,0 +1,18 @@
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include "../phi_blocks.h"
+
+using namespace boost::python;
+
+namespace dials { namespace refinement { namespace boost_python {
+
+  void export_phi_blocks() {
+    class_<PhiBlocks>("PhiBlocks", no_init)
+      .def(init<const af::const_ref<double> &, double, double, std::size_t>(
+        (arg("phi"), arg("phi_start"), arg("block_size"), arg("nblocks"))))
+      .def("block", &PhiBlocks::block)
+      .def("count", &PhiBlocks::count)
+      .def("permutation", &PhiBlocks::permutation);
+  }
+
+}}}  // namespace dials::refinement::boost_python
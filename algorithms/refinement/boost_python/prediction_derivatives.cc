@@ -0,0 +1,180 @@
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include "../parameterisation/prediction_derivatives.h"
+
+using namespace boost::python;
+
+namespace dials { namespace refinement { namespace boost_python {
+
+  namespace detail {
+
+    template <typename Derivatives, typename T, typename Fn>
+    tuple derivatives(const Derivatives &self,
+                      Fn fn,
+                      const af::const_ref<std::size_t> &isel,
+                      const af::const_ref<T> &der) {
+      af::shared<vec3<double> > dpv(isel.size());
+      af::shared<double> dphi(isel.size());
+      (self.*fn)(isel, der, dpv.ref(), dphi.ref());
+      return make_tuple(dpv, dphi);
+    }
+
+    tuple beam(const XYPhiDerivatives &self,
+               const af::const_ref<std::size_t> &isel,
+               const af::const_ref<vec3<double> > &ds0) {
+      return derivatives(self, &XYPhiDerivatives::beam, isel, ds0);
+    }
+
+    tuple crystal_orientation(const XYPhiDerivatives &self,
+                              const af::const_ref<std::size_t> &isel,
+                              const af::const_ref<mat3<double> > &dU) {
+      return derivatives(self, &XYPhiDerivatives::crystal_orientation, isel, dU);
+    }
+
+    tuple crystal_unit_cell(const XYPhiDerivatives &self,
+                            const af::const_ref<std::size_t> &isel,
+                            const af::const_ref<mat3<double> > &dB) {
+      return derivatives(self, &XYPhiDerivatives::crystal_unit_cell, isel, dB);
+    }
+
+    tuple goniometer(const XYPhiDerivatives &self,
+                     const af::const_ref<std::size_t> &isel,
+                     const af::const_ref<mat3<double> > &dS) {
+      return derivatives(self, &XYPhiDerivatives::goniometer, isel, dS);
+    }
+
+    tuple stills_beam(const StillsDeltaPsiDerivatives &self,
+                      const af::const_ref<std::size_t> &isel,
+                      const af::const_ref<vec3<double> > &ds0) {
+      return derivatives(self, &StillsDeltaPsiDerivatives::beam, isel, ds0);
+    }
+
+    tuple stills_crystal_orientation(const StillsDeltaPsiDerivatives &self,
+                                     const af::const_ref<std::size_t> &isel,
+                                     const af::const_ref<mat3<double> > &dU) {
+      return derivatives(
+        self, &StillsDeltaPsiDerivatives::crystal_orientation, isel, dU);
+    }
+
+    tuple stills_crystal_unit_cell(const StillsDeltaPsiDerivatives &self,
+                                   const af::const_ref<std::size_t> &isel,
+                                   const af::const_ref<mat3<double> > &dB) {
+      return derivatives(self, &StillsDeltaPsiDerivatives::crystal_unit_cell, isel, dB);
+    }
+
+    af::shared<double> two_theta_crystal_unit_cell(
+      const TwoThetaDerivatives &self,
+      const af::const_ref<std::size_t> &isel,
+      const af::const_ref<mat3<double> > &dB) {
+      af::shared<double> d2theta(isel.size());
+      self.crystal_unit_cell(isel, dB, d2theta.ref());
+      return d2theta;
+    }
+
+    tuple dX_dp_and_dY_dp_from_dpv_dp_wrapper(
+      const af::const_ref<double> &w_inv,
+      const af::const_ref<double> &u_w_inv,
+      const af::const_ref<double> &v_w_inv,
+      const af::const_ref<vec3<double> > &dpv) {
+      af::shared<double> dX(dpv.size());
+      af::shared<double> dY(dpv.size());
+      dX_dp_and_dY_dp_from_dpv_dp(w_inv, u_w_inv, v_w_inv, dpv, dX.ref(), dY.ref());
+      return make_tuple(dX, dY);
+    }
+
+  }  // namespace detail
+
+  void export_prediction_derivatives() {
+    def("dX_dp_and_dY_dp_from_dpv_dp",
+        &detail::dX_dp_and_dY_dp_from_dpv_dp_wrapper,
+        (arg("w_inv"), arg("u_w_inv"), arg("v_w_inv"), arg("dpv")));
+
+    class_<XYPhiDerivatives>("XYPhiDerivatives", no_init)
+      .def(init<const af::const_ref<vec3<double> > &,
+                const af::const_ref<mat3<double> > &,
+                const af::const_ref<mat3<double> > &,
+                const af::const_ref<mat3<double> > &,
+                const af::const_ref<mat3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<mat3<double> > &,
+                std::size_t>((arg("h"),
+                              arg("U"),
+                              arg("B"),
+                              arg("fixed_rotation"),
+                              arg("setting_rotation"),
+                              arg("axis"),
+                              arg("phi"),
+                              arg("r"),
+                              arg("s1"),
+                              arg("e_X_r"),
+                              arg("e_r_s0"),
+                              arg("D"),
+                              arg("nthreads") = 1)))
+      .def("__len__", &XYPhiDerivatives::size)
+      .def("nthreads", &XYPhiDerivatives::nthreads)
+      .def("beam", &detail::beam, (arg("isel"), arg("ds0")))
+      .def("crystal_orientation",
+           &detail::crystal_orientation,
+           (arg("isel"), arg("dU")))
+      .def("crystal_unit_cell", &detail::crystal_unit_cell, (arg("isel"), arg("dB")))
+      .def("goniometer", &detail::goniometer, (arg("isel"), arg("dS")));
+
+    class_<StillsDeltaPsiDerivatives>("StillsDeltaPsiDerivatives", no_init)
+      .def(init<const af::const_ref<vec3<double> > &,
+                const af::const_ref<mat3<double> > &,
+                const af::const_ref<mat3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<mat3<double> > &,
+                std::size_t>((arg("h"),
+                              arg("U"),
+                              arg("B"),
+                              arg("s0"),
+                              arg("s0u"),
+                              arg("wavelength"),
+                              arg("r"),
+                              arg("e1"),
+                              arg("q"),
+                              arg("q0"),
+                              arg("c0"),
+                              arg("s1"),
+                              arg("DeltaPsi"),
+                              arg("D"),
+                              arg("nthreads") = 1)))
+      .def("__len__", &StillsDeltaPsiDerivatives::size)
+      .def("nthreads", &StillsDeltaPsiDerivatives::nthreads)
+      .def("beam", &detail::stills_beam, (arg("isel"), arg("ds0")))
+      .def("crystal_orientation",
+           &detail::stills_crystal_orientation,
+           (arg("isel"), arg("dU")))
+      .def("crystal_unit_cell",
+           &detail::stills_crystal_unit_cell,
+           (arg("isel"), arg("dB")));
+
+    class_<TwoThetaDerivatives>("TwoThetaDerivatives", no_init)
+      .def(init<const af::const_ref<vec3<double> > &,
+                const af::const_ref<mat3<double> > &,
+                const af::const_ref<double> &,
+                std::size_t>(
+        (arg("h"), arg("B"), arg("wavelength"), arg("nthreads") = 1)))
+      .def("__len__", &TwoThetaDerivatives::size)
+      .def("nthreads", &TwoThetaDerivatives::nthreads)
+      .def("crystal_unit_cell",
+           &detail::two_theta_crystal_unit_cell,
+           (arg("isel"), arg("dB")));
+  }
+
+}}}  // namespace dials::refinement::boost_python
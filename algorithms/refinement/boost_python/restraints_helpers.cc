@@ -25,6 +25,19 @@ namespace dials { namespace refinement { namespace boost_python {
       .def("daa_dp", &CalculateCellGradients::daa_dp)
       .def("dbb_dp", &CalculateCellGradients::dbb_dp)
       .def("dcc_dp", &CalculateCellGradients::dcc_dp);
+
+    class_<CalculateMultiCellGradients>("CalculateMultiCellGradients", no_init)
+      .def(init<const af::const_ref<mat3<double> > &,
+                const af::const_ref<mat3<double> > &,
+                const af::const_ref<std::size_t> &,
+                std::size_t>(
+        (arg("B"), arg("dB_dp"), arg("offset"), arg("nthreads") = 1)))
+      .def("da_dp", &CalculateMultiCellGradients::da_dp)
+      .def("db_dp", &CalculateMultiCellGradients::db_dp)
+      .def("dc_dp", &CalculateMultiCellGradients::dc_dp)
+      .def("daa_dp", &CalculateMultiCellGradients::daa_dp)
+      .def("dbb_dp", &CalculateMultiCellGradients::dbb_dp)
+      .def("dcc_dp", &CalculateMultiCellGradients::dcc_dp);
   }
 
 }}}  // namespace dials::refinement::boost_python
@@ -16,10 +16,30 @@ using namespace boost::python;
 
 namespace dials { namespace refinement { namespace boost_python {
 
+  boost::python::tuple R_and_dR_from_axes_and_angles_wrapper(
+    const af::const_ref<vec3<double> > &axes,
+    const af::const_ref<double> &angles,
+    bool deg) {
+    af::shared<mat3<double> > R(angles.size(), af::init_functor_null<mat3<double> >());
+    af::shared<mat3<double> > dR(angles.size(),
+                                 af::init_functor_null<mat3<double> >());
+    R_and_dR_from_axes_and_angles(axes, angles, R.ref(), dR.ref(), deg);
+    return boost::python::make_tuple(R, dR);
+  }
+
   void export_rtmats() {
     def("dR_from_axis_and_angle",
         &dR_from_axis_and_angle,
         (arg("axis"), arg("angle"), arg("deg") = false));
+    def("R_from_axes_and_angles",
+        &R_from_axes_and_angles,
+        (arg("axes"), arg("angles"), arg("deg") = false));
+    def("dR_from_axes_and_angles",
+        &dR_from_axes_and_angles,
+        (arg("axes"), arg("angles"), arg("deg") = false));
+    def("R_and_dR_from_axes_and_angles",
+        &R_and_dR_from_axes_and_angles_wrapper,
+        (arg("axes"), arg("angles"), arg("deg") = false));
   }
 
 }}}  // namespace dials::refinement::boost_python
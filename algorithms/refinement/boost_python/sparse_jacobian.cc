@@ -0,0 +1,46 @@
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include "../sparse_jacobian.h"
+
+using namespace boost::python;
+
+namespace dials { namespace refinement { namespace boost_python {
+
+  namespace detail {
+
+    typedef scitbx::sparse::matrix<double>::column_type column_type;
+
+    /**
+     * Build the Jacobian from a list with a list of gradient vectors for each
+     * dimension. The vectors are compacted here, while the GIL is held, so
+     * that the threads only read them.
+     */
+    scitbx::sparse::matrix<double> build_sparse_jacobian_wrapper(
+      list grads_each_dim,
+      std::size_t nref,
+      std::size_t nparam,
+      std::size_t nthreads) {
+      std::size_t ndim = len(grads_each_dim);
+      std::vector<const column_type *> gradients;
+      gradients.reserve(ndim * nparam);
+      for (std::size_t d = 0; d < ndim; ++d) {
+        list grads = extract<list>(grads_each_dim[d]);
+        DIALS_ASSERT((std::size_t)len(grads) == nparam);
+        for (std::size_t j = 0; j < nparam; ++j) {
+          column_type &grad = extract<column_type &>(grads[j]);
+          grad.compact();
+          gradients.push_back(&grad);
+        }
+      }
+      return build_sparse_jacobian(gradients, nref, nparam, nthreads);
+    }
+
+  }  // namespace detail
+
+  void export_sparse_jacobian() {
+    def("build_sparse_jacobian",
+        &detail::build_sparse_jacobian_wrapper,
+        (arg("grads_each_dim"), arg("nref"), arg("nparam"), arg("nthreads") = 1));
+  }
+
+}}}  // namespace dials::refinement::boost_python
@@ -14,10 +14,12 @@
 
 #include <cmath>      // for exp
 #include <algorithm>  // for std::min, std::max
+#include <vector>
 #include <scitbx/vec2.h>
 #include <scitbx/sparse/vector.h>
 #include <scitbx/sparse/matrix.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 #include <boost/math/special_functions/round.hpp>  // for iround
 
@@ -73,6 +75,223 @@ namespace dials { namespace refinement {
     }
   };
 
+  /**
+   * @returns The maximum number of smoother values with a non-zero weight at
+   *          a point, along one dimension of a smoother with nvalues values
+   *          of which naverage are averaged
+   */
+  inline std::size_t max_weights_per_point(std::size_t nvalues, std::size_t naverage) {
+    return std::max(std::max(naverage, (std::size_t)2),
+                    std::min(nvalues, (std::size_t)3));
+  }
+
+  /**
+   * The weights of a Gaussian smoother at a fixed set of points, such as the
+   * phi or frame positions of a set of reflections. The weights only depend
+   * on the positions of the points, so they are computed once and the
+   * interpolated values for new smoother parameter values are then found as
+   * a sparse matrix-vector product, in bands of points across threads, and
+   * with the same result as multi_value_weight.
+   *
+   * The smoother values below first_column have no column in the weight
+   * matrices, for smoothers with fixed initial values.
+   */
+  class SmootherWeights {
+  public:
+    /**
+     * Compute the weights at each point
+     * @param point_weights A functor that fills the column indices and
+     *                      weights of a point and returns their number
+     * @param npoints The number of points
+     * @param nvalues The number of smoother values
+     * @param stride The maximum number of weights at a point
+     * @param first_column The first smoother value with a column in the
+     *                     weight matrices
+     * @param nthreads The number of threads to use
+     */
+    template <typename PointWeights>
+    SmootherWeights(const PointWeights &point_weights,
+                    std::size_t npoints,
+                    std::size_t nvalues,
+                    std::size_t stride,
+                    std::size_t first_column,
+                    std::size_t nthreads)
+        : npoints_(npoints),
+          nvalues_(nvalues),
+          stride_(stride),
+          first_column_(first_column),
+          count_(npoints),
+          index_(npoints * stride),
+          weight_(npoints * stride),
+          sumweight_(npoints, af::init_functor_null<double>()) {
+      DIALS_ASSERT(stride > 0);
+      DIALS_ASSERT(first_column < nvalues);
+      dials::algorithms::for_each_band(
+        WeightRows<PointWeights>(*this, point_weights), (int)npoints, nthreads);
+    }
+
+    /** @returns The number of points */
+    std::size_t num_points() const {
+      return npoints_;
+    }
+
+    /** @returns The number of smoother values */
+    std::size_t num_values() const {
+      return nvalues_;
+    }
+
+    /** @returns The sum of the weights at each point */
+    af::shared<double> sumweight() const {
+      return sumweight_;
+    }
+
+    /**
+     * @returns The weight matrix, with a row for each point, as given by
+     *          multi_value_weight
+     */
+    matrix<double> weight(std::size_t nthreads = 1) const {
+      return weight_matrix(false, nthreads);
+    }
+
+    /**
+     * @returns The weight matrix with each row divided by the sum of its
+     *          weights, which is the derivative of the interpolated values
+     *          with respect to the smoother values
+     */
+    matrix<double> normalised_weight(std::size_t nthreads = 1) const {
+      return weight_matrix(true, nthreads);
+    }
+
+    /**
+     * Calculate the interpolated values at the points
+     * @param values The smoother values
+     * @param nthreads The number of threads to use
+     */
+    af::shared<double> value(const af::const_ref<double> &values,
+                             std::size_t nthreads = 1) const {
+      DIALS_ASSERT(values.size() == nvalues_);
+      af::shared<double> result(npoints_, af::init_functor_null<double>());
+      dials::algorithms::for_each_band(
+        ValueRows(*this, values, result.ref()), (int)npoints_, nthreads);
+      return result;
+    }
+
+    /**
+     * Calculate the interpolated values at the points and return them with
+     * the weights and their sums, as multi_value_weight
+     * @param values The smoother values
+     * @param nthreads The number of threads to use
+     */
+    MultiValueWeights multi_value_weight(const af::const_ref<double> &values,
+                                         std::size_t nthreads = 1) const {
+      return MultiValueWeights(value(values, nthreads), weight(nthreads), sumweight_);
+    }
+
+  private:
+    /**
+     * Compute the weights of a band of points
+     */
+    template <typename PointWeights>
+    struct WeightRows {
+      SmootherWeights &parent;
+      const PointWeights &point_weights;
+
+      WeightRows(SmootherWeights &parent_, const PointWeights &point_weights_)
+          : parent(parent_), point_weights(point_weights_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          std::size_t *index = &parent.index_[i * parent.stride_];
+          double *weight = &parent.weight_[i * parent.stride_];
+          std::size_t count = point_weights(i, index, weight);
+          DIALS_ASSERT(count <= parent.stride_);
+          double sumw = 0.0;
+          for (std::size_t k = 0; k < count; ++k) {
+            DIALS_ASSERT(index[k] < parent.nvalues_);
+            sumw += weight[k];
+          }
+          parent.count_[i] = count;
+          parent.sumweight_[i] = sumw;
+        }
+      }
+    };
+
+    /**
+     * Compute the interpolated values of a band of points
+     */
+    struct ValueRows {
+      const SmootherWeights &parent;
+      af::const_ref<double> values;
+      af::ref<double> result;
+
+      ValueRows(const SmootherWeights &parent_,
+                const af::const_ref<double> &values_,
+                af::ref<double> result_)
+          : parent(parent_), values(values_), result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          const std::size_t *index = &parent.index_[i * parent.stride_];
+          const double *weight = &parent.weight_[i * parent.stride_];
+          double sumwv = 0.0;
+          for (std::size_t k = 0; k < parent.count_[i]; ++k) {
+            sumwv += weight[k] * values[index[k]];
+          }
+          double sumw = parent.sumweight_[i];
+          result[i] = sumw > 0.0 ? sumwv / sumw : 0.0;
+        }
+      }
+    };
+
+    /**
+     * Fill a band of columns of a weight matrix. The elements of each column
+     * are added in row order, so the result is the same for any number of
+     * threads.
+     */
+    struct FillColumns {
+      const SmootherWeights &parent;
+      bool normalise;
+      matrix<double> &result;
+
+      FillColumns(const SmootherWeights &parent_,
+                  bool normalise_,
+                  matrix<double> &result_)
+          : parent(parent_), normalise(normalise_), result(result_) {}
+
+      void operator()(int j0, int j1) const {
+        std::size_t c0 = j0 + parent.first_column_;
+        std::size_t c1 = j1 + parent.first_column_;
+        for (std::size_t i = 0; i < parent.npoints_; ++i) {
+          const std::size_t *index = &parent.index_[i * parent.stride_];
+          const double *weight = &parent.weight_[i * parent.stride_];
+          double scale = normalise ? 1.0 / parent.sumweight_[i] : 1.0;
+          for (std::size_t k = 0; k < parent.count_[i]; ++k) {
+            if (index[k] >= c0 && index[k] < c1) {
+              double w = normalise ? weight[k] * scale : weight[k];
+              result(i, index[k] - parent.first_column_) = w;
+            }
+          }
+        }
+      }
+    };
+
+    matrix<double> weight_matrix(bool normalise, std::size_t nthreads) const {
+      matrix<double> result(npoints_, nvalues_ - first_column_);
+      dials::algorithms::for_each_band(
+        FillColumns(*this, normalise, result), (int)result.n_cols(), nthreads);
+      return result;
+    }
+
+    std::size_t npoints_;
+    std::size_t nvalues_;
+    std::size_t stride_;
+    std::size_t first_column_;
+    std::vector<std::size_t> count_;
+    std::vector<std::size_t> index_;
+    std::vector<double> weight_;
+    af::shared<double> sumweight_;
+  };
+
   // A Gaussian smoother, based largely on class SmoothedValue from Aimless.
   class GaussianSmoother {
   public:
@@ -255,8 +474,49 @@ namespace dials { namespace refinement {
       return MultiValueWeights(value, weight, sumweight);
     }
 
+    /**
+     * Compute the weights at multiple points using the original unnormalised
+     * coordinate, to find the interpolated values for any parameter values
+     * @param x The array of points
+     * @param nthreads The number of threads to use
+     */
+    SmootherWeights cached_weights(const af::const_ref<double> x,
+                                   std::size_t nthreads = 1) const {
+      return SmootherWeights(PointWeights(*this, x),
+                             x.size(),
+                             nvalues,
+                             max_weights_per_point(nvalues, naverage),
+                             0,
+                             nthreads);
+    }
+
   protected:
-    vec2<int> idx_range(double z) {
+    /**
+     * Compute the weights at a point, in the same order as multi_value_weight
+     */
+    struct PointWeights {
+      const GaussianSmoother &smoother;
+      af::const_ref<double> x;
+
+      PointWeights(const GaussianSmoother &smoother_, const af::const_ref<double> &x_)
+          : smoother(smoother_), x(x_) {}
+
+      std::size_t operator()(std::size_t irow,
+                             std::size_t *index,
+                             double *weight) const {
+        double z = (x[irow] - smoother.x0) / smoother.spacing_;
+        vec2<int> irange = smoother.idx_range(z);
+        std::size_t count = 0;
+        for (int icol = irange[0]; icol < irange[1]; ++icol, ++count) {
+          double ds = (z - smoother.positions_[icol]) / smoother.sigma_;
+          index[count] = icol;
+          weight[count] = exp(-ds * ds);
+        }
+        return count;
+      }
+    };
+
+    vec2<int> idx_range(double z) const {
       int i1, i2;
       if (nvalues <= 3) {
         i1 = 0;
@@ -334,11 +334,80 @@ namespace dials { namespace refinement {
       return MultiValueWeights(value, weight, sumweight);
     }
 
+    /**
+     * Compute the weights at multiple points using the original unnormalised
+     * coordinate, to find the interpolated values for any parameter values
+     * @param x The array of x coordinates of the points
+     * @param y The array of y coordinates of the points
+     * @param z The array of z coordinates of the points
+     * @param nthreads The number of threads to use
+     */
+    SmootherWeights cached_weights(const af::const_ref<double> x,
+                                   const af::const_ref<double> y,
+                                   const af::const_ref<double> z,
+                                   std::size_t nthreads = 1) const {
+      DIALS_ASSERT(y.size() == x.size());
+      DIALS_ASSERT(z.size() == x.size());
+      std::size_t stride = max_weights_per_point(nxvalues, n_x_average)
+                           * max_weights_per_point(nyvalues, n_y_average)
+                           * max_weights_per_point(nzvalues, n_z_average);
+      return SmootherWeights(PointWeights(*this, x, y, z),
+                             x.size(),
+                             nxvalues * nyvalues * nzvalues,
+                             stride,
+                             0,
+                             nthreads);
+    }
+
   private:
+    /**
+     * Compute the weights at a point, in the same order as multi_value_weight
+     */
+    struct PointWeights {
+      const GaussianSmoother3D &smoother;
+      af::const_ref<double> x;
+      af::const_ref<double> y;
+      af::const_ref<double> z;
+
+      PointWeights(const GaussianSmoother3D &smoother_,
+                   const af::const_ref<double> &x_,
+                   const af::const_ref<double> &y_,
+                   const af::const_ref<double> &z_)
+          : smoother(smoother_), x(x_), y(y_), z(z_) {}
+
+      std::size_t operator()(std::size_t irow,
+                             std::size_t *index,
+                             double *weight) const {
+        const GaussianSmoother3D &s = smoother;
+        double z1 = (x[irow] - s.x0) / s.x_spacing_;
+        double z2 = (y[irow] - s.y0) / s.y_spacing_;
+        double z3 = (z[irow] - s.z0) / s.z_spacing_;
+        vec2<int> irange = s.idx_range(z1, s.nxvalues, s.half_nxaverage, s.n_x_average);
+        vec2<int> jrange = s.idx_range(z2, s.nyvalues, s.half_nyaverage, s.n_y_average);
+        vec2<int> krange = s.idx_range(z3, s.nzvalues, s.half_nzaverage, s.n_z_average);
+        std::size_t count = 0;
+        for (int icol = irange[0]; icol < irange[1]; ++icol) {
+          for (int jcol = jrange[0]; jcol < jrange[1]; ++jcol) {
+            for (int kcol = krange[0]; kcol < krange[1]; ++kcol, ++count) {
+              double ds = pow(pow(z1 - s.x_positions_[icol], 2)
+                                + pow(z2 - s.y_positions_[jcol], 2)
+                                + pow(z3 - s.z_positions_[kcol], 2),
+                              0.5)
+                          / s.sigma_;
+              index[count] =
+                icol + (jcol * s.nxvalues) + (kcol * s.nxvalues * s.nyvalues);
+              weight[count] = exp(-ds * ds);
+            }
+          }
+        }
+        return count;
+      }
+    };
+
     vec2<int> idx_range(double z,
                         std::size_t nvalues,
                         double half_naverage,
-                        std::size_t naverage) {
+                        std::size_t naverage) const {
       int i1, i2;
       if (nvalues <= 3) {
         i1 = 0;
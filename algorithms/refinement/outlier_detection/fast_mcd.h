@@ -0,0 +1,460 @@
+/*
+ * fast_mcd.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_REFINEMENT_FAST_MCD_H
+#define DIALS_REFINEMENT_FAST_MCD_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace refinement {
+
+  using dials::algorithms::for_each_band;
+
+  /**
+   * A set of location and scatter estimates from the trials of the FAST-MCD
+   * algorithm, each with the determinant of its covariance matrix.
+   */
+  class MCDTrials {
+  public:
+    MCDTrials() : p_(0) {}
+
+    /**
+     * Initialise a set of empty trials
+     * @param ntrials The number of trials
+     * @param p The number of variables
+     */
+    MCDTrials(std::size_t ntrials, std::size_t p)
+        : p_(p),
+          det_(ntrials, 0),
+          location_(ntrials * p, 0),
+          covariance_(ntrials * p * p, 0) {}
+
+    /** @returns The number of trials */
+    std::size_t size() const {
+      return det_.size();
+    }
+
+    /** @returns The number of variables */
+    std::size_t num_params() const {
+      return p_;
+    }
+
+    /** @returns The covariance matrix determinant of each trial */
+    af::shared<double> det() const {
+      return af::shared<double>(det_.begin(), det_.end());
+    }
+
+    /** @returns The location estimate of trial i */
+    af::shared<double> location(std::size_t i) const {
+      DIALS_ASSERT(i < size());
+      const double *T = location_begin(i);
+      return af::shared<double>(T, T + p_);
+    }
+
+    /** @returns The covariance matrix of trial i */
+    af::versa<double, af::c_grid<2> > covariance(std::size_t i) const {
+      DIALS_ASSERT(i < size());
+      af::versa<double, af::c_grid<2> > result(af::c_grid<2>(p_, p_));
+      const double *S = covariance_begin(i);
+      std::copy(S, S + p_ * p_, result.begin());
+      return result;
+    }
+
+    /**
+     * Select a subset of the trials
+     * @param index The indices of the trials to select
+     * @returns The selected trials
+     */
+    MCDTrials select(const af::const_ref<std::size_t> &index) const {
+      MCDTrials result(index.size(), p_);
+      for (std::size_t i = 0; i < index.size(); ++i) {
+        DIALS_ASSERT(index[i] < size());
+        result.set(
+          i, det_[index[i]], location_begin(index[i]), covariance_begin(index[i]));
+      }
+      return result;
+    }
+
+    /**
+     * Append the trials from another set with the same number of variables
+     * @param other The other trials
+     */
+    void extend(const MCDTrials &other) {
+      if (size() == 0) {
+        p_ = other.p_;
+      }
+      DIALS_ASSERT(other.p_ == p_);
+      MCDTrials result(size() + other.size(), p_);
+      for (std::size_t i = 0; i < size(); ++i) {
+        result.set(i, det_[i], location_begin(i), covariance_begin(i));
+      }
+      for (std::size_t i = 0; i < other.size(); ++i) {
+        result.set(size() + i,
+                   other.det_[i],
+                   other.location_begin(i),
+                   other.covariance_begin(i));
+      }
+      *this = result;
+    }
+
+    /**
+     * Set the estimates of trial i
+     * @param i The trial index
+     * @param det The covariance matrix determinant
+     * @param T The p elements of the location
+     * @param S The p * p elements of the covariance matrix
+     */
+    void set(std::size_t i, double det, const double *T, const double *S) {
+      DIALS_ASSERT(i < size());
+      det_[i] = det;
+      std::copy(T, T + p_, location_.begin() + i * p_);
+      std::copy(S, S + p_ * p_, covariance_.begin() + i * p_ * p_);
+    }
+
+    /** @returns A pointer to the location of trial i */
+    const double *location_begin(std::size_t i) const {
+      return location_.begin() + i * p_;
+    }
+
+    /** @returns A pointer to the covariance matrix of trial i */
+    const double *covariance_begin(std::size_t i) const {
+      return covariance_.begin() + i * p_ * p_;
+    }
+
+  private:
+    std::size_t p_;
+    af::shared<double> det_;
+    af::shared<double> location_;
+    af::shared<double> covariance_;
+  };
+
+  /**
+   * The concentration steps (C-steps) of the FAST-MCD algorithm of Rousseeuw
+   * and van Driessen (1999) on a set of n observations of p variables. Each
+   * step computes the squared Mahalanobis distances of all the observations
+   * from the current estimates, using the Cholesky factor of the covariance
+   * matrix, and forms the new estimates from the h observations with the
+   * smallest distances. The trials are independent so are run in bands
+   * across threads, each band with its own workspace.
+   */
+  class MCDConcentration {
+  public:
+    /**
+     * @param obs The n * p matrix of observations
+     * @param h The number of observations in each subset
+     */
+    MCDConcentration(const af::const_ref<double, af::c_grid<2> > &obs, std::size_t h)
+        : obs_(obs.begin(), obs.end()),
+          n_(obs.accessor()[0]),
+          p_(obs.accessor()[1]),
+          h_(h) {
+      DIALS_ASSERT(p_ > 0);
+      DIALS_ASSERT(n_ > p_);
+      DIALS_ASSERT(h_ > p_ && h_ <= n_);
+    }
+
+    /** @returns The number of observations */
+    std::size_t num_obs() const {
+      return n_;
+    }
+
+    /** @returns The number of variables */
+    std::size_t num_params() const {
+      return p_;
+    }
+
+    /** @returns The subset size */
+    std::size_t h() const {
+      return h_;
+    }
+
+    /**
+     * Run the initial trials. For each trial, the smallest leading subset of
+     * its permutation of the observations with a non-singular covariance
+     * matrix (of at least p + 1 observations) gives the starting estimates,
+     * from which the first h-subset and a further nsteps C-steps are taken.
+     * @param permutations A permutation of the observations for each trial
+     * @param nsteps The number of C-steps to take after the first h-subset
+     * @param nthreads The number of threads to use
+     * @returns The estimates of each trial
+     */
+    MCDTrials initial_trials(
+      const af::const_ref<std::size_t, af::c_grid<2> > &permutations,
+      std::size_t nsteps,
+      std::size_t nthreads = 1) const {
+      DIALS_ASSERT(permutations.accessor()[1] == n_);
+      for (std::size_t i = 0; i < permutations.size(); ++i) {
+        DIALS_ASSERT(permutations[i] < n_);
+      }
+      MCDTrials result(permutations.accessor()[0], p_);
+      for_each_band(InitialTrialsBand(*this, permutations, nsteps, result),
+                    (int)result.size(),
+                    nthreads);
+      return result;
+    }
+
+    /**
+     * Take further C-steps from a set of estimates
+     * @param trials The starting estimates
+     * @param max_steps The maximum number of C-steps to take
+     * @param stop_on_convergence Stop once the determinant is unchanged
+     * @param nthreads The number of threads to use
+     * @returns The final estimates of each trial
+     */
+    MCDTrials iterate(const MCDTrials &trials,
+                      std::size_t max_steps,
+                      bool stop_on_convergence = false,
+                      std::size_t nthreads = 1) const {
+      DIALS_ASSERT(trials.num_params() == p_ || trials.size() == 0);
+      MCDTrials result(trials.size(), p_);
+      for_each_band(
+        IterateBand(*this, trials, max_steps, stop_on_convergence, result),
+        (int)result.size(),
+        nthreads);
+      return result;
+    }
+
+  private:
+    /**
+     * The working arrays for the trials in a band
+     */
+    struct Workspace {
+      std::vector<double> d2;
+      std::vector<std::size_t> index;
+      std::vector<double> chol;
+      std::vector<double> diff;
+      std::vector<double> location;
+      std::vector<double> covariance;
+
+      Workspace(std::size_t n, std::size_t p)
+          : d2(n), index(n), chol(p * p), diff(p), location(p), covariance(p * p) {}
+    };
+
+    /**
+     * Order observations by distance, with ties kept in observation order
+     */
+    struct CompareDistance {
+      const std::vector<double> &d2;
+
+      CompareDistance(const std::vector<double> &d2_) : d2(d2_) {}
+
+      bool operator()(std::size_t a, std::size_t b) const {
+        return d2[a] < d2[b] || (d2[a] == d2[b] && a < b);
+      }
+    };
+
+    /**
+     * Run the initial trials for a band of trials
+     */
+    struct InitialTrialsBand {
+      const MCDConcentration &mcd;
+      af::const_ref<std::size_t, af::c_grid<2> > permutations;
+      std::size_t nsteps;
+      MCDTrials &result;
+
+      InitialTrialsBand(const MCDConcentration &mcd_,
+                        const af::const_ref<std::size_t, af::c_grid<2> > &permutations_,
+                        std::size_t nsteps_,
+                        MCDTrials &result_)
+          : mcd(mcd_), permutations(permutations_), nsteps(nsteps_), result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        Workspace w(mcd.n_, mcd.p_);
+        for (int i = i0; i < i1; ++i) {
+          const std::size_t *rows = &permutations(i, 0);
+
+          // Draw the smallest non-singular leading subset
+          double det = 0;
+          for (std::size_t m = mcd.p_ + 1; !(det > 0); ++m) {
+            DIALS_ASSERT(m <= mcd.n_);
+            mcd.mean_and_covariance(rows, m, w.location, w.covariance);
+            det = cholesky(w.covariance, w.chol, mcd.p_);
+          }
+
+          // Form the first h-subset, then take the C-steps. The determinant
+          // cannot increase (Theorem 1 of R&vD) beyond rounding errors.
+          det = mcd.step(w);
+          for (std::size_t j = 0; j < nsteps; ++j) {
+            double det_new = mcd.step(w);
+            DIALS_ASSERT(det > (det_new - det_new / 1.0e9));
+            det = det_new;
+          }
+          result.set(i, det, &w.location[0], &w.covariance[0]);
+        }
+      }
+    };
+
+    /**
+     * Take further C-steps for a band of trials
+     */
+    struct IterateBand {
+      const MCDConcentration &mcd;
+      const MCDTrials &trials;
+      af::shared<double> det;
+      std::size_t max_steps;
+      bool stop_on_convergence;
+      MCDTrials &result;
+
+      IterateBand(const MCDConcentration &mcd_,
+                  const MCDTrials &trials_,
+                  std::size_t max_steps_,
+                  bool stop_on_convergence_,
+                  MCDTrials &result_)
+          : mcd(mcd_),
+            trials(trials_),
+            det(trials_.det()),
+            max_steps(max_steps_),
+            stop_on_convergence(stop_on_convergence_),
+            result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        Workspace w(mcd.n_, mcd.p_);
+        for (int i = i0; i < i1; ++i) {
+          const double *T = trials.location_begin(i);
+          const double *S = trials.covariance_begin(i);
+          std::copy(T, T + mcd.p_, w.location.begin());
+          std::copy(S, S + mcd.p_ * mcd.p_, w.covariance.begin());
+          double det_curr = det[i];
+          for (std::size_t j = 0; j < max_steps; ++j) {
+            double det_new = mcd.step(w);
+            bool converged = det_new == det_curr;
+            det_curr = det_new;
+            if (stop_on_convergence && converged) {
+              break;
+            }
+          }
+          result.set(i, det_curr, &w.location[0], &w.covariance[0]);
+        }
+      }
+    };
+
+    /**
+     * Take a single C-step, replacing the estimates in the workspace by those
+     * of the h observations closest to them. The selected observations are
+     * summed in index order, so the same subset always gives the same
+     * estimates and convergence can be detected from the determinant.
+     * @returns The determinant of the new covariance matrix
+     */
+    double step(Workspace &w) const {
+      double det = cholesky(w.covariance, w.chol, p_);
+      DIALS_ASSERT(det > 0);
+      const double *L = &w.chol[0];
+      const double *T = &w.location[0];
+      double *z = &w.diff[0];
+      for (std::size_t i = 0; i < n_; ++i) {
+        // Solve L z = x - T by forward substitution so that the squared
+        // Mahalanobis distance is z.z
+        const double *x = &obs_[i * p_];
+        double d2 = 0;
+        for (std::size_t a = 0; a < p_; ++a) {
+          double s = x[a] - T[a];
+          for (std::size_t b = 0; b < a; ++b) {
+            s -= L[a * p_ + b] * z[b];
+          }
+          z[a] = s / L[a * p_ + a];
+          d2 += z[a] * z[a];
+        }
+        w.d2[i] = d2;
+        w.index[i] = i;
+      }
+      std::nth_element(w.index.begin(),
+                       w.index.begin() + (h_ - 1),
+                       w.index.end(),
+                       CompareDistance(w.d2));
+      std::sort(w.index.begin(), w.index.begin() + h_);
+      mean_and_covariance(&w.index[0], h_, w.location, w.covariance);
+      return cholesky(w.covariance, w.chol, p_);
+    }
+
+    /**
+     * Compute the mean and sample covariance matrix of a set of observations
+     * @param rows The indices of the observations
+     * @param m The number of observations
+     * @param T The mean
+     * @param S The p * p covariance matrix
+     */
+    void mean_and_covariance(const std::size_t *rows,
+                             std::size_t m,
+                             std::vector<double> &T,
+                             std::vector<double> &S) const {
+      std::fill(T.begin(), T.end(), 0);
+      std::fill(S.begin(), S.end(), 0);
+      for (std::size_t k = 0; k < m; ++k) {
+        const double *x = &obs_[rows[k] * p_];
+        for (std::size_t a = 0; a < p_; ++a) {
+          T[a] += x[a];
+        }
+      }
+      for (std::size_t a = 0; a < p_; ++a) {
+        T[a] /= m;
+      }
+      for (std::size_t k = 0; k < m; ++k) {
+        const double *x = &obs_[rows[k] * p_];
+        for (std::size_t a = 0; a < p_; ++a) {
+          double da = x[a] - T[a];
+          for (std::size_t b = a; b < p_; ++b) {
+            S[a * p_ + b] += da * (x[b] - T[b]);
+          }
+        }
+      }
+      for (std::size_t a = 0; a < p_; ++a) {
+        for (std::size_t b = a; b < p_; ++b) {
+          S[a * p_ + b] /= (m - 1);
+          S[b * p_ + a] = S[a * p_ + b];
+        }
+      }
+    }
+
+    /**
+     * Compute the lower triangular Cholesky factor of a covariance matrix
+     * @param S The p * p covariance matrix
+     * @param L The Cholesky factor
+     * @param p The number of variables
+     * @returns The determinant of S, or zero if S is not positive definite
+     */
+    static double cholesky(const std::vector<double> &S,
+                           std::vector<double> &L,
+                           std::size_t p) {
+      std::fill(L.begin(), L.end(), 0);
+      double det = 1;
+      for (std::size_t j = 0; j < p; ++j) {
+        double d = S[j * p + j];
+        for (std::size_t k = 0; k < j; ++k) {
+          d -= L[j * p + k] * L[j * p + k];
+        }
+        if (!(d > 0)) {
+          return 0;
+        }
+        L[j * p + j] = std::sqrt(d);
+        det *= d;
+        for (std::size_t i = j + 1; i < p; ++i) {
+          double s = S[i * p + j];
+          for (std::size_t k = 0; k < j; ++k) {
+            s -= L[i * p + k] * L[j * p + k];
+          }
+          L[i * p + j] = s / L[j * p + j];
+        }
+      }
+      return det;
+    }
+
+    af::shared<double> obs_;
+    std::size_t n_;
+    std::size_t p_;
+    std::size_t h_;
+  };
+
+}}  // namespace dials::refinement
+
+#endif  // DIALS_REFINEMENT_FAST_MCD_H
@@ -2,6 +2,7 @@
 #ifndef DIALS_REFINEMENT_MAHALANOBIS_H
 #define DIALS_REFINEMENT_MAHALANOBIS_H
 
+#include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/array_family/versa_matrix.h>
 #include <dials/error.h>
@@ -28,30 +29,33 @@ namespace dials { namespace refinement {
     // create output array
     af::shared<double> d2(nobs);
 
-    // loop over observations
-    std::size_t k = 0;
-    for (std::size_t i = 0; i < nobs; i++) {
-      // copy row from obs and shift by means
-      af::shared<double> row(nparam);
-
+    // loop over observations, reusing a single row buffer
+    std::vector<double> row(nparam);
+    const double *obs_row = obs.begin();
+    const double *m = covinv.begin();
+    for (std::size_t i = 0; i < nobs; i++, obs_row += nparam) {
+      // shift row from obs by means
       for (std::size_t j = 0; j < nparam; j++) {
-        row[j] = obs[k] - center[j];
-        k++;
+        row[j] = obs_row[j] - center[j];
       }
 
       // Mahalanobis distance squared is defined by the matrix product
       //
       // (x - mu)^T [S]^-1 (x - mu)
       //
-      // (x - mu) is in 'row' and [S]^-1 is 'covinv'. Perform the right
-      // hand part of the product first with matrix_multiply and the
-      // second step is just a dot product.
-      af::shared<double> prod =
-        af::matrix_multiply(covinv.const_ref(), row.const_ref());
-      d2[i] = 0.0;
+      // (x - mu) is in 'row' and [S]^-1 is 'covinv'. Each row of [S]^-1 is
+      // contiguous, so the right hand part of the product is a set of dot
+      // products with 'row' and the second step is one more.
+      double sum = 0.0;
       for (std::size_t j = 0; j < nparam; j++) {
-        d2[i] += row[j] * prod[j];
+        const double *m_row = m + j * nparam;
+        double prod = 0.0;
+        for (std::size_t l = 0; l < nparam; l++) {
+          prod += m_row[l] * row[l];
+        }
+        sum += row[j] * prod;
       }
+      d2[i] = sum;
     }
     return d2;
   }
@@ -25,6 +25,7 @@ def __init__(
         k2=2,
         k3=100,
         threshold_probability=0.975,
+        nproc=1,
     ):
 
         if cols is None:
@@ -46,6 +47,7 @@ def __init__(
         self._k1 = k1
         self._k2 = k2
         self._k3 = k3
+        self._nproc = nproc
 
         # Calculate Mahalanobis distance threshold
         df = len(cols)
@@ -64,6 +66,7 @@ def _detect_outliers(self, cols):
             k1=self._k1,
             k2=self._k2,
             k3=self._k3,
+            nthreads=self._nproc,
         )
 
         # get location and MCD scatter estimate
@@ -85,8 +85,16 @@ def __call__(self, reflections):
         for col in self._cols:
             assert col in reflections
 
+        # only the columns needed to split the jobs and to find the outliers are
+        # copied, rather than every column of the reflection table
+        keys = ["id"] + [col for col in self._cols if col != "id"]
+        if self._separate_panels and "panel" not in keys:
+            keys.append("panel")
+        if self.get_block_width() is not None and "xyzobs.mm.value" not in keys:
+            keys.append("xyzobs.mm.value")
+
         sel = reflections.get_flags(reflections.flags.predicted)
-        all_data = reflections.select(sel)
+        all_data = reflections.select(tuple(keys)).select(sel)
         all_data_indices = sel.iselection()
         nexp = flex.max(all_data["id"]) + 1
 
@@ -378,6 +386,11 @@ def __call__(self, reflections):
                "Observations whose robust Mahalanobis distances are larger than"
                "the obtained quantile will be flagged as outliers."
        .type = float(value_min = 0., value_max = 1.0)
+
+     nproc = 1
+       .help = "The number of threads used to run the trials and concentration"
+               "steps."
+       .type = int(value_min = 1)
   }
 
   sauter_poon
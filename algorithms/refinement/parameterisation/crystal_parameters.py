@@ -6,12 +6,14 @@
 
 from rstbx.symmetry.constraints.parameter_reduction import symmetrize_reduce_enlarge
 from scitbx import matrix
+from scitbx.array_family import flex
 
 from dials.algorithms.refinement.parameterisation.model_parameters import (
     ModelParameterisation,
     Parameter,
 )
 from dials.algorithms.refinement.refinement_helpers import CrystalOrientationCompose
+from dials_refinement_helpers_ext import MultiCrystalOrientationCompose
 
 
 class CrystalOrientationMixin(object):
@@ -98,6 +100,33 @@ def compose(self):
 
         return
 
+    @staticmethod
+    def compose_all(parameterisations, nthreads=1):
+        """Compose the orientations and derivatives of many crystals in a single
+        call, with the same result as calling compose for each parameterisation
+
+        Args:
+            parameterisations (list): CrystalOrientationParameterisation objects
+            nthreads (int): The number of threads to use
+        """
+
+        U0 = flex.mat3_double([p._initial_state.elems for p in parameterisations])
+        phi = flex.double([e.value for p in parameterisations for e in p._param])
+        phi_axes = flex.vec3_double(
+            [e.axis for p in parameterisations for e in p._param]
+        )
+        mcoc = MultiCrystalOrientationCompose(U0, phi, phi_axes, nthreads=nthreads)
+
+        for p, U, dU1, dU2, dU3 in zip(
+            parameterisations,
+            mcoc.U(),
+            mcoc.dU_dphi1(),
+            mcoc.dU_dphi2(),
+            mcoc.dU_dphi3(),
+        ):
+            p._model.set_U(matrix.sqr(U))
+            p._dstate_dp = [matrix.sqr(dU1), matrix.sqr(dU2), matrix.sqr(dU3)]
+
     def get_state(self):
 
         # only a single crystal is parameterised here, so no multi_state_elt
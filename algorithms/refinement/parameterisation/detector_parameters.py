@@ -10,11 +10,11 @@
     Parameter,
 )
 from dials.algorithms.refinement.refinement_helpers import (
-    PanelGroupCompose,
     dR_from_axis_and_angle,
     get_panel_groups_at_depth,
     get_panel_ids_at_root,
 )
+from dials_refinement_helpers_ext import MultiPanelGroupCompose
 
 
 class DetectorMixin(object):
@@ -1049,6 +1049,21 @@ def __init__(self, detector, experiment_ids=None, level=0):
             p_list.extend([dist, shift1, shift2, tau1, tau2, tau3])
             self._group_ids_by_parameter.extend([igp] * 6)
 
+        # flatten the fixed panel quantities, one group after another, for the
+        # composition of all groups in a single call
+        self._flat_panel_ids = [
+            i for pnl_ids in self._panel_ids_by_group for i in pnl_ids
+        ]
+        self._group_offset = flex.size_t([0])
+        for pnl_ids in self._panel_ids_by_group:
+            self._group_offset.append(self._group_offset[-1] + len(pnl_ids))
+        self._flat_offsets = flex.vec3_double(
+            [e for offsets in self._offsets for e in offsets]
+        )
+        self._flat_dir1s = flex.vec3_double([e for dir1s in self._dir1s for e in dir1s])
+        self._flat_dir2s = flex.vec3_double([e for dir2s in self._dir2s for e in dir2s])
+        self._nthreads = 1
+
         # set up the base class
         ModelParameterisation.__init__(
             self,
@@ -1086,63 +1101,58 @@ def get_param_panel_groups(self):
         """
         return self._group_ids_by_parameter
 
+    def set_nthreads(self, nthreads):
+        """Set the number of threads used to compose the derivatives of the
+        panels"""
+        assert nthreads > 0
+        self._nthreads = nthreads
+
     def compose(self):
 
         # reset the list that holds derivatives
         for i in range(len(self._model)):
             self._multi_state_derivatives[i] = [None] * len(self._dstate_dp)
 
-        # loop over groups of panels collecting derivatives of the state wrt
-        # parameters
-        param = iter(self._param)
-        for igp, pnl_ids in enumerate(self._panel_ids_by_group):
-
-            # extract parameters from the internal list
-            dist = next(param)
-            shift1 = next(param)
-            shift2 = next(param)
-            tau1 = next(param)
-            tau2 = next(param)
-            tau3 = next(param)
-
-            param_vals = flex.double(
-                (
-                    dist.value,
-                    shift1.value,
-                    shift2.value,
-                    tau1.value,
-                    tau2.value,
-                    tau3.value,
-                )
-            )
-            param_axes = flex.vec3_double(
-                (dist.axis, shift1.axis, shift2.axis, tau1.axis, tau2.axis, tau3.axis)
-            )
-
-            offsets = self._offsets[igp]
-            dir1s = self._dir1s[igp]
-            dir2s = self._dir2s[igp]
-
-            # Get items from the initial state for the group of interest
-            initial_state = self._initial_state[igp]
-            id1 = initial_state["d1"]
-            id2 = initial_state["d2"]
-            idn = initial_state["dn"]
-            igp_offset = initial_state["gp_offset"]
-
-            # Compose the new state using the helper class for calculations
-            pgc = PanelGroupCompose(id1, id2, idn, igp_offset, param_vals, param_axes)
+        # extract parameters from the internal list, 6 for each group in the
+        # order dist, shift1, shift2, tau1, tau2, tau3
+        param_vals = flex.double([p.value for p in self._param])
+        param_axes = flex.vec3_double([p.axis for p in self._param])
+
+        # Get items from the initial state of each group
+        id1s = flex.vec3_double([s["d1"] for s in self._initial_state])
+        id2s = flex.vec3_double([s["d2"] for s in self._initial_state])
+        idns = flex.vec3_double([s["dn"] for s in self._initial_state])
+        igp_offsets = flex.vec3_double([s["gp_offset"] for s in self._initial_state])
+
+        # Compose the new state of all groups and the derivatives of the d
+        # matrix of each attached Panel using the helper class for calculations
+        mpgc = MultiPanelGroupCompose(
+            id1s,
+            id2s,
+            idns,
+            igp_offsets,
+            param_vals,
+            param_axes,
+            self._group_offset,
+            self._flat_offsets,
+            self._flat_dir1s,
+            self._flat_dir2s,
+            nthreads=self._nthreads,
+        )
 
-            # assign back to the group frame
-            self._groups[igp].set_frame(pgc.d1(), pgc.d2(), pgc.origin())
+        # assign back to the group frames
+        for group, d1, d2, origin in zip(
+            self._groups, mpgc.d1(), mpgc.d2(), mpgc.origin()
+        ):
+            group.set_frame(d1, d2, origin)
 
-            # Loop over attached Panel matrices, using the helper class to calculate
-            # derivatives of the d matrix in each case and store them.
+        # store the derivatives of each Panel, which come back as 6 consecutive
+        # elements per panel, against the parameters of its group
+        derivatives = [matrix.sqr(e) for e in mpgc.derivatives()]
+        for igp in range(len(self._groups)):
             i = igp * 6
-            for (panel_id, offset, dir1_new_basis, dir2_new_basis) in zip(
-                pnl_ids, offsets, dir1s, dir2s
-            ):
-
-                self._multi_state_derivatives[panel_id][
-                    i : (i + 6)
-                ] = pgc.derivatives_for_panel(offset, dir1_new_basis, dir2_new_basis)
+            for j in range(self._group_offset[igp], self._group_offset[igp + 1]):
+                panel_id = self._flat_panel_ids[j]
+                self._multi_state_derivatives[panel_id][i : (i + 6)] = derivatives[
+                    6 * j : (6 * j + 6)
+                ]
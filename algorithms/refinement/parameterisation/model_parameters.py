@@ -234,13 +234,15 @@ def get_param_names(self, only_free=True):
         else:
             return [x.name for x in self._param]
 
-    def set_param_vals(self, vals):
+    def set_param_vals(self, vals, compose=True):
         """Set the values of the internal list of parameters from a sequence of
         floats.
 
         Args:
             vals (list): A list of floating point parameter values, equal in length
                 to the number of free parameters.
+            compose (bool): Whether to compose the model with the new values. The
+                caller must compose the model itself if this is False.
         """
 
         assert len(vals) == self.num_free()
@@ -252,7 +254,8 @@ def set_param_vals(self, vals):
                 p.esd = None
 
         # compose with the new parameter values
-        self.compose()
+        if compose:
+            self.compose()
 
         return
 
@@ -2,6 +2,7 @@
 #ifndef DIALS_REFINEMENT_PREDICTION_PARAMETER_HELPERS_H
 #define DIALS_REFINEMENT_PREDICTION_PARAMETER_HELPERS_H
 
+#include <vector>
 #include <scitbx/vec3.h>
 #include <scitbx/mat3.h>
 #include <cctbx/miller.h>
@@ -9,8 +10,9 @@
 #include <dxtbx/model/panel.h>
 #include <dials/error.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
-//#include <dials/algorithms/refinement/rtmats.h>
+#include <dials/algorithms/refinement/rtmats.h>
 #include <scitbx/math/r3_rotation.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 
 namespace dials { namespace refinement {
 
@@ -19,12 +21,6 @@ namespace dials { namespace refinement {
   using scitbx::vec3;
   using scitbx::math::r3_rotation::axis_and_angle_as_matrix;
 
-  // declare this here - can't #include the header as the function is defined
-  // there, leading to multiple definitions
-  mat3<double> dR_from_axis_and_angle(const vec3<double> &axis,
-                                      double angle,
-                                      bool deg = false);
-
   af::shared<mat3<double> > selected_multi_panel_compose(
     const af::const_ref<vec3<double> > &initial_state,
     const af::const_ref<double> &params_vals,
@@ -467,24 +463,36 @@ namespace dials { namespace refinement {
     }
 
     // Accessors for the newly composed state
-    vec3<double> d1() {
+    vec3<double> d1() const {
       return d1_;
     }
 
-    vec3<double> d2() {
+    vec3<double> d2() const {
       return d2_;
     }
 
-    vec3<double> origin() {
+    vec3<double> origin() const {
       return origin_;
     }
 
     // Use the cached derivatives for the panel group to calculate the
     // derivatives of the d matrix for one panel, described by the offset,
     // dir1_new_basis and dir2_new_basis vectors.
-    af::shared<mat3<double> > derivatives_for_panel(const vec3<double> offset,
-                                                    const vec3<double> dir1_new_basis,
-                                                    const vec3<double> dir2_new_basis) {
+    af::shared<mat3<double> > derivatives_for_panel(
+      const vec3<double> offset,
+      const vec3<double> dir1_new_basis,
+      const vec3<double> dir2_new_basis) const {
+      af::shared<mat3<double> > ret(6, af::init_functor_null<mat3<double> >());
+      store_derivatives_for_panel(offset, dir1_new_basis, dir2_new_basis, &ret[0]);
+      return ret;
+    }
+
+    // As above, but write the 6 derivatives to the array starting at ret so
+    // that the derivatives of many panels can be stored contiguously.
+    void store_derivatives_for_panel(const vec3<double> &offset,
+                                     const vec3<double> &dir1_new_basis,
+                                     const vec3<double> &dir2_new_basis,
+                                     mat3<double> *ret) const {
       // Panel origin, which is calculated by:
       // o = dorg + offset[0] * d1 + offset[1] * d2 + offset[2] * dn
 
@@ -596,8 +604,6 @@ namespace dials { namespace refinement {
       // combine these vectors together into derivatives of the panel
       // matrix d and store them, converting angles back to mrad
 
-      af::shared<mat3<double> > ret(6, af::init_functor_null<mat3<double> >());
-
       // derivative wrt dist
       ret[0] = mat3<double>(ddir1_ddist[0],
                             ddir2_ddist[0],
@@ -666,8 +672,6 @@ namespace dials { namespace refinement {
                             ddir2_dtau3[2],
                             do_dtau3[2])
                / 1000.;
-
-      return ret;
     }
 
   private:
@@ -862,6 +866,148 @@ namespace dials { namespace refinement {
     vec3<double> ddn_dtau3;
   };
 
+  /**
+   * Helper class for the compose method of the hierarchical detector
+   * parameterisation that composes the new state of every panel group in a
+   * single call. The frames and cached derivatives of each group are found
+   * using PanelGroupCompose, then the derivatives of the d matrix of every
+   * panel are calculated in bands of panels across threads. The panels are
+   * held one group after another, and the derivatives are returned as 6
+   * consecutive matrices per panel, in the same order as the panels.
+   */
+  class MultiPanelGroupCompose {
+  public:
+    /**
+     * @param initial_d1s The initial d1 vector of each group
+     * @param initial_d2s The initial d2 vector of each group
+     * @param initial_dns The initial dn vector of each group
+     * @param initial_gp_offsets The initial offset of each group origin
+     * @param param_vals The 6 parameter values of each group
+     * @param param_axes The 6 parameter axes of each group
+     * @param group_offset The start of each group in the panel arrays, and
+     *                     the end of the last
+     * @param offsets The offset of each panel in the basis of its group
+     * @param dir1s The dir1 of each panel in the basis of its group
+     * @param dir2s The dir2 of each panel in the basis of its group
+     * @param nthreads The number of threads to use
+     */
+    MultiPanelGroupCompose(const af::const_ref<vec3<double> > &initial_d1s,
+                           const af::const_ref<vec3<double> > &initial_d2s,
+                           const af::const_ref<vec3<double> > &initial_dns,
+                           const af::const_ref<vec3<double> > &initial_gp_offsets,
+                           const af::const_ref<double> &param_vals,
+                           const af::const_ref<vec3<double> > &param_axes,
+                           const af::const_ref<std::size_t> &group_offset,
+                           const af::const_ref<vec3<double> > &offsets,
+                           const af::const_ref<vec3<double> > &dir1s,
+                           const af::const_ref<vec3<double> > &dir2s,
+                           std::size_t nthreads = 1)
+        : d1_(initial_d1s.size(), af::init_functor_null<vec3<double> >()),
+          d2_(initial_d1s.size(), af::init_functor_null<vec3<double> >()),
+          origin_(initial_d1s.size(), af::init_functor_null<vec3<double> >()),
+          derivatives_(6 * offsets.size(), af::init_functor_null<mat3<double> >()) {
+      std::size_t ngroups = initial_d1s.size();
+      DIALS_ASSERT(initial_d2s.size() == ngroups);
+      DIALS_ASSERT(initial_dns.size() == ngroups);
+      DIALS_ASSERT(initial_gp_offsets.size() == ngroups);
+      DIALS_ASSERT(param_vals.size() == 6 * ngroups);
+      DIALS_ASSERT(param_axes.size() == 6 * ngroups);
+      DIALS_ASSERT(group_offset.size() == ngroups + 1);
+      DIALS_ASSERT(group_offset[0] == 0);
+      DIALS_ASSERT(group_offset[ngroups] == offsets.size());
+      DIALS_ASSERT(dir1s.size() == offsets.size());
+      DIALS_ASSERT(dir2s.size() == offsets.size());
+
+      // Compose the new state of each group and record the group of each panel
+      std::vector<PanelGroupCompose> groups;
+      groups.reserve(ngroups);
+      std::vector<std::size_t> panel_group(offsets.size());
+      for (std::size_t i = 0; i < ngroups; ++i) {
+        DIALS_ASSERT(group_offset[i] <= group_offset[i + 1]);
+        groups.push_back(PanelGroupCompose(initial_d1s[i],
+                                           initial_d2s[i],
+                                           initial_dns[i],
+                                           initial_gp_offsets[i],
+                                           af::const_ref<double>(&param_vals[6 * i], 6),
+                                           af::const_ref<vec3<double> >(
+                                             &param_axes[6 * i], 6)));
+        d1_[i] = groups[i].d1();
+        d2_[i] = groups[i].d2();
+        origin_[i] = groups[i].origin();
+        for (std::size_t j = group_offset[i]; j < group_offset[i + 1]; ++j) {
+          panel_group[j] = i;
+        }
+      }
+
+      // Calculate the derivatives of each panel
+      for_each_band(
+        PanelBand(groups, panel_group, offsets, dir1s, dir2s, derivatives_.ref()),
+        (int)offsets.size(),
+        nthreads);
+    }
+
+    /** @returns The new d1 vector of each group */
+    af::shared<vec3<double> > d1() const {
+      return d1_;
+    }
+
+    /** @returns The new d2 vector of each group */
+    af::shared<vec3<double> > d2() const {
+      return d2_;
+    }
+
+    /** @returns The new origin of each group */
+    af::shared<vec3<double> > origin() const {
+      return origin_;
+    }
+
+    /**
+     * @returns The derivatives of the d matrix of each panel with respect to
+     *          the 6 parameters of its group, 6 consecutive elements per panel
+     */
+    af::shared<mat3<double> > derivatives() const {
+      return derivatives_;
+    }
+
+  private:
+    /**
+     * Calculate the derivatives for a band of panels
+     */
+    struct PanelBand {
+      const std::vector<PanelGroupCompose> &groups;
+      const std::vector<std::size_t> &panel_group;
+      af::const_ref<vec3<double> > offsets;
+      af::const_ref<vec3<double> > dir1s;
+      af::const_ref<vec3<double> > dir2s;
+      af::ref<mat3<double> > derivatives;
+
+      PanelBand(const std::vector<PanelGroupCompose> &groups_,
+                const std::vector<std::size_t> &panel_group_,
+                const af::const_ref<vec3<double> > &offsets_,
+                const af::const_ref<vec3<double> > &dir1s_,
+                const af::const_ref<vec3<double> > &dir2s_,
+                af::ref<mat3<double> > derivatives_)
+          : groups(groups_),
+            panel_group(panel_group_),
+            offsets(offsets_),
+            dir1s(dir1s_),
+            dir2s(dir2s_),
+            derivatives(derivatives_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          groups[panel_group[i]].store_derivatives_for_panel(
+            offsets[i], dir1s[i], dir2s[i], &derivatives[6 * i]);
+        }
+      }
+    };
+
+    af::shared<vec3<double> > d1_;
+    af::shared<vec3<double> > d2_;
+    af::shared<vec3<double> > origin_;
+    af::shared<mat3<double> > derivatives_;
+  };
+
   /**
    * Given an initial orientation matrix, the values of the three orientation
    * parameters, phi1, phi2 and phi3 (in mrad), plus the axes about which these
@@ -926,6 +1072,112 @@ namespace dials { namespace refinement {
     mat3<double> dU_dphi3_;
   };
 
+  /**
+   * Compose the orientations of many crystals and their derivatives, as done
+   * for one crystal by CrystalOrientationCompose, with the crystals processed
+   * in bands across threads. The three parameters of each crystal are held
+   * one crystal after another.
+   */
+  class MultiCrystalOrientationCompose {
+  public:
+    /**
+     * @param U0 The initial orientation matrix of each crystal
+     * @param phi The values of phi1, phi2 and phi3 (in mrad) of each crystal
+     * @param phi_axes The axes of phi1, phi2 and phi3 of each crystal
+     * @param nthreads The number of threads to use
+     */
+    MultiCrystalOrientationCompose(const af::const_ref<mat3<double> > &U0,
+                                   const af::const_ref<double> &phi,
+                                   const af::const_ref<vec3<double> > &phi_axes,
+                                   std::size_t nthreads = 1)
+        : U_(U0.size(), af::init_functor_null<mat3<double> >()),
+          dU_dphi1_(U0.size(), af::init_functor_null<mat3<double> >()),
+          dU_dphi2_(U0.size(), af::init_functor_null<mat3<double> >()),
+          dU_dphi3_(U0.size(), af::init_functor_null<mat3<double> >()) {
+      DIALS_ASSERT(phi.size() == 3 * U0.size());
+      DIALS_ASSERT(phi_axes.size() == 3 * U0.size());
+      for_each_band(CrystalBand(U0,
+                                phi,
+                                phi_axes,
+                                U_.ref(),
+                                dU_dphi1_.ref(),
+                                dU_dphi2_.ref(),
+                                dU_dphi3_.ref()),
+                    (int)U0.size(),
+                    nthreads);
+    }
+
+    /** @returns The new orientation matrix of each crystal */
+    af::shared<mat3<double> > U() const {
+      return U_;
+    }
+
+    /** @returns The derivative of each U with respect to phi1 */
+    af::shared<mat3<double> > dU_dphi1() const {
+      return dU_dphi1_;
+    }
+
+    /** @returns The derivative of each U with respect to phi2 */
+    af::shared<mat3<double> > dU_dphi2() const {
+      return dU_dphi2_;
+    }
+
+    /** @returns The derivative of each U with respect to phi3 */
+    af::shared<mat3<double> > dU_dphi3() const {
+      return dU_dphi3_;
+    }
+
+  private:
+    /**
+     * Compose the orientations of a band of crystals
+     */
+    struct CrystalBand {
+      af::const_ref<mat3<double> > U0;
+      af::const_ref<double> phi;
+      af::const_ref<vec3<double> > phi_axes;
+      af::ref<mat3<double> > U;
+      af::ref<mat3<double> > dU_dphi1;
+      af::ref<mat3<double> > dU_dphi2;
+      af::ref<mat3<double> > dU_dphi3;
+
+      CrystalBand(const af::const_ref<mat3<double> > &U0_,
+                  const af::const_ref<double> &phi_,
+                  const af::const_ref<vec3<double> > &phi_axes_,
+                  af::ref<mat3<double> > U_,
+                  af::ref<mat3<double> > dU_dphi1_,
+                  af::ref<mat3<double> > dU_dphi2_,
+                  af::ref<mat3<double> > dU_dphi3_)
+          : U0(U0_),
+            phi(phi_),
+            phi_axes(phi_axes_),
+            U(U_),
+            dU_dphi1(dU_dphi1_),
+            dU_dphi2(dU_dphi2_),
+            dU_dphi3(dU_dphi3_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          CrystalOrientationCompose coc(U0[i],
+                                        phi[3 * i],
+                                        phi_axes[3 * i],
+                                        phi[3 * i + 1],
+                                        phi_axes[3 * i + 1],
+                                        phi[3 * i + 2],
+                                        phi_axes[3 * i + 2]);
+          U[i] = coc.U();
+          dU_dphi1[i] = coc.dU_dphi1();
+          dU_dphi2[i] = coc.dU_dphi2();
+          dU_dphi3[i] = coc.dU_dphi3();
+        }
+      }
+    };
+
+    af::shared<mat3<double> > U_;
+    af::shared<mat3<double> > dU_dphi1_;
+    af::shared<mat3<double> > dU_dphi2_;
+    af::shared<mat3<double> > dU_dphi3_;
+  };
+
 }}  // namespace dials::refinement
 
 #endif  // DIALS_REFINEMENT_PREDICTION_PARAMETER_HELPERS_H
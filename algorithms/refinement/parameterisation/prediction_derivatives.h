@@ -0,0 +1,697 @@
+/*
+ * prediction_derivatives.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_REFINEMENT_PREDICTION_DERIVATIVES_H
+#define DIALS_REFINEMENT_PREDICTION_DERIVATIVES_H
+
+#include <cmath>
+#include <scitbx/vec3.h>
+#include <scitbx/mat3.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/algorithms/refinement/gallego_yezzi.h>
+#include <dials/algorithms/refinement/rtmats.h>
+#include <dials/error.h>
+
+namespace dials { namespace refinement {
+
+  using dials::algorithms::for_each_band;
+  using scitbx::mat3;
+  using scitbx::vec3;
+
+  /**
+   * Convert derivatives of the projection vector pv = D s1 into derivatives
+   * of the predicted X and Y positions using the quotient rule, for a set of
+   * reflections.
+   * @param w_inv 1 / w for each reflection
+   * @param u_w_inv u / w for each reflection
+   * @param v_w_inv v / w for each reflection
+   * @param dpv The derivatives of pv for each reflection
+   * @param dX The derivatives of X for each reflection
+   * @param dY The derivatives of Y for each reflection
+   */
+  inline void dX_dp_and_dY_dp_from_dpv_dp(const af::const_ref<double> &w_inv,
+                                          const af::const_ref<double> &u_w_inv,
+                                          const af::const_ref<double> &v_w_inv,
+                                          const af::const_ref<vec3<double> > &dpv,
+                                          af::ref<double> dX,
+                                          af::ref<double> dY) {
+    DIALS_ASSERT(u_w_inv.size() == w_inv.size());
+    DIALS_ASSERT(v_w_inv.size() == w_inv.size());
+    DIALS_ASSERT(dpv.size() == w_inv.size());
+    DIALS_ASSERT(dX.size() == w_inv.size());
+    DIALS_ASSERT(dY.size() == w_inv.size());
+    for (std::size_t i = 0; i < dpv.size(); ++i) {
+      dX[i] = w_inv[i] * (dpv[i][0] - dpv[i][2] * u_w_inv[i]);
+      dY[i] = w_inv[i] * (dpv[i][1] - dpv[i][2] * v_w_inv[i]);
+    }
+  }
+
+  /**
+   * Calculate the derivatives of the projection vector pv and of the angle phi
+   * of the scan-static or scan-varying rotation prediction equation with
+   * respect to the parameters of the beam, crystal and goniometer models. The
+   * per-reflection quantities are set up once for each gradient calculation,
+   * then each derivative is computed for a selection of the reflections in a
+   * single pass, with the reflections split into bands across threads, in
+   * place of a chain of flex array operations with a temporary array for each.
+   */
+  class XYPhiDerivatives {
+  public:
+    /**
+     * @param h The Miller indices
+     * @param U The U matrices
+     * @param B The B matrices
+     * @param fixed_rotation The goniometer fixed rotation matrices F
+     * @param setting_rotation The goniometer setting rotation matrices S
+     * @param axis The rotation axes
+     * @param phi The calculated rotation angles
+     * @param r The reciprocal lattice vectors in the lab frame
+     * @param s1 The diffracted beam vectors
+     * @param e_X_r The cross products of the rotated axis and r
+     * @param e_r_s0 The dot products of e_X_r and s0
+     * @param D The D matrices of the panels the reflections are on
+     * @param nthreads The number of threads to use
+     */
+    XYPhiDerivatives(const af::const_ref<vec3<double> > &h,
+                     const af::const_ref<mat3<double> > &U,
+                     const af::const_ref<mat3<double> > &B,
+                     const af::const_ref<mat3<double> > &fixed_rotation,
+                     const af::const_ref<mat3<double> > &setting_rotation,
+                     const af::const_ref<vec3<double> > &axis,
+                     const af::const_ref<double> &phi,
+                     const af::const_ref<vec3<double> > &r,
+                     const af::const_ref<vec3<double> > &s1,
+                     const af::const_ref<vec3<double> > &e_X_r,
+                     const af::const_ref<double> &e_r_s0,
+                     const af::const_ref<mat3<double> > &D,
+                     std::size_t nthreads = 1)
+        : h_(h.begin(), h.end()),
+          U_(U.begin(), U.end()),
+          B_(B.begin(), B.end()),
+          fixed_rotation_(fixed_rotation.begin(), fixed_rotation.end()),
+          setting_rotation_(setting_rotation.begin(), setting_rotation.end()),
+          R_(R_from_axes_and_angles(axis, phi)),
+          r_(r.begin(), r.end()),
+          s1_(s1.begin(), s1.end()),
+          e_X_r_(e_X_r.begin(), e_X_r.end()),
+          e_r_s0_(e_r_s0.begin(), e_r_s0.end()),
+          D_(D.begin(), D.end()),
+          nthreads_(nthreads) {
+      std::size_t n = h.size();
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(U.size() == n);
+      DIALS_ASSERT(B.size() == n);
+      DIALS_ASSERT(fixed_rotation.size() == n);
+      DIALS_ASSERT(setting_rotation.size() == n);
+      DIALS_ASSERT(axis.size() == n);
+      DIALS_ASSERT(phi.size() == n);
+      DIALS_ASSERT(r.size() == n);
+      DIALS_ASSERT(s1.size() == n);
+      DIALS_ASSERT(e_X_r.size() == n);
+      DIALS_ASSERT(e_r_s0.size() == n);
+      DIALS_ASSERT(D.size() == n);
+    }
+
+    /** @returns The number of reflections */
+    std::size_t size() const {
+      return h_.size();
+    }
+
+    /** @returns The number of threads */
+    std::size_t nthreads() const {
+      return nthreads_;
+    }
+
+    /**
+     * Calculate the derivatives with respect to a beam parameter
+     * @param isel The selected reflections
+     * @param ds0 The derivative of s0 for each selected reflection
+     * @param dpv The derivative of pv for each selected reflection
+     * @param dphi The derivative of phi for each selected reflection
+     */
+    void beam(const af::const_ref<std::size_t> &isel,
+              const af::const_ref<vec3<double> > &ds0,
+              af::ref<vec3<double> > dpv,
+              af::ref<double> dphi) const {
+      check_sizes(isel, ds0.size(), dpv, dphi);
+      for_each_band(BeamBand(*this, isel, ds0, dpv, dphi), (int)isel.size(), nthreads_);
+    }
+
+    /**
+     * Calculate the derivatives with respect to a crystal orientation
+     * parameter
+     * @param isel The selected reflections
+     * @param dU The derivative of U for each selected reflection
+     * @param dpv The derivative of pv for each selected reflection
+     * @param dphi The derivative of phi for each selected reflection
+     */
+    void crystal_orientation(const af::const_ref<std::size_t> &isel,
+                             const af::const_ref<mat3<double> > &dU,
+                             af::ref<vec3<double> > dpv,
+                             af::ref<double> dphi) const {
+      check_sizes(isel, dU.size(), dpv, dphi);
+      for_each_band(RotationBand(*this, isel, dU, CrystalOrientation, dpv, dphi),
+                    (int)isel.size(),
+                    nthreads_);
+    }
+
+    /**
+     * Calculate the derivatives with respect to a crystal unit cell parameter
+     * @param isel The selected reflections
+     * @param dB The derivative of B for each selected reflection
+     * @param dpv The derivative of pv for each selected reflection
+     * @param dphi The derivative of phi for each selected reflection
+     */
+    void crystal_unit_cell(const af::const_ref<std::size_t> &isel,
+                           const af::const_ref<mat3<double> > &dB,
+                           af::ref<vec3<double> > dpv,
+                           af::ref<double> dphi) const {
+      check_sizes(isel, dB.size(), dpv, dphi);
+      for_each_band(RotationBand(*this, isel, dB, CrystalUnitCell, dpv, dphi),
+                    (int)isel.size(),
+                    nthreads_);
+    }
+
+    /**
+     * Calculate the derivatives with respect to a goniometer parameter
+     * @param isel The selected reflections
+     * @param dS The derivative of S for each selected reflection
+     * @param dpv The derivative of pv for each selected reflection
+     * @param dphi The derivative of phi for each selected reflection
+     */
+    void goniometer(const af::const_ref<std::size_t> &isel,
+                    const af::const_ref<mat3<double> > &dS,
+                    af::ref<vec3<double> > dpv,
+                    af::ref<double> dphi) const {
+      check_sizes(isel, dS.size(), dpv, dphi);
+      for_each_band(RotationBand(*this, isel, dS, Goniometer, dpv, dphi),
+                    (int)isel.size(),
+                    nthreads_);
+    }
+
+  private:
+    /**
+     * The model whose parameter the derivative is with respect to
+     */
+    enum RotationModel { CrystalOrientation, CrystalUnitCell, Goniometer };
+
+    /**
+     * Calculate the beam derivatives for a band of reflections
+     */
+    struct BeamBand {
+      const XYPhiDerivatives &parent;
+      af::const_ref<std::size_t> isel;
+      af::const_ref<vec3<double> > ds0;
+      af::ref<vec3<double> > dpv;
+      af::ref<double> dphi;
+
+      BeamBand(const XYPhiDerivatives &parent_,
+               const af::const_ref<std::size_t> &isel_,
+               const af::const_ref<vec3<double> > &ds0_,
+               af::ref<vec3<double> > dpv_,
+               af::ref<double> dphi_)
+          : parent(parent_), isel(isel_), ds0(ds0_), dpv(dpv_), dphi(dphi_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int k = i0; k < i1; ++k) {
+          std::size_t i = isel[k];
+          double dp = -(parent.r_[i] * ds0[k]) / parent.e_r_s0_[i];
+          dphi[k] = dp;
+          dpv[k] = parent.D_[i] * (parent.e_X_r_[i] * dp + ds0[k]);
+        }
+      }
+    };
+
+    /**
+     * Calculate the crystal or goniometer derivatives for a band of
+     * reflections. The derivative of the reciprocal lattice vector is
+     *
+     *  dr = S R F dU B h (crystal orientation)
+     *  dr = S R F U dB h (crystal unit cell)
+     *  dr = dS R F U B h (goniometer)
+     *
+     * where R is the rotation by phi about the axis, from which those of phi
+     * and pv follow.
+     */
+    struct RotationBand {
+      const XYPhiDerivatives &parent;
+      af::const_ref<std::size_t> isel;
+      af::const_ref<mat3<double> > der;
+      RotationModel model;
+      af::ref<vec3<double> > dpv;
+      af::ref<double> dphi;
+
+      RotationBand(const XYPhiDerivatives &parent_,
+                   const af::const_ref<std::size_t> &isel_,
+                   const af::const_ref<mat3<double> > &der_,
+                   RotationModel model_,
+                   af::ref<vec3<double> > dpv_,
+                   af::ref<double> dphi_)
+          : parent(parent_),
+            isel(isel_),
+            der(der_),
+            model(model_),
+            dpv(dpv_),
+            dphi(dphi_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int k = i0; k < i1; ++k) {
+          std::size_t i = isel[k];
+          const vec3<double> &h = parent.h_[i];
+          const mat3<double> &F = parent.fixed_rotation_[i];
+          vec3<double> dr;
+          if (model == CrystalOrientation) {
+            vec3<double> q = F * (der[k] * parent.B_[i] * h);
+            dr = parent.setting_rotation_[i] * rotate(q, i);
+          } else if (model == CrystalUnitCell) {
+            vec3<double> q = F * (parent.U_[i] * der[k] * h);
+            dr = parent.setting_rotation_[i] * rotate(q, i);
+          } else {
+            vec3<double> q = F * (parent.U_[i] * parent.B_[i] * h);
+            dr = der[k] * rotate(q, i);
+          }
+          double dp = -(dr * parent.s1_[i]) / parent.e_r_s0_[i];
+          dphi[k] = dp;
+          dpv[k] = parent.D_[i] * (dr + parent.e_X_r_[i] * dp);
+        }
+      }
+
+      vec3<double> rotate(const vec3<double> &q, std::size_t i) const {
+        return parent.R_[i] * q;
+      }
+    };
+
+    void check_sizes(const af::const_ref<std::size_t> &isel,
+                     std::size_t nder,
+                     const af::ref<vec3<double> > &dpv,
+                     const af::ref<double> &dphi) const {
+      for (std::size_t k = 0; k < isel.size(); ++k) {
+        DIALS_ASSERT(isel[k] < size());
+      }
+      DIALS_ASSERT(nder == isel.size());
+      DIALS_ASSERT(dpv.size() == isel.size());
+      DIALS_ASSERT(dphi.size() == isel.size());
+    }
+
+    af::shared<vec3<double> > h_;
+    af::shared<mat3<double> > U_;
+    af::shared<mat3<double> > B_;
+    af::shared<mat3<double> > fixed_rotation_;
+    af::shared<mat3<double> > setting_rotation_;
+    af::shared<mat3<double> > R_;
+    af::shared<vec3<double> > r_;
+    af::shared<vec3<double> > s1_;
+    af::shared<vec3<double> > e_X_r_;
+    af::shared<double> e_r_s0_;
+    af::shared<mat3<double> > D_;
+    std::size_t nthreads_;
+  };
+
+  /**
+   * Calculate the derivatives of the projection vector pv and of the angle
+   * DeltaPsi of the stills prediction equation, in which the relp q is
+   * rotated by DeltaPsi about the axis e1 onto the Ewald sphere, with respect
+   * to the parameters of the beam and crystal models. As for
+   * XYPhiDerivatives, each derivative is computed for a selection of the
+   * reflections, such as those of one experiment, in a single pass split into
+   * bands across threads.
+   */
+  class StillsDeltaPsiDerivatives {
+  public:
+    /**
+     * @param h The Miller indices
+     * @param U The U matrices
+     * @param B The B matrices
+     * @param s0 The beam vectors
+     * @param s0u The unit beam directions
+     * @param wavelength The wavelengths
+     * @param r The relps rotated onto the Ewald sphere
+     * @param e1 The unit axes of the DeltaPsi rotation
+     * @param q The relps in the lab frame
+     * @param q0 The unit directions of q
+     * @param c0 The unit vectors completing an orthonormal set with s0u and e1
+     * @param s1 The diffracted beam vectors
+     * @param DeltaPsi The calculated DeltaPsi angles
+     * @param D The D matrices of the panels the reflections are on
+     * @param nthreads The number of threads to use
+     */
+    StillsDeltaPsiDerivatives(const af::const_ref<vec3<double> > &h,
+                              const af::const_ref<mat3<double> > &U,
+                              const af::const_ref<mat3<double> > &B,
+                              const af::const_ref<vec3<double> > &s0,
+                              const af::const_ref<vec3<double> > &s0u,
+                              const af::const_ref<double> &wavelength,
+                              const af::const_ref<vec3<double> > &r,
+                              const af::const_ref<vec3<double> > &e1,
+                              const af::const_ref<vec3<double> > &q,
+                              const af::const_ref<vec3<double> > &q0,
+                              const af::const_ref<vec3<double> > &c0,
+                              const af::const_ref<vec3<double> > &s1,
+                              const af::const_ref<double> &DeltaPsi,
+                              const af::const_ref<mat3<double> > &D,
+                              std::size_t nthreads = 1)
+        : h_(h.begin(), h.end()),
+          U_(U.begin(), U.end()),
+          B_(B.begin(), B.end()),
+          s0_(s0.begin(), s0.end()),
+          s0u_(s0u.begin(), s0u.end()),
+          wavelength_(wavelength.begin(), wavelength.end()),
+          r_(r.begin(), r.end()),
+          e1_(e1.begin(), e1.end()),
+          q_(q.begin(), q.end()),
+          q0_(q0.begin(), q0.end()),
+          c0_(c0.begin(), c0.end()),
+          s1_(s1.begin(), s1.end()),
+          DeltaPsi_(DeltaPsi.begin(), DeltaPsi.end()),
+          D_(D.begin(), D.end()),
+          e1_X_r_(h.size()),
+          e1_r_s0_(h.size()),
+          nthreads_(nthreads) {
+      std::size_t n = h.size();
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(U.size() == n);
+      DIALS_ASSERT(B.size() == n);
+      DIALS_ASSERT(s0.size() == n);
+      DIALS_ASSERT(s0u.size() == n);
+      DIALS_ASSERT(wavelength.size() == n);
+      DIALS_ASSERT(r.size() == n);
+      DIALS_ASSERT(e1.size() == n);
+      DIALS_ASSERT(q.size() == n);
+      DIALS_ASSERT(q0.size() == n);
+      DIALS_ASSERT(c0.size() == n);
+      DIALS_ASSERT(s1.size() == n);
+      DIALS_ASSERT(DeltaPsi.size() == n);
+      DIALS_ASSERT(D.size() == n);
+
+      // All of the derivatives of DeltaPsi have the common denominator
+      // (e1 X r).s0
+      for (std::size_t i = 0; i < n; ++i) {
+        e1_X_r_[i] = e1[i].cross(r[i]);
+        e1_r_s0_[i] = e1_X_r_[i] * s0[i];
+      }
+    }
+
+    /** @returns The number of reflections */
+    std::size_t size() const {
+      return h_.size();
+    }
+
+    /** @returns The number of threads */
+    std::size_t nthreads() const {
+      return nthreads_;
+    }
+
+    /**
+     * Calculate the derivatives with respect to a beam parameter
+     * @param isel The selected reflections
+     * @param ds0 The derivative of s0 for each selected reflection
+     * @param dpv The derivative of pv for each selected reflection
+     * @param dDeltaPsi The derivative of DeltaPsi for each selected reflection
+     */
+    void beam(const af::const_ref<std::size_t> &isel,
+              const af::const_ref<vec3<double> > &ds0,
+              af::ref<vec3<double> > dpv,
+              af::ref<double> dDeltaPsi) const {
+      check_sizes(isel, ds0.size(), dpv, dDeltaPsi);
+      for_each_band(
+        BeamBand(*this, isel, ds0, dpv, dDeltaPsi), (int)isel.size(), nthreads_);
+    }
+
+    /**
+     * Calculate the derivatives with respect to a crystal orientation
+     * parameter
+     * @param isel The selected reflections
+     * @param dU The derivative of U for each selected reflection
+     * @param dpv The derivative of pv for each selected reflection
+     * @param dDeltaPsi The derivative of DeltaPsi for each selected reflection
+     */
+    void crystal_orientation(const af::const_ref<std::size_t> &isel,
+                             const af::const_ref<mat3<double> > &dU,
+                             af::ref<vec3<double> > dpv,
+                             af::ref<double> dDeltaPsi) const {
+      check_sizes(isel, dU.size(), dpv, dDeltaPsi);
+      for_each_band(CrystalBand(*this, isel, dU, true, dpv, dDeltaPsi),
+                    (int)isel.size(),
+                    nthreads_);
+    }
+
+    /**
+     * Calculate the derivatives with respect to a crystal unit cell parameter
+     * @param isel The selected reflections
+     * @param dB The derivative of B for each selected reflection
+     * @param dpv The derivative of pv for each selected reflection
+     * @param dDeltaPsi The derivative of DeltaPsi for each selected reflection
+     */
+    void crystal_unit_cell(const af::const_ref<std::size_t> &isel,
+                           const af::const_ref<mat3<double> > &dB,
+                           af::ref<vec3<double> > dpv,
+                           af::ref<double> dDeltaPsi) const {
+      check_sizes(isel, dB.size(), dpv, dDeltaPsi);
+      for_each_band(CrystalBand(*this, isel, dB, false, dpv, dDeltaPsi),
+                    (int)isel.size(),
+                    nthreads_);
+    }
+
+  private:
+    /**
+     * Calculate the beam derivatives for a band of reflections. The
+     * derivative of the unit beam direction requires scaling by the
+     * wavelength and projection onto the Ewald sphere, and the derivative of
+     * r with respect to the axis e1 is found by the method of Gallego & Yezzi.
+     */
+    struct BeamBand {
+      const StillsDeltaPsiDerivatives &parent;
+      af::const_ref<std::size_t> isel;
+      af::const_ref<vec3<double> > ds0;
+      af::ref<vec3<double> > dpv;
+      af::ref<double> dDeltaPsi;
+
+      BeamBand(const StillsDeltaPsiDerivatives &parent_,
+               const af::const_ref<std::size_t> &isel_,
+               const af::const_ref<vec3<double> > &ds0_,
+               af::ref<vec3<double> > dpv_,
+               af::ref<double> dDeltaPsi_)
+          : parent(parent_),
+            isel(isel_),
+            ds0(ds0_),
+            dpv(dpv_),
+            dDeltaPsi(dDeltaPsi_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int k = i0; k < i1; ++k) {
+          std::size_t i = isel[k];
+          const vec3<double> &c0 = parent.c0_[i];
+          const vec3<double> &e1 = parent.e1_[i];
+          vec3<double> scaled = ds0[k] * parent.wavelength_[i];
+          vec3<double> ds0u = (scaled * c0) * c0 + (scaled * e1) * e1;
+          double dp = -(parent.r_[i] * ds0[k]) / parent.e1_r_s0_[i];
+          dDeltaPsi[k] = dp;
+          vec3<double> de1 = c0.cross(ds0u);
+          vec3<double> drde_dedp =
+            dRq_de_single(parent.DeltaPsi_[i], e1, parent.q_[i]) * de1;
+          dpv[k] = parent.D_[i] * (ds0[k] + parent.e1_X_r_[i] * dp + drde_dedp);
+        }
+      }
+    };
+
+    /**
+     * Calculate the crystal derivatives for a band of reflections. The
+     * derivative of q is
+     *
+     *  dq = dU B h (crystal orientation)
+     *  dq = U dB h (crystal unit cell)
+     *
+     * from which those of r and DeltaPsi follow. The partial derivative of r
+     * with respect to a change in the axis e1 is found by central finite
+     * differences.
+     */
+    struct CrystalBand {
+      const StillsDeltaPsiDerivatives &parent;
+      af::const_ref<std::size_t> isel;
+      af::const_ref<mat3<double> > der;
+      bool orientation;
+      af::ref<vec3<double> > dpv;
+      af::ref<double> dDeltaPsi;
+
+      CrystalBand(const StillsDeltaPsiDerivatives &parent_,
+                  const af::const_ref<std::size_t> &isel_,
+                  const af::const_ref<mat3<double> > &der_,
+                  bool orientation_,
+                  af::ref<vec3<double> > dpv_,
+                  af::ref<double> dDeltaPsi_)
+          : parent(parent_),
+            isel(isel_),
+            der(der_),
+            orientation(orientation_),
+            dpv(dpv_),
+            dDeltaPsi(dDeltaPsi_) {}
+
+      void operator()(int i0, int i1) const {
+        const double step = 1.0e-8;
+        for (int k = i0; k < i1; ++k) {
+          std::size_t i = isel[k];
+          const vec3<double> &e1 = parent.e1_[i];
+          const vec3<double> &q = parent.q_[i];
+          double DeltaPsi = parent.DeltaPsi_[i];
+          vec3<double> dq = orientation ? der[k] * parent.B_[i] * parent.h_[i]
+                                        : parent.U_[i] * der[k] * parent.h_[i];
+          vec3<double> dr = dq.rotate_around_origin(e1, DeltaPsi);
+          double dp = -(dr * parent.s1_[i]) / parent.e1_r_s0_[i];
+          dDeltaPsi[k] = dp;
+
+          // derivative of the axis e1
+          double q_scalar = q.length();
+          double qq = q_scalar * q_scalar;
+          vec3<double> dq0 = (q_scalar * dq - (q * dq) * parent.q0_[i]) / qq;
+          vec3<double> de1 = dq0.cross(parent.s0u_[i]);
+
+          // finite difference derivative of r wrt the change in e1
+          vec3<double> del_e1 = de1 * step;
+          vec3<double> rfwd = q.rotate_around_origin(e1 + del_e1 * 0.5, DeltaPsi);
+          vec3<double> rrev = q.rotate_around_origin(e1 - del_e1 * 0.5, DeltaPsi);
+          vec3<double> drde_dedp = (rfwd - rrev) * (1 / step);
+
+          dpv[k] = parent.D_[i] * (dr + parent.e1_X_r_[i] * dp + drde_dedp);
+        }
+      }
+    };
+
+    void check_sizes(const af::const_ref<std::size_t> &isel,
+                     std::size_t nder,
+                     const af::ref<vec3<double> > &dpv,
+                     const af::ref<double> &dDeltaPsi) const {
+      for (std::size_t k = 0; k < isel.size(); ++k) {
+        DIALS_ASSERT(isel[k] < size());
+      }
+      DIALS_ASSERT(nder == isel.size());
+      DIALS_ASSERT(dpv.size() == isel.size());
+      DIALS_ASSERT(dDeltaPsi.size() == isel.size());
+    }
+
+    af::shared<vec3<double> > h_;
+    af::shared<mat3<double> > U_;
+    af::shared<mat3<double> > B_;
+    af::shared<vec3<double> > s0_;
+    af::shared<vec3<double> > s0u_;
+    af::shared<double> wavelength_;
+    af::shared<vec3<double> > r_;
+    af::shared<vec3<double> > e1_;
+    af::shared<vec3<double> > q_;
+    af::shared<vec3<double> > q0_;
+    af::shared<vec3<double> > c0_;
+    af::shared<vec3<double> > s1_;
+    af::shared<double> DeltaPsi_;
+    af::shared<mat3<double> > D_;
+    af::shared<vec3<double> > e1_X_r_;
+    af::shared<double> e1_r_s0_;
+    std::size_t nthreads_;
+  };
+
+  /**
+   * Calculate the derivatives of the 2theta angle, 2 asin(|r0| wl / 2) with
+   * r0 = B h, with respect to the unit cell parameters, for two theta
+   * refinement. The derivative is
+   *
+   *  d2theta = wl / sqrt(1 - sin^2(theta)) d|r0|, d|r0| = (dB h).r0 / |r0|
+   *
+   * so r0 and the factor multiplying (dB h).r0 are computed once, and each
+   * derivative is computed for a selection of the reflections in a single
+   * pass split into bands across threads.
+   */
+  class TwoThetaDerivatives {
+  public:
+    /**
+     * @param h The Miller indices
+     * @param B The B matrices
+     * @param wavelength The wavelengths
+     * @param nthreads The number of threads to use
+     */
+    TwoThetaDerivatives(const af::const_ref<vec3<double> > &h,
+                        const af::const_ref<mat3<double> > &B,
+                        const af::const_ref<double> &wavelength,
+                        std::size_t nthreads = 1)
+        : h_(h.begin(), h.end()),
+          r0_(h.size()),
+          factor_(h.size()),
+          nthreads_(nthreads) {
+      std::size_t n = h.size();
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(B.size() == n);
+      DIALS_ASSERT(wavelength.size() == n);
+      for (std::size_t i = 0; i < n; ++i) {
+        r0_[i] = B[i] * h[i];
+        double r0len = r0_[i].length();
+        double sintheta = 0.5 * r0len * wavelength[i];
+        factor_[i] = wavelength[i] / (std::sqrt(1.0 - sintheta * sintheta) * r0len);
+      }
+    }
+
+    /** @returns The number of reflections */
+    std::size_t size() const {
+      return h_.size();
+    }
+
+    /** @returns The number of threads */
+    std::size_t nthreads() const {
+      return nthreads_;
+    }
+
+    /**
+     * Calculate the derivatives with respect to a crystal unit cell parameter
+     * @param isel The selected reflections
+     * @param dB The derivative of B for each selected reflection
+     * @param d2theta The derivative of 2theta for each selected reflection
+     */
+    void crystal_unit_cell(const af::const_ref<std::size_t> &isel,
+                           const af::const_ref<mat3<double> > &dB,
+                           af::ref<double> d2theta) const {
+      for (std::size_t k = 0; k < isel.size(); ++k) {
+        DIALS_ASSERT(isel[k] < size());
+      }
+      DIALS_ASSERT(dB.size() == isel.size());
+      DIALS_ASSERT(d2theta.size() == isel.size());
+      for_each_band(
+        UnitCellBand(*this, isel, dB, d2theta), (int)isel.size(), nthreads_);
+    }
+
+  private:
+    /**
+     * Calculate the unit cell derivatives for a band of reflections
+     */
+    struct UnitCellBand {
+      const TwoThetaDerivatives &parent;
+      af::const_ref<std::size_t> isel;
+      af::const_ref<mat3<double> > dB;
+      af::ref<double> d2theta;
+
+      UnitCellBand(const TwoThetaDerivatives &parent_,
+                   const af::const_ref<std::size_t> &isel_,
+                   const af::const_ref<mat3<double> > &dB_,
+                   af::ref<double> d2theta_)
+          : parent(parent_), isel(isel_), dB(dB_), d2theta(d2theta_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int k = i0; k < i1; ++k) {
+          std::size_t i = isel[k];
+          vec3<double> dr0 = dB[k] * parent.h_[i];
+          d2theta[k] = parent.factor_[i] * (dr0 * parent.r0_[i]);
+        }
+      }
+    };
+
+    af::shared<vec3<double> > h_;
+    af::shared<vec3<double> > r0_;
+    af::shared<double> factor_;
+    std::size_t nthreads_;
+  };
+
+}}  // namespace dials::refinement
+
+#endif  // DIALS_REFINEMENT_PREDICTION_DERIVATIVES_H
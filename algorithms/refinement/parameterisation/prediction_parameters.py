@@ -5,7 +5,11 @@
 from scitbx import matrix, sparse
 
 from dials.algorithms.refinement import DialsRefineConfigError
+from dials.algorithms.refinement.parameterisation.crystal_parameters import (
+    CrystalOrientationParameterisation,
+)
 from dials.array_family import flex
+from dials_refinement_helpers_ext import XYPhiDerivatives, dX_dp_and_dY_dp_from_dpv_dp
 
 """The PredictionParameterisation class ties together parameterisations for
 individual experimental models: beam, crystal orientation, crystal unit cell
@@ -86,6 +90,9 @@ def __init__(
         self._xl_unit_cell_parameterisations = xl_unit_cell_parameterisations
         self._goniometer_parameterisations = goniometer_parameterisations
 
+        # Number of threads used by the C++ gradient calculations
+        self._nthreads = 1
+
         self._update()
 
     def _update(self):
@@ -131,6 +138,19 @@ def _update(self):
         }
 
     # accessors for the lists of parameterisations of different types
+    def set_nthreads(self, nthreads):
+        """Set the number of threads used to calculate the gradients of each
+        parameter over the reflections, and by the detector parameterisations
+        that compose their panel derivatives in parallel"""
+        assert nthreads > 0
+        self._nthreads = nthreads
+        for p in self._detector_parameterisations:
+            if hasattr(p, "set_nthreads"):
+                p.set_nthreads(nthreads)
+
+    def get_nthreads(self):
+        return self._nthreads
+
     def get_detector_parameterisations(self):
         return self._detector_parameterisations
 
@@ -235,6 +255,8 @@ def _modify_parameters(self, vals, set_vals=False, set_esds=False, set_fix=False
         assert len(vals) == len(self)
         it = iter(vals)
 
+        # the static crystal orientations are composed together in one call
+        batched_xlo = []
         for model in (
             self._detector_parameterisations
             + self._beam_parameterisations
@@ -245,6 +267,9 @@ def _modify_parameters(self, vals, set_vals=False, set_esds=False, set_fix=False
             tmp = [next(it) for i in range(model.num_free())]
             if set_esds:
                 model.set_param_esds(tmp)
+            elif set_vals and type(model) is CrystalOrientationParameterisation:
+                model.set_param_vals(tmp, compose=False)
+                batched_xlo.append(model)
             elif set_vals:
                 model.set_param_vals(tmp)
             elif set_fix:
@@ -256,6 +281,11 @@ def _modify_parameters(self, vals, set_vals=False, set_esds=False, set_fix=False
                         current_fixes[i] = True
                 model.set_fixed(current_fixes)
 
+        if batched_xlo:
+            CrystalOrientationParameterisation.compose_all(
+                batched_xlo, nthreads=self._nthreads
+            )
+
     def set_param_vals(self, vals):
         """Set the parameter values of the contained models to the values in
         vals. This list must be of the same length as the result of get_param_vals
@@ -744,25 +774,36 @@ def _local_setup(self, reflections):
             print(matrix.col(reflections["s1"][imin]).accute_angle(vecn))
             raise e
 
+        # Set up the calculation of the derivatives of pv and phi
+        self._derivatives = XYPhiDerivatives(
+            self._h,
+            self._U,
+            self._B,
+            self._fixed_rotation,
+            self._setting_rotation,
+            self._axis,
+            self._phi_calc,
+            self._r,
+            self._s1,
+            self._e_X_r,
+            self._e_r_s0,
+            self._D,
+            nthreads=self._nthreads,
+        )
+
     def _beam_derivatives(
         self, isel, parameterisation=None, ds0_dbeam_p=None, reflections=None
     ):
         """helper function to extend the derivatives lists by derivatives of the
         beam parameterisations."""
 
-        # Get required data
-        r = self._r.select(isel)
-        e_X_r = self._e_X_r.select(isel)
-        e_r_s0 = self._e_r_s0.select(isel)
-        D = self._D.select(isel)
-
         if ds0_dbeam_p is None:
 
             # get the derivatives of the beam vector wrt the parameters
             ds0_dbeam_p = parameterisation.get_ds_dp(use_none_as_null=True)
 
             ds0_dbeam_p = [
-                None if e is None else flex.vec3_double(len(r), e.elems)
+                None if e is None else flex.vec3_double(len(isel), e.elems)
                 for e in ds0_dbeam_p
             ]
 
@@ -777,33 +818,21 @@ def _beam_derivatives(
                 dpv_dp.append(None)
                 continue
 
-            # calculate the derivative of phi for this parameter
-            dphi = (r.dot(der) / e_r_s0) * -1.0
+            # calculate the derivatives of pv and phi for this parameter
+            dpv, dphi = self._derivatives.beam(isel, der)
+            dpv_dp.append(dpv)
             dphi_dp.append(dphi)
 
-            # calculate the derivative of pv for this parameter
-            dpv_dp.append(D * (e_X_r * dphi + der))
-
         return dpv_dp, dphi_dp
 
     def _xl_derivatives(self, isel, derivatives, b_matrix, parameterisation=None):
         """helper function to extend the derivatives lists by derivatives of
         generic parameterisations."""
 
-        # Get required data
-        axis = self._axis.select(isel)
-        fixed_rotation = self._fixed_rotation.select(isel)
-        setting_rotation = self._setting_rotation.select(isel)
-        phi_calc = self._phi_calc.select(isel)
-        h = self._h.select(isel)
-        s1 = self._s1.select(isel)
-        e_X_r = self._e_X_r.select(isel)
-        e_r_s0 = self._e_r_s0.select(isel)
         if b_matrix:
-            B = self._B.select(isel)
+            calculate = self._derivatives.crystal_orientation
         else:
-            U = self._U.select(isel)
-        D = self._D.select(isel)
+            calculate = self._derivatives.crystal_unit_cell
 
         if derivatives is None:
             # get derivatives of the B/U matrix wrt the parameters
@@ -822,20 +851,11 @@ def _xl_derivatives(self, isel, derivatives, b_matrix, parameterisation=None):
                 dpv_dp.append(None)
                 continue
 
-            # calculate the derivative of r for this parameter
-            if b_matrix:
-                tmp = fixed_rotation * (der * B * h)
-            else:
-                tmp = fixed_rotation * (U * der * h)
-            dr = setting_rotation * tmp.rotate_around_origin(axis, phi_calc)
-
-            # calculate the derivative of phi for this parameter
-            dphi = -1.0 * dr.dot(s1) / e_r_s0
+            # calculate the derivatives of pv and phi for this parameter
+            dpv, dphi = calculate(isel, der)
+            dpv_dp.append(dpv)
             dphi_dp.append(dphi)
 
-            # calculate the derivative of pv for this parameter
-            dpv_dp.append(D * (dr + e_X_r * dphi))
-
         return dpv_dp, dphi_dp
 
     def _xl_orientation_derivatives(
@@ -862,17 +882,6 @@ def _goniometer_derivatives(
         """helper function to extend the derivatives lists by
         derivatives of the goniometer parameterisations"""
 
-        # Get required data
-        axis = self._axis.select(isel)
-        fixed_rotation = self._fixed_rotation.select(isel)
-        phi_calc = self._phi_calc.select(isel)
-        h = self._h.select(isel)
-        s1 = self._s1.select(isel)
-        e_X_r = self._e_X_r.select(isel)
-        e_r_s0 = self._e_r_s0.select(isel)
-        UB = self._UB.select(isel)
-        D = self._D.select(isel)
-
         if dS_dgon_p is None:
 
             # get derivatives of the setting matrix S wrt the parameters
@@ -892,17 +901,11 @@ def _goniometer_derivatives(
                 dpv_dp.append(None)
                 continue
 
-            # calculate the derivative of r for this parameter
-            tmp = fixed_rotation * (UB * h)
-            dr = der * tmp.rotate_around_origin(axis, phi_calc)
-
-            # calculate the derivative of phi for this parameter
-            dphi = -1.0 * dr.dot(s1) / e_r_s0
+            # calculate the derivatives of pv and phi for this parameter
+            dpv, dphi = self._derivatives.goniometer(isel, der)
+            dpv_dp.append(dpv)
             dphi_dp.append(dphi)
 
-            # calculate the derivative of pv for this parameter
-            dpv_dp.append(D * (dr + e_X_r * dphi))
-
         return dpv_dp, dphi_dp
 
     @staticmethod
@@ -918,10 +921,9 @@ def _calc_dX_dp_and_dY_dp_from_dpv_dp(w_inv, u_w_inv, v_w_inv, dpv_dp):
                 dX_dp.append(None)
                 dY_dp.append(None)
             else:
-                du_dp, dv_dp, dw_dp = der.parts()
-
-                dX_dp.append(w_inv * (du_dp - dw_dp * u_w_inv))
-                dY_dp.append(w_inv * (dv_dp - dw_dp * v_w_inv))
+                dX, dY = dX_dp_and_dY_dp_from_dpv_dp(w_inv, u_w_inv, v_w_inv, der)
+                dX_dp.append(dX)
+                dY_dp.append(dY)
 
         return dX_dp, dY_dp
 
@@ -5,7 +5,10 @@
     SparseGradientVectorMixin,
 )
 from dials.array_family import flex
-from dials_refinement_helpers_ext import dRq_de
+from dials_refinement_helpers_ext import (
+    StillsDeltaPsiDerivatives,
+    dX_dp_and_dY_dp_from_dpv_dp,
+)
 
 
 class StillsPredictionParameterisation(PredictionParameterisation):
@@ -54,23 +57,31 @@ def _local_setup(self, reflections):
         # we want the wavelength
         self._wavelength = 1.0 / self._s0.norms()
 
+        # Set up the calculation of the derivatives of pv and DeltaPsi
+        self._derivatives = StillsDeltaPsiDerivatives(
+            self._h,
+            self._U,
+            self._B,
+            self._s0,
+            self._s0u,
+            self._wavelength,
+            self._r,
+            self._e1,
+            self._q,
+            self._q0,
+            self._c0,
+            self._s1,
+            self._DeltaPsi,
+            self._D,
+            nthreads=self._nthreads,
+        )
+
         return
 
     def _beam_derivatives(self, isel, parameterisation=None, reflections=None):
         """helper function to extend the derivatives lists by derivatives of the
         beam parameterisations"""
 
-        # Get required data
-        s0 = self._s0.select(isel)
-        s0u = self._s0u.select(isel)
-        wl = self._wavelength.select(isel)
-        r = self._r.select(isel)
-        e1 = self._e1.select(isel)
-        q = self._q.select(isel)
-        c0 = self._c0.select(isel)
-        DeltaPsi = self._DeltaPsi.select(isel)
-        D = self._D.select(isel)
-
         # get the derivatives of the beam vector wrt the parameters
         ds0_dbeam_p = parameterisation.get_ds_dp(use_none_as_null=True)
 
@@ -86,175 +97,55 @@ def _beam_derivatives(self, isel, parameterisation=None, reflections=None):
                 continue
 
             # repeat the derivative in an array
-            ds0 = flex.vec3_double(len(s0u), der.elems)
-
-            # we need the derivative of the unit beam direction too. This requires
-            # scaling by the wavelength and projection onto the Ewald sphere
-            scaled = ds0 * wl
-            ds0u = scaled.dot(c0) * c0 + scaled.dot(e1) * e1
+            ds0 = flex.vec3_double(len(isel), der.elems)
 
-            # calculate the derivative of DeltaPsi for this parameter
-            dDeltaPsi = -1.0 * (r.dot(ds0)) / (e1.cross(r).dot(s0))
+            # calculate the derivatives of pv and DeltaPsi for this parameter
+            dpv, dDeltaPsi = self._derivatives.beam(isel, ds0)
+            dpv_dp.append(dpv)
             dDeltaPsi_dp.append(dDeltaPsi)
 
-            # calculate (d[r]/d[e1])(d[e1]/dp)
-            de1_dp = c0.cross(ds0u)
-            dr_de1 = dRq_de(DeltaPsi, e1, q)
-            drde_dedp = dr_de1 * de1_dp
-
-            # dp = 1.e-8 # finite step size for the parameter
-            # del_e1 = de1_dp * dp
-            # e1f = e1 + del_e1 * 0.5
-            # rfwd = q.rotate_around_origin(e1f, DeltaPsi)
-            # e1r = e1 - del_e1 * 0.5
-            # rrev = q.rotate_around_origin(e1r, DeltaPsi)
-            # drde_dedp = (rfwd - rrev) * (1 / dp)
-
-            # calculate the derivative of pv for this parameter
-            dpv_dp.append(D * (ds0 + e1.cross(r) * dDeltaPsi + drde_dedp))
-
         return dpv_dp, dDeltaPsi_dp
 
-    def _xl_orientation_derivatives(
-        self, isel, parameterisation=None, reflections=None
-    ):
+    def _xl_derivatives(self, isel, parameterisation, b_matrix):
         """helper function to extend the derivatives lists by derivatives of the
-        crystal orientation parameterisations"""
+        crystal orientation or unit cell parameterisations"""
 
-        # Get required data
-        B = self._B.select(isel)
-        h = self._h.select(isel)
-        e1 = self._e1.select(isel)
-        DeltaPsi = self._DeltaPsi.select(isel)
-        s1 = self._s1.select(isel)
-        q = self._q.select(isel)
-        q_scalar = self._q_scalar.select(isel)
-        qq = self._qq.select(isel)
-        q0 = self._q0.select(isel)
-        r = self._r.select(isel)
-        s0 = self._s0.select(isel)
-        s0u = self._s0u.select(isel)
-        D = self._D.select(isel)
-
-        # get derivatives of the U matrix wrt the parameters
-        dU_dxlo_p = parameterisation.get_ds_dp(use_none_as_null=True)
+        if b_matrix:
+            calculate = self._derivatives.crystal_orientation
+        else:
+            calculate = self._derivatives.crystal_unit_cell
 
         dDeltaPsi_dp = []
         dpv_dp = []
 
         # loop through the parameters
-        for der in dU_dxlo_p:
+        for der in parameterisation.get_ds_dp(use_none_as_null=True):
 
             if der is None:
                 dpv_dp.append(None)
                 dDeltaPsi_dp.append(None)
                 continue
 
-            der_mat = flex.mat3_double(len(B), der.elems)
-
-            # calculate the derivative of q for this parameter
-            dq = der_mat * B * h
-
-            # calculate the derivative of r for this parameter
-            dr = dq.rotate_around_origin(e1, DeltaPsi)
+            der_mat = flex.mat3_double(len(isel), der.elems)
 
-            # calculate the derivative of DeltaPsi for this parameter
-            dDeltaPsi = -1.0 * (dr.dot(s1)) / (e1.cross(r).dot(s0))
+            # calculate the derivatives of pv and DeltaPsi for this parameter
+            dpv, dDeltaPsi = calculate(isel, der_mat)
+            dpv_dp.append(dpv)
             dDeltaPsi_dp.append(dDeltaPsi)
 
-            # derivative of the axis e1
-            q_dot_dq = q.dot(dq)
-            dq0 = (q_scalar * dq - (q_dot_dq * q0)) / qq
-            de1_dp = dq0.cross(s0u)
-
-            # calculate (d[r]/d[e1])(d[e1]/dp)
-            # dr_de1 = dRq_de(DeltaPsi, e1, q)
-            # drde_dedp = dr_de1 * de1_dp
-
-            # The above calculation is not correct. Instead, calculate the partial
-            # derivative of r wrt change in rotation axis e1 by finite differences
-            dp = 1.0e-8
-            del_e1 = de1_dp * dp
-            e1f = e1 + del_e1 * 0.5
-            rfwd = q.rotate_around_origin(e1f, DeltaPsi)
-            e1r = e1 - del_e1 * 0.5
-            rrev = q.rotate_around_origin(e1r, DeltaPsi)
-            drde_dedp = (rfwd - rrev) * (1 / dp)
-
-            # calculate the derivative of pv for this parameter
-            dpv_dp.append(D * (dr + e1.cross(r) * dDeltaPsi + drde_dedp))
-
         return dpv_dp, dDeltaPsi_dp
 
+    def _xl_orientation_derivatives(
+        self, isel, parameterisation=None, reflections=None
+    ):
+        """helper function to extend the derivatives lists by derivatives of the
+        crystal orientation parameterisations"""
+        return self._xl_derivatives(isel, parameterisation, b_matrix=True)
+
     def _xl_unit_cell_derivatives(self, isel, parameterisation=None, reflections=None):
         """helper function to extend the derivatives lists by derivatives of the
         crystal unit cell parameterisations"""
-
-        # Get required data
-        U = self._U.select(isel)
-        h = self._h.select(isel)
-        e1 = self._e1.select(isel)
-        DeltaPsi = self._DeltaPsi.select(isel)
-        s1 = self._s1.select(isel)
-        q = self._q.select(isel)
-        q_scalar = self._q_scalar.select(isel)
-        qq = self._qq.select(isel)
-        q0 = self._q0.select(isel)
-        r = self._r.select(isel)
-        s0 = self._s0.select(isel)
-        s0u = self._s0u.select(isel)
-        D = self._D.select(isel)
-
-        # get derivatives of the B matrix wrt the parameters
-        dB_dxluc_p = parameterisation.get_ds_dp(use_none_as_null=True)
-
-        dDeltaPsi_dp = []
-        dpv_dp = []
-
-        # loop through the parameters
-        for der in dB_dxluc_p:
-
-            if der is None:
-                dpv_dp.append(None)
-                dDeltaPsi_dp.append(None)
-                continue
-
-            der_mat = flex.mat3_double(len(U), der.elems)
-
-            # calculate the derivative of q for this parameter
-            dq = U * der_mat * h
-
-            # calculate the derivative of r for this parameter
-            dr = dq.rotate_around_origin(e1, DeltaPsi)
-
-            # calculate the derivative of DeltaPsi for this parameter
-            dDeltaPsi = -1.0 * (dr.dot(s1)) / (e1.cross(r).dot(s0))
-            dDeltaPsi_dp.append(dDeltaPsi)
-
-            # derivative of the axis e1
-            q_dot_dq = q.dot(dq)
-            dq0 = (q_scalar * dq - (q_dot_dq * q0)) / qq
-            de1_dp = dq0.cross(s0u)
-
-            # calculate (d[r]/d[e1])(d[e1]/dp)
-            # dr_de1 = dRq_de(DeltaPsi, e1, q)
-            # drde_dedp = dr_de1 * de1_dp
-
-            # The above calculation is not correct. Instead, calculate the partial
-            # derivative of r wrt change in rotation axis e1 by finite differences
-            dp = 1.0e-8
-            del_e1 = de1_dp * dp
-            e1f = e1 + del_e1 * 0.5
-            rfwd = q.rotate_around_origin(e1f, DeltaPsi)
-            e1r = e1 - del_e1 * 0.5
-            rrev = q.rotate_around_origin(e1r, DeltaPsi)
-            drde_dedp = (rfwd - rrev) * (1 / dp)
-
-            # calculate the derivative of pv for this parameter
-            dpv = D * (dr + e1.cross(r) * dDeltaPsi + drde_dedp)
-            dpv_dp.append(dpv)
-
-        return dpv_dp, dDeltaPsi_dp
+        return self._xl_derivatives(isel, parameterisation, b_matrix=False)
 
     @staticmethod
     def _calc_dX_dp_and_dY_dp_from_dpv_dp(w_inv, u_w_inv, v_w_inv, dpv_dp):
@@ -269,10 +160,9 @@ def _calc_dX_dp_and_dY_dp_from_dpv_dp(w_inv, u_w_inv, v_w_inv, dpv_dp):
                 dX_dp.append(None)
                 dY_dp.append(None)
             else:
-                du_dp, dv_dp, dw_dp = der.parts()
-
-                dX_dp.append(w_inv * (du_dp - dw_dp * u_w_inv))
-                dY_dp.append(w_inv * (dv_dp - dw_dp * v_w_inv))
+                dX, dY = dX_dp_and_dY_dp_from_dpv_dp(w_inv, u_w_inv, v_w_inv, der)
+                dX_dp.append(dX)
+                dY_dp.append(dY)
 
         return dX_dp, dY_dp
 
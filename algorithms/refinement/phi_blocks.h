@@ -0,0 +1,103 @@
+/*
+ * phi_blocks.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_REFINEMENT_PHI_BLOCKS_H
+#define DIALS_REFINEMENT_PHI_BLOCKS_H
+
+#include <algorithm>
+#include <cmath>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace refinement {
+
+  /**
+   * Split observations into blocks of equal width in phi in a single pass.
+   * Block i covers phi_start + i * block_size to phi_start + (i + 1) *
+   * block_size, and the last block also includes any larger phi, so that it
+   * ends at the largest observation. The observations are grouped by block,
+   * keeping their order within each block, so that the residuals of every
+   * block can be taken as slices of one selection rather than by a selection
+   * over all the observations for each block.
+   */
+  class PhiBlocks {
+  public:
+    /**
+     * @param phi The phi of each observation
+     * @param phi_start The start of the first block
+     * @param block_size The width of the blocks
+     * @param nblocks The number of blocks
+     */
+    PhiBlocks(const af::const_ref<double> &phi,
+              double phi_start,
+              double block_size,
+              std::size_t nblocks)
+        : block_(phi.size()), count_(nblocks, 0), permutation_(phi.size()) {
+      DIALS_ASSERT(nblocks > 0);
+      DIALS_ASSERT(block_size > 0 || nblocks == 1);
+      for (std::size_t i = 0; i < phi.size(); ++i) {
+        DIALS_ASSERT(phi[i] >= phi_start);
+        std::size_t j = 0;
+        if (nblocks > 1) {
+          double b = std::min(std::floor((phi[i] - phi_start) / block_size),
+                              (double)(nblocks - 1));
+          j = (std::size_t)b;
+
+          // Correct for rounding, so that the block is the last one which
+          // starts at or before phi
+          while (j > 0 && phi[i] < phi_start + j * block_size) {
+            --j;
+          }
+          while (j + 1 < nblocks && phi[i] >= phi_start + (j + 1) * block_size) {
+            ++j;
+          }
+        }
+        block_[i] = j;
+        count_[j]++;
+      }
+
+      // Group the observations by block with a counting sort
+      af::shared<std::size_t> offset(nblocks, 0);
+      for (std::size_t j = 1; j < nblocks; ++j) {
+        offset[j] = offset[j - 1] + count_[j - 1];
+      }
+      for (std::size_t i = 0; i < phi.size(); ++i) {
+        permutation_[offset[block_[i]]++] = i;
+      }
+    }
+
+    /**
+     * @returns The block of each observation
+     */
+    af::shared<std::size_t> block() const {
+      return block_;
+    }
+
+    /**
+     * @returns The number of observations in each block
+     */
+    af::shared<int> count() const {
+      return count_;
+    }
+
+    /**
+     * @returns The observations grouped by block, in order within each block
+     */
+    af::shared<std::size_t> permutation() const {
+      return permutation_;
+    }
+
+  private:
+    af::shared<std::size_t> block_;
+    af::shared<int> count_;
+    af::shared<std::size_t> permutation_;
+  };
+
+}}  // namespace dials::refinement
+
+#endif  // DIALS_REFINEMENT_PHI_BLOCKS_H
@@ -12,7 +12,10 @@
 
 from scitbx.array_family import flex
 
-from dials.algorithms.spot_prediction import ScanStaticRayPredictor
+from dials.algorithms.spot_prediction import (
+    ScanStaticPredictionCache,
+    ScanStaticRayPredictor,
+)
 from dials.algorithms.spot_prediction import ScanStaticReflectionPredictor as sc
 from dials.algorithms.spot_prediction import ScanVaryingReflectionPredictor as sv
 from dials.algorithms.spot_prediction import StillsReflectionPredictor as st
@@ -102,6 +105,13 @@ def _post_prediction(self, reflections):
 
 
 class ScansExperimentsPredictor(ExperimentsPredictor):
+    def __init__(self, experiments):
+        super(ScansExperimentsPredictor, self).__init__(experiments)
+
+        # the rotation angles from the last scan-static prediction for each
+        # experiment, so that the next prediction can start from them
+        self._caches = {}
+
     def _predict_one_experiment(self, experiment, reflections):
 
         # scan-varying
@@ -116,7 +126,8 @@ def _predict_one_experiment(self, experiment, reflections):
         else:
             predictor = sc(experiment)
             UB = experiment.crystal.get_A()
-            predictor.for_reflection_table(reflections, UB)
+            cache = self._caches.setdefault(id(experiment), ScanStaticPredictionCache())
+            predictor.for_reflection_table_incremental(reflections, UB, cache)
 
     def _post_prediction(self, reflections):
 
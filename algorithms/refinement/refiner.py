@@ -71,7 +71,8 @@
       .help = "The number of processes to use. Not all choices of refinement"
               "engine support nproc > 1. Where multiprocessing is possible,"
               "it is helpful only in certain circumstances, so this is not"
-              "recommended for typical use."
+              "recommended for typical use. Otherwise, nproc threads are used"
+              "to calculate the gradients of each parameter."
   }
 
   parameterisation
@@ -634,11 +635,12 @@ def config_refinery(params, target, pred_param, constraints_manager):
             try:
                 engine.set_nproc(nproc)
             except NotImplementedError:
-                logger.warning(
-                    "Could not set nproc={0} for refinement engine of type {1}".format(
-                        nproc, options.engine
-                    )
+                # Calculate the gradients of each parameter with threads instead
+                logger.info(
+                    "Using nproc={0} threads for gradients with refinement engine "
+                    "of type {1}".format(nproc, options.engine)
                 )
+                pred_param.set_nthreads(nproc)
 
         return engine
 
@@ -30,6 +30,19 @@
 RAD2DEG = 180.0 / math.pi
 DEG2RAD = math.pi / 180.0
 
+
+def _indices_by_experiment(ids, nexp):
+    """Split the indices of a column of experiment ids into one array per
+    experiment in a single pass, rather than making a boolean selection over
+    the whole column for each experiment. Falls back to those selections if
+    any id lies outside the range of experiments."""
+
+    if len(ids) > 0 and flex.min(ids) >= 0 and flex.max(ids) < nexp:
+        table = flex.reflection_table()
+        table["id"] = ids
+        return table.split_indices_by_experiment_id(nexp)
+    return [(ids == iexp).iselection() for iexp in range(nexp)]
+
 # PHIL
 format_data = {"outlier_phil": outlier_phil_str}
 phil_str = (
@@ -536,22 +549,28 @@ def _id_refs_to_keep(self, obs_data):
         # combine selections
         sel = sel1 & sel2
         inc = flex.size_t_range(len(obs_data)).select(sel)
-        obs_data = obs_data.select(sel)
 
         # Default to True to pass the following test if there is no rotation axis
         # for a particular experiment
         to_keep = flex.bool(len(inc), True)
 
+        # select only the columns needed below, rather than copying the table,
+        # and locate the reflections of each experiment in a single pass
+        obs_id = obs_data["id"].select(inc)
+        obs_s1 = obs_data["s1"].select(inc)
+        obs_phi = obs_data["xyzobs.mm.value"].parts()[2].select(inc)
+        index_list = _indices_by_experiment(obs_id, len(self._experiments))
+
         for iexp, exp in enumerate(self._experiments):
             axis = self._axes[iexp]
             if not axis or exp.scan is None:
                 continue
             if exp.scan.is_still():
                 continue
-            sel = obs_data["id"] == iexp
+            sel = index_list[iexp]
             s0 = self._s0vecs[iexp]
-            s1 = obs_data["s1"].select(sel)
-            phi = obs_data["xyzobs.mm.value"].parts()[2].select(sel)
+            s1 = obs_s1.select(sel)
+            phi = obs_phi.select(sel)
 
             # first test: reject reflections for which the parallelepiped formed
             # between the gonio axis, s0 and s1 has a volume of less than the cutoff.
@@ -606,11 +625,12 @@ def _create_working_set(self):
         """Make a subset of the indices of reflections to use in refinement"""
 
         working_isel = flex.size_t()
+        index_list = _indices_by_experiment(
+            self._reflections["id"], len(self._experiments)
+        )
         for iexp, exp in enumerate(self._experiments):
 
-            sel = self._reflections["id"] == iexp
-            isel = sel.iselection()
-            # refs = self._reflections.select(sel)
+            isel = index_list[iexp]
             nrefs = sample_size = len(isel)
 
             # set sample size according to nref_per_degree (per experiment)
@@ -6,7 +6,10 @@
 from scitbx import sparse
 from scitbx.array_family import flex
 
-from dials_refinement_helpers_ext import CalculateCellGradients
+from dials_refinement_helpers_ext import (
+    CalculateCellGradients,
+    CalculateMultiCellGradients,
+)
 
 logger = logging.getLogger(__name__)
 
@@ -384,24 +387,31 @@ def gradients(self):
         being restrained. Gradients of zero are detected and not set in the sparse
         matrices to save memory."""
 
-        for i, xlucp in enumerate(self._xlucp):
-            B = xlucp.get_state()
-            dB_dp = flex.mat3_double(xlucp.get_ds_dp())
-            # Use C++ function for speed
-            ccg = CalculateCellGradients(B, dB_dp)
+        # Use C++ function for speed, calculating the gradients for all the
+        # crystals in one call
+        B = flex.mat3_double()
+        dB_dp = flex.mat3_double()
+        offset = flex.size_t([0])
+        for xlucp in self._xlucp:
+            B.append(xlucp.get_state().elems)
+            dB_dp.extend(flex.mat3_double(xlucp.get_ds_dp()))
+            offset.append(len(dB_dp))
+        ccg = CalculateMultiCellGradients(B, dB_dp, offset)
+        grads = [
+            ccg.da_dp(),
+            ccg.db_dp(),
+            ccg.dc_dp(),
+            ccg.daa_dp(),
+            ccg.dbb_dp(),
+            ccg.dcc_dp(),
+        ]
+
+        for i in range(self._nxls):
             dRdp = []
-            if self._sel[0]:
-                dRdp.append(self._construct_grad_block(ccg.da_dp(), i))
-            if self._sel[1]:
-                dRdp.append(self._construct_grad_block(ccg.db_dp(), i))
-            if self._sel[2]:
-                dRdp.append(self._construct_grad_block(ccg.dc_dp(), i))
-            if self._sel[3]:
-                dRdp.append(self._construct_grad_block(ccg.daa_dp(), i))
-            if self._sel[4]:
-                dRdp.append(self._construct_grad_block(ccg.dbb_dp(), i))
-            if self._sel[5]:
-                dRdp.append(self._construct_grad_block(ccg.dcc_dp(), i))
+            for sel, g in zip(self._sel, grads):
+                if sel:
+                    param_grads = g[offset[i] : offset[i + 1]]
+                    dRdp.append(self._construct_grad_block(param_grads, i))
 
             yield dRdp
 
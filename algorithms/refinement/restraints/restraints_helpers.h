@@ -15,11 +15,14 @@
 #define RAD2DEG(x) ((x)*57.29577951308232087721)
 #endif
 
+#include <algorithm>
+#include <vector>
 #include <scitbx/mat3.h>
 #include <scitbx/vec3.h>
 #include <scitbx/array_family/tiny.h>
 #include <scitbx/math/angle_derivative.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace refinement {
@@ -69,7 +72,7 @@ namespace dials { namespace refinement {
     }
 
     // gradients of parameter a
-    af::shared<double> da_dp() {
+    af::shared<double> da_dp() const {
       af::shared<double> result;
       for (std::size_t i = 0; i < dO_dp_.size(); ++i) {
         vec3<double> dav_dp = dO_dp_[i].get_column(0);
@@ -80,7 +83,7 @@ namespace dials { namespace refinement {
     }
 
     // gradients of parameter b
-    af::shared<double> db_dp() {
+    af::shared<double> db_dp() const {
       af::shared<double> result;
       for (std::size_t i = 0; i < dO_dp_.size(); ++i) {
         vec3<double> dbv_dp = dO_dp_[i].get_column(1);
@@ -91,7 +94,7 @@ namespace dials { namespace refinement {
     }
 
     // gradients of parameter c
-    af::shared<double> dc_dp() {
+    af::shared<double> dc_dp() const {
       af::shared<double> result;
       for (std::size_t i = 0; i < dO_dp_.size(); ++i) {
         vec3<double> dcv_dp = dO_dp_[i].get_column(2);
@@ -102,7 +105,7 @@ namespace dials { namespace refinement {
     }
 
     // gradients of parameter alpha
-    af::shared<double> daa_dp() {
+    af::shared<double> daa_dp() const {
       af::shared<double> result;
       for (std::size_t i = 0; i < dO_dp_.size(); ++i) {
         vec3<double> dbv_dp = dO_dp_[i].get_column(1);
@@ -114,7 +117,7 @@ namespace dials { namespace refinement {
     }
 
     // gradients of parameter beta
-    af::shared<double> dbb_dp() {
+    af::shared<double> dbb_dp() const {
       af::shared<double> result;
       for (std::size_t i = 0; i < dO_dp_.size(); ++i) {
         vec3<double> dav_dp = dO_dp_[i].get_column(0);
@@ -126,7 +129,7 @@ namespace dials { namespace refinement {
     }
 
     // gradients of parameter gamma
-    af::shared<double> dcc_dp() {
+    af::shared<double> dcc_dp() const {
       af::shared<double> result;
       for (std::size_t i = 0; i < dO_dp_.size(); ++i) {
         vec3<double> dav_dp = dO_dp_[i].get_column(0);
@@ -146,6 +149,115 @@ namespace dials { namespace refinement {
     vec3<double> dbeta_da_, dbeta_dc_;
     vec3<double> dgamma_da_, dgamma_db_;
   };
+
+  /**
+   * Calculate the derivatives of the real space cells of many crystals with
+   * respect to the parameters of their unit cell parameterisations, as done
+   * for one crystal by CalculateCellGradients. The crystals are processed in
+   * bands across threads. The derivatives of the B matrices are held one
+   * crystal after another, and each gradient is returned in the same order.
+   */
+  class CalculateMultiCellGradients {
+  public:
+    /**
+     * @param B The B matrix of each crystal
+     * @param dB_dp The derivatives of the B matrices of all the crystals
+     * @param offset The start of each crystal in dB_dp, and the end of the last
+     * @param nthreads The number of threads to use
+     */
+    CalculateMultiCellGradients(const af::const_ref<mat3<double> > &B,
+                                const af::const_ref<mat3<double> > &dB_dp,
+                                const af::const_ref<std::size_t> &offset,
+                                std::size_t nthreads = 1)
+        : gradients_(6) {
+      DIALS_ASSERT(offset.size() == B.size() + 1);
+      DIALS_ASSERT(offset[0] == 0);
+      DIALS_ASSERT(offset[B.size()] == dB_dp.size());
+      for (std::size_t i = 0; i < B.size(); ++i) {
+        DIALS_ASSERT(offset[i] <= offset[i + 1]);
+      }
+      for (std::size_t i = 0; i < gradients_.size(); ++i) {
+        gradients_[i] = af::shared<double>(dB_dp.size(), 0);
+      }
+      for_each_band(CrystalBand(B, dB_dp, offset, gradients_), (int)B.size(), nthreads);
+    }
+
+    // gradients of parameter a
+    af::shared<double> da_dp() const {
+      return gradients_[0];
+    }
+
+    // gradients of parameter b
+    af::shared<double> db_dp() const {
+      return gradients_[1];
+    }
+
+    // gradients of parameter c
+    af::shared<double> dc_dp() const {
+      return gradients_[2];
+    }
+
+    // gradients of parameter alpha
+    af::shared<double> daa_dp() const {
+      return gradients_[3];
+    }
+
+    // gradients of parameter beta
+    af::shared<double> dbb_dp() const {
+      return gradients_[4];
+    }
+
+    // gradients of parameter gamma
+    af::shared<double> dcc_dp() const {
+      return gradients_[5];
+    }
+
+  private:
+    /**
+     * Calculate the gradients for a band of crystals
+     */
+    struct CrystalBand {
+      af::const_ref<mat3<double> > B;
+      af::const_ref<mat3<double> > dB_dp;
+      af::const_ref<std::size_t> offset;
+      std::vector<af::ref<double> > gradients;
+
+      CrystalBand(const af::const_ref<mat3<double> > &B_,
+                  const af::const_ref<mat3<double> > &dB_dp_,
+                  const af::const_ref<std::size_t> &offset_,
+                  std::vector<af::shared<double> > &gradients_)
+          : B(B_), dB_dp(dB_dp_), offset(offset_) {
+        for (std::size_t i = 0; i < gradients_.size(); ++i) {
+          gradients.push_back(gradients_[i].ref());
+        }
+      }
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          std::size_t n = offset[i + 1] - offset[i];
+          if (n == 0) {
+            continue;
+          }
+          CalculateCellGradients ccg(
+            B[i], af::const_ref<mat3<double> >(&dB_dp[offset[i]], n));
+          store(ccg.da_dp(), offset[i], gradients[0]);
+          store(ccg.db_dp(), offset[i], gradients[1]);
+          store(ccg.dc_dp(), offset[i], gradients[2]);
+          store(ccg.daa_dp(), offset[i], gradients[3]);
+          store(ccg.dbb_dp(), offset[i], gradients[4]);
+          store(ccg.dcc_dp(), offset[i], gradients[5]);
+        }
+      }
+
+      static void store(const af::shared<double> &values,
+                        std::size_t first,
+                        af::ref<double> result) {
+        std::copy(values.begin(), values.end(), result.begin() + first);
+      }
+    };
+
+    std::vector<af::shared<double> > gradients_;
+  };
 }}  // namespace dials::refinement
 
 #endif  // DIALS_REFINEMENT_RESTRAINTS_HELPERS_H
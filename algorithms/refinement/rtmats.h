@@ -18,6 +18,7 @@
 #include <cmath>
 #include <scitbx/mat3.h>
 #include <scitbx/vec3.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/error.h>
 
 namespace dials { namespace refinement {
@@ -25,6 +26,42 @@ namespace dials { namespace refinement {
   using scitbx::mat3;
   using scitbx::vec3;
 
+  namespace detail {
+
+    /**
+     * The rotation matrix R by an angle with cosine ca and sine sa in a
+     * right-handed sense about the unit vector e
+     */
+    inline mat3<double> R_from_unit_axis(const vec3<double> &e, double ca, double sa) {
+      double t = 1.0 - ca;
+      return mat3<double>(t * e[0] * e[0] + ca,
+                          t * e[0] * e[1] - sa * e[2],
+                          t * e[0] * e[2] + sa * e[1],
+                          t * e[1] * e[0] + sa * e[2],
+                          t * e[1] * e[1] + ca,
+                          t * e[1] * e[2] - sa * e[0],
+                          t * e[2] * e[0] - sa * e[1],
+                          t * e[2] * e[1] + sa * e[0],
+                          t * e[2] * e[2] + ca);
+    }
+
+    /**
+     * The first derivative of R_from_unit_axis with respect to the angle
+     */
+    inline mat3<double> dR_from_unit_axis(const vec3<double> &e, double ca, double sa) {
+      return mat3<double>(sa * e[0] * e[0] - sa,
+                          sa * e[0] * e[1] - ca * e[2],
+                          sa * e[0] * e[2] + ca * e[1],
+                          sa * e[1] * e[0] + ca * e[2],
+                          sa * e[1] * e[1] - sa,
+                          sa * e[1] * e[2] - ca * e[0],
+                          sa * e[2] * e[0] - ca * e[1],
+                          sa * e[2] * e[1] + ca * e[0],
+                          sa * e[2] * e[2] - sa);
+    }
+
+  }  // namespace detail
+
   /**
    * Calculate the first derivative of a rotation matrix R with respect to the
    * angle of rotation, given the axis and angle.
@@ -33,22 +70,81 @@ namespace dials { namespace refinement {
    * Here the rotation is taken to be in a right-handed sense around the axis
    * whereas RTMATS uses a left-handed rotation.
    */
-  mat3<double> dR_from_axis_and_angle(const vec3<double> &axis,
-                                      double angle,
-                                      bool deg = false) {
+  inline mat3<double> dR_from_axis_and_angle(const vec3<double> &axis,
+                                             double angle,
+                                             bool deg = false) {
     if (deg) angle = DEG2RAD(angle);
-    vec3<double> axis_ = axis.normalize();
-    double ca = cos(angle);
-    double sa = sin(angle);
-    return mat3<double>(sa * axis_[0] * axis_[0] - sa,
-                        sa * axis_[0] * axis_[1] - ca * axis_[2],
-                        sa * axis_[0] * axis_[2] + ca * axis_[1],
-                        sa * axis_[1] * axis_[0] + ca * axis_[2],
-                        sa * axis_[1] * axis_[1] - sa,
-                        sa * axis_[1] * axis_[2] - ca * axis_[0],
-                        sa * axis_[2] * axis_[0] - ca * axis_[1],
-                        sa * axis_[2] * axis_[1] + ca * axis_[0],
-                        sa * axis_[2] * axis_[2] - sa);
+    return detail::dR_from_unit_axis(axis.normalize(), cos(angle), sin(angle));
+  }
+
+  /**
+   * Calculate the rotation matrices R and their first derivatives with
+   * respect to the angle of rotation for many axes and angles at once, as
+   * used for the spindle rotation of each reflection. The sine and cosine of
+   * each angle are found once and shared between R and dR.
+   * @param axes The rotation axis for each angle
+   * @param angles The angles of rotation
+   * @param R The rotation matrix for each angle
+   * @param dR The derivative of the rotation matrix for each angle
+   * @param deg True if the angles are in degrees
+   */
+  inline void R_and_dR_from_axes_and_angles(const af::const_ref<vec3<double> > &axes,
+                                            const af::const_ref<double> &angles,
+                                            af::ref<mat3<double> > R,
+                                            af::ref<mat3<double> > dR,
+                                            bool deg = false) {
+    DIALS_ASSERT(axes.size() == angles.size());
+    DIALS_ASSERT(R.size() == angles.size());
+    DIALS_ASSERT(dR.size() == angles.size());
+    for (std::size_t i = 0; i < angles.size(); ++i) {
+      double angle = deg ? DEG2RAD(angles[i]) : angles[i];
+      double ca = cos(angle);
+      double sa = sin(angle);
+      vec3<double> e = axes[i].normalize();
+      R[i] = detail::R_from_unit_axis(e, ca, sa);
+      dR[i] = detail::dR_from_unit_axis(e, ca, sa);
+    }
+  }
+
+  /**
+   * Calculate the rotation matrices for many axes and angles at once
+   * @param axes The rotation axis for each angle
+   * @param angles The angles of rotation
+   * @param deg True if the angles are in degrees
+   * @returns The rotation matrix for each angle
+   */
+  inline af::shared<mat3<double> > R_from_axes_and_angles(
+    const af::const_ref<vec3<double> > &axes,
+    const af::const_ref<double> &angles,
+    bool deg = false) {
+    DIALS_ASSERT(axes.size() == angles.size());
+    af::shared<mat3<double> > R(angles.size(), af::init_functor_null<mat3<double> >());
+    for (std::size_t i = 0; i < angles.size(); ++i) {
+      double angle = deg ? DEG2RAD(angles[i]) : angles[i];
+      R[i] = detail::R_from_unit_axis(axes[i].normalize(), cos(angle), sin(angle));
+    }
+    return R;
+  }
+
+  /**
+   * Calculate the first derivatives of the rotation matrices with respect to
+   * the angle of rotation for many axes and angles at once
+   * @param axes The rotation axis for each angle
+   * @param angles The angles of rotation
+   * @param deg True if the angles are in degrees
+   * @returns The derivative of the rotation matrix for each angle
+   */
+  inline af::shared<mat3<double> > dR_from_axes_and_angles(
+    const af::const_ref<vec3<double> > &axes,
+    const af::const_ref<double> &angles,
+    bool deg = false) {
+    DIALS_ASSERT(axes.size() == angles.size());
+    af::shared<mat3<double> > dR(angles.size(), af::init_functor_null<mat3<double> >());
+    for (std::size_t i = 0; i < angles.size(); ++i) {
+      double angle = deg ? DEG2RAD(angles[i]) : angles[i];
+      dR[i] = detail::dR_from_unit_axis(axes[i].normalize(), cos(angle), sin(angle));
+    }
+    return dR;
   }
 
 }}  // namespace dials::refinement
@@ -0,0 +1,99 @@
+/*
+ * sparse_jacobian.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_REFINEMENT_SPARSE_JACOBIAN_H
+#define DIALS_REFINEMENT_SPARSE_JACOBIAN_H
+
+#include <vector>
+#include <scitbx/sparse/matrix.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace refinement {
+
+  using dials::algorithms::for_each_band;
+
+  namespace detail {
+
+    /**
+     * Fill the columns of the Jacobian for a band of parameters. Each column
+     * is the concatenation of the gradient vectors of the parameter for each
+     * dimension of the residual, so the elements are appended in order of
+     * increasing row without any random insertion.
+     */
+    struct SparseJacobianBand {
+      typedef scitbx::sparse::matrix<double>::column_type column_type;
+
+      const std::vector<const column_type *> &gradients;
+      std::size_t nref;
+      scitbx::sparse::matrix<double> &jacobian;
+
+      SparseJacobianBand(const std::vector<const column_type *> &gradients_,
+                         std::size_t nref_,
+                         scitbx::sparse::matrix<double> &jacobian_)
+          : gradients(gradients_), nref(nref_), jacobian(jacobian_) {}
+
+      void operator()(int j0, int j1) const {
+        std::size_t nparam = jacobian.n_cols();
+        std::size_t ndim = gradients.size() / nparam;
+        for (int j = j0; j < j1; ++j) {
+          column_type &result = jacobian.col(j);
+          for (std::size_t d = 0; d < ndim; ++d) {
+            const column_type &grad = *gradients[d * nparam + j];
+            std::size_t offset = d * nref;
+            for (column_type::const_iterator it = grad.begin(); it != grad.end();
+                 ++it) {
+              result[offset + it.index()] = *it;
+            }
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Build the sparse Jacobian of the residuals from the sparse gradient
+   * vectors of each parameter. The rows are ordered by dimension of the
+   * residual (e.g. X, Y then phi) and then by reflection, so each gradient
+   * vector fills a contiguous block of its column. Only the non-zero elements
+   * of each gradient vector, those of the reflections affected by the
+   * parameter, are visited, and the columns are filled in bands across
+   * threads.
+   * @param gradients The gradient vectors, ordered by dimension then by
+   *                  parameter. They must be compact, as they are read
+   *                  concurrently.
+   * @param nref The number of reflections
+   * @param nparam The number of parameters
+   * @param nthreads The number of threads to use
+   * @returns The Jacobian, with nref rows for each dimension
+   */
+  inline scitbx::sparse::matrix<double> build_sparse_jacobian(
+    const std::vector<const scitbx::sparse::matrix<double>::column_type *> &gradients,
+    std::size_t nref,
+    std::size_t nparam,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(nparam > 0);
+    DIALS_ASSERT(gradients.size() % nparam == 0);
+    std::size_t ndim = gradients.size() / nparam;
+    for (std::size_t k = 0; k < gradients.size(); ++k) {
+      DIALS_ASSERT(gradients[k] != NULL);
+      DIALS_ASSERT(gradients[k]->size() == nref);
+    }
+    scitbx::sparse::matrix<double> jacobian(ndim * nref, nparam);
+    for_each_band(detail::SparseJacobianBand(gradients, nref, jacobian),
+                  (int)nparam,
+                  nthreads);
+    jacobian.compact();
+    return jacobian;
+  }
+
+}}  // namespace dials::refinement
+
+#endif  // DIALS_REFINEMENT_SPARSE_JACOBIAN_H
@@ -9,6 +9,8 @@
 from scitbx import sparse
 from scitbx.array_family import flex
 
+from dials_refinement_helpers_ext import build_sparse_jacobian
+
 phil_str = """
     rmsd_cutoff = *fraction_of_bin_size absolute
       .help = "Method to choose rmsd cutoffs. This is currently either as a"
@@ -434,7 +436,12 @@ def compute_residuals_and_gradients(self, block=None):
 
         nelem = len(matches) * len(self._grad_names)
         nparam = len(self._prediction_parameterisation)
-        jacobian = self._build_jacobian(reshaped, nelem=nelem, nparam=nparam)
+        jacobian = self._build_jacobian(
+            reshaped,
+            nelem=nelem,
+            nparam=nparam,
+            nthreads=self._prediction_parameterisation.get_nthreads(),
+        )
 
         return (residuals, jacobian, weights)
 
@@ -455,7 +462,7 @@ def compute_restraints_residuals_and_gradients(self):
             return None
 
     @staticmethod
-    def _build_jacobian(grads_each_dim, nelem=None, nparam=None):
+    def _build_jacobian(grads_each_dim, nelem=None, nparam=None, nthreads=1):
         """construct Jacobian from lists of gradient vectors. The elements of
         grads_each_dim refer to the gradients of each dimension of the problem
         (e.g. dX, dY, dZ). The elements for a single dimension give the arrays
@@ -651,24 +658,16 @@ class SparseGradientsMixin:
     that employed sparse storage."""
 
     @staticmethod
-    def _build_jacobian(grads_each_dim, nelem=None, nparam=None):
-        """construct Jacobian from lists of sparse gradient vectors."""
+    def _build_jacobian(grads_each_dim, nelem=None, nparam=None, nthreads=1):
+        """construct Jacobian from lists of sparse gradient vectors. The columns
+        are filled directly from the non-zero elements of the gradient vectors of
+        each parameter, in parallel over the parameters."""
 
         nref = int(nelem / len(grads_each_dim))
 
-        blocks = [sparse.matrix(nref, nparam) for _ in grads_each_dim]
-        jacobian = sparse.matrix(nelem, nparam)
-
-        # loop over parameters, building full width blocks of the full Jacobian
-        for i in range(nparam):
-            for block, grad in zip(blocks, grads_each_dim):
-                block[:, i] = grad[i]
-
-        # set the blocks in the Jacobian
-        for i, block in enumerate(blocks):
-            jacobian.assign_block(block, (i * nref), 0)
-
-        return jacobian
+        return build_sparse_jacobian(
+            grads_each_dim, nref=nref, nparam=nparam, nthreads=nthreads
+        )
 
     @staticmethod
     def _concatenate_gradients(grads):
@@ -18,6 +18,7 @@
 from dials.algorithms.refinement.target import Target
 from dials.array_family import flex
 from dials.util import tabulate
+from dials_refinement_helpers_ext import TwoThetaDerivatives
 
 logger = logging.getLogger(__name__)
 
@@ -227,41 +228,29 @@ def _local_setup(self, reflections):
         # we want the wavelength
         self._wavelength = 1.0 / self._s0.norms()
 
+        # Set up the calculation of the derivatives of 2theta
+        self._derivatives = TwoThetaDerivatives(
+            self._h, self._B, self._wavelength, nthreads=self._nthreads
+        )
+
         return
 
     def _xl_unit_cell_derivatives(self, isel, parameterisation=None, reflections=None):
 
-        # Get required data
-        h = self._h.select(isel)
-        B = self._B.select(isel)
-        wl = self._wavelength.select(isel)
-
-        # get derivatives of the B matrix wrt the parameters
-        dB_dxluc_p = [
-            None if der is None else flex.mat3_double(len(isel), der.elems)
-            for der in parameterisation.get_ds_dp(use_none_as_null=True)
-        ]
-
         d2theta_dp = []
 
         # loop through the parameters
-        for der in dB_dxluc_p:
+        for der in parameterisation.get_ds_dp(use_none_as_null=True):
 
             if der is None:
                 d2theta_dp.append(None)
                 continue
 
-            r0 = B * h
-            dr0 = der * h
-            r0len = r0.norms()
-            dr0len = dr0.dot(r0) / r0len
+            # repeat the derivative of the B matrix in an array
+            dB = flex.mat3_double(len(isel), der.elems)
 
             # 2theta = 2 * arcsin( |r0| / (2 * |s0| ) )
-            sintheta = 0.5 * r0len * wl
-            fac = 1.0 / flex.sqrt(flex.double(len(wl), 1.0) - flex.pow2(sintheta))
-            val = fac * wl * dr0len
-
-            d2theta_dp.append(val)
+            d2theta_dp.append(self._derivatives.crystal_unit_cell(isel, dB))
 
         return d2theta_dp
 
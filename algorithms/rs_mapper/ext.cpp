@@ -1,8 +1,13 @@
 #include <boost/python.hpp>
 #include <scitbx/array_family/shared.h>
 #include <scitbx/array_family/flex_types.h>
+#include <scitbx/math/r3_rotation.h>
+#include <algorithm>
 #include <cctype>
+#include <vector>
 #include <dxtbx/model/panel.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
 #include <iostream>
 
 namespace recviewer { namespace ext {
@@ -33,6 +38,71 @@ namespace recviewer { namespace ext {
     return ret;
   }
 
+  /**
+   * Find the target pixels of a band of columns of the image, with the S
+   * vector of each
+   */
+  struct TargetPixelsBand {
+    const dxtbx::model::Panel &panel;
+    vec3<double> s0;
+    int ylim;
+    double maxres;
+    std::vector<std::vector<vec2<double> > > &xy;
+    std::vector<std::vector<vec3<double> > > &S;
+
+    TargetPixelsBand(const dxtbx::model::Panel &panel_,
+                     const vec3<double> &s0_,
+                     int ylim_,
+                     double maxres_,
+                     std::vector<std::vector<vec2<double> > > &xy_,
+                     std::vector<std::vector<vec3<double> > > &S_)
+        : panel(panel_), s0(s0_), ylim(ylim_), maxres(maxres_), xy(xy_), S(S_) {}
+
+    void operator()(int x0, int x1) const {
+      double pixel_size = panel.get_pixel_size()[0];
+      double inv_wavelength = s0.length();
+      vec2<double> p;
+      for (int x = x0; x < x1; x++) {
+        for (int y = 0; y < ylim; y++) {
+          p[0] = x;
+          p[1] = y;
+          if (panel.get_resolution_at_pixel(s0, p) > maxres) {
+            vec3<double> s1 = panel.get_lab_coord(p * pixel_size);
+            s1 = s1 / s1.length() * inv_wavelength;
+            xy[x].push_back(p);
+            S[x].push_back(s1 - s0);
+          }
+        }
+      }
+    }
+  };
+
+  /**
+   * Find the target pixels as get_target_pixels, together with the S vector
+   * of each, in one pass over the panel. The columns of the image are split
+   * into bands across threads.
+   */
+  static boost::python::tuple get_target_pixels_and_S(dxtbx::model::Panel panel,
+                                                      vec3<double> s0,
+                                                      int xlim,
+                                                      int ylim,
+                                                      double maxres,
+                                                      std::size_t nthreads) {
+    std::vector<std::vector<vec2<double> > > xy(std::max(xlim, 0));
+    std::vector<std::vector<vec3<double> > > S(xy.size());
+    dials::algorithms::for_each_band(
+      TargetPixelsBand(panel, s0, ylim, maxres, xy, S), (int)xy.size(), nthreads);
+    af::shared<vec2<double> > xy_all;
+    af::shared<vec3<double> > S_all;
+    for (std::size_t x = 0; x < xy.size(); x++) {
+      for (std::size_t i = 0; i < xy[x].size(); i++) {
+        xy_all.push_back(xy[x][i]);
+        S_all.push_back(S[x][i]);
+      }
+    }
+    return boost::python::make_tuple(xy_all, S_all);
+  }
+
   static void fill_voxels(const af::flex_int &image,
                           af::flex_double &grid,
                           af::flex_int &counts,
@@ -57,7 +127,158 @@ namespace recviewer { namespace ext {
     }
   }
 
-  static void normalize_voxels(af::flex_double &grid, af::flex_int &counts) {
+  /**
+   * Find the voxel of a band of pixels after rotating their S vectors, and
+   * the offset of each pixel in the image
+   */
+  struct VoxelIndexBand {
+    const vec3<double> *S;
+    const vec2<double> *xy;
+    mat3<double> R;
+    double step;
+    int npoints;
+    int width;
+    int *voxel;
+    int *pixel;
+
+    VoxelIndexBand(const vec3<double> *S_,
+                   const vec2<double> *xy_,
+                   const mat3<double> &R_,
+                   double step_,
+                   int npoints_,
+                   int width_,
+                   int *voxel_,
+                   int *pixel_)
+        : S(S_),
+          xy(xy_),
+          R(R_),
+          step(step_),
+          npoints(npoints_),
+          width(width_),
+          voxel(voxel_),
+          pixel(pixel_) {}
+
+    void operator()(int i0, int i1) const {
+      for (int i = i0; i < i1; i++) {
+        vec3<double> rotated_S = R * S[i];
+        int ind_x = rotated_S[0] / step + npoints / 2 + 0.5;
+        int ind_y = rotated_S[1] / step + npoints / 2 + 0.5;
+        int ind_z = rotated_S[2] / step + npoints / 2 + 0.5;
+        int x = xy[i][0];
+        int y = xy[i][1];
+        pixel[i] = y * width + x;
+
+        if (ind_x >= npoints || ind_y >= npoints || ind_z >= npoints || ind_x < 0
+            || ind_y < 0 || ind_z < 0) {
+          voxel[i] = -1;
+        } else {
+          voxel[i] = (ind_x * npoints + ind_y) * npoints + ind_z;
+        }
+      }
+    }
+  };
+
+  /**
+   * Add the pixels that fall in a band of slabs of the grid, so that each
+   * thread writes to its own part of the grid. The pixels are added in the
+   * same order as by a single thread.
+   */
+  template <typename FloatType>
+  struct FillSlabBand {
+    const int *image;
+    const int *voxel;
+    const int *pixel;
+    int npixels;
+    int slab;
+    FloatType *grid;
+    int *counts;
+
+    FillSlabBand(const int *image_,
+                 const int *voxel_,
+                 const int *pixel_,
+                 int npixels_,
+                 int slab_,
+                 FloatType *grid_,
+                 int *counts_)
+        : image(image_),
+          voxel(voxel_),
+          pixel(pixel_),
+          npixels(npixels_),
+          slab(slab_),
+          grid(grid_),
+          counts(counts_) {}
+
+    void operator()(int x0, int x1) const {
+      int v0 = x0 * slab;
+      int v1 = x1 * slab;
+      for (int i = 0; i < npixels; i++) {
+        int v = voxel[i];
+        if (v >= v0 && v < v1) {
+          grid[v] += image[pixel[i]];
+          counts[v]++;
+        }
+      }
+    }
+  };
+
+  /**
+   * Rotate the S vectors of the target pixels to the frame of an image and
+   * add the pixels to the grid. The rotation matrix is computed once for the
+   * image. The voxel of each pixel is found in bands of pixels across
+   * threads, then each thread adds the pixels falling in its own slabs of
+   * the grid.
+   */
+  template <typename FloatType>
+  static void rotate_and_fill_voxels(
+    const af::flex_int &image,
+    af::versa<FloatType, af::flex_grid<> > &grid,
+    af::flex_int &counts,
+    const flex_vec3_double &S,
+    const flex_vec2_double &xy,
+    const vec3<double> &axis,
+    const double angle,
+    const double rec_range,
+    std::size_t nthreads) {
+    DIALS_ASSERT(grid.accessor().nd() == 3);
+    DIALS_ASSERT(grid.accessor().all()[1] == grid.accessor().all()[0]);
+    DIALS_ASSERT(grid.accessor().all()[2] == grid.accessor().all()[0]);
+    DIALS_ASSERT(counts.size() == grid.size());
+    DIALS_ASSERT(image.accessor().nd() == 2);
+    DIALS_ASSERT(S.size() == xy.size());
+    int npoints = grid.accessor().all()[0];
+    double step = 2 * rec_range / npoints;
+    int npixels = xy.size();
+    mat3<double> R =
+      scitbx::math::r3_rotation::axis_and_angle_as_matrix(axis, angle, false);
+
+    std::vector<int> voxel(npixels);
+    std::vector<int> pixel(npixels);
+    if (npixels > 0) {
+      dials::algorithms::for_each_band(VoxelIndexBand(&S[0],
+                                                      &xy[0],
+                                                      R,
+                                                      step,
+                                                      npoints,
+                                                      image.accessor().all()[1],
+                                                      &voxel[0],
+                                                      &pixel[0]),
+                                       npixels,
+                                       nthreads);
+      dials::algorithms::for_each_band(FillSlabBand<FloatType>(&image[0],
+                                                               &voxel[0],
+                                                               &pixel[0],
+                                                               npixels,
+                                                               npoints * npoints,
+                                                               &grid[0],
+                                                               &counts[0]),
+                                       npoints,
+                                       nthreads);
+    }
+  }
+
+  template <typename FloatType>
+  static void normalize_voxels(af::versa<FloatType, af::flex_grid<> > &grid,
+                               af::flex_int &counts) {
     for (int i = 0, ilim = grid.size(); i < ilim; i++) {
       if (counts[i] != 0) {
         grid[i] /= counts[i];
@@ -65,11 +286,37 @@ namespace recviewer { namespace ext {
     }
   }
 
+  template <typename FloatType>
+  void export_grid_functions() {
+    using namespace boost::python;
+    def("rotate_and_fill_voxels",
+        rotate_and_fill_voxels<FloatType>,
+        (arg("image"),
+         arg("grid"),
+         arg("counts"),
+         arg("S"),
+         arg("xy"),
+         arg("axis"),
+         arg("angle"),
+         arg("rec_range"),
+         arg("nthreads") = 1));
+    def("normalize_voxels", normalize_voxels<FloatType>);
+  }
+
   void init_module() {
     using namespace boost::python;
     def("get_target_pixels", get_target_pixels);
+    def("get_target_pixels_and_S",
+        get_target_pixels_and_S,
+        (arg("panel"),
+         arg("s0"),
+         arg("xlim"),
+         arg("ylim"),
+         arg("maxres"),
+         arg("nthreads") = 1));
     def("fill_voxels", fill_voxels);
-    def("normalize_voxels", normalize_voxels);
+    export_grid_functions<double>();
+    export_grid_functions<float>();
   }
 
 }}  // namespace recviewer::ext
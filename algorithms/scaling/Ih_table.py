@@ -12,6 +12,7 @@
 from scitbx import sparse
 
 from dials.array_family import flex
+from dials_scaling_ext import calc_Ih_values
 
 
 def map_indices_to_asu(miller_indices, space_group, anomalous=False):
@@ -347,39 +348,50 @@ def extract_free_set(self, free_set_percentage, offset=0):
         interval_between_groups = int(100 / free_set_percentage)
         free_reflection_table = flex.reflection_table()
         free_indices = flex.size_t()
+        n_free_in_dataset = [0] * self.n_datasets
         for j, block in enumerate(self.Ih_table_blocks):
             n_groups = block.h_index_matrix.n_cols
-            groups_for_free_set = flex.bool(n_groups, False)
+            groups_for_free_set = flex.double(n_groups, 0.0)
             for_free = flex.size_t(
                 [i for i in range(0 + offset, n_groups, interval_between_groups)]
             )
-            groups_for_free_set.set_selected(for_free, True)
-            free_block = block.select_on_groups(groups_for_free_set)
+            groups_for_free_set.set_selected(for_free, 1.0)
+            # Expand the group selection to the reflections once, and use it to
+            # split the block into the free and work sets.
+            free_rows = (groups_for_free_set * block.h_expand_matrix) > 0
+            free_block = block.select(free_rows)
             free_reflection_table.extend(free_block.Ih_table)
             for sel in free_block.block_selections:
                 free_indices.extend(sel)
-            self.Ih_table_blocks[j] = block.select_on_groups(~groups_for_free_set)
-            # Now need to update dataset_info dict.
-            removed_from_each_dataset = [
-                (free_block.Ih_table["dataset_id"] == i).count(True)
-                for i in range(0, block.n_datasets)
-            ]
+            self.Ih_table_blocks[j] = block.select(~free_rows)
+            # Now need to update dataset_info dict. The rows of the block are
+            # ordered by dataset, so count the free rows in each dataset's range.
             n_removed = 0
             for i in range(0, self.Ih_table_blocks[j].n_datasets):
+                start = block.dataset_info[i]["start_index"]
+                end = block.dataset_info[i]["end_index"]
+                n_free = free_rows[start:end].count(True)
+                n_free_in_dataset[i] += n_free
                 self.Ih_table_blocks[j].dataset_info[i]["start_index"] -= n_removed
-                n_removed += removed_from_each_dataset[i]
+                n_removed += n_free
                 self.Ih_table_blocks[j].dataset_info[i]["end_index"] -= n_removed
         self.blocked_selection_list = [
             block.block_selections for block in self.Ih_table_blocks
         ]
-        # now split by dataset and use to instantiate another Ih_table
-        datasets = set(free_reflection_table["dataset_id"])
+        # now split by dataset and use to instantiate another Ih_table. A stable
+        # sort by dataset keeps the order within each dataset, so each dataset is
+        # a contiguous slice of the sorted table.
+        perm = flex.sort_permutation(free_reflection_table["dataset_id"], stable=True)
+        free_reflection_table = free_reflection_table.select(perm)
+        free_indices = free_indices.select(perm)
         tables = []
         indices_lists = []
-        for id_ in datasets:
-            dataset_sel = free_reflection_table["dataset_id"] == id_
-            tables.append(free_reflection_table.select(dataset_sel))
-            indices_lists.append(free_indices.select(dataset_sel))
+        start = 0
+        for n_free in n_free_in_dataset:
+            if n_free:
+                tables.append(free_reflection_table[start : start + n_free])
+                indices_lists.append(free_indices[start : start + n_free])
+                start += n_free
         free_Ih_table = IhTable(
             tables, self.space_group, indices_lists, nblocks=1, anomalous=self.anomalous
         )
@@ -437,6 +449,9 @@ class IhTableBlock(object):
             entry with a value of 1.
         h_expand_matrix: The transpose of the h_index_matrix, used to expand an
             array of values for symmetry groups into an array of size n_refl.
+            This is formed when requested rather than held for each block, as
+            it would double the memory used by the group structure of every
+            block for the whole of scaling.
         derivatives: A matrix of derivatives of the reflections wrt the model
             parameters.
     """
@@ -449,7 +464,6 @@ def __init__(self, n_groups, n_refl, n_datasets=1):
         self._setup_info = {"next_row": 0, "next_dataset": 0, "setup_complete": False}
         self.dataset_info = {}
         self.n_datasets = n_datasets
-        self.h_expand_matrix = None
         self.derivatives = None
         self.binner = None
 
@@ -497,7 +511,6 @@ def _complete_setup(self):
             self._setup_info["next_row"] == self.h_index_matrix.n_rows
         ), """
 Not all rows of h_index_matrix appear to be filled in IhTableBlock setup."""
-        self.h_expand_matrix = self.h_index_matrix.transpose()
         self.Ih_table["weights"] = 1.0 / self.Ih_table["variance"]
         self._setup_info["setup_complete"] = True
 
@@ -508,15 +521,13 @@ def group_multiplicities(self):
     def select(self, sel):
         """Select a subset of the data, returning a new IhTableBlock object."""
         Ih_table = self.Ih_table.select(sel)
-        h_idx_sel = self.h_expand_matrix.select_columns(sel.iselection())
+        h_idx_sel = self.h_index_matrix.transpose().select_columns(sel.iselection())
         reduced_h_idx = h_idx_sel.transpose()
         unity = flex.double(reduced_h_idx.n_rows, 1.0)
         nz_col_sel = (unity * reduced_h_idx) > 0
         h_index_matrix = reduced_h_idx.select_columns(nz_col_sel.iselection())
-        h_expand = h_index_matrix.transpose()
         newtable = IhTableBlock(n_groups=0, n_refl=0, n_datasets=self.n_datasets)
         newtable.Ih_table = Ih_table
-        newtable.h_expand_matrix = h_expand
         newtable.h_index_matrix = h_index_matrix
         newtable.block_selections = []
         offset = 0
@@ -547,13 +558,12 @@ def select_on_groups_isel(self, isel):
 
     def calc_Ih(self):
         """Calculate the current best estimate for Ih for each reflection group."""
-        scale_factors = self.Ih_table["inverse_scale_factor"]
-        gsq = flex.pow2(scale_factors) * self.Ih_table["weights"]
-        sumgsq = gsq * self.h_index_matrix
-        gI = (scale_factors * self.Ih_table["intensity"]) * self.Ih_table["weights"]
-        sumgI = gI * self.h_index_matrix
-        Ih = sumgI / sumgsq
-        self.Ih_table["Ih_values"] = Ih * self.h_expand_matrix
+        self.Ih_table["Ih_values"] = calc_Ih_values(
+            self.h_index_matrix,
+            self.Ih_table["inverse_scale_factor"],
+            self.Ih_table["intensity"],
+            self.Ih_table["weights"],
+        )
 
     def update_error_model(self, error_model):
         """Update the scaling weights based on an error model."""
@@ -611,9 +621,13 @@ def match_Ih_values_to_target(self, target_Ih_table):
         # now set attributes to update object
         self.Ih_table = new_table.Ih_table
         self.h_index_matrix = new_table.h_index_matrix
-        self.h_expand_matrix = new_table.h_expand_matrix
         self.block_selections = new_table.block_selections
 
+    @property
+    def h_expand_matrix(self):
+        """The transpose of the h_index_matrix."""
+        return self.h_index_matrix.transpose()
+
     @property
     def inverse_scale_factors(self):
         """The inverse scale factors of the reflections."""
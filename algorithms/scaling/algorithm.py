@@ -382,6 +382,7 @@ def run(self):
                     self.params.filtering.deltacchalf.group_size
                 )
                 delta_cc_params.stdcutoff = self.params.filtering.deltacchalf.stdcutoff
+                delta_cc_params.nproc = self.params.scaling_options.nproc
                 logger.info("\nPerforming a round of filtering.\n")
 
                 # need to reduce to single table.
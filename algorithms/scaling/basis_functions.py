@@ -50,14 +50,20 @@ def _calculate_derivatives(apm, block_id, scales, derivatives_list):
             # for block_id in range(len(apm.n_obs)):
             return derivatives_list[0]
         derivatives = sparse.matrix(apm.n_obs[block_id], apm.n_active_params)
+        # The product of all scales other than scales[i] is the product of the
+        # scales before i and the scales after i, so form the running products
+        # from each end once rather than the full product for every component.
+        products_after = [flex.double(apm.n_obs[block_id], 1.0)]
+        if apm.constant_g_values:
+            products_after[0] *= apm.constant_g_values[block_id]
+        for s in reversed(scales[1:]):
+            products_after.append(products_after[-1] * s)
+        products_after.reverse()
+        product_before = flex.double(apm.n_obs[block_id], 1.0)
         col_idx = 0
         for i, d in enumerate(derivatives_list):
-            scale_multipliers = flex.double(apm.n_obs[block_id], 1.0)
-            for j, s1 in enumerate(scales):
-                if i != j:
-                    scale_multipliers *= s1
-            if apm.constant_g_values:
-                scale_multipliers *= apm.constant_g_values[block_id]
+            scale_multipliers = product_before * products_after[i]
+            product_before *= scales[i]
             next_deriv = row_multiply(d, scale_multipliers)
             derivatives.assign_block(next_deriv, 0, col_idx)
             col_idx += d.n_cols
@@ -10,11 +10,20 @@ namespace dials_scaling { namespace boost_python {
   void export_rotate_vectors_about_axis();
   void export_calc_theta_phi();
   void export_calc_sigmasq();
+  void export_calc_error_model_deltas();
+  void export_calc_error_model_bin_sums();
   void export_row_multiply();
   void export_determine_outlier_indices();
+  void export_determine_normdev_outlier_indices();
+  void export_determine_simple_normdev_outliers();
   void export_calc_dIh_by_dpi();
   void export_calc_jacobian();
+  void export_calc_Ih_values();
+  void export_calc_scaling_gradient();
   void export_calculate_harmonic_tables_from_selections();
+  void export_calculate_harmonic_scales();
+  void export_calculate_harmonic_table_from_selections();
+  void export_calculate_harmonic_scales_from_selections();
   void export_calc_lookup_index();
   void export_create_sph_harm_lookup_table();
   void export_gaussian_smoother_first_fixed();
@@ -26,11 +35,20 @@ namespace dials_scaling { namespace boost_python {
     export_rotate_vectors_about_axis();
     export_calc_theta_phi();
     export_calc_sigmasq();
+    export_calc_error_model_deltas();
+    export_calc_error_model_bin_sums();
     export_row_multiply();
     export_determine_outlier_indices();
+    export_determine_normdev_outlier_indices();
+    export_determine_simple_normdev_outliers();
     export_calc_dIh_by_dpi();
     export_calc_jacobian();
+    export_calc_Ih_values();
+    export_calc_scaling_gradient();
     export_calculate_harmonic_tables_from_selections();
+    export_calculate_harmonic_scales();
+    export_calculate_harmonic_table_from_selections();
+    export_calculate_harmonic_scales_from_selections();
     export_calc_lookup_index();
     export_create_sph_harm_lookup_table();
     export_gaussian_smoother_first_fixed();
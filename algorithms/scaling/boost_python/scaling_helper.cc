@@ -14,6 +14,28 @@ namespace dials_scaling { namespace boost_python {
         (arg("h_index_matrix"), arg("z_scores"), arg("zmax")));
   }
 
+  void export_determine_normdev_outlier_indices() {
+    def("determine_normdev_outlier_indices",
+        &determine_normdev_outlier_indices,
+        (arg("h_index_matrix"),
+         arg("intensity"),
+         arg("g"),
+         arg("weights"),
+         arg("zmax"),
+         arg("nthreads") = 1));
+  }
+
+  void export_determine_simple_normdev_outliers() {
+    def("determine_simple_normdev_outliers",
+        &determine_simple_normdev_outliers,
+        (arg("h_index_matrix"),
+         arg("intensity"),
+         arg("g"),
+         arg("weights"),
+         arg("zmax"),
+         arg("nthreads") = 1));
+  }
+
   void export_elementwise_square() {
     def("elementwise_square", &elementwise_square, (arg("m")));
   }
@@ -21,7 +43,33 @@ namespace dials_scaling { namespace boost_python {
   void export_calc_dIh_by_dpi() {
     def("calc_dIh_by_dpi",
         &calculate_dIh_by_dpi,
-        (arg("a"), arg("sumgsq"), arg("h_index_mat"), arg("derivatives")));
+        (arg("a"),
+         arg("sumgsq"),
+         arg("h_index_mat"),
+         arg("derivatives"),
+         arg("nthreads") = 1));
+  }
+
+  void export_calc_Ih_values() {
+    def("calc_Ih_values",
+        &calc_Ih_values,
+        (arg("h_index_mat"),
+         arg("g"),
+         arg("intensity"),
+         arg("weight"),
+         arg("nthreads") = 1));
+  }
+
+  void export_calc_scaling_gradient() {
+    def("calc_scaling_gradient",
+        &calc_scaling_gradient,
+        (arg("h_index_mat"),
+         arg("derivatives"),
+         arg("intensity"),
+         arg("Ih"),
+         arg("g"),
+         arg("weight"),
+         arg("nthreads") = 1));
   }
 
   void export_calc_jacobian() {
@@ -32,7 +80,8 @@ namespace dials_scaling { namespace boost_python {
          arg("Ih"),
          arg("g"),
          arg("dIh"),
-         arg("sumgsq")));
+         arg("sumgsq"),
+         arg("nthreads") = 1));
   }
 
   void export_sph_harm_table() {
@@ -55,6 +104,32 @@ namespace dials_scaling { namespace boost_python {
     def("calc_sigmasq", &calc_sigmasq, (arg("jacobian_transpose"), arg("var_cov")));
   }
 
+  void export_calc_error_model_deltas() {
+    def("calc_error_model_deltas",
+        &calc_error_model_deltas,
+        (arg("intensity"),
+         arg("g"),
+         arg("Ih"),
+         arg("variance"),
+         arg("n_h"),
+         arg("a"),
+         arg("b"),
+         arg("nthreads") = 1));
+  }
+
+  void export_calc_error_model_bin_sums() {
+    def("calc_error_model_bin_sums",
+        &calc_error_model_bin_sums,
+        (arg("summation_matrix"),
+         arg("delta_hl"),
+         arg("sigmaprime"),
+         arg("intensity"),
+         arg("g"),
+         arg("a"),
+         arg("b"),
+         arg("nthreads") = 1));
+  }
+
   void export_row_multiply() {
     def("row_multiply", &row_multiply, (arg("m"), arg("v")));
   }
@@ -83,6 +158,27 @@ namespace dials_scaling { namespace boost_python {
         (arg("s0_selection"), arg("s1_selection"), arg("coefficients_list")));
   }
 
+  void export_calculate_harmonic_table_from_selections() {
+    def("calculate_harmonic_table_from_selections",
+        &calculate_harmonic_table_from_selections,
+        (arg("s0_selection"), arg("s1_selection"), arg("coefficients_list")));
+  }
+
+  void export_calculate_harmonic_scales_from_selections() {
+    def("calculate_harmonic_scales_from_selections",
+        &calculate_harmonic_scales_from_selections,
+        (arg("s0_selection"),
+         arg("s1_selection"),
+         arg("coefficients_list"),
+         arg("parameters")));
+  }
+
+  void export_calculate_harmonic_scales() {
+    def("calculate_harmonic_scales",
+        &calculate_harmonic_scales,
+        (arg("harmonic_values"), arg("parameters")));
+  }
+
   void export_gaussian_smoother_first_fixed() {
     class_<GaussianSmootherFirstFixed>("GaussianSmootherFirstFixed", no_init)
       .def(init<vec2<double>, std::size_t>((arg("x_range"), arg("num_intervals"))))
@@ -98,7 +194,14 @@ namespace dials_scaling { namespace boost_python {
            &GaussianSmootherFirstFixed::value_weight_first_fixed)
       .def("multi_value_weight", &GaussianSmootherFirstFixed::multi_value_weight)
       .def("multi_value_weight_first_fixed",
-           &GaussianSmootherFirstFixed::multi_value_weight_first_fixed);
+           &GaussianSmootherFirstFixed::multi_value_weight_first_fixed,
+           (arg("x"), arg("values"), arg("nthreads") = 1))
+      .def("cached_weights",
+           &GaussianSmootherFirstFixed::cached_weights,
+           (arg("x"), arg("nthreads") = 1))
+      .def("cached_weights_first_fixed",
+           &GaussianSmootherFirstFixed::cached_weights_first_fixed,
+           (arg("x"), arg("nthreads") = 1));
   }
 
 }}  // namespace dials_scaling::boost_python
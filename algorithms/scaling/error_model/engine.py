@@ -21,7 +21,7 @@
 logger = logging.getLogger("dials")
 
 
-def run_error_model_refinement(error_model_phil_scope, Ih_table):
+def run_error_model_refinement(error_model_phil_scope, Ih_table, nthreads=1):
     """
     Refine an error model for the input data, returning the model.
 
@@ -31,7 +31,7 @@ def run_error_model_refinement(error_model_phil_scope, Ih_table):
     """
     assert Ih_table.n_work_blocks == 1
     model_class, scope = get_error_model_class_and_scope(error_model_phil_scope)
-    model = model_class(Ih_table.blocked_data_list[0], scope)
+    model = model_class(Ih_table.blocked_data_list[0], scope, nthreads=nthreads)
     active_parameters = get_error_parameters_to_refine(model_class, scope)
     if not active_parameters:
         logger.info("All error model parameters fixed, skipping refinement")
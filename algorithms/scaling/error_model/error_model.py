@@ -15,6 +15,7 @@
 
 from dials.array_family import flex
 from dials.util import tabulate
+from dials_scaling_ext import calc_error_model_bin_sums, calc_error_model_deltas
 
 logger = logging.getLogger("dials")
 
@@ -208,7 +209,7 @@ class ErrorModelBinner(object):
     Data are binned based on Ih, and methods are available for
     calculating bin variances, summation within bins etc."""
 
-    def __init__(self, Ih_table, min_reflections_required=250, n_bins=10):
+    def __init__(self, Ih_table, min_reflections_required=250, n_bins=10, nthreads=1):
         self.binning_info = {
             "initial_variances": [],
             "bin_boundaries": [],
@@ -218,6 +219,7 @@ def __init__(self, Ih_table, min_reflections_required=250, n_bins=10):
             "n_reflections": None,
         }
         self.n_bins = n_bins
+        self.nthreads = nthreads
         self.Ih_table = Ih_table
         self.min_reflections_required = min_reflections_required
         self.n_h = self.Ih_table.calc_nh()
@@ -230,10 +232,32 @@ def __init__(self, Ih_table, min_reflections_required=250, n_bins=10):
 
     def update(self, parameters):
         """Update the variances for updated model parameters."""
-        self.sigmaprime = calc_sigmaprime(parameters, self.Ih_table)
-        self.delta_hl = calc_deltahl(self.Ih_table, self.n_h, self.sigmaprime)
+        self.sigmaprime, self.delta_hl = calc_error_model_deltas(
+            self.Ih_table.intensities,
+            self.Ih_table.inverse_scale_factors,
+            self.Ih_table.Ih_values,
+            self.Ih_table.variances,
+            self.n_h,
+            parameters[0],
+            parameters[1],
+            nthreads=self.nthreads,
+        )
         self.bin_variances = self.calculate_bin_variances()
 
+    def calculate_bin_sums(self, a, b):
+        """Return the sums of delta_hl, delta_hl^2, d(delta_hl)/db and
+        delta_hl * d(delta_hl)/db over each bin, for the current delta_hl."""
+        return calc_error_model_bin_sums(
+            self.summation_matrix,
+            self.delta_hl,
+            self.sigmaprime,
+            self.Ih_table.intensities,
+            self.Ih_table.inverse_scale_factors,
+            a,
+            b,
+            nthreads=self.nthreads,
+        )
+
     def _create_summation_matrix(self):
         """ "Create a summation matrix to allow sums into intensity bins.
 
@@ -357,13 +381,14 @@ class BasicErrorModel(object):
 
     id_ = "basic"
 
-    def __init__(self, Ih_table, basic_params, min_partiality=0.4):
+    def __init__(self, Ih_table, basic_params, min_partiality=0.4, nthreads=1):
 
         """Raises: ValueError if insufficient reflections left after filtering."""
 
         self.free_components = []
         self.sortedy = None
         self.sortedx = None
+        self._central_quantiles = None
         self.binner = None
         self.filtered_Ih_table = self.filter_unsuitable_reflections(
             Ih_table, basic_params, min_partiality
@@ -374,7 +399,10 @@ def __init__(self, Ih_table, basic_params, min_partiality=0.4):
 
         # always want binning info so that can calc for output.
         self.binner = ErrorModelBinner(
-            self.filtered_Ih_table, self.min_reflections_required, basic_params.n_bins
+            self.filtered_Ih_table,
+            self.min_reflections_required,
+            basic_params.n_bins,
+            nthreads=nthreads,
         )
 
         # need to calculate sorted deltahl for norm dev plotting (and used by
@@ -417,22 +445,23 @@ def filter_unsuitable_reflections(cls, Ih_table, error_params, min_partiality):
     def calculate_sorted_deviations(self, parameters):
         """Sort the x,y data."""
         sigmaprime = calc_sigmaprime(parameters, self.filtered_Ih_table)
-        delta_hl = calc_deltahl(
-            self.filtered_Ih_table, self.filtered_Ih_table.calc_nh(), sigmaprime
-        )
-        norm = normal_distribution()
-        n = len(delta_hl)
-        if n <= 10:
-            a = 3 / 8
-        else:
-            a = 0.5
-        self.sortedy = flex.sorted(flex.double(delta_hl))
-        self.sortedx = flex.double(
-            [norm.quantile((i + 1 - a) / (n + 1 - (2 * a))) for i in range(n)]
-        )
-        central_sel = (self.sortedx < 1.5) & (self.sortedx > -1.5)
-        self.sortedx = self.sortedx.select(central_sel)
-        self.sortedy = self.sortedy.select(central_sel)
+        delta_hl = calc_deltahl(self.filtered_Ih_table, self.binner.n_h, sigmaprime)
+        # The normal quantiles depend only on the number of reflections, so are
+        # calculated once rather than for every update of the parameters.
+        if self._central_quantiles is None:
+            norm = normal_distribution()
+            n = len(delta_hl)
+            if n <= 10:
+                a = 3 / 8
+            else:
+                a = 0.5
+            quantiles = flex.double(
+                [norm.quantile((i + 1 - a) / (n + 1 - (2 * a))) for i in range(n)]
+            )
+            central_sel = (quantiles < 1.5) & (quantiles > -1.5)
+            self._central_quantiles = (quantiles.select(central_sel), central_sel)
+        self.sortedx, central_sel = self._central_quantiles
+        self.sortedy = flex.sorted(flex.double(delta_hl)).select(central_sel)
 
     def update(self, parameters):
         """Update the model with new parameters."""
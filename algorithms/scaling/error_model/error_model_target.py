@@ -161,33 +161,20 @@ def calculate_gradients(self, apm):
         "calculate the gradient vector"
         a = self.error_model.components["a"].parameters[0]
         b = apm.x[0]
-        Ih_table = self.error_model.binner.Ih_table
-        I_hl = Ih_table.intensities
-        g_hl = Ih_table.inverse_scale_factors
-        weights = self.error_model.binner.weights
-        bin_vars = self.error_model.binner.bin_variances
-        sum_matrix = self.error_model.binner.summation_matrix
-        bin_counts = self.error_model.binner.binning_info["refl_per_bin"]
-        dsig_dc = (
-            b
-            * flex.pow2(I_hl)
-            * (a ** 2)
-            / (self.error_model.binner.sigmaprime * flex.pow2(g_hl))
-        )
-        ddelta_dsigma = (
-            -1.0 * self.error_model.binner.delta_hl / self.error_model.binner.sigmaprime
-        )
-        deriv = ddelta_dsigma * dsig_dc
+        binner = self.error_model.binner
+        weights = binner.weights
+        bin_vars = binner.bin_variances
+        bin_counts = binner.binning_info["refl_per_bin"]
+        sum_delta, _, sum_deriv, sum_delta_deriv = binner.calculate_bin_sums(a, b)
         dphi_by_dvar = -2.0 * (
             flex.double(bin_vars.size(), 0.5)
             - bin_vars
             + (1.0 / (2.0 * flex.pow2(bin_vars)))
         )
-        term1 = 2.0 * self.error_model.binner.delta_hl * deriv * sum_matrix
-        term2a = self.error_model.binner.delta_hl * sum_matrix
-        term2b = deriv * sum_matrix
+        term1 = 2.0 * sum_delta_deriv
         grad = dphi_by_dvar * (
-            (term1 / bin_counts) - (2.0 * term2a * term2b / flex.pow2(bin_counts))
+            (term1 / bin_counts)
+            - (2.0 * sum_delta * sum_deriv / flex.pow2(bin_counts))
         )
         gradients = flex.double([flex.sum(grad * weights) / flex.sum(weights)])
         return gradients
@@ -25,7 +25,12 @@
 from scitbx import sparse
 
 from dials.array_family import flex
-from dials_scaling_ext import calculate_harmonic_tables_from_selections
+from dials_scaling_ext import (
+    calculate_harmonic_scales,
+    calculate_harmonic_scales_from_selections,
+    calculate_harmonic_table_from_selections,
+    calculate_harmonic_tables_from_selections,
+)
 
 
 class ScaleComponentBase(object):
@@ -439,11 +444,22 @@ def __init__(self, initial_values, parameter_esds=None):
         """Set the initial parameter values, parameter esds and n_params."""
         super(SHScaleComponent, self).__init__(initial_values, parameter_esds)
         self._harmonic_values = []
-        self._matrices = []
+        self._lookup_selections = []
+        self._mode = None
 
     @property
     def harmonic_values(self):
-        """Return the matrix of harmonic coefficients for the internal data."""
+        """Return the matrix of harmonic coefficients for the internal data.
+
+        In memory mode this is a list of arrays for each block, which is
+        formed from the lookup tables on request."""
+        if self._mode == "memory":
+            return [
+                calculate_harmonic_tables_from_selections(
+                    n0, n1, self.coefficients_list
+                )[0]
+                for n0, n1 in self._lookup_selections
+            ]
         return self._harmonic_values
 
     @property
@@ -505,34 +521,23 @@ def _update_reflection_data_memorymode(self, selection=None, block_selections=No
         if len(self.coefficients_list) != self.n_params:
             self.coefficients_list = self.coefficients_list[0 : self.n_params]
             # modify only for this instance, only needs to be done once per instance.
+        # Only the lookup indices are held for each block, the harmonic values
+        # are formed from the shared lookup tables when they are needed.
         if selection:
-            n0 = self.data["s0_lookup"].select(selection)
-            n1 = self.data["s1_lookup"].select(selection)
-            values, matrix = calculate_harmonic_tables_from_selections(
-                n0, n1, self.coefficients_list
-            )
-            self._harmonic_values = [values]
-            self._matrices = [matrix]
-        elif block_selections:
-            self._harmonic_values = []
-            self._matrices = []
-            for sel in block_selections:
-                n0 = self.data["s0_lookup"].select(sel)
-                n1 = self.data["s1_lookup"].select(sel)
-                values, matrix = calculate_harmonic_tables_from_selections(
-                    n0, n1, self.coefficients_list
+            self._lookup_selections = [
+                (
+                    self.data["s0_lookup"].select(selection),
+                    self.data["s1_lookup"].select(selection),
                 )
-                self._harmonic_values.append(values)
-                self._matrices.append(matrix)
+            ]
+        elif block_selections:
+            self._lookup_selections = [
+                (self.data["s0_lookup"].select(sel), self.data["s1_lookup"].select(sel))
+                for sel in block_selections
+            ]
         else:
-            n0 = self.data["s0_lookup"]
-            n1 = self.data["s1_lookup"]
-            values, matrix = calculate_harmonic_tables_from_selections(
-                n0, n1, self.coefficients_list
-            )
-            self._harmonic_values = [values]
-            self._matrices = [matrix]
-        self._n_refl = [val[0].size() for val in self._harmonic_values]
+            self._lookup_selections = [(self.data["s0_lookup"], self.data["s1_lookup"])]
+        self._n_refl = [n0.size() for n0, _ in self._lookup_selections]
 
     def _update_reflection_data_speedmode(self, selection=None, block_selections=None):
         if selection:
@@ -568,23 +573,20 @@ def calculate_scales_and_derivatives(self, block_id=0):
             return self._calculate_scales_and_derivatives_memorymode(block_id)
 
     def _calculate_scales_and_derivatives_speedmode(self, block_id, derivatives=True):
-        abs_scale = flex.double(
-            self._harmonic_values[block_id].n_rows, 1.0
-        )  # Unity term
-        for i, col in enumerate(self._harmonic_values[block_id].cols()):
-            abs_scale += flex.double(col.as_dense_vector() * self._parameters[i])
+        abs_scale = calculate_harmonic_scales(
+            self._harmonic_values[block_id], self._parameters
+        )
         if derivatives:
             return abs_scale, self._harmonic_values[block_id]
         return abs_scale
 
     def _calculate_scales_and_derivatives_memorymode(self, block_id, derivatives=True):
-        abs_scale = flex.double(
-            self._harmonic_values[block_id][0].size(), 1.0
-        )  # Unity term
-        for i, arr in enumerate(
-            self._harmonic_values[block_id]
-        ):  # iterate over a list of arrays
-            abs_scale += arr * self._parameters[i]
-        if derivatives:
-            return abs_scale, self._matrices[block_id]
-        return abs_scale
+        n0, n1 = self._lookup_selections[block_id]
+        if not derivatives:
+            return calculate_harmonic_scales_from_selections(
+                n0, n1, self.coefficients_list, self._parameters
+            )
+        matrix = calculate_harmonic_table_from_selections(
+            n0, n1, self.coefficients_list
+        )
+        return calculate_harmonic_scales(matrix, self._parameters), matrix
@@ -42,10 +42,10 @@ def multi_value_weight(self, x, value):
         result = super(GaussianSmoother1D, self).multi_value_weight(x, value)
         return (result.get_value(), result.get_weight(), result.get_sumweight())
 
-    def multi_value_weight_first_fixed(self, x, value):
+    def multi_value_weight_first_fixed(self, x, value, nthreads=1):
         """Return the value, weight and sumweight at multiple points."""
         result = super(GaussianSmoother1D, self).multi_value_weight_first_fixed(
-            x, value
+            x, value, nthreads=nthreads
         )
         return (result.get_value(), result.get_weight(), result.get_sumweight())
 
@@ -109,6 +109,9 @@ class SmoothMixin(object):
     based on the parameters and a have a set of normalised_values
     associated with the data."""
 
+    # The number of threads used to compute the smoother weights
+    nthreads = 1
+
     def __init__(self):
         self._Vr = 1.0
         self._smoother = None
@@ -123,6 +126,20 @@ def smoother(self):
         """The Gaussian smoother."""
         return self._smoother
 
+    def smoother_weights(self, block_id=0):
+        """The smoother weights at the normalised values of a block. These only
+        depend on the reflection data, so are computed once after each update of
+        the reflection data and reused for every set of parameter values."""
+        if block_id not in self._smoother_weights:
+            self._smoother_weights[block_id] = self._calculate_smoother_weights(
+                block_id
+            )
+        return self._smoother_weights[block_id]
+
+    def _calculate_smoother_weights(self, block_id):
+        """Compute the smoother weights at the normalised values of a block."""
+        raise NotImplementedError()
+
     @staticmethod
     def nparam_to_val(n_params):
         """Convert the number of parameters to the required input value
@@ -147,10 +164,12 @@ def __init__(self, initial_values, parameter_esds=None):
         super(SmoothScaleComponent1D, self).__init__(initial_values, parameter_esds)
         self._normalised_values = []
         self._fixed_initial = False
+        self._smoother_weights = {}
 
     def fix_initial_parameter(self):
         """Set a flag to indicate that we're fixing the first parameter."""
         self._fixed_initial = True
+        self._smoother_weights = {}
 
     @property
     def free_parameters(self):
@@ -213,6 +232,7 @@ def update_reflection_data(self, selection=None, block_selections=None):
         """Set the normalised coordinate values and configure the smoother."""
         self._normalised_values = []
         self._n_refl = []
+        self._smoother_weights = {}
         normalised_values = self.data["x"]
         if selection:
             normalised_values = normalised_values.select(selection)
@@ -234,22 +254,20 @@ def update_reflection_data(self, selection=None, block_selections=None):
             self._normalised_values.append(normalised_values)
             self._n_refl.append(normalised_values.size())
 
+    def _calculate_smoother_weights(self, block_id):
+        if self._fixed_initial:
+            return self._smoother.cached_weights_first_fixed(
+                self._normalised_values[block_id], nthreads=self.nthreads
+            )
+        return self._smoother.cached_weights(
+            self._normalised_values[block_id], nthreads=self.nthreads
+        )
+
     def calculate_scales_and_derivatives(self, block_id=0):
         if self._n_refl[block_id] > 1:
-            if self._fixed_initial:
-                (
-                    value,
-                    weight,
-                    sumweight,
-                ) = self._smoother.multi_value_weight_first_fixed(
-                    self._normalised_values[block_id], self.value
-                )
-            else:
-                value, weight, sumweight = self._smoother.multi_value_weight(
-                    self._normalised_values[block_id], self.value
-                )
-            inv_sw = 1.0 / sumweight
-            dv_dp = row_multiply(weight, inv_sw)
+            weights = self.smoother_weights(block_id)
+            value = weights.value(self.value, nthreads=self.nthreads)
+            dv_dp = weights.normalised_weight(nthreads=self.nthreads)
         elif self._n_refl[block_id] == 1:
             if self._fixed_initial:
                 value, weight, sumweight = self._smoother.value_weight_first_fixed(
@@ -271,9 +289,8 @@ def calculate_scales_and_derivatives(self, block_id=0):
     def calculate_scales(self, block_id=0):
         """"Only calculate the scales if needed, for performance."""
         if self._n_refl[block_id] > 1:
-            value, _, __ = self._smoother.multi_value_weight(
-                self._normalised_values[block_id], self.value
-            )
+            weights = self.smoother_weights(block_id)
+            value = weights.value(self.value, nthreads=self.nthreads)
         elif self._n_refl[block_id] == 1:
             value, _, __ = self._smoother.value_weight(
                 self._normalised_values[block_id][0], self.value
@@ -367,6 +384,7 @@ def __init__(self, initial_values, shape, parameter_esds=None):
         self._n_y_params = shape[1]
         self._normalised_x_values = None
         self._normalised_y_values = None
+        self._smoother_weights = {}
 
     @ScaleComponentBase.data.setter
     def data(self, data):
@@ -408,6 +426,7 @@ def update_reflection_data(self, selection=None, block_selections=None):
         self._normalised_x_values = []
         self._normalised_y_values = []
         self._n_refl = []
+        self._smoother_weights = {}
         normalised_x_values = self.data["x"]
         normalised_y_values = self.data["y"]
         if selection:
@@ -439,15 +458,18 @@ def update_reflection_data(self, selection=None, block_selections=None):
             self._normalised_y_values.append(normalised_y_values)
             self._n_refl.append(normalised_x_values.size())
 
+    def _calculate_smoother_weights(self, block_id):
+        return self._smoother.cached_weights(
+            self._normalised_x_values[block_id],
+            self._normalised_y_values[block_id],
+            nthreads=self.nthreads,
+        )
+
     def calculate_scales_and_derivatives(self, block_id=0):
         if self._n_refl[block_id] > 1:
-            value, weight, sumweight = self._smoother.multi_value_weight(
-                self._normalised_x_values[block_id],
-                self._normalised_y_values[block_id],
-                self.value,
-            )
-            inv_sw = 1.0 / sumweight
-            dv_dp = row_multiply(weight, inv_sw)
+            weights = self.smoother_weights(block_id)
+            value = weights.value(self.value, nthreads=self.nthreads)
+            dv_dp = weights.normalised_weight(nthreads=self.nthreads)
         elif self._n_refl[block_id] == 1:
             value, weight, sumweight = self._smoother.value_weight(
                 self._normalised_x_values[block_id][0],
@@ -466,11 +488,8 @@ def calculate_scales_and_derivatives(self, block_id=0):
     def calculate_scales(self, block_id=0):
         """Only calculate the scales if needed, for performance."""
         if self._n_refl[block_id] > 1:
-            value, _, __ = self._smoother.multi_value_weight(
-                self._normalised_x_values[block_id],
-                self._normalised_y_values[block_id],
-                self.value,
-            )
+            weights = self.smoother_weights(block_id)
+            value = weights.value(self.value, nthreads=self.nthreads)
         elif self._n_refl[block_id] == 1:
             value, _, __ = self._smoother.value_weight(
                 self._normalised_x_values[block_id][0],
@@ -507,6 +526,7 @@ def __init__(self, initial_values, shape, parameter_esds=None):
         self._normalised_x_values = None
         self._normalised_y_values = None
         self._normalised_z_values = None
+        self._smoother_weights = {}
 
     def set_new_parameters(self, new_parameters, shape):
         """Set new parameters of a different length i.e. after batch handling"""
@@ -559,6 +579,7 @@ def update_reflection_data(self, selection=None, block_selections=None):
         self._normalised_y_values = []
         self._normalised_z_values = []
         self._n_refl = []
+        self._smoother_weights = {}
         normalised_x_values = self.data["x"]
         normalised_y_values = self.data["y"]
         normalised_z_values = self.data["z"]
@@ -602,16 +623,19 @@ def update_reflection_data(self, selection=None, block_selections=None):
             self._normalised_z_values.append(normalised_z_values)
             self._n_refl.append(normalised_x_values.size())
 
+    def _calculate_smoother_weights(self, block_id):
+        return self._smoother.cached_weights(
+            self._normalised_x_values[block_id],
+            self._normalised_y_values[block_id],
+            self._normalised_z_values[block_id],
+            nthreads=self.nthreads,
+        )
+
     def calculate_scales_and_derivatives(self, block_id=0):
         if self._n_refl[block_id] > 1:
-            value, weight, sumweight = self._smoother.multi_value_weight(
-                self._normalised_x_values[block_id],
-                self._normalised_y_values[block_id],
-                self._normalised_z_values[block_id],
-                self.value,
-            )
-            inv_sw = 1.0 / sumweight
-            dv_dp = row_multiply(weight, inv_sw)
+            weights = self.smoother_weights(block_id)
+            value = weights.value(self.value, nthreads=self.nthreads)
+            dv_dp = weights.normalised_weight(nthreads=self.nthreads)
         elif self._n_refl[block_id] == 1:
             value, weight, sumweight = self._smoother.value_weight(
                 self._normalised_x_values[block_id][0],
@@ -631,12 +655,8 @@ def calculate_scales_and_derivatives(self, block_id=0):
     def calculate_scales(self, block_id=0):
         """"Only calculate the scales if needed, for performance."""
         if self._n_refl[block_id] > 1:
-            value, _, __ = self._smoother.multi_value_weight(
-                self._normalised_x_values[block_id],
-                self._normalised_y_values[block_id],
-                self._normalised_z_values[block_id],
-                self.value,
-            )
+            weights = self.smoother_weights(block_id)
+            value = weights.value(self.value, nthreads=self.nthreads)
         elif self._n_refl[block_id] == 1:
             value, _, __ = self._smoother.value_weight(
                 self._normalised_x_values[block_id][0],
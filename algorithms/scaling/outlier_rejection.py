@@ -15,7 +15,11 @@
 from scitbx.array_family import flex
 
 from dials.algorithms.scaling.Ih_table import IhTable
-from dials_scaling_ext import determine_outlier_indices, limit_outlier_weights
+from dials_scaling_ext import (
+    determine_normdev_outlier_indices,
+    determine_simple_normdev_outliers,
+    limit_outlier_weights,
+)
 
 logger = logging.getLogger("dials")
 
@@ -72,7 +76,9 @@ def reject_outliers(reflection_table, experiment, method="standard", zmax=6.0):
     return reflection_table
 
 
-def determine_outlier_index_arrays(Ih_table, method="standard", zmax=6.0, target=None):
+def determine_outlier_index_arrays(
+    Ih_table, method="standard", zmax=6.0, target=None, nthreads=1
+):
     """
     Run an outlier algorithm and return the outlier indices.
 
@@ -84,6 +90,8 @@ def determine_outlier_index_arrays(Ih_table, method="standard", zmax=6.0, target
         zmax (float): Normalised deviation threshold for classifying an outlier.
         target (Optional[IhTable]): An IhTable to use to obtain target Ih for
             outlier rejectiob, if method=target.
+        nthreads (int): The number of threads to use for the standard and
+            simple methods.
 
     Returns:
         outlier_index_arrays (list): A list of flex.size_t arrays, with one
@@ -97,9 +105,9 @@ def determine_outlier_index_arrays(Ih_table, method="standard", zmax=6.0, target
     """
     outlier_rej = None
     if method == "standard":
-        outlier_rej = NormDevOutlierRejection(Ih_table, zmax)
+        outlier_rej = NormDevOutlierRejection(Ih_table, zmax, nthreads)
     elif method == "simple":
-        outlier_rej = SimpleNormDevOutlierRejection(Ih_table, zmax)
+        outlier_rej = SimpleNormDevOutlierRejection(Ih_table, zmax, nthreads)
     elif method == "target":
         assert target is not None
         outlier_rej = TargetedOutlierRejection(Ih_table, zmax, target)
@@ -254,38 +262,27 @@ class SimpleNormDevOutlierRejection(OutlierRejectionBase):
     the symmetry group excluding the test reflection.
     """
 
-    def __init__(self, Ih_table, zmax):
+    def __init__(self, Ih_table, zmax, nthreads=1):
         super(SimpleNormDevOutlierRejection, self).__init__(Ih_table, zmax)
         self.weights = limit_outlier_weights(
             copy.deepcopy(self._Ih_table_block.weights),
             self._Ih_table_block.h_index_matrix,
         )
+        self._nthreads = nthreads
 
     def _do_outlier_rejection(self):
         """Add indices (w.r.t. the Ih_table data) to self._outlier_indices."""
         Ih_table = self._Ih_table_block
-        intensity = Ih_table.intensities
-        g = Ih_table.inverse_scale_factors
-        w = self.weights
-        wgIsum = (
-            (w * g * intensity) * Ih_table.h_index_matrix
-        ) * Ih_table.h_expand_matrix
-        wg2sum = ((w * g * g) * Ih_table.h_index_matrix) * Ih_table.h_expand_matrix
-
-        # guard against zero divison errors - can happen due to rounding errors
-        # or bad data giving g values are very small
-        zero_sel = wg2sum == 0.0
-        # set as one for now, then mark as outlier below. This will only affect if
-        # g is near zero, if w is zero then throw an assertionerror.
-        wg2sum.set_selected(zero_sel, 1.0)
-
-        assert w.all_gt(0)  # guard against division by zero
-        norm_dev = (intensity - (g * wgIsum / wg2sum)) / (
-            flex.sqrt((1.0 / w) + flex.pow2(g / wg2sum))
+        # A reflection is an outlier if any weights are zero, or if g is near
+        # zero due to rounding errors or bad data, as well as by deviation.
+        outliers = determine_simple_normdev_outliers(
+            Ih_table.h_index_matrix,
+            Ih_table.intensities,
+            Ih_table.inverse_scale_factors,
+            self.weights,
+            self._zmax,
+            self._nthreads,
         )
-        norm_dev.set_selected(zero_sel, 1000)  # to trigger rejection
-        outliers = flex.abs(norm_dev) > self._zmax
-
         self._outlier_indices.extend(Ih_table.Ih_table["loc_indices"].select(outliers))
         self._datasets.extend(
             self._Ih_table_block.Ih_table["dataset_id"].select(outliers)
@@ -299,72 +296,33 @@ class NormDevOutlierRejection(OutlierRejectionBase):
     the symmetry group excluding the test reflection.
     """
 
-    def __init__(self, Ih_table, zmax):
+    def __init__(self, Ih_table, zmax, nthreads=1):
         super(NormDevOutlierRejection, self).__init__(Ih_table, zmax)
         self.weights = limit_outlier_weights(
             copy.deepcopy(self._Ih_table_block.weights),
             self._Ih_table_block.h_index_matrix,
         )
+        self._nthreads = nthreads
 
     def _do_outlier_rejection(self):
-        """Add indices (w.r.t. the Ih_table data) to self._outlier_indices."""
-        self._round_of_outlier_rejection()
-        n_outliers = len(self._outlier_indices)
-        n_new_outliers = n_outliers
-        while n_new_outliers:
-            self._round_of_outlier_rejection()
-            n_new_outliers = len(self._outlier_indices) - n_outliers
-            n_outliers = len(self._outlier_indices)
-
-    def _round_of_outlier_rejection(self):
-        """
-        Calculate normal deviations from the data in the Ih_table.
+        """Add indices (w.r.t. the Ih_table data) to self._outlier_indices.
+
+        Each round rejects at most one reflection per group, the one with the
+        largest normalised deviation from the others, until no more are found.
+        The groups are independent, so the rounds are run to completion for
+        each group in turn, in parallel over the groups, with the outliers
+        returned in the order of the round in which they were rejected.
         """
         Ih_table = self._Ih_table_block
-        intensity = Ih_table.intensities
-        g = Ih_table.inverse_scale_factors
-        w = self.weights
-        wgIsum = (
-            (w * g * intensity) * Ih_table.h_index_matrix
-        ) * Ih_table.h_expand_matrix
-        wg2sum = ((w * g * g) * Ih_table.h_index_matrix) * Ih_table.h_expand_matrix
-        wgIsum_others = wgIsum - (w * g * intensity)
-        wg2sum_others = wg2sum - (w * g * g)
-        # Now do the rejection analyis if n_in_group > 2
-        nh = Ih_table.calc_nh()
-        sel = nh > 2
-        wg2sum_others_sel = wg2sum_others.select(sel)
-        wgIsum_others_sel = wgIsum_others.select(sel)
-
-        # guard against zero divison errors - can happen due to rounding errors
-        # or bad data giving g values are very small
-        zero_sel = wg2sum_others_sel == 0.0
-        # set as one for now, then mark as outlier below. This will only affect if
-        # g is near zero, if w is zero then throw an assertionerror.
-        wg2sum_others_sel.set_selected(zero_sel, 1.0)
-        g_sel = g.select(sel)
-        I_sel = intensity.select(sel)
-        w_sel = w.select(sel)
-
-        assert w_sel.all_gt(0)  # guard against division by zero
-        norm_dev = (I_sel - (g_sel * wgIsum_others_sel / wg2sum_others_sel)) / (
-            flex.sqrt((1.0 / w_sel) + (flex.pow2(g_sel) / wg2sum_others_sel))
-        )
-        norm_dev.set_selected(zero_sel, 1000)  # to trigger rejection
-        z_score = flex.abs(norm_dev)
-        # Want an array same size as Ih table.
-        all_z_scores = flex.double(Ih_table.size, 0.0)
-        all_z_scores.set_selected(sel.iselection(), z_score)
-        outlier_indices, other_potential_outliers = determine_outlier_indices(
-            Ih_table.h_index_matrix, all_z_scores, self._zmax
+        outlier_indices = determine_normdev_outlier_indices(
+            Ih_table.h_index_matrix,
+            Ih_table.intensities,
+            Ih_table.inverse_scale_factors,
+            self.weights,
+            self._zmax,
+            self._nthreads,
         )
         self._outlier_indices.extend(
-            self._Ih_table_block.Ih_table["loc_indices"].select(outlier_indices)
-        )
-        self._datasets.extend(
-            self._Ih_table_block.Ih_table["dataset_id"].select(outlier_indices)
+            Ih_table.Ih_table["loc_indices"].select(outlier_indices)
         )
-        sel = flex.bool(Ih_table.size, False)
-        sel.set_selected(other_potential_outliers, True)
-        self._Ih_table_block = self._Ih_table_block.select(sel)
-        self.weights = self.weights.select(sel)
+        self._datasets.extend(Ih_table.Ih_table["dataset_id"].select(outlier_indices))
@@ -31,6 +31,9 @@
 )
 from dials.algorithms.scaling.error_model.engine import run_error_model_refinement
 from dials.algorithms.scaling.Ih_table import IhTable
+from dials.algorithms.scaling.model.components.smooth_scale_components import (
+    SmoothMixin,
+)
 from dials.algorithms.scaling.outlier_rejection import determine_outlier_index_arrays
 from dials.algorithms.scaling.parameter_handler import ScalingParameterManagerGenerator
 from dials.algorithms.scaling.reflection_selection import (
@@ -170,7 +173,7 @@ def perform_scaling(self, engine=None, max_iterations=None, tolerance=None):
     def _perform_scaling(
         self, target_type, engine=None, max_iterations=None, tolerance=None
     ):
-        target = target_type()
+        target = target_type(nthreads=self.params.scaling_options.nproc)
         # find if any components to share
         shared = self.determine_shared_model_components()
         pmg = ScalingParameterManagerGenerator(
@@ -210,7 +213,9 @@ def perform_error_optimisation(self, update_Ih=True):
         Ih_table, _ = self._create_global_Ih_table(anomalous=True, remove_outliers=True)
         try:
             model = run_error_model_refinement(
-                self.params.weighting.error_model, Ih_table
+                self.params.weighting.error_model,
+                Ih_table,
+                nthreads=self.params.scaling_options.nproc,
             )
         except (ValueError, RuntimeError) as e:
             logger.info(e)
@@ -713,6 +718,8 @@ def _update_model_data(self):
         assert self.Ih_table is not None
         block_selections = self.Ih_table.get_block_selections_for_dataset(dataset=0)
         for component in self.components.values():
+            if isinstance(component, SmoothMixin):
+                component.nthreads = self.params.scaling_options.nproc
             component.update_reflection_data(block_selections=block_selections)
 
     def _create_Ih_table(self):
@@ -802,6 +809,7 @@ def round_of_outlier_rejection(self):
                 self.global_Ih_table,
                 self.params.scaling_options.outlier_rejection,
                 self.params.scaling_options.outlier_zmax,
+                nthreads=self.params.scaling_options.nproc,
             )[0]
             self.outliers = flex.bool(self.n_suitable_refl, False)
             self.outliers.set_selected(outlier_indices, True)
@@ -810,6 +818,7 @@ def round_of_outlier_rejection(self):
                     self._free_Ih_table,
                     self.params.scaling_options.outlier_rejection,
                     self.params.scaling_options.outlier_zmax,
+                    nthreads=self.params.scaling_options.nproc,
                 )[0]
                 self.outliers.set_selected(free_outlier_indices, True)
 
@@ -967,6 +976,8 @@ def _update_model_data(self):
         for i, scaler in enumerate(self.active_scalers):
             block_selections = self.Ih_table.get_block_selections_for_dataset(i)
             for component in scaler.components.values():
+                if isinstance(component, SmoothMixin):
+                    component.nthreads = self.params.scaling_options.nproc
                 component.update_reflection_data(block_selections=block_selections)
 
     def _create_global_Ih_table(self, anomalous=False, remove_outliers=False):
@@ -1089,6 +1100,7 @@ def _round_of_outlier_rejection(self, target=None):
                 self.params.scaling_options.outlier_rejection,
                 self.params.scaling_options.outlier_zmax,
                 target=target,
+                nthreads=self.params.scaling_options.nproc,
             )
             for outlier_indices, scaler in zip(
                 outlier_index_arrays, self.active_scalers
@@ -1101,6 +1113,7 @@ def _round_of_outlier_rejection(self, target=None):
                     self.params.scaling_options.outlier_rejection,
                     self.params.scaling_options.outlier_zmax,
                     target=target,
+                    nthreads=self.params.scaling_options.nproc,
                 )
                 for outlier_indices, scaler in zip(
                     free_outlier_index_arrays, self.active_scalers
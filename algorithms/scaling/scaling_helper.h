@@ -1,6 +1,8 @@
 #ifndef DIALS_SCALING_SCALING_HELPER_H
 #define DIALS_SCALING_SCALING_HELPER_H
 
+#include <algorithm>
+#include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <scitbx/sparse/matrix.h>
 #include <scitbx/math/zernike.h>
@@ -8,6 +10,7 @@
 #include <dials/error.h>
 #include <math.h>
 #include <dials/algorithms/refinement/gaussian_smoother.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 
 typedef scitbx::sparse::matrix<double>::column_type col_type;
 
@@ -55,51 +58,163 @@ public:
     return SingleValueWeights(value, weight, sumweight);
   }
 
+  /**
+   * Calculate the interpolated values and the weights at multiple points,
+   * with the first parameter fixed so that it has no column in the weight
+   * matrix. The weights of bands of the points are computed in parallel and
+   * stored densely, as each row has at most a few contiguous non-zero
+   * columns, and the sparse matrix is then filled in bands of columns in
+   * parallel. As the elements of each column are added in row order, the
+   * result is the same for any number of threads.
+   * @param x The array of points to interpolate at
+   * @param values The parameter values
+   * @param nthreads The number of threads to use
+   */
   dials::refinement::MultiValueWeights multi_value_weight_first_fixed(
     const scitbx::af::const_ref<double> x,
-    const scitbx::af::const_ref<double> values) {
-    // Use sparse storage as only naverage (default 3) values per row are
-    // non-zero
+    const scitbx::af::const_ref<double> values,
+    std::size_t nthreads = 1) {
     std::size_t npoints = x.size();  //# data
     DIALS_ASSERT(npoints > 1);
     matrix<double> weight(npoints, nvalues - 1);
 
-    // Allocate space for the interpolated values and sumweights, with raw
-    // refs for fastest access (See Michael Hohn's notes)
     scitbx::af::shared<double> value(npoints, scitbx::af::init_functor_null<double>());
-    scitbx::af::ref<double> value_ref = value.ref();
     scitbx::af::shared<double> sumweight(npoints,
                                          scitbx::af::init_functor_null<double>());
-    scitbx::af::ref<double> sumweight_ref = sumweight.ref();
 
-    for (std::size_t irow = 0; irow < npoints; ++irow) {
-      // normalised coordinate
-      double z = (x[irow] - x0) / spacing_;
-      double sumw = 0.0;
-      double sumwv = 0.0;
+    // The weights of each row are stored from the first column with a
+    // non-zero weight, which is -1 for the fixed parameter
+    std::size_t stride = std::max(std::max(naverage, (std::size_t)2),
+                                  std::min(nvalues, (std::size_t)3));
+    std::vector<int> first(npoints);
+    std::vector<int> count(npoints);
+    std::vector<double> row_weight(npoints * stride);
+    dials::algorithms::for_each_band(
+      WeightRows(*this, x, values, stride, first, count, row_weight, value, sumweight),
+      (int)npoints,
+      nthreads);
+    dials::algorithms::for_each_band(
+      FillColumns(first, count, row_weight, stride, weight),
+      (int)weight.n_cols(),
+      nthreads);
+    return MultiValueWeights(value, weight, sumweight);
+  }
+
+  /**
+   * Compute the weights at multiple points, with the first parameter fixed
+   * so that it has no column in the weight matrices, to find the
+   * interpolated values for any parameter values
+   * @param x The array of points
+   * @param nthreads The number of threads to use
+   */
+  dials::refinement::SmootherWeights cached_weights_first_fixed(
+    const scitbx::af::const_ref<double> x,
+    std::size_t nthreads = 1) const {
+    return dials::refinement::SmootherWeights(
+      PointWeights(*this, x),
+      x.size(),
+      nvalues,
+      dials::refinement::max_weights_per_point(nvalues, naverage),
+      1,
+      nthreads);
+  }
+
+private:
+  /**
+   * Compute the values and weights for a band of points
+   */
+  struct WeightRows {
+    GaussianSmootherFirstFixed &smoother;
+    scitbx::af::const_ref<double> x;
+    scitbx::af::const_ref<double> values;
+    std::size_t stride;
+    std::vector<int> &first;
+    std::vector<int> &count;
+    std::vector<double> &row_weight;
+    scitbx::af::ref<double> value;
+    scitbx::af::ref<double> sumweight;
 
-      vec2<int> irange = idx_range(z);
+    WeightRows(GaussianSmootherFirstFixed &smoother_,
+               const scitbx::af::const_ref<double> &x_,
+               const scitbx::af::const_ref<double> &values_,
+               std::size_t stride_,
+               std::vector<int> &first_,
+               std::vector<int> &count_,
+               std::vector<double> &row_weight_,
+               scitbx::af::shared<double> value_,
+               scitbx::af::shared<double> sumweight_)
+        : smoother(smoother_),
+          x(x_),
+          values(values_),
+          stride(stride_),
+          first(first_),
+          count(count_),
+          row_weight(row_weight_),
+          value(value_.ref()),
+          sumweight(sumweight_.ref()) {}
 
-      for (int icol = irange[0]; icol < irange[1]; ++icol) {
-        double ds = (z - positions_[icol]) / sigma_;
-        double w = exp(-ds * ds);
-        if (icol > 0) {
-          weight(irow, icol - 1) = w;
+    void operator()(int i0, int i1) const {
+      for (int irow = i0; irow < i1; ++irow) {
+        // normalised coordinate
+        double z = (x[irow] - smoother.x0) / smoother.spacing_;
+        double sumw = 0.0;
+        double sumwv = 0.0;
+
+        vec2<int> irange = smoother.idx_range(z);
+        DIALS_ASSERT(irange[1] - irange[0] <= (int)stride);
+        double *w_row = &row_weight[irow * stride];
+        first[irow] = irange[0] - 1;
+        count[irow] = irange[1] - irange[0];
+        for (int icol = irange[0]; icol < irange[1]; ++icol) {
+          double ds = (z - smoother.positions_[icol]) / smoother.sigma_;
+          double w = exp(-ds * ds);
+          w_row[icol - irange[0]] = w;
+          sumw += w;
+          sumwv += w * values[icol];
         }
-        sumw += w;
-        sumwv += w * values[icol];
-      }
-      sumweight_ref[irow] = sumw;
+        sumweight[irow] = sumw;
 
-      if (sumw > 0.0) {
-        value_ref[irow] = sumwv / sumw;
-      } else {
-        value_ref[irow] = 0.0;
+        if (sumw > 0.0) {
+          value[irow] = sumwv / sumw;
+        } else {
+          value[irow] = 0.0;
+        }
       }
     }
+  };
 
-    return MultiValueWeights(value, weight, sumweight);
-  }
+  /**
+   * Fill a band of columns of the weight matrix from the row weights
+   */
+  struct FillColumns {
+    const std::vector<int> &first;
+    const std::vector<int> &count;
+    const std::vector<double> &row_weight;
+    std::size_t stride;
+    matrix<double> &weight;
+
+    FillColumns(const std::vector<int> &first_,
+                const std::vector<int> &count_,
+                const std::vector<double> &row_weight_,
+                std::size_t stride_,
+                matrix<double> &weight_)
+        : first(first_),
+          count(count_),
+          row_weight(row_weight_),
+          stride(stride_),
+          weight(weight_) {}
+
+    void operator()(int j0, int j1) const {
+      for (std::size_t irow = 0; irow < first.size(); ++irow) {
+        int c0 = std::max(first[irow], j0);
+        int c1 = std::min(first[irow] + count[irow], j1);
+        const double *w_row = &row_weight[irow * stride];
+        for (int icol = c0; icol < c1; ++icol) {
+          weight(irow, icol) = w_row[icol - first[irow]];
+        }
+      }
+    }
+  };
 };
 
 /**
@@ -145,112 +260,387 @@ scitbx::af::shared<double> limit_outlier_weights(
   return weights;
 }
 
-scitbx::sparse::matrix<double> calculate_dIh_by_dpi(
-  scitbx::af::shared<double> dIh,
-  scitbx::af::shared<double> sumgsq,
-  scitbx::sparse::matrix<double> h_index_mat,
-  scitbx::sparse::matrix<double> derivatives) {
-  // derivatives is a matrix where rows are params and cols are reflections
-  int n_params = derivatives.n_rows();
-  int n_groups = h_index_mat.n_cols();
-  scitbx::sparse::matrix<double> dIh_by_dpi(n_groups, n_params);
+/**
+ * Compute the columns of the transpose of dIh/dp for a band of groups. The
+ * derivatives of the reflections in a group are summed into a dense vector
+ * over the parameters and the non-zero elements then appended to the column
+ * in order, so the sparse matrix is filled without any random insertion.
+ */
+struct dIhByDpiTransposeBand {
+  scitbx::af::const_ref<double> dIh;
+  scitbx::af::const_ref<double> sumgsq;
+  const scitbx::sparse::matrix<double> &h_index_mat;
+  const scitbx::sparse::matrix<double> &derivatives;
+  scitbx::sparse::matrix<double> &dIh_by_dpi;
 
-  for (int i = 0; i < h_index_mat.n_cols(); ++i) {
-    const col_type column = h_index_mat.col(i);
-    // loop over reflection groups
-    column.compact();
-    for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
-      // so it.index gives index of a refl from group i
-      int refl_idx = it.index();
-      const col_type dgidx_by_dpi = derivatives.col(refl_idx);
-      // deriv of one refl wrt all params
-      for (col_type::const_iterator dgit = dgidx_by_dpi.begin();
-           dgit != dgidx_by_dpi.end();
-           ++dgit) {
-        // dgit.index indicates which params have nonzero derivs
-        dIh_by_dpi(i, dgit.index()) += (dIh[refl_idx] * *dgit / sumgsq[i]);
+  dIhByDpiTransposeBand(const scitbx::af::const_ref<double> &dIh_,
+                        const scitbx::af::const_ref<double> &sumgsq_,
+                        const scitbx::sparse::matrix<double> &h_index_mat_,
+                        const scitbx::sparse::matrix<double> &derivatives_,
+                        scitbx::sparse::matrix<double> &dIh_by_dpi_)
+      : dIh(dIh_),
+        sumgsq(sumgsq_),
+        h_index_mat(h_index_mat_),
+        derivatives(derivatives_),
+        dIh_by_dpi(dIh_by_dpi_) {}
+
+  void operator()(int i0, int i1) const {
+    std::size_t n_params = derivatives.n_rows();
+    std::vector<double> sum(n_params, 0.0);
+    std::vector<bool> used(n_params, false);
+    std::vector<std::size_t> touched;
+    for (int i = i0; i < i1; ++i) {
+      const col_type &column = h_index_mat.col(i);
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        // it.index gives index of a refl from group i
+        std::size_t refl_idx = it.index();
+        const col_type &dgidx_by_dpi = derivatives.col(refl_idx);
+        for (col_type::const_iterator dgit = dgidx_by_dpi.begin();
+             dgit != dgidx_by_dpi.end();
+             ++dgit) {
+          std::size_t j = dgit.index();
+          if (!used[j]) {
+            used[j] = true;
+            touched.push_back(j);
+          }
+          sum[j] += (dIh[refl_idx] * *dgit / sumgsq[i]);
+        }
+      }
+      std::sort(touched.begin(), touched.end());
+      col_type &result = dIh_by_dpi.col(i);
+      for (std::size_t k = 0; k < touched.size(); ++k) {
+        std::size_t j = touched[k];
+        result[j] = sum[j];
+        sum[j] = 0.0;
+        used[j] = false;
       }
+      touched.clear();
     }
   }
-  dIh_by_dpi.compact();
-  return dIh_by_dpi;
-}
+};
+
+/**
+ * Compute the columns of the Jacobian for a band of parameters. Each
+ * element is -g * dIh/dp for the group of the reflection minus Ih times the
+ * derivative of g, summed in that order into a dense vector over the
+ * reflections.
+ */
+struct JacobianBand {
+  const scitbx::sparse::matrix<double> &dg_by_dp;
+  const scitbx::sparse::matrix<double> &dIh_by_dp;
+  const scitbx::sparse::matrix<double> &h_index_mat;
+  scitbx::af::const_ref<double> Ih;
+  scitbx::af::const_ref<double> g;
+  scitbx::sparse::matrix<double> &jacobian;
+
+  JacobianBand(const scitbx::sparse::matrix<double> &dg_by_dp_,
+               const scitbx::sparse::matrix<double> &dIh_by_dp_,
+               const scitbx::sparse::matrix<double> &h_index_mat_,
+               const scitbx::af::const_ref<double> &Ih_,
+               const scitbx::af::const_ref<double> &g_,
+               scitbx::sparse::matrix<double> &jacobian_)
+      : dg_by_dp(dg_by_dp_),
+        dIh_by_dp(dIh_by_dp_),
+        h_index_mat(h_index_mat_),
+        Ih(Ih_),
+        g(g_),
+        jacobian(jacobian_) {}
+
+  void operator()(int j0, int j1) const {
+    std::size_t n_refl = jacobian.n_rows();
+    std::vector<double> sum(n_refl, 0.0);
+    std::vector<bool> used(n_refl, false);
+    std::vector<std::size_t> touched;
+    for (int j = j0; j < j1; ++j) {
+      const col_type &dg_col = dg_by_dp.col(j);
+      for (col_type::const_iterator it = dg_col.begin(); it != dg_col.end(); ++it) {
+        std::size_t refl_idx = it.index();
+        used[refl_idx] = true;
+        touched.push_back(refl_idx);
+        sum[refl_idx] -= *it * Ih[refl_idx];
+      }
+      const col_type &dIh_col = dIh_by_dp.col(j);
+      for (col_type::const_iterator dIit = dIh_col.begin(); dIit != dIh_col.end();
+           ++dIit) {
+        // loop over the reflections in the group
+        const col_type &column = h_index_mat.col(dIit.index());
+        for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+          std::size_t refl_idx = it.index();
+          if (!used[refl_idx]) {
+            used[refl_idx] = true;
+            touched.push_back(refl_idx);
+          }
+          sum[refl_idx] -= g[refl_idx] * *dIit;
+        }
+      }
+      std::sort(touched.begin(), touched.end());
+      col_type &result = jacobian.col(j);
+      for (std::size_t k = 0; k < touched.size(); ++k) {
+        std::size_t r = touched[k];
+        result[r] = sum[r];
+        sum[r] = 0.0;
+        used[r] = false;
+      }
+      touched.clear();
+    }
+  }
+};
 
 scitbx::sparse::matrix<double> calculate_dIh_by_dpi_transpose(
   scitbx::af::shared<double> dIh,
   scitbx::af::shared<double> sumgsq,
   scitbx::sparse::matrix<double> h_index_mat,
-  scitbx::sparse::matrix<double> derivatives) {
+  scitbx::sparse::matrix<double> derivatives,
+  std::size_t nthreads = 1) {
   // derivatives is a matrix where rows are params and cols are reflections
   int n_params = derivatives.n_rows();
   int n_groups = h_index_mat.n_cols();
+  DIALS_ASSERT(sumgsq.size() == (std::size_t)n_groups);
+  DIALS_ASSERT(dIh.size() == derivatives.n_cols());
+  DIALS_ASSERT(h_index_mat.n_rows() == derivatives.n_cols());
   scitbx::sparse::matrix<double> dIh_by_dpi(n_params, n_groups);
 
-  for (int i = 0; i < h_index_mat.n_cols(); ++i) {
-    const col_type column = h_index_mat.col(i);
-    // first loop over h_idx to get indices for a reflection group
-    column.compact();
-    scitbx::sparse::vector<double> deriv_of_group_by_params(n_params);
-    for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
-      // it.index gives index of a refl from group i
-      int refl_idx = it.index();
-      const col_type dgidx_by_dpi = derivatives.col(refl_idx);
-      // deriv of one refl wrt all params
-      for (col_type::const_iterator dgit = dgidx_by_dpi.begin();
-           dgit != dgidx_by_dpi.end();
-           ++dgit) {
-        // dgit.index indicates which params have nonzero derivs
-        dIh_by_dpi(dgit.index(), i) += (dIh[refl_idx] * *dgit / sumgsq[i]);
-      }
-    }
-  }
+  // Compact the inputs first so that they are only read by the threads
+  h_index_mat.compact();
+  derivatives.compact();
+  dials::algorithms::for_each_band(
+    dIhByDpiTransposeBand(
+      dIh.const_ref(), sumgsq.const_ref(), h_index_mat, derivatives, dIh_by_dpi),
+    n_groups,
+    nthreads);
   dIh_by_dpi.compact();
   return dIh_by_dpi;
 }
 
+scitbx::sparse::matrix<double> calculate_dIh_by_dpi(
+  scitbx::af::shared<double> dIh,
+  scitbx::af::shared<double> sumgsq,
+  scitbx::sparse::matrix<double> h_index_mat,
+  scitbx::sparse::matrix<double> derivatives,
+  std::size_t nthreads = 1) {
+  return calculate_dIh_by_dpi_transpose(
+           dIh, sumgsq, h_index_mat, derivatives, nthreads)
+    .transpose();
+}
+
 scitbx::sparse::matrix<double> calc_jacobian(scitbx::sparse::matrix<double> derivatives,
                                              scitbx::sparse::matrix<double> h_index_mat,
                                              scitbx::af::shared<double> Ih,
                                              scitbx::af::shared<double> g,
                                              scitbx::af::shared<double> dIh,
-                                             scitbx::af::shared<double> sumgsq) {
+                                             scitbx::af::shared<double> sumgsq,
+                                             std::size_t nthreads = 1) {
   // derivatives is a matrix where rows are params and cols are reflections
   int n_params = derivatives.n_rows();
   int n_refl = derivatives.n_cols();
+  DIALS_ASSERT(Ih.size() == (std::size_t)n_refl);
+  DIALS_ASSERT(g.size() == (std::size_t)n_refl);
 
-  scitbx::sparse::matrix<double> dIhbydpiT =
-    calculate_dIh_by_dpi_transpose(dIh, sumgsq, h_index_mat, derivatives);
+  // The jacobian is built one column per parameter, so the derivatives and
+  // dIh/dp are needed with the parameters along the columns
+  scitbx::sparse::matrix<double> dIh_by_dp =
+    calculate_dIh_by_dpi_transpose(dIh, sumgsq, h_index_mat, derivatives, nthreads)
+      .transpose();
+  scitbx::sparse::matrix<double> dg_by_dp = derivatives.transpose();
+  dg_by_dp.compact();
+  dIh_by_dp.compact();
+  h_index_mat.compact();
   scitbx::sparse::matrix<double> Jacobian(n_refl, n_params);
+  dials::algorithms::for_each_band(
+    JacobianBand(
+      dg_by_dp, dIh_by_dp, h_index_mat, Ih.const_ref(), g.const_ref(), Jacobian),
+    n_params,
+    nthreads);
+  Jacobian.compact();
+  return Jacobian;
+}
 
-  for (int i = 0; i < h_index_mat.n_cols(); ++i) {
-    const col_type column = h_index_mat.col(i);
-    // first loop over h_idx to get indices for a reflection group
-    column.compact();
-    for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
-      // it.index gives index of a refl from group i
-      int refl_idx = it.index();
-      const col_type dgidx_by_dpi = derivatives.col(refl_idx);
-      // deriv of one refl wrt all params
-      dgidx_by_dpi.compact();
-      // loop over nonzero elements of dgidx by dpi
-      for (col_type::const_iterator dgit = dgidx_by_dpi.begin();
-           dgit != dgidx_by_dpi.end();
-           ++dgit) {
-        // dgit.index indicates which params have nonzero derivs
-        Jacobian(refl_idx, dgit.index()) -= *dgit * Ih[refl_idx];
+/**
+ * Compute the best estimate of Ih for a band of groups of symmetry
+ * equivalent reflections and write it to each reflection of the groups.
+ * The sums run over the reflections of each group in the same order as the
+ * product of a vector with the h_index_matrix, so the results are the same
+ * as in the equivalent flex calculation.
+ */
+struct IhValuesBand {
+  const scitbx::sparse::matrix<double> &h_index_mat;
+  scitbx::af::const_ref<double> g;
+  scitbx::af::const_ref<double> intensity;
+  scitbx::af::const_ref<double> weight;
+  scitbx::af::ref<double> Ih;
+
+  IhValuesBand(const scitbx::sparse::matrix<double> &h_index_mat_,
+               const scitbx::af::const_ref<double> &g_,
+               const scitbx::af::const_ref<double> &intensity_,
+               const scitbx::af::const_ref<double> &weight_,
+               scitbx::af::ref<double> Ih_)
+      : h_index_mat(h_index_mat_),
+        g(g_),
+        intensity(intensity_),
+        weight(weight_),
+        Ih(Ih_) {}
+
+  void operator()(int i0, int i1) const {
+    for (int i = i0; i < i1; ++i) {
+      const col_type &column = h_index_mat.col(i);
+      double sumgsq = 0.0;
+      double sumgI = 0.0;
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        std::size_t r = it.index();
+        sumgsq += (g[r] * g[r]) * weight[r];
+        sumgI += (g[r] * intensity[r]) * weight[r];
       }
-      // now loop over nonzero elements of dIhbydpi
-      // get col corresponding to group
-      const col_type dIh_col = dIhbydpiT.col(i);
-      // now loop over nonzero params
-      for (col_type::const_iterator dIit = dIh_col.begin(); dIit != dIh_col.end();
-           ++dIit) {
-        Jacobian(refl_idx, dIit.index()) -= g[refl_idx] * *dIit;
+      double value = sumgI / sumgsq;
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        Ih[it.index()] = value;
       }
     }
   }
-  Jacobian.compact();
-  return Jacobian;
+};
+
+/**
+ * Calculate Ih = sum(w g I) / sum(w g^2) over each group of symmetry
+ * equivalent reflections, in a single pass over the data with no temporary
+ * arrays, returning the value of Ih for each reflection.
+ * @param h_index_mat The n_refl by n_groups matrix assigning each reflection
+ *                    to a group
+ * @param g The inverse scale factors
+ * @param intensity The intensities
+ * @param weight The weights
+ * @param nthreads The number of threads to use
+ */
+scitbx::af::shared<double> calc_Ih_values(scitbx::sparse::matrix<double> h_index_mat,
+                                          scitbx::af::const_ref<double> g,
+                                          scitbx::af::const_ref<double> intensity,
+                                          scitbx::af::const_ref<double> weight,
+                                          std::size_t nthreads = 1) {
+  std::size_t n_refl = h_index_mat.n_rows();
+  DIALS_ASSERT(g.size() == n_refl);
+  DIALS_ASSERT(intensity.size() == n_refl);
+  DIALS_ASSERT(weight.size() == n_refl);
+  scitbx::af::shared<double> Ih(n_refl, 0.0);
+  h_index_mat.compact();
+  dials::algorithms::for_each_band(
+    IhValuesBand(h_index_mat, g, intensity, weight, Ih.ref()),
+    (int)h_index_mat.n_cols(),
+    nthreads);
+  return Ih;
+}
+
+/**
+ * Compute the per-reflection factor of the gradient of the scaling target
+ * for a band of groups. The gradient is this factor times the derivatives.
+ */
+struct GradientFactorBand {
+  const scitbx::sparse::matrix<double> &h_index_mat;
+  scitbx::af::const_ref<double> intensity;
+  scitbx::af::const_ref<double> Ih;
+  scitbx::af::const_ref<double> g;
+  scitbx::af::const_ref<double> weight;
+  scitbx::af::ref<double> factor;
+
+  GradientFactorBand(const scitbx::sparse::matrix<double> &h_index_mat_,
+                     const scitbx::af::const_ref<double> &intensity_,
+                     const scitbx::af::const_ref<double> &Ih_,
+                     const scitbx::af::const_ref<double> &g_,
+                     const scitbx::af::const_ref<double> &weight_,
+                     scitbx::af::ref<double> factor_)
+      : h_index_mat(h_index_mat_),
+        intensity(intensity_),
+        Ih(Ih_),
+        g(g_),
+        weight(weight_),
+        factor(factor_) {}
+
+  void operator()(int i0, int i1) const {
+    for (int i = i0; i < i1; ++i) {
+      const col_type &column = h_index_mat.col(i);
+      double sumgsq = 0.0;
+      double sum_pg = 0.0;
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        std::size_t r = it.index();
+        double prefactor = -2.0 * weight[r] * (intensity[r] - Ih[r] * g[r]);
+        sumgsq += g[r] * g[r] * weight[r];
+        sum_pg += prefactor * g[r];
+      }
+      double group_factor = sum_pg / sumgsq;
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        std::size_t r = it.index();
+        double prefactor = -2.0 * weight[r] * (intensity[r] - Ih[r] * g[r]);
+        double dIh = (intensity[r] - Ih[r] * 2.0 * g[r]) * weight[r];
+        factor[r] = prefactor * Ih[r] + dIh * group_factor;
+      }
+    }
+  }
+};
+
+/**
+ * Compute the elements of the product of a vector with the columns of a
+ * sparse matrix for a band of columns
+ */
+struct VectorTimesColumnsBand {
+  scitbx::af::const_ref<double> v;
+  const scitbx::sparse::matrix<double> &m;
+  scitbx::af::ref<double> result;
+
+  VectorTimesColumnsBand(const scitbx::af::const_ref<double> &v_,
+                         const scitbx::sparse::matrix<double> &m_,
+                         scitbx::af::ref<double> result_)
+      : v(v_), m(m_), result(result_) {}
+
+  void operator()(int j0, int j1) const {
+    for (int j = j0; j < j1; ++j) {
+      const col_type &column = m.col(j);
+      double sum = 0.0;
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        sum += v[it.index()] * *it;
+      }
+      result[j] = sum;
+    }
+  }
+};
+
+/**
+ * Calculate the gradient of the scaling target, sum(w (I - g Ih)^2), with
+ * respect to the parameters. The group sums, the per-reflection factor and
+ * its product with the derivatives are computed in one call, in parallel
+ * over the groups and then over the parameters.
+ * @param h_index_mat The n_refl by n_groups matrix assigning each reflection
+ *                    to a group
+ * @param derivatives The n_refl by n_params derivatives of g
+ * @param intensity The intensities
+ * @param Ih The current Ih value of each reflection
+ * @param g The inverse scale factors
+ * @param weight The weights
+ * @param nthreads The number of threads to use
+ */
+scitbx::af::shared<double> calc_scaling_gradient(
+  scitbx::sparse::matrix<double> h_index_mat,
+  scitbx::sparse::matrix<double> derivatives,
+  scitbx::af::const_ref<double> intensity,
+  scitbx::af::const_ref<double> Ih,
+  scitbx::af::const_ref<double> g,
+  scitbx::af::const_ref<double> weight,
+  std::size_t nthreads = 1) {
+  std::size_t n_refl = h_index_mat.n_rows();
+  DIALS_ASSERT(derivatives.n_rows() == n_refl);
+  DIALS_ASSERT(intensity.size() == n_refl);
+  DIALS_ASSERT(Ih.size() == n_refl);
+  DIALS_ASSERT(g.size() == n_refl);
+  DIALS_ASSERT(weight.size() == n_refl);
+  h_index_mat.compact();
+  derivatives.compact();
+  scitbx::af::shared<double> factor(n_refl, 0.0);
+  dials::algorithms::for_each_band(
+    GradientFactorBand(h_index_mat, intensity, Ih, g, weight, factor.ref()),
+    (int)h_index_mat.n_cols(),
+    nthreads);
+  scitbx::af::shared<double> gradient(derivatives.n_cols(), 0.0);
+  dials::algorithms::for_each_band(
+    VectorTimesColumnsBand(factor.const_ref(), derivatives, gradient.ref()),
+    (int)derivatives.n_cols(),
+    nthreads);
+  return gradient;
 }
 
 scitbx::sparse::matrix<double> row_multiply(scitbx::sparse::matrix<double> m,
@@ -336,6 +726,213 @@ boost::python::tuple determine_outlier_indices(
   return boost::python::make_tuple(outlier_indices, other_potential_outlier_indices);
 }
 
+/**
+ * Run the iterative normalised deviation outlier rejection for a band of
+ * groups. In each round the normalised deviation of each remaining reflection
+ * is found from the weighted mean of the other remaining reflections of its
+ * group and, if the largest exceeds zmax, that reflection is rejected. Groups
+ * are independent, so the rounds of each group can be run to completion
+ * before moving onto the next. The reflections rejected by group i are
+ * recorded in rejected[i] in the order they were rejected.
+ */
+struct NormDevOutlierBand {
+  const scitbx::sparse::matrix<double> &h_index_mat;
+  scitbx::af::const_ref<double> intensity;
+  scitbx::af::const_ref<double> g;
+  scitbx::af::const_ref<double> weights;
+  double zmax;
+  std::vector<std::vector<std::size_t> > &rejected;
+
+  NormDevOutlierBand(const scitbx::sparse::matrix<double> &h_index_mat_,
+                     const scitbx::af::const_ref<double> &intensity_,
+                     const scitbx::af::const_ref<double> &g_,
+                     const scitbx::af::const_ref<double> &weights_,
+                     double zmax_,
+                     std::vector<std::vector<std::size_t> > &rejected_)
+      : h_index_mat(h_index_mat_),
+        intensity(intensity_),
+        g(g_),
+        weights(weights_),
+        zmax(zmax_),
+        rejected(rejected_) {}
+
+  void operator()(int i0, int i1) const {
+    std::vector<std::size_t> members;
+    for (int i = i0; i < i1; ++i) {
+      const col_type &column = h_index_mat.col(i);
+      members.clear();
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        members.push_back(it.index());
+      }
+      while (members.size() > 2) {
+        double wgIsum = 0.0;
+        double wg2sum = 0.0;
+        for (std::size_t k = 0; k < members.size(); ++k) {
+          std::size_t r = members[k];
+          wgIsum += weights[r] * g[r] * intensity[r];
+          wg2sum += weights[r] * g[r] * g[r];
+        }
+        double max_z = zmax;
+        std::size_t k_max = members.size();
+        for (std::size_t k = 0; k < members.size(); ++k) {
+          std::size_t r = members[k];
+          DIALS_ASSERT(weights[r] > 0);
+          double wgI_others = wgIsum - (weights[r] * g[r] * intensity[r]);
+          double wg2_others = wg2sum - (weights[r] * g[r] * g[r]);
+          double z = 1000;
+          if (wg2_others != 0.0) {
+            double norm_dev =
+              (intensity[r] - (g[r] * wgI_others / wg2_others))
+              / std::sqrt((1.0 / weights[r]) + ((g[r] * g[r]) / wg2_others));
+            z = std::abs(norm_dev);
+          }
+          if (z > max_z) {
+            max_z = z;
+            k_max = k;
+          }
+        }
+        if (k_max == members.size()) {
+          break;
+        }
+        rejected[i].push_back(members[k_max]);
+        members.erase(members.begin() + k_max);
+      }
+    }
+  }
+};
+
+/**
+ * Determine the outliers by iterative normalised deviation outlier rejection,
+ * in parallel over the groups of symmetry equivalent reflections.
+ * @param h_index_mat The n_refl by n_groups matrix assigning each reflection
+ *                    to a group
+ * @param intensity The intensities
+ * @param g The inverse scale factors
+ * @param weights The weights
+ * @param zmax The normalised deviation above which a reflection is an outlier
+ * @param nthreads The number of threads to use
+ * @returns The indices of the outliers, ordered by the round of rejection
+ *          in which they were found and then by group
+ */
+scitbx::af::shared<std::size_t> determine_normdev_outlier_indices(
+  scitbx::sparse::matrix<double> h_index_mat,
+  scitbx::af::const_ref<double> intensity,
+  scitbx::af::const_ref<double> g,
+  scitbx::af::const_ref<double> weights,
+  double zmax,
+  std::size_t nthreads = 1) {
+  std::size_t n_refl = h_index_mat.n_rows();
+  DIALS_ASSERT(intensity.size() == n_refl);
+  DIALS_ASSERT(g.size() == n_refl);
+  DIALS_ASSERT(weights.size() == n_refl);
+  h_index_mat.compact();
+  std::size_t n_groups = h_index_mat.n_cols();
+  std::vector<std::vector<std::size_t> > rejected(n_groups);
+  dials::algorithms::for_each_band(
+    NormDevOutlierBand(h_index_mat, intensity, g, weights, zmax, rejected),
+    (int)n_groups,
+    nthreads);
+  scitbx::af::shared<std::size_t> outlier_indices;
+  for (std::size_t round = 0;; ++round) {
+    bool any = false;
+    for (std::size_t i = 0; i < n_groups; ++i) {
+      if (round < rejected[i].size()) {
+        outlier_indices.push_back(rejected[i][round]);
+        any = true;
+      }
+    }
+    if (!any) {
+      break;
+    }
+  }
+  return outlier_indices;
+}
+
+/**
+ * Flag the outliers by normalised deviation from the weighted mean of the
+ * whole group, for a band of groups
+ */
+struct SimpleNormDevOutlierBand {
+  const scitbx::sparse::matrix<double> &h_index_mat;
+  scitbx::af::const_ref<double> intensity;
+  scitbx::af::const_ref<double> g;
+  scitbx::af::const_ref<double> weights;
+  double zmax;
+  scitbx::af::ref<bool> outliers;
+
+  SimpleNormDevOutlierBand(const scitbx::sparse::matrix<double> &h_index_mat_,
+                           const scitbx::af::const_ref<double> &intensity_,
+                           const scitbx::af::const_ref<double> &g_,
+                           const scitbx::af::const_ref<double> &weights_,
+                           double zmax_,
+                           scitbx::af::ref<bool> outliers_)
+      : h_index_mat(h_index_mat_),
+        intensity(intensity_),
+        g(g_),
+        weights(weights_),
+        zmax(zmax_),
+        outliers(outliers_) {}
+
+  void operator()(int i0, int i1) const {
+    for (int i = i0; i < i1; ++i) {
+      const col_type &column = h_index_mat.col(i);
+      double wgIsum = 0.0;
+      double wg2sum = 0.0;
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        std::size_t r = it.index();
+        wgIsum += weights[r] * g[r] * intensity[r];
+        wg2sum += weights[r] * g[r] * g[r];
+      }
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        std::size_t r = it.index();
+        DIALS_ASSERT(weights[r] > 0);
+        if (wg2sum == 0.0) {
+          outliers[r] = true;
+          continue;
+        }
+        double gw = g[r] / wg2sum;
+        double norm_dev = (intensity[r] - (g[r] * wgIsum / wg2sum))
+                          / std::sqrt((1.0 / weights[r]) + gw * gw);
+        outliers[r] = std::abs(norm_dev) > zmax;
+      }
+    }
+  }
+};
+
+/**
+ * Determine the outliers by normalised deviation from the weighted mean of
+ * each group, including the reflection itself, in a single pass in parallel
+ * over the groups.
+ * @param h_index_mat The n_refl by n_groups matrix assigning each reflection
+ *                    to a group
+ * @param intensity The intensities
+ * @param g The inverse scale factors
+ * @param weights The weights
+ * @param zmax The normalised deviation above which a reflection is an outlier
+ * @param nthreads The number of threads to use
+ * @returns A selection flagging the outliers
+ */
+scitbx::af::shared<bool> determine_simple_normdev_outliers(
+  scitbx::sparse::matrix<double> h_index_mat,
+  scitbx::af::const_ref<double> intensity,
+  scitbx::af::const_ref<double> g,
+  scitbx::af::const_ref<double> weights,
+  double zmax,
+  std::size_t nthreads = 1) {
+  std::size_t n_refl = h_index_mat.n_rows();
+  DIALS_ASSERT(intensity.size() == n_refl);
+  DIALS_ASSERT(g.size() == n_refl);
+  DIALS_ASSERT(weights.size() == n_refl);
+  h_index_mat.compact();
+  scitbx::af::shared<bool> outliers(n_refl, false);
+  dials::algorithms::for_each_band(
+    SimpleNormDevOutlierBand(
+      h_index_mat, intensity, g, weights, zmax, outliers.ref()),
+    (int)h_index_mat.n_cols(),
+    nthreads);
+  return outliers;
+}
+
 scitbx::af::shared<double> calc_sigmasq(
   scitbx::sparse::matrix<double> jacobian_transpose,
   scitbx::sparse::matrix<double> var_cov_matrix) {
@@ -359,6 +956,212 @@ scitbx::af::shared<double> calc_sigmasq(
   return sigmasq;
 }
 
+/**
+ * Compute the error model sigma and normalised deviation of each reflection
+ * for a band of reflections
+ */
+struct ErrorModelDeltasBand {
+  scitbx::af::const_ref<double> intensity;
+  scitbx::af::const_ref<double> g;
+  scitbx::af::const_ref<double> Ih;
+  scitbx::af::const_ref<double> variance;
+  scitbx::af::const_ref<double> n_h;
+  double a;
+  double b;
+  scitbx::af::ref<double> sigmaprime;
+  scitbx::af::ref<double> delta_hl;
+
+  ErrorModelDeltasBand(const scitbx::af::const_ref<double> &intensity_,
+                       const scitbx::af::const_ref<double> &g_,
+                       const scitbx::af::const_ref<double> &Ih_,
+                       const scitbx::af::const_ref<double> &variance_,
+                       const scitbx::af::const_ref<double> &n_h_,
+                       double a_,
+                       double b_,
+                       scitbx::af::ref<double> sigmaprime_,
+                       scitbx::af::ref<double> delta_hl_)
+      : intensity(intensity_),
+        g(g_),
+        Ih(Ih_),
+        variance(variance_),
+        n_h(n_h_),
+        a(a_),
+        b(b_),
+        sigmaprime(sigmaprime_),
+        delta_hl(delta_hl_) {}
+
+  void operator()(int i0, int i1) const {
+    for (int i = i0; i < i1; ++i) {
+      double bI = b * intensity[i];
+      double sp = (a * std::sqrt(variance[i] + bI * bI)) / g[i];
+      double prefactor = std::sqrt((n_h[i] - 1.0) / n_h[i]);
+      sigmaprime[i] = sp;
+      delta_hl[i] = prefactor * ((intensity[i] / g[i]) - Ih[i]) / sp;
+    }
+  }
+};
+
+/**
+ * Calculate sigma' = a sqrt(var + (b I)^2) / g and the normalised deviations
+ * delta_hl = sqrt((n_h - 1) / n_h) (I / g - Ih) / sigma' of the reflections
+ * in one pass.
+ * @param intensity The intensities
+ * @param g The inverse scale factors
+ * @param Ih The Ih values
+ * @param variance The variances
+ * @param n_h The number of reflections in the group of each reflection
+ * @param a The a parameter of the error model
+ * @param b The b parameter of the error model
+ * @param nthreads The number of threads to use
+ * @returns A tuple of sigma' and delta_hl
+ */
+boost::python::tuple calc_error_model_deltas(scitbx::af::const_ref<double> intensity,
+                                             scitbx::af::const_ref<double> g,
+                                             scitbx::af::const_ref<double> Ih,
+                                             scitbx::af::const_ref<double> variance,
+                                             scitbx::af::const_ref<double> n_h,
+                                             double a,
+                                             double b,
+                                             std::size_t nthreads = 1) {
+  std::size_t n = intensity.size();
+  DIALS_ASSERT(g.size() == n);
+  DIALS_ASSERT(Ih.size() == n);
+  DIALS_ASSERT(variance.size() == n);
+  DIALS_ASSERT(n_h.size() == n);
+  scitbx::af::shared<double> sigmaprime(n, 0.0);
+  scitbx::af::shared<double> delta_hl(n, 0.0);
+  dials::algorithms::for_each_band(ErrorModelDeltasBand(intensity,
+                                                        g,
+                                                        Ih,
+                                                        variance,
+                                                        n_h,
+                                                        a,
+                                                        b,
+                                                        sigmaprime.ref(),
+                                                        delta_hl.ref()),
+                                   (int)n,
+                                   nthreads);
+  return boost::python::make_tuple(sigmaprime, delta_hl);
+}
+
+/**
+ * Compute the sums over each intensity bin needed for the bin variances and
+ * the gradient of the error model b target, for a band of bins
+ */
+struct ErrorModelBinSumsBand {
+  const scitbx::sparse::matrix<double> &summation_matrix;
+  scitbx::af::const_ref<double> delta_hl;
+  scitbx::af::const_ref<double> sigmaprime;
+  scitbx::af::const_ref<double> intensity;
+  scitbx::af::const_ref<double> g;
+  double a;
+  double b;
+  scitbx::af::ref<double> sum_delta;
+  scitbx::af::ref<double> sum_deltasq;
+  scitbx::af::ref<double> sum_deriv;
+  scitbx::af::ref<double> sum_delta_deriv;
+
+  ErrorModelBinSumsBand(const scitbx::sparse::matrix<double> &summation_matrix_,
+                        const scitbx::af::const_ref<double> &delta_hl_,
+                        const scitbx::af::const_ref<double> &sigmaprime_,
+                        const scitbx::af::const_ref<double> &intensity_,
+                        const scitbx::af::const_ref<double> &g_,
+                        double a_,
+                        double b_,
+                        scitbx::af::ref<double> sum_delta_,
+                        scitbx::af::ref<double> sum_deltasq_,
+                        scitbx::af::ref<double> sum_deriv_,
+                        scitbx::af::ref<double> sum_delta_deriv_)
+      : summation_matrix(summation_matrix_),
+        delta_hl(delta_hl_),
+        sigmaprime(sigmaprime_),
+        intensity(intensity_),
+        g(g_),
+        a(a_),
+        b(b_),
+        sum_delta(sum_delta_),
+        sum_deltasq(sum_deltasq_),
+        sum_deriv(sum_deriv_),
+        sum_delta_deriv(sum_delta_deriv_) {}
+
+  void operator()(int j0, int j1) const {
+    double asq = a * a;
+    for (int j = j0; j < j1; ++j) {
+      const col_type &column = summation_matrix.col(j);
+      double sd = 0.0, sdsq = 0.0, sderiv = 0.0, sdd = 0.0;
+      for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+        std::size_t i = it.index();
+        double delta = delta_hl[i];
+        double sp = sigmaprime[i];
+        // d(sigma')/db and d(delta)/d(sigma')
+        double dsig_dc =
+          ((b * (intensity[i] * intensity[i])) * asq) / (sp * (g[i] * g[i]));
+        double deriv = ((-1.0 * delta) / sp) * dsig_dc;
+        sd += delta;
+        sdsq += delta * delta;
+        sderiv += deriv;
+        sdd += delta * deriv;
+      }
+      sum_delta[j] = sd;
+      sum_deltasq[j] = sdsq;
+      sum_deriv[j] = sderiv;
+      sum_delta_deriv[j] = sdd;
+    }
+  }
+};
+
+/**
+ * Calculate the sums of delta_hl, delta_hl^2, d(delta_hl)/db and
+ * delta_hl d(delta_hl)/db over each intensity bin in one pass, in parallel
+ * over the bins.
+ * @param summation_matrix The n_refl by n_bins matrix assigning reflections
+ *                         to bins
+ * @param delta_hl The normalised deviations
+ * @param sigmaprime The error model sigmas
+ * @param intensity The intensities
+ * @param g The inverse scale factors
+ * @param a The a parameter of the error model
+ * @param b The b parameter of the error model
+ * @param nthreads The number of threads to use
+ * @returns A tuple of the four sums for each bin
+ */
+boost::python::tuple calc_error_model_bin_sums(
+  scitbx::sparse::matrix<double> summation_matrix,
+  scitbx::af::const_ref<double> delta_hl,
+  scitbx::af::const_ref<double> sigmaprime,
+  scitbx::af::const_ref<double> intensity,
+  scitbx::af::const_ref<double> g,
+  double a,
+  double b,
+  std::size_t nthreads = 1) {
+  std::size_t n = summation_matrix.n_rows();
+  DIALS_ASSERT(delta_hl.size() == n);
+  DIALS_ASSERT(sigmaprime.size() == n);
+  DIALS_ASSERT(intensity.size() == n);
+  DIALS_ASSERT(g.size() == n);
+  summation_matrix.compact();
+  std::size_t n_bins = summation_matrix.n_cols();
+  scitbx::af::shared<double> sum_delta(n_bins, 0.0);
+  scitbx::af::shared<double> sum_deltasq(n_bins, 0.0);
+  scitbx::af::shared<double> sum_deriv(n_bins, 0.0);
+  scitbx::af::shared<double> sum_delta_deriv(n_bins, 0.0);
+  dials::algorithms::for_each_band(ErrorModelBinSumsBand(summation_matrix,
+                                                         delta_hl,
+                                                         sigmaprime,
+                                                         intensity,
+                                                         g,
+                                                         a,
+                                                         b,
+                                                         sum_delta.ref(),
+                                                         sum_deltasq.ref(),
+                                                         sum_deriv.ref(),
+                                                         sum_delta_deriv.ref()),
+                                   (int)n_bins,
+                                   nthreads);
+  return boost::python::make_tuple(
+    sum_delta, sum_deltasq, sum_deriv, sum_delta_deriv);
+}
+
 scitbx::af::shared<scitbx::vec3<double> > rotate_vectors_about_axis(
   scitbx::af::shared<scitbx::vec3<double> > const rot_axis,
   scitbx::af::shared<scitbx::vec3<double> > const vectors,
@@ -424,6 +1227,86 @@ boost::python::tuple calculate_harmonic_tables_from_selections(
   return boost::python::make_tuple(output_coefficients_list, coefficients_matrix);
 }
 
+/**
+ * Calculate the table of harmonic values for a selection of reflections from
+ * the lookup tables, without also returning a copy of the values as a list of
+ * arrays, so only one table is held while it is in use.
+ * @param s0_selection The lookup index of the s0 vector of each reflection
+ * @param s1_selection The lookup index of the s1 vector of each reflection
+ * @param coefficients_list The lookup table of each harmonic
+ * @returns The n_refl by n_param table of harmonic values
+ */
+matrix<double> calculate_harmonic_table_from_selections(
+  const scitbx::af::const_ref<std::size_t> &s0_selection,
+  const scitbx::af::const_ref<std::size_t> &s1_selection,
+  boost::python::list coefficients_list) {
+  DIALS_ASSERT(s0_selection.size() == s1_selection.size());
+  std::size_t n_refl = s0_selection.size();
+  std::size_t n_param = boost::python::len(coefficients_list);
+  matrix<double> coefficients_matrix(n_refl, n_param);
+  for (std::size_t i = 0; i < n_param; ++i) {
+    scitbx::af::shared<double> coefs =
+      boost::python::extract<scitbx::af::shared<double> >(coefficients_list[i]);
+    for (std::size_t j = 0; j < n_refl; ++j) {
+      coefficients_matrix(j, i) =
+        (coefs[s0_selection[j]] + coefs[s1_selection[j]]) / 2.0;
+    }
+  }
+  return coefficients_matrix;
+}
+
+/**
+ * Calculate the absorption scales for a selection of reflections directly
+ * from the lookup tables, without forming the table of harmonic values. The
+ * scales are the same as from calculate_harmonic_scales applied to the table
+ * from calculate_harmonic_table_from_selections.
+ * @param s0_selection The lookup index of the s0 vector of each reflection
+ * @param s1_selection The lookup index of the s1 vector of each reflection
+ * @param coefficients_list The lookup table of each harmonic
+ * @param parameters The harmonic coefficients
+ */
+scitbx::af::shared<double> calculate_harmonic_scales_from_selections(
+  const scitbx::af::const_ref<std::size_t> &s0_selection,
+  const scitbx::af::const_ref<std::size_t> &s1_selection,
+  boost::python::list coefficients_list,
+  const scitbx::af::const_ref<double> &parameters) {
+  DIALS_ASSERT(s0_selection.size() == s1_selection.size());
+  DIALS_ASSERT(boost::python::len(coefficients_list) == parameters.size());
+  std::size_t n_refl = s0_selection.size();
+  scitbx::af::shared<double> scales(n_refl, 1.0);
+  for (std::size_t i = 0; i < parameters.size(); ++i) {
+    scitbx::af::shared<double> coefs =
+      boost::python::extract<scitbx::af::shared<double> >(coefficients_list[i]);
+    for (std::size_t j = 0; j < n_refl; ++j) {
+      double value = (coefs[s0_selection[j]] + coefs[s1_selection[j]]) / 2.0;
+      scales[j] += value * parameters[i];
+    }
+  }
+  return scales;
+}
+
+/**
+ * Calculate the absorption scales 1 + sum_j p_j Y_j for each reflection,
+ * accumulating the columns of the harmonic table in order so only the
+ * non-zero elements are touched and no dense column is formed.
+ * @param harmonic_values The n_refl by n_param table of harmonic values
+ * @param parameters The harmonic coefficients
+ */
+scitbx::af::shared<double> calculate_harmonic_scales(
+  matrix<double> harmonic_values,
+  scitbx::af::const_ref<double> parameters) {
+  DIALS_ASSERT(harmonic_values.n_cols() == parameters.size());
+  harmonic_values.compact();
+  scitbx::af::shared<double> scales(harmonic_values.n_rows(), 1.0);
+  for (std::size_t j = 0; j < harmonic_values.n_cols(); ++j) {
+    const col_type &column = harmonic_values.col(j);
+    for (col_type::const_iterator it = column.begin(); it != column.end(); ++it) {
+      scales[it.index()] += *it * parameters[j];
+    }
+  }
+  return scales;
+}
+
 matrix<double> create_sph_harm_table(
   scitbx::af::shared<scitbx::vec2<double> > const s0_theta_phi,
   scitbx::af::shared<scitbx::vec2<double> > const s1_theta_phi,
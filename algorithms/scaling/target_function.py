@@ -9,7 +9,7 @@
 
 from dials.algorithms.scaling.scaling_restraints import ScalingRestraintsCalculator
 from dials.array_family import flex
-from dials_scaling_ext import calc_dIh_by_dpi, calc_jacobian, row_multiply
+from dials_scaling_ext import calc_jacobian, calc_scaling_gradient, row_multiply
 
 
 class ScalingTarget(object):
@@ -22,7 +22,8 @@ class ScalingTarget(object):
     rmsd_names = ["RMSD_I"]
     rmsd_units = ["a.u"]
 
-    def __init__(self):
+    def __init__(self, nthreads=1):
+        self.nthreads = nthreads
         self.rmsd_names = ["RMSD_I"]
         self.rmsd_units = ["a.u"]
         # Quantities to cache each step
@@ -58,35 +59,19 @@ def calculate_residuals(Ih_table):
         R = Ih_table.intensities - (Ih_table.inverse_scale_factors * Ih_table.Ih_values)
         return R
 
-    @staticmethod
-    def calculate_gradients(Ih_table):
+    def calculate_gradients(self, Ih_table):
         """Return a gradient vector on length len(self.apm.x)."""
-        gsq = flex.pow2(Ih_table.inverse_scale_factors) * Ih_table.weights
-        sumgsq = gsq * Ih_table.h_index_matrix
-        prefactor = (
-            -2.0
-            * Ih_table.weights
-            * (
-                Ih_table.intensities
-                - (Ih_table.Ih_values * Ih_table.inverse_scale_factors)
-            )
-        )
-        dIh = (
-            Ih_table.intensities
-            - (Ih_table.Ih_values * 2.0 * Ih_table.inverse_scale_factors)
-        ) * Ih_table.weights
-        dIh_by_dpi = calc_dIh_by_dpi(
-            dIh, sumgsq, Ih_table.h_index_matrix, Ih_table.derivatives.transpose()
+        return calc_scaling_gradient(
+            Ih_table.h_index_matrix,
+            Ih_table.derivatives,
+            Ih_table.intensities,
+            Ih_table.Ih_values,
+            Ih_table.inverse_scale_factors,
+            Ih_table.weights,
+            nthreads=self.nthreads,
         )
-        term_1 = (prefactor * Ih_table.Ih_values) * Ih_table.derivatives
-        term_2 = (
-            prefactor * Ih_table.inverse_scale_factors * Ih_table.h_index_matrix
-        ) * dIh_by_dpi
-        gradient = term_1 + term_2
-        return gradient
 
-    @staticmethod
-    def calculate_jacobian(Ih_table):
+    def calculate_jacobian(self, Ih_table):
         """Calculate the jacobian matrix, size Ih_table.size by len(self.apm.x)."""
         gsq = flex.pow2(Ih_table.inverse_scale_factors) * Ih_table.weights
         sumgsq = gsq * Ih_table.h_index_matrix
@@ -101,15 +86,15 @@ def calculate_jacobian(Ih_table):
             Ih_table.inverse_scale_factors,
             dIh,
             sumgsq,
+            nthreads=self.nthreads,
         )
         return jacobian
 
     # The following methods are for adaptlbfgs.
-    @classmethod
-    def compute_functional_gradients(cls, Ih_table):
+    def compute_functional_gradients(self, Ih_table):
         """Return the functional and gradients."""
-        resids = cls.calculate_residuals(Ih_table)
-        gradients = cls.calculate_gradients(Ih_table)
+        resids = self.calculate_residuals(Ih_table)
+        gradients = self.calculate_gradients(Ih_table)
         weights = Ih_table.weights
         functional = flex.sum(flex.pow2(resids) * weights)
         del Ih_table.derivatives
@@ -136,11 +121,10 @@ def compute_residuals(cls, Ih_table):
         weights = Ih_table.weights
         return residuals, weights
 
-    @classmethod
-    def compute_residuals_and_gradients(cls, Ih_table):
+    def compute_residuals_and_gradients(self, Ih_table):
         """Return the residuals array, jacobian matrix and weights."""
-        residuals = cls.calculate_residuals(Ih_table)
-        jacobian = cls.calculate_jacobian(Ih_table)
+        residuals = self.calculate_residuals(Ih_table)
+        jacobian = self.calculate_jacobian(Ih_table)
         weights = Ih_table.weights
         Ih_table.derivatives = None
         return residuals, jacobian, weights
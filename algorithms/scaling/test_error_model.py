@@ -227,6 +227,37 @@ def test_errormodel(large_reflection_table, test_sg):
     assert list(delta_hl) == pytest.approx(expected_deltas)
 
 
+def test_error_model_binner_kernels(large_reflection_table, test_sg):
+    """Test the binner deltas and bin sums against the flex calculation."""
+    Ih_table = IhTable([large_reflection_table], test_sg, nblocks=1)
+    block = Ih_table.blocked_data_list[0]
+    em = BasicErrorModel
+    em.min_reflections_required = 1
+    params = generated_param()
+    params.weighting.error_model.basic.n_bins = 2
+    params.weighting.error_model.basic.min_Ih = 1.0
+    error_model = em(block, params.weighting.error_model.basic, nthreads=2)
+    binner = error_model.binner
+    binner.update([1.1, 0.05])
+    table = error_model.filtered_Ih_table
+    sigmaprime = calc_sigmaprime([1.1, 0.05], table)
+    delta_hl = calc_deltahl(table, table.calc_nh(), sigmaprime)
+    assert list(binner.sigmaprime) == pytest.approx(list(sigmaprime))
+    assert list(binner.delta_hl) == pytest.approx(list(delta_hl))
+
+    sum_delta, sum_deltasq, _, _ = binner.calculate_bin_sums(1.1, 0.05)
+    assert list(sum_delta) == pytest.approx(list(delta_hl * binner.summation_matrix))
+    assert list(sum_deltasq) == pytest.approx(
+        list(flex.pow2(delta_hl) * binner.summation_matrix)
+    )
+    binner.nthreads = 1
+    serial = binner.calculate_bin_sums(1.1, 0.05)
+    binner.nthreads = 2
+    threaded = binner.calculate_bin_sums(1.1, 0.05)
+    for s, t in zip(serial, threaded):
+        assert list(s) == list(t)
+
+
 def test_error_model_target(large_reflection_table, test_sg):
     """Test the error model target."""
     Ih_table = IhTable([large_reflection_table], test_sg, nblocks=1)
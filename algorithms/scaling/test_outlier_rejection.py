@@ -377,6 +377,14 @@ def test_determine_outlier_index_arrays(generated_Ih_table, outlier_target_table
     )
     assert list(outliers[0]) == [5, 6, 7, 8]
 
+    # The group-wise kernels should not depend on the number of threads
+    for method in ["standard", "simple"]:
+        expected = determine_outlier_index_arrays(generated_Ih_table, method)
+        outliers = determine_outlier_index_arrays(
+            generated_Ih_table, method, nthreads=3
+        )
+        assert list(outliers[0]) == list(expected[0])
+
     outliers = determine_outlier_index_arrays(generated_Ih_table, method=None)
     assert len(outliers) == 1
     assert not outliers[0]
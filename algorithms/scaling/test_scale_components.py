@@ -145,6 +145,28 @@ def test_SHScalefactor():
     assert jacobian_restraints[1] is not None
 
 
+def test_SHScalefactor_multiple_harmonics():
+    """Test the absorption scales from a table with several harmonics."""
+    parameters = flex.double([0.1, -0.2, 0.05, 0.3])
+    harmonic_values = sparse.matrix(4, 5)
+    for i in range(4):
+        for j in range(5):
+            if (i + j) % 2 == 0:
+                harmonic_values[i, j] = 0.1 * (i + 1) - 0.05 * j
+    SF = SHScaleComponent(parameters)
+    SF.data = {"sph_harm_table": harmonic_values}
+    SF.update_reflection_data()
+    s, d = SF.calculate_scales_and_derivatives()
+    for j in range(5):
+        expected = 1.0
+        for i in range(4):
+            expected += harmonic_values[i, j] * parameters[i]
+        assert s[j] == pytest.approx(expected)
+    assert list(SF.calculate_scales()) == list(s)
+    assert d.n_rows == 5
+    assert d.n_cols == 4
+
+
 def test_SmoothMixin():
     """Simple test for the Smooth Mixin class."""
     Smooth_mixin_class = SmoothMixin()
@@ -197,6 +219,67 @@ def test_SmoothScaleFactor1D():
     assert list(s) == list(s2)
 
 
+def test_SmoothScaleFactor1D_first_fixed_threaded():
+    """Test the threaded weights with the first parameter fixed."""
+    SF = SmoothScaleComponent1D(flex.double([1.0, 1.1, 0.9, 1.2, 1.0, 0.8, 1.3]))
+    SF.fix_initial_parameter()
+    SF.data = {"x": flex.double([i * 0.037 for i in range(150)])}
+    SF.update_reflection_data()
+    x = SF.normalised_values[0]
+    value, weight, sumweight = SF.smoother.multi_value_weight_first_fixed(
+        x, SF.value
+    )
+    assert weight.n_cols == SF.n_params - 1
+    for nthreads in (2, 5):
+        v, w, sw = SF.smoother.multi_value_weight_first_fixed(
+            x, SF.value, nthreads=nthreads
+        )
+        assert list(v) == list(value)
+        assert list(sw) == list(sumweight)
+        assert list(w.as_dense_matrix()) == list(weight.as_dense_matrix())
+    SF.nthreads = 3
+    s, d = SF.calculate_scales_and_derivatives()
+    assert list(s) == list(value)
+
+
+def test_smoother_cached_weights():
+    """Test the cached weights give the same values and weights as the
+    smoothers, for new parameter values."""
+    x = flex.double([i * 0.037 for i in range(150)])
+    y = flex.double([(i * 0.61) % 3.0 for i in range(150)])
+    z = flex.double([(i * 0.29) % 2.0 for i in range(150)])
+    components = [
+        (SmoothScaleComponent1D(flex.double(7, 1.0)), [x]),
+        (SmoothScaleComponent2D(flex.double(12, 1.0), shape=(4, 3)), [x, y]),
+        (SmoothScaleComponent3D(flex.double(24, 1.0), shape=(4, 3, 2)), [x, y, z]),
+    ]
+    for SF, coords in components:
+        SF.data = dict(zip("xyz", coords))
+        SF.nthreads = 3
+        SF.update_reflection_data()
+        # the normalised coordinates start from zero
+        coords = [c - flex.min(c) for c in coords]
+        weights = SF.smoother_weights()
+        assert weights is SF.smoother_weights()
+        assert weights.num_points() == 150
+        for i in range(3):
+            SF.parameters = flex.double(
+                [1.0 + 0.1 * ((i + j) % 4) for j in range(SF.n_params)]
+            )
+            value, weight, sumweight = SF.smoother.multi_value_weight(
+                *(coords + [SF.value])
+            )
+            assert list(weights.value(SF.value)) == list(value)
+            assert list(weights.sumweight()) == list(sumweight)
+            assert list(weights.weight().as_dense_matrix()) == list(
+                weight.as_dense_matrix()
+            )
+            s, d = SF.calculate_scales_and_derivatives()
+            assert list(s) == list(value)
+            assert list(SF.calculate_scales()) == list(value)
+            assert d.n_cols == SF.n_params
+
+
 def test_SmoothBScaleFactor1D():
     "test for a gaussian smoothed 1D scalefactor object"
     SF = SmoothBScaleComponent1D(flex.double(5, 0.0))
@@ -28,6 +28,9 @@
 from dials_scaling_ext import (
     calc_lookup_index,
     calc_theta_phi,
+    calculate_harmonic_scales,
+    calculate_harmonic_scales_from_selections,
+    calculate_harmonic_table_from_selections,
     calculate_harmonic_tables_from_selections,
     create_sph_harm_lookup_table,
     create_sph_harm_table,
@@ -299,6 +302,30 @@ def test_calculate_harmonic_tables_from_selections():
     assert mat[4, 1] == arrays[1][4]
 
 
+def test_calculate_harmonic_scales_from_selections():
+    s0_selection = flex.size_t([1, 0, 2, 3, 1])
+    s1_selection = flex.size_t([3, 2, 2, 0, 1])
+    coefficients = [flex.double([10, 11, 12, 13]), flex.double([20, 21, 22, 23])]
+    parameters = flex.double([0.1, -0.05])
+
+    arrays, expected = calculate_harmonic_tables_from_selections(
+        s0_selection, s1_selection, coefficients
+    )
+    mat = calculate_harmonic_table_from_selections(
+        s0_selection, s1_selection, coefficients
+    )
+    assert (mat.as_dense_matrix() == expected.as_dense_matrix()).all_eq(True)
+    scales = calculate_harmonic_scales(mat, parameters)
+    assert list(scales) == pytest.approx(
+        list(1.0 + arrays[0] * parameters[0] + arrays[1] * parameters[1])
+    )
+    assert list(
+        calculate_harmonic_scales_from_selections(
+            s0_selection, s1_selection, coefficients, parameters
+        )
+    ) == list(scales)
+
+
 def test_equality_of_two_harmonic_table_methods(dials_data):
     data_dir = dials_data("l_cysteine_dials_output")
     pickle_path = data_dir / "20_integrated.pickle"
@@ -460,3 +460,85 @@ def calculate_jacobian_fd(target, scaler, apm, block_id=0):
         for j in range(fin_difference.size()):
             jacobian[j, i] = fin_difference[j]
     return jacobian
+
+
+def test_sparse_dIh_by_dpi_and_jacobian_kernels():
+    """Compare the sparse kernels with a dense calculation."""
+    from dials_scaling_ext import calc_dIh_by_dpi, calc_jacobian
+
+    n_refl, n_groups, n_params = 40, 9, 6
+    group = [i % n_groups for i in range(n_refl)]
+    H = sparse.matrix(n_refl, n_groups)
+    for i, j in enumerate(group):
+        H[i, j] = 1.0
+    derivatives = sparse.matrix(n_params, n_refl)
+    for i in range(n_refl):
+        for j in range(n_params):
+            if (i + 2 * j) % 3 == 0:
+                derivatives[j, i] = 0.1 * (i + 1) - 0.3 * j
+    dIh = flex.double([0.5 + 0.01 * i for i in range(n_refl)])
+    sumgsq = flex.double([1.0 + 0.2 * i for i in range(n_groups)])
+    Ih = flex.double([2.0 - 0.03 * i for i in range(n_refl)])
+    g = flex.double([1.0 + 0.02 * i for i in range(n_refl)])
+
+    dIh_by_dpi = calc_dIh_by_dpi(dIh, sumgsq, H, derivatives)
+    jacobian = calc_jacobian(derivatives, H, Ih, g, dIh, sumgsq)
+    for i in range(n_groups):
+        for j in range(n_params):
+            expected = sum(
+                dIh[r] * derivatives[j, r] / sumgsq[i]
+                for r in range(n_refl)
+                if group[r] == i
+            )
+            assert dIh_by_dpi[i, j] == pytest.approx(expected)
+    for r in range(n_refl):
+        for j in range(n_params):
+            expected = -derivatives[j, r] * Ih[r] - g[r] * dIh_by_dpi[group[r], j]
+            assert jacobian[r, j] == pytest.approx(expected)
+
+    # The threaded kernels should give identical results
+    for nthreads in (2, 4):
+        threaded = calc_dIh_by_dpi(dIh, sumgsq, H, derivatives, nthreads=nthreads)
+        assert (threaded.as_dense_matrix() == dIh_by_dpi.as_dense_matrix()).all_eq(
+            True
+        )
+        threaded = calc_jacobian(derivatives, H, Ih, g, dIh, sumgsq, nthreads=nthreads)
+        assert (threaded.as_dense_matrix() == jacobian.as_dense_matrix()).all_eq(
+            True
+        )
+
+
+def test_Ih_values_and_scaling_gradient_kernels():
+    """Compare the Ih and gradient kernels with the flex calculation."""
+    from dials_scaling_ext import calc_Ih_values, calc_scaling_gradient
+
+    n_refl, n_groups, n_params = 40, 9, 6
+    H = sparse.matrix(n_refl, n_groups)
+    for i in range(n_refl):
+        H[i, i % n_groups] = 1.0
+    derivatives = sparse.matrix(n_refl, n_params)
+    for i in range(n_refl):
+        for j in range(n_params):
+            if (i + 2 * j) % 3 == 0:
+                derivatives[i, j] = 0.1 * (i + 1) - 0.3 * j
+    intensities = flex.double([10.0 + 0.7 * i for i in range(n_refl)])
+    weights = flex.double([1.0 / (1.0 + 0.05 * i) for i in range(n_refl)])
+    g = flex.double([1.0 + 0.02 * i for i in range(n_refl)])
+
+    sumgsq = (flex.pow2(g) * weights) * H
+    sumgI = ((g * intensities) * weights) * H
+    expected_Ih = (sumgI / sumgsq) * H.transpose()
+    Ih = calc_Ih_values(H, g, intensities, weights)
+    assert list(Ih) == list(expected_Ih)
+    assert list(calc_Ih_values(H, g, intensities, weights, nthreads=4)) == list(Ih)
+
+    prefactor = -2.0 * weights * (intensities - (Ih * g))
+    dIh = (intensities - (Ih * 2.0 * g)) * weights
+    group_factor = (prefactor * g * H) / sumgsq
+    expected = (prefactor * Ih) * derivatives + (dIh * (H * group_factor)) * derivatives
+    gradient = calc_scaling_gradient(H, derivatives, intensities, Ih, g, weights)
+    assert list(gradient) == pytest.approx(list(expected))
+    threaded = calc_scaling_gradient(
+        H, derivatives, intensities, Ih, g, weights, nthreads=3
+    )
+    assert list(threaded) == list(gradient)
@@ -0,0 +1,54 @@
+from __future__ import absolute_import, division, print_function
+
+import math
+
+from dials_algorithms_shadowing_ext import GoniometerShadowMasks
+
+__all__ = ["GoniometerShadowMasks", "goniometer_shadow_masks"]
+
+
+def goniometer_shadow_masks(masker, detector, angle0, step, num_angles, nproc=1):
+    """Project the goniometer shadow onto the detector at num_angles scan angles
+    from angle0 in steps of step (degrees), and rasterise the shadows.
+
+    :param masker: The goniometer shadow masker of the imageset
+    :param detector: The detector model
+    :param angle0: The first scan angle (degrees)
+    :param step: The step between the scan angles (degrees)
+    :param num_angles: The number of scan angles
+    :param nproc: The number of threads for the rasterisation
+    :returns: The GoniometerShadowMasks
+    """
+    masks = GoniometerShadowMasks(detector, angle0, step, num_angles)
+    for i in range(num_angles):
+        shadow = masker.project_extrema(detector, masks.angle(i))
+        for p_id in range(len(detector)):
+            if shadow[p_id].size() < 4:
+                continue
+            masks.set_polygon(i, p_id, shadow[p_id])
+    masks.rasterise(nthreads=nproc)
+    return masks
+
+
+def scan_shadow_masks(masker, detector, scan, step=None, nproc=1):
+    """The goniometer shadow masks over the scan. By default the shadow is
+    projected at the start of each image; with a larger step the shadows of the
+    images between the sampled angles are interpolated.
+
+    :param masker: The goniometer shadow masker of the imageset
+    :param detector: The detector model
+    :param scan: The scan model
+    :param step: The step between the projected angles (degrees)
+    :param nproc: The number of threads for the rasterisation
+    :returns: The GoniometerShadowMasks
+    """
+    start, end = scan.get_array_range()
+    angle0 = scan.get_angle_from_array_index(start)
+    oscillation = scan.get_oscillation()[1]
+    if step is None:
+        step = oscillation
+    num_images = max(end - start, 1)
+    num_angles = int(math.ceil((num_images - 1) * oscillation / step - 1e-6)) + 1
+    return goniometer_shadow_masks(
+        masker, detector, angle0, step, num_angles, nproc=nproc
+    )
@@ -0,0 +1,39 @@
+/*
+ * shadowing_ext.cc
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/shadowing/shadow_masks.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  BOOST_PYTHON_MODULE(dials_algorithms_shadowing_ext) {
+    class_<GoniometerShadowMasks>("GoniometerShadowMasks", no_init)
+      .def(init<const Detector &, double, double, std::size_t>(
+        (arg("detector"), arg("angle0"), arg("step"), arg("num_angles"))))
+      .def("num_angles", &GoniometerShadowMasks::num_angles)
+      .def("num_panels", &GoniometerShadowMasks::num_panels)
+      .def("angle", &GoniometerShadowMasks::angle)
+      .def("step", &GoniometerShadowMasks::step)
+      .def("set_polygon",
+           &GoniometerShadowMasks::set_polygon,
+           (arg("index"), arg("panel"), arg("polygon")))
+      .def("polygon", &GoniometerShadowMasks::polygon)
+      .def("rasterise", &GoniometerShadowMasks::rasterise, (arg("nthreads") = 1))
+      .def("is_rasterised", &GoniometerShadowMasks::is_rasterised)
+      .def("num_shadowed", &GoniometerShadowMasks::num_shadowed)
+      .def("mask", &GoniometerShadowMasks::mask, (arg("angle"), arg("panel")))
+      .def("is_shadowed",
+           &GoniometerShadowMasks::is_shadowed,
+           (arg("angle"), arg("panel"), arg("xy"), arg("nthreads") = 1))
+      .def("nbytes", &GoniometerShadowMasks::nbytes);
+  }
+
+}}}  // namespace dials::algorithms::boost_python
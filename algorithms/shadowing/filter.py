@@ -1,38 +1,57 @@
 from __future__ import absolute_import, division, print_function
 
 
-def filter_shadowed_reflections(experiments, reflections, experiment_goniometer=False):
-    from dxtbx.masking import is_inside_polygon
+def filter_shadowed_reflections(
+    experiments, reflections, experiment_goniometer=False, step=None, nproc=1
+):
+    """Find the reflections which are in the goniometer shadow.
+
+    The shadow is projected at the start of each image, or every step degrees
+    if a step is given and interpolated between, and each reflection is tested
+    against the shadow of the image containing its predicted centroid.
+
+    :param experiments: The experiments
+    :param reflections: The reflections
+    :param step: The step between the projected shadows (degrees)
+    :param nproc: The number of threads to use
+    :returns: True for the shadowed reflections
+    """
     from scitbx.array_family import flex
 
+    from dials.algorithms.shadowing import scan_shadow_masks
+
     shadowed = flex.bool(reflections.size(), False)
     for expt_id in range(len(experiments)):
         expt = experiments[expt_id]
         imageset = expt.imageset
         masker = imageset.masker()
+        if masker is None:
+            continue
         detector = expt.detector
-        sel = reflections["id"] == expt_id
-        isel = sel.iselection()
+        isel = (reflections["id"] == expt_id).iselection()
+        if len(isel) == 0:
+            continue
         x, y, z = reflections["xyzcal.px"].select(isel).parts()
+        panel = reflections["panel"].select(isel)
+        masks = scan_shadow_masks(masker, detector, expt.scan, step=step, nproc=nproc)
+
+        # Use the shadow at the start of the image of each reflection, as
+        # reflections outside the scan are never shadowed
         start, end = expt.scan.get_array_range()
-        for i in range(start, end):
-            shadow = masker.project_extrema(
-                detector, expt.scan.get_angle_from_array_index(i)
-            )
-            img_sel = (z >= i) & (z < (i + 1))
-            img_isel = img_sel.iselection()
-            for p_id in range(len(detector)):
-                panel = reflections["panel"].select(img_isel)
-                if shadow[p_id].size() < 4:
-                    continue
-                panel_isel = img_isel.select(panel == p_id)
-                inside = is_inside_polygon(
-                    shadow[p_id],
-                    flex.vec2_double(
-                        x.select(isel.select(panel_isel)),
-                        y.select(isel.select(panel_isel)),
-                    ),
-                )
-                shadowed.set_selected(panel_isel, inside)
+        frame = flex.floor(z)
+        inside = (frame >= start) & (frame < end)
+        angle = expt.scan.get_angle_from_array_index(start) + (
+            frame.select(inside) - start
+        ) * expt.scan.get_oscillation()[1]
+        sel = inside.iselection()
+        shadowed.set_selected(
+            isel.select(sel),
+            masks.is_shadowed(
+                angle,
+                panel.select(sel),
+                flex.vec2_double(x.select(sel), y.select(sel)),
+                nthreads=nproc,
+            ),
+        )
 
     return shadowed
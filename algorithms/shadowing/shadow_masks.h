@@ -0,0 +1,457 @@
+/*
+ * shadow_masks.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ALGORITHMS_SHADOWING_SHADOW_MASKS_H
+#define DIALS_ALGORITHMS_SHADOWING_SHADOW_MASKS_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <scitbx/vec2.h>
+#include <dxtbx/model/detector.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dxtbx::model::Detector;
+  using scitbx::vec2;
+
+  /**
+   * The shadowed pixels of a panel as runs of pixels along each row. The runs
+   * of row j are the pixels x0[k] to x1[k] - 1 for the runs row[j] to
+   * row[j + 1] - 1.
+   */
+  struct ShadowRuns {
+    af::shared<std::size_t> row;
+    af::shared<int> x0;
+    af::shared<int> x1;
+
+    ShadowRuns() {}
+
+    ShadowRuns(std::size_t height) : row(height + 1, 0) {}
+
+    /** @returns The number of shadowed pixels */
+    std::size_t num_pixels() const {
+      std::size_t count = 0;
+      for (std::size_t k = 0; k < x0.size(); ++k) {
+        count += x1[k] - x0[k];
+      }
+      return count;
+    }
+
+    /** @returns The number of bytes used */
+    std::size_t nbytes() const {
+      return row.capacity() * sizeof(std::size_t)
+             + (x0.capacity() + x1.capacity()) * sizeof(int);
+    }
+  };
+
+  namespace detail {
+
+    /**
+     * Test if a point is inside a polygon using the crossing number
+     */
+    inline bool inside_polygon(const af::const_ref<vec2<double> > &polygon,
+                               const vec2<double> &p) {
+      bool inside = false;
+      for (std::size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        const vec2<double> &a = polygon[i];
+        const vec2<double> &b = polygon[j];
+        if ((a[1] > p[1]) != (b[1] > p[1])
+            && p[0] < (b[0] - a[0]) * (p[1] - a[1]) / (b[1] - a[1]) + a[0]) {
+          inside = !inside;
+        }
+      }
+      return inside;
+    }
+
+    /**
+     * Rasterise a polygon into runs of the pixels whose centres are inside it
+     * @param polygon The polygon in pixel coordinates
+     * @param width The width of the panel
+     * @param height The height of the panel
+     * @returns The runs of shadowed pixels
+     */
+    inline ShadowRuns rasterise_polygon(const af::const_ref<vec2<double> > &polygon,
+                                        std::size_t width,
+                                        std::size_t height) {
+      ShadowRuns result(height);
+      std::vector<double> crossings;
+      for (std::size_t j = 0; j < height; ++j) {
+        double y = j + 0.5;
+        crossings.clear();
+        for (std::size_t i = 0, k = polygon.size() - 1; i < polygon.size(); k = i++) {
+          const vec2<double> &a = polygon[i];
+          const vec2<double> &b = polygon[k];
+          if ((a[1] > y) != (b[1] > y)) {
+            crossings.push_back(a[0] + (y - a[1]) * (b[0] - a[0]) / (b[1] - a[1]));
+          }
+        }
+        std::sort(crossings.begin(), crossings.end());
+        for (std::size_t k = 0; k + 1 < crossings.size(); k += 2) {
+          double c0 = std::min(std::max(crossings[k] - 0.5, -1.0), (double)width);
+          double c1 = std::min(std::max(crossings[k + 1] - 0.5, -1.0), (double)width);
+          int x0 = std::max((int)std::ceil(c0), 0);
+          int x1 = std::min((int)std::ceil(c1), (int)width);
+          if (x1 > x0) {
+            if (result.x1.size() > result.row[j] && result.x1.back() >= x0) {
+              result.x1.back() = std::max(result.x1.back(), x1);
+            } else {
+              result.x0.push_back(x0);
+              result.x1.push_back(x1);
+            }
+          }
+        }
+        result.row[j + 1] = result.x0.size();
+      }
+      return result;
+    }
+
+    /**
+     * Rasterise a band of the (angle, panel) shadow polygons
+     */
+    struct RasteriseShadowBand {
+      const std::vector<af::shared<vec2<double> > > &polygons;
+      const std::vector<vec2<std::size_t> > &image_size;
+      std::vector<ShadowRuns> &runs;
+
+      RasteriseShadowBand(const std::vector<af::shared<vec2<double> > > &polygons_,
+                          const std::vector<vec2<std::size_t> > &image_size_,
+                          std::vector<ShadowRuns> &runs_)
+          : polygons(polygons_), image_size(image_size_), runs(runs_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          const vec2<std::size_t> &size = image_size[i % image_size.size()];
+          if (polygons[i].size() < 3) {
+            runs[i] = ShadowRuns(size[1]);
+          } else {
+            runs[i] = rasterise_polygon(polygons[i].const_ref(), size[0], size[1]);
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * The goniometer shadow on each panel of a detector at a list of scan angles
+   * spaced by a fixed step. The shadow polygons of each angle are given (by
+   * the goniometer masker) and are rasterised once into runs of shadowed
+   * pixels along each row of each panel, so the shadow mask of any image can
+   * be made without projecting the goniometer again. Between the sampled
+   * angles the ends of the runs of a row are interpolated when both angles
+   * have the same number of runs in the row; otherwise the union of the runs
+   * is used, so the shadow is never missed.
+   */
+  class GoniometerShadowMasks {
+  public:
+    /**
+     * @param detector The detector model
+     * @param angle0 The first scan angle (degrees)
+     * @param step The step between the scan angles (degrees)
+     * @param num_angles The number of scan angles
+     */
+    GoniometerShadowMasks(const Detector &detector,
+                          double angle0,
+                          double step,
+                          std::size_t num_angles)
+        : angle0_(angle0),
+          step_(step),
+          num_angles_(num_angles),
+          rasterised_(false) {
+      DIALS_ASSERT(step > 0);
+      DIALS_ASSERT(num_angles > 0);
+      DIALS_ASSERT(detector.size() > 0);
+      for (std::size_t p = 0; p < detector.size(); ++p) {
+        image_size_.push_back(detector[p].get_image_size());
+      }
+      polygons_.resize(num_angles * image_size_.size());
+      runs_.resize(num_angles * image_size_.size());
+    }
+
+    /** @returns The number of scan angles */
+    std::size_t num_angles() const {
+      return num_angles_;
+    }
+
+    /** @returns The number of panels */
+    std::size_t num_panels() const {
+      return image_size_.size();
+    }
+
+    /** @returns The scan angle i (degrees) */
+    double angle(std::size_t i) const {
+      DIALS_ASSERT(i < num_angles_);
+      return angle0_ + i * step_;
+    }
+
+    /** @returns The step between the scan angles (degrees) */
+    double step() const {
+      return step_;
+    }
+
+    /**
+     * Set the shadow polygon of a panel at scan angle i
+     * @param i The scan angle index
+     * @param panel The panel
+     * @param polygon The polygon in pixel coordinates
+     */
+    void set_polygon(std::size_t i,
+                     std::size_t panel,
+                     const af::const_ref<vec2<double> > &polygon) {
+      polygons_[index(i, panel)] = af::shared<vec2<double> >(polygon.begin(),
+                                                             polygon.end());
+      rasterised_ = false;
+    }
+
+    /** @returns The shadow polygon of a panel at scan angle i */
+    af::shared<vec2<double> > polygon(std::size_t i, std::size_t panel) const {
+      return polygons_[index(i, panel)];
+    }
+
+    /**
+     * Rasterise the shadow polygons into runs of shadowed pixels
+     * @param nthreads The number of threads to use
+     */
+    void rasterise(std::size_t nthreads = 1) {
+      for_each_band(detail::RasteriseShadowBand(polygons_, image_size_, runs_),
+                    (int)runs_.size(),
+                    nthreads);
+      rasterised_ = true;
+    }
+
+    /** @returns Have the polygons been rasterised */
+    bool is_rasterised() const {
+      return rasterised_;
+    }
+
+    /** @returns The number of pixels of a panel shadowed at scan angle i */
+    std::size_t num_shadowed(std::size_t i, std::size_t panel) const {
+      DIALS_ASSERT(rasterised_);
+      return runs_[index(i, panel)].num_pixels();
+    }
+
+    /**
+     * Get the mask of a panel at a scan angle, interpolated between the
+     * nearest sampled angles. Angles outside the sampled range use the
+     * nearest end.
+     * @param angle The scan angle (degrees)
+     * @param panel The panel
+     * @returns The mask, which is false for shadowed pixels
+     */
+    af::versa<bool, af::c_grid<2> > mask(double angle, std::size_t panel) const {
+      DIALS_ASSERT(rasterised_);
+      DIALS_ASSERT(panel < num_panels());
+      std::size_t width = image_size_[panel][0];
+      std::size_t height = image_size_[panel][1];
+      af::versa<bool, af::c_grid<2> > result(af::c_grid<2>(height, width), true);
+      std::vector<int> x0, x1;
+      for (std::size_t j = 0; j < height; ++j) {
+        row_runs(angle, panel, j, x0, x1);
+        for (std::size_t k = 0; k < x0.size(); ++k) {
+          for (int i = x0[k]; i < x1[k]; ++i) {
+            result(j, i) = false;
+          }
+        }
+      }
+      return result;
+    }
+
+    /**
+     * Test if points are shadowed. At the sampled angles the points are
+     * tested against the shadow polygons themselves; between them, against
+     * the interpolated runs of shadowed pixels.
+     * @param angle The scan angle of each point (degrees)
+     * @param panel The panel of each point
+     * @param xy The pixel coordinate of each point
+     * @param nthreads The number of threads to use
+     * @returns True for the points which are shadowed
+     */
+    af::shared<bool> is_shadowed(const af::const_ref<double> &angle,
+                                 const af::const_ref<std::size_t> &panel,
+                                 const af::const_ref<vec2<double> > &xy,
+                                 std::size_t nthreads = 1) const {
+      DIALS_ASSERT(rasterised_);
+      DIALS_ASSERT(angle.size() == xy.size());
+      DIALS_ASSERT(panel.size() == xy.size());
+      af::shared<bool> result(xy.size(), false);
+      for_each_band(ShadowedBand(*this, angle, panel, xy, result.ref()),
+                    (int)xy.size(),
+                    nthreads);
+      return result;
+    }
+
+    /** @returns The number of bytes used by the polygons and runs */
+    std::size_t nbytes() const {
+      std::size_t result = 0;
+      for (std::size_t i = 0; i < runs_.size(); ++i) {
+        result += runs_[i].nbytes();
+        result += polygons_[i].capacity() * sizeof(vec2<double>);
+      }
+      return result;
+    }
+
+  private:
+    struct ShadowedBand;
+    friend struct ShadowedBand;
+
+    /**
+     * Test a band of points for shadowing
+     */
+    struct ShadowedBand {
+      const GoniometerShadowMasks &masks;
+      af::const_ref<double> angle;
+      af::const_ref<std::size_t> panel;
+      af::const_ref<vec2<double> > xy;
+      af::ref<bool> result;
+
+      ShadowedBand(const GoniometerShadowMasks &masks_,
+                   const af::const_ref<double> &angle_,
+                   const af::const_ref<std::size_t> &panel_,
+                   const af::const_ref<vec2<double> > &xy_,
+                   af::ref<bool> result_)
+          : masks(masks_), angle(angle_), panel(panel_), xy(xy_), result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        std::vector<int> x0, x1;
+        for (int i = i0; i < i1; ++i) {
+          result[i] = masks.point_is_shadowed(angle[i], panel[i], xy[i], x0, x1);
+        }
+      }
+    };
+
+    std::size_t index(std::size_t i, std::size_t panel) const {
+      DIALS_ASSERT(i < num_angles_);
+      DIALS_ASSERT(panel < num_panels());
+      return i * num_panels() + panel;
+    }
+
+    /**
+     * Find the sampled angle below a scan angle and the fraction of the step
+     * to the next, clamping to the sampled range
+     */
+    void bracket(double angle, std::size_t &k, double &w) const {
+      double t = (angle - angle0_) / step_;
+      double eps = 1e-9;
+      if (t <= eps || num_angles_ == 1) {
+        k = 0;
+        w = 0;
+      } else if (t >= num_angles_ - 1 - eps) {
+        k = num_angles_ - 1;
+        w = 0;
+      } else {
+        k = (std::size_t)std::floor(t + eps);
+        w = std::max(t - k, 0.0);
+        if (w < eps) {
+          w = 0;
+        }
+      }
+    }
+
+    /**
+     * Get the runs of shadowed pixels of a row at a scan angle
+     */
+    void row_runs(double angle,
+                  std::size_t panel,
+                  std::size_t j,
+                  std::vector<int> &x0,
+                  std::vector<int> &x1) const {
+      std::size_t k;
+      double w;
+      bracket(angle, k, w);
+      x0.clear();
+      x1.clear();
+      const ShadowRuns &a = runs_[index(k, panel)];
+      if (w == 0) {
+        for (std::size_t n = a.row[j]; n < a.row[j + 1]; ++n) {
+          x0.push_back(a.x0[n]);
+          x1.push_back(a.x1[n]);
+        }
+        return;
+      }
+      const ShadowRuns &b = runs_[index(k + 1, panel)];
+      std::size_t na = a.row[j + 1] - a.row[j];
+      std::size_t nb = b.row[j + 1] - b.row[j];
+      if (na == nb) {
+        for (std::size_t n = 0; n < na; ++n) {
+          std::size_t ia = a.row[j] + n;
+          std::size_t ib = b.row[j] + n;
+          int r0 = (int)std::floor((1 - w) * a.x0[ia] + w * b.x0[ib] + 0.5);
+          int r1 = (int)std::floor((1 - w) * a.x1[ia] + w * b.x1[ib] + 0.5);
+          if (r1 > r0) {
+            x0.push_back(r0);
+            x1.push_back(r1);
+          }
+        }
+        return;
+      }
+
+      // Merge the runs of both angles into their union
+      std::size_t ia = a.row[j];
+      std::size_t ib = b.row[j];
+      while (ia < a.row[j + 1] || ib < b.row[j + 1]) {
+        int r0, r1;
+        if (ib >= b.row[j + 1] || (ia < a.row[j + 1] && a.x0[ia] <= b.x0[ib])) {
+          r0 = a.x0[ia];
+          r1 = a.x1[ia];
+          ++ia;
+        } else {
+          r0 = b.x0[ib];
+          r1 = b.x1[ib];
+          ++ib;
+        }
+        if (x1.size() > 0 && x1.back() >= r0) {
+          x1.back() = std::max(x1.back(), r1);
+        } else {
+          x0.push_back(r0);
+          x1.push_back(r1);
+        }
+      }
+    }
+
+    bool point_is_shadowed(double angle,
+                           std::size_t panel,
+                           const vec2<double> &xy,
+                           std::vector<int> &x0,
+                           std::vector<int> &x1) const {
+      DIALS_ASSERT(panel < num_panels());
+      std::size_t k;
+      double w;
+      bracket(angle, k, w);
+      if (w == 0) {
+        const af::shared<vec2<double> > &polygon = polygons_[index(k, panel)];
+        return polygon.size() >= 3 && detail::inside_polygon(polygon.const_ref(), xy);
+      }
+      if (xy[1] < 0 || xy[1] >= image_size_[panel][1]) {
+        return false;
+      }
+      row_runs(angle, panel, (std::size_t)xy[1], x0, x1);
+      for (std::size_t n = 0; n < x0.size(); ++n) {
+        if (xy[0] >= x0[n] && xy[0] < x1[n]) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    double angle0_;
+    double step_;
+    std::size_t num_angles_;
+    bool rasterised_;
+    std::vector<vec2<std::size_t> > image_size_;
+    std::vector<af::shared<vec2<double> > > polygons_;
+    std::vector<ShadowRuns> runs_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SHADOWING_SHADOW_MASKS_H
@@ -13,6 +13,7 @@
 #include <boost/python/iterator.hpp>
 #include <boost_adaptbx/std_pair_conversion.h>
 #include <dials/algorithms/shoebox/find_overlapping.h>
+#include <dials/algorithms/shoebox/overlap_index.h>
 
 namespace dials { namespace algorithms { namespace shoebox { namespace boost_python {
 
@@ -23,6 +24,16 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
     def("find_overlapping", &find_overlapping_multi_panel, (arg("bbox"), arg("panel")));
 
     class_<OverlapFinder>("OverlapFinder").def("__call__", &OverlapFinder::operator());
+
+    af::shared<std::size_t> (OverlapIndex::*find)(std::size_t) const =
+      &OverlapIndex::find;
+
+    class_<OverlapIndex>("OverlapIndex", no_init)
+      .def(init<const af::const_ref<int6> &, const af::const_ref<std::size_t> &>(
+        (arg("bbox"), arg("panel"))))
+      .def("__len__", &OverlapIndex::size)
+      .def("find", find, (arg("index")))
+      .def("adjacency_list", &OverlapIndex::adjacency_list);
   }
 
 }}}}  // namespace dials::algorithms::shoebox::boost_python
@@ -19,7 +19,9 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
   void export_mask_empirical() {
     class_<MaskEmpirical>("MaskEmpirical", no_init)
       .def(init<const af::reflection_table&>((arg("reference"))))
-      .def("__call__", &MaskEmpirical::mask);
+      .def("__call__",
+           &MaskEmpirical::mask,
+           (arg("reflections"), arg("nthreads") = 1));
   }
 
 }}}}  // namespace dials::algorithms::shoebox::boost_python
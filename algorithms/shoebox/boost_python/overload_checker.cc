@@ -21,6 +21,19 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
     class_<OverloadChecker>("OverloadChecker")
       .def("add", &OverloadChecker::add)
       .def("__call__", &OverloadChecker::operator());
+
+    class_<OverloadBitmap>("OverloadBitmap")
+      .def(init<const af::const_ref<double, af::c_grid<2> > &, double>(
+        (arg("data"), arg("overload"))))
+      .def("set",
+           &OverloadBitmap::set<double>,
+           (arg("data"), arg("overload")))
+      .def("ysize", &OverloadBitmap::ysize)
+      .def("xsize", &OverloadBitmap::xsize)
+      .def("num_overloaded", &OverloadBitmap::num_overloaded)
+      .def("count",
+           &OverloadBitmap::count,
+           (arg("x0"), arg("x1"), arg("y0"), arg("y1")));
   }
 
 }}}}  // namespace dials::algorithms::shoebox::boost_python
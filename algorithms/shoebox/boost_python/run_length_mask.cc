@@ -0,0 +1,36 @@
+/*
+ * run_length_mask.cc
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/shoebox/run_length_mask.h>
+
+namespace dials { namespace algorithms { namespace shoebox { namespace boost_python {
+
+  using namespace boost::python;
+
+  void export_run_length_mask() {
+    af::versa<bool, af::c_grid<2> > (RunLengthMask::*expand_all)() const =
+      &RunLengthMask::expand;
+    af::versa<bool, af::c_grid<2> > (RunLengthMask::*expand_region)(int, int, int, int)
+      const = &RunLengthMask::expand;
+
+    class_<RunLengthMask>("RunLengthMask")
+      .def(init<const af::const_ref<bool, af::c_grid<2> > &>((arg("mask"))))
+      .def("ysize", &RunLengthMask::ysize)
+      .def("xsize", &RunLengthMask::xsize)
+      .def("num_runs", &RunLengthMask::num_runs)
+      .def("num_masked", &RunLengthMask::num_masked)
+      .def("nbytes", &RunLengthMask::nbytes)
+      .def("expand", expand_all)
+      .def("expand", expand_region, (arg("x0"), arg("x1"), arg("y0"), arg("y1")))
+      .def("__eq__", &RunLengthMask::operator==)
+      .def("__ne__", &RunLengthMask::operator!=);
+  }
+
+}}}}  // namespace dials::algorithms::shoebox::boost_python
@@ -21,6 +21,7 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
   void export_mask_overlapping();
   void export_mask_builder();
   void export_overload_checker();
+  void export_run_length_mask();
 
   BOOST_PYTHON_MODULE(dials_algorithms_shoebox_ext) {
     export_mask_code();
@@ -29,6 +30,7 @@ namespace dials { namespace algorithms { namespace shoebox { namespace boost_pyt
     export_mask_overlapping();
     export_mask_builder();
     export_overload_checker();
+    export_run_length_mask();
   }
 
 }}}}  // namespace dials::algorithms::shoebox::boost_python
@@ -13,10 +13,11 @@
 
 #include <vector>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/adjacency_list.h>
-#include <dials/algorithms/spatial_indexing/detect_collisions.h>
+#include <dials/algorithms/spatial_indexing/detect_collisions_parallel.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -60,6 +61,35 @@ namespace dials { namespace algorithms { namespace shoebox {
   using dials::model::AdjacencyList;
   using scitbx::af::int6;
 
+  namespace detail {
+
+    /**
+     * The number of bounding boxes above which the collision detection is
+     * split between threads. Below this the cost of starting the threads is
+     * comparable to the time taken.
+     */
+    const std::size_t parallel_collision_threshold = 50000;
+
+    /**
+     * Detect the collisions between bounding boxes, using all the hardware
+     * threads if there are enough boxes.
+     * @param first The first bounding box
+     * @param last The last bounding box
+     * @param collisions The list of collisions
+     */
+    template <typename Iterator>
+    void detect_collisions(Iterator first,
+                           Iterator last,
+                           std::vector<std::pair<int, int> > &collisions) {
+      std::size_t num_threads = 1;
+      if (std::size_t(last - first) > parallel_collision_threshold) {
+        num_threads = std::max(boost::thread::hardware_concurrency(), 1U);
+      }
+      detect_collisions3d(first, last, collisions, num_threads);
+    }
+
+  }  // namespace detail
+
   /**
    * Given a set of reflections, find the bounding_boxes that overlap.
    * This function uses a single shot collision detection algorithm to
@@ -75,7 +105,7 @@ namespace dials { namespace algorithms { namespace shoebox {
 
     // Create a list of all the pairs of collisions between bouding boxes.
     std::vector<std::pair<int, int> > collisions;
-    detect_collisions3d(bboxes.begin(), bboxes.end(), collisions);
+    detail::detect_collisions(bboxes.begin(), bboxes.end(), collisions);
 
     // Put all the collisions into an adjacency list
     AdjacencyList list(bboxes.size());
@@ -149,7 +179,7 @@ namespace dials { namespace algorithms { namespace shoebox {
       std::vector<std::pair<int, int> > collisions;
 
       // Detect the collisions
-      detect_collisions3d(data.begin() + d0, data.begin() + d1, collisions);
+      detail::detect_collisions(data.begin() + d0, data.begin() + d1, collisions);
 
       // Put all the collisions into an adjacency list
       for (std::size_t i = 0; i < collisions.size(); ++i) {
@@ -222,7 +252,7 @@ namespace dials { namespace algorithms { namespace shoebox {
         std::vector<std::pair<int, int> > collisions;
 
         // Detect the collisions
-        detect_collisions3d(data.begin() + d0, data.begin() + d1, collisions);
+        detail::detect_collisions(data.begin() + d0, data.begin() + d1, collisions);
 
         // Put all the collisions into an adjacency list
         for (std::size_t i = 0; i < collisions.size(); ++i) {
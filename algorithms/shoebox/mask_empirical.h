@@ -15,6 +15,7 @@
 #include <scitbx/vec3.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/algorithms/shoebox/mask_code.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/array_family/reflection_table.h>
 #include <annlib_adaptbx/ann_adaptor.h>
 #include <dials/error.h>
@@ -28,6 +29,105 @@ namespace dials { namespace algorithms { namespace shoebox {
   using scitbx::vec3;
   using scitbx::af::int6;
 
+  namespace detail {
+
+    /**
+     * Mask a query reflection from the union of the masks of its nearest
+     * reference reflections
+     * @param table_shoebox The shoebox of the query reflection
+     * @param reference_shoeboxes The shoeboxes of the reference reflections
+     * @param nn The indices of the nearest reference reflections
+     */
+    inline void mask_empirical_reflection(Shoebox<> &table_shoebox,
+                                          af::const_ref<Shoebox<> > reference_shoeboxes,
+                                          af::const_ref<int> nn) {
+      af::ref<int, af::c_grid<3> > table_mask = table_shoebox.mask.ref();
+      int6 table_bbox = table_shoebox.bbox;
+      int tblx1 = table_bbox[0];
+      int tbly1 = table_bbox[2];
+      int tblz1 = table_bbox[4];
+      int tblx2 = table_bbox[1];
+      int tbly2 = table_bbox[3];
+      int tblz2 = table_bbox[5];
+
+      // Calculate the midpoint of the query reflection.  Center the union of the
+      // reference masks around this point
+      int tmid_x = boost::math::iround((tblx2 - tblx1) / 2);
+      int tmid_y = boost::math::iround((tbly2 - tbly1) / 2);
+      int tmid_z = boost::math::iround((tblz2 - tblz1) / 2);
+
+      // Iterate over the nearest bright neigbors of this query reflection
+      for (std::size_t nn_iter = 0; nn_iter < nn.size(); ++nn_iter) {
+        const Shoebox<> &reference_shoebox = reference_shoeboxes[nn[nn_iter]];
+        af::const_ref<int, af::c_grid<3> > reference_mask =
+          reference_shoebox.mask.const_ref();
+        int6 bbox_nn = reference_shoebox.bbox;
+        int nnx1 = bbox_nn[0];
+        int nny1 = bbox_nn[2];
+        int nnz1 = bbox_nn[4];
+        int nnx2 = bbox_nn[1];
+        int nny2 = bbox_nn[3];
+        int nnz2 = bbox_nn[5];
+
+        // Calculate the midpoint of the reference reflection.  Center the union of
+        // this reflection's mask on the query reflection around this point
+        int rmid_x = boost::math::iround((nnx2 - nnx1) / 2);
+        int rmid_y = boost::math::iround((nny2 - nny1) / 2);
+        int rmid_z = boost::math::iround((nnz2 - nnz1) / 2);
+
+        // Union this reflection's mask with the query reflection
+        for (std::size_t z = 0; z < nnz2 - nnz1; z++) {
+          for (std::size_t y = 0; y < nny2 - nny1; y++) {
+            for (std::size_t x = 0; x < nnx2 - nnx1; x++) {
+              table_mask(
+                tmid_z - rmid_z + z, tmid_y - rmid_y + y, tmid_x - rmid_x + x) |=
+                reference_mask(z, y, x);
+            }
+          }
+        }
+      }
+
+      // Finally, need to explicitly set the background flags for the rest of the
+      // pixels as they are not set by spotfinder in the reference set
+      for (std::size_t z = 0; z < tblz2 - tblz1; z++)
+        for (std::size_t y = 0; y < tbly2 - tbly1; y++)
+          for (std::size_t x = 0; x < tblx2 - tblx1; x++)
+            if ((table_mask(z, y, x) & Foreground) != Foreground)
+              table_mask(z, y, x) |= Background;
+    }
+
+    /**
+     * Mask a band of query reflections. Each query reflection only writes to
+     * its own mask and the reference shoeboxes are only read, so the bands
+     * can be masked in parallel.
+     */
+    struct MaskEmpiricalBand {
+      af::ref<Shoebox<> > table_shoeboxes;
+      af::const_ref<Shoebox<> > reference_shoeboxes;
+      af::const_ref<int> nn;
+      std::size_t nn_window;
+
+      MaskEmpiricalBand(af::ref<Shoebox<> > table_shoeboxes_,
+                        af::const_ref<Shoebox<> > reference_shoeboxes_,
+                        af::const_ref<int> nn_,
+                        std::size_t nn_window_)
+          : table_shoeboxes(table_shoeboxes_),
+            reference_shoeboxes(reference_shoeboxes_),
+            nn(nn_),
+            nn_window(nn_window_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          mask_empirical_reflection(
+            table_shoeboxes[i],
+            reference_shoeboxes,
+            af::const_ref<int>(&nn[i * nn_window], nn_window));
+        }
+      }
+    };
+
+  }  // namespace detail
+
   /**
    * A class to mask foreground/background using an empirical approach pixels
    */
@@ -44,8 +144,9 @@ namespace dials { namespace algorithms { namespace shoebox {
      * Set all the foreground/background pixels in the shoebox mask by looking at the
      * nearest bright spots
      * @param table Reflection table with a shoebox array and a bbox array for masking
+     * @param nthreads The number of threads to use
      */
-    void mask(af::reflection_table &table) {
+    void mask(af::reflection_table &table, std::size_t nthreads = 1) {
       // Convert the reference xyz mm values to a single array for AnnAdaptor, instead
       // of a vec3 double array
       af::shared<vec3<double> > reference_xyz_mm;
@@ -82,63 +183,13 @@ namespace dials { namespace algorithms { namespace shoebox {
       af::shared<Shoebox<> > table_shoeboxes = table.get<Shoebox<> >("shoebox");
 
       // Generate the mask for each query reflection
-      for (std::size_t query_iter = 0; query_iter < table.size(); ++query_iter) {
-        Shoebox<> table_shoebox = table_shoeboxes[query_iter];
-        af::ref<int, af::c_grid<3> > table_mask = table_shoebox.mask.ref();
-        int6 table_bbox = table_shoebox.bbox;
-        int tblx1 = table_bbox[0];
-        int tbly1 = table_bbox[2];
-        int tblz1 = table_bbox[4];
-        int tblx2 = table_bbox[1];
-        int tbly2 = table_bbox[3];
-        int tblz2 = table_bbox[5];
-
-        // Calculate the midpoint of the query reflection.  Center the union of the
-        // reference masks around this point
-        int tmid_x = boost::math::iround((tblx2 - tblx1) / 2);
-        int tmid_y = boost::math::iround((tbly2 - tbly1) / 2);
-        int tmid_z = boost::math::iround((tblz2 - tblz1) / 2);
-
-        // Iterate over the nearest bright neigbors of this query reflection
-        for (std::size_t nn_iter = query_iter * nn_window;
-             nn_iter < (query_iter * nn_window) + nn_window;
-             ++nn_iter) {
-          Shoebox<> reference_shoebox = reference_shoeboxes[A.nn[nn_iter]];
-          af::ref<int, af::c_grid<3> > reference_mask = reference_shoebox.mask.ref();
-          int6 bbox_nn = reference_shoebox.bbox;
-          int nnx1 = bbox_nn[0];
-          int nny1 = bbox_nn[2];
-          int nnz1 = bbox_nn[4];
-          int nnx2 = bbox_nn[1];
-          int nny2 = bbox_nn[3];
-          int nnz2 = bbox_nn[5];
-
-          // Calculate the midpoint of the reference reflection.  Center the union of
-          // this reflection's mask on the query reflection around this point
-          int rmid_x = boost::math::iround((nnx2 - nnx1) / 2);
-          int rmid_y = boost::math::iround((nny2 - nny1) / 2);
-          int rmid_z = boost::math::iround((nnz2 - nnz1) / 2);
-
-          // Union this reflection's mask with the query reflection
-          for (std::size_t z = 0; z < nnz2 - nnz1; z++) {
-            for (std::size_t y = 0; y < nny2 - nny1; y++) {
-              for (std::size_t x = 0; x < nnx2 - nnx1; x++) {
-                table_mask(
-                  tmid_z - rmid_z + z, tmid_y - rmid_y + y, tmid_x - rmid_x + x) |=
-                  reference_mask(z, y, x);
-              }
-            }
-          }
-        }
-
-        // Finally, need to explicitly set the background flags for the rest of the
-        // pixels as they are not set by spotfinder in the reference set
-        for (std::size_t z = 0; z < tblz2 - tblz1; z++)
-          for (std::size_t y = 0; y < tbly2 - tbly1; y++)
-            for (std::size_t x = 0; x < tblx2 - tblx1; x++)
-              if ((table_mask(z, y, x) & Foreground) != Foreground)
-                table_mask(z, y, x) |= Background;
-      }
+      af::shared<int> nn(A.nn.begin(), A.nn.end());
+      DIALS_ASSERT(nn.size() == table.size() * nn_window);
+      detail::MaskEmpiricalBand band(table_shoeboxes.ref(),
+                                     reference_shoeboxes.const_ref(),
+                                     nn.const_ref(),
+                                     nn_window);
+      for_each_band(band, (int)table.size(), nthreads);
     }
 
   private:
@@ -15,6 +15,7 @@
 #include <scitbx/array_family/tiny_types.h>
 #include <dials/model/data/adjacency_list.h>
 #include <dials/algorithms/shoebox/mask_code.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms { namespace shoebox {
@@ -25,6 +26,33 @@ namespace dials { namespace algorithms { namespace shoebox {
   using scitbx::af::int3;
   using scitbx::af::int6;
 
+  class MaskOverlapping;
+
+  namespace detail {
+
+    /**
+     * Assign the ownership of the pixels of a band of reflections
+     */
+    struct MaskOverlappingBand {
+      const MaskOverlapping &masker;
+      af::ref<Shoebox<> > shoeboxes;
+      const af::const_ref<vec3<double> > &coords;
+      const AdjacencyList &adjacency_list;
+
+      MaskOverlappingBand(const MaskOverlapping &masker_,
+                          af::ref<Shoebox<> > shoeboxes_,
+                          const af::const_ref<vec3<double> > &coords_,
+                          const AdjacencyList &adjacency_list_)
+          : masker(masker_),
+            shoeboxes(shoeboxes_),
+            coords(coords_),
+            adjacency_list(adjacency_list_) {}
+
+      void operator()(int i0, int i1) const;
+    };
+
+  }  // namespace detail
+
   /** Class to calculate the shoebox masks for all reflections */
   class MaskOverlapping {
   public:
@@ -46,79 +74,82 @@ namespace dials { namespace algorithms { namespace shoebox {
      * reflection whose predicted central location is closer to the pixel
      * will gain ownership of the pixel (mask value 1).
      *
+     * Each reflection only loses the pixels of its own mask, comparing with
+     * all its neighbours, so the reflections are split into bands which are
+     * masked in parallel. A pixel equidistant from two reflections belongs
+     * to the reflection with the higher index.
+     *
      * @param shoeboxes The list of shoeboxes
      * @param coords The pixel coordinate
      * @param adjacency_list The adjacency_list
+     * @param nthreads The number of threads to use
      */
     void operator()(af::ref<Shoebox<> > shoeboxes,
                     const af::const_ref<vec3<double> > &coords,
-                    const boost::shared_ptr<AdjacencyList> &adjacency_list) const {
-      // Loop through all the reflections
+                    const boost::shared_ptr<AdjacencyList> &adjacency_list,
+                    std::size_t nthreads = 1) const {
       if (adjacency_list) {
-        for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
-          // Get a reference to the reflection
-          Shoebox<> &s = shoeboxes[i];
-          vec3<double> c = coords[i];
-
-          // Get the list of overlapping shoeboxes
-          edge_iterator_range range = adjacency_list->edges(i);
-          for (edge_iterator it = range.first; it != range.second; ++it) {
-            std::size_t index1 = it->first;
-            std::size_t index2 = it->second;
-            DIALS_ASSERT(index1 == i);
-            if (index1 < index2) {
-              assign_ownership(s, c, shoeboxes[index2], coords[index2]);
-            }
-          }
-        }
+        DIALS_ASSERT(coords.size() == shoeboxes.size());
+        DIALS_ASSERT(adjacency_list->num_vertices() == shoeboxes.size());
+        for_each_band(
+          detail::MaskOverlappingBand(*this, shoeboxes, coords, *adjacency_list),
+          (int)shoeboxes.size(),
+          nthreads);
       }
     }
 
-  private:
-    /**
-     * The distance between two points
-     * @param a Point a
-     * @param b Point b
-     * @returns The distance from a to b
-     */
-    double distance(vec3<double> a, vec3<double> b) const {
-      return (b - a).length_sq();
-    }
-
     /**
-     * Get a coordinate from the voxel.
-     * @param i The voxel x index
-     * @param j The voxel y index
-     * @param k THe voxel z index
-     * @returns An (x, y, z) coordinate
+     * Remove the pixels of one reflection which are closer to any of the
+     * reflections it overlaps
+     * @param shoeboxes The list of shoeboxes
+     * @param coords The pixel coordinate
+     * @param adjacency_list The adjacency_list
+     * @param index The reflection to mask
      */
-    vec3<double> voxel_coord(double i, double j, double k) const {
-      return vec3<double>(i + 0.5, j + 0.5, k + 0.5);
+    void mask_reflection(af::ref<Shoebox<> > shoeboxes,
+                         const af::const_ref<vec3<double> > &coords,
+                         const AdjacencyList &adjacency_list,
+                         std::size_t index) const {
+      edge_iterator_range range = adjacency_list.edges(index);
+      for (edge_iterator it = range.first; it != range.second; ++it) {
+        std::size_t index1 = it->first;
+        std::size_t index2 = it->second;
+        DIALS_ASSERT(index1 == index);
+        DIALS_ASSERT(index2 < shoeboxes.size());
+        if (index1 != index2) {
+          remove_pixels(shoeboxes[index1],
+                        coords[index1],
+                        shoeboxes[index2].bbox,
+                        coords[index2],
+                        index1 > index2);
+        }
+      }
     }
 
+  private:
     /**
-     * Assign ownership of all the pixels in the overlapping range.
+     * Remove the pixels in the overlapping range which belong to another
+     * reflection.
      * @param a Shoebox a
      * @param coord_a The coordinate of a
-     * @param b Shoebox b
+     * @param bbox_b The bounding box of b
      * @param coord_b The coordinate of b
+     * @param a_owns_ties True/False a owns pixels equidistant from a and b
      * @throws RuntimeError if reflections to do overlap.
      */
-    void assign_ownership(Shoebox<> &a,
-                          vec3<double> coord_a,
-                          Shoebox<> &b,
-                          vec3<double> coord_b) const {
-      // Get the reflection mask arrays
+    void remove_pixels(Shoebox<> &a,
+                       vec3<double> coord_a,
+                       const int6 &bbox_b,
+                       vec3<double> coord_b,
+                       bool a_owns_ties) const {
+      // Get the reflection mask array
       af::ref<int, af::c_grid<3> > mask_a = a.mask.ref();
-      af::ref<int, af::c_grid<3> > mask_b = b.mask.ref();
 
       // Get the sizes of the masks
       af::c_grid<3> size_a = mask_a.accessor();
-      af::c_grid<3> size_b = mask_b.accessor();
 
-      // Get the bounding boxes
+      // Get the bounding box
       int6 bbox_a = a.bbox;
-      int6 bbox_b = b.bbox;
 
       // Get range to iterate over
       int i0 = std::max(bbox_a[0], bbox_b[0]);
@@ -135,29 +166,31 @@ namespace dials { namespace algorithms { namespace shoebox {
       DIALS_ASSERT(j0 - bbox_a[2] >= 0 && j1 - bbox_a[2] <= size_a[1]);
       DIALS_ASSERT(k0 - bbox_a[4] >= 0 && k1 - bbox_a[4] <= size_a[0]);
 
-      DIALS_ASSERT(i0 - bbox_b[0] >= 0 && i1 - bbox_b[0] <= size_b[2]);
-      DIALS_ASSERT(j0 - bbox_b[2] >= 0 && j1 - bbox_b[2] <= size_b[1]);
-      DIALS_ASSERT(k0 - bbox_b[4] >= 0 && k1 - bbox_b[4] <= size_b[0]);
-
-      // Iterate over range of indices
+      // Iterate over range of indices. The squared distance from a pixel
+      // centre c is ((cx - x)^2 + (cy - y)^2) + (cz - z)^2, so the y and z
+      // terms are computed once per row without changing the result.
       for (int k = k0; k < k1; ++k) {
+        double dza = (k + 0.5) - coord_a[2];
+        double dzb = (k + 0.5) - coord_b[2];
+        double dza2 = dza * dza;
+        double dzb2 = dzb * dzb;
         for (int j = j0; j < j1; ++j) {
+          double dya = (j + 0.5) - coord_a[1];
+          double dyb = (j + 0.5) - coord_b[1];
+          double dya2 = dya * dya;
+          double dyb2 = dyb * dyb;
+          int *row = &mask_a(k - bbox_a[4], j - bbox_a[2], i0 - bbox_a[0]);
           for (int i = i0; i < i1; ++i) {
-            // Set the coordinate
-            vec3<double> coord_c(voxel_coord(i, j, k));
-
-            // Set the mask indices
-            int ka = k - bbox_a[4], kb = k - bbox_b[4];
-            int ja = j - bbox_a[2], jb = j - bbox_b[2];
-            int ia = i - bbox_a[0], ib = i - bbox_b[0];
-
-            // If the distance from a to c is less than b to c then
-            // set the mask for a to 1 and b to 0, otherwise set
-            // b to 1 and a to 0.
-            if (distance(coord_a, coord_c) < distance(coord_b, coord_c)) {
-              mask_b(kb, jb, ib) = 0;
-            } else {
-              mask_a(ka, ja, ia) = 0;
+            double dxa = (i + 0.5) - coord_a[0];
+            double dxb = (i + 0.5) - coord_b[0];
+            double da = (dxa * dxa + dya2) + dza2;
+            double db = (dxb * dxb + dyb2) + dzb2;
+
+            // If the distance from b to c is less than a to c then b owns
+            // the pixel. If the distances are the same then the
+            // reflection with the higher index owns the pixel.
+            if (db < da || (db == da && !a_owns_ties)) {
+              row[i - i0] = 0;
             }
           }
         }
@@ -165,6 +198,16 @@ namespace dials { namespace algorithms { namespace shoebox {
     }
   };
 
+  namespace detail {
+
+    inline void MaskOverlappingBand::operator()(int i0, int i1) const {
+      for (int i = i0; i < i1; ++i) {
+        masker.mask_reflection(shoeboxes, coords, adjacency_list, i);
+      }
+    }
+
+  }  // namespace detail
+
 }}}  // namespace dials::algorithms::shoebox
 
 #endif /* DIALS_ALGORITHMS_INTEGRATION_MASK_OVERLAPPING_H */
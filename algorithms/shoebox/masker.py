@@ -8,16 +8,18 @@
 class MaskerBase(object):
     """A root class to that does overlap masking"""
 
-    def __init__(self, experiment):
+    def __init__(self, experiment, nproc=1):
         """Initialise the overlap masking algorithm
 
         Params:
             experiment The experiment data
+            nproc The number of threads to use
         """
         from dials.algorithms.shoebox import MaskOverlapping
 
         # Construct the overlapping reflection mask
         self.mask_overlapping = MaskOverlapping()
+        self.nproc = nproc
 
     def __call__(self, reflections, adjacency_list=None):
         """Mask the given reflections.
@@ -34,7 +36,10 @@ def __call__(self, reflections, adjacency_list=None):
         if adjacency_list:
             logger.info("Masking overlapping reflections")
             self.mask_overlapping(
-                reflections["shoebox"], reflections["xyzcal.px"], adjacency_list
+                reflections["shoebox"],
+                reflections["xyzcal.px"],
+                adjacency_list,
+                nthreads=self.nproc,
             )
             logger.info("Masked {} overlapping reflections".format(len(adjacency_list)))
 
@@ -85,13 +90,15 @@ def __call__(self, reflections, adjacency_list=None):
 class MaskerEmpirical(MaskerBase):
     """A class to perform empirical masking"""
 
-    def __init__(self, experiment, reference):
+    def __init__(self, experiment, reference, nproc=1):
         """Initialise the masking algorithms
 
         Params:
             experiment The experiment data
+            reference The reference reflections
+            nproc The number of threads to use
         """
-        super(MaskerEmpirical, self).__init__(experiment)
+        super(MaskerEmpirical, self).__init__(experiment, nproc=nproc)
 
         from dials.algorithms.shoebox import MaskEmpirical
 
@@ -113,7 +120,7 @@ def __call__(self, reflections, adjacency_list=None):
 
         if self.mask_empirical:
             # Mask the foreground region
-            self.mask_empirical(reflections)
+            self.mask_empirical(reflections, nthreads=self.nproc)
 
         # Return the reflections
         return reflections
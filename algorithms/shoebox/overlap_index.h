@@ -0,0 +1,302 @@
+/*
+ * overlap_index.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SHOEBOX_OVERLAP_INDEX_H
+#define DIALS_ALGORITHMS_SHOEBOX_OVERLAP_INDEX_H
+
+#include <algorithm>
+#include <vector>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/model/data/adjacency_list.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms { namespace shoebox {
+
+  using dials::model::AdjacencyList;
+  using scitbx::af::int6;
+
+  /**
+   * A spatial index of reflection bounding boxes that finds the reflections
+   * overlapping a given reflection on request, rather than computing all the
+   * overlaps up front as find_overlapping does.
+   *
+   * Each panel is divided into a grid of cells about the size of a typical
+   * bounding box. A bounding box is listed in every cell it covers and each
+   * cell's list is sorted by the first frame of the boxes. To find the
+   * overlaps of a box, each cell it covers is searched over the range of frames
+   * in which an overlapping box could start, using the largest frame extent of
+   * any box in the cell to bound the search. A pair of boxes is only reported
+   * from the cell containing the corner of their intersection, so no
+   * duplicates need to be removed.
+   *
+   * As in find_overlapping, boxes which just touch do not overlap and only
+   * boxes on the same panel can overlap. The index is immutable once built so
+   * it can be queried from many threads at once.
+   */
+  class OverlapIndex {
+  public:
+    /**
+     * Build the index
+     * @param bbox The list of bounding boxes
+     * @param panel The list of panels
+     */
+    OverlapIndex(const af::const_ref<int6> &bbox,
+                 const af::const_ref<std::size_t> &panel)
+        : bbox_(bbox.begin(), bbox.end()), panel_(panel.begin(), panel.end()) {
+      DIALS_ASSERT(bbox.size() == panel.size());
+      std::size_t num_panels = 0;
+      for (std::size_t i = 0; i < panel.size(); ++i) {
+        num_panels = std::max(num_panels, panel[i] + 1);
+      }
+      grid_.resize(num_panels);
+      init_grids();
+      init_cells();
+    }
+
+    /**
+     * @returns The number of bounding boxes
+     */
+    std::size_t size() const {
+      return bbox_.size();
+    }
+
+    /**
+     * Find the bounding boxes which overlap a bounding box
+     * @param index The index of the bounding box
+     * @param result The indices of the overlapping boxes in ascending order
+     */
+    void find(std::size_t index, std::vector<std::size_t> &result) const {
+      DIALS_ASSERT(index < bbox_.size());
+      result.clear();
+      const int6 &a = bbox_[index];
+      if (is_empty(a)) {
+        return;
+      }
+      const Grid &grid = grid_[panel_[index]];
+      int cx0 = 0, cx1 = 0, cy0 = 0, cy1 = 0;
+      grid.cell_range(a, cx0, cx1, cy0, cy1);
+      for (int cy = cy0; cy < cy1; ++cy) {
+        for (int cx = cx0; cx < cx1; ++cx) {
+          std::size_t cell = grid.first_cell + cy * grid.xsize + cx;
+          std::vector<int>::const_iterator z_first =
+            cell_z0_.begin() + cell_offset_[cell];
+          std::vector<int>::const_iterator z_last =
+            cell_z0_.begin() + cell_offset_[cell + 1];
+
+          // Only boxes starting in this frame range can overlap in z
+          std::vector<int>::const_iterator first =
+            std::upper_bound(z_first, z_last, a[4] - cell_zsize_[cell]);
+          std::vector<int>::const_iterator last = std::lower_bound(first, z_last, a[5]);
+          for (; first != last; ++first) {
+            std::size_t j = cell_item_[first - cell_z0_.begin()];
+            const int6 &b = bbox_[j];
+            if (j == index || !overlaps(a, b)) {
+              continue;
+            }
+
+            // Report the pair only once in the cell with the intersection corner
+            if (grid.cell_x(std::max(a[0], b[0])) == cx
+                && grid.cell_y(std::max(a[2], b[2])) == cy) {
+              result.push_back(j);
+            }
+          }
+        }
+      }
+      std::sort(result.begin(), result.end());
+    }
+
+    /**
+     * Find the bounding boxes which overlap a bounding box
+     * @param index The index of the bounding box
+     * @returns The indices of the overlapping boxes in ascending order
+     */
+    af::shared<std::size_t> find(std::size_t index) const {
+      std::vector<std::size_t> result;
+      find(index, result);
+      return af::shared<std::size_t>(result.begin(), result.end());
+    }
+
+    /**
+     * Compute all the overlaps as an adjacency list
+     * @returns The adjacency list
+     */
+    AdjacencyList adjacency_list() const {
+      AdjacencyList list(bbox_.size());
+      std::vector<std::size_t> result;
+      for (std::size_t i = 0; i < bbox_.size(); ++i) {
+        find(i, result);
+        for (std::size_t k = 0; k < result.size(); ++k) {
+          if (result[k] > i) {
+            list.add_edge(i, result[k]);
+          }
+        }
+      }
+      list.finish();
+      return list;
+    }
+
+  protected:
+    /**
+     * The grid of cells for a panel
+     */
+    struct Grid {
+      int x0, y0;
+      int cell_size;
+      int xsize, ysize;
+      std::size_t first_cell;
+
+      Grid() : x0(0), y0(0), cell_size(1), xsize(0), ysize(0), first_cell(0) {}
+
+      int cell_x(int x) const {
+        return std::min(std::max((x - x0) / cell_size, 0), xsize - 1);
+      }
+
+      int cell_y(int y) const {
+        return std::min(std::max((y - y0) / cell_size, 0), ysize - 1);
+      }
+
+      void cell_range(const int6 &b, int &cx0, int &cx1, int &cy0, int &cy1) const {
+        cx0 = cell_x(b[0]);
+        cx1 = cell_x(b[1] - 1) + 1;
+        cy0 = cell_y(b[2]);
+        cy1 = cell_y(b[3] - 1) + 1;
+      }
+    };
+
+    /**
+     * Sort cell items by the first frame of the bounding box
+     */
+    struct sort_by_z0 {
+      const std::vector<int6> &bbox_;
+      sort_by_z0(const std::vector<int6> &bbox) : bbox_(bbox) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        return bbox_[a][4] < bbox_[b][4];
+      }
+    };
+
+    static bool is_empty(const int6 &b) {
+      return b[1] <= b[0] || b[3] <= b[2] || b[5] <= b[4];
+    }
+
+    static bool overlaps(const int6 &a, const int6 &b) {
+      return !(a[0] >= b[1] || b[0] >= a[1] || a[2] >= b[3] || b[2] >= a[3]
+               || a[4] >= b[5] || b[4] >= a[5]);
+    }
+
+    /**
+     * Set the extent and cell size of the grid for each panel. The cell size
+     * is the mean of the bounding box width and height on the panel.
+     */
+    void init_grids() {
+      std::vector<int6> extent(grid_.size());
+      std::vector<double> total_size(grid_.size(), 0);
+      std::vector<std::size_t> count(grid_.size(), 0);
+      for (std::size_t i = 0; i < bbox_.size(); ++i) {
+        const int6 &b = bbox_[i];
+        if (is_empty(b)) {
+          continue;
+        }
+        std::size_t p = panel_[i];
+        if (count[p] == 0) {
+          extent[p] = b;
+        } else {
+          extent[p][0] = std::min(extent[p][0], b[0]);
+          extent[p][1] = std::max(extent[p][1], b[1]);
+          extent[p][2] = std::min(extent[p][2], b[2]);
+          extent[p][3] = std::max(extent[p][3], b[3]);
+        }
+        total_size[p] += 0.5 * ((b[1] - b[0]) + (b[3] - b[2]));
+        count[p]++;
+      }
+      std::size_t num_cells = 0;
+      for (std::size_t p = 0; p < grid_.size(); ++p) {
+        Grid &grid = grid_[p];
+        grid.first_cell = num_cells;
+        if (count[p] == 0) {
+          continue;
+        }
+        grid.x0 = extent[p][0];
+        grid.y0 = extent[p][2];
+        grid.cell_size = std::max((int)(total_size[p] / count[p]), 1);
+        grid.xsize = (extent[p][1] - extent[p][0] - 1) / grid.cell_size + 1;
+        grid.ysize = (extent[p][3] - extent[p][2] - 1) / grid.cell_size + 1;
+        num_cells += grid.xsize * grid.ysize;
+      }
+      cell_offset_.assign(num_cells + 1, 0);
+      cell_zsize_.assign(num_cells, 0);
+    }
+
+    /**
+     * List the bounding boxes in each cell they cover sorted by first frame
+     */
+    void init_cells() {
+      // Count the boxes in each cell and find the largest frame extent
+      for (std::size_t i = 0; i < bbox_.size(); ++i) {
+        const int6 &b = bbox_[i];
+        if (is_empty(b)) {
+          continue;
+        }
+        const Grid &grid = grid_[panel_[i]];
+        int cx0 = 0, cx1 = 0, cy0 = 0, cy1 = 0;
+        grid.cell_range(b, cx0, cx1, cy0, cy1);
+        for (int cy = cy0; cy < cy1; ++cy) {
+          for (int cx = cx0; cx < cx1; ++cx) {
+            std::size_t cell = grid.first_cell + cy * grid.xsize + cx;
+            cell_offset_[cell + 1]++;
+            cell_zsize_[cell] = std::max(cell_zsize_[cell], b[5] - b[4]);
+          }
+        }
+      }
+      for (std::size_t c = 1; c < cell_offset_.size(); ++c) {
+        cell_offset_[c] += cell_offset_[c - 1];
+      }
+
+      // Fill the cells
+      std::vector<std::size_t> position(cell_offset_.begin(), cell_offset_.end() - 1);
+      cell_item_.resize(cell_offset_.back());
+      for (std::size_t i = 0; i < bbox_.size(); ++i) {
+        const int6 &b = bbox_[i];
+        if (is_empty(b)) {
+          continue;
+        }
+        const Grid &grid = grid_[panel_[i]];
+        int cx0 = 0, cx1 = 0, cy0 = 0, cy1 = 0;
+        grid.cell_range(b, cx0, cx1, cy0, cy1);
+        for (int cy = cy0; cy < cy1; ++cy) {
+          for (int cx = cx0; cx < cx1; ++cx) {
+            std::size_t cell = grid.first_cell + cy * grid.xsize + cx;
+            cell_item_[position[cell]++] = i;
+          }
+        }
+      }
+
+      // Sort each cell by first frame and keep the first frames for searching
+      cell_z0_.resize(cell_item_.size());
+      for (std::size_t c = 0; c + 1 < cell_offset_.size(); ++c) {
+        std::sort(cell_item_.begin() + cell_offset_[c],
+                  cell_item_.begin() + cell_offset_[c + 1],
+                  sort_by_z0(bbox_));
+      }
+      for (std::size_t k = 0; k < cell_item_.size(); ++k) {
+        cell_z0_[k] = bbox_[cell_item_[k]][4];
+      }
+    }
+
+    std::vector<int6> bbox_;
+    std::vector<std::size_t> panel_;
+    std::vector<Grid> grid_;
+    std::vector<std::size_t> cell_offset_;
+    std::vector<int> cell_zsize_;
+    std::vector<std::size_t> cell_item_;
+    std::vector<int> cell_z0_;
+  };
+
+}}}  // namespace dials::algorithms::shoebox
+
+#endif  // DIALS_ALGORITHMS_SHOEBOX_OVERLAP_INDEX_H
@@ -11,7 +11,9 @@
 #ifndef DIALS_ALGORITHMS_SHOEBOX_OVERLOAD_CHECKER_H
 #define DIALS_ALGORITHMS_SHOEBOX_OVERLOAD_CHECKER_H
 
+#include <algorithm>
 #include <vector>
+#include <boost/cstdint.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/error.h>
@@ -96,6 +98,133 @@ namespace dials { namespace algorithms { namespace shoebox {
     std::vector<Checker> checker_;
   };
 
+  /**
+   * A bitmap of the overloaded pixels of an image, with the number of
+   * overloaded pixels in each row summed down the rows. Whether a rectangle
+   * contains an overload is then found from the sums alone if none of its
+   * rows have any, which is nearly always the case, otherwise by counting
+   * the bits of the rows that do a word at a time. The bitmap can be filled
+   * again for another image without reallocating.
+   */
+  class OverloadBitmap {
+  public:
+    typedef boost::uint64_t word_type;
+
+    OverloadBitmap() : ysize_(0), xsize_(0), nwords_(0), row_sum_(1, 0) {}
+
+    /**
+     * Create the bitmap for an image
+     * @param data The image data
+     * @param overload The overload value
+     */
+    template <typename T>
+    OverloadBitmap(const af::const_ref<T, af::c_grid<2> > &data, double overload)
+        : ysize_(0), xsize_(0), nwords_(0), row_sum_(1, 0) {
+      set(data, overload);
+    }
+
+    /**
+     * Fill the bitmap with the pixels of an image which are >= overload
+     * @param data The image data
+     * @param overload The overload value
+     */
+    template <typename T>
+    void set(const af::const_ref<T, af::c_grid<2> > &data, double overload) {
+      ysize_ = data.accessor()[0];
+      xsize_ = data.accessor()[1];
+      nwords_ = (xsize_ + 63) / 64;
+      bits_.assign(ysize_ * nwords_, 0);
+      row_sum_.resize(ysize_ + 1);
+      row_sum_[0] = 0;
+      for (std::size_t j = 0; j < ysize_; ++j) {
+        const T *row = &data[j * xsize_];
+        word_type *bits = &bits_[j * nwords_];
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < xsize_; ++i) {
+          if (row[i] >= overload) {
+            bits[i / 64] |= word_type(1) << (i % 64);
+            count++;
+          }
+        }
+        row_sum_[j + 1] = row_sum_[j] + count;
+      }
+    }
+
+    /** @returns The number of rows */
+    std::size_t ysize() const {
+      return ysize_;
+    }
+
+    /** @returns The number of columns */
+    std::size_t xsize() const {
+      return xsize_;
+    }
+
+    /** @returns The number of overloaded pixels in the image */
+    std::size_t num_overloaded() const {
+      return row_sum_[ysize_];
+    }
+
+    /** @returns The number of bytes of the bitmap */
+    std::size_t nbytes() const {
+      return bits_.capacity() * sizeof(word_type)
+             + row_sum_.capacity() * sizeof(std::size_t);
+    }
+
+    /**
+     * Count the overloaded pixels in a rectangle, clipped to the image
+     * @param x0 The first column
+     * @param x1 The last column + 1
+     * @param y0 The first row
+     * @param y1 The last row + 1
+     * @returns The number of overloaded pixels
+     */
+    std::size_t count(int x0, int x1, int y0, int y1) const {
+      x0 = std::max(x0, 0);
+      y0 = std::max(y0, 0);
+      x1 = std::min(x1, (int)xsize_);
+      y1 = std::min(y1, (int)ysize_);
+      if (x1 <= x0 || y1 <= y0 || row_sum_[y1] == row_sum_[y0]) {
+        return 0;
+      }
+      std::size_t w0 = x0 / 64;
+      std::size_t w1 = (x1 - 1) / 64;
+      word_type first_mask = ~word_type(0) << (x0 % 64);
+      word_type last_mask = ~word_type(0) >> (63 - (x1 - 1) % 64);
+      std::size_t result = 0;
+      for (int j = y0; j < y1; ++j) {
+        if (row_sum_[j + 1] == row_sum_[j]) {
+          continue;
+        }
+        const word_type *bits = &bits_[j * nwords_];
+        if (w0 == w1) {
+          result += popcount(bits[w0] & first_mask & last_mask);
+        } else {
+          result += popcount(bits[w0] & first_mask);
+          for (std::size_t w = w0 + 1; w < w1; ++w) {
+            result += popcount(bits[w]);
+          }
+          result += popcount(bits[w1] & last_mask);
+        }
+      }
+      return result;
+    }
+
+  private:
+    static std::size_t popcount(word_type x) {
+      x = x - ((x >> 1) & 0x5555555555555555ULL);
+      x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+      x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+      return (std::size_t)((x * 0x0101010101010101ULL) >> 56);
+    }
+
+    std::size_t ysize_;
+    std::size_t xsize_;
+    std::size_t nwords_;
+    std::vector<word_type> bits_;
+    std::vector<std::size_t> row_sum_;
+  };
+
 }}}  // namespace dials::algorithms::shoebox
 
 #endif  // DIALS_ALGORITHMS_SHOEBOX_OVERLOAD_CHECKER_H
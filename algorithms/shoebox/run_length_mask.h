@@ -0,0 +1,183 @@
+/*
+ * run_length_mask.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SHOEBOX_RUN_LENGTH_MASK_H
+#define DIALS_ALGORITHMS_SHOEBOX_RUN_LENGTH_MASK_H
+
+#include <algorithm>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms { namespace shoebox {
+
+  /**
+   * The masked (false) pixels of an image as runs of pixels along each row.
+   * The runs of row j are the pixels x0[k] to x1[k] - 1 for k from row(j) to
+   * row(j + 1) - 1. Dynamic masks, e.g. of a goniometer shadow, mask few
+   * pixels or large regions, so the runs are much smaller than the mask and
+   * a region of the mask can be expanded, or applied to an image, without
+   * reading the rest.
+   */
+  class RunLengthMask {
+  public:
+    RunLengthMask() : ysize_(0), xsize_(0), row_(1, 0) {}
+
+    /**
+     * Encode a mask
+     * @param mask The mask, which is false for masked pixels
+     */
+    RunLengthMask(const af::const_ref<bool, af::c_grid<2> > &mask)
+        : ysize_(mask.accessor()[0]), xsize_(mask.accessor()[1]), row_(ysize_ + 1, 0) {
+      for (std::size_t j = 0; j < ysize_; ++j) {
+        const bool *row = &mask[j * xsize_];
+        std::size_t i = 0;
+        while (i < xsize_) {
+          if (row[i]) {
+            ++i;
+            continue;
+          }
+          std::size_t i0 = i;
+          while (i < xsize_ && !row[i]) {
+            ++i;
+          }
+          x0_.push_back((int)i0);
+          x1_.push_back((int)i);
+        }
+        row_[j + 1] = x0_.size();
+      }
+    }
+
+    /** @returns The number of rows */
+    std::size_t ysize() const {
+      return ysize_;
+    }
+
+    /** @returns The number of columns */
+    std::size_t xsize() const {
+      return xsize_;
+    }
+
+    /** @returns The number of runs */
+    std::size_t num_runs() const {
+      return x0_.size();
+    }
+
+    /** @returns The number of masked pixels */
+    std::size_t num_masked() const {
+      std::size_t result = 0;
+      for (std::size_t k = 0; k < x0_.size(); ++k) {
+        result += x1_[k] - x0_[k];
+      }
+      return result;
+    }
+
+    /** @returns The number of bytes of the runs */
+    std::size_t nbytes() const {
+      return row_.capacity() * sizeof(std::size_t)
+             + (x0_.capacity() + x1_.capacity()) * sizeof(int);
+    }
+
+    /**
+     * Expand a rectangle of the mask, clipped to the image
+     * @param x0 The first column
+     * @param x1 The last column + 1
+     * @param y0 The first row
+     * @param y1 The last row + 1
+     * @returns The mask of the rectangle, false outside the image
+     */
+    af::versa<bool, af::c_grid<2> > expand(int x0, int x1, int y0, int y1) const {
+      DIALS_ASSERT(x1 >= x0 && y1 >= y0);
+      af::versa<bool, af::c_grid<2> > result(af::c_grid<2>(y1 - y0, x1 - x0), false);
+      std::size_t width = x1 - x0;
+      for (int j = std::max(y0, 0); j < std::min(y1, (int)ysize_); ++j) {
+        bool *row = &result[(j - y0) * width];
+        int i0 = std::max(x0, 0);
+        int i1 = std::min(x1, (int)xsize_);
+        for (int i = i0; i < i1; ++i) {
+          row[i - x0] = true;
+        }
+        for (std::size_t k = row_[j]; k < row_[j + 1]; ++k) {
+          for (int i = std::max(x0_[k], i0); i < std::min(x1_[k], i1); ++i) {
+            row[i - x0] = false;
+          }
+        }
+      }
+      return result;
+    }
+
+    /** @returns The whole mask */
+    af::versa<bool, af::c_grid<2> > expand() const {
+      return expand(0, (int)xsize_, 0, (int)ysize_);
+    }
+
+    /**
+     * Set the masked pixels of a region of the image in a buffer
+     * @param dst The buffer of the region, (y1 - y0) rows of (x1 - x0) pixels
+     * @param x0 The first column of the region
+     * @param y0 The first row of the region
+     * @param value The value of masked pixels
+     */
+    template <typename T>
+    void apply(af::ref<T, af::c_grid<2> > dst, int x0, int y0, T value) const {
+      int ysize = (int)dst.accessor()[0];
+      int xsize = (int)dst.accessor()[1];
+      DIALS_ASSERT(x0 >= 0 && x0 + xsize <= (int)xsize_);
+      DIALS_ASSERT(y0 >= 0 && y0 + ysize <= (int)ysize_);
+      for (int j = 0; j < ysize; ++j) {
+        T *row = &dst[j * xsize];
+        for (std::size_t k = row_[y0 + j]; k < row_[y0 + j + 1]; ++k) {
+          int i0 = std::max(x0_[k] - x0, 0);
+          int i1 = std::min(x1_[k] - x0, xsize);
+          for (int i = i0; i < i1; ++i) {
+            row[i] = value;
+          }
+        }
+      }
+    }
+
+    /** @returns True/False the masks are the same */
+    bool operator==(const RunLengthMask &other) const {
+      return ysize_ == other.ysize_ && xsize_ == other.xsize_
+             && row_.size() == other.row_.size() && x0_.size() == other.x0_.size()
+             && std::equal(row_.begin(), row_.end(), other.row_.begin())
+             && std::equal(x0_.begin(), x0_.end(), other.x0_.begin())
+             && std::equal(x1_.begin(), x1_.end(), other.x1_.begin());
+    }
+
+    /** @returns True/False the masks are different */
+    bool operator!=(const RunLengthMask &other) const {
+      return !(*this == other);
+    }
+
+  private:
+    std::size_t ysize_;
+    std::size_t xsize_;
+    std::vector<std::size_t> row_;
+    std::vector<int> x0_;
+    std::vector<int> x1_;
+  };
+
+  /**
+   * Encode each panel of a multi-panel mask
+   * @param mask The mask image, e.g. a dxtbx::format::Image<bool>
+   * @returns The runs of each panel
+   */
+  template <typename ImageType>
+  std::vector<RunLengthMask> run_length_encode(const ImageType &mask) {
+    std::vector<RunLengthMask> result;
+    result.reserve(mask.n_tiles());
+    for (std::size_t i = 0; i < mask.n_tiles(); ++i) {
+      result.push_back(RunLengthMask(mask.tile(i).data().const_ref()));
+    }
+    return result;
+  }
+
+}}}  // namespace dials::algorithms::shoebox
+
+#endif  // DIALS_ALGORITHMS_SHOEBOX_RUN_LENGTH_MASK_H
@@ -19,6 +19,20 @@ namespace dials { namespace algorithms { namespace boost_python {
   BOOST_PYTHON_MODULE(dials_algorithms_simulation_ext) {
     def("simulate_reciprocal_space_gaussian", &simulate_reciprocal_space_gaussian);
     def("integrate_reciprocal_space_gaussian", &integrate_reciprocal_space_gaussian);
+    def("simulate_reciprocal_space_gaussians",
+        &simulate_reciprocal_space_gaussians,
+        (arg("beam"),
+         arg("detector"),
+         arg("goniometer"),
+         arg("scan"),
+         arg("sigma_b"),
+         arg("sigma_m"),
+         arg("s1"),
+         arg("phi"),
+         arg("intensity"),
+         arg("pool"),
+         arg("seed") = -1,
+         arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -8,12 +8,16 @@
 class Simulator(object):
     """Class to help with simulation from reciprocal space."""
 
-    def __init__(self, experiment, sigma_b, sigma_m, n_sigma):
-        """Initialise with models and parameters."""
+    def __init__(self, experiment, sigma_b, sigma_m, n_sigma, seed=-1, nproc=1):
+        """Initialise with models and parameters. The signal of the reflections
+        is simulated in nproc threads from the random seed, or a seed from the
+        time if the seed is negative."""
         self.experiment = experiment
         self.sigma_b = sigma_b
         self.sigma_m = sigma_m
         self.n_sigma = n_sigma
+        self.seed = seed
+        self.nproc = nproc
 
     def with_given_intensity(self, N, In, Ba, Bb, Bc, Bd):
         """Generate reflections with a given intensity and background."""
@@ -52,11 +56,12 @@ def with_random_intensity(self, N, Imax, Bamax, Bbmax, Bcmax, Bdmax):
 
     def with_individual_given_intensity(self, N, In, Ba, Bb, Bc, Bd):
         """Generate reflections with given intensity and background."""
-        from dials.algorithms.simulation import simulate_reciprocal_space_gaussian
+        from dials.algorithms.simulation import simulate_reciprocal_space_gaussians
         from dials.algorithms.simulation.generate_test_reflections import (
             random_background_plane2,
         )
-        from dials.util.command_line import ProgressBar
+        from dials.model.data import ShoeboxPool
+        from dials.util.command_line import Command, ProgressBar
 
         # Check the lengths
         assert N == len(In)
@@ -69,36 +74,26 @@ def with_individual_given_intensity(self, N, In, Ba, Bb, Bc, Bd):
         refl = self.generate_predictions(N)
 
         # Calculate the signal
-        progress = ProgressBar(
-            title="Calculating signal for %d reflections" % len(refl)
-        )
-        s1 = refl["s1"]
-        phi = refl["xyzcal.mm"].parts()[2]
-        bbox = refl["bbox"]
+        Command.start("Calculating signal for %d reflections" % len(refl))
+        pool = ShoeboxPool(refl["shoebox"])
+        I_exp = simulate_reciprocal_space_gaussians(
+            self.experiment.beam,
+            self.experiment.detector,
+            self.experiment.goniometer,
+            self.experiment.scan,
+            self.sigma_b,
+            self.sigma_m,
+            refl["s1"],
+            refl["xyzcal.mm"].parts()[2],
+            In,
+            pool,
+            seed=self.seed,
+            nthreads=self.nproc,
+        ).as_double()
+        refl["shoebox"] = pool.shoeboxes()
         shoebox = refl["shoebox"]
         m = int(len(refl) / 100)
-        I_exp = flex.double(len(refl), 0)
-        for i in range(len(refl)):
-            if In[i] > 0:
-                data = shoebox[i].data.as_double()
-                I_exp[i] = simulate_reciprocal_space_gaussian(
-                    self.experiment.beam,
-                    self.experiment.detector,
-                    self.experiment.goniometer,
-                    self.experiment.scan,
-                    self.sigma_b,
-                    self.sigma_m,
-                    s1[i],
-                    phi[i],
-                    bbox[i],
-                    In[i],
-                    data,
-                    shoebox[i].mask,
-                )
-                shoebox[i].data = data.as_float()
-            if i % m == 0:
-                progress.update(100.0 * float(i) / len(refl))
-        progress.finished("Calculated signal impacts for %d reflections" % len(refl))
+        Command.end("Calculated signal impacts for %d reflections" % len(refl))
 
         # Calculate the background
         progress = ProgressBar(
@@ -11,6 +11,7 @@
 #ifndef DIALS_ALGORITHMS_SIMULATION_RECIPROCAL_SPACE_HELPERS_H
 #define DIALS_ALGORITHMS_SIMULATION_RECIPROCAL_SPACE_HELPERS_H
 
+#include <boost/cstdint.hpp>
 #include <boost/random.hpp>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
@@ -20,16 +21,22 @@
 #include <dxtbx/model/goniometer.h>
 #include <dxtbx/model/scan.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/array_family/hash_join.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
 #include <ctime>
 #include <dials/model/data/shoebox.h>
+#include <dials/model/data/shoebox_pool.h>
+#include <dials/error.h>
 
 namespace dials { namespace algorithms {
 
   using dials::model::Foreground;
+  using dials::model::ShoeboxPool;
   using dxtbx::model::BeamBase;
   using dxtbx::model::Detector;
   using dxtbx::model::Goniometer;
+  using dxtbx::model::Panel;
   using dxtbx::model::Scan;
   using profile_model::gaussian_rs::CoordinateSystem;
   using scitbx::vec2;
@@ -167,6 +174,208 @@ namespace dials { namespace algorithms {
     return counts;
   }
 
+  namespace detail {
+
+    /**
+     * A counter based random number engine. Each number is the splitmix64
+     * mix of the key and the count of numbers drawn, so the numbers for a
+     * key can be drawn without a long lived state and do not depend on
+     * anything drawn for other keys.
+     */
+    class CounterEngine {
+    public:
+      typedef boost::uint64_t result_type;
+      BOOST_STATIC_CONSTANT(bool, has_fixed_range = false);
+
+      /**
+       * @param key The key of the stream of random numbers
+       */
+      CounterEngine(boost::uint64_t key) : key_(af::hash_mix(key)), counter_(0) {}
+
+      static result_type min BOOST_PREVENT_MACRO_SUBSTITUTION() {
+        return 0;
+      }
+
+      static result_type max BOOST_PREVENT_MACRO_SUBSTITUTION() {
+        return ~(result_type)0;
+      }
+
+      result_type operator()() {
+        counter_ += 0x9e3779b97f4a7c15ULL;
+        return af::hash_mix(key_ + counter_);
+      }
+
+    private:
+      boost::uint64_t key_;
+      boost::uint64_t counter_;
+    };
+
+    /**
+     * Simulate the reflections of a band of shoeboxes in a pool
+     */
+    struct SimulateReciprocalSpaceGaussianBand {
+      const BeamBase &beam;
+      const Detector &detector;
+      const Goniometer &goniometer;
+      const Scan &scan;
+      double sigma_b;
+      double sigma_m;
+      af::const_ref<vec3<double> > s1;
+      af::const_ref<double> phi;
+      af::const_ref<int> intensity;
+      ShoeboxPool<> &pool;
+      boost::uint64_t seed;
+      af::ref<int> counts;
+
+      SimulateReciprocalSpaceGaussianBand(const BeamBase &beam_,
+                                          const Detector &detector_,
+                                          const Goniometer &goniometer_,
+                                          const Scan &scan_,
+                                          double sigma_b_,
+                                          double sigma_m_,
+                                          const af::const_ref<vec3<double> > &s1_,
+                                          const af::const_ref<double> &phi_,
+                                          const af::const_ref<int> &intensity_,
+                                          ShoeboxPool<> &pool_,
+                                          boost::uint64_t seed_,
+                                          af::ref<int> counts_)
+          : beam(beam_),
+            detector(detector_),
+            goniometer(goniometer_),
+            scan(scan_),
+            sigma_b(sigma_b_),
+            sigma_m(sigma_m_),
+            s1(s1_),
+            phi(phi_),
+            intensity(intensity_),
+            pool(pool_),
+            seed(seed_),
+            counts(counts_) {}
+
+      void operator()(int i0, int i1) const {
+        vec3<double> s0 = beam.get_s0();
+        vec3<double> m2 = goniometer.get_rotation_axis();
+        boost::random::normal_distribution<double> dist_x(0, sigma_b);
+        boost::random::normal_distribution<double> dist_y(0, sigma_b);
+        boost::random::normal_distribution<double> dist_z(0, sigma_m);
+        for (int i = i0; i < i1; ++i) {
+          counts[i] = 0;
+          if (intensity[i] <= 0) {
+            continue;
+          }
+
+          // Each reflection draws from its own stream
+          CounterEngine gen(seed ^ af::hash_mix((boost::uint64_t)i));
+          dist_x.reset();
+          dist_y.reset();
+          dist_z.reset();
+
+          const Panel &panel = detector[pool.panel(i)];
+          int6 bbox = pool.bbox(i);
+          af::ref<ShoeboxPool<>::float_type, af::c_grid<3> > shoebox = pool.data(i);
+          af::const_ref<ShoeboxPool<>::mask_type, af::c_grid<3> > mask =
+            pool.mask(i);
+          CoordinateSystem cs(m2, s0, s1[i], phi[i]);
+          for (int j = 0; j < intensity[i]; ++j) {
+            // Get the random coordinates
+            double e1 = dist_x(gen);
+            double e2 = dist_y(gen);
+            double e3 = dist_z(gen);
+
+            // Get the beam vector and rotation angle
+            vec3<double> s1_dash = cs.to_beam_vector(vec2<double>(e1, e2));
+            double phi_dash = cs.to_rotation_angle_fast(e3);
+
+            // Get the pixel coordinate
+            vec2<double> mm = panel.get_ray_intersection(s1_dash);
+            vec2<double> px = panel.millimeter_to_pixel(mm);
+
+            // Get the frame
+            double frame = scan.get_array_index_from_angle(phi_dash);
+
+            // Make sure coordinate is within range
+            if (px[0] < bbox[0] || px[0] >= bbox[1] || px[1] < bbox[2]
+                || px[1] >= bbox[3] || frame < bbox[4] || frame >= bbox[5]) {
+              continue;
+            }
+
+            // Get the pixel index
+            int x = (int)(px[0] - bbox[0]);
+            int y = (int)(px[1] - bbox[2]);
+            int z = pool.flat(i) ? 0 : (int)(frame - bbox[4]);
+
+            // Add the count
+            shoebox(z, y, x) += 1;
+
+            if (mask(z, y, x) & Foreground) {
+              counts[i] += 1;
+            }
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Simulate a gaussian in reciprocal space for each of a list of reflections
+   * and add the counts to the data of their shoeboxes in a pool. The photons
+   * of each reflection are drawn from a counter based random number stream
+   * keyed by the seed and the index of the reflection, so the result for a
+   * given seed does not depend on the number of threads.
+   * @param beam The beam model
+   * @param detector The detector model
+   * @param goniometer The goniometer model
+   * @param scan The scan model
+   * @param sigma_b The beam divergence
+   * @param sigma_m The mosaicity
+   * @param s1 The diffracted beam vector of each reflection
+   * @param phi The rotation angle of each reflection
+   * @param intensity The number of photons to simulate for each reflection
+   * @param pool The allocated shoeboxes of the reflections
+   * @param seed The random seed, or negative to seed from the time
+   * @param nthreads The number of threads to use
+   * @returns The number of counts in the foreground of each shoebox
+   */
+  inline af::shared<int> simulate_reciprocal_space_gaussians(
+    const BeamBase &beam,
+    const Detector &detector,
+    const Goniometer &goniometer,
+    const Scan &scan,
+    double sigma_b,
+    double sigma_m,
+    const af::const_ref<vec3<double> > &s1,
+    const af::const_ref<double> &phi,
+    const af::const_ref<int> &intensity,
+    ShoeboxPool<> &pool,
+    int seed = -1,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(s1.size() == pool.size());
+    DIALS_ASSERT(phi.size() == pool.size());
+    DIALS_ASSERT(intensity.size() == pool.size());
+    DIALS_ASSERT(pool.size() == 0 || pool.is_allocated());
+    for (std::size_t i = 0; i < pool.size(); ++i) {
+      DIALS_ASSERT(pool.panel(i) < detector.size());
+    }
+    boost::uint64_t base = seed < 0 ? (boost::uint64_t)time(0) : (boost::uint64_t)seed;
+    af::shared<int> counts(pool.size(), 0);
+    for_each_band(detail::SimulateReciprocalSpaceGaussianBand(beam,
+                                                              detector,
+                                                              goniometer,
+                                                              scan,
+                                                              sigma_b,
+                                                              sigma_m,
+                                                              s1,
+                                                              phi,
+                                                              intensity,
+                                                              pool,
+                                                              base,
+                                                              counts.ref()),
+                  (int)pool.size(),
+                  nthreads);
+    return counts;
+  }
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_SIMULATION_RECIPROCAL_SPACE_HELPERS_H
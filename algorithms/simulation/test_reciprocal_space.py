@@ -20,3 +20,51 @@ def test_simulation(dials_data):
     B = 10
     simulate = Simulator(experiments[0], sigma_b, sigma_m, n_sigma)
     simulate.with_random_intensity(N, In, B, 0, 0, 0)
+
+
+def test_simulate_reciprocal_space_gaussians(dials_data):
+    from dials.algorithms.simulation import simulate_reciprocal_space_gaussians
+    from dials.array_family import flex
+    from dials.model.data import ShoeboxPool
+
+    experiments = ExperimentListFactory.from_json_file(
+        dials_data("centroid_test_data").join("experiments.json").strpath,
+        check_format=False,
+    )
+    experiment = experiments[0]
+    sigma_b = 0.058 * math.pi / 180
+    sigma_m = 0.157 * math.pi / 180
+    simulate = Simulator(experiment, sigma_b, sigma_m, 3)
+    refl = simulate.generate_predictions(100)
+    intensity = flex.int(len(refl), 1000)
+    intensity[0] = 0
+
+    def simulate_counts(seed, nthreads):
+        pool = ShoeboxPool(refl["shoebox"])
+        counts = simulate_reciprocal_space_gaussians(
+            experiment.beam,
+            experiment.detector,
+            experiment.goniometer,
+            experiment.scan,
+            sigma_b,
+            sigma_m,
+            refl["s1"],
+            refl["xyzcal.mm"].parts()[2],
+            intensity,
+            pool,
+            seed=seed,
+            nthreads=nthreads,
+        )
+        return counts, pool.data()
+
+    # The counts depend on the seed but not on the number of threads
+    counts, data = simulate_counts(0, 1)
+    assert counts[0] == 0
+    assert counts.all_le(1000) and flex.sum(counts) > 0
+    assert flex.sum(data) >= flex.sum(counts)
+    for nthreads in (2, 5):
+        other_counts, other_data = simulate_counts(0, nthreads)
+        assert list(other_counts) == list(counts)
+        assert list(other_data) == list(data)
+    other_counts, other_data = simulate_counts(1, 1)
+    assert list(other_data) != list(data)
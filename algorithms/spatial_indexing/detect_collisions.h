@@ -349,18 +349,41 @@ namespace dials { namespace algorithms {
      * @param collisions The list of collisions
      */
     void operator()(DataIterator first, DataIterator last, CollisionList &collisions) {
+      IndexList index;
+      BoxType box;
+      initialise(first, last, index, box);
+
+      // Start the recursive partitioning of the data to find the collisions.
+      partition_data<0>(index.begin(), index.end(), first, collisions, box, 0);
+    }
+
+  protected:
+    int max_depth_;
+
+    /**
+     * Create the index array and bounding box of the data range and set the
+     * maximum recursion depth.
+     * @param first The first iterator in the range
+     * @param last The last iterator in the range
+     * @param index The indices of the input data range
+     * @param box The bounding box of the whole data range
+     */
+    void initialise(DataIterator first,
+                    DataIterator last,
+                    IndexList &index,
+                    BoxType &box) {
       // Ensure the amount of data is greater than zero.
       int n = last - first;
       DIALS_ASSERT(n > 0);
 
       // Create and fill a vector with the indices of the input data range
-      IndexList index(n);
+      index.resize(n);
       for (std::size_t i = 0; i < n; ++i) {
         index[i] = i;
       }
 
       // Get the bounding box of the whole data range
-      BoxType box = get_bounding_box<BoxType>(first, last);
+      box = get_bounding_box<BoxType>(first, last);
       DimType min_size = get_minimum_box_size<DimType>(first, last);
       for (std::size_t i = 0; i < DIM; ++i) {
         DIALS_ASSERT(min_size.d[i] > 0);
@@ -379,14 +402,8 @@ namespace dials { namespace algorithms {
       max_depth_ = log2(min_length / min_size.d[j]) - 1;
       if (max_depth_ < 1) max_depth_ = 1;
       max_depth_ *= DIM;
-
-      // Start the recursive partitioning of the data to find the collisions.
-      partition_data<0>(index.begin(), index.end(), first, collisions, box, 0);
     }
 
-  private:
-    int max_depth_;
-
     /**
      * The main body of the algorithm.
      *
@@ -0,0 +1,142 @@
+/*
+ * detect_collisions_parallel.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPATIAL_INDEXING_DETECT_COLLISIONS_PARALLEL_H
+#define DIALS_ALGORITHMS_SPATIAL_INDEXING_DETECT_COLLISIONS_PARALLEL_H
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread.hpp>
+#include <dials/algorithms/spatial_indexing/detect_collisions.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * A multi-threaded version of the collision detection algorithm. The first
+   * few levels of the recursive partitioning are split between threads: at
+   * each of these levels the upper half of the split is handed to a new
+   * thread while the calling thread carries on with the lower half. Below the
+   * spawning levels each thread runs the serial algorithm in place on its own
+   * part of the index array.
+   *
+   * The two halves of a split share elements that span the split so the
+   * spawned half works on a copy of the indices at that level; with n threads
+   * this is n - 1 copies of parts of the index array in all. Each spawned
+   * thread writes to its own collision list and the lists are appended after
+   * the threads have joined. The same collisions are found as by
+   * DetectCollisions although the order of the list may differ.
+   */
+  template <int DIM, typename Iterator, typename ListType, bool touching = false>
+  class ParallelDetectCollisions
+      : public DetectCollisions<DIM, Iterator, ListType, touching> {
+  public:
+    typedef DetectCollisions<DIM, Iterator, ListType, touching> base_type;
+    typedef typename base_type::DataIterator DataIterator;
+    typedef typename base_type::IndexList IndexList;
+    typedef typename base_type::IndexIterator IndexIterator;
+    typedef typename base_type::CollisionList CollisionList;
+    typedef typename base_type::BoxType BoxType;
+
+    /**
+     * @param num_threads The number of threads to use
+     */
+    ParallelDetectCollisions(std::size_t num_threads) : spawn_depth_(0) {
+      DIALS_ASSERT(num_threads > 0);
+      while ((std::size_t(1) << spawn_depth_) < num_threads) {
+        spawn_depth_++;
+      }
+    }
+
+    /**
+     * Find the collisions using multiple threads
+     * @param first The first iterator in the range
+     * @param last The last iterator in the range
+     * @param collisions The list of collisions
+     */
+    void operator()(DataIterator first, DataIterator last, CollisionList &collisions) {
+      IndexList index;
+      BoxType box;
+      this->initialise(first, last, index, box);
+      spawn_partition<0>(index.begin(), index.end(), first, collisions, box, 0);
+    }
+
+  protected:
+    /**
+     * Split the data along the current axis as in partition_data, processing
+     * the upper half in a new thread. Once the spawning depth has been reached
+     * continue with the serial algorithm.
+     */
+    template <int D>
+    void spawn_partition(IndexIterator first,
+                         IndexIterator last,
+                         DataIterator data,
+                         CollisionList &collisions,
+                         const BoxType &box,
+                         int depth) const {
+      const int D_NEXT = (D + 1) % DIM;
+      if (depth >= spawn_depth_ || depth >= this->max_depth_
+          || last - first <= base_type::BF_THRESHOLD) {
+        this->template partition_data<D>(first, last, data, collisions, box, depth);
+        return;
+      }
+
+      // The boxes either side of the split
+      BoxType lower_box(box);
+      BoxType upper_box(box);
+      lower_box.max[D] = box.min[D] + (box.max[D] - box.min[D]) / 2;
+      upper_box.min[D] = lower_box.max[D];
+
+      // Partition a copy of the indices for the upper half and start it
+      typedef typename base_type::template by_lower<D> by_lower;
+      typedef typename base_type::template by_upper<D> by_upper;
+      IndexList upper(first, last);
+      IndexIterator upper_mid =
+        std::partition(upper.begin(), upper.end(), by_upper(data, upper_box.min[D]));
+      CollisionList upper_collisions;
+      boost::thread thread(
+        boost::bind(&ParallelDetectCollisions::template spawn_partition<D_NEXT>,
+                    this,
+                    upper_mid,
+                    upper.end(),
+                    data,
+                    boost::ref(upper_collisions),
+                    upper_box,
+                    depth + 1));
+
+      // Process the lower half in place in this thread
+      IndexIterator mid = std::partition(first, last, by_lower(data, lower_box.max[D]));
+      spawn_partition<D_NEXT>(first, mid, data, collisions, lower_box, depth + 1);
+
+      // Add the collisions from the upper half after those from the lower
+      thread.join();
+      collisions.insert(
+        collisions.end(), upper_collisions.begin(), upper_collisions.end());
+    }
+
+    int spawn_depth_;
+  };
+
+  /** Wrapper function for multi-threaded 3D collision detection */
+  template <typename Iterator, typename ListType>
+  void detect_collisions3d(Iterator first,
+                           Iterator last,
+                           ListType &collisions,
+                           std::size_t num_threads) {
+    if (num_threads > 1) {
+      ParallelDetectCollisions<3, Iterator, ListType, false> detect(num_threads);
+      detect(first, last, collisions);
+    } else {
+      DetectCollisions<3, Iterator, ListType, false>()(first, last, collisions);
+    }
+  }
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPATIAL_INDEXING_DETECT_COLLISIONS_PARALLEL_H
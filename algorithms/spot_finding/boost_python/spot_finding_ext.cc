@@ -11,15 +11,98 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/spot_finding/helpers.h>
+#include <dials/algorithms/spot_finding/per_image_statistics.h>
+#include <dials/algorithms/spot_finding/spot_matcher.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
+  /**
+   * Find the closest spot to each point
+   * @returns A tuple of the closest spots (or -1) and their distances
+   */
+  boost::python::tuple SpotGridIndex_nearest(const SpotGridIndex &self,
+                                             const af::const_ref<vec3<double> > &xyz,
+                                             const af::const_ref<std::size_t> &panel,
+                                             std::size_t nthreads) {
+    af::shared<int> index(xyz.size(), -1);
+    af::shared<double> distance(xyz.size(), 0);
+    self.nearest(xyz, panel, index.ref(), distance.ref(), nthreads);
+    return boost::python::make_tuple(index, distance);
+  }
+
+  /**
+   * Match points to spots one to one
+   * @returns A tuple of the points and spots of the matches
+   */
+  boost::python::tuple SpotGridIndex_match(const SpotGridIndex &self,
+                                           const af::const_ref<vec3<double> > &xyz,
+                                           const af::const_ref<std::size_t> &panel,
+                                           std::size_t nthreads) {
+    af::shared<std::size_t> point_index;
+    af::shared<std::size_t> spot_index;
+    self.match(xyz, panel, point_index, spot_index, nthreads);
+    return boost::python::make_tuple(point_index, spot_index);
+  }
+
   BOOST_PYTHON_MODULE(dials_algorithms_spot_finding_ext) {
     class_<StrongSpotCombiner>("StrongSpotCombiner")
       .def("add", &StrongSpotCombiner::add)
+      .def("pop_finished", &StrongSpotCombiner::pop_finished)
+      .def("num_finished", &StrongSpotCombiner::num_finished)
+      .def("num_pending", &StrongSpotCombiner::num_pending)
       .def("shoeboxes", &StrongSpotCombiner::shoeboxes);
+
+    class_<SpotGridIndex>("SpotGridIndex", no_init)
+      .def(init<const af::const_ref<vec3<double> > &,
+                const af::const_ref<std::size_t> &,
+                double>((arg("xyz"), arg("panel"), arg("max_separation"))))
+      .def("size", &SpotGridIndex::size)
+      .def("__len__", &SpotGridIndex::size)
+      .def("max_separation", &SpotGridIndex::max_separation)
+      .def("nearest",
+           &SpotGridIndex_nearest,
+           (arg("xyz"), arg("panel"), arg("nthreads") = 1))
+      .def("match",
+           &SpotGridIndex_match,
+           (arg("xyz"), arg("panel"), arg("nthreads") = 1));
+
+    class_<PerImageStatistics>("PerImageStatistics", no_init)
+      .def(init<const af::const_ref<double> &,
+                const af::const_ref<vec3<double> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<double> &,
+                int,
+                int,
+                const af::const_ref<double> &,
+                double,
+                bool,
+                bool,
+                std::size_t>((arg("z"),
+                              arg("rlp"),
+                              arg("intensity"),
+                              arg("variance"),
+                              arg("first_image"),
+                              arg("last_image"),
+                              arg("ice_d_star_sq"),
+                              arg("ice_half_width"),
+                              arg("filter_ice") = true,
+                              arg("resolution_analysis") = true,
+                              arg("nthreads") = 1)))
+      .def("n_spots_total", &PerImageStatistics::n_spots_total)
+      .def("n_spots_no_ice", &PerImageStatistics::n_spots_no_ice)
+      .def("n_spots_4A", &PerImageStatistics::n_spots_4A)
+      .def("total_intensity", &PerImageStatistics::total_intensity)
+      .def("estimated_d_min", &PerImageStatistics::estimated_d_min)
+      .def("d_min_distl_method_1", &PerImageStatistics::d_min_distl_method_1)
+      .def("noisiness_method_1", &PerImageStatistics::noisiness_method_1)
+      .def("d_min_distl_method_2", &PerImageStatistics::d_min_distl_method_2)
+      .def("noisiness_method_2", &PerImageStatistics::noisiness_method_2);
+
+    def("slot_means",
+        &slot_means,
+        (arg("x"), arg("values"), arg("low_cutoff"), arg("high_cutoff")));
   }
 
 }}}  // namespace dials::algorithms::boost_python
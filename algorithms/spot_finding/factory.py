@@ -6,6 +6,8 @@
 import six
 import six.moves.cPickle as pickle
 
+import libtbx
+
 from dials.array_family import flex
 
 logger = logging.getLogger(__name__)
@@ -423,6 +425,8 @@ def from_parameters(params=None, experiments=None):
         if params is None:
             params = phil_scope.fetch(source=parse("")).extract()
 
+        SpotFinderFactory.configure_min_spot_size(params, experiments)
+
         if params.spotfinder.force_2d and params.output.shoeboxes is False:
             no_shoeboxes_2d = True
         elif experiments is not None and params.output.shoeboxes is False:
@@ -476,6 +480,26 @@ def from_parameters(params=None, experiments=None):
             min_chunksize=params.spotfinder.mp.min_chunksize,
         )
 
+    @staticmethod
+    def configure_min_spot_size(params, experiments):
+        """
+        Set the minimum spot size for the type of detector, if it is Auto
+
+        :param params: The input parameters
+        :param experiments: The experiments
+        """
+        if params.spotfinder.filter.min_spot_size is libtbx.Auto:
+            detector = experiments[0].imageset.get_detector()
+            if detector[0].get_type() == "SENSOR_PAD":
+                # smaller default value for pixel array detectors
+                params.spotfinder.filter.min_spot_size = 3
+            else:
+                params.spotfinder.filter.min_spot_size = 6
+            logger.info(
+                "Setting spotfinder.filter.min_spot_size=%i",
+                params.spotfinder.filter.min_spot_size,
+            )
+
     @staticmethod
     def configure_threshold(params):
         """
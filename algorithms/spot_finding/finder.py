@@ -640,8 +640,8 @@ def _find_spots_2d_no_shoeboxes(self, imageset):
         # The indices to iterate over
         indices = list(range(len(imageset)))
 
-        # The resulting reflections
-        reflections = flex.reflection_table()
+        # The reflections found on each image, joined once at the end
+        tables = []
 
         # Do the processing
         logger.info("Extracting strong spots from images")
@@ -657,7 +657,7 @@ def _find_spots_2d_no_shoeboxes(self, imageset):
             def process_output(result):
                 for message in result[1]:
                     logger.log(message.levelno, message.msg)
-                reflections.extend(result[0][0])
+                tables.append(result[0][0])
                 result[0][0] = None
 
             batch_multi_node_parallel_map(
@@ -671,10 +671,10 @@ def process_output(result):
             )
         else:
             for task in indices:
-                reflections.extend(function(task)[0])
+                tables.append(function(task)[0])
 
         # Return the reflections
-        return reflections, None
+        return flex.reflection_table.concat(tables), None
 
 
 class SpotFinder(object):
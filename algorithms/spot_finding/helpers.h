@@ -13,7 +13,7 @@
 
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/boost_python/flex_table_suite.h>
-#include <dials/algorithms/image/connected_components/connected_components.h>
+#include <dials/algorithms/image/connected_components/union_find.h>
 
 namespace dials { namespace algorithms {
 
@@ -34,12 +34,12 @@ namespace dials { namespace algorithms {
     af::shared<Shoebox<> > shoeboxes() {
       typedef Shoebox<>::float_type float_type;
 
-      // Adjacency list type
-      typedef boost::adjacency_list<boost::listS, boost::vecS, boost::undirectedS>
-        AdjacencyList;
+      if (shoeboxes_.size() == 0) {
+        return af::shared<Shoebox<> >();
+      }
 
-      // Create the edges between shoeboxes
-      AdjacencyList graph(shoeboxes_.size());
+      // Join the shoeboxes which are connected
+      UnionFind sets(shoeboxes_.size());
       for (std::size_t s1 = 0; s1 < shoeboxes_.size() - 1; ++s1) {
         std::size_t panel1 = shoeboxes_[s1].panel;
         int6 bbox1 = shoeboxes_[s1].bbox;
@@ -69,7 +69,7 @@ namespace dials { namespace algorithms {
                 DIALS_ASSERT(j2 >= 0 && j2 < mask2.accessor()[1]);
                 if ((mask1(k1, j1, i1) & Foreground)
                     && (mask2(k2, j2, i2) & Foreground)) {
-                  boost::add_edge(s1, s2, graph);
+                  sets.join(s1, s2);
                 }
               }
             }
@@ -78,10 +78,8 @@ namespace dials { namespace algorithms {
       }
 
       // Do the connected components
-      af::shared<int> labels(num_vertices(graph), af::init_functor_null<int>());
+      af::shared<int> labels = sets.labels();
       DIALS_ASSERT(labels.size() == shoeboxes_.size());
-      int num = boost::connected_components(graph, &labels[0]);
-      DIALS_ASSERT(num <= labels.size());
 
       // Get the number of labels and allocate the array
       std::size_t max_label = af::max(labels.const_ref());
@@ -157,6 +155,10 @@ namespace dials { namespace algorithms {
       shoeboxes_ = af::shared<Shoebox<> >();
     }
 
+    std::size_t size() const {
+      return shoeboxes_.size();
+    }
+
   private:
     af::shared<Shoebox<> > shoeboxes_;
   };
@@ -164,6 +166,12 @@ namespace dials { namespace algorithms {
   /**
    * A class to combine strong spot lists (i.e. perform the connected component
    * labelling at the boundary of two spot lists from the same sequence.
+   *
+   * The spots are combined incrementally as each chunk of frames is added.
+   * Only the spots which touch the last frame of the chunks seen so far are
+   * kept pending, since only they can be extended by the next chunk. All other
+   * spots are finished and can be taken with pop_finished() so that the memory
+   * needed is bounded by the number of spots at a single chunk boundary.
    */
   class StrongSpotCombiner {
   public:
@@ -177,6 +185,10 @@ namespace dials { namespace algorithms {
      * @param rlist The reflection table
      */
     void add(af::const_ref<Shoebox<> > shoebox) {
+      if (shoebox.size() == 0) {
+        return;
+      }
+
       // Find the min and max frame
       int minz = shoebox[0].bbox[4];
       int maxz = shoebox[0].bbox[5];
@@ -191,7 +203,8 @@ namespace dials { namespace algorithms {
 
       // If this is the first reflection table, then copy, otherwise, check that
       // the frame frames match.
-      if (all_maxz_ == all_minz_) {
+      bool first = (all_maxz_ == all_minz_);
+      if (first) {
         all_minz_ = minz;
         all_maxz_ = maxz;
       } else {
@@ -199,30 +212,79 @@ namespace dials { namespace algorithms {
         all_maxz_ = maxz;
       }
 
-      // Loop through all the shoeboxes. If the shoebox is not at the edge of
-      // the image, then add it to the finished list. Otherwise, add it to the
-      // labeller.
+      // Loop through all the shoeboxes. If the shoebox starts on the first
+      // frame of the chunk, then it may join a pending spot from the previous
+      // chunk so is added to the labeller. Otherwise it is either finished or,
+      // if it is on the last frame of the chunk, pending.
+      Labeller labeller;
+      for (std::size_t i = 0; i < pending_.size(); ++i) {
+        labeller.add(pending_[i]);
+      }
+      pending_ = af::shared<Shoebox<> >();
       for (std::size_t i = 0; i < shoebox.size(); ++i) {
-        if (minz < shoebox[i].bbox[4] && shoebox[i].bbox[5] < maxz) {
-          finished_.push_back(shoebox[i]);
+        if (!first && shoebox[i].bbox[4] == minz) {
+          labeller.add(shoebox[i]);
         } else {
-          labeller_.add(shoebox[i]);
+          add_labelled(shoebox[i], maxz);
         }
       }
+
+      // Merge the spots at the boundary
+      af::shared<Shoebox<> > labelled = labeller.shoeboxes();
+      for (std::size_t i = 0; i < labelled.size(); ++i) {
+        add_labelled(labelled[i], maxz);
+      }
+    }
+
+    /**
+     * Take the spots which cannot be extended by any further chunks
+     * @returns The finished spots
+     */
+    af::shared<Shoebox<> > pop_finished() {
+      af::shared<Shoebox<> > result = finished_;
+      finished_ = af::shared<Shoebox<> >();
+      return result;
+    }
+
+    /**
+     * @returns The number of finished spots not yet taken
+     */
+    std::size_t num_finished() const {
+      return finished_.size();
+    }
+
+    /**
+     * @returns The number of spots on the last frame waiting for the next chunk
+     */
+    std::size_t num_pending() const {
+      return pending_.size();
     }
 
     /**
      * @returns The final reflection table
      */
     af::shared<Shoebox<> > shoeboxes() {
-      af::shared<Shoebox<> > labelled = labeller_.shoeboxes();
-      finished_.insert(finished_.end(), labelled.begin(), labelled.end());
-      labeller_.clear();
-      return finished_;
+      af::shared<Shoebox<> > result = pop_finished();
+      result.insert(result.end(), pending_.begin(), pending_.end());
+      pending_ = af::shared<Shoebox<> >();
+      return result;
     }
 
   private:
-    Labeller labeller_;
+    /**
+     * Add a labelled spot to the pending or finished list
+     * @param shoebox The shoebox
+     * @param maxz The last frame of the current chunk
+     */
+    void add_labelled(const Shoebox<> &shoebox, int maxz) {
+      if (shoebox.bbox[5] == maxz) {
+        pending_.push_back(shoebox);
+      } else {
+        finished_.push_back(shoebox);
+      }
+    }
+
+    af::shared<Shoebox<> > pending_;
     af::shared<Shoebox<> > finished_;
     int all_minz_;
     int all_maxz_;
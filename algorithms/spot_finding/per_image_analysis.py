@@ -10,6 +10,7 @@
 from dials.algorithms.integration import filtering
 from dials.array_family import flex
 from dials.util import tabulate
+from dials_algorithms_spot_finding_ext import PerImageStatistics
 
 Slot = collections.namedtuple("Slot", "d_min d_max")
 _stats_field_names = [
@@ -553,17 +554,19 @@ def side(p1, p2, p):
     return inside
 
 
+def ice_ring_filter(d_min, width=0.004):
+    """Create the filter of the hexagonal ice rings to a resolution of d_min"""
+    unit_cell = uctbx.unit_cell((4.498, 4.498, 7.338, 90, 90, 120))
+    space_group = sgtbx.space_group_info(number=194).group()
+    return filtering.PowderRingFilter(unit_cell, space_group, d_min, width)
+
+
 def ice_rings_selection(reflections, width=0.004):
     d_star_sq = flex.pow2(reflections["rlp"].norms())
     d_spacings = uctbx.d_star_sq_as_d(d_star_sq)
 
-    unit_cell = uctbx.unit_cell((4.498, 4.498, 7.338, 90, 90, 120))
-    space_group = sgtbx.space_group_info(number=194).group()
-
     if d_spacings:
-        ice_filter = filtering.PowderRingFilter(
-            unit_cell, space_group, flex.min(d_spacings), width
-        )
+        ice_filter = ice_ring_filter(flex.min(d_spacings), width)
 
         ice_sel = ice_filter(d_spacings)
 
@@ -623,49 +626,59 @@ def stats_for_reflection_table(
     )
 
 
-def stats_per_image(experiment, reflections, resolution_analysis=True):
-    n_spots_total = []
-    n_spots_no_ice = []
-    n_spots_4A = []
-    total_intensity = []
-    estimated_d_min = []
-    d_min_distl_method_1 = []
-    d_min_distl_method_2 = []
-    noisiness_method_1 = []
-    noisiness_method_2 = []
-
-    image_number = reflections["xyzobs.px.value"].parts()[2]
-    image_number = flex.floor(image_number)
-
+def stats_per_image(
+    experiment,
+    reflections,
+    resolution_analysis=True,
+    filter_ice=True,
+    ice_rings_width=0.004,
+    nthreads=1,
+):
+    """
+    Compute the statistics of each image of a scan, as stats_for_reflection_table
+    does for the spots of a single image. The statistics of all the images are
+    computed in C++ in a single pass over the spots.
+    """
+    assert "rlp" in reflections, "Reflections must have been mapped to reciprocal space"
     try:
         start, end = experiment.scan.get_array_range()
     except AttributeError:
         start, end = 0, 1
-    for i in range(start, end):
-        stats = stats_for_reflection_table(
-            reflections.select(image_number == i),
-            resolution_analysis=resolution_analysis,
-        )
-        n_spots_total.append(stats.n_spots_total)
-        n_spots_no_ice.append(stats.n_spots_no_ice)
-        n_spots_4A.append(stats.n_spots_4A)
-        total_intensity.append(stats.total_intensity)
-        estimated_d_min.append(stats.estimated_d_min)
-        d_min_distl_method_1.append(stats.d_min_distl_method_1)
-        noisiness_method_1.append(stats.noisiness_method_1)
-        d_min_distl_method_2.append(stats.d_min_distl_method_2)
-        noisiness_method_2.append(stats.noisiness_method_2)
 
+    # The ice rings to the highest resolution of any image, which give the
+    # same selection on each image as the rings to the resolution of the image
+    ice_d_star_sq = flex.double()
+    ice_half_width = 0.0
+    norms = reflections["rlp"].norms()
+    d_spacings = uctbx.d_star_sq_as_d(flex.pow2(norms.select(norms > 0)))
+    if filter_ice and len(d_spacings):
+        ice_filter = ice_ring_filter(flex.min(d_spacings), width=ice_rings_width)
+        ice_d_star_sq = ice_filter.d_star_sq
+        ice_half_width = ice_filter.half_width
+
+    stats = PerImageStatistics(
+        reflections["xyzobs.px.value"].parts()[2],
+        reflections["rlp"],
+        reflections["intensity.sum.value"],
+        reflections["intensity.sum.variance"],
+        start,
+        end,
+        ice_d_star_sq,
+        ice_half_width,
+        filter_ice=filter_ice,
+        resolution_analysis=resolution_analysis,
+        nthreads=nthreads,
+    )
     return StatsMultiImage(
-        n_spots_total=n_spots_total,
-        n_spots_no_ice=n_spots_no_ice,
-        n_spots_4A=n_spots_4A,
-        total_intensity=total_intensity,
-        estimated_d_min=estimated_d_min,
-        d_min_distl_method_1=d_min_distl_method_1,
-        noisiness_method_1=noisiness_method_1,
-        d_min_distl_method_2=d_min_distl_method_2,
-        noisiness_method_2=noisiness_method_2,
+        n_spots_total=list(stats.n_spots_total()),
+        n_spots_no_ice=list(stats.n_spots_no_ice()),
+        n_spots_4A=list(stats.n_spots_4A()),
+        total_intensity=list(stats.total_intensity()),
+        estimated_d_min=list(stats.estimated_d_min()),
+        d_min_distl_method_1=list(stats.d_min_distl_method_1()),
+        noisiness_method_1=list(stats.noisiness_method_1()),
+        d_min_distl_method_2=list(stats.d_min_distl_method_2()),
+        noisiness_method_2=list(stats.noisiness_method_2()),
     )
 
 
@@ -0,0 +1,760 @@
+/*
+ * per_image_statistics.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPOT_FINDING_PER_IMAGE_STATISTICS_H
+#define DIALS_ALGORITHMS_SPOT_FINDING_PER_IMAGE_STATISTICS_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <set>
+#include <vector>
+#include <boost/math/special_functions/sign.hpp>
+#include <scitbx/vec3.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::vec3;
+
+  /**
+   * The estimators of dials.algorithms.spot_finding.per_image_analysis. Each
+   * follows the python implementation step by step, so that they give the
+   * same results, but works on plain arrays so that the images can be
+   * analysed in parallel.
+   */
+  namespace per_image_analysis {
+
+    /** Round to the nearest integer, as libtbx.math_utils.nearest_integer */
+    inline int nearest_integer(double x) {
+      return (int)std::floor(x + 0.5);
+    }
+
+    /** Compare the values at two indices, for a stable sort permutation */
+    struct IndexLess {
+      const std::vector<double> &values;
+      IndexLess(const std::vector<double> &values_) : values(values_) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        return values[a] < values[b];
+      }
+    };
+
+    /** Compare the values at two indices in reverse */
+    struct IndexGreater {
+      const std::vector<double> &values;
+      IndexGreater(const std::vector<double> &values_) : values(values_) {}
+      bool operator()(std::size_t a, std::size_t b) const {
+        return values[a] > values[b];
+      }
+    };
+
+    /**
+     * The stable sort permutation of the values, as flex.sort_permutation
+     * @param values The values
+     * @param reverse Sort in descending order
+     * @returns The permutation
+     */
+    inline std::vector<std::size_t> sort_permutation(const std::vector<double> &values,
+                                                     bool reverse = false) {
+      std::vector<std::size_t> perm(values.size());
+      for (std::size_t i = 0; i < perm.size(); ++i) {
+        perm[i] = i;
+      }
+      if (reverse) {
+        std::stable_sort(perm.begin(), perm.end(), IndexGreater(values));
+      } else {
+        std::stable_sort(perm.begin(), perm.end(), IndexLess(values));
+      }
+      return perm;
+    }
+
+    /** @returns The index of the first maximum value */
+    inline std::size_t max_index(const std::vector<double> &values, std::size_t first) {
+      DIALS_ASSERT(first < values.size());
+      std::size_t result = first;
+      for (std::size_t i = first + 1; i < values.size(); ++i) {
+        if (values[i] > values[result]) {
+          result = i;
+        }
+      }
+      return result;
+    }
+
+    /**
+     * The least squares fit of a line, as flex.linear_regression. The slope
+     * and intercept are zero if the fit is not defined.
+     */
+    struct LinearFit {
+      double slope;
+      double intercept;
+
+      LinearFit(const std::vector<double> &x, const std::vector<double> &y)
+          : slope(0), intercept(0) {
+        DIALS_ASSERT(x.size() == y.size());
+        if (x.empty()) {
+          return;
+        }
+        double x_mean = 0, y_mean = 0;
+        for (std::size_t i = 0; i < x.size(); ++i) {
+          x_mean += x[i];
+          y_mean += y[i];
+        }
+        x_mean /= x.size();
+        y_mean /= y.size();
+        double sum_xx = 0, sum_xy = 0;
+        for (std::size_t i = 0; i < x.size(); ++i) {
+          double dx = x[i] - x_mean;
+          sum_xx += dx * dx;
+          sum_xy += dx * (y[i] - y_mean);
+        }
+        if (sum_xx < 1e-15) {
+          return;
+        }
+        slope = sum_xy / sum_xx;
+        intercept = y_mean - slope * x_mean;
+      }
+    };
+
+    /**
+     * The spots of an image with a positive variance, which are those used
+     * by the resolution estimates
+     */
+    struct Spots {
+      std::vector<double> norm;
+      std::vector<double> d_star_sq;
+      std::vector<double> d;
+      std::vector<double> intensity;
+      std::vector<double> variance;
+      std::vector<bool> ice;
+    };
+
+    /**
+     * Find the outliers of a Wilson distribution, iteratively removing them
+     * until there are no more
+     * @param intensity The intensities
+     * @param ice Whether each spot is in an ice ring
+     * @param index The spots to test
+     * @param outliers Set for the outliers
+     */
+    inline void wilson_outliers(const std::vector<double> &intensity,
+                                const std::vector<bool> &ice,
+                                std::vector<std::size_t> index,
+                                std::vector<bool> &outliers) {
+      const double E_cutoff = std::sqrt(-std::log(1e-2));
+      while (!index.empty()) {
+        double sum = 0;
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < index.size(); ++i) {
+          if (!ice[index[i]]) {
+            sum += intensity[index[i]];
+            count++;
+          }
+        }
+        if (count == 0) {
+          return;
+        }
+        double Sigma_n = sum / count;
+        std::vector<std::size_t> inliers;
+        for (std::size_t i = 0; i < index.size(); ++i) {
+          double E = std::sqrt(intensity[index[i]]) / std::sqrt(Sigma_n);
+          if (E >= E_cutoff) {
+            outliers[index[i]] = true;
+          } else {
+            inliers.push_back(index[i]);
+          }
+        }
+        if (inliers.size() == index.size()) {
+          return;
+        }
+        index.swap(inliers);
+      }
+    }
+
+    /**
+     * Whether a point is below a line, as points_below_line
+     */
+    inline bool point_below_line(double x, double y, double m, double c) {
+      double diff = (m * 1 + c) - c;
+      double d = 0.0 + x * -diff + (y - c) * 1.0;
+      return boost::math::signbit(d) != 0;
+    }
+
+    /**
+     * Estimate the resolution limit from the fall off of I/sigma, as
+     * estimate_resolution_limit
+     * @param spots The spots of the image
+     * @returns The resolution estimate or -1
+     */
+    inline double estimate_resolution_limit(const Spots &spots) {
+      const std::vector<double> &d_star_sq = spots.d_star_sq;
+      const std::vector<double> &d = spots.d;
+      const std::vector<bool> &ice = spots.ice;
+      std::size_t n = d_star_sq.size();
+      if (n == 0) {
+        return -1;
+      }
+      std::vector<double> log_i_over_sigi(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        log_i_over_sigi[i] =
+          std::log(spots.intensity[i] / std::sqrt(spots.variance[i]));
+      }
+
+      // The bins of equal population, as binner_equal_population
+      int n_slots = std::max(std::min((int)(n / 20), 20), 5);
+      double n_per_bin = (double)n / n_slots;
+      std::vector<double> d_sorted(d_star_sq);
+      std::sort(d_sorted.begin(), d_sorted.end());
+      for (std::size_t i = 0; i < n; ++i) {
+        d_sorted[i] = 1.0 / std::sqrt(d_sorted[i]);
+      }
+
+      std::vector<double> log_i_sigi_lower, d_star_sq_lower;
+      std::vector<double> log_i_sigi_upper, d_star_sq_upper;
+      std::vector<bool> outliers_all(n, false);
+      double d_max = d_sorted[0];
+      for (int i_slot = 0; i_slot < n_slots; ++i_slot) {
+        int j = nearest_integer((i_slot + 1) * n_per_bin) - 1;
+        DIALS_ASSERT(j >= 0 && j < (int)n);
+        double d_min = d_sorted[j];
+        double slot_d_max = d_max;
+        d_max = d_min;
+
+        std::vector<std::size_t> sel_all;
+        bool any = false;
+        for (std::size_t i = 0; i < n; ++i) {
+          if (d[i] < slot_d_max && d[i] >= d_min) {
+            sel_all.push_back(i);
+            any = any || !ice[i];
+          }
+        }
+        if (!any) {
+          continue;
+        }
+        wilson_outliers(spots.intensity, ice, sel_all, outliers_all);
+
+        std::vector<double> log_sel, d_star_sq_sel;
+        for (std::size_t i = 0; i < sel_all.size(); ++i) {
+          if (!outliers_all[sel_all[i]] && !ice[sel_all[i]]) {
+            log_sel.push_back(log_i_over_sigi[sel_all[i]]);
+            d_star_sq_sel.push_back(d_star_sq[sel_all[i]]);
+          }
+        }
+        if (log_sel.empty()) {
+          continue;
+        }
+        std::vector<std::size_t> perm = sort_permutation(log_sel);
+        std::size_t i_lower = perm[(std::size_t)std::floor(0.1 * perm.size())];
+        std::size_t i_upper = perm[(std::size_t)std::floor((1 - 0.1) * perm.size())];
+        log_i_sigi_lower.push_back(log_sel[i_lower]);
+        log_i_sigi_upper.push_back(log_sel[i_upper]);
+        d_star_sq_upper.push_back(d_star_sq_sel[i_lower]);
+        d_star_sq_lower.push_back(d_star_sq_sel[i_upper]);
+      }
+
+      LinearFit fit_upper(d_star_sq_upper, log_i_sigi_upper);
+      LinearFit fit_lower(d_star_sq_lower, log_i_sigi_lower);
+      if (fit_upper.slope == fit_lower.slope) {
+        return -1;
+      }
+      bool found = false;
+      double d_star_sq_estimate = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        if (!outliers_all[i] && !ice[i]
+            && point_below_line(d_star_sq[i],
+                                log_i_over_sigi[i],
+                                fit_upper.slope,
+                                fit_upper.intercept)) {
+          if (!found || d_star_sq[i] > d_star_sq_estimate) {
+            d_star_sq_estimate = d_star_sq[i];
+          }
+          found = true;
+        }
+      }
+      return found ? 1.0 / std::sqrt(d_star_sq_estimate) : -1;
+    }
+
+    /**
+     * Estimate the resolution limit with method 1 of Zhang et al (2006), as
+     * estimate_resolution_limit_distl_method1
+     * @param spots The spots of the image
+     * @param d_min The resolution estimate, or -1
+     * @param noisiness The noisiness of the estimate, or -1
+     */
+    inline void estimate_resolution_limit_distl_method1(const Spots &spots,
+                                                        double &d_min,
+                                                        double &noisiness) {
+      d_min = -1;
+      noisiness = -1;
+      std::size_t nref = spots.d.size();
+      std::size_t step = 2;
+      while ((double)nref / step > 40) {
+        step++;
+      }
+      std::vector<std::size_t> order = sort_permutation(spots.d, true);
+      std::vector<double> ds3_subset, d_subset;
+      for (std::size_t i = 0; i < nref / step; ++i) {
+        ds3_subset.push_back(std::pow(spots.norm[order[i * step]], 3.0));
+        d_subset.push_back(spots.d[order[i * step]]);
+      }
+      std::size_t n = ds3_subset.size();
+      const std::size_t skip_first = 3;
+      if (n < skip_first + 2) {
+        return;
+      }
+
+      // (i)
+      std::vector<double> slopes(n - 1);
+      for (std::size_t i = 1; i < n; ++i) {
+        slopes[i - 1] = (ds3_subset[i] - ds3_subset[0]) / ((double)i - 0.0);
+      }
+      std::size_t p_m = max_index(slopes, skip_first) + 1;
+
+      // (ii)
+      double v0 = ds3_subset[p_m] - ds3_subset[0];
+      double v1 = -((double)p_m - 0);
+      double length = std::sqrt(0.0 + v0 * v0 + v1 * v1);
+      v0 /= length;
+      v1 /= length;
+      std::vector<double> gaps(1, 0);
+      for (std::size_t i = 1; i < p_m; ++i) {
+        double r0 = 0 - (double)i;
+        double r1 = ds3_subset[0] - ds3_subset[i];
+        gaps.push_back(std::abs(0.0 + v0 * r0 + v1 * r1));
+      }
+      double mean = 0;
+      for (std::size_t i = 0; i < gaps.size(); ++i) {
+        mean += gaps[i];
+      }
+      mean /= gaps.size();
+      double var = 0;
+      for (std::size_t i = 0; i < gaps.size(); ++i) {
+        var += (gaps[i] - mean) * (gaps[i] - mean);
+      }
+      double s = std::sqrt(var / (gaps.size() - 1));
+
+      // (iii)
+      std::size_t p_k = max_index(gaps, 0);
+      double g_k = gaps[p_k];
+      std::size_t p_g = p_k;
+      for (std::size_t i = p_k + 1; i < gaps.size(); ++i) {
+        if (gaps[i] > (g_k - 0.5 * s)) {
+          p_g = i;
+        }
+      }
+      d_min = d_subset[p_g];
+
+      std::size_t count = 0;
+      for (std::size_t i = 0; i + 1 < n; ++i) {
+        for (std::size_t j = i + 1; j + 1 < n; ++j) {
+          if (slopes[i] >= slopes[j]) {
+            count++;
+          }
+        }
+      }
+      noisiness = count / ((n - 1) * (n - 2) / 2.0);
+    }
+
+    /**
+     * Estimate the resolution limit with method 2 of Zhang et al (2006), as
+     * estimate_resolution_limit_distl_method2
+     * @param spots The spots of the image
+     * @param d_min The resolution estimate, or -1
+     * @param noisiness The noisiness of the estimate, or -1
+     */
+    inline void estimate_resolution_limit_distl_method2(const Spots &spots,
+                                                        double &d_min,
+                                                        double &noisiness) {
+      d_min = -1;
+      noisiness = -1;
+
+      // The bins of equal volume in d*^3, as binner_d_star_cubed
+      std::set<double> unique(spots.d.begin(), spots.d.end());
+      std::vector<double> ds3(unique.size());
+      std::size_t k = ds3.size();
+      for (std::set<double>::const_iterator it = unique.begin(); it != unique.end();
+           ++it) {
+        ds3[--k] = std::pow(1 / *it, 3.0);
+      }
+      std::size_t nd = ds3.size();
+      std::size_t low_res_count =
+        (std::size_t)std::ceil(std::min(std::max(25.0, 0.05 * nd), 0.25 * nd));
+      if (low_res_count >= nd) {
+        return;
+      }
+      double bin_step = ds3[low_res_count] - ds3[0];
+      if (!(bin_step > 0)) {
+        return;
+      }
+      int n_slots = (int)std::ceil((ds3[nd - 1] - ds3[0]) / bin_step);
+      n_slots = std::max(std::min(n_slots, 40), 20);
+      bin_step = (ds3[nd - 1] - ds3[0]) / n_slots;
+      std::vector<double> bin_d_min(n_slots), bin_d_max(n_slots);
+      double ds3_max = ds3[0];
+      for (int i = 0; i < n_slots; ++i) {
+        double ds3_min = ds3[0] + (i + 1) * bin_step;
+        bin_d_min[i] = 1 / std::pow(ds3_min, 1.0 / 3.0);
+        bin_d_max[i] = 1 / std::pow(ds3_max, 1.0 / 3.0);
+        ds3_max = ds3_min;
+      }
+
+      std::vector<std::size_t> bin_counts(n_slots, 0);
+      for (int i = 0; i < n_slots; ++i) {
+        for (std::size_t j = 0; j < spots.d.size(); ++j) {
+          if (spots.d[j] < bin_d_max[i] && spots.d[j] >= bin_d_min[i]) {
+            bin_counts[i]++;
+          }
+        }
+      }
+
+      double t0 = (bin_counts[0] + bin_counts[1]) / 2.0;
+      const double mu = 0.15;
+      int i = 0;
+      for (; i < n_slots - 1; ++i) {
+        if (bin_counts[i] < mu * t0 && bin_counts[i + 1] < mu * t0) {
+          break;
+        }
+      }
+      if (i == n_slots - 1) {
+        i = n_slots - 2;
+      }
+      d_min = bin_d_min[i];
+
+      std::size_t count = 0;
+      for (int a = 0; a < n_slots; ++a) {
+        for (int b = a + 1; b < n_slots; ++b) {
+          if (bin_counts[a] <= bin_counts[b]) {
+            count++;
+          }
+        }
+      }
+      noisiness = count / (0.5 * n_slots * (n_slots - 1));
+    }
+
+  }  // namespace per_image_analysis
+
+  /**
+   * Compute the statistics of dials.algorithms.spot_finding.per_image_analysis
+   * for every image of a scan in one pass over the strong spots. The spots
+   * are grouped by image with a counting sort, which keeps their order, and
+   * the images are analysed in parallel.
+   */
+  class PerImageStatistics {
+  public:
+    /**
+     * @param z The z centroid of each spot in images
+     * @param rlp The reciprocal lattice point of each spot
+     * @param intensity The summed intensity of each spot
+     * @param variance The variance of the summed intensity
+     * @param first_image The first image of the scan, as an array index
+     * @param last_image One past the last image of the scan
+     * @param ice_d_star_sq The d*^2 of the ice rings, in ascending order
+     * @param ice_half_width The half width of the ice rings in d*^2
+     * @param filter_ice Exclude the spots in the ice rings
+     * @param resolution_analysis Estimate the resolution limits
+     * @param nthreads The number of threads
+     */
+    PerImageStatistics(const af::const_ref<double> &z,
+                       const af::const_ref<vec3<double> > &rlp,
+                       const af::const_ref<double> &intensity,
+                       const af::const_ref<double> &variance,
+                       int first_image,
+                       int last_image,
+                       const af::const_ref<double> &ice_d_star_sq,
+                       double ice_half_width,
+                       bool filter_ice,
+                       bool resolution_analysis,
+                       std::size_t nthreads)
+        : n_spots_total_(std::max(last_image - first_image, 0)),
+          n_spots_no_ice_(n_spots_total_.size()),
+          n_spots_4A_(n_spots_total_.size()),
+          total_intensity_(n_spots_total_.size()),
+          estimated_d_min_(n_spots_total_.size(), -1),
+          d_min_distl_method_1_(n_spots_total_.size(), -1),
+          noisiness_method_1_(n_spots_total_.size(), -1),
+          d_min_distl_method_2_(n_spots_total_.size(), -1),
+          noisiness_method_2_(n_spots_total_.size(), -1) {
+      DIALS_ASSERT(rlp.size() == z.size());
+      DIALS_ASSERT(intensity.size() == z.size());
+      DIALS_ASSERT(variance.size() == z.size());
+      DIALS_ASSERT(ice_half_width >= 0);
+      DIALS_ASSERT(nthreads > 0);
+
+      // Group the spots by image
+      std::size_t nimages = n_spots_total_.size();
+      std::vector<std::size_t> offset(nimages + 1, 0);
+      std::vector<int> image(z.size());
+      for (std::size_t i = 0; i < z.size(); ++i) {
+        double frame = std::floor(z[i]);
+        image[i] = -1;
+        if (frame >= first_image && frame < last_image) {
+          image[i] = (int)frame - first_image;
+          offset[image[i] + 1]++;
+        }
+      }
+      for (std::size_t i = 0; i < nimages; ++i) {
+        offset[i + 1] += offset[i];
+      }
+      std::vector<std::size_t> index(offset[nimages]);
+      std::vector<std::size_t> next(offset.begin(), offset.end() - 1);
+      for (std::size_t i = 0; i < z.size(); ++i) {
+        if (image[i] >= 0) {
+          index[next[image[i]]++] = i;
+        }
+      }
+
+      std::vector<double> rings(ice_d_star_sq.begin(), ice_d_star_sq.end());
+      for (std::size_t i = 1; i < rings.size(); ++i) {
+        DIALS_ASSERT(rings[i - 1] <= rings[i]);
+      }
+      Analyse analyse(rlp,
+                      intensity,
+                      variance,
+                      offset,
+                      index,
+                      rings,
+                      ice_half_width,
+                      filter_ice,
+                      resolution_analysis,
+                      *this);
+      for_each_band(analyse, (int)nimages, nthreads);
+    }
+
+    /** @returns The number of spots on each image */
+    af::shared<std::size_t> n_spots_total() const {
+      return n_spots_total_;
+    }
+
+    /** @returns The number of spots outside the ice rings */
+    af::shared<std::size_t> n_spots_no_ice() const {
+      return n_spots_no_ice_;
+    }
+
+    /** @returns The number of spots at a resolution lower than 4A */
+    af::shared<std::size_t> n_spots_4A() const {
+      return n_spots_4A_;
+    }
+
+    /** @returns The total intensity of the spots outside the ice rings */
+    af::shared<double> total_intensity() const {
+      return total_intensity_;
+    }
+
+    /** @returns The resolution estimate from the fall off of I/sigma */
+    af::shared<double> estimated_d_min() const {
+      return estimated_d_min_;
+    }
+
+    /** @returns The resolution estimate of distl method 1 */
+    af::shared<double> d_min_distl_method_1() const {
+      return d_min_distl_method_1_;
+    }
+
+    /** @returns The noisiness of distl method 1 */
+    af::shared<double> noisiness_method_1() const {
+      return noisiness_method_1_;
+    }
+
+    /** @returns The resolution estimate of distl method 2 */
+    af::shared<double> d_min_distl_method_2() const {
+      return d_min_distl_method_2_;
+    }
+
+    /** @returns The noisiness of distl method 2 */
+    af::shared<double> noisiness_method_2() const {
+      return noisiness_method_2_;
+    }
+
+  private:
+    /**
+     * Analyse a band of images. The results are written to the arrays of
+     * the statistics, which are allocated before the threads start.
+     */
+    struct Analyse {
+      af::const_ref<vec3<double> > rlp;
+      af::const_ref<double> intensity;
+      af::const_ref<double> variance;
+      const std::vector<std::size_t> &offset;
+      const std::vector<std::size_t> &index;
+      const std::vector<double> &rings;
+      double half_width;
+      bool filter_ice;
+      bool resolution_analysis;
+      af::ref<std::size_t> n_spots_total;
+      af::ref<std::size_t> n_spots_no_ice;
+      af::ref<std::size_t> n_spots_4A;
+      af::ref<double> total_intensity;
+      af::ref<double> estimated_d_min;
+      af::ref<double> d_min_distl_method_1;
+      af::ref<double> noisiness_method_1;
+      af::ref<double> d_min_distl_method_2;
+      af::ref<double> noisiness_method_2;
+
+      Analyse(const af::const_ref<vec3<double> > &rlp_,
+              const af::const_ref<double> &intensity_,
+              const af::const_ref<double> &variance_,
+              const std::vector<std::size_t> &offset_,
+              const std::vector<std::size_t> &index_,
+              const std::vector<double> &rings_,
+              double half_width_,
+              bool filter_ice_,
+              bool resolution_analysis_,
+              PerImageStatistics &stats)
+          : rlp(rlp_),
+            intensity(intensity_),
+            variance(variance_),
+            offset(offset_),
+            index(index_),
+            rings(rings_),
+            half_width(half_width_),
+            filter_ice(filter_ice_),
+            resolution_analysis(resolution_analysis_),
+            n_spots_total(stats.n_spots_total_.ref()),
+            n_spots_no_ice(stats.n_spots_no_ice_.ref()),
+            n_spots_4A(stats.n_spots_4A_.ref()),
+            total_intensity(stats.total_intensity_.ref()),
+            estimated_d_min(stats.estimated_d_min_.ref()),
+            d_min_distl_method_1(stats.d_min_distl_method_1_.ref()),
+            noisiness_method_1(stats.noisiness_method_1_.ref()),
+            d_min_distl_method_2(stats.d_min_distl_method_2_.ref()),
+            noisiness_method_2(stats.noisiness_method_2_.ref()) {}
+
+      /** @returns True if the d*^2 of a resolution is in an ice ring */
+      bool in_ice_ring(double d) const {
+        double d_star_sq = 1 / (d * d);
+        std::vector<double>::const_iterator it =
+          std::lower_bound(rings.begin(), rings.end(), d_star_sq);
+        if (it != rings.end() && std::abs(d_star_sq - *it) < half_width) {
+          return true;
+        }
+        return it != rings.begin() && std::abs(d_star_sq - *(it - 1)) < half_width;
+      }
+
+      void operator()(int j0, int j1) const {
+        for (int j = j0; j < j1; ++j) {
+          analyse_image(j);
+        }
+      }
+
+      void analyse_image(std::size_t j) const {
+        // The spots with a reciprocal lattice point
+        std::vector<double> norm, d_star_sq, d, spot_intensity, spot_variance;
+        for (std::size_t k = offset[j]; k < offset[j + 1]; ++k) {
+          double length = rlp[index[k]].length();
+          if (length > 0) {
+            norm.push_back(length);
+            d_star_sq.push_back(length * length);
+            d.push_back(1 / std::sqrt(d_star_sq.back()));
+            spot_intensity.push_back(intensity[index[k]]);
+            spot_variance.push_back(variance[index[k]]);
+          }
+        }
+        std::vector<bool> ice(d.size(), false);
+        if (filter_ice) {
+          for (std::size_t i = 0; i < d.size(); ++i) {
+            ice[i] = in_ice_ring(d[i]);
+          }
+        }
+
+        std::size_t n_no_ice = 0;
+        std::size_t n_4A = 0;
+        double total = 0;
+        for (std::size_t i = 0; i < d.size(); ++i) {
+          if (!ice[i]) {
+            n_no_ice++;
+            total += spot_intensity[i];
+          }
+          if (d[i] > 4) {
+            n_4A++;
+          }
+        }
+        n_spots_total[j] = d.size();
+        n_spots_no_ice[j] = n_no_ice;
+        n_spots_4A[j] = n_4A;
+        total_intensity[j] = total;
+        if (!resolution_analysis || n_no_ice <= 10) {
+          return;
+        }
+
+        // The estimators only use the spots with a positive variance
+        per_image_analysis::Spots spots;
+        for (std::size_t i = 0; i < d.size(); ++i) {
+          if (spot_variance[i] > 0) {
+            spots.norm.push_back(norm[i]);
+            spots.d_star_sq.push_back(d_star_sq[i]);
+            spots.d.push_back(d[i]);
+            spots.intensity.push_back(spot_intensity[i]);
+            spots.variance.push_back(spot_variance[i]);
+            spots.ice.push_back(ice[i]);
+          }
+        }
+        estimated_d_min[j] = per_image_analysis::estimate_resolution_limit(spots);
+        per_image_analysis::estimate_resolution_limit_distl_method1(
+          spots, d_min_distl_method_1[j], noisiness_method_1[j]);
+        per_image_analysis::estimate_resolution_limit_distl_method2(
+          spots, d_min_distl_method_2[j], noisiness_method_2[j]);
+      }
+    };
+
+    af::shared<std::size_t> n_spots_total_;
+    af::shared<std::size_t> n_spots_no_ice_;
+    af::shared<std::size_t> n_spots_4A_;
+    af::shared<double> total_intensity_;
+    af::shared<double> estimated_d_min_;
+    af::shared<double> d_min_distl_method_1_;
+    af::shared<double> noisiness_method_1_;
+    af::shared<double> d_min_distl_method_2_;
+    af::shared<double> noisiness_method_2_;
+  };
+
+  /**
+   * The mean of the values in each of a set of slots, such as those of a
+   * histogram, or zero for an empty slot. A value is in a slot if its
+   * position is at least the low cutoff and less than the high cutoff.
+   * @param x The position of each value
+   * @param values The values
+   * @param low_cutoff The low cutoff of each slot, in ascending order
+   * @param high_cutoff The high cutoff of each slot
+   * @returns The mean of each slot
+   */
+  inline af::shared<double> slot_means(const af::const_ref<double> &x,
+                                       const af::const_ref<double> &values,
+                                       const af::const_ref<double> &low_cutoff,
+                                       const af::const_ref<double> &high_cutoff) {
+    DIALS_ASSERT(x.size() == values.size());
+    DIALS_ASSERT(low_cutoff.size() == high_cutoff.size());
+    std::vector<double> sum(low_cutoff.size(), 0);
+    std::vector<std::size_t> count(low_cutoff.size(), 0);
+    for (std::size_t i = 0; i < x.size(); ++i) {
+      const double *it = std::upper_bound(low_cutoff.begin(), low_cutoff.end(), x[i]);
+      // Check the slots which start at or before the position, in case the
+      // slots overlap
+      while (it != low_cutoff.begin()) {
+        --it;
+        std::size_t slot = it - low_cutoff.begin();
+        if (x[i] < high_cutoff[slot]) {
+          sum[slot] += values[i];
+          count[slot]++;
+        } else {
+          break;
+        }
+      }
+    }
+    af::shared<double> result(low_cutoff.size(), 0);
+    for (std::size_t i = 0; i < result.size(); ++i) {
+      if (count[i] > 0) {
+        result[i] = sum[i] / count[i];
+      }
+    }
+    return result;
+  }
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPOT_FINDING_PER_IMAGE_STATISTICS_H
@@ -0,0 +1,234 @@
+/*
+ * spot_matcher.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPOT_FINDING_SPOT_MATCHER_H
+#define DIALS_ALGORITHMS_SPOT_FINDING_SPOT_MATCHER_H
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <scitbx/vec3.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/array_family/hash_join.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using scitbx::vec3;
+
+  /**
+   * A grid of cells over the positions of a set of spots, such as the
+   * predicted centroids of reflections, to find the closest spot on the same
+   * panel to each of a set of points, such as observed centroids, within a
+   * maximum separation. The cells are the size of the maximum separation,
+   * so only the cells next to that of a point need to be searched. The cell
+   * of each spot is hashed into a power of two of buckets, which hold the
+   * spots in order, and the index can be reused for many queries.
+   */
+  class SpotGridIndex {
+  public:
+    /**
+     * @param xyz The position of each spot
+     * @param panel The panel of each spot
+     * @param max_separation The maximum separation of a match
+     */
+    SpotGridIndex(const af::const_ref<vec3<double> > &xyz,
+                  const af::const_ref<std::size_t> &panel,
+                  double max_separation)
+        : xyz_(xyz.begin(), xyz.end()),
+          panel_(panel.begin(), panel.end()),
+          max_separation_(max_separation) {
+      DIALS_ASSERT(panel.size() == xyz.size());
+      DIALS_ASSERT(max_separation > 0);
+      std::size_t nbuckets = 1;
+      while (nbuckets < 2 * xyz.size()) {
+        nbuckets *= 2;
+      }
+      mask_ = nbuckets - 1;
+      std::vector<std::size_t> bucket(xyz.size());
+      start_.assign(nbuckets + 1, 0);
+      for (std::size_t j = 0; j < xyz.size(); ++j) {
+        vec3<boost::int64_t> c = cell(xyz[j]);
+        bucket[j] = cell_bucket(panel[j], c[0], c[1], c[2]);
+        start_[bucket[j] + 1]++;
+      }
+      for (std::size_t k = 0; k < nbuckets; ++k) {
+        start_[k + 1] += start_[k];
+      }
+      std::vector<std::size_t> offset(start_.begin(), start_.end() - 1);
+      entries_.resize(xyz.size());
+      for (std::size_t j = 0; j < xyz.size(); ++j) {
+        entries_[offset[bucket[j]]++] = j;
+      }
+    }
+
+    /** @returns The number of spots */
+    std::size_t size() const {
+      return xyz_.size();
+    }
+
+    /** @returns The maximum separation of a match */
+    double max_separation() const {
+      return max_separation_;
+    }
+
+    /**
+     * Find the closest spot to each point. Ties are won by the first spot.
+     * @param xyz The position of each point
+     * @param panel The panel of each point
+     * @param index The closest spot to each point, or -1 if there are none
+     *              within the maximum separation
+     * @param distance The distance to the closest spot
+     * @param nthreads The number of threads to use
+     */
+    void nearest(const af::const_ref<vec3<double> > &xyz,
+                 const af::const_ref<std::size_t> &panel,
+                 af::ref<int> index,
+                 af::ref<double> distance,
+                 std::size_t nthreads = 1) const {
+      DIALS_ASSERT(panel.size() == xyz.size());
+      DIALS_ASSERT(index.size() == xyz.size());
+      DIALS_ASSERT(distance.size() == xyz.size());
+      for_each_band(
+        NearestBand(*this, xyz, panel, index, distance), (int)xyz.size(), nthreads);
+    }
+
+    /**
+     * Match points to spots one to one. Each point is paired with its
+     * closest spot, and each spot is then kept by the closest of the points
+     * paired with it. The matches are returned in order of point.
+     * @param xyz The position of each point
+     * @param panel The panel of each point
+     * @param point_index The point of each match
+     * @param spot_index The spot of each match
+     * @param nthreads The number of threads to use
+     */
+    void match(const af::const_ref<vec3<double> > &xyz,
+               const af::const_ref<std::size_t> &panel,
+               af::shared<std::size_t> point_index,
+               af::shared<std::size_t> spot_index,
+               std::size_t nthreads = 1) const {
+      if (xyz.size() == 0) {
+        DIALS_ASSERT(panel.size() == 0);
+        return;
+      }
+      std::vector<int> index(xyz.size(), -1);
+      std::vector<double> distance(xyz.size(), 0);
+      nearest(xyz,
+              panel,
+              af::ref<int>(&index[0], index.size()),
+              af::ref<double>(&distance[0], distance.size()),
+              nthreads);
+      af::shared<std::size_t> pairs_a;
+      af::shared<std::size_t> pairs_b;
+      af::shared<double> pairs_d;
+      for (std::size_t i = 0; i < index.size(); ++i) {
+        if (index[i] >= 0) {
+          pairs_a.push_back(i);
+          pairs_b.push_back(index[i]);
+          pairs_d.push_back(distance[i]);
+        }
+      }
+      af::unique_closest_pairs(pairs_a.const_ref(),
+                               pairs_b.const_ref(),
+                               pairs_d.const_ref(),
+                               point_index,
+                               spot_index);
+    }
+
+  private:
+    /**
+     * Find the closest spots to a band of points
+     */
+    struct NearestBand {
+      const SpotGridIndex &grid;
+      af::const_ref<vec3<double> > xyz;
+      af::const_ref<std::size_t> panel;
+      af::ref<int> index;
+      af::ref<double> distance;
+
+      NearestBand(const SpotGridIndex &grid_,
+                  const af::const_ref<vec3<double> > &xyz_,
+                  const af::const_ref<std::size_t> &panel_,
+                  af::ref<int> index_,
+                  af::ref<double> distance_)
+          : grid(grid_),
+            xyz(xyz_),
+            panel(panel_),
+            index(index_),
+            distance(distance_) {}
+
+      void operator()(int i0, int i1) const {
+        double max_d2 = grid.max_separation_ * grid.max_separation_;
+        for (int i = i0; i < i1; ++i) {
+          vec3<boost::int64_t> c = grid.cell(xyz[i]);
+          std::size_t best = std::numeric_limits<std::size_t>::max();
+          double best_d2 = max_d2;
+          for (int dz = -1; dz <= 1; ++dz) {
+            for (int dy = -1; dy <= 1; ++dy) {
+              for (int dx = -1; dx <= 1; ++dx) {
+                std::size_t bucket =
+                  grid.cell_bucket(panel[i], c[0] + dx, c[1] + dy, c[2] + dz);
+                for (std::size_t e = grid.start_[bucket]; e < grid.start_[bucket + 1];
+                     ++e) {
+                  std::size_t j = grid.entries_[e];
+                  if (grid.panel_[j] != panel[i]) {
+                    continue;
+                  }
+                  double d2 = (grid.xyz_[j] - xyz[i]).length_sq();
+                  if (d2 < best_d2 || (d2 == best_d2 && j < best)) {
+                    best = j;
+                    best_d2 = d2;
+                  }
+                }
+              }
+            }
+          }
+          if (best < grid.xyz_.size()) {
+            index[i] = (int)best;
+            distance[i] = std::sqrt(best_d2);
+          } else {
+            index[i] = -1;
+            distance[i] = 0;
+          }
+        }
+      }
+    };
+
+    /** @returns The cell of a position */
+    vec3<boost::int64_t> cell(const vec3<double> &x) const {
+      return vec3<boost::int64_t>((boost::int64_t)std::floor(x[0] / max_separation_),
+                                  (boost::int64_t)std::floor(x[1] / max_separation_),
+                                  (boost::int64_t)std::floor(x[2] / max_separation_));
+    }
+
+    /** @returns The bucket of a cell */
+    std::size_t cell_bucket(std::size_t panel,
+                            boost::int64_t cx,
+                            boost::int64_t cy,
+                            boost::int64_t cz) const {
+      boost::uint64_t h = af::hash_mix((boost::uint64_t)panel);
+      h = af::hash_mix(h ^ (boost::uint64_t)cx);
+      h = af::hash_mix(h ^ (boost::uint64_t)cy);
+      h = af::hash_mix(h ^ (boost::uint64_t)cz);
+      return (std::size_t)h & mask_;
+    }
+
+    std::vector<vec3<double> > xyz_;
+    std::vector<std::size_t> panel_;
+    double max_separation_;
+    std::size_t mask_;
+    std::vector<std::size_t> start_;
+    std::vector<std::size_t> entries_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPOT_FINDING_SPOT_MATCHER_H
@@ -0,0 +1,346 @@
+"""
+Find spots and compute the per-image statistics on frames as they arrive from
+a detector stream, rather than from files once the data collection is done.
+
+The frames are put into a ring buffer by the thread receiving them, and a pool
+of worker threads takes them from the buffer, finds the spots and passes the
+statistics for each frame to a callback. The threshold is computed in C++ with
+the GIL released, so the worker threads can analyse frames concurrently.
+"""
+
+import collections
+import json
+import logging
+import threading
+
+from dials.algorithms.spot_finding import per_image_analysis
+from dials.array_family import flex
+
+logger = logging.getLogger(__name__)
+
+# A frame from the stream: the frame number and the image of each panel
+Frame = collections.namedtuple("Frame", ["number", "data"])
+
+
+class FrameBuffer(object):
+    """
+    A ring buffer of frames waiting to be processed. When the buffer is full
+    either the oldest frame is dropped, so the analysis keeps up with the
+    detector, or the producer waits for a free slot.
+    """
+
+    def __init__(self, size, block=False):
+        """
+        :param size: The maximum number of frames to hold
+        :param block: Wait for a free slot instead of dropping frames
+        """
+        assert size > 0
+        self.size = size
+        self.block = block
+        self.dropped = []
+        self._frames = collections.deque()
+        self._closed = False
+        self._condition = threading.Condition()
+
+    def __len__(self):
+        with self._condition:
+            return len(self._frames)
+
+    def put(self, frame):
+        """
+        Add a frame to the buffer.
+
+        :param frame: The frame
+        """
+        with self._condition:
+            assert not self._closed, "The buffer is closed"
+            if self.block:
+                while len(self._frames) >= self.size:
+                    self._condition.wait()
+            elif len(self._frames) >= self.size:
+                self.dropped.append(self._frames.popleft().number)
+            self._frames.append(frame)
+            self._condition.notify_all()
+
+    def get(self):
+        """
+        Take the oldest frame from the buffer, waiting for one if necessary.
+
+        :returns: The frame, or None once the buffer is closed and empty
+        """
+        with self._condition:
+            while not self._frames and not self._closed:
+                self._condition.wait()
+            if not self._frames:
+                return None
+            frame = self._frames.popleft()
+            self._condition.notify_all()
+            return frame
+
+    def close(self):
+        """Stop accepting frames. The frames in the buffer are still given out."""
+        with self._condition:
+            self._closed = True
+            self._condition.notify_all()
+
+
+class FrameAnalyser(object):
+    """
+    Find the spots on a single frame and compute the per-image statistics.
+
+    Each worker thread needs its own analyser, since the threshold algorithm
+    keeps its workspace from one frame to the next.
+    """
+
+    def __init__(
+        self,
+        experiments,
+        params,
+        mask,
+        resolution_analysis=True,
+        filter_ice=True,
+        ice_rings_width=0.004,
+    ):
+        """
+        :param experiments: The experiment giving the models of the stream
+        :param params: The spot finding parameters
+        :param mask: The static mask of each panel
+        :param resolution_analysis: Estimate the resolution limits
+        :param filter_ice: Exclude spots at ice ring resolutions
+        :param ice_rings_width: The width of the ice rings
+        """
+        from dials.algorithms.spot_finding.factory import SpotFinderFactory
+
+        self.experiments = experiments
+        self.imageset = experiments[0].imageset
+        self.detector = experiments[0].detector
+        self.mask = mask
+        SpotFinderFactory.configure_min_spot_size(params, experiments)
+        self.threshold_function = SpotFinderFactory.configure_threshold(params)
+        self.filter_spots = SpotFinderFactory.configure_filter(params)
+        self.min_spot_size = params.spotfinder.filter.min_spot_size
+        self.max_spot_size = params.spotfinder.filter.max_spot_size
+        self.resolution_analysis = resolution_analysis
+        self.filter_ice = filter_ice
+        self.ice_rings_width = ice_rings_width
+        assert len(self.mask) == len(self.detector)
+
+    def find_spots(self, frame):
+        """
+        Find the spots on a frame.
+
+        :param frame: The frame
+        :returns: The strong spots
+        """
+        from dials.model.data import PixelList, PixelListLabeller
+
+        assert len(frame.data) == len(self.detector)
+        shoeboxes = flex.shoebox()
+        for index, (data, mask, panel) in enumerate(
+            zip(frame.data, self.mask, self.detector)
+        ):
+            mask = mask & panel.get_trusted_range_mask(data)
+            data = data.as_double()
+            threshold_mask = self.threshold_function.compute_threshold(data, mask)
+            labeller = PixelListLabeller()
+            labeller.add(PixelList(frame.number, data, threshold_mask))
+            if labeller.num_pixels() > 0:
+                creator = flex.PixelListShoeboxCreator(
+                    labeller,
+                    index,  # panel
+                    0,  # zrange
+                    True,  # twod
+                    self.min_spot_size,  # min_pixels
+                    self.max_spot_size,  # max_pixels
+                    False,  # find_hot_pixels
+                )
+                shoeboxes.extend(creator.result())
+        shoeboxes = shoeboxes.select(shoeboxes.is_allocated())
+
+        # Create the observations and filter them
+        observed = flex.observation(
+            shoeboxes.panels(), shoeboxes.centroid_valid(), shoeboxes.summed_intensity()
+        )
+        flags = self.filter_spots(
+            None, sequence=self.imageset, observations=observed, shoeboxes=shoeboxes
+        )
+        reflections = flex.reflection_table(
+            observed.select(flags), shoeboxes.select(flags)
+        )
+        del reflections["shoeboxes"]
+        reflections["id"] = flex.int(len(reflections), 0)
+        return reflections
+
+    def __call__(self, frame):
+        """
+        Analyse a frame.
+
+        :param frame: The frame
+        :returns: A dictionary of the statistics of the frame
+        """
+        reflections = self.find_spots(frame)
+        reflections.centroid_px_to_mm(self.experiments)
+        reflections.map_centroids_to_reciprocal_space(self.experiments)
+        stats = per_image_analysis.stats_for_reflection_table(
+            reflections,
+            resolution_analysis=self.resolution_analysis,
+            filter_ice=self.filter_ice,
+            ice_rings_width=self.ice_rings_width,
+        )._asdict()
+        stats["frame"] = frame.number
+        return stats
+
+
+class StreamingSpotFinder(object):
+    """
+    Analyse frames with a pool of worker threads as they are received.
+    """
+
+    def __init__(
+        self, create_analyser, callback, nthreads=1, buffer_size=64, block=False
+    ):
+        """
+        :param create_analyser: A function to create the analyser of a thread
+        :param callback: The function called with the statistics of each frame.
+                         It is called from the worker threads.
+        :param nthreads: The number of worker threads
+        :param buffer_size: The number of frames which can wait to be processed
+        :param block: Wait for space in the buffer instead of dropping frames
+        """
+        assert nthreads > 0
+        self.buffer = FrameBuffer(buffer_size, block=block)
+        self.callback = callback
+        self._threads = [
+            threading.Thread(
+                target=self._work,
+                args=(create_analyser,),
+                name="stream_analyser_%d" % i,
+            )
+            for i in range(nthreads)
+        ]
+        for thread in self._threads:
+            thread.daemon = True
+            thread.start()
+
+    def put(self, frame):
+        """
+        Add a frame to be analysed.
+
+        :param frame: The frame
+        """
+        self.buffer.put(frame)
+
+    def close(self):
+        """Wait for the frames in the buffer to be analysed and stop the threads."""
+        self.buffer.close()
+        for thread in self._threads:
+            thread.join()
+
+    @property
+    def dropped(self):
+        """The numbers of the frames dropped because the buffer was full"""
+        return self.buffer.dropped
+
+    def _work(self, create_analyser):
+        analyser = create_analyser()
+        while True:
+            frame = self.buffer.get()
+            if frame is None:
+                break
+            try:
+                stats = analyser(frame)
+            except Exception as e:
+                logger.error("Analysis of frame %d failed: %s", frame.number, e)
+                stats = {"frame": frame.number, "error": str(e)}
+            self.callback(stats)
+
+
+def decode_image(header, blob):
+    """
+    Decode an image of the DECTRIS stream format.
+
+    :param header: The image data header (htype dimage_d-1.0)
+    :param blob: The bytes of the image
+    :returns: The image as a flex.int array
+    """
+    import numpy as np
+
+    width, height = header["shape"]
+    dtype = np.dtype(header["type"]).newbyteorder("<")
+    encoding = header["encoding"]
+    if encoding == "<":
+        data = np.frombuffer(blob, dtype)
+    elif encoding == "lz4<":
+        import lz4.block
+
+        size = width * height * dtype.itemsize
+        data = np.frombuffer(lz4.block.decompress(blob, uncompressed_size=size), dtype)
+    elif encoding in ("bs8-lz4<", "bs16-lz4<", "bs32-lz4<"):
+        import bitshuffle
+
+        # The compressed data follows the 8 byte uncompressed size and the
+        # 4 byte block size, both big endian
+        block_size = int.from_bytes(blob[8:12], "big") // dtype.itemsize
+        data = bitshuffle.decompress_lz4(
+            np.frombuffer(blob[12:], np.uint8), (width * height,), dtype, block_size
+        )
+    else:
+        raise ValueError("Unknown image encoding %s" % encoding)
+
+    # The pixels in the gaps between modules have the maximum value, which is
+    # -1 as a signed 32 bit integer
+    if dtype.itemsize == 4 and dtype.kind == "u":
+        data = data.view(np.int32)
+    image = flex.int(data.astype(np.int32, copy=False))
+    image.reshape(flex.grid(height, width))
+    return image
+
+
+class StreamReceiver(object):
+    """
+    Receive the frames of a series from a detector streaming in the DECTRIS
+    stream format (version 1) over ZeroMQ.
+    """
+
+    def __init__(self, endpoint, context=None, timeout=None):
+        """
+        :param endpoint: The ZeroMQ endpoint to connect to
+        :param context: The ZeroMQ context
+        :param timeout: The time to wait for a message in seconds
+        """
+        import zmq
+
+        self.context = context or zmq.Context.instance()
+        self.socket = self.context.socket(zmq.PULL)
+        self.socket.connect(endpoint)
+        self.timeout = timeout
+
+    def close(self):
+        self.socket.close()
+
+    def frames(self):
+        """
+        Iterate through the frames of the next series.
+
+        :returns: A generator of frames, which stops at the end of the series
+        """
+        series = None
+        while True:
+            if self.timeout is not None and not self.socket.poll(self.timeout * 1000):
+                raise RuntimeError("No message received from the stream")
+            parts = self.socket.recv_multipart(copy=False)
+            header = json.loads(bytes(parts[0].buffer))
+            htype = header.get("htype", "")
+            if htype.startswith("dheader"):
+                series = header.get("series")
+                logger.info("Receiving series %s", series)
+            elif htype.startswith("dimage-"):
+                if series is not None and header.get("series") != series:
+                    continue
+                image_header = json.loads(bytes(parts[1].buffer))
+                image = decode_image(image_header, parts[2].buffer)
+                yield Frame(header["frame"], (image,))
+            elif htype.startswith("dseries_end"):
+                if series is None or header.get("series") == series:
+                    logger.info("End of series %s", series)
+                    return
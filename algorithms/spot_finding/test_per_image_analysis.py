@@ -133,6 +133,24 @@ def test_stats_per_image(centroid_test_data):
     assert [tt[0] for tt in t[1:]] == [str(i + 1) for i in perm]
 
 
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_stats_per_image_matches_stats_for_reflection_table(
+    centroid_test_data, nthreads
+):
+    experiments, reflections = centroid_test_data
+    stats = per_image_analysis.stats_per_image(
+        experiments[0], reflections, nthreads=nthreads
+    )
+    image_number = flex.floor(reflections["xyzobs.px.value"].parts()[2])
+    start, end = experiments[0].scan.get_array_range()
+    for i in range(start, end):
+        expected = per_image_analysis.stats_for_reflection_table(
+            reflections.select(image_number == i)
+        )
+        for k, v in expected._asdict().items():
+            assert getattr(stats, k)[i - start] == pytest.approx(v)
+
+
 def test_stats_table_no_resolution_analysis(centroid_test_data):
     experiments, reflections = centroid_test_data
     stats = per_image_analysis.stats_per_image(
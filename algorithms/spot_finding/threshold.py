@@ -39,6 +39,7 @@ def __init__(self, **kwargs):
         self._n_sigma_s = kwargs.get("n_sigma_s", 3)
         self._min_count = kwargs.get("min_count", 2)
         self._threshold = kwargs.get("global_threshold", 0)
+        self._nthreads = kwargs.get("nthreads", 1)
 
         # Save the constant gain
         self._gain_map = None
@@ -61,14 +62,24 @@ def __call__(self, image, mask):
         try:
             algorithm = self.algorithm[image.all()]
         except Exception:
-            algorithm = threshold.DispersionThreshold(
-                image.all(),
-                self._kernel_size,
-                self._n_sigma_b,
-                self._n_sigma_s,
-                self._threshold,
-                self._min_count,
-            )
+            if self._nthreads > 1:
+                algorithm = threshold.TiledDispersionThreshold(
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                    nthreads=self._nthreads,
+                )
+            else:
+                algorithm = threshold.DispersionThreshold(
+                    image.all(),
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                )
             self.algorithm[image.all()] = algorithm
 
         # Set the gain
@@ -108,6 +119,8 @@ def __init__(self, **kwargs):
         self._n_sigma_s = kwargs.get("n_sigma_s", 3)
         self._min_count = kwargs.get("min_count", 2)
         self._threshold = kwargs.get("global_threshold", 0)
+        self._nthreads = kwargs.get("nthreads", 1)
+        self._backend = kwargs.get("backend", "cpu")
 
         # Save the constant gain
         self._gain_map = None
@@ -130,14 +143,26 @@ def __call__(self, image, mask):
         try:
             algorithm = self.algorithm[image.all()]
         except Exception:
-            algorithm = threshold.DispersionExtendedThreshold(
-                image.all(),
-                self._kernel_size,
-                self._n_sigma_b,
-                self._n_sigma_s,
-                self._threshold,
-                self._min_count,
-            )
+            if self._backend == "cuda":
+                algorithm = self._cuda_algorithm(image.all())
+            elif self._nthreads > 1:
+                algorithm = threshold.TiledDispersionExtendedThreshold(
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                    nthreads=self._nthreads,
+                )
+            else:
+                algorithm = threshold.DispersionExtendedThreshold(
+                    image.all(),
+                    self._kernel_size,
+                    self._n_sigma_b,
+                    self._n_sigma_s,
+                    self._threshold,
+                    self._min_count,
+                )
             self.algorithm[image.all()] = algorithm
 
         # Set the gain
@@ -155,3 +180,27 @@ def __call__(self, image, mask):
 
         # Return the result
         return result
+
+    def _cuda_algorithm(self, image_size):
+        """
+        Create the GPU implementation of the algorithm
+
+        :param image_size: The size of the image
+        :return: The algorithm
+        """
+        from dials.util import Sorry
+
+        try:
+            from dials.algorithms.image.threshold import cuda
+        except ImportError:
+            raise Sorry("DIALS was not built with CUDA support")
+        if not cuda.is_available():
+            raise Sorry("No CUDA device is available")
+        return cuda.DispersionExtendedThreshold(
+            image_size,
+            self._kernel_size,
+            self._n_sigma_b,
+            self._n_sigma_s,
+            self._threshold,
+            self._min_count,
+        )
@@ -2,12 +2,15 @@
 
 import dials_algorithms_spot_prediction_ext
 from dials_algorithms_spot_prediction_ext import (
+    DetectorRayIntersector,
     IndexGenerator,
     NaveStillsReflectionPredictor,
     PixelLabeller,
     PixelToMillerIndex,
+    ReekeIndexCache,
     ReekeIndexGenerator,
     RotationAngles,
+    ScanStaticPredictionCache,
     ScanStaticRayPredictor,
     ScanVaryingRayPredictor,
     SphericalRelpStillsReflectionPredictor,
@@ -17,13 +20,17 @@
 )
 
 __all__ = [
+    "DetectorRayIntersector",
     "IndexGenerator",
     "NaveStillsReflectionPredictor",
     "PixelLabeller",
     "PixelToMillerIndex",
+    "predict_stills",
     "ray_intersection",
+    "ReekeIndexCache",
     "ReekeIndexGenerator",
     "RotationAngles",
+    "ScanStaticPredictionCache",
     "ScanStaticRayPredictor",
     "ScanStaticReflectionPredictor",
     "ScanVaryingRayPredictor",
@@ -35,13 +42,23 @@
 ]
 
 
-def ScanStaticReflectionPredictor(experiment, dmin=None, margin=1, padding=0, **kwargs):
+def ScanStaticReflectionPredictor(
+    experiment,
+    dmin=None,
+    margin=1,
+    padding=0,
+    nthreads=1,
+    index_cache=None,
+    **kwargs
+):
     """
     A constructor for the reflection predictor.
 
     :param experiment: The experiment to predict for
     :param dmin: The maximum resolution to predict to
     :param margin: The margin for prediction
+    :param nthreads: The number of threads to use in for_ub
+    :param index_cache: A ReekeIndexCache to share between predictors
     :return: The spot predictor
     """
 
@@ -54,7 +71,7 @@ def ScanStaticReflectionPredictor(experiment, dmin=None, margin=1, padding=0, **
     space_group = space_group.build_derived_patterson_group()
 
     # Create the reflection predictor
-    return dials_algorithms_spot_prediction_ext.ScanStaticReflectionPredictor(
+    predictor = dials_algorithms_spot_prediction_ext.ScanStaticReflectionPredictor(
         experiment.beam,
         experiment.detector,
         experiment.goniometer,
@@ -64,11 +81,21 @@ def ScanStaticReflectionPredictor(experiment, dmin=None, margin=1, padding=0, **
         dmin,
         margin,
         padding,
+        nthreads,
     )
+    if index_cache is not None:
+        predictor.set_index_cache(index_cache)
+    return predictor
 
 
 def ScanVaryingReflectionPredictor(
-    experiment, dmin=None, margin=1, padding=0, **kwargs
+    experiment,
+    dmin=None,
+    margin=1,
+    padding=0,
+    nthreads=1,
+    index_cache=None,
+    **kwargs
 ):
     """
     A constructor for the reflection predictor.
@@ -76,6 +103,8 @@ def ScanVaryingReflectionPredictor(
     :param experiment: The experiment to predict for
     :param dmin: The maximum resolution to predict to
     :param margin: The margin for prediction
+    :param nthreads: The number of threads to use in for_ub and for_varying_models
+    :param index_cache: A ReekeIndexCache to share between predictors
     :return: The spot predictor
     """
 
@@ -88,7 +117,7 @@ def ScanVaryingReflectionPredictor(
     space_group = space_group.build_derived_patterson_group()
 
     # Create the reflection predictor
-    return dials_algorithms_spot_prediction_ext.ScanVaryingReflectionPredictor(
+    predictor = dials_algorithms_spot_prediction_ext.ScanVaryingReflectionPredictor(
         experiment.beam,
         experiment.detector,
         experiment.goniometer,
@@ -97,7 +126,11 @@ def ScanVaryingReflectionPredictor(
         dmin,
         margin,
         padding,
+        nthreads,
     )
+    if index_cache is not None:
+        predictor.set_index_cache(index_cache)
+    return predictor
 
 
 def StillsReflectionPredictor(experiment, dmin=None, spherical_relp=False, **kwargs):
@@ -155,3 +188,30 @@ def StillsReflectionPredictor(experiment, dmin=None, spherical_relp=False, **kwa
         experiment.crystal.get_space_group().type(),
         dmin,
     )
+
+
+def predict_stills(experiments, dmin=None, spherical_relp=False, nthreads=1):
+    """
+    Predict the reflections for a list of still experiments in a single call,
+    without returning to Python between the stills.
+
+    :param experiments: The experiments to predict for
+    :param dmin: The maximum resolution to predict to
+    :param spherical_relp: Whether to use the spherical relp prediction model
+    :param nthreads: The number of threads to use
+    :return: The reflection table with the experiment index in "id"
+    """
+    from scitbx.array_family import flex
+
+    predictors = [
+        StillsReflectionPredictor(e, dmin=dmin, spherical_relp=spherical_relp)
+        for e in experiments
+    ]
+    ub = flex.mat3_double([e.crystal.get_A() for e in experiments])
+    table = dials_algorithms_spot_prediction_ext.predict_stills_for_ub(
+        predictors, ub, nthreads
+    )
+    for i, e in enumerate(experiments):
+        if e.identifier:
+            table.experiment_identifiers()[i] = e.identifier
+    return table
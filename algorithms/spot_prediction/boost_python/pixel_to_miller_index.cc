@@ -10,6 +10,7 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <scitbx/array_family/accessors/flex_grid.h>
 #include <dials/algorithms/spot_prediction/pixel_to_miller_index.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
@@ -31,6 +32,21 @@ namespace dials { namespace algorithms { namespace boost_python {
     return self.h(panel, x, y);
   }
 
+  template <typename FloatType>
+  static af::versa<FloatType, af::flex_grid<> > PixelToMillerIndex_h_map(
+    const PixelToMillerIndex &self,
+    std::size_t panel,
+    double z,
+    std::size_t nthreads) {
+    af::c_grid<2> size = self.panel_size(panel);
+    af::c_grid<3> grid(size[0], size[1], 3);
+    af::versa<FloatType, af::flex_grid<> > result(
+      af::flex_grid<>(grid[0], grid[1], grid[2]));
+    self.h_map(
+      panel, z, af::ref<FloatType, af::c_grid<3> >(result.begin(), grid), nthreads);
+    return result;
+  }
+
   void export_pixel_to_miller_index() {
     class_<PixelToMillerIndex>("PixelToMillerIndex", no_init)
       .def(init<const BeamBase &,
@@ -41,7 +57,17 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def(init<const BeamBase &, const Detector &, const CrystalBase &>())
       .def("h", &PixelToMillerIndex_h_rotation)
       .def("h", &PixelToMillerIndex_h_stills)
-      .def("q", &PixelToMillerIndex::q);
+      .def("q", &PixelToMillerIndex::q)
+      .def("cache_pixel_centres",
+           &PixelToMillerIndex::cache_pixel_centres,
+           (arg("nthreads") = 1))
+      .def("h_at_pixel_centre", &PixelToMillerIndex::h_at_pixel_centre)
+      .def("h_map",
+           &PixelToMillerIndex_h_map<double>,
+           (arg("panel"), arg("z"), arg("nthreads") = 1))
+      .def("h_map_float",
+           &PixelToMillerIndex_h_map<float>,
+           (arg("panel"), arg("z"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -17,6 +17,19 @@ namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
+  /**
+   * Intersect an array of rays, returning the success flags, panels and
+   * millimetre coordinates
+   */
+  boost::python::tuple detector_ray_intersector_call(
+    const DetectorRayIntersector &self,
+    const af::const_ref<vec3<double> > &s1) {
+    af::shared<std::size_t> panel(s1.size(), 0);
+    af::shared<vec2<double> > mm(s1.size(), vec2<double>(0, 0));
+    af::shared<bool> success = self(s1, panel.ref(), mm.ref());
+    return boost::python::make_tuple(success, panel, mm);
+  }
+
   void export_ray_intersection() {
     af::shared<bool> (*ray_intersection_table)(const Detector&, af::reflection_table) =
       &ray_intersection;
@@ -48,6 +61,12 @@ namespace dials { namespace algorithms { namespace boost_python {
     //.def(from_s1_single_panel)
     //.def(from_s1_panel_array);
 
+    class_<DetectorRayIntersector>("DetectorRayIntersector", no_init)
+      .def(init<const Detector&, std::size_t>(
+        (arg("detector"), arg("grid_size") = 16)))
+      .def("mean_candidates", &DetectorRayIntersector::mean_candidates)
+      .def("__call__", &detector_ray_intersector_call);
+
     // Export all the ray intersection functions
     def("ray_intersection",
         ray_intersection_table,
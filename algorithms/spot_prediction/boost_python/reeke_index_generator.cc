@@ -11,6 +11,7 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/spot_prediction/reeke_index_generator.h>
+#include <dials/algorithms/spot_prediction/reeke_index_cache.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -48,6 +49,15 @@ namespace dials { namespace algorithms { namespace boost_python {
                       arg("margin"))))
       .def("next", &ReekeIndexGenerator::next)
       .def("to_array", &ReekeIndexGenerator::to_array);
+
+    class_<ReekeIndexCache, boost::shared_ptr<ReekeIndexCache>, boost::noncopyable>(
+      "ReekeIndexCache", no_init)
+      .def(init<std::size_t>((arg("max_indices") = 1 << 22)))
+      .def("num_indices", &ReekeIndexCache::num_indices)
+      .def("num_hits", &ReekeIndexCache::num_hits)
+      .def("num_misses", &ReekeIndexCache::num_misses)
+      .def("clear", &ReekeIndexCache::clear)
+      .def("__len__", &ReekeIndexCache::size);
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -11,11 +11,34 @@
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <dials/algorithms/spot_prediction/reflection_predictor.h>
+#include <dials/util/python_gil.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
   using namespace boost::python;
 
+  void export_scan_static_prediction_cache() {
+    typedef ScanStaticPredictionCache Cache;
+
+    class_<Cache>("ScanStaticPredictionCache", no_init)
+      .def(init<double>((arg("tolerance") = 1e-12)))
+      .def("tolerance", &Cache::tolerance)
+      .def("num_updated", &Cache::num_updated)
+      .def("num_recomputed", &Cache::num_recomputed)
+      .def("clear", &Cache::clear)
+      .def("__len__", &Cache::size);
+  }
+
+  /**
+   * Predict the reflections for the UB matrix with the GIL released, so that
+   * python threads can run while a whole scan is predicted
+   */
+  template <typename Predictor, typename UBType>
+  af::reflection_table for_ub_nogil(const Predictor& self, const UBType& ub) {
+    dials::util::ScopedGILRelease release_gil;
+    return self.for_ub(ub);
+  }
+
   void export_scan_static_reflection_predictor() {
     typedef ScanStaticReflectionPredictor Predictor;
 
@@ -28,13 +51,17 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const cctbx::sgtbx::space_group_type&,
                 double,
                 double,
-                double>())
+                double,
+                optional<std::size_t> >())
+      .def("set_index_cache", &Predictor::set_index_cache)
       .def("for_ub_old_index_generator", &Predictor::for_ub_old_index_generator)
-      .def("for_ub", &Predictor::for_ub)
+      .def("for_ub", &for_ub_nogil<Predictor, mat3<double> >)
       .def("for_hkl", &Predictor::for_hkl)
       .def("for_hkl", &Predictor::for_hkl_with_individual_ub)
       .def("for_reflection_table", &Predictor::for_reflection_table)
-      .def("for_reflection_table", &Predictor::for_reflection_table_with_individual_ub);
+      .def("for_reflection_table", &Predictor::for_reflection_table_with_individual_ub)
+      .def("for_reflection_table_incremental",
+           &Predictor::for_reflection_table_incremental);
   }
 
   void export_scan_varying_reflection_predictor() {
@@ -48,13 +75,18 @@ namespace dials { namespace algorithms { namespace boost_python {
                 const cctbx::sgtbx::space_group_type&,
                 double,
                 std::size_t,
-                double>())
-      .def("for_ub", &Predictor::for_ub)
+                double,
+                optional<std::size_t> >())
+      .def("set_index_cache", &Predictor::set_index_cache)
+      .def("for_ub", &for_ub_nogil<Predictor, af::const_ref<mat3<double> > >)
+      .def("for_ub_delta", &Predictor::for_ub_delta)
       .def("for_ub_on_single_image", &Predictor::for_ub_on_single_image)
       .def("for_varying_models", &Predictor::for_varying_models)
+      .def("for_varying_models_delta", &Predictor::for_varying_models_delta)
       .def("for_varying_models_on_single_image",
            &Predictor::for_varying_models_on_single_image)
-      .def("for_reflection_table", &Predictor::for_reflection_table);
+      .def("for_reflection_table", &Predictor::for_reflection_table)
+      .def("num_predicted_frames", &Predictor::num_predicted_frames);
   }
 
   void export_stills_delta_psi_reflection_predictor() {
@@ -155,12 +187,43 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("for_reflection_table", &Predictor::for_reflection_table_with_individual_ub);
   }
 
+  /**
+   * Collect the stills predictors from a Python sequence for
+   * predict_stills_for_ub, which is called with the GIL released
+   */
+  af::reflection_table predict_stills_for_ub_wrapper(
+    boost::python::object predictors,
+    const af::const_ref<mat3<double> >& ub,
+    std::size_t nthreads) {
+    std::vector<StillsDeltaPsiReflectionPredictor*> pointers;
+    for (std::size_t i = 0; i < len(predictors); ++i) {
+      object item = predictors[i];
+      extract<NaveStillsReflectionPredictor&> nave(item);
+      extract<SphericalRelpStillsReflectionPredictor&> spherical(item);
+      extract<StillsDeltaPsiReflectionPredictor&> delta_psi(item);
+      if (nave.check()) {
+        pointers.push_back(&nave());
+      } else if (spherical.check()) {
+        pointers.push_back(&spherical());
+      } else {
+        pointers.push_back(&delta_psi());
+      }
+    }
+    dials::util::ScopedGILRelease release_gil;
+    return predict_stills_for_ub(pointers, ub, nthreads);
+  }
+
   void export_reflection_predictor() {
+    export_scan_static_prediction_cache();
     export_scan_static_reflection_predictor();
     export_scan_varying_reflection_predictor();
     export_stills_delta_psi_reflection_predictor();
     export_nave_stills_reflection_predictor();
     export_spherical_relp_stills_reflection_predictor();
+
+    def("predict_stills_for_ub",
+        &predict_stills_for_ub_wrapper,
+        (arg("predictors"), arg("ub"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
@@ -0,0 +1,114 @@
+/*
+ * pixel_lab_vector_table.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_LAB_VECTOR_TABLE_H
+#define DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_LAB_VECTOR_TABLE_H
+
+#include <scitbx/vec2.h>
+#include <scitbx/vec3.h>
+#include <dxtbx/model/panel.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  using dxtbx::model::Panel;
+  using scitbx::vec2;
+  using scitbx::vec3;
+
+  /**
+   * A table of the unit vectors from the sample to the same point within each
+   * pixel of a panel, such as the pixel centres. Computing the lab coordinate
+   * of a pixel goes through the pixel to millimetre conversion of the panel,
+   * so for code that visits the same pixels many times, such as for each image
+   * of a sweep, the vectors can be computed once and looked up afterwards.
+   * The vectors are held in single precision to halve the size of the table.
+   */
+  class PixelLabVectorTable {
+  public:
+    typedef af::versa<vec3<float>, af::c_grid<2> > table_type;
+
+    /**
+     * Compute the table
+     * @param panel The panel
+     * @param offset The point within each pixel, 0.5 for the pixel centres
+     * @param nthreads The number of threads to use
+     */
+    PixelLabVectorTable(const Panel &panel,
+                        double offset = 0.5,
+                        std::size_t nthreads = 1)
+        : table_(af::c_grid<2>(panel.get_image_size()[1], panel.get_image_size()[0])) {
+      DIALS_ASSERT(nthreads > 0);
+      for_each_band(
+        TableBand(panel, offset, table_.ref()), (int)table_.accessor()[0], nthreads);
+    }
+
+    /** @returns The number of pixels along the fast axis */
+    std::size_t xsize() const {
+      return table_.accessor()[1];
+    }
+
+    /** @returns The number of pixels along the slow axis */
+    std::size_t ysize() const {
+      return table_.accessor()[0];
+    }
+
+    /** @returns True/False if the pixel is within the table */
+    bool contains(int x, int y) const {
+      return x >= 0 && y >= 0 && x < (int)xsize() && y < (int)ysize();
+    }
+
+    /**
+     * @param x The fast pixel index
+     * @param y The slow pixel index
+     * @returns The unit lab vector to the pixel
+     */
+    vec3<double> direction(int x, int y) const {
+      DIALS_ASSERT(contains(x, y));
+      const vec3<float> &v = table_(y, x);
+      return vec3<double>(v[0], v[1], v[2]);
+    }
+
+    /** @returns The table of unit vectors */
+    table_type data() const {
+      return table_;
+    }
+
+  private:
+    /**
+     * Compute a band of rows of the table
+     */
+    struct TableBand {
+      const Panel &panel;
+      double offset;
+      af::ref<vec3<float>, af::c_grid<2> > table;
+
+      TableBand(const Panel &panel_,
+                double offset_,
+                af::ref<vec3<float>, af::c_grid<2> > table_)
+          : panel(panel_), offset(offset_), table(table_) {}
+
+      void operator()(int y0, int y1) const {
+        for (int y = y0; y < y1; ++y) {
+          for (std::size_t x = 0; x < table.accessor()[1]; ++x) {
+            vec3<double> v =
+              panel.get_pixel_lab_coord(vec2<double>(x + offset, y + offset))
+                .normalize();
+            table(y, x) = vec3<float>(v[0], v[1], v[2]);
+          }
+        }
+      }
+    };
+
+    table_type table_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_LAB_VECTOR_TABLE_H
@@ -19,6 +19,7 @@
 #include <scitbx/mat3.h>
 #include <cctbx/miller.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -42,21 +43,17 @@ namespace dials { namespace algorithms {
      * Preprocess the beam and detector
      * @param beam The beam model
      * @param detector The detector model
+     * @param nthreads The number of threads to use
      */
-    PixelLabeller(BeamBase &beam, Detector detector) {
+    PixelLabeller(BeamBase &beam, Detector detector, std::size_t nthreads = 1) {
       p_star_.resize(detector.size());
       vec3<double> s0 = beam.get_s0();
       for (std::size_t p = 0; p < detector.size(); ++p) {
         const Panel &panel = detector[p];
         vec2<std::size_t> image_size = panel.get_image_size();
         p_star_[p].resize(af::c_grid<2>(image_size[1], image_size[0]));
-        pstar_array_type ps = p_star_[p];
-        for (std::size_t j = 0; j < image_size[1]; ++j) {
-          for (std::size_t i = 0; i < image_size[0]; ++i) {
-            vec3<double> s1 = panel.get_pixel_lab_coord(vec2<double>(j + 0.5, i + 0.5));
-            ps(j, i) = s1 - s0;
-          }
-        }
+        for_each_band(
+          PStarBand(panel, s0, p_star_[p].ref()), (int)image_size[1], nthreads);
       }
     }
 
@@ -83,24 +80,67 @@ namespace dials { namespace algorithms {
      */
     void label(af::ref<cctbx::miller::index<> > index,
                mat3<double> A,
-               std::size_t panel_number) const {
+               std::size_t panel_number,
+               std::size_t nthreads = 1) const {
       DIALS_ASSERT(panel_number < size());
       af::c_grid<2> size = panel_size(panel_number);
       DIALS_ASSERT(index.size() == size[0] * size[1]);
-      mat3<double> A1 = A.inverse();
-      pstar_array_type ps = p_star_[panel_number];
-      for (std::size_t j = 0; j < size[0]; ++j) {
-        for (std::size_t i = 0; i < size[1]; ++i) {
-          vec3<double> hf = A1 * ps(j, i);
-          cctbx::miller::index<> h((int)std::floor(hf[0] + 0.5),
-                                   (int)std::floor(hf[1] + 0.5),
-                                   (int)std::floor(hf[2] + 0.5));
-          index[i + j * size[1]] = h;
-        }
-      }
+      for_each_band(LabelBand(p_star_[panel_number].const_ref(), A.inverse(), index),
+                    (int)size[0],
+                    nthreads);
     }
 
   private:
+    /**
+     * Compute the p* vectors of a band of rows of a panel
+     */
+    struct PStarBand {
+      const Panel &panel;
+      vec3<double> s0;
+      af::ref<vec3<double>, af::c_grid<2> > ps;
+
+      PStarBand(const Panel &panel_,
+                const vec3<double> &s0_,
+                af::ref<vec3<double>, af::c_grid<2> > ps_)
+          : panel(panel_), s0(s0_), ps(ps_) {}
+
+      void operator()(int j0, int j1) const {
+        for (std::size_t j = j0; j < (std::size_t)j1; ++j) {
+          for (std::size_t i = 0; i < ps.accessor()[1]; ++i) {
+            vec3<double> s1 = panel.get_pixel_lab_coord(vec2<double>(j + 0.5, i + 0.5));
+            ps(j, i) = s1 - s0;
+          }
+        }
+      }
+    };
+
+    /**
+     * Label a band of rows of a panel
+     */
+    struct LabelBand {
+      af::const_ref<vec3<double>, af::c_grid<2> > ps;
+      mat3<double> A1;
+      af::ref<cctbx::miller::index<> > index;
+
+      LabelBand(const af::const_ref<vec3<double>, af::c_grid<2> > &ps_,
+                const mat3<double> &A1_,
+                af::ref<cctbx::miller::index<> > index_)
+          : ps(ps_), A1(A1_), index(index_) {}
+
+      void operator()(int j0, int j1) const {
+        std::size_t width = ps.accessor()[1];
+        for (std::size_t j = j0; j < (std::size_t)j1; ++j) {
+          for (std::size_t i = 0; i < width; ++i) {
+            vec3<double> hf = A1 * ps(j, i);
+            cctbx::miller::index<> h((int)std::floor(hf[0] + 0.5),
+                                     (int)std::floor(hf[1] + 0.5),
+                                     (int)std::floor(hf[2] + 0.5));
+            index[i + j * width] = h;
+          }
+        }
+      }
+    };
+
     array_type p_star_;
   };
 
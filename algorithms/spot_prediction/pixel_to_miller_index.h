@@ -11,11 +11,14 @@
 #ifndef DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_TO_MILLER_INDEX_H
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_PIXEL_TO_MILLER_INDEX_H
 
+#include <vector>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/detector.h>
 #include <dxtbx/model/goniometer.h>
 #include <dxtbx/model/scan.h>
 #include <dxtbx/model/crystal.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/algorithms/spot_prediction/pixel_lab_vector_table.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -73,24 +76,75 @@ namespace dials { namespace algorithms {
       vec3<double> s1 =
         detector_[panel].get_pixel_lab_coord(vec2<double>(x, y)).normalize()
         * s0_.length();
+      return h_from_s1(s1, z);
+    }
 
-      // Compute the angle
-      double angle = scan_.get_angle_from_array_index(z);
+    /**
+     * Cache the lab vectors to the centres of the pixels of each panel, to
+     * be looked up by h_at_pixel_centre
+     * @param nthreads The number of threads to use
+     */
+    void cache_pixel_centres(std::size_t nthreads = 1) {
+      tables_.clear();
+      for (std::size_t i = 0; i < detector_.size(); ++i) {
+        tables_.push_back(PixelLabVectorTable(detector_[i], 0.5, nthreads));
+      }
+    }
 
-      // Compute the reciprocal lattice vector
-      vec3<double> r = s1 - s0_;
+    /**
+     * Compute the miller index at the centre of a pixel. If the pixel centres
+     * have been cached then the lab vector is looked up, otherwise this is the
+     * same as h(panel, x + 0.5, y + 0.5, z).
+     */
+    vec3<double> h_at_pixel_centre(std::size_t panel, int x, int y, double z) const {
+      DIALS_ASSERT(!(m2_[0] == 0 && m2_[1] == 0 && m2_[2] == 0));
+      vec3<double> s1;
+      if (panel < tables_.size() && tables_[panel].contains(x, y)) {
+        s1 = tables_[panel].direction(x, y) * s0_.length();
+      } else {
+        s1 = detector_[panel]
+               .get_pixel_lab_coord(vec2<double>(x + 0.5, y + 0.5))
+               .normalize()
+             * s0_.length();
+      }
+      return h_from_s1(s1, z);
+    }
 
-      // Create the rotation matrix
-      mat3<double> R = scitbx::math::r3_rotation::axis_and_angle_as_matrix(m2_, angle);
+    /**
+     * @returns The size of a panel as (slow, fast)
+     */
+    af::c_grid<2> panel_size(std::size_t panel) const {
+      DIALS_ASSERT(panel < detector_.size());
+      af::int2 image_size = detector_[panel].get_image_size();
+      return af::c_grid<2>(image_size[1], image_size[0]);
+    }
 
-      // Compue the miller index
-      //  r = S R F A h
-      //  where:
-      //   S = setting rotation
-      //   R = rotation
-      //   F = fixed rotation
-      //   A = UB
-      return A_inv_ * F_inv_ * R.transpose() * S_inv_ * r;
+    /**
+     * Compute the fractional miller indices at the centres of all the pixels
+     * of a panel on one image. The matrix taking each reciprocal lattice
+     * vector to its miller index is computed once for the image, the lab
+     * vectors are looked up if the pixel centres have been cached, and the
+     * rows of the panel are split into bands across threads.
+     * @param panel The panel
+     * @param z The image
+     * @param result The miller index of each pixel as (slow, fast, 3)
+     * @param nthreads The number of threads to use
+     */
+    template <typename FloatType>
+    void h_map(std::size_t panel,
+               double z,
+               af::ref<FloatType, af::c_grid<3> > result,
+               std::size_t nthreads = 1) const {
+      DIALS_ASSERT(!(m2_[0] == 0 && m2_[1] == 0 && m2_[2] == 0));
+      af::c_grid<2> size = panel_size(panel);
+      DIALS_ASSERT(result.accessor()[0] == size[0]);
+      DIALS_ASSERT(result.accessor()[1] == size[1]);
+      DIALS_ASSERT(result.accessor()[2] == 3);
+      double angle = scan_.get_angle_from_array_index(z);
+      mat3<double> R = scitbx::math::r3_rotation::axis_and_angle_as_matrix(m2_, angle);
+      mat3<double> M = A_inv_ * F_inv_ * R.transpose() * S_inv_;
+      for_each_band(
+        HMapBand<FloatType>(*this, panel, M, result), (int)size[0], nthreads);
     }
 
     /**
@@ -129,6 +183,67 @@ namespace dials { namespace algorithms {
     }
 
   protected:
+    /**
+     * Compute the miller indices of a band of rows of a panel
+     */
+    template <typename FloatType>
+    struct HMapBand {
+      const PixelToMillerIndex &parent;
+      std::size_t panel;
+      mat3<double> M;
+      af::ref<FloatType, af::c_grid<3> > result;
+
+      HMapBand(const PixelToMillerIndex &parent_,
+               std::size_t panel_,
+               const mat3<double> &M_,
+               af::ref<FloatType, af::c_grid<3> > result_)
+          : parent(parent_), panel(panel_), M(M_), result(result_) {}
+
+      void operator()(int y0, int y1) const {
+        const Panel &p = parent.detector_[panel];
+        bool cached = panel < parent.tables_.size();
+        double s0_length = parent.s0_.length();
+        int width = (int)result.accessor()[1];
+        for (int y = y0; y < y1; ++y) {
+          for (int x = 0; x < width; ++x) {
+            vec3<double> s1;
+            if (cached) {
+              s1 = parent.tables_[panel].direction(x, y);
+            } else {
+              s1 = p.get_pixel_lab_coord(vec2<double>(x + 0.5, y + 0.5)).normalize();
+            }
+            vec3<double> h = M * (s1 * s0_length - parent.s0_);
+            for (std::size_t i = 0; i < 3; ++i) {
+              result(y, x, i) = h[i];
+            }
+          }
+        }
+      }
+    };
+
+    /**
+     * Compute the miller index from the diffracted beam vector
+     */
+    vec3<double> h_from_s1(const vec3<double> &s1, double z) const {
+      // Compute the angle
+      double angle = scan_.get_angle_from_array_index(z);
+
+      // Compute the reciprocal lattice vector
+      vec3<double> r = s1 - s0_;
+
+      // Create the rotation matrix
+      mat3<double> R = scitbx::math::r3_rotation::axis_and_angle_as_matrix(m2_, angle);
+
+      // Compue the miller index
+      //  r = S R F A h
+      //  where:
+      //   S = setting rotation
+      //   R = rotation
+      //   F = fixed rotation
+      //   A = UB
+      return A_inv_ * F_inv_ * R.transpose() * S_inv_ * r;
+    }
+
     Detector detector_;
     Scan scan_;
     vec3<double> s0_;
@@ -136,6 +251,7 @@ namespace dials { namespace algorithms {
     mat3<double> S_inv_;
     mat3<double> F_inv_;
     mat3<double> A_inv_;
+    std::vector<PixelLabVectorTable> tables_;
   };
 
 }}  // namespace dials::algorithms
@@ -11,6 +11,10 @@
 #ifndef DIALS_ALGORITHMS_SPOT_PREDICTION_RAY_INTERSECTOR_H
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_RAY_INTERSECTOR_H
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <scitbx/mat3.h>
 #include <scitbx/vec2.h>
 #include <scitbx/vec3.h>
 #include <dxtbx/model/detector.h>
@@ -22,6 +26,7 @@ namespace dials { namespace algorithms {
   // Using lots of stuff from other namespaces
   using dxtbx::model::Detector;
   using dxtbx::model::Panel;
+  using scitbx::mat3;
   using scitbx::vec2;
   using scitbx::vec3;
 
@@ -94,6 +99,233 @@ namespace dials { namespace algorithms {
   // af::shared< std::size_t > panel_;
   //};
 
+  /**
+   * Intersect rays with the panels of a detector, giving the same result as
+   * Detector::get_ray_intersection without testing every panel for every ray.
+   *
+   * The directions from the sample are divided into cells by projecting them
+   * onto the faces of a cube. A ray can only hit a panel if the cone of
+   * directions around the panel overlaps the cone around the cell of the ray,
+   * so each cell is given the list of panels for which this is true. The D
+   * matrices of the panels are copied into a single array so that testing
+   * the few candidate panels for a ray does not touch the panel objects
+   * unless the ray is found to hit the panel plane.
+   */
+  class DetectorRayIntersector {
+  public:
+    /**
+     * @param detector The detector
+     * @param grid_size The number of cells along each edge of a cube face
+     */
+    DetectorRayIntersector(const Detector &detector, std::size_t grid_size = 16)
+        : detector_(detector), grid_size_(grid_size) {
+      DIALS_ASSERT(grid_size > 0);
+      for (std::size_t i = 0; i < detector_.size(); ++i) {
+        d_matrix_.push_back(detector_[i].get_D_matrix());
+      }
+      init_cells();
+    }
+
+    /**
+     * Intersect a single ray with the detector
+     * @param s1 The diffracted beam vector
+     * @param panel The panel hit by the ray
+     * @param mm The millimetre coordinate on the panel
+     * @returns True/False the ray hit the detector
+     */
+    bool operator()(const vec3<double> &s1,
+                    std::size_t &panel,
+                    vec2<double> &mm) const {
+      std::size_t cell = 0;
+      if (!find_cell(s1, cell)) {
+        return false;
+      }
+
+      // As in Detector, take the valid intersection with the largest w
+      bool found = false;
+      double w_max = 0;
+      for (std::size_t k = cell_offset_[cell]; k < cell_offset_[cell + 1]; ++k) {
+        std::size_t p = cell_panel_[k];
+        vec3<double> v = d_matrix_[p] * s1;
+        if (v[2] > w_max) {
+          vec2<double> xy(v[0] / v[2], v[1] / v[2]);
+          if (detector_[p].is_coord_valid_mm(xy)) {
+            found = true;
+            panel = p;
+            mm = xy;
+            w_max = v[2];
+          }
+        }
+      }
+      return found;
+    }
+
+    /**
+     * Intersect an array of rays with the detector
+     * @param s1 The diffracted beam vectors
+     * @param panel The panels hit by the rays
+     * @param mm The millimetre coordinates on the panels
+     * @returns True/False each ray hit the detector
+     */
+    af::shared<bool> operator()(const af::const_ref<vec3<double> > &s1,
+                                af::ref<std::size_t> panel,
+                                af::ref<vec2<double> > mm) const {
+      DIALS_ASSERT(panel.size() == s1.size());
+      DIALS_ASSERT(mm.size() == s1.size());
+      af::shared<bool> success(s1.size(), false);
+      for (std::size_t i = 0; i < s1.size(); ++i) {
+        success[i] = (*this)(s1[i], panel[i], mm[i]);
+      }
+      return success;
+    }
+
+    /**
+     * @returns The mean number of candidate panels per cell
+     */
+    double mean_candidates() const {
+      return (double)cell_panel_.size() / (cell_offset_.size() - 1);
+    }
+
+  protected:
+    /**
+     * Find the cell of a direction. The direction is projected onto the cube
+     * face of its largest component, giving coordinates in [-1, 1] on the face.
+     * @param s1 The direction
+     * @param cell The cell index
+     * @returns False if the direction is zero or not finite
+     */
+    bool find_cell(const vec3<double> &s1, std::size_t &cell) const {
+      std::size_t k = 0;
+      for (std::size_t j = 1; j < 3; ++j) {
+        if (std::abs(s1[j]) > std::abs(s1[k])) {
+          k = j;
+        }
+      }
+      double length = std::abs(s1[k]);
+      if (!(length > 0)) {
+        return false;
+      }
+      std::size_t face = 2 * k + (s1[k] < 0 ? 1 : 0);
+      std::size_t a = face_index(s1[(k + 1) % 3] / length);
+      std::size_t b = face_index(s1[(k + 2) % 3] / length);
+      cell = (face * grid_size_ + b) * grid_size_ + a;
+      return true;
+    }
+
+    std::size_t face_index(double x) const {
+      int i = (int)std::floor((x + 1.0) * 0.5 * grid_size_);
+      return (std::size_t)std::min(std::max(i, 0), (int)grid_size_ - 1);
+    }
+
+    /**
+     * The point on the cube face at coordinates (a, b) in [-1, 1]
+     */
+    static vec3<double> face_point(std::size_t face, double a, double b) {
+      std::size_t k = face / 2;
+      vec3<double> x(0, 0, 0);
+      x[k] = (face % 2 == 0) ? 1.0 : -1.0;
+      x[(k + 1) % 3] = a;
+      x[(k + 2) % 3] = b;
+      return x;
+    }
+
+    /**
+     * A cone of directions with its axis and the cosine and sine of its half
+     * angle. The cone around a convex polygon contains all the directions of
+     * points on the polygon if it contains those of the corners and its half
+     * angle is less than 90 degrees.
+     */
+    struct Cone {
+      vec3<double> axis;
+      double cos_angle;
+      double sin_angle;
+      bool everything;
+
+      Cone(const vec3<double> &centre, const vec3<double> corner[4])
+          : cos_angle(1), sin_angle(0), everything(false) {
+        if (centre.length() == 0) {
+          everything = true;
+          return;
+        }
+        axis = centre.normalize();
+        for (std::size_t i = 0; i < 4; ++i) {
+          double c = corner[i].length() > 0 ? axis * corner[i].normalize() : -1.0;
+          cos_angle = std::min(cos_angle, c);
+        }
+        if (cos_angle <= 0) {
+          everything = true;
+          return;
+        }
+        sin_angle = std::sqrt(std::max(1.0 - cos_angle * cos_angle, 0.0));
+      }
+
+      bool overlaps(const Cone &other) const {
+        if (everything || other.everything) {
+          return true;
+        }
+
+        // The angle between the axes is at most the sum of the half angles
+        double cos_sum = cos_angle * other.cos_angle - sin_angle * other.sin_angle;
+        double sin_sum = sin_angle * other.cos_angle + cos_angle * other.sin_angle;
+        return sin_sum < 0 || axis * other.axis >= cos_sum;
+      }
+    };
+
+    /**
+     * List the candidate panels for each cell. The panels are extended by a
+     * margin so that coordinates valid after a parallax correction are kept.
+     */
+    void init_cells() {
+      const double margin = 0.1;
+      std::vector<Cone> panel_cone;
+      for (std::size_t i = 0; i < detector_.size(); ++i) {
+        const Panel &panel = detector_[i];
+        vec2<double> size = panel.get_image_size_mm();
+        double extra = margin * std::max(size[0], size[1]);
+        vec3<double> f = panel.get_fast_axis();
+        vec3<double> s = panel.get_slow_axis();
+        vec3<double> o = panel.get_origin();
+        vec3<double> corner[4] = {
+          o - f * extra - s * extra,
+          o + f * (size[0] + extra) - s * extra,
+          o - f * extra + s * (size[1] + extra),
+          o + f * (size[0] + extra) + s * (size[1] + extra)};
+        vec3<double> centre = o + f * (size[0] / 2.0) + s * (size[1] / 2.0);
+        panel_cone.push_back(Cone(centre, corner));
+      }
+      std::size_t num_cells = 6 * grid_size_ * grid_size_;
+      cell_offset_.reserve(num_cells + 1);
+      cell_offset_.push_back(0);
+      double width = 2.0 / grid_size_;
+      for (std::size_t face = 0; face < 6; ++face) {
+        for (std::size_t b = 0; b < grid_size_; ++b) {
+          for (std::size_t a = 0; a < grid_size_; ++a) {
+            double a0 = -1.0 + a * width;
+            double b0 = -1.0 + b * width;
+            vec3<double> corner[4] = {face_point(face, a0, b0),
+                                      face_point(face, a0 + width, b0),
+                                      face_point(face, a0, b0 + width),
+                                      face_point(face, a0 + width, b0 + width)};
+            Cone cell_cone(
+              face_point(face, a0 + width / 2.0, b0 + width / 2.0), corner);
+            for (std::size_t p = 0; p < panel_cone.size(); ++p) {
+              if (panel_cone[p].overlaps(cell_cone)) {
+                cell_panel_.push_back(p);
+              }
+            }
+            cell_offset_.push_back(cell_panel_.size());
+          }
+        }
+      }
+    }
+
+    Detector detector_;
+    std::size_t grid_size_;
+    std::vector<mat3<double> > d_matrix_;
+    std::vector<std::size_t> cell_offset_;
+    std::vector<std::size_t> cell_panel_;
+  };
+
   inline af::shared<bool> ray_intersection(const Detector &detector,
                                            af::reflection_table reflections) {
     DIALS_ASSERT(reflections.is_consistent());
@@ -104,14 +336,16 @@ namespace dials { namespace algorithms {
     af::ref<std::size_t> panel = reflections["panel"];
     af::ref<vec3<double> > xyzcalmm = reflections["xyzcal.mm"];
     af::shared<bool> success(reflections.size(), true);
+    DetectorRayIntersector intersect(detector);
     for (std::size_t i = 0; i < reflections.size(); ++i) {
-      try {
-        Detector::coord_type coord = detector.get_ray_intersection(s1[i]);
-        xyzcalmm[i][0] = coord.second[0];
-        xyzcalmm[i][1] = coord.second[1];
+      std::size_t p = 0;
+      vec2<double> mm;
+      if (intersect(s1[i], p, mm)) {
+        xyzcalmm[i][0] = mm[0];
+        xyzcalmm[i][1] = mm[1];
         xyzcalmm[i][2] = phi[i];
-        panel[i] = coord.first;
-      } catch (dxtbx::error) {
+        panel[i] = p;
+      } else {
         success[i] = false;
       }
     }
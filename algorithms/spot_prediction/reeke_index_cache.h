@@ -0,0 +1,252 @@
+/*
+ * reeke_index_cache.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SPOT_PREDICTION_REEKE_INDEX_CACHE_H
+#define DIALS_ALGORITHMS_SPOT_PREDICTION_REEKE_INDEX_CACHE_H
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <dials/algorithms/spot_prediction/reeke_index_generator.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * A cache of the Miller indices generated by ReekeIndexGenerator for the
+   * frames of a scan. Predicting the same scan again with the same models, as
+   * happens in refinement and integration, then looks up the indices for each
+   * frame rather than enumerating them again.
+   *
+   * The indices for a frame are keyed on everything the generator is given:
+   * the setting matrices and beam vectors at the start and end of the frame,
+   * the rotation axis, the resolution limit, the margin and the space group.
+   * The least recently used frames are dropped once the total number of
+   * cached indices exceeds a limit. The cache may be shared between
+   * predictors and used from several threads at once; the index arrays it
+   * returns are never changed.
+   */
+  class ReekeIndexCache : public boost::noncopyable {
+  public:
+    typedef cctbx::miller::index<> miller_index;
+    typedef boost::shared_ptr<const std::vector<miller_index> > index_array;
+
+    /**
+     * The generator settings for a frame
+     */
+    struct Key {
+      mat3<double> A1;
+      mat3<double> A2;
+      vec3<double> s0a;
+      vec3<double> s0b;
+      vec3<double> m2;
+      double dmin;
+      int margin;
+      std::string hall_symbol;
+
+      Key(const mat3<double> &A1_,
+          const mat3<double> &A2_,
+          const cctbx::sgtbx::space_group_type &space_group_type,
+          const vec3<double> &m2_,
+          const vec3<double> &s0a_,
+          const vec3<double> &s0b_,
+          double dmin_,
+          int margin_)
+          : A1(A1_),
+            A2(A2_),
+            s0a(s0a_),
+            s0b(s0b_),
+            m2(m2_),
+            dmin(dmin_),
+            margin(margin_),
+            hall_symbol(space_group_type.hall_symbol()) {}
+
+      bool operator==(const Key &other) const {
+        return std::equal(A1.begin(), A1.end(), other.A1.begin())
+               && std::equal(A2.begin(), A2.end(), other.A2.begin())
+               && std::equal(s0a.begin(), s0a.end(), other.s0a.begin())
+               && std::equal(s0b.begin(), s0b.end(), other.s0b.begin())
+               && std::equal(m2.begin(), m2.end(), other.m2.begin())
+               && dmin == other.dmin && margin == other.margin
+               && hall_symbol == other.hall_symbol;
+      }
+
+      std::size_t hash() const {
+        std::size_t seed = 0;
+        boost::hash_range(seed, A1.begin(), A1.end());
+        boost::hash_range(seed, A2.begin(), A2.end());
+        boost::hash_range(seed, s0a.begin(), s0a.end());
+        boost::hash_range(seed, s0b.begin(), s0b.end());
+        boost::hash_range(seed, m2.begin(), m2.end());
+        boost::hash_combine(seed, dmin);
+        boost::hash_combine(seed, margin);
+        boost::hash_combine(seed, hall_symbol);
+        return seed;
+      }
+    };
+
+    /**
+     * @param max_indices The largest number of indices to keep
+     */
+    ReekeIndexCache(std::size_t max_indices = 1 << 22)
+        : max_indices_(max_indices), num_indices_(0), num_hits_(0), num_misses_(0) {}
+
+    /**
+     * Get the indices for a frame, generating them if they are not cached
+     * @param key The generator settings
+     * @param space_group_type The space group type named in the key
+     * @returns The indices in the order given by the generator
+     */
+    index_array get(const Key &key,
+                    const cctbx::sgtbx::space_group_type &space_group_type) {
+      std::size_t hash = key.hash();
+      {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        lookup_iterator it = find(key, hash);
+        if (it != lookup_.end()) {
+          lru_.splice(lru_.begin(), lru_, it->second);
+          num_hits_++;
+          return it->second->indices;
+        }
+        num_misses_++;
+      }
+
+      // Generate the indices without holding the lock
+      ReekeIndexGenerator generator(key.A1,
+                                    key.A2,
+                                    space_group_type,
+                                    key.m2,
+                                    key.s0a,
+                                    key.s0b,
+                                    key.dmin,
+                                    key.margin);
+      boost::shared_ptr<std::vector<miller_index> > indices(
+        new std::vector<miller_index>());
+      for (;;) {
+        miller_index h = generator.next();
+        if (h.is_zero()) {
+          break;
+        }
+        indices->push_back(h);
+      }
+
+      // Add the indices unless another thread got there first
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      if (find(key, hash) == lookup_.end() && indices->size() <= max_indices_) {
+        lru_.push_front(Entry(key, hash, indices));
+        lookup_.insert(std::make_pair(hash, lru_.begin()));
+        num_indices_ += indices->size();
+        evict();
+      }
+      return indices;
+    }
+
+    /**
+     * @returns The number of frames in the cache
+     */
+    std::size_t size() const {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return lru_.size();
+    }
+
+    /**
+     * @returns The number of indices in the cache
+     */
+    std::size_t num_indices() const {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return num_indices_;
+    }
+
+    /**
+     * @returns The number of frames found in the cache
+     */
+    std::size_t num_hits() const {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return num_hits_;
+    }
+
+    /**
+     * @returns The number of frames which had to be generated
+     */
+    std::size_t num_misses() const {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      return num_misses_;
+    }
+
+    /**
+     * Remove all the frames from the cache
+     */
+    void clear() {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      lru_.clear();
+      lookup_.clear();
+      num_indices_ = 0;
+    }
+
+  private:
+    struct Entry {
+      Key key;
+      std::size_t hash;
+      index_array indices;
+
+      Entry(const Key &key_, std::size_t hash_, const index_array &indices_)
+          : key(key_), hash(hash_), indices(indices_) {}
+    };
+
+    typedef std::list<Entry> list_type;
+    typedef std::multimap<std::size_t, list_type::iterator> lookup_type;
+    typedef lookup_type::iterator lookup_iterator;
+
+    lookup_iterator find(const Key &key, std::size_t hash) {
+      std::pair<lookup_iterator, lookup_iterator> range = lookup_.equal_range(hash);
+      for (lookup_iterator it = range.first; it != range.second; ++it) {
+        if (it->second->key == key) {
+          return it;
+        }
+      }
+      return lookup_.end();
+    }
+
+    /**
+     * Drop the least recently used frames until the cache is within its limit
+     */
+    void evict() {
+      while (num_indices_ > max_indices_) {
+        DIALS_ASSERT(!lru_.empty());
+        list_type::iterator last = --lru_.end();
+        std::pair<lookup_iterator, lookup_iterator> range =
+          lookup_.equal_range(last->hash);
+        for (lookup_iterator it = range.first; it != range.second; ++it) {
+          if (it->second == last) {
+            lookup_.erase(it);
+            break;
+          }
+        }
+        num_indices_ -= last->indices->size();
+        lru_.erase(last);
+      }
+    }
+
+    list_type lru_;
+    lookup_type lookup_;
+    std::size_t max_indices_;
+    std::size_t num_indices_;
+    std::size_t num_hits_;
+    std::size_t num_misses_;
+    mutable boost::mutex mutex_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SPOT_PREDICTION_REEKE_INDEX_CACHE_H
@@ -669,7 +669,9 @@ namespace dials { namespace algorithms {
                         double dmin,
                         int margin)
         : model_(ub_beg, ub_end, axis, -s0, -s0, dmin, margin),
-          space_group_type_(space_group_type) {}
+          space_group_type_(space_group_type),
+          ridx_(0),
+          state_(enter) {}
 
     /**
      * Initialise the reeke model with varying s0 vector
@@ -690,7 +692,9 @@ namespace dials { namespace algorithms {
                         double dmin,
                         int margin)
         : model_(ub_beg, ub_end, axis, -s0_beg, -s0_end, dmin, margin),
-          space_group_type_(space_group_type) {}
+          space_group_type_(space_group_type),
+          ridx_(0),
+          state_(enter) {}
 
     /**
      * @returns The next miller index to be generated
@@ -729,35 +733,24 @@ namespace dials { namespace algorithms {
      * @returns The next pqr index
      */
     cctbx::miller::index<> next_pqr() {
-      // Constants to make clearer
-      const int enter = 0;
-      const int yield = 1;
-
-      // Static variables
-      static vec2<int> p;
-      static vec2<int> q;
-      static af::small<vec2<int>, 2> r;
-      static std::size_t ridx;
-      static int state = enter;
-
       // This switch simulates a co-routine or python generator. The first time
-      // the function is executed, control starts at the top (case 1). On
-      // subsequent calls, control starts after the "yield" point (case 0), The
-      // static variables ensure that the state is recovered on each subsequent
-      // function call.
+      // the function is executed, control starts at the top (case enter). On
+      // subsequent calls, control starts after the "yield" point. The loop
+      // state is kept in the generator so that generators used at the same
+      // time, e.g. on different threads, do not interfere.
       cctbx::miller::index<> result(0, 0, 0);
-      switch (state) {
+      switch (state_) {
       case enter:
-        state = yield;
-        p = model_.p_limits();
-        for (; p[0] < p[1]; ++p[0]) {
-          q = model_.q_limits(p[0]);
-          for (; q[0] < q[1]; ++q[0]) {
-            r = model_.r_limits(p[0], q[0]);
-            ridx = 0;
-            for (; ridx < r.size(); ++ridx) {
-              for (; r[ridx][0] < r[ridx][1]; ++r[ridx][0]) {
-                result = cctbx::miller::index<>(p[0], q[0], r[ridx][0]);
+        state_ = yield;
+        p_ = model_.p_limits();
+        for (; p_[0] < p_[1]; ++p_[0]) {
+          q_ = model_.q_limits(p_[0]);
+          for (; q_[0] < q_[1]; ++q_[0]) {
+            r_ = model_.r_limits(p_[0], q_[0]);
+            ridx_ = 0;
+            for (; ridx_ < r_.size(); ++ridx_) {
+              for (; r_[ridx_][0] < r_[ridx_][1]; ++r_[ridx_][0]) {
+                result = cctbx::miller::index<>(p_[0], q_[0], r_[ridx_][0]);
                 if (!result.is_zero()) {
                   return result;
                 case yield:;
@@ -767,12 +760,20 @@ namespace dials { namespace algorithms {
           }
         }
       }
-      state = enter;
+      state_ = enter;
       return cctbx::miller::index<>(0, 0, 0);
     }
 
+    // The states of the generator
+    enum { enter, yield };
+
     ReekeModel model_;
     cctbx::sgtbx::space_group_type space_group_type_;
+    vec2<int> p_;
+    vec2<int> q_;
+    af::small<vec2<int>, 2> r_;
+    std::size_t ridx_;
+    int state_;
   };
 
 }}  // namespace dials::algorithms
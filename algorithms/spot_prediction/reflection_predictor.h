@@ -13,6 +13,10 @@
 #define DIALS_ALGORITHMS_SPOT_PREDICTION_REFLECTION_PREDICTOR_H
 
 #include <algorithm>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
 #include <scitbx/math/r3_rotation.h>
 #include <scitbx/constants.h>
 #include <dxtbx/model/beam.h>
@@ -22,11 +26,13 @@
 #include <dxtbx/model/scan_helpers.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/algorithms/spot_prediction/index_generator.h>
+#include <dials/algorithms/spot_prediction/reeke_index_cache.h>
 #include <dials/algorithms/spot_prediction/reeke_index_generator.h>
 #include <dials/algorithms/spot_prediction/ray_predictor.h>
 #include <dials/algorithms/spot_prediction/scan_varying_ray_predictor.h>
 #include <dials/algorithms/spot_prediction/stills_ray_predictor.h>
 #include <dials/algorithms/spot_prediction/ray_intersection.h>
+#include <dials/util/thread_pool.h>
 
 namespace dials { namespace algorithms {
 
@@ -65,6 +71,20 @@ namespace dials { namespace algorithms {
       xyz_mm = table.get<vec3<double> >("xyzcal.mm");
       flags = table.get<std::size_t>("flags");
     }
+
+    /**
+     * Append the predictions from another container
+     * @param other The other predictions
+     */
+    void append(const prediction_data &other) {
+      hkl.extend(other.hkl.begin(), other.hkl.end());
+      panel.extend(other.panel.begin(), other.panel.end());
+      enter.extend(other.enter.begin(), other.enter.end());
+      s1.extend(other.s1.begin(), other.s1.end());
+      xyz_px.extend(other.xyz_px.begin(), other.xyz_px.end());
+      xyz_mm.extend(other.xyz_mm.begin(), other.xyz_mm.end());
+      flags.extend(other.flags.begin(), other.flags.end());
+    }
   };
 
   struct stills_prediction_data : prediction_data {
@@ -73,6 +93,112 @@ namespace dials { namespace algorithms {
     stills_prediction_data(af::reflection_table &table) : prediction_data(table) {
       delpsi = table.get<double>("delpsical.rad");
     }
+
+    /**
+     * Append the predictions from another container
+     * @param other The other predictions
+     */
+    void append(const stills_prediction_data &other) {
+      prediction_data::append(other);
+      delpsi.extend(other.delpsi.begin(), other.delpsi.end());
+    }
+  };
+
+  /**
+   * A cache of the rotation angles predicted for the rows of a reflection
+   * table, used to update the predictions incrementally as the models change
+   * by small amounts, e.g. between the cycles of refinement. A cached angle is
+   * only used for a row with the same Miller index and entering flag as when
+   * it was predicted, so the table may be changed between updates at the cost
+   * of recomputing the changed rows.
+   */
+  class ScanStaticPredictionCache {
+    typedef cctbx::miller::index<> miller_index;
+
+  public:
+    struct Entry {
+      miller_index h;
+      bool entering;
+      bool valid;
+      double angle;
+      double cos_angle;
+      double sin_angle;
+
+      Entry()
+          : entering(false), valid(false), angle(0), cos_angle(1), sin_angle(0) {}
+    };
+
+    /**
+     * @param tolerance The largest distance of an updated diffracted beam
+     * vector from the Ewald sphere, as a fraction of the radius, before it is
+     * recomputed exactly.
+     */
+    ScanStaticPredictionCache(double tolerance = 1e-12)
+        : tolerance_(tolerance), num_updated_(0), num_recomputed_(0) {
+      DIALS_ASSERT(tolerance > 0);
+    }
+
+    /**
+     * @returns The tolerance
+     */
+    double tolerance() const {
+      return tolerance_;
+    }
+
+    /**
+     * @returns The number of rows in the cache
+     */
+    std::size_t size() const {
+      return entries_.size();
+    }
+
+    /**
+     * Resize the cache, keeping the entries of the remaining rows
+     * @param n The number of rows
+     */
+    void resize(std::size_t n) {
+      entries_.resize(n);
+    }
+
+    /**
+     * Forget all the cached angles
+     */
+    void clear() {
+      entries_.clear();
+    }
+
+    Entry &operator[](std::size_t i) {
+      DIALS_ASSERT(i < entries_.size());
+      return entries_[i];
+    }
+
+    /**
+     * @returns The number of rows updated from the cache in the last update
+     */
+    std::size_t num_updated() const {
+      return num_updated_;
+    }
+
+    /**
+     * @returns The number of rows recomputed exactly in the last update
+     */
+    std::size_t num_recomputed() const {
+      return num_recomputed_;
+    }
+
+    /**
+     * Set the counts for the last update
+     */
+    void set_counts(std::size_t num_updated, std::size_t num_recomputed) {
+      num_updated_ = num_updated;
+      num_recomputed_ = num_recomputed;
+    }
+
+  private:
+    std::vector<Entry> entries_;
+    double tolerance_;
+    std::size_t num_updated_;
+    std::size_t num_recomputed_;
   };
 
   /**
@@ -94,9 +220,11 @@ namespace dials { namespace algorithms {
       const cctbx::sgtbx::space_group_type &space_group_type,
       double dmin,
       double margin,
-      double padding)
+      double padding,
+      std::size_t nthreads = 1)
         : beam_(beam),
           detector_(detector),
+          intersect_(detector),
           goniometer_(goniometer),
           scan_(scan),
           unit_cell_(unit_cell),
@@ -104,14 +232,34 @@ namespace dials { namespace algorithms {
           dmin_(dmin),
           margin_(margin),
           padding_(padding),
+          nthreads_(nthreads),
           predict_rays_(beam->get_s0(),
                         goniometer.get_rotation_axis_datum(),
                         goniometer.get_fixed_rotation(),
                         goniometer.get_setting_rotation(),
                         vec2<double>(0.0, two_pi)) {
       DIALS_ASSERT(padding >= 0);
+      DIALS_ASSERT(nthreads > 0);
+    }
+
+    /**
+     * Use a cache of the Miller indices generated for each frame, which may be
+     * shared with other predictors. Pass a null pointer to stop using it.
+     * @param cache The index cache
+     */
+    void set_index_cache(boost::shared_ptr<ReekeIndexCache> cache) {
+      index_cache_ = cache;
     }
 
+    /**
+     * Predict reflections for UB, generating the indices over the whole
+     * resolution sphere rather than frame by frame. If more than one thread is
+     * used then the indices are split into blocks which are predicted
+     * concurrently and the results are joined in index order, so the
+     * reflections are in the same order as when predicting on a single thread.
+     * @param ub The UB matrix
+     * @returns A reflection table.
+     */
     af::reflection_table for_ub_old_index_generator(const mat3<double> &ub) const {
       // Create the reflection table and the local container
       af::reflection_table table;
@@ -120,12 +268,62 @@ namespace dials { namespace algorithms {
       // Create the index generate and loop through the indices. For each index,
       // predict the rays and append to the reflection table
       IndexGenerator indices(unit_cell_, space_group_type_, dmin_);
+      if (nthreads_ == 1) {
+        for (;;) {
+          miller_index h = indices.next();
+          if (h.is_zero()) {
+            break;
+          }
+          append_for_index(predictions, ub, h);
+        }
+        return table;
+      }
+
+      // Generate all the indices, so that they can be split between the threads
+      af::shared<miller_index> hkl;
       for (;;) {
         miller_index h = indices.next();
         if (h.is_zero()) {
           break;
         }
-        append_for_index(predictions, ub, h);
+        hkl.push_back(h);
+      }
+      if (hkl.size() < 2) {
+        for (std::size_t i = 0; i < hkl.size(); ++i) {
+          append_for_index(predictions, ub, hkl[i]);
+        }
+        return table;
+      }
+
+      // Split the indices into a few blocks per thread to balance the load
+      std::size_t num_blocks = std::min(hkl.size(), 4 * nthreads_);
+      std::vector<af::reflection_table> blocks(num_blocks);
+      std::string error;
+      boost::mutex error_mutex;
+      {
+        dials::util::WorkStealingThreadPool pool(std::min(nthreads_, num_blocks));
+        for (std::size_t i = 0; i < num_blocks; ++i) {
+          std::size_t i0 = i * hkl.size() / num_blocks;
+          std::size_t i1 = (i + 1) * hkl.size() / num_blocks;
+          pool.post(boost::bind(&ScanStaticReflectionPredictor::predict_index_block,
+                                this,
+                                ub,
+                                hkl.const_ref(),
+                                i0,
+                                i1,
+                                &blocks[i],
+                                &error,
+                                &error_mutex));
+        }
+        pool.wait();
+      }
+      if (!error.empty()) {
+        throw DIALS_ERROR(error);
+      }
+
+      // Join the blocks in index order
+      for (std::size_t i = 0; i < num_blocks; ++i) {
+        predictions.append(prediction_data(blocks[i]));
       }
 
       // Return the reflection table
@@ -133,7 +331,10 @@ namespace dials { namespace algorithms {
     }
 
     /**
-     * Predict reflections for UB
+     * Predict reflections for UB. If more than one thread is used then the
+     * frames are split into blocks which are predicted concurrently and the
+     * results are joined in frame order, so the reflections are in the same
+     * order as when predicting on a single thread.
      * @param ub The UB matrix
      * @returns A reflection table.
      */
@@ -146,28 +347,43 @@ namespace dials { namespace algorithms {
       int z1 =
         std::floor(scan_.get_array_index_from_angle(a1 + padding_ * pi / 180.0) + 0.5);
 
-      // Get the rotation axis and beam vector
-      vec3<double> m2 = goniometer_.get_rotation_axis_datum();
-      vec3<double> s0 = beam_->get_s0();
-
       // Create the reflection table and the local container
       af::reflection_table table;
       prediction_data predictions(table);
-      for (int frame = z0; frame < z1; ++frame) {
-        mat3<double> A1 = ub;
-        mat3<double> A2 = ub;
-        compute_setting_matrices(A1, A2, frame);
+      std::size_t num_frames = z1 > z0 ? z1 - z0 : 0;
+      if (nthreads_ == 1 || num_frames < 2) {
+        append_for_frames(predictions, ub, z0, z1);
+        return table;
+      }
 
-        // Create the index generate and loop through the indices. For each index,
-        // predict the rays and append to the reflection table
-        ReekeIndexGenerator indices(A1, A2, space_group_type_, m2, s0, dmin_, margin_);
-        for (;;) {
-          miller_index h = indices.next();
-          if (h.is_zero()) {
-            break;
-          }
-          append_for_index(predictions, ub, h, frame);
+      // Split the frames into a few blocks per thread to balance the load
+      std::size_t num_blocks = std::min(num_frames, 4 * nthreads_);
+      std::vector<af::reflection_table> blocks(num_blocks);
+      std::string error;
+      boost::mutex error_mutex;
+      {
+        dials::util::WorkStealingThreadPool pool(std::min(nthreads_, num_blocks));
+        for (std::size_t i = 0; i < num_blocks; ++i) {
+          int f0 = z0 + (int)(i * num_frames / num_blocks);
+          int f1 = z0 + (int)((i + 1) * num_frames / num_blocks);
+          pool.post(boost::bind(&ScanStaticReflectionPredictor::predict_block,
+                                this,
+                                ub,
+                                f0,
+                                f1,
+                                &blocks[i],
+                                &error,
+                                &error_mutex));
         }
+        pool.wait();
+      }
+      if (!error.empty()) {
+        throw DIALS_ERROR(error);
+      }
+
+      // Join the blocks in frame order
+      for (std::size_t i = 0; i < num_blocks; ++i) {
+        predictions.append(prediction_data(blocks[i]));
       }
 
       // Return the reflection table
@@ -258,7 +474,277 @@ namespace dials { namespace algorithms {
       DIALS_ASSERT(table.is_consistent());
     }
 
+    /**
+     * Update the predictions in a reflection table in place for a single UB
+     * matrix, starting from the rotation angles saved in the cache by the
+     * previous update. For each row a few Newton steps are taken from the
+     * cached angle to the diffracting angle for the current models; this needs
+     * no square roots and, for small steps, no trigonometric functions. A row
+     * is predicted exactly, as in for_reflection_table, if it is not in the
+     * cache or if the updated diffracted beam vector is not on the Ewald sphere
+     * to within the tolerance of the cache.
+     * @param table The reflection table
+     * @param ub The ub matrix
+     * @param cache The cached rotation angles for the rows of the table
+     */
+    void for_reflection_table_incremental(af::reflection_table table,
+                                          const mat3<double> &ub,
+                                          ScanStaticPredictionCache &cache) const {
+      DIALS_ASSERT(scan_.get_oscillation()[1] > 0.0);
+      af::shared<miller_index> hkl = table["miller_index"];
+      af::shared<bool> enter = table["entering"];
+      af::shared<std::size_t> panel = table["panel"];
+      af::shared<vec3<double> > s1 = table.get<vec3<double> >("s1");
+      af::shared<vec3<double> > xyz_mm = table.get<vec3<double> >("xyzcal.mm");
+      af::shared<vec3<double> > xyz_px = table.get<vec3<double> >("xyzcal.px");
+      af::shared<std::size_t> flags = table["flags"];
+
+      // The geometry shared by all the reflections
+      update_geometry geometry;
+      geometry.s0 = beam_->get_s0();
+      geometry.m2 = goniometer_.get_rotation_axis_datum().normalize();
+      geometry.setting = goniometer_.get_setting_rotation();
+      geometry.s0_setting = geometry.setting.transpose() * geometry.s0;
+      geometry.s0_m2_plane =
+        geometry.s0.cross(geometry.setting * geometry.m2).normalize();
+      geometry.fixed_ub = goniometer_.get_fixed_rotation() * ub;
+      geometry.tolerance = cache.tolerance();
+
+      std::size_t num_updated = 0;
+      cache.resize(table.nrows());
+      for (std::size_t i = 0; i < table.nrows(); ++i) {
+        ScanStaticPredictionCache::Entry &entry = cache[i];
+        flags[i] &= ~af::Predicted;
+
+        // Update from the cached angle or predict the reflection exactly
+        if (entry.valid && entry.h == hkl[i] && entry.entering == enter[i]
+            && update_angle(geometry, entry, s1[i])) {
+          num_updated++;
+        } else {
+          entry.h = hkl[i];
+          entry.entering = enter[i];
+          entry.valid = false;
+          af::small<Ray, 2> rays = predict_rays_(hkl[i], ub);
+          for (std::size_t j = 0; j < rays.size(); ++j) {
+            if (rays[j].entering == enter[i]) {
+              entry.valid = true;
+              entry.angle = rays[j].angle;
+              entry.cos_angle = std::cos(rays[j].angle);
+              entry.sin_angle = std::sin(rays[j].angle);
+              s1[i] = rays[j].s1;
+              break;
+            }
+          }
+          if (!entry.valid) {
+            s1[i] = vec3<double>(0, 0, 0);
+            xyz_mm[i] = vec3<double>(0, 0, 0);
+            xyz_px[i] = vec3<double>(0, 0, 0);
+            continue;
+          }
+        }
+
+        // Intersect the ray with the detector
+        double frame = scan_.get_array_index_from_angle(entry.angle);
+        try {
+          vec2<double> mm = detector_[panel[i]].get_ray_intersection(s1[i]);
+          vec2<double> px = detector_[panel[i]].millimeter_to_pixel(mm);
+          xyz_mm[i] = vec3<double>(mm[0], mm[1], entry.angle);
+          xyz_px[i] = vec3<double>(px[0], px[1], frame);
+          flags[i] |= af::Predicted;
+        } catch (dxtbx::error) {
+          xyz_mm[i] = vec3<double>(0, 0, entry.angle);
+          xyz_px[i] = vec3<double>(0, 0, frame);
+        }
+      }
+      cache.set_counts(num_updated, table.nrows() - num_updated);
+      DIALS_ASSERT(table.is_consistent());
+    }
+
   private:
+    /**
+     * The models needed to update the cached predictions
+     */
+    struct update_geometry {
+      vec3<double> s0;
+      vec3<double> m2;
+      vec3<double> s0_setting;
+      vec3<double> s0_m2_plane;
+      mat3<double> setting;
+      mat3<double> fixed_ub;
+      double tolerance;
+    };
+
+    /**
+     * Rotate a vector around a unit axis given the cosine and sine of the angle
+     */
+    static vec3<double> rotate(const vec3<double> &v,
+                               const vec3<double> &axis,
+                               double c,
+                               double s) {
+      return v * c + axis.cross(v) * s + axis * ((axis * v) * (1.0 - c));
+    }
+
+    /**
+     * Move a cached rotation angle to the diffracting angle for the current
+     * models with Newton's method. The rotated reciprocal lattice vector p
+     * diffracts when f = 2 s0.(S p) + |p|^2 is zero and df/dphi is
+     * 2 s0.(S (m2 x p)). Small steps use the Taylor series of the cosine and
+     * sine, which are exact to double precision for steps below 1e-3 rad.
+     * @param geometry The models
+     * @param entry The cache entry, updated with the new angle
+     * @param s1 The diffracted beam vector
+     * @returns True if the angle converged to within the tolerance
+     */
+    bool update_angle(const update_geometry &geometry,
+                      ScanStaticPredictionCache::Entry &entry,
+                      vec3<double> &s1) const {
+      const int max_iterations = 3;
+      const double max_step = 0.05;
+      vec3<double> pstar0 = geometry.fixed_ub * entry.h;
+      double pstar0_sq = pstar0.length_sq();
+      double s0_sq = geometry.s0.length_sq();
+      vec3<double> pstar =
+        rotate(pstar0, geometry.m2, entry.cos_angle, entry.sin_angle);
+      double angle = entry.angle;
+      double c = entry.cos_angle;
+      double s = entry.sin_angle;
+      for (int iteration = 0; iteration < max_iterations; ++iteration) {
+        double f = 2.0 * (geometry.s0_setting * pstar) + pstar0_sq;
+        double dfdphi = 2.0 * (geometry.s0_setting * geometry.m2.cross(pstar));
+        if (std::abs(f) <= 2.0 * geometry.tolerance * s0_sq) {
+          s1 = geometry.s0 + geometry.setting * pstar;
+          if ((s1 * geometry.s0_m2_plane < 0.) != entry.entering) {
+            return false;
+          }
+          double norm = std::sqrt(c * c + s * s);
+          entry.angle = mod_2pi(angle);
+          entry.cos_angle = c / norm;
+          entry.sin_angle = s / norm;
+          return true;
+        }
+        if (dfdphi == 0) {
+          return false;
+        }
+        double step = -f / dfdphi;
+        if (std::abs(step) > max_step) {
+          return false;
+        }
+        double cs = 0, ss = 0;
+        if (std::abs(step) < 1e-3) {
+          double step_sq = step * step;
+          cs = 1.0 - step_sq / 2.0 * (1.0 - step_sq / 12.0);
+          ss = step * (1.0 - step_sq / 6.0 * (1.0 - step_sq / 20.0));
+        } else {
+          cs = std::cos(step);
+          ss = std::sin(step);
+        }
+        pstar = rotate(pstar, geometry.m2, cs, ss);
+        angle += step;
+        double c_next = c * cs - s * ss;
+        s = s * cs + c * ss;
+        c = c_next;
+      }
+      return false;
+    }
+
+    /**
+     * Predict the reflections on a range of frames
+     * @param p The prediction data
+     * @param ub The UB matrix
+     * @param z0 The first frame
+     * @param z1 The last frame
+     */
+    void append_for_frames(prediction_data &p,
+                           const mat3<double> &ub,
+                           int z0,
+                           int z1) const {
+      // Get the rotation axis and beam vector
+      vec3<double> m2 = goniometer_.get_rotation_axis_datum();
+      vec3<double> s0 = beam_->get_s0();
+
+      for (int frame = z0; frame < z1; ++frame) {
+        mat3<double> A1 = ub;
+        mat3<double> A2 = ub;
+        compute_setting_matrices(A1, A2, frame);
+
+        // Take the indices for the frame from the cache if there is one
+        if (index_cache_) {
+          ReekeIndexCache::index_array indices = index_cache_->get(
+            ReekeIndexCache::Key(
+              A1, A2, space_group_type_, m2, s0, s0, dmin_, margin_),
+            space_group_type_);
+          for (std::size_t i = 0; i < indices->size(); ++i) {
+            append_for_index(p, ub, (*indices)[i], frame);
+          }
+          continue;
+        }
+
+        // Create the index generate and loop through the indices. For each index,
+        // predict the rays and append to the reflection table
+        ReekeIndexGenerator indices(A1, A2, space_group_type_, m2, s0, dmin_, margin_);
+        for (;;) {
+          miller_index h = indices.next();
+          if (h.is_zero()) {
+            break;
+          }
+          append_for_index(p, ub, h, frame);
+        }
+      }
+    }
+
+    /**
+     * Predict the reflections on a block of frames in a worker thread.
+     * Exceptions are caught and saved so that they can be reported from the
+     * calling thread.
+     * @param ub The UB matrix
+     * @param z0 The first frame
+     * @param z1 The last frame
+     * @param table The reflection table for the block
+     * @param error The error message
+     * @param error_mutex The mutex for the error message
+     */
+    void predict_block(mat3<double> ub,
+                       int z0,
+                       int z1,
+                       af::reflection_table *table,
+                       std::string *error,
+                       boost::mutex *error_mutex) const {
+      try {
+        prediction_data predictions(*table);
+        append_for_frames(predictions, ub, z0, z1);
+      } catch (const std::exception &e) {
+        boost::lock_guard<boost::mutex> lock(*error_mutex);
+        if (error->empty()) {
+          *error = e.what();
+        }
+      }
+    }
+
+    /**
+     * Predict the reflections for the indices i0 to i1 - 1 into their own
+     * table, keeping the first error so that it can be raised on the calling
+     * thread.
+     */
+    void predict_index_block(mat3<double> ub,
+                             af::const_ref<miller_index> hkl,
+                             std::size_t i0,
+                             std::size_t i1,
+                             af::reflection_table *table,
+                             std::string *error,
+                             boost::mutex *error_mutex) const {
+      try {
+        prediction_data predictions(*table);
+        for (std::size_t i = i0; i < i1; ++i) {
+          append_for_index(predictions, ub, hkl[i]);
+        }
+      } catch (const std::exception &e) {
+        boost::lock_guard<boost::mutex> lock(*error_mutex);
+        if (error->empty()) {
+          *error = e.what();
+        }
+      }
+    }
+
     /**
      * Helper function to compute the setting matrix and the beginning and end
      * of a frame.
@@ -284,10 +770,12 @@ namespace dials { namespace algorithms {
                           int frame) const {
       af::small<Ray, 2> rays = predict_rays_(h, ub);
       for (std::size_t i = 0; i < rays.size(); ++i) {
+        std::size_t panel = 0;
+        vec2<double> mm;
+        if (!intersect_(rays[i].s1, panel, mm)) {
+          continue;
+        }
         try {
-          Detector::coord_type impact = detector_.get_ray_intersection(rays[i].s1);
-          std::size_t panel = impact.first;
-          vec2<double> mm = impact.second;
           vec2<double> px = detector_[panel].millimeter_to_pixel(mm);
           af::shared<vec2<double> > frames =
             scan_.get_array_indices_with_angle(rays[i].angle, padding_, true);
@@ -314,10 +802,12 @@ namespace dials { namespace algorithms {
                           const miller_index &h) const {
       af::small<Ray, 2> rays = predict_rays_(h, ub);
       for (std::size_t i = 0; i < rays.size(); ++i) {
+        std::size_t panel = 0;
+        vec2<double> mm;
+        if (!intersect_(rays[i].s1, panel, mm)) {
+          continue;
+        }
         try {
-          Detector::coord_type impact = detector_.get_ray_intersection(rays[i].s1);
-          std::size_t panel = impact.first;
-          vec2<double> mm = impact.second;
           vec2<double> px = detector_[panel].millimeter_to_pixel(mm);
           af::shared<vec2<double> > frames =
             scan_.get_array_indices_with_angle(rays[i].angle, padding_, true);
@@ -371,6 +861,7 @@ namespace dials { namespace algorithms {
 
     boost::shared_ptr<BeamBase> beam_;
     Detector detector_;
+    DetectorRayIntersector intersect_;
     Goniometer goniometer_;
     Scan scan_;
     cctbx::uctbx::unit_cell unit_cell_;
@@ -378,6 +869,8 @@ namespace dials { namespace algorithms {
     double dmin_;
     double margin_;
     double padding_;
+    std::size_t nthreads_;
+    boost::shared_ptr<ReekeIndexCache> index_cache_;
     ScanStaticRayPredictor predict_rays_;
   };
 
@@ -410,20 +903,35 @@ namespace dials { namespace algorithms {
       const cctbx::sgtbx::space_group_type &space_group_type,
       double dmin,
       std::size_t margin,
-      double padding)
+      double padding,
+      std::size_t nthreads = 1)
         : beam_(beam),
           detector_(detector),
+          intersect_(detector),
           goniometer_(goniometer),
           scan_(scan),
           space_group_type_(space_group_type),
           dmin_(dmin),
           margin_(margin),
           padding_(padding),
+          nthreads_(nthreads),
+          num_predicted_(0),
           predict_rays_(beam->get_s0(),
                         goniometer.get_rotation_axis_datum(),
                         scan.get_array_range()[0],
                         scan.get_oscillation(),
-                        dmin) {}
+                        dmin) {
+      DIALS_ASSERT(nthreads > 0);
+    }
+
+    /**
+     * Use a cache of the Miller indices generated for each frame, which may be
+     * shared with other predictors. Pass a null pointer to stop using it.
+     * @param cache The index cache
+     */
+    void set_index_cache(boost::shared_ptr<ReekeIndexCache> cache) {
+      index_cache_ = cache;
+    }
 
     /**
      * Return the beam model
@@ -453,36 +961,34 @@ namespace dials { namespace algorithms {
       return scan_;
     }
 
+    /**
+     * @returns The number of frames predicted by the last call to for_ub or
+     * for_varying_models
+     */
+    std::size_t num_predicted_frames() const {
+      return num_predicted_;
+    }
+
     /**
      * Predict all the reflections given an array of UB matrices.
      * @param A The UB matrix recorded at scan points
      * @returns The reflection table
      */
     af::reflection_table for_ub(const af::const_ref<mat3<double> > &A) const {
-      DIALS_ASSERT(A.size() == scan_.get_num_images() + 1);
-
-      // Create the table and local stuff
-      af::reflection_table table;
-      prediction_data predictions(table);
-
-      // Get the array range and loop through all the images
-      vec2<int> array_range = scan_.get_array_range();
-      double a0 = scan_.get_oscillation_range()[0];
-      double a1 = scan_.get_oscillation_range()[1];
-      int z0 =
-        std::floor(scan_.get_array_index_from_angle(a0 - padding_ * pi / 180.0) + 0.5);
-      int z1 =
-        std::floor(scan_.get_array_index_from_angle(a1 + padding_ * pi / 180.0) + 0.5);
-      const int offset = array_range[0];
-      for (int frame = z0; frame < z1; ++frame) {
-        int i = frame - offset;
-        if (i < 0) i = 0;
-        if (i >= A.size() - 1) i = A.size() - 2;
-        append_for_image(predictions, frame, A[i], A[i + 1]);
-      }
+      return predict_frames(settings_for_ub(A), false);
+    }
 
-      // Return the reflection table
-      return table;
+    /**
+     * Predict all the reflections given an array of UB matrices, only
+     * predicting the frames whose setting matrices have changed since the last
+     * call to for_ub_delta or for_varying_models_delta. The predictions for
+     * the other frames are reused. Delta calls must not be made concurrently
+     * on the same predictor.
+     * @param A The UB matrix recorded at scan points
+     * @returns The reflection table
+     */
+    af::reflection_table for_ub_delta(const af::const_ref<mat3<double> > &A) const {
+      return predict_frames(settings_for_ub(A), true);
     }
 
     /**
@@ -503,8 +1009,16 @@ namespace dials { namespace algorithms {
       af::reflection_table table;
       prediction_data predictions(table);
 
-      // Get the array range and loop through all the images
-      append_for_image(predictions, frame, A1, A2);
+      // Predict the reflections on the image
+      FrameSetting setting;
+      setting.frame = frame;
+      setting.A1 = A1;
+      setting.A2 = A2;
+      setting.s0a = beam_->get_s0();
+      setting.s0b = setting.s0a;
+      setting.varying_s0 = false;
+      compute_setting_matrices(setting.A1, setting.A2, frame);
+      append_for_setting(predictions, setting);
 
       // Return the reflection table
       return table;
@@ -523,33 +1037,25 @@ namespace dials { namespace algorithms {
       const af::const_ref<mat3<double> > &A,
       const af::const_ref<vec3<double> > &s0,
       const af::const_ref<mat3<double> > &S) const {
-      DIALS_ASSERT(A.size() == scan_.get_num_images() + 1);
-      DIALS_ASSERT(s0.size() == A.size());
-      DIALS_ASSERT(S.size() == A.size());
-
-      // Create the table and local stuff
-      af::reflection_table table;
-      prediction_data predictions(table);
-
-      // Get the array range and loop through all the images
-      vec2<int> array_range = scan_.get_array_range();
-      double a0 = scan_.get_oscillation_range()[0];
-      double a1 = scan_.get_oscillation_range()[1];
-      int z0 =
-        std::floor(scan_.get_array_index_from_angle(a0 - padding_ * pi / 180.0) + 0.5);
-      int z1 =
-        std::floor(scan_.get_array_index_from_angle(a1 + padding_ * pi / 180.0) + 0.5);
-      const int offset = array_range[0];
-      for (int frame = z0; frame < z1; ++frame) {
-        int i = frame - offset;
-        if (i < 0) i = 0;
-        if (i >= A.size() - 1) i = A.size() - 2;
-        append_for_image(
-          predictions, frame, A[i], A[i + 1], s0[i], s0[i + 1], S[i], S[i + 1]);
-      }
+      return predict_frames(settings_for_varying_models(A, s0, S), false);
+    }
 
-      // Return the reflection table
-      return table;
+    /**
+     * Predict all the reflections given arrays of models that are allowed to
+     * vary, only predicting the frames whose models have changed since the last
+     * call to for_ub_delta or for_varying_models_delta. The predictions for
+     * the other frames are reused. Delta calls must not be made concurrently
+     * on the same predictor.
+     * @param A The UB matrix recorded at scan points
+     * @param s0 The s0 vector recorded at scan points
+     * @param S The setting rotation matrix recorded at scan points
+     * @returns The reflection table
+     */
+    af::reflection_table for_varying_models_delta(
+      const af::const_ref<mat3<double> > &A,
+      const af::const_ref<vec3<double> > &s0,
+      const af::const_ref<mat3<double> > &S) const {
+      return predict_frames(settings_for_varying_models(A, s0, S), true);
     }
 
     /**
@@ -580,8 +1086,18 @@ namespace dials { namespace algorithms {
       af::reflection_table table;
       prediction_data predictions(table);
 
-      // Get the array range and loop through all the images
-      append_for_image(predictions, frame, A1, A2, s0a, s0b, S1, S2);
+      // Predict the reflections on the image
+      FrameSetting setting;
+      setting.frame = frame;
+      setting.A1 = A1;
+      setting.A2 = A2;
+      setting.s0a = s0a;
+      setting.s0b = s0b;
+      setting.varying_s0 = true;
+      mat3<double> S1_copy = S1;
+      mat3<double> S2_copy = S2;
+      compute_setting_matrices(setting.A1, setting.A2, S1_copy, S2_copy, frame);
+      append_for_setting(predictions, setting);
 
       // Return the reflection table
       return table;
@@ -704,67 +1220,259 @@ namespace dials { namespace algorithms {
     }
 
     /**
-     * For the given image with start and end A matrices, generate the indices
-     * and do the prediction.
-     * @param p The reflection data
-     * @param frame The image frame to predict on.
-     * @param A1 The start UB matrix
-     * @param A2 The end UB matrix
+     * The crystal setting matrices and beam vectors at the beginning and end of
+     * a frame.
      */
-    void append_for_image(prediction_data &p,
-                          int frame,
-                          mat3<double> A1,
-                          mat3<double> A2) const {
-      // Get the rotation axis and beam vector
-      vec3<double> m2 = goniometer_.get_rotation_axis_datum();
+    struct FrameSetting {
+      int frame;
+      mat3<double> A1;
+      mat3<double> A2;
+      vec3<double> s0a;
+      vec3<double> s0b;
+      bool varying_s0;
+
+      bool operator==(const FrameSetting &other) const {
+        return frame == other.frame && varying_s0 == other.varying_s0
+               && std::equal(A1.begin(), A1.end(), other.A1.begin())
+               && std::equal(A2.begin(), A2.end(), other.A2.begin())
+               && std::equal(s0a.begin(), s0a.end(), other.s0a.begin())
+               && std::equal(s0b.begin(), s0b.end(), other.s0b.begin());
+      }
+    };
+
+    /**
+     * The predictions for a frame kept for delta prediction
+     */
+    struct CachedFrame {
+      FrameSetting setting;
+      af::reflection_table table;
+    };
+
+    /**
+     * Get the range of frames to predict on, including the padding.
+     */
+    void frame_range(int &z0, int &z1) const {
+      double a0 = scan_.get_oscillation_range()[0];
+      double a1 = scan_.get_oscillation_range()[1];
+      z0 =
+        std::floor(scan_.get_array_index_from_angle(a0 - padding_ * pi / 180.0) + 0.5);
+      z1 =
+        std::floor(scan_.get_array_index_from_angle(a1 + padding_ * pi / 180.0) + 0.5);
+    }
+
+    /**
+     * Get the index of the scan point at the start of a frame, clamped so that
+     * frames in the padding use the first or last scan interval.
+     */
+    std::size_t scan_point(int frame, std::size_t num_points) const {
+      int i = frame - scan_.get_array_range()[0];
+      if (i < 0) i = 0;
+      if (i >= (int)num_points - 1) i = num_points - 2;
+      return i;
+    }
+
+    /**
+     * Compute the setting matrices for all the frames from the UB matrices
+     * @param A The UB matrix recorded at scan points
+     * @returns The setting for each frame
+     */
+    std::vector<FrameSetting> settings_for_ub(
+      const af::const_ref<mat3<double> > &A) const {
+      DIALS_ASSERT(A.size() == scan_.get_num_images() + 1);
+      int z0 = 0, z1 = 0;
+      frame_range(z0, z1);
       vec3<double> s0 = beam_->get_s0();
-      compute_setting_matrices(A1, A2, frame);
+      std::vector<FrameSetting> settings;
+      for (int frame = z0; frame < z1; ++frame) {
+        std::size_t i = scan_point(frame, A.size());
+        FrameSetting setting;
+        setting.frame = frame;
+        setting.A1 = A[i];
+        setting.A2 = A[i + 1];
+        setting.s0a = s0;
+        setting.s0b = s0;
+        setting.varying_s0 = false;
+        compute_setting_matrices(setting.A1, setting.A2, frame);
+        settings.push_back(setting);
+      }
+      return settings;
+    }
 
-      // Construct the index generator and do the predictions for each index
-      ReekeIndexGenerator indices(A1, A2, space_group_type_, m2, s0, dmin_, margin_);
-      for (;;) {
-        miller_index h = indices.next();
-        if (h.is_zero()) {
-          break;
+    /**
+     * Compute the setting matrices for all the frames from the varying models
+     * @param A The UB matrix recorded at scan points
+     * @param s0 The s0 vector recorded at scan points
+     * @param S The setting rotation matrix recorded at scan points
+     * @returns The setting for each frame
+     */
+    std::vector<FrameSetting> settings_for_varying_models(
+      const af::const_ref<mat3<double> > &A,
+      const af::const_ref<vec3<double> > &s0,
+      const af::const_ref<mat3<double> > &S) const {
+      DIALS_ASSERT(A.size() == scan_.get_num_images() + 1);
+      DIALS_ASSERT(s0.size() == A.size());
+      DIALS_ASSERT(S.size() == A.size());
+      int z0 = 0, z1 = 0;
+      frame_range(z0, z1);
+      std::vector<FrameSetting> settings;
+      for (int frame = z0; frame < z1; ++frame) {
+        std::size_t i = scan_point(frame, A.size());
+        FrameSetting setting;
+        setting.frame = frame;
+        setting.A1 = A[i];
+        setting.A2 = A[i + 1];
+        setting.s0a = s0[i];
+        setting.s0b = s0[i + 1];
+        setting.varying_s0 = true;
+        mat3<double> S1 = S[i];
+        mat3<double> S2 = S[i + 1];
+        compute_setting_matrices(setting.A1, setting.A2, S1, S2, frame);
+        settings.push_back(setting);
+      }
+      return settings;
+    }
+
+    /**
+     * Predict the reflections on all the frames. Each frame is predicted into
+     * its own table; if more than one thread is used then blocks of frames are
+     * predicted concurrently. The tables are joined in frame order so the
+     * result does not depend on the number of threads.
+     * @param settings The setting for each frame
+     * @param delta Reuse the predictions for frames which have not changed
+     * @returns The reflection table
+     */
+    af::reflection_table predict_frames(const std::vector<FrameSetting> &settings,
+                                        bool delta) const {
+      // Find the frames which need to be predicted
+      std::vector<af::reflection_table> frames(settings.size());
+      std::vector<std::size_t> todo;
+      bool use_cache = delta && cache_.size() == settings.size();
+      for (std::size_t i = 0; i < settings.size(); ++i) {
+        if (use_cache && cache_[i].setting == settings[i]) {
+          frames[i] = cache_[i].table;
+        } else {
+          todo.push_back(i);
+        }
+      }
+
+      // Predict the frames
+      std::string error;
+      boost::mutex error_mutex;
+      if (nthreads_ == 1 || todo.size() < 2) {
+        predict_block(&settings, &todo, 0, todo.size(), &frames, &error, &error_mutex);
+      } else {
+        std::size_t num_blocks = std::min(todo.size(), 4 * nthreads_);
+        dials::util::WorkStealingThreadPool pool(std::min(nthreads_, num_blocks));
+        for (std::size_t i = 0; i < num_blocks; ++i) {
+          pool.post(boost::bind(&ScanVaryingReflectionPredictor::predict_block,
+                                this,
+                                &settings,
+                                &todo,
+                                i * todo.size() / num_blocks,
+                                (i + 1) * todo.size() / num_blocks,
+                                &frames,
+                                &error,
+                                &error_mutex));
         }
-        append_for_index(p, A1, A2, frame, h);
+        pool.wait();
       }
+      if (!error.empty()) {
+        throw DIALS_ERROR(error);
+      }
+
+      // Join the frames in order
+      af::reflection_table table;
+      prediction_data predictions(table);
+      for (std::size_t i = 0; i < frames.size(); ++i) {
+        predictions.append(prediction_data(frames[i]));
+      }
+
+      // Keep the frames for the next delta prediction
+      if (delta) {
+        cache_.resize(settings.size());
+        for (std::size_t i = 0; i < settings.size(); ++i) {
+          cache_[i].setting = settings[i];
+          cache_[i].table = frames[i];
+        }
+      }
+      num_predicted_ = todo.size();
+      return table;
     }
 
     /**
-     * For the given image with start and end A matrices, s0 vectors, and
-     * goniometer setting rotations S, generate the indices and do the
-     * prediction.
+     * Predict a block of frames. Exceptions are caught and saved so that they
+     * can be reported from the calling thread.
+     * @param settings The setting for each frame
+     * @param todo The indices of the frames to predict
+     * @param first The first index in the block
+     * @param last The last index in the block
+     * @param frames The table for each frame
+     * @param error The error message
+     * @param error_mutex The mutex for the error message
+     */
+    void predict_block(const std::vector<FrameSetting> *settings,
+                       const std::vector<std::size_t> *todo,
+                       std::size_t first,
+                       std::size_t last,
+                       std::vector<af::reflection_table> *frames,
+                       std::string *error,
+                       boost::mutex *error_mutex) const {
+      try {
+        for (std::size_t k = first; k < last; ++k) {
+          std::size_t i = (*todo)[k];
+          prediction_data predictions((*frames)[i]);
+          append_for_setting(predictions, (*settings)[i]);
+        }
+      } catch (const std::exception &e) {
+        boost::lock_guard<boost::mutex> lock(*error_mutex);
+        if (error->empty()) {
+          *error = e.what();
+        }
+      }
+    }
+
+    /**
+     * For the given frame setting, generate the indices and do the prediction.
      * @param p The reflection data
-     * @param frame The image frame to predict on.
-     * @param A1 The start UB matrix
-     * @param A2 The end UB matrix
-     * @param s0a The start s0 vector
-     * @param s0b The end s0 vector
-     * @param S1 The start S matrix
-     * @param S2 The end S matrix
+     * @param setting The setting matrices and beam vectors for the frame
      */
-    void append_for_image(prediction_data &p,
-                          int frame,
-                          mat3<double> A1,
-                          mat3<double> A2,
-                          vec3<double> s0a,
-                          vec3<double> s0b,
-                          mat3<double> S1,
-                          mat3<double> S2) const {
-      // Get the rotation axis
+    void append_for_setting(prediction_data &p, const FrameSetting &setting) const {
       vec3<double> m2 = goniometer_.get_rotation_axis_datum();
-      compute_setting_matrices(A1, A2, S1, S2, frame);
-
-      // Construct the index generator and do the predictions for each index
-      ReekeIndexGenerator indices(
-        A1, A2, space_group_type_, m2, s0a, s0b, dmin_, margin_);
-      for (;;) {
-        miller_index h = indices.next();
-        if (h.is_zero()) {
-          break;
+      const mat3<double> &A1 = setting.A1;
+      const mat3<double> &A2 = setting.A2;
+      if (index_cache_) {
+        ReekeIndexCache::index_array indices = index_cache_->get(
+          ReekeIndexCache::Key(
+            A1, A2, space_group_type_, m2, setting.s0a, setting.s0b, dmin_, margin_),
+          space_group_type_);
+        for (std::size_t i = 0; i < indices->size(); ++i) {
+          if (setting.varying_s0) {
+            append_for_index(
+              p, A1, A2, setting.s0a, setting.s0b, setting.frame, (*indices)[i]);
+          } else {
+            append_for_index(p, A1, A2, setting.frame, (*indices)[i]);
+          }
+        }
+      } else if (setting.varying_s0) {
+        ReekeIndexGenerator indices(
+          A1, A2, space_group_type_, m2, setting.s0a, setting.s0b, dmin_, margin_);
+        for (;;) {
+          miller_index h = indices.next();
+          if (h.is_zero()) {
+            break;
+          }
+          append_for_index(p, A1, A2, setting.s0a, setting.s0b, setting.frame, h);
+        }
+      } else {
+        ReekeIndexGenerator indices(
+          A1, A2, space_group_type_, m2, setting.s0a, dmin_, margin_);
+        for (;;) {
+          miller_index h = indices.next();
+          if (h.is_zero()) {
+            break;
+          }
+          append_for_index(p, A1, A2, setting.frame, h);
         }
-        append_for_index(p, A1, A2, s0a, s0b, frame, h);
       }
     }
 
@@ -824,11 +1532,14 @@ namespace dials { namespace algorithms {
                         const miller_index &h,
                         const Ray &ray,
                         int panel) const {
+      // Get the impact on the detector
+      std::size_t impact_panel = 0;
+      vec2<double> mm;
+      if (!intersect_(ray.s1, impact_panel, mm)) {
+        return;
+      }
       try {
-        // Get the impact on the detector
-        Detector::coord_type impact = detector_.get_ray_intersection(ray.s1);
-        std::size_t panel = impact.first;
-        vec2<double> mm = impact.second;
+        std::size_t panel = impact_panel;
         vec2<double> px = detector_[panel].millimeter_to_pixel(mm);
 
         // Get the frame
@@ -906,12 +1617,17 @@ namespace dials { namespace algorithms {
 
     boost::shared_ptr<BeamBase> beam_;
     Detector detector_;
+    DetectorRayIntersector intersect_;
     Goniometer goniometer_;
     Scan scan_;
     cctbx::sgtbx::space_group_type space_group_type_;
     double dmin_;
     std::size_t margin_;
     double padding_;
+    std::size_t nthreads_;
+    mutable std::size_t num_predicted_;
+    mutable std::vector<CachedFrame> cache_;
+    boost::shared_ptr<ReekeIndexCache> index_cache_;
     ScanVaryingRayPredictor predict_rays_;
   };
 
@@ -934,12 +1650,15 @@ namespace dials { namespace algorithms {
       const double &dmin)
         : beam_(beam),
           detector_(detector),
+          intersect_(detector),
           ub_(ub),
           unit_cell_(unit_cell),
           space_group_type_(space_group_type),
           dmin_(dmin),
           predict_ray_(beam->get_s0()) {}
 
+    virtual ~StillsDeltaPsiReflectionPredictor() {}
+
     /**
      * Predict all reflection.
      * @returns reflection table.
@@ -954,7 +1673,7 @@ namespace dials { namespace algorithms {
      * @param ub The UB matrix
      * @returns A reflection table.
      */
-    af::reflection_table for_ub(const mat3<double> &ub) {
+    virtual af::reflection_table for_ub(const mat3<double> &ub) {
       // Create the reflection table and the local container
       af::reflection_table table;
       stills_prediction_data predictions(table);
@@ -1124,9 +1843,12 @@ namespace dials { namespace algorithms {
                         double delpsi) const {
       try {
         // Get the impact on the detector
-        Detector::coord_type impact = get_ray_intersection(ray.s1, panel);
-        std::size_t panel = impact.first;
-        vec2<double> mm = impact.second;
+        std::size_t impact_panel = 0;
+        vec2<double> mm;
+        if (!get_ray_intersection(ray.s1, panel, impact_panel, mm)) {
+          return;
+        }
+        std::size_t panel = impact_panel;
         vec2<double> px = detector_[panel].millimeter_to_pixel(mm);
 
         // Add the reflections to the table
@@ -1147,21 +1869,24 @@ namespace dials { namespace algorithms {
   private:
     /**
      * Helper function to do ray intersection with/without panel set.
+     * @returns False if no panel was set and the ray misses the detector
      */
-    Detector::coord_type get_ray_intersection(vec3<double> s1, int panel) const {
-      Detector::coord_type coord;
+    bool get_ray_intersection(vec3<double> s1,
+                              int panel,
+                              std::size_t &impact_panel,
+                              vec2<double> &mm) const {
       if (panel < 0) {
-        coord = detector_.get_ray_intersection(s1);
-      } else {
-        coord.first = panel;
-        coord.second = detector_[panel].get_ray_intersection(s1);
+        return intersect_(s1, impact_panel, mm);
       }
-      return coord;
+      impact_panel = panel;
+      mm = detector_[panel].get_ray_intersection(s1);
+      return true;
     }
 
   protected:
     boost::shared_ptr<BeamBase> beam_;
     Detector detector_;
+    DetectorRayIntersector intersect_;
     mat3<double> ub_;
     cctbx::uctbx::unit_cell unit_cell_;
     cctbx::sgtbx::space_group_type space_group_type_;
@@ -1199,7 +1924,7 @@ namespace dials { namespace algorithms {
      * @param ub The UB matrix
      * @returns A reflection table.
      */
-    af::reflection_table for_ub(const mat3<double> &ub) {
+    virtual af::reflection_table for_ub(const mat3<double> &ub) {
       // Create the reflection table and the local container
       af::reflection_table table;
       stills_prediction_data predictions(table);
@@ -1264,7 +1989,7 @@ namespace dials { namespace algorithms {
      * @param ub The UB matrix
      * @returns A reflection table.
      */
-    af::reflection_table for_ub(const mat3<double> &ub) {
+    virtual af::reflection_table for_ub(const mat3<double> &ub) {
       // Create the reflection table and the local container
       af::reflection_table table;
       stills_prediction_data predictions(table);
@@ -1309,6 +2034,86 @@ namespace dials { namespace algorithms {
     SphericalRelpStillsRayPredictor spherical_relp_predict_ray_;
   };
 
+  namespace detail {
+
+    /**
+     * Predict the reflections for one still in a worker thread. Exceptions
+     * are caught and saved so that they can be reported from the calling
+     * thread.
+     */
+    inline void predict_still_for_ub(StillsDeltaPsiReflectionPredictor *predictor,
+                                     mat3<double> ub,
+                                     af::reflection_table *table,
+                                     std::string *error,
+                                     boost::mutex *error_mutex) {
+      try {
+        *table = predictor->for_ub(ub);
+      } catch (const std::exception &e) {
+        boost::lock_guard<boost::mutex> lock(*error_mutex);
+        if (error->empty()) {
+          *error = e.what();
+        }
+      }
+    }
+
+  }  // namespace detail
+
+  /**
+   * Predict the reflections for a batch of stills, e.g. the lattices found
+   * in a run of serial crystallography, with the stills shared between
+   * threads. The predictors keep state while predicting so each still must
+   * have its own predictor.
+   * @param predictors The predictor for each still
+   * @param ub The UB matrix for each still
+   * @param nthreads The number of threads to use
+   * @returns The predictions for all the stills in order, with the index of
+   * the still in the "id" column
+   */
+  inline af::reflection_table predict_stills_for_ub(
+    const std::vector<StillsDeltaPsiReflectionPredictor *> &predictors,
+    const af::const_ref<mat3<double> > &ub,
+    std::size_t nthreads = 1) {
+    DIALS_ASSERT(predictors.size() == ub.size());
+    DIALS_ASSERT(nthreads > 0);
+    std::vector<StillsDeltaPsiReflectionPredictor *> distinct(predictors);
+    std::sort(distinct.begin(), distinct.end());
+    DIALS_ASSERT(std::adjacent_find(distinct.begin(), distinct.end())
+                 == distinct.end());
+
+    // Predict each still in its own table
+    std::vector<af::reflection_table> tables(predictors.size());
+    std::string error;
+    boost::mutex error_mutex;
+    {
+      dials::util::WorkStealingThreadPool pool(
+        std::max<std::size_t>(std::min(nthreads, predictors.size()), 1));
+      for (std::size_t i = 0; i < predictors.size(); ++i) {
+        pool.post(boost::bind(&detail::predict_still_for_ub,
+                              predictors[i],
+                              ub[i],
+                              &tables[i],
+                              &error,
+                              &error_mutex));
+      }
+      pool.wait();
+    }
+    if (!error.empty()) {
+      throw DIALS_ERROR(error);
+    }
+
+    // Join the tables in order
+    af::reflection_table table;
+    stills_prediction_data predictions(table);
+    af::shared<int> id = table.get<int>("id");
+    for (std::size_t i = 0; i < tables.size(); ++i) {
+      stills_prediction_data block(tables[i]);
+      predictions.append(block);
+      id.resize(id.size() + block.hkl.size(), (int)i);
+    }
+    DIALS_ASSERT(table.is_consistent());
+    return table;
+  }
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_SPOT_PREDICTION_REFLECTION_PREDICTOR_H
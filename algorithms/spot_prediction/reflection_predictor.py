@@ -45,7 +45,15 @@ class ReflectionPredictor(object):
     """
 
     def __init__(
-        self, experiment, dmin=None, dmax=None, margin=1, force_static=False, padding=0
+        self,
+        experiment,
+        dmin=None,
+        dmax=None,
+        margin=1,
+        force_static=False,
+        padding=0,
+        nthreads=1,
+        index_cache=None,
     ):
         """
         Initialise a predictor for each experiment.
@@ -55,6 +63,8 @@ def __init__(
         :param dmax: The minimum resolution
         :param margin: The margin of hkl to predict
         :param force_static: force scan varying prediction to be static
+        :param nthreads: The number of threads to use for prediction
+        :param index_cache: A ReekeIndexCache to reuse the generated indices
         """
         from dxtbx.imageset import ImageSequence
 
@@ -97,7 +107,12 @@ def __call__(self):
             sv_compatible = (xl_nsp == nim + 1) or (bm_nsp == nim + 1)
             if not force_static and sv_compatible:
                 predictor = ScanVaryingReflectionPredictor(
-                    experiment, dmin=dmin, margin=margin, padding=padding
+                    experiment,
+                    dmin=dmin,
+                    margin=margin,
+                    padding=padding,
+                    nthreads=nthreads,
+                    index_cache=index_cache,
                 )
 
                 if bm_nsp == 0 and gn_nsp == 0:
@@ -147,11 +162,16 @@ def __call__(self):
                     )
             else:
                 predictor = ScanStaticReflectionPredictor(
-                    experiment, dmin=dmin, padding=padding
+                    experiment,
+                    dmin=dmin,
+                    padding=padding,
+                    nthreads=nthreads,
+                    index_cache=index_cache,
                 )
 
                 # Choose index generation method based on number of images
-                # https://github.com/dials/dials/issues/585
+                # https://github.com/dials/dials/issues/585. Both methods are
+                # threaded.
                 if experiment.scan.get_num_images() > 50:
                     predict_method = predictor.for_ub_old_index_generator
                 else:
@@ -4,11 +4,17 @@
 
 __all__ = (  # noqa: F405
     "BinnedGMMSingle1D",
+    "BinnedGMMSingle1DBatch",
     "BinnedGMMSingle1DFixedMean",
+    "BinnedGMMSingle1DFixedMeanBatch",
+    "CCHalfAccumulator",
+    "is_poisson_distributed",
     "kolmogorov_smirnov_one_sided_cdf",
+    "kolmogorov_smirnov_test_poisson",
     "kolmogorov_smirnov_test_standard_normal",
     "kolmogorov_smirnov_two_sided_cdf",
     "pearson_correlation_coefficient",
     "poisson_expected_max_counts",
     "spearman_correlation_coefficient",
+    "spearman_correlation_matrix",
 )
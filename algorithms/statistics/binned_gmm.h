@@ -15,6 +15,8 @@
 #include <cmath>
 #include <boost/math/special_functions/erf.hpp>
 #include <scitbx/constants.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -117,7 +119,6 @@ namespace dials { namespace algorithms {
 
       af::shared<bool> use(a.size(), true);
       for (std::size_t i = 0; i < m.size(); ++i) {
-        detail::Expectation e(a[i], b[i], mu_, sigma_);
         if (m[i] < 1) {
           use[i] = false;
         }
@@ -323,6 +324,129 @@ namespace dials { namespace algorithms {
     double sigma_;
   };
 
+  /**
+   * Fit one of the binned gaussian models to each row of a 2D histogram. The
+   * histograms share the same bins and the fits are independent, so they are
+   * done in bands of rows across threads.
+   */
+  template <typename Model>
+  class BinnedGMMBatch {
+  public:
+    /**
+     * Compute the parameters
+     * @param a The lower bounds of the bins
+     * @param b The upper bounds of the bins
+     * @param n The number of counts in each bin of each histogram
+     * @param mu The mean parameter estimate for each histogram
+     * @param sigma The sigma parameter estimate for each histogram
+     * @param epsilon The convergence tolerance
+     * @param max_iter The maximum number of iterations
+     * @param nthreads The number of threads to use
+     */
+    BinnedGMMBatch(const af::const_ref<double> &a,
+                   const af::const_ref<double> &b,
+                   const af::const_ref<double, af::c_grid<2> > &n,
+                   const af::const_ref<double> &mu,
+                   const af::const_ref<double> &sigma,
+                   double epsilon,
+                   std::size_t max_iter,
+                   std::size_t nthreads = 1)
+        : max_iter_(max_iter),
+          epsilon_(epsilon),
+          num_iter_(n.accessor()[0], 0),
+          mu_(n.accessor()[0], 0),
+          sigma_(n.accessor()[0], 0) {
+      // Check the input
+      DIALS_ASSERT(a.size() == b.size());
+      DIALS_ASSERT(a.size() == n.accessor()[1]);
+      DIALS_ASSERT(mu.size() == n.accessor()[0]);
+      DIALS_ASSERT(sigma.size() == n.accessor()[0]);
+
+      // Do the fits
+      for_each_band(FitBand(*this, a, b, n, mu, sigma), (int)mu.size(), nthreads);
+    }
+
+    /**
+     * @returns The number of fits
+     */
+    std::size_t size() const {
+      return mu_.size();
+    }
+
+    /**
+     * @returns The maximum number of iterations
+     */
+    std::size_t max_iter() const {
+      return max_iter_;
+    }
+
+    /**
+     * @returns The epsilon
+     */
+    double epsilon() const {
+      return epsilon_;
+    }
+
+    /**
+     * @returns The number of iterations of each fit
+     */
+    af::shared<std::size_t> num_iter() const {
+      return num_iter_;
+    }
+
+    /**
+     * @returns The mu parameter estimate of each fit
+     */
+    af::shared<double> mu() const {
+      return mu_;
+    }
+
+    /**
+     * @returns The sigma parameter estimate of each fit
+     */
+    af::shared<double> sigma() const {
+      return sigma_;
+    }
+
+  protected:
+    /**
+     * Fit the histograms in a band of rows
+     */
+    struct FitBand {
+      BinnedGMMBatch &batch;
+      af::const_ref<double> a;
+      af::const_ref<double> b;
+      af::const_ref<double, af::c_grid<2> > n;
+      af::const_ref<double> mu;
+      af::const_ref<double> sigma;
+
+      FitBand(BinnedGMMBatch &batch_,
+              const af::const_ref<double> &a_,
+              const af::const_ref<double> &b_,
+              const af::const_ref<double, af::c_grid<2> > &n_,
+              const af::const_ref<double> &mu_,
+              const af::const_ref<double> &sigma_)
+          : batch(batch_), a(a_), b(b_), n(n_), mu(mu_), sigma(sigma_) {}
+
+      void operator()(int i0, int i1) const {
+        std::size_t nbins = a.size();
+        for (int i = i0; i < i1; ++i) {
+          af::const_ref<double> row(n.begin() + i * nbins, nbins);
+          Model model(a, b, row, mu[i], sigma[i], batch.epsilon_, batch.max_iter_);
+          batch.num_iter_[i] = model.num_iter();
+          batch.mu_[i] = model.mu();
+          batch.sigma_[i] = model.sigma();
+        }
+      }
+    };
+
+    std::size_t max_iter_;
+    double epsilon_;
+    af::shared<std::size_t> num_iter_;
+    af::shared<double> mu_;
+    af::shared<double> sigma_;
+  };
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_STATISTICS_BINNED_GMM_H
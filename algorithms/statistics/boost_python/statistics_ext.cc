@@ -18,6 +18,7 @@
 #include <dials/algorithms/statistics/poisson_test.h>
 #include <dials/algorithms/statistics/correlation.h>
 #include <dials/algorithms/statistics/binned_gmm.h>
+#include <dials/algorithms/statistics/cc_half_accumulator.h>
 
 namespace dials { namespace algorithms { namespace boost_python {
 
@@ -39,11 +40,7 @@ namespace dials { namespace algorithms { namespace boost_python {
   // return pdf(kolmogorov_smirnov_one_sided_distribution<RealType>(n), x);
   //}
 
-  template <typename RealType>
-  boost::python::tuple kolmogorov_smirnov_test_standard_normal(
-    const af::const_ref<RealType> &data,
-    std::string type) {
-    // Get the enumeration
+  inline KSType ks_type_from_string(const std::string &type) {
     KSType etype = TwoSided;
     if (type.compare("less") == 0) {
       etype = Less;
@@ -52,6 +49,15 @@ namespace dials { namespace algorithms { namespace boost_python {
     } else {
       DIALS_ASSERT(type.compare("two_sided") == 0);
     }
+    return etype;
+  }
+
+  template <typename RealType>
+  boost::python::tuple kolmogorov_smirnov_test_standard_normal(
+    const af::const_ref<RealType> &data,
+    std::string type) {
+    // Get the enumeration
+    KSType etype = ks_type_from_string(type);
 
     // Perform the test
     std::pair<RealType, RealType> result =
@@ -62,6 +68,46 @@ namespace dials { namespace algorithms { namespace boost_python {
     return boost::python::make_tuple(result.first, result.second);
   }
 
+  boost::python::tuple kolmogorov_smirnov_test_poisson_wrapper(
+    const af::const_ref<double> &data,
+    const af::const_ref<std::size_t> &offset,
+    std::string type,
+    std::size_t nthreads) {
+    DIALS_ASSERT(offset.size() > 0);
+    af::shared<double> D(offset.size() - 1, 0);
+    af::shared<double> p(offset.size() - 1, 0);
+    kolmogorov_smirnov_test_poisson(
+      data, offset, ks_type_from_string(type), D.ref(), p.ref(), nthreads);
+    return boost::python::make_tuple(D, p);
+  }
+
+  template <typename Model>
+  void export_binned_gmm_batch(const char *name) {
+    typedef BinnedGMMBatch<Model> batch_type;
+    class_<batch_type>(name, no_init)
+      .def(init<const af::const_ref<double> &,
+                const af::const_ref<double> &,
+                const af::const_ref<double, af::c_grid<2> > &,
+                const af::const_ref<double> &,
+                const af::const_ref<double> &,
+                double,
+                std::size_t,
+                std::size_t>((arg("a"),
+                              arg("b"),
+                              arg("n"),
+                              arg("mu"),
+                              arg("sigma"),
+                              arg("epsilon"),
+                              arg("max_iter"),
+                              arg("nthreads") = 1)))
+      .def("__len__", &batch_type::size)
+      .def("max_iter", &batch_type::max_iter)
+      .def("num_iter", &batch_type::num_iter)
+      .def("epsilon", &batch_type::epsilon)
+      .def("mu", &batch_type::mu)
+      .def("sigma", &batch_type::sigma);
+  }
+
   BOOST_PYTHON_MODULE(dials_algorithms_statistics_ext) {
     def("kolmogorov_smirnov_one_sided_cdf", &kolmogorov_smirnov_one_sided_cdf<double>);
     def("kolmogorov_smirnov_two_sided_cdf", &kolmogorov_smirnov_two_sided_cdf<double>);
@@ -71,9 +117,19 @@ namespace dials { namespace algorithms { namespace boost_python {
         &kolmogorov_smirnov_test_standard_normal<double>,
         (arg("data"), arg("type") = "two_sided"));
 
+    def("kolmogorov_smirnov_test_poisson",
+        &kolmogorov_smirnov_test_poisson_wrapper,
+        (arg("data"), arg("offset"), arg("type") = "two_sided", arg("nthreads") = 1));
+
     def("poisson_expected_max_counts", &poisson_expected_max_counts);
+    def("is_poisson_distributed",
+        &is_poisson_distributed,
+        (arg("data"), arg("offset"), arg("nthreads") = 1));
 
     def("spearman_correlation_coefficient", &spearman_correlation_coefficient<double>);
+    def("spearman_correlation_matrix",
+        &spearman_correlation_matrix<double>,
+        (arg("data"), arg("nthreads") = 1));
     def("pearson_correlation_coefficient", &pearson_correlation_coefficient<double>);
 
     class_<BinnedGMMSingle1DFixedMean>("BinnedGMMSingle1DFixedMean", no_init)
@@ -103,6 +159,30 @@ namespace dials { namespace algorithms { namespace boost_python {
       .def("epsilon", &BinnedGMMSingle1D::epsilon)
       .def("mu", &BinnedGMMSingle1D::mu)
       .def("sigma", &BinnedGMMSingle1D::sigma);
+
+    export_binned_gmm_batch<BinnedGMMSingle1DFixedMean>(
+      "BinnedGMMSingle1DFixedMeanBatch");
+    export_binned_gmm_batch<BinnedGMMSingle1D>("BinnedGMMSingle1DBatch");
+
+    class_<CCHalfAccumulator>("CCHalfAccumulator", no_init)
+      .def(init<const af::const_ref<std::size_t> &,
+                const af::const_ref<std::size_t> &,
+                std::size_t,
+                const af::const_ref<double> &>(
+        (arg("unique_index"), arg("bin_index"), arg("nbins"), arg("intensity"))))
+      .def("num_observations", &CCHalfAccumulator::num_observations)
+      .def("num_unique", &CCHalfAccumulator::num_unique)
+      .def("num_bins", &CCHalfAccumulator::num_bins)
+      .def("update", &CCHalfAccumulator::update, (arg("index"), arg("intensity")))
+      .def("bin_count", &CCHalfAccumulator::bin_count)
+      .def("bin_cc_half", &CCHalfAccumulator::bin_cc_half)
+      .def("mean_cc_half", &CCHalfAccumulator::mean_cc_half)
+      .def("mean_cc_half_excluding",
+           &CCHalfAccumulator::mean_cc_half_excluding,
+           (arg("index")))
+      .def("mean_cc_half_excluding_groups",
+           &CCHalfAccumulator::mean_cc_half_excluding_groups,
+           (arg("group"), arg("ngroups"), arg("nthreads") = 1));
   }
 
 }}}  // namespace dials::algorithms::boost_python
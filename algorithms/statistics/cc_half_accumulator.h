@@ -0,0 +1,346 @@
+/*
+ * cc_half_accumulator.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ALGORITHMS_STATISTICS_CC_HALF_ACCUMULATOR_H
+#define DIALS_ALGORITHMS_STATISTICS_CC_HALF_ACCUMULATOR_H
+
+#include <algorithm>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  /**
+   * A class to hold running sums of the observations of each unique
+   * reflection, and of the mean and variance of the mean intensity of the
+   * unique reflections in each resolution bin, from which the CC1/2 is
+   * computed using the sigma-tau method of Assmann, Brehm and Diederichs
+   * (2016).
+   *
+   * Changing the intensities of a few observations only updates the sums of
+   * the unique reflections they belong to, rather than all the data, and the
+   * CC1/2 with a set of observations excluded is found by adjusting a copy of
+   * the bin sums for the unique reflections those observations belong to. The
+   * CC1/2 with each group of observations excluded can therefore be computed
+   * for all the groups in parallel.
+   */
+  class CCHalfAccumulator {
+  public:
+    /**
+     * Initialise the sums
+     * @param unique_index The index of the unique reflection of each
+     *                     observation
+     * @param bin_index The resolution bin of each unique reflection
+     * @param nbins The number of resolution bins
+     * @param intensity The intensity of each observation
+     */
+    CCHalfAccumulator(const af::const_ref<std::size_t> &unique_index,
+                      const af::const_ref<std::size_t> &bin_index,
+                      std::size_t nbins,
+                      const af::const_ref<double> &intensity)
+        : unique_index_(unique_index.begin(), unique_index.end()),
+          bin_index_(bin_index.begin(), bin_index.end()),
+          intensity_(intensity.begin(), intensity.end()),
+          unique_(bin_index.size()),
+          bin_(nbins) {
+      DIALS_ASSERT(nbins > 0);
+      DIALS_ASSERT(unique_index.size() == intensity.size());
+      for (std::size_t i = 0; i < bin_index.size(); ++i) {
+        DIALS_ASSERT(bin_index[i] < nbins);
+      }
+      for (std::size_t i = 0; i < unique_index.size(); ++i) {
+        DIALS_ASSERT(unique_index[i] < unique_.size());
+        unique_[unique_index[i]].add(intensity[i], 1);
+      }
+      for (std::size_t i = 0; i < unique_.size(); ++i) {
+        bin_[bin_index_[i]].add(unique_[i], 1);
+      }
+
+      // Order the observations by unique reflection
+      std::vector<std::size_t> position(unique_.size() + 1, 0);
+      for (std::size_t i = 0; i < unique_.size(); ++i) {
+        position[i + 1] = position[i] + unique_[i].n;
+      }
+      by_unique_.resize(unique_index.size());
+      for (std::size_t i = 0; i < unique_index.size(); ++i) {
+        by_unique_[position[unique_index[i]]++] = i;
+      }
+    }
+
+    /** @returns The number of observations */
+    std::size_t num_observations() const {
+      return intensity_.size();
+    }
+
+    /** @returns The number of unique reflections */
+    std::size_t num_unique() const {
+      return unique_.size();
+    }
+
+    /** @returns The number of resolution bins */
+    std::size_t num_bins() const {
+      return bin_.size();
+    }
+
+    /**
+     * Change the intensities of some of the observations, for example after
+     * their scale factors have changed
+     * @param index The indices of the observations
+     * @param intensity The new intensities
+     */
+    void update(const af::const_ref<std::size_t> &index,
+                const af::const_ref<double> &intensity) {
+      DIALS_ASSERT(index.size() == intensity.size());
+      for (std::size_t i = 0; i < index.size(); ++i) {
+        DIALS_ASSERT(index[i] < intensity_.size());
+        std::size_t h = unique_index_[index[i]];
+        BinSums &bin = bin_[bin_index_[h]];
+        bin.add(unique_[h], -1);
+        unique_[h].add(intensity_[index[i]], -1);
+        unique_[h].add(intensity[i], 1);
+        bin.add(unique_[h], 1);
+        intensity_[index[i]] = intensity[i];
+      }
+    }
+
+    /**
+     * @returns The number of unique reflections with more than one
+     *          observation in each bin
+     */
+    af::shared<std::size_t> bin_count() const {
+      af::shared<std::size_t> result(bin_.size());
+      for (std::size_t i = 0; i < bin_.size(); ++i) {
+        result[i] = bin_[i].n;
+      }
+      return result;
+    }
+
+    /**
+     * @returns The CC1/2 in each bin, or zero for bins with fewer than two
+     *          unique reflections with more than one observation
+     */
+    af::shared<double> bin_cc_half() const {
+      af::shared<double> result(bin_.size(), 0);
+      for (std::size_t i = 0; i < bin_.size(); ++i) {
+        if (bin_[i].n > 1) {
+          result[i] = bin_[i].cc_half();
+        }
+      }
+      return result;
+    }
+
+    /**
+     * @returns The mean of the CC1/2 in each bin, weighted by the number of
+     *          unique reflections in the bin
+     */
+    double mean_cc_half() const {
+      return weighted_mean_cc_half(bin_);
+    }
+
+    /**
+     * Compute the mean CC1/2 with a set of observations excluded
+     * @param index The indices of the observations to exclude
+     * @returns The mean CC1/2 of the remaining observations
+     */
+    double mean_cc_half_excluding(const af::const_ref<std::size_t> &index) const {
+      std::vector<std::size_t> sorted(index.begin(), index.end());
+      for (std::size_t i = 0; i < sorted.size(); ++i) {
+        DIALS_ASSERT(sorted[i] < intensity_.size());
+      }
+      std::sort(sorted.begin(), sorted.end(), CompareUnique(unique_index_.const_ref()));
+      std::vector<BinSums> bins(bin_);
+      const std::size_t *data = sorted.empty() ? NULL : &sorted[0];
+      remove_observations(data, data + sorted.size(), bins);
+      return weighted_mean_cc_half(bins);
+    }
+
+    /**
+     * Compute the mean CC1/2 with each group of observations excluded in turn.
+     * The observations are ordered by group and, within each group, by unique
+     * reflection. The sums of the unique reflections in each group are then
+     * removed from a copy of the bin sums in a single pass over the group,
+     * with the groups processed in bands across threads.
+     * @param group The group of each observation
+     * @param ngroups The number of groups
+     * @param nthreads The number of threads to use
+     * @returns The mean CC1/2 of the remaining observations for each group
+     */
+    af::shared<double> mean_cc_half_excluding_groups(
+      const af::const_ref<std::size_t> &group,
+      std::size_t ngroups,
+      std::size_t nthreads = 1) const {
+      DIALS_ASSERT(group.size() == intensity_.size());
+
+      // Sort the observations by group, keeping them in unique reflection
+      // order within each group
+      std::vector<std::size_t> offset(ngroups + 1, 0);
+      for (std::size_t i = 0; i < group.size(); ++i) {
+        DIALS_ASSERT(group[i] < ngroups);
+        offset[group[i] + 1]++;
+      }
+      for (std::size_t i = 0; i < ngroups; ++i) {
+        offset[i + 1] += offset[i];
+      }
+      std::vector<std::size_t> position(offset.begin(), offset.end() - 1);
+      std::vector<std::size_t> members(group.size());
+      for (std::size_t k = 0; k < by_unique_.size(); ++k) {
+        std::size_t i = by_unique_[k];
+        members[position[group[i]]++] = i;
+      }
+
+      af::shared<double> result(ngroups, 0);
+      for_each_band(ExcludeGroupsBand(*this, offset, members, result.ref()),
+                    (int)ngroups,
+                    nthreads);
+      return result;
+    }
+
+  private:
+    /**
+     * The number of observations of a unique reflection with the sum of
+     * their intensities and squared intensities
+     */
+    struct UniqueSums {
+      std::size_t n;
+      double sum_x;
+      double sum_x2;
+
+      UniqueSums() : n(0), sum_x(0), sum_x2(0) {}
+
+      void add(double x, int sign) {
+        n += sign;
+        sum_x += sign * x;
+        sum_x2 += sign * x * x;
+      }
+    };
+
+    /**
+     * The number of unique reflections with more than one observation in a
+     * bin, with the sums of their mean intensities, squared mean intensities
+     * and the variances of their mean intensities
+     */
+    struct BinSums {
+      std::size_t n;
+      double sum_mean;
+      double sum_mean2;
+      double sum_var;
+
+      BinSums() : n(0), sum_mean(0), sum_mean2(0), sum_var(0) {}
+
+      void add(const UniqueSums &u, int sign) {
+        if (u.n > 1) {
+          double mean = u.sum_x / u.n;
+          double var = (u.sum_x2 - u.sum_x * u.sum_x / u.n) / (u.n - 1) / u.n;
+          n += sign;
+          sum_mean += sign * mean;
+          sum_mean2 += sign * mean * mean;
+          sum_var += sign * var;
+        }
+      }
+
+      double cc_half() const {
+        DIALS_ASSERT(n > 1);
+        double sigma_e = sum_var / n;
+        double sigma_y = (sum_mean2 - sum_mean * sum_mean / n) / (n - 1);
+        return (sigma_y - sigma_e) / (sigma_y + sigma_e);
+      }
+    };
+
+    /**
+     * Compute the mean CC1/2 with each group excluded for a band of groups
+     */
+    struct ExcludeGroupsBand {
+      const CCHalfAccumulator &accumulator;
+      const std::vector<std::size_t> &offset;
+      const std::vector<std::size_t> &members;
+      af::ref<double> result;
+
+      ExcludeGroupsBand(const CCHalfAccumulator &accumulator_,
+                        const std::vector<std::size_t> &offset_,
+                        const std::vector<std::size_t> &members_,
+                        af::ref<double> result_)
+          : accumulator(accumulator_),
+            offset(offset_),
+            members(members_),
+            result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        const std::size_t *data = members.empty() ? NULL : &members[0];
+        std::vector<BinSums> bins;
+        for (int i = i0; i < i1; ++i) {
+          bins = accumulator.bin_;
+          accumulator.remove_observations(data + offset[i], data + offset[i + 1], bins);
+          result[i] = weighted_mean_cc_half(bins);
+        }
+      }
+    };
+
+    /**
+     * Order observations by their unique reflection
+     */
+    struct CompareUnique {
+      af::const_ref<std::size_t> unique_index;
+
+      CompareUnique(const af::const_ref<std::size_t> &unique_index_)
+          : unique_index(unique_index_) {}
+
+      bool operator()(std::size_t a, std::size_t b) const {
+        return unique_index[a] < unique_index[b];
+      }
+    };
+
+    /**
+     * Remove the observations in a range, ordered by unique reflection, from
+     * a set of bin sums. The sums of each unique reflection in the range are
+     * replaced by the sums without the observations.
+     */
+    void remove_observations(const std::size_t *first,
+                             const std::size_t *last,
+                             std::vector<BinSums> &bins) const {
+      while (first != last) {
+        std::size_t h = unique_index_[*first];
+        UniqueSums remaining = unique_[h];
+        for (; first != last && unique_index_[*first] == h; ++first) {
+          remaining.add(intensity_[*first], -1);
+        }
+        BinSums &bin = bins[bin_index_[h]];
+        bin.add(unique_[h], -1);
+        bin.add(remaining, 1);
+      }
+    }
+
+    /**
+     * Compute the mean CC1/2 from a set of bin sums
+     */
+    static double weighted_mean_cc_half(const std::vector<BinSums> &bins) {
+      double mean = 0;
+      std::size_t count = 0;
+      for (std::size_t i = 0; i < bins.size(); ++i) {
+        if (bins[i].n > 1) {
+          mean += bins[i].n * bins[i].cc_half();
+          count += bins[i].n;
+        }
+      }
+      DIALS_ASSERT(count > 0);
+      return mean / count;
+    }
+
+    af::shared<std::size_t> unique_index_;
+    af::shared<std::size_t> bin_index_;
+    af::shared<double> intensity_;
+    std::vector<UniqueSums> unique_;
+    std::vector<BinSums> bin_;
+    std::vector<std::size_t> by_unique_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_STATISTICS_CC_HALF_ACCUMULATOR_H
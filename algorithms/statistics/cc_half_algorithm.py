@@ -496,6 +496,7 @@ def run(self):
             self.params.dmin,
             self.params.dmax,
             self.params.nbins,
+            nthreads=self.params.nproc,
         )
 
         statistics.run()
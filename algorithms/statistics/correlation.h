@@ -13,6 +13,10 @@
 #define DIALS_ALGORITHMS_STATISTICS_CORRELATION_H
 
 #include <algorithm>
+#include <cmath>
+#include <vector>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -31,15 +35,102 @@ namespace dials { namespace algorithms {
 
   }  // namespace detail
 
+  template <typename T>
+  void rank(const af::const_ref<T> &data,
+            af::ref<T> result,
+            std::vector<std::size_t> &index);
+
+  namespace detail {
+
+    /**
+     * Compute the rank correlation coefficient from two arrays of ranks
+     */
+    template <typename T>
+    T spearman_from_ranks(const af::const_ref<T> &ra, const af::const_ref<T> &rb) {
+      DIALS_ASSERT(ra.size() == rb.size());
+
+      // The numerator
+      T num = 0.0;
+      for (std::size_t i = 0; i < ra.size(); ++i) {
+        num += (ra[i] - rb[i]) * (ra[i] - rb[i]);
+      }
+      num *= 6.0;
+
+      // The denominator
+      T n = (T)ra.size();
+      T den = n * (n * n - 1.0);
+      DIALS_ASSERT(den > 0);
+
+      // Return the correlation
+      return 1.0 - num / den;
+    }
+
+    /**
+     * Rank each of a band of rows of a matrix, reusing the workspace for the
+     * sorted indices between rows
+     */
+    template <typename T>
+    struct RankRows {
+      af::const_ref<T, af::c_grid<2> > data;
+      af::ref<T, af::c_grid<2> > ranks;
+
+      RankRows(const af::const_ref<T, af::c_grid<2> > &data_,
+               af::ref<T, af::c_grid<2> > ranks_)
+          : data(data_), ranks(ranks_) {}
+
+      void operator()(int j0, int j1) const {
+        std::size_t ncols = data.accessor()[1];
+        std::vector<std::size_t> index;
+        for (int j = j0; j < j1; ++j) {
+          af::const_ref<T> row(&data(j, 0), ncols);
+          rank(row, af::ref<T>(&ranks(j, 0), ncols), index);
+        }
+      }
+    };
+
+    /**
+     * Compute the rank correlation of each of a band of rows of a matrix of
+     * ranks with every other row
+     */
+    template <typename T>
+    struct SpearmanFromRankRows {
+      af::const_ref<T, af::c_grid<2> > ranks;
+      af::ref<T, af::c_grid<2> > result;
+
+      SpearmanFromRankRows(const af::const_ref<T, af::c_grid<2> > &ranks_,
+                           af::ref<T, af::c_grid<2> > result_)
+          : ranks(ranks_), result(result_) {}
+
+      void operator()(int j0, int j1) const {
+        std::size_t nrows = ranks.accessor()[0];
+        std::size_t ncols = ranks.accessor()[1];
+        for (int j = j0; j < j1; ++j) {
+          af::const_ref<T> a(&ranks(j, 0), ncols);
+          for (std::size_t i = 0; i < nrows; ++i) {
+            af::const_ref<T> b(&ranks(i, 0), ncols);
+            result(j, i) = spearman_from_ranks(a, b);
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
   /**
-   * A function to compute the rank of an array
+   * A function to compute the rank of an array, using a workspace for the
+   * sorted indices so that repeated calls need not allocate
    * @param data The data to rank
-   * @return The rank
+   * @param result The array to hold the rank
+   * @param index The workspace for the sorted indices
    */
   template <typename T>
-  af::shared<T> rank(const af::const_ref<T> data) {
+  void rank(const af::const_ref<T> &data,
+            af::ref<T> result,
+            std::vector<std::size_t> &index) {
+    DIALS_ASSERT(result.size() == data.size());
+
     // Construct the indices
-    std::vector<std::size_t> index(data.size());
+    index.resize(data.size());
     for (std::size_t i = 0; i < index.size(); ++i) {
       index[i] = i;
     }
@@ -48,7 +139,6 @@ namespace dials { namespace algorithms {
     std::sort(index.begin(), index.end(), detail::sort_by_index<T>(data));
 
     // Loop through
-    af::shared<T> result(index.size());
     for (std::size_t i = 0; i < index.size();) {
       std::size_t j = i + 1;
       T value = (T)(i + 1.0);
@@ -64,8 +154,18 @@ namespace dials { namespace algorithms {
         result[index[i]] = value;
       }
     }
+  }
 
-    // Return the rank
+  /**
+   * A function to compute the rank of an array
+   * @param data The data to rank
+   * @return The rank
+   */
+  template <typename T>
+  af::shared<T> rank(const af::const_ref<T> data) {
+    af::shared<T> result(data.size());
+    std::vector<std::size_t> index;
+    rank(data, result.ref(), index);
     return result;
   }
 
@@ -83,21 +183,32 @@ namespace dials { namespace algorithms {
     // Rank the two datasets
     af::shared<T> ra = rank(a);
     af::shared<T> rb = rank(b);
+    return detail::spearman_from_ranks(ra.const_ref(), rb.const_ref());
+  }
 
-    // The numerator
-    T num = 0.0;
-    for (std::size_t i = 0; i < ra.size(); ++i) {
-      num += (ra[i] - rb[i]) * (ra[i] - rb[i]);
-    }
-    num *= 6.0;
-
-    // The denominator
-    T n = (T)ra.size();
-    T den = n * (n * n - 1.0);
-    DIALS_ASSERT(den > 0);
-
-    // Return the correlation
-    return 1.0 - num / den;
+  /**
+   * Compute the rank correlation between each pair of rows of a matrix, for
+   * example the intensities of a common set of reflections in each dataset.
+   * Each row is ranked once, in parallel over the rows, and the pairwise
+   * coefficients are then computed from the ranks in parallel over the rows
+   * of the result.
+   * @param data The data, with one row per dataset
+   * @param nthreads The number of threads to use
+   * @return The symmetric matrix of rank correlation coefficients
+   */
+  template <typename T>
+  af::versa<T, af::c_grid<2> > spearman_correlation_matrix(
+    const af::const_ref<T, af::c_grid<2> > &data,
+    std::size_t nthreads = 1) {
+    std::size_t nrows = data.accessor()[0];
+    DIALS_ASSERT(data.accessor()[1] > 1);
+    af::versa<T, af::c_grid<2> > ranks(data.accessor());
+    detail::RankRows<T> rank_rows(data, ranks.ref());
+    for_each_band(rank_rows, (int)nrows, nthreads);
+    af::versa<T, af::c_grid<2> > result(af::c_grid<2>(nrows, nrows));
+    detail::SpearmanFromRankRows<T> from_ranks(ranks.const_ref(), result.ref());
+    for_each_band(from_ranks, (int)nrows, nthreads);
+    return result;
   }
 
   /**
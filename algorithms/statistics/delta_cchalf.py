@@ -3,13 +3,13 @@
 from __future__ import absolute_import, division, print_function
 
 import logging
-from collections import defaultdict
 from math import floor, sqrt
 
 import six
 
 from cctbx import crystal, miller
 
+from dials.algorithms.statistics import CCHalfAccumulator
 from dials.array_family import flex
 
 logger = logging.getLogger("dials.command_line.compute_delta_cchalf")
@@ -166,6 +166,7 @@ def __init__(
         d_min=None,
         d_max=None,
         n_bins=10,
+        nthreads=1,
     ):
         # here dataset is the sweep number, group is the group number for doing
         # the cc half analysis. May be the same as dataset if doing per dataset
@@ -176,6 +177,7 @@ def __init__(
         self.d_min = d_min
         self.d_max = d_max
         self._num_bins = n_bins
+        self._nthreads = nthreads
         self.reflection_table = reflection_table
         self._cchalf_mean = None
         self._cchalf = None
@@ -196,30 +198,31 @@ def __init__(
             self.d_max = flex.max(self.reflection_table["d"])
         self.binner = ResolutionBinner(mean_unit_cell, self.d_min, self.d_max, n_bins)
 
-        self.reflection_sums = defaultdict(ReflectionSum)
+        self._accumulator = None
         self.compute_overall_stats()
 
     def compute_overall_stats(self):
-        # Create lookups for elements by miller index
-        index_lookup = defaultdict(list)
+        # Number the unique reflections by miller index, and accumulate the
+        # Sum(X) and Sum(X^2) for each unique reflection
+        unique_lookup = {}
+        unique_index = flex.size_t(self.reflection_table.size())
         for i, h in enumerate(self.reflection_table["miller_index"]):
-            index_lookup[h].append(i)
-
-        # Compute the Overall Sum(X) and Sum(X^2) for each unique reflection
-
-        for h in index_lookup:
-            sel = flex.size_t(index_lookup[h])
-            intensities = self.reflection_table["intensity"].select(sel)
-            n = intensities.size()
-            sum_x = flex.sum(intensities)
-            sum_x2 = flex.sum(flex.pow2(intensities))
-            self.reflection_sums[h] = ReflectionSum(sum_x, sum_x2, n)
+            unique_index[i] = unique_lookup.setdefault(h, len(unique_lookup))
+        bin_index = flex.size_t(len(unique_lookup))
+        for h, j in six.iteritems(unique_lookup):
+            bin_index[j] = self.binner.index(h)
+        self._accumulator = CCHalfAccumulator(
+            unique_index,
+            bin_index,
+            self.binner.nbins(),
+            self.reflection_table["intensity"],
+        )
 
         # Compute some numbers
         self._num_datasets = len(set(self.reflection_table["dataset"]))
         self._num_groups = len(set(self.reflection_table["group"]))
         self._num_reflections = self.reflection_table.size()
-        self._num_unique = len(self.reflection_sums)
+        self._num_unique = self._accumulator.num_unique()
 
         logger.info(
             """
@@ -257,54 +260,30 @@ def d_filter(self):
 
     def run(self):
         """Compute the ΔCC½ for all the data"""
-        self._cchalf_mean = compute_cchalf_from_reflection_sums(
-            self.reflection_sums, self.binner
-        )
+        self._cchalf_mean = self._accumulator.mean_cc_half()
         logger.info("CC 1/2 mean: %.3f", (100 * self._cchalf_mean))
         self._cchalf = self._compute_cchalf_excluding_each_group()
 
     def _compute_cchalf_excluding_each_group(self):
-        #   self, reflection_sums, binner, miller_index, dataset, intensity
-        # ):
         """
         Compute the CC 1/2 with an image excluded.
 
         For each image, update the sums by removing the contribution from the image
-        and then compute the CC 1/2 of the remaining data
+        and then compute the CC 1/2 of the remaining data. Only the sums of the
+        unique reflections observed in the image need to change, so the groups
+        are computed in parallel in the accumulator.
         """
+        groups = sorted(set(self.reflection_table["group"]))
+        group_lookup = {g: i for i, g in enumerate(groups)}
+        group_index = flex.size_t(
+            [group_lookup[g] for g in self.reflection_table["group"]]
+        )
+        cchalf_excluding = self._accumulator.mean_cc_half_excluding_groups(
+            group_index, len(groups), self._nthreads
+        )
 
-        # Create a lookup table for each reflection by dataset i.e. group of images
-        dataset_lookup = defaultdict(list)
-        for i, b in enumerate(self.reflection_table["group"]):
-            dataset_lookup[b].append(i)
-
-        # Compute CC1/2 minus each dataset
         cchalf_i = {}
-        for dataset in dataset_lookup:
-
-            # Find all observations from this dataset and create a lookup based on
-            # miller index
-            index_lookup = defaultdict(list)
-            for i in dataset_lookup[dataset]:
-                index_lookup[self.reflection_table["miller_index"][i]].append(i)
-
-            # Loop through all the reflections and remove the contribution of
-            # reflections from the current dataset
-            dataset_reflection_sums = defaultdict(ReflectionSum)
-            for h in self.reflection_sums:
-                sum_x = self.reflection_sums[h].sum_x
-                sum_x2 = self.reflection_sums[h].sum_x2
-                n = self.reflection_sums[h].n
-                for i in index_lookup[h]:
-                    sum_x -= self.reflection_table["intensity"][i]
-                    sum_x2 -= self.reflection_table["intensity"][i] ** 2
-                    n -= 1
-                dataset_reflection_sums[h] = ReflectionSum(sum_x, sum_x2, n)
-
-            # Compute the CC 1/2 without the reflections from the current dataset
-            cchalf = compute_cchalf_from_reflection_sums(
-                dataset_reflection_sums, self.binner
-            )
+        for dataset, cchalf in zip(groups, cchalf_excluding):
             cchalf_i[dataset] = cchalf
             logger.info("CC 1/2 excluding group %d: %.3f", dataset, 100 * cchalf)
 
@@ -4,6 +4,7 @@
 
 from scitbx.array_family import flex
 
+from dials_refinement_helpers_ext import MCDConcentration
 from dials_refinement_helpers_ext import maha_dist_sq as maha_dist_sq_cpp
 from dials_refinement_helpers_ext import mcd_consistency
 
@@ -38,17 +39,20 @@ def maha_dist_sq(cols, center, cov):
     vectors contained in the list cols) from the center vector with respect to
     the covariance matrix cov"""
 
-    n = len(cols[0])
-    p = len(cols)
-    assert len(center) == p
+    assert len(center) == len(cols)
 
-    # observation matrix
-    obs = flex.double(flex.grid(n, p))
+    d2 = maha_dist_sq_cpp(observation_matrix(cols), flex.double(center), cov)
+    return d2
+
+
+def observation_matrix(cols):
+    """Form the matrix with the observations in the vectors contained in the
+    list cols as its rows"""
+
+    obs = flex.double(flex.grid(len(cols[0]), len(cols)))
     for i, col in enumerate(cols):
         obs.matrix_paste_column_in_place(col, i)
-
-    d2 = maha_dist_sq_cpp(obs, flex.double(center), cov)
-    return d2
+    return obs
 
 
 def mcd_finite_sample(p, n, alpha):
@@ -130,7 +134,8 @@ def mcd_finite_sample(p, n, alpha):
 
 class FastMCD(object):
     """Experimental implementation of the FAST-MCD algorithm of Rousseeuw and
-    van Driessen"""
+    van Driessen. The random subsets are drawn here, while the trials and their
+    concentration steps run in C++ across nthreads threads"""
 
     def __init__(
         self,
@@ -142,6 +147,7 @@ def __init__(
         k1=2,
         k2=2,
         k3=100,
+        nthreads=1,
     ):
         """data expected to be a list of flex.double arrays of the same length,
         representing the vectors of observations in each dimension"""
@@ -182,6 +188,9 @@ def __init__(
         self._k2 = k2
         self._k3 = k3
 
+        # number of threads for the trials
+        self._nthreads = nthreads
+
         # correction factors
         self._consistency_fac = mcd_consistency(self._p, self._h / self._n)
         self._finite_samp_fac = mcd_finite_sample(self._p, self._n, self._alpha)
@@ -216,17 +225,6 @@ def get_corrected_T_and_S(self):
         fac = self._consistency_fac * self._finite_samp_fac
         return self._T_raw, self._S_raw * fac
 
-    @staticmethod
-    def means_and_covariance(vecs):
-        """Prepare a dataset of equal length vectors for Mahalanobis distance
-        squared calculation. The maha_dist_sq function requires the vectors,
-        the vector of their means and their covariance matrix. Given the vectors,
-        return the latter pair as a tuple"""
-
-        center = flex.double([flex.mean(e) for e in vecs])
-        covmat = cov(*vecs)
-        return (center, covmat)
-
     @staticmethod
     def sample_data(data, sample_size):
         """sample (without replacement) the data vectors to select the same
@@ -265,81 +263,46 @@ def split_into_groups(self, sample, ngroups):
 
         return groups
 
-    def form_initial_subset(self, h, data):
-        """Method 2 of subsection 3.1 of R&vD"""
-
-        # permutation of input data for sampling
-        p = flex.random_permutation(len(data[0]))
-        permuted = [col.select(p) for col in data]
-
-        # draw random p+1 subset J (or larger if required)
-        detS0 = 0.0
-        i = 0
-        while not detS0 > 0.0:
-            subset_size = self._p + 1 + i
-            J = [e[0:subset_size] for e in permuted]
-            i += 1
-            T0, S0 = self.means_and_covariance(J)
-            detS0 = S0.matrix_determinant_via_lu()
+    @staticmethod
+    def random_permutations(ntrials, n):
+        """Draw a random permutation of n observations for each of ntrials
+        trials, as the rows of a matrix"""
 
-        H1 = self.concentration_step(h, data, T0, S0)
-        return H1
+        permutations = flex.size_t()
+        for i in range(ntrials):
+            permutations.extend(flex.random_permutation(n))
+        permutations.reshape(flex.grid(ntrials, n))
+        return permutations
 
     @staticmethod
-    def concentration_step(h, data, T, S):
-        """Practical application of Theorem 1 of R&vD"""
+    def best_trials(trials, ntrials):
+        """Select the ntrials trials with the lowest covariance determinants,
+        ordered by determinant"""
 
-        d2s = maha_dist_sq(data, T, S)
-        p = flex.sort_permutation(d2s)
-        H1 = [col.select(p)[0:h] for col in data]
-        return H1
+        order = flex.sort_permutation(trials.det())
+        return trials.select(order[0:ntrials])
 
     def small_dataset_estimate(self):
         """When a dataset is small, perform the initial trials directly on the
         whole dataset"""
 
-        trials = []
-        for i in range(self._n_trials):
-
-            H1 = self.form_initial_subset(h=self._h, data=self._data)
-            T1, S1 = self.means_and_covariance(H1)
-            detS1 = S1.matrix_determinant_via_lu()
-
-            # perform concentration steps
-            detScurr, Tcurr, Scurr = detS1, T1, S1
-            for j in range(self._k1):  # take maximum of k1 steps
-
-                Hnew = self.concentration_step(self._h, self._data, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
-                detSnew = Snew.matrix_determinant_via_lu()
-
-                # detS3 < detS2 < detS1 by Theorem 1. In practice (rounding errors?)
-                # this is not always the case here. Ensure that detScurr is no smaller than
-                # one billionth the value of detSnew less than detSnew
-                assert detScurr > (detSnew - detSnew / 1.0e9)
-                detScurr, Tcurr, Scurr = detSnew, Tnew, Snew
-
-            trials.append((detSnew, Tnew, Snew))
-
-        # choose 10 trials with the lowest detS3
-        trials.sort(key=lambda x: x[0])
-        best_trials = []
-        for i in range(10):
-            detCurr, Tcurr, Scurr = trials[i]
-            for j in range(self._k3):  # take maximum of k3 steps
-                Hnew = self.concentration_step(self._h, self._data, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
-                detNew = Snew.matrix_determinant_via_lu()
-                if detNew == detCurr:
-                    # print "trial {0}; iteration {1}; convergence".format(i,j)
-                    break
-                detCurr, Tcurr, Scurr = detNew, Tnew, Snew
-            best_trials.append((detNew, Tnew, Snew))
+        cstep = MCDConcentration(observation_matrix(self._data), self._h)
+        permutations = self.random_permutations(self._n_trials, self._n)
+        trials = cstep.initial_trials(
+            permutations, nsteps=self._k1, nthreads=self._nthreads
+        )
+
+        # choose 10 trials with the lowest detS3 and take a maximum of k3 steps
+        best_trials = cstep.iterate(
+            self.best_trials(trials, 10),
+            max_steps=self._k3,
+            stop_on_convergence=True,
+            nthreads=self._nthreads,
+        )
 
         # Find the minimum covariance determinant from that set of 10
-        best_trials.sort(key=lambda x: x[0])
-        _, Tbest, Sbest = best_trials[0]
-        return Tbest, Sbest
+        best = self.best_trials(best_trials, 1)
+        return best.location(0), best.covariance(0)
 
     def large_dataset_estimate(self):
         """When a dataset is large, construct disjoint subsets of the full data
@@ -360,56 +323,29 @@ def large_dataset_estimate(self):
 
         # work within the groups now
         n_trials = self._n_trials // ngroups
-        trials = []
+        trials = None
         h_frac = self._h / self._n
         for group in groups:
 
             h_sub = int(len(group[0]) * h_frac)
-            gp_trials = []
-            for i in range(n_trials):
-
-                H1 = self.form_initial_subset(h=h_sub, data=group)
-                T1, S1 = self.means_and_covariance(H1)
-                detS1 = S1.matrix_determinant_via_lu()
-
-                # perform concentration steps
-                detScurr, Tcurr, Scurr = detS1, T1, S1
-                for j in range(self._k1):  # take k1 steps
-
-                    Hnew = self.concentration_step(h_sub, group, Tcurr, Scurr)
-                    Tnew, Snew = self.means_and_covariance(Hnew)
-                    detSnew = Snew.matrix_determinant_via_lu()
-
-                    # detS3 < detS2 < detS1 by Theorem 1. In practice (rounding errors?)
-                    # this is not always the case here. Ensure that detScurr is no smaller than
-                    # one billionth the value of detSnew less than detSnew
-                    assert detScurr > (detSnew - detSnew / 1.0e9)
-                    detScurr, Tcurr, Scurr = detSnew, Tnew, Snew
-
-                gp_trials.append((detSnew, Tnew, Snew))
+            cstep = MCDConcentration(observation_matrix(group), h_sub)
+            permutations = self.random_permutations(n_trials, len(group[0]))
+            gp_trials = cstep.initial_trials(
+                permutations, nsteps=self._k1, nthreads=self._nthreads
+            )
 
             # choose 10 trials with the lowest determinant and put in the outer list
-            gp_trials.sort(key=lambda x: x[0])
-            trials.extend(gp_trials[0:10])
+            gp_trials = self.best_trials(gp_trials, 10)
+            if trials is None:
+                trials = gp_trials
+            else:
+                trials.extend(gp_trials)
 
         # now have 10 best trials from each group. Work with the merged (==sampled)
-        # set
-        mrgd_trials = []
+        # set, taking k2 steps
         h_mrgd = int(sample_size * h_frac)
-        for trial in trials:
-
-            detScurr, Tcurr, Scurr = trial
-            for j in range(self._k2):  # take k2 steps
-
-                Hnew = self.concentration_step(h_mrgd, sampled, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
-                detSnew = Snew.matrix_determinant_via_lu()
-                detScurr, Tcurr, Scurr = detSnew, Tnew, Snew
-
-            mrgd_trials.append((detSnew, Tnew, Snew))
-
-        # sort trials by the lowest detS3 and work with the whole dataset now
-        mrgd_trials.sort(key=lambda x: x[0])
+        cstep = MCDConcentration(observation_matrix(sampled), h_mrgd)
+        mrgd_trials = cstep.iterate(trials, max_steps=self._k2, nthreads=self._nthreads)
 
         # choose number of steps to iterate based on dataset size (ugly)
         size = self._n * self._p
@@ -439,24 +375,16 @@ def large_dataset_estimate(self):
         # choose number of trials to look at based on number of obs (ugly)
         n_reps = 1 if self._n > 5000 else 10
 
-        best_trials = []
-        for i in range(n_reps):
-            detCurr, Tcurr, Scurr = mrgd_trials[i]
-            for j in range(k4):  # take maximum of k4 steps
-                Hnew = self.concentration_step(self._h, self._data, Tcurr, Scurr)
-                Tnew, Snew = self.means_and_covariance(Hnew)
-                detNew = Snew.matrix_determinant_via_lu()
-                if detNew == detCurr:
-                    # print "trial {0}; iteration {1}; convergence".format(i,j)
-                    break
-                detCurr, Tcurr, Scurr = detNew, Tnew, Snew
-            # print "determinant", detNew
-            # print "location:", list(Tnew)
-            # print "covariance:"
-            # print Snew.as_scitbx_matrix()
-            best_trials.append((detNew, Tnew, Snew))
+        # sort trials by the lowest detS3 and work with the whole dataset now,
+        # taking a maximum of k4 steps
+        cstep = MCDConcentration(observation_matrix(self._data), self._h)
+        best_trials = cstep.iterate(
+            self.best_trials(mrgd_trials, n_reps),
+            max_steps=k4,
+            stop_on_convergence=True,
+            nthreads=self._nthreads,
+        )
 
         # Find the minimum covariance determinant from that set of 10
-        best_trials.sort(key=lambda x: x[0])
-        _, Tbest, Sbest = best_trials[0]
-        return Tbest, Sbest
+        best = self.best_trials(best_trials, 1)
+        return best.location(0), best.covariance(0)
@@ -97,6 +97,36 @@ namespace dials { namespace algorithms {
     return std::make_pair(D, (1.0 - cdf(ks_dist1(n), D)) * 2.0);
   }
 
+  /**
+   * Perform the kolmogorov smirnov test given the values of the CDF at the
+   * sample points, sorted into ascending order. This allows the CDF values
+   * for many samples to be looked up from a precomputed table.
+   * @param cdfv The sorted CDF values
+   * @param kstype The type of test to perform (less, greater, two_sided)
+   * @returns (D, p-value)
+   */
+  template <typename RealType>
+  std::pair<RealType, RealType> kolmogorov_smirnov_test_cdf(
+    const std::vector<RealType> &cdfv,
+    const KSType &kstype) {
+    std::pair<RealType, RealType> result(0, 0);
+    switch (kstype) {
+    case Less:
+      result = kolmogorov_smirnov_test_less(cdfv);
+      break;
+    case Greater:
+      result = kolmogorov_smirnov_test_greater(cdfv);
+      break;
+    case TwoSided:
+      result = kolmogorov_smirnov_test_two_sided(cdfv);
+      break;
+    default:
+      DIALS_ASSERT(false);
+      break;
+    };
+    return result;
+  }
+
   /**
    * Perform the kolmogorov smirnov test. Sorted the data into ascending order
    * the calculate the emiprical distribution function. Then compute the value
@@ -129,22 +159,7 @@ namespace dials { namespace algorithms {
     }
 
     // Do the ks test
-    std::pair<value_type, value_type> result(0, 0);
-    switch (kstype) {
-    case Less:
-      result = kolmogorov_smirnov_test_less(cdfv);
-      break;
-    case Greater:
-      result = kolmogorov_smirnov_test_greater(cdfv);
-      break;
-    case TwoSided:
-      result = kolmogorov_smirnov_test_two_sided(cdfv);
-      break;
-    default:
-      DIALS_ASSERT(false);
-      break;
-    };
-    return result;
+    return kolmogorov_smirnov_test_cdf(cdfv, kstype);
   }
 
 }}  // namespace dials::algorithms
@@ -2,7 +2,13 @@
 #ifndef DIALS_ALGORITHMS_STATISTICS_POISSON_TEST_H
 #define DIALS_ALGORITHMS_STATISTICS_POISSON_TEST_H
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
 #include <boost/math/distributions.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/algorithms/statistics/kolmogorov_smirnov_test.h>
 #include <dials/error.h>
 
 namespace dials { namespace algorithms {
@@ -13,6 +19,239 @@ namespace dials { namespace algorithms {
     return boost::math::quantile(d, 1 - 1.0 / nobs) + 1;
   }
 
+  /**
+   * A table of the CDF of a Poisson distribution at the counts 0, 1, 2, ...
+   * The table is extended as higher counts are looked up, summing the
+   * probabilities given by the recurrence p(k) = p(k - 1) * mean / k in log
+   * space so that large means do not underflow. All the counts of a sample
+   * then share one table instead of each evaluating the incomplete gamma
+   * function.
+   */
+  class PoissonCDFTable {
+  public:
+    /**
+     * @param mean The mean of the distribution
+     */
+    PoissonCDFTable(double mean)
+        : mean_(std::max(mean, 0.0)),
+          log_mean_(mean_ > 0 ? std::log(mean_) : 0),
+          log_p_(-mean_),
+          sum_(0) {}
+
+    /** @returns The mean of the distribution */
+    double mean() const {
+      return mean_;
+    }
+
+    /**
+     * @param x A count, which is rounded down
+     * @returns The value of the CDF at x
+     */
+    double cdf(double x) {
+      if (x < 0) {
+        return 0.0;
+      }
+      if (mean_ == 0) {
+        return 1.0;
+      }
+      std::size_t k = (std::size_t)std::floor(x);
+      while (table_.size() <= k && !complete()) {
+        extend();
+      }
+      return k < table_.size() ? table_[k] : 1.0;
+    }
+
+    /**
+     * @param p A probability
+     * @returns The smallest count at which the CDF is at least p
+     */
+    std::size_t quantile(double p) {
+      if (mean_ == 0) {
+        return 0;
+      }
+      std::size_t k = 0;
+      for (;; ++k) {
+        if (k == table_.size()) {
+          if (complete()) {
+            return k;
+          }
+          extend();
+        }
+        if (table_[k] >= p) {
+          return k;
+        }
+      }
+    }
+
+    /**
+     * @param nobs The number of observations
+     * @returns The expected maximum counts of nobs observations, as given by
+     *          poisson_expected_max_counts
+     */
+    double expected_max_counts(std::size_t nobs) {
+      DIALS_ASSERT(nobs > 0);
+      return quantile(1 - 1.0 / nobs) + 1;
+    }
+
+  private:
+    /**
+     * @returns True once the remaining terms are too small to change the sum
+     */
+    bool complete() const {
+      return sum_ >= 1.0 || (table_.size() > mean_ && log_p_ < -745.0);
+    }
+
+    void extend() {
+      std::size_t k = table_.size();
+      if (k > 0) {
+        log_p_ += log_mean_ - std::log((double)k);
+      }
+      sum_ = std::min(sum_ + std::exp(log_p_), 1.0);
+      table_.push_back(sum_);
+    }
+
+    double mean_;
+    double log_mean_;
+    double log_p_;
+    double sum_;
+    std::vector<double> table_;
+  };
+
+  namespace detail {
+
+    /**
+     * Check the offsets of a set of samples held one after the other in an
+     * array. The offsets hold the start of each sample and the end of the
+     * last, and every sample must be non-empty.
+     */
+    inline void check_sample_offsets(const af::const_ref<std::size_t> &offset,
+                                     std::size_t size) {
+      DIALS_ASSERT(offset.size() > 0);
+      DIALS_ASSERT(offset[0] == 0);
+      DIALS_ASSERT(offset[offset.size() - 1] == size);
+      for (std::size_t i = 0; i + 1 < offset.size(); ++i) {
+        DIALS_ASSERT(offset[i] < offset[i + 1]);
+      }
+    }
+
+    /**
+     * Test the maximum counts of a band of samples
+     */
+    struct PoissonMaxCountsBand {
+      af::const_ref<double> data;
+      af::const_ref<std::size_t> offset;
+      af::ref<bool> result;
+
+      PoissonMaxCountsBand(const af::const_ref<double> &data_,
+                           const af::const_ref<std::size_t> &offset_,
+                           af::ref<bool> result_)
+          : data(data_), offset(offset_), result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          const double *first = &data[offset[i]];
+          const double *last = &data[0] + offset[i + 1];
+          std::size_t n = last - first;
+          double sum = 0;
+          for (const double *x = first; x != last; ++x) {
+            sum += *x;
+          }
+          PoissonCDFTable table(sum / n);
+          result[i] = *std::max_element(first, last) < table.expected_max_counts(n);
+        }
+      }
+    };
+
+    /**
+     * Perform the kolmogorov smirnov test for a band of samples
+     */
+    struct KolmogorovSmirnovPoissonBand {
+      af::const_ref<double> data;
+      af::const_ref<std::size_t> offset;
+      KSType kstype;
+      af::ref<double> D;
+      af::ref<double> p;
+
+      KolmogorovSmirnovPoissonBand(const af::const_ref<double> &data_,
+                                   const af::const_ref<std::size_t> &offset_,
+                                   KSType kstype_,
+                                   af::ref<double> D_,
+                                   af::ref<double> p_)
+          : data(data_), offset(offset_), kstype(kstype_), D(D_), p(p_) {}
+
+      void operator()(int i0, int i1) const {
+        std::vector<double> x;
+        std::vector<double> cdfv;
+        for (int i = i0; i < i1; ++i) {
+          x.assign(&data[offset[i]], &data[0] + offset[i + 1]);
+          std::sort(x.begin(), x.end());
+          double sum = 0;
+          for (std::size_t j = 0; j < x.size(); ++j) {
+            sum += x[j];
+          }
+          PoissonCDFTable table(sum / x.size());
+          cdfv.resize(x.size());
+          for (std::size_t j = 0; j < x.size(); ++j) {
+            cdfv[j] = table.cdf(x[j]);
+          }
+          std::pair<double, double> r = kolmogorov_smirnov_test_cdf(cdfv, kstype);
+          D[i] = r.first;
+          p[i] = r.second;
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Check whether each of a set of samples of counts, such as the background
+   * pixels of many shoeboxes, is consistent with a Poisson distribution with
+   * the mean of the sample. A sample passes if its maximum is less than the
+   * expected maximum counts for the number of observations.
+   * @param data The counts of all the samples, one sample after another
+   * @param offset The start of each sample in data, and the end of the last
+   * @param nthreads The number of threads to use
+   * @returns True/False for each sample
+   */
+  inline af::shared<bool> is_poisson_distributed(
+    const af::const_ref<double> &data,
+    const af::const_ref<std::size_t> &offset,
+    std::size_t nthreads = 1) {
+    detail::check_sample_offsets(offset, data.size());
+    af::shared<bool> result(offset.size() - 1, false);
+    for_each_band(detail::PoissonMaxCountsBand(data, offset, result.ref()),
+                  (int)result.size(),
+                  nthreads);
+    return result;
+  }
+
+  /**
+   * Perform the kolmogorov smirnov test on each of a set of samples of
+   * counts, such as the background pixels of many shoeboxes, against a
+   * Poisson distribution with the mean of the sample. The CDF values of each
+   * sample are looked up from a single table and the samples are tested in
+   * bands across threads.
+   * @param data The counts of all the samples, one sample after another
+   * @param offset The start of each sample in data, and the end of the last
+   * @param kstype The type of test to perform (less, greater, two_sided)
+   * @param D The statistic for each sample
+   * @param p The p-value for each sample
+   * @param nthreads The number of threads to use
+   */
+  inline void kolmogorov_smirnov_test_poisson(const af::const_ref<double> &data,
+                                              const af::const_ref<std::size_t> &offset,
+                                              const KSType &kstype,
+                                              af::ref<double> D,
+                                              af::ref<double> p,
+                                              std::size_t nthreads = 1) {
+    detail::check_sample_offsets(offset, data.size());
+    DIALS_ASSERT(D.size() == offset.size() - 1);
+    DIALS_ASSERT(p.size() == D.size());
+    for_each_band(detail::KolmogorovSmirnovPoissonBand(data, offset, kstype, D, p),
+                  (int)D.size(),
+                  nthreads);
+  }
+
 }}  // namespace dials::algorithms
 
 #endif  // DIALS_ALGORITHMS_STATISTICS_POISSON_TEST_H
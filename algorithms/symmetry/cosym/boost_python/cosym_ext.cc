@@ -0,0 +1,70 @@
+/*
+ * cosym_ext.cc
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/algorithms/symmetry/cosym/target.h>
+
+namespace dials { namespace algorithms { namespace boost_python {
+
+  using namespace boost::python;
+
+  boost::python::tuple cosym_target_functional_and_gradients(
+    const CosymTarget &self,
+    const af::const_ref<double> &x) {
+    return boost::python::make_tuple(self.compute_functional(x),
+                                     self.compute_gradients(x));
+  }
+
+  BOOST_PYTHON_MODULE(dials_algorithms_symmetry_cosym_ext) {
+    class_<CosymCorrelations>("CosymCorrelations", no_init)
+      .def(init<const af::const_ref<std::size_t> &,
+                const af::const_ref<double> &,
+                const af::const_ref<cctbx::miller::index<> > &,
+                const af::const_ref<bool> &,
+                const af::const_ref<std::size_t> &,
+                std::size_t,
+                std::size_t,
+                std::size_t>((arg("offset"),
+                              arg("intensity"),
+                              arg("indices"),
+                              arg("use"),
+                              arg("relative_op"),
+                              arg("n_ops"),
+                              arg("min_pairs"),
+                              arg("nthreads") = 1)))
+      .def("row", &CosymCorrelations::row)
+      .def("col", &CosymCorrelations::col)
+      .def("cc", &CosymCorrelations::cc)
+      .def("n", &CosymCorrelations::n);
+
+    class_<CosymTarget>("CosymTarget", no_init)
+      .def(init<std::size_t,
+                const af::const_ref<std::size_t> &,
+                const af::const_ref<std::size_t> &,
+                const af::const_ref<double> &,
+                const af::const_ref<double> &,
+                std::size_t>((arg("size"),
+                              arg("row"),
+                              arg("col"),
+                              arg("rij"),
+                              arg("wij"),
+                              arg("nthreads") = 1)))
+      .def("size", &CosymTarget::size)
+      .def("num_elements", &CosymTarget::num_elements)
+      .def("weighted", &CosymTarget::weighted)
+      .def("rij_matrix", &CosymTarget::rij_matrix)
+      .def("wij_matrix", &CosymTarget::wij_matrix)
+      .def("compute_functional", &CosymTarget::compute_functional)
+      .def("compute_gradients", &CosymTarget::compute_gradients)
+      .def("compute_functional_and_gradients",
+           &cosym_target_functional_and_gradients)
+      .def("curvatures", &CosymTarget::curvatures);
+  }
+
+}}}  // namespace dials::algorithms::boost_python
@@ -0,0 +1,653 @@
+/*
+ * target.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ALGORITHMS_SYMMETRY_COSYM_TARGET_H
+#define DIALS_ALGORITHMS_SYMMETRY_COSYM_TARGET_H
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+#include <cctbx/miller.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace algorithms {
+
+  namespace detail {
+
+    /**
+     * An observed intensity, ordered by its miller index
+     */
+    struct CosymObservation {
+      cctbx::miller::index<> h;
+      double intensity;
+
+      CosymObservation() : intensity(0) {}
+
+      CosymObservation(const cctbx::miller::index<> &h_, double intensity_)
+          : h(h_), intensity(intensity_) {}
+
+      bool operator<(const CosymObservation &other) const {
+        return h < other.h;
+      }
+    };
+
+    /**
+     * The linear correlation coefficient between two sets of observations,
+     * with the number of observations it was computed from
+     */
+    struct CosymCorrelation {
+      double cc;
+      std::size_t n;
+      bool is_well_defined;
+
+      CosymCorrelation() : cc(0), n(0), is_well_defined(false) {}
+    };
+
+    /**
+     * Compute the linear correlation between the intensities of the matching
+     * miller indices of two sets of observations sorted by miller index, in
+     * the same way as flex.linear_correlation.
+     */
+    inline CosymCorrelation cosym_correlation(const std::vector<CosymObservation> &a,
+                                              const std::vector<CosymObservation> &b,
+                                              std::vector<double> &x,
+                                              std::vector<double> &y) {
+      x.clear();
+      y.clear();
+      std::vector<CosymObservation>::const_iterator ia = a.begin();
+      std::vector<CosymObservation>::const_iterator ib = b.begin();
+      while (ia != a.end() && ib != b.end()) {
+        if (ia->h < ib->h) {
+          ++ia;
+        } else if (ib->h < ia->h) {
+          ++ib;
+        } else {
+          x.push_back(ia->intensity);
+          y.push_back(ib->intensity);
+          ++ia;
+          ++ib;
+        }
+      }
+      CosymCorrelation result;
+      result.n = x.size();
+      if (result.n == 0) {
+        return result;
+      }
+      double mean_x = 0;
+      double mean_y = 0;
+      for (std::size_t i = 0; i < x.size(); ++i) {
+        mean_x += x[i];
+        mean_y += y[i];
+      }
+      mean_x /= x.size();
+      mean_y /= y.size();
+      double sxx = 0;
+      double syy = 0;
+      double sxy = 0;
+      for (std::size_t i = 0; i < x.size(); ++i) {
+        double dx = x[i] - mean_x;
+        double dy = y[i] - mean_y;
+        sxx += dx * dx;
+        syy += dy * dy;
+        sxy += dx * dy;
+      }
+      double den = std::sqrt(sxx * syy);
+      if (den > 1e-15) {
+        result.cc = sxy / den;
+        result.is_well_defined = true;
+      }
+      return result;
+    }
+
+  }  // namespace detail
+
+  /**
+   * Compute the correlation coefficients between the intensities of each
+   * pair of datasets, with each dataset reindexed by each symmetry operator,
+   * as used to build the rij matrix of the cosym target. Element (i, k) of
+   * the matrix is dataset i reindexed by operator k, with the row index
+   * i + n_datasets * k.
+   *
+   * The observations of each dataset under each operator are sorted by miller
+   * index once, so that the common reflections of any pair are found with a
+   * single merge. The datasets are processed in bands in parallel, and only
+   * the pairs with a well defined correlation coefficient from at least
+   * min_pairs common reflections are kept.
+   */
+  class CosymCorrelations {
+  public:
+    /**
+     * Compute the correlation coefficients
+     * @param offset The index of the first observation of each dataset, with
+     *               the number of observations as the last element
+     * @param intensity The intensities, ordered by dataset
+     * @param indices The miller indices mapped to the asu after reindexing by
+     *                each operator, with the indices for each operator in turn
+     * @param use The observations to use, for each operator in turn
+     * @param relative_op The index of the operator relating each pair of
+     *                    operators k and kk, at k * n_ops + kk. Pairs related
+     *                    by the same operator are only computed once per
+     *                    pair of datasets.
+     * @param n_ops The number of operators
+     * @param min_pairs The minimum number of common reflections
+     * @param nthreads The number of threads to use
+     */
+    CosymCorrelations(const af::const_ref<std::size_t> &offset,
+                      const af::const_ref<double> &intensity,
+                      const af::const_ref<cctbx::miller::index<> > &indices,
+                      const af::const_ref<bool> &use,
+                      const af::const_ref<std::size_t> &relative_op,
+                      std::size_t n_ops,
+                      std::size_t min_pairs,
+                      std::size_t nthreads = 1)
+        : relative_op_(relative_op.begin(), relative_op.end()),
+          n_datasets_(offset.size() - 1),
+          n_ops_(n_ops),
+          min_pairs_(min_pairs),
+          observations_((offset.size() - 1) * n_ops),
+          row_(offset.size() - 1),
+          col_(offset.size() - 1),
+          cc_(offset.size() - 1),
+          n_(offset.size() - 1) {
+      DIALS_ASSERT(offset.size() > 0);
+      DIALS_ASSERT(n_ops > 0);
+      DIALS_ASSERT(offset.back() == intensity.size());
+      DIALS_ASSERT(indices.size() == intensity.size() * n_ops);
+      DIALS_ASSERT(use.size() == indices.size());
+      DIALS_ASSERT(relative_op.size() == n_ops * n_ops);
+      for (std::size_t i = 0; i < n_datasets_; ++i) {
+        DIALS_ASSERT(offset[i] <= offset[i + 1]);
+      }
+      for_each_band(SortBand(*this, offset, intensity, indices, use),
+                    (int)n_datasets_,
+                    nthreads);
+      for_each_band(CorrelateBand(*this), (int)n_datasets_, nthreads);
+    }
+
+    /** @returns The row of each element of the rij matrix */
+    af::shared<std::size_t> row() const {
+      return gather(row_);
+    }
+
+    /** @returns The column of each element of the rij matrix */
+    af::shared<std::size_t> col() const {
+      return gather(col_);
+    }
+
+    /** @returns The correlation coefficient of each element */
+    af::shared<double> cc() const {
+      return gather(cc_);
+    }
+
+    /** @returns The number of common reflections for each element */
+    af::shared<std::size_t> n() const {
+      return gather(n_);
+    }
+
+  private:
+    /**
+     * Sort the observations of a band of datasets under each operator
+     */
+    struct SortBand {
+      CosymCorrelations &self;
+      const af::const_ref<std::size_t> &offset;
+      const af::const_ref<double> &intensity;
+      const af::const_ref<cctbx::miller::index<> > &indices;
+      const af::const_ref<bool> &use;
+
+      SortBand(CosymCorrelations &self_,
+               const af::const_ref<std::size_t> &offset_,
+               const af::const_ref<double> &intensity_,
+               const af::const_ref<cctbx::miller::index<> > &indices_,
+               const af::const_ref<bool> &use_)
+          : self(self_),
+            offset(offset_),
+            intensity(intensity_),
+            indices(indices_),
+            use(use_) {}
+
+      void operator()(int i0, int i1) const {
+        std::size_t n_obs = intensity.size();
+        for (int i = i0; i < i1; ++i) {
+          for (std::size_t k = 0; k < self.n_ops_; ++k) {
+            std::vector<detail::CosymObservation> &obs = self.observations(i, k);
+            for (std::size_t r = offset[i]; r < offset[i + 1]; ++r) {
+              if (use[k * n_obs + r]) {
+                obs.push_back(
+                  detail::CosymObservation(indices[k * n_obs + r], intensity[r]));
+              }
+            }
+            std::sort(obs.begin(), obs.end());
+          }
+        }
+      }
+    };
+
+    /**
+     * Compute the rows of the rij matrix for a band of datasets
+     */
+    struct CorrelateBand {
+      CosymCorrelations &self;
+
+      CorrelateBand(CosymCorrelations &self_) : self(self_) {}
+
+      void operator()(int i0, int i1) const {
+        typedef std::map<std::pair<std::size_t, std::size_t>,
+                         detail::CosymCorrelation>
+          cache_type;
+        std::vector<double> x, y;
+        std::size_t n_datasets = self.n_datasets_;
+        std::size_t n_ops = self.n_ops_;
+        for (int i = i0; i < i1; ++i) {
+          cache_type cache;
+          for (std::size_t j = 0; j < n_datasets; ++j) {
+            for (std::size_t k = 0; k < n_ops; ++k) {
+              for (std::size_t kk = 0; kk < n_ops; ++kk) {
+                if (i == (int)j && k == kk) {
+                  // don't include correlation of dataset with itself
+                  continue;
+                }
+                std::pair<std::size_t, std::size_t> key(
+                  j, self.relative_op_[k * n_ops + kk]);
+                detail::CosymCorrelation corr;
+                cache_type::const_iterator cached = cache.find(key);
+                if (cached != cache.end()) {
+                  corr = cached->second;
+                } else {
+                  corr = detail::cosym_correlation(
+                    self.observations(i, k), self.observations(j, kk), x, y);
+                  if (corr.is_well_defined) {
+                    cache[key] = corr;
+                  }
+                }
+                if (!corr.is_well_defined || corr.n < self.min_pairs_) {
+                  continue;
+                }
+                self.row_[i].push_back(i + n_datasets * k);
+                self.col_[i].push_back(j + n_datasets * kk);
+                self.cc_[i].push_back(corr.cc);
+                self.n_[i].push_back(corr.n);
+              }
+            }
+          }
+        }
+      }
+    };
+
+    std::vector<detail::CosymObservation> &observations(std::size_t i,
+                                                        std::size_t k) {
+      return observations_[i * n_ops_ + k];
+    }
+
+    template <typename T>
+    static af::shared<T> gather(const std::vector<std::vector<T> > &rows) {
+      af::shared<T> result;
+      for (std::size_t i = 0; i < rows.size(); ++i) {
+        result.insert(result.end(), rows[i].begin(), rows[i].end());
+      }
+      return result;
+    }
+
+    af::shared<std::size_t> relative_op_;
+    std::size_t n_datasets_;
+    std::size_t n_ops_;
+    std::size_t min_pairs_;
+    std::vector<std::vector<detail::CosymObservation> > observations_;
+    std::vector<std::vector<std::size_t> > row_;
+    std::vector<std::vector<std::size_t> > col_;
+    std::vector<std::vector<double> > cc_;
+    std::vector<std::vector<std::size_t> > n_;
+  };
+
+  /**
+   * The cosym target function, computed from a sparse rij matrix and,
+   * optionally, a sparse matrix of weights. With coordinates x, the target is
+   *
+   *   f = 0.5 * sum_ij w_ij * (r_ij - x_i . x_j)^2
+   *
+   * Without weights, every element contributes with w_ij = 1, including those
+   * where r_ij is zero. Their contribution is found from the dim x dim matrix
+   * of the coordinate products rather than by visiting every element, so the
+   * cost is linear in the number of stored elements.
+   *
+   * The coordinates are stored with all of the first dimension first,
+   * followed by the second dimension and so on, and the elements of the
+   * gradients and curvatures are in the same order.
+   */
+  class CosymTarget {
+  public:
+    /**
+     * Build the sparse matrices
+     * @param size The number of rows and columns of the rij matrix
+     * @param row The row of each element
+     * @param col The column of each element
+     * @param rij The value of each element
+     * @param wij The weight of each element, added at (row, col) and
+     *            (col, row), or an empty array for no weights
+     * @param nthreads The number of threads to use
+     */
+    CosymTarget(std::size_t size,
+                const af::const_ref<std::size_t> &row,
+                const af::const_ref<std::size_t> &col,
+                const af::const_ref<double> &rij,
+                const af::const_ref<double> &wij,
+                std::size_t nthreads = 1)
+        : size_(size), weighted_(wij.size() > 0), nthreads_(nthreads) {
+      DIALS_ASSERT(nthreads > 0);
+      DIALS_ASSERT(row.size() == rij.size());
+      DIALS_ASSERT(col.size() == rij.size());
+      DIALS_ASSERT(!weighted_ || wij.size() == rij.size());
+
+      // Collect the elements, then sort and sum any duplicates
+      std::vector<Element> elements;
+      elements.reserve(weighted_ ? 2 * rij.size() : rij.size());
+      for (std::size_t i = 0; i < rij.size(); ++i) {
+        DIALS_ASSERT(row[i] < size && col[i] < size);
+        double w = weighted_ ? wij[i] : 1.0;
+        elements.push_back(Element(row[i], col[i], rij[i], w));
+        if (weighted_) {
+          elements.push_back(Element(col[i], row[i], 0.0, w));
+        }
+      }
+      std::sort(elements.begin(), elements.end());
+      indptr_.resize(size + 1, 0);
+      for (std::size_t i = 0; i < elements.size();) {
+        Element e = elements[i];
+        for (++i; i < elements.size() && elements[i].row == e.row
+                  && elements[i].col == e.col;
+             ++i) {
+          e.rij += elements[i].rij;
+          e.wij += elements[i].wij;
+        }
+        indptr_[e.row + 1]++;
+        col_.push_back(e.col);
+        rij_.push_back(e.rij);
+        wij_.push_back(e.wij);
+      }
+      for (std::size_t i = 0; i < size; ++i) {
+        indptr_[i + 1] += indptr_[i];
+      }
+    }
+
+    /** @returns The number of rows and columns of the rij matrix */
+    std::size_t size() const {
+      return size_;
+    }
+
+    /** @returns The number of stored elements */
+    std::size_t num_elements() const {
+      return col_.size();
+    }
+
+    /** @returns Are weights used */
+    bool weighted() const {
+      return weighted_;
+    }
+
+    /** @returns The rij matrix as a dense matrix */
+    af::versa<double, af::c_grid<2> > rij_matrix() const {
+      return dense(rij_);
+    }
+
+    /** @returns The weights as a dense matrix */
+    af::versa<double, af::c_grid<2> > wij_matrix() const {
+      DIALS_ASSERT(weighted_);
+      return dense(wij_);
+    }
+
+    /**
+     * Compute the target function
+     * @param x The coordinates
+     * @returns The value of the target function
+     */
+    double compute_functional(const af::const_ref<double> &x) const {
+      std::size_t dim = dimensions(x);
+      std::vector<double> row_sums(size_, 0);
+      for_each_band(
+        FunctionalBand(*this, x, dim, row_sums), (int)size_, nthreads_);
+      double f = 0;
+      for (std::size_t i = 0; i < size_; ++i) {
+        f += row_sums[i];
+      }
+      if (!weighted_) {
+        std::vector<double> xtx = coordinate_products(x, dim);
+        for (std::size_t i = 0; i < xtx.size(); ++i) {
+          f += xtx[i] * xtx[i];
+        }
+      }
+      return 0.5 * f;
+    }
+
+    /**
+     * Compute the gradients of the target function
+     * @param x The coordinates
+     * @returns The gradients with respect to the coordinates
+     */
+    af::shared<double> compute_gradients(const af::const_ref<double> &x) const {
+      std::size_t dim = dimensions(x);
+      std::vector<double> xtx;
+      if (!weighted_) {
+        xtx = coordinate_products(x, dim);
+      }
+      af::shared<double> grad(x.size(), 0);
+      for_each_band(
+        GradientBand(*this, x, dim, xtx, grad.ref()), (int)size_, nthreads_);
+      return grad;
+    }
+
+    /**
+     * Compute the curvatures of the target function
+     * @param x The coordinates
+     * @returns The curvatures with respect to the coordinates
+     */
+    af::shared<double> curvatures(const af::const_ref<double> &x) const {
+      std::size_t dim = dimensions(x);
+      af::shared<double> curvs(x.size(), 0);
+      if (!weighted_) {
+        for (std::size_t a = 0; a < dim; ++a) {
+          double sum = 0;
+          for (std::size_t j = 0; j < size_; ++j) {
+            sum += x[a * size_ + j] * x[a * size_ + j];
+          }
+          std::fill(
+            curvs.begin() + a * size_, curvs.begin() + (a + 1) * size_, 2 * sum);
+        }
+        return curvs;
+      }
+      for_each_band(CurvatureBand(*this, x, dim, curvs.ref()), (int)size_, nthreads_);
+      return curvs;
+    }
+
+  private:
+    struct Element {
+      std::size_t row;
+      std::size_t col;
+      double rij;
+      double wij;
+
+      Element(std::size_t row_, std::size_t col_, double rij_, double wij_)
+          : row(row_), col(col_), rij(rij_), wij(wij_) {}
+
+      bool operator<(const Element &other) const {
+        return row < other.row || (row == other.row && col < other.col);
+      }
+    };
+
+    /**
+     * Sum the squared residuals of a band of rows. Without weights, the
+     * squared coordinate products of the stored elements are subtracted, as
+     * they are added back for every element from the coordinate products.
+     */
+    struct FunctionalBand {
+      const CosymTarget &self;
+      const af::const_ref<double> &x;
+      std::size_t dim;
+      std::vector<double> &row_sums;
+
+      FunctionalBand(const CosymTarget &self_,
+                     const af::const_ref<double> &x_,
+                     std::size_t dim_,
+                     std::vector<double> &row_sums_)
+          : self(self_), x(x_), dim(dim_), row_sums(row_sums_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          double sum = 0;
+          for (std::size_t e = self.indptr_[i]; e < self.indptr_[i + 1]; ++e) {
+            double d = self.dot(x, dim, i, self.col_[e]);
+            double r = self.rij_[e] - d;
+            if (self.weighted_) {
+              sum += self.wij_[e] * r * r;
+            } else {
+              sum += r * r - d * d;
+            }
+          }
+          row_sums[i] = sum;
+        }
+      }
+    };
+
+    /**
+     * Compute the gradients for a band of rows
+     */
+    struct GradientBand {
+      const CosymTarget &self;
+      const af::const_ref<double> &x;
+      std::size_t dim;
+      const std::vector<double> &xtx;
+      af::ref<double> grad;
+
+      GradientBand(const CosymTarget &self_,
+                   const af::const_ref<double> &x_,
+                   std::size_t dim_,
+                   const std::vector<double> &xtx_,
+                   af::ref<double> grad_)
+          : self(self_), x(x_), dim(dim_), xtx(xtx_), grad(grad_) {}
+
+      void operator()(int i0, int i1) const {
+        std::size_t n = self.size_;
+        for (int i = i0; i < i1; ++i) {
+          for (std::size_t e = self.indptr_[i]; e < self.indptr_[i + 1]; ++e) {
+            std::size_t j = self.col_[e];
+            double c = self.wij_[e] * self.rij_[e];
+            if (self.weighted_) {
+              c -= self.wij_[e] * self.dot(x, dim, i, j);
+            }
+            for (std::size_t a = 0; a < dim; ++a) {
+              grad[a * n + i] += c * x[a * n + j];
+            }
+          }
+          if (!self.weighted_) {
+            for (std::size_t a = 0; a < dim; ++a) {
+              double sum = 0;
+              for (std::size_t b = 0; b < dim; ++b) {
+                sum += x[b * n + i] * xtx[b * dim + a];
+              }
+              grad[a * n + i] -= sum;
+            }
+          }
+          for (std::size_t a = 0; a < dim; ++a) {
+            grad[a * n + i] *= -2;
+          }
+        }
+      }
+    };
+
+    /**
+     * Compute the curvatures for a band of rows with weights
+     */
+    struct CurvatureBand {
+      const CosymTarget &self;
+      const af::const_ref<double> &x;
+      std::size_t dim;
+      af::ref<double> curvs;
+
+      CurvatureBand(const CosymTarget &self_,
+                    const af::const_ref<double> &x_,
+                    std::size_t dim_,
+                    af::ref<double> curvs_)
+          : self(self_), x(x_), dim(dim_), curvs(curvs_) {}
+
+      void operator()(int i0, int i1) const {
+        std::size_t n = self.size_;
+        for (int i = i0; i < i1; ++i) {
+          for (std::size_t e = self.indptr_[i]; e < self.indptr_[i + 1]; ++e) {
+            std::size_t j = self.col_[e];
+            for (std::size_t a = 0; a < dim; ++a) {
+              curvs[a * n + i] += self.wij_[e] * x[a * n + j] * x[a * n + j];
+            }
+          }
+          for (std::size_t a = 0; a < dim; ++a) {
+            curvs[a * n + i] *= 2;
+          }
+        }
+      }
+    };
+
+    std::size_t dimensions(const af::const_ref<double> &x) const {
+      DIALS_ASSERT(size_ > 0);
+      DIALS_ASSERT(x.size() % size_ == 0);
+      return x.size() / size_;
+    }
+
+    double dot(const af::const_ref<double> &x,
+               std::size_t dim,
+               std::size_t i,
+               std::size_t j) const {
+      double d = 0;
+      for (std::size_t a = 0; a < dim; ++a) {
+        d += x[a * size_ + i] * x[a * size_ + j];
+      }
+      return d;
+    }
+
+    /**
+     * Compute the dim x dim matrix of the sums of the coordinate products
+     * over all the rows
+     */
+    std::vector<double> coordinate_products(const af::const_ref<double> &x,
+                                            std::size_t dim) const {
+      std::vector<double> xtx(dim * dim, 0);
+      for (std::size_t a = 0; a < dim; ++a) {
+        for (std::size_t b = 0; b < dim; ++b) {
+          double sum = 0;
+          for (std::size_t j = 0; j < size_; ++j) {
+            sum += x[a * size_ + j] * x[b * size_ + j];
+          }
+          xtx[a * dim + b] = sum;
+        }
+      }
+      return xtx;
+    }
+
+    af::versa<double, af::c_grid<2> > dense(const std::vector<double> &values) const {
+      af::versa<double, af::c_grid<2> > result(af::c_grid<2>(size_, size_), 0);
+      for (std::size_t i = 0; i < size_; ++i) {
+        for (std::size_t e = indptr_[i]; e < indptr_[i + 1]; ++e) {
+          result(i, col_[e]) = values[e];
+        }
+      }
+      return result;
+    }
+
+    std::size_t size_;
+    bool weighted_;
+    std::size_t nthreads_;
+    std::vector<std::size_t> indptr_;
+    std::vector<std::size_t> col_;
+    std::vector<double> rij_;
+    std::vector<double> wij_;
+  };
+
+}}  // namespace dials::algorithms
+
+#endif  // DIALS_ALGORITHMS_SYMMETRY_COSYM_TARGET_H
@@ -3,15 +3,13 @@
 
 import copy
 import logging
-import math
 
 from orderedset import OrderedSet
-from scipy import sparse
 
 import cctbx.sgtbx.cosets
 from cctbx import miller, sgtbx
 from cctbx.array_family import flex
-from libtbx import easy_mp
+from dials_algorithms_symmetry_cosym_ext import CosymCorrelations, CosymTarget
 
 logger = logging.getLogger(__name__)
 
@@ -55,7 +53,8 @@ def __init__(
             in the analysis. If not set, then the number of dimensions used is
             equal to the greater of 2 or the number of symmetry operations in the
             lattice group.
-          nproc (int): number of processors to use for computing the rij matrix.
+          nproc (int): number of threads to use for computing the rij matrix
+            and the target function.
         """
         if weights is not None:
             assert weights in ("count", "standard_error")
@@ -154,155 +153,82 @@ def _lattice_lower_upper_index(self, lattice_id):
             assert lattice_id == len(self._lattices) - 1
         return lower_index, upper_index
 
-    def _compute_rij_wij(self, use_cache=True):
-        """Compute the rij_wij matrix."""
+    @property
+    def rij_matrix(self):
+        """The rij matrix as a dense matrix."""
+        return self._target.rij_matrix()
+
+    @property
+    def wij_matrix(self):
+        """The weights as a dense matrix, or None if no weights are used."""
+        if self._weights is None:
+            return None
+        return self._target.wij_matrix()
+
+    def _compute_rij_wij(self):
+        """Compute the sparse rij and wij matrices.
+
+        The correlation coefficients between each pair of datasets under each
+        pair of symmetry operators are computed in parallel, and only the
+        well-defined elements from at least min_pairs common reflections are
+        stored.
+        """
         n_lattices = self._lattices.size()
         n_sym_ops = len(self._sym_ops)
 
         NN = n_lattices * n_sym_ops
 
-        self.rij_matrix = flex.double(flex.grid(NN, NN), 0.0)
-        if self._weights is None:
-            self.wij_matrix = None
-        else:
-            self.wij_matrix = flex.double(flex.grid(NN, NN), 0.0)
-
-        indices = {}
+        # The asu indices under each operator, with the reflections to use
+        # for each, i.e. those not systematically enhanced in the Patterson group
+        indices = flex.miller_index()
+        use = flex.bool()
         space_group_type = self._data.space_group().type()
-        for cb_op in self._sym_ops:
-            cb_op = sgtbx.change_of_basis_op(cb_op)
+        cb_ops = [sgtbx.change_of_basis_op(cb_op) for cb_op in self._sym_ops]
+        for cb_op in cb_ops:
             indices_reindexed = cb_op.apply(self._data.indices())
             miller.map_to_asu(space_group_type, False, indices_reindexed)
-            indices[cb_op.as_xyz()] = indices_reindexed
-
-        def _compute_rij_matrix_one_row_block(i):
-            rij_cache = {}
-
-            n_sym_ops = len(self._sym_ops)
-            NN = n_lattices * n_sym_ops
-
-            rij_row = []
-            rij_col = []
-            rij_data = []
-            if self._weights is not None:
-                wij_row = []
-                wij_col = []
-                wij_data = []
-            else:
-                wij = None
-
-            i_lower, i_upper = self._lattice_lower_upper_index(i)
-            intensities_i = self._data.data()[i_lower:i_upper]
-
-            for j in range(n_lattices):
-
-                j_lower, j_upper = self._lattice_lower_upper_index(j)
-                intensities_j = self._data.data()[j_lower:j_upper]
-
-                for k, cb_op_k in enumerate(self._sym_ops):
-                    cb_op_k = sgtbx.change_of_basis_op(cb_op_k)
-
-                    indices_i = indices[cb_op_k.as_xyz()][i_lower:i_upper]
-
-                    for kk, cb_op_kk in enumerate(self._sym_ops):
-                        if i == j and k == kk:
-                            # don't include correlation of dataset with itself
-                            continue
-                        cb_op_kk = sgtbx.change_of_basis_op(cb_op_kk)
-
-                        ik = i + (n_lattices * k)
-                        jk = j + (n_lattices * kk)
-
-                        key = (i, j, str(cb_op_k.inverse() * cb_op_kk))
-                        if use_cache and key in rij_cache:
-                            cc, n = rij_cache[key]
-                        else:
-                            indices_j = indices[cb_op_kk.as_xyz()][j_lower:j_upper]
-
-                            matches = miller.match_indices(indices_i, indices_j)
-                            pairs = matches.pairs()
-                            isel_i = pairs.column(0)
-                            isel_j = pairs.column(1)
-                            isel_i = isel_i.select(
-                                self._patterson_group.epsilon(indices_i.select(isel_i))
-                                == 1
-                            )
-                            isel_j = isel_j.select(
-                                self._patterson_group.epsilon(indices_j.select(isel_j))
-                                == 1
-                            )
-                            corr = flex.linear_correlation(
-                                intensities_i.select(isel_i),
-                                intensities_j.select(isel_j),
-                            )
-
-                            if corr.is_well_defined():
-                                cc = corr.coefficient()
-                                n = corr.n()
-                                rij_cache[key] = (cc, n)
-                            else:
-                                cc = None
-                                n = None
-
-                        if (
-                            n is None
-                            or cc is None
-                            or (self._min_pairs is not None and n < self._min_pairs)
-                        ):
-                            continue
-
-                        if self._weights == "count":
-                            wij_row.extend([ik, jk])
-                            wij_col.extend([jk, ik])
-                            wij_data.extend([n, n])
-                        elif self._weights == "standard_error":
-                            assert n > 2
-                            # http://www.sjsu.edu/faculty/gerstman/StatPrimer/correlation.pdf
-                            se = math.sqrt((1 - cc ** 2) / (n - 2))
-                            wij = 1 / se
-                            wij_row.extend([ik, jk])
-                            wij_col.extend([jk, ik])
-                            wij_data.extend([wij, wij])
-
-                        rij_row.append(ik)
-                        rij_col.append(jk)
-                        rij_data.append(cc)
-
-            rij = sparse.coo_matrix((rij_data, (rij_row, rij_col)), shape=(NN, NN))
-            if self._weights is not None:
-                wij = sparse.coo_matrix((wij_data, (wij_row, wij_col)), shape=(NN, NN))
-
-            return rij, wij
-
-        args = [(i,) for i in range(n_lattices)]
-        results = easy_mp.parallel_map(
-            _compute_rij_matrix_one_row_block,
-            args,
-            processes=self._nproc,
-            iterable_type=easy_mp.posiargs,
-            method="multiprocessing",
+            indices.extend(indices_reindexed)
+            use.extend(self._patterson_group.epsilon(indices_reindexed) == 1)
+
+        # Pairs of operators related by the same operator give the same
+        # correlation between a pair of datasets
+        relative_ops = {}
+        relative_op = flex.size_t()
+        for cb_op_k in cb_ops:
+            for cb_op_kk in cb_ops:
+                key = str(cb_op_k.inverse() * cb_op_kk)
+                relative_op.append(relative_ops.setdefault(key, len(relative_ops)))
+
+        offset = flex.size_t(list(self._lattices) + [self._data.size()])
+        correlations = CosymCorrelations(
+            offset,
+            self._data.data(),
+            indices,
+            use,
+            relative_op,
+            n_sym_ops,
+            self._min_pairs if self._min_pairs is not None else 0,
+            self._nproc,
         )
+        cc = correlations.cc()
+        n = correlations.n().as_double()
+
+        if self._weights == "count":
+            wij = n
+        elif self._weights == "standard_error":
+            assert n.all_gt(2)
+            # http://www.sjsu.edu/faculty/gerstman/StatPrimer/correlation.pdf
+            se = flex.sqrt((1 - flex.pow2(cc)) / (n - 2))
+            wij = 1 / se
+        else:
+            wij = flex.double()
 
-        rij_matrix = None
-        wij_matrix = None
-        for i, (rij, wij) in enumerate(results):
-            if rij_matrix is None:
-                rij_matrix = rij
-            else:
-                rij_matrix += rij
-            if wij is not None:
-                if wij_matrix is None:
-                    wij_matrix = wij
-                else:
-                    wij_matrix += wij
-
-        self.rij_matrix = flex.double(rij_matrix.todense())
-        if wij_matrix is not None:
-            import numpy as np
-
-            self.wij_matrix = flex.double(wij_matrix.todense().astype(np.float64))
-
-        return self.rij_matrix, self.wij_matrix
+        self._target = CosymTarget(
+            NN, correlations.row(), correlations.col(), cc, wij, self._nproc
+        )
+        logger.debug(
+            "Stored %i of %i rij matrix elements", self._target.num_elements(), NN * NN
+        )
 
     def compute_functional(self, x):
         """Compute the target function at coordinates `x`.
@@ -317,17 +243,7 @@ def compute_functional(self, x):
           f (float): The value of the target function at coordinates `x`.
         """
         assert (x.size() // self.dim) == (self._lattices.size() * len(self._sym_ops))
-        inner = self.rij_matrix.deep_copy()
-        NN = x.size() // self.dim
-        for i in range(self.dim):
-            coord = x[i * NN : (i + 1) * NN]
-            outer_prod = coord.matrix_outer_product(coord)
-            inner -= outer_prod
-        elements = inner * inner
-        if self.wij_matrix is not None:
-            elements = self.wij_matrix * elements
-        f = 0.5 * flex.sum(elements)
-        return f
+        return self._target.compute_functional(x)
 
     def compute_gradients_fd(self, x, eps=1e-6):
         """Compute the gradients at coordinates `x` using finite differences.
@@ -368,36 +284,7 @@ def compute_functional_and_gradients(self, x):
           f: The value of the target function at coordinates `x`.
           grad: The gradients of the target function with respect to the parameters.
         """
-        f = self.compute_functional(x)
-        grad = flex.double()
-        if self.wij_matrix is not None:
-            wrij_matrix = self.wij_matrix * self.rij_matrix
-        else:
-            wrij_matrix = self.rij_matrix
-
-        coords = []
-        NN = x.size() // self.dim
-        for i in range(self.dim):
-            coords.append(x[i * NN : (i + 1) * NN])
-
-        # term 1
-        for i in range(self.dim):
-            grad.extend(wrij_matrix.matrix_multiply(coords[i]))
-
-        for i in range(self.dim):
-            tmp_array = flex.double()
-            tmp = coords[i].matrix_outer_product(coords[i])
-            if self.wij_matrix is not None:
-                tmp = self.wij_matrix * tmp
-            for j in range(self.dim):
-                tmp_array.extend(tmp.matrix_multiply(coords[j]))
-            grad -= tmp_array
-        grad *= -2
-
-        # grad_fd = self.compute_gradients_fd(x)
-        # assert grad.all_approx_equal_relatively(grad_fd, relative_error=1e-4)
-
-        return f, grad
+        return self._target.compute_functional_and_gradients(x)
 
     def curvatures(self, x):
         """Compute the curvature of the target function.
@@ -412,21 +299,7 @@ def curvatures(self, x):
           curvs (scitbx.array_family.flex.double):
           The curvature of the target function with respect to the parameters.
         """
-        coords = []
-        NN = x.size() // self.dim
-        for i in range(self.dim):
-            coords.append(x[i * NN : (i + 1) * NN])
-
-        curvs = flex.double()
-        if self.wij_matrix is not None:
-            wij = self.wij_matrix
-        else:
-            wij = flex.double(self.rij_matrix.accessor(), 1)
-        for i in range(self.dim):
-            curvs.extend(wij.matrix_multiply(coords[i] * coords[i]))
-        curvs *= 2
-
-        return curvs
+        return self._target.curvatures(x)
 
     def curvatures_fd(self, x, eps=1e-6):
         """Compute the curvatures at coordinates `x` using finite differences.
@@ -9,6 +9,19 @@
 from dials.algorithms.symmetry.cosym._generate_test_data import generate_test_data
 
 
+def dense_functional(t, x):
+    """The target function evaluated from the dense rij and wij matrices."""
+    inner = t.rij_matrix.deep_copy()
+    NN = x.size() // t.dim
+    for i in range(t.dim):
+        coord = x[i * NN : (i + 1) * NN]
+        inner -= coord.matrix_outer_product(coord)
+    elements = inner * inner
+    if t.wij_matrix is not None:
+        elements = t.wij_matrix * elements
+    return 0.5 * flex.sum(elements)
+
+
 @pytest.mark.parametrize("space_group", ["P2", "P3", "P6", "R3:h", "I23"])
 def test_cosym_target(space_group):
     datasets, expected_reindexing_ops = generate_test_data(
@@ -30,6 +43,10 @@ def test_cosym_target(space_group):
         assert t.rij_matrix.all() == (n * m, n * m)
         x = flex.random_double(n * m * t.dim)
         f0, g = t.compute_functional_and_gradients(x)
+        assert f0 == pytest.approx(dense_functional(t, x))
+        t_threaded = target.Target(intensities, dataset_ids, weights=weights, nproc=2)
+        assert list(t_threaded.rij_matrix) == list(t.rij_matrix)
+        assert t_threaded.compute_functional(x) == pytest.approx(f0)
         g_fd = t.compute_gradients_fd(x)
         for n, value in enumerate(zip(g, g_fd)):
             assert value[0] == pytest.approx(value[1], rel=2e-3), n
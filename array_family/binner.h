@@ -11,14 +11,156 @@
 #ifndef DIALS_ARRAY_FAMILY_BINNER_H
 #define DIALS_ARRAY_FAMILY_BINNER_H
 
+#include <algorithm>
 #include <map>
+#include <vector>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace af {
 
   /**
-   * A class to compute the count, sum and mean of values in bins
+   * The statistics of the values in each bin, computed in one pass
+   */
+  struct BinStatistics {
+    af::shared<std::size_t> count;
+    af::shared<double> sum;
+    af::shared<double> mean;
+    af::shared<double> variance;
+    af::shared<double> min;
+    af::shared<double> max;
+    af::shared<double> sum_weights;
+    af::shared<double> weighted_mean;
+
+    BinStatistics(std::size_t nbins)
+        : count(nbins, 0),
+          sum(nbins, 0),
+          mean(nbins, 0),
+          variance(nbins, 0),
+          min(nbins, 0),
+          max(nbins, 0),
+          sum_weights(nbins, 0),
+          weighted_mean(nbins, 0) {}
+  };
+
+  namespace detail {
+
+    /**
+     * The running statistics of the values in a bin. The mean and the sum
+     * of squared deviations are updated as in Welford's method, and merged
+     * as in the pairwise method of Chan et al.
+     */
+    struct BinAccumulator {
+      std::size_t n;
+      double sum;
+      double mean;
+      double m2;
+      double min;
+      double max;
+      double sum_w;
+      double sum_wy;
+
+      BinAccumulator()
+          : n(0), sum(0), mean(0), m2(0), min(0), max(0), sum_w(0), sum_wy(0) {}
+
+      void add(double y, double w) {
+        n++;
+        sum += y;
+        double delta = y - mean;
+        mean += delta / n;
+        m2 += delta * (y - mean);
+        min = (n == 1 || y < min) ? y : min;
+        max = (n == 1 || y > max) ? y : max;
+        sum_w += w;
+        sum_wy += w * y;
+      }
+
+      void merge(const BinAccumulator &other) {
+        if (other.n == 0) {
+          return;
+        }
+        if (n == 0) {
+          *this = other;
+          return;
+        }
+        std::size_t total = n + other.n;
+        double delta = other.mean - mean;
+        mean += delta * other.n / total;
+        m2 += other.m2 + delta * delta * ((double)n * other.n / total);
+        n = total;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        sum_w += other.sum_w;
+        sum_wy += other.sum_wy;
+      }
+    };
+
+    /**
+     * Sum the values of bands of items into partial bins for each band
+     */
+    template <typename T, typename R>
+    struct BinSumBand {
+      af::const_ref<std::size_t> index;
+      af::const_ref<T> y;
+      std::size_t band;
+      std::vector<std::vector<R> > &partial;
+
+      BinSumBand(const af::const_ref<std::size_t> &index_,
+                 const af::const_ref<T> &y_,
+                 std::size_t band_,
+                 std::vector<std::vector<R> > &partial_)
+          : index(index_), y(y_), band(band_), partial(partial_) {}
+
+      void operator()(int b0, int b1) const {
+        for (int k = b0; k < b1; ++k) {
+          std::vector<R> &result = partial[k];
+          std::size_t first = std::min(k * band, index.size());
+          std::size_t last = std::min(first + band, index.size());
+          for (std::size_t i = first; i < last; ++i) {
+            result[index[i]] += (y.size() == 0 ? R(1) : R(y[i]));
+          }
+        }
+      }
+    };
+
+    /**
+     * Accumulate the statistics of bands of items into partial bins
+     */
+    struct BinStatisticsBand {
+      af::const_ref<std::size_t> index;
+      af::const_ref<double> y;
+      af::const_ref<double> w;
+      std::size_t band;
+      std::vector<std::vector<BinAccumulator> > &partial;
+
+      BinStatisticsBand(const af::const_ref<std::size_t> &index_,
+                        const af::const_ref<double> &y_,
+                        const af::const_ref<double> &w_,
+                        std::size_t band_,
+                        std::vector<std::vector<BinAccumulator> > &partial_)
+          : index(index_), y(y_), w(w_), band(band_), partial(partial_) {}
+
+      void operator()(int b0, int b1) const {
+        for (int k = b0; k < b1; ++k) {
+          std::vector<BinAccumulator> &result = partial[k];
+          std::size_t first = std::min(k * band, index.size());
+          std::size_t last = std::min(first + band, index.size());
+          for (std::size_t i = first; i < last; ++i) {
+            result[index[i]].add(y[i], w.size() == 0 ? 1.0 : w[i]);
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * A class to compute the count, sum and mean of values in bins. The items
+   * are split into a fixed set of bands, each summed into its own partial
+   * bins by one thread, and the partial bins are then added in band order,
+   * so the results do not depend on the scheduling of the threads.
    */
   class BinIndexer {
   public:
@@ -49,71 +191,55 @@ namespace dials { namespace af {
     }
 
     /**
+     * @param nthreads The number of threads to use
      * @returns A count of the values in each bin
      */
-    af::shared<std::size_t> count() const {
-      af::shared<std::size_t> result(nbins_, 0);
-      for (std::size_t i = 0; i < index_.size(); ++i) {
-        DIALS_ASSERT(index_[i] < nbins_);
-        result[index_[i]]++;
-      }
-      return result;
+    af::shared<std::size_t> count(std::size_t nthreads = 1) const {
+      return reduce<std::size_t, std::size_t>(af::const_ref<std::size_t>(0, 0),
+                                              nthreads);
     }
 
     /**
      * @param y The quantity
+     * @param nthreads The number of threads to use
      * @returns The sum of y in each bin
      */
-    af::shared<double> sum(const af::const_ref<double> &y) const {
+    af::shared<double> sum(const af::const_ref<double> &y,
+                           std::size_t nthreads = 1) const {
       DIALS_ASSERT(y.size() == index_.size());
-      af::shared<double> result(nbins_, 0);
-      for (std::size_t i = 0; i < y.size(); ++i) {
-        DIALS_ASSERT(index_[i] < nbins_);
-        result[index_[i]] += y[i];
-      }
-      return result;
+      return reduce<double, double>(y, nthreads);
     }
 
     /**
      * @param y The quantity
+     * @param nthreads The number of threads to use
      * @returns The sum of y in each bin
      */
-    af::shared<int> sum(const af::const_ref<int> &y) const {
+    af::shared<int> sum(const af::const_ref<int> &y, std::size_t nthreads = 1) const {
       DIALS_ASSERT(y.size() == index_.size());
-      af::shared<int> result(nbins_, 0);
-      for (std::size_t i = 0; i < y.size(); ++i) {
-        DIALS_ASSERT(index_[i] < nbins_);
-        result[index_[i]] += y[i];
-      }
-      return result;
+      return reduce<int, int>(y, nthreads);
     }
 
     /**
      * @param y The quantity
+     * @param nthreads The number of threads to use
      * @returns The sum of y in each bin
      */
-    af::shared<int> sum(const af::const_ref<bool> &y) const {
+    af::shared<int> sum(const af::const_ref<bool> &y, std::size_t nthreads = 1) const {
       DIALS_ASSERT(y.size() == index_.size());
-      af::shared<int> result(nbins_, 0);
-      for (std::size_t i = 0; i < y.size(); ++i) {
-        DIALS_ASSERT(index_[i] < nbins_);
-        result[index_[i]] += (int)y[i];
-      }
-      return result;
+      return reduce<bool, int>(y, nthreads);
     }
 
     /**
      * @param y The quantity
+     * @param nthreads The number of threads to use
      * @returns The mean of y in each bin
      */
-    af::shared<double> mean(const af::const_ref<double> &y) const {
+    af::shared<double> mean(const af::const_ref<double> &y,
+                            std::size_t nthreads = 1) const {
       DIALS_ASSERT(y.size() == index_.size());
-      af::shared<std::size_t> num = count();
-      af::shared<double> result(nbins_, 0);
-      for (std::size_t i = 0; i < y.size(); ++i) {
-        DIALS_ASSERT(index_[i] < nbins_);
-        result[index_[i]] += y[i];
-      }
+      af::shared<std::size_t> num = count(nthreads);
+      af::shared<double> result = sum(y, nthreads);
       for (std::size_t i = 0; i < result.size(); ++i) {
         if (num[i] > 0) {
           result[i] /= num[i];
@@ -122,7 +248,96 @@ namespace dials { namespace af {
       return result;
     }
 
+    /**
+     * Compute the count, sum, mean, sample variance, minimum and maximum of
+     * y and the sum of weights and weighted mean of y in each bin in a
+     * single pass. Empty bins are zero, as is the variance of a bin with a
+     * single value.
+     * @param y The quantity
+     * @param w The weights, or an empty array for unit weights
+     * @param nthreads The number of threads to use
+     * @returns The statistics of y in each bin
+     */
+    BinStatistics statistics(const af::const_ref<double> &y,
+                             const af::const_ref<double> &w,
+                             std::size_t nthreads = 1) const {
+      DIALS_ASSERT(y.size() == index_.size());
+      DIALS_ASSERT(w.size() == 0 || w.size() == index_.size());
+      std::size_t nbands = num_bands(nthreads);
+      std::vector<std::vector<detail::BinAccumulator> > partial(
+        nbands, std::vector<detail::BinAccumulator>(nbins_));
+      dials::algorithms::for_each_band(
+        detail::BinStatisticsBand(
+          index_.const_ref(), y, w, band_size(nbands), partial),
+        (int)nbands,
+        nthreads);
+      BinStatistics result(nbins_);
+      for (std::size_t j = 0; j < nbins_; ++j) {
+        detail::BinAccumulator acc;
+        for (std::size_t k = 0; k < nbands; ++k) {
+          acc.merge(partial[k][j]);
+        }
+        result.count[j] = acc.n;
+        result.sum[j] = acc.sum;
+        result.mean[j] = acc.mean;
+        result.variance[j] = acc.n > 1 ? acc.m2 / (acc.n - 1) : 0.0;
+        result.min[j] = acc.min;
+        result.max[j] = acc.max;
+        result.sum_weights[j] = acc.sum_w;
+        result.weighted_mean[j] = acc.sum_w != 0 ? acc.sum_wy / acc.sum_w : 0.0;
+      }
+      return result;
+    }
+
+    /**
+     * Compute the statistics of y in each bin with unit weights
+     * @param y The quantity
+     * @param nthreads The number of threads to use
+     * @returns The statistics of y in each bin
+     */
+    BinStatistics statistics(const af::const_ref<double> &y,
+                             std::size_t nthreads = 1) const {
+      return statistics(y, af::const_ref<double>(0, 0), nthreads);
+    }
+
   private:
+    /**
+     * @returns The number of bands to split the items into
+     */
+    std::size_t num_bands(std::size_t nthreads) const {
+      const std::size_t min_band = 1 << 14;
+      DIALS_ASSERT(nthreads > 0);
+      return std::min(nthreads, std::max(index_.size() / min_band, (std::size_t)1));
+    }
+
+    /**
+     * @returns The number of items in each band
+     */
+    std::size_t band_size(std::size_t nbands) const {
+      return std::max((index_.size() + nbands - 1) / nbands, (std::size_t)1);
+    }
+
+    /**
+     * Sum y, or count the items if y is empty, into partial bins for each
+     * band and add the partial bins in band order.
+     */
+    template <typename T, typename R>
+    af::shared<R> reduce(const af::const_ref<T> &y, std::size_t nthreads) const {
+      std::size_t nbands = num_bands(nthreads);
+      std::vector<std::vector<R> > partial(nbands, std::vector<R>(nbins_, 0));
+      dials::algorithms::for_each_band(
+        detail::BinSumBand<T, R>(index_.const_ref(), y, band_size(nbands), partial),
+        (int)nbands,
+        nthreads);
+      af::shared<R> result(nbins_, 0);
+      for (std::size_t k = 0; k < nbands; ++k) {
+        for (std::size_t j = 0; j < nbins_; ++j) {
+          result[j] += partial[k][j];
+        }
+      }
+      return result;
+    }
+
     std::size_t nbins_;
     af::shared<std::size_t> index_;
   };
@@ -158,18 +373,14 @@ namespace dials { namespace af {
 
     /**
      * @param x The x value
+     * @param nthreads The number of threads to use
      * @returns an indexer
      */
-    BinIndexer indexer(const af::const_ref<double> &x) {
+    BinIndexer indexer(const af::const_ref<double> &x, std::size_t nthreads = 1) {
       // Find the indices of elements
       af::shared<std::size_t> index(x.size());
-      for (std::size_t i = 0; i < x.size(); ++i) {
-        map_type::const_iterator it = bins_.upper_bound(x[i]);
-        if (it != bins_.begin()) {
-          --it;
-        }
-        index[i] = it->second;
-      }
+      dials::algorithms::for_each_band(
+        IndexBand(bins_, x, index.ref()), (int)x.size(), nthreads);
 
       // Return the indexer
       return BinIndexer(bins_.size(), index);
@@ -183,6 +394,30 @@ namespace dials { namespace af {
     }
 
   private:
+    /**
+     * Find the bins of a band of elements
+     */
+    struct IndexBand {
+      const map_type &bins;
+      af::const_ref<double> x;
+      af::ref<std::size_t> index;
+
+      IndexBand(const map_type &bins_,
+                const af::const_ref<double> &x_,
+                af::ref<std::size_t> index_)
+          : bins(bins_), x(x_), index(index_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          map_type::const_iterator it = bins.upper_bound(x[i]);
+          if (it != bins.begin()) {
+            --it;
+          }
+          index[i] = it->second;
+        }
+      }
+    };
+
     map_type bins_;
   };
 
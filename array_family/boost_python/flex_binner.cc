@@ -17,31 +17,71 @@ namespace dials { namespace af { namespace boost_python {
   using namespace boost::python;
 
   af::shared<double> sum_double(const BinIndexer &self,
-                                const af::const_ref<double> &data) {
-    return self.sum(data);
+                                const af::const_ref<double> &data,
+                                std::size_t nthreads) {
+    return self.sum(data, nthreads);
   }
 
-  af::shared<int> sum_int(const BinIndexer &self, const af::const_ref<int> &data) {
-    return self.sum(data);
+  af::shared<int> sum_int(const BinIndexer &self,
+                          const af::const_ref<int> &data,
+                          std::size_t nthreads) {
+    return self.sum(data, nthreads);
   }
 
-  af::shared<int> sum_bool(const BinIndexer &self, const af::const_ref<bool> &data) {
-    return self.sum(data);
+  af::shared<int> sum_bool(const BinIndexer &self,
+                           const af::const_ref<bool> &data,
+                           std::size_t nthreads) {
+    return self.sum(data, nthreads);
+  }
+
+  BinStatistics statistics(const BinIndexer &self,
+                           const af::const_ref<double> &data,
+                           af::shared<double> weights,
+                           std::size_t nthreads) {
+    return self.statistics(data, weights.const_ref(), nthreads);
   }
 
   void export_flex_binner() {
+    class_<BinStatistics>("BinStatistics", no_init)
+      .add_property(
+        "count",
+        make_getter(&BinStatistics::count, return_value_policy<return_by_value>()))
+      .add_property(
+        "sum", make_getter(&BinStatistics::sum, return_value_policy<return_by_value>()))
+      .add_property(
+        "mean",
+        make_getter(&BinStatistics::mean, return_value_policy<return_by_value>()))
+      .add_property(
+        "variance",
+        make_getter(&BinStatistics::variance, return_value_policy<return_by_value>()))
+      .add_property(
+        "min", make_getter(&BinStatistics::min, return_value_policy<return_by_value>()))
+      .add_property(
+        "max", make_getter(&BinStatistics::max, return_value_policy<return_by_value>()))
+      .add_property("sum_weights",
+                    make_getter(&BinStatistics::sum_weights,
+                                return_value_policy<return_by_value>()))
+      .add_property("weighted_mean",
+                    make_getter(&BinStatistics::weighted_mean,
+                                return_value_policy<return_by_value>()));
+
     class_<BinIndexer>("BinIndexer", no_init)
       .def("indices", &BinIndexer::indices)
-      .def("count", &BinIndexer::count)
-      .def("sum", &sum_double)
-      .def("sum", &sum_int)
-      .def("sum", &sum_bool)
-      .def("mean", &BinIndexer::mean);
+      .def("count", &BinIndexer::count, (arg("nthreads") = 1))
+      .def("sum", &sum_double, (arg("data"), arg("nthreads") = 1))
+      .def("sum", &sum_int, (arg("data"), arg("nthreads") = 1))
+      .def("sum", &sum_bool, (arg("data"), arg("nthreads") = 1))
+      .def("mean", &BinIndexer::mean, (arg("data"), arg("nthreads") = 1))
+      .def("statistics",
+           &statistics,
+           (arg("data"),
+            arg("weights") = af::shared<double>(),
+            arg("nthreads") = 1));
 
     class_<Binner>("Binner", no_init)
       .def(init<const af::const_ref<double> &>())
       .def("bins", &Binner::bins)
-      .def("indexer", &Binner::indexer)
+      .def("indexer", &Binner::indexer, (arg("x"), arg("nthreads") = 1))
       .def("__len__", &Binner::size);
   }
 
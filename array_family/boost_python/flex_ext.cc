@@ -14,6 +14,7 @@
 #include <scitbx/boost_python/container_conversions.h>
 #include <scitbx/array_family/boost_python/c_grid_flex_conversions.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/array_family/memory_usage.h>
 #include <dials/model/data/ray.h>
 #include <dials/config.h>
 
@@ -45,7 +46,17 @@ namespace dials { namespace af { namespace boost_python {
     return "double";
   }
 
+  void export_memory_usage() {
+    class_<memory_usage>("memory_usage")
+      .def_readonly("array_bytes", &memory_usage::array_bytes)
+      .def_readonly("element_bytes", &memory_usage::element_bytes)
+      .def_readonly("shared_bytes", &memory_usage::shared_bytes)
+      .def_readonly("use_count", &memory_usage::use_count)
+      .def("total_bytes", &memory_usage::total_bytes);
+  }
+
   BOOST_PYTHON_MODULE(dials_array_family_flex_ext) {
+    export_memory_usage();
     export_flex_int6();
     export_flex_shoebox();
     export_flex_centroid();
@@ -12,11 +12,17 @@
 #include <boost/python/def.hpp>
 #include <boost/python/suite/indexing/map_indexing_suite.hpp>
 #include <dials/util/python_streambuf.h>
+#include <dials/util/python_gil.h>
+#include <algorithm>
 #include <numeric>
 #include <dials/array_family/boost_python/flex_table_suite.h>
 #include <dials/array_family/reflection_table.h>
 #include <dials/array_family/reflection.h>
 #include <dials/array_family/reflection_table_msgpack_adapter.h>
+#include <dials/array_family/reflection_table_mapped_file.h>
+#include <dials/array_family/sort_index.h>
+#include <dials/array_family/hash_join.h>
+#include <dials/array_family/packed_index.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/model/data/observation.h>
 #include <dials/algorithms/profile_model/gaussian_rs/coordinate_system.h>
@@ -643,6 +649,227 @@ namespace dials { namespace af { namespace boost_python {
     flex_table_suite::extend(self, other);
   }
 
+  /**
+   * A visitor to sort an index stably by an integer column, or by one
+   * component of a column of Miller indices or int6
+   */
+  struct radix_sort_visitor : public boost::static_visitor<void> {
+    af::ref<std::size_t> index;
+    int component;
+    bool reverse;
+    std::size_t nthreads;
+
+    radix_sort_visitor(af::ref<std::size_t> index_,
+                       int component_,
+                       bool reverse_,
+                       std::size_t nthreads_)
+        : index(index_),
+          component(component_),
+          reverse(reverse_),
+          nthreads(nthreads_) {}
+
+    void operator()(const af::shared<bool> &col) {
+      sort_by_array(col);
+    }
+
+    void operator()(const af::shared<int> &col) {
+      sort_by_array(col);
+    }
+
+    void operator()(const af::shared<std::size_t> &col) {
+      sort_by_array(col);
+    }
+
+    void operator()(const af::shared<int6> &col) {
+      sort_by_component(col, 6);
+    }
+
+    void operator()(const af::shared<cctbx::miller::index<> > &col) {
+      sort_by_component(col, 3);
+    }
+
+    template <typename U>
+    void operator()(const U &col) {
+      throw DIALS_ERROR("Column does not hold integer keys");
+    }
+
+    template <typename U>
+    void sort_by_array(const af::shared<U> &col) {
+      DIALS_ASSERT(component < 0);
+      DIALS_ASSERT(col.size() == index.size());
+      radix_sort_index(
+        index.begin(), index.end(), radix_array_key<U>(col.begin()), reverse, nthreads);
+    }
+
+    template <typename U>
+    void sort_by_component(const af::shared<U> &col, int size) {
+      DIALS_ASSERT(component >= 0 && component < size);
+      DIALS_ASSERT(col.size() == index.size());
+      radix_sort_index(index.begin(),
+                       index.end(),
+                       radix_component_key<U>(col.begin(), component),
+                       reverse,
+                       nthreads);
+    }
+  };
+
+  /**
+   * Get the permutation that sorts the table by a list of integer keys. Each
+   * key is either the name of a bool, int or size_t column, or a tuple of the
+   * name of a Miller index or int6 column and the component to sort by. The
+   * first key is the most significant and the sort is stable. The keys are
+   * sorted in turn with a radix sort, in threads for large tables.
+   * @param self The table
+   * @param keys The list of keys
+   * @param reverse Sort into descending order
+   * @returns The permutation
+   */
+  template <typename T>
+  af::shared<std::size_t> sort_permutation(const T &self,
+                                           boost::python::list keys,
+                                           bool reverse) {
+    af::shared<std::size_t> index(self.nrows());
+    for (std::size_t i = 0; i < index.size(); ++i) {
+      index[i] = i;
+    }
+    std::size_t nthreads = flex_table_suite::get_table_nthreads();
+    for (std::size_t i = len(keys); i > 0; --i) {
+      object key = keys[i - 1];
+      std::string name;
+      int component = -1;
+      extract<std::string> get_name(key);
+      if (get_name.check()) {
+        name = get_name();
+      } else {
+        name = extract<std::string>(key[0]);
+        component = extract<int>(key[1]);
+      }
+      typename T::const_iterator it = self.find(name);
+      DIALS_ASSERT(it != self.end());
+      radix_sort_visitor visitor(index.ref(), component, reverse, nthreads);
+      it->second.apply_visitor(visitor);
+    }
+    return index;
+  }
+
+  /**
+   * A visitor to add the keys of an integer column, or of one or all the
+   * components of a column of Miller indices or int6, to a set of join keys
+   */
+  struct join_keys_visitor : public boost::static_visitor<void> {
+    JoinKeys &keys;
+    int component;
+
+    join_keys_visitor(JoinKeys &keys_, int component_)
+        : keys(keys_), component(component_) {}
+
+    void operator()(const af::shared<bool> &col) {
+      DIALS_ASSERT(component < 0);
+      keys.add(col.begin());
+    }
+
+    void operator()(const af::shared<int> &col) {
+      DIALS_ASSERT(component < 0);
+      keys.add(col.begin());
+    }
+
+    void operator()(const af::shared<std::size_t> &col) {
+      DIALS_ASSERT(component < 0);
+      keys.add(col.begin());
+    }
+
+    void operator()(const af::shared<int6> &col) {
+      DIALS_ASSERT(sizeof(int6) == 6 * sizeof(int));
+      add_components(reinterpret_cast<const int *>(col.begin()), col.size(), 6);
+    }
+
+    void operator()(const af::shared<cctbx::miller::index<> > &col) {
+      DIALS_ASSERT(sizeof(cctbx::miller::index<>) == 3 * sizeof(int));
+      add_components(reinterpret_cast<const int *>(col.begin()), col.size(), 3);
+    }
+
+    template <typename U>
+    void operator()(const U &col) {
+      throw DIALS_ERROR("Column does not hold integer keys");
+    }
+
+    void add_components(const int *data, std::size_t size, int stride) {
+      DIALS_ASSERT(component < stride);
+      int first = component < 0 ? 0 : component;
+      int last = component < 0 ? stride : component + 1;
+      for (int c = first; c < last; ++c) {
+        keys.add(size > 0 ? data + c : data, stride);
+      }
+    }
+  };
+
+  /**
+   * Get the join keys of a table from a list of keys, each of which is either
+   * the name of a column or a tuple of the name of a column of Miller indices
+   * or int6 and a component.
+   */
+  template <typename T>
+  JoinKeys make_join_keys(const T &self, boost::python::list keys) {
+    JoinKeys result(self.nrows());
+    for (std::size_t i = 0; i < len(keys); ++i) {
+      object key = keys[i];
+      std::string name;
+      int component = -1;
+      extract<std::string> get_name(key);
+      if (get_name.check()) {
+        name = get_name();
+      } else {
+        name = extract<std::string>(key[0]);
+        component = extract<int>(key[1]);
+      }
+      typename T::const_iterator it = self.find(name);
+      DIALS_ASSERT(it != self.end());
+      join_keys_visitor visitor(result, component);
+      it->second.apply_visitor(visitor);
+    }
+    return result;
+  }
+
+  /**
+   * Find all the pairs of rows of two tables with equal keys, such as the
+   * Miller index and experiment id. The pairs are found with a hash join, in
+   * threads for large tables, and are returned in order of the row of this
+   * table, then of the other.
+   * @param self The table
+   * @param other The other table
+   * @param keys The list of keys
+   * @returns A tuple of the rows of each table of the pairs
+   */
+  template <typename T>
+  boost::python::tuple hash_join(const T &self,
+                                 const T &other,
+                                 boost::python::list keys) {
+    JoinKeys keys_a = make_join_keys(self, keys);
+    JoinKeys keys_b = make_join_keys(other, keys);
+    af::shared<std::size_t> index_a;
+    af::shared<std::size_t> index_b;
+    af::hash_join(
+      keys_a, keys_b, index_a, index_b, flex_table_suite::get_table_nthreads());
+    return boost::python::make_tuple(index_a, index_b);
+  }
+
+  /**
+   * Reduce the candidate pairs of rows of two tables to one to one matches
+   * @param index_a The row of the first table of each pair
+   * @param index_b The row of the second table of each pair
+   * @param distance The distance between the rows of each pair
+   * @returns A tuple of the rows of each table of the matches
+   */
+  boost::python::tuple unique_closest_pairs_wrapper(
+    const af::const_ref<std::size_t> &index_a,
+    const af::const_ref<std::size_t> &index_b,
+    const af::const_ref<double> &distance) {
+    af::shared<std::size_t> match_a;
+    af::shared<std::size_t> match_b;
+    af::unique_closest_pairs(index_a, index_b, distance, match_a, match_b);
+    return boost::python::make_tuple(match_a, match_b);
+  }
+
   /**
    * Update the reflection table
    */
@@ -813,15 +1040,20 @@ namespace dials { namespace af { namespace boost_python {
   }
 
   /**
-   * Pack the reflection table in msgpack format
+   * Pack the reflection table in msgpack format. The GIL is released while
+   * packing, which only touches the C++ columns.
    * @param self The reflection table
    * @returns The msgpack string
    */
   boost::python::object reflection_table_as_msgpack(reflection_table self) {
-    std::stringstream buffer;
-    msgpack::pack(buffer, self);
+    std::string data;
+    {
+      dials::util::ScopedGILRelease release_gil;
+      std::stringstream buffer;
+      msgpack::pack(buffer, self);
+      data = buffer.str();
+    }
     // Convert to a python bytes object
-    std::string data = buffer.str();
     boost::python::object data_bytes(
       boost::python::handle<>(PyBytes_FromStringAndSize(data.c_str(), data.size())));
     return data_bytes;
@@ -831,10 +1063,14 @@ namespace dials { namespace af { namespace boost_python {
    * Pack the reflection table in msgpack format into a streambuf object
    * @param self The reflection table
    * @param output A streambuf object encapsulating a Python file-like object
+   * @param nthreads The number of threads to pack the columns
    */
-  void reflection_table_as_msgpack_to_file(reflection_table self, streambuf &output) {
+  void reflection_table_as_msgpack_to_file(reflection_table self,
+                                           streambuf &output,
+                                           std::size_t nthreads,
+                                           bool compress_shoeboxes) {
     streambuf::ostream os(output);
-    msgpack::pack(os, self);
+    pack_reflection_table(os, self, nthreads, compress_shoeboxes);
   }
 
   /**
@@ -847,17 +1083,112 @@ namespace dials { namespace af { namespace boost_python {
   }
 
   /**
-   * Unpack the reflection table from msgpack format
+   * A helper to select columns by name from either a list of names or a
+   * python function which takes the column name and returns True or False
+   */
+  class column_selector {
+  public:
+    column_selector(boost::python::object columns)
+        : columns_(columns), is_function_(PyCallable_Check(columns.ptr())) {
+      if (!is_function_) {
+        for (std::size_t i = 0; i < len(columns); ++i) {
+          names_.push_back(extract<std::string>(columns[i]));
+        }
+      }
+    }
+
+    bool operator()(const std::string &name) const {
+      if (is_function_) {
+        return extract<bool>(columns_(name));
+      }
+      return std::find(names_.begin(), names_.end(), name) != names_.end();
+    }
+
+    /**
+     * Check that all the named columns have been found
+     */
+    void check(const reflection_table &table) const {
+      for (std::size_t i = 0; i < names_.size(); ++i) {
+        if (!table.contains(names_[i])) {
+          throw DIALS_ERROR("Column " + names_[i] + " not found in file");
+        }
+      }
+    }
+
+  private:
+    boost::python::object columns_;
+    bool is_function_;
+    std::vector<std::string> names_;
+  };
+
+  /**
+   * Unpack the reflection table from msgpack format. The GIL is released while
+   * parsing the bytes, which are immutable, and while converting all the
+   * columns. A predicate to select the columns is called with the GIL held.
    * @param the msgpack string
+   * @param columns The columns to read as a list or a predicate (None for all)
    * @returns The reflection table
    */
-  reflection_table reflection_table_from_msgpack(boost::python::object packed) {
+  reflection_table reflection_table_from_msgpack(boost::python::object packed,
+                                                 boost::python::object columns) {
     const char *data = PyBytes_AsString(packed.ptr());
     std::size_t size = PyBytes_Size(packed.ptr());
+    bool all_columns = columns.ptr() == Py_None;
     msgpack::unpacked result;
     std::size_t off = 0;
-    msgpack::unpack(result, data, size, off, reflection_table_reference_func);
-    reflection_table r = result.get().as<reflection_table>();
+    {
+      dials::util::ScopedGILRelease release_gil;
+      msgpack::unpack(result, data, size, off, reflection_table_reference_func);
+      if (all_columns) {
+        reflection_table r = result.get().as<reflection_table>();
+        return r;
+      }
+    }
+    column_selector selector(columns);
+    reflection_table r;
+    msgpack::adaptor::convert<reflection_table>().read(result.get(), r, selector);
+    selector.check(r);
+    return r;
+  }
+
+  /**
+   * Write the reflection table to a memory mapped file
+   * @param self The reflection table
+   * @param filename The filename
+   */
+  void reflection_table_as_mapped_file(const reflection_table &self,
+                                       std::string filename) {
+    dials::util::ScopedGILRelease release_gil;
+    write_mapped_file(self, filename);
+  }
+
+  /**
+   * Read the reflection table from a memory mapped file
+   * @param filename The filename
+   * @param columns The columns to read as a list or a predicate (None for all)
+   * @returns The reflection table
+   */
+  reflection_table reflection_table_from_mapped_file(std::string filename,
+                                                     boost::python::object columns) {
+    MappedReflectionFile mapped(filename);
+    if (columns.ptr() == Py_None) {
+      dials::util::ScopedGILRelease release_gil;
+      return mapped.read();
+    }
+    column_selector selector(columns);
+    std::vector<std::string> keys = mapped.keys();
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      if (selector(keys[i])) {
+        names.push_back(keys[i]);
+      }
+    }
+    reflection_table r;
+    {
+      dials::util::ScopedGILRelease release_gil;
+      r = mapped.read(names);
+    }
+    selector.check(r);
     return r;
   }
 
@@ -1001,9 +1332,24 @@ namespace dials { namespace af { namespace boost_python {
              &split_indices_by_experiment_id<flex_table_type>)
         .def("compute_phi_range", &compute_phi_range<flex_table_type>)
         .def("as_msgpack", &reflection_table_as_msgpack)
-        .def("as_msgpack_to_file", &reflection_table_as_msgpack_to_file)
-        .def("from_msgpack", &reflection_table_from_msgpack)
+        .def("as_msgpack_to_file",
+             &reflection_table_as_msgpack_to_file,
+             (boost::python::arg("output"),
+              boost::python::arg("nthreads") = 1,
+              boost::python::arg("compress_shoeboxes") = false))
+        .def("from_msgpack",
+             &reflection_table_from_msgpack,
+             (boost::python::arg("packed"),
+              boost::python::arg("columns") = boost::python::object()))
         .staticmethod("from_msgpack")
+        .def("write_mapped_file", &reflection_table_as_mapped_file)
+        .def("from_mapped_file",
+             &reflection_table_from_mapped_file,
+             (boost::python::arg("filename"),
+              boost::python::arg("columns") = boost::python::object()))
+        .staticmethod("from_mapped_file")
+        .def("is_mapped_file", &is_mapped_file)
+        .staticmethod("is_mapped_file")
         .def("experiment_identifiers", &T::experiment_identifiers)
         .def("select", &reflection_table_select_rows_index<flex_table_type>)
         .def("select", &reflection_table_select_rows_flags<flex_table_type>)
@@ -1011,6 +1357,12 @@ namespace dials { namespace af { namespace boost_python {
         .def("select", &reflection_table_select_cols_tuple<flex_table_type>)
         .def("extend", reflection_table_extend)
         .def("update", reflection_table_update)
+        .def("sort_permutation",
+             &sort_permutation<flex_table_type>,
+             (boost::python::arg("keys"), boost::python::arg("reverse") = false))
+        .def("hash_join",
+             &hash_join<flex_table_type>,
+             (boost::python::arg("other"), boost::python::arg("keys")))
         .def_pickle(flex_reflection_table_pickle_suite());
 
       // Create the flags enum in the reflection table scope
@@ -1203,6 +1555,25 @@ namespace dials { namespace af { namespace boost_python {
     // Export the reflection table
     flex_reflection_table_wrapper<reflection_table>::wrap("reflection_table");
 
+    def("unique_closest_pairs",
+        &unique_closest_pairs_wrapper,
+        (boost::python::arg("index_a"),
+         boost::python::arg("index_b"),
+         boost::python::arg("distance")));
+
+    class_<MappedReflectionFileWriter, boost::noncopyable>(
+      "reflection_table_file_writer", no_init)
+      .def(init<std::string>((boost::python::arg("filename"))))
+      .def("append", &MappedReflectionFileWriter::append)
+      .def("close", &MappedReflectionFileWriter::close)
+      .def("nrows", &MappedReflectionFileWriter::nrows)
+      .def("nchunks", &MappedReflectionFileWriter::nchunks);
+
+    def("pack_miller_indices", &pack_miller_indices);
+    def("unpack_miller_indices", &unpack_miller_indices);
+    def("pack_flags", &pack_flags);
+    def("unpack_flags", &unpack_flags);
+
     // Export the reflection object
     class_<Reflection>("Reflection")
       .def("get", &Reflection_get)
@@ -10,16 +10,20 @@
  */
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
+#include <algorithm>
 #include <cmath>
+#include <vector>
 #include <scitbx/array_family/boost_python/flex_wrapper.h>
 #include <scitbx/array_family/ref_reductions.h>
 #include <scitbx/array_family/boost_python/ref_pickle_double_buffered.h>
 #include <scitbx/array_family/boost_python/flex_pickle_double_buffered.h>
 #include <cctbx/miller.h>
+#include <dials/array_family/memory_usage.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/model/data/pixel_list.h>
 #include <dials/model/data/observation.h>
 #include <dials/algorithms/image/connected_components/connected_components.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/algorithms/spot_prediction/pixel_to_miller_index.h>
 #include <dials/config.h>
 
@@ -34,6 +38,7 @@ namespace dials { namespace af { namespace boost_python {
   using dials::algorithms::LabelImageStack;
   using dials::algorithms::LabelPixels;
   using dials::algorithms::PixelToMillerIndex;
+  using dials::algorithms::for_each_band;
   using dials::model::Background;
   using dials::model::BackgroundUsed;
   using dials::model::Centroid;
@@ -42,6 +47,7 @@ namespace dials { namespace af { namespace boost_python {
   using dials::model::Observation;
   using dials::model::PixelListLabeller;
   using dials::model::Shoebox;
+  using dials::model::Strong;
   using dials::model::Valid;
   using dxtbx::model::BeamBase;
   using dxtbx::model::CrystalBase;
@@ -356,27 +362,62 @@ namespace dials { namespace af { namespace boost_python {
   }
 
   /**
-   * Allocate the shoeboxes
+   * Fill the arrays of a band of shoeboxes with a mask value. The arrays are
+   * only written through their refs, so no array handles are copied or
+   * released in the threads.
+   */
+  template <typename FloatType>
+  struct AllocateWithValueBand {
+    af::ref<Shoebox<FloatType> > a;
+    int mask_code;
+
+    AllocateWithValueBand(af::ref<Shoebox<FloatType> > a_, int mask_code_)
+        : a(a_), mask_code(mask_code_) {}
+
+    void operator()(int i0, int i1) const {
+      for (int i = i0; i < i1; ++i) {
+        std::fill(a[i].data.begin(), a[i].data.end(), FloatType(0));
+        std::fill(a[i].mask.begin(), a[i].mask.end(), mask_code);
+        std::fill(a[i].background.begin(), a[i].background.end(), FloatType(0));
+      }
+    }
+  };
+
+  /**
+   * Allocate the shoeboxes with a mask value. The array handles of the
+   * shoeboxes have reference counts which are not atomic and may be shared
+   * between shoeboxes, so the arrays are replaced on the calling thread and
+   * only filled in threads.
    */
   template <typename FloatType>
-  void allocate(af::ref<Shoebox<FloatType> > a) {
+  void allocate_with_value(af::ref<Shoebox<FloatType> > a,
+                           int mask_code,
+                           std::size_t nthreads) {
     for (std::size_t i = 0; i < a.size(); ++i) {
-      a[i].allocate();
+      std::size_t zs = a[i].flat ? 1 : a[i].zsize();
+      af::c_grid<3> accessor(zs, a[i].ysize(), a[i].xsize());
+      a[i].data = af::versa<FloatType, af::c_grid<3> >(
+        accessor, af::init_functor_null<FloatType>());
+      a[i].mask =
+        af::versa<int, af::c_grid<3> >(accessor, af::init_functor_null<int>());
+      a[i].background = af::versa<FloatType, af::c_grid<3> >(
+        accessor, af::init_functor_null<FloatType>());
     }
+    for_each_band(
+      AllocateWithValueBand<FloatType>(a, mask_code), (int)a.size(), nthreads);
   }
 
   /**
    * Allocate the shoeboxes
    */
   template <typename FloatType>
-  void allocate_with_value(af::ref<Shoebox<FloatType> > a, int mask_code) {
-    for (std::size_t i = 0; i < a.size(); ++i) {
-      a[i].allocate_with_value(mask_code);
-    }
+  void allocate(af::ref<Shoebox<FloatType> > a, std::size_t nthreads) {
+    allocate_with_value(a, 0, nthreads);
   }
 
   /**
-   * Deallocate the shoeboxes
+   * Deallocate the shoeboxes. This only releases the array handles, which
+   * must be done on the calling thread, so it is not threaded.
    */
   template <typename FloatType>
   void deallocate(af::ref<Shoebox<FloatType> > a) {
@@ -477,6 +518,22 @@ namespace dials { namespace af { namespace boost_python {
     return result;
   }
 
+  /**
+   * Move the shoeboxes to new bounding boxes of the same size, keeping the
+   * pixel data, e.g. to set each slice of a 3D shoebox to the frame of an
+   * image of its own
+   */
+  template <typename FloatType>
+  void set_bounding_boxes(ref<Shoebox<FloatType> > a, const const_ref<int6> &bbox) {
+    DIALS_ASSERT(a.size() == bbox.size());
+    for (std::size_t i = 0; i < a.size(); ++i) {
+      DIALS_ASSERT(bbox[i][1] - bbox[i][0] == a[i].bbox[1] - a[i].bbox[0]);
+      DIALS_ASSERT(bbox[i][3] - bbox[i][2] == a[i].bbox[3] - a[i].bbox[2]);
+      DIALS_ASSERT(bbox[i][5] - bbox[i][4] == a[i].bbox[5] - a[i].bbox[4]);
+      a[i].bbox = bbox[i];
+    }
+  }
+
   /**
    * Get the panel numbers
    */
@@ -506,48 +563,36 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_masked(const const_ref<Shoebox<FloatType> > &a,
-                                       int code) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_masked(code);
-    }
-    return result;
+                                       int code,
+                                       std::size_t nthreads) {
+    return dials::model::centroid_masked(a, code, false, nthreads);
   }
 
   /**
    * Get a list of centroid
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_valid(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_valid();
-    }
-    return result;
+  af::shared<Centroid> centroid_valid(const const_ref<Shoebox<FloatType> > &a,
+                                      std::size_t nthreads) {
+    return dials::model::centroid_masked(a, Valid, false, nthreads);
   }
 
   /**
    * Get a list of centroid
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_foreground(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_foreground();
-    }
-    return result;
+  af::shared<Centroid> centroid_foreground(const const_ref<Shoebox<FloatType> > &a,
+                                           std::size_t nthreads) {
+    return dials::model::centroid_masked(a, Valid | Foreground, false, nthreads);
   }
 
   /**
    * Get a list of centroid
    */
   template <typename FloatType>
-  af::shared<Centroid> centroid_strong(const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_strong();
-    }
-    return result;
+  af::shared<Centroid> centroid_strong(const const_ref<Shoebox<FloatType> > &a,
+                                       std::size_t nthreads) {
+    return dials::model::centroid_masked(a, Valid | Strong, false, nthreads);
   }
 
   /**
@@ -569,12 +614,9 @@ namespace dials { namespace af { namespace boost_python {
   template <typename FloatType>
   af::shared<Centroid> centroid_masked_minus_background(
     const const_ref<Shoebox<FloatType> > &a,
-    int code) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_masked_minus_background(code);
-    }
-    return result;
+    int code,
+    std::size_t nthreads) {
+    return dials::model::centroid_masked(a, code, true, nthreads);
   }
 
   /**
@@ -582,12 +624,9 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_valid_minus_background(
-    const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_valid_minus_background();
-    }
-    return result;
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return dials::model::centroid_masked(a, Valid, true, nthreads);
   }
 
   /**
@@ -595,12 +634,9 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_foreground_minus_background(
-    const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_foreground_minus_background();
-    }
-    return result;
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return dials::model::centroid_masked(a, Valid | Foreground, true, nthreads);
   }
 
   /**
@@ -608,35 +644,70 @@ namespace dials { namespace af { namespace boost_python {
    */
   template <typename FloatType>
   af::shared<Centroid> centroid_strong_minus_background(
-    const const_ref<Shoebox<FloatType> > &a) {
-    af::shared<Centroid> result(a.size(), Centroid());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].centroid_strong_minus_background();
-    }
-    return result;
+    const const_ref<Shoebox<FloatType> > &a,
+    std::size_t nthreads) {
+    return dials::model::centroid_masked(a, Valid | Strong, true, nthreads);
   }
 
+  /**
+   * Compute the summed intensities of a band of shoeboxes
+   */
+  template <typename FloatType>
+  struct SummedIntensityBand {
+    af::const_ref<Shoebox<FloatType> > a;
+    af::ref<Intensity> result;
+
+    SummedIntensityBand(const af::const_ref<Shoebox<FloatType> > &a_,
+                        af::ref<Intensity> result_)
+        : a(a_), result(result_) {}
+
+    void operator()(int i0, int i1) const {
+      for (int i = i0; i < i1; ++i) {
+        result[i] = a[i].summed_intensity();
+      }
+    }
+  };
+
   /**
    * Get a list of intensities
    */
   template <typename FloatType>
-  af::shared<Intensity> summed_intensity(const const_ref<Shoebox<FloatType> > &a) {
+  af::shared<Intensity> summed_intensity(const const_ref<Shoebox<FloatType> > &a,
+                                         std::size_t nthreads) {
     af::shared<Intensity> result(a.size(), Intensity());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].summed_intensity();
-    }
+    for_each_band(
+      SummedIntensityBand<FloatType>(a, result.ref()), (int)a.size(), nthreads);
     return result;
   }
 
+  /**
+   * Compute the bayesian intensities of a band of shoeboxes
+   */
+  template <typename FloatType>
+  struct BayesianIntensityBand {
+    af::const_ref<Shoebox<FloatType> > a;
+    af::ref<Intensity> result;
+
+    BayesianIntensityBand(const af::const_ref<Shoebox<FloatType> > &a_,
+                          af::ref<Intensity> result_)
+        : a(a_), result(result_) {}
+
+    void operator()(int i0, int i1) const {
+      for (int i = i0; i < i1; ++i) {
+        result[i] = a[i].bayesian_intensity();
+      }
+    }
+  };
+
   /**
    * Get a list of intensities
    */
   template <typename FloatType>
-  af::shared<Intensity> bayesian_intensity(const const_ref<Shoebox<FloatType> > &a) {
+  af::shared<Intensity> bayesian_intensity(const const_ref<Shoebox<FloatType> > &a,
+                                           std::size_t nthreads) {
     af::shared<Intensity> result(a.size(), Intensity());
-    for (std::size_t i = 0; i < result.size(); ++i) {
-      result[i] = a[i].bayesian_intensity();
-    }
+    for_each_band(
+      BayesianIntensityBand<FloatType>(a, result.ref()), (int)a.size(), nthreads);
     return result;
   }
 
@@ -695,12 +766,77 @@ namespace dials { namespace af { namespace boost_python {
   }
 
   /**
-   * Flatten the shoeboxes
+   * Check whether any of the shoeboxes share an array, as they do when a
+   * shoebox is selected more than once.
+   */
+  template <typename FloatType>
+  bool share_arrays(const const_ref<Shoebox<FloatType> > &a) {
+    std::vector<const void *> arrays;
+    arrays.reserve(3 * a.size());
+    for (std::size_t i = 0; i < a.size(); ++i) {
+      if (a[i].data.size() > 0) arrays.push_back(a[i].data.begin());
+      if (a[i].mask.size() > 0) arrays.push_back(a[i].mask.begin());
+      if (a[i].background.size() > 0) arrays.push_back(a[i].background.begin());
+    }
+    std::sort(arrays.begin(), arrays.end());
+    return std::adjacent_find(arrays.begin(), arrays.end()) != arrays.end();
+  }
+
+  /**
+   * Sum the frames of a band of shoeboxes into the first frame. The arrays are
+   * only written through their refs, so no array handles are copied or
+   * released in the threads.
+   */
+  template <typename FloatType>
+  struct FlattenBand {
+    af::ref<Shoebox<FloatType> > a;
+
+    FlattenBand(af::ref<Shoebox<FloatType> > a_) : a(a_) {}
+
+    void operator()(int i0, int i1) const {
+      for (int i = i0; i < i1; ++i) {
+        if (a[i].flat) {
+          continue;
+        }
+        af::ref<FloatType, af::c_grid<3> > data = a[i].data.ref();
+        af::ref<int, af::c_grid<3> > mask = a[i].mask.ref();
+        for (std::size_t k = 1; k < data.accessor()[0]; ++k) {
+          for (std::size_t j = 0; j < data.accessor()[1]; ++j) {
+            for (std::size_t ii = 0; ii < data.accessor()[2]; ++ii) {
+              data(0, j, ii) += data(k, j, ii);
+              mask(0, j, ii) |= mask(k, j, ii);
+            }
+          }
+        }
+      }
+    }
+  };
+
+  /**
+   * Flatten the shoeboxes. The frames are summed in threads and the arrays
+   * are then resized on the calling thread. Shoeboxes which share their
+   * arrays are flattened one at a time on the calling thread, as before.
    */
   template <typename FloatType>
-  void flatten(ref<Shoebox<FloatType> > self) {
+  void flatten(ref<Shoebox<FloatType> > self, std::size_t nthreads) {
+    if (nthreads <= 1 || share_arrays(self)) {
+      for (std::size_t i = 0; i < self.size(); ++i) {
+        self[i].flatten();
+      }
+      return;
+    }
     for (std::size_t i = 0; i < self.size(); ++i) {
-      self[i].flatten();
+      DIALS_ASSERT(self[i].is_consistent());
+    }
+    for_each_band(FlattenBand<FloatType>(self), (int)self.size(), nthreads);
+    for (std::size_t i = 0; i < self.size(); ++i) {
+      if (!self[i].flat) {
+        af::c_grid<3> accessor(1, self[i].ysize(), self[i].xsize());
+        self[i].data.resize(accessor);
+        self[i].mask.resize(accessor);
+        self[i].background.resize(accessor);
+        self[i].flat = true;
+      }
     }
   }
 
@@ -843,10 +979,12 @@ namespace dials { namespace af { namespace boost_python {
       for (std::size_t y = 0; y < ysize; ++y) {
         for (std::size_t x = 0; x < xsize; ++x) {
           double z1 = z0 + z;
-          double y1 = y0 + y + 0.5;
-          double x1 = x0 + x + 0.5;
-          vec3<double> pixel_hkl1 = compute_miller_index.h(self.panel, x1, y1, z1);
-          vec3<double> pixel_hkl2 = compute_miller_index.h(self.panel, x1, y1, z1 + 1);
+          int y1 = y0 + (int)y;
+          int x1 = x0 + (int)x;
+          vec3<double> pixel_hkl1 =
+            compute_miller_index.h_at_pixel_centre(self.panel, x1, y1, z1);
+          vec3<double> pixel_hkl2 =
+            compute_miller_index.h_at_pixel_centre(self.panel, x1, y1, z1 + 1);
           int h1 = (int)std::floor(pixel_hkl1[0] + 0.5);
           int k1 = (int)std::floor(pixel_hkl1[1] + 0.5);
           int l1 = (int)std::floor(pixel_hkl1[2] + 0.5);
@@ -864,6 +1002,32 @@ namespace dials { namespace af { namespace boost_python {
     return modified;
   }
 
+  /**
+   * Apply the pixel labelling filter to a band of shoeboxes
+   */
+  template <typename FloatType>
+  struct MaskNeighbouringBand {
+    af::ref<Shoebox<FloatType> > self;
+    af::const_ref<cctbx::miller::index<> > hkl;
+    const PixelToMillerIndex &compute_miller_index;
+    af::ref<bool> modified;
+
+    MaskNeighbouringBand(af::ref<Shoebox<FloatType> > self_,
+                         const af::const_ref<cctbx::miller::index<> > &hkl_,
+                         const PixelToMillerIndex &compute_miller_index_,
+                         af::ref<bool> modified_)
+        : self(self_),
+          hkl(hkl_),
+          compute_miller_index(compute_miller_index_),
+          modified(modified_) {}
+
+    void operator()(int i0, int i1) const {
+      for (int i = i0; i < i1; ++i) {
+        modified[i] = mask_neighbouring_single(self[i], hkl[i], compute_miller_index);
+      }
+    }
+  };
+
   /**
    * Do a pixel labelling filter to set any pixel closer to another pixel to
    * background
@@ -875,13 +1039,30 @@ namespace dials { namespace af { namespace boost_python {
                                      const Detector &detector,
                                      const Goniometer &goniometer,
                                      const Scan &scan,
-                                     const CrystalBase &crystal) {
+                                     const CrystalBase &crystal,
+                                     std::size_t nthreads) {
     DIALS_ASSERT(self.size() == hkl.size());
     af::shared<bool> modified(self.size());
     PixelToMillerIndex compute_miller_index(beam, detector, goniometer, scan, crystal);
+
+    // Each shoebox pixel is looked up twice, so only cache the lab vectors of
+    // the detector pixels if that is fewer than the pixels of the shoeboxes
+    std::size_t npixels_shoebox = 0;
     for (std::size_t i = 0; i < self.size(); ++i) {
-      modified[i] = mask_neighbouring_single(self[i], hkl[i], compute_miller_index);
+      npixels_shoebox += 2 * self[i].xsize() * self[i].ysize() * self[i].zsize();
     }
+    std::size_t npixels_detector = 0;
+    for (std::size_t i = 0; i < detector.size(); ++i) {
+      int2 image_size = detector[i].get_image_size();
+      npixels_detector += image_size[0] * image_size[1];
+    }
+    if (npixels_shoebox > npixels_detector) {
+      compute_miller_index.cache_pixel_centres(nthreads);
+    }
+    for_each_band(MaskNeighbouringBand<FloatType>(
+                    self, hkl, compute_miller_index, modified.ref()),
+                  (int)self.size(),
+                  nthreads);
     return modified;
   }
 
@@ -973,6 +1154,15 @@ namespace dials { namespace af { namespace boost_python {
     unsigned int version;
   };
 
+  /**
+   * @returns The memory used by the shoeboxes and their pixels
+   */
+  template <typename FloatType>
+  memory_usage shoebox_memory_usage(const const_ref<Shoebox<FloatType> > &a) {
+    std::set<const void *> seen;
+    return compute_memory_usage(a, seen);
+  }
+
   template <typename FloatType>
   typename scitbx::af::boost_python::
     flex_wrapper<Shoebox<FloatType>, return_internal_reference<> >::class_f_t
@@ -1013,13 +1203,17 @@ namespace dials { namespace af { namespace boost_python {
                                boost::python::arg("bbox"),
                                boost::python::arg("allocate") = false,
                                boost::python::arg("flatten") = false)))
-        .def("allocate", &allocate<FloatType>)
-        .def("allocate_with_value", &allocate_with_value<FloatType>)
+        .def("allocate", &allocate<FloatType>, (boost::python::arg("nthreads") = 1))
+        .def("allocate_with_value",
+             &allocate_with_value<FloatType>,
+             (boost::python::arg("mask_code"), boost::python::arg("nthreads") = 1))
         .def("deallocate", &deallocate<FloatType>)
         .def("is_consistent", &is_consistent<FloatType>)
         .def("is_allocated", &is_allocated<FloatType>)
+        .def("memory_usage", &shoebox_memory_usage<FloatType>)
         .def("panels", &panels<FloatType>)
         .def("bounding_boxes", &bounding_boxes<FloatType>)
+        .def("set_bounding_boxes", &set_bounding_boxes<FloatType>)
         .def("count_mask_values", &count_mask_values<FloatType>)
         .def("is_bbox_within_image_volume",
              &is_bbox_within_image_volume<FloatType>,
@@ -1029,27 +1223,51 @@ namespace dials { namespace af { namespace boost_python {
              (boost::python::arg("mask")))
         .def("peak_coordinates", &peak_coordinates<FloatType>)
         .def("centroid_all", &centroid_all<FloatType>)
-        .def("centroid_masked", &centroid_masked<FloatType>)
-        .def("centroid_valid", &centroid_valid<FloatType>)
-        .def("centroid_foreground", &centroid_foreground<FloatType>)
-        .def("centroid_strong", &centroid_strong<FloatType>)
+        .def("centroid_masked",
+             &centroid_masked<FloatType>,
+             (boost::python::arg("code"), boost::python::arg("nthreads") = 1))
+        .def("centroid_valid",
+             &centroid_valid<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("centroid_foreground",
+             &centroid_foreground<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("centroid_strong",
+             &centroid_strong<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("centroid_all_minus_background", &centroid_all_minus_background<FloatType>)
         .def("centroid_masked_minus_background",
-             &centroid_masked_minus_background<FloatType>)
+             &centroid_masked_minus_background<FloatType>,
+             (boost::python::arg("code"), boost::python::arg("nthreads") = 1))
         .def("centroid_valid_minus_background",
-             &centroid_valid_minus_background<FloatType>)
+             &centroid_valid_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("centroid_foreground_minus_background",
-             &centroid_foreground_minus_background<FloatType>)
+             &centroid_foreground_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("centroid_strong_minus_background",
-             &centroid_strong_minus_background<FloatType>)
-        .def("bayesian_intensity", &bayesian_intensity<FloatType>)
-        .def("summed_intensity", &summed_intensity<FloatType>)
+             &centroid_strong_minus_background<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("bayesian_intensity",
+             &bayesian_intensity<FloatType>,
+             (boost::python::arg("nthreads") = 1))
+        .def("summed_intensity",
+             &summed_intensity<FloatType>,
+             (boost::python::arg("nthreads") = 1))
         .def("mean_background", &mean_background<FloatType>)
         .def("mean_modelled_background", &mean_modelled_background<FloatType>)
-        .def("flatten", &flatten<FloatType>)
+        .def("flatten", &flatten<FloatType>, (boost::python::arg("nthreads") = 1))
         .def("apply_background_mask", &apply_background_mask<FloatType>)
         .def("apply_pixel_data", &apply_pixel_data<FloatType>)
-        .def("mask_neighbouring", &mask_neighbouring<FloatType>)
+        .def("mask_neighbouring",
+             &mask_neighbouring<FloatType>,
+             (boost::python::arg("hkl"),
+              boost::python::arg("beam"),
+              boost::python::arg("detector"),
+              boost::python::arg("goniometer"),
+              boost::python::arg("scan"),
+              boost::python::arg("crystal"),
+              boost::python::arg("nthreads") = 1))
         .def_pickle(flex_pickle_double_buffered<shoebox_type,
                                                 shoebox_to_string<FloatType>,
                                                 shoebox_from_string<FloatType> >());
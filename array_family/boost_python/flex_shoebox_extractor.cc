@@ -18,11 +18,12 @@ namespace dials { namespace af { namespace boost_python {
 
   void export_flex_shoebox_extractor() {
     class_<ShoeboxExtractor>("ShoeboxExtractor", no_init)
-      .def(init<af::reflection_table, std::size_t, int, int>(
+      .def(init<af::reflection_table, std::size_t, int, int, std::size_t>(
         (boost::python::arg("data"),
          boost::python::arg("npanels"),
          boost::python::arg("frame0"),
-         boost::python::arg("frame1"))))
+         boost::python::arg("frame1"),
+         boost::python::arg("nthreads") = 1)))
       .def("next", &ShoeboxExtractor::next<int>)
       .def("next", &ShoeboxExtractor::next<float>)
       .def("next", &ShoeboxExtractor::next<double>)
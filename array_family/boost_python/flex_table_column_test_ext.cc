@@ -0,0 +1,36 @@
+/*
+ * flex_table_column_test_ext.cc
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/array_family/reflection_table.h>
+
+namespace dials { namespace af { namespace {
+
+  flex_table_column<double> double_column(const reflection_table &table,
+                                          const std::string &key) {
+    return table.column<double>(key);
+  }
+
+  void wrap_all() {
+    using namespace boost::python;
+
+    // Expose a column handle so that its validity can be tested
+    class_<flex_table_column<double> >("double_column_handle", no_init)
+      .def("is_valid", &flex_table_column<double>::is_valid)
+      .def("size", &flex_table_column<double>::size)
+      .def("data", &flex_table_column<double>::data);
+
+    def("double_column", double_column);
+  }
+
+}}}  // namespace dials::af::
+
+BOOST_PYTHON_MODULE(dials_array_family_flex_table_column_test_ext) {
+  dials::af::wrap_all();
+}
@@ -12,22 +12,27 @@
 #ifndef DIALS_FRAMEWORK_TABLE_BOOST_PYTHON_FLEX_TABLE_SUITE_H
 #define DIALS_FRAMEWORK_TABLE_BOOST_PYTHON_FLEX_TABLE_SUITE_H
 
+#include <algorithm>
 #include <string>
 #include <iterator>
 #include <iostream>
 #include <sstream>
 #include <set>
+#include <vector>
 #include <boost/python.hpp>
 #include <boost/python/def.hpp>
 #include <boost/python/slice.hpp>
 #include <boost/python/suite/indexing/vector_indexing_suite.hpp>
 #include <boost/mpl/for_each.hpp>
+#include <boost/type_traits/has_trivial_copy.hpp>
 #include <scitbx/array_family/flex_types.h>
 #include <scitbx/array_family/boost_python/ref_pickle_double_buffered.h>
 #include <scitbx/boost_python/slice.h>
 #include <scitbx/boost_python/utils.h>
 #include <dials/array_family/flex_table.h>
+#include <dials/array_family/memory_usage.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 #include <dxtbx/model/experiment.h>
 #include <dxtbx/model/experiment_list.h>
@@ -75,31 +80,6 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     }
   };
 
-  /**
-   * A visitor to append column data from 1 table to another
-   */
-  template <typename T>
-  struct extend_column_visitor : public boost::static_visitor<void> {
-    T &self;
-    typename T::key_type key;
-    typename T::size_type na, nb;
-
-    extend_column_visitor(T &self_,
-                          typename T::key_type key_,
-                          typename T::size_type na_,
-                          typename T::size_type nb_)
-        : self(self_), key(key_), na(na_), nb(nb_) {}
-
-    template <typename U>
-    void operator()(const U &other_column) {
-      U self_column = self[key];
-      DIALS_ASSERT(na + nb == self_column.size());
-      for (typename T::size_type i = 0; i < nb; ++i) {
-        self_column[na + i] = other_column[i];
-      }
-    }
-  };
-
   /**
    * A visitor to add new columns (and over-write old columns) in the table.
    */
@@ -196,30 +176,6 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     }
   };
 
-  /**
-   * Copy the selected rows from the input column to a output column.
-   */
-  template <typename T>
-  struct copy_from_indices_visitor : public boost::static_visitor<void> {
-    T &result;
-    typename T::key_type key;
-    af::const_ref<std::size_t> index;
-
-    copy_from_indices_visitor(T &result_,
-                              typename T::key_type key_,
-                              af::const_ref<std::size_t> index_)
-        : result(result_), key(key_), index(index_) {}
-
-    template <typename U>
-    void operator()(const U &other_column) {
-      U result_column = result[key];
-      DIALS_ASSERT(result_column.size() == index.size());
-      for (std::size_t i = 0; i < index.size(); ++i) {
-        result_column[i] = other_column[index[i]];
-      }
-    }
-  };
-
   /**
    * Copy the selected rows from the input column to a output column.
    */
@@ -273,23 +229,208 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
   };
 
   /**
-   * A visitor to reorder the elements of a column
+   * The number of threads used to copy and sort the rows of large tables.
+   * This is shared by all the tables and defaults to the number of cores.
    */
-  struct reorder_visitor : public boost::static_visitor<void> {
+  inline std::size_t &table_nthreads() {
+    static std::size_t nthreads =
+      std::max((std::size_t)boost::thread::hardware_concurrency(), (std::size_t)1);
+    return nthreads;
+  }
+
+  /** Set the number of threads used for large tables */
+  inline void set_table_nthreads(std::size_t nthreads) {
+    DIALS_ASSERT(nthreads > 0);
+    table_nthreads() = nthreads;
+  }
+
+  /** @returns The number of threads used for large tables */
+  inline std::size_t get_table_nthreads() {
+    return table_nthreads();
+  }
+
+  /**
+   * The fewest rows given to a thread. Tables with fewer elements than this
+   * are copied on the calling thread.
+   */
+  const std::size_t table_chunk_rows = 1 << 16;
+
+  /**
+   * Get a column of the table, adding it with the type of the visited column
+   * if it is not there.
+   */
+  template <typename T>
+  struct make_column_visitor : public boost::static_visitor<typename T::mapped_type> {
+    T &self;
+    typename T::key_type key;
+
+    make_column_visitor(T &self_, typename T::key_type key_)
+        : self(self_), key(key_) {}
+
+    template <typename U>
+    typename T::mapped_type operator()(const U &other_column) {
+      U self_column = self[key];
+      return typename T::mapped_type(self_column);
+    }
+  };
+
+  /**
+   * Make a copy of the data in a column
+   */
+  template <typename Variant>
+  struct copy_column_data_visitor : public boost::static_visitor<Variant> {
+    template <typename U>
+    Variant operator()(const U &column) {
+      return Variant(U(column.begin(), column.end()));
+    }
+  };
+
+  /**
+   * Copy the rows picked by an index from one column to another
+   */
+  struct copy_from_indices_op {
     af::const_ref<std::size_t> index;
 
-    reorder_visitor(const af::const_ref<std::size_t> &index_) : index(index_) {}
+    copy_from_indices_op(const af::const_ref<std::size_t> &index_) : index(index_) {}
 
-    template <typename T>
-    void operator()(T &column) {
-      std::vector<typename T::value_type> temp(column.begin(), column.end());
-      DIALS_ASSERT(index.size() == column.size());
-      for (std::size_t i = 0; i < index.size(); ++i) {
-        column[i] = temp[index[i]];
+    template <typename U>
+    void operator()(const U &src, U &dst, std::size_t i0, std::size_t i1) const {
+      for (std::size_t i = i0; i < i1; ++i) {
+        dst[i] = src[index[i]];
+      }
+    }
+  };
+
+  /**
+   * Copy the rows of one column to another, starting at an offset
+   */
+  struct copy_to_offset_op {
+    std::size_t offset;
+
+    copy_to_offset_op(std::size_t offset_) : offset(offset_) {}
+
+    template <typename U>
+    void operator()(const U &src, U &dst, std::size_t i0, std::size_t i1) const {
+      for (std::size_t i = i0; i < i1; ++i) {
+        dst[offset + i] = src[i];
+      }
+    }
+  };
+
+  /**
+   * Elements which can be copied in threads. Elements such as shoeboxes hold
+   * array handles, whose reference counts are not atomic, and a handle may be
+   * shared by the elements of different rows, so they are only copied on the
+   * calling thread.
+   */
+  template <typename T>
+  struct is_thread_copyable : public boost::has_trivial_copy<T> {};
+
+  /**
+   * Apply a copy operation to a range of rows of a column. The destination
+   * column is used in place so that the column handles are not copied in
+   * threads. Only the columns whose elements are, or are not, copyable in
+   * threads are copied, as chosen by threaded.
+   */
+  template <typename Op, typename Variant>
+  struct copy_rows_visitor : public boost::static_visitor<void> {
+    const Op &op;
+    Variant &dst;
+    std::size_t i0;
+    std::size_t i1;
+    bool threaded;
+
+    copy_rows_visitor(const Op &op_,
+                      Variant &dst_,
+                      std::size_t i0_,
+                      std::size_t i1_,
+                      bool threaded_)
+        : op(op_), dst(dst_), i0(i0_), i1(i1_), threaded(threaded_) {}
+
+    template <typename U>
+    void operator()(const U &src) {
+      if (is_thread_copyable<typename U::value_type>::value != threaded) {
+        return;
+      }
+      U *column = boost::get<U>(&dst);
+      DIALS_ASSERT(column != NULL);
+      op(src, *column, i0, i1);
+    }
+  };
+
+  /**
+   * Apply a copy operation to a band of chunks of columns
+   */
+  template <typename Op, typename Variant>
+  struct copy_rows_band {
+    const Op &op;
+    const std::vector<Variant> &src;
+    std::vector<Variant> &dst;
+    std::size_t nrows;
+    std::size_t nchunks;
+    std::size_t chunk;
+
+    copy_rows_band(const Op &op_,
+                   const std::vector<Variant> &src_,
+                   std::vector<Variant> &dst_,
+                   std::size_t nrows_,
+                   std::size_t nchunks_,
+                   std::size_t chunk_)
+        : op(op_),
+          src(src_),
+          dst(dst_),
+          nrows(nrows_),
+          nchunks(nchunks_),
+          chunk(chunk_) {}
+
+    void operator()(int j0, int j1) const {
+      for (int j = j0; j < j1; ++j) {
+        std::size_t c = j / nchunks;
+        std::size_t i0 = std::min((j % nchunks) * chunk, nrows);
+        std::size_t i1 = std::min(i0 + chunk, nrows);
+        copy_rows_visitor<Op, Variant> visitor(op, dst[c], i0, i1, true);
+        src[c].apply_visitor(visitor);
       }
     }
   };
 
+  /**
+   * Apply a copy operation to the rows of pairs of columns in threads. The
+   * work is split by column and, when there are fewer columns than threads,
+   * into chunks of rows as well, so that a single large column is still
+   * shared between threads. Columns of elements which are not copyable in
+   * threads, such as shoeboxes, are copied first on the calling thread.
+   * @param op The copy operation
+   * @param src The source columns
+   * @param dst The destination columns
+   * @param nrows The number of rows to copy of each column
+   */
+  template <typename Op, typename Variant>
+  void copy_rows(const Op &op,
+                 const std::vector<Variant> &src,
+                 std::vector<Variant> &dst,
+                 std::size_t nrows) {
+    DIALS_ASSERT(src.size() == dst.size());
+    std::size_t ncols = src.size();
+    std::size_t nthreads = table_nthreads();
+    std::size_t nchunks = 1;
+    if (ncols * nrows < table_chunk_rows) {
+      nthreads = 1;
+    } else if (ncols < nthreads) {
+      nchunks = std::min((nthreads + ncols - 1) / ncols,
+                         std::max(nrows / table_chunk_rows, (std::size_t)1));
+    }
+    for (std::size_t c = 0; c < ncols; ++c) {
+      copy_rows_visitor<Op, Variant> visitor(op, dst[c], 0, nrows, false);
+      src[c].apply_visitor(visitor);
+    }
+    std::size_t chunk = (nrows + nchunks - 1) / nchunks;
+    dials::algorithms::for_each_band(
+      copy_rows_band<Op, Variant>(op, src, dst, nrows, nchunks, chunk),
+      (int)(ncols * nchunks),
+      nthreads);
+  }
+
   /**
    * Functor to compare elements by index
    */
@@ -305,6 +446,80 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     }
   };
 
+  /**
+   * Sort runs of an index by the values of a column
+   */
+  template <typename T>
+  struct sort_runs_band {
+    af::ref<std::size_t> index;
+    const T &col;
+    std::size_t run;
+
+    sort_runs_band(af::ref<std::size_t> index_, const T &col_, std::size_t run_)
+        : index(index_), col(col_), run(run_) {}
+
+    void operator()(int j0, int j1) const {
+      for (int j = j0; j < j1; ++j) {
+        std::size_t first = std::min(j * run, index.size());
+        std::size_t last = std::min(first + run, index.size());
+        std::sort(index.begin() + first, index.begin() + last, compare_index<T>(col));
+      }
+    }
+  };
+
+  /**
+   * Merge pairs of sorted runs of an index
+   */
+  template <typename T>
+  struct merge_runs_band {
+    af::ref<std::size_t> index;
+    const T &col;
+    std::size_t width;
+
+    merge_runs_band(af::ref<std::size_t> index_, const T &col_, std::size_t width_)
+        : index(index_), col(col_), width(width_) {}
+
+    void operator()(int j0, int j1) const {
+      for (int j = j0; j < j1; ++j) {
+        std::size_t first = std::min(2 * j * width, index.size());
+        std::size_t middle = std::min(first + width, index.size());
+        std::size_t last = std::min(middle + width, index.size());
+        if (middle < last) {
+          std::inplace_merge(index.begin() + first,
+                             index.begin() + middle,
+                             index.begin() + last,
+                             compare_index<T>(col));
+        }
+      }
+    }
+  };
+
+  /**
+   * Sort an index by the values of a column. Large indices are sorted in runs
+   * in threads and the runs are then merged in pairs, also in threads.
+   * @param index The index to sort
+   * @param col The column to sort by
+   */
+  template <typename T>
+  void sort_index(af::ref<std::size_t> index, const T &col) {
+    std::size_t n = index.size();
+    std::size_t nthreads =
+      std::min(table_nthreads(), std::max(n / table_chunk_rows, (std::size_t)1));
+    if (nthreads <= 1) {
+      std::sort(index.begin(), index.end(), compare_index<T>(col));
+      return;
+    }
+    std::size_t run = (n + nthreads - 1) / nthreads;
+    std::size_t nruns = (n + run - 1) / run;
+    dials::algorithms::for_each_band(
+      sort_runs_band<T>(index, col, run), (int)nruns, nthreads);
+    for (std::size_t width = run; width < n; width *= 2) {
+      std::size_t nmerges = (n + 2 * width - 1) / (2 * width);
+      dials::algorithms::for_each_band(
+        merge_runs_band<T>(index, col, width), (int)nmerges, nthreads);
+    }
+  }
+
   /**
    * A visitor to sort the table by columns
    */
@@ -319,7 +534,7 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
 
     template <typename T>
     void operator()(const T &col) {
-      std::sort(index.begin(), index.end(), compare_index<T>(col));
+      sort_index(index, col);
     }
   };
 
@@ -587,17 +802,58 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
   template <typename T>
   void extend(T &self, const T &other) {
     typedef typename T::const_iterator iterator;
+    typedef typename T::mapped_type mapped_type;
     typename T::size_type ns = self.nrows();
     typename T::size_type no = other.nrows();
     self.resize(ns + no);
+    std::vector<mapped_type> src;
+    std::vector<mapped_type> dst;
     for (iterator it = other.begin(); it != other.end(); ++it) {
-      extend_column_visitor<T> visitor(self, it->first, ns, no);
-      it->second.apply_visitor(visitor);
+      make_column_visitor<T> visitor(self, it->first);
+      dst.push_back(it->second.apply_visitor(visitor));
+      src.push_back(it->second);
     }
+    copy_rows(copy_to_offset_op(ns), src, dst, no);
     // now extend identifiers
     reflection_table_extend_identifiers(self, other);
   }
 
+  /**
+   * Join a list of tables into one. The size of the result is known before
+   * any data is copied, so each column is allocated once and each row copied
+   * once, instead of the columns being reallocated for every table as with
+   * repeated calls to extend. Columns missing from some of the tables are
+   * zero for their rows, as with extend.
+   * @param tables The list of tables
+   * @returns The joined table
+   */
+  template <typename T>
+  T concat(boost::python::list tables) {
+    typedef typename T::const_iterator iterator;
+    typedef typename T::mapped_type mapped_type;
+    std::vector<T> inputs;
+    std::size_t nrows = 0;
+    for (std::size_t i = 0; i < len(tables); ++i) {
+      inputs.push_back(extract<T>(tables[i])());
+      nrows += inputs.back().nrows();
+    }
+    T result(nrows);
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < inputs.size(); ++i) {
+      reflection_table_extend_identifiers(result, inputs[i]);
+      std::vector<mapped_type> src;
+      std::vector<mapped_type> dst;
+      for (iterator it = inputs[i].begin(); it != inputs[i].end(); ++it) {
+        make_column_visitor<T> visitor(result, it->first);
+        dst.push_back(it->second.apply_visitor(visitor));
+        src.push_back(it->second);
+      }
+      copy_rows(copy_to_offset_op(offset), src, dst, inputs[i].nrows());
+      offset += inputs[i].nrows();
+    }
+    return result;
+  }
+
   /**
    * Update the table with column data from another table. New columns are added
    * to the table and exisiting columns are over-written by columns from the
@@ -632,12 +888,16 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
       DIALS_ASSERT(index[i] < nrows);
     }
 
-    // Get the indices from the table
+    // Get the indices from the table, copying the columns in threads
     T result(index.size());
+    std::vector<typename T::mapped_type> src;
+    std::vector<typename T::mapped_type> dst;
     for (typename T::const_iterator it = self.begin(); it != self.end(); ++it) {
-      copy_from_indices_visitor<T> visitor(result, it->first, index);
-      it->second.apply_visitor(visitor);
+      make_column_visitor<T> visitor(result, it->first);
+      dst.push_back(it->second.apply_visitor(visitor));
+      src.push_back(it->second);
     }
+    copy_rows(copy_from_indices_op(index), src, dst, index.size());
 
     // Get the id column (if it exists) and make a set of unique values
     if (self.contains("id")) {
@@ -670,6 +930,7 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
   T select_rows_flags(const T &self, const af::const_ref<bool> &flags) {
     DIALS_ASSERT(self.nrows() == flags.size());
     af::shared<std::size_t> index;
+    index.reserve(std::count(flags.begin(), flags.end(), true));
     for (std::size_t i = 0; i < flags.size(); ++i) {
       if (flags[i]) index.push_back(i);
     }
@@ -944,6 +1205,22 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
     return result;
   }
 
+  /**
+   * Get the memory used by each column of the table
+   * @param self The table
+   * @returns A dictionary of the memory usage of each column
+   */
+  template <typename T>
+  dict table_memory_usage(const T &self) {
+    typedef std::map<std::string, memory_usage> usage_map;
+    usage_map usage = compute_table_memory_usage(self);
+    dict result;
+    for (usage_map::const_iterator it = usage.begin(); it != usage.end(); ++it) {
+      result[it->first] = it->second;
+    }
+    return result;
+  }
+
   /**
    * Reorder all the columns according to the input indices
    * @param self The table object
@@ -952,10 +1229,30 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
   template <typename T>
   void reorder(T &self, const af::const_ref<std::size_t> &index) {
     typedef typename T::iterator iterator;
+    typedef typename T::mapped_type mapped_type;
     DIALS_ASSERT(self.is_consistent());
-    reorder_visitor visitor(index);
-    for (iterator it = self.begin(); it != self.end(); ++it) {
-      it->second.apply_visitor(visitor);
+    if (self.empty()) {
+      return;
+    }
+    DIALS_ASSERT(index.size() == self.nrows());
+    for (std::size_t i = 0; i < index.size(); ++i) {
+      DIALS_ASSERT(index[i] < index.size());
+    }
+
+    // Reorder a group of columns at a time, one for each thread, to limit
+    // the memory held by the temporary copies
+    std::size_t group = table_nthreads();
+    copy_from_indices_op op(index);
+    iterator it = self.begin();
+    while (it != self.end()) {
+      std::vector<mapped_type> temp;
+      std::vector<mapped_type> columns;
+      for (std::size_t i = 0; i < group && it != self.end(); ++i, ++it) {
+        copy_column_data_visitor<mapped_type> visitor;
+        temp.push_back(it->second.apply_visitor(visitor));
+        columns.push_back(it->second);
+      }
+      copy_rows(op, temp, columns, index.size());
     }
   }
 
@@ -1264,6 +1561,7 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
       flex_table_class.def(init<std::size_t>())
         .def("__init__", make_constructor(&make_flex_table<flex_table_type>))
         .def("types", &types<flex_table_type>)
+        .def("memory_usage", &table_memory_usage<flex_table_type>)
         .def("has_key", &has_key<flex_table_type>)
         .def("clear", &flex_table_type::clear)
         .def("empty", &flex_table_type::empty)
@@ -1271,10 +1569,17 @@ namespace dials { namespace af { namespace boost_python { namespace flex_table_s
         .def("append", &append<flex_table_type>)
         .def("insert", &insert<flex_table_type>)
         .def("extend", &extend<flex_table_type>)
+        .def("concat", &concat<flex_table_type>)
+        .staticmethod("concat")
         .def("update", &update<flex_table_type>)
         .def("nrows", &flex_table_type::nrows)
         .def("ncols", &flex_table_type::ncols)
         .def("is_consistent", &flex_table_type::is_consistent)
+        .def("schema_version", &flex_table_type::schema_version)
+        .def("set_nthreads", &set_table_nthreads)
+        .staticmethod("set_nthreads")
+        .def("get_nthreads", &get_table_nthreads)
+        .staticmethod("get_nthreads")
         .def("size", &flex_table_type::size)
         .def("__len__", &flex_table_type::size)
         .def("__contains__", &has_key<flex_table_type>)
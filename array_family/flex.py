@@ -133,7 +133,13 @@
     PixelListShoeboxCreator,
     int6,
     observation,
+    pack_flags,
+    pack_miller_indices,
     reflection_table,
+    reflection_table_file_writer,
     reflection_table_to_list_of_reflections,
     shoebox,
+    unique_closest_pairs,
+    unpack_flags,
+    unpack_miller_indices,
 )
@@ -63,7 +63,13 @@ class _(object):
 
     @staticmethod
     def from_predictions(
-        experiment, dmin=None, dmax=None, margin=1, force_static=False, padding=0
+        experiment,
+        dmin=None,
+        dmax=None,
+        margin=1,
+        force_static=False,
+        padding=0,
+        nthreads=1,
     ):
         """
         Construct a reflection table from predictions.
@@ -74,6 +80,7 @@ def from_predictions(
         :param margin: The margin to predict around
         :param force_static: Do static prediction with a scan varying model
         :param padding: Padding in degrees
+        :param nthreads: The number of threads to use for scan prediction
         :return: The reflection table of predictions
         """
         if experiment.profile is not None:
@@ -89,6 +96,7 @@ def from_predictions(
                 margin=margin,
                 force_static=force_static,
                 padding=padding,
+                nthreads=nthreads,
             )
         from dials.algorithms.spot_prediction.reflection_predictor import (
             ReflectionPredictor,
@@ -101,12 +109,19 @@ def from_predictions(
             margin=margin,
             force_static=force_static,
             padding=padding,
+            nthreads=nthreads,
         )
         return predict()
 
     @staticmethod
     def from_predictions_multi(
-        experiments, dmin=None, dmax=None, margin=1, force_static=False, padding=0
+        experiments,
+        dmin=None,
+        dmax=None,
+        margin=1,
+        force_static=False,
+        padding=0,
+        nthreads=1,
     ):
         """
         Construct a reflection table from predictions.
@@ -117,8 +132,26 @@ def from_predictions_multi(
         :param margin: The margin to predict around
         :param force_static: Do static prediction with a scan varying model
         :param padding: Padding in degrees
+        :param nthreads: The number of threads to use for scan prediction
         :return: The reflection table of predictions
         """
+        from dxtbx.imageset import ImageSequence
+
+        # Predict all the stills in one call if there are no scans or profile
+        # models with their own prediction
+        if experiments and all(
+            e.profile is None and not isinstance(e.imageset, ImageSequence)
+            for e in experiments
+        ):
+            from dials.algorithms.spot_prediction import predict_stills
+
+            result = predict_stills(experiments, dmin=dmin)
+            if dmax is not None:
+                assert dmax > 0
+                result.compute_d(experiments)
+                result.del_selected(result["d"] > dmax)
+            return result
+
         result = dials_array_family_flex_ext.reflection_table()
         for i, e in enumerate(experiments):
             rlist = dials_array_family_flex_ext.reflection_table.from_predictions(
@@ -128,6 +161,7 @@ def from_predictions_multi(
                 margin=margin,
                 force_static=force_static,
                 padding=padding,
+                nthreads=nthreads,
             )
             rlist["id"] = cctbx.array_family.flex.int(len(rlist), i)
             if e.identifier:
@@ -152,18 +186,6 @@ def from_observations(experiments, params=None):
 
             params = phil_scope.fetch(source=parse("")).extract()
 
-        if params.spotfinder.filter.min_spot_size is libtbx.Auto:
-            detector = experiments[0].imageset.get_detector()
-            if detector[0].get_type() == "SENSOR_PAD":
-                # smaller default value for pixel array detectors
-                params.spotfinder.filter.min_spot_size = 3
-            else:
-                params.spotfinder.filter.min_spot_size = 6
-            logger.info(
-                "Setting spotfinder.filter.min_spot_size=%i",
-                params.spotfinder.filter.min_spot_size,
-            )
-
         # Get the integrator from the input parameters
         logger.info("Configuring spot finder from input parameters")
         find_spots = SpotFinderFactory.from_parameters(
@@ -191,27 +213,54 @@ def from_pickle(filename):
             assert isinstance(result, dials_array_family_flex_ext.reflection_table)
             return result
 
-    def as_msgpack_file(self, filename):
+    def as_msgpack_file(self, filename, nthreads=1, compress_shoeboxes=False):
         """
         Write the reflection table to file in msgpack format
+
+        :param filename: The msgpack filename
+        :param nthreads: The number of threads used to pack the columns
+        :param compress_shoeboxes: Compress the shoebox arrays. Files written
+                                   with compressed shoeboxes cannot be read by
+                                   older versions of DIALS.
         """
         if filename and hasattr(filename, "__fspath__"):
             filename = filename.__fspath__()
         with libtbx.smart_open.for_writing(filename, "wb") as outfile:
-            self.as_msgpack_to_file(dials.util.ext.streambuf(python_file_obj=outfile))
+            self.as_msgpack_to_file(
+                dials.util.ext.streambuf(python_file_obj=outfile),
+                nthreads,
+                compress_shoeboxes,
+            )
 
     @staticmethod
-    def from_msgpack_file(filename):
+    def from_msgpack_file(filename, columns=None):
         """
         Read the reflection table from file in msgpack format
+
+        :param filename: The msgpack filename
+        :param columns: A list of the column names to read or a function taking
+                        the column name and returning True if the column is to
+                        be read. If None then all columns are read.
+        :return: The reflection table
         """
         if filename and hasattr(filename, "__fspath__"):
             filename = filename.__fspath__()
         with libtbx.smart_open.for_reading(filename, "rb") as infile:
             return dials_array_family_flex_ext.reflection_table.from_msgpack(
-                infile.read()
+                infile.read(), columns
             )
 
+    def as_mapped_file(self, filename):
+        """
+        Write the reflection table to file in the memory mapped format. The
+        columns are stored uncompressed so that they can be read quickly and
+        individually. The file is not portable between machines with a
+        different byte order.
+        """
+        if filename and hasattr(filename, "__fspath__"):
+            filename = filename.__fspath__()
+        self.write_mapped_file(filename)
+
     def as_file(self, filename):
         """
         Write the reflection table to file in either msgpack or pickle format
@@ -222,16 +271,36 @@ def as_file(self, filename):
             self.as_msgpack_file(filename)
 
     @staticmethod
-    def from_file(filename):
+    def from_file(filename, columns=None):
         """
-        Read the reflection table from either pickle or msgpack
+        Read the reflection table from either pickle, msgpack or the memory
+        mapped format
+
+        :param filename: The reflection filename
+        :param columns: A list of the column names to read or a function taking
+                        the column name and returning True if the column is to
+                        be read. If None then all columns are read.
+        :return: The reflection table
         """
+        if filename and hasattr(filename, "__fspath__"):
+            filename = filename.__fspath__()
+        if dials_array_family_flex_ext.reflection_table.is_mapped_file(filename):
+            return dials_array_family_flex_ext.reflection_table.from_mapped_file(
+                filename, columns
+            )
         try:
             return dials_array_family_flex_ext.reflection_table.from_msgpack_file(
-                filename
+                filename, columns
             )
         except RuntimeError:
-            return dials_array_family_flex_ext.reflection_table.from_pickle(filename)
+            table = dials_array_family_flex_ext.reflection_table.from_pickle(filename)
+            if columns is None:
+                return table
+            if callable(columns):
+                keys = [key for key in table.keys() if columns(key)]
+            else:
+                keys = list(columns)
+            return table.select(tuple(keys))
 
     @staticmethod
     def empty_standard(nrows):
@@ -421,19 +490,57 @@ def sort(self, name, reverse=False, order=None):
         """
         Sort the reflection table by a key.
 
-        :param name: The name of the column
+        Integer columns and Miller indices are sorted with a stable radix sort
+        in C++; other columns fall back to sorting in Python.
+
+        :param name: The name of the column, or a list of names to sort by in
+                     turn, the first being the most significant
         :param reverse: Reverse the sort order
         :param order: For multi element items specify order
         """
-
-        if type(self[name]) in (
+        names = [name] if isinstance(name, six.string_types) else list(name)
+
+        # Build the integer keys for the radix sort, if all the columns have them
+        keys = []
+        for key in names:
+            column_type = type(self[key])
+            if column_type in (
+                cctbx.array_family.flex.bool,
+                cctbx.array_family.flex.int,
+                cctbx.array_family.flex.size_t,
+            ):
+                keys.append(key)
+            elif column_type in (
+                cctbx.array_family.flex.miller_index,
+                dials_array_family_flex_ext.int6,
+            ):
+                size = 3 if column_type is cctbx.array_family.flex.miller_index else 6
+                if order:
+                    assert len(order) == size
+                    keys.extend((key, i) for i in order)
+                else:
+                    keys.extend((key, i) for i in range(size))
+            else:
+                keys = None
+                break
+
+        if keys is not None:
+            perm = self.sort_permutation(keys, reverse=reverse)
+        elif len(names) > 1:
+            columns = [self[key] for key in names]
+            perm = cctbx.array_family.flex.size_t(
+                sorted(
+                    range(len(self)),
+                    key=lambda x: tuple(column[x] for column in columns),
+                    reverse=reverse,
+                )
+            )
+        elif type(self[names[0]]) in (
             cctbx.array_family.flex.vec2_double,
             cctbx.array_family.flex.vec3_double,
             cctbx.array_family.flex.mat3_double,
-            dials_array_family_flex_ext.int6,
-            cctbx.array_family.flex.miller_index,
         ):
-            data = self[name]
+            data = self[names[0]]
             if not order:
                 perm = cctbx.array_family.flex.size_t(
                     sorted(range(len(self)), key=lambda x: data[x], reverse=reverse)
@@ -449,7 +556,7 @@ def sort(self, name, reverse=False, order=None):
                 )
         else:
             perm = cctbx.array_family.flex.sort_permutation(
-                self[name], reverse=reverse, stable=True
+                self[names[0]], reverse=reverse, stable=True
             )
         self.reorder(perm)
 
@@ -496,74 +603,19 @@ def match_with_reference(self, other):
         logger.info(" %d observed reflections input" % len(other))
         logger.info(" %d reflections predicted" % len(self))
 
-        # Get the miller index, entering flag and turn number for
-        # Both sets of reflections
-        i1 = self["id"]
-        h1 = self["miller_index"]
-        e1 = self["entering"].as_int()
-        x1, y1, z1 = self["xyzcal.px"].parts()
-        p1 = self["panel"]
-
-        i2 = other["id"]
-        h2 = other["miller_index"]
-        e2 = other["entering"].as_int()
-        x2, y2, z2 = other["xyzcal.px"].parts()
-        p2 = other["panel"]
-
-        class Match(object):
-            def __init__(self):
-                self.a = []
-                self.b = []
-
-        # Create the match lookup
-        lookup = collections.defaultdict(Match)
-        for i in range(len(self)):
-            item = h1[i] + (e1[i], i1[i], p1[i])
-            lookup[item].a.append(i)
-
-        # Add matches from input reflections
-        for i in range(len(other)):
-            item = h2[i] + (e2[i], i2[i], p2[i])
-            if item in lookup:
-                lookup[item].b.append(i)
-
-        # Create the list of matches
-        match1 = []
-        match2 = []
-        for item, value in lookup.items():
-            if len(value.b) == 0:
-                continue
-            elif len(value.a) == 1 and len(value.b) == 1:
-                match1.append(value.a[0])
-                match2.append(value.b[0])
-            else:
-                matched = {}
-                for i in value.a:
-                    d = []
-                    for j in value.b:
-                        dx = x1[i] - x2[j]
-                        dy = y1[i] - y2[j]
-                        dz = z1[i] - z2[j]
-                        d.append((i, j, dx ** 2 + dy ** 2 + dz ** 2))
-                    i, j, d = min(d, key=lambda x: x[2])
-                    if j not in matched:
-                        matched[j] = (i, d)
-                    elif d < matched[j][1]:
-                        matched[j] = (i, d)
-                for key1, value1 in matched.items():
-                    match1.append(value1[0])
-                    match2.append(key1)
-
-        # Select everything which matches
-        sind = cctbx.array_family.flex.size_t(match1)
-        oind = cctbx.array_family.flex.size_t(match2)
-
-        # Sort by self index
-        sort_index = cctbx.array_family.flex.size_t(
-            sorted(range(len(sind)), key=lambda x: sind[x])
+        # Find the pairs of reflections with the same Miller index, entering
+        # flag, experiment and panel
+        keys = ["miller_index", "entering", "id", "panel"]
+        pair1, pair2 = self.hash_join(other, keys)
+
+        # Keep the closest pair of each predicted reflection, then the closest
+        # of those pairs for each reference reflection
+        distance = (
+            self["xyzcal.px"].select(pair1) - other["xyzcal.px"].select(pair2)
+        ).norms()
+        sind, oind = dials_array_family_flex_ext.unique_closest_pairs(
+            pair1, pair2, distance
         )
-        sind = sind.select(sort_index)
-        oind = oind.select(sort_index)
 
         s2 = self.select(sind)
         o2 = other.select(oind)
@@ -667,13 +719,14 @@ def compute_d(self, experiments):
         )
         return self["d"]
 
-    def compute_bbox(self, experiments, sigma_b_multiplier=2.0):
+    def compute_bbox(self, experiments, sigma_b_multiplier=2.0, nthreads=1):
         """
         Compute the bounding boxes.
 
         :param experiments: The list of experiments
         :param profile_model: The profile models
         :param sigma_b_multiplier: Multiplier to cover extra background
+        :param nthreads: The number of threads to use
         :return: The bounding box for each reflection
         """
         self["bbox"] = dials_array_family_flex_ext.int6(len(self))
@@ -688,16 +741,18 @@ def compute_bbox(self, experiments, sigma_b_multiplier=2.0):
                     expr.goniometer,
                     expr.scan,
                     sigma_b_multiplier=sigma_b_multiplier,
+                    nthreads=nthreads,
                 ),
             )
         return self["bbox"]
 
-    def compute_partiality(self, experiments):
+    def compute_partiality(self, experiments, nthreads=1):
         """
         Compute the reflection partiality.
 
         :param experiments: The experiment list
         :param profile_model: The profile models
+        :param nthreads: The number of threads to use
         :return: The partiality for each reflection
         """
         self["partiality"] = cctbx.array_family.flex.double(len(self))
@@ -711,6 +766,7 @@ def compute_partiality(self, experiments):
                     expr.detector,
                     expr.goniometer,
                     expr.scan,
+                    nthreads=nthreads,
                 ),
             )
         return self["partiality"]
@@ -793,11 +849,12 @@ def compute_fitted_intensity(self, fitter):
         success = fitter.fit(self)
         self.set_flags(~success, self.flags.failed_during_profile_fitting)
 
-    def compute_corrections(self, experiments):
+    def compute_corrections(self, experiments, nthreads=1):
         """
         Helper function to correct the intensity.
 
         :param experiments: The list of experiments
+        :param nthreads: The number of threads to use
         :return: The LP correction for each reflection
         """
         from dials.algorithms.integration import Corrections, CorrectionsMulti
@@ -812,10 +869,10 @@ def compute_corrections(self, experiments):
                 )
             else:
                 compute.append(Corrections(experiment.beam, experiment.detector))
-        lp = compute.lp(self["id"], self["s1"])
+        lp = compute.lp(self["id"], self["s1"], nthreads=nthreads)
         self["lp"] = lp
         if experiment.detector[0].get_mu() > 0:
-            qe = compute.qe(self["id"], self["s1"], self["panel"])
+            qe = compute.qe(self["id"], self["s1"], self["panel"], nthreads=nthreads)
             self["qe"] = qe
         return lp
 
@@ -839,7 +896,7 @@ def extract_shoeboxes(self, imageset, mask=None, nthreads=1):
         except Exception:
             frame0, frame1 = (0, len(imageset))
         extractor = dials_array_family_flex_ext.ShoeboxExtractor(
-            self, len(detector), frame0, frame1
+            self, len(detector), frame0, frame1, nthreads=nthreads
         )
         logger.info(" Beginning to read images")
         read_time = 0
@@ -1257,6 +1314,59 @@ def get(self, key, default=None):
             return self[key]
         return default
 
+    def memory_report(self, prefix=""):
+        """
+        Make a table of the memory used by each column, largest first. The
+        array bytes are those of the column itself and the element bytes those
+        owned by its elements, such as the pixels of shoeboxes. Shared bytes
+        would not be freed along with the table, because something else, such
+        as another table or a python object, refers to them too.
+
+        :param prefix: A prefix for each line of the table
+        :returns: The table as a string
+        """
+        from dials.util import tabulate
+
+        usage = self.memory_usage()
+        rows = []
+        total = [0, 0, 0]
+        for name in sorted(usage, key=lambda k: usage[k].total_bytes(), reverse=True):
+            u = usage[name]
+            rows.append(
+                [
+                    name,
+                    "%.1f" % (u.array_bytes / 1e6),
+                    "%.1f" % (u.element_bytes / 1e6),
+                    "%.1f" % (u.shared_bytes / 1e6),
+                    u.use_count,
+                ]
+            )
+            total[0] += u.array_bytes
+            total[1] += u.element_bytes
+            total[2] += u.shared_bytes
+        rows.append(["Total"] + ["%.1f" % (t / 1e6) for t in total] + [""])
+        table = tabulate(
+            rows, ["Column", "Array (MB)", "Elements (MB)", "Shared (MB)", "Refs"]
+        )
+        return "\n".join(prefix + line for line in table.split("\n"))
+
+
+@boost_adaptbx.boost.python.inject_into(
+    dials_array_family_flex_ext.reflection_table_file_writer
+)
+class _(object):
+    """
+    Write reflection tables to a file in chunks, each flushed to disk as it is
+    appended. The file is read as one table with reflection_table.from_file,
+    and a file which was not closed holds the chunks completely written.
+    """
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
 
 class reflection_table_selector(object):
     """
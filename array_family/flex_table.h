@@ -36,6 +36,63 @@ namespace dials { namespace af {
     return ElementType();
   }
 
+  /**
+   * A typed handle to a column of a flex_table. The column is looked up once
+   * when the handle is made, so code which accesses a column repeatedly can
+   * keep the handle instead of finding the column by name each time. The
+   * handle shares the column data and is valid until a column is added to or
+   * removed from the table, after which it must be made again.
+   */
+  template <typename T>
+  class flex_table_column {
+  public:
+    typedef T value_type;
+
+    flex_table_column() : version_(0) {}
+
+    /**
+     * @param data The column data
+     * @param schema The schema version of the table
+     */
+    flex_table_column(const af::shared<T> &data,
+                      const boost::shared_ptr<std::size_t> &schema)
+        : data_(data), schema_(schema), version_(*schema) {}
+
+    /** @returns True/False the table columns have not changed */
+    bool is_valid() const {
+      return schema_ && *schema_ == version_;
+    }
+
+    /** @returns The number of elements in the column */
+    std::size_t size() const {
+      return data_.size();
+    }
+
+    /** @returns The column data */
+    af::shared<T> data() const {
+      DIALS_ASSERT(is_valid());
+      return data_;
+    }
+
+    /** @returns A reference to the column data */
+    af::ref<T> ref() const {
+      DIALS_ASSERT(is_valid());
+      af::shared<T> data = data_;
+      return data.ref();
+    }
+
+    /** @returns A const reference to the column data */
+    af::const_ref<T> const_ref() const {
+      DIALS_ASSERT(is_valid());
+      return data_.const_ref();
+    }
+
+  private:
+    af::shared<T> data_;
+    boost::shared_ptr<std::size_t> schema_;
+    std::size_t version_;
+  };
+
   /**
    * A class to represent a column-centric table. I.e. a table in which the
    * data is represented as a list of columns. It is created with a variant
@@ -47,6 +104,10 @@ namespace dials { namespace af {
    * The columns can be accessed as values in a std::map as follows:
    *
    * af::shared<int> col = table["column"];
+   *
+   * or through a typed handle which is looked up once:
+   *
+   * flex_table_column<int> col = table.column<int>("column");
    */
   template <typename VarientType>
   class flex_table {
@@ -75,6 +136,7 @@ namespace dials { namespace af {
         if (it == table->end() || table->key_comp()(k_, it->first)) {
           it = table->insert(
             it, map_value_type(k_, mapped_type(af::shared<T>(n, init_zero<T>()))));
+          ++(*t_->schema_);
         }
         af::shared<T> this_column = boost::get<af::shared<T> >(it->second);
         DIALS_ASSERT(this_column.size() == other_column.size());
@@ -134,6 +196,7 @@ namespace dials { namespace af {
         if (it == table->end() || table->key_comp()(k_, it->first)) {
           it = table->insert(
             it, map_value_type(k_, mapped_type(af::shared<T>(n, init_zero<T>()))));
+          ++(*t_->schema_);
         }
         return boost::get<af::shared<T> >(it->second);
       }
@@ -212,14 +275,19 @@ namespace dials { namespace af {
 
   public:
     /** Initialise the table */
-    flex_table() : table_(boost::make_shared<map_type>()), default_nrows_(0) {}
+    flex_table()
+        : table_(boost::make_shared<map_type>()),
+          schema_(boost::make_shared<std::size_t>(0)),
+          default_nrows_(0) {}
 
     /**
      * Initialise the table to a certain size
      * @param n The size to initialise to
      */
     flex_table(size_type n)
-        : table_(boost::make_shared<map_type>()), default_nrows_(n) {}
+        : table_(boost::make_shared<map_type>()),
+          schema_(boost::make_shared<std::size_t>(0)),
+          default_nrows_(n) {}
 
     /**
      * Virtual destructor
@@ -258,6 +326,33 @@ namespace dials { namespace af {
       return boost::get<af::shared<T> >(it->second);
     }
 
+    /**
+     * Get a typed handle to a column, creating the column if needed
+     * @param key The column name
+     * @returns The column handle
+     */
+    template <typename T>
+    flex_table_column<T> column(const key_type &key) {
+      return flex_table_column<T>(get<T>(key), schema_);
+    }
+
+    /**
+     * Get a typed handle to an existing column
+     * @param key The column name
+     * @returns The column handle
+     */
+    template <typename T>
+    flex_table_column<T> column(const key_type &key) const {
+      return flex_table_column<T>(get<T>(key), schema_);
+    }
+
+    /**
+     * @returns A number which changes whenever a column is added or removed
+     */
+    std::size_t schema_version() const {
+      return *schema_;
+    }
+
     /** @returns An iterator to the beginning of the column map */
     iterator begin() {
       return table_->begin();
@@ -415,12 +510,31 @@ namespace dials { namespace af {
      * @returns The number of columns removed
      */
     size_type erase(const key_type &key) {
-      return table_->erase(key);
+      size_type n = table_->erase(key);
+      if (n > 0) {
+        ++(*schema_);
+      }
+      return n;
+    }
+
+    /**
+     * Add a column to the table without copying the data. Any existing column
+     * with the same key is replaced and the new column is shared with the
+     * caller rather than copied element by element.
+     * @param key The column name
+     * @param column The column data
+     */
+    void insert_column(const key_type &key, const mapped_type &column) {
+      size_visitor visitor;
+      DIALS_ASSERT(column.apply_visitor(visitor) == nrows());
+      (*table_)[key] = column;
+      ++(*schema_);
     }
 
     /** Clear the table */
     void clear() {
       table_->clear();
+      ++(*schema_);
       resize(0);
     }
 
@@ -432,6 +546,7 @@ namespace dials { namespace af {
 
   private:
     boost::shared_ptr<map_type> table_;
+    boost::shared_ptr<std::size_t> schema_;
     size_type default_nrows_;
   };
 
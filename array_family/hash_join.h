@@ -0,0 +1,312 @@
+/*
+ * hash_join.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ARRAY_FAMILY_HASH_JOIN_H
+#define DIALS_ARRAY_FAMILY_HASH_JOIN_H
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace af {
+
+  /**
+   * Mix the bits of a 64 bit value, as in the splitmix64 generator
+   */
+  inline boost::uint64_t hash_mix(boost::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  }
+
+  /**
+   * The integer keys of the rows of a table, made of one or more components.
+   * Each component is read in place from an array of bool, int or size_t
+   * values with a stride, so that a component of an array of integer
+   * vectors, such as the h of an array of Miller indices, can be used
+   * without a copy.
+   */
+  class JoinKeys {
+  public:
+    /**
+     * @param size The number of rows
+     */
+    JoinKeys(std::size_t size) : size_(size) {}
+
+    /** Add a component read from an array of bool */
+    void add(const bool *data, std::size_t stride = 1) {
+      components_.push_back(Component(data, Bool, stride));
+    }
+
+    /** Add a component read from an array of int */
+    void add(const int *data, std::size_t stride = 1) {
+      components_.push_back(Component(data, Int, stride));
+    }
+
+    /** Add a component read from an array of size_t */
+    void add(const std::size_t *data, std::size_t stride = 1) {
+      components_.push_back(Component(data, Size, stride));
+    }
+
+    /** @returns The number of rows */
+    std::size_t size() const {
+      return size_;
+    }
+
+    /** @returns The number of components of each key */
+    std::size_t num_components() const {
+      return components_.size();
+    }
+
+    /** @returns The value of a component of the key of a row */
+    boost::int64_t value(std::size_t c, std::size_t i) const {
+      const Component &comp = components_[c];
+      std::size_t k = i * comp.stride;
+      switch (comp.type) {
+      case Bool:
+        return static_cast<const bool *>(comp.data)[k] ? 1 : 0;
+      case Int:
+        return static_cast<const int *>(comp.data)[k];
+      default:
+        return (boost::int64_t) static_cast<const std::size_t *>(comp.data)[k];
+      }
+    }
+
+    /** @returns The hash of the key of a row */
+    boost::uint64_t hash(std::size_t i) const {
+      boost::uint64_t h = 0;
+      for (std::size_t c = 0; c < components_.size(); ++c) {
+        h = hash_mix(h ^ (boost::uint64_t)value(c, i));
+      }
+      return h;
+    }
+
+    /** @returns True if the key of a row equals that of a row of another */
+    bool equal(std::size_t i, const JoinKeys &other, std::size_t j) const {
+      DIALS_ASSERT(other.num_components() == num_components());
+      for (std::size_t c = 0; c < components_.size(); ++c) {
+        if (value(c, i) != other.value(c, j)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+  private:
+    enum Type { Bool, Int, Size };
+
+    struct Component {
+      const void *data;
+      Type type;
+      std::size_t stride;
+
+      Component(const void *data_, Type type_, std::size_t stride_)
+          : data(data_), type(type_), stride(stride_) {}
+    };
+
+    std::vector<Component> components_;
+    std::size_t size_;
+  };
+
+  namespace detail {
+
+    /**
+     * Compute the hashes of a band of keys
+     */
+    struct HashKeysBand {
+      const JoinKeys &keys;
+      std::vector<boost::uint64_t> &hashes;
+
+      HashKeysBand(const JoinKeys &keys_, std::vector<boost::uint64_t> &hashes_)
+          : keys(keys_), hashes(hashes_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          hashes[i] = keys.hash(i);
+        }
+      }
+    };
+
+    /**
+     * Probe the hash table with the rows of bands of the first table
+     */
+    struct ProbeKeysBand {
+      const JoinKeys &a;
+      const JoinKeys &b;
+      const std::vector<boost::uint64_t> &hash_b;
+      const std::vector<std::size_t> &start;
+      const std::vector<std::size_t> &entries;
+      std::size_t band;
+      std::vector<std::vector<std::pair<std::size_t, std::size_t> > > &pairs;
+
+      ProbeKeysBand(
+        const JoinKeys &a_,
+        const JoinKeys &b_,
+        const std::vector<boost::uint64_t> &hash_b_,
+        const std::vector<std::size_t> &start_,
+        const std::vector<std::size_t> &entries_,
+        std::size_t band_,
+        std::vector<std::vector<std::pair<std::size_t, std::size_t> > > &pairs_)
+          : a(a_),
+            b(b_),
+            hash_b(hash_b_),
+            start(start_),
+            entries(entries_),
+            band(band_),
+            pairs(pairs_) {}
+
+      void operator()(int b0, int b1) const {
+        std::size_t mask = start.size() - 2;
+        for (int k = b0; k < b1; ++k) {
+          std::size_t first = std::min(k * band, a.size());
+          std::size_t last = std::min(first + band, a.size());
+          for (std::size_t i = first; i < last; ++i) {
+            boost::uint64_t h = a.hash(i);
+            std::size_t bucket = (std::size_t)h & mask;
+            for (std::size_t e = start[bucket]; e < start[bucket + 1]; ++e) {
+              std::size_t j = entries[e];
+              if (hash_b[j] == h && a.equal(i, b, j)) {
+                pairs[k].push_back(std::make_pair(i, j));
+              }
+            }
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Find all the pairs of rows of two tables which have equal keys. A hash
+   * table of the keys of the second table is built once and probed with the
+   * keys of the first table in bands across threads. The pairs are returned
+   * in order of the row of the first table, then of the second.
+   * @param a The keys of the first table
+   * @param b The keys of the second table
+   * @param index_a The row of the first table of each pair
+   * @param index_b The row of the second table of each pair
+   * @param nthreads The number of threads to use
+   */
+  inline void hash_join(const JoinKeys &a,
+                        const JoinKeys &b,
+                        af::shared<std::size_t> index_a,
+                        af::shared<std::size_t> index_b,
+                        std::size_t nthreads = 1) {
+    const std::size_t min_band = 1 << 14;
+    DIALS_ASSERT(nthreads > 0);
+    DIALS_ASSERT(a.num_components() == b.num_components());
+    DIALS_ASSERT(a.num_components() > 0);
+
+    // Hash the keys of the second table into a power of two of buckets,
+    // keeping the rows of each bucket in order
+    std::vector<boost::uint64_t> hash_b(b.size());
+    dials::algorithms::for_each_band(
+      detail::HashKeysBand(b, hash_b), (int)b.size(), nthreads);
+    std::size_t nbuckets = 1;
+    while (nbuckets < 2 * b.size()) {
+      nbuckets *= 2;
+    }
+    std::size_t mask = nbuckets - 1;
+    std::vector<std::size_t> start(nbuckets + 1, 0);
+    for (std::size_t j = 0; j < b.size(); ++j) {
+      start[((std::size_t)hash_b[j] & mask) + 1]++;
+    }
+    for (std::size_t k = 0; k < nbuckets; ++k) {
+      start[k + 1] += start[k];
+    }
+    std::vector<std::size_t> entries(b.size());
+    {
+      std::vector<std::size_t> offset(start.begin(), start.end() - 1);
+      for (std::size_t j = 0; j < b.size(); ++j) {
+        entries[offset[(std::size_t)hash_b[j] & mask]++] = j;
+      }
+    }
+
+    // Probe the table with bands of the first table
+    std::size_t nbands =
+      std::min(nthreads, std::max(a.size() / min_band, (std::size_t)1));
+    std::size_t band = std::max((a.size() + nbands - 1) / nbands, (std::size_t)1);
+    std::vector<std::vector<std::pair<std::size_t, std::size_t> > > pairs(nbands);
+    dials::algorithms::for_each_band(
+      detail::ProbeKeysBand(a, b, hash_b, start, entries, band, pairs),
+      (int)nbands,
+      nthreads);
+    for (std::size_t k = 0; k < pairs.size(); ++k) {
+      for (std::size_t p = 0; p < pairs[k].size(); ++p) {
+        index_a.push_back(pairs[k][p].first);
+        index_b.push_back(pairs[k][p].second);
+      }
+    }
+  }
+
+  /**
+   * Reduce a set of candidate pairs of rows of two tables to one to one
+   * matches. Each row of the first table keeps its closest pair, and each
+   * row of the second table is then kept by the closest of the rows that
+   * chose it. Ties are won by the first pair. The matches are returned in
+   * order of the row of the first table.
+   * @param index_a The row of the first table of each pair
+   * @param index_b The row of the second table of each pair
+   * @param distance The distance between the rows of each pair
+   * @param match_a The row of the first table of each match
+   * @param match_b The row of the second table of each match
+   */
+  inline void unique_closest_pairs(const af::const_ref<std::size_t> &index_a,
+                                   const af::const_ref<std::size_t> &index_b,
+                                   const af::const_ref<double> &distance,
+                                   af::shared<std::size_t> match_a,
+                                   af::shared<std::size_t> match_b) {
+    const std::size_t none = std::numeric_limits<std::size_t>::max();
+    DIALS_ASSERT(index_b.size() == index_a.size());
+    DIALS_ASSERT(distance.size() == index_a.size());
+    std::size_t na = 0;
+    std::size_t nb = 0;
+    for (std::size_t k = 0; k < index_a.size(); ++k) {
+      na = std::max(na, index_a[k] + 1);
+      nb = std::max(nb, index_b[k] + 1);
+    }
+
+    // The closest pair of each row of the first table
+    std::vector<std::size_t> best_a(na, none);
+    for (std::size_t k = 0; k < index_a.size(); ++k) {
+      std::size_t &best = best_a[index_a[k]];
+      if (best == none || distance[k] < distance[best]) {
+        best = k;
+      }
+    }
+
+    // The closest of those pairs for each row of the second table
+    std::vector<std::size_t> best_b(nb, none);
+    for (std::size_t i = 0; i < na; ++i) {
+      std::size_t k = best_a[i];
+      if (k != none) {
+        std::size_t &best = best_b[index_b[k]];
+        if (best == none || distance[k] < distance[best]) {
+          best = k;
+        }
+      }
+    }
+    for (std::size_t i = 0; i < na; ++i) {
+      std::size_t k = best_a[i];
+      if (k != none && best_b[index_b[k]] == k) {
+        match_a.push_back(i);
+        match_b.push_back(index_b[k]);
+      }
+    }
+  }
+
+}}  // namespace dials::af
+
+#endif  // DIALS_ARRAY_FAMILY_HASH_JOIN_H
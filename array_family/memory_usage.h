@@ -0,0 +1,173 @@
+/*
+ * memory_usage.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+#ifndef DIALS_ARRAY_FAMILY_MEMORY_USAGE_H
+#define DIALS_ARRAY_FAMILY_MEMORY_USAGE_H
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <boost/variant.hpp>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/model/data/shoebox.h>
+
+namespace dials { namespace af {
+
+  /**
+   * The memory used by an array, or a column of a table, in bytes. The array
+   * bytes are those of the allocation of the array itself and the element
+   * bytes are those of the arrays owned by its elements, such as the pixels
+   * of shoeboxes. An allocation which is also referred to from elsewhere,
+   * such as another table or a python object, is counted as shared, so it
+   * would not be freed along with the array. An allocation found more than
+   * once, for example in two columns which are the same array, is counted
+   * only the first time.
+   */
+  struct memory_usage {
+    std::size_t array_bytes;
+    std::size_t element_bytes;
+    std::size_t shared_bytes;
+    std::size_t use_count;
+
+    memory_usage() : array_bytes(0), element_bytes(0), shared_bytes(0), use_count(0) {}
+
+    /** @returns The total number of bytes */
+    std::size_t total_bytes() const {
+      return array_bytes + element_bytes;
+    }
+
+    memory_usage &operator+=(const memory_usage &other) {
+      array_bytes += other.array_bytes;
+      element_bytes += other.element_bytes;
+      shared_bytes += other.shared_bytes;
+      use_count = std::max(use_count, other.use_count);
+      return *this;
+    }
+  };
+
+  namespace detail {
+
+    /**
+     * Count the allocation of an array, if it has not been seen before
+     * @param a The array
+     * @param seen The allocations seen so far
+     * @param shared The number of bytes of the array if it is shared
+     * @returns The number of bytes allocated
+     */
+    template <typename ArrayType>
+    std::size_t allocation_bytes(const ArrayType &a,
+                                 std::set<const void *> &seen,
+                                 std::size_t &shared) {
+      std::size_t nbytes = a.capacity() * sizeof(typename ArrayType::value_type);
+      if (nbytes == 0 || !seen.insert((const void *)a.begin()).second) {
+        return 0;
+      }
+      if (a.use_count() > 1) {
+        shared += nbytes;
+      }
+      return nbytes;
+    }
+
+    /**
+     * The memory owned by an element. Most elements own none.
+     */
+    template <typename T>
+    std::size_t element_bytes(const T &, std::set<const void *> &, std::size_t &) {
+      return 0;
+    }
+
+    inline std::size_t element_bytes(const std::string &s,
+                                     std::set<const void *> &,
+                                     std::size_t &) {
+      return s.capacity();
+    }
+
+    template <typename FloatType>
+    std::size_t element_bytes(const dials::model::Shoebox<FloatType> &s,
+                              std::set<const void *> &seen,
+                              std::size_t &shared) {
+      return allocation_bytes(s.data, seen, shared)
+             + allocation_bytes(s.mask, seen, shared)
+             + allocation_bytes(s.background, seen, shared);
+    }
+
+  }  // namespace detail
+
+  /**
+   * Compute the memory used by the elements of an array. The allocation of
+   * the array itself is not known from a reference and is taken to be its
+   * size.
+   * @param a The array
+   * @param seen The allocations already counted
+   * @returns The memory usage
+   */
+  template <typename T>
+  memory_usage compute_memory_usage(const af::const_ref<T> &a,
+                                    std::set<const void *> &seen) {
+    memory_usage result;
+    result.array_bytes = a.size() * sizeof(T);
+    for (std::size_t i = 0; i < a.size(); ++i) {
+      result.element_bytes += detail::element_bytes(a[i], seen, result.shared_bytes);
+    }
+    return result;
+  }
+
+  /**
+   * Compute the memory used by an array and its elements
+   * @param a The array
+   * @param seen The allocations already counted
+   * @returns The memory usage
+   */
+  template <typename T>
+  memory_usage compute_memory_usage(const af::shared<T> &a,
+                                    std::set<const void *> &seen) {
+    memory_usage result = compute_memory_usage(a.const_ref(), seen);
+    result.use_count = a.use_count();
+    result.array_bytes = detail::allocation_bytes(a, seen, result.shared_bytes);
+    return result;
+  }
+
+  namespace detail {
+
+    /**
+     * Visitor to compute the memory used by a column of a table
+     */
+    struct memory_usage_visitor : public boost::static_visitor<memory_usage> {
+      std::set<const void *> &seen;
+
+      memory_usage_visitor(std::set<const void *> &seen_) : seen(seen_) {}
+
+      template <typename T>
+      memory_usage operator()(const T &column) const {
+        return compute_memory_usage(column, seen);
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the memory used by each column of a table
+   * @param table The table
+   * @returns The memory usage of each column
+   */
+  template <typename Table>
+  std::map<std::string, memory_usage> compute_table_memory_usage(const Table &table) {
+    std::map<std::string, memory_usage> result;
+    std::set<const void *> seen;
+    detail::memory_usage_visitor visitor(seen);
+    for (typename Table::const_iterator it = table.begin(); it != table.end(); ++it) {
+      result[it->first] = it->second.apply_visitor(visitor);
+    }
+    return result;
+  }
+
+}}  // namespace dials::af
+
+#endif  // DIALS_ARRAY_FAMILY_MEMORY_USAGE_H
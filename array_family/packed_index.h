@@ -0,0 +1,120 @@
+/*
+ * packed_index.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ARRAY_FAMILY_PACKED_INDEX_H
+#define DIALS_ARRAY_FAMILY_PACKED_INDEX_H
+
+#include <boost/cstdint.hpp>
+#include <cctbx/miller.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/error.h>
+
+namespace dials { namespace af {
+
+  /**
+   * The number of bits of each component of a packed Miller index
+   */
+  const std::size_t packed_index_bits = 21;
+
+  /**
+   * The offset added to each component of a Miller index to pack it
+   */
+  const boost::int64_t packed_index_offset = boost::int64_t(1)
+                                             << (packed_index_bits - 1);
+
+  /**
+   * Pack a Miller index into one 64 bit code, with 21 bits for each of h, k
+   * and l from the most to the least significant. Each component is offset
+   * so that it is not negative, so the codes are in the same order as the
+   * indices compared by h, then k, then l, and can be sorted or joined as
+   * a single integer key.
+   * @param h The Miller index, with components in [-2^20, 2^20)
+   * @returns The code
+   */
+  inline boost::uint64_t pack_miller_index(const cctbx::miller::index<> &h) {
+    boost::uint64_t code = 0;
+    for (std::size_t j = 0; j < 3; ++j) {
+      boost::int64_t v = (boost::int64_t)h[j] + packed_index_offset;
+      DIALS_ASSERT(v >= 0 && v < 2 * packed_index_offset);
+      code = (code << packed_index_bits) | (boost::uint64_t)v;
+    }
+    return code;
+  }
+
+  /**
+   * Unpack a Miller index from its code
+   * @param code The code
+   * @returns The Miller index
+   */
+  inline cctbx::miller::index<> unpack_miller_index(boost::uint64_t code) {
+    const boost::uint64_t mask = (boost::uint64_t(1) << packed_index_bits) - 1;
+    cctbx::miller::index<> h;
+    for (std::size_t j = 3; j > 0; --j) {
+      h[j - 1] = (int)((boost::int64_t)(code & mask) - packed_index_offset);
+      code >>= packed_index_bits;
+    }
+    return h;
+  }
+
+  /**
+   * Pack an array of Miller indices into 64 bit codes
+   * @param h The Miller indices
+   * @returns The codes
+   */
+  inline af::shared<std::size_t> pack_miller_indices(
+    const af::const_ref<cctbx::miller::index<> > &h) {
+    af::shared<std::size_t> result(h.size());
+    for (std::size_t i = 0; i < h.size(); ++i) {
+      result[i] = (std::size_t)pack_miller_index(h[i]);
+    }
+    return result;
+  }
+
+  /**
+   * Unpack an array of Miller indices from their codes
+   * @param code The codes
+   * @returns The Miller indices
+   */
+  inline af::shared<cctbx::miller::index<> > unpack_miller_indices(
+    const af::const_ref<std::size_t> &code) {
+    af::shared<cctbx::miller::index<> > result(code.size());
+    for (std::size_t i = 0; i < code.size(); ++i) {
+      result[i] = unpack_miller_index(code[i]);
+    }
+    return result;
+  }
+
+  /**
+   * Pack an array of reflection flags into 32 bits each. All the flags of a
+   * reflection table are in the low 32 bits, so this halves the storage of
+   * the flags.
+   * @param flags The flags
+   * @returns The packed flags
+   */
+  inline af::shared<unsigned int> pack_flags(const af::const_ref<std::size_t> &flags) {
+    af::shared<unsigned int> result(flags.size());
+    for (std::size_t i = 0; i < flags.size(); ++i) {
+      result[i] = (unsigned int)flags[i];
+      DIALS_ASSERT(result[i] == flags[i]);
+    }
+    return result;
+  }
+
+  /**
+   * Unpack an array of reflection flags from 32 bits each
+   * @param flags The packed flags
+   * @returns The flags
+   */
+  inline af::shared<std::size_t> unpack_flags(
+    const af::const_ref<unsigned int> &flags) {
+    return af::shared<std::size_t>(flags.begin(), flags.end());
+  }
+
+}}  // namespace dials::af
+
+#endif  // DIALS_ARRAY_FAMILY_PACKED_INDEX_H
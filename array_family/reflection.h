@@ -11,6 +11,8 @@
 #ifndef DIALS_ARRAY_FAMILY_REFLECTION_H
 #define DIALS_ARRAY_FAMILY_REFLECTION_H
 
+#include <utility>
+#include <vector>
 #include <dials/array_family/reflection_table.h>
 
 namespace dials { namespace af {
@@ -226,8 +228,202 @@ namespace dials { namespace af {
       }
     }
 
+    /**
+     * A visitor to set an item in a column of a reflection table
+     */
+    struct set_column_item_visitor : public boost::static_visitor<void> {
+      af::reflection_table::mapped_type &column_;
+      std::size_t n_;
+      set_column_item_visitor(af::reflection_table::mapped_type &column,
+                              std::size_t n)
+          : column_(column), n_(n) {}
+      template <typename T>
+      void operator()(const T &item) const {
+        af::shared<T> *col = boost::get<af::shared<T> >(&column_);
+        DIALS_ASSERT(col != NULL);
+        DIALS_ASSERT(n_ < col->size());
+        (*col)[n_] = item;
+      }
+    };
+
+    /**
+     * A visitor to create a new column with the type of an item
+     */
+    struct new_column_visitor
+        : public boost::static_visitor<af::reflection_table::mapped_type> {
+      std::size_t n_;
+      new_column_visitor(std::size_t n) : n_(n) {}
+      template <typename T>
+      af::reflection_table::mapped_type operator()(const T &) const {
+        return af::reflection_table::mapped_type(af::shared<T>(n_, init_zero<T>()));
+      }
+    };
+
   }  // namespace detail
 
+  /**
+   * A view of the columns of a reflection table giving access to the rows as
+   * reflection objects. The columns are looked up once on construction and
+   * held in a flat array sorted by name, so getting or setting a row does not
+   * search the table or need a copy of the whole table as an array of
+   * reflections. Single items can also be got and set with their type, which
+   * avoids making a reflection for the whole row when only a few columns are
+   * needed. Columns which are set in a row but which are not in the table are
+   * added to the table with default values for the other rows. The class is
+   * not thread safe; the caller must serialise access.
+   */
+  class ReflectionColumns {
+  public:
+    typedef af::reflection_table::key_type key_type;
+    typedef af::reflection_table::mapped_type mapped_type;
+    typedef std::pair<key_type, mapped_type> column_type;
+
+    /**
+     * Create the view. The table is modified in place by set.
+     * @param table The reflection table
+     */
+    ReflectionColumns(af::reflection_table table) : table_(table) {
+      typedef af::reflection_table::const_iterator iterator;
+      columns_.reserve(table.ncols());
+      for (iterator it = table.begin(); it != table.end(); ++it) {
+        columns_.push_back(column_type(it->first, it->second));
+      }
+    }
+
+    /**
+     * @returns The number of rows
+     */
+    std::size_t size() const {
+      return table_.nrows();
+    }
+
+    /**
+     * Get a row of the table
+     * @param index The row index
+     * @returns The reflection
+     */
+    Reflection get(std::size_t index) const {
+      DIALS_ASSERT(index < size());
+      Reflection result;
+      detail::row_to_reflection_visitor visitor(index);
+      for (std::size_t i = 0; i < columns_.size(); ++i) {
+        result[columns_[i].first] = columns_[i].second.apply_visitor(visitor);
+      }
+      return result;
+    }
+
+    /**
+     * Set a row of the table. Both the reflection and the columns are sorted
+     * by name so the columns are found in a single pass.
+     * @param index The row index
+     * @param value The reflection
+     */
+    void set(std::size_t index, const Reflection &value) {
+      DIALS_ASSERT(index < size());
+      std::size_t i = 0;
+      for (Reflection::const_iterator it = value.begin(); it != value.end(); ++it) {
+        while (i < columns_.size() && columns_[i].first < it->first) {
+          ++i;
+        }
+        if (i == columns_.size() || columns_[i].first != it->first) {
+          detail::new_column_visitor visitor(size());
+          mapped_type column = it->second.apply_visitor(visitor);
+          table_.insert_column(it->first, column);
+          columns_.insert(columns_.begin() + i, column_type(it->first, column));
+        }
+        it->second.apply_visitor(
+          detail::set_column_item_visitor(columns_[i].second, index));
+      }
+    }
+
+    /**
+     * @param key The column name
+     * @returns True/False the table has the column
+     */
+    bool contains(const key_type &key) const {
+      std::size_t i = lower_bound(key);
+      return i < columns_.size() && columns_[i].first == key;
+    }
+
+    /**
+     * Get a typed handle to a column. The handle is made invalid if set adds a
+     * column to the table.
+     * @param key The column name
+     * @returns The column handle
+     */
+    template <typename T>
+    flex_table_column<T> column(const key_type &key) const {
+      return table_.column<T>(key);
+    }
+
+    /**
+     * Get an item of a column without making a reflection for the whole row
+     * @param index The row index
+     * @param key The column name
+     * @returns The item
+     */
+    template <typename T>
+    T get(std::size_t index, const key_type &key) const {
+      DIALS_ASSERT(index < size());
+      std::size_t i = lower_bound(key);
+      DIALS_ASSERT(i < columns_.size() && columns_[i].first == key);
+      const af::shared<T> *col = boost::get<af::shared<T> >(&columns_[i].second);
+      DIALS_ASSERT(col != NULL);
+      return (*col)[index];
+    }
+
+    /**
+     * Set an item of a column without making a reflection for the whole row.
+     * If the column is not in the table it is added with default values for
+     * the other rows.
+     * @param index The row index
+     * @param key The column name
+     * @param value The item
+     */
+    template <typename T>
+    void set(std::size_t index, const key_type &key, const T &value) {
+      DIALS_ASSERT(index < size());
+      std::size_t i = lower_bound(key);
+      if (i == columns_.size() || columns_[i].first != key) {
+        mapped_type column(af::shared<T>(size(), init_zero<T>()));
+        table_.insert_column(key, column);
+        columns_.insert(columns_.begin() + i, column_type(key, column));
+      }
+      af::shared<T> *col = boost::get<af::shared<T> >(&columns_[i].second);
+      DIALS_ASSERT(col != NULL);
+      (*col)[index] = value;
+    }
+
+    /**
+     * @returns The reflection table
+     */
+    af::reflection_table table() const {
+      return table_;
+    }
+
+  protected:
+    /**
+     * @returns The index of the first column not before the key
+     */
+    std::size_t lower_bound(const key_type &key) const {
+      std::size_t first = 0;
+      std::size_t count = columns_.size();
+      while (count > 0) {
+        std::size_t step = count / 2;
+        if (columns_[first + step].first < key) {
+          first += step + 1;
+          count -= step + 1;
+        } else {
+          count = step;
+        }
+      }
+      return first;
+    }
+
+    af::reflection_table table_;
+    std::vector<column_type> columns_;
+  };
+
   /**
    * Convert a reflection table to an array of reflections
    * @param table The reflection table
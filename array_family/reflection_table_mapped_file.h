@@ -0,0 +1,812 @@
+/*
+ * reflection_table_mapped_file.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ARRAY_FAMILY_REFLECTION_TABLE_MAPPED_FILE_H
+#define DIALS_ARRAY_FAMILY_REFLECTION_TABLE_MAPPED_FILE_H
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <dials/array_family/reflection_table.h>
+#include <dials/array_family/reflection_table_msgpack_adapter.h>
+#include <dials/error.h>
+
+namespace dials { namespace af {
+
+  namespace mapped_file_detail {
+
+    /**
+     * The magic bytes at the start of the file
+     */
+    inline const char *magic() {
+      return "DIALSRTM";
+    }
+
+    /**
+     * The magic bytes at the start of a file written in chunks
+     */
+    inline const char *chunked_magic() {
+      return "DIALSRTC";
+    }
+
+    /**
+     * The magic bytes at the end of a file written in chunks which was closed
+     */
+    inline const char *footer_magic() {
+      return "DIALSEND";
+    }
+
+    /**
+     * The file layout version
+     */
+    inline std::size_t version() {
+      return 1;
+    }
+
+    /**
+     * The alignment of the start of each column in the file
+     */
+    inline std::size_t alignment() {
+      return 64;
+    }
+
+    /**
+     * Round the offset up to the alignment
+     */
+    inline std::size_t align(std::size_t offset) {
+      return ((offset + alignment() - 1) / alignment()) * alignment();
+    }
+
+    /**
+     * Columns of plain data are stored as the raw array of elements. Other
+     * columns are stored as a msgpack blob in the same way as the msgpack
+     * reflection file.
+     */
+    template <typename T>
+    struct is_raw {
+      static const bool value = true;
+    };
+
+    template <>
+    struct is_raw<std::string> {
+      static const bool value = false;
+    };
+
+    template <>
+    struct is_raw<Shoebox<> > {
+      static const bool value = false;
+    };
+
+    /**
+     * Reference the mapped data instead of copying when unpacking msgpack
+     */
+    inline bool reference_mapped_data(msgpack::type::object_type type,
+                                      std::size_t length,
+                                      void *user_data) {
+      return true;
+    }
+
+    /**
+     * The description of a single column in the file
+     */
+    struct column_info {
+      std::string name;
+      std::string type;
+      std::size_t offset;
+      std::size_t size;
+    };
+
+    /**
+     * A visitor to get the type and size of a column in the file. Columns which
+     * are not stored raw are serialised into the string.
+     */
+    struct column_info_visitor : boost::static_visitor<void> {
+      column_info *info;
+      std::string *bytes;
+
+      column_info_visitor(column_info *info_, std::string *bytes_)
+          : info(info_), bytes(bytes_) {}
+
+      template <typename T>
+      void operator()(const af::shared<T> &column) const {
+        info->type = msgpack::adaptor::column_type<T>::name();
+        if (is_raw<T>::value) {
+          info->size = column.size() * sizeof(T);
+        } else {
+          std::stringstream buffer;
+          msgpack::pack(buffer, column);
+          *bytes = buffer.str();
+          info->size = bytes->size();
+        }
+      }
+    };
+
+    /**
+     * A visitor to write a raw column to the stream
+     */
+    struct write_raw_visitor : boost::static_visitor<void> {
+      std::ostream *stream;
+
+      write_raw_visitor(std::ostream *stream_) : stream(stream_) {}
+
+      template <typename T>
+      void operator()(const af::shared<T> &column) const {
+        DIALS_ASSERT(is_raw<T>::value);
+        if (column.size() > 0) {
+          stream->write(reinterpret_cast<const char *>(&column[0]),
+                        column.size() * sizeof(T));
+        }
+      }
+    };
+
+    /**
+     * The description of one chunk of the file: its rows, identifiers,
+     * columns and the absolute offset of its data
+     */
+    struct chunk_info {
+      std::size_t nrows;
+      std::size_t data_start;
+      std::size_t end;
+      reflection_table::experiment_map_type identifiers;
+      std::vector<column_info> columns;
+    };
+
+    /**
+     * Write a table as one chunk: the 64 bit size of the header, the header
+     * and the columns, each aligned from the start of the file.
+     * @param outfile The output stream
+     * @param table The reflection table
+     * @param position The position in the file of the start of the chunk
+     * @returns The position in the file of the end of the chunk
+     */
+    inline std::size_t write_chunk(std::ostream &outfile,
+                                   const reflection_table &table,
+                                   std::size_t position) {
+      // Serialise the non raw columns and compute the offsets of the columns
+      std::vector<column_info> columns;
+      std::vector<std::string> blobs;
+      std::size_t offset = 0;
+      for (reflection_table::const_iterator it = table.begin(); it != table.end();
+           ++it) {
+        column_info info;
+        std::string bytes;
+        boost::apply_visitor(column_info_visitor(&info, &bytes), it->second);
+        info.name = it->first;
+        info.offset = offset;
+        offset = align(offset + info.size);
+        columns.push_back(info);
+        blobs.push_back(bytes);
+      }
+
+      // Write the header
+      std::stringstream header;
+      msgpack::packer<std::stringstream> packer(header);
+      packer.pack_map(4);
+      packer.pack("version");
+      packer.pack(version());
+      packer.pack("nrows");
+      packer.pack(table.nrows());
+      packer.pack("identifiers");
+      packer.pack_map(table.experiment_identifiers()->size());
+      for (reflection_table::experiment_map_type::const_iterator it =
+             table.experiment_identifiers()->begin();
+           it != table.experiment_identifiers()->end();
+           ++it) {
+        packer.pack(it->first);
+        packer.pack(it->second);
+      }
+      packer.pack("columns");
+      packer.pack_array(columns.size());
+      for (std::size_t i = 0; i < columns.size(); ++i) {
+        packer.pack_array(4);
+        packer.pack(columns[i].name);
+        packer.pack(columns[i].type);
+        packer.pack(columns[i].offset);
+        packer.pack(columns[i].size);
+      }
+      std::string header_string = header.str();
+
+      // Write the chunk
+      boost::uint64_t header_size = header_string.size();
+      outfile.write(reinterpret_cast<const char *>(&header_size), sizeof(header_size));
+      outfile.write(header_string.c_str(), header_string.size());
+      position += sizeof(header_size) + header_string.size();
+      std::size_t data_start = align(position);
+      std::string padding(alignment(), '\0');
+      outfile.write(padding.c_str(), data_start - position);
+      std::size_t i = 0;
+      for (reflection_table::const_iterator it = table.begin(); it != table.end();
+           ++it, ++i) {
+        if (blobs[i].size() > 0) {
+          outfile.write(blobs[i].c_str(), blobs[i].size());
+        } else {
+          boost::apply_visitor(write_raw_visitor(&outfile), it->second);
+        }
+        std::size_t end = columns[i].offset + columns[i].size;
+        std::size_t next = (i + 1 < columns.size()) ? columns[i + 1].offset : end;
+        outfile.write(padding.c_str(), next - end);
+      }
+      if (columns.empty()) {
+        return data_start;
+      }
+      return data_start + columns.back().offset + columns.back().size;
+    }
+
+    /**
+     * A visitor to make an empty column of the same type as another
+     */
+    struct new_column_visitor : boost::static_visitor<reflection_table::mapped_type> {
+      std::size_t size;
+
+      new_column_visitor(std::size_t size_) : size(size_) {}
+
+      template <typename T>
+      reflection_table::mapped_type operator()(const af::shared<T> &column) const {
+        return af::shared<T>(size);
+      }
+    };
+
+    /**
+     * A visitor to copy the column of a chunk into a column of the table
+     */
+    struct copy_chunk_visitor : boost::static_visitor<void> {
+      reflection_table::mapped_type *result;
+      std::size_t offset;
+
+      copy_chunk_visitor(reflection_table::mapped_type *result_, std::size_t offset_)
+          : result(result_), offset(offset_) {}
+
+      template <typename T>
+      void operator()(const af::shared<T> &column) const {
+        af::shared<T> *dst = boost::get<af::shared<T> >(result);
+        if (dst == NULL) {
+          throw DIALS_ERROR("Column has a different type in each chunk");
+        }
+        DIALS_ASSERT(offset + column.size() <= dst->size());
+        std::copy(column.begin(), column.end(), dst->begin() + offset);
+      }
+    };
+
+  }  // namespace mapped_file_detail
+
+  /**
+   * Write the reflection table to a file in which the columns are stored as
+   * uncompressed and aligned blobs with an index in the header. The layout of
+   * the file is:
+   *
+   *  magic     8 bytes "DIALSRTM"
+   *  size      64 bit unsigned size of the header
+   *  header    msgpack map with the version, nrows, identifiers and a list of
+   *            [name, type, offset, size] for each column
+   *  columns   the column data. The offsets are given from the aligned end
+   *            of the header
+   *
+   * Data are written in the native byte order. Plain columns can then be
+   * read by copying straight from the mapped file.
+   * @param table The reflection table
+   * @param filename The filename
+   */
+  inline void write_mapped_file(const reflection_table &table,
+                                const std::string &filename) {
+    using namespace mapped_file_detail;
+    std::ofstream outfile(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!outfile) {
+      throw DIALS_ERROR("Unable to open " + filename + " for writing");
+    }
+    outfile.write(magic(), 8);
+    write_chunk(outfile, table, 8);
+    if (!outfile) {
+      throw DIALS_ERROR("Error writing " + filename);
+    }
+  }
+
+  /**
+   * A class to write a reflection table to file in chunks as it is produced,
+   * such as the results of each job of a long processing run. Each chunk is
+   * laid out as the body of a memory mapped reflection file, with its own
+   * header, and is flushed to disk when it is appended. On closing, a footer
+   * is written with the offset of each chunk. The layout of the file is:
+   *
+   *  magic     8 bytes "DIALSRTC"
+   *  chunks    the chunks, each with the 64 bit size of the header, the
+   *            header and the columns as in the memory mapped file
+   *  footer    msgpack map with the version, nrows and the offsets of the
+   *            chunks
+   *  trailer   the 64 bit offset of the footer and 8 bytes "DIALSEND"
+   *
+   * A file which was not closed can still be read, by walking the headers
+   * of the complete chunks from the start of the file.
+   */
+  class MappedReflectionFileWriter : public boost::noncopyable {
+  public:
+    /**
+     * Open the file and write the magic bytes
+     * @param filename The filename
+     */
+    MappedReflectionFileWriter(const std::string &filename)
+        : filename_(filename),
+          outfile_(filename.c_str(), std::ios::out | std::ios::binary),
+          position_(8),
+          nrows_(0),
+          closed_(false) {
+      if (!outfile_) {
+        throw DIALS_ERROR("Unable to open " + filename + " for writing");
+      }
+      outfile_.write(mapped_file_detail::chunked_magic(), 8);
+      outfile_.flush();
+    }
+
+    /**
+     * Close the file if it is still open
+     */
+    ~MappedReflectionFileWriter() {
+      if (!closed_) {
+        try {
+          close();
+        } catch (...) {
+          // Don't throw from the destructor
+        }
+      }
+    }
+
+    /**
+     * Write the table to the end of the file as a new chunk
+     * @param table The reflection table
+     */
+    void append(const reflection_table &table) {
+      DIALS_ASSERT(!closed_);
+      offsets_.push_back(position_);
+      position_ = mapped_file_detail::write_chunk(outfile_, table, position_);
+      nrows_ += table.nrows();
+      outfile_.flush();
+      if (!outfile_) {
+        throw DIALS_ERROR("Error writing " + filename_);
+      }
+    }
+
+    /**
+     * Write the footer and close the file
+     */
+    void close() {
+      DIALS_ASSERT(!closed_);
+      closed_ = true;
+      std::stringstream footer;
+      msgpack::packer<std::stringstream> packer(footer);
+      packer.pack_map(3);
+      packer.pack("version");
+      packer.pack(mapped_file_detail::version());
+      packer.pack("nrows");
+      packer.pack(nrows_);
+      packer.pack("chunks");
+      packer.pack(offsets_);
+      std::string footer_string = footer.str();
+      boost::uint64_t footer_offset = position_;
+      outfile_.write(footer_string.c_str(), footer_string.size());
+      outfile_.write(reinterpret_cast<const char *>(&footer_offset),
+                     sizeof(footer_offset));
+      outfile_.write(mapped_file_detail::footer_magic(), 8);
+      outfile_.close();
+      if (!outfile_) {
+        throw DIALS_ERROR("Error writing " + filename_);
+      }
+    }
+
+    /**
+     * @returns The number of rows written
+     */
+    std::size_t nrows() const {
+      return nrows_;
+    }
+
+    /**
+     * @returns The number of chunks written
+     */
+    std::size_t nchunks() const {
+      return offsets_.size();
+    }
+
+  private:
+    std::string filename_;
+    std::ofstream outfile_;
+    std::size_t position_;
+    std::size_t nrows_;
+    bool closed_;
+    std::vector<std::size_t> offsets_;
+  };
+
+  /**
+   * Check if the file is a memory mapped reflection file
+   * @param filename The filename
+   * @returns True/False
+   */
+  inline bool is_mapped_file(const std::string &filename) {
+    std::ifstream infile(filename.c_str(), std::ios::in | std::ios::binary);
+    char buffer[8];
+    infile.read(buffer, 8);
+    return infile && (std::memcmp(buffer, mapped_file_detail::magic(), 8) == 0
+                      || std::memcmp(buffer, mapped_file_detail::chunked_magic(), 8)
+                           == 0);
+  }
+
+  /**
+   * A class to read a reflection table from a memory mapped file. The file is
+   * mapped read only and only the header is read on construction. Columns are
+   * then read when requested, so the cost of reading a table is proportional
+   * to the size of the columns which are used. A file written in chunks is
+   * read as the table of all its chunks joined in order.
+   */
+  class MappedReflectionFile {
+  public:
+    typedef mapped_file_detail::column_info column_info;
+    typedef mapped_file_detail::chunk_info chunk_info;
+
+    /**
+     * Map the file and read the header
+     * @param filename The filename
+     */
+    MappedReflectionFile(const std::string &filename) : nrows_(0), complete_(true) {
+      using namespace boost::interprocess;
+      if (!is_mapped_file(filename)) {
+        throw DIALS_ERROR(filename + " is not a mapped reflection file");
+      }
+      file_mapping mapping(filename.c_str(), read_only);
+      region_.reset(new mapped_region(mapping, read_only));
+      data_ = static_cast<const char *>(region_->get_address());
+      size_ = region_->get_size();
+      if (std::memcmp(data_, mapped_file_detail::magic(), 8) == 0) {
+        chunks_.push_back(read_chunk_header(8));
+      } else {
+        read_chunks();
+      }
+      for (std::size_t i = 0; i < chunks_.size(); ++i) {
+        nrows_ += chunks_[i].nrows;
+        add_identifiers(identifiers_, chunks_[i].identifiers);
+        for (std::size_t j = 0; j < chunks_[i].columns.size(); ++j) {
+          if (!contains(chunks_[i].columns[j].name)) {
+            names_.push_back(chunks_[i].columns[j].name);
+          }
+        }
+      }
+    }
+
+    /**
+     * @returns The number of rows in the table
+     */
+    std::size_t nrows() const {
+      return nrows_;
+    }
+
+    /**
+     * @returns The number of chunks in the file
+     */
+    std::size_t nchunks() const {
+      return chunks_.size();
+    }
+
+    /**
+     * @returns False if the file was written in chunks and not closed
+     */
+    bool is_complete() const {
+      return complete_;
+    }
+
+    /**
+     * @returns The names of the columns
+     */
+    std::vector<std::string> keys() const {
+      return names_;
+    }
+
+    /**
+     * @returns Does the file contain the column
+     */
+    bool contains(const std::string &name) const {
+      return std::find(names_.begin(), names_.end(), name) != names_.end();
+    }
+
+    /**
+     * Read all the columns
+     * @returns The reflection table
+     */
+    reflection_table read() const {
+      return read(keys());
+    }
+
+    /**
+     * Read the requested columns. A column missing from some of the chunks
+     * of the file is zero for their rows, as when extending a table.
+     * @param names The names of the columns
+     * @returns The reflection table
+     */
+    reflection_table read(const std::vector<std::string> &names) const {
+      reflection_table result(nrows_);
+      *result.experiment_identifiers() = identifiers_;
+      for (std::size_t i = 0; i < names.size(); ++i) {
+        if (!contains(names[i])) {
+          throw DIALS_ERROR("Column " + names[i] + " not found in file");
+        }
+        if (chunks_.size() == 1) {
+          const column_info *info = find(chunks_[0], names[i]);
+          result.insert_column(info->name, read_column(chunks_[0], *info));
+          continue;
+        }
+        reflection_table::mapped_type column;
+        bool created = false;
+        std::size_t offset = 0;
+        for (std::size_t k = 0; k < chunks_.size(); ++k) {
+          const column_info *info = find(chunks_[k], names[i]);
+          if (info != NULL) {
+            reflection_table::mapped_type data = read_column(chunks_[k], *info);
+            if (!created) {
+              column = boost::apply_visitor(
+                mapped_file_detail::new_column_visitor(nrows_), data);
+              created = true;
+            }
+            boost::apply_visitor(
+              mapped_file_detail::copy_chunk_visitor(&column, offset), data);
+          }
+          offset += chunks_[k].nrows;
+        }
+        result.insert_column(names[i], column);
+      }
+      return result;
+    }
+
+  private:
+    /**
+     * Find the column info of a chunk by name
+     */
+    const column_info *find(const chunk_info &chunk, const std::string &name) const {
+      for (std::size_t i = 0; i < chunk.columns.size(); ++i) {
+        if (chunk.columns[i].name == name) {
+          return &chunk.columns[i];
+        }
+      }
+      return NULL;
+    }
+
+    /**
+     * Add the identifiers of a chunk, checking that they agree
+     */
+    void add_identifiers(reflection_table::experiment_map_type &result,
+                         const reflection_table::experiment_map_type &other) const {
+      typedef reflection_table::experiment_map_type::const_iterator iterator;
+      for (iterator it = other.begin(); it != other.end(); ++it) {
+        iterator found = result.find(it->first);
+        if (found == result.end()) {
+          result[it->first] = it->second;
+        } else if (found->second != it->second) {
+          throw DIALS_ERROR("Experiment identifiers do not match");
+        }
+      }
+    }
+
+    /**
+     * Find the chunks of a file written in chunks. If the file was closed
+     * the offsets are read from the footer, otherwise the complete chunks
+     * are found by walking their headers from the start of the file.
+     */
+    void read_chunks() {
+      using namespace mapped_file_detail;
+      boost::uint64_t footer_offset = 0;
+      std::size_t trailer = sizeof(footer_offset) + 8;
+      if (size_ >= 8 + trailer
+          && std::memcmp(data_ + size_ - 8, footer_magic(), 8) == 0) {
+        std::memcpy(&footer_offset, data_ + size_ - trailer, sizeof(footer_offset));
+        DIALS_ASSERT(footer_offset >= 8 && footer_offset <= size_ - trailer);
+        msgpack::unpacked unpacked;
+        msgpack::unpack(
+          unpacked, data_ + footer_offset, size_ - trailer - footer_offset);
+        msgpack::object footer = unpacked.get();
+        if (footer.type != msgpack::type::MAP) {
+          throw DIALS_ERROR("Mapped reflection file footer is not a map");
+        }
+        std::vector<std::size_t> offsets;
+        bool found_chunks = false;
+        msgpack::object_kv *first = footer.via.map.ptr;
+        msgpack::object_kv *last = first + footer.via.map.size;
+        for (msgpack::object_kv *it = first; it != last; ++it) {
+          std::string name;
+          it->key.convert(name);
+          if (name == "version") {
+            std::size_t file_version = 0;
+            it->val.convert(file_version);
+            if (file_version != version()) {
+              throw DIALS_ERROR("Mapped reflection file has unknown version");
+            }
+          } else if (name == "chunks") {
+            it->val.convert(offsets);
+            found_chunks = true;
+          }
+        }
+        if (!found_chunks) {
+          throw DIALS_ERROR("Mapped reflection file footer is incomplete");
+        }
+        for (std::size_t i = 0; i < offsets.size(); ++i) {
+          chunks_.push_back(read_chunk_header(offsets[i]));
+        }
+      } else {
+        complete_ = false;
+        std::size_t position = 8;
+        while (position < size_) {
+          try {
+            chunks_.push_back(read_chunk_header(position));
+          } catch (std::exception const &) {
+            // The last chunk was not completely written
+            break;
+          }
+          position = chunks_.back().end;
+        }
+      }
+    }
+
+    /**
+     * Read the header of the chunk at a position in the file
+     */
+    chunk_info read_chunk_header(std::size_t position) const {
+      using namespace mapped_file_detail;
+      chunk_info chunk;
+      boost::uint64_t header_size = 0;
+      DIALS_ASSERT(position + sizeof(header_size) <= size_);
+      std::memcpy(&header_size, data_ + position, sizeof(header_size));
+      std::size_t header_start = position + sizeof(header_size);
+      DIALS_ASSERT(header_start + header_size <= size_);
+      chunk.data_start = align(header_start + header_size);
+      chunk.end = chunk.data_start;
+
+      // Unpack the header
+      msgpack::unpacked unpacked;
+      msgpack::unpack(unpacked, data_ + header_start, header_size);
+      msgpack::object header = unpacked.get();
+      if (header.type != msgpack::type::MAP) {
+        throw DIALS_ERROR("Mapped reflection file header is not a map");
+      }
+      bool found_version = false;
+      bool found_nrows = false;
+      bool found_columns = false;
+      msgpack::object_kv *first = header.via.map.ptr;
+      msgpack::object_kv *last = first + header.via.map.size;
+      for (msgpack::object_kv *it = first; it != last; ++it) {
+        std::string name;
+        it->key.convert(name);
+        if (name == "version") {
+          std::size_t file_version = 0;
+          it->val.convert(file_version);
+          if (file_version != version()) {
+            throw DIALS_ERROR("Mapped reflection file has unknown version");
+          }
+          found_version = true;
+        } else if (name == "nrows") {
+          it->val.convert(chunk.nrows);
+          found_nrows = true;
+        } else if (name == "identifiers") {
+          it->val.convert(chunk.identifiers);
+        } else if (name == "columns") {
+          read_column_index(it->val, chunk);
+          found_columns = true;
+        } else {
+          throw DIALS_ERROR("Unknown key in mapped reflection file header");
+        }
+      }
+      if (!found_version || !found_nrows || !found_columns) {
+        throw DIALS_ERROR("Mapped reflection file header is incomplete");
+      }
+      return chunk;
+    }
+
+    /**
+     * Read the list of [name, type, offset, size]
+     */
+    void read_column_index(const msgpack::object &o, chunk_info &chunk) const {
+      if (o.type != msgpack::type::ARRAY) {
+        throw DIALS_ERROR("Mapped reflection file column index is not an array");
+      }
+      for (std::size_t i = 0; i < o.via.array.size; ++i) {
+        const msgpack::object &item = o.via.array.ptr[i];
+        if (item.type != msgpack::type::ARRAY || item.via.array.size != 4) {
+          throw DIALS_ERROR("Mapped reflection file column index is invalid");
+        }
+        column_info info;
+        item.via.array.ptr[0].convert(info.name);
+        item.via.array.ptr[1].convert(info.type);
+        item.via.array.ptr[2].convert(info.offset);
+        item.via.array.ptr[3].convert(info.size);
+        DIALS_ASSERT(chunk.data_start + info.offset + info.size <= size_);
+        chunk.end = std::max(chunk.end, chunk.data_start + info.offset + info.size);
+        chunk.columns.push_back(info);
+      }
+    }
+
+    /**
+     * Read a column of a chunk from the mapped data
+     */
+    reflection_table::mapped_type read_column(const chunk_info &chunk,
+                                              const column_info &info) const {
+      if (info.type == "bool") {
+        return read_raw<bool>(chunk, info);
+      } else if (info.type == "int") {
+        return read_raw<int>(chunk, info);
+      } else if (info.type == "std::size_t") {
+        return read_raw<std::size_t>(chunk, info);
+      } else if (info.type == "double") {
+        return read_raw<double>(chunk, info);
+      } else if (info.type == "std::string") {
+        return read_packed<std::string>(chunk, info);
+      } else if (info.type == "vec2<double>") {
+        return read_raw<vec2<double> >(chunk, info);
+      } else if (info.type == "vec3<double>") {
+        return read_raw<vec3<double> >(chunk, info);
+      } else if (info.type == "mat3<double>") {
+        return read_raw<mat3<double> >(chunk, info);
+      } else if (info.type == "int6") {
+        return read_raw<int6>(chunk, info);
+      } else if (info.type == "cctbx::miller::index<>") {
+        return read_raw<cctbx::miller::index<> >(chunk, info);
+      } else if (info.type == "Shoebox<>") {
+        return read_packed<Shoebox<> >(chunk, info);
+      }
+      throw DIALS_ERROR("Unknown column type in mapped reflection file");
+      return reflection_table::mapped_type();
+    }
+
+    /**
+     * Copy a column of plain data
+     */
+    template <typename T>
+    af::shared<T> read_raw(const chunk_info &chunk, const column_info &info) const {
+      if (info.size != chunk.nrows * sizeof(T)) {
+        throw DIALS_ERROR("Column " + info.name + " has the wrong size");
+      }
+      af::shared<T> result(chunk.nrows, af::init_functor_null<T>());
+      if (chunk.nrows > 0) {
+        std::memcpy(&result[0], data_ + chunk.data_start + info.offset, info.size);
+      }
+      return result;
+    }
+
+    /**
+     * Unpack a msgpack column
+     */
+    template <typename T>
+    af::shared<T> read_packed(const chunk_info &chunk, const column_info &info) const {
+      msgpack::unpacked unpacked;
+      std::size_t offset = 0;
+      msgpack::unpack(unpacked,
+                      data_ + chunk.data_start + info.offset,
+                      info.size,
+                      offset,
+                      mapped_file_detail::reference_mapped_data);
+      af::shared<T> result;
+      unpacked.get().convert(result);
+      if (result.size() != chunk.nrows) {
+        throw DIALS_ERROR("Column " + info.name + " has the wrong size");
+      }
+      return result;
+    }
+
+    boost::shared_ptr<boost::interprocess::mapped_region> region_;
+    const char *data_;
+    std::size_t size_;
+    std::size_t nrows_;
+    bool complete_;
+    reflection_table::experiment_map_type identifiers_;
+    std::vector<chunk_info> chunks_;
+    std::vector<std::string> names_;
+  };
+
+}}  // namespace dials::af
+
+#endif  // DIALS_ARRAY_FAMILY_REFLECTION_TABLE_MAPPED_FILE_H
@@ -11,8 +11,14 @@
 #ifndef DIALS_ARRAY_FAMILY_REFLECTION_TABLE_MSGPACK_ADAPTER_H
 #define DIALS_ARRAY_FAMILY_REFLECTION_TABLE_MSGPACK_ADAPTER_H
 
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/thread.hpp>
 #include <scitbx/array_family/shared.h>
 #include <dials/array_family/reflection_table.h>
+#include <dials/array_family/shoebox_codec.h>
 #include <msgpack.hpp>
 
 namespace msgpack {
@@ -179,7 +185,16 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
      * Pack a shared<Shoebox<>> into a msgpack array.
      *
      * Shoebox arrays are treated differently because they are themselves
-     * structs with multiple items.
+     * structs with multiple items. The size of the binary data is computed
+     * first so that each shoebox can be written straight to the output stream
+     * without an intermediate buffer.
+     *
+     * If the shoeboxes are compressed then the arrays of each shoebox are
+     * written as a codec id, the encoded size and the encoded data. The data
+     * and background are encoded with the shuffle + RLE codec and the mask with
+     * the run length codec. The mask is packed into a byte per pixel first if
+     * all its values fit. Since the encoded size is not known in advance the
+     * compressed shoeboxes are encoded into a buffer before being written.
      */
     template <typename T>
     struct pack<scitbx::af::const_ref<dials::af::Shoebox<T> > > {
@@ -189,59 +204,156 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
         const scitbx::af::const_ref<dials::af::Shoebox<T> >& v) const {
         typedef typename scitbx::af::const_ref<dials::af::Shoebox<T> >::const_iterator
           iterator;
-        std::stringstream buffer;
-        for (iterator it = v.begin(); it != v.end(); ++it) {
-          // Write the panel
-          write(buffer, (uint32_t)it->panel);
 
-          // Check the bounding box makes sense
-          DIALS_ASSERT(it->bbox[1] >= it->bbox[0]);
-          DIALS_ASSERT(it->bbox[3] >= it->bbox[2]);
-          DIALS_ASSERT(it->bbox[5] >= it->bbox[4]);
+        // Compute the size of the binary data
+        std::size_t binary_size = 0;
+        for (iterator it = v.begin(); it != v.end(); ++it) {
+          binary_size += sizeof(uint32_t) + 6 * sizeof(int32_t) + sizeof(uint8_t);
+          if (it->data.size() > 0) {
+            binary_size += it->data.size() * element_size_helper<T>::size();
+            binary_size += it->mask.size() * element_size_helper<int>::size();
+            binary_size += it->background.size() * element_size_helper<T>::size();
+          }
+        }
 
-          // Write the bounding box
-          write(buffer, (int32_t)it->bbox[0]);
-          write(buffer, (int32_t)it->bbox[1]);
-          write(buffer, (int32_t)it->bbox[2]);
-          write(buffer, (int32_t)it->bbox[3]);
-          write(buffer, (int32_t)it->bbox[4]);
-          write(buffer, (int32_t)it->bbox[5]);
+        // Write the shoeboxes into the msgpack binary
+        o.pack_bin(binary_size);
+        for (iterator it = v.begin(); it != v.end(); ++it) {
+          // Write the panel and bounding box
+          write_header(o, *it);
 
           // Serialise data
           if (it->data.size() > 0) {
             DIALS_ASSERT(it->is_consistent());
 
             // Write 1 to indicate data is present
-            write(buffer, (uint8_t)1);
+            write(o, (uint8_t)1);
 
             // Write data array
-            buffer.write((const char*)&it->data[0],
-                         it->data.size() * element_size_helper<T>::size());
+            o.pack_bin_body((const char*)&it->data[0],
+                            it->data.size() * element_size_helper<T>::size());
 
             // Write mask array
-            buffer.write((const char*)&it->mask[0],
-                         it->mask.size() * element_size_helper<int>::size());
+            o.pack_bin_body((const char*)&it->mask[0],
+                            it->mask.size() * element_size_helper<int>::size());
 
             // Write background array
-            buffer.write((const char*)&it->background[0],
-                         it->background.size() * element_size_helper<T>::size());
+            o.pack_bin_body((const char*)&it->background[0],
+                            it->background.size() * element_size_helper<T>::size());
 
           } else {
             // Write zero to indicate data is not present
-            write(buffer, (uint8_t)0);
+            write(o, (uint8_t)0);
           }
         }
+        return o;
+      }
 
-        // Serialise the string to msgpack binary
-        std::string buffer_string = buffer.str();
-        o.pack_bin(buffer_string.size());
-        o.pack_bin_body(buffer_string.c_str(), buffer_string.size());
+      /**
+       * Pack the shoeboxes with the arrays compressed
+       */
+      template <typename Stream>
+      msgpack::packer<Stream>& pack_compressed(
+        msgpack::packer<Stream>& o,
+        const scitbx::af::const_ref<dials::af::Shoebox<T> >& v) const {
+        typedef typename scitbx::af::const_ref<dials::af::Shoebox<T> >::const_iterator
+          iterator;
+        msgpack::sbuffer buffer;
+        msgpack::packer<msgpack::sbuffer> b(buffer);
+        std::string encoded;
+        std::vector<dials::model::packed_mask_type> packed;
+        for (iterator it = v.begin(); it != v.end(); ++it) {
+          // Write the panel and bounding box
+          write_header(b, *it);
+
+          // Serialise data
+          if (it->data.size() > 0) {
+            DIALS_ASSERT(it->is_consistent());
+
+            // Write 3 to indicate compressed data with a packed mask is
+            // present, otherwise 2 for compressed data
+            bool is_packed =
+              dials::model::is_packable_mask(it->mask.begin(), it->mask.end());
+            write(b, (uint8_t)(is_packed ? 3 : 2));
+
+            // Write the data, mask and background arrays
+            write_encoded(b,
+                          dials::af::shoebox_codec::ShuffleRLE,
+                          (const char*)&it->data[0],
+                          it->data.size(),
+                          element_size_helper<T>::size(),
+                          encoded);
+            if (is_packed) {
+              packed.resize(it->mask.size());
+              dials::model::pack_mask(it->mask.begin(), it->mask.end(), &packed[0]);
+              write_encoded(b,
+                            dials::af::shoebox_codec::RunLength,
+                            (const char*)&packed[0],
+                            packed.size(),
+                            sizeof(dials::model::packed_mask_type),
+                            encoded);
+            } else {
+              write_encoded(b,
+                            dials::af::shoebox_codec::RunLength,
+                            (const char*)&it->mask[0],
+                            it->mask.size(),
+                            element_size_helper<int>::size(),
+                            encoded);
+            }
+            write_encoded(b,
+                          dials::af::shoebox_codec::ShuffleRLE,
+                          (const char*)&it->background[0],
+                          it->background.size(),
+                          element_size_helper<T>::size(),
+                          encoded);
+          } else {
+            // Write zero to indicate data is not present
+            write(b, (uint8_t)0);
+          }
+        }
+        o.pack_bin(buffer.size());
+        o.pack_bin_body(buffer.data(), buffer.size());
         return o;
       }
 
+      template <typename Stream>
+      void write_header(msgpack::packer<Stream>& o,
+                        const dials::af::Shoebox<T>& x) const {
+        // Write the panel
+        write(o, (uint32_t)x.panel);
+
+        // Check the bounding box makes sense
+        DIALS_ASSERT(x.bbox[1] >= x.bbox[0]);
+        DIALS_ASSERT(x.bbox[3] >= x.bbox[2]);
+        DIALS_ASSERT(x.bbox[5] >= x.bbox[4]);
+
+        // Write the bounding box
+        write(o, (int32_t)x.bbox[0]);
+        write(o, (int32_t)x.bbox[1]);
+        write(o, (int32_t)x.bbox[2]);
+        write(o, (int32_t)x.bbox[3]);
+        write(o, (int32_t)x.bbox[4]);
+        write(o, (int32_t)x.bbox[5]);
+      }
+
+      template <typename Stream>
+      void write_encoded(msgpack::packer<Stream>& o,
+                         dials::af::shoebox_codec::Codec codec,
+                         const char* data,
+                         std::size_t num_elements,
+                         std::size_t element_size,
+                         std::string& encoded) const {
+        codec = dials::af::shoebox_codec::encode(
+          codec, data, num_elements, element_size, encoded);
+        DIALS_ASSERT(encoded.size() <= 0xffffffff);
+        write(o, (uint8_t)codec);
+        write(o, (uint32_t)encoded.size());
+        o.pack_bin_body(encoded.data(), encoded.size());
+      }
+
       template <typename Stream, typename ValueType>
-      void write(Stream& buffer, const ValueType& x) const {
-        buffer.write((const char*)&x, sizeof(ValueType));
+      void write(msgpack::packer<Stream>& o, const ValueType& x) const {
+        o.pack_bin_body((const char*)&x, sizeof(ValueType));
       }
     };
 
@@ -311,17 +423,32 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
     /**
      * A visitor to help with packing a column variant type.
      * Pack the column into an array like: [ name, data ]
+     * If compress is set then shoebox columns are packed compressed.
      */
     template <typename Stream>
     struct packer_visitor : boost::static_visitor<void> {
       packer<Stream>& o_;
-      packer_visitor(packer<Stream>& o) : o_(o) {}
+      bool compress_;
+      packer_visitor(packer<Stream>& o, bool compress = false)
+          : o_(o), compress_(compress) {}
       template <typename T>
       void operator()(T const& value) const {
         o_.pack_array(2);
         o_.pack(column_type<typename T::value_type>::name());
         o_.pack(value);
       }
+      void operator()(scitbx::af::shared<dials::af::Shoebox<> > const& value) const {
+        typedef scitbx::af::const_ref<dials::af::Shoebox<> > const_ref_type;
+        o_.pack_array(2);
+        o_.pack(column_type<dials::af::Shoebox<> >::name());
+        if (compress_) {
+          o_.pack_array(2);
+          o_.pack(value.size());
+          pack<const_ref_type>().pack_compressed(o_, value.const_ref());
+        } else {
+          o_.pack(value);
+        }
+      }
     };
 
     /**
@@ -341,6 +468,9 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
      * The fourth entry is a map with key value pairs corresponding to the names
      * and arrays of the column data.
      *
+     * Version 2 is the same as version 1 except that the shoebox arrays may be
+     * compressed.
+     *
      */
     template <>
     struct pack<dials::af::reflection_table> {
@@ -348,8 +478,25 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
       msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o,
                                           const dials::af::reflection_table& v) const {
         typedef dials::af::reflection_table::const_iterator iterator;
+        pack_header(o, v);
+        for (iterator it = v.begin(); it != v.end(); ++it) {
+          o.pack(it->first);
+          boost::apply_visitor(packer_visitor<Stream>(o), it->second);
+        }
+        return o;
+      }
+
+      /**
+       * Pack everything up to the start of the column data. The columns must
+       * then be packed as ncols pairs of name and column. If the shoeboxes
+       * are to be compressed then the version is set to 2.
+       */
+      template <typename Stream>
+      static void pack_header(msgpack::packer<Stream>& o,
+                              const dials::af::reflection_table& v,
+                              bool compress = false) {
         std::string filetype = "dials::af::reflection_table";
-        std::size_t version = 1;
+        std::size_t version = compress ? 2 : 1;
 
         // Pack the:
         //  filetype
@@ -375,14 +522,9 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
         o.pack("nrows");
         o.pack(v.nrows());
 
-        // Pack the data
+        // Pack the start of the data
         o.pack("data");
         o.pack_map(v.ncols());
-        for (iterator it = v.begin(); it != v.end(); ++it) {
-          o.pack(it->first);
-          boost::apply_visitor(packer_visitor<Stream>(o), it->second);
-        }
-        return o;
       }
     };
 
@@ -445,6 +587,8 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
         std::size_t binary_size = o.via.bin.size;
         const char* binary_data = reinterpret_cast<const char*>(o.via.bin.ptr);
         std::stringstream buffer(std::string(binary_data, binary_size));
+        std::vector<char> encoded;
+        std::vector<dials::model::packed_mask_type> packed;
 
         // Stream into shoeboxes
         for (iterator it = v.begin(); it != v.end(); ++it) {
@@ -464,9 +608,10 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
           DIALS_ASSERT(it->bbox[3] >= it->bbox[2]);
           DIALS_ASSERT(it->bbox[5] >= it->bbox[4]);
 
-          // If the data present
-          bool read_data = read<uint8_t>(buffer);
-          if (read_data) {
+          // If the data present (1 for raw data, 2 for compressed data and 3
+          // for compressed data with a packed mask)
+          uint8_t read_data = read<uint8_t>(buffer);
+          if (read_data == 1) {
             // Create the accessor
             scitbx::af::c_grid<3> accessor(it->bbox[5] - it->bbox[4],
                                            it->bbox[3] - it->bbox[2],
@@ -495,12 +640,71 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
 
             // Check to ensure consistency
             DIALS_ASSERT(it->is_consistent());
+          } else if (read_data == 2 || read_data == 3) {
+            // Create the accessor
+            scitbx::af::c_grid<3> accessor(it->bbox[5] - it->bbox[4],
+                                           it->bbox[3] - it->bbox[2],
+                                           it->bbox[1] - it->bbox[0]);
+
+            // Allocate and decode the arrays
+            it->data = scitbx::af::versa<T, scitbx::af::c_grid<3> >(accessor);
+            it->mask = scitbx::af::versa<int, scitbx::af::c_grid<3> >(accessor);
+            it->background = scitbx::af::versa<T, scitbx::af::c_grid<3> >(accessor);
+            read_encoded(buffer,
+                         (char*)&it->data[0],
+                         it->data.size(),
+                         element_size_helper<T>::size(),
+                         encoded);
+            if (read_data == 3) {
+              packed.resize(it->mask.size());
+              read_encoded(buffer,
+                           (char*)&packed[0],
+                           packed.size(),
+                           sizeof(dials::model::packed_mask_type),
+                           encoded);
+              dials::model::unpack_mask(
+                &packed[0], &packed[0] + packed.size(), it->mask.begin());
+            } else {
+              read_encoded(buffer,
+                           (char*)&it->mask[0],
+                           it->mask.size(),
+                           element_size_helper<int>::size(),
+                           encoded);
+            }
+            read_encoded(buffer,
+                         (char*)&it->background[0],
+                         it->background.size(),
+                         element_size_helper<T>::size(),
+                         encoded);
+
+            // Check to ensure consistency
+            DIALS_ASSERT(it->is_consistent());
+          } else {
+            DIALS_ASSERT(read_data == 0);
           }
         }
 
         return o;
       }
 
+      template <typename Stream>
+      void read_encoded(Stream& buffer,
+                        char* data,
+                        std::size_t num_elements,
+                        std::size_t element_size,
+                        std::vector<char>& encoded) const {
+        dials::af::shoebox_codec::Codec codec =
+          (dials::af::shoebox_codec::Codec)read<uint8_t>(buffer);
+        std::size_t size = read<uint32_t>(buffer);
+        encoded.resize(size);
+        if (size > 0) {
+          buffer.read(&encoded[0], size);
+          DIALS_ASSERT((std::size_t)buffer.gcount() == size);
+        }
+        dials::af::shoebox_codec::decode(
+          codec, size > 0 ? &encoded[0] : 0, size, num_elements, element_size, data);
+      }
+
       template <typename ValueType, typename Stream>
       ValueType read(Stream& buffer) const {
         ValueType x;
@@ -709,8 +913,24 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
      */
     template <>
     struct convert<dials::af::reflection_table> {
+      typedef boost::function<bool(const std::string&)> selector_type;
+
       msgpack::object const& operator()(msgpack::object const& o,
                                         dials::af::reflection_table& v) const {
+        return read(o, v, selector_type());
+      }
+
+      /**
+       * Convert the msgpack structure into a reflection table, only converting
+       * the columns for which the selector returns true. The data for the other
+       * columns are skipped without being unpacked.
+       * @param o The msgpack object
+       * @param v The reflection table
+       * @param selector The column selector (or empty to select all columns)
+       */
+      msgpack::object const& read(msgpack::object const& o,
+                                  dials::af::reflection_table& v,
+                                  const selector_type& selector) const {
         typedef dials::af::reflection_table::key_type key_type;
         typedef dials::af::reflection_table::mapped_type mapped_type;
 
@@ -739,9 +959,10 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
         // Check the version
         std::size_t version;
         o.via.array.ptr[1].convert(version);
-        if (version != 1) {
+        if (version != 1 && version != 2) {
           throw DIALS_ERROR(
-            "dials::af::reflection_table: expected version 1, got something else");
+            "dials::af::reflection_table: expected version 1 or 2, got something "
+            "else");
         }
 
         // Get the header object
@@ -829,8 +1050,11 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
             key_type key;
             mapped_type value;
             it->key.convert(key);
+            if (selector && !selector(key)) {
+              continue;
+            }
             it->val.convert(value);
-            v[key] = value;
+            v.insert_column(key, value);
           }
         }
         return o;
@@ -841,4 +1065,101 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
 }  // MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
 }  // namespace msgpack
 
+namespace dials { namespace af {
+
+  namespace msgpack_detail {
+
+    /**
+     * Pack a single column into a buffer. Any exception is saved so it can be
+     * reported from the calling thread.
+     */
+    struct pack_column_task {
+      reflection_table::const_iterator column;
+      msgpack::sbuffer* buffer;
+      std::string* error;
+      bool compress;
+
+      pack_column_task(reflection_table::const_iterator column_,
+                       msgpack::sbuffer* buffer_,
+                       std::string* error_,
+                       bool compress_)
+          : column(column_), buffer(buffer_), error(error_), compress(compress_) {}
+
+      void operator()() const {
+        try {
+          msgpack::packer<msgpack::sbuffer> o(*buffer);
+          o.pack(column->first);
+          boost::apply_visitor(
+            msgpack::adaptor::packer_visitor<msgpack::sbuffer>(o, compress),
+            column->second);
+        } catch (const std::exception& e) {
+          *error = e.what();
+        }
+      }
+    };
+
+  }  // namespace msgpack_detail
+
+  /**
+   * Pack the reflection table in msgpack format using multiple threads. The
+   * output is identical to msgpack::pack(stream, table). Up to nthreads
+   * columns are packed concurrently into separate buffers which are then
+   * written to the stream in order, so at most nthreads packed columns are
+   * held in memory at once. If compress is set then the shoebox arrays are
+   * compressed and the table is written as version 2.
+   * @param stream The output stream
+   * @param table The reflection table
+   * @param nthreads The number of threads
+   * @param compress Compress the shoebox arrays
+   */
+  template <typename Stream>
+  void pack_reflection_table(Stream& stream,
+                             const reflection_table& table,
+                             std::size_t nthreads,
+                             bool compress = false) {
+    typedef reflection_table::const_iterator iterator;
+    msgpack::packer<Stream> o(stream);
+    if (nthreads <= 1 && !compress) {
+      o.pack(table);
+      return;
+    }
+
+    // Pack the header
+    msgpack::adaptor::pack<reflection_table>::pack_header(o, table, compress);
+    if (nthreads <= 1) {
+      for (iterator it = table.begin(); it != table.end(); ++it) {
+        o.pack(it->first);
+        boost::apply_visitor(msgpack::adaptor::packer_visitor<Stream>(o, compress),
+                             it->second);
+      }
+      return;
+    }
+
+    // Pack the columns in batches
+    iterator it = table.begin();
+    while (it != table.end()) {
+      std::vector<iterator> columns;
+      for (; it != table.end() && columns.size() < nthreads; ++it) {
+        columns.push_back(it);
+      }
+      boost::ptr_vector<msgpack::sbuffer> buffers;
+      std::vector<std::string> errors(columns.size());
+      boost::thread_group threads;
+      for (std::size_t i = 0; i < columns.size(); ++i) {
+        buffers.push_back(new msgpack::sbuffer());
+        threads.create_thread(msgpack_detail::pack_column_task(
+          columns[i], &buffers[i], &errors[i], compress));
+      }
+      threads.join_all();
+      for (std::size_t i = 0; i < columns.size(); ++i) {
+        if (!errors[i].empty()) {
+          throw DIALS_ERROR(errors[i]);
+        }
+        stream.write(buffers[i].data(), buffers[i].size());
+      }
+    }
+  }
+
+}}  // namespace dials::af
+
 #endif
@@ -0,0 +1,230 @@
+/*
+ * shoebox_codec.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_ARRAY_FAMILY_SHOEBOX_CODEC_H
+#define DIALS_ARRAY_FAMILY_SHOEBOX_CODEC_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <dials/error.h>
+
+namespace dials { namespace af { namespace shoebox_codec {
+
+  /**
+   * The codecs used to store the shoebox arrays. The codec is written before
+   * each array so new codecs can be added without changing the file format.
+   */
+  enum Codec {
+    Raw = 0,         ///< The raw bytes
+    RunLength = 1,   ///< Runs of identical elements (for the mask)
+    ShuffleRLE = 2,  ///< Byte shuffle followed by byte run length encoding
+  };
+
+  namespace detail {
+
+    /**
+     * Encode runs of identical elements as pairs of a 32 bit count and the
+     * element value.
+     */
+    inline void encode_run_length(const char *src,
+                                  std::size_t num_elements,
+                                  std::size_t element_size,
+                                  std::string &dst) {
+      std::size_t i = 0;
+      while (i < num_elements) {
+        const char *value = src + i * element_size;
+        boost::uint32_t count = 1;
+        while (i + count < num_elements && count < 0xffffffff
+               && std::memcmp(value, value + count * element_size, element_size)
+                    == 0) {
+          count++;
+        }
+        dst.append(reinterpret_cast<const char *>(&count), sizeof(count));
+        dst.append(value, element_size);
+        i += count;
+      }
+    }
+
+    inline void decode_run_length(const char *src,
+                                  std::size_t src_size,
+                                  std::size_t num_elements,
+                                  std::size_t element_size,
+                                  char *dst) {
+      std::size_t record_size = sizeof(boost::uint32_t) + element_size;
+      DIALS_ASSERT(src_size % record_size == 0);
+      std::size_t n = 0;
+      for (const char *it = src; it != src + src_size; it += record_size) {
+        boost::uint32_t count = 0;
+        std::memcpy(&count, it, sizeof(count));
+        DIALS_ASSERT(n + count <= num_elements);
+        for (std::size_t j = 0; j < count; ++j, ++n) {
+          std::memcpy(dst + n * element_size, it + sizeof(count), element_size);
+        }
+      }
+      DIALS_ASSERT(n == num_elements);
+    }
+
+    /**
+     * Encode bytes using a PackBits style run length encoding. A control byte
+     * c < 128 is followed by c + 1 literal bytes. A control byte c >= 128 is
+     * followed by a single byte that is repeated c - 125 times.
+     */
+    inline void encode_byte_run_length(const char *src,
+                                       std::size_t size,
+                                       std::string &dst) {
+      std::size_t i = 0;
+      while (i < size) {
+        // Look for a run of at least 3 bytes
+        std::size_t run = 1;
+        while (i + run < size && run < 130 && src[i + run] == src[i]) {
+          run++;
+        }
+        if (run >= 3) {
+          dst.push_back(static_cast<char>(run + 125));
+          dst.push_back(src[i]);
+          i += run;
+          continue;
+        }
+
+        // Otherwise copy literal bytes up to the next run
+        std::size_t start = i;
+        while (i < size && i - start < 128) {
+          if (i + 2 < size && src[i] == src[i + 1] && src[i] == src[i + 2]) {
+            break;
+          }
+          i++;
+        }
+        dst.push_back(static_cast<char>(i - start - 1));
+        dst.append(src + start, i - start);
+      }
+    }
+
+    inline void decode_byte_run_length(const char *src,
+                                       std::size_t src_size,
+                                       char *dst,
+                                       std::size_t dst_size) {
+      std::size_t j = 0;
+      for (std::size_t i = 0; i < src_size;) {
+        unsigned char control = static_cast<unsigned char>(src[i++]);
+        if (control < 128) {
+          std::size_t n = control + 1;
+          DIALS_ASSERT(i + n <= src_size && j + n <= dst_size);
+          std::memcpy(dst + j, src + i, n);
+          i += n;
+          j += n;
+        } else {
+          std::size_t n = control - 125;
+          DIALS_ASSERT(i < src_size && j + n <= dst_size);
+          std::memset(dst + j, src[i++], n);
+          j += n;
+        }
+      }
+      DIALS_ASSERT(j == dst_size);
+    }
+
+    /**
+     * Transpose the bytes of the elements so that byte k of every element is
+     * contiguous. For counts stored as floating point numbers this puts the
+     * sign, exponent and mostly zero mantissa bytes into long runs.
+     */
+    inline void shuffle(const char *src,
+                        std::size_t num_elements,
+                        std::size_t element_size,
+                        char *dst) {
+      for (std::size_t i = 0; i < num_elements; ++i) {
+        for (std::size_t k = 0; k < element_size; ++k) {
+          dst[k * num_elements + i] = src[i * element_size + k];
+        }
+      }
+    }
+
+    inline void unshuffle(const char *src,
+                          std::size_t num_elements,
+                          std::size_t element_size,
+                          char *dst) {
+      for (std::size_t i = 0; i < num_elements; ++i) {
+        for (std::size_t k = 0; k < element_size; ++k) {
+          dst[i * element_size + k] = src[k * num_elements + i];
+        }
+      }
+    }
+
+  }  // namespace detail
+
+  /**
+   * Encode an array with the given codec. If the encoded array would be
+   * larger than the raw array then the raw codec is used instead.
+   * @param codec The requested codec
+   * @param src The array data
+   * @param num_elements The number of elements
+   * @param element_size The size of each element
+   * @param dst The encoded data
+   * @returns The codec used
+   */
+  inline Codec encode(Codec codec,
+                      const char *src,
+                      std::size_t num_elements,
+                      std::size_t element_size,
+                      std::string &dst) {
+    std::size_t size = num_elements * element_size;
+    dst.clear();
+    if (codec == RunLength) {
+      detail::encode_run_length(src, num_elements, element_size, dst);
+    } else if (codec == ShuffleRLE) {
+      std::vector<char> shuffled(size);
+      if (size > 0) {
+        detail::shuffle(src, num_elements, element_size, &shuffled[0]);
+        detail::encode_byte_run_length(&shuffled[0], size, dst);
+      }
+    } else {
+      DIALS_ASSERT(codec == Raw);
+    }
+    if (codec == Raw || dst.size() >= size) {
+      dst.assign(src, size);
+      return Raw;
+    }
+    return codec;
+  }
+
+  /**
+   * Decode an array
+   * @param codec The codec that was used to encode the array
+   * @param src The encoded data
+   * @param src_size The size of the encoded data
+   * @param num_elements The number of elements
+   * @param element_size The size of each element
+   * @param dst The array data
+   */
+  inline void decode(Codec codec,
+                     const char *src,
+                     std::size_t src_size,
+                     std::size_t num_elements,
+                     std::size_t element_size,
+                     char *dst) {
+    std::size_t size = num_elements * element_size;
+    if (codec == Raw) {
+      DIALS_ASSERT(src_size == size);
+      std::memcpy(dst, src, size);
+    } else if (codec == RunLength) {
+      detail::decode_run_length(src, src_size, num_elements, element_size, dst);
+    } else if (codec == ShuffleRLE) {
+      std::vector<char> shuffled(size);
+      if (size > 0) {
+        detail::decode_byte_run_length(src, src_size, &shuffled[0], size);
+        detail::unshuffle(&shuffled[0], num_elements, element_size, dst);
+      }
+    } else {
+      throw DIALS_ERROR("Unknown shoebox codec");
+    }
+  }
+
+}}}  // namespace dials::af::shoebox_codec
+
+#endif  // DIALS_ARRAY_FAMILY_SHOEBOX_CODEC_H
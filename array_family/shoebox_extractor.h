@@ -23,13 +23,111 @@
 #include <dials/model/data/image.h>
 #include <dials/model/data/shoebox.h>
 #include <dials/array_family/reflection_table.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 
 namespace dials { namespace af {
 
+  using dials::algorithms::for_each_band;
   using model::Image;
   using model::Shoebox;
   using model::Valid;
 
+  namespace detail {
+
+    /**
+     * Copy the pixels of one frame of an image into a range of the shoeboxes
+     * recorded on that frame. The shoeboxes for the frame are listed panel by
+     * panel, with the shoeboxes for panel p given by the entries offset[p] to
+     * offset[p + 1] - 1 of the index array. Each shoebox appears at most once
+     * for a frame so ranges of the list can be copied in parallel.
+     */
+    template <typename T>
+    struct ExtractShoeboxPixels {
+      typedef Shoebox<>::float_type float_type;
+      typedef af::ref<float_type, af::c_grid<3> > sbox_data_type;
+      typedef af::ref<int, af::c_grid<3> > sbox_mask_type;
+
+      const Image<T>& image;
+      af::ref<Shoebox<> > shoebox;
+      const std::size_t* indices;
+      const std::size_t* offset;
+      int frame;
+
+      ExtractShoeboxPixels(const Image<T>& image_,
+                           af::ref<Shoebox<> > shoebox_,
+                           const std::size_t* indices_,
+                           const std::size_t* offset_,
+                           int frame_)
+          : image(image_),
+            shoebox(shoebox_),
+            indices(indices_),
+            offset(offset_),
+            frame(frame_) {}
+
+      /**
+       * Copy the pixels for the entries k0 to k1 - 1 of the list
+       */
+      void operator()(int k0, int k1) const {
+        for (std::size_t p = 0; p < image.npanels(); ++p) {
+          int i0 = std::max(k0, (int)(offset[p] - offset[0]));
+          int i1 = std::min(k1, (int)(offset[p + 1] - offset[0]));
+          if (i0 >= i1) {
+            continue;
+          }
+          af::const_ref<T, af::c_grid<2> > data = image.data(p);
+          af::const_ref<bool, af::c_grid<2> > mask = image.mask(p);
+          DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+          for (int i = i0; i < i1; ++i) {
+            std::size_t index = indices[offset[0] + i];
+            DIALS_ASSERT(index < shoebox.size());
+            copy(data, mask, shoebox[index]);
+          }
+        }
+      }
+
+      /**
+       * Copy the pixels of the frame into a single shoebox
+       */
+      void copy(const af::const_ref<T, af::c_grid<2> >& data,
+                const af::const_ref<bool, af::c_grid<2> >& mask,
+                Shoebox<>& sbox) const {
+        int6 b = sbox.bbox;
+        sbox_data_type sdata = sbox.data.ref();
+        sbox_mask_type smask = sbox.mask.ref();
+        DIALS_ASSERT(b[1] > b[0]);
+        DIALS_ASSERT(b[3] > b[2]);
+        DIALS_ASSERT(b[5] > b[4]);
+        DIALS_ASSERT(frame >= b[4] && frame < b[5]);
+        int x0 = b[0];
+        int x1 = b[1];
+        int y0 = b[2];
+        int y1 = b[3];
+        int z0 = b[4];
+        std::size_t xs = x1 - x0;
+        std::size_t ys = y1 - y0;
+        std::size_t z = frame - z0;
+        std::size_t yi = data.accessor()[0];
+        std::size_t xi = data.accessor()[1];
+        int xb = x0 >= 0 ? 0 : std::abs(x0);
+        int yb = y0 >= 0 ? 0 : std::abs(y0);
+        int xe = x1 <= xi ? xs : xs - (x1 - (int)xi);
+        int ye = y1 <= yi ? ys : ys - (y1 - (int)yi);
+        DIALS_ASSERT(ye > yb && yb >= 0 && ye <= ys);
+        DIALS_ASSERT(xe > xb && xb >= 0 && xe <= xs);
+        DIALS_ASSERT(yb + y0 >= 0 && ye + y0 <= yi);
+        DIALS_ASSERT(xb + x0 >= 0 && xe + x0 <= xi);
+        DIALS_ASSERT(sbox.is_consistent());
+        for (std::size_t y = yb; y < ye; ++y) {
+          for (std::size_t x = xb; x < xe; ++x) {
+            sdata(z, y, x) = data(y + y0, x + x0);
+            smask(z, y, x) = mask(y + y0, x + x0) ? Valid : 0;
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
   /**
    * A class to extract shoebox pixels from images
    */
@@ -43,14 +141,17 @@ namespace dials { namespace af {
     ShoeboxExtractor(af::reflection_table data,
                      std::size_t npanels,
                      int frame0,
-                     int frame1)
+                     int frame1,
+                     std::size_t nthreads = 1)
         : npanels_(npanels),
+          nthreads_(nthreads),
           frame0_(frame0),
           frame1_(frame1),
           frame_(frame0),
           nframes_(frame1 - frame0) {
       DIALS_ASSERT(frame0_ < frame1_);
       DIALS_ASSERT(npanels_ > 0);
+      DIALS_ASSERT(nthreads_ > 0);
       DIALS_ASSERT(data.is_consistent());
       DIALS_ASSERT(data.contains("panel"));
       DIALS_ASSERT(data.contains("bbox"));
@@ -91,58 +192,26 @@ namespace dials { namespace af {
 
     /**
      * Extract the pixels from the image and copy to the relevant shoeboxes.
+     * The list of shoeboxes recorded on the frame, across all panels, is
+     * split into ranges which are copied in separate threads.
      * @param image The image to process
-     * @param frame The current image frame
      */
     template <typename T>
     void next(const Image<T>& image) {
-      typedef Shoebox<>::float_type float_type;
-      typedef af::ref<float_type, af::c_grid<3> > sbox_data_type;
-      typedef af::ref<int, af::c_grid<3> > sbox_mask_type;
       DIALS_ASSERT(frame_ >= frame0_ && frame_ < frame1_);
       DIALS_ASSERT(image.npanels() == npanels_);
-      for (std::size_t p = 0; p < image.npanels(); ++p) {
-        af::const_ref<std::size_t> ind = indices(frame_, p);
-        af::const_ref<T, af::c_grid<2> > data = image.data(p);
-        af::const_ref<bool, af::c_grid<2> > mask = image.mask(p);
-        DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
-        for (std::size_t i = 0; i < ind.size(); ++i) {
-          DIALS_ASSERT(ind[i] < shoebox_.size());
-          Shoebox<>& sbox = shoebox_[ind[i]];
-          int6 b = sbox.bbox;
-          sbox_data_type sdata = sbox.data.ref();
-          sbox_mask_type smask = sbox.mask.ref();
-          DIALS_ASSERT(b[1] > b[0]);
-          DIALS_ASSERT(b[3] > b[2]);
-          DIALS_ASSERT(b[5] > b[4]);
-          DIALS_ASSERT(frame_ >= b[4] && frame_ < b[5]);
-          int x0 = b[0];
-          int x1 = b[1];
-          int y0 = b[2];
-          int y1 = b[3];
-          int z0 = b[4];
-          std::size_t xs = x1 - x0;
-          std::size_t ys = y1 - y0;
-          std::size_t z = frame_ - z0;
-          std::size_t yi = data.accessor()[0];
-          std::size_t xi = data.accessor()[1];
-          int xb = x0 >= 0 ? 0 : std::abs(x0);
-          int yb = y0 >= 0 ? 0 : std::abs(y0);
-          int xe = x1 <= xi ? xs : xs - (x1 - (int)xi);
-          int ye = y1 <= yi ? ys : ys - (y1 - (int)yi);
-          DIALS_ASSERT(ye > yb && yb >= 0 && ye <= ys);
-          DIALS_ASSERT(xe > xb && xb >= 0 && xe <= xs);
-          DIALS_ASSERT(yb + y0 >= 0 && ye + y0 <= yi);
-          DIALS_ASSERT(xb + x0 >= 0 && xe + x0 <= xi);
-          DIALS_ASSERT(sbox.is_consistent());
-          for (std::size_t y = yb; y < ye; ++y) {
-            for (std::size_t x = xb; x < xe; ++x) {
-              sdata(z, y, x) = data(y + y0, x + x0);
-              smask(z, y, x) = mask(y + y0, x + x0) ? Valid : 0;
-            }
-          }
-        }
+      std::size_t j0 = (frame_ - frame0_) * npanels_;
+      DIALS_ASSERT(j0 + npanels_ < offset_.size());
+      const std::size_t* offset = &offset_[j0];
+      int num = (int)(offset[npanels_] - offset[0]);
+      if (num == 0) {
+        frame_++;
+        return;
       }
+      for_each_band(detail::ExtractShoeboxPixels<T>(
+                      image, shoebox_.ref(), &indices_[0], offset, frame_),
+                    num,
+                    nthreads_);
       frame_++;
     }
 
@@ -179,27 +248,8 @@ namespace dials { namespace af {
     }
 
   private:
-    /**
-     * Get an index array specifying which reflections are recorded on a given
-     * frame and panel.
-     * @param frame The frame number
-     * @param panel The panel number
-     * @returns An array of indices
-     */
-    af::const_ref<std::size_t> indices(int frame, std::size_t panel) const {
-      std::size_t j0 = panel + (frame - frame0_) * npanels_;
-      DIALS_ASSERT(offset_.size() > 0);
-      DIALS_ASSERT(j0 < offset_.size() - 1);
-      std::size_t i0 = offset_[j0];
-      std::size_t i1 = offset_[j0 + 1];
-      DIALS_ASSERT(i1 >= i0);
-      std::size_t off = i0;
-      std::size_t num = i1 - off;
-      DIALS_ASSERT(off + num <= indices_.size());
-      return af::const_ref<std::size_t>(&indices_[off], num);
-    }
-
     std::size_t npanels_;
+    std::size_t nthreads_;
     int frame0_;
     int frame1_;
     int frame_;
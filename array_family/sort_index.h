@@ -12,6 +12,10 @@
 #define DIALS_ARRAY_FAMILY_SORT_INDEX_H
 
 #include <algorithm>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
 
 namespace dials { namespace af {
 
@@ -39,6 +43,228 @@ namespace dials { namespace af {
     std::sort(begin, end, index_less<RandomAccessIterator>(v));
   }
 
+  /**
+   * Partially order a list of indices so that the index at nth is the one
+   * that would be there if the list were sorted by value. The indices before
+   * it have values no greater and those after it values no less.
+   * @param v The list of values
+   */
+  template <typename IndexIterator, typename RandomAccessIterator>
+  void nth_element_index(IndexIterator begin,
+                         IndexIterator nth,
+                         IndexIterator end,
+                         RandomAccessIterator v) {
+    std::nth_element(begin, nth, end, index_less<RandomAccessIterator>(v));
+  }
+
+  /**
+   * A key for radix_sort_index giving the values of an array of integers
+   */
+  template <typename T>
+  struct radix_array_key {
+    const T *data;
+
+    radix_array_key(const T *data_) : data(data_) {}
+
+    boost::int64_t operator()(std::size_t i) const {
+      return (boost::int64_t)data[i];
+    }
+  };
+
+  /**
+   * A key for radix_sort_index giving one component of an array of integer
+   * vectors, such as the h, k or l of an array of Miller indices
+   */
+  template <typename T>
+  struct radix_component_key {
+    const T *data;
+    std::size_t component;
+
+    radix_component_key(const T *data_, std::size_t component_)
+        : data(data_), component(component_) {}
+
+    boost::int64_t operator()(std::size_t i) const {
+      return (boost::int64_t)data[i][component];
+    }
+  };
+
+  namespace detail {
+
+    /**
+     * Get a byte of the offset of a key from the smallest key, or from the
+     * largest for a reverse sort
+     */
+    struct RadixDigit {
+      boost::uint64_t origin;
+      bool reverse;
+      std::size_t shift;
+
+      RadixDigit(boost::uint64_t origin_, bool reverse_, std::size_t shift_)
+          : origin(origin_), reverse(reverse_), shift(shift_) {}
+
+      std::size_t operator()(boost::int64_t key) const {
+        boost::uint64_t v = (boost::uint64_t)key;
+        v = reverse ? origin - v : v - origin;
+        return (std::size_t)((v >> shift) & 0xff);
+      }
+    };
+
+    /**
+     * Count the digits of the keys in bands of the index
+     */
+    template <typename Key>
+    struct RadixCountBand {
+      const Key &key;
+      const std::vector<std::size_t> &src;
+      std::size_t band;
+      RadixDigit digit;
+      std::vector<std::size_t> &counts;
+
+      RadixCountBand(const Key &key_,
+                     const std::vector<std::size_t> &src_,
+                     std::size_t band_,
+                     RadixDigit digit_,
+                     std::vector<std::size_t> &counts_)
+          : key(key_), src(src_), band(band_), digit(digit_), counts(counts_) {}
+
+      void operator()(int b0, int b1) const {
+        for (int b = b0; b < b1; ++b) {
+          std::size_t *count = &counts[b * 256];
+          std::size_t first = std::min(b * band, src.size());
+          std::size_t last = std::min(first + band, src.size());
+          for (std::size_t j = first; j < last; ++j) {
+            count[digit(key(src[j]))]++;
+          }
+        }
+      }
+    };
+
+    /**
+     * Move the indices of bands of the index to the positions given by their
+     * digits. The offsets hold where each band starts for each digit.
+     */
+    template <typename Key>
+    struct RadixScatterBand {
+      const Key &key;
+      const std::vector<std::size_t> &src;
+      std::vector<std::size_t> &dst;
+      std::size_t band;
+      RadixDigit digit;
+      const std::vector<std::size_t> &offsets;
+
+      RadixScatterBand(const Key &key_,
+                       const std::vector<std::size_t> &src_,
+                       std::vector<std::size_t> &dst_,
+                       std::size_t band_,
+                       RadixDigit digit_,
+                       const std::vector<std::size_t> &offsets_)
+          : key(key_),
+            src(src_),
+            dst(dst_),
+            band(band_),
+            digit(digit_),
+            offsets(offsets_) {}
+
+      void operator()(int b0, int b1) const {
+        for (int b = b0; b < b1; ++b) {
+          std::size_t offset[256];
+          std::copy(&offsets[b * 256], &offsets[b * 256] + 256, offset);
+          std::size_t first = std::min(b * band, src.size());
+          std::size_t last = std::min(first + band, src.size());
+          for (std::size_t j = first; j < last; ++j) {
+            dst[offset[digit(key(src[j]))]++] = src[j];
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Sort a list of indices by integer keys with a least significant digit
+   * radix sort. The sort is stable, so a sort by several keys is done by
+   * sorting by each key in turn from the least to the most significant. The
+   * keys are offset from their smallest value (or largest for a reverse
+   * sort) and sorted a byte at a time, skipping the bytes that are the same
+   * for all the keys. Each pass counts and moves the indices in bands across
+   * threads, the bands being kept in order to keep the sort stable.
+   * @param begin The start of the indices
+   * @param end The end of the indices
+   * @param key The key of each index, as key(index)
+   * @param reverse Sort into descending order of key
+   * @param nthreads The number of threads to use
+   */
+  template <typename IndexIterator, typename Key>
+  void radix_sort_index(IndexIterator begin,
+                        IndexIterator end,
+                        const Key &key,
+                        bool reverse = false,
+                        std::size_t nthreads = 1) {
+    const std::size_t min_band = 1 << 16;
+    DIALS_ASSERT(nthreads > 0);
+    std::vector<std::size_t> src(begin, end);
+    std::size_t n = src.size();
+    if (n < 2) {
+      return;
+    }
+
+    // Find the range of the keys as unsigned offsets
+    boost::int64_t kmin = key(src[0]);
+    boost::int64_t kmax = kmin;
+    for (std::size_t j = 1; j < n; ++j) {
+      boost::int64_t k = key(src[j]);
+      kmin = std::min(kmin, k);
+      kmax = std::max(kmax, k);
+    }
+    boost::uint64_t range = (boost::uint64_t)kmax - (boost::uint64_t)kmin;
+    boost::uint64_t origin = reverse ? (boost::uint64_t)kmax : (boost::uint64_t)kmin;
+
+    // Split the indices into bands, one for each thread
+    std::size_t nbands = std::min(nthreads, std::max(n / min_band, (std::size_t)1));
+    std::size_t band = (n + nbands - 1) / nbands;
+    nbands = (n + band - 1) / band;
+
+    // Do a counting sort on each byte of the offsets
+    std::vector<std::size_t> dst(n);
+    std::vector<std::size_t> counts(nbands * 256);
+    bool moved = false;
+    for (std::size_t shift = 0; shift < 64 && (range >> shift) != 0; shift += 8) {
+      detail::RadixDigit digit(origin, reverse, shift);
+      std::fill(counts.begin(), counts.end(), 0);
+      dials::algorithms::for_each_band(
+        detail::RadixCountBand<Key>(key, src, band, digit, counts),
+        (int)nbands,
+        nthreads);
+
+      // Turn the counts into offsets, skipping the pass if all the indices
+      // have the same digit
+      std::size_t sum = 0;
+      bool skip = false;
+      for (std::size_t d = 0; d < 256 && !skip; ++d) {
+        std::size_t total = 0;
+        for (std::size_t b = 0; b < nbands; ++b) {
+          std::size_t count = counts[b * 256 + d];
+          counts[b * 256 + d] = sum + total;
+          total += count;
+        }
+        skip = total == n;
+        sum += total;
+      }
+      if (skip) {
+        continue;
+      }
+      dials::algorithms::for_each_band(
+        detail::RadixScatterBand<Key>(key, src, dst, band, digit, counts),
+        (int)nbands,
+        nthreads);
+      src.swap(dst);
+      moved = true;
+    }
+    if (moved) {
+      std::copy(src.begin(), src.end(), begin);
+    }
+  }
+
 }}  // namespace dials::af
 
 #endif /* DIALS_ARRAY_FAMILY_SORT_INDEX_H */
@@ -0,0 +1,296 @@
+"""
+Run the processing pipeline on a dataset for a number of processor counts,
+and record the wall time, CPU time, peak memory and I/O of each stage.
+"""
+
+import json
+import logging
+import os
+import subprocess
+import sys
+import time
+
+import libtbx.phil
+
+from dials.util import Sorry, log, show_mail_handle_errors, tabulate
+from dials.util.mp import available_cores
+from dials.util.options import OptionParser
+from dials.util.version import dials_version
+
+logger = logging.getLogger("dials.command_line.benchmark_pipeline")
+
+help_message = """
+Benchmark the processing pipeline of dials.import, dials.find_spots,
+dials.index, dials.integrate and dials.scale on a reference dataset.
+
+The pipeline is run in a separate directory for each number of processors
+and each repeat, and each stage is run as a separate process so that its
+resource usage can be measured on its own: the wall time; the user and system
+CPU time, including that of any processes it starts; the peak resident memory;
+and the number of bytes read and written to disk. The results, with the speed
+up and parallel efficiency of each stage relative to the smallest number of
+processors, are written to a json file.
+
+This is only available on POSIX systems.
+
+Examples::
+
+  dials.benchmark_pipeline /data/image_*.cbf nproc=1,2,4,8
+
+  dials.benchmark_pipeline imported.expt nproc=4 repeats=3 index.extra="space_group=P4"
+"""
+
+phil_scope = libtbx.phil.parse(
+    """
+nproc = None
+  .type = ints(value_min=1)
+  .help = "The numbers of processors to run the pipeline with. The pipeline"
+          "is run once for each. By default the number of available cores is"
+          "used."
+repeats = 1
+  .type = int(value_min=1)
+  .help = "The number of times to run the pipeline for each number of"
+          "processors."
+stages = *find_spots *index *integrate *scale
+  .type = choice(multi=True)
+  .help = "The stages to run after importing the data. The stages needed by"
+          "a stage must be included too."
+find_spots.extra = None
+  .type = strings
+  .help = "Extra parameters for dials.find_spots"
+index.extra = None
+  .type = strings
+  .help = "Extra parameters for dials.index"
+integrate.extra = None
+  .type = strings
+  .help = "Extra parameters for dials.integrate"
+scale.extra = None
+  .type = strings
+  .help = "Extra parameters for dials.scale"
+output {
+  directory = benchmark
+    .type = path
+    .help = "The directory to run the pipeline in"
+  json = benchmark.json
+    .type = path
+  log = dials.benchmark_pipeline.log
+    .type = path
+}
+"""
+)
+
+# The stages of the pipeline: the name, the command, its input files and the
+# parameter which sets its number of processors
+_stages = (
+    ("find_spots", "dials.find_spots", ["imported.expt"], "spotfinder.mp.nproc"),
+    ("index", "dials.index", ["imported.expt", "strong.refl"], "indexing.nproc"),
+    (
+        "integrate",
+        "dials.integrate",
+        ["indexed.expt", "indexed.refl"],
+        "integration.mp.nproc",
+    ),
+    (
+        "scale",
+        "dials.scale",
+        ["integrated.expt", "integrated.refl"],
+        "scaling_options.nproc",
+    ),
+)
+
+# The size of a block counted by getrusage
+_block_size = 512
+
+
+def run_stage(name, command, directory):
+    """
+    Run a stage of the pipeline as a separate process and measure its
+    resource usage.
+
+    Args:
+        name (str): The name of the stage, used for its log file
+        command (list): The command to run
+        directory (str): The directory to run it in
+
+    Returns:
+        dict: The exit code, the wall time and CPU times in seconds, the peak
+        resident memory in bytes and the bytes read and written
+    """
+    with open(os.path.join(directory, f"{name}.stdout"), "w") as stdout:
+        start = time.perf_counter()
+        process = subprocess.Popen(
+            command, cwd=directory, stdout=stdout, stderr=subprocess.STDOUT
+        )
+        _, status, usage = os.wait4(process.pid, 0)
+        wall_time = time.perf_counter() - start
+
+    # The process has been reaped, so tell Popen not to wait for it again
+    if os.WIFSIGNALED(status):
+        process.returncode = -os.WTERMSIG(status)
+    else:
+        process.returncode = os.WEXITSTATUS(status)
+
+    # The peak memory is in kilobytes on Linux and bytes on macOS
+    max_rss = usage.ru_maxrss
+    if sys.platform != "darwin":
+        max_rss *= 1024
+    return {
+        "returncode": process.returncode,
+        "wall_time": wall_time,
+        "user_time": usage.ru_utime,
+        "system_time": usage.ru_stime,
+        "cpu_time": usage.ru_utime + usage.ru_stime,
+        "max_rss": max_rss,
+        "read_bytes": usage.ru_inblock * _block_size,
+        "write_bytes": usage.ru_oublock * _block_size,
+    }
+
+
+def run_pipeline(params, inputs, nproc, directory):
+    """
+    Run the pipeline in a directory.
+
+    Args:
+        params: The parameters
+        inputs (list): The images or experiments to import
+        nproc (int): The number of processors for each stage
+        directory (str): The directory to run in
+
+    Returns:
+        dict: The results of each stage which was run
+    """
+    os.makedirs(directory, exist_ok=True)
+    results = {}
+    command = ["dials.import", "output.experiments=imported.expt"] + inputs
+    results["import"] = run_stage("import", command, directory)
+    if results["import"]["returncode"]:
+        logger.info(f"dials.import failed in {directory}")
+        return results
+    for name, dispatcher, files, nproc_param in _stages:
+        if name not in params.stages:
+            continue
+        extra = getattr(params, name).extra or []
+        command = [dispatcher] + files + [f"{nproc_param}={nproc}"] + extra
+        results[name] = run_stage(name, command, directory)
+        if results[name]["returncode"]:
+            logger.info(f"{dispatcher} failed in {directory}, see {name}.stdout")
+            break
+    return results
+
+
+def summarise(runs):
+    """
+    Summarise the runs of the pipeline. The best wall time of the repeats is
+    taken for each stage and number of processors, and the speed up and
+    efficiency are relative to the smallest number of processors.
+
+    Args:
+        runs (list): The runs, each a dict of the number of processors and
+            the results of each stage
+
+    Returns:
+        dict: For each stage, a dict of the results for each number of
+        processors
+    """
+    summary = {}
+    for run in runs:
+        for name, result in run["stages"].items():
+            if result["returncode"]:
+                continue
+            best = summary.setdefault(name, {}).get(run["nproc"])
+            if best is None or result["wall_time"] < best["wall_time"]:
+                summary[name][run["nproc"]] = {
+                    "wall_time": result["wall_time"],
+                    "cpu_time": result["cpu_time"],
+                    "max_rss": result["max_rss"],
+                }
+    for name, results in summary.items():
+        base = min(results)
+        for nproc, result in results.items():
+            speedup = results[base]["wall_time"] / max(result["wall_time"], 1e-9)
+            result["speedup"] = speedup
+            result["efficiency"] = speedup * base / nproc
+    return summary
+
+
+@show_mail_handle_errors()
+def run(args=None):
+    usage = "dials.benchmark_pipeline [options] (images | imported.expt)"
+    parser = OptionParser(usage=usage, phil=phil_scope, epilog=help_message)
+    params, options, inputs = parser.parse_args(
+        args=args, show_diff_phil=False, return_unhandled=True
+    )
+    if not inputs:
+        parser.print_help()
+        return
+    if not hasattr(os, "wait4"):
+        raise Sorry("dials.benchmark_pipeline is only available on POSIX systems")
+
+    log.config(logfile=params.output.log)
+    logger.info(dials_version())
+    diff_phil = parser.diff_phil.as_str()
+    if diff_phil:
+        logger.info("The following parameters have been modified:\n%s", diff_phil)
+
+    inputs = [os.path.abspath(i) if os.path.exists(i) else i for i in inputs]
+    nprocs = params.nproc or [available_cores()]
+    runs = []
+    for nproc in nprocs:
+        for repeat in range(params.repeats):
+            directory = os.path.join(
+                params.output.directory, f"nproc_{nproc}", f"repeat_{repeat}"
+            )
+            logger.info(f"Running the pipeline with nproc={nproc} in {directory}")
+            stages = run_pipeline(params, inputs, nproc, directory)
+            runs.append({"nproc": nproc, "repeat": repeat, "stages": stages})
+
+    summary = summarise(runs)
+    rows = []
+    for name in ["import"] + [stage[0] for stage in _stages]:
+        for nproc, result in sorted(summary.get(name, {}).items()):
+            rows.append(
+                [
+                    name,
+                    nproc,
+                    f"{result['wall_time']:.2f}",
+                    f"{result['cpu_time']:.2f}",
+                    f"{result['max_rss'] / 2**20:.1f}",
+                    f"{result['speedup']:.2f}",
+                    f"{result['efficiency']:.2f}",
+                ]
+            )
+    logger.info(
+        tabulate(
+            rows,
+            [
+                "Stage",
+                "nproc",
+                "Wall time (s)",
+                "CPU time (s)",
+                "Peak RSS (MB)",
+                "Speed up",
+                "Efficiency",
+            ],
+        )
+    )
+
+    with open(params.output.json, "w") as fh:
+        json.dump(
+            {
+                "dials_version": dials_version(),
+                "cpu_count": available_cores(),
+                "inputs": inputs,
+                "runs": runs,
+                "summary": {
+                    name: {str(nproc): r for nproc, r in results.items()}
+                    for name, results in summary.items()
+                },
+            },
+            fh,
+            indent=2,
+        )
+    logger.info(f"Saved the results to {params.output.json}")
+
+
+if __name__ == "__main__":
+    run()
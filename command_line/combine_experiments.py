@@ -22,6 +22,10 @@
 from dials.algorithms.integration.stills_significance_filter import SignificanceFilter
 from dials.array_family import flex
 from dials.util import tabulate
+from dials.util.multi_dataset_handling import (
+    rows_by_experiment_id,
+    select_experiment_rows,
+)
 from dials.util.options import OptionParser, flatten_experiments
 
 help_message = """
@@ -520,10 +524,12 @@ def average_detectors(target, panelgroups, depth):
             ids_map = dict(refs.experiment_identifiers())
             for k in refs.experiment_identifiers().keys():
                 del refs.experiment_identifiers()[k]
+            # Find the rows of each experiment in one pass over the table
+            rows = rows_by_experiment_id(refs)
+            first_id = global_id
+            kept_ids = []
             for i, exp in enumerate(exps):
-                sel = refs["id"] == i
-                sub_ref = refs.select(sel)
-                n_sub_ref = len(sub_ref)
+                n_sub_ref = len(rows.get(i, ()))
                 if (
                     params.output.min_reflections_per_experiment is not None
                     and n_sub_ref < params.output.min_reflections_per_experiment
@@ -538,13 +544,7 @@ def average_detectors(target, panelgroups, depth):
                     continue
 
                 nrefs_per_exp.append(n_sub_ref)
-                sub_ref["id"] = flex.int(len(sub_ref), global_id)
-                # now update identifiers if set.
-                if i in ids_map:
-                    sub_ref.experiment_identifiers()[global_id] = ids_map[i]
-                if params.output.delete_shoeboxes and "shoebox" in sub_ref:
-                    del sub_ref["shoebox"]
-                reflections.extend(sub_ref)
+                kept_ids.append(i)
                 try:
                     experiments.append(combine(exp))
                 except ComparisonError as e:
@@ -559,6 +559,19 @@ def average_detectors(target, panelgroups, depth):
 
                 global_id += 1
 
+            # Select the reflections of the experiments kept with one selection
+            if not kept_ids:
+                continue
+            sub_ref = select_experiment_rows(refs, rows, kept_ids)
+            sub_ref["id"] = sub_ref["id"] + first_id
+            # now update identifiers if set.
+            for new_id, i in enumerate(kept_ids, start=first_id):
+                if i in ids_map:
+                    sub_ref.experiment_identifiers()[new_id] = ids_map[i]
+            if params.output.delete_shoeboxes and "shoebox" in sub_ref:
+                del sub_ref["shoebox"]
+            reflections.extend(sub_ref)
+
         if (
             params.output.min_reflections_per_experiment is not None
             and skipped_expts_min_refl > 0
@@ -78,6 +78,10 @@
     .type = float
     .help = "Datasets with a ΔCC½ below (mean - stdcutoff*std) are removed"
 
+  nproc = 1
+    .type = int(value_min=1)
+    .help = "The number of threads to use when computing ΔCC½ for each group"
+
   output {
     log = 'dials.compute_delta_cchalf.log'
       .type = str
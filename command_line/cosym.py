@@ -278,6 +278,7 @@ def _unit_cell_clustering(self, experiments):
             write_file_lists=False,
             schnell=False,
             doplot=False,
+            nproc=self.params.nproc,
         )
         logger.info(unit_cell_info(self.unit_cell_clusters))
         largest_cluster_lattice_ids = None
@@ -14,11 +14,11 @@
     ExperimentListFactory,
     ExperimentListTemplateImporter,
 )
-from libtbx.phil import parse
 
 from dials.util import Sorry, show_mail_handle_errors
 from dials.util.multi_dataset_handling import generate_experiment_identifiers
 from dials.util.options import flatten_experiments
+from dials.util.phil import cached_parse
 
 logger = logging.getLogger("dials.command_line.import")
 
@@ -75,7 +75,7 @@ def _pickle_load(fh):
 
 
 # Create the phil parameters
-phil_scope = parse(
+phil_scope = cached_parse(
     """
 
   output {
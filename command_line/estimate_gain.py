@@ -28,6 +28,9 @@
     .type = int
     .help = "For multi-file images (NeXus for example), report a gain for each"
             "image, up to max_images, and then report an average gain"
+  nproc = 1
+    .type = int(value_min=1)
+    .help = "The number of threads used to compute the index of dispersion"
   output {
     gain_map = None
       .type = str
@@ -38,7 +41,9 @@
 )
 
 
-def estimate_gain(imageset, kernel_size=(10, 10), output_gain_map=None, max_images=1):
+def estimate_gain(
+    imageset, kernel_size=(10, 10), output_gain_map=None, max_images=1, nproc=1
+):
     detector = imageset.get_detector()
 
     from dials.algorithms.image.threshold import DispersionThresholdDebug
@@ -48,12 +53,6 @@ def estimate_gain(imageset, kernel_size=(10, 10), output_gain_map=None, max_imag
     for image_no in range(len(imageset)):
         raw_data = imageset.get_raw_data(image_no)
 
-        gain_value = 1
-        gain_map = [
-            flex.double(raw_data[i].accessor(), gain_value)
-            for i in range(len(detector))
-        ]
-
         mask = imageset.get_mask(image_no)
 
         min_local = 0
@@ -63,22 +62,20 @@ def estimate_gain(imageset, kernel_size=(10, 10), output_gain_map=None, max_imag
         nsigma_s = 3
         global_threshold = 0
 
-        kabsch_debug_list = [
-            DispersionThresholdDebug(
+        # The gain only affects the thresholds, not the index of dispersion, so
+        # none is given, and only one panel's maps are held at a time
+        dispersion = flex.double()
+        for i_panel in range(len(detector)):
+            kabsch = DispersionThresholdDebug(
                 raw_data[i_panel].as_double(),
                 mask[i_panel],
-                gain_map[i_panel],
                 kernel_size,
                 nsigma_b,
                 nsigma_s,
                 global_threshold,
                 min_local,
+                nproc,
             )
-            for i_panel in range(len(detector))
-        ]
-
-        dispersion = flex.double()
-        for kabsch in kabsch_debug_list:
             dispersion.extend(kabsch.index_of_dispersion().as_1d())
 
         sorted_dispersion = flex.sorted(dispersion)
@@ -160,7 +157,11 @@ def run(args=None):
     assert len(imagesets) == 1
     imageset = imagesets[0]
     estimate_gain(
-        imageset, params.kernel_size, params.output.gain_map, params.max_images
+        imageset,
+        params.kernel_size,
+        params.output.gain_map,
+        params.max_images,
+        params.nproc,
     )
 
 
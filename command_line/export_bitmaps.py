@@ -1,5 +1,8 @@
 from __future__ import absolute_import, division, print_function
 
+import concurrent.futures
+import itertools
+import math
 import os
 import sys
 
@@ -68,6 +71,10 @@
   .type = int
 show_mask = False
   .type = bool
+nproc = 1
+  .type = int(value_min=1)
+  .help = "The number of processes used to export the images. Each process "
+          "reads, renders and writes one contiguous block of the images."
 png {
   compress_level = 1
     .type = int(value_min=0, value_max=9)
@@ -127,27 +134,15 @@ def run(args=None):
 
 
 def imageset_as_bitmaps(imageset, params):
-    brightness = params.brightness / 100
-    vendortype = "made up"
     # check that binning is a power of 2
     binning = params.binning
     if not (binning > 0 and ((binning & (binning - 1)) == 0)):
         raise Sorry("binning must be a power of 2")
     output_dir = params.output.directory
-    if output_dir is None:
-        output_dir = "."
-    elif not os.path.exists(output_dir):
+    if output_dir is not None and not os.path.exists(output_dir):
         os.makedirs(output_dir)
-    output_files = []
-
-    detector = imageset.get_detector()
 
-    panel = detector[0]
     scan = imageset.get_scan()
-    # XXX is this inclusive or exclusive?
-    saturation = panel.get_trusted_range()[1]
-    if params.saturation:
-        saturation = params.saturation
     if scan is not None and scan.get_oscillation()[1] > 0 and not params.imageset_index:
         start, end = scan.get_image_range()
     else:
@@ -160,6 +155,48 @@ def imageset_as_bitmaps(imageset, params):
     ]
     if params.output.file and len(image_range) != 1:
         sys.exit("output.file can only be specified if a single image is exported")
+
+    nproc = min(params.nproc, len(image_range))
+    if nproc <= 1:
+        return _export_images(imageset, image_range, start, params)
+
+    # Export contiguous blocks of the images concurrently, so that the files
+    # are returned in the same order as a serial export
+    block_size = int(math.ceil(len(image_range) / nproc))
+    blocks = [
+        image_range[i : i + block_size] for i in range(0, len(image_range), block_size)
+    ]
+    with concurrent.futures.ProcessPoolExecutor(max_workers=nproc) as pool:
+        results = pool.map(
+            _export_images,
+            itertools.repeat(imageset),
+            blocks,
+            itertools.repeat(start),
+            itertools.repeat(params),
+        )
+        return list(itertools.chain.from_iterable(results))
+
+
+def _export_images(imageset, image_range, start, params):
+    """Export the images image_range of an imageset with first image start.
+
+    Returns:
+        The paths of the files written, in the order of image_range
+    """
+    brightness = params.brightness / 100
+    vendortype = "made up"
+    binning = params.binning
+    output_dir = params.output.directory
+    if output_dir is None:
+        output_dir = "."
+    output_files = []
+
+    detector = imageset.get_detector()
+    # XXX is this inclusive or exclusive?
+    saturation = detector[0].get_trusted_range()[1]
+    if params.saturation:
+        saturation = params.saturation
+
     for i_image in image_range:
         image = imageset.get_raw_data(i_image - start)
 
@@ -115,15 +115,10 @@ def hot_pixel_mask(imageset, reflections):
 
 
 def filter_reflections(reflections, depth):
-    xylist = []
-
-    for i in range(len(reflections)):
-        refl = reflections[i]
-        s = refl["shoebox"]
-        if s.zsize() == depth:
-            xylist.append((s.xoffset(), s.yoffset()))
-
-    return xylist
+    """The corner (x, y) of the spots on every image, from their bounding boxes"""
+    x0, x1, y0, y1, z0, z1 = reflections["bbox"].parts()
+    sel = (z1 - z0) == depth
+    return list(zip(x0.select(sel), y0.select(sel)))
 
 
 if __name__ == "__main__":
@@ -4,8 +4,6 @@
 
 import logging
 
-from libtbx.phil import parse
-
 from dials.algorithms.shoebox import MaskCode
 from dials.algorithms.spot_finding import per_image_analysis
 from dials.array_family import flex
@@ -13,6 +11,7 @@
 from dials.util.ascii_art import spot_counts_per_image_plot
 from dials.util.multi_dataset_handling import generate_experiment_identifiers
 from dials.util.options import OptionParser, flatten_experiments
+from dials.util.phil import cached_parse
 from dials.util.version import dials_version
 
 logger = logging.getLogger("dials.command_line.find_spots")
@@ -45,7 +44,7 @@
 """
 
 # Set the phil scope
-phil_scope = parse(
+phil_scope = cached_parse(
     """
 
   output {
@@ -214,7 +213,10 @@ def run(self, args=None):
                 refl.centroid_px_to_mm([experiment])
                 refl.map_centroids_to_reciprocal_space([experiment])
                 stats = per_image_analysis.stats_per_image(
-                    experiment, refl, resolution_analysis=False
+                    experiment,
+                    refl,
+                    resolution_analysis=False,
+                    nthreads=params.spotfinder.mp.nproc,
                 )
                 logger.info(str(stats))
 
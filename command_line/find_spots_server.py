@@ -4,11 +4,13 @@
 
 standard_library.install_aliases()
 
+import concurrent.futures
+import functools
 import http.server as server_base
 import json
 import logging
-import multiprocessing
 import sys
+import threading
 import time
 import urllib.parse
 
@@ -68,10 +70,23 @@
 stop = False
 
 
-def work(filename, cl=None):
-    if cl is None:
-        cl = []
+# The state kept by each worker thread of the server between requests
+_worker = threading.local()
+
+
+@functools.lru_cache(maxsize=32)
+def parse_arguments(cl):
+    """
+    Interpret the arguments of a request. The arguments of recent requests are
+    cached, since clients usually send the same arguments with each image.
 
+    Args:
+        cl (tuple): The arguments of the request
+
+    Returns:
+        tuple: The server parameters, the spot finding phil and the arguments
+        which were not handled by either
+    """
     phil_scope = libtbx.phil.parse(
         """\
 ice_rings {
@@ -90,17 +105,9 @@ def work(filename, cl=None):
     )
     interp = phil_scope.command_line_argument_interpreter()
     params, unhandled = interp.process_and_fetch(
-        cl, custom_processor="collect_remaining"
+        list(cl), custom_processor="collect_remaining"
     )
-    filter_ice = params.extract().ice_rings.filter
-    ice_rings_width = params.extract().ice_rings.width
-    index = params.extract().index
-    integrate = params.extract().integrate
-    indexing_min_spots = params.extract().indexing_min_spots
-
-    from dxtbx.model.experiment_list import ExperimentListFactory
 
-    from dials.array_family import flex
     from dials.command_line.find_spots import phil_scope as find_spots_phil_scope
 
     interp = find_spots_phil_scope.command_line_argument_interpreter()
@@ -109,12 +116,67 @@ def work(filename, cl=None):
     )
     logger.info("The following spotfinding parameters have been modified:")
     logger.info(find_spots_phil_scope.fetch_diff(source=phil_scope).as_str())
+    return params.extract(), phil_scope, tuple(unhandled)
+
+
+def spot_finder(cl, phil_scope, experiments):
+    """
+    Get the spot finder of the current worker thread for the arguments of a
+    request. The spot finder is kept, with its masks and the workspaces of its
+    threshold algorithm, for the next request with the same arguments and
+    type of detector. Each thread has its own spot finders since the
+    workspaces can only be used by one thread at a time.
+
+    Args:
+        cl (tuple): The arguments of the request
+        phil_scope: The spot finding phil for the arguments
+        experiments: The experiments to find spots on
+
+    Returns:
+        The spot finder
+    """
+    from dials.algorithms.spot_finding.factory import SpotFinderFactory
+    from dials.util.masking import CachedMaskGenerator
+
+    if not hasattr(_worker, "spot_finders"):
+        _worker.spot_finders = {}
+    key = (cl, experiments[0].detector[0].get_type())
+    try:
+        return _worker.spot_finders[key]
+    except KeyError:
+        pass
     params = phil_scope.extract()
     # no need to write the hot mask in the server/client
     params.spotfinder.write_hot_mask = False
+    find_spots = SpotFinderFactory.from_parameters(
+        experiments=experiments, params=params
+    )
+    find_spots.mask_generator = CachedMaskGenerator(params.spotfinder.filter)
+    _worker.spot_finders[key] = find_spots
+    return find_spots
+
+
+def work(filename, cl=None):
+    if cl is None:
+        cl = []
+    cl = tuple(cl)
+
+    options, find_spots_phil, unhandled = parse_arguments(cl)
+    filter_ice = options.ice_rings.filter
+    ice_rings_width = options.ice_rings.width
+    index = options.index
+    integrate = options.integrate
+    indexing_min_spots = options.indexing_min_spots
+    unhandled = list(unhandled)
+
+    from dxtbx.model.experiment_list import ExperimentListFactory
+
+    from dials.array_family import flex
+
     experiments = ExperimentListFactory.from_filenames([filename])
     t0 = time.time()
-    reflections = flex.reflection_table.from_observations(experiments, params)
+    find_spots = spot_finder(cl, find_spots_phil, experiments)
+    reflections = find_spots(experiments)
     t1 = time.time()
     logger.info("Spotfinding took %.2f seconds" % (t1 - t0))
     from dials.algorithms.spot_finding import per_image_analysis
@@ -295,6 +357,39 @@ def do_GET(self):
         self.wfile.write(response)
 
 
+class server(server_base.HTTPServer):
+    """
+    A HTTP server which handles requests concurrently with a fixed pool of
+    worker threads. The threads live as long as the server, so the spot
+    finders they keep are reused for later requests.
+    """
+
+    # The time to wait for a request before checking whether to stop
+    timeout = 0.5
+
+    def __init__(self, server_address, handler_class, nproc):
+        super().__init__(server_address, handler_class)
+        self.executor = concurrent.futures.ThreadPoolExecutor(
+            max_workers=nproc, thread_name_prefix="find_spots_server"
+        )
+
+    def process_request(self, request, client_address):
+        self.executor.submit(self.process_request_thread, request, client_address)
+
+    def process_request_thread(self, request, client_address):
+        """Handle a request in a worker thread, as socketserver.ThreadingMixIn"""
+        try:
+            self.finish_request(request, client_address)
+        except Exception:
+            self.handle_error(request, client_address)
+        finally:
+            self.shutdown_request(request)
+
+    def server_close(self):
+        super().server_close()
+        self.executor.shutdown(wait=True)
+
+
 def serve(httpd):
     try:
         while not stop:
@@ -307,6 +402,7 @@ def serve(httpd):
     """\
 nproc = Auto
   .type = int(value_min=1)
+  .help = "The number of requests to process concurrently"
 port = 1701
   .type = int(value_min=1)
 """
@@ -314,14 +410,8 @@ def serve(httpd):
 
 
 def main(nproc, port):
-    server_class = server_base.HTTPServer
-    httpd = server_class(("", port), handler)
-    print(time.asctime(), "Serving %d processes on port %d" % (nproc, port))
-
-    for j in range(nproc - 1):
-        proc = multiprocessing.Process(target=serve, args=(httpd,))
-        proc.daemon = True
-        proc.start()
+    httpd = server(("", port), handler, nproc)
+    print(time.asctime(), "Serving %d threads on port %d" % (nproc, port))
     serve(httpd)
     httpd.server_close()
     print(time.asctime(), "done")
@@ -331,10 +421,6 @@ def main(nproc, port):
 def run(args=None):
     usage = "dials.find_spots_server [options]"
 
-    # Python 3.8 on macOS... needs fork
-    if sys.hexversion >= 0x3080000 and sys.platform == "darwin":
-        multiprocessing.set_start_method("fork")
-
     from dials.util.options import OptionParser
 
     parser = OptionParser(usage=usage, phil=phil_scope, epilog=help_message)
@@ -0,0 +1,237 @@
+"""
+Find spots on the frames streamed by a detector and publish the per-image
+statistics as each frame is analysed.
+"""
+
+import json
+import logging
+import threading
+import time
+
+import libtbx.phil
+
+from dials.util import Sorry, log, show_mail_handle_errors
+from dials.util.mp import available_cores
+from dials.util.options import OptionParser, flatten_experiments
+from dials.util.version import dials_version
+
+logger = logging.getLogger("dials.command_line.find_spots_stream")
+
+help_message = """
+Find spots on the frames of a data collection as they are streamed by the
+detector, and compute the number of spots and the estimates of the resolution
+limit for each frame, as dials.spot_counts_per_image does for the results of
+dials.find_spots. This gives feedback on the data while it is collected.
+
+The frames are received over ZeroMQ in the DECTRIS stream format (version 1)
+and the detector and beam models are taken from an experiment list imported
+from an image of the same detector. The frames are put into a buffer and
+analysed by a pool of threads; if the analysis cannot keep up with the
+detector the oldest frames in the buffer are dropped. The statistics of each
+frame can be published as a json message on a ZeroMQ PUB socket, and are all
+written to a json file at the end of the series.
+
+This requires pyzmq, and lz4 or bitshuffle for compressed frames.
+
+Examples::
+
+  dials.find_spots_stream imported.expt endpoint=tcp://eiger:9999
+
+  dials.find_spots_stream imported.expt endpoint=tcp://eiger:9999 \\
+    publish=tcp://*:9998 nproc=8 d_min=2
+"""
+
+phil_scope = libtbx.phil.parse(
+    """
+endpoint = None
+  .type = str
+  .help = "The ZeroMQ endpoint of the detector stream"
+publish = None
+  .type = str
+  .help = "A ZeroMQ endpoint to bind, on which the statistics of each frame"
+          "are published"
+nproc = Auto
+  .type = int(value_min=1)
+  .help = "The number of threads analysing frames"
+buffer {
+  size = 64
+    .type = int(value_min=1)
+    .help = "The number of frames which can wait to be analysed"
+  block = False
+    .type = bool
+    .help = "Stop receiving frames while the buffer is full, instead of"
+            "dropping the oldest frames"
+}
+timeout = None
+  .type = float(value_min=0)
+  .help = "Stop if no message is received for this many seconds"
+resolution_analysis = True
+  .type = bool
+ice_rings {
+  filter = True
+    .type = bool
+  width = 0.004
+    .type = float(value_min=0.0)
+}
+output {
+  json = stream_spots.json
+    .type = path
+  log = dials.find_spots_stream.log
+    .type = path
+}
+include scope dials.algorithms.spot_finding.factory.phil_scope
+""",
+    process_includes=True,
+)
+
+
+class Publisher(object):
+    """
+    Collect the statistics of the frames, log them and publish them. It is
+    called from the analysis threads.
+    """
+
+    def __init__(self, endpoint=None):
+        self.results = []
+        self._lock = threading.Lock()
+        self._socket = None
+        if endpoint is not None:
+            import zmq
+
+            self._socket = zmq.Context.instance().socket(zmq.PUB)
+            self._socket.bind(endpoint)
+
+    def __call__(self, stats):
+        with self._lock:
+            self.results.append(stats)
+            if "error" in stats:
+                return
+            logger.info(
+                "Frame %d: %d spots, %d excluding ice rings, d_min %.2f",
+                stats["frame"],
+                stats["n_spots_total"],
+                stats["n_spots_no_ice"],
+                stats["estimated_d_min"],
+            )
+            if self._socket is not None:
+                self._socket.send_json(stats)
+
+    def close(self):
+        if self._socket is not None:
+            self._socket.close()
+
+
+def run_stream(params, experiments):
+    """
+    Analyse the frames of a series from the stream.
+
+    Args:
+        params: The parameters
+        experiments: The experiment list giving the models of the detector
+
+    Returns:
+        dict: The statistics of each frame, in frame order, the frames which
+        were dropped and the frame rate of the analysis
+    """
+    from dials.algorithms.spot_finding.factory import SpotFinderFactory
+    from dials.algorithms.spot_finding.stream import (
+        FrameAnalyser,
+        StreamingSpotFinder,
+        StreamReceiver,
+    )
+    from dials.util.masking import MaskGenerator
+
+    if len(experiments[0].detector) != 1:
+        raise Sorry("Only single panel detectors can be streamed")
+
+    # The static mask of the detector, shared by the analysers
+    mask = MaskGenerator(params.spotfinder.filter).generate(experiments[0].imageset)
+    lookup = SpotFinderFactory.load_image(params.spotfinder.lookup.mask)
+    if lookup is not None:
+        mask = tuple(m1 & m2 for m1, m2 in zip(mask, lookup))
+
+    def create_analyser():
+        return FrameAnalyser(
+            experiments,
+            params,
+            mask,
+            resolution_analysis=params.resolution_analysis,
+            filter_ice=params.ice_rings.filter,
+            ice_rings_width=params.ice_rings.width,
+        )
+
+    publisher = Publisher(params.publish)
+    receiver = StreamReceiver(params.endpoint, timeout=params.timeout)
+    finder = StreamingSpotFinder(
+        create_analyser,
+        publisher,
+        nthreads=params.nproc,
+        buffer_size=params.buffer.size,
+        block=params.buffer.block,
+    )
+    logger.info(f"Receiving frames from {params.endpoint}")
+    start = None
+    try:
+        for frame in receiver.frames():
+            if start is None:
+                start = time.perf_counter()
+            finder.put(frame)
+    finally:
+        finder.close()
+        receiver.close()
+        publisher.close()
+    elapsed = time.perf_counter() - start if start is not None else 0
+
+    results = sorted(publisher.results, key=lambda stats: stats["frame"])
+    if finder.dropped:
+        logger.warning(
+            f"{len(finder.dropped)} frames were dropped since the analysis could "
+            "not keep up with the stream"
+        )
+    frame_rate = len(results) / elapsed if elapsed > 0 else 0
+    logger.info(f"Analysed {len(results)} frames at {frame_rate:.1f} frames/s")
+    return {
+        "frames": results,
+        "dropped": sorted(finder.dropped),
+        "frame_rate": frame_rate,
+    }
+
+
+@show_mail_handle_errors()
+def run(args=None):
+    usage = "dials.find_spots_stream [options] imported.expt endpoint=tcp://host:port"
+    parser = OptionParser(
+        usage=usage,
+        phil=phil_scope,
+        read_experiments=True,
+        check_format=False,
+        epilog=help_message,
+    )
+    params, options = parser.parse_args(args=args, show_diff_phil=False)
+    experiments = flatten_experiments(params.input.experiments)
+    if not experiments or params.endpoint is None:
+        parser.print_help()
+        return
+
+    log.config(logfile=params.output.log)
+    logger.info(dials_version())
+    diff_phil = parser.diff_phil.as_str()
+    if diff_phil:
+        logger.info("The following parameters have been modified:\n%s", diff_phil)
+
+    try:
+        import zmq  # noqa: F401
+    except ImportError:
+        raise Sorry("dials.find_spots_stream requires pyzmq")
+
+    if params.nproc is libtbx.Auto:
+        params.nproc = available_cores()
+
+    results = run_stream(params, experiments)
+    with open(params.output.json, "w") as fh:
+        json.dump(results, fh, indent=2)
+    logger.info(f"Saved the statistics to {params.output.json}")
+
+
+if __name__ == "__main__":
+    run()
@@ -15,6 +15,7 @@
 from dials.util import log, show_mail_handle_errors
 from dials.util.multi_dataset_handling import renumber_table_id_columns
 from dials.util.options import OptionParser, reflections_and_experiments_from_files
+from dials.util.phil import cached_parse
 from dials.util.slice import slice_reflections
 from dials.util.version import dials_version
 
@@ -53,7 +54,7 @@
 """
 
 
-phil_scope = iotbx.phil.parse(
+phil_scope = cached_parse(
     """\
 include scope dials.algorithms.indexing.indexer.phil_scope
 
@@ -85,6 +86,7 @@
     .type = str
 }
 """,
+    converter_registry=iotbx.phil.default_converter_registry,
     process_includes=True,
 )
 
@@ -169,6 +171,11 @@ def index(experiments, reflections, params):
         indexed_experiments = ExperimentList()
         indexed_reflections = flex.reflection_table()
 
+        # the sweeps are indexed in separate processes, so each of them assigns
+        # indices with a single thread
+        worker_params = copy.deepcopy(params)
+        worker_params.indexing.nproc = 1
+
         with concurrent.futures.ProcessPoolExecutor(
             max_workers=params.indexing.nproc
         ) as pool:
@@ -181,7 +188,7 @@ def index(experiments, reflections, params):
                         _index_experiments,
                         ExperimentList([expt]),
                         refl,
-                        copy.deepcopy(params),
+                        copy.deepcopy(worker_params),
                         known_crystal_models=known_crystal_models,
                     )
                 )
@@ -27,7 +27,6 @@
 import sys
 
 from dxtbx.model.experiment_list import Experiment, ExperimentList
-from libtbx.phil import parse
 
 import dials.util.log
 from dials.algorithms.integration.integrator import create_integrator
@@ -36,6 +35,7 @@
 from dials.util import show_mail_handle_errors
 from dials.util.command_line import heading
 from dials.util.options import OptionParser, reflections_and_experiments_from_files
+from dials.util.phil import cached_parse
 from dials.util.slice import slice_crystal
 from dials.util.version import dials_version
 
@@ -43,7 +43,7 @@
 
 # Create the phil scope
 
-phil_scope = parse(
+phil_scope = cached_parse(
     """
 
   output {
@@ -199,7 +199,7 @@ def process_reference(reference):
     return reference, rubbish
 
 
-def filter_reference_pixels(reference, experiments):
+def filter_reference_pixels(reference, experiments, nthreads=1):
     """
     Set any pixel closer to other reflections to background.
 
@@ -220,6 +220,7 @@ def filter_reference_pixels(reference, experiments):
             experiment.goniometer,
             experiment.scan,
             experiment.crystal,
+            nthreads=nthreads,
         )
         modified_count += modified.count(True)
         reference.set_selected(indices, subset)
@@ -448,7 +449,9 @@ def run_integration(params, experiments, reference=None):
 
         # Check pixels don't belong to neighbours
         if exp.goniometer is not None and exp.scan is not None:
-            reference = filter_reference_pixels(reference, experiments)
+            reference = filter_reference_pixels(
+                reference, experiments, nthreads=params.integration.mp.nproc
+            )
 
         # Modify experiment list if scan range is set.
         experiments, reference = split_for_scan_range(
@@ -471,6 +474,7 @@ def run_integration(params, experiments, reference=None):
         margin=params.prediction.margin,
         force_static=params.prediction.force_static,
         padding=params.prediction.padding,
+        nthreads=params.integration.mp.nproc,
     )
 
     # Match reference with predicted
@@ -24,6 +24,12 @@
       .type = str
       .help = "The output filename"
 
+    mapped = False
+      .type = bool
+      .help = "Write the model as a memory mapped file rather than a pickle."
+              "Integration processes reading the model then share a single"
+              "copy of it rather than each unpickling their own."
+
     log = 'dials.model_background.log'
       .type = str
       .help = "The log filename"
@@ -83,6 +89,10 @@
       .type = choice
       .help = "Which image to use"
 
+    nproc = 1
+      .type = int(value_min=1)
+      .help = "The number of threads to use for the polar transform"
+
   }
 
   include scope dials.algorithms.integration.integrator.phil_scope
@@ -270,8 +280,11 @@ def run(self, args=None):
         static_model = StaticBackgroundModel()
         for m in model:
             static_model.add(m.model)
-        with open(params.output.model, "wb") as outfile:
-            pickle.dump(static_model, outfile, protocol=pickle.HIGHEST_PROTOCOL)
+        if params.output.mapped:
+            static_model.as_mapped_file(params.output.model)
+        else:
+            with open(params.output.model, "wb") as outfile:
+                pickle.dump(static_model, outfile, protocol=pickle.HIGHEST_PROTOCOL)
 
         # Output some diagnostic images
         image_generator = ImageGenerator(model)
@@ -49,6 +49,12 @@
     .type = bool
     .optional = True
     .short_caption = Ignore masks from dxtbx class
+  single_precision = False
+    .type = bool
+    .help = "Accumulate the map in single precision to halve its memory use"
+  nproc = 1
+    .type = int(value_min=1)
+    .help = "The number of threads to use when filling the map"
 }
 """,
     process_includes=True,
@@ -91,8 +97,13 @@ def run(self, args=None):
         self.grid_size = params.rs_mapper.grid_size
         self.max_resolution = params.rs_mapper.max_resolution
         self.ignore_mask = params.rs_mapper.ignore_mask
+        self.nproc = params.rs_mapper.nproc
 
-        self.grid = flex.double(
+        if params.rs_mapper.single_precision:
+            grid_type = flex.float
+        else:
+            grid_type = flex.double
+        self.grid = grid_type(
             flex.grid(self.grid_size, self.grid_size, self.grid_size), 0
         )
         self.counts = flex.int(
@@ -103,6 +114,8 @@ def run(self, args=None):
             self.process_imageset(experiment.imageset)
 
         recviewer.normalize_voxels(self.grid, self.counts)
+        if isinstance(self.grid, flex.float):
+            self.grid = self.grid.as_double()
 
         # Let's use 1/(100A) as the unit so that the absolute numbers in the
         # "cell dimensions" field of the ccp4 map are typical for normal
@@ -135,10 +148,9 @@ def process_imageset(self, imageset):
             raise Sorry("This program does not support non-square pixels.")
 
         # cache transformation
-        xy = recviewer.get_target_pixels(panel, s0, xlim, ylim, self.max_resolution)
-        s1 = panel.get_lab_coord(xy * pixel_size[0])
-        s1 = s1 / s1.norms() * (1 / beam.get_wavelength())
-        S = s1 - s0
+        xy, S = recviewer.get_target_pixels_and_S(
+            panel, s0, xlim, ylim, self.max_resolution, nthreads=self.nproc
+        )
 
         for i in range(len(imageset)):
             axis = imageset.get_goniometer().get_rotation_axis()
@@ -148,15 +160,22 @@ def process_imageset(self, imageset):
             if not self.reverse_phi:
                 # the pixel is in S AFTER rotation. Thus we have to rotate BACK.
                 angle *= -1
-            rotated_S = S.rotate_around_origin(axis, angle)
 
             data = imageset.get_raw_data(i)[0]
             if not self.ignore_mask:
                 mask = imageset.get_mask(i)[0]
                 data.set_selected(~mask, 0)
 
-            recviewer.fill_voxels(
-                data, self.grid, self.counts, rotated_S, xy, rec_range
+            recviewer.rotate_and_fill_voxels(
+                data,
+                self.grid,
+                self.counts,
+                S,
+                xy,
+                axis,
+                angle,
+                rec_range,
+                nthreads=self.nproc,
             )
 
 
@@ -92,6 +92,7 @@ def optimize_origin_offset_local_scope(
     mm_search_scope=4,
     wide_search_binning=1,
     plot_search_scope=False,
+    nproc=1,
 ):
     """Local scope: find the optimal origin-offset closest to the current overall detector position
     (local minimum, simple minimization)"""
@@ -115,23 +116,13 @@ def optimize_origin_offset_local_scope(
         grid = max(1, int(mm_search_scope / plot_px_sz))
         widegrid = 2 * grid + 1
 
-        def get_experiment_score_for_coord(x, y):
-            new_origin_offset = x * plot_px_sz * beamr1 + y * plot_px_sz * beamr2
-            return sum(
-                _get_origin_offset_score(
-                    new_origin_offset,
-                    solution_lists[i],
-                    amax_lists[i],
-                    reflection_lists[i],
-                    experiment,
-                )
-                for i, experiment in enumerate(experiments)
-            )
-
-        scores = flex.double(
-            get_experiment_score_for_coord(x, y)
+        offsets = [
+            (x * plot_px_sz * beamr1 + y * plot_px_sz * beamr2).elems
             for y in range(-grid, grid + 1)
             for x in range(-grid, grid + 1)
+        ]
+        scores = _score_origin_offsets(
+            offsets, solution_lists, amax_lists, reflection_lists, experiments, nproc
         )
 
         def igrid(x):
@@ -192,20 +183,14 @@ def target(self, vector):
     if plot_search_scope:
         plot_px_sz = experiments[0].get_detector()[0].get_pixel_size()[0]
         grid = max(1, int(mm_search_scope / plot_px_sz))
-        scores = flex.double()
-        for y in range(-grid, grid + 1):
-            for x in range(-grid, grid + 1):
-                new_origin_offset = x * plot_px_sz * beamr1 + y * plot_px_sz * beamr2
-                score = 0
-                for i, experiment in enumerate(experiments):
-                    score += _get_origin_offset_score(
-                        new_origin_offset,
-                        solution_lists[i],
-                        amax_lists[i],
-                        reflection_lists[i],
-                        experiment,
-                    )
-                scores.append(score)
+        offsets = [
+            (x * plot_px_sz * beamr1 + y * plot_px_sz * beamr2).elems
+            for y in range(-grid, grid + 1)
+            for x in range(-grid, grid + 1)
+        ]
+        scores = _score_origin_offsets(
+            offsets, solution_lists, amax_lists, reflection_lists, experiments, nproc
+        )
 
         def show_plot(widegrid, excursi):
             excursi.reshape(flex.grid(widegrid, widegrid))
@@ -253,6 +238,54 @@ def igrid(x):
     return new_experiments
 
 
+def _get_origin_offset_scores(
+    offsets, solution_lists, amax_lists, reflection_lists, experiments
+):
+    """The score of each trial origin offset, summed over the experiments"""
+    return [
+        sum(
+            _get_origin_offset_score(
+                matrix.col(offset),
+                solution_lists[i],
+                amax_lists[i],
+                reflection_lists[i],
+                experiment,
+            )
+            for i, experiment in enumerate(experiments)
+        )
+        for offset in offsets
+    ]
+
+
+def _score_origin_offsets(
+    offsets, solution_lists, amax_lists, reflection_lists, experiments, nproc=1
+):
+    """Score a grid of trial origin offsets, with one block of offsets per process.
+
+    Each trial is independent, so the blocks are scored in parallel and the
+    scores are returned in the order of the offsets.
+    """
+    nproc = min(nproc, len(offsets))
+    if nproc <= 1:
+        return flex.double(
+            _get_origin_offset_scores(
+                offsets, solution_lists, amax_lists, reflection_lists, experiments
+            )
+        )
+    block_size = int(math.ceil(len(offsets) / nproc))
+    blocks = [offsets[i : i + block_size] for i in range(0, len(offsets), block_size)]
+    with concurrent.futures.ProcessPoolExecutor(max_workers=nproc) as pool:
+        results = pool.map(
+            _get_origin_offset_scores,
+            blocks,
+            itertools.repeat(solution_lists),
+            itertools.repeat(amax_lists),
+            itertools.repeat(reflection_lists),
+            itertools.repeat(experiments),
+        )
+        return flex.double(itertools.chain.from_iterable(results))
+
+
 def _get_origin_offset_score(
     trial_origin_offset, solutions, amax, spots_mm, experiment
 ):
@@ -433,6 +466,7 @@ def discover_better_experimental_model(
         mm_search_scope=mm_search_scope,
         wide_search_binning=wide_search_binning,
         plot_search_scope=plot_search_scope,
+        nproc=nproc,
     )
     new_detector = new_experiments[0].detector
     old_panel, old_beam_centre = detector.get_ray_intersection(beam.get_s0())
@@ -19,7 +19,6 @@
     ExperimentsPredictorFactory,
 )
 from dials.array_family import flex
-from dials.model.data import Shoebox
 from dials.util import show_mail_handle_errors
 from dials.util.options import OptionParser, reflections_and_experiments_from_files
 
@@ -52,6 +51,55 @@
 )
 
 
+def _split_into_stills(reflections, keys, first, last, first_id):
+    """Split the reflections of a sequence into a 2D slice on each image.
+
+    Each reflection in a 3D shoebox can be found on multiple images, so the
+    shoeboxes are split into one slice per image in a single pass, and the
+    slices on the scan points first to last - 1 are kept, ordered by image. The
+    slices on scan point i are given the id first_id + i - first and a bounding
+    box on frame 0 of their own single image imageset.
+
+    Args:
+        reflections: The reflections of one sequence
+        keys: The columns to keep
+        first: The first scan point
+        last: The last scan point + 1
+        first_id: The id of the still of the first scan point
+
+    Returns:
+        The reflection table of the slices, with their intensities and
+        centroids recalculated
+    """
+    slices = flex.reflection_table()
+    for key in keys:
+        slices[key] = reflections[key]
+    slices.split_partials_with_shoebox()
+    if "partial_id" in slices:
+        del slices["partial_id"]
+
+    frame = slices["bbox"].parts()[4]
+    slices = slices.select((frame >= first) & (frame < last))
+    frame = slices["bbox"].parts()[4]
+    slices = slices.select(flex.sort_permutation(frame, stable=True))
+    x0, x1, y0, y1, frame, _ = slices["bbox"].parts()
+
+    # keep the original shoebox but reset the z values
+    n = len(slices)
+    slices["bbox"] = flex.int6(x0, x1, y0, y1, flex.int(n, 0), flex.int(n, 1))
+    slices["shoebox"].set_bounding_boxes(slices["bbox"])
+    slices["id"] = frame - first + first_id
+    slices["imageset_id"] = frame - first + first_id
+
+    intensity = slices["shoebox"].summed_intensity()
+    slices["intensity.sum.value"] = intensity.observed_value()
+    slices["intensity.sum.variance"] = intensity.observed_variance()
+    centroid = slices["shoebox"].centroid_foreground_minus_background()
+    slices["xyzobs.px.value"] = centroid.px_position()
+    slices["xyzobs.px.variance"] = centroid.px_variance()
+    return slices
+
+
 def sequence_to_stills(experiments, reflections, params):
     assert len(reflections) == 1
     reflections = reflections[0]
@@ -94,13 +142,22 @@ def sequence_to_stills(experiments, reflections, params):
         goniometer_axis = matrix.col(experiment.goniometer.get_rotation_axis())
         step = experiment.scan.get_oscillation()[1]
 
+        # The scan points to make stills of
+        first, last = experiment.scan.get_array_range()
+        if params.max_scan_points:
+            last = max(first, min(last, params.max_scan_points))
+
+        # Split the reflections of this sequence into one slice per image
         refls = reflections.select(reflections["id"] == expt_id)
-        _, _, _, _, z1, z2 = refls["bbox"].parts()
+        new_reflections.extend(
+            _split_into_stills(
+                refls, list(new_reflections.keys()), first, last, len(new_experiments)
+            )
+        )
 
         # Create an experiment for each scanpoint
-        for i_scan_point in range(*experiment.scan.get_array_range()):
-            if params.max_scan_points and i_scan_point >= params.max_scan_points:
-                break
+        imageset = experiment.imageset.as_imageset()
+        for i_scan_point in range(first, last):
             # The A matrix is the goniometer setting matrix for this scan point
             # times the scan varying A matrix at this scan point. Note, the
             # goniometer setting matrix for scan point zero will be the identity
@@ -141,45 +198,10 @@ def sequence_to_stills(experiments, reflections, params):
                 detector=experiment.detector,
                 beam=experiment.beam,
                 crystal=crystal,
-                imageset=experiment.imageset.as_imageset()[
-                    i_scan_point : i_scan_point + 1
-                ],
+                imageset=imageset[i_scan_point : i_scan_point + 1],
             )
             new_experiments.append(new_experiment)
 
-            # Each reflection in a 3D shoebox can be found on multiple images.
-            # Slice the reflections such that any reflection on this scan point
-            # is included with this image
-            new_id = len(new_experiments) - 1
-            subrefls = refls.select((i_scan_point >= z1) & (i_scan_point < z2))
-            for refl in subrefls.rows():
-                assert i_scan_point in range(*refl["bbox"][4:6])
-
-                new_sb = Shoebox()
-                start = i_scan_point - refl["bbox"][4]  # z1
-                new_sb.data = refl["shoebox"].data[start : start + 1, :, :]
-                new_sb.background = refl["shoebox"].background[start : start + 1, :, :]
-                new_sb.mask = refl["shoebox"].mask[start : start + 1, :, :]
-                intensity = new_sb.summed_intensity()
-                new_sb.bbox = tuple(
-                    list(refl["bbox"])[0:4] + [0, 1]
-                )  # keep the original shoebox but reset the z values
-                new_sb.panel = refl["panel"]
-                new_refl = {}
-                new_refl["id"] = new_refl["imageset_id"] = new_id
-                new_refl["shoebox"] = new_sb
-                new_refl["bbox"] = new_sb.bbox
-                new_refl["intensity.sum.value"] = intensity.observed.value
-                new_refl["intensity.sum.variance"] = intensity.observed.variance
-                for key in ["entering", "flags", "miller_index", "panel"]:
-                    new_refl[key] = refl[key]
-                centroid = new_sb.centroid_foreground_minus_background()
-                new_refl["xyzobs.px.value"] = centroid.px.position
-                new_refl["xyzobs.px.variance"] = centroid.px.variance
-                new_reflections.append({})
-                for key in new_refl:
-                    new_reflections[key][-1] = new_refl[key]
-
     # Re-predict using the reflection slices and the stills predictors
     ref_predictor = ExperimentsPredictorFactory.from_experiments(
         new_experiments, force_stills=new_experiments.all_stills()
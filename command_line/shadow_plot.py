@@ -10,6 +10,7 @@
 from scitbx.array_family import flex
 
 import dials.util
+from dials.algorithms.shadowing import goniometer_shadow_masks
 from dials.util import Sorry
 
 help_message = """
@@ -32,6 +33,9 @@
   .type = float(value_min=0, value_max=100)
 mode = *1d 2d
   .type = choice
+nproc = 1
+  .type = int(value_min=1)
+  .help = "The number of threads used to rasterise the shadows in 1d mode"
 output {
   plot = scan_shadow_plot.png
     .type = path
@@ -99,14 +103,14 @@ def run(args=None):
         n_px_tot = flex.double(scan_points.size(), 0)
 
         assert len(angles) == 3
-        for i, scan_angle in enumerate(scan_points):
-            shadow = masker.project_extrema(detector, scan_angle)
+        masks = goniometer_shadow_masks(
+            masker, detector, start, step, scan_points.size(), nproc=params.nproc
+        )
+        for i in range(scan_points.size()):
             for p_id in range(len(detector)):
                 px_x, px_y = detector[p_id].get_image_size()
                 n_px_tot[i] += px_x * px_y
-                if shadow[p_id].size() < 4:
-                    continue
-                n_px_shadowed[i] += polygon_area(shadow[p_id])
+                n_px_shadowed[i] += masks.num_shadowed(i, p_id)
 
     else:
         kappa_values = flex.double(libtbx.utils.frange(0, 360, step=step))
@@ -3,7 +3,6 @@
 from __future__ import absolute_import, division, print_function
 
 import dials.util
-from dials.array_family import flex
 
 help_message = """
 
@@ -49,12 +48,6 @@ def __init__(self):
             usage=usage, phil=phil_scope, read_reflections=True, epilog=help_message
         )
 
-    @staticmethod
-    def sort_permutation(column, reverse=False):
-        indices = flex.size_t_range(len(column))
-        perm = sorted(indices, key=lambda k: column[k], reverse=reverse)
-        return flex.size_t(perm)
-
     def run(self, args=None):
         """Execute the script."""
         from dials.util.options import flatten_reflections
@@ -74,8 +67,7 @@ def run(self, args=None):
 
         # Sort the reflections
         print("Sorting by %s with reverse=%r" % (params.key, params.reverse))
-        perm = self.sort_permutation(reflections[params.key], params.reverse)
-        reflections = reflections.select(perm)
+        reflections.sort(params.key, reverse=params.reverse)
 
         if options.verbose > 0:
             print("Head of sorted list " + params.key + ":")
@@ -6,9 +6,12 @@
 from libtbx.phil import parse
 
 import dials.util
-from dials.array_family import flex
 from dials.util import Sorry
 from dials.util.export_mtz import match_wavelengths
+from dials.util.multi_dataset_handling import (
+    rows_by_experiment_id,
+    select_experiment_rows,
+)
 from dials.util.options import OptionParser, reflections_and_experiments_from_files
 
 help_message = """
@@ -145,6 +148,26 @@ def run(self, args=None):
                     % (sum(params.output.chunk_sizes), len(experiments))
                 )
 
+        # Find the rows of each experiment once, and move the identifiers out of
+        # the table so that they are not copied to every selection
+        identifiers = {}
+        if reflections is not None and not params.by_wavelength:
+            rows = rows_by_experiment_id(reflections)
+            identifiers = dict(reflections.experiment_identifiers())
+            for k in identifiers:
+                del reflections.experiment_identifiers()[k]
+        id_by_identifier = {v: k for k, v in identifiers.items()}
+
+        def experiment_id(i, experiment):
+            """The id of the reflections of an experiment in the input table"""
+            if not identifiers:
+                return i
+            if experiment.identifier not in id_by_identifier:
+                raise Sorry(
+                    "Unable to find id matching experiment identifier in reflection table."
+                )
+            return id_by_identifier[experiment.identifier]
+
         if params.by_wavelength:
             if reflections:
                 if not reflections.experiment_identifiers():
@@ -186,19 +209,10 @@ def run(self, args=None):
             assert (
                 not params.output.chunk_size
             ), "chunk_size + by_detector is not implemented"
-            if reflections is None:
-                split_data = {
-                    detector: {"experiments": ExperimentList()}
-                    for detector in experiments.detectors()
-                }
-            else:
-                split_data = {
-                    detector: {
-                        "experiments": ExperimentList(),
-                        "reflections": flex.reflection_table(),
-                    }
-                    for detector in experiments.detectors()
-                }
+            split_data = {
+                detector: {"experiments": ExperimentList(), "ids": []}
+                for detector in experiments.detectors()
+            }
 
             for i, experiment in enumerate(experiments):
                 split_expt_id = experiments.detectors().index(experiment.detector)
@@ -211,32 +225,9 @@ def run(self, args=None):
                         "Adding reflections for experiment %d to %s"
                         % (i, reflections_filename)
                     )
-                    if reflections.experiment_identifiers().keys():
-                        # first find which id value corresponds to experiment in question
-                        identifier = experiment.identifier
-                        id_ = None
-                        for k in reflections.experiment_identifiers().keys():
-                            if reflections.experiment_identifiers()[k] == identifier:
-                                id_ = k
-                                break
-                        if id_ is None:
-                            raise Sorry(
-                                "Unable to find id matching experiment identifier in reflection table."
-                            )
-                        ref_sel = reflections.select(reflections["id"] == id_)
-                        # now reset ids and reset/update identifiers map
-                        for k in ref_sel.experiment_identifiers().keys():
-                            del ref_sel.experiment_identifiers()[k]
-                        new_id = len(split_data[experiment.detector]["experiments"]) - 1
-                        ref_sel["id"] = flex.int(len(ref_sel), new_id)
-                        ref_sel.experiment_identifiers()[new_id] = identifier
-                    else:
-                        ref_sel = reflections.select(reflections["id"] == i)
-                        ref_sel["id"] = flex.int(
-                            len(ref_sel),
-                            len(split_data[experiment.detector]["experiments"]) - 1,
-                        )
-                    split_data[experiment.detector]["reflections"].extend(ref_sel)
+                    split_data[experiment.detector]["ids"].append(
+                        experiment_id(i, experiment)
+                    )
 
             for i, detector in enumerate(experiments.detectors()):
                 experiment_filename = experiments_template(index=i)
@@ -249,67 +240,43 @@ def run(self, args=None):
                         "Saving reflections for experiment %d to %s"
                         % (i, reflections_filename)
                     )
-                    split_data[detector]["reflections"].as_file(reflections_filename)
+                    select_experiment_rows(
+                        reflections, rows, split_data[detector]["ids"], identifiers
+                    ).as_file(reflections_filename)
         elif params.output.chunk_size or params.output.chunk_sizes:
 
-            def save_chunk(chunk_id, expts, refls):
+            def save_chunk(chunk_id, expts, ids):
                 experiment_filename = experiments_template(index=chunk_id)
                 print("Saving chunk %d to %s" % (chunk_id, experiment_filename))
                 expts.as_json(experiment_filename)
-                if refls is not None:
+                if reflections:
                     reflections_filename = reflections_template(index=chunk_id)
                     print(
                         "Saving reflections for chunk %d to %s"
                         % (chunk_id, reflections_filename)
                     )
-                    refls.as_file(reflections_filename)
+                    select_experiment_rows(
+                        reflections, rows, ids, identifiers
+                    ).as_file(reflections_filename)
 
             chunk_counter = 0
             chunk_expts = ExperimentList()
-            if reflections:
-                chunk_refls = flex.reflection_table()
-            else:
-                chunk_refls = None
+            chunk_ids = []
             for i, experiment in enumerate(experiments):
                 chunk_expts.append(experiment)
                 if reflections:
-                    if reflections.experiment_identifiers().keys():
-                        # first find which id value corresponds to experiment in question
-                        identifier = experiment.identifier
-                        id_ = None
-                        for k in reflections.experiment_identifiers().keys():
-                            if reflections.experiment_identifiers()[k] == identifier:
-                                id_ = k
-                                break
-                        if id_ is None:
-                            raise Sorry(
-                                "Unable to find id matching experiment identifier in reflection table."
-                            )
-                        ref_sel = reflections.select(reflections["id"] == id_)
-                        # now reset ids and reset/update identifiers map
-                        for k in ref_sel.experiment_identifiers().keys():
-                            del ref_sel.experiment_identifiers()[k]
-                        new_id = len(chunk_expts) - 1
-                        ref_sel["id"] = flex.int(len(ref_sel), new_id)
-                        ref_sel.experiment_identifiers()[new_id] = identifier
-                    else:
-                        ref_sel = reflections.select(reflections["id"] == i)
-                        ref_sel["id"] = flex.int(len(ref_sel), len(chunk_expts) - 1)
-                    chunk_refls.extend(ref_sel)
+                    chunk_ids.append(experiment_id(i, experiment))
                 if params.output.chunk_sizes:
                     chunk_limit = params.output.chunk_sizes[chunk_counter]
                 else:
                     chunk_limit = params.output.chunk_size
                 if len(chunk_expts) == chunk_limit:
-                    save_chunk(chunk_counter, chunk_expts, chunk_refls)
+                    save_chunk(chunk_counter, chunk_expts, chunk_ids)
                     chunk_counter += 1
                     chunk_expts = ExperimentList()
-                    if reflections:
-                        chunk_refls = flex.reflection_table()
-                    else:
-                        chunk_refls = None
+                    chunk_ids = []
             if len(chunk_expts) > 0:
-                save_chunk(chunk_counter, chunk_expts, chunk_refls)
+                save_chunk(chunk_counter, chunk_expts, chunk_ids)
         else:
             for i, experiment in enumerate(experiments):
 
@@ -323,16 +290,9 @@ def save_chunk(chunk_id, expts, refls):
                         "Saving reflections for experiment %d to %s"
                         % (i, reflections_filename)
                     )
-                    ref_sel = reflections.select(reflections["id"] == i)
-                    if ref_sel.experiment_identifiers().keys():
-                        identifier = ref_sel.experiment_identifiers()[i]
-                        for k in ref_sel.experiment_identifiers().keys():
-                            del ref_sel.experiment_identifiers()[k]
-                        ref_sel["id"] = flex.int(ref_sel.size(), 0)
-                        ref_sel.experiment_identifiers()[0] = identifier
-                    else:
-                        ref_sel["id"] = flex.int(len(ref_sel), 0)
-                    ref_sel.as_file(reflections_filename)
+                    select_experiment_rows(
+                        reflections, rows, [i], identifiers
+                    ).as_file(reflections_filename)
 
         return
 
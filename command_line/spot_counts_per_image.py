@@ -4,10 +4,12 @@
 import sys
 
 import iotbx.phil
+import libtbx
 
 import dials.util
 from dials.algorithms.spot_finding import per_image_analysis
 from dials.util import tabulate
+from dials.util.mp import available_cores
 from dials.util.options import OptionParser, reflections_and_experiments_from_files
 
 help_message = """
@@ -37,6 +39,9 @@
   .type = bool
 id = None
   .type = int(value_min=0)
+nproc = Auto
+  .type = int(value_min=1)
+  .help = "The number of threads used to compute the statistics"
 """
 )
 
@@ -75,11 +80,17 @@ def run(args=None):
     if params.id is not None:
         reflections = reflections.select(reflections["id"] == params.id)
 
+    if params.nproc is libtbx.Auto:
+        params.nproc = available_cores()
+
     all_stats = []
     for i, expt in enumerate(experiments):
         refl = reflections.select(reflections["id"] == i)
         stats = per_image_analysis.stats_per_image(
-            expt, refl, resolution_analysis=params.resolution_analysis
+            expt,
+            refl,
+            resolution_analysis=params.resolution_analysis,
+            nthreads=params.nproc,
         )
         all_stats.append(stats)
 
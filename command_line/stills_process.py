@@ -24,6 +24,7 @@
 import dials.util
 from dials.array_family import flex
 from dials.util import log
+from dials.util.phil import cached_parse
 
 logger = logging.getLogger("dials.command_line.stills_process")
 
@@ -159,6 +160,12 @@
     nproc = 1
       .type = int(value_min=1)
       .help = "The number of processes to use."
+    prefetch = 0
+      .type = int(value_min=0)
+      .help = "The number of images each process imports and reads ahead on a \
+               background thread while the current image is processed, so  \
+               that reading the files overlaps with spot finding, indexing \
+               and integration. Not used with dispatch.pre_import=True."
     composite_stride = None
       .type = int
       .help = For MPI, if using composite mode, specify how many ranks to    \
@@ -260,7 +267,7 @@
 profile.gaussian_rs.min_spots.overall = 0
 """
 
-phil_scope = parse(control_phil_str + dials_phil_str, process_includes=True).fetch(
+phil_scope = cached_parse(control_phil_str + dials_phil_str).fetch(
     parse(program_defaults_phil_str)
 )
 
@@ -302,6 +309,44 @@ def do_import(filename, load_models=True):
     return all_experiments
 
 
+def _import_and_read(filename):
+    experiments = do_import(filename, load_models=True)
+    imagesets = experiments.imagesets()
+    if len(imagesets) == 1 and len(imagesets[0]) == 1:
+        # Read the image into the imageset cache for spot finding
+        imagesets[0].get_raw_data(0)
+    return experiments
+
+
+def prefetch_imports(filenames, depth):
+    """
+    Import each file, up to depth files ahead of the caller on a background
+    thread, and read the image data so that it is cached when the image is
+    processed. Each file has its own imageset, so nothing is shared between
+    the reader thread and the processing.
+
+    :param filenames: The image files, in processing order
+    :param depth: The number of files to read ahead; 0 imports in the caller
+    :returns: A generator of the experiments of each file
+    """
+    if depth == 0:
+        for filename in filenames:
+            yield do_import(filename, load_models=True)
+        return
+
+    import collections
+    import concurrent.futures
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=1) as executor:
+        pending = collections.deque()
+        for filename in filenames:
+            pending.append(executor.submit(_import_and_read, filename))
+            if len(pending) > depth:
+                yield pending.popleft().result()
+        while pending:
+            yield pending.popleft().result()
+
+
 def sync_geometry(src, dest):
     dest.set_local_frame(
         src.get_local_fast_axis(), src.get_local_slow_axis(), src.get_local_origin()
@@ -563,10 +608,12 @@ def do_work(i, item_list, processor=None, finalize=True):
                     processor = Processor(
                         copy.deepcopy(params), composite_tag="%04d" % i, rank=i
                     )
-                for item in item_list:
+                imported = prefetch_imports(
+                    [filename for tag, filename in item_list], params.mp.prefetch
+                )
+                for item, experiments in zip(item_list, imported):
                     tag, filename = item
 
-                    experiments = do_import(filename, load_models=True)
                     imagesets = experiments.imagesets()
                     if len(imagesets) == 0 or len(imagesets[0]) == 0:
                         logger.info("Zero length imageset in file: %s" % filename)
@@ -22,7 +22,19 @@ class DispersionExtendedSpotFinderThresholdExt(object):
 
     @staticmethod
     def phil():
-        return None
+        from libtbx.phil import parse
+
+        phil = parse(
+            """
+      backend = *cpu cuda
+        .type = choice
+        .help = "The device used to compute the threshold. The cuda backend"
+                "requires DIALS to be built with CUDA support and gives the"
+                "same result as the cpu backend."
+        .expert_level = 2
+    """
+        )
+        return phil
 
     def __init__(self, params):
         """
@@ -31,6 +43,14 @@ def __init__(self, params):
         :param params: The input parameters
         """
         self.params = params
+        self._algorithm = None
+
+    def __getstate__(self):
+        # The algorithm holds the workspaces of the threshold, which are not
+        # picklable, so it is created again by each process
+        state = self.__dict__.copy()
+        state["_algorithm"] = None
+        return state
 
     def compute_threshold(self, image, mask):
         """
@@ -51,15 +71,18 @@ def compute_threshold(self, image, mask):
                 % (params.spotfinder.threshold.dispersion.global_threshold)
             )
 
-        self._algorithm = DispersionExtendedThresholdStrategy(
-            kernel_size=params.spotfinder.threshold.dispersion.kernel_size,
-            gain=params.spotfinder.threshold.dispersion.gain,
-            mask=params.spotfinder.lookup.mask,
-            n_sigma_b=params.spotfinder.threshold.dispersion.sigma_background,
-            n_sigma_s=params.spotfinder.threshold.dispersion.sigma_strong,
-            min_count=params.spotfinder.threshold.dispersion.min_local,
-            global_threshold=params.spotfinder.threshold.dispersion.global_threshold,
-        )
+        if self._algorithm is None:
+            self._algorithm = DispersionExtendedThresholdStrategy(
+                kernel_size=params.spotfinder.threshold.dispersion.kernel_size,
+                gain=params.spotfinder.threshold.dispersion.gain,
+                mask=params.spotfinder.lookup.mask,
+                n_sigma_b=params.spotfinder.threshold.dispersion.sigma_background,
+                n_sigma_s=params.spotfinder.threshold.dispersion.sigma_strong,
+                min_count=params.spotfinder.threshold.dispersion.min_local,
+                global_threshold=params.spotfinder.threshold.dispersion.global_threshold,
+                nthreads=params.spotfinder.threshold.dispersion.nthreads,
+                backend=params.spotfinder.threshold.dispersion_extended.backend,
+            )
 
         return self._algorithm(image, mask)
 
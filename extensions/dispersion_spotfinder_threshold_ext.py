@@ -61,6 +61,12 @@ def phil():
         .type = float
         .help = "The global threshold value. Consider all pixels less than this"
                 "value to be part of the background."
+
+      nthreads = 1
+        .type = int(value_min=1)
+        .help = "The number of threads to use to threshold each image. Each"
+                "image is split into tiles which are thresholded in parallel."
+        .expert_level = 1
     """
         )
         return phil
@@ -72,6 +78,14 @@ def __init__(self, params):
         :param params: The input parameters
         """
         self.params = params
+        self._algorithm = None
+
+    def __getstate__(self):
+        # The algorithm holds the workspaces of the threshold, which are not
+        # picklable, so it is created again by each process
+        state = self.__dict__.copy()
+        state["_algorithm"] = None
+        return state
 
     def compute_threshold(self, image, mask):
         """
@@ -96,15 +110,17 @@ def compute_threshold(self, image, mask):
 
         from dials.algorithms.spot_finding.threshold import DispersionThresholdStrategy
 
-        self._algorithm = DispersionThresholdStrategy(
-            kernel_size=params.spotfinder.threshold.dispersion.kernel_size,
-            gain=params.spotfinder.threshold.dispersion.gain,
-            mask=params.spotfinder.lookup.mask,
-            n_sigma_b=params.spotfinder.threshold.dispersion.sigma_background,
-            n_sigma_s=params.spotfinder.threshold.dispersion.sigma_strong,
-            min_count=params.spotfinder.threshold.dispersion.min_local,
-            global_threshold=params.spotfinder.threshold.dispersion.global_threshold,
-        )
+        if self._algorithm is None:
+            self._algorithm = DispersionThresholdStrategy(
+                kernel_size=params.spotfinder.threshold.dispersion.kernel_size,
+                gain=params.spotfinder.threshold.dispersion.gain,
+                mask=params.spotfinder.lookup.mask,
+                n_sigma_b=params.spotfinder.threshold.dispersion.sigma_background,
+                n_sigma_s=params.spotfinder.threshold.dispersion.sigma_strong,
+                min_count=params.spotfinder.threshold.dispersion.min_local,
+                global_threshold=params.spotfinder.threshold.dispersion.global_threshold,
+                nthreads=params.spotfinder.threshold.dispersion.nthreads,
+            )
 
         return self._algorithm(image, mask)
 
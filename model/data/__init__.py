@@ -25,5 +25,6 @@
     "Prediction",
     "Ray",
     "Shoebox",
+    "ShoeboxPool",
     "make_image",
 )
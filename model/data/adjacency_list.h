@@ -11,9 +11,12 @@
 #ifndef DIALS_MODEL_ADJACENCY_LIST_H
 #define DIALS_MODEL_ADJACENCY_LIST_H
 
+#include <algorithm>
 #include <iostream>
-#include <deque>
+#include <limits>
 #include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/iterator/iterator_facade.hpp>
 #include <dials/error.h>
 
 namespace dials { namespace model {
@@ -27,15 +30,69 @@ namespace dials { namespace model {
   // typedef boost_adaptbx::graph_type::adjacency_list_undirected_vecS_setS_type
   // AdjacencyList;
 
+  /**
+   * An undirected graph stored in compressed sparse row form. Edges are added
+   * to a pending list and the graph is built by calling finish; each vertex
+   * then has a contiguous, sorted row of the vertices adjacent to it. This
+   * needs a single 32 bit vertex index per edge direction. Edges can still be
+   * added after finish but the graph is only consistent again once finish
+   * has been called.
+   */
   class AdjacencyList {
   public:
+    typedef boost::uint32_t vertex_type;
     typedef std::pair<std::size_t, std::size_t> edge_descriptor;
-    typedef std::deque<edge_descriptor> edge_list;
-    typedef edge_list::const_iterator edge_iterator;
+
+    /**
+     * Iterate through the edges in the rows of the graph. The edges are
+     * generated from the rows so are returned by value.
+     */
+    class edge_iterator : public boost::iterator_facade<edge_iterator,
+                                                        const edge_descriptor,
+                                                        boost::forward_traversal_tag,
+                                                        edge_descriptor> {
+    public:
+      edge_iterator() : list_(NULL), source_(0), position_(0) {}
+
+      edge_iterator(const AdjacencyList *list, std::size_t source, std::size_t position)
+          : list_(list), source_(source), position_(position) {
+        skip_empty_rows();
+      }
+
+    private:
+      friend class boost::iterator_core_access;
+
+      edge_descriptor dereference() const {
+        return edge_descriptor(source_, list_->target_[position_]);
+      }
+
+      bool equal(const edge_iterator &other) const {
+        return position_ == other.position_;
+      }
+
+      void increment() {
+        ++position_;
+        skip_empty_rows();
+      }
+
+      void skip_empty_rows() {
+        while (source_ < list_->num_vertices_
+               && list_->offset_[source_ + 1] <= position_) {
+          ++source_;
+        }
+      }
+
+      const AdjacencyList *list_;
+      std::size_t source_;
+      std::size_t position_;
+    };
+
     typedef std::pair<edge_iterator, edge_iterator> edge_iterator_range;
 
     AdjacencyList(std::size_t num_vertices)
-        : offset_(num_vertices + 1), num_vertices_(num_vertices), consistent_(false) {}
+        : offset_(num_vertices + 1), num_vertices_(num_vertices), consistent_(false) {
+      DIALS_ASSERT(num_vertices <= std::numeric_limits<vertex_type>::max());
+    }
 
     std::size_t source(edge_descriptor edge) const {
       DIALS_ASSERT(consistent_);
@@ -49,39 +106,67 @@ namespace dials { namespace model {
 
     edge_iterator_range edges() const {
       DIALS_ASSERT(consistent_);
-      return edge_iterator_range(edges_.begin(), edges_.end());
+      return edge_iterator_range(edge_iterator(this, 0, 0),
+                                 edge_iterator(this, num_vertices_, target_.size()));
     }
 
     edge_iterator_range edges(std::size_t i) const {
       DIALS_ASSERT(consistent_);
       DIALS_ASSERT(i < num_vertices());
-      DIALS_ASSERT(i < offset_.size() - 1);
       std::size_t o1 = offset_[i];
       std::size_t o2 = offset_[i + 1];
       DIALS_ASSERT(o2 >= o1);
-      DIALS_ASSERT(o2 <= edges_.size());
-      return edge_iterator_range(edges_.begin() + o1, edges_.begin() + o2);
+      DIALS_ASSERT(o2 <= target_.size());
+      return edge_iterator_range(edge_iterator(this, i, o1),
+                                 edge_iterator(this, i + 1, o2));
     }
 
     void add_edge(std::size_t a, std::size_t b) {
       consistent_ = false;
-      DIALS_ASSERT(num_vertices());
-      DIALS_ASSERT(num_vertices());
-      edges_.push_back(edge_descriptor(a, b));
-      edges_.push_back(edge_descriptor(b, a));
+      DIALS_ASSERT(a < num_vertices());
+      DIALS_ASSERT(b < num_vertices());
+      pending_.push_back(pending_edge(a, b));
     }
 
+    /**
+     * Merge the pending edges into the rows of the graph
+     */
     void finish() {
-      std::sort(edges_.begin(), edges_.end());
-      std::vector<std::size_t> num(num_vertices());
-      for (std::size_t i = 0; i < edges_.size(); ++i) {
-        num[edges_[i].first]++;
+      // Count the edges for each vertex
+      std::vector<std::size_t> offset(num_vertices_ + 1, 0);
+      for (std::size_t i = 0; i < num_vertices_; ++i) {
+        offset[i + 1] = offset_[i + 1] - offset_[i];
       }
-      offset_[0] = 0;
-      for (std::size_t i = 0; i < num.size(); ++i) {
-        offset_[i + 1] = offset_[i] + num[i];
+      for (std::size_t i = 0; i < pending_.size(); ++i) {
+        offset[pending_[i].first + 1]++;
+        offset[pending_[i].second + 1]++;
+      }
+      for (std::size_t i = 0; i < num_vertices_; ++i) {
+        offset[i + 1] += offset[i];
+      }
+
+      // Fill the rows with the existing and pending edges
+      std::vector<vertex_type> target(offset.back());
+      std::vector<std::size_t> position(offset.begin(), offset.end() - 1);
+      for (std::size_t i = 0; i < num_vertices_; ++i) {
+        for (std::size_t k = offset_[i]; k < offset_[i + 1]; ++k) {
+          target[position[i]++] = target_[k];
+        }
       }
-      DIALS_ASSERT(offset_.back() == edges_.size());
+      for (std::size_t i = 0; i < pending_.size(); ++i) {
+        vertex_type a = pending_[i].first;
+        vertex_type b = pending_[i].second;
+        target[position[a]++] = b;
+        target[position[b]++] = a;
+      }
+      for (std::size_t i = 0; i < num_vertices_; ++i) {
+        std::sort(target.begin() + offset[i], target.begin() + offset[i + 1]);
+      }
+
+      // Swap in the new rows and release the pending edges
+      offset_.swap(offset);
+      target_.swap(target);
+      std::vector<pending_edge>().swap(pending_);
       consistent_ = true;
     }
 
@@ -90,8 +175,8 @@ namespace dials { namespace model {
     }
 
     std::size_t num_edges() const {
-      DIALS_ASSERT((edges_.size() & 1) == 0);
-      return edges_.size() / 2;
+      DIALS_ASSERT((target_.size() & 1) == 0);
+      return target_.size() / 2 + pending_.size();
     }
 
     std::size_t vertex_num_edges(std::size_t i) const {
@@ -103,7 +188,12 @@ namespace dials { namespace model {
     }
 
   private:
-    edge_list edges_;
+    friend class edge_iterator;
+
+    typedef std::pair<vertex_type, vertex_type> pending_edge;
+
+    std::vector<pending_edge> pending_;
+    std::vector<vertex_type> target_;
     std::vector<std::size_t> offset_;
     std::size_t num_vertices_;
     bool consistent_;
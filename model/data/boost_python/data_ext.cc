@@ -17,6 +17,7 @@ namespace dials { namespace model { namespace boost_python {
 
   void export_image_volume();
   void export_shoebox();
+  void export_shoebox_pool();
   void export_observation();
   void export_prediction();
   void export_pixel_list();
@@ -29,6 +30,7 @@ namespace dials { namespace model { namespace boost_python {
     export_observation();
     export_prediction();
     export_shoebox();
+    export_shoebox_pool();
     export_pixel_list();
     export_ray();
     export_image();
@@ -163,8 +163,12 @@ namespace dials { namespace model { namespace boost_python {
       .def("frame1", &Class::frame1)
       .def("add", &Class::add)
       .def("get", &Class::get)
-      .def("set_image", &Class::template set_image<int>)
-      .def("set_image", &Class::template set_image<double>)
+      .def("set_image",
+           &Class::template set_image<int>,
+           (arg("frame"), arg("image"), arg("nthreads") = 1))
+      .def("set_image",
+           &Class::template set_image<double>,
+           (arg("frame"), arg("image"), arg("nthreads") = 1))
       .def("update_reflection_info",
            &MultiPanelImageVolume_update_reflection_info<FloatType>)
       .def("__len__", &Class::size);
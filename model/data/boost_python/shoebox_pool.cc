@@ -0,0 +1,80 @@
+/*
+ * shoebox_pool.cc
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#include <boost/python.hpp>
+#include <boost/python/def.hpp>
+#include <dials/model/data/shoebox_pool.h>
+#include <dials/config.h>
+
+namespace dials { namespace model { namespace boost_python {
+
+  using namespace boost::python;
+
+  template <typename FloatType>
+  ShoeboxPool<FloatType> *make_shoebox_pool(const af::const_ref<std::size_t> &panel,
+                                            const af::const_ref<int6> &bbox,
+                                            bool flat) {
+    return new ShoeboxPool<FloatType>(panel, bbox, flat);
+  }
+
+  template <typename FloatType>
+  ShoeboxPool<FloatType> *make_shoebox_pool_from_shoeboxes(
+    const af::const_ref<Shoebox<FloatType> > &shoeboxes) {
+    return new ShoeboxPool<FloatType>(shoeboxes);
+  }
+
+  /**
+   * @returns A copy of the packed mask slab as ints
+   */
+  template <typename FloatType>
+  af::shared<int> shoebox_pool_mask(const ShoeboxPool<FloatType> &self) {
+    af::shared<typename ShoeboxPool<FloatType>::mask_type> mask = self.mask();
+    af::shared<int> result(mask.size(), af::init_functor_null<int>());
+    unpack_mask(mask.begin(), mask.end(), result.begin());
+    return result;
+  }
+
+  template <typename FloatType>
+  void shoebox_pool_wrapper(const char *name) {
+    typedef ShoeboxPool<FloatType> pool_type;
+    typedef af::shared<FloatType> (pool_type::*float_slab_type)() const;
+
+    class_<pool_type>(name, no_init)
+      .def("__init__",
+           make_constructor(&make_shoebox_pool<FloatType>,
+                            default_call_policies(),
+                            (arg("panel"), arg("bbox"), arg("flat") = false)))
+      .def("__init__",
+           make_constructor(&make_shoebox_pool_from_shoeboxes<FloatType>,
+                            default_call_policies(),
+                            (arg("shoeboxes"))))
+      .def("__len__", &pool_type::size)
+      .def("size", &pool_type::size)
+      .def("num_pixels", &pool_type::num_pixels)
+      .def("panel", &pool_type::panel)
+      .def("bbox", &pool_type::bbox)
+      .def("flat", &pool_type::flat)
+      .def("offset", &pool_type::offset)
+      .def("allocate", &pool_type::allocate, (arg("mask_code") = 0))
+      .def("deallocate", &pool_type::deallocate)
+      .def("is_allocated", &pool_type::is_allocated)
+      .def("nbytes", &pool_type::nbytes)
+      .def("data", (float_slab_type)&pool_type::data)
+      .def("mask", &shoebox_pool_mask<FloatType>)
+      .def("background", (float_slab_type)&pool_type::background)
+      .def("set", &pool_type::set)
+      .def("count_mask_values", &pool_type::count_mask_values, (arg("code")))
+      .def("shoebox", &pool_type::shoebox)
+      .def("shoeboxes", &pool_type::shoeboxes);
+  }
+
+  void export_shoebox_pool() {
+    shoebox_pool_wrapper<ProfileFloatType>("ShoeboxPool");
+  }
+
+}}}  // namespace dials::model::boost_python
@@ -16,6 +16,7 @@
 #include <dials/array_family/scitbx_shared_and_versa.h>
 #include <dials/model/data/image.h>
 #include <dials/model/data/mask_code.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace model {
@@ -57,7 +58,7 @@ namespace dials { namespace model {
           data_(grid_, 0),
           background_(grid_, 0),
           mask_(grid_, 0),
-          label_(grid_) {}
+          label_(grid_, -1) {}
 
     /**
      * Check the arrays all make sense
@@ -113,7 +114,42 @@ namespace dials { namespace model {
      * @returns The labels
      */
     af::versa<Label, af::c_grid<3> > label1() const {
-      return label_;
+      af::versa<Label, af::c_grid<3> > result(grid_);
+      for (std::size_t l = 0; l < result.size(); ++l) {
+        result[l] = label(l);
+      }
+      return result;
+    }
+
+    /**
+     * Get the label of a pixel. The label of a pixel claimed by a single
+     * reflection is held in place; a pixel claimed by two holds -2 minus the
+     * index of the pair in a pool of overlapped labels.
+     * @param l The index of the pixel
+     * @returns The label
+     */
+    Label label(std::size_t l) const {
+      int value = label_[l];
+      if (value < -1) {
+        return overlap_[-value - 2];
+      }
+      Label result;
+      result.first = value;
+      return result;
+    }
+
+    /**
+     * Check if a pixel is labelled by a reflection
+     * @param l The index of the pixel
+     * @param index The reflection index
+     * @returns True/False the pixel is labelled by the reflection
+     */
+    bool label_contains(std::size_t l, std::size_t index) const {
+      int value = label_[l];
+      if (value < -1) {
+        return overlap_[-value - 2].contains((int)index);
+      }
+      return value == (int)index;
     }
 
     /**
@@ -218,8 +254,7 @@ namespace dials { namespace model {
             std::size_t l = grid_(k + k0, j + j0, i + i0);
             int value = mask_[l];
             if (value & Foreground) {
-              const Label &label = label_[l];
-              if (!label.contains(index)) {
+              if (!label_contains(l, index)) {
                 value &= ~Foreground;
                 value &= ~Valid;
               }
@@ -343,15 +378,18 @@ namespace dials { namespace model {
       }
       if (value2 & Foreground) {
         value1 &= ~Background;
-        Label &label = label_[l];
-        if (label.first < 0) {
-          label.first = (int)index;
-        } else if (label.second < 0) {
-          label.second = (int)index;
+        int &label = label_[l];
+        if (label == -1) {
+          label = (int)index;
+        } else if (label >= 0) {
+          Label overlap;
+          overlap.first = label;
+          overlap.second = (int)index;
+          label = -2 - (int)overlap_.size();
+          overlap_.push_back(overlap);
           value2 |= Overlapped;
         } else {
-          label.first = -1;
-          label.second = -1;
+          label = -1;
           value2 &= ~Valid;
           value2 |= Overlapped;
         }
@@ -399,7 +437,8 @@ namespace dials { namespace model {
     af::versa<FloatType, af::c_grid<3> > data_;
     af::versa<FloatType, af::c_grid<3> > background_;
     af::versa<int, af::c_grid<3> > mask_;
-    af::versa<Label, af::c_grid<3> > label_;
+    af::versa<int, af::c_grid<3> > label_;
+    af::shared<Label> overlap_;
   };
 
   /**
@@ -464,14 +503,35 @@ namespace dials { namespace model {
      * @param image The multipanel image
      */
     template <typename T>
-    void set_image(int frame, const Image<T> &image) {
+    void set_image(int frame, const Image<T> &image, std::size_t nthreads = 1) {
       DIALS_ASSERT(image.npanels() == volume_.size());
-      for (std::size_t i = 0; i < image.npanels(); ++i) {
-        volume_[i].set_image(frame, image.data(i), image.mask(i));
-      }
+      dials::algorithms::for_each_band(
+        SetImageBand<T>(volume_.ref(), frame, image), (int)volume_.size(), nthreads);
     }
 
   private:
+    /**
+     * Set the image of a band of panels. The volumes of the panels are
+     * separate, so each panel can be set by a different thread.
+     */
+    template <typename T>
+    struct SetImageBand {
+      af::ref<ImageVolume<FloatType> > volume;
+      int frame;
+      const Image<T> &image;
+
+      SetImageBand(af::ref<ImageVolume<FloatType> > volume_,
+                   int frame_,
+                   const Image<T> &image_)
+          : volume(volume_), frame(frame_), image(image_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          volume[i].set_image(frame, image.data(i), image.mask(i));
+        }
+      }
+    };
+
     af::shared<ImageVolume<FloatType> > volume_;
   };
 
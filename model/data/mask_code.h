@@ -11,6 +11,8 @@
 #ifndef DIALS_MODEL_DATA_MASK_CODE_H
 #define DIALS_MODEL_DATA_MASK_CODE_H
 
+#include <dials/error.h>
+
 namespace dials { namespace model {
 
   /**
@@ -31,6 +33,53 @@ namespace dials { namespace model {
     Overlapped = (1 << 5),      ///< Pixel overlaps another reflection foreground
   };
 
+  /**
+   * The type of a mask code packed into a single byte. All the mask codes fit
+   * in the low 6 bits, so masks which are stored for many shoeboxes can use a
+   * quarter of the memory of an int mask.
+   */
+  typedef unsigned char packed_mask_type;
+
+  /**
+   * @param first The first mask value
+   * @param last One past the last mask value
+   * @returns True/False all the mask values fit in a packed mask
+   */
+  inline bool is_packable_mask(const int *first, const int *last) {
+    int bits = 0;
+    for (const int *it = first; it != last; ++it) {
+      bits |= *it;
+    }
+    return (bits & ~0xff) == 0;
+  }
+
+  /**
+   * Pack mask values into bytes
+   * @param first The first mask value
+   * @param last One past the last mask value
+   * @param out The first packed mask value
+   */
+  inline void pack_mask(const int *first, const int *last, packed_mask_type *out) {
+    DIALS_ASSERT(is_packable_mask(first, last));
+    for (const int *it = first; it != last; ++it, ++out) {
+      *out = (packed_mask_type)*it;
+    }
+  }
+
+  /**
+   * Unpack bytes into mask values
+   * @param first The first packed mask value
+   * @param last One past the last packed mask value
+   * @param out The first mask value
+   */
+  inline void unpack_mask(const packed_mask_type *first,
+                          const packed_mask_type *last,
+                          int *out) {
+    for (const packed_mask_type *it = first; it != last; ++it, ++out) {
+      *out = *it;
+    }
+  }
+
 }}  // namespace dials::model
 
 #endif
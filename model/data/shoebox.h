@@ -19,6 +19,7 @@
 #include <dials/algorithms/image/centroid/centroid_masked_image.h>
 #include <dials/algorithms/integration/sum/summation.h>
 #include <dials/algorithms/integration/bayes/bayesian_integrator.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/model/data/mask_code.h>
 #include <dials/config.h>
 #include <dials/error.h>
@@ -29,6 +30,7 @@ namespace dials { namespace model {
   using dials::algorithms::CentroidImage3d;
   using dials::algorithms::CentroidMaskedImage3d;
   using dials::algorithms::Summation;
+  using dials::algorithms::for_each_band;
   using dials::model::Centroid;
   using dials::model::Foreground;
   using dials::model::Intensity;
@@ -58,6 +60,40 @@ namespace dials { namespace model {
     return result;
   }
 
+  namespace detail {
+
+    /**
+     * Select the pixels of a shoebox with the given mask code which are not
+     * overlapped, optionally subtracting the background and keeping only
+     * pixels above it. For use with CentroidMaskedImage3d.
+     */
+    template <typename FloatType>
+    struct SelectShoeboxPixels {
+      const FloatType *data;
+      const FloatType *background;
+      const int *mask;
+      int code;
+
+      SelectShoeboxPixels(const FloatType *data_,
+                          const FloatType *background_,
+                          const int *mask_,
+                          int code_)
+          : data(data_), background(background_), mask(mask_), code(code_) {}
+
+      bool operator()(std::size_t index, FloatType &value) const {
+        int m = mask[index];
+        bool selected = (m & code) == code && (m & Overlapped) == 0;
+        if (background == NULL) {
+          value = data[index];
+          return selected;
+        }
+        value = data[index] - background[index];
+        return selected && value > 0;
+      }
+    };
+
+  }  // namespace detail
+
   /**
    * A class to hold shoebox information
    */
@@ -311,19 +347,16 @@ namespace dials { namespace model {
     Centroid centroid_masked(int code) const {
       typedef CentroidMaskedImage3d<FloatType> Centroider;
 
-      // Calculate the foreground mask
-      af::versa<bool, af::c_grid<3> > fg_mask_arr(mask.accessor());
-      af::ref<bool, af::c_grid<3> > foreground_mask = fg_mask_arr.ref();
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        foreground_mask[i] = (mask[i] & code) == code && ((mask[i] & Overlapped) == 0);
-      }
-
       // Calculate the centroid
       int zoff = flat ? (bbox[5] + bbox[4]) / 2 : bbox[4];
       vec3<double> offset(bbox[0], bbox[2], zoff);
       Centroid result;
       try {
-        Centroider centroid(data.const_ref(), foreground_mask);
+        DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+        DIALS_ASSERT(data.accessor().all_gt(0));
+        Centroider centroid(data.accessor(),
+                            detail::SelectShoeboxPixels<FloatType>(
+                              data.begin(), NULL, mask.begin(), code));
         result = extract_centroid_object(centroid, offset);
         if (bbox[5] == bbox[4] + 1) {
           result.px.position[2] = bbox[4] + 0.5;
@@ -392,25 +425,20 @@ namespace dials { namespace model {
     Centroid centroid_masked_minus_background(int code) const {
       typedef CentroidMaskedImage3d<FloatType> Centroider;
 
-      // Calculate the foreground mask and data
+      // Check the data, mask and background are the same size
       DIALS_ASSERT(data.size() == mask.size());
       DIALS_ASSERT(data.size() == background.size());
-      af::versa<bool, af::c_grid<3> > fg_mask_arr(mask.accessor());
-      af::versa<FloatType, af::c_grid<3> > fg_data_arr(data.accessor());
-      af::ref<FloatType, af::c_grid<3> > foreground_data = fg_data_arr.ref();
-      af::ref<bool, af::c_grid<3> > foreground_mask = fg_mask_arr.ref();
-      for (std::size_t i = 0; i < mask.size(); ++i) {
-        foreground_data[i] = data[i] - background[i];
-        foreground_mask[i] = ((mask[i] & code) == code) && ((mask[i] & Overlapped) == 0)
-                             && (foreground_data[i] > 0);
-      }
 
       // Calculate the centroid
       int zoff = flat ? (bbox[5] + bbox[4]) / 2 : bbox[4];
       vec3<double> offset(bbox[0], bbox[2], zoff);
       Centroid result;
       try {
-        Centroider centroid(foreground_data, foreground_mask);
+        DIALS_ASSERT(data.accessor().all_eq(mask.accessor()));
+        DIALS_ASSERT(data.accessor().all_gt(0));
+        Centroider centroid(data.accessor(),
+                            detail::SelectShoeboxPixels<FloatType>(
+                              data.begin(), background.begin(), mask.begin(), code));
         result = extract_centroid_object(centroid, offset);
       } catch (dials::error) {
         double xmid = (bbox[1] + bbox[0]) / 2.0;
@@ -532,6 +560,64 @@ namespace dials { namespace model {
     }
   };
 
+  namespace detail {
+
+    /**
+     * Compute the masked centroids of a band of shoeboxes
+     */
+    template <typename FloatType>
+    struct CentroidShoeboxes {
+      af::const_ref<Shoebox<FloatType> > shoeboxes;
+      int code;
+      bool minus_background;
+      af::ref<Centroid> result;
+
+      CentroidShoeboxes(const af::const_ref<Shoebox<FloatType> > &shoeboxes_,
+                        int code_,
+                        bool minus_background_,
+                        af::ref<Centroid> result_)
+          : shoeboxes(shoeboxes_),
+            code(code_),
+            minus_background(minus_background_),
+            result(result_) {}
+
+      void operator()(int i0, int i1) const {
+        for (int i = i0; i < i1; ++i) {
+          result[i] = minus_background
+                        ? shoeboxes[i].centroid_masked_minus_background(code)
+                        : shoeboxes[i].centroid_masked(code);
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Compute the centroid of the masked pixels of each of a list of
+   * shoeboxes, as given by Shoebox::centroid_masked or
+   * Shoebox::centroid_masked_minus_background. The shoeboxes are split into
+   * bands which are processed in separate threads.
+   * @param shoeboxes The shoeboxes
+   * @param code The mask code
+   * @param minus_background Subtract the background
+   * @param nthreads The number of threads to use
+   * @returns The centroids
+   */
+  template <typename FloatType>
+  af::shared<Centroid> centroid_masked(
+    const af::const_ref<Shoebox<FloatType> > &shoeboxes,
+    int code,
+    bool minus_background,
+    std::size_t nthreads = 1) {
+    af::shared<Centroid> result(shoeboxes.size(), Centroid());
+    for_each_band(
+      detail::CentroidShoeboxes<FloatType>(
+        shoeboxes, code, minus_background, result.ref()),
+      (int)shoeboxes.size(),
+      nthreads);
+    return result;
+  }
+
 }};  // namespace dials::model
 
 #endif /* DIALS_MODEL_DATA_SHOEBOX_H */
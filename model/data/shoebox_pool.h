@@ -0,0 +1,332 @@
+/*
+ * shoebox_pool.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_MODEL_DATA_SHOEBOX_POOL_H
+#define DIALS_MODEL_DATA_SHOEBOX_POOL_H
+
+#include <algorithm>
+#include <scitbx/array_family/tiny_types.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/model/data/shoebox.h>
+#include <dials/config.h>
+#include <dials/error.h>
+
+namespace dials { namespace model {
+
+  using scitbx::af::int6;
+
+  /**
+   * A list of shoeboxes whose pixels are held in three contiguous slabs, one
+   * each for the data, mask and background, rather than in three separate
+   * arrays per shoebox. The pixels of shoebox i are the elements offset(i) to
+   * offset(i + 1) - 1 of each slab, in the usual (z, y, x) order, so
+   * allocating or deallocating all the shoeboxes needs only three
+   * allocations and the pixels can be copied in and out of a list of
+   * Shoebox objects or serialised with one copy per shoebox or slab.
+   *
+   * The versa arrays of a Shoebox cannot start part way into another array,
+   * so the pool gives access to the pixels of each shoebox as references
+   * into the slabs and copies to and from Shoebox objects when needed.
+   *
+   * The mask codes are stored packed into a byte per pixel, rather than an
+   * int as in a Shoebox, since a pool may hold the pixels of every reflection
+   * of a dataset.
+   */
+  template <typename FloatType = ProfileFloatType>
+  class ShoeboxPool {
+  public:
+    typedef FloatType float_type;
+    typedef Shoebox<FloatType> shoebox_type;
+    typedef packed_mask_type mask_type;
+
+    /**
+     * Initialise an empty pool
+     */
+    ShoeboxPool() : offset_(1, 0) {}
+
+    /**
+     * Initialise the pool from the panels and bounding boxes. The pixel
+     * slabs are not allocated.
+     * @param panel The panel numbers
+     * @param bbox The bounding boxes
+     * @param flat Are the shoeboxes flat
+     */
+    ShoeboxPool(const af::const_ref<std::size_t> &panel,
+                const af::const_ref<int6> &bbox,
+                bool flat = false)
+        : panel_(panel.begin(), panel.end()),
+          bbox_(bbox.begin(), bbox.end()),
+          flat_(bbox.size(), flat),
+          offset_(bbox.size() + 1, 0) {
+      DIALS_ASSERT(panel.size() == bbox.size());
+      compute_offsets();
+    }
+
+    /**
+     * Initialise the pool from a list of shoeboxes, copying the pixels of
+     * any shoeboxes which are allocated. If none are allocated then the
+     * slabs are not allocated either.
+     * @param shoeboxes The shoeboxes
+     */
+    ShoeboxPool(const af::const_ref<shoebox_type> &shoeboxes)
+        : panel_(shoeboxes.size()),
+          bbox_(shoeboxes.size()),
+          flat_(shoeboxes.size()),
+          offset_(shoeboxes.size() + 1, 0) {
+      bool allocated = false;
+      for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
+        panel_[i] = shoeboxes[i].panel;
+        bbox_[i] = shoeboxes[i].bbox;
+        flat_[i] = shoeboxes[i].flat;
+        allocated = allocated || shoeboxes[i].is_allocated();
+      }
+      compute_offsets();
+      if (allocated) {
+        allocate();
+        for (std::size_t i = 0; i < shoeboxes.size(); ++i) {
+          if (shoeboxes[i].is_allocated()) {
+            set(i, shoeboxes[i]);
+          }
+        }
+      }
+    }
+
+    /** @returns The number of shoeboxes */
+    std::size_t size() const {
+      return bbox_.size();
+    }
+
+    /** @returns The total number of pixels in all the shoeboxes */
+    std::size_t num_pixels() const {
+      return offset_.back();
+    }
+
+    /** @returns The panel of shoebox i */
+    std::size_t panel(std::size_t i) const {
+      DIALS_ASSERT(i < size());
+      return panel_[i];
+    }
+
+    /** @returns The bounding box of shoebox i */
+    int6 bbox(std::size_t i) const {
+      DIALS_ASSERT(i < size());
+      return bbox_[i];
+    }
+
+    /** @returns Is shoebox i flat */
+    bool flat(std::size_t i) const {
+      DIALS_ASSERT(i < size());
+      return flat_[i];
+    }
+
+    /** @returns The offset of the first pixel of shoebox i in the slabs */
+    std::size_t offset(std::size_t i) const {
+      DIALS_ASSERT(i <= size());
+      return offset_[i];
+    }
+
+    /** @returns The size of the pixel arrays of shoebox i */
+    af::c_grid<3> accessor(std::size_t i) const {
+      DIALS_ASSERT(i < size());
+      const int6 &b = bbox_[i];
+      std::size_t zs = flat_[i] ? 1 : b[5] - b[4];
+      return af::c_grid<3>(zs, b[3] - b[2], b[1] - b[0]);
+    }
+
+    /**
+     * Allocate the pixel slabs with the data and background set to zero
+     * @param mask_code The value to set the mask to
+     */
+    void allocate(int mask_code = 0) {
+      DIALS_ASSERT(is_packable_mask(&mask_code, &mask_code + 1));
+      data_ = af::shared<FloatType>(num_pixels(), FloatType(0));
+      mask_ = af::shared<mask_type>(num_pixels(), (mask_type)mask_code);
+      background_ = af::shared<FloatType>(num_pixels(), FloatType(0));
+    }
+
+    /**
+     * Release the pixel slabs
+     */
+    void deallocate() {
+      data_ = af::shared<FloatType>();
+      mask_ = af::shared<mask_type>();
+      background_ = af::shared<FloatType>();
+    }
+
+    /**
+     * @returns The number of bytes of the pixel slabs and the lists of
+     * panels, bounding boxes and offsets
+     */
+    std::size_t nbytes() const {
+      return data_.capacity() * sizeof(FloatType) + mask_.capacity() * sizeof(mask_type)
+             + background_.capacity() * sizeof(FloatType)
+             + panel_.capacity() * sizeof(std::size_t)
+             + bbox_.capacity() * sizeof(int6) + flat_.capacity() * sizeof(bool)
+             + offset_.capacity() * sizeof(std::size_t);
+    }
+
+    /** @returns Are the pixel slabs allocated */
+    bool is_allocated() const {
+      return data_.size() == num_pixels() && mask_.size() == num_pixels()
+             && background_.size() == num_pixels() && num_pixels() > 0;
+    }
+
+    /** @returns The data slab */
+    af::shared<FloatType> data() const {
+      return data_;
+    }
+
+    /** @returns The packed mask slab */
+    af::shared<mask_type> mask() const {
+      return mask_;
+    }
+
+    /** @returns The background slab */
+    af::shared<FloatType> background() const {
+      return background_;
+    }
+
+    /** @returns The data of shoebox i */
+    af::ref<FloatType, af::c_grid<3> > data(std::size_t i) {
+      return slab_ref(data_, i);
+    }
+
+    /** @returns The packed mask of shoebox i */
+    af::ref<mask_type, af::c_grid<3> > mask(std::size_t i) {
+      return slab_ref(mask_, i);
+    }
+
+    /** @returns The background of shoebox i */
+    af::ref<FloatType, af::c_grid<3> > background(std::size_t i) {
+      return slab_ref(background_, i);
+    }
+
+    /** @returns The data of shoebox i */
+    af::const_ref<FloatType, af::c_grid<3> > data(std::size_t i) const {
+      return slab_const_ref(data_, i);
+    }
+
+    /** @returns The packed mask of shoebox i */
+    af::const_ref<mask_type, af::c_grid<3> > mask(std::size_t i) const {
+      return slab_const_ref(mask_, i);
+    }
+
+    /** @returns The background of shoebox i */
+    af::const_ref<FloatType, af::c_grid<3> > background(std::size_t i) const {
+      return slab_const_ref(background_, i);
+    }
+
+    /**
+     * Copy the pixels of a shoebox into the slabs
+     * @param i The shoebox index
+     * @param sbox The shoebox
+     */
+    void set(std::size_t i, const shoebox_type &sbox) {
+      DIALS_ASSERT(is_allocated());
+      DIALS_ASSERT(sbox.is_consistent());
+      DIALS_ASSERT(sbox.data.accessor().all_eq(accessor(i)));
+      std::copy(sbox.data.begin(), sbox.data.end(), data_.begin() + offset_[i]);
+      pack_mask(sbox.mask.begin(), sbox.mask.end(), mask_.begin() + offset_[i]);
+      std::copy(sbox.background.begin(),
+                sbox.background.end(),
+                background_.begin() + offset_[i]);
+    }
+
+    /**
+     * Get shoebox i with a copy of its pixels if the slabs are allocated
+     * @param i The shoebox index
+     * @returns The shoebox
+     */
+    shoebox_type shoebox(std::size_t i) const {
+      DIALS_ASSERT(i < size());
+      shoebox_type result(panel_[i], bbox_[i], flat_[i]);
+      if (is_allocated()) {
+        af::c_grid<3> grid = accessor(i);
+        const FloatType *d = data_.begin() + offset_[i];
+        const mask_type *m = mask_.begin() + offset_[i];
+        const FloatType *b = background_.begin() + offset_[i];
+        std::size_t n = grid.size_1d();
+        result.data = af::versa<FloatType, af::c_grid<3> >(
+          af::shared<FloatType>(d, d + n).handle(), grid);
+        result.mask = af::versa<int, af::c_grid<3> >(grid);
+        unpack_mask(m, m + n, result.mask.begin());
+        result.background = af::versa<FloatType, af::c_grid<3> >(
+          af::shared<FloatType>(b, b + n).handle(), grid);
+      }
+      return result;
+    }
+
+    /**
+     * Count the pixels of each shoebox with all the bits of a mask code set.
+     * This is equivalent to Shoebox::count_mask_values.
+     * @param code The mask code
+     * @returns The number of pixels of each shoebox
+     */
+    af::shared<int> count_mask_values(int code) const {
+      DIALS_ASSERT(is_allocated());
+      af::shared<int> result(size(), 0);
+      const mask_type *mask = mask_.begin();
+      for (std::size_t i = 0; i < size(); ++i) {
+        int count = 0;
+        for (std::size_t k = offset_[i]; k < offset_[i + 1]; ++k) {
+          count += (mask[k] & code) == code;
+        }
+        result[i] = count;
+      }
+      return result;
+    }
+
+    /**
+     * @returns The list of shoeboxes with copies of their pixels
+     */
+    af::shared<shoebox_type> shoeboxes() const {
+      af::shared<shoebox_type> result;
+      result.reserve(size());
+      for (std::size_t i = 0; i < size(); ++i) {
+        result.push_back(shoebox(i));
+      }
+      return result;
+    }
+
+  protected:
+    /**
+     * Compute the offset of each shoebox from the bounding boxes
+     */
+    void compute_offsets() {
+      for (std::size_t i = 0; i < bbox_.size(); ++i) {
+        const int6 &b = bbox_[i];
+        DIALS_ASSERT(b[1] > b[0] && b[3] > b[2] && b[5] > b[4]);
+        offset_[i + 1] = offset_[i] + accessor(i).size_1d();
+      }
+    }
+
+    template <typename T>
+    af::ref<T, af::c_grid<3> > slab_ref(af::shared<T> &slab, std::size_t i) {
+      DIALS_ASSERT(is_allocated());
+      return af::ref<T, af::c_grid<3> >(slab.begin() + offset(i), accessor(i));
+    }
+
+    template <typename T>
+    af::const_ref<T, af::c_grid<3> > slab_const_ref(const af::shared<T> &slab,
+                                                    std::size_t i) const {
+      DIALS_ASSERT(is_allocated());
+      return af::const_ref<T, af::c_grid<3> >(slab.begin() + offset(i), accessor(i));
+    }
+
+    af::shared<std::size_t> panel_;
+    af::shared<int6> bbox_;
+    af::shared<bool> flat_;
+    af::shared<std::size_t> offset_;
+    af::shared<FloatType> data_;
+    af::shared<mask_type> mask_;
+    af::shared<FloatType> background_;
+  };
+
+}}  // namespace dials::model
+
+#endif  // DIALS_MODEL_DATA_SHOEBOX_POOL_H
@@ -11,6 +11,8 @@
 #ifndef DIALS_PYCHEF_H
 #define DIALS_PYCHEF_H
 
+#include <vector>
+#include <boost/shared_ptr.hpp>
 #include <cctbx/miller.h>
 #include <cctbx/miller/asu.h>
 #include <cctbx/miller/bins.h>
@@ -20,6 +22,7 @@
 #include <scitbx/array_family/shared.h>
 #include <scitbx/array_family/versa.h>
 #include <scitbx/array_family/ref_reductions.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace pychef {
@@ -101,14 +104,12 @@ namespace dials { namespace pychef {
             flag = MINUS;
           }
         }
-        ObservationGroup group;
         map_type::iterator it = observation_groups_.find(h_uniq);
         if (it == observation_groups_.end()) {
-          group = ObservationGroup(h_uniq, flag == CENTRIC);
-          observation_groups_[h_uniq] = group;
-        } else {
-          group = observation_groups_[h_uniq];
+          ObservationGroup group(h_uniq, flag == CENTRIC);
+          it = observation_groups_.insert(std::make_pair(h_uniq, group)).first;
         }
+        ObservationGroup &group = it->second;
         if (flag == MINUS) {
           n_minus++;
           group.add_iminus(iref);
@@ -130,6 +131,26 @@ namespace dials { namespace pychef {
 
   namespace accumulator {
 
+    /**
+     * The observations of a group, as pointers into the arrays of an
+     * ObservationGroup, so the accumulators can read a group without copying
+     * its array handles, which is not safe to do from several threads
+     */
+    struct GroupIndices {
+      const std::size_t *iplus;
+      std::size_t n_iplus;
+      const std::size_t *iminus;
+      std::size_t n_iminus;
+      bool centric;
+
+      GroupIndices(ObservationGroup &group)
+          : iplus(group.iplus().begin()),
+            n_iplus(group.iplus().size()),
+            iminus(group.iminus().begin()),
+            n_iminus(group.iminus().size()),
+            centric(group.is_centric()) {}
+    };
+
     class CompletenessAccumulator {
     public:
       CompletenessAccumulator(af::const_ref<std::size_t> const &dose,
@@ -151,13 +172,17 @@ namespace dials { namespace pychef {
             iboth_comp_overall(n_steps, 0.0) {}
 
       void operator()(ObservationGroup group) {
+        add(GroupIndices(group));
+      }
+
+      void add(const GroupIndices &group) {
         std::size_t dose_min_iplus = 1e8;
         std::size_t dose_min_iminus = 1e8;
         std::size_t i_bin;
-        if (group.iplus().size()) {
-          i_bin = binner_.get_i_bin(d_star_sq_[group.iplus()[0]]);
+        if (group.n_iplus) {
+          i_bin = binner_.get_i_bin(d_star_sq_[group.iplus[0]]);
         } else {
-          i_bin = binner_.get_i_bin(d_star_sq_[group.iminus()[0]]);
+          i_bin = binner_.get_i_bin(d_star_sq_[group.iminus[0]]);
         }
 
         if (i_bin == 0) {
@@ -167,19 +192,19 @@ namespace dials { namespace pychef {
 
         i_bin -= 1;
 
-        for (std::size_t i = 0; i < group.iplus().size(); i++) {
-          std::size_t dose_i = dose_[group.iplus()[i]];
+        for (std::size_t i = 0; i < group.n_iplus; i++) {
+          std::size_t dose_i = dose_[group.iplus[i]];
           dose_min_iplus = std::min(dose_i, dose_min_iplus);
-          if (group.is_centric()) {
+          if (group.centric) {
             dose_min_iminus = std::min(dose_i, dose_min_iminus);
           }
         }
 
-        for (std::size_t i = 0; i < group.iminus().size(); i++) {
-          for (std::size_t j = 0; j < group.iplus().size(); j++) {
-            DIALS_ASSERT(group.iminus()[i] != group.iplus()[j]);
+        for (std::size_t i = 0; i < group.n_iminus; i++) {
+          for (std::size_t j = 0; j < group.n_iplus; j++) {
+            DIALS_ASSERT(group.iminus[i] != group.iplus[j]);
           }
-          std::size_t dose_i = dose_[group.iminus()[i]];
+          std::size_t dose_i = dose_[group.iminus[i]];
           dose_min_iminus = std::min(dose_i, dose_min_iminus);
         }
 
@@ -197,6 +222,39 @@ namespace dials { namespace pychef {
         }
       }
 
+      /**
+       * @returns An accumulator of the same observations with nothing
+       * accumulated, to accumulate some of the groups separately and merge
+       */
+      CompletenessAccumulator empty_copy() const {
+        DIALS_ASSERT(!finalised_);
+        CompletenessAccumulator result(*this);
+        af::c_grid<2> grid = iplus_count.accessor();
+        result.iplus_count = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.iminus_count = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.ieither_count = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.iboth_count = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.iplus_comp_overall = af::shared<double>(n_steps_, 0.0);
+        result.iminus_comp_overall = af::shared<double>(n_steps_, 0.0);
+        result.ieither_comp_overall = af::shared<double>(n_steps_, 0.0);
+        result.iboth_comp_overall = af::shared<double>(n_steps_, 0.0);
+        return result;
+      }
+
+      /**
+       * Add the counts of another accumulator of the same observations
+       */
+      void merge(const CompletenessAccumulator &other) {
+        DIALS_ASSERT(!finalised_ && !other.finalised_);
+        DIALS_ASSERT(other.iplus_count.size() == iplus_count.size());
+        for (std::size_t i = 0; i < iplus_count.size(); i++) {
+          iplus_count[i] += other.iplus_count[i];
+          iminus_count[i] += other.iminus_count[i];
+          ieither_count[i] += other.ieither_count[i];
+          iboth_count[i] += other.iboth_count[i];
+        }
+      }
+
       void finalise(af::const_ref<std::size_t> counts_complete) {
         DIALS_ASSERT(!finalised_);
 
@@ -324,36 +382,71 @@ namespace dials { namespace pychef {
             scp_(n_steps, 0.0) {}
 
       void operator()(ObservationGroup group) {
-        if (group.iplus().size()) {
-          std::size_t i_bin = binner_.get_i_bin(d_star_sq_[group.iplus()[0]]);
-          if (i_bin > binner_.n_bins_used()) {
-          }
+        add(GroupIndices(group));
+      }
+
+      void add(const GroupIndices &group) {
+        if (group.n_iplus) {
+          std::size_t i_bin = binner_.get_i_bin(d_star_sq_[group.iplus[0]]);
           DIALS_ASSERT(i_bin <= binner_.n_bins_used())(i_bin);
           if (i_bin == 0) {
             // outside "used" bins
             return;
           }
-          accumulate(group.iplus(), i_bin - 1);
+          accumulate(group.iplus, group.n_iplus, i_bin - 1);
         }
-        if (group.iminus().size()) {
-          std::size_t i_bin = binner_.get_i_bin(d_star_sq_[group.iminus()[0]]);
+        if (group.n_iminus) {
+          std::size_t i_bin = binner_.get_i_bin(d_star_sq_[group.iminus[0]]);
           DIALS_ASSERT(i_bin <= binner_.n_bins_used())(i_bin);
           if (i_bin == 0) {
             // outside "used" bins
             return;
           }
-          accumulate(group.iminus(), i_bin - 1);
+          accumulate(group.iminus, group.n_iminus, i_bin - 1);
+        }
+      }
+
+      /**
+       * @returns An accumulator of the same observations with nothing
+       * accumulated, to accumulate some of the groups separately and merge
+       */
+      RcpScpAccumulator empty_copy() const {
+        DIALS_ASSERT(!finalised_);
+        RcpScpAccumulator result(*this);
+        af::c_grid<2> grid = A.accessor();
+        result.A = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.B = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.isigma = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.rcp_bins_ = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.scp_bins_ = af::versa<double, af::c_grid<2> >(grid, 0.0);
+        result.count = af::versa<std::size_t, af::c_grid<2> >(grid, 0);
+        result.rcp_ = af::shared<double>(n_steps_, 0.0);
+        result.scp_ = af::shared<double>(n_steps_, 0.0);
+        return result;
+      }
+
+      /**
+       * Add the sums of another accumulator of the same observations
+       */
+      void merge(const RcpScpAccumulator &other) {
+        DIALS_ASSERT(!finalised_ && !other.finalised_);
+        DIALS_ASSERT(other.A.size() == A.size());
+        for (std::size_t i = 0; i < A.size(); i++) {
+          A[i] += other.A[i];
+          B[i] += other.B[i];
+          isigma[i] += other.isigma[i];
+          count[i] += other.count[i];
         }
       }
 
     private:
-      void accumulate(scitbx::af::shared<std::size_t> irefs, std::size_t i_bin) {
+      void accumulate(const std::size_t *irefs, std::size_t n, std::size_t i_bin) {
         DIALS_ASSERT(i_bin < binner_.n_bins_used());
-        for (std::size_t i = 0; i < irefs.size(); i++) {
+        for (std::size_t i = 0; i < n; i++) {
           std::size_t dose_i = dose_[irefs[i]];
           double I_i = intensities_[irefs[i]];
           double sigi_i = sigmas_[irefs[i]];
-          for (std::size_t j = i + 1; j < irefs.size(); j++) {
+          for (std::size_t j = i + 1; j < n; j++) {
             std::size_t dose_j = dose_[irefs[j]];
             double I_j = intensities_[irefs[j]];
             double sigi_j = sigmas_[irefs[j]];
@@ -471,20 +564,49 @@ namespace dials { namespace pychef {
             rd_(n_steps, 0.0) {}
 
       void operator()(ObservationGroup group) {
-        if (group.iplus().size()) {
-          accumulate(group.iplus());
+        add(GroupIndices(group));
+      }
+
+      void add(const GroupIndices &group) {
+        if (group.n_iplus) {
+          accumulate(group.iplus, group.n_iplus);
+        }
+        if (group.n_iminus) {
+          accumulate(group.iminus, group.n_iminus);
         }
-        if (group.iminus().size()) {
-          accumulate(group.iminus());
+      }
+
+      /**
+       * @returns An accumulator of the same observations with nothing
+       * accumulated, to accumulate some of the groups separately and merge
+       */
+      RdAccumulator empty_copy() const {
+        DIALS_ASSERT(!finalised_);
+        RdAccumulator result(*this);
+        result.rd_top = af::shared<double>(n_steps_, 0.0);
+        result.rd_bottom = af::shared<double>(n_steps_, 0.0);
+        result.rd_ = af::shared<double>(n_steps_, 0.0);
+        return result;
+      }
+
+      /**
+       * Add the sums of another accumulator of the same observations
+       */
+      void merge(const RdAccumulator &other) {
+        DIALS_ASSERT(!finalised_ && !other.finalised_);
+        DIALS_ASSERT(other.rd_top.size() == rd_top.size());
+        for (std::size_t i = 0; i < rd_top.size(); i++) {
+          rd_top[i] += other.rd_top[i];
+          rd_bottom[i] += other.rd_bottom[i];
         }
       }
 
     private:
-      void accumulate(scitbx::af::shared<std::size_t> irefs) {
-        for (std::size_t i = 0; i < irefs.size(); i++) {
+      void accumulate(const std::size_t *irefs, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) {
           int dose_i = dose_[irefs[i]];
           double I_i = intensities_[irefs[i]];
-          for (std::size_t j = i + 1; j < irefs.size(); j++) {
+          for (std::size_t j = i + 1; j < n; j++) {
             int dose_j = dose_[irefs[j]];
             double I_j = intensities_[irefs[j]];
             std::size_t d_dose = std::abs(dose_i - dose_j);
@@ -525,6 +647,51 @@ namespace dials { namespace pychef {
 
   }  // namespace accumulator
 
+  namespace detail {
+
+    /**
+     * The most blocks of groups accumulated separately. The groups are split
+     * into this many blocks whatever the number of threads, and the blocks
+     * merged in order, so the statistics do not depend on the threads.
+     */
+    const std::size_t chef_max_blocks = 16;
+
+    /**
+     * Accumulate a band of blocks of groups, each into its own accumulators
+     */
+    struct AccumulateBlocks {
+      const std::vector<accumulator::GroupIndices> &groups;
+      std::size_t nblocks;
+      accumulator::CompletenessAccumulator **completeness;
+      accumulator::RcpScpAccumulator **rcp_scp;
+      accumulator::RdAccumulator **rd;
+
+      AccumulateBlocks(const std::vector<accumulator::GroupIndices> &groups_,
+                       std::size_t nblocks_,
+                       accumulator::CompletenessAccumulator **completeness_,
+                       accumulator::RcpScpAccumulator **rcp_scp_,
+                       accumulator::RdAccumulator **rd_)
+          : groups(groups_),
+            nblocks(nblocks_),
+            completeness(completeness_),
+            rcp_scp(rcp_scp_),
+            rd(rd_) {}
+
+      void operator()(int b0, int b1) const {
+        for (int b = b0; b < b1; ++b) {
+          std::size_t i0 = groups.size() * b / nblocks;
+          std::size_t i1 = groups.size() * (b + 1) / nblocks;
+          for (std::size_t i = i0; i < i1; ++i) {
+            completeness[b]->add(groups[i]);
+            rcp_scp[b]->add(groups[i]);
+            rd[b]->add(groups[i]);
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
   class ChefStatistics {
   public:
     ChefStatistics(scitbx::af::const_ref<cctbx::miller::index<> > const &miller_indices,
@@ -536,19 +703,57 @@ namespace dials { namespace pychef {
                    cctbx::miller::binner const &binner,
                    sgtbx::space_group space_group,
                    bool anomalous_flag,
-                   int n_steps)
+                   int n_steps,
+                   std::size_t nthreads = 1)
         : observations(miller_indices, space_group, anomalous_flag),
           completeness_accumulator(dose, d_star_sq, binner, n_steps),
           rcp_scp_accumulator(intensities, sigmas, dose, d_star_sq, binner, n_steps),
           rd_accumulator(intensities, dose, n_steps) {
+      using namespace accumulator;
       typedef Observations::map_type map_t;
-      map_t groups = observations.observation_groups();
+      DIALS_ASSERT(nthreads > 0);
 
+      // Point at the observations of each group, so they can be read without
+      // copying the arrays of the groups in the threads
+      map_t &groups = observations.observation_groups_;
+      std::vector<GroupIndices> indices;
+      indices.reserve(groups.size());
       for (map_t::iterator it = groups.begin(); it != groups.end(); it++) {
-        ObservationGroup group = it->second;
-        completeness_accumulator(group);
-        rcp_scp_accumulator(group);
-        rd_accumulator(group);
+        indices.push_back(GroupIndices(it->second));
+      }
+
+      // Accumulate blocks of the groups into separate accumulators
+      std::size_t nblocks = std::min(detail::chef_max_blocks, indices.size());
+      std::vector<boost::shared_ptr<CompletenessAccumulator> > completeness;
+      std::vector<boost::shared_ptr<RcpScpAccumulator> > rcp_scp;
+      std::vector<boost::shared_ptr<RdAccumulator> > rd;
+      std::vector<CompletenessAccumulator *> completeness_ptr;
+      std::vector<RcpScpAccumulator *> rcp_scp_ptr;
+      std::vector<RdAccumulator *> rd_ptr;
+      for (std::size_t b = 0; b < nblocks; ++b) {
+        completeness.push_back(boost::shared_ptr<CompletenessAccumulator>(
+          new CompletenessAccumulator(completeness_accumulator.empty_copy())));
+        rcp_scp.push_back(boost::shared_ptr<RcpScpAccumulator>(
+          new RcpScpAccumulator(rcp_scp_accumulator.empty_copy())));
+        rd.push_back(boost::shared_ptr<RdAccumulator>(
+          new RdAccumulator(rd_accumulator.empty_copy())));
+        completeness_ptr.push_back(completeness.back().get());
+        rcp_scp_ptr.push_back(rcp_scp.back().get());
+        rd_ptr.push_back(rd.back().get());
+      }
+      if (nblocks > 0) {
+        dials::algorithms::for_each_band(
+          detail::AccumulateBlocks(
+            indices, nblocks, &completeness_ptr[0], &rcp_scp_ptr[0], &rd_ptr[0]),
+          (int)nblocks,
+          nthreads);
+      }
+
+      // Merge the blocks in order
+      for (std::size_t b = 0; b < nblocks; ++b) {
+        completeness_accumulator.merge(*completeness[b]);
+        rcp_scp_accumulator.merge(*rcp_scp[b]);
+        rd_accumulator.merge(*rd[b]);
       }
 
       completeness_accumulator.finalise(counts_complete);
@@ -5,6 +5,7 @@
 from libtbx import phil
 
 from dials.util import resolution_analysis
+from dials.util.mp import available_cores
 from dials_pychef_ext import ChefStatistics, Observations
 
 __all__ = [
@@ -108,7 +109,14 @@ def interpret_images_to_doses_options(
 
 class Statistics(object):
     def __init__(
-        self, intensities, dose, n_bins=8, range_min=None, range_max=None, range_width=1
+        self,
+        intensities,
+        dose,
+        n_bins=8,
+        range_min=None,
+        range_max=None,
+        range_width=1,
+        nthreads=None,
     ):
 
         if isinstance(dose, flex.double):
@@ -178,6 +186,7 @@ def __init__(
             intensities.space_group(),
             intensities.anomalous_flag(),
             self.n_steps,
+            nthreads=nthreads if nthreads else available_cores(),
         )
 
         self.iplus_comp_bins = chef_stats.iplus_completeness_bins()
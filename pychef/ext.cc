@@ -51,16 +51,18 @@ namespace dials { namespace pychef { namespace boost_python {
                 cctbx::miller::binner const &,
                 sgtbx::space_group,
                 bool,
-                int>((arg("miller_index"),
-                      arg("intensities"),
-                      arg("sigmas"),
-                      arg("d_star_sq"),
-                      arg("dose"),
-                      arg("counts_complete"),
-                      arg("binner"),
-                      arg("space_group"),
-                      arg("anomalous_flag"),
-                      arg("n_steps"))))
+                int,
+                std::size_t>((arg("miller_index"),
+                              arg("intensities"),
+                              arg("sigmas"),
+                              arg("d_star_sq"),
+                              arg("dose"),
+                              arg("counts_complete"),
+                              arg("binner"),
+                              arg("space_group"),
+                              arg("anomalous_flag"),
+                              arg("n_steps"),
+                              arg("nthreads") = 1)))
       .def("iplus_completeness", &chef_statistics_t::iplus_completeness)
       .def("iminus_completeness", &chef_statistics_t::iminus_completeness)
       .def("ieither_completeness", &chef_statistics_t::ieither_completeness)
@@ -0,0 +1,26 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+from dials.algorithms.background.glm import RobustPoissonMean
+from dials.array_family import flex
+
+
+def test_robust_poisson_mean_sorted():
+    random.seed(0)
+    for mean in (0.5, 5, 50):
+        # Poisson-like background with a few bright outliers
+        Y = flex.double(
+            random.gauss(mean, mean ** 0.5) if i % 37 else 20 * mean
+            for i in range(1000)
+        )
+        Y.set_selected(Y < 0, 0)
+        median = max(1.0, flex.median(Y))
+
+        expected = RobustPoissonMean(Y, median)
+        result = RobustPoissonMean(flex.sorted(Y), median, sorted=True)
+        assert result.converged()
+        assert result.niter() == expected.niter()
+        assert result.mean() == pytest.approx(expected.mean(), rel=1e-9)
@@ -135,3 +135,96 @@ def test_robust(dials_data, model, tmpdir):
 
     scale4 = integrated4["background.scale"]
     assert (scale4 > 0).count(False) == 0
+
+
+def test_mapped_model(tmpdir):
+    import six.moves.cPickle as pickle
+
+    from dials.algorithms.background.gmodel import (
+        is_mapped_background_model,
+        MappedBackgroundModel,
+        StaticBackgroundModel,
+    )
+    from dials.array_family import flex
+
+    model = StaticBackgroundModel()
+    for ysize, xsize in ((20, 30), (7, 11)):
+        data = flex.double(flex.grid(ysize, xsize))
+        for i in range(len(data)):
+            data[i] = i
+        model.add(data)
+
+    filename = tmpdir.join("model.bgm").strpath
+    model.as_mapped_file(filename)
+    assert is_mapped_background_model(filename)
+    mapped = MappedBackgroundModel(filename)
+    assert len(mapped) == len(model)
+    for panel in range(len(model)):
+        assert mapped.data(panel).all() == model.data(panel).all()
+        assert list(mapped.data(panel)) == list(model.data(panel))
+
+    # Shoeboxes overlapping the edge of the panel
+    for bbox in ((-2, 5, 3, 9, 0, 2), (25, 35, 15, 25, 4, 5)):
+        expected = model.extract(0, bbox)
+        assert list(mapped.extract(0, bbox)) == list(expected)
+
+    # Pickling the mapped model only stores the filename
+    mapped2 = pickle.loads(pickle.dumps(mapped))
+    assert mapped2.filename() == filename
+    assert list(mapped2.data(1)) == list(model.data(1))
+
+
+def _small_experiment_models():
+    from dxtbx.model import BeamFactory, DetectorFactory, GoniometerFactory
+
+    beam = BeamFactory.simple((0, 0, 1), 1.0)
+    detector = DetectorFactory.simple(
+        "PAD", 50, (12.5, 20.0), "+x", "-y", (0.5, 0.5), (60, 80)
+    )
+    goniometer = GoniometerFactory.known_axis((1, 0, 0))
+    return beam, detector, goniometer
+
+
+def test_polar_transform_threads():
+    from dials.algorithms.background.gmodel import PolarTransform
+    from dials.array_family import flex
+
+    beam, detector, goniometer = _small_experiment_models()
+    transform = PolarTransform(beam, detector[0], goniometer)
+    assert transform.num_matrix_elements() > 0
+
+    data = flex.double(flex.grid(80, 60))
+    for j in range(80):
+        for i in range(60):
+            data[j, i] = 10 + (i * 7 + j * 3) % 11
+    mask = flex.bool(data.accessor(), True)
+    mask[40, 30] = False
+
+    polar = transform.to_polar(data, mask)
+    image = transform.from_polar(polar.data(), polar.mask())
+    for nthreads in (2, 7):
+        threaded = PolarTransform(beam, detector[0], goniometer, nthreads=nthreads)
+        other = threaded.to_polar(data, mask, nthreads=nthreads)
+        assert list(other.data()) == list(polar.data())
+        assert list(other.mask()) == list(polar.mask())
+        other = threaded.from_polar(polar.data(), polar.mask(), nthreads=nthreads)
+        assert list(other.data()) == list(image.data())
+        assert list(other.mask()) == list(image.mask())
+
+
+def test_radial_average_frames():
+    from dials.algorithms.background import RadialAverage
+    from dials.array_family import flex
+
+    beam, detector, goniometer = _small_experiment_models()
+    data = flex.double(flex.grid(80, 60), 5)
+    mask = flex.bool(data.accessor(), True)
+
+    single = RadialAverage(beam, detector, 0.0, 1.0, 20)
+    single.add(data, mask)
+    frames = RadialAverage(beam, detector, 0.0, 1.0, 20)
+    for i in range(3):
+        frames.add(data, mask)
+    assert list(frames.mean()) == list(single.mean())
+    assert list(frames.weight()) == [3 * w for w in single.weight()]
+    assert flex.sum(single.weight()) > 0
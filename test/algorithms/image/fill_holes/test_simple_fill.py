@@ -23,3 +23,10 @@ def test():
     filled = result.as_1d().select(~mask.as_1d())
     assert flex.max(filled) <= flex.max(known)
     assert flex.min(filled) >= flex.min(known)
+
+    # Separate holes are filled in parallel with the same result
+    for j in range(5):
+        for i in range(0, 100, 7):
+            mask[80 + j, i] = False
+    result = simple_fill(data, mask)
+    assert simple_fill(data, mask, nthreads=3).all_eq(result)
@@ -0,0 +1,36 @@
+from __future__ import absolute_import, division, print_function
+
+import pytest
+
+
+def test_anisotropic_diffusion():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import anisotropic_diffusion
+
+    image = flex.random_double(203 * 101) * 100
+    image.reshape(flex.grid(203, 101))
+    mask = flex.random_bool(203 * 101, 0.9)
+    mask.reshape(flex.grid(203, 101))
+
+    for args in ((image,), (image, mask)):
+        result = anisotropic_diffusion(*args, niter=5)
+
+        # The edge pixels are not filtered
+        assert result[0, 10] == image[0, 10]
+        assert result[202, 100] == image[202, 100]
+
+        # The result does not depend on the number of threads
+        threaded = anisotropic_diffusion(*args, niter=5, nthreads=3)
+        assert list(threaded) == list(result)
+
+        # The single precision filter is close to the double precision one
+        float_args = (image.as_float(),) + args[1:]
+        single = anisotropic_diffusion(*float_args, niter=5)
+        assert list(single.as_double()) == pytest.approx(list(result), abs=1e-3)
+
+    # Masked pixels are not changed
+    result = anisotropic_diffusion(image, mask, niter=5)
+    for i in range(10000):
+        if not mask[i]:
+            assert result[i] == image[i]
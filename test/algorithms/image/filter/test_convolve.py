@@ -0,0 +1,63 @@
+from __future__ import absolute_import, division, print_function
+
+import pytest
+
+
+def generate_image(xsize, ysize):
+    from scitbx.array_family import flex
+
+    image = flex.random_double(xsize * ysize)
+    image.reshape(flex.grid(ysize, xsize))
+    return image
+
+
+def reference_convolve(image, kernel):
+    """Convolve by summing over the kernel, repeating the edge pixels"""
+    ysize, xsize = image.all()
+    ky, kx = kernel.all()
+    result = []
+    for j in range(ysize):
+        for i in range(xsize):
+            value = 0
+            for jj in range(ky):
+                for ii in range(kx):
+                    y = min(max(j + jj - ky // 2, 0), ysize - 1)
+                    x = min(max(i + ii - kx // 2, 0), xsize - 1)
+                    value += image[y, x] * kernel[jj, ii]
+            result.append(value)
+    return result
+
+
+@pytest.mark.parametrize("kernel_size", [(3, 5), (17, 15)])
+def test_convolve(kernel_size):
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import convolve, convolve_direct, convolve_fft
+
+    image = generate_image(40, 30)
+    kernel = flex.random_double(kernel_size[0] * kernel_size[1]) - 0.5
+    kernel.reshape(flex.grid(kernel_size))
+    expected = reference_convolve(image, kernel)
+
+    for method in (convolve, convolve_direct, convolve_fft):
+        result = method(image, kernel)
+        assert list(result) == pytest.approx(expected, abs=1e-10)
+
+
+def test_convolve_separable():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import convolve, convolve_separable
+
+    image = generate_image(40, 30)
+    col = flex.double([1, 3, 4, 3, 1])
+    row = flex.double([-1, 2, 0.5])
+    kernel = flex.double(flex.grid(5, 3))
+    for j in range(5):
+        for i in range(3):
+            kernel[j, i] = col[j] * row[i]
+    expected = reference_convolve(image, kernel)
+
+    assert list(convolve(image, kernel)) == pytest.approx(expected, abs=1e-10)
+    result = convolve_separable(image, col, row)
+    assert list(result) == pytest.approx(expected, abs=1e-10)
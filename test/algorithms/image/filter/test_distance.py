@@ -110,3 +110,26 @@ def test_chebyshev_small():
     known.reshape(distance.accessor())
 
     assert (known == distance).count(False) == 0
+
+
+def test_euclidean():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import euclidean_distance, euclidean_distance_sq
+
+    height, width = 37, 53
+    data = flex.bool(flex.grid(height, width), False)
+    points = [(3, 4), (20, 40), (30, 10), (36, 52), (10, 30)]
+    for j, i in points:
+        data[j, i] = True
+
+    distance_sq = euclidean_distance_sq(data, True)
+    for j in range(height):
+        for i in range(width):
+            expected = min((j - y) ** 2 + (i - x) ** 2 for y, x in points)
+            assert distance_sq[j, i] == expected
+
+    assert list(euclidean_distance_sq(data, True, nthreads=4)) == list(distance_sq)
+    distance = euclidean_distance(data, True, nthreads=3)
+    for d, d2 in zip(distance, distance_sq):
+        assert abs(d - math.sqrt(d2)) < 1e-12
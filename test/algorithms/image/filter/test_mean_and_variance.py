@@ -130,3 +130,27 @@ def test_masked_mean_and_variance_filter():
             v2 = mv.unweighted_sample_variance()
         assert m1 == pytest.approx(m2, abs=eps)
         assert v1 == pytest.approx(v2, abs=eps)
+
+
+def test_threaded_mean_and_variance_filter():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import mean_and_variance_filter
+
+    image = flex.random_double(301 * 203)
+    image.reshape(flex.grid(301, 203))
+    mask = flex.random_bool(301 * 203, 0.95).as_int()
+    mask.reshape(flex.grid(301, 203))
+
+    # The filtered images should not depend on the number of threads
+    for args in ((image, (3, 2)), (image, mask, (3, 2), 5)):
+        serial = mean_and_variance_filter(*args)
+        threaded = mean_and_variance_filter(*args, nthreads=4)
+        for name in ("mean", "variance", "sample_variance"):
+            expected = getattr(serial, name)()
+            assert getattr(threaded, name)() == pytest.approx(expected)
+
+            # Write the filtered image into an existing array
+            result = flex.double(flex.grid(301, 203), -1)
+            getattr(threaded, name)(result)
+            assert result == pytest.approx(expected)
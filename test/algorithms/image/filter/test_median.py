@@ -75,3 +75,35 @@ def test_masked_filter():
                     pixels = sorted(list(pixels))
                     value = pixels[len(pixels) // 2]
                 assert result[j, i] == pytest.approx(value, abs=eps)
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_integer_filter(nthreads):
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import median_filter
+
+    xsize = 200
+    ysize = 300
+    kernel = (3, 2)
+
+    image = (generate_image(xsize, ysize) * 100).iround()
+    mask = generate_mask(xsize, ysize)
+
+    # The histogram filter used for integer images should match the generic
+    # filter applied to the same values
+    result = median_filter(image, kernel, nthreads=nthreads)
+    expected = median_filter(image.as_double(), kernel)
+    assert list(result.as_double()) == list(expected)
+
+    for periodic in (False, True):
+        result = median_filter(image, mask, kernel, periodic, nthreads=nthreads)
+        expected = median_filter(image.as_double(), mask, kernel, periodic)
+        assert list(result.as_double()) == list(expected)
+
+    # A range of values too large for a histogram
+    image[0] = 2 ** 30
+    result = median_filter(image, kernel, nthreads=nthreads)
+    expected = median_filter(image.as_double(), kernel)
+    assert list(result.as_double()) == list(expected)
+    assert isinstance(result, flex.int)
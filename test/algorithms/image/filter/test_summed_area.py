@@ -25,3 +25,19 @@ def test():
         v = sa[j, i]
         e = flex.sum(image[j - 3 : j + 4, i - 3 : i + 4])
         assert e == pytest.approx(v, abs=1e-7)
+
+
+def test_threaded():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.image.filter import summed_area, summed_area_table
+
+    image = flex.random_int_gaussian_distribution(301 * 203, 100, 10)
+    image.reshape(flex.grid(301, 203))
+
+    # Integer tables are exact so should not depend on the number of threads
+    table = summed_area_table(image)
+    assert table[300, 202] == flex.sum(image)
+    assert list(summed_area_table(image, nthreads=4)) == list(table)
+    expected = summed_area(image, (3, 2))
+    assert list(summed_area(image, (3, 2), nthreads=4)) == list(expected)
@@ -13,6 +13,8 @@
     DispersionExtendedThresholdDebug,
     DispersionThreshold,
     DispersionThresholdDebug,
+    TiledDispersionExtendedThreshold,
+    TiledDispersionThreshold,
 )
 
 
@@ -161,6 +163,24 @@ def test_dispersion_debug(self):
         result4 = debug.final_mask()
         assert result3 == result4
 
+        # The maps do not depend on the number of threads
+        threaded = DispersionThresholdDebug(
+            self.image,
+            self.mask,
+            self.gain,
+            self.size,
+            nsig_b,
+            nsig_s,
+            0,
+            self.min_count,
+            nthreads=3,
+        )
+        assert threaded.final_mask().all_eq(result4)
+        assert threaded.mean().all_approx_equal(debug.mean())
+        assert threaded.index_of_dispersion().all_approx_equal(
+            debug.index_of_dispersion()
+        )
+
     def test_dispersion_threshold(self):
         from dials.algorithms.image.threshold import (
             DispersionThreshold,
@@ -190,6 +210,71 @@ def test_dispersion_threshold(self):
         assert result1 == result3
         assert result2 == result4
 
+    def test_dispersion_threshold_vectorise(self):
+        from dials.algorithms.image.threshold import DispersionThreshold
+        from dials.array_family import flex
+
+        nsig_b = 3
+        nsig_s = 3
+        algorithm = DispersionThreshold(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+        assert algorithm.vectorise
+
+        results = []
+        for vectorise in (True, False):
+            algorithm.vectorise = vectorise
+            result1 = flex.bool(flex.grid(self.image.all()))
+            result2 = flex.bool(flex.grid(self.image.all()))
+            algorithm(self.image, self.mask, result1)
+            algorithm(self.image, self.mask, self.gain, result2)
+            results.append((result1, result2))
+        assert results[0][0] == results[1][0]
+        assert results[0][1] == results[1][1]
+
+    def test_dispersion_threshold_streaming(self):
+        from dials.algorithms.image.threshold import DispersionThreshold
+        from dials.array_family import flex
+
+        nsig_b = 3
+        nsig_s = 3
+        algorithm = DispersionThreshold(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+        assert not algorithm.streaming
+
+        # The image contains integer counts so the running sums are exact
+        results = []
+        for streaming in (False, True):
+            algorithm.streaming = streaming
+            result1 = flex.bool(flex.grid(self.image.all()))
+            result2 = flex.bool(flex.grid(self.image.all()))
+            algorithm(self.image, self.mask, result1)
+            algorithm(self.image, self.mask, self.gain, result2)
+            results.append((result1, result2))
+        assert results[0][0] == results[1][0]
+        assert results[0][1] == results[1][1]
+
+    def test_dispersion_threshold_native_types(self):
+        from dials.algorithms.image.threshold import DispersionThreshold
+        from dials.array_family import flex
+
+        nsig_b = 3
+        nsig_s = 3
+        algorithm = DispersionThreshold(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+
+        # The image contains integer counts so every input type gives the
+        # same result
+        expected = flex.bool(flex.grid(self.image.all()))
+        algorithm(self.image, self.mask, expected)
+        for image in (self.image.iround(), self.image.as_float()):
+            image.reshape(flex.grid(self.image.all()))
+            result = flex.bool(flex.grid(self.image.all()))
+            algorithm(image, self.mask, result)
+            assert result == expected
+
     def test_dispersion_extended_threshold(self):
         from dials.algorithms.image.threshold import (
             DispersionExtendedThreshold,
@@ -227,6 +312,72 @@ def test_dispersion_extended_threshold(self):
         result4 = debug.final_mask()
         assert result2 == result4
 
+    @pytest.mark.parametrize(
+        "algorithm,tiled_algorithm",
+        [
+            (DispersionThreshold, TiledDispersionThreshold),
+            (DispersionExtendedThreshold, TiledDispersionExtendedThreshold),
+        ],
+    )
+    def test_tiled_dispersion_threshold(self, algorithm, tiled_algorithm):
+        nsig_b = 3
+        nsig_s = 3
+        thresholder = algorithm(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+        result1 = flex.bool(flex.grid(self.image.all()))
+        result2 = flex.bool(flex.grid(self.image.all()))
+        thresholder(self.image, self.mask, result1)
+        thresholder(self.image, self.mask, self.gain, result2)
+
+        tiled = tiled_algorithm(
+            self.size,
+            nsig_b,
+            nsig_s,
+            0,
+            self.min_count,
+            tile_size=(300, 170),
+            nthreads=4,
+        )
+        result3 = flex.bool(flex.grid(self.image.all()))
+        result4 = flex.bool(flex.grid(self.image.all()))
+        tiled(self.image, self.mask, result3)
+        tiled(self.image, self.mask, self.gain, result4)
+        assert result1 == result3
+        assert result2 == result4
+
+        # Multiple panels are thresholded in one call
+        result5 = flex.bool(flex.grid(self.image.all()))
+        result6 = flex.bool(flex.grid(self.image.all()))
+        tiled((self.image, self.image), (self.mask, self.mask), (result5, result6))
+        assert result1 == result5
+        assert result1 == result6
+
+    def test_cuda_dispersion_extended_threshold(self):
+        cuda = pytest.importorskip("dials.algorithms.image.threshold.cuda")
+        if not cuda.is_available():
+            pytest.skip("No CUDA device available")
+
+        nsig_b = 3
+        nsig_s = 3
+        thresholder = DispersionExtendedThreshold(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+        result1 = flex.bool(flex.grid(self.image.all()))
+        result2 = flex.bool(flex.grid(self.image.all()))
+        thresholder(self.image, self.mask, result1)
+        thresholder(self.image, self.mask, self.gain, result2)
+
+        gpu = cuda.DispersionExtendedThreshold(
+            self.image.all(), self.size, nsig_b, nsig_s, 0, self.min_count
+        )
+        result3 = flex.bool(flex.grid(self.image.all()))
+        result4 = flex.bool(flex.grid(self.image.all()))
+        gpu(self.image, self.mask, result3)
+        gpu(self.image, self.mask, self.gain, result4)
+        assert result1 == result3
+        assert result2 == result4
+
     @pytest.mark.parametrize(
         "algorithm", [DispersionThreshold, DispersionExtendedThreshold]
     )
@@ -75,6 +75,34 @@ def test_with_identical_non_negative_profiles(self):
                         assert abs(reference[k, j, i] - profile[k, j, i]) <= eps
             assert abs(flex.sum(reference) - 1.0) <= eps
 
+    def test_with_single_precision_storage(self):
+        from scitbx.array_family import flex
+
+        # Generate identical non-negative profiles
+        reflections, profiles, profile = self.generate_identical_non_negative_profiles()
+
+        # Create the reference learner storing the profiles as float
+        modeller = Modeller(self.n, self.grid_size, self.threshold, True)
+        assert modeller.single_precision()
+
+        # Do the modelling
+        modeller.model(reflections, profiles)
+        modeller.finalize()
+
+        # Normalize the profile
+        profile = self.normalize_profile(profile)
+
+        # Check the reference profiles are the same to single precision
+        eps = 1e-7
+        for index in range(len(modeller)):
+            reference = modeller.data(index)
+            assert reference.all() == self.grid_size
+            for k in range(self.grid_size[2]):
+                for j in range(self.grid_size[1]):
+                    for i in range(self.grid_size[0]):
+                        assert abs(reference[k, j, i] - profile[k, j, i]) <= eps
+            assert abs(flex.sum(reference) - 1.0) <= 1e-5
+
     def test_with_systematically_offset_profiles(self):
         from scitbx.array_family import flex
 
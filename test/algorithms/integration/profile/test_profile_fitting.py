@@ -5,7 +5,7 @@
 import numpy as np
 import pytest
 
-from dials.algorithms.integration.fit import ProfileFitter
+from dials.algorithms.integration.fit import BatchProfileFitter, ProfileFitter
 from dials.array_family import flex
 
 
@@ -297,6 +297,86 @@ def test_with_flat_background_partial():
     assert V[0] == pytest.approx(Vknown, abs=eps)
 
 
+def test_batch():
+    np.random.seed(0)
+
+    # Create profile
+    p = gaussian((9, 9, 9), 1, (4, 4, 4), (2, 2, 2))
+    s = flex.sum(p)
+    p = p / s
+
+    # Create reflections with different intensities and backgrounds, the last
+    # of which is fully masked so cannot be fitted
+    n = 6
+    c = flex.double()
+    b = flex.double()
+    m = flex.bool()
+    for i in range(n):
+        bi = flex.double(flex.grid(9, 9, 9), i)
+        c.extend(add_poisson_noise(100 * (i + 1) * p) + add_poisson_noise(bi))
+        b.extend(bi)
+        m.extend(flex.bool(flex.grid(9, 9, 9), i < n - 1))
+    c.reshape(flex.grid(n, len(p)))
+    b.reshape(flex.grid(n, len(p)))
+    m.reshape(flex.grid(n, len(p)))
+
+    # Fit
+    fit = BatchProfileFitter(c, b, m, p.as_1d())
+    intensity = fit.intensity()
+    V = fit.variance()
+    success = fit.success()
+    assert len(intensity) == n
+
+    # Test the results are the same as fitting each reflection on its own
+    for i in range(n):
+        ci = c[i : i + 1, :]
+        bi = b[i : i + 1, :]
+        mi = m[i : i + 1, :]
+        if i == n - 1:
+            assert not success[i]
+            with pytest.raises(RuntimeError):
+                ProfileFitter(ci.as_1d(), bi.as_1d(), mi.as_1d(), p.as_1d())
+            continue
+        single = ProfileFitter(ci.as_1d(), bi.as_1d(), mi.as_1d(), p.as_1d())
+        assert success[i]
+        assert fit.niter()[i] == single.niter()
+        assert intensity[i] == pytest.approx(single.intensity()[0])
+        assert V[i] == pytest.approx(single.variance()[0])
+        assert fit.correlation()[i] == pytest.approx(single.correlation())
+
+
+def test_warm_start_and_sigma_tolerance():
+    np.random.seed(0)
+
+    # Create profile
+    p = gaussian((9, 9, 9), 1, (4, 4, 4), (2, 2, 2))
+    s = flex.sum(p)
+    p = p / s
+
+    # Copy profile
+    c0 = add_poisson_noise(100 * p)
+    b = flex.double(flex.grid(9, 9, 9), 10)
+    m = flex.bool(flex.grid(9, 9, 9), True)
+    c = c0 + add_poisson_noise(b)
+
+    # Fit from the summation intensity
+    fit = ProfileFitter(c, b, m, p)
+    intensity = fit.intensity()[0]
+    assert fit.niter() > 0
+
+    # Starting from the fitted intensity converges straight away
+    warm = ProfileFitter(c, b, m, p, start=intensity)
+    assert warm.niter() == 0
+    assert warm.intensity()[0] == pytest.approx(intensity, abs=1e-3)
+
+    # A tolerance in terms of sigma stops earlier but stays within it
+    sigma_tolerance = 0.5
+    loose = ProfileFitter(c, b, m, p, sigma_tolerance=sigma_tolerance)
+    assert loose.niter() < fit.niter()
+    sigma = math.sqrt(loose.variance()[0])
+    assert loose.intensity()[0] == pytest.approx(intensity, abs=sigma_tolerance * sigma)
+
+
 def test_deconvolve_3_with_no_background():
     np.random.seed(0)
 
@@ -30,6 +30,35 @@ def test_run(dials_data):
     diff = flex.abs(lp1 - lp2)
     assert diff.all_lt(1e-7)
 
+    # The threaded corrections should be identical
+    assert list(corrector.lp(rlist["id"], rlist["s1"], nthreads=4)) == list(lp1)
+
+
+def test_qe(dials_data):
+    from dials.algorithms.integration import qe_correction
+
+    filename = dials_data("centroid_test_data").join("experiments.json").strpath
+    exlist = ExperimentListFactory.from_json_file(filename)
+    rlist = flex.reflection_table.from_predictions_multi(exlist)
+
+    detector = exlist[0].detector
+    for panel in detector:
+        panel.set_mu(1.5)
+        panel.set_thickness(0.32)
+    corrector = CorrectionsMulti()
+    corrector.append(Corrections(exlist[0].beam, exlist[0].goniometer, detector))
+
+    qe1 = corrector.qe(rlist["id"], rlist["s1"], rlist["panel"])
+    qe2 = flex.double(
+        [
+            qe_correction(1.5, 0.32, s1, detector[p].get_normal())
+            for s1, p in zip(rlist["s1"], rlist["panel"])
+        ]
+    )
+    assert flex.abs(qe1 - qe2).all_lt(1e-12)
+    qe3 = corrector.qe(rlist["id"], rlist["s1"], rlist["panel"], nthreads=3)
+    assert list(qe3) == list(qe1)
+
 
 def LP_calculations(experiment, s1):
     """See Kabsch, J. Appl. Cryst 1988 21 916-924."""
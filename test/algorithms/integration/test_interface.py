@@ -248,6 +248,40 @@ def test_split_blocks_overlapping():
         assert bb[3] == bbox[3]
 
 
+def test_split_blocks_balanced():
+    from dials.algorithms.integration.integrator import JobList
+    from dials.array_family import flex
+
+    # The second half of the frames has ten times the work of the first
+    work = flex.double([1] * 50 + [10] * 50)
+    jobs = JobList()
+    jobs.add_balanced((0, 1), (0, 100), work, 4, 3)
+    frames = [jobs[i].frames() for i in range(len(jobs))]
+    assert frames == [(0, 62), (59, 76), (73, 90), (87, 100)]
+
+    # Each job needs more frames than the overlap
+    jobs = JobList()
+    jobs.add_balanced((0, 1), (0, 10), flex.double(10, 1), 8, 4)
+    frames = [jobs[i].frames() for i in range(len(jobs))]
+    assert frames == [(0, 9), (5, 10)]
+
+    # Without any work the frames are split evenly
+    jobs = JobList()
+    jobs.add_balanced((0, 1), (10, 30), flex.double(20, 0), 2, 0)
+    frames = [jobs[i].frames() for i in range(len(jobs))]
+    assert frames == [(10, 20), (20, 30)]
+
+    # The work on each frame is the number of shoebox pixels
+    from dials.algorithms.integration.processor import shoebox_pixels_per_frame
+
+    reflections = flex.reflection_table()
+    reflections["bbox"] = flex.int6([(0, 2, 0, 3, 1, 3), (0, 1, 0, 1, -1, 2)])
+    reflections["id"] = flex.int([0, 0])
+    reflections["flags"] = flex.size_t([0, 0])
+    work = shoebox_pixels_per_frame(reflections, (0, 1), (0, 4))
+    assert list(work) == [1, 7, 6, 0]
+
+
 def test_reflection_manager():
     from dials.array_family import flex
 
@@ -402,6 +436,48 @@ def test_reflection_manager():
     # Test passed
 
 
+def test_shoebox_memory_estimate():
+    from dials.algorithms.integration.integrator import JobList
+    from dials.array_family import flex
+
+    random.seed(0)
+    reflections = flex.reflection_table()
+    reflections["bbox"] = flex.int6()
+    reflections["id"] = flex.int()
+    reflections["flags"] = flex.size_t()
+    for i in range(1000):
+        x0 = random.randint(0, 990)
+        y0 = random.randint(0, 990)
+        z0 = random.randint(0, 95)
+        bbox = (
+            x0,
+            x0 + random.randint(1, 10),
+            y0,
+            y0 + random.randint(1, 10),
+            z0,
+            z0 + random.randint(1, 5),
+        )
+        reflections.append({"bbox": bbox, "id": 0, "flags": 0})
+
+    # With a single job the estimate is exact
+    jobs = JobList()
+    jobs.add((0, 1), (0, 100), 100, 0)
+    for flatten in (False, True):
+        expected = jobs.shoebox_memory(reflections, flatten)
+        assert list(jobs.shoebox_memory_estimate(reflections, flatten)) == list(
+            expected
+        )
+
+    # With several jobs it is an upper bound on the memory after splitting
+    jobs = JobList()
+    jobs.add((0, 1), (0, 100), 20, 4)
+    estimate = jobs.shoebox_memory_estimate(reflections, False)
+    jobs.split(reflections)
+    memory = jobs.shoebox_memory(reflections, False)
+    assert len(estimate) == len(memory) == len(jobs)
+    assert all(e >= m for e, m in zip(estimate, memory))
+
+
 @pytest.mark.parametrize("nproc", [1, 2])
 def test_integrator_3d(dials_data, nproc):
     from math import pi
@@ -8,7 +8,91 @@
 from dxtbx.model.experiment_list import ExperimentListFactory
 from libtbx.phil import parse
 
+from dials.algorithms.integration import get_kapton_path_cpp
+from dials.algorithms.integration.kapton_2019_correction import KaptonTape_2019
+from dials.algorithms.integration.kapton_correction import KaptonAbsorption
+from dials.algorithms.shoebox import MaskCode
 from dials.array_family import flex
+from dials.model.data import Shoebox
+
+
+def _s1_grid(n=25):
+    """Unit vectors on a grid of directions to and behind the sample"""
+    s1 = flex.vec3_double()
+    for i in range(n):
+        for j in range(n):
+            x = -1 + 2 * i / (n - 1)
+            y = -1 + 2 * j / (n - 1)
+            s1.append((x, y, -1))
+            s1.append((x, y, 1))
+    return s1.each_normalize()
+
+
+def test_kapton_2019_absorption_correction():
+    tape = KaptonTape_2019(0.04, 0.025, 0.665, 0.55, wavelength_ang=1.3)
+    s1 = _s1_grid()
+    expected = flex.double(tape.abs_correction(s) for s in s1)
+    assert expected.all_ge(1) and not expected.all_eq(1)
+    for nthreads in (1, 3):
+        corrections = tape.abs_correction_flex(s1, nthreads=nthreads)
+        assert list(corrections) == pytest.approx(list(expected))
+    path = get_kapton_path_cpp(tape.faces, s1)
+    assert list(path) == pytest.approx([tape.get_kapton_path_mm(s) for s in s1])
+
+
+def test_fuller_kapton_absorption_correction():
+    tape = KaptonAbsorption(0.02, 0.05, 1.5875, 1.15, wavelength_ang=1.3)
+    s1 = _s1_grid()
+    expected = flex.double(tape.abs_correction(s) for s in s1)
+    assert expected.all_ge(1) and not expected.all_eq(1)
+    for nthreads in (1, 3):
+        corrections = tape.abs_correction_flex(s1, nthreads=nthreads)
+        assert list(corrections) == pytest.approx(list(expected))
+
+
+@pytest.mark.parametrize("algorithm", ["fuller_kapton", "kapton_2019"])
+def test_kapton_spot_absorption_correction(algorithm):
+    from dxtbx.model import Detector
+
+    detector = Detector()
+    panel = detector.add_panel()
+    panel.set_local_frame((1, 0, 0), (0, -1, 0), (-20, 20, -100))
+    panel.set_pixel_size((0.1, 0.1))
+    panel.set_image_size((400, 400))
+
+    if algorithm == "fuller_kapton":
+        tape = KaptonAbsorption(0.02, 0.05, 1.5875, 1.15, wavelength_ang=1.3)
+        offset = 0
+    else:
+        tape = KaptonTape_2019(0.04, 0.025, 0.665, 0.55, wavelength_ang=1.3)
+        offset = 0.5
+
+    foreground = MaskCode.Valid | MaskCode.Foreground
+    shoeboxes = flex.shoebox()
+    for x0, y0 in ((10, 20), (180, 200), (195, 150), (300, 300)):
+        shoebox = Shoebox(0, (x0, x0 + 6, y0, y0 + 5, 0, 1))
+        shoebox.allocate()
+        mask = flex.int(shoebox.mask.accessor(), foreground)
+        mask[0, 0, 0] = MaskCode.Valid
+        shoebox.mask = mask
+        shoeboxes.append(shoebox)
+
+    mean, sigma = tape.abs_correction_spots(detector, shoeboxes, nthreads=2)
+    for i, shoebox in enumerate(shoeboxes):
+        x0, x1, y0, y1 = shoebox.bbox[0:4]
+        px = flex.vec2_double(
+            [
+                (x + offset, y + offset)
+                for y in range(y0, y1)
+                for x in range(x0, x1)
+                if (x, y) != (x0, y0)
+            ]
+        )
+        s1 = panel.get_lab_coord(panel.pixel_to_millimeter(px)).each_normalize()
+        corrections = tape.abs_correction_flex(s1)
+        mv = flex.mean_and_variance(corrections)
+        assert mean[i] == pytest.approx(mv.mean())
+        assert sigma[i] == pytest.approx(mv.unweighted_sample_standard_deviation())
 
 
 def test_kapton(run_in_tmpdir):
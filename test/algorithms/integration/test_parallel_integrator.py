@@ -431,3 +431,40 @@ def check_job(index):
     check_job(2)
     check_job(3)
     check_job(4)
+
+
+def test_required_memory_for_reflection_regions(data):
+    from dials.algorithms.integration.parallel_integrator import MultiThreadedIntegrator
+
+    imageset = data.experiments[0].imageset
+    full = MultiThreadedIntegrator.compute_required_memory(imageset, 10)
+    sparse = MultiThreadedIntegrator.compute_required_memory(
+        imageset, 10, data.reflections
+    )
+    assert 0 < sparse <= full
+
+    # Only the region covered by the bounding boxes is needed
+    x0, x1, y0, y1, _, _ = data.reflections["bbox"].parts()
+    xsize, ysize = imageset.get_detector()[0].get_image_size()
+    width = min(flex.max(x1), xsize) - max(flex.min(x0), 0)
+    height = min(flex.max(y1), ysize) - max(flex.min(y0), 0)
+    assert sparse <= 10 * width * height * 4
+
+
+def test_shared_buffer_name():
+    from dials.algorithms.integration.parallel_integrator import shared_buffer_name
+
+    class ImageSet(object):
+        def __init__(self, paths):
+            self._paths = paths
+
+        def paths(self):
+            return self._paths
+
+    # Only the same images share a buffer
+    a = ImageSet(["a_0001.cbf", "a_0002.cbf"])
+    b = ImageSet(["b_0001.cbf", "b_0002.cbf"])
+    assert shared_buffer_name("dials", a) == shared_buffer_name("dials", a)
+    assert shared_buffer_name("dials", a) != shared_buffer_name("dials", b)
+    assert shared_buffer_name("dials", a).startswith("dials_")
+    assert shared_buffer_name(None, a) == ""
@@ -0,0 +1,130 @@
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <dials/algorithms/integration/shared_image_buffer.h>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+
+using dials::algorithms::SharedImageBuffer;
+
+typedef SharedImageBuffer<float> buffer_type;
+
+/**
+ * The name of the buffer, made from the id of the parent process so that the
+ * child processes use the same name
+ */
+std::string buffer_name() {
+  static std::string name;
+  if (name.empty()) {
+    std::ostringstream result;
+    result << "dials_tst_shared_image_buffer_" << getpid();
+    name = result.str();
+  }
+  return name;
+}
+
+std::vector<std::size_t> panel_size() {
+  std::vector<std::size_t> result;
+  result.push_back(2);
+  result.push_back(3);
+  return result;
+}
+
+/**
+ * Run a function in a child process and check that it succeeded
+ */
+template <typename Function>
+void run_in_child(Function function) {
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    bool ok = false;
+    try {
+      ok = function();
+    } catch (...) {
+    }
+    _exit(ok ? 0 : 1);
+  }
+  int status = 0;
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/**
+ * Load the first image in another process
+ */
+bool load_image() {
+  buffer_type buffer(buffer_name(), 0, 2, panel_size());
+  if (!buffer.acquire(0)) {
+    return false;
+  }
+  for (std::size_t i = 0; i < 6; ++i) {
+    buffer.data(0)[i] = 7;
+  }
+  buffer.release(0);
+  return true;
+}
+
+/**
+ * Start loading the second image and die without finishing
+ */
+bool die_while_loading() {
+  buffer_type *buffer = new buffer_type(buffer_name(), 0, 2, panel_size());
+  if (!buffer->acquire(1)) {
+    return false;
+  }
+  _exit(0);
+  return true;
+}
+
+void tst_image_loaded_by_other_process() {
+  buffer_type buffer(buffer_name(), 0, 2, panel_size());
+  run_in_child(load_image);
+
+  // The image has been loaded by the other process
+  assert(buffer.is_ready(0));
+  assert(!buffer.acquire(0));
+  for (std::size_t i = 0; i < 6; ++i) {
+    assert(buffer.data(0)[i] == 7);
+  }
+
+  // Test passed
+  std::cout << "OK" << std::endl;
+}
+
+void tst_process_died_while_loading() {
+  buffer_type buffer(buffer_name(), 0, 2, panel_size());
+  run_in_child(die_while_loading);
+
+  // The image was left as loading by a process which has died, so it is
+  // acquired by this process rather than waiting forever
+  assert(!buffer.is_ready(1));
+  assert(buffer.acquire(1));
+  buffer.release(1);
+  assert(buffer.is_ready(1));
+
+  // The process which died is still counted as a user of the segment
+  buffer_type::remove(buffer_name(), 0, 2);
+
+  // Test passed
+  std::cout << "OK" << std::endl;
+}
+
+int main(int argc, char const *argv[]) {
+  buffer_name();
+  tst_image_loaded_by_other_process();
+  tst_process_died_while_loading();
+
+  return 0;
+}
+
+#else
+
+int main(int argc, char const *argv[]) {
+  return 0;
+}
+
+#endif
@@ -3,6 +3,8 @@
 import math
 import random
 
+import pytest
+
 from scitbx.array_family import flex
 
 from dials.algorithms.polygon import clip
@@ -214,6 +216,56 @@ def test_QuadWithConvexQuad_non_intersecting():
         assert len(result) == 0
 
 
+def signed_area(poly):
+    return 0.5 * sum(
+        x0 * y1 - x1 * y0
+        for (x0, y0), (x1, y1) in zip(poly, list(poly[1:]) + list(poly[:1]))
+    )
+
+
+def test_QuadWithRect():
+    for i in range(10000):
+
+        # Generate intersecting polygons
+        subject, target = generate_intersecting(4, 4)
+        x0, y0 = random.uniform(-5, 5), random.uniform(-5, 5)
+        x1, y1 = x0 + random.uniform(0.1, 5), y0 + random.uniform(0.1, 5)
+        rect = ((x0, y0), (x1, y1))
+        target = ((x0, y0), (x1, y0), (x1, y1), (x0, y1))
+
+        # Do the clipping with the rect and general clipper
+        result = clip.quad_with_rect(subject, rect)
+        expected = clip.quad_with_convex_quad(subject, target)
+
+        # Ensure the intersections have the same area
+        area = clip.quad_with_rect_area(subject, rect)
+        assert area == pytest.approx(signed_area(expected), abs=1e-7)
+        if len(result) > 0:
+            assert signed_area(result) == pytest.approx(area)
+        else:
+            assert area == 0
+
+
+def test_QuadWithGridArea():
+    for i in range(1000):
+
+        # Generate a polygon within a grid
+        subject, target = generate_intersecting(4, 4)
+        subject = [(x + 5, y + 5) for x, y in subject]
+
+        # Get the areas of intersection with each grid square
+        areas = clip.quad_with_grid_area(subject, 0, 10, 2, 8)
+        assert areas.all() == (6, 10)
+        for j, i in [(0, 0), (3, 5), (5, 9)]:
+            rect = ((i, j + 2), (i + 1, j + 3))
+            assert areas[j, i] == pytest.approx(clip.quad_with_rect_area(subject, rect))
+
+        # Ensure that the areas sum to the area of the part of the polygon
+        # within the rows of the grid
+        expected = clip.quad_with_rect_area(subject, ((0, 2), (10, 8)))
+        assert flex.sum(areas) == pytest.approx(expected)
+
+
 class TestLineWithRect(object):
     def test(self):
         self.box = ((-10, -10), (10, 10))
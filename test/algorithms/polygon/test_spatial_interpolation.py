@@ -2,7 +2,11 @@
 
 import random
 
+import pytest
+
 from dials.algorithms.polygon.spatial_interpolation import (
+    grid_to_irregular_grid_matrix,
+    irregular_grid_to_grid_matrix,
     regrid_grid_to_irregular_grid,
     regrid_irregular_grid_to_grid,
 )
@@ -423,3 +427,45 @@ def test_conservation_of_counts():
         # Check that the sum of the counts is conserved
         eps = 1e-7
         assert abs(flex.sum(output) - flex.sum(grid)) <= eps
+
+
+def test_regrid_matrix():
+    from math import cos, pi, sin
+
+    from scitbx import matrix
+    from scitbx.array_family import flex
+
+    # Set the size of the grid
+    height = 20
+    width = 30
+
+    # Create the distorted grid coordinates
+    xy = []
+    angle = random.uniform(0, pi / 8)
+    R = matrix.sqr((cos(angle), -sin(angle), sin(angle), cos(angle)))
+    for j in range(height + 1):
+        for i in range(width + 1):
+            ij = R * matrix.col((i * 1.1, j * 0.9))
+            xy.append((ij[0] + random.uniform(-0.1, 0.1), ij[1] + 3))
+    gridxy = flex.vec2_double(xy)
+    gridxy.reshape(flex.grid(height + 1, width + 1))
+
+    # Compute the matrices once
+    to_grid = irregular_grid_to_grid_matrix(gridxy, (height, width), nthreads=2)
+    from_grid = grid_to_irregular_grid_matrix(gridxy, (height, width), nthreads=2)
+    assert len(to_grid) > 0
+    assert len(from_grid) > 0
+
+    # Check that applying the matrices to several images gives the same
+    # result as regridding each one
+    for k in range(3):
+        grid = flex.double([random.uniform(0, 100) for i in range(height * width)])
+        grid.reshape(flex.grid(height, width))
+        expected = regrid_irregular_grid_to_grid(grid, gridxy, (height, width))
+        output = to_grid.apply(grid, nthreads=2)
+        assert output.all() == expected.all()
+        assert list(output) == pytest.approx(list(expected))
+        expected = regrid_grid_to_irregular_grid(grid, gridxy)
+        output = from_grid.apply(grid)
+        assert output.all() == expected.all()
+        assert list(output) == pytest.approx(list(expected))
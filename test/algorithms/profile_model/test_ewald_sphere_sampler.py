@@ -36,6 +36,23 @@ def test_run(dials_data):
     assert sorted(sampler.nearest_n(26)) == sorted([9, 26, 27, 25])
     assert sorted(sampler.nearest_n(56)) == sorted([24, 56, 25, 55])
 
+    # The combined and batch lookups agree with the single point lookups
+    from dials.array_family import flex
+
+    width, height = detector[0].get_image_size()
+    xyz = flex.vec3_double()
+    for j in range(0, height, 50):
+        for i in range(0, width, 50):
+            xyz.append((i, j, scan.get_array_range()[0] + 0.5))
+    panel = flex.size_t(len(xyz), 0)
+    nearest = sampler.nearest_batch(panel, xyz)
+    for k in range(len(xyz)):
+        assert nearest[k] == sampler.nearest(0, xyz[k])
+        indices, weights = sampler.nearest_n_weights(0, xyz[k])
+        assert list(indices) == list(sampler.nearest_n(nearest[k]))
+        for index, weight in zip(indices, weights):
+            assert weight == sampler.weight(index, 0, xyz[k])
+
     # from scitbx import matrix
     # from math import cos, sin
     # s0 = matrix.col(beam.get_s0()).normalize()
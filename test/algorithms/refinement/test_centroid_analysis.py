@@ -0,0 +1,64 @@
+from __future__ import absolute_import, division, print_function
+
+import math
+
+import pytest
+
+from dials.algorithms.refinement.analysis.centroid_analysis import CentroidAnalyser
+from dials.array_family import flex
+from dials_refinement_helpers_ext import PhiBlocks
+
+
+def test_phi_blocks():
+    flex.set_random_seed(0)
+    phi = flex.random_double(1000) * 10
+    phi_start, phi_end = flex.min(phi), flex.max(phi)
+    nblocks = 7
+    block_size = (phi_end - phi_start) / nblocks
+    blocks = PhiBlocks(phi, phi_start, block_size, nblocks)
+
+    permutation = blocks.permutation()
+    assert sorted(permutation) == list(range(len(phi)))
+    assert flex.sum(blocks.count()) == len(phi)
+    end = 0
+    for i, count in enumerate(blocks.count()):
+        start, end = end, end + count
+        sel = phi >= phi_start + i * block_size
+        if i < nblocks - 1:
+            sel &= phi < phi_start + (i + 1) * block_size
+        assert list(permutation[start:end]) == list(sel.iselection())
+        assert blocks.block().select(permutation[start:end]).all_eq(i)
+
+
+def test_centroid_analyser_average_residuals():
+    flex.set_random_seed(0)
+    n = 5000
+    phi = flex.random_double(n) * math.radians(20)
+    reflections = flex.reflection_table()
+    reflections["miller_index"] = flex.miller_index(n, (1, 2, 3))
+    reflections["id"] = flex.int(n, 0)
+    reflections["xyzobs.mm.value"] = flex.vec3_double(
+        flex.random_double(n), flex.random_double(n), phi
+    )
+    reflections["xyzcal.mm"] = reflections["xyzobs.mm.value"] + flex.vec3_double(
+        flex.random_double(n) + 1, flex.random_double(n), flex.double(n, 0.001)
+    )
+
+    results = CentroidAnalyser(reflections)()[0]
+    nblocks = results["nblocks"]
+    block_size = results["block_size"]
+    phi_start = results["phi_range"][0]
+    assert nblocks > 5
+    assert len(results["av_x_resid_per_block"]) == nblocks
+
+    x_obs = reflections["xyzobs.mm.value"].parts()[0]
+    x_resid = reflections["xyzcal.mm"].parts()[0] - x_obs
+    phi_deg = phi * (180.0 / math.pi)
+    for i in range(1, nblocks - 1):
+        sel = (phi_deg >= phi_start + i * block_size) & (
+            phi_deg < phi_start + (i + 1) * block_size
+        )
+        assert results["nref_per_block"][i] == sel.count(True)
+        assert results["av_x_resid_per_block"][i] == pytest.approx(
+            flex.mean(x_resid.select(sel))
+        )
@@ -39,3 +39,31 @@ def test_centroid_outlier(dials_regression, method, colnames, expected_nout):
     outliers = residuals.get_flags(residuals.flags.centroid_outlier)
 
     assert outliers.count(True) == expected_nout
+
+
+def test_centroid_outlier_ignores_other_columns():
+    flex.set_random_seed(42)
+    n = 200
+    residuals = flex.reflection_table()
+    residuals["id"] = flex.int(n, 0)
+    residuals["panel"] = flex.size_t(n, 0)
+    residuals["x_resid"] = flex.random_double(n) - 0.5
+    residuals["y_resid"] = flex.random_double(n) - 0.5
+    residuals["phi_resid"] = flex.random_double(n) - 0.5
+    residuals["x_resid"][10] = 50
+    residuals["y_resid"][20] = -50
+    residuals.set_flags(flex.bool(n, True), residuals.flags.predicted)
+
+    # A column which is not used for outlier detection
+    residuals["background.mean"] = flex.double(n, 1)
+
+    params = phil_scope.extract()
+    params.outlier.algorithm = "tukey"
+    params.outlier.separate_panels = True
+    outlier_detector = CentroidOutlierFactory.from_parameters_and_colnames(
+        params, ("x_resid", "y_resid", "phi_resid")
+    )
+    assert outlier_detector(residuals)
+    outliers = residuals.get_flags(residuals.flags.centroid_outlier)
+    assert outliers[10] and outliers[20]
+    assert "background.mean" in residuals and len(residuals) == n
@@ -138,3 +138,74 @@ def random_direction_close_to(vector):
                 an=xl_uc_an_ds_dp[j],
                 diff=xl_uc_fd_ds_dp[j] - xl_uc_an_ds_dp[j],
             )
+
+
+def _random_crystals(n, space_group_symbol="P 1"):
+    import random
+
+    crystals = []
+    for _ in range(n):
+        a = random.uniform(10, 50)
+        b = a if space_group_symbol == "P 4" else random.uniform(10, 50)
+        c = random.uniform(10, 50)
+        xl = Crystal(
+            (a, 0, 0), (0, b, 0), (0, 0, c), space_group_symbol=space_group_symbol
+        )
+        axis = matrix.col((random.random(), random.random(), random.random()))
+        xl.set_U(axis.normalize().axis_and_angle_as_r3_rotation_matrix(random.random()))
+        crystals.append(xl)
+    return crystals
+
+
+def test_compose_all_crystal_orientations():
+    import copy
+    import random
+
+    from libtbx.test_utils import approx_equal
+
+    crystals = _random_crystals(5)
+    single = [CrystalOrientationParameterisation(xl) for xl in crystals]
+    batched = [
+        CrystalOrientationParameterisation(copy.deepcopy(xl)) for xl in crystals
+    ]
+    for p1, p2 in zip(single, batched):
+        vals = [random.uniform(-10, 10) for _ in range(3)]
+        p1.set_param_vals(vals)
+        p2.set_param_vals(vals, compose=False)
+
+    CrystalOrientationParameterisation.compose_all(batched, nthreads=2)
+
+    for p1, p2 in zip(single, batched):
+        assert approx_equal(p1.get_state().elems, p2.get_state().elems)
+        for d1, d2 in zip(p1.get_ds_dp(), p2.get_ds_dp()):
+            assert approx_equal(d1.elems, d2.elems)
+
+
+def test_calculate_multi_cell_gradients():
+    from libtbx.test_utils import approx_equal
+    from scitbx.array_family import flex
+
+    from dials_refinement_helpers_ext import (
+        CalculateCellGradients,
+        CalculateMultiCellGradients,
+    )
+
+    # mix space groups so that the crystals have different numbers of parameters
+    crystals = _random_crystals(3) + _random_crystals(3, space_group_symbol="P 4")
+    params = [CrystalUnitCellParameterisation(xl) for xl in crystals]
+
+    B = flex.mat3_double()
+    dB_dp = flex.mat3_double()
+    offset = flex.size_t([0])
+    for p in params:
+        B.append(p.get_state().elems)
+        dB_dp.extend(flex.mat3_double(p.get_ds_dp()))
+        offset.append(len(dB_dp))
+    mccg = CalculateMultiCellGradients(B, dB_dp, offset, nthreads=2)
+
+    for i in range(len(params)):
+        ccg = CalculateCellGradients(B[i], dB_dp[offset[i] : offset[i + 1]])
+        for name in ("da_dp", "db_dp", "dc_dp", "daa_dp", "dbb_dp", "dcc_dp"):
+            expected = getattr(ccg, name)()
+            result = getattr(mccg, name)()[offset[i] : offset[i + 1]]
+            assert approx_equal(list(expected), list(result))
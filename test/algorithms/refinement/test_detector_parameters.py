@@ -361,3 +361,63 @@ def test():
                     an=an_ds_dp[k],
                     diff=fd_ds_dp[k] - matrix.sqr(an_ds_dp[k]),
                 )
+
+
+def test_multi_panel_group_compose():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.refinement.refinement_helpers import PanelGroupCompose
+    from dials_refinement_helpers_ext import MultiPanelGroupCompose
+
+    def random_vec():
+        return matrix.col([random.uniform(-1, 1) for _ in range(3)])
+
+    ngroups = 4
+    npanels = [3, 1, 5, 2]
+    states = []
+    param_vals = flex.double()
+    param_axes = flex.vec3_double()
+    group_offset = flex.size_t([0])
+    offsets = flex.vec3_double()
+    dir1s = flex.vec3_double()
+    dir2s = flex.vec3_double()
+    for igp in range(ngroups):
+        d1 = random_vec().normalize()
+        dn = d1.cross(random_vec()).normalize()
+        d2 = dn.cross(d1)
+        states.append((d1, d2, dn, 100 * random_vec()))
+        param_vals.extend(flex.double([random.uniform(-10, 10) for _ in range(6)]))
+        param_axes.extend(flex.vec3_double([dn, d1, d2, dn, d1, d2]))
+        group_offset.append(group_offset[-1] + npanels[igp])
+        for _ in range(npanels[igp]):
+            offsets.append(100 * random_vec())
+            dir1s.append(random_vec().normalize())
+            dir2s.append(random_vec().normalize())
+
+    args = [flex.vec3_double([s[i] for s in states]) for i in range(4)]
+    args.extend([param_vals, param_axes, group_offset, offsets, dir1s, dir2s])
+    mpgc = MultiPanelGroupCompose(*args)
+    derivatives = mpgc.derivatives()
+    assert len(derivatives) == 6 * len(offsets)
+
+    # the results must match composing each group separately
+    for igp in range(ngroups):
+        pgc = PanelGroupCompose(
+            states[igp][0],
+            states[igp][1],
+            states[igp][2],
+            states[igp][3],
+            param_vals[6 * igp : 6 * igp + 6],
+            param_axes[6 * igp : 6 * igp + 6],
+        )
+        assert approx_equal(pgc.d1().elems, mpgc.d1()[igp])
+        assert approx_equal(pgc.d2().elems, mpgc.d2()[igp])
+        assert approx_equal(pgc.origin().elems, mpgc.origin()[igp])
+        for j in range(group_offset[igp], group_offset[igp + 1]):
+            expected = pgc.derivatives_for_panel(offsets[j], dir1s[j], dir2s[j])
+            for k in range(6):
+                assert approx_equal(expected[k].elems, derivatives[6 * j + k])
+
+    # the derivatives do not depend on the number of threads
+    threaded = MultiPanelGroupCompose(*args, nthreads=3).derivatives()
+    assert list(threaded) == list(derivatives)
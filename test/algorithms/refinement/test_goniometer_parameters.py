@@ -71,3 +71,34 @@ def test():
                 print("so that difference fd_ds_dp - an_ds_dp =")
                 print(fd_ds_dp[j] - an_ds_dp[j])
                 raise
+
+
+def test_rotation_matrices_from_axes_and_angles():
+    from dials_refinement_helpers_ext import (
+        R_and_dR_from_axes_and_angles,
+        R_from_axes_and_angles,
+        dR_from_axes_and_angles,
+    )
+
+    from dials.algorithms.refinement.refinement_helpers import dR_from_axis_and_angle
+
+    n = 20
+    axes = flex.vec3_double([flex.random_double_point_on_sphere() for i in range(n)])
+    axes *= flex.random_double(n) + 0.5
+    angles = (flex.random_double(n) - 0.5) * 4 * math.pi
+
+    R = R_from_axes_and_angles(axes, angles)
+    dR = dR_from_axes_and_angles(axes, angles)
+    R2, dR2 = R_and_dR_from_axes_and_angles(axes, angles)
+    for i in range(n):
+        axis = matrix.col(axes[i])
+        R_ref = axis.axis_and_angle_as_r3_rotation_matrix(angles[i])
+        dR_ref = dR_from_axis_and_angle(axis, angles[i])
+        assert approx_equal(R[i], R_ref.elems)
+        assert approx_equal(dR[i], dR_ref.elems)
+        assert R2[i] == R[i]
+        assert dR2[i] == dR[i]
+
+    deg = angles * 180.0 / math.pi
+    assert approx_equal(R_from_axes_and_angles(axes, deg, deg=True), R)
+    assert approx_equal(dR_from_axes_and_angles(axes, deg, deg=True), dR)
@@ -189,3 +189,10 @@ def test():
 
     # return to the initial state
     pred_param.set_param_vals(p_vals)
+
+    # the gradients calculated with several threads are identical
+    pred_param.set_nthreads(4)
+    threaded_grads = pred_param.get_gradients(reflections)
+    for grads, threaded in zip(an_grads, threaded_grads):
+        for key in ("dX_dp", "dY_dp", "dphi_dp"):
+            assert list(threaded[key]) == list(grads[key])
@@ -6,7 +6,10 @@
 
 from dxtbx.model.experiment_list import ExperimentListFactory
 
-from dials.algorithms.refinement.reflection_manager import ReflectionManager
+from dials.algorithms.refinement.reflection_manager import (
+    ReflectionManager,
+    _indices_by_experiment,
+)
 from dials.array_family import flex
 
 
@@ -46,3 +49,19 @@ def test_scan_margin(dials_data):
     # Check 1 degree scan margin trims approximately 1 degree
     assert min(phi2) == pytest.approx(min(phi1) + math.radians(margin), abs=1e-3)
     assert max(phi2) == pytest.approx(max(phi1) - math.radians(margin), abs=1e-3)
+
+
+def test_indices_by_experiment():
+
+    ids = flex.int([2, 0, 1, 0, 2, 2])
+    index_list = _indices_by_experiment(ids, 4)
+    assert len(index_list) == 4
+    for iexp, isel in enumerate(index_list):
+        assert list(isel) == list((ids == iexp).iselection())
+
+    # ids outside the range of experiments fall back to selections
+    ids = flex.int([-1, 0, 1, 0])
+    index_list = _indices_by_experiment(ids, 2)
+    assert [list(isel) for isel in index_list] == [[1, 3], [2]]
+
+    assert [len(isel) for isel in _indices_by_experiment(flex.int(), 2)] == [0, 0]
@@ -0,0 +1,41 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+from scitbx import sparse
+
+from dials_refinement_helpers_ext import build_sparse_jacobian
+
+
+def random_gradients(nref, nparam):
+    grads = []
+    for _ in range(nparam):
+        col = sparse.matrix_column(nref)
+        for i in random.sample(range(nref), nref // 4):
+            col[i] = random.uniform(-1, 1)
+        grads.append(col)
+    return grads
+
+
+def test_build_sparse_jacobian():
+    random.seed(0)
+    nref, nparam = 200, 12
+    grads_each_dim = [random_gradients(nref, nparam) for _ in range(3)]
+
+    # the Jacobian assembled block by block
+    blocks = [sparse.matrix(nref, nparam) for _ in grads_each_dim]
+    for i in range(nparam):
+        for block, grad in zip(blocks, grads_each_dim):
+            block[:, i] = grad[i]
+    expected = sparse.matrix(3 * nref, nparam)
+    for i, block in enumerate(blocks):
+        expected.assign_block(block, i * nref, 0)
+
+    for nthreads in (1, 4):
+        jacobian = build_sparse_jacobian(
+            grads_each_dim, nref=nref, nparam=nparam, nthreads=nthreads
+        )
+        assert jacobian.n_rows == 3 * nref
+        assert jacobian.n_cols == nparam
+        dense = jacobian.as_dense_matrix()
+        assert (dense == expected.as_dense_matrix()).all_eq(True)
@@ -303,6 +303,28 @@ def test_stills_pred_param(tc):
                 assert abs(tst_val) < 6, "should be < 6, not %s" % tst_val
 
 
+def test_stills_pred_param_threaded(tc):
+    # Build a prediction parameterisation for the stills experiment
+    pred_param = StillsPredictionParameterisation(
+        tc.stills_experiments,
+        detector_parameterisations=[tc.det_param],
+        beam_parameterisations=[tc.s0_param],
+        xl_orientation_parameterisations=[tc.xlo_param],
+        xl_unit_cell_parameterisations=[tc.xluc_param],
+    )
+    ref_predictor = StillsExperimentsPredictor(tc.stills_experiments)
+    ref_predictor(tc.reflections)
+
+    serial_grads = pred_param.get_gradients(tc.reflections)
+    pred_param.set_nthreads(3)
+    threaded_grads = pred_param.get_gradients(tc.reflections)
+
+    # the gradients do not depend on the number of threads
+    for serial, threaded in zip(serial_grads, threaded_grads):
+        for name in ["dX_dp", "dY_dp", "dDeltaPsi_dp"]:
+            assert list(serial[name]) == list(threaded[name])
+
+
 # In comparison with FD approximations, the worst gradients by far are dX/dp
 # and dY/dp for parameter Crystal0g_param_3. Is this to do with the geometry
 # of the test case?
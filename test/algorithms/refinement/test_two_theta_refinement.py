@@ -156,6 +156,13 @@ def test_fd_derivatives():
     # Get analytical gradients
     an_grads = pred_param.get_gradients(reflections)
 
+    # The gradients do not depend on the number of threads
+    pred_param.set_nthreads(3)
+    threaded_grads = pred_param.get_gradients(reflections)
+    pred_param.set_nthreads(1)
+    for an_grad, threaded_grad in zip(an_grads, threaded_grads):
+        assert list(threaded_grad["d2theta_dp"]) == list(an_grad["d2theta_dp"])
+
     # Get finite difference gradients
     p_vals = pred_param.get_param_vals()
     deltas = [1.0e-7] * len(p_vals)
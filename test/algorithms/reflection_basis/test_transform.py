@@ -70,6 +70,8 @@ def test_forward(dials_data):
         beam, detector, gonio, scan, sigma_divergence, mosaicity, n_sigma + 1, grid_size
     )
 
+    assert spec.cache_nbytes() > 0
+
     # tst_conservation_of_counts(self):
 
     assert len(detector) == 1
@@ -179,3 +179,76 @@ def test_radius(setup):
             if bbox[2] > 0 and bbox[3] < height:
                 assert math.sqrt(e11 ** 2 + e21 ** 2) >= radius12
                 assert math.sqrt(e12 ** 2 + e22 ** 2) >= radius12
+
+
+def test_parallel_array(setup):
+    from dials.array_family import flex
+
+    s0_length = matrix.col(setup["beam"].get_s0()).length()
+    random.seed(0)
+    s1 = flex.vec3_double()
+    frame = flex.double()
+    for i in range(5000):
+        x = random.uniform(0, 2000)
+        y = random.uniform(0, 2000)
+        s1.append(
+            matrix.col(setup["detector"][0].get_pixel_lab_coord((x, y))).normalize()
+            * s0_length
+        )
+        frame.append(random.uniform(0, 9))
+    panel = flex.size_t(len(s1), 0)
+
+    expected = setup["calculate_bbox"](s1, frame, panel)
+    for nthreads in (1, 2, 4):
+        bbox = setup["calculate_bbox"](s1, frame, panel, nthreads)
+        assert list(bbox) == list(expected)
+
+
+def test_coordinate_systems(setup):
+    from dials.algorithms.profile_model.gaussian_rs import PartialityCalculator3D
+    from dials.array_family import flex
+
+    s0 = setup["beam"].get_s0()
+    m2 = setup["gonio"].get_rotation_axis()
+    s0_length = matrix.col(s0).length()
+    random.seed(0)
+    s1 = flex.vec3_double()
+    frame = flex.double()
+    for i in range(2000):
+        x = random.uniform(0, 2000)
+        y = random.uniform(0, 2000)
+        s1.append(
+            matrix.col(setup["detector"][0].get_pixel_lab_coord((x, y))).normalize()
+            * s0_length
+        )
+        frame.append(random.uniform(0, 9))
+    panel = flex.size_t(len(s1), 0)
+
+    calculate_bbox = setup["calculate_bbox"]
+    cs = calculate_bbox.coordinate_systems(s1, frame)
+    assert len(cs) == len(s1)
+    for i in (0, 1000, len(s1) - 1):
+        phi = setup["scan"].get_angle_from_array_index(frame[i], deg=False)
+        xcs = CoordinateSystem(m2, s0, s1[i], phi)
+        assert cs.phi()[i] == pytest.approx(phi)
+        assert cs.e1_axis()[i] == xcs.e1_axis()
+        assert cs.e2_axis()[i] == xcs.e2_axis()
+        assert cs.e3_axis()[i] == xcs.e3_axis()
+        assert cs.p_star()[i] == xcs.p_star()
+        assert cs.zeta()[i] == xcs.zeta()
+        assert cs[i].zeta() == xcs.zeta()
+
+    # The axes computed by several threads are the same
+    for nthreads in (2, 4):
+        other = calculate_bbox.coordinate_systems(s1, frame, nthreads)
+        assert list(other.e2_axis()) == list(cs.e2_axis())
+        assert list(other.zeta()) == list(cs.zeta())
+
+    # The table gives the same bounding boxes and partialities
+    bbox = calculate_bbox.from_coordinate_systems(cs, frame, panel)
+    assert list(bbox) == list(calculate_bbox(s1, frame, panel))
+    calculate_partiality = PartialityCalculator3D(
+        setup["beam"], setup["gonio"], setup["scan"], setup["delta_mosaicity"] / 5
+    )
+    partiality = calculate_partiality.from_coordinate_systems(cs, frame, bbox)
+    assert list(partiality) == list(calculate_partiality(s1, frame, bbox))
@@ -70,6 +70,45 @@ def test_multiple_panels():
         assert edge in edges
 
 
+def test_overlap_index():
+    from dials.algorithms.shoebox import OverlapIndex
+    from dials.array_family import flex
+
+    nrefl = 1000
+
+    # Generate bboxes
+    bbox = flex.int6(nrefl)
+    panel = flex.size_t(nrefl)
+    for i in range(nrefl):
+        x0 = random.randint(0, 500)
+        y0 = random.randint(0, 500)
+        z0 = random.randint(0, 10)
+        x1 = x0 + random.randint(2, 40)
+        y1 = y0 + random.randint(2, 10)
+        z1 = z0 + random.randint(2, 10)
+        bbox[i] = (x0, x1, y0, y1, z0, z1)
+        panel[i] = random.randint(0, 2)
+
+    # Check the overlaps of each reflection against the brute force result
+    index = OverlapIndex(bbox, panel)
+    assert len(index) == nrefl
+    expected = [[] for i in range(nrefl)]
+    for i, j in brute_force(bbox, panel):
+        expected[i].append(j)
+        expected[j].append(i)
+    for i in range(nrefl):
+        assert list(index.find(i)) == sorted(expected[i])
+
+    # The adjacency list has each overlap once
+    overlaps = index.adjacency_list()
+    assert overlaps.num_vertices() == nrefl
+    assert overlaps.num_edges() == sum(len(e) for e in expected) // 2
+    for i in range(nrefl):
+        assert list(overlaps.adjacent_vertices(i)) == sorted(expected[i])
+    edges = [(overlaps.source(e), overlaps.target(e)) for e in overlaps.edges()]
+    assert edges == sorted((i, j) for i in range(nrefl) for j in expected[i])
+
+
 def brute_force(bbox, panel=None):
     overlaps = []
     if panel is None:
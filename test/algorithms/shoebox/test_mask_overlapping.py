@@ -94,6 +94,13 @@ def test(dials_data):
     tst_non_overlapping(reflections, non_overlapping, detector[0].get_image_size())
     tst_overlapping(reflections, overlapping, adjacency_list, image_size)
 
+    # Masking in parallel gives the same masks
+    parallel = flex.shoebox(reflections["panel"], reflections["bbox"])
+    parallel.allocate_with_value(shoebox.MaskCode.Valid)
+    shoebox_masker(parallel, coords, adjacency_list, nthreads=3)
+    for a, b in zip(shoeboxes, parallel):
+        assert a.mask.all_eq(b.mask)
+
 
 def tst_non_overlapping(reflections, non_overlapping, image_size):
     """Ensure non-overlapping reflections have all their values 1."""
@@ -0,0 +1,42 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+
+def test_overload_bitmap():
+    from dials.algorithms.shoebox import OverloadBitmap
+    from dials.array_family import flex
+
+    height, width = 40, 150
+    overload = 1000
+    data = flex.double(
+        [
+            overload + 1 if random.random() < 0.02 else random.uniform(0, 100)
+            for i in range(height * width)
+        ]
+    )
+    data.reshape(flex.grid(height, width))
+
+    bitmap = OverloadBitmap(data, overload)
+    assert bitmap.ysize() == height
+    assert bitmap.xsize() == width
+    assert bitmap.num_overloaded() == (data >= overload).count(True)
+
+    # Compare the counts in random rectangles with a brute force count,
+    # including rectangles which extend past the image
+    for i in range(200):
+        x0 = random.randint(-10, width)
+        y0 = random.randint(-10, height)
+        x1 = x0 + random.randint(0, 100)
+        y1 = y0 + random.randint(0, 20)
+        expected = 0
+        for y in range(max(y0, 0), min(y1, height)):
+            for x in range(max(x0, 0), min(x1, width)):
+                if data[y, x] >= overload:
+                    expected += 1
+        assert bitmap.count(x0, x1, y0, y1) == expected
+
+    # Refill the bitmap from an image with no overloads
+    bitmap.set(flex.double(flex.grid(height, width), 0), overload)
+    assert bitmap.num_overloaded() == 0
+    assert bitmap.count(0, width, 0, height) == 0
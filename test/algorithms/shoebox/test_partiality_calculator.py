@@ -68,3 +68,15 @@ def test(dials_data):
     # Should have all partials
     assert len(partiality) == len(predicted)
     assert partiality.all_le(1.0) and partiality.all_gt(0)
+
+    # Computing in blocks on several threads gives the same partialities
+    s1 = flex.vec3_double()
+    frame = flex.double()
+    bbox = flex.int6()
+    for i in range(1 + 3000 // len(predicted)):
+        s1.extend(predicted["s1"])
+        frame.extend(predicted["xyzcal.px"].parts()[2])
+        bbox.extend(predicted["bbox"])
+    expected = calculator(s1, frame, bbox)
+    assert list(calculator(s1, frame, bbox, 3)) == list(expected)
+    assert list(expected[: len(partiality)]) == list(partiality)
@@ -0,0 +1,44 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+
+def test_run_length_mask():
+    from dials.algorithms.shoebox import RunLengthMask
+    from dials.array_family import flex
+
+    height, width = 40, 150
+    mask = flex.bool([random.random() > 0.05 for i in range(height * width)])
+    mask.reshape(flex.grid(height, width))
+
+    # Add a large masked region like a goniometer shadow
+    for y in range(10, 30):
+        for x in range(20, 120):
+            mask[y, x] = False
+
+    runs = RunLengthMask(mask)
+    assert runs.ysize() == height
+    assert runs.xsize() == width
+    assert runs.num_masked() == mask.count(False)
+    assert runs.num_runs() < runs.num_masked()
+    assert runs.expand().all_eq(mask)
+    assert runs == RunLengthMask(mask)
+
+    # Compare random rectangles with the mask, including rectangles which
+    # extend past the image where the expanded mask is false
+    for i in range(200):
+        x0 = random.randint(-10, width)
+        y0 = random.randint(-10, height)
+        x1 = x0 + random.randint(0, 100)
+        y1 = y0 + random.randint(0, 20)
+        region = runs.expand(x0, x1, y0, y1)
+        assert region.all() == (y1 - y0, x1 - x0)
+        for y in range(y0, y1):
+            for x in range(x0, x1):
+                expected = 0 <= x < width and 0 <= y < height and mask[y, x]
+                assert region[y - y0, x - x0] == expected
+
+    # A mask with nothing masked has no runs
+    runs = RunLengthMask(flex.bool(flex.grid(height, width), True))
+    assert runs.num_runs() == 0
+    assert runs != RunLengthMask(mask)
@@ -1,9 +1,11 @@
 #include <cassert>
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <sstream>
 #include <deque>
 #include <dials/algorithms/spatial_indexing/detect_collisions.h>
+#include <dials/algorithms/spatial_indexing/detect_collisions_parallel.h>
 
 struct Box {
   int x0, y0, x1, y1;
@@ -189,9 +191,49 @@ void tst_detect_3d() {
   std::cout << "OK" << std::endl;
 }
 
+std::vector<std::pair<int, int> > sorted_pairs(
+  const std::vector<std::pair<int, int> > &collisions) {
+  std::vector<std::pair<int, int> > result;
+  for (std::size_t i = 0; i < collisions.size(); ++i) {
+    int a = collisions[i].first;
+    int b = collisions[i].second;
+    result.push_back(std::pair<int, int>(std::min(a, b), std::max(a, b)));
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+void tst_detect_3d_parallel() {
+  std::size_t num = 10000;
+  std::vector<Box3d> data(num);
+  std::vector<std::pair<int, int> > collisions1;
+
+  Box3d bounds(0, 0, 0, 512, 512, 512);
+
+  // Create a load of random boxes
+  for (std::size_t i = 0; i < num; ++i) {
+    data[i] = random_box3d(bounds, 3, 8);
+  }
+
+  // Do the serial collision check
+  detect_collisions3d(data.begin(), data.end(), collisions1);
+  collisions1 = sorted_pairs(collisions1);
+
+  // Check the same collisions are found with different numbers of threads
+  for (std::size_t num_threads = 1; num_threads <= 8; ++num_threads) {
+    std::vector<std::pair<int, int> > collisions2;
+    detect_collisions3d(data.begin(), data.end(), collisions2, num_threads);
+    assert(sorted_pairs(collisions2) == collisions1);
+  }
+
+  // Test passed
+  std::cout << "OK" << std::endl;
+}
+
 int main(int argc, char const *argv[]) {
   tst_detect_2d();
   tst_detect_3d();
+  tst_detect_3d_parallel();
 
   return 0;
 }
@@ -0,0 +1,65 @@
+from __future__ import absolute_import, division, print_function
+
+import math
+import random
+
+import pytest
+
+from dials.algorithms.spot_finding import SpotGridIndex
+from dials.algorithms.spot_finding.spot_matcher import SpotMatcher
+from dials.array_family import flex
+
+
+def random_spots(n, npanels):
+    xyz = flex.vec3_double(
+        [
+            (random.uniform(0, 100), random.uniform(0, 100), random.uniform(0, 10))
+            for i in range(n)
+        ]
+    )
+    panel = flex.size_t([random.randrange(npanels) for i in range(n)])
+    return xyz, panel
+
+
+def test_spot_grid_index_nearest():
+    spots_xyz, spots_panel = random_spots(2000, 2)
+    points_xyz, points_panel = random_spots(1000, 2)
+    index = SpotGridIndex(spots_xyz, spots_panel, max_separation=2)
+    assert len(index) == 2000
+
+    for nthreads in (1, 3):
+        nearest, distance = index.nearest(points_xyz, points_panel, nthreads=nthreads)
+
+        # Compare with a brute force search
+        for i in range(len(points_xyz)):
+            best, best_d = -1, 2
+            for j in range(len(spots_xyz)):
+                if spots_panel[j] != points_panel[i]:
+                    continue
+                d = math.sqrt(
+                    sum((a - b) ** 2 for a, b in zip(spots_xyz[j], points_xyz[i]))
+                )
+                if d <= best_d and (best < 0 or d < best_d):
+                    best, best_d = j, d
+            assert nearest[i] == best
+            if best >= 0:
+                assert distance[i] == pytest.approx(best_d)
+
+
+def test_spot_matcher_is_one_to_one():
+    spots_xyz, spots_panel = random_spots(500, 1)
+    points_xyz, points_panel = random_spots(2000, 1)
+    predicted = flex.reflection_table()
+    predicted["xyzcal.px"] = spots_xyz
+    predicted["panel"] = spots_panel
+    observed = flex.reflection_table()
+    observed["xyzobs.px.value"] = points_xyz
+    observed["panel"] = points_panel
+
+    oind, pind = SpotMatcher(max_separation=2)(observed, predicted)
+    assert len(oind) == len(pind) > 0
+    assert len(set(oind)) == len(oind)
+    assert len(set(pind)) == len(pind)
+    assert list(oind) == sorted(oind)
+    distance = (points_xyz.select(oind) - spots_xyz.select(pind)).norms()
+    assert flex.max(distance) <= 2
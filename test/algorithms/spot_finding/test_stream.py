@@ -0,0 +1,92 @@
+import json
+import threading
+
+import pytest
+
+from dxtbx.model.experiment_list import ExperimentListFactory
+
+from dials.algorithms.spot_finding.stream import (
+    Frame,
+    FrameAnalyser,
+    FrameBuffer,
+    StreamingSpotFinder,
+    decode_image,
+)
+from dials.array_family import flex
+from dials.command_line.find_spots import phil_scope
+from dials.util.masking import MaskGenerator
+
+
+def test_frame_buffer_drops_oldest():
+    buffer = FrameBuffer(2)
+    for i in range(4):
+        buffer.put(Frame(i, None))
+    assert buffer.dropped == [0, 1]
+    buffer.close()
+    assert [buffer.get().number, buffer.get().number] == [2, 3]
+    assert buffer.get() is None
+
+
+def test_frame_buffer_blocks():
+    buffer = FrameBuffer(1, block=True)
+    buffer.put(Frame(0, None))
+    producer = threading.Thread(target=buffer.put, args=(Frame(1, None),))
+    producer.start()
+    producer.join(0.1)
+    assert producer.is_alive()
+    assert buffer.get().number == 0
+    producer.join()
+    assert buffer.get().number == 1
+    assert not buffer.dropped
+
+
+def test_decode_image():
+    np = pytest.importorskip("numpy")
+
+    data = np.arange(12, dtype=np.uint32)
+    data[5] = 0xFFFFFFFF
+    header = {"shape": [4, 3], "type": "uint32", "encoding": "<"}
+    image = decode_image(header, data.tobytes())
+    assert image.all() == (3, 4)
+    assert image[1, 1] == -1
+    assert image[2, 3] == 11
+
+
+@pytest.fixture
+def centroid_frames(dials_data):
+    filename = dials_data("centroid_test_data").join("experiments.json").strpath
+    experiments = ExperimentListFactory.from_json_file(filename)
+    imageset = experiments[0].imageset
+    frames = [Frame(i, imageset.get_raw_data(i)) for i in range(len(imageset))]
+    return experiments, frames
+
+
+def test_streaming_spot_finder(centroid_frames):
+    experiments, frames = centroid_frames
+    params = phil_scope.extract()
+    mask = MaskGenerator(params.spotfinder.filter).generate(experiments[0].imageset)
+
+    def create_analyser():
+        return FrameAnalyser(experiments, params, mask)
+
+    expected = [create_analyser()(frame) for frame in frames]
+    assert all(stats["n_spots_total"] > 0 for stats in expected)
+    assert [stats["frame"] for stats in expected] == list(range(len(frames)))
+
+    results = []
+    lock = threading.Lock()
+
+    def callback(stats):
+        with lock:
+            results.append(stats)
+
+    finder = StreamingSpotFinder(
+        create_analyser, callback, nthreads=3, buffer_size=len(frames), block=True
+    )
+    for frame in frames:
+        finder.put(frame)
+    finder.close()
+    assert not finder.dropped
+    results.sort(key=lambda stats: stats["frame"])
+    assert results == expected
+    json.dumps(results)
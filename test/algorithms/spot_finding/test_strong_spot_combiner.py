@@ -0,0 +1,59 @@
+from __future__ import absolute_import, division, print_function
+
+from dials.algorithms.shoebox import MaskCode
+from dials.algorithms.spot_finding import StrongSpotCombiner
+from dials.array_family import flex
+from dials.model.data import Shoebox
+
+
+def make_shoebox(bbox):
+    shoebox = Shoebox()
+    shoebox.bbox = bbox
+    shoebox.allocate()
+    for i in range(len(shoebox.mask)):
+        shoebox.mask[i] = MaskCode.Valid | MaskCode.Foreground
+        shoebox.data[i] = 1
+    return shoebox
+
+
+def make_chunk(bboxes):
+    shoeboxes = flex.shoebox()
+    for bbox in bboxes:
+        shoeboxes.append(make_shoebox(bbox))
+    return shoeboxes
+
+
+def test_strong_spot_combiner_incremental():
+    combiner = StrongSpotCombiner()
+
+    # Spots on the last frame are kept until the next chunk is added
+    combiner.add(
+        make_chunk(
+            [
+                (0, 5, 0, 5, 0, 2),
+                (10, 15, 10, 15, 3, 5),
+                (0, 5, 0, 5, 8, 10),
+                (50, 55, 50, 55, 9, 10),
+            ]
+        )
+    )
+    assert combiner.num_finished() == 2
+    assert combiner.num_pending() == 2
+
+    # The spot at the boundary is joined to the spot from the previous chunk
+    combiner.add(make_chunk([(2, 7, 2, 7, 10, 12), (20, 25, 20, 25, 15, 20)]))
+    assert combiner.num_finished() == 4
+    assert combiner.num_pending() == 1
+    finished = combiner.pop_finished()
+    assert len(finished) == 4
+    assert (0, 7, 0, 7, 8, 12) in [s.bbox for s in finished]
+    assert combiner.num_finished() == 0
+
+    combiner.add(make_chunk([(20, 25, 20, 25, 20, 22), (30, 35, 30, 35, 25, 30)]))
+    shoeboxes = combiner.shoeboxes()
+    assert sorted(s.bbox for s in shoeboxes) == [
+        (20, 25, 20, 25, 15, 22),
+        (30, 35, 30, 35, 25, 30),
+    ]
+    assert combiner.num_pending() == 0
+    assert combiner.num_finished() == 0
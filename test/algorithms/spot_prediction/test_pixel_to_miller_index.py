@@ -29,3 +29,68 @@ def test(dials_data):
         h0 = r["miller_index"]
         h1 = transform.h(panel, x, y, z)
         assert h0 == pytest.approx(h1, abs=1e-7)
+
+
+def test_cached_pixel_centres(dials_data):
+    from dxtbx.model.experiment_list import ExperimentListFactory
+
+    from dials.algorithms.spot_prediction import PixelToMillerIndex
+
+    filename = dials_data("centroid_test_data").join("experiments.json").strpath
+
+    experiments = ExperimentListFactory.from_json_file(filename)
+
+    transform = PixelToMillerIndex(
+        experiments[0].beam,
+        experiments[0].detector,
+        experiments[0].goniometer,
+        experiments[0].scan,
+        experiments[0].crystal,
+    )
+    pixels = [(0, 0, 0.5), (100, 200, 3.0), (2462, 2526, 8.5), (-5, 10, 2.0)]
+    expected = [transform.h(0, x + 0.5, y + 0.5, z) for x, y, z in pixels]
+    assert [transform.h_at_pixel_centre(0, x, y, z) for x, y, z in pixels] == [
+        pytest.approx(h, abs=1e-7) for h in expected
+    ]
+
+    # The lab vectors are held in single precision once cached
+    transform.cache_pixel_centres(nthreads=2)
+    for (x, y, z), h0 in zip(pixels, expected):
+        assert transform.h_at_pixel_centre(0, x, y, z) == pytest.approx(h0, abs=1e-4)
+
+
+def test_h_map(dials_data):
+    from dxtbx.model.experiment_list import ExperimentListFactory
+
+    from dials.algorithms.spot_prediction import PixelLabeller, PixelToMillerIndex
+
+    filename = dials_data("centroid_test_data").join("experiments.json").strpath
+
+    experiments = ExperimentListFactory.from_json_file(filename)
+    experiment = experiments[0]
+
+    transform = PixelToMillerIndex(
+        experiment.beam,
+        experiment.detector,
+        experiment.goniometer,
+        experiment.scan,
+        experiment.crystal,
+    )
+    nfast, nslow = experiment.detector[0].get_image_size()
+    h_map = transform.h_map(0, 2.5)
+    assert h_map.all() == (nslow, nfast, 3)
+    for x, y in ((0, 0), (100, 200), (nfast - 1, nslow - 1)):
+        h = transform.h(0, x + 0.5, y + 0.5, 2.5)
+        assert tuple(h_map[y, x, i] for i in range(3)) == pytest.approx(h, abs=1e-7)
+    assert transform.h_map(0, 2.5, nthreads=4).all_eq(h_map)
+
+    transform.cache_pixel_centres(nthreads=4)
+    h_map_float = transform.h_map_float(0, 2.5, nthreads=4)
+    assert h_map_float.all() == h_map.all()
+    assert (h_map_float.as_double() - h_map).norm() / h_map.norm() < 1e-5
+
+    labeller = PixelLabeller(experiment.beam, experiment.detector)
+    A = experiment.crystal.get_A()
+    labels = labeller.label(A, 0).as_vec3_double()
+    labels_threaded = labeller.label(A, 0, nthreads=4).as_vec3_double()
+    assert (labels_threaded - labels).norms().all_eq(0)
@@ -0,0 +1,62 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+from dxtbx.model.detector import Detector
+from scitbx import matrix
+
+
+def make_detector(n=16):
+    """Make a flat n x n panel detector with gaps between the panels"""
+    pixel_size = 0.1
+    npixels = 20
+    gap = 0.5
+    distance = 100
+    fast = matrix.col((1, 0, 0))
+    slow = matrix.col((0, -1, 0))
+    width = npixels * pixel_size + gap
+    orig = matrix.col((0, 0, -distance)) - (n * width / 2) * (fast + slow)
+
+    d = Detector()
+    root = d.hierarchy()
+    root.set_local_frame(fast.elems, slow.elems, orig.elems)
+    for j in range(n):
+        for i in range(n):
+            p = d.add_panel()
+            p.set_image_size((npixels, npixels))
+            p.set_pixel_size((pixel_size, pixel_size))
+            p.set_local_frame((1, 0, 0), (0, 1, 0), (i * width, j * width, 0))
+    return d
+
+
+def test_detector_ray_intersector():
+    from dials.algorithms.spot_prediction import DetectorRayIntersector
+    from dials.array_family import flex
+
+    detector = make_detector()
+    intersect = DetectorRayIntersector(detector)
+    assert intersect.mean_candidates() < len(detector)
+
+    # Rays spread over the detector, its gaps and the space around it
+    random.seed(0)
+    s1 = flex.vec3_double()
+    for _ in range(5000):
+        s1.append((random.uniform(-0.3, 0.3), random.uniform(-0.3, 0.3), -1))
+    s1.append((0, 0, 1))
+    s1.append((0, 0, 0))
+
+    success, panel, mm = intersect(s1)
+    num_hits = 0
+    for i in range(len(s1)):
+        try:
+            expected = detector.get_ray_intersection(s1[i])
+        except RuntimeError:
+            assert not success[i]
+            continue
+        num_hits += 1
+        assert success[i]
+        assert panel[i] == expected[0]
+        assert mm[i] == pytest.approx(expected[1])
+    assert 0 < num_hits < len(s1)
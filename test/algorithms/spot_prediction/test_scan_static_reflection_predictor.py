@@ -119,6 +119,82 @@ def test_with_old_index_generator(data):
         )
 
 
+def test_multithreaded(data):
+    from dials.algorithms.spot_prediction import ScanStaticReflectionPredictor
+
+    A = data.experiments[0].crystal.get_A()
+    r_serial = ScanStaticReflectionPredictor(data.experiments[0]).for_ub(A)
+    for nthreads in (2, 3, 8):
+        predict = ScanStaticReflectionPredictor(data.experiments[0], nthreads=nthreads)
+        r_threaded = predict.for_ub(A)
+
+        # The predictions are the same and in the same order
+        assert len(r_threaded) == len(r_serial)
+        assert list(r_threaded["miller_index"]) == list(r_serial["miller_index"])
+        assert list(r_threaded["panel"]) == list(r_serial["panel"])
+        assert list(r_threaded["entering"]) == list(r_serial["entering"])
+        assert list(r_threaded["xyzcal.px"]) == list(r_serial["xyzcal.px"])
+
+
+def test_multithreaded_old_index_generator(data):
+    from dials.algorithms.spot_prediction import ScanStaticReflectionPredictor
+
+    A = data.experiments[0].crystal.get_A()
+    predict = ScanStaticReflectionPredictor(data.experiments[0])
+    r_serial = predict.for_ub_old_index_generator(A)
+    for nthreads in (2, 3, 8):
+        predict = ScanStaticReflectionPredictor(data.experiments[0], nthreads=nthreads)
+        r_threaded = predict.for_ub_old_index_generator(A)
+
+        # The predictions are the same and in the same order
+        assert len(r_threaded) == len(r_serial)
+        assert list(r_threaded["miller_index"]) == list(r_serial["miller_index"])
+        assert list(r_threaded["panel"]) == list(r_serial["panel"])
+        assert list(r_threaded["entering"]) == list(r_serial["entering"])
+        assert list(r_threaded["xyzcal.px"]) == list(r_serial["xyzcal.px"])
+
+
+def test_from_predictions_multithreaded(data):
+    from dials.array_family import flex
+
+    r_serial = flex.reflection_table.from_predictions(data.experiments[0])
+    r_threaded = flex.reflection_table.from_predictions(
+        data.experiments[0], nthreads=3
+    )
+    assert list(r_threaded["miller_index"]) == list(r_serial["miller_index"])
+    assert list(r_threaded["xyzcal.px"]) == list(r_serial["xyzcal.px"])
+
+
+def test_with_index_cache(data):
+    from dials.algorithms.spot_prediction import (
+        ReekeIndexCache,
+        ScanStaticReflectionPredictor,
+    )
+
+    A = data.experiments[0].crystal.get_A()
+    r_expected = ScanStaticReflectionPredictor(data.experiments[0]).for_ub(A)
+    cache = ReekeIndexCache()
+    for nthreads in (1, 1, 4):
+        predict = ScanStaticReflectionPredictor(
+            data.experiments[0], nthreads=nthreads, index_cache=cache
+        )
+        r_cached = predict.for_ub(A)
+        assert list(r_cached["miller_index"]) == list(r_expected["miller_index"])
+        assert list(r_cached["xyzcal.px"]) == list(r_expected["xyzcal.px"])
+
+    # Only the first prediction generated the indices
+    num_frames = len(cache)
+    assert num_frames > 0
+    assert cache.num_misses() == num_frames
+    assert cache.num_hits() == 2 * num_frames
+
+    # The least recently used frames are dropped to stay within the limit
+    small = ReekeIndexCache(max_indices=cache.num_indices() // 2)
+    ScanStaticReflectionPredictor(data.experiments[0], index_cache=small).for_ub(A)
+    assert 0 < len(small) < num_frames
+    assert small.num_indices() <= cache.num_indices() // 2
+
+
 def test_with_reflection_table(data):
     from dials.algorithms.spot_prediction import ScanStaticReflectionPredictor
     from dials.array_family import flex
@@ -206,3 +282,50 @@ def test_with_reflection_table(data):
     # r_old = self.predict_new()
     # r_new = self.predict_new(indices, panels)
     # assert(len(r_old) < len(r_new))
+
+
+def test_incremental_with_reflection_table(data):
+    from scitbx import matrix
+
+    from dials.algorithms.spot_prediction import (
+        ScanStaticPredictionCache,
+        ScanStaticReflectionPredictor,
+    )
+    from dials.array_family import flex
+
+    def new_table():
+        r_old = data.reflections
+        r_new = flex.reflection_table()
+        r_new["miller_index"] = r_old["miller_index"]
+        r_new["panel"] = r_old["panel"]
+        r_new["entering"] = r_old["entering"]
+        r_new["flags"] = flex.size_t(len(r_old), 0)
+        return r_new
+
+    predict = ScanStaticReflectionPredictor(data.experiments[0])
+    UB = matrix.sqr(data.experiments[0].crystal.get_A())
+    cache = ScanStaticPredictionCache()
+    r_inc = new_table()
+
+    # The first update predicts everything exactly
+    predict.for_reflection_table_incremental(r_inc, UB, cache)
+    assert len(cache) == len(r_inc)
+    assert cache.num_updated() == 0
+
+    # Rotate the crystal by a small amount, as in a cycle of refinement
+    R = matrix.col((0, 1, 0)).axis_and_angle_as_r3_rotation_matrix(0.01, deg=True)
+    for _ in range(3):
+        UB = R * UB
+        predict.for_reflection_table_incremental(r_inc, UB, cache)
+        assert cache.num_updated() > 0.9 * len(r_inc)
+        assert cache.num_updated() + cache.num_recomputed() == len(r_inc)
+        r_ref = new_table()
+        predict.for_reflection_table(r_ref, UB)
+        assert list(r_inc.get_flags(r_inc.flags.predicted)) == list(
+            r_ref.get_flags(r_ref.flags.predicted)
+        )
+        for r1, r2 in zip(r_ref.rows(), r_inc.rows()):
+            for key in ("s1", "xyzcal.px", "xyzcal.mm"):
+                assert all(
+                    a == pytest.approx(b, abs=1e-7) for a, b in zip(r1[key], r2[key])
+                )
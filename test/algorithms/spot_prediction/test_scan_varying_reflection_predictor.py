@@ -203,6 +203,56 @@ def test_regression(data):
     # print 'OK'
 
 
+def test_multithreaded_and_delta(data):
+    from dials.algorithms.spot_prediction import ScanVaryingReflectionPredictor
+    from dials.array_family import flex
+
+    experiment = data.experiments[0]
+    A = flex.mat3_double(
+        [
+            experiment.crystal.get_A_at_scan_point(i)
+            for i in range(experiment.crystal.num_scan_points)
+        ]
+    )
+    r_serial = data._predict_new()
+
+    def assert_same(r1, r2):
+        assert len(r1) == len(r2)
+        assert list(r1["miller_index"]) == list(r2["miller_index"])
+        assert list(r1["xyzcal.px"]) == list(r2["xyzcal.px"])
+
+    # Threaded prediction gives the same reflections in the same order
+    predict = ScanVaryingReflectionPredictor(experiment, nthreads=4)
+    assert_same(predict.for_ub(A), r_serial)
+
+    # The first delta prediction predicts every frame, the second none
+    r1 = predict.for_ub_delta(A)
+    num_frames = predict.num_predicted_frames()
+    assert num_frames > 0
+    assert_same(r1, r_serial)
+    r2 = predict.for_ub_delta(A)
+    assert predict.num_predicted_frames() == 0
+    assert_same(r2, r_serial)
+
+    # Changing one scan point only repredicts the frames either side of it
+    A[2] = experiment.crystal.get_A_at_scan_point(3)
+    r3 = predict.for_ub_delta(A)
+    assert predict.num_predicted_frames() == 2
+    assert_same(r3, predict.for_ub(A))
+
+
+def test_from_predictions_multithreaded(data):
+    from dials.array_family import flex
+
+    # The threads are passed through to the scan varying predictor
+    experiment = data.experiments[0]
+    r_serial = flex.reflection_table.from_predictions(experiment)
+    r_threaded = flex.reflection_table.from_predictions(experiment, nthreads=4)
+    assert len(r_threaded) == len(r_serial)
+    assert list(r_threaded["miller_index"]) == list(r_serial["miller_index"])
+    assert list(r_threaded["xyzcal.px"]) == list(r_serial["xyzcal.px"])
+
+
 def test_scan_varying_results_are_close_to_static_prediction_when_model_is_static(
     static_test,  # noqa: F811, not a redefinition
 ):
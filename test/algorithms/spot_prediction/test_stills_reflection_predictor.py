@@ -160,3 +160,40 @@ def test_spherical_relps():
         denom = sqrt(radicand)
         s1 = es_radius * (q + s0) / denom
         assert approx_equal(s1, ref["s1"])
+
+
+@pytest.mark.parametrize("nave_model", [True, False], ids=["nave", "native"])
+def test_predict_stills(nave_model):
+    import copy
+
+    from dxtbx.model.experiment_list import Experiment, ExperimentList
+
+    from dials.algorithms.spot_prediction import (
+        StillsReflectionPredictor,
+        predict_stills,
+    )
+
+    # A few stills of the same crystal in different orientations
+    model = Model(test_nave_model=nave_model)
+    experiments = ExperimentList()
+    for i in range(5):
+        crystal = copy.deepcopy(model.crystal)
+        R = matrix.col((0, 1, 0)).axis_and_angle_as_r3_rotation_matrix(
+            7 * i, deg=True
+        )
+        crystal.set_U(R * matrix.sqr(crystal.get_U()))
+        experiments.append(
+            Experiment(beam=model.beam, detector=model.detector, crystal=crystal)
+        )
+
+    for nthreads in (1, 3):
+        table = predict_stills(experiments, dmin=1.5, nthreads=nthreads)
+        for i, e in enumerate(experiments):
+            expected = StillsReflectionPredictor(e, dmin=1.5).for_ub(
+                e.crystal.get_A()
+            )
+            subset = table.select(table["id"] == i)
+            assert len(expected) > 0
+            assert list(subset["miller_index"]) == list(expected["miller_index"])
+            assert list(subset["xyzcal.px"]) == list(expected["xyzcal.px"])
+            assert list(subset["delpsical.rad"]) == list(expected["delpsical.rad"])
@@ -0,0 +1,48 @@
+from __future__ import absolute_import, division, print_function
+
+import math
+
+from scitbx.array_family import flex
+
+from dials.algorithms.statistics import (
+    BinnedGMMSingle1D,
+    BinnedGMMSingle1DBatch,
+    BinnedGMMSingle1DFixedMean,
+    BinnedGMMSingle1DFixedMeanBatch,
+)
+
+
+def gaussian_histograms(nhist, nbins):
+    a = flex.double(list(range(-nbins // 2, nbins // 2)))
+    b = a + 1
+    n = flex.double(flex.grid(nhist, nbins))
+    for i in range(nhist):
+        mu = 0.1 * i - 1
+        sigma = 1 + 0.2 * i
+        for j in range(nbins):
+            x = (a[j] + b[j]) / 2 - mu
+            n[i, j] = round(1000 * math.exp(-x * x / (2 * sigma * sigma)))
+    return a, b, n
+
+
+def test_batch_matches_single_fits():
+    a, b, n = gaussian_histograms(20, 30)
+    mu = flex.double(20, 0)
+    sigma = flex.double(20, 2)
+    for Batch, Single in (
+        (BinnedGMMSingle1DBatch, BinnedGMMSingle1D),
+        (BinnedGMMSingle1DFixedMeanBatch, BinnedGMMSingle1DFixedMean),
+    ):
+        batch = Batch(a, b, n, mu, sigma, 1e-7, 100)
+        assert len(batch) == 20
+        for i in range(20):
+            row = n[i : i + 1, :].as_1d()
+            single = Single(a, b, row, mu[i], sigma[i], 1e-7, 100)
+            assert batch.mu()[i] == single.mu()
+            assert batch.sigma()[i] == single.sigma()
+            assert batch.num_iter()[i] == single.num_iter()
+
+        threaded = Batch(a, b, n, mu, sigma, 1e-7, 100, nthreads=4)
+        assert list(threaded.mu()) == list(batch.mu())
+        assert list(threaded.sigma()) == list(batch.sigma())
+        assert list(threaded.num_iter()) == list(batch.num_iter())
@@ -0,0 +1,28 @@
+from __future__ import absolute_import, division, print_function
+
+import pytest
+
+from dials.algorithms.statistics import (
+    spearman_correlation_coefficient,
+    spearman_correlation_matrix,
+)
+from dials.array_family import flex
+
+
+def test_spearman_correlation_matrix():
+    flex.set_random_seed(0)
+    rows = [flex.random_double(50) for _ in range(7)]
+    # Include ties, which share the mean of their ranks
+    rows.append(flex.double([float(i // 5) for i in range(50)]))
+    data = flex.double()
+    for row in rows:
+        data.extend(row)
+    data.reshape(flex.grid(len(rows), 50))
+
+    result = spearman_correlation_matrix(data)
+    assert result.all() == (len(rows), len(rows))
+    for j, a in enumerate(rows):
+        for i, b in enumerate(rows):
+            expected = spearman_correlation_coefficient(a, b)
+            assert result[j, i] == pytest.approx(expected)
+    assert list(spearman_correlation_matrix(data, nthreads=3)) == list(result)
@@ -3,11 +3,19 @@
 """Tests for ΔCC½ algorithms."""
 from __future__ import absolute_import, division, print_function
 
+from collections import defaultdict
+
 import mock
+import pytest
 
 from dxtbx.model import Crystal, Experiment, ExperimentList, Scan
 
+from dials.algorithms.statistics import CCHalfAccumulator
 from dials.algorithms.statistics.cc_half_algorithm import CCHalfFromDials
+from dials.algorithms.statistics.delta_cchalf import (
+    ReflectionSum,
+    compute_cchalf_from_reflection_sums,
+)
 from dials.array_family import flex
 from dials.command_line.compute_delta_cchalf import phil_scope
 
@@ -119,3 +127,48 @@ def mock_algorithm(*_):
         assert script.results_summary["dataset_removal"][
             "experiments_fully_removed"
         ] == ["0"]
+
+
+def test_CCHalfAccumulator():
+    """Test the accumulated CC1/2 against the reference from reflection sums."""
+
+    class Binner(object):
+        def nbins(self):
+            return 3
+
+        def index(self, h):
+            return h % 3
+
+    flex.set_random_seed(0)
+    n_unique = 60
+    unique_index = flex.random_size_t(600, n_unique)
+    true_intensity = flex.random_double(n_unique) * 100.0
+    intensity = true_intensity.select(unique_index) + flex.random_double(600) * 10.0
+    group = flex.random_size_t(600, 5)
+    bin_index = flex.size_t([h % 3 for h in range(n_unique)])
+
+    def reference(exclude):
+        sums = defaultdict(ReflectionSum)
+        for i, (h, x) in enumerate(zip(unique_index, intensity)):
+            if not exclude[i]:
+                sums[h].sum_x += x
+                sums[h].sum_x2 += x ** 2
+                sums[h].n += 1
+        return compute_cchalf_from_reflection_sums(sums, Binner())
+
+    accumulator = CCHalfAccumulator(unique_index, bin_index, 3, intensity)
+    assert accumulator.num_unique() == n_unique
+    assert accumulator.mean_cc_half() == pytest.approx(reference(flex.bool(600)))
+    excluded = accumulator.mean_cc_half_excluding_groups(group, 5)
+    threaded = accumulator.mean_cc_half_excluding_groups(group, 5, nthreads=3)
+    assert list(threaded) == list(excluded)
+    for g in range(5):
+        sel = group == g
+        assert excluded[g] == pytest.approx(reference(sel))
+        assert accumulator.mean_cc_half_excluding(sel.iselection()) == excluded[g]
+
+    # Changing some intensities should give the same as starting afresh
+    changed = flex.size_t(range(0, 600, 7))
+    intensity.set_selected(changed, intensity.select(changed) * 1.5)
+    accumulator.update(changed, intensity.select(changed))
+    assert accumulator.mean_cc_half() == pytest.approx(reference(flex.bool(600)))
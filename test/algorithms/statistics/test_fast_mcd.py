@@ -261,3 +261,24 @@ def test_fast_mcd_large(dials_regression):
     # Correction factors
     assert approx_equal(fast_mcd._consistency_fac, 2.45659976388)
     assert approx_equal(fast_mcd._finite_samp_fac, 1.00193273884)
+
+
+def test_fast_mcd_threaded():
+    from scitbx.array_family import flex
+
+    from dials.algorithms.statistics.fast_mcd import FastMCD
+
+    # both the small and large dataset algorithms should give identical results
+    # with any number of threads, as the random subsets are drawn up front
+    for n in (200, 1000):
+        flex.set_random_seed(42)
+        x1 = flex.random_double(n)
+        x2 = x1 + flex.random_double(n)
+        x3 = x2 + flex.random_double(n)
+
+        results = []
+        for nthreads in (1, 3):
+            flex.set_random_seed(0)
+            T, S = FastMCD([x1, x2, x3], nthreads=nthreads).get_raw_T_and_S()
+            results.append((list(T), list(S)))
+        assert results[0] == results[1]
@@ -0,0 +1,74 @@
+from __future__ import absolute_import, division, print_function
+
+import math
+import random
+
+import pytest
+
+from scitbx.array_family import flex
+
+from dials.algorithms.statistics import (
+    is_poisson_distributed,
+    kolmogorov_smirnov_test_poisson,
+    poisson_expected_max_counts,
+)
+
+
+def random_poisson(mean):
+    # Knuth's algorithm, which is fine for small means
+    limit = math.exp(-mean)
+    k = 0
+    p = random.random()
+    while p > limit:
+        k += 1
+        p *= random.random()
+    return k
+
+
+def random_samples():
+    random.seed(0)
+    data = flex.double()
+    offset = flex.size_t([0])
+    for i in range(50):
+        mean = 0.5 + i
+        n = 10 + 7 * i
+        data.extend(flex.double([random_poisson(mean) for j in range(n)]))
+        offset.append(len(data))
+    # a sample with an obvious outlier
+    data.extend(flex.double([1, 2, 1, 0, 3, 2, 1, 1, 2, 100]))
+    offset.append(len(data))
+    return data, offset
+
+
+def poisson_cdf(k, mean):
+    return sum(
+        math.exp(j * math.log(mean) - mean - math.lgamma(j + 1))
+        for j in range(int(k) + 1)
+    )
+
+
+def test_is_poisson_distributed():
+    data, offset = random_samples()
+    result = is_poisson_distributed(data, offset)
+    for i in range(len(offset) - 1):
+        sample = data[offset[i] : offset[i + 1]]
+        expected = poisson_expected_max_counts(flex.mean(sample), len(sample))
+        assert result[i] == (flex.max(sample) < expected)
+    assert not result[-1]
+    assert list(is_poisson_distributed(data, offset, nthreads=4)) == list(result)
+
+
+def test_kolmogorov_smirnov_test_poisson():
+    data, offset = random_samples()
+    D, p = kolmogorov_smirnov_test_poisson(data, offset, "greater")
+    for i in range(len(offset) - 1):
+        sample = sorted(data[offset[i] : offset[i + 1]])
+        mean = sum(sample) / len(sample)
+        n = len(sample)
+        expected = max((j + 1) / n - poisson_cdf(x, mean) for j, x in enumerate(sample))
+        assert D[i] == pytest.approx(max(expected, 0), abs=1e-10)
+    for kstype in ("less", "greater", "two_sided"):
+        D1, p1 = kolmogorov_smirnov_test_poisson(data, offset, kstype)
+        D4, p4 = kolmogorov_smirnov_test_poisson(data, offset, kstype, nthreads=4)
+        assert list(D4) == list(D1)
+        assert list(p4) == list(p1)
@@ -0,0 +1,36 @@
+from __future__ import absolute_import, division, print_function
+
+import math
+
+
+def test_beam_vector_filter_matches_individual_filters(dials_data):
+    from dxtbx.model.experiment_list import ExperimentListFactory
+
+    from dials.algorithms import filtering
+    from dials.array_family import flex
+
+    experiments = ExperimentListFactory.from_json_file(
+        dials_data("centroid_test_data").join("experiments.json").strpath,
+        check_format=False,
+    )
+    experiment = experiments[0]
+    reflections = flex.reflection_table.from_predictions(experiment)
+    g = experiment.goniometer
+    b = experiment.beam
+    s1 = reflections["s1"]
+    delta_m = 3 * math.radians(0.5)
+
+    by_zeta = filtering.by_zeta(g, b, s1, 0.05)
+    by_small_angle = filtering.by_xds_small_angle(g, b, s1, delta_m)
+    by_angle = filtering.by_xds_angle(g, b, s1, delta_m)
+    assert list(filtering.by_zeta(g, b, s1, 0.05, nthreads=3)) == list(by_zeta)
+
+    f = filtering.BeamVectorFilter(g, b)
+    assert f(s1).all_eq(True)
+    f.set_min_zeta(0.05)
+    f.set_xds_small_angle(delta_m)
+    f.set_xds_angle(delta_m)
+    expected = by_zeta & by_small_angle & by_angle
+    assert list(f(s1)) == list(expected)
+    assert list(f(s1, nthreads=3)) == list(expected)
+    assert [f.is_valid(s) for s in s1[:10]] == list(expected[:10])
@@ -0,0 +1,40 @@
+from __future__ import absolute_import, division, print_function
+
+import pytest
+
+from dials.array_family import flex
+
+
+def test_binner_statistics():
+    n = 50000
+    x = flex.random_double(n)
+    y = flex.random_double(n)
+    w = flex.random_double(n) + 0.5
+    binner = flex.Binner(flex.double([0, 0.25, 0.5, 0.75]))
+    assert len(binner) == 4
+
+    indexer = binner.indexer(x)
+    threaded = binner.indexer(x, nthreads=4)
+    for i in range(4):
+        assert list(threaded.indices(i)) == list(indexer.indices(i))
+    assert list(indexer.count(nthreads=4)) == list(indexer.count())
+
+    stats = indexer.statistics(y, weights=w, nthreads=4)
+    for i in range(4):
+        sel = indexer.indices(i)
+        yi = y.select(sel)
+        wi = w.select(sel)
+        mv = flex.mean_and_variance(yi)
+        assert stats.count[i] == len(sel)
+        assert stats.sum[i] == pytest.approx(flex.sum(yi))
+        assert stats.mean[i] == pytest.approx(mv.mean())
+        assert stats.variance[i] == pytest.approx(mv.unweighted_sample_variance())
+        assert stats.min[i] == flex.min(yi)
+        assert stats.max[i] == flex.max(yi)
+        assert stats.sum_weights[i] == pytest.approx(flex.sum(wi))
+        assert stats.weighted_mean[i] == pytest.approx(flex.sum(wi * yi) / flex.sum(wi))
+        assert indexer.mean(y, nthreads=4)[i] == pytest.approx(mv.mean())
+        assert indexer.sum(y, nthreads=4)[i] == pytest.approx(flex.sum(yi))
+
+    unweighted = indexer.statistics(y)
+    assert list(unweighted.sum_weights) == [float(c) for c in unweighted.count]
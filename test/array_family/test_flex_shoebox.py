@@ -2,6 +2,8 @@
 
 import random
 
+import pytest
+
 
 def test_consistent():
     from dials.array_family import flex
@@ -139,3 +141,113 @@ def test_bounding_boxes():
     bbox2 = shoebox.bounding_boxes()
     for i in range(10):
         assert bbox2[i] == bbox[i]
+
+
+def test_set_bounding_boxes():
+    from dials.array_family import flex
+    from dials.model.data import Shoebox
+
+    shoebox = flex.shoebox()
+    for bbox in [(0, 3, 10, 12, 5, 6), (20, 22, 30, 34, 7, 9)]:
+        shoebox.append(Shoebox(0, bbox))
+    shoebox.allocate()
+    shoebox[1].data[1, 2, 1] = 5
+
+    bbox = flex.int6([(0, 3, 10, 12, 0, 1), (21, 23, 31, 35, 0, 2)])
+    shoebox.set_bounding_boxes(bbox)
+    assert list(shoebox.bounding_boxes()) == list(bbox)
+    assert shoebox.is_consistent().all_eq(True)
+    assert shoebox[1].data[1, 2, 1] == 5
+
+    # The shoeboxes must keep their size
+    with pytest.raises(RuntimeError):
+        shoebox.set_bounding_boxes(flex.int6([(0, 3, 10, 12, 0, 2)] * 2))
+
+
+def test_threaded_bulk_operations():
+    from dials.algorithms.shoebox import MaskCode
+    from dials.array_family import flex
+    from dials.model.data import Shoebox
+
+    def create(n):
+        shoebox = flex.shoebox(n)
+        for i in range(n):
+            x0 = random.randint(0, 90)
+            y0 = random.randint(0, 90)
+            z0 = random.randint(0, 90)
+            x1 = random.randint(1, 10) + x0
+            y1 = random.randint(1, 10) + y0
+            z1 = random.randint(1, 10) + z0
+            shoebox[i] = Shoebox((x0, x1, y0, y1, z0, z1))
+        return shoebox
+
+    shoebox = create(50)
+    shoebox.allocate_with_value(MaskCode.Valid | MaskCode.Foreground, nthreads=4)
+    assert shoebox.is_consistent().all_eq(True)
+    for sbox in shoebox:
+        assert sbox.mask.all_eq(MaskCode.Valid | MaskCode.Foreground)
+        for j in range(len(sbox.data)):
+            sbox.data[j] = random.uniform(0, 10)
+
+    expected = [i.observed.value for i in shoebox.summed_intensity()]
+    intensity = shoebox.summed_intensity(nthreads=4)
+    assert [i.observed.value for i in intensity] == expected
+
+    expected = [i.observed.value for i in shoebox.bayesian_intensity()]
+    intensity = shoebox.bayesian_intensity(nthreads=4)
+    assert [i.observed.value for i in intensity] == expected
+    expected = [i.observed.value for i in shoebox.summed_intensity()]
+
+    shoebox.flatten(nthreads=4)
+    assert all(sbox.flat for sbox in shoebox)
+    intensity = shoebox.summed_intensity()
+    assert [i.observed.value for i in intensity] == pytest.approx(expected)
+
+    shoebox.deallocate()
+    assert shoebox.is_consistent().all_eq(False)
+
+    shoebox = create(20)
+    shoebox.allocate(nthreads=3)
+    assert shoebox.is_consistent().all_eq(True)
+
+
+def test_threaded_bulk_operations_repeated_shoeboxes():
+    # Selecting the same shoeboxes many times over shares their arrays between
+    # rows, whose handles must not be replaced or released in threads
+    from dials.algorithms.shoebox import MaskCode
+    from dials.array_family import flex
+    from dials.model.data import Shoebox
+
+    shoebox = flex.shoebox()
+    for i in range(4):
+        shoebox.append(Shoebox(0, (i, i + 2, 0, 2, 0, 3)))
+    shoebox.allocate()
+    index = flex.size_t(i % 4 for i in range(20000))
+    repeated = shoebox.select(index)
+
+    # Every row gets arrays of its own
+    code = MaskCode.Valid | MaskCode.Foreground
+    repeated.allocate_with_value(code, nthreads=4)
+    del shoebox
+    assert repeated.is_consistent().all_eq(True)
+    repeated[0].data[0] = 1
+    assert repeated[4].data[0] == 0
+    for sbox in repeated:
+        assert sbox.mask.all_eq(code)
+        sbox.data[0] = 1
+
+    # The rows no longer share arrays so are flattened in threads
+    repeated.flatten(nthreads=4)
+    assert all(sbox.flat for sbox in repeated)
+    assert all(sbox.data.all() == (1, 2, 2) for sbox in repeated)
+    intensity = repeated.summed_intensity(nthreads=4)
+    assert all(i.observed.value == 1 for i in intensity)
+
+    # Shared arrays are flattened on the calling thread
+    shared = repeated.select(flex.size_t(range(4))).select(index)
+    shared.flatten(nthreads=4)
+    assert shared.is_consistent().all_eq(True)
+
+    shared.deallocate()
+    repeated.deallocate()
+    assert repeated.is_consistent().all_eq(False)
@@ -6,6 +6,7 @@
 
 import pytest
 
+import boost_adaptbx.boost.python
 from cctbx import sgtbx
 from dxtbx.model import Crystal, Experiment, ExperimentList
 from dxtbx.serialize import load
@@ -13,6 +14,209 @@
 from dials.array_family import flex
 
 
+def test_memory_usage():
+    table = flex.reflection_table()
+    table["a"] = flex.int(range(100))
+    table["b"] = flex.double(100)
+    shoeboxes = flex.shoebox(flex.size_t(100, 0), flex.int6(100, (0, 2, 0, 3, 0, 4)))
+    shoeboxes.allocate()
+    table["shoebox"] = shoeboxes
+
+    usage = table.memory_usage()
+    assert set(usage) == {"a", "b", "shoebox"}
+    assert usage["a"].array_bytes >= 100 * 4
+    assert usage["a"].element_bytes == 0
+    assert usage["b"].array_bytes >= 100 * 8
+    assert usage["shoebox"].element_bytes >= 100 * 24 * 12
+    assert usage["a"].total_bytes() == usage["a"].array_bytes
+
+    # The shoebox pixels are also referred to from the original array
+    assert usage["shoebox"].shared_bytes == usage["shoebox"].element_bytes
+    assert shoeboxes.memory_usage().element_bytes == usage["shoebox"].element_bytes
+    del shoeboxes
+    assert table.memory_usage()["shoebox"].shared_bytes == 0
+
+    # A column held by python is shared
+    column = table["a"]
+    assert table.memory_usage()["a"].use_count == 2
+    assert table.memory_usage()["a"].shared_bytes == usage["a"].array_bytes
+    del column
+
+    report = table.memory_report()
+    assert "shoebox" in report
+    assert "Total" in report
+
+
+def test_schema_version():
+    table = flex.reflection_table()
+    version = table.schema_version()
+
+    # Adding a column changes the schema
+    table["a"] = flex.int(range(100))
+    assert table.schema_version() != version
+    version = table.schema_version()
+
+    # Reading and changing the data does not
+    column = table["a"]
+    column[0] = 10
+    assert table["a"][0] == 10
+    table.resize(50)
+    assert table.schema_version() == version
+
+    # Replacing or removing a column does
+    table["a"] = flex.int(range(50))
+    assert table.schema_version() != version
+    version = table.schema_version()
+    del table["a"]
+    assert table.schema_version() != version
+
+
+def test_column_handle_is_valid():
+    ext = boost_adaptbx.boost.python.import_ext(
+        "dials_array_family_flex_table_column_test_ext"
+    )
+    table = flex.reflection_table()
+    table["a"] = flex.double(range(10))
+
+    # The handle shares the column data
+    handle = ext.double_column(table, "a")
+    assert handle.is_valid()
+    assert handle.size() == 10
+    handle.data()[0] = 5
+    assert table["a"][0] == 5
+
+    # Changing the data or the number of rows keeps the handle valid
+    table["a"][1] = 6
+    table.resize(20)
+    assert handle.is_valid()
+
+    # Adding a column makes it invalid
+    table["b"] = flex.int(20)
+    assert not handle.is_valid()
+    with pytest.raises(RuntimeError):
+        handle.data()
+
+    # Erasing a column makes it invalid
+    handle = ext.double_column(table, "a")
+    assert handle.is_valid()
+    del table["b"]
+    assert not handle.is_valid()
+
+
+def test_threaded_select_reorder_extend():
+    n = 200000
+    table = flex.reflection_table()
+    table["a"] = flex.random_double(n)
+    table["b"] = flex.size_t_range(n)
+    table["c"] = flex.vec3_double(n, (1, 2, 3))
+    flags = flex.random_double(n) < 0.1
+    perm = flex.random_permutation(n)
+
+    nthreads = flex.reflection_table.get_nthreads()
+    results = []
+    try:
+        for threads in (1, 4):
+            flex.reflection_table.set_nthreads(threads)
+            selected = table.select(flags)
+            reordered = table.copy()
+            reordered.reorder(perm)
+            extended = table.copy()
+            extended.extend(table)
+            results.append((selected, reordered, extended))
+    finally:
+        flex.reflection_table.set_nthreads(nthreads)
+
+    serial, threaded = results
+    for t1, t2 in zip(serial, threaded):
+        assert t1.nrows() == t2.nrows()
+        for key in ("a", "b", "c"):
+            assert (t1[key] == t2[key]).all_eq(True)
+    assert serial[0].nrows() == flags.count(True)
+    assert (serial[1]["b"] == perm).all_eq(True)
+    assert (serial[2]["b"][n:] == table["b"]).all_eq(True)
+
+
+def test_threaded_select_repeated_shoeboxes():
+    # Selecting the same shoeboxes many times over shares their arrays between
+    # rows in different chunks, which must not be copied in threads
+    from dials.model.data import Shoebox
+
+    shoeboxes = flex.shoebox()
+    for i in range(4):
+        shoebox = Shoebox(0, (i, i + 2, 0, 2, 0, 1))
+        shoebox.allocate()
+        shoeboxes.append(shoebox)
+    table = flex.reflection_table()
+    table["shoebox"] = shoeboxes
+    table["b"] = flex.int(range(4))
+    index = flex.size_t(i % 4 for i in range(200000))
+
+    nthreads = flex.reflection_table.get_nthreads()
+    try:
+        flex.reflection_table.set_nthreads(4)
+        selected = table.select(index)
+        tables = flex.reflection_table.concat([selected, selected])
+    finally:
+        flex.reflection_table.set_nthreads(nthreads)
+    for t in (selected, tables):
+        assert (t["b"] == t["shoebox"].bounding_boxes().parts()[0]).all_eq(True)
+    del table, shoeboxes, tables
+    assert selected["shoebox"][5].data.all() == (1, 2, 2)
+
+
+def test_concat_matches_repeated_extend():
+    tables = []
+    for i in range(3):
+        table = flex.reflection_table()
+        table["id"] = flex.int(10 + i, i)
+        table["a"] = flex.random_double(10 + i)
+        if i != 1:
+            table["b"] = flex.size_t_range(10 + i)
+        table.experiment_identifiers()[i] = str(i)
+        tables.append(table)
+
+    extended = flex.reflection_table()
+    for table in tables:
+        extended.extend(table)
+    joined = flex.reflection_table.concat(tables)
+    assert joined.nrows() == extended.nrows() == 33
+    for key in ("id", "a", "b"):
+        assert (joined[key] == extended[key]).all_eq(True)
+    assert dict(joined.experiment_identifiers()) == {0: "0", 1: "1", 2: "2"}
+    assert flex.reflection_table.concat([]).nrows() == 0
+
+    tables[1].experiment_identifiers()[0] = "x"
+    with pytest.raises(RuntimeError):
+        flex.reflection_table.concat(tables)
+
+
+def test_packed_miller_indices_and_flags():
+    from cctbx.array_family import flex as cctbx_flex
+
+    hkl = cctbx_flex.miller_index(
+        [(0, 0, 0), (-3, 5, -(2 ** 20)), (2 ** 20 - 1, -2, 7), (-1, 0, 1), (-1, 0, 0)]
+    )
+    code = flex.pack_miller_indices(hkl)
+    assert list(flex.unpack_miller_indices(code)) == list(hkl)
+
+    # The codes sort in the same order as the indices
+    table = flex.reflection_table()
+    table["miller_index"] = hkl
+    table["code"] = code
+    table.sort("code")
+    assert list(table["miller_index"]) == sorted(hkl)
+
+    with pytest.raises(RuntimeError):
+        flex.pack_miller_indices(cctbx_flex.miller_index([(2 ** 20, 0, 0)]))
+
+    flags = flex.size_t([0, 1, flex.reflection_table.flags.scaled, 2 ** 31])
+    packed = flex.pack_flags(flags)
+    assert len(packed) == 4
+    assert list(flex.unpack_flags(packed)) == list(flags)
+    with pytest.raises(RuntimeError):
+        flex.pack_flags(flex.size_t([2 ** 32]))
+
+
 def test_accessing_invalid_key_throws_keyerror():
     table = flex.reflection_table()
     with pytest.raises(KeyError) as e:
@@ -638,6 +842,110 @@ def test_sort():
     ]
 
 
+def test_sort_multiple_keys():
+    table = flex.reflection_table()
+    table["a"] = flex.int([2, 1, 2, 1, 2, 1])
+    table["b"] = flex.size_t([3, 3, 1, 2, 2, 1])
+    table["c"] = flex.double([0, 1, 2, 3, 4, 5])
+
+    table.sort(["a", "b"])
+    assert list(table["c"]) == [5, 3, 1, 2, 4, 0]
+
+    table.sort(["a", "b"], reverse=True)
+    assert list(table["c"]) == [0, 4, 2, 1, 3, 5]
+
+    # A key without integer values falls back to sorting in Python
+    table.sort(["a", "c"])
+    assert list(table["c"]) == [1, 3, 5, 0, 2, 4]
+
+
+def test_sort_permutation_matches_python_sort():
+    n = 200000
+    table = flex.reflection_table()
+    table["miller_index"] = flex.miller_index(
+        [tuple(random.randint(-20, 20) for j in range(3)) for i in range(n)]
+    )
+    table["id"] = flex.int([random.randint(0, 2) for i in range(n)])
+
+    keys = ["id", ("miller_index", 0), ("miller_index", 1), ("miller_index", 2)]
+    nthreads = flex.reflection_table.get_nthreads()
+    try:
+        for threads in (1, 4):
+            flex.reflection_table.set_nthreads(threads)
+            for reverse in (False, True):
+                perm = table.sort_permutation(keys, reverse=reverse)
+                ids = table["id"]
+                hkl = table["miller_index"]
+                expected = sorted(
+                    range(n), key=lambda i: (ids[i], hkl[i]), reverse=reverse
+                )
+                assert list(perm) == expected
+    finally:
+        flex.reflection_table.set_nthreads(nthreads)
+
+
+def test_sort_permutation_rejects_non_integer_keys():
+    table = flex.reflection_table()
+    table["id"] = flex.int([2, 0, 1])
+    table["value"] = flex.double([0.5, 0.1, 0.3])
+    with pytest.raises(RuntimeError, match="integer keys"):
+        table.sort_permutation(["value"])
+    with pytest.raises(RuntimeError, match="integer keys"):
+        table.sort_permutation(["id", "value"])
+
+
+def test_hash_join():
+    table1 = flex.reflection_table()
+    table1["miller_index"] = flex.miller_index(
+        [(random.randint(-3, 3), random.randint(-3, 3), 0) for i in range(500)]
+    )
+    table1["id"] = flex.int([random.randint(0, 1) for i in range(500)])
+    table2 = flex.reflection_table()
+    table2["miller_index"] = flex.miller_index(
+        [(random.randint(-3, 3), random.randint(-3, 3), 0) for i in range(300)]
+    )
+    table2["id"] = flex.int([random.randint(0, 1) for i in range(300)])
+
+    index1, index2 = table1.hash_join(table2, ["miller_index", "id"])
+
+    # Compare with a join in Python
+    lookup = {}
+    for j in range(len(table2)):
+        key = table2["miller_index"][j] + (table2["id"][j],)
+        lookup.setdefault(key, []).append(j)
+    expected = []
+    for i in range(len(table1)):
+        key = table1["miller_index"][i] + (table1["id"][i],)
+        expected.extend((i, j) for j in lookup.get(key, []))
+    assert list(zip(index1, index2)) == expected
+
+    # Join on a single component of the Miller index
+    index1, index2 = table1.hash_join(table2, [("miller_index", 0)])
+    for i, j in zip(index1, index2):
+        assert table1["miller_index"][i][0] == table2["miller_index"][j][0]
+
+
+def test_hash_join_rejects_non_integer_keys():
+    table1 = flex.reflection_table()
+    table1["value"] = flex.double([0.5, 0.1, 0.3])
+    table1["name"] = flex.std_string(["a", "b", "c"])
+    table2 = flex.reflection_table()
+    table2["value"] = flex.double([0.1, 0.3])
+    table2["name"] = flex.std_string(["b", "c"])
+    for key in ("value", "name"):
+        with pytest.raises(RuntimeError, match="integer keys"):
+            table1.hash_join(table2, [key])
+
+
+def test_unique_closest_pairs():
+    index_a = flex.size_t([0, 0, 1, 1, 2, 3])
+    index_b = flex.size_t([0, 1, 1, 2, 1, 4])
+    distance = flex.double([2, 1, 0.5, 3, 0.5, 1])
+    match_a, match_b = flex.unique_closest_pairs(index_a, index_b, distance)
+    assert list(match_a) == [1, 3]
+    assert list(match_b) == [1, 4]
+
+
 def test_flags():
     # Create a table with flags all 0
     table = flex.reflection_table()
@@ -847,6 +1155,16 @@ def get_mask(self, index):
                         assert v1 == 0
                         assert m1 == 0
 
+    # Extracting in several threads should give the same pixels
+    threaded = flex.shoebox(reflections["panel"], reflections["bbox"])
+    threaded.allocate()
+    expected = reflections["shoebox"]
+    reflections["shoebox"] = threaded
+    reflections.extract_shoeboxes(imageset, nthreads=4)
+    for s1, s2 in zip(reflections["shoebox"], expected):
+        assert s1.data.all_eq(s2.data)
+        assert s1.mask.all_eq(s2.mask)
+
 
 def test_split_by_experiment_id():
     r = flex.reflection_table()
@@ -1179,6 +1497,217 @@ def compare(a, b):
     assert all(tuple(compare(a, b) for a, b in zip(new_table["col11"], c11)))
 
 
+def test_to_msgpack_file_with_threads(tmpdir):
+    from dials.model.data import Shoebox
+
+    shoebox = Shoebox(0, (0, 4, 0, 3, 0, 2))
+    shoebox.allocate()
+    for i in range(len(shoebox.data)):
+        shoebox.data[i] = i
+        shoebox.mask[i] = i % 3
+
+    table = flex.reflection_table()
+    table["id"] = flex.int(range(20))
+    table["flags"] = flex.size_t(range(20))
+    table["intensity.sum.value"] = flex.double(range(20))
+    table["xyzobs.px.value"] = flex.vec3_double([(i, i, i) for i in range(20)])
+    table["shoebox"] = flex.shoebox([shoebox, Shoebox()] * 10)
+
+    # The output does not depend on the number of threads
+    filename1 = tmpdir.join("single.refl").strpath
+    filename2 = tmpdir.join("threads.refl").strpath
+    table.as_msgpack_file(filename1)
+    table.as_msgpack_file(filename2, nthreads=3)
+    with open(filename1, "rb") as infile1, open(filename2, "rb") as infile2:
+        assert infile1.read() == infile2.read()
+
+    new_table = flex.reflection_table.from_file(filename2)
+    assert new_table.nrows() == 20
+    assert list(new_table["xyzobs.px.value"]) == list(table["xyzobs.px.value"])
+    assert list(new_table["shoebox"][0].data) == list(shoebox.data)
+
+
+def test_to_msgpack_file_with_compressed_shoeboxes(tmpdir):
+    from dials.model.data import Shoebox
+
+    shoeboxes = flex.shoebox()
+    for i in range(10):
+        shoebox = Shoebox(i % 2, (0, 10, 0, 8, 0, 3))
+        shoebox.allocate()
+        for j in range(len(shoebox.data)):
+            shoebox.data[j] = (j * i) % 7 if j % 5 == 0 else 0
+            shoebox.background[j] = 0.5
+            shoebox.mask[j] = 5 if j > 100 else 3
+        shoeboxes.append(shoebox)
+    shoeboxes.append(Shoebox())
+
+    # A mask with values which do not fit in a byte is stored unpacked
+    shoebox = Shoebox(0, (0, 4, 0, 4, 0, 1))
+    shoebox.allocate()
+    shoebox.mask[3] = 1 << 10
+    shoeboxes.append(shoebox)
+
+    table = flex.reflection_table()
+    table["id"] = flex.int(range(12))
+    table["shoebox"] = shoeboxes
+
+    filename1 = tmpdir.join("raw.refl").strpath
+    filename2 = tmpdir.join("compressed.refl").strpath
+    table.as_msgpack_file(filename1)
+    table.as_msgpack_file(filename2, compress_shoeboxes=True)
+    assert os.path.getsize(filename2) < os.path.getsize(filename1)
+
+    for nthreads in (1, 2):
+        table.as_msgpack_file(filename2, nthreads=nthreads, compress_shoeboxes=True)
+        new_table = flex.reflection_table.from_file(filename2)
+        assert new_table.nrows() == 12
+        assert list(new_table["id"]) == list(table["id"])
+        for sbox1, sbox2 in zip(table["shoebox"], new_table["shoebox"]):
+            assert sbox1.panel == sbox2.panel
+            assert sbox1.bbox == sbox2.bbox
+            assert list(sbox1.data) == list(sbox2.data)
+            assert list(sbox1.mask) == list(sbox2.mask)
+            assert list(sbox1.background) == list(sbox2.background)
+
+
+def test_from_msgpack_select_columns(tmpdir):
+    table = flex.reflection_table()
+    table["id"] = flex.int(range(10))
+    table["miller_index"] = flex.miller_index([(i, 0, 0) for i in range(10)])
+    table["intensity.sum.value"] = flex.double(range(10))
+    table["shoebox"] = flex.shoebox(10)
+    table.experiment_identifiers()[0] = "abcd"
+
+    filename = tmpdir.join("reflections.refl").strpath
+    table.as_msgpack_file(filename)
+
+    # Select the columns by name
+    new_table = flex.reflection_table.from_file(
+        filename, columns=["miller_index", "intensity.sum.value"]
+    )
+    assert new_table.nrows() == 10
+    assert sorted(new_table.keys()) == ["intensity.sum.value", "miller_index"]
+    assert list(new_table["miller_index"]) == list(table["miller_index"])
+    assert new_table.experiment_identifiers()[0] == "abcd"
+
+    # Select the columns with a predicate
+    new_table = flex.reflection_table.from_msgpack_file(
+        filename, columns=lambda key: key != "shoebox"
+    )
+    assert sorted(new_table.keys()) == ["id", "intensity.sum.value", "miller_index"]
+
+    # Select no columns
+    new_table = flex.reflection_table.from_msgpack(table.as_msgpack(), [])
+    assert new_table.nrows() == 10
+    assert new_table.ncols() == 0
+
+    # Asking for missing columns is an error
+    with pytest.raises(RuntimeError):
+        flex.reflection_table.from_msgpack_file(filename, columns=["missing"])
+
+
+def test_to_from_mapped_file(tmpdir):
+    from dials.model.data import Shoebox
+
+    shoebox = Shoebox(0, (0, 4, 0, 3, 0, 1))
+    shoebox.allocate()
+    for i in range(len(shoebox.data)):
+        shoebox.data[i] = i + 0.1
+        shoebox.mask[i] = i % 2
+        shoebox.background[i] = i + 0.2
+
+    table = flex.reflection_table()
+    table["col1"] = flex.int(range(10))
+    table["col2"] = flex.double(range(10))
+    table["col3"] = flex.std_string("abcdefghij")
+    table["col4"] = flex.bool([True, False] * 5)
+    table["col5"] = flex.size_t(range(10))
+    table["col6"] = flex.vec2_double([(i + 1, i + 2) for i in range(10)])
+    table["col7"] = flex.vec3_double([(i + 1, i + 2, i + 3) for i in range(10)])
+    table["col8"] = flex.mat3_double(
+        [tuple(i + j for j in range(9)) for i in range(10)]
+    )
+    table["col9"] = flex.int6([tuple(i + j for j in range(6)) for i in range(10)])
+    table["col10"] = flex.miller_index([(i + 1, i + 2, i + 3) for i in range(10)])
+    table["col11"] = flex.shoebox([shoebox] * 10)
+    table.experiment_identifiers()[0] = "abcd"
+
+    filename = tmpdir.join("reflections.refl").strpath
+    table.as_mapped_file(filename)
+    assert flex.reflection_table.is_mapped_file(filename)
+
+    new_table = flex.reflection_table.from_file(filename)
+    assert new_table.is_consistent()
+    assert new_table.nrows() == 10
+    assert new_table.ncols() == 11
+    assert new_table.experiment_identifiers()[0] == "abcd"
+    for key in table.keys():
+        if key == "col11":
+            continue
+        assert list(new_table[key]) == list(table[key])
+    for a, b in zip(new_table["col11"], table["col11"]):
+        assert a.bbox == b.bbox
+        assert list(a.data) == list(b.data)
+        assert list(a.mask) == list(b.mask)
+        assert list(a.background) == list(b.background)
+
+    # Read only some of the columns
+    new_table = flex.reflection_table.from_mapped_file(filename, ["col2", "col7"])
+    assert new_table.nrows() == 10
+    assert sorted(new_table.keys()) == ["col2", "col7"]
+    assert list(new_table["col7"]) == list(table["col7"])
+    with pytest.raises(RuntimeError):
+        flex.reflection_table.from_mapped_file(filename, ["missing"])
+
+    # Tables saved in other formats are not mapped files
+    table.as_msgpack_file(tmpdir.join("reflections.mpack").strpath)
+    assert not flex.reflection_table.is_mapped_file(
+        tmpdir.join("reflections.mpack").strpath
+    )
+
+
+def test_reflection_table_file_writer(tmpdir):
+    tables = []
+    for i in range(3):
+        table = flex.reflection_table()
+        table["id"] = flex.int(5 + i, i)
+        table["a"] = flex.random_double(5 + i)
+        table["s"] = flex.std_string(["x%d" % j for j in range(5 + i)])
+        if i != 1:
+            table["b"] = flex.size_t_range(5 + i)
+        table.experiment_identifiers()[i] = str(i)
+        tables.append(table)
+    expected = flex.reflection_table.concat(tables)
+
+    filename = tmpdir.join("chunked.refl").strpath
+    with flex.reflection_table_file_writer(filename) as writer:
+        for table in tables:
+            writer.append(table)
+        assert writer.nchunks() == 3
+        assert writer.nrows() == 18
+    assert flex.reflection_table.is_mapped_file(filename)
+
+    result = flex.reflection_table.from_file(filename)
+    assert result.nrows() == 18
+    assert sorted(result.keys()) == sorted(expected.keys())
+    for key in expected.keys():
+        assert list(result[key]) == list(expected[key])
+    assert dict(result.experiment_identifiers()) == {0: "0", 1: "1", 2: "2"}
+    result = flex.reflection_table.from_file(filename, ["b"])
+    assert list(result["b"]) == list(expected["b"])
+
+    # The complete chunks of a file which was not closed can be read
+    writer = flex.reflection_table_file_writer(filename)
+    writer.append(tables[0])
+    writer.append(tables[1])
+    with open(filename, "ab") as outfile:
+        outfile.write(b"\x40\x00")
+    result = flex.reflection_table.from_file(filename)
+    assert result.nrows() == 11
+    assert list(result["a"]) == list(tables[0]["a"]) + list(tables[1]["a"])
+    writer.close()
+
+
 def test_experiment_identifiers():
     from dxtbx.model import Experiment, ExperimentList
 
@@ -0,0 +1,559 @@
+/*
+ * bench_kernels.cc
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+
+/**
+ * Benchmarks of the kernels which take most of the time in spot finding and
+ * integration. Each kernel is run over a set of synthetic reflections,
+ * simulated in reciprocal space and mapped onto the detector, for at least
+ * the minimum time, and the throughput is reported in items per second.
+ *
+ * Usage:
+ *   bench_kernels [--filter NAME] [--min-time SECONDS]
+ *                 [--image FILE --width W --height H]
+ *                 [--output FILE] [--baseline FILE] [--tolerance FRACTION]
+ *
+ * The image option reads a raw little endian array of 32 bit integers, for
+ * example an image of a real data set saved with numpy tofile, to use in
+ * place of the synthetic image for the threshold benchmark. The output file
+ * holds one line of the name and the throughput of each benchmark, and can
+ * be given as the baseline of a later run, which then fails if the
+ * throughput of any benchmark falls by more than the tolerance.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/random.hpp>
+#include <boost/shared_ptr.hpp>
+#include <scitbx/constants.h>
+#include <dials/algorithms/simulation/reciprocal_space_helpers.h>
+#include <dials/algorithms/image/threshold/local.h>
+#include <dials/algorithms/profile_model/gaussian_rs/bbox_calculator.h>
+#include <dials/algorithms/profile_model/gaussian_rs/mask_calculator.h>
+#include <dials/algorithms/profile_model/gaussian_rs/transform/transform.h>
+#include <dials/algorithms/integration/fit/fitting.h>
+#include <dials/algorithms/background/simple/creator.h>
+#include <dials/algorithms/background/simple/modeller.h>
+#include <dials/algorithms/background/simple/nsigma_outlier_rejector.h>
+#include <dials/algorithms/background/glm/creator.h>
+
+using dials::algorithms::DispersionThreshold;
+using dials::algorithms::GLMBackgroundCreator;
+using dials::algorithms::ProfileFitter;
+using dials::algorithms::simulate_reciprocal_space_gaussian;
+using dials::algorithms::background::Constant3dModeller;
+using dials::algorithms::background::Modeller;
+using dials::algorithms::background::NSigmaOutlierRejector;
+using dials::algorithms::background::OutlierRejector;
+using dials::algorithms::background::SimpleBackgroundCreator;
+using dials::algorithms::profile_model::gaussian_rs::BBoxCalculator3D;
+using dials::algorithms::profile_model::gaussian_rs::CoordinateSystem;
+using dials::algorithms::profile_model::gaussian_rs::MaskCalculator3D;
+using dials::algorithms::profile_model::gaussian_rs::transform::TransformForward;
+using dials::algorithms::profile_model::gaussian_rs::transform::TransformSpec;
+using dials::model::Foreground;
+using dials::model::Shoebox;
+using dials::model::Valid;
+using dxtbx::model::Beam;
+using dxtbx::model::BeamBase;
+using dxtbx::model::Detector;
+using dxtbx::model::Goniometer;
+using dxtbx::model::Panel;
+using dxtbx::model::Scan;
+using scitbx::vec2;
+using scitbx::vec3;
+using scitbx::af::int2;
+using scitbx::af::int6;
+
+namespace af = scitbx::af;
+
+/**
+ * @returns The elapsed time in seconds since the given time
+ */
+double seconds_since(const boost::posix_time::ptime &start) {
+  return (boost::posix_time::microsec_clock::universal_time() - start)
+           .total_microseconds()
+         / 1e6;
+}
+
+/**
+ * The experiment and the synthetic reflections which the benchmarks run on
+ */
+struct Fixture {
+  boost::shared_ptr<BeamBase> beam;
+  Detector detector;
+  Goniometer goniometer;
+  Scan scan;
+  double sigma_b;
+  double sigma_m;
+  double n_sigma;
+
+  std::vector<vec3<double> > s1;
+  std::vector<double> frame;
+  std::vector<Shoebox<> > shoebox;
+  std::vector<af::versa<double, af::c_grid<3> > > profile;
+
+  af::versa<int, af::c_grid<2> > image;
+  af::versa<bool, af::c_grid<2> > image_mask;
+
+  Fixture(std::size_t num_reflections)
+      : beam(new Beam(vec3<double>(0, 0, -1))),
+        detector(Panel("PAD",
+                       "Panel",
+                       vec3<double>(1, 0, 0),
+                       vec3<double>(0, -1, 0),
+                       vec3<double>(-211.0, 218.0, -200.0),
+                       vec2<double>(0.172, 0.172),
+                       af::tiny<std::size_t, 2>(2463, 2527),
+                       vec2<double>(-1, 1e6),
+                       0.32,
+                       "Si")),
+        goniometer(vec3<double>(1, 0, 0)),
+        scan(vec2<int>(1, 100), vec2<double>(0, 0.2 * scitbx::constants::pi / 180)),
+        sigma_b(0.06 * scitbx::constants::pi / 180),
+        sigma_m(0.1 * scitbx::constants::pi / 180),
+        n_sigma(3) {
+    boost::random::mt19937 gen(0);
+    boost::random::uniform_real_distribution<double> xy(100, 2300);
+    boost::random::uniform_real_distribution<double> z(10, 90);
+    boost::random::uniform_int_distribution<std::size_t> counts(100, 10000);
+    boost::random::poisson_distribution<int> background(1.0);
+
+    BBoxCalculator3D bbox_calculator(
+      *beam, detector, goniometer, scan, n_sigma * sigma_b, n_sigma * sigma_m);
+    MaskCalculator3D mask_calculator(
+      *beam, detector, goniometer, scan, n_sigma * sigma_b, n_sigma * sigma_m);
+    double s0_length = beam->get_s0().length();
+    while (shoebox.size() < num_reflections) {
+      vec2<double> px(xy(gen), xy(gen));
+      vec3<double> s1_i =
+        detector[0].get_pixel_lab_coord(px).normalize() * s0_length;
+      double frame_i = z(gen);
+      double phi = scan.get_angle_from_array_index(frame_i);
+      int6 bbox = bbox_calculator.single(s1_i, frame_i, 0);
+      if (bbox[4] < scan.get_array_range()[0] || bbox[5] > scan.get_array_range()[1]) {
+        continue;
+      }
+
+      // Mask the shoebox then simulate the spot, once with noise and once
+      // with many counts for the reference profile
+      Shoebox<> sbox(0, bbox);
+      sbox.allocate_with_value(Valid);
+      mask_calculator.single(sbox, s1_i, frame_i, 0);
+      af::versa<double, af::c_grid<3> > data(sbox.data.accessor(), 0);
+      af::versa<double, af::c_grid<3> > ref(sbox.data.accessor(), 0);
+      simulate_reciprocal_space_gaussian(*beam,
+                                         detector,
+                                         goniometer,
+                                         scan,
+                                         sigma_b,
+                                         sigma_m,
+                                         s1_i,
+                                         phi,
+                                         bbox,
+                                         counts(gen),
+                                         data.ref(),
+                                         sbox.mask.const_ref());
+      simulate_reciprocal_space_gaussian(*beam,
+                                         detector,
+                                         goniometer,
+                                         scan,
+                                         sigma_b,
+                                         sigma_m,
+                                         s1_i,
+                                         phi,
+                                         bbox,
+                                         100000,
+                                         ref.ref(),
+                                         sbox.mask.const_ref());
+      double total = 0;
+      for (std::size_t i = 0; i < ref.size(); ++i) {
+        total += ref[i];
+      }
+      if (total <= 0) {
+        continue;
+      }
+      for (std::size_t i = 0; i < ref.size(); ++i) {
+        ref[i] /= total;
+      }
+      for (std::size_t i = 0; i < data.size(); ++i) {
+        sbox.data[i] = (float)(data[i] + background(gen));
+        sbox.background[i] = 1.0;
+      }
+      s1.push_back(s1_i);
+      frame.push_back(frame_i);
+      shoebox.push_back(sbox);
+      profile.push_back(ref);
+    }
+
+    // A synthetic image of background with the spots summed over frames
+    af::tiny<std::size_t, 2> image_size = detector[0].get_image_size();
+    af::c_grid<2> grid(image_size[1], image_size[0]);
+    image = af::versa<int, af::c_grid<2> >(grid, 0);
+    image_mask = af::versa<bool, af::c_grid<2> >(grid, true);
+    for (std::size_t i = 0; i < image.size(); ++i) {
+      image[i] = background(gen);
+    }
+    for (std::size_t i = 0; i < shoebox.size(); ++i) {
+      const Shoebox<> &sbox = shoebox[i];
+      for (std::size_t k = 0; k < sbox.zsize(); ++k) {
+        for (std::size_t j = 0; j < sbox.ysize(); ++j) {
+          for (std::size_t l = 0; l < sbox.xsize(); ++l) {
+            image(sbox.bbox[2] + j, sbox.bbox[0] + l) += (int)sbox.data(k, j, l);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Replace the image with one read from a file of 32 bit integers
+   */
+  void read_image(const std::string &filename, std::size_t width, std::size_t height) {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file) {
+      throw std::runtime_error("Unable to open " + filename);
+    }
+    af::c_grid<2> grid(height, width);
+    std::vector<boost::int32_t> buffer(grid.size_1d());
+    file.read(reinterpret_cast<char *>(&buffer[0]),
+              buffer.size() * sizeof(boost::int32_t));
+    if (file.gcount() != (std::streamsize)(buffer.size() * sizeof(boost::int32_t))) {
+      throw std::runtime_error("Not enough data in " + filename);
+    }
+    image = af::versa<int, af::c_grid<2> >(grid, 0);
+    image_mask = af::versa<bool, af::c_grid<2> >(grid, true);
+    for (std::size_t i = 0; i < buffer.size(); ++i) {
+      image[i] = buffer[i];
+      image_mask[i] = buffer[i] >= 0;
+    }
+  }
+};
+
+/**
+ * The base class of a benchmark. A single run processes all the items of the
+ * fixture once and returns the number of items processed.
+ */
+class Benchmark {
+public:
+  virtual ~Benchmark() {}
+  virtual std::string name() const = 0;
+  virtual std::string unit() const = 0;
+  virtual std::size_t run(Fixture &fixture) = 0;
+};
+
+class DispersionThresholdBenchmark : public Benchmark {
+public:
+  std::string name() const {
+    return "dispersion_threshold";
+  }
+
+  std::string unit() const {
+    return "pixels";
+  }
+
+  std::size_t run(Fixture &fixture) {
+    af::c_grid<2> grid = fixture.image.accessor();
+    if (algorithm_.get() == NULL) {
+      algorithm_.reset(
+        new DispersionThreshold(int2(grid[1], grid[0]), int2(3, 3), 6, 3, 0, 2));
+      result_ = af::versa<bool, af::c_grid<2> >(grid, false);
+    }
+    algorithm_->threshold(
+      fixture.image.const_ref(), fixture.image_mask.const_ref(), result_.ref());
+    return grid.size_1d();
+  }
+
+private:
+  boost::shared_ptr<DispersionThreshold> algorithm_;
+  af::versa<bool, af::c_grid<2> > result_;
+};
+
+class MaskCalculatorBenchmark : public Benchmark {
+public:
+  std::string name() const {
+    return "gaussian_rs_mask_calculator";
+  }
+
+  std::string unit() const {
+    return "reflections";
+  }
+
+  std::size_t run(Fixture &fixture) {
+    MaskCalculator3D calculator(*fixture.beam,
+                                fixture.detector,
+                                fixture.goniometer,
+                                fixture.scan,
+                                fixture.n_sigma * fixture.sigma_b,
+                                fixture.n_sigma * fixture.sigma_m);
+    for (std::size_t i = 0; i < fixture.shoebox.size(); ++i) {
+      calculator.single(fixture.shoebox[i], fixture.s1[i], fixture.frame[i], 0);
+    }
+    return fixture.shoebox.size();
+  }
+};
+
+class TransformForwardBenchmark : public Benchmark {
+public:
+  std::string name() const {
+    return "transform_forward";
+  }
+
+  std::string unit() const {
+    return "reflections";
+  }
+
+  std::size_t run(Fixture &fixture) {
+    TransformSpec spec(fixture.beam,
+                       fixture.detector,
+                       fixture.goniometer,
+                       fixture.scan,
+                       fixture.sigma_b,
+                       fixture.sigma_m,
+                       fixture.n_sigma,
+                       5);
+    vec3<double> s0 = fixture.beam->get_s0();
+    vec3<double> m2 = fixture.goniometer.get_rotation_axis();
+    for (std::size_t i = 0; i < fixture.shoebox.size(); ++i) {
+      const Shoebox<> &sbox = fixture.shoebox[i];
+      double phi = fixture.scan.get_angle_from_array_index(fixture.frame[i]);
+      CoordinateSystem cs(m2, s0, fixture.s1[i], phi);
+      af::versa<bool, af::c_grid<3> > mask(sbox.mask.accessor(), false);
+      for (std::size_t j = 0; j < mask.size(); ++j) {
+        mask[j] = (sbox.mask[j] & Foreground) != 0;
+      }
+      TransformForward<float> transform(spec,
+                                        cs,
+                                        sbox.bbox,
+                                        0,
+                                        sbox.data.const_ref(),
+                                        sbox.background.const_ref(),
+                                        mask.const_ref());
+    }
+    return fixture.shoebox.size();
+  }
+};
+
+class ProfileFitterBenchmark : public Benchmark {
+public:
+  std::string name() const {
+    return "profile_fitter";
+  }
+
+  std::string unit() const {
+    return "reflections";
+  }
+
+  std::size_t run(Fixture &fixture) {
+    for (std::size_t i = 0; i < fixture.shoebox.size(); ++i) {
+      const Shoebox<> &sbox = fixture.shoebox[i];
+      std::size_t n = sbox.data.size();
+      af::shared<double> d(n), b(n);
+      af::shared<bool> m(n);
+      for (std::size_t j = 0; j < n; ++j) {
+        d[j] = sbox.data[j];
+        b[j] = sbox.background[j];
+        m[j] = (sbox.mask[j] & Foreground) != 0;
+      }
+      try {
+        ProfileFitter<double> fit(d.const_ref(),
+                                  b.const_ref(),
+                                  m.const_ref(),
+                                  fixture.profile[i].as_1d().const_ref(),
+                                  1e-3,
+                                  100);
+      } catch (dials::error) {
+        // Reflections which fail to fit are still counted
+      }
+    }
+    return fixture.shoebox.size();
+  }
+};
+
+class SimpleBackgroundBenchmark : public Benchmark {
+public:
+  std::string name() const {
+    return "simple_background_creator";
+  }
+
+  std::string unit() const {
+    return "reflections";
+  }
+
+  std::size_t run(Fixture &fixture) {
+    SimpleBackgroundCreator creator(
+      boost::shared_ptr<Modeller>(new Constant3dModeller()),
+      boost::shared_ptr<OutlierRejector>(new NSigmaOutlierRejector(3, 3)),
+      10);
+    for (std::size_t i = 0; i < fixture.shoebox.size(); ++i) {
+      Shoebox<> &sbox = fixture.shoebox[i];
+      try {
+        creator(sbox.data.const_ref(), sbox.mask.ref(), sbox.background.ref());
+      } catch (dials::error) {
+        // Reflections which fail are still counted
+      }
+    }
+    return fixture.shoebox.size();
+  }
+};
+
+class GLMBackgroundBenchmark : public Benchmark {
+public:
+  std::string name() const {
+    return "glm_background_creator";
+  }
+
+  std::string unit() const {
+    return "reflections";
+  }
+
+  std::size_t run(Fixture &fixture) {
+    GLMBackgroundCreator creator(GLMBackgroundCreator::Constant3d, 1.345, 100, 10);
+    for (std::size_t i = 0; i < fixture.shoebox.size(); ++i) {
+      try {
+        creator.single(fixture.shoebox[i]);
+      } catch (dials::error) {
+        // Reflections which fail are still counted
+      }
+    }
+    return fixture.shoebox.size();
+  }
+};
+
+/**
+ * Read the throughput of each benchmark from a results file. Lines starting
+ * with a # are comments.
+ */
+std::map<std::string, double> read_results(const std::string &filename) {
+  std::map<std::string, double> results;
+  std::ifstream file(filename.c_str());
+  if (!file) {
+    throw std::runtime_error("Unable to open " + filename);
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream stream(line);
+    std::string name;
+    double value = 0;
+    if (stream >> name >> value) {
+      results[name] = value;
+    }
+  }
+  return results;
+}
+
+int main(int argc, char *argv[]) {
+  std::string filter, image_file, output_file, baseline_file;
+  std::size_t width = 0, height = 0, num_reflections = 1000;
+  double min_time = 1.0;
+  double tolerance = 0.2;
+  for (int i = 1; i < argc; ++i) {
+    std::string option = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << option << std::endl;
+      return 2;
+    }
+    std::string value = argv[++i];
+    if (option == "--filter") {
+      filter = value;
+    } else if (option == "--min-time") {
+      min_time = std::atof(value.c_str());
+    } else if (option == "--reflections") {
+      num_reflections = std::atoi(value.c_str());
+    } else if (option == "--image") {
+      image_file = value;
+    } else if (option == "--width") {
+      width = std::atoi(value.c_str());
+    } else if (option == "--height") {
+      height = std::atoi(value.c_str());
+    } else if (option == "--output") {
+      output_file = value;
+    } else if (option == "--baseline") {
+      baseline_file = value;
+    } else if (option == "--tolerance") {
+      tolerance = std::atof(value.c_str());
+    } else {
+      std::cerr << "Unknown option " << option << std::endl;
+      return 2;
+    }
+  }
+
+  std::map<std::string, double> baseline;
+  if (!baseline_file.empty()) {
+    baseline = read_results(baseline_file);
+  }
+
+  // Create the fixture
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+  Fixture fixture(num_reflections);
+  if (!image_file.empty()) {
+    fixture.read_image(image_file, width, height);
+  }
+  std::cout << "Created " << fixture.shoebox.size() << " reflections in "
+            << seconds_since(start) << " s" << std::endl;
+
+  std::vector<boost::shared_ptr<Benchmark> > benchmarks;
+  benchmarks.push_back(boost::shared_ptr<Benchmark>(new DispersionThresholdBenchmark));
+  benchmarks.push_back(boost::shared_ptr<Benchmark>(new MaskCalculatorBenchmark));
+  benchmarks.push_back(boost::shared_ptr<Benchmark>(new TransformForwardBenchmark));
+  benchmarks.push_back(boost::shared_ptr<Benchmark>(new ProfileFitterBenchmark));
+  benchmarks.push_back(boost::shared_ptr<Benchmark>(new SimpleBackgroundBenchmark));
+  benchmarks.push_back(boost::shared_ptr<Benchmark>(new GLMBackgroundBenchmark));
+
+  // Run each benchmark once to warm up, then repeatedly for the minimum time
+  std::ostringstream output;
+  output << "# benchmark items_per_second" << std::endl;
+  int status = 0;
+  for (std::size_t i = 0; i < benchmarks.size(); ++i) {
+    Benchmark &benchmark = *benchmarks[i];
+    if (benchmark.name().find(filter) == std::string::npos) {
+      continue;
+    }
+    benchmark.run(fixture);
+    std::size_t items = 0, runs = 0;
+    double elapsed = 0;
+    start = boost::posix_time::microsec_clock::universal_time();
+    while (runs == 0 || elapsed < min_time) {
+      items += benchmark.run(fixture);
+      runs += 1;
+      elapsed = seconds_since(start);
+    }
+    double rate = items / elapsed;
+    std::cout << std::left << std::setw(30) << benchmark.name() << std::right
+              << std::setw(14) << std::setprecision(6) << rate << " "
+              << benchmark.unit() << "/s" << std::setw(8) << runs << " runs";
+    std::map<std::string, double>::const_iterator it = baseline.find(benchmark.name());
+    if (it != baseline.end() && it->second > 0) {
+      double ratio = rate / it->second;
+      std::cout << std::setw(10) << std::setprecision(3) << ratio << "x baseline";
+      if (ratio < 1.0 - tolerance) {
+        std::cout << " REGRESSION";
+        status = 1;
+      }
+    }
+    std::cout << std::endl;
+    output << benchmark.name() << " " << std::setprecision(9) << rate << std::endl;
+  }
+
+  if (!output_file.empty()) {
+    std::ofstream file(output_file.c_str());
+    file << output.str();
+  }
+  return status;
+}
@@ -0,0 +1,47 @@
+import json
+
+import pytest
+
+from dials.command_line import benchmark_pipeline
+
+
+def test_summarise():
+    runs = [
+        {"nproc": 1, "repeat": 0, "stages": {"index": _result(10.0)}},
+        {"nproc": 1, "repeat": 1, "stages": {"index": _result(8.0)}},
+        {"nproc": 4, "repeat": 0, "stages": {"index": _result(4.0)}},
+        {"nproc": 4, "repeat": 1, "stages": {"index": _result(1.0, returncode=1)}},
+    ]
+    summary = benchmark_pipeline.summarise(runs)
+    assert summary["index"][1]["wall_time"] == 8.0
+    assert summary["index"][4]["wall_time"] == 4.0
+    assert summary["index"][4]["speedup"] == pytest.approx(2.0)
+    assert summary["index"][4]["efficiency"] == pytest.approx(0.5)
+
+
+def _result(wall_time, returncode=0):
+    return {
+        "returncode": returncode,
+        "wall_time": wall_time,
+        "cpu_time": wall_time,
+        "max_rss": 0,
+    }
+
+
+def test_benchmark_pipeline(dials_data, run_in_tmpdir):
+    images = dials_data("centroid_test_data").listdir("centroid*.cbf")
+    benchmark_pipeline.run(
+        [image.strpath for image in images]
+        + ["nproc=1,2", "stages=find_spots", "output.json=benchmark.json"]
+    )
+    with open("benchmark.json") as fh:
+        results = json.load(fh)
+    assert [run["nproc"] for run in results["runs"]] == [1, 2]
+    for run in results["runs"]:
+        assert set(run["stages"]) == {"import", "find_spots"}
+        for stage in run["stages"].values():
+            assert stage["returncode"] == 0
+            assert stage["wall_time"] > 0
+            assert stage["max_rss"] > 0
+    assert set(results["summary"]["find_spots"]) == {"1", "2"}
+    assert run_in_tmpdir.join("benchmark", "nproc_2", "repeat_0", "strong.refl").check()
@@ -37,6 +37,25 @@ def test_export_multiple_bitmaps(dials_data, tmpdir):
         assert tmpdir.join("variance_000%i.png" % i).check(file=1)
 
 
+def test_export_multiple_bitmaps_in_parallel(dials_data, tmpdir):
+    serial = tmpdir.mkdir("serial")
+    parallel = tmpdir.mkdir("parallel")
+    for nproc, directory in ((1, serial), (3, parallel)):
+        result = procrunner.run(
+            [
+                "dials.export_bitmaps",
+                dials_data("centroid_test_data").join("experiments.json").strpath,
+                "nproc=%i" % nproc,
+            ],
+            working_directory=directory.strpath,
+        )
+        assert not result.returncode and not result.stderr
+
+    for i in range(1, 8):
+        name = "image000%i.png" % i
+        assert parallel.join(name).read_binary() == serial.join(name).read_binary()
+
+
 def test_export_bitmap_with_prefix_and_no_padding(dials_data, tmpdir):
     result = procrunner.run(
         [
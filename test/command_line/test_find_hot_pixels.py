@@ -2,6 +2,23 @@
 
 import procrunner
 
+from dials.array_family import flex
+from dials.command_line.find_hot_pixels import filter_reflections
+
+
+def test_filter_reflections():
+    reflections = flex.reflection_table()
+    reflections["bbox"] = flex.int6(
+        [
+            (10, 11, 20, 21, 0, 5),
+            (30, 32, 40, 42, 1, 3),
+            (50, 51, 60, 61, 0, 5),
+            (70, 71, 80, 81, 0, 4),
+        ]
+    )
+    assert filter_reflections(reflections, 5) == [(10, 20), (50, 60)]
+    assert filter_reflections(reflections, 2) == [(30, 40)]
+
 
 def test(dials_data, tmpdir):
     images = dials_data("centroid_test_data").listdir("centroid*.cbf")
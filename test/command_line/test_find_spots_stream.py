@@ -0,0 +1,66 @@
+import json
+import threading
+
+import pytest
+
+from dxtbx.model.experiment_list import ExperimentListFactory
+
+from dials.command_line import find_spots_stream
+
+
+def _send_series(socket, imageset):
+    """Send the images of an imageset in the DECTRIS stream format"""
+    socket.send_json({"htype": "dheader-1.0", "series": 1, "header_detail": "none"})
+    for i in range(len(imageset)):
+        data = imageset.get_raw_data(i)[0].as_numpy_array().astype("uint32")
+        height, width = data.shape
+        socket.send_multipart(
+            [
+                json.dumps({"htype": "dimage-1.0", "series": 1, "frame": i}).encode(),
+                json.dumps(
+                    {
+                        "htype": "dimage_d-1.0",
+                        "shape": [width, height],
+                        "type": "uint32",
+                        "encoding": "<",
+                        "size": data.nbytes,
+                    }
+                ).encode(),
+                data.tobytes(),
+                json.dumps({"htype": "dconfig-1.0"}).encode(),
+            ]
+        )
+    socket.send_json({"htype": "dseries_end-1.0", "series": 1})
+
+
+def test_find_spots_stream(dials_data, run_in_tmpdir):
+    zmq = pytest.importorskip("zmq")
+
+    filename = dials_data("centroid_test_data").join("experiments.json").strpath
+    imageset = ExperimentListFactory.from_json_file(filename)[0].imageset
+
+    socket = zmq.Context.instance().socket(zmq.PUSH)
+    port = socket.bind_to_random_port("tcp://127.0.0.1")
+    sender = threading.Thread(target=_send_series, args=(socket, imageset))
+    sender.start()
+    try:
+        find_spots_stream.run(
+            [
+                filename,
+                f"endpoint=tcp://127.0.0.1:{port}",
+                "nproc=2",
+                "buffer.block=True",
+                "timeout=30",
+            ]
+        )
+    finally:
+        sender.join()
+        socket.close()
+
+    with open("stream_spots.json") as fh:
+        results = json.load(fh)
+    assert [stats["frame"] for stats in results["frames"]] == list(
+        range(len(imageset))
+    )
+    assert not results["dropped"]
+    assert all(stats["n_spots_total"] > 0 for stats in results["frames"])
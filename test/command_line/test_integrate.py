@@ -161,6 +161,109 @@ def test_basic_threaded_integrate(dials_data, tmp_path):
     assert table.select(table["id"] == 0).size() == 4204
 
 
+def test_threaded_integrate_batch_size(dials_data, tmp_path):
+    """Compare batched and per-reflection jobs in the threaded integrator."""
+
+    expts = dials_data("centroid_test_data") / "indexed.expt"
+    refls = dials_data("centroid_test_data") / "indexed.refl"
+
+    tables = []
+    for batch_size in (1, 16):
+        directory = tmp_path / ("batch_%d" % batch_size)
+        directory.mkdir()
+        result = procrunner.run(
+            [
+                "dials.integrate",
+                "integration.integrator=3d_threaded",
+                "nproc=4",
+                "mp.batch_size=%d" % batch_size,
+                refls,
+                expts,
+            ],
+            working_directory=directory,
+        )
+        assert not result.returncode and not result.stderr
+        tables.append(flex.reflection_table.from_file(directory / "integrated.refl"))
+
+    # The results must not depend on how the reflections are batched
+    assert tables[0].size() == tables[1].size()
+    assert list(tables[0]["miller_index"]) == list(tables[1]["miller_index"])
+    assert tables[0]["intensity.sum.value"].all_approx_equal(
+        tables[1]["intensity.sum.value"]
+    )
+
+
+def test_threaded_integrate_single_pass(dials_data, tmp_path):
+    """Compare the single pass threaded integrator with the two pass one."""
+
+    expts = dials_data("centroid_test_data") / "indexed.expt"
+    refls = dials_data("centroid_test_data") / "indexed.refl"
+
+    tables = []
+    for single_pass in (False, True):
+        directory = tmp_path / ("single_pass_%s" % single_pass)
+        directory.mkdir()
+        result = procrunner.run(
+            [
+                "dials.integrate",
+                "integration.integrator=3d_threaded",
+                "nproc=2",
+                "block.size=9",
+                "block.units=frames",
+                "profile.single_pass=%s" % single_pass,
+                refls,
+                expts,
+            ],
+            working_directory=directory,
+        )
+        assert not result.returncode and not result.stderr
+        tables.append(flex.reflection_table.from_file(directory / "integrated.refl"))
+
+    # The summation does not depend on when the profiles are fitted
+    assert tables[0].size() == tables[1].size()
+    assert list(tables[0]["miller_index"]) == list(tables[1]["miller_index"])
+    assert tables[0]["intensity.sum.value"].all_approx_equal(
+        tables[1]["intensity.sum.value"]
+    )
+    fitted = tables[1].get_flags(tables[1].flags.integrated_prf)
+    assert fitted.count(True) > 0
+
+
+def test_threaded_integrate_reference_profiles(dials_data, tmp_path):
+    """Compare reference profiles accumulated on one and on several threads."""
+
+    expts = dials_data("centroid_test_data") / "indexed.expt"
+    refls = dials_data("centroid_test_data") / "indexed.refl"
+
+    tables = []
+    for nproc in (1, 4):
+        directory = tmp_path / ("nproc_%d" % nproc)
+        directory.mkdir()
+        result = procrunner.run(
+            [
+                "dials.integrate",
+                "integration.integrator=3d_threaded",
+                "nproc=%d" % nproc,
+                refls,
+                expts,
+            ],
+            working_directory=directory,
+        )
+        assert not result.returncode and not result.stderr
+        tables.append(flex.reflection_table.from_file(directory / "integrated.refl"))
+
+    # The profiles merged from each thread are those of a single thread, so the
+    # profile fitted intensities are the same
+    assert tables[0].size() == tables[1].size()
+    assert list(tables[0]["miller_index"]) == list(tables[1]["miller_index"])
+    fitted = [t.get_flags(t.flags.integrated_prf) for t in tables]
+    assert list(fitted[0]) == list(fitted[1])
+    assert fitted[0].count(True) > 0
+    assert tables[0]["intensity.prf.value"].all_approx_equal(
+        tables[1]["intensity.prf.value"], 1e-6
+    )
+
+
 def test_basic_integrate_output_integrated_only(dials_data, tmpdir):
 
     exp = load.experiment_list(
@@ -53,3 +53,26 @@ def test_masked(dials_data, tmpdir):
     m = ccp4_map.map_reader(file_name=tmpdir.join("junk.ccp4").strpath)
 
     assert m.header_max == pytest.approx(6330.33350)
+
+
+def test_rs_mapper_nproc_single_precision(dials_data, tmpdir):
+    result = procrunner.run(
+        [
+            "dials.rs_mapper",
+            dials_data("centroid_test_data").join("datablock.json").strpath,
+            'map_file="junk.ccp4"',
+            "nproc=4",
+            "single_precision=True",
+        ],
+        working_directory=tmpdir.strpath,
+    )
+    assert not result.returncode and not result.stderr
+    assert tmpdir.join("junk.ccp4").check()
+
+    from iotbx import ccp4_map
+    from scitbx.array_family import flex
+
+    m = ccp4_map.map_reader(file_name=tmpdir.join("junk.ccp4").strpath)
+    assert len(m.data) == 7189057
+    assert flex.max(m.data) == pytest.approx(2052.75)
+    assert flex.mean(m.data) == pytest.approx(0.018905939534306526, abs=1e-6)
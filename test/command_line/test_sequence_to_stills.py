@@ -1,11 +1,17 @@
 from __future__ import absolute_import, division, print_function
 
 import os
+import random
 
 import procrunner
 
 from dxtbx.model.experiment_list import ExperimentListFactory
 
+from dials.algorithms.shoebox import MaskCode
+from dials.array_family import flex
+from dials.command_line.sequence_to_stills import _split_into_stills
+from dials.model.data import Shoebox
+
 
 def test_sequence_to_stills(dials_regression, tmpdir):
     path = os.path.join(
@@ -33,3 +39,56 @@ def test_sequence_to_stills(dials_regression, tmpdir):
         tmpdir.join("stills.expt").strpath, check_format=False
     )
     assert len(experiments) == 10
+
+
+def test_split_into_stills():
+    bboxes = [(0, 4, 0, 3, 2, 5), (10, 13, 10, 14, 0, 2), (5, 8, 5, 7, 3, 4)]
+    shoeboxes = flex.shoebox()
+    for bbox in bboxes:
+        shoebox = Shoebox(0, bbox)
+        shoebox.allocate()
+        data = flex.float(random.uniform(0, 10) for _ in range(len(shoebox.data)))
+        data.reshape(shoebox.data.accessor())
+        shoebox.data = data
+        shoebox.mask = flex.int(
+            shoebox.mask.accessor(), MaskCode.Valid | MaskCode.Foreground
+        )
+        shoeboxes.append(shoebox)
+
+    reflections = flex.reflection_table()
+    reflections["id"] = flex.int(3, 0)
+    reflections["imageset_id"] = flex.int(3, 0)
+    reflections["panel"] = flex.size_t(3, 0)
+    reflections["miller_index"] = flex.miller_index([(1, 0, 0), (0, 1, 0), (0, 0, 1)])
+    reflections["bbox"] = flex.int6(bboxes)
+    reflections["shoebox"] = shoeboxes
+    reflections["intensity.sum.value"] = flex.double(3)
+    reflections["xyzobs.px.value"] = flex.vec3_double(3)
+    keys = list(reflections.keys())
+
+    slices = _split_into_stills(reflections, keys, 1, 4, 7)
+
+    # The slices on images 1, 2 and 3, ordered by image
+    assert list(slices["id"]) == [7, 8, 9, 9]
+    assert list(slices["imageset_id"]) == [7, 8, 9, 9]
+    assert list(slices["panel"]) == [0, 0, 0, 0]
+    assert list(slices["bbox"]) == [
+        (10, 13, 10, 14, 0, 1),
+        (0, 4, 0, 3, 0, 1),
+        (0, 4, 0, 3, 0, 1),
+        (5, 8, 5, 7, 0, 1),
+    ]
+    for z, i, sliced in zip((1, 2, 3, 3), (1, 0, 0, 2), slices.rows()):
+        assert sliced["miller_index"] == reflections["miller_index"][i]
+        assert sliced["shoebox"].bbox == sliced["bbox"]
+        shoebox = shoeboxes[i]
+        start = z - shoebox.bbox[4]
+        expected = Shoebox(0, sliced["bbox"])
+        expected.data = shoebox.data[start : start + 1, :, :]
+        expected.background = shoebox.background[start : start + 1, :, :]
+        expected.mask = shoebox.mask[start : start + 1, :, :]
+        assert list(sliced["shoebox"].data) == list(expected.data)
+        intensity = expected.summed_intensity()
+        assert sliced["intensity.sum.value"] == intensity.observed.value
+        centroid = expected.centroid_foreground_minus_background()
+        assert sliced["xyzobs.px.value"] == centroid.px.position
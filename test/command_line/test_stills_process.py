@@ -12,9 +12,30 @@
 from libtbx.phil import parse
 
 from dials.array_family import flex
+from dials.command_line import stills_process
 from dials.command_line.stills_process import Processor, phil_scope
 
 
+@pytest.mark.parametrize("depth", [0, 1, 3])
+def test_prefetch_imports(monkeypatch, depth):
+    imported = []
+
+    def fake_import(filename, load_models=True):
+        imported.append(filename)
+        return "experiments of %s" % filename
+
+    monkeypatch.setattr(stills_process, "do_import", fake_import)
+    monkeypatch.setattr(stills_process, "_import_and_read", fake_import)
+
+    filenames = ["image_%d.cbf" % i for i in range(10)]
+    results = stills_process.prefetch_imports(filenames, depth)
+    for i, experiments in enumerate(results):
+        assert experiments == "experiments of %s" % filenames[i]
+        # No more than depth files are imported ahead of the caller
+        assert len(imported) <= i + 1 + depth
+    assert imported == filenames
+
+
 def test_cspad_cbf_in_memory(dials_regression, run_in_tmpdir):
     # Check the data files for this test exist
     image_path = os.path.join(
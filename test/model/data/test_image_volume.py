@@ -0,0 +1,43 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+
+def test_multi_panel_image_volume_set_image():
+    from dials.array_family import flex
+    from dials.model.data import ImageVolume, MultiPanelImageVolume, make_image
+
+    height, width = 20, 30
+    frame0, frame1 = 10, 13
+    volume = MultiPanelImageVolume()
+    for panel in range(4):
+        volume.add(ImageVolume(frame0, frame1, height, width))
+    assert len(volume) == 4
+
+    # Set the images, with the panels split across threads
+    images = []
+    for frame in range(frame0, frame1):
+        data = []
+        mask = []
+        for panel in range(4):
+            d = flex.double([random.uniform(0, 100) for i in range(height * width)])
+            d.reshape(flex.grid(height, width))
+            m = flex.bool([random.random() < 0.9 for i in range(height * width)])
+            m.reshape(flex.grid(height, width))
+            data.append(d)
+            mask.append(m)
+        images.append((data, mask))
+        volume.set_image(frame, make_image(tuple(data), tuple(mask)), nthreads=3)
+
+    # Check each panel holds its own images
+    for panel in range(4):
+        v = volume.get(panel)
+        assert v.is_consistent()
+        for k, (data, mask) in enumerate(images):
+            bbox = (0, width, 0, height, frame0 + k, frame0 + k + 1)
+            result = v.extract_data(bbox).as_double()
+            assert list(result) == pytest.approx(list(data[panel]), abs=1e-4)
+            valid = v.extract_mask(bbox, 0).as_1d() != 0
+            assert list(valid) == list(mask[panel].as_1d())
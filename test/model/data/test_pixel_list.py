@@ -178,3 +178,28 @@ def test_with_no_points():
     assert len(coords) == 0
     assert len(labels1) == 0
     assert len(labels2) == 0
+
+
+def test_label_numbering():
+    from scitbx.array_family import flex
+
+    from dials.model.data import PixelList, PixelListLabeller
+
+    # Two separate spots on the first frame, the second of which extends onto
+    # the next frame. Labels are numbered in order of the first pixel.
+    size = (10, 10)
+    masks = [flex.bool(flex.grid(size), False) for i in range(2)]
+    masks[0][1, 1] = True
+    masks[0][1, 2] = True
+    masks[0][5, 5] = True
+    masks[0][6, 5] = True
+    masks[1][6, 5] = True
+    masks[1][8, 8] = True
+
+    labeller = PixelListLabeller()
+    for i, mask in enumerate(masks):
+        image = flex.double(flex.grid(size), 1)
+        labeller.add(PixelList(i, image, mask))
+
+    assert list(labeller.labels_3d()) == [0, 0, 1, 1, 1, 2]
+    assert list(labeller.labels_2d()) == [0, 0, 1, 1, 2, 3]
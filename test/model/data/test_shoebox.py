@@ -266,6 +266,22 @@ def test_centroid_masked():
         assert abs(matrix.col(centroid.px.position) - matrix.col(XC)) < 1.0
 
 
+def test_flex_centroid_threaded():
+    from dials.array_family import flex
+
+    shoeboxes = flex.shoebox()
+    for shoebox, (XC, I) in random_shoeboxes(10, mask=True):
+        shoebox.background = flex.real(shoebox.data.accessor(), 0.5)
+        shoeboxes.append(shoebox)
+    for name in ("centroid_valid", "centroid_foreground_minus_background"):
+        expected = [getattr(s, name)() for s in shoeboxes]
+        centroids = getattr(shoeboxes, name)(nthreads=3)
+        for c, e in zip(centroids, expected):
+            assert c.px.position == e.px.position
+            assert c.px.variance == e.px.variance
+            assert c.px.std_err_sq == e.px.std_err_sq
+
+
 def test_summed_intensity():
     for shoebox, (XC, I) in random_shoeboxes(10):
         intensity = shoebox.summed_intensity()
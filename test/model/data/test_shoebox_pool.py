@@ -0,0 +1,140 @@
+from __future__ import absolute_import, division, print_function
+
+import random
+
+import pytest
+
+
+def test_shoebox_pool():
+    from dials.array_family import flex
+    from dials.model.data import Shoebox, ShoeboxPool
+
+    shoeboxes = flex.shoebox()
+    for i in range(20):
+        x0 = random.randint(0, 90)
+        y0 = random.randint(0, 90)
+        z0 = random.randint(0, 90)
+        x1 = random.randint(1, 10) + x0
+        y1 = random.randint(1, 10) + y0
+        z1 = random.randint(1, 10) + z0
+        shoebox = Shoebox(i % 3, (x0, x1, y0, y1, z0, z1))
+        shoebox.allocate()
+        for j in range(len(shoebox.data)):
+            shoebox.data[j] = random.uniform(0, 100)
+            shoebox.mask[j] = random.randint(0, 15)
+            shoebox.background[j] = random.uniform(0, 10)
+        shoeboxes.append(shoebox)
+
+    # The pixels should all be held in one slab of each type
+    pool = ShoeboxPool(shoeboxes)
+    assert len(pool) == len(shoeboxes)
+    assert pool.is_allocated()
+    assert pool.num_pixels() == sum(len(s.data) for s in shoeboxes)
+    assert len(pool.data()) == pool.num_pixels()
+    for i, shoebox in enumerate(shoeboxes):
+        n = len(shoebox.data)
+        assert pool.offset(i + 1) - pool.offset(i) == n
+        assert list(pool.mask()[pool.offset(i) : pool.offset(i) + n]) == list(
+            shoebox.mask
+        )
+
+    # The packed masks should count the same mask values as the shoeboxes
+    for code in (1, 3, 4, 12):
+        assert list(pool.count_mask_values(code)) == list(
+            shoeboxes.count_mask_values(code)
+        )
+
+    # Copying the shoeboxes back out should give the same shoeboxes
+    for shoebox, copied in zip(shoeboxes, pool.shoeboxes()):
+        assert copied.panel == shoebox.panel
+        assert copied.bbox == shoebox.bbox
+        assert copied.is_consistent()
+        assert list(copied.data) == list(shoebox.data)
+        assert list(copied.mask) == list(shoebox.mask)
+        assert list(copied.background) == list(shoebox.background)
+
+    pool.deallocate()
+    assert not pool.is_allocated()
+    assert not pool.shoebox(0).is_allocated()
+
+
+def test_shoebox_pool_from_bbox():
+    from dials.algorithms.shoebox import MaskCode
+    from dials.array_family import flex
+    from dials.model.data import ShoeboxPool
+
+    panel = flex.size_t([0, 1])
+    bbox = flex.int6([(0, 2, 0, 3, 0, 4), (10, 15, 10, 11, 0, 2)])
+    pool = ShoeboxPool(panel, bbox, flat=True)
+    assert not pool.is_allocated()
+    assert pool.num_pixels() == 2 * 3 + 5 * 1
+    nbytes = pool.nbytes()
+    pool.allocate(MaskCode.Valid)
+    assert pool.mask().all_eq(MaskCode.Valid)
+    assert pool.nbytes() >= nbytes + pool.num_pixels() * 9
+    shoebox = pool.shoebox(1)
+    assert shoebox.flat
+    assert shoebox.panel == 1
+    assert shoebox.data.all() == (1, 1, 5)
+
+
+def test_shoebox_pool_rejects_unpackable_mask():
+    from dials.array_family import flex
+    from dials.model.data import Shoebox, ShoeboxPool
+
+    # The pool packs the masks into a byte per pixel
+    shoebox = Shoebox(0, (0, 2, 0, 2, 0, 1))
+    shoebox.allocate()
+    shoebox.mask[0] = 1 << 8
+    shoeboxes = flex.shoebox()
+    shoeboxes.append(shoebox)
+    with pytest.raises(RuntimeError):
+        ShoeboxPool(shoeboxes)
+
+
+def test_sum_shoebox_pool():
+    from dials.algorithms.integration.sum import sum_integrate_and_update_table
+    from dials.algorithms.shoebox import MaskCode
+    from dials.array_family import flex
+    from dials.model.data import Shoebox, ShoeboxPool
+
+    codes = [
+        MaskCode.Valid | MaskCode.Foreground,
+        MaskCode.Valid | MaskCode.Background | MaskCode.BackgroundUsed,
+        MaskCode.Valid | MaskCode.Background,
+    ]
+    shoeboxes = flex.shoebox()
+    for i in range(30):
+        shoebox = Shoebox(0, (0, random.randint(1, 8), 0, 5, 0, random.randint(1, 4)))
+        shoebox.allocate()
+        for j in range(len(shoebox.data)):
+            shoebox.data[j] = random.uniform(0, 100)
+            shoebox.background[j] = random.uniform(0, 10)
+            shoebox.mask[j] = random.choice(codes)
+        if i % 5 == 0:
+            shoebox.mask[0] = MaskCode.Foreground
+        shoeboxes.append(shoebox)
+    reflections = flex.reflection_table()
+    reflections["shoebox"] = shoeboxes
+    reflections["flags"] = flex.size_t(len(reflections), 0)
+
+    # The pooled summation should give the same results as the shoeboxes
+    expected = reflections.copy()
+    success = sum_integrate_and_update_table(expected)
+    pool = ShoeboxPool(shoeboxes)
+    result = sum_integrate_and_update_table(reflections, shoebox_pool=pool)
+    assert list(result) == list(success)
+    assert success.count(False) == 6
+    for name in (
+        "intensity.sum.value",
+        "intensity.sum.variance",
+        "background.sum.value",
+        "background.sum.variance",
+        "flags",
+    ):
+        assert list(reflections[name]) == list(expected[name])
+    threaded = reflections.copy()
+    sum_integrate_and_update_table(threaded, shoebox_pool=pool, nthreads=4)
+    assert list(threaded["intensity.sum.value"]) == list(
+        expected["intensity.sum.value"]
+    )
@@ -7,8 +7,10 @@
 
 cpp_tests = [
     # Paths are under /build/
+    "test/algorithms/integration/tst_shared_image_buffer",
     "test/algorithms/spatial_indexing/tst_collision_detection",
     "test/algorithms/spot_prediction/tst_reeke_model",
+    "test/util/tst_thread_limit",
 ]
 
 
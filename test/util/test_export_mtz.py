@@ -99,3 +99,46 @@ def test_calculate_batch_ranges(self):
         assert all(float(x).is_integer() for x in offsets)
         assert all(isinstance(x, int) for x in offsets)
         assert all(x > 0 for x in offsets)
+
+
+def test_mtz_column_writer():
+    import pytest
+    from cctbx import sgtbx
+    from iotbx import mtz
+
+    import dials.util.ext
+    from dials.array_family import flex
+
+    nref = 1000
+    mtz_file = mtz.object()
+    mtz_file.set_space_group_info(sgtbx.space_group_info("P1"))
+    crystal = mtz_file.add_crystal("crystal", "project", (10, 11, 12, 90, 90, 90))
+    dataset = crystal.add_dataset("dataset", 1.0)
+    mtz_file.adjust_column_array_sizes(nref)
+    mtz_file.set_n_reflections(nref)
+
+    batch = flex.int(range(nref))
+    intensity = flex.double(range(nref)) * 0.5
+    variance = flex.double(range(1, nref + 1))
+    xyz = flex.vec3_double([(i, i + 0.25, 0) for i in range(nref)])
+
+    writer = dials.util.ext.MtzColumnWriter(nref)
+    for label, type_ in ("BATCH", "B"), ("I", "J"), ("SIGI", "Q"), ("YDET", "R"):
+        dataset.add_column(label, type_)
+    dataset.add_column("QE", "R")
+    writer.add_int("BATCH", batch)
+    writer.add_double("I", intensity)
+    writer.add_double("SIGI", variance, square_root=True)
+    writer.add_vec3_component("YDET", xyz, 1)
+    writer.add_constant("QE", 1.0)
+    assert len(writer) == 5
+    writer.write(mtz_file, crystal.i_crystal(), dataset.i_dataset(), nthreads=3)
+
+    def values(label):
+        return list(mtz_file.get_column(label).extract_values())
+
+    assert values("BATCH") == list(batch.as_double())
+    assert values("I") == pytest.approx(list(intensity))
+    assert values("SIGI") == pytest.approx(list(flex.sqrt(variance)))
+    assert values("YDET") == pytest.approx([x[1] for x in xyz])
+    assert values("QE") == [1.0] * nref
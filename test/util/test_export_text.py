@@ -0,0 +1,86 @@
+from __future__ import absolute_import, division, print_function
+
+import io
+import random
+
+import pytest
+
+from scitbx import matrix
+
+import dials.util.ext
+from dials.array_family import flex
+
+
+def _psi(UB, axis, s0, phi, hkl):
+    h, k, l = hkl
+    X = (UB * hkl).rotate(axis, phi, deg=True)
+    s = s0 + X
+    g = s.cross(s0).normalize()
+    e = -(s + s0).normalize()
+    if h == k and k == l:
+        u = (h, -h, 0)
+    else:
+        u = (k - l, l - h, h - k)
+    q = (
+        (matrix.col(u).transpose() * UB.inverse())
+        .normalize()
+        .transpose()
+        .rotate(axis, phi, deg=True)
+    )
+    psi = q.angle(g, deg=True)
+    if q.dot(e) < 0:
+        psi *= -1
+    return psi
+
+
+def test_xds_ascii_formatter():
+    random.seed(0)
+    UB = matrix.sqr([random.uniform(-0.1, 0.1) for i in range(9)])
+    axis = matrix.col((1, 0.01, 0.02))
+    s0 = matrix.col((0, 0, -1.02))
+    phi_start, phi_range = 12.5, 0.1
+    formatter = dials.util.ext.XdsAsciiFormatter(UB, axis, s0, phi_start, phi_range)
+
+    n = 50000
+    miller_index = flex.miller_index(
+        [tuple(random.randint(-30, 30) for j in range(3)) for i in range(n)]
+    )
+    miller_index[0] = (3, 3, 3)
+    miller_index[1] = (1, 2, 3)
+    xyzcal = flex.vec3_double(
+        [(random.uniform(0, 2000), random.uniform(0, 2000), i % 20) for i in range(n)]
+    )
+    intensity = flex.random_double(n) * 1000
+    sigma = flex.random_double(n) * 10
+    scl = flex.double(n, 1.0)
+    partiality = flex.double(n, 100.0)
+    correlation = flex.random_double(n) * 100
+
+    # The output does not depend on the number of threads
+    text = []
+    for nthreads in (1, 4):
+        buffer = io.BytesIO()
+        formatter.write(
+            dials.util.ext.streambuf(python_file_obj=buffer),
+            miller_index,
+            intensity,
+            sigma,
+            xyzcal,
+            scl,
+            partiality,
+            correlation,
+            nthreads=nthreads,
+        )
+        text.append(buffer.getvalue().decode("ascii"))
+    assert text[0] == text[1]
+
+    records = text[0].splitlines()
+    assert len(records) == n
+    for i in (0, 1, 2, n // 2, n - 1):
+        tokens = records[i].split()
+        assert tuple(map(int, tokens[:3])) == miller_index[i]
+        assert float(tokens[3]) == pytest.approx(intensity[i], abs=1e-6)
+        phi = phi_start + xyzcal[i][2] * phi_range
+        psi = _psi(UB, axis, s0, phi, miller_index[i])
+        assert float(tokens[-1]) == pytest.approx(psi, abs=1e-6)
+        assert formatter.psi(miller_index[i], xyzcal[i][2]) == pytest.approx(psi)
@@ -111,6 +111,56 @@ def test_filter_shadowed_reflections(dials_regression):
         assert shadowed.count(False) == 674
 
 
+def test_goniometer_shadow_masks():
+    from dxtbx.masking import is_inside_polygon
+    from dxtbx.model import DetectorFactory
+
+    from dials.algorithms.shadowing import GoniometerShadowMasks
+
+    detector = DetectorFactory.simple(
+        "PAD", 100, (5, 5), "+x", "-y", (0.1, 0.1), (60, 50)
+    )
+    masks = GoniometerShadowMasks(detector, 10.0, 2.0, 3)
+    assert masks.num_angles() == 3
+    square = flex.vec2_double([(10.2, 5.7), (30.4, 5.7), (30.4, 20.1), (10.2, 20.1)])
+    shifted = flex.vec2_double([(x + 10, y) for x, y in square])
+    triangle = flex.vec2_double([(-5.3, -5.1), (70.2, 40.3), (-5.3, 40.3)])
+    masks.set_polygon(0, 0, square)
+    masks.set_polygon(1, 0, shifted)
+    masks.set_polygon(2, 0, triangle)
+    masks.rasterise(nthreads=2)
+
+    # At the sampled angles the masks are the pixels with centres outside
+    centres = flex.vec2_double(
+        [(i + 0.5, j + 0.5) for j in range(50) for i in range(60)]
+    )
+    for i, polygon in enumerate((square, shifted, triangle)):
+        mask = masks.mask(masks.angle(i), 0)
+        assert mask.all() == (50, 60)
+        inside = is_inside_polygon(polygon, centres)
+        assert list(mask.as_1d()) == list(~inside)
+        assert masks.num_shadowed(i, 0) == inside.count(True)
+
+    # Half way between the squares the run ends are interpolated
+    mask = masks.mask(11.0, 0)
+    expected = is_inside_polygon(
+        flex.vec2_double([(x + 5, y) for x, y in square]), centres
+    )
+    assert list(mask.as_1d()) == list(~expected)
+
+    # Points at the sampled angles are tested against the polygons
+    xy = flex.vec2_double([(10.5, 6.0), (34.5, 10.0), (15.0, 19.0), (1.0, 30.0)])
+    for angle, polygon in ((10.0, square), (12.0, shifted), (14.0, triangle)):
+        shadowed = masks.is_shadowed(
+            flex.double(len(xy), angle), flex.size_t(len(xy), 0), xy
+        )
+        assert list(shadowed) == list(is_inside_polygon(polygon, xy))
+    shadowed = masks.is_shadowed(
+        flex.double(len(xy), 11.0), flex.size_t(len(xy), 0), xy, nthreads=2
+    )
+    assert list(shadowed) == [False, True, True, False]
+
+
 def test_lru_equality_cache_basic():
 
     callargs = []
@@ -175,3 +225,52 @@ def __hash__(self):
     fun(a)
     fun(b)
     assert fun.cache_info() == (1, 1, 1, 1)
+
+
+def test_resolution_mask_ranges(dials_data):
+    from dials.util.ext import ResolutionMaskGenerator
+
+    filename = dials_data("centroid_test_data").join("experiments.json").strpath
+    experiments = ExperimentListFactory.from_json_file(filename)
+    beam = experiments[0].beam
+    panel = experiments[0].detector[0]
+
+    generator = ResolutionMaskGenerator(beam, panel)
+    threaded = ResolutionMaskGenerator(beam, panel, nthreads=4)
+    assert list(threaded.resolution()) == list(generator.resolution())
+
+    # Applying several overlapping ranges at once should match applying each
+    ranges = [(3.0, 3.5), (1.5, 2.0), (1.9, 2.1), (4.0, 4.01), (0, 1.2)]
+    expected = flex.bool(flex.grid(generator.resolution().all()), True)
+    for d_min, d_max in ranges:
+        generator.apply(expected, d_min, d_max)
+    mask = flex.bool(flex.grid(generator.resolution().all()), True)
+    d_min, d_max = zip(*ranges)
+    generator.apply_ranges(mask, flex.double(d_min), flex.double(d_max))
+    assert mask.count(False) > 0
+    assert list(mask) == list(expected)
+
+
+def test_cached_mask_generator(dials_data):
+    from dials.util.masking import CachedMaskGenerator, MaskGenerator, phil_scope
+
+    filename = dials_data("centroid_test_data").join("experiments.json").strpath
+    experiments = ExperimentListFactory.from_json_file(filename)
+    imageset = experiments[0].imageset
+    params = phil_scope.extract()
+    params.d_min = 2.0
+
+    generator = CachedMaskGenerator(params, maxsize=1)
+    mask = generator.generate(imageset)
+    expected = MaskGenerator(params).generate(imageset)
+    assert mask[0].count(False) > 0
+    assert list(mask[0]) == list(expected[0])
+
+    # The mask is reused for an imageset with an equal detector and beam
+    assert generator.generate(experiments[0].imageset) is mask
+
+    # but not once the beam changes
+    beam = imageset.get_beam()
+    beam.set_wavelength(beam.get_wavelength() * 1.1)
+    imageset.set_beam(beam)
+    assert generator.generate(imageset) is not mask
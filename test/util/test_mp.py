@@ -14,3 +14,47 @@ def test_core_detection_override(monkeypatch):
     true_cores = dials.util.mp.available_cores()
     monkeypatch.setenv("NSLOTS", str(true_cores + 1))
     assert dials.util.mp.available_cores() == true_cores + 1
+
+
+def _square(x):
+    return x * x
+
+
+def test_multi_node_parallel_map_on_one_node():
+    results = []
+    squares = dials.util.mp.multi_node_parallel_map(
+        _square, list(range(20)), njobs=1, nproc=3, callback=results.append
+    )
+    assert squares == [x * x for x in range(20)]
+    assert sorted(results) == squares
+
+
+def test_cgroup_cpu_limit(tmpdir):
+    assert dials.util.mp.cgroup_cpu_limit(tmpdir.strpath) is None
+    tmpdir.join("cpu.max").write("max 100000\n")
+    assert dials.util.mp.cgroup_cpu_limit(tmpdir.strpath) is None
+    tmpdir.join("cpu.max").write("250000 100000\n")
+    assert dials.util.mp.cgroup_cpu_limit(tmpdir.strpath) == 3
+
+    v1 = tmpdir.mkdir("v1")
+    v1.mkdir("cpu").join("cpu.cfs_quota_us").write("-1\n")
+    v1.join("cpu", "cpu.cfs_period_us").write("100000\n")
+    assert dials.util.mp.cgroup_cpu_limit(v1.strpath) is None
+    v1.join("cpu", "cpu.cfs_quota_us").write("50000\n")
+    assert dials.util.mp.cgroup_cpu_limit(v1.strpath) == 1
+
+
+def _max_threads(x):
+    import os
+
+    return os.environ["DIALS_MAX_THREADS"]
+
+
+def test_thread_limited_function(monkeypatch):
+    monkeypatch.setattr(dials.util.mp, "available_cores", lambda: 8)
+    monkeypatch.setenv("DIALS_MAX_THREADS", "0")
+    assert dials.util.mp.threads_per_process(3) == 2
+    assert dials.util.mp.threads_per_process(16) == 1
+    assert dials.util.mp.ThreadLimitedFunction(_max_threads, 3)(None) == "2"
+    monkeypatch.setenv("DIALS_MAX_THREADS", "1")
+    assert dials.util.mp.ThreadLimitedFunction(_max_threads, 2)(None) == "1"
@@ -13,7 +13,9 @@
     assign_unique_identifiers,
     parse_multiple_datasets,
     renumber_table_id_columns,
+    rows_by_experiment_id,
     select_datasets_on_ids,
+    select_experiment_rows,
     sort_tables_to_experiments_order,
 )
 
@@ -346,6 +348,28 @@ def test_renumber_table_id_columns():
     assert list(rs[1].experiment_identifiers().values()) == ["0"]
 
 
+def test_select_experiment_rows():
+    """Test selecting several experiments from a table in one pass."""
+    table = flex.reflection_table()
+    table["id"] = flex.int([2, -1, 0, 2, 1, 0, 2])
+    table["x"] = flex.double(range(7))
+    rows = rows_by_experiment_id(table)
+    assert sorted(rows) == [0, 1, 2]
+    assert list(rows[0]) == [2, 5]
+    assert list(rows[1]) == [4]
+    assert list(rows[2]) == [0, 3, 6]
+
+    result = select_experiment_rows(table, rows, [2, 0], {0: "a", 2: "c"})
+    assert list(result["id"]) == [0, 0, 0, 1, 1]
+    assert list(result["x"]) == [0, 3, 6, 2, 5]
+    assert dict(result.experiment_identifiers()) == {0: "c", 1: "a"}
+
+    # An id with no reflections is still given its number
+    result = select_experiment_rows(table, rows, [3, 1])
+    assert list(result["id"]) == [1]
+    assert list(result["x"]) == [4]
+
+
 def test_sort_tables_to_experiments_order_single_dataset_files():
     """Test reflection table sorting when tables contain a single dataset."""
     # Reflection tables in the wrong order
@@ -140,3 +140,44 @@ def test_run(dials_regression, run_in_tmpdir):
         uc2 = c2.get_unit_cell_at_scan_point(i)
         for p1, p2 in zip(uc1.parameters(), uc2.parameters()):
             assert abs(p1 - p2) < EPS
+
+
+def test_reflections_chunked_and_read_by_rows(tmpdir):
+    import h5py
+
+    from dials.array_family import flex
+    from dials.util.nexus import nx_reflections
+
+    n = 1000
+    table = flex.reflection_table()
+    table["miller_index"] = flex.miller_index(
+        [(i % 7 - 3, i % 11 - 5, i % 13 - 6) for i in range(n)]
+    )
+    table["id"] = flex.int(n, 0)
+    table["flags"] = flex.size_t(range(n))
+    table["xyzcal.px"] = flex.vec3_double([(i, 2 * i, 3 * i) for i in range(n)])
+    table["bbox"] = flex.int6([(i, i + 1, i, i + 2, 0, 1) for i in range(n)])
+    table["intensity.sum.value"] = flex.double(range(n))
+
+    filename = tmpdir.join("reflections.nxs").strpath
+    with h5py.File(filename, "w") as handle:
+        entry = handle.create_group("entry")
+        nx_reflections.dump(entry, table, ["/entry/experiment_0"])
+
+    with h5py.File(filename, "r") as handle:
+        entry = handle["entry"]
+        dset = entry["reflections/int_sum"]
+        assert dset.chunks is not None
+        assert dset.compression == "gzip"
+        assert entry["reflections/bounding_box"].chunks[1] == 6
+
+        # Read the whole table, then a range of rows
+        result, experiments = nx_reflections.load(entry)
+        subset, experiments = nx_reflections.load(entry, slice(100, 250))
+
+    assert result.size() == n
+    assert subset.size() == 150
+    expected = table[100:250]
+    for key in table.keys():
+        assert list(result[key]) == list(table[key])
+        assert list(subset[key]) == list(expected[key])
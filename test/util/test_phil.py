@@ -0,0 +1,41 @@
+"""
+Tests for the functions in dials.util.phil
+"""
+from __future__ import absolute_import, division, print_function
+
+import os
+
+from dials.util.phil import cached_parse
+
+master_phil_str = """
+spotfinder {
+  threshold = 3.0
+    .type = float
+  method = *dispersion radial_profile
+    .type = choice
+}
+include scope dials.util.options.format_phil_scope
+"""
+
+
+def test_cached_parse(monkeypatch, tmpdir):
+    monkeypatch.delenv("DIALS_PHIL_CACHE", raising=False)
+    expected = cached_parse(master_phil_str)
+
+    cache_dir = tmpdir.join("phil_cache").strpath
+    monkeypatch.setenv("DIALS_PHIL_CACHE", cache_dir)
+    first = cached_parse(master_phil_str)
+    assert first.as_str() == expected.as_str()
+    assert len(os.listdir(cache_dir)) == 1
+
+    # The second parse is read from the cache, and works as a master scope
+    second = cached_parse(master_phil_str)
+    assert len(os.listdir(cache_dir)) == 1
+    assert second.as_str() == expected.as_str()
+    params = second.fetch(cached_parse("spotfinder.threshold=5")).extract()
+    assert params.spotfinder.threshold == 5
+    assert params.spotfinder.method == "dispersion"
+
+    # A different string has a different key
+    cached_parse(master_phil_str.replace("3.0", "4.0"))
+    assert len(os.listdir(cache_dir)) == 2
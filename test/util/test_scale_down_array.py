@@ -0,0 +1,27 @@
+from __future__ import absolute_import, division, print_function
+
+from scitbx.array_family import flex
+
+from dials.util.ext import scale_down_array
+
+
+def test_scale_down_array():
+    image = flex.int(200000, 0)
+    for j in range(len(image)):
+        image[j] = (j % 500) if j % 11 else -2
+
+    scaled = scale_down_array(image, 0.25, seed=5)
+
+    # Flagged pixels are kept, and no pixel gains counts
+    assert (scaled == -2).count(True) == (image == -2).count(True)
+    assert (scaled <= image).all_eq(True)
+    positive = image > 0
+    ratio = flex.sum(scaled.select(positive)) / flex.sum(image.select(positive))
+    assert abs(ratio - 0.25) < 1e-3
+
+    # The result for a seed does not depend on the number of threads
+    assert scaled.all_eq(scale_down_array(image, 0.25, seed=5, nthreads=3))
+    assert scale_down_array(image, 1.0, seed=5).all_eq(image)
+    assert scale_down_array(image, 0.0, seed=5).all_eq(
+        image.deep_copy().set_selected(positive, 0)
+    )
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <dials/util/thread_limit.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+
+using dials::algorithms::for_each_band;
+using dials::util::ThreadReservation;
+
+void set_max_threads(const char *value) {
+#ifdef _WIN32
+  _putenv_s("DIALS_MAX_THREADS", value);
+#else
+  setenv("DIALS_MAX_THREADS", value, 1);
+#endif
+}
+
+/**
+ * Count the bands which run at once, and run a nested for_each_band in each
+ */
+struct NestedBands {
+  boost::mutex &mutex;
+  std::size_t &active;
+  std::size_t &peak;
+  std::size_t nthreads;
+  bool nested;
+
+  NestedBands(boost::mutex &mutex_,
+              std::size_t &active_,
+              std::size_t &peak_,
+              std::size_t nthreads_,
+              bool nested_)
+      : mutex(mutex_),
+        active(active_),
+        peak(peak_),
+        nthreads(nthreads_),
+        nested(nested_) {}
+
+  void operator()(int j0, int j1) const {
+    if (nested) {
+      NestedBands inner(mutex, active, peak, nthreads, false);
+      for_each_band(inner, 8, nthreads);
+      return;
+    }
+    {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      active++;
+      peak = std::max(peak, active);
+    }
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      active--;
+    }
+  }
+};
+
+void tst_nested_reservations() {
+  set_max_threads("4");
+
+  // The first reservation gets what it asks for, and the nested ones share the
+  // rest of the limit but always get at least one thread
+  {
+    ThreadReservation outer(3);
+    assert(outer.size() == 3);
+    {
+      ThreadReservation inner(3);
+      assert(inner.size() == 1);
+      ThreadReservation innermost(2);
+      assert(innermost.size() == 1);
+    }
+    ThreadReservation inner(3);
+    assert(inner.size() == 1);
+  }
+
+  // The threads are returned to the limit
+  {
+    ThreadReservation outer(8);
+    assert(outer.size() == 4);
+  }
+
+  // Without a limit the threads are granted as requested
+  set_max_threads("");
+  {
+    ThreadReservation outer(8);
+    assert(outer.size() == 8);
+    ThreadReservation inner(8);
+    assert(inner.size() == 8);
+  }
+
+  // Test passed
+  std::cout << "OK" << std::endl;
+}
+
+void tst_nested_bands() {
+  set_max_threads("4");
+
+  // The bands of the nested calls run on the threads of the outer call, so no
+  // more than the limit run at once
+  boost::mutex mutex;
+  std::size_t active = 0;
+  std::size_t peak = 0;
+  NestedBands outer(mutex, active, peak, 4, true);
+  for_each_band(outer, 4, 4);
+  assert(active == 0);
+  assert(peak >= 1 && peak <= 4);
+
+  // Test passed
+  std::cout << "OK" << std::endl;
+}
+
+int main(int argc, char const *argv[]) {
+  tst_nested_reservations();
+  tst_nested_bands();
+
+  return 0;
+}
@@ -3,6 +3,7 @@
 #include <dials/util/scale_down_array.h>
 #include <dials/util/masking.h>
 #include <dials/util/export_mtz_helpers.h>
+#include <dials/util/export_text.h>
 #include <dials/util/python_streambuf.h>
 
 std::size_t dials::util::streambuf::default_buffer_size = 1024;
@@ -34,9 +35,48 @@ namespace dials { namespace util { namespace boost_python {
     }
   };
 
+  void xds_ascii_formatter_write(
+    const XdsAsciiFormatter &self,
+    streambuf &output,
+    const af::const_ref<cctbx::miller::index<> > &miller_index,
+    const af::const_ref<double> &intensity,
+    const af::const_ref<double> &sigma,
+    const af::const_ref<vec3<double> > &xyzcal,
+    const af::const_ref<double> &scl,
+    const af::const_ref<double> &partiality,
+    const af::const_ref<double> &correlation,
+    std::size_t nthreads) {
+    streambuf::ostream os(output);
+    self.write(os,
+               miller_index,
+               intensity,
+               sigma,
+               xyzcal,
+               scl,
+               partiality,
+               correlation,
+               nthreads);
+  }
+
+  void sadabs_formatter_write(
+    const SadabsFormatter &self,
+    streambuf &output,
+    const af::const_ref<cctbx::miller::index<> > &miller_index,
+    const af::const_ref<double> &intensity,
+    const af::const_ref<double> &sigma,
+    const af::const_ref<vec3<double> > &xyz,
+    const af::const_ref<vec3<double> > &xyzcal,
+    const af::const_ref<double> &stol,
+    std::size_t nthreads) {
+    streambuf::ostream os(output);
+    self.write(os, miller_index, intensity, sigma, xyz, xyzcal, stol, nthreads);
+  }
+
   using namespace boost::python;
   BOOST_PYTHON_MODULE(dials_util_ext) {
-    def("scale_down_array", &scale_down_array, (arg("image"), arg("scale_factor")));
+    def("scale_down_array",
+        &scale_down_array,
+        (arg("image"), arg("scale_factor"), arg("seed") = -1, arg("nthreads") = 1));
 
     def("dials_u_to_mosflm", &dials_u_to_mosflm, (arg("dials_U"), arg("uc")));
 
@@ -57,9 +97,74 @@ namespace dials { namespace util { namespace boost_python {
          arg("axis"),
          arg("s0n")));
 
+    class_<MtzColumnWriter>("MtzColumnWriter", no_init)
+      .def(init<std::size_t>((arg("nref"))))
+      .def("add_double",
+           &MtzColumnWriter::add_double,
+           (arg("label"), arg("values"), arg("square_root") = false))
+      .def("add_int", &MtzColumnWriter::add_int, (arg("label"), arg("values")))
+      .def("add_vec3_component",
+           &MtzColumnWriter::add_vec3_component,
+           (arg("label"), arg("values"), arg("component")))
+      .def("add_constant",
+           &MtzColumnWriter::add_constant,
+           (arg("label"), arg("value")))
+      .def("__len__", &MtzColumnWriter::size)
+      .def("write",
+           &MtzColumnWriter::write,
+           (arg("mtz"), arg("i_crystal"), arg("i_dataset"), arg("nthreads") = 1));
+
+    class_<XdsAsciiFormatter>("XdsAsciiFormatter", no_init)
+      .def(init<mat3<double>, vec3<double>, vec3<double>, double, double>(
+        (arg("UB"), arg("axis"), arg("s0"), arg("phi_start"), arg("phi_range"))))
+      .def("psi", &XdsAsciiFormatter::psi, (arg("miller_index"), arg("z")))
+      .def("write",
+           &xds_ascii_formatter_write,
+           (arg("output"),
+            arg("miller_index"),
+            arg("intensity"),
+            arg("sigma"),
+            arg("xyzcal"),
+            arg("scl"),
+            arg("partiality"),
+            arg("correlation"),
+            arg("nthreads") = 1));
+
+    class_<SadabsFormatter>("SadabsFormatter", no_init)
+      .def(init<const af::const_ref<mat3<double> > &,
+                mat3<double>,
+                mat3<double>,
+                vec3<double>,
+                vec3<double>,
+                double,
+                double,
+                double,
+                int>((arg("A"),
+                      arg("F"),
+                      arg("S"),
+                      arg("axis"),
+                      arg("s0"),
+                      arg("phi_start"),
+                      arg("phi_range"),
+                      arg("detector2t"),
+                      arg("run"))))
+      .def("write",
+           &sadabs_formatter_write,
+           (arg("output"),
+            arg("miller_index"),
+            arg("intensity"),
+            arg("sigma"),
+            arg("xyz"),
+            arg("xyzcal"),
+            arg("stol"),
+            arg("nthreads") = 1));
+
     class_<ResolutionMaskGenerator>("ResolutionMaskGenerator", no_init)
-      .def(init<const BeamBase &, const Panel &>())
-      .def("apply", &ResolutionMaskGenerator::apply);
+      .def(init<const BeamBase &, const Panel &, std::size_t>(
+        (arg("beam"), arg("panel"), arg("nthreads") = 1)))
+      .def("resolution", &ResolutionMaskGenerator::resolution)
+      .def("apply", &ResolutionMaskGenerator::apply)
+      .def("apply_ranges", &ResolutionMaskGenerator::apply_ranges);
 
     python_streambuf_wrapper::wrap();
     python_ostream_wrapper::wrap();
@@ -3,6 +3,7 @@
 
 #include <dials/util/python_streambuf.h>
 #include <fstream>
+#include <vector>
 
 namespace dials { namespace util { namespace {
 
@@ -103,6 +104,34 @@ namespace dials { namespace util { namespace {
     return write_and_seek_ostream(os);
   }
 
+  boost::python::object write_large(streambuf& output, std::size_t n) {
+    streambuf::ostream os(output);
+    std::string result, data;
+    for (std::size_t i = 0; i < n; ++i) {
+      data += (char)('a' + i % 26);
+    }
+    os << "<";
+    os.write(data.c_str(), data.size());
+    os << ">";
+    os.flush();
+
+    return append_status(os, result);
+  }
+
+  boost::python::object read_large(streambuf& input, std::size_t n) {
+    streambuf::istream is(input);
+    std::string result;
+    char first;
+    is.get(first);
+    std::vector<char> data(n);
+    is.read(&data[0], n);
+    result += first;
+    result.append(&data[0], is.gcount());
+    result += ", ";
+
+    return append_status(is, result);
+  }
+
   void wrap_all() {
     using namespace boost::python;
     def("read_word", read_word);
@@ -112,6 +141,8 @@ namespace dials { namespace util { namespace {
     def("write_word", write_word_ostream);
     def("write_and_seek", write_and_seek);
     def("write_and_seek", write_and_seek_ostream);
+    def("write_large", write_large);
+    def("read_large", read_large);
   }
 
 }}}  // namespace dials::util::
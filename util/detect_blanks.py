@@ -4,6 +4,7 @@
 from libtbx.math_utils import iceil
 
 from dials.array_family import flex
+from dials_algorithms_spot_finding_ext import slot_means
 
 logger = logging.getLogger(__name__)
 
@@ -101,16 +102,6 @@ def blank_integrated_analysis(reflections, scan, phi_step, fractional_loss):
     logger.debug("Histogram:")
     logger.debug(hist.as_str())
 
-    mean_i_sigi = flex.double()
-    for i, slot_info in enumerate(hist.slot_infos()):
-        sel = (z_px >= slot_info.low_cutoff) & (z_px < slot_info.high_cutoff)
-        if sel.count(True) == 0:
-            mean_i_sigi.append(0)
-        else:
-            mean_i_sigi.append(flex.mean(i_sigi.select(sel)))
-
-    potential_blank_sel = mean_i_sigi <= (fractional_loss * flex.max(mean_i_sigi))
-
     xmin, xmax = zip(
         *[
             (slot_info.low_cutoff, slot_info.high_cutoff)
@@ -118,6 +109,11 @@ def blank_integrated_analysis(reflections, scan, phi_step, fractional_loss):
         ]
     )
 
+    # The mean I/sigma of the reflections in each slot, in one pass
+    mean_i_sigi = slot_means(z_px, i_sigi, flex.double(xmin), flex.double(xmax))
+
+    potential_blank_sel = mean_i_sigi <= (fractional_loss * flex.max(mean_i_sigi))
+
     d = {
         "data": [
             {
@@ -19,6 +19,7 @@
     get_image_ranges,
 )
 from dials.util.filter_reflections import filter_reflection_table
+from dials.util.mp import available_cores
 from dials.util.multi_dataset_handling import (
     assign_unique_identifiers,
     parse_multiple_datasets,
@@ -240,7 +241,7 @@ def add_batch_list(
             s0n,
         )
 
-    def write_columns(self, reflection_table):
+    def write_columns(self, reflection_table, nthreads=None):
         """Write the column definitions AND data to the current dataset."""
 
         # now create the actual data structures - first keep a track of the columns
@@ -252,9 +253,8 @@ def write_columns(self, reflection_table):
 
         nref = len(reflection_table["miller_index"])
         assert nref
-        xdet, ydet, _ = [
-            flex.double(x) for x in reflection_table["xyzobs.px.value"].parts()
-        ]
+        if nthreads is None:
+            nthreads = available_cores()
 
         # now add column information...
 
@@ -282,6 +282,8 @@ def write_columns(self, reflection_table):
             "FRACTIONCALC": "R",
             "ROT": "R",
             "QE": "R",
+            "SCALEUSED": "R",
+            "SIGSCALEUSED": "R",
         }
 
         # derive index columns from original indices with
@@ -298,16 +300,23 @@ def write_columns(self, reflection_table):
         # assign H, K, L, M_ISYM space
         for column in "H", "K", "L", "M_ISYM":
             dataset.add_column(column, type_table[column]).set_values(
-                flex.double(nref, 0.0).as_float()
+                flex.float(nref, 0.0)
             )
 
         self.mtz_file.replace_original_index_miller_indices(
             reflection_table["miller_index"]
         )
 
-        dataset.add_column("BATCH", type_table["BATCH"]).set_values(
-            reflection_table["batch"].as_double().as_float()
-        )
+        # The remaining columns are added here, then converted to MTZ floats
+        # in one pass in C++
+        writer = dials.util.ext.MtzColumnWriter(nref)
+
+        def add_double(label, values, square_root=False):
+            dataset.add_column(label, type_table[label])
+            writer.add_double(label, values, square_root)
+
+        dataset.add_column("BATCH", type_table["BATCH"])
+        writer.add_int("BATCH", reflection_table["batch"])
 
         # if intensity values used in scaling exist, then just export these as I, SIGI
         if "intensity.scale.value" in reflection_table:
@@ -315,15 +324,13 @@ def write_columns(self, reflection_table):
             V_scaling = reflection_table["intensity.scale.variance"]
             # Trap negative variances
             assert V_scaling.all_gt(0)
-            dataset.add_column("I", type_table["I"]).set_values(I_scaling.as_float())
-            dataset.add_column("SIGI", type_table["SIGI"]).set_values(
-                flex.sqrt(V_scaling).as_float()
-            )
-            dataset.add_column("SCALEUSED", "R").set_values(
-                reflection_table["inverse_scale_factor"].as_float()
-            )
-            dataset.add_column("SIGSCALEUSED", "R").set_values(
-                flex.sqrt(reflection_table["inverse_scale_factor_variance"]).as_float()
+            add_double("I", I_scaling)
+            add_double("SIGI", V_scaling, square_root=True)
+            add_double("SCALEUSED", reflection_table["inverse_scale_factor"])
+            add_double(
+                "SIGSCALEUSED",
+                reflection_table["inverse_scale_factor_variance"],
+                square_root=True,
             )
         else:
             if "intensity.prf.value" in reflection_table:
@@ -335,21 +342,15 @@ def write_columns(self, reflection_table):
                 V_profile = reflection_table["intensity.prf.variance"]
                 # Trap negative variances
                 assert V_profile.all_gt(0)
-                dataset.add_column(col_names[0], type_table["I"]).set_values(
-                    I_profile.as_float()
-                )
-                dataset.add_column(col_names[1], type_table["SIGI"]).set_values(
-                    flex.sqrt(V_profile).as_float()
-                )
+                add_double(col_names[0], I_profile)
+                add_double(col_names[1], V_profile, square_root=True)
             if "intensity.sum.value" in reflection_table:
                 I_sum = reflection_table["intensity.sum.value"]
                 V_sum = reflection_table["intensity.sum.variance"]
                 # Trap negative variances
                 assert V_sum.all_gt(0)
-                dataset.add_column("I", type_table["I"]).set_values(I_sum.as_float())
-                dataset.add_column("SIGI", type_table["SIGI"]).set_values(
-                    flex.sqrt(V_sum).as_float()
-                )
+                add_double("I", I_sum)
+                add_double("SIGI", V_sum, square_root=True)
         if (
             "background.sum.value" in reflection_table
             and "background.sum.variance" in reflection_table
@@ -357,37 +358,34 @@ def write_columns(self, reflection_table):
             bg = reflection_table["background.sum.value"]
             varbg = reflection_table["background.sum.variance"]
             assert (varbg >= 0).count(False) == 0
-            sigbg = flex.sqrt(varbg)
-            dataset.add_column("BG", type_table["BG"]).set_values(bg.as_float())
-            dataset.add_column("SIGBG", type_table["SIGBG"]).set_values(
-                sigbg.as_float()
-            )
+            add_double("BG", bg)
+            add_double("SIGBG", varbg, square_root=True)
 
-        dataset.add_column("FRACTIONCALC", type_table["FRACTIONCALC"]).set_values(
-            reflection_table["fractioncalc"].as_float()
-        )
+        add_double("FRACTIONCALC", reflection_table["fractioncalc"])
 
-        dataset.add_column("XDET", type_table["XDET"]).set_values(xdet.as_float())
-        dataset.add_column("YDET", type_table["YDET"]).set_values(ydet.as_float())
-        dataset.add_column("ROT", type_table["ROT"]).set_values(
-            reflection_table["ROT"].as_float()
-        )
+        xyzobs = reflection_table["xyzobs.px.value"]
+        dataset.add_column("XDET", type_table["XDET"])
+        writer.add_vec3_component("XDET", xyzobs, 0)
+        dataset.add_column("YDET", type_table["YDET"])
+        writer.add_vec3_component("YDET", xyzobs, 1)
+        add_double("ROT", reflection_table["ROT"])
         if "lp" in reflection_table:
-            dataset.add_column("LP", type_table["LP"]).set_values(
-                reflection_table["lp"].as_float()
-            )
+            add_double("LP", reflection_table["lp"])
         if "qe" in reflection_table:
-            dataset.add_column("QE", type_table["QE"]).set_values(
-                reflection_table["qe"].as_float()
-            )
+            add_double("QE", reflection_table["qe"])
         elif "dqe" in reflection_table:
-            dataset.add_column("QE", type_table["QE"]).set_values(
-                reflection_table["dqe"].as_float()
-            )
+            add_double("QE", reflection_table["dqe"])
         else:
-            dataset.add_column("QE", type_table["QE"]).set_values(
-                flex.double(nref, 1.0).as_float()
-            )
+            dataset.add_column("QE", type_table["QE"])
+            writer.add_constant("QE", 1.0)
+
+        self.mtz_file.adjust_column_array_sizes(nref)
+        writer.write(
+            self.mtz_file,
+            self.current_crystal.i_crystal(),
+            dataset.i_dataset(),
+            nthreads,
+        )
 
 
 def export_mtz(
@@ -1,7 +1,10 @@
 #ifndef DIALS_UTIL_EXPORT_MTZ_HELPERS_H
 #define DIALS_UTIL_EXPORT_MTZ_HELPERS_H
 
+#include <algorithm>
 #include <cmath>
+#include <string>
+#include <vector>
 #include <scitbx/vec3.h>
 #include <scitbx/vec2.h>
 #include <scitbx/constants.h>
@@ -10,12 +13,16 @@
 #include <scitbx/array_family/tiny_types.h>
 #include <cctbx/uctbx.h>
 #include <iotbx/mtz/object.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
 
 namespace dials { namespace util {
 
   using cctbx::uctbx::unit_cell;
   using iotbx::mtz::object;
   using scitbx::mat3;
+  using scitbx::vec3;
 
   void add_dials_batches(iotbx::mtz::object* mtz,
                          int dataset_id,
@@ -178,6 +185,203 @@ namespace dials { namespace util {
     }
   }
 
+  /**
+   * Fill the values of the columns of an MTZ dataset from the columns of a
+   * reflection table. The columns are added to the writer with the cast or
+   * square root to apply, and are then all converted to MTZ floats in one
+   * pass over the reflections, split into bands across threads, without
+   * the intermediate arrays of converting each column in Python.
+   */
+  class MtzColumnWriter {
+  public:
+    /**
+     * @param nref The number of reflections
+     */
+    MtzColumnWriter(std::size_t nref) : nref_(nref) {}
+
+    /**
+     * Add a column of double values
+     * @param label The label of the MTZ column
+     * @param values The values
+     * @param square_root Write the square root of the values, as for sigmas
+     */
+    void add_double(const std::string &label,
+                    af::shared<double> values,
+                    bool square_root) {
+      DIALS_ASSERT(values.size() == nref_);
+      Column column(label, Double);
+      column.doubles = values;
+      column.square_root = square_root;
+      columns_.push_back(column);
+    }
+
+    /**
+     * Add a column of int values
+     * @param label The label of the MTZ column
+     * @param values The values
+     */
+    void add_int(const std::string &label, af::shared<int> values) {
+      DIALS_ASSERT(values.size() == nref_);
+      Column column(label, Int);
+      column.ints = values;
+      columns_.push_back(column);
+    }
+
+    /**
+     * Add a column from one component of an array of vectors
+     * @param label The label of the MTZ column
+     * @param values The vectors
+     * @param component The component of the vectors
+     */
+    void add_vec3_component(const std::string &label,
+                            af::shared<vec3<double> > values,
+                            std::size_t component) {
+      DIALS_ASSERT(values.size() == nref_);
+      DIALS_ASSERT(component < 3);
+      Column column(label, Vec3);
+      column.vec3s = values;
+      column.component = component;
+      columns_.push_back(column);
+    }
+
+    /**
+     * Add a column with the same value for all reflections
+     * @param label The label of the MTZ column
+     * @param value The value
+     */
+    void add_constant(const std::string &label, double value) {
+      Column column(label, Constant);
+      column.constant = value;
+      columns_.push_back(column);
+    }
+
+    /** @returns The number of columns */
+    std::size_t size() const {
+      return columns_.size();
+    }
+
+    /**
+     * Write the values into the columns of a dataset, which must already
+     * have been added to the MTZ object with these labels
+     * @param mtz The MTZ object
+     * @param i_crystal The index of the crystal of the dataset
+     * @param i_dataset The index of the dataset in the crystal
+     * @param nthreads The number of threads to use
+     */
+    void write(iotbx::mtz::object *mtz,
+               int i_crystal,
+               int i_dataset,
+               std::size_t nthreads) const {
+      CMtz::MTZ *ptr = mtz->ptr();
+      DIALS_ASSERT(ptr->nref == (int)nref_);
+      DIALS_ASSERT(i_crystal >= 0 && i_crystal < ptr->nxtal);
+      CMtz::MTZXTAL *xtal = ptr->xtal[i_crystal];
+      DIALS_ASSERT(i_dataset >= 0 && i_dataset < xtal->nset);
+      CMtz::MTZSET *set = xtal->set[i_dataset];
+
+      // Find the destination of each column before starting the threads
+      std::vector<Target> targets;
+      for (std::size_t c = 0; c < columns_.size(); ++c) {
+        const Column &column = columns_[c];
+        float *dst = 0;
+        for (int k = 0; k < set->ncol; ++k) {
+          if (column.label == set->col[k]->label) {
+            dst = set->col[k]->ref;
+            break;
+          }
+        }
+        DIALS_ASSERT(dst != 0);
+        targets.push_back(Target(column, dst));
+      }
+      dials::algorithms::for_each_band(FillBand(targets), (int)nref_, nthreads);
+    }
+
+  private:
+    enum Type { Double, Int, Vec3, Constant };
+
+    struct Column {
+      std::string label;
+      Type type;
+      af::shared<double> doubles;
+      af::shared<int> ints;
+      af::shared<vec3<double> > vec3s;
+      std::size_t component;
+      bool square_root;
+      double constant;
+
+      Column(const std::string &label_, Type type_)
+          : label(label_), type(type_), component(0), square_root(false), constant(0) {}
+    };
+
+    /**
+     * The raw pointers of a column, so no handles are copied in the threads
+     */
+    struct Target {
+      Type type;
+      const double *doubles;
+      const int *ints;
+      const vec3<double> *vec3s;
+      std::size_t component;
+      bool square_root;
+      double constant;
+      float *dst;
+
+      Target(const Column &column, float *dst_)
+          : type(column.type),
+            doubles(column.doubles.begin()),
+            ints(column.ints.begin()),
+            vec3s(column.vec3s.begin()),
+            component(column.component),
+            square_root(column.square_root),
+            constant(column.constant),
+            dst(dst_) {}
+    };
+
+    /**
+     * Convert a band of the reflections of all the columns
+     */
+    struct FillBand {
+      const std::vector<Target> &targets;
+
+      FillBand(const std::vector<Target> &targets_) : targets(targets_) {}
+
+      void operator()(int i0, int i1) const {
+        for (std::size_t c = 0; c < targets.size(); ++c) {
+          const Target &t = targets[c];
+          switch (t.type) {
+          case Double:
+            if (t.square_root) {
+              for (int i = i0; i < i1; ++i) {
+                t.dst[i] = (float)std::sqrt(t.doubles[i]);
+              }
+            } else {
+              for (int i = i0; i < i1; ++i) {
+                t.dst[i] = (float)t.doubles[i];
+              }
+            }
+            break;
+          case Int:
+            for (int i = i0; i < i1; ++i) {
+              t.dst[i] = (float)t.ints[i];
+            }
+            break;
+          case Vec3:
+            for (int i = i0; i < i1; ++i) {
+              t.dst[i] = (float)t.vec3s[i][t.component];
+            }
+            break;
+          default:
+            std::fill(t.dst + i0, t.dst + i1, (float)t.constant);
+            break;
+          }
+        }
+      }
+    };
+
+    std::size_t nref_;
+    std::vector<Column> columns_;
+  };
+
   mat3<double> dials_u_to_mosflm(const mat3<double> dials_U, unit_cell uc) {
     scitbx::af::double6 p = uc.parameters();
     scitbx::af::double6 rp = uc.reciprocal_parameters();
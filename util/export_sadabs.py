@@ -7,7 +7,9 @@
 
 from scitbx import matrix
 
+import dials.util.ext
 from dials.util.filter_reflections import filter_reflection_table
+from dials.util.mp import available_cores
 
 logger = logging.getLogger(__name__)
 
@@ -47,10 +49,10 @@ def export_sadabs(integrated_data, experiment_list, params):
     assert experiment.scan is not None
 
     # sort data before output
-    nref = len(integrated_data["miller_index"])
-    indices = flex.size_t_range(nref)
-    perm = sorted(indices, key=lambda k: integrated_data["miller_index"][k])
-    integrated_data = integrated_data.select(flex.size_t(perm))
+    perm = flex.sort_permutation(
+        flex.pack_miller_indices(integrated_data["miller_index"]), stable=True
+    )
+    integrated_data = integrated_data.select(perm)
 
     assert experiment.goniometer is not None
 
@@ -160,61 +162,43 @@ def export_sadabs(integrated_data, experiment_list, params):
     else:
         static = False
 
-    with open(params.sadabs.hklout, "w") as fout:
-
-        for j in range(nref):
-
-            h, k, l = miller_index[j]
-
-            if params.sadabs.predict:
-                x_mm, y_mm, z_rad = integrated_data["xyzcal.mm"][j]
-            else:
-                x_mm, y_mm, z_rad = integrated_data["xyzobs.mm.value"][j]
-
-            z0 = integrated_data["xyzcal.px"][j][2]
-            istol = int(round(10000 * unit_cell.stol((h, k, l))))
-
-            if params.sadabs.predict or static:
-                # work from a scan static model & assume perfect goniometer
-                # FIXME maybe should work back in the option to predict spot positions
-                UB = matrix.sqr(experiment.crystal.get_A())
-                phi = phi_start + z0 * phi_range
-                R = axis.axis_and_angle_as_r3_rotation_matrix(phi, deg=True)
-                RUB = S * R * F * UB
-            else:
-                # properly compute RUB for every reflection
-                UB = matrix.sqr(experiment.crystal.get_A_at_scan_point(int(round(z0))))
-                phi = phi_start + z0 * phi_range
-                R = axis.axis_and_angle_as_r3_rotation_matrix(phi, deg=True)
-                RUB = S * R * F * UB
-
-            x = RUB * (h, k, l)
-            s = (s0 + x).normalize()
-
-            # can also compute s based on centre of mass of spot
-            # s = (origin + x_mm * fast_axis + y_mm * slow_axis).normalize()
-
-            astar = (RUB * (1, 0, 0)).normalize()
-            bstar = (RUB * (0, 1, 0)).normalize()
-            cstar = (RUB * (0, 0, 1)).normalize()
-
-            ix = beam.dot(astar)
-            iy = beam.dot(bstar)
-            iz = beam.dot(cstar)
-
-            dx = s.dot(astar)
-            dy = s.dot(bstar)
-            dz = s.dot(cstar)
+    # The setting of the crystal, static or at each scan point
+    if params.sadabs.predict or static:
+        A = flex.mat3_double([experiment.crystal.get_A()])
+    else:
+        A = flex.mat3_double(
+            [
+                experiment.crystal.get_A_at_scan_point(i)
+                for i in range(experiment.crystal.num_scan_points)
+            ]
+        )
 
-            x = x_mm * scl_x
-            y = y_mm * scl_y
-            z = (z_rad * 180 / math.pi - phi_start) / phi_range
+    if params.sadabs.predict:
+        xyz_mm = integrated_data["xyzcal.mm"]
+    else:
+        xyz_mm = integrated_data["xyzobs.mm.value"]
+    x_mm, y_mm, z_rad = xyz_mm.parts()
+    xyz = flex.vec3_double(
+        x_mm * scl_x,
+        y_mm * scl_y,
+        (z_rad * 180 / math.pi - phi_start) / phi_range,
+    )
+    stol = unit_cell.stol(miller_index)
 
-            fout.write(
-                "%4d%4d%4d%8.2f%8.2f%4d%8.5f%8.5f%8.5f%8.5f%8.5f%8.5f"
-                % (h, k, l, I[j], sigI[j], params.sadabs.run, ix, dx, iy, dy, iz, dz)
-            )
-            fout.write("%7.2f%7.2f%8.2f%7.2f%5d\n" % (x, y, z, detector2t, istol))
+    # Format the records in C++ across threads
+    formatter = dials.util.ext.SadabsFormatter(
+        A, F, S, axis, s0, phi_start, phi_range, detector2t, params.sadabs.run
+    )
+    with open(params.sadabs.hklout, "wb") as fout:
+        formatter.write(
+            dials.util.ext.streambuf(python_file_obj=fout),
+            miller_index,
+            I,
+            sigI,
+            xyz,
+            integrated_data["xyzcal.px"],
+            stol,
+            nthreads=available_cores(),
+        )
 
-    fout.close()
     logger.info("Output %d reflections to %s" % (nref, params.sadabs.hklout))
@@ -0,0 +1,451 @@
+/*
+ * export_text.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_EXPORT_TEXT_H
+#define DIALS_UTIL_EXPORT_TEXT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <scitbx/vec3.h>
+#include <scitbx/mat3.h>
+#include <scitbx/constants.h>
+#include <cctbx/miller.h>
+#include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
+
+namespace dials { namespace util {
+
+  using scitbx::mat3;
+  using scitbx::vec3;
+
+  namespace detail {
+
+    /**
+     * Round half to even, as the Python round function does
+     */
+    inline double round_half_even(double x) {
+      double r = std::floor(x);
+      double d = x - r;
+      if (d > 0.5 || (d == 0.5 && std::fmod(r, 2.0) != 0)) {
+        r += 1;
+      }
+      return r;
+    }
+
+    /**
+     * Rotate a vector around an axis through the origin by an angle in
+     * degrees, as scitbx.matrix.col.rotate_around_origin
+     */
+    inline vec3<double> rotate_around_origin(const vec3<double> &x,
+                                             const vec3<double> &axis,
+                                             double angle) {
+      angle *= scitbx::constants::pi_180;
+      vec3<double> n = axis.normalize();
+      double c = std::cos(angle);
+      double s = std::sin(angle);
+      return x * c + n * (n * x) * (1 - c) + n.cross(x) * s;
+    }
+
+    /**
+     * The angle between two vectors in degrees
+     */
+    inline double angle_degrees(const vec3<double> &a, const vec3<double> &b) {
+      double c = (a * b) / std::sqrt((a * a) * (b * b));
+      c = std::max(-1.0, std::min(1.0, c));
+      return std::acos(c) * 180 / scitbx::constants::pi;
+    }
+
+    /**
+     * Format the records of a block of rows of each band
+     */
+    template <typename Formatter>
+    struct FormatBlocksBand {
+      const Formatter &formatter;
+      std::size_t first;
+      std::size_t block;
+      std::size_t size;
+      std::vector<std::string> &text;
+
+      FormatBlocksBand(const Formatter &formatter_,
+                       std::size_t first_,
+                       std::size_t block_,
+                       std::size_t size_,
+                       std::vector<std::string> &text_)
+          : formatter(formatter_),
+            first(first_),
+            block(block_),
+            size(size_),
+            text(text_) {}
+
+      void operator()(int k0, int k1) const {
+        for (int k = k0; k < k1; ++k) {
+          std::size_t i0 = first + k * block;
+          std::size_t i1 = std::min(i0 + block, size);
+          text[k].clear();
+          for (std::size_t i = i0; i < i1; ++i) {
+            formatter.format(i, text[k]);
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
+  /**
+   * Write the text records of a set of rows. The rows are formatted in
+   * blocks, one for each thread at a time, and the blocks are written in
+   * order, so the output does not depend on the number of threads.
+   * @param os The stream to write to
+   * @param formatter The formatter, with format(i, text) to append row i
+   * @param size The number of rows
+   * @param nthreads The number of threads to use
+   */
+  template <typename Formatter>
+  void write_text_records(std::ostream &os,
+                          const Formatter &formatter,
+                          std::size_t size,
+                          std::size_t nthreads) {
+    const std::size_t block = 1 << 14;
+    DIALS_ASSERT(nthreads > 0);
+    std::vector<std::string> text(nthreads);
+    for (std::size_t first = 0; first < size; first += block * nthreads) {
+      std::size_t nblocks = std::min(nthreads, (size - first + block - 1) / block);
+      dials::algorithms::for_each_band(
+        detail::FormatBlocksBand<Formatter>(formatter, first, block, size, text),
+        (int)nblocks,
+        nthreads);
+      for (std::size_t k = 0; k < nblocks; ++k) {
+        os.write(text[k].data(), text[k].size());
+      }
+    }
+  }
+
+  /**
+   * Format the reflection records of an XDS_ASCII file. The azimuth psi of
+   * each reflection is computed here from the setting of the crystal.
+   */
+  class XdsAsciiFormatter {
+  public:
+    /**
+     * @param UB The UB matrix in the XDS frame
+     * @param axis The rotation axis in the XDS frame
+     * @param s0 The incident beam vector in the XDS frame
+     * @param phi_start The rotation angle of the start of frame zero
+     * @param phi_range The rotation angle of each frame
+     */
+    XdsAsciiFormatter(mat3<double> UB,
+                      vec3<double> axis,
+                      vec3<double> s0,
+                      double phi_start,
+                      double phi_range)
+        : UB_(UB),
+          UBinv_(UB.inverse()),
+          axis_(axis),
+          s0_(s0),
+          phi_start_(phi_start),
+          phi_range_(phi_range) {}
+
+    /**
+     * @param h The Miller index
+     * @param z The predicted frame
+     * @returns The azimuth of a reflection in degrees
+     */
+    double psi(const cctbx::miller::index<> &h, double z) const {
+      vec3<double> hkl(h[0], h[1], h[2]);
+      double phi = phi_start_ + z * phi_range_;
+      vec3<double> X = detail::rotate_around_origin(UB_ * hkl, axis_, phi);
+      vec3<double> s = s0_ + X;
+      vec3<double> g = s.cross(s0_).normalize();
+
+      // find component of beam perpendicular to f, e
+      vec3<double> e = -(s + s0_).normalize();
+      vec3<double> u;
+      if (h[0] == h[1] && h[1] == h[2]) {
+        u = vec3<double>(h[0], -h[0], 0);
+      } else {
+        u = vec3<double>(h[1] - h[2], h[2] - h[0], h[0] - h[1]);
+      }
+      vec3<double> q =
+        detail::rotate_around_origin((u * UBinv_).normalize(), axis_, phi);
+      double result = detail::angle_degrees(q, g);
+      if (q * e < 0) {
+        result = -result;
+      }
+      return result;
+    }
+
+    /**
+     * Write the records of the reflections
+     * @param os The stream to write to
+     * @param miller_index The Miller indices
+     * @param intensity The intensities
+     * @param sigma The sigmas of the intensities
+     * @param xyzcal The predicted positions in pixels and frames
+     * @param scl The lp / qe correction of each reflection
+     * @param partiality The partiality as a percent
+     * @param correlation The profile correlation as a percent
+     * @param nthreads The number of threads to use
+     */
+    void write(std::ostream &os,
+               const af::const_ref<cctbx::miller::index<> > &miller_index,
+               const af::const_ref<double> &intensity,
+               const af::const_ref<double> &sigma,
+               const af::const_ref<vec3<double> > &xyzcal,
+               const af::const_ref<double> &scl,
+               const af::const_ref<double> &partiality,
+               const af::const_ref<double> &correlation,
+               std::size_t nthreads) const {
+      std::size_t n = miller_index.size();
+      DIALS_ASSERT(intensity.size() == n);
+      DIALS_ASSERT(sigma.size() == n);
+      DIALS_ASSERT(xyzcal.size() == n);
+      DIALS_ASSERT(scl.size() == n);
+      DIALS_ASSERT(partiality.size() == n);
+      DIALS_ASSERT(correlation.size() == n);
+      Records records(
+        *this, miller_index, intensity, sigma, xyzcal, scl, partiality, correlation);
+      write_text_records(os, records, n, nthreads);
+    }
+
+  private:
+    /**
+     * The columns of the reflections to format
+     */
+    struct Records {
+      const XdsAsciiFormatter &formatter;
+      af::const_ref<cctbx::miller::index<> > miller_index;
+      af::const_ref<double> intensity;
+      af::const_ref<double> sigma;
+      af::const_ref<vec3<double> > xyzcal;
+      af::const_ref<double> scl;
+      af::const_ref<double> partiality;
+      af::const_ref<double> correlation;
+
+      Records(const XdsAsciiFormatter &formatter_,
+              const af::const_ref<cctbx::miller::index<> > &miller_index_,
+              const af::const_ref<double> &intensity_,
+              const af::const_ref<double> &sigma_,
+              const af::const_ref<vec3<double> > &xyzcal_,
+              const af::const_ref<double> &scl_,
+              const af::const_ref<double> &partiality_,
+              const af::const_ref<double> &correlation_)
+          : formatter(formatter_),
+            miller_index(miller_index_),
+            intensity(intensity_),
+            sigma(sigma_),
+            xyzcal(xyzcal_),
+            scl(scl_),
+            partiality(partiality_),
+            correlation(correlation_) {}
+
+      void format(std::size_t i, std::string &text) const {
+        char buffer[8192];
+        const cctbx::miller::index<> &h = miller_index[i];
+        int n = snprintf(buffer,
+                         sizeof(buffer),
+                         "%d %d %d %f %f %f %f %f %f %.1f %.1f %f\n",
+                         h[0],
+                         h[1],
+                         h[2],
+                         intensity[i],
+                         sigma[i],
+                         xyzcal[i][0],
+                         xyzcal[i][1],
+                         xyzcal[i][2],
+                         scl[i],
+                         partiality[i],
+                         correlation[i],
+                         formatter.psi(h, xyzcal[i][2]));
+        DIALS_ASSERT(n > 0 && n < (int)sizeof(buffer));
+        text.append(buffer, n);
+      }
+    };
+
+    mat3<double> UB_;
+    mat3<double> UBinv_;
+    vec3<double> axis_;
+    vec3<double> s0_;
+    double phi_start_;
+    double phi_range_;
+  };
+
+  /**
+   * Format the reflection records of a SADABS file. The direction cosines
+   * of the incident and diffracted beams are computed here from the
+   * setting of the crystal, which is either static or taken from the scan
+   * point nearest the predicted frame of each reflection.
+   */
+  class SadabsFormatter {
+  public:
+    /**
+     * @param A The A matrix, or the A matrix at each scan point
+     * @param F The fixed rotation of the goniometer
+     * @param S The setting rotation of the goniometer
+     * @param axis The rotation axis
+     * @param s0 The incident beam vector
+     * @param phi_start The rotation angle of the start of frame zero
+     * @param phi_range The rotation angle of each frame
+     * @param detector2t The two theta angle of the detector in degrees
+     * @param run The SADABS run number
+     */
+    SadabsFormatter(const af::const_ref<mat3<double> > &A,
+                    mat3<double> F,
+                    mat3<double> S,
+                    vec3<double> axis,
+                    vec3<double> s0,
+                    double phi_start,
+                    double phi_range,
+                    double detector2t,
+                    int run)
+        : A_(A.begin(), A.end()),
+          F_(F),
+          S_(S),
+          axis_(axis),
+          beam_(-s0.normalize()),
+          s0_(s0),
+          phi_start_(phi_start),
+          phi_range_(phi_range),
+          detector2t_(detector2t),
+          run_(run) {
+      DIALS_ASSERT(A.size() > 0);
+      DIALS_ASSERT(phi_range != 0);
+    }
+
+    /**
+     * Write the records of the reflections
+     * @param os The stream to write to
+     * @param miller_index The Miller indices
+     * @param intensity The intensities
+     * @param sigma The sigmas of the intensities
+     * @param xyz The positions in the 512 pixel frame and frames
+     * @param xyzcal The predicted positions in pixels and frames
+     * @param stol The sin(theta) / lambda of each reflection
+     * @param nthreads The number of threads to use
+     */
+    void write(std::ostream &os,
+               const af::const_ref<cctbx::miller::index<> > &miller_index,
+               const af::const_ref<double> &intensity,
+               const af::const_ref<double> &sigma,
+               const af::const_ref<vec3<double> > &xyz,
+               const af::const_ref<vec3<double> > &xyzcal,
+               const af::const_ref<double> &stol,
+               std::size_t nthreads) const {
+      std::size_t n = miller_index.size();
+      DIALS_ASSERT(intensity.size() == n);
+      DIALS_ASSERT(sigma.size() == n);
+      DIALS_ASSERT(xyz.size() == n);
+      DIALS_ASSERT(xyzcal.size() == n);
+      DIALS_ASSERT(stol.size() == n);
+      Records records(*this, miller_index, intensity, sigma, xyz, xyzcal, stol);
+      write_text_records(os, records, n, nthreads);
+    }
+
+  private:
+    /**
+     * The columns of the reflections to format
+     */
+    struct Records {
+      const SadabsFormatter &formatter;
+      af::const_ref<cctbx::miller::index<> > miller_index;
+      af::const_ref<double> intensity;
+      af::const_ref<double> sigma;
+      af::const_ref<vec3<double> > xyz;
+      af::const_ref<vec3<double> > xyzcal;
+      af::const_ref<double> stol;
+
+      Records(const SadabsFormatter &formatter_,
+              const af::const_ref<cctbx::miller::index<> > &miller_index_,
+              const af::const_ref<double> &intensity_,
+              const af::const_ref<double> &sigma_,
+              const af::const_ref<vec3<double> > &xyz_,
+              const af::const_ref<vec3<double> > &xyzcal_,
+              const af::const_ref<double> &stol_)
+          : formatter(formatter_),
+            miller_index(miller_index_),
+            intensity(intensity_),
+            sigma(sigma_),
+            xyz(xyz_),
+            xyzcal(xyzcal_),
+            stol(stol_) {}
+
+      void format(std::size_t i, std::string &text) const {
+        const SadabsFormatter &f = formatter;
+        const cctbx::miller::index<> &h = miller_index[i];
+        vec3<double> hkl(h[0], h[1], h[2]);
+        double z0 = xyzcal[i][2];
+        int istol = (int)detail::round_half_even(10000 * stol[i]);
+
+        // The setting of the crystal at the reflection
+        std::size_t index = 0;
+        if (f.A_.size() > 1) {
+          double z = detail::round_half_even(z0);
+          DIALS_ASSERT(z >= 0 && z < f.A_.size());
+          index = (std::size_t)z;
+        }
+        double phi = f.phi_start_ + z0 * f.phi_range_;
+        vec3<double> e1 =
+          detail::rotate_around_origin(vec3<double>(1, 0, 0), f.axis_, phi);
+        vec3<double> e2 =
+          detail::rotate_around_origin(vec3<double>(0, 1, 0), f.axis_, phi);
+        vec3<double> e3 =
+          detail::rotate_around_origin(vec3<double>(0, 0, 1), f.axis_, phi);
+        mat3<double> R(e1[0], e2[0], e3[0], e1[1], e2[1], e3[1], e1[2], e2[2], e3[2]);
+        mat3<double> RUB = f.S_ * R * f.F_ * f.A_[index];
+
+        vec3<double> s = (f.s0_ + RUB * hkl).normalize();
+        vec3<double> astar = RUB.get_column(0).normalize();
+        vec3<double> bstar = RUB.get_column(1).normalize();
+        vec3<double> cstar = RUB.get_column(2).normalize();
+
+        char buffer[8192];
+        int n = snprintf(buffer,
+                         sizeof(buffer),
+                         "%4d%4d%4d%8.2f%8.2f%4d%8.5f%8.5f%8.5f%8.5f%8.5f%8.5f"
+                         "%7.2f%7.2f%8.2f%7.2f%5d\n",
+                         h[0],
+                         h[1],
+                         h[2],
+                         intensity[i],
+                         sigma[i],
+                         f.run_,
+                         f.beam_ * astar,
+                         s * astar,
+                         f.beam_ * bstar,
+                         s * bstar,
+                         f.beam_ * cstar,
+                         s * cstar,
+                         xyz[i][0],
+                         xyz[i][1],
+                         xyz[i][2],
+                         f.detector2t_,
+                         istol);
+        DIALS_ASSERT(n > 0 && n < (int)sizeof(buffer));
+        text.append(buffer, n);
+      }
+    };
+
+    std::vector<mat3<double> > A_;
+    mat3<double> F_;
+    mat3<double> S_;
+    vec3<double> axis_;
+    vec3<double> beam_;
+    vec3<double> s0_;
+    double phi_start_;
+    double phi_range_;
+    double detector2t_;
+    int run_;
+  };
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_EXPORT_TEXT_H
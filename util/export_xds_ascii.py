@@ -10,12 +10,14 @@
 from rstbx.cftbx.coordinate_frame_helpers import align_reference_frame
 from scitbx import matrix
 
+import dials.util.ext
 from dials.array_family import flex
 from dials.util import Sorry
 from dials.util.filter_reflections import (
     FilteringReductionMethods,
     filter_reflection_table,
 )
+from dials.util.mp import available_cores
 
 try:
     from typing import Tuple
@@ -85,15 +87,13 @@ def _export_experiment(filename, integrated_data, experiment, params, var_model=
     ) = FilteringReductionMethods.calculate_lp_qe_correction_and_filter(integrated_data)
 
     # sort data before output
-    nref = len(integrated_data["miller_index"])
-    indices = flex.size_t_range(nref)
-
     unique = copy.deepcopy(integrated_data["miller_index"])
 
     map_to_asu(experiment.crystal.get_space_group().type(), False, unique)
 
-    perm = sorted(indices, key=lambda k: unique[k])
-    integrated_data = integrated_data.select(flex.size_t(perm))
+    perm = flex.sort_permutation(flex.pack_miller_indices(unique), stable=True)
+    integrated_data = integrated_data.select(perm)
+    scl = scl.select(perm)
 
     if experiment.goniometer is None:
         print("Warning: No goniometer. Experimentally exporting with (1 0 0) axis")
@@ -124,7 +124,7 @@ def _export_experiment(filename, integrated_data, experiment, params, var_model=
     if "partiality" in integrated_data:
         partiality = 100 * integrated_data["partiality"]
     else:
-        prof_corr = flex.double(nref, 100.0)
+        partiality = flex.double(nref, 100.0)
 
     if "intensity.sum.value" in integrated_data:
         I = integrated_data["intensity.sum.value"]
@@ -219,52 +219,24 @@ def _export_experiment(filename, integrated_data, experiment, params, var_model=
         )
     )
 
-    # then write the data records
+    # then write the data records, formatted in C++ across threads into the
+    # binary buffer under the text file
 
     s0 = Rd * matrix.col(experiment.beam.get_s0())
 
-    for j in range(nref):
-        x, y, z = integrated_data["xyzcal.px"][j]
-        phi = phi_start + z * phi_range
-        h, k, l = miller_index[j]
-        X = (UB * (h, k, l)).rotate(axis, phi, deg=True)
-        s = s0 + X
-        g = s.cross(s0).normalize()
-
-        # find component of beam perpendicular to f, e
-        e = -(s + s0).normalize()
-        if h == k and k == l:
-            u = (h, -h, 0)
-        else:
-            u = (k - l, l - h, h - k)
-        q = (
-            (matrix.col(u).transpose() * UB.inverse())
-            .normalize()
-            .transpose()
-            .rotate(axis, phi, deg=True)
-        )
-
-        psi = q.angle(g, deg=True)
-        if q.dot(e) < 0:
-            psi *= -1
-
-        fout.write(
-            "%d %d %d %f %f %f %f %f %f %.1f %.1f %f\n"
-            % (
-                h,
-                k,
-                l,
-                I[j],
-                sigI[j],
-                x,
-                y,
-                z,
-                scl[j],
-                partiality[j],
-                prof_corr[j],
-                psi,
-            )
-        )
+    formatter = dials.util.ext.XdsAsciiFormatter(UB, axis, s0, phi_start, phi_range)
+    fout.flush()
+    formatter.write(
+        dials.util.ext.streambuf(python_file_obj=fout.buffer),
+        miller_index,
+        I,
+        sigI,
+        integrated_data["xyzcal.px"],
+        scl,
+        partiality,
+        prof_corr,
+        nthreads=available_cores(),
+    )
 
     fout.write("!END_OF_DATA\n")
     fout.close()
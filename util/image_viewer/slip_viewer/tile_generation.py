@@ -1,5 +1,6 @@
 from __future__ import absolute_import, division, print_function
 
+import collections
 import math
 import sys
 
@@ -243,6 +244,10 @@ class _Tiles(object):
     # maximum number of tiles held in each level cache
     MaxTileList = 512
 
+    # maximum number of brightness and colour scheme renderings kept, with
+    # their tiles, so that going back to recent settings needs no re-render
+    MaxRenderings = 4
+
     def __init__(self, filename):
         (self.tile_size_x, self.tile_size_y) = (256, 256)
         self.levels = [-3, -2, -1, 0, 1, 2, 3, 4, 5]
@@ -307,6 +312,7 @@ def set_image(
 
         if self.zoom_level >= 0:
             self.flex_image.adjust(color_scheme=self.current_color_scheme)
+        self.keep_rendering()
 
     def set_image_data(self, raw_image_data, show_saturated=True):
         self.reset_the_cache()
@@ -325,34 +331,73 @@ def set_image_data(self, raw_image_data, show_saturated=True):
         )
 
         self.flex_image.adjust(color_scheme=self.current_color_scheme)
+        self.keep_rendering()
 
     def update_brightness(self, b, color_scheme=0):
-        image_data = self.raw_image.get_image_data()
-        if not isinstance(image_data, tuple):
-            image_data = (image_data,)
-
-        self.flex_image = get_flex_image_multipanel(
-            brightness=b / 100,
-            panels=self.raw_image.get_detector(),
-            show_untrusted=self.show_untrusted,
-            image_data=image_data,
-            beam=self.raw_image.get_beam(),
-            color_scheme=color_scheme,
-        )
+        if not self.use_rendering(b, color_scheme):
+            image_data = self.raw_image.get_image_data()
+            if not isinstance(image_data, tuple):
+                image_data = (image_data,)
+
+            self.flex_image = get_flex_image_multipanel(
+                brightness=b / 100,
+                panels=self.raw_image.get_detector(),
+                show_untrusted=self.show_untrusted,
+                image_data=image_data,
+                beam=self.raw_image.get_beam(),
+                color_scheme=color_scheme,
+            )
 
-        self.reset_the_cache()
-        self.UseLevel(self.zoom_level)
+            self.new_tile_caches()
+            self.flex_image.adjust(color_scheme)
         self.current_color_scheme = color_scheme
         self.current_brightness = b
-        self.flex_image.adjust(color_scheme)
+        self.keep_rendering()
+        self.UseLevel(self.zoom_level)
 
     def update_color_scheme(self, color_scheme=0):
-        self.flex_image.adjust(color_scheme)
-        self.reset_the_cache()
-        self.UseLevel(self.zoom_level)
+        if not self.use_rendering(self.current_brightness, color_scheme):
+            # The flex image is changed in place, so the tiles of the
+            # previous colour scheme can't be rendered from it any more
+            self.renderings.pop(self.rendering_key(), None)
+            self.flex_image.adjust(color_scheme)
+            self.new_tile_caches()
         self.current_color_scheme = color_scheme
+        self.keep_rendering()
+        self.UseLevel(self.zoom_level)
+
+    def rendering_key(self, brightness=None, color_scheme=None):
+        if brightness is None:
+            brightness = self.current_brightness
+        if color_scheme is None:
+            color_scheme = self.current_color_scheme
+        return (brightness, color_scheme, self.show_untrusted)
+
+    def use_rendering(self, brightness, color_scheme):
+        """Switch to a kept rendering of the image, with its tile caches.
+
+        Returns True if there is one for the brightness and colour scheme."""
+        key = self.rendering_key(brightness, color_scheme)
+        if key not in self.renderings:
+            return False
+        self.flex_image, self.cache, self.lru = self.renderings[key]
+        return True
+
+    def keep_rendering(self):
+        """Keep the current rendering as the most recently used, dropping the
+        least recently used if there are too many"""
+        key = self.rendering_key()
+        self.renderings.pop(key, None)
+        self.renderings[key] = (self.flex_image, self.cache, self.lru)
+        while len(self.renderings) > self.MaxRenderings:
+            self.renderings.popitem(last=False)
 
     def reset_the_cache(self):
+        self.new_tile_caches()
+        # the tiles kept for other renderings are out of date too
+        self.renderings = collections.OrderedDict()
+
+    def new_tile_caches(self):
         # setup the tile caches and Least Recently Used lists
         self.cache = {}
         self.lru = {}
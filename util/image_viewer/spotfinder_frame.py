@@ -30,6 +30,7 @@
 from dials.util import masking
 from dials.util.image_viewer.mask_frame import MaskSettingsFrame
 from dials.util.image_viewer.spotfinder_wrap import chooser_wrapper
+from dials.util.mp import available_cores
 
 from .slip_viewer.frame import MASK_VAL, XrayFrame
 from .viewer_tools import (
@@ -80,6 +81,9 @@ def create_load_image_event(destination, filename):
 
 
 class SpotFrame(XrayFrame):
+    # the number of dispersion threshold debug results kept
+    dispersion_debug_memo_size = 4
+
     def __init__(self, *args, **kwds):
         self.experiments = kwds.pop("experiments")
         self.reflections = kwds.pop("reflections")
@@ -118,7 +122,7 @@ def __init__(self, *args, **kwds):
         self._mask_frame = None
 
         self.display_foreground_circles_patch = False  # hard code this option, for now
-        self._dispersion_debug_memo = {}
+        self._dispersion_debug_memo = collections.OrderedDict()
 
         if (
             self.experiments is not None
@@ -916,9 +920,17 @@ def _calculate_dispersion_debug(self, image):
         request["size"] = self.settings.kernel_size
         request["extended"] = self.settings.dispersion_extended
 
-        # If the request was already cached, return the result
-        if request == self._dispersion_debug_memo:
-            return self._kabsch_debug_list
+        # If the request was already cached, return the result, so that going
+        # back to a recent image or set of parameters needs no recalculation
+        # (the kernel size may be a list, which can't be hashed)
+        key = tuple(
+            (name, tuple(value) if isinstance(value, list) else value)
+            for name, value in sorted(request.items())
+        )
+        if key in self._dispersion_debug_memo:
+            kabsch_debug_list = self._dispersion_debug_memo.pop(key)
+            self._dispersion_debug_memo[key] = kabsch_debug_list
+            return kabsch_debug_list
 
         detector = image.get_detector()
         image_mask = self.get_mask(image)
@@ -945,11 +957,14 @@ def _calculate_dispersion_debug(self, image):
                     self.settings.nsigma_s,
                     self.settings.global_threshold,
                     self.settings.min_local,
+                    nthreads=available_cores(),
                 )
             )
-        # Store the request in cache and return the result
-        self._dispersion_debug_memo = request
-        self._kabsch_debug_list = kabsch_debug_list
+        # Store the request in cache, dropping the least recently used, and
+        # return the result
+        self._dispersion_debug_memo[key] = kabsch_debug_list
+        while len(self._dispersion_debug_memo) > self.dispersion_debug_memo_size:
+            self._dispersion_debug_memo.popitem(last=False)
         return kabsch_debug_list
 
     def show_filters(self):
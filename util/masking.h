@@ -12,9 +12,12 @@
 #define DIALS_UTIL_MASKING_H
 
 #include <algorithm>
+#include <utility>
+#include <vector>
 #include <dxtbx/model/beam.h>
 #include <dxtbx/model/panel.h>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
 #include <dials/error.h>
 
 namespace dials { namespace util {
@@ -24,6 +27,38 @@ namespace dials { namespace util {
   using scitbx::vec2;
   using scitbx::vec3;
 
+  namespace detail {
+
+    /**
+     * Compute the resolution at the centre of each pixel for a band of rows
+     */
+    struct ResolutionMapBand {
+      const Panel &panel;
+      vec3<double> s0;
+      af::ref<double, af::c_grid<2> > resolution;
+
+      ResolutionMapBand(const Panel &panel_,
+                        vec3<double> s0_,
+                        af::ref<double, af::c_grid<2> > resolution_)
+          : panel(panel_), s0(s0_), resolution(resolution_) {}
+
+      void operator()(int j0, int j1) const {
+        for (int j = j0; j < j1; ++j) {
+          for (std::size_t i = 0; i < resolution.accessor()[1]; ++i) {
+            vec2<double> px(i + 0.5, j + 0.5);
+            try {
+              resolution(j, i) = panel.get_resolution_at_pixel(s0, px);
+            } catch (dxtbx::error) {
+              // Known failure: resolution at beam center is undefined
+              resolution(j, i) = 0.0;
+            }
+          }
+        }
+      }
+    };
+
+  }  // namespace detail
+
   /**
    * A class to mask multiple resolution ranges
    */
@@ -33,22 +68,24 @@ namespace dials { namespace util {
      * Initialise the resolution at each pixel
      * @param beam The beam model
      * @param panel The panel model
+     * @param nthreads The number of threads to use
      */
-    ResolutionMaskGenerator(const BeamBase &beam, const Panel &panel)
+    ResolutionMaskGenerator(const BeamBase &beam,
+                            const Panel &panel,
+                            std::size_t nthreads = 1)
         : resolution_(
           af::c_grid<2>(panel.get_image_size()[1], panel.get_image_size()[0])) {
-      vec3<double> s0 = beam.get_s0();
-      for (std::size_t j = 0; j < resolution_.accessor()[0]; ++j) {
-        for (std::size_t i = 0; i < resolution_.accessor()[1]; ++i) {
-          vec2<double> px(i + 0.5, j + 0.5);
-          try {
-            resolution_(j, i) = panel.get_resolution_at_pixel(s0, px);
-          } catch (dxtbx::error) {
-            // Known failure: resolution at beam center is undefined
-            resolution_(j, i) = 0.0;
-          }
-        }
-      }
+      dials::algorithms::for_each_band(
+        detail::ResolutionMapBand(panel, beam.get_s0(), resolution_.ref()),
+        (int)resolution_.accessor()[0],
+        nthreads);
+    }
+
+    /**
+     * @returns The resolution at the centre of each pixel
+     */
+    af::versa<double, af::c_grid<2> > resolution() const {
+      return resolution_;
     }
 
     /**
@@ -71,6 +108,53 @@ namespace dials { namespace util {
       }
     }
 
+    /**
+     * Apply the mask for several resolution ranges in a single pass over the
+     * image. The result is the same as calling apply for each range but, for
+     * many ranges such as the ice rings, the resolution of each pixel is
+     * only looked up in the sorted ranges rather than read once per range.
+     * @param mask The mask
+     * @param d_min The high resolution of each range
+     * @param d_max The low resolution of each range
+     */
+    void apply_ranges(af::ref<bool, af::c_grid<2> > mask,
+                      const af::const_ref<double> &d_min,
+                      const af::const_ref<double> &d_max) const {
+      DIALS_ASSERT(d_min.size() == d_max.size());
+      DIALS_ASSERT(resolution_.accessor()[0] == mask.accessor()[0]);
+      DIALS_ASSERT(resolution_.accessor()[1] == mask.accessor()[1]);
+      if (d_min.size() == 0) {
+        return;
+      }
+
+      // Merge the ranges into a sorted list of disjoint ranges
+      std::vector<std::pair<double, double> > ranges;
+      for (std::size_t k = 0; k < d_min.size(); ++k) {
+        DIALS_ASSERT(d_min[k] < d_max[k]);
+        ranges.push_back(std::make_pair(d_min[k], d_max[k]));
+      }
+      std::sort(ranges.begin(), ranges.end());
+      std::vector<double> lower(1, ranges[0].first);
+      std::vector<double> upper(1, ranges[0].second);
+      for (std::size_t k = 1; k < ranges.size(); ++k) {
+        if (ranges[k].first <= upper.back()) {
+          upper.back() = std::max(upper.back(), ranges[k].second);
+        } else {
+          lower.push_back(ranges[k].first);
+          upper.push_back(ranges[k].second);
+        }
+      }
+
+      // Mask the pixels within any of the ranges
+      for (std::size_t k = 0; k < resolution_.size(); ++k) {
+        double d = resolution_[k];
+        std::size_t n = std::upper_bound(lower.begin(), lower.end(), d) - lower.begin();
+        if (n > 0 && d <= upper[n - 1]) {
+          mask[k] = false;
+        }
+      }
+    }
+
   private:
     af::versa<double, af::c_grid<2> > resolution_;
   };
@@ -1,5 +1,6 @@
 from __future__ import absolute_import, division, print_function
 
+import copy
 import logging
 import math
 import warnings
@@ -182,14 +183,36 @@ def generate_ice_ring_resolution_ranges(beam, panel, params):
             yield (d_min, d_max)
 
 
+class _ResolutionMaskers(object):
+    """The resolution maskers for each panel of a detector, created on demand."""
+
+    def __init__(self, beam, detector):
+        self._beam = beam
+        self._detector = detector
+        self._maskers = [None] * len(detector)
+
+    def __getitem__(self, index):
+        if self._maskers[index] is None:
+            self._maskers[index] = ResolutionMaskGenerator(
+                self._beam, self._detector[index]
+            )
+        return self._maskers[index]
+
+
 @lru_equality_cache(maxsize=3)
-def _get_resolution_masker(beam, panel):
+def _get_resolution_maskers(beam, detector):
+    # Cached for the whole detector rather than per panel so that the maps of
+    # all the panels of a multi-panel detector are kept between calls
     logger.debug("resolution masker cache miss")
-    return ResolutionMaskGenerator(beam, panel)
+    return _ResolutionMaskers(beam, detector)
 
 
-def _apply_resolution_mask(mask, beam, panel, *args):
-    _get_resolution_masker(beam, panel).apply(mask, *args)
+def _apply_resolution_mask(mask, beam, detector, index, ranges):
+    if ranges:
+        d_min, d_max = zip(*ranges)
+        _get_resolution_maskers(beam, detector)[index].apply_ranges(
+            mask, flex.double(d_min), flex.double(d_max)
+        )
 
 
 class MaskGenerator(object):
@@ -205,13 +228,9 @@ def generate(self, imageset):
         detector = imageset.get_detector()
         beam = imageset.get_beam()
 
-        # Get the first image
-        image = imageset.get_raw_data(0)
-        assert len(detector) == len(image)
-
         # Create the mask for each panel
         masks = []
-        for index, (im, panel) in enumerate(zip(image, detector)):
+        for index, panel in enumerate(detector):
 
             # Build a trusted mask by looking for pixels that are always outside
             # the trusted range. This identifies bad pixels, but does not include
@@ -243,7 +262,7 @@ def generate(self, imageset):
                         break
                 mask = trusted_mask
             else:
-                mask = flex.bool(flex.grid(im.all()), True)
+                mask = flex.bool(flex.grid(panel.get_image_size()[::-1]), True)
 
             # Add a border around the image
             if self.params.border > 0:
@@ -307,19 +326,21 @@ def generate(self, imageset):
                     if region.pixel is not None:
                         mask[region.pixel] = False
 
-            # Generate high and low resolution masks
+            # Generate high and low resolution masks. The resolution ranges
+            # are collected and applied to the mask in a single pass.
+            ranges = []
             if self.params.d_min is not None:
                 logger.debug(
                     f"Generating high resolution mask:\n d_min = {self.params.d_min}"
                 )
-                _apply_resolution_mask(mask, beam, panel, 0, self.params.d_min)
+                ranges.append((0, self.params.d_min))
             if self.params.d_max is not None:
                 logger.debug(
                     f"Generating low resolution mask:\n d_max = {self.params.d_max}"
                 )
                 d_max = self.params.d_max
                 d_inf = max(d_max + 1, 1e9)
-                _apply_resolution_mask(mask, beam, panel, d_max, d_inf)
+                ranges.append((d_max, d_inf))
 
             try:
                 # Mask out the resolution range
@@ -332,7 +353,7 @@ def generate(self, imageset):
                         + f" d_min = {d_min}\n"
                         + f" d_max = {d_max}"
                     )
-                    _apply_resolution_mask(mask, beam, panel, d_min, d_max)
+                    ranges.append((d_min, d_max))
             except TypeError:
                 # Catch the default value None of self.params.resolution_range
                 if any(self.params.resolution_range):
@@ -350,10 +371,49 @@ def generate(self, imageset):
                     + f" d_min = {d_min:.4f}\n"
                     + f" d_max = {d_max:.4f}"
                 )
-                _apply_resolution_mask(mask, beam, panel, d_min, d_max)
+                ranges.append((d_min, d_max))
+            _apply_resolution_mask(mask, beam, detector, index, ranges)
 
             # Add to the list
             masks.append(mask)
 
         # Return the mask
         return tuple(masks)
+
+
+class CachedMaskGenerator(MaskGenerator):
+    """
+    Generate a mask, reusing the mask generated for an earlier imageset with
+    the same detector and beam. The arrays of a cached mask are shared between
+    imagesets, so must not be modified.
+    """
+
+    def __init__(self, params, maxsize=8):
+        """
+        Set the parameters.
+
+        :param params: The mask parameters
+        :param maxsize: The maximum number of masks to keep
+        """
+        super().__init__(params)
+        self.maxsize = maxsize
+        self._cache = []
+
+    def generate(self, imageset):
+        """Generate the mask, or get it from the cache."""
+        # The trusted range mask depends on the image data
+        if self.params.use_trusted_range:
+            return super().generate(imageset)
+
+        # The models are compared by equality, as lru_equality_cache
+        key = (imageset.get_detector(), imageset.get_beam())
+        for i, (cached_key, mask) in enumerate(self._cache):
+            if cached_key == key:
+                self._cache.append(self._cache.pop(i))
+                return mask
+        mask = super().generate(imageset)
+        # Keep copies of the models, which may be changed after this
+        self._cache.append((copy.deepcopy(key), mask))
+        if len(self._cache) > self.maxsize:
+            self._cache.pop(0)
+        return mask
@@ -8,23 +8,45 @@
 import libtbx.easy_mp
 
 
-def available_cores() -> int:
+def cgroup_cpu_limit(root="/sys/fs/cgroup"):
     """
-    Determine the number of available processor cores.
+    Determine the number of processor cores allowed by the CPU quota of the
+    control group, e.g. of a container, which the process runs in.
+
+    :param root: The mount point of the control group file system
+    :return: The quota rounded up to whole cores or None if there is no quota
+    """
+    # cgroup v2 has "<quota> <period>" or "max <period>" in cpu.max, whereas
+    # cgroup v1 has the quota, or -1, and the period in separate files
+    try:
+        with open(os.path.join(root, "cpu.max")) as fh:
+            quota, period = fh.read().split()[:2]
+    except (IOError, OSError, ValueError):
+        try:
+            with open(os.path.join(root, "cpu", "cpu.cfs_quota_us")) as fh:
+                quota = fh.read().strip()
+            with open(os.path.join(root, "cpu", "cpu.cfs_period_us")) as fh:
+                period = fh.read().strip()
+        except (IOError, OSError):
+            return None
+    try:
+        quota, period = int(quota), int(period)
+    except ValueError:
+        return None
+    if quota <= 0 or period <= 0:
+        return None
+    return max(1, -(-quota // period))
+
+
+def _affinity_cores():
+    """
+    Determine the number of processor cores the process may run on.
 
     There are a number of different methods to get this information, some of
     which may not be available on a specific OS and/or version of Python. So try
     them in order and return the first successful one.
     """
 
-    nproc = os.environ.get("NSLOTS", 0)
-    try:
-        nproc = int(nproc)
-        if nproc >= 1:
-            return nproc
-    except ValueError:
-        pass
-
     try:
         return len(os.sched_getaffinity(0))
     except AttributeError:
@@ -46,6 +68,67 @@ def available_cores() -> int:
     return 1
 
 
+def available_cores() -> int:
+    """
+    Determine the number of available processor cores.
+
+    The NSLOTS environment variable set by the cluster scheduler takes
+    precedence. Otherwise this is the number of cores the process may run on,
+    limited by any CPU quota of its control group.
+    """
+
+    nproc = os.environ.get("NSLOTS", 0)
+    try:
+        nproc = int(nproc)
+        if nproc >= 1:
+            return nproc
+    except ValueError:
+        pass
+
+    nproc = _affinity_cores()
+    quota = cgroup_cpu_limit()
+    if quota is not None:
+        nproc = min(nproc, quota)
+    return nproc
+
+
+def threads_per_process(nproc):
+    """
+    The number of threads each of nproc processes may use, so that together
+    they do not use more than the available cores.
+
+    :param nproc: The number of processes
+    :return: The number of threads per process
+    """
+    return max(1, available_cores() // max(1, nproc))
+
+
+class ThreadLimitedFunction(object):
+    """
+    A function called in each of nproc processes. The threaded algorithms of
+    the process are limited, through the DIALS_MAX_THREADS environment variable
+    which the C++ thread pools read, to the process's share of the cores. This
+    stops nproc processes each running up to mp.nproc threads, e.g. through
+    nthreads=params.mp.nproc, from oversubscribing the cores.
+    """
+
+    def __init__(self, func, nproc):
+        self.func = func
+        self.nthreads = threads_per_process(nproc)
+
+    def __call__(self, *args, **kwargs):
+        # A limit set by the user is only ever lowered
+        nthreads = self.nthreads
+        try:
+            limit = int(os.environ.get("DIALS_MAX_THREADS", 0))
+            if limit > 0:
+                nthreads = min(nthreads, limit)
+        except ValueError:
+            pass
+        os.environ["DIALS_MAX_THREADS"] = str(nthreads)
+        return self.func(*args, **kwargs)
+
+
 def parallel_map(
     func,
     iterable,
@@ -109,7 +192,7 @@ def __init__(
         self.func = func
         self.nproc = nproc
         self.asynchronous = asynchronous
-        self.preserve_order = (preserve_order,)
+        self.preserve_order = preserve_order
         self.preserve_exception_message = preserve_exception_message
 
     def __call__(self, iterable):
@@ -117,7 +200,7 @@ def __call__(self, iterable):
         Call the function
         """
         return libtbx.easy_mp.parallel_map(
-            func=self.func,
+            func=ThreadLimitedFunction(self.func, self.nproc),
             iterable=iterable,
             processes=self.nproc,
             method="multiprocessing",
@@ -163,8 +246,28 @@ def multi_node_parallel_map(
     """
     A wrapper function to call a function using multiple cluster nodes and with
     multiple processors on each node
+
+    On a single node the items are shared dynamically between the processes, so
+    that a process takes the next item as soon as it is free. On a cluster each
+    job is given nproc items, which its node shares between its processes.
     """
 
+    # On one node map the items directly rather than in groups of nproc, which
+    # would wait for the slowest item of each group before starting the next
+    if njobs == 1:
+        return list(
+            libtbx.easy_mp.parallel_map(
+                func=ThreadLimitedFunction(func, nproc),
+                iterable=iterable,
+                callback=callback,
+                method="multiprocessing",
+                processes=nproc,
+                asynchronous=asynchronous,
+                preserve_order=preserve_order,
+                preserve_exception_message=preserve_exception_message,
+            )
+        )
+
     # The function to all on the cluster
     cluster_func = MultiNodeClusterFunction(
         func=func,
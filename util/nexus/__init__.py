@@ -20,9 +20,9 @@ def get_entry(filename, mode="a"):
     return entry
 
 
-def load(filename):
+def load(filename, rows=slice(None)):
     entry = get_entry(filename, "r")
-    ref, exp_index = nx_reflections.load(entry)
+    ref, exp_index = nx_reflections.load(entry, rows)
     exp = nx_mx.load(entry, exp_index)
     return exp, ref
 
@@ -5,10 +5,32 @@
 from dials.array_family import flex
 
 
+# The target size in bytes of a chunk of a column
+chunk_bytes = 1 << 20
+
+
+def chunk_shape(shape, itemsize):
+    """The chunk shape of a column, holding whole rows up to chunk_bytes"""
+    row_bytes = itemsize * int(np.prod(shape[1:]))
+    nrows = max(1, min(shape[0], chunk_bytes // max(row_bytes, 1)))
+    return (nrows,) + tuple(shape[1:])
+
+
 def make_dataset(handle, name, dtype, data, description, units=None):
-    dset = handle.create_dataset(
-        name, data.focus(), dtype=dtype, data=data.as_numpy_array().astype(dtype)
-    )
+    array = data.as_numpy_array()
+    if array.dtype != np.dtype(dtype):
+        array = array.astype(dtype)
+    options = {}
+    if array.size > 0:
+        # Store the columns in chunks of rows, so they can be compressed and
+        # a range of rows can be read without reading the whole column
+        options = {
+            "chunks": chunk_shape(array.shape, array.dtype.itemsize),
+            "compression": "gzip",
+            "compression_opts": 1,
+            "shuffle": True,
+        }
+    dset = handle.create_dataset(name, data=array, **options)
     dset.attrs["description"] = description
     if units is not None:
         dset.attrs["units"] = units
@@ -47,10 +69,7 @@ def make_vlen_uint(handle, name, data, description, units=None):
 
 def write(handle, key, data):
     if key == "miller_index":
-        col1, col2, col3 = zip(*list(data))
-        col1 = flex.int(col1)
-        col2 = flex.int(col2)
-        col3 = flex.int(col3)
+        col1, col2, col3 = (c.iround() for c in data.as_vec3_double().parts())
         dsc1 = "The h component of the miller index"
         dsc2 = "The k component of the miller index"
         dsc3 = "The l component of the miller index"
@@ -199,121 +218,122 @@ def write(handle, key, data):
         raise KeyError("Column %s not written to file" % key)
 
 
-def read(handle, key):
+def read(handle, key, rows=slice(None)):
+    """Read a column, or a range of rows of it given by the slice rows"""
     from dxtbx.format.nexus import convert_units
 
     if key == "miller_index":
-        h = flex.int(handle["h"][:].astype(np.int32))
-        k = flex.int(handle["k"][:].astype(np.int32))
-        l = flex.int(handle["l"][:].astype(np.int32))
+        h = flex.int(handle["h"][rows].astype(np.int32))
+        k = flex.int(handle["k"][rows].astype(np.int32))
+        l = flex.int(handle["l"][rows].astype(np.int32))
         return flex.miller_index(h, k, l)
     elif key == "id":
-        return flex.int(handle["id"][:].astype(int))
+        return flex.int(handle["id"][rows].astype(int))
     elif key == "partial_id":
-        return flex.size_t(handle["reflection_id"][:].astype(int))
+        return flex.size_t(handle["reflection_id"][rows].astype(int))
     elif key == "entering":
-        return flex.bool(handle["entering"][:].astype(np.bool))
+        return flex.bool(handle["entering"][rows].astype(np.bool))
     elif key == "flags":
-        return flex.size_t(handle["flags"][:].astype(int))
+        return flex.size_t(handle["flags"][rows].astype(int))
     elif key == "panel":
-        return flex.size_t(handle["det_module"][:].astype(int))
+        return flex.size_t(handle["det_module"][rows].astype(int))
     elif key == "d":
-        return flex.double(handle["d"][:])
+        return flex.double(handle["d"][rows])
     elif key == "partiality":
-        return flex.double(handle["partiality"][:])
+        return flex.double(handle["partiality"][rows])
     elif key == "xyzcal.px":
-        x = flex.double(handle["predicted_px_x"][:])
-        y = flex.double(handle["predicted_px_y"][:])
-        z = flex.double(handle["predicted_frame"][:])
+        x = flex.double(handle["predicted_px_x"][rows])
+        y = flex.double(handle["predicted_px_y"][rows])
+        z = flex.double(handle["predicted_frame"][rows])
         return flex.vec3_double(x, y, z)
     elif key == "xyzcal.mm":
         x = convert_units(
-            flex.double(handle["predicted_x"][:]),
+            flex.double(handle["predicted_x"][rows]),
             handle["predicted_x"].attrs["units"],
             "mm",
         )
         y = convert_units(
-            flex.double(handle["predicted_y"][:]),
+            flex.double(handle["predicted_y"][rows]),
             handle["predicted_y"].attrs["units"],
             "mm",
         )
         z = convert_units(
-            flex.double(handle["predicted_phi"][:]),
+            flex.double(handle["predicted_phi"][rows]),
             handle["predicted_phi"].attrs["units"],
             "rad",
         )
         return flex.vec3_double(x, y, z)
     elif key == "bbox":
-        b = flex.int(handle["bounding_box"][:].astype(np.int32))
+        b = flex.int(handle["bounding_box"][rows].astype(np.int32))
         return flex.int6(b.as_1d())
     elif key == "xyzobs.px.value":
-        x = flex.double(handle["observed_px_x"][:])
-        y = flex.double(handle["observed_px_y"][:])
-        z = flex.double(handle["observed_frame"][:])
+        x = flex.double(handle["observed_px_x"][rows])
+        y = flex.double(handle["observed_px_y"][rows])
+        z = flex.double(handle["observed_frame"][rows])
         return flex.vec3_double(x, y, z)
     elif key == "xyzobs.px.variance":
-        x = flex.double(handle["observed_px_x_var"][:])
-        y = flex.double(handle["observed_px_y_var"][:])
-        z = flex.double(handle["observed_frame_var"][:])
+        x = flex.double(handle["observed_px_x_var"][rows])
+        y = flex.double(handle["observed_px_y_var"][rows])
+        z = flex.double(handle["observed_frame_var"][rows])
         return flex.vec3_double(x, y, z)
     elif key == "xyzobs.mm.value":
         x = convert_units(
-            flex.double(handle["observed_x"][:]),
+            flex.double(handle["observed_x"][rows]),
             handle["observed_x"].attrs["units"],
             "mm",
         )
         y = convert_units(
-            flex.double(handle["observed_y"][:]),
+            flex.double(handle["observed_y"][rows]),
             handle["observed_y"].attrs["units"],
             "mm",
         )
         z = convert_units(
-            flex.double(handle["observed_phi"][:]),
+            flex.double(handle["observed_phi"][rows]),
             handle["observed_phi"].attrs["units"],
             "rad",
         )
         return flex.vec3_double(x, y, z)
     elif key == "xyzobs.mm.variance":
         x = convert_units(
-            flex.double(handle["observed_x_var"][:]),
+            flex.double(handle["observed_x_var"][rows]),
             handle["observed_x_var"].attrs["units"],
             "mm",
         )
         y = convert_units(
-            flex.double(handle["observed_y_var"][:]),
+            flex.double(handle["observed_y_var"][rows]),
             handle["observed_y_var"].attrs["units"],
             "mm",
         )
         z = convert_units(
-            flex.double(handle["observed_phi_var"][:]),
+            flex.double(handle["observed_phi_var"][rows]),
             handle["observed_phi_var"].attrs["units"],
             "rad",
         )
         return flex.vec3_double(x, y, z)
     elif key == "background.mean":
-        return flex.double(handle["background_mean"][:])
+        return flex.double(handle["background_mean"][rows])
     elif key == "intensity.sum.value":
-        return flex.double(handle["int_sum"][:])
+        return flex.double(handle["int_sum"][rows])
     elif key == "intensity.sum.variance":
-        return flex.double(handle["int_sum_var"][:])
+        return flex.double(handle["int_sum_var"][rows])
     elif key == "intensity.prf.value":
-        return flex.double(handle["int_prf"][:])
+        return flex.double(handle["int_prf"][rows])
     elif key == "intensity.prf.variance":
-        return flex.double(handle["int_prf_var"][:])
+        return flex.double(handle["int_prf_var"][rows])
     elif key == "profile.correlation":
-        return flex.double(handle["prf_cc"][:])
+        return flex.double(handle["prf_cc"][rows])
     elif key == "lp":
-        return flex.double(handle["lp"][:])
+        return flex.double(handle["lp"][rows])
     elif key == "num_pixels.background":
-        return flex.int(handle["num_bg"][:].astype(np.int32))
+        return flex.int(handle["num_bg"][rows].astype(np.int32))
     elif key == "num_pixels.background_used":
-        return flex.int(handle["num_bg_used"][:].astype(np.int32))
+        return flex.int(handle["num_bg_used"][rows].astype(np.int32))
     elif key == "num_pixels.foreground":
-        return flex.int(handle["num_fg"][:].astype(np.int32))
+        return flex.int(handle["num_fg"][rows].astype(np.int32))
     elif key == "num_pixels.valid":
-        return flex.int(handle["num_valid"][:].astype(np.int32))
+        return flex.int(handle["num_valid"][rows].astype(np.int32))
     elif key == "profile.rmsd":
-        return flex.double(handle["prf_rmsd"][:])
+        return flex.double(handle["prf_rmsd"][rows])
     else:
         raise KeyError("Column %s not read from file" % key)
 
@@ -362,7 +382,7 @@ def dump(entry, reflections, experiments):
     # make_vlen_uint(refls, "overlaps", overlaps, "Reflection overlap list")
 
 
-def load(entry):
+def load(entry, rows=slice(None)):
     print("Loading NXreflections")
 
     # Check the feature is present
@@ -420,7 +440,7 @@ def load(entry):
     # For each column in the reflection table dump to file
     for key in columns:
         try:
-            col = read(refls, key)
+            col = read(refls, key, rows)
         except KeyError:
             continue
         if table is None:
@@ -0,0 +1,156 @@
+/*
+ * numa.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_NUMA_H
+#define DIALS_UTIL_NUMA_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace dials { namespace util { namespace numa {
+
+  /**
+   * Helpers to place threads and memory on the NUMA nodes of a Linux host.
+   * They talk to the kernel directly rather than through libnuma. On other
+   * platforms, or if the information is not available, threads are not pinned
+   * and every CPU and page is reported as being on node -1.
+   */
+
+  /**
+   * @param cpu The CPU number
+   * @returns The NUMA node of the CPU or -1 if unknown
+   */
+  inline int cpu_node(int cpu) {
+#ifdef __linux__
+    char path[64];
+    std::sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+      return -1;
+    }
+    int node = -1;
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+      int n = 0;
+      if (std::sscanf(entry->d_name, "node%d", &n) == 1) {
+        node = n;
+        break;
+      }
+    }
+    closedir(dir);
+    return node;
+#else
+    return -1;
+#endif
+  }
+
+  /**
+   * @returns The CPUs the process is allowed to run on
+   */
+  inline std::vector<int> allowed_cpus() {
+    std::vector<int> result;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &set)) {
+          result.push_back(i);
+        }
+      }
+    }
+#endif
+    return result;
+  }
+
+  /**
+   * Order the allowed CPUs so that consecutive CPUs are on different nodes.
+   * Pinning thread i to CPU i then spreads the threads evenly over the nodes.
+   * @returns The allowed CPUs interleaved by node
+   */
+  inline std::vector<int> interleaved_cpus() {
+    std::vector<int> cpus = allowed_cpus();
+    std::map<int, std::vector<int> > by_node;
+    for (std::size_t i = 0; i < cpus.size(); ++i) {
+      by_node[cpu_node(cpus[i])].push_back(cpus[i]);
+    }
+    std::vector<int> result;
+    for (std::size_t j = 0; result.size() < cpus.size(); ++j) {
+      for (std::map<int, std::vector<int> >::iterator it = by_node.begin();
+           it != by_node.end();
+           ++it) {
+        if (j < it->second.size()) {
+          result.push_back(it->second[j]);
+        }
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Pin the calling thread to a CPU
+   * @param cpu The CPU number
+   * @returns True/False the thread was pinned
+   */
+  inline bool pin_current_thread(int cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @returns The NUMA node the calling thread is running on or -1 if unknown
+   */
+  inline int current_node() {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+      return (int)node;
+    }
+#endif
+    return -1;
+  }
+
+  /**
+   * @param address An address in memory which has been touched
+   * @returns The NUMA node of the page holding the address or -1 if unknown
+   */
+  inline int page_node(const void *address) {
+#if defined(__linux__) && defined(SYS_move_pages)
+    const std::size_t page_size = sysconf(_SC_PAGESIZE);
+    void *page = (void *)((std::size_t)address & ~(page_size - 1));
+    int status = -1;
+    if (syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) == 0
+        && status >= 0) {
+      return status;
+    }
+#endif
+    return -1;
+  }
+
+}}}  // namespace dials::util::numa
+
+#endif  // DIALS_UTIL_NUMA_H
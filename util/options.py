@@ -14,17 +14,14 @@
 from six.moves.urllib.parse import urlparse
 
 import libtbx.phil
-from dxtbx.model import ExperimentList
-from dxtbx.model.experiment_list import ExperimentListFactory
 
-from dials.array_family import flex
 from dials.util import Sorry
-from dials.util.multi_dataset_handling import (
-    renumber_table_id_columns,
-    sort_tables_to_experiments_order,
-)
 from dials.util.phil import FilenameDataWrapper
 
+# The extension modules for experiments and reflections are imported by the
+# functions which read them, so that a program can parse its options without
+# loading them.
+
 try:
     import cPickle  # deliberately not using six.moves
 
@@ -299,7 +296,10 @@ def try_read_experiments(self, args, check_format, verbose):
         :param verbose: Print verbose output
         :returns: Unhandled arguments
         """
-        from dxtbx.model.experiment_list import InvalidExperimentListError
+        from dxtbx.model.experiment_list import (
+            ExperimentListFactory,
+            InvalidExperimentListError,
+        )
 
         unhandled = []
         for argument in args:
@@ -330,6 +330,8 @@ def try_read_reflections(self, args, verbose):
         :param verbose: Print verbose output
         :returns: Unhandled arguments
         """
+        from dials.array_family import flex
+
         unhandled = []
         for argument in args:
             try:
@@ -1112,6 +1114,8 @@ def flatten_reflections(filename_object_list):
     :param filename_object_list: The parameter item
     :return: The flattened reflection table
     """
+    from dials.util.multi_dataset_handling import renumber_table_id_columns
+
     tables = [o.data for o in filename_object_list]
     if len(tables) > 1:
         tables = renumber_table_id_columns(tables)
@@ -1125,6 +1129,7 @@ def flatten_experiments(filename_object_list):
     :param filename_object_list: The parameter item
     :return: The flattened experiment lists
     """
+    from dxtbx.model import ExperimentList
 
     result = ExperimentList()
     for o in filename_object_list:
@@ -1139,6 +1144,8 @@ def reflections_and_experiments_from_files(
     If experiment identifiers are set, the order of the reflection tables is
     changed to match the order of experiments.
     """
+    from dials.util.multi_dataset_handling import sort_tables_to_experiments_order
+
     tables = flatten_reflections(reflection_file_object_list)
 
     experiments = flatten_experiments(experiment_file_object_list)
@@ -1,14 +1,21 @@
 from __future__ import absolute_import, division, print_function
 
 import collections
+import hashlib
+import logging
 import os
+import pickle
 import re
+import sys
 
 import libtbx.phil
-from dxtbx.model.experiment_list import ExperimentListFactory
 from libtbx.utils import Sorry
 
-from dials.array_family import flex
+logger = logging.getLogger(__name__)
+
+# The extension modules needed to read experiments and reflections are only
+# imported by the converters which use them, so that parsing a phil scope does
+# not load them when a program starts.
 
 FilenameDataWrapper = collections.namedtuple("FilenameDataWrapper", "filename, data")
 
@@ -32,6 +39,8 @@ def from_words(self, words, master):
             return FilenameDataWrapper(filename=s, data=None)
         if not os.path.exists(s):
             raise Sorry("File %s does not exist" % s)
+        from dxtbx.model.experiment_list import ExperimentListFactory
+
         return FilenameDataWrapper(
             filename=s,
             data=ExperimentListFactory.from_json_file(
@@ -61,6 +70,8 @@ def from_words(self, words, master):
             return None
         if not os.path.exists(s):
             raise Sorry("File %s does not exist" % s)
+        from dials.array_family import flex
+
         return FilenameDataWrapper(filename=s, data=flex.reflection_table.from_file(s))
 
     def as_words(self, python_object, master):
@@ -93,6 +104,8 @@ def from_words(self, words, master):
             match = matches[0]
         assert len(match) == 3
         col, op, value = match
+        from dials.array_family import flex
+
         return flex.reflection_table_selector(col, op, value)
 
     def as_words(self, python_object, master):
@@ -134,3 +147,83 @@ def parse(
         converter_registry=converter_registry,
         process_includes=process_includes,
     )
+
+
+_cache_version = None
+
+
+def _phil_cache_key(input_string, converter_registry, process_includes):
+    global _cache_version
+    if _cache_version is None:
+        from dials.util.version import dials_version
+
+        _cache_version = dials_version()
+    key = hashlib.sha1()
+    for part in (
+        _cache_version,
+        sys.version,
+        " ".join(sorted(converter_registry)),
+        str(process_includes),
+        input_string,
+    ):
+        key.update(part.encode("utf-8"))
+    return key.hexdigest()
+
+
+def cached_parse(input_string, converter_registry=None, process_includes=True):
+    """
+    Parse a master phil scope, reusing the scope parsed by an earlier process.
+
+    Parsing the large master scopes of the programs, with their included
+    scopes, is a significant part of the start up time of a program which is
+    run for each of many images. If the environment variable DIALS_PHIL_CACHE
+    names a directory then the parsed scope is pickled there, keyed on the
+    DIALS and Python versions, the converters and the phil string, and later
+    processes load it instead of parsing the string again. Included scopes
+    are not part of the key, so the cache should be cleared after changing
+    them in a development installation. Without DIALS_PHIL_CACHE, or if the
+    scope can not be pickled, the string is simply parsed.
+
+    :param input_string: The phil string
+    :param converter_registry: The converters, by default those of DIALS
+    :param process_includes: Process the include statements
+    :returns: The phil scope
+    """
+    if converter_registry is None:
+        converter_registry = default_converter_registry
+    cache_dir = os.environ.get("DIALS_PHIL_CACHE")
+    if not cache_dir:
+        return libtbx.phil.parse(
+            input_string=input_string,
+            converter_registry=converter_registry,
+            process_includes=process_includes,
+        )
+    filename = os.path.join(
+        cache_dir,
+        "%s.pickle"
+        % _phil_cache_key(input_string, converter_registry, process_includes),
+    )
+    try:
+        with open(filename, "rb") as infile:
+            return pickle.load(infile)
+    except Exception:
+        pass
+    scope = libtbx.phil.parse(
+        input_string=input_string,
+        converter_registry=converter_registry,
+        process_includes=process_includes,
+    )
+    # Write to a temporary file first so that a concurrent process never reads
+    # a partly written scope
+    temp_filename = "%s.%d" % (filename, os.getpid())
+    try:
+        if not os.path.isdir(cache_dir):
+            os.makedirs(cache_dir)
+        with open(temp_filename, "wb") as outfile:
+            pickle.dump(scope, outfile, pickle.HIGHEST_PROTOCOL)
+        os.rename(temp_filename, filename)
+    except Exception as e:
+        logger.debug("Could not cache the phil scope: %s", e)
+        if os.path.exists(temp_filename):
+            os.remove(temp_filename)
+    return scope
@@ -0,0 +1,48 @@
+/*
+ * python_gil.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_PYTHON_GIL_H
+#define DIALS_UTIL_PYTHON_GIL_H
+
+#include <boost/python.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace dials { namespace util {
+
+  /**
+   * Release the python GIL for the lifetime of the object
+   */
+  class ScopedGILRelease : public boost::noncopyable {
+  public:
+    ScopedGILRelease() : state_(PyEval_SaveThread()) {}
+    ~ScopedGILRelease() {
+      PyEval_RestoreThread(state_);
+    }
+
+  private:
+    PyThreadState *state_;
+  };
+
+  /**
+   * Acquire the python GIL for the lifetime of the object. This can be used
+   * from any thread whether or not it already holds the GIL.
+   */
+  class ScopedGILAcquire : public boost::noncopyable {
+  public:
+    ScopedGILAcquire() : state_(PyGILState_Ensure()) {}
+    ~ScopedGILAcquire() {
+      PyGILState_Release(state_);
+    }
+
+  private:
+    PyGILState_STATE state_;
+  };
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_PYTHON_GIL_H
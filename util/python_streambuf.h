@@ -2,6 +2,7 @@
 #define DIALS_UTIL_PYTHON_STREAMBUF_H
 
 #include <boost/python/object.hpp>
+#include <boost/python/import.hpp>
 #include <boost/python/str.hpp>
 #include <boost/python/extract.hpp>
 
@@ -10,6 +11,8 @@
 
 #include <dials/error.h>
 
+#include <algorithm>
+#include <cstring>
 #include <streambuf>
 #include <iostream>
 
@@ -124,6 +127,8 @@ namespace dials { namespace util {
           py_write(getattr(python_file_obj, "write", bp::object())),
           py_seek(getattr(python_file_obj, "seek", bp::object())),
           py_tell(getattr(python_file_obj, "tell", bp::object())),
+          py_readinto(getattr(python_file_obj, "readinto", bp::object())),
+          is_io_object(false),
           buffer_size(buffer_size_ != 0 ? buffer_size_ : default_buffer_size),
           write_buffer(0),
           pos_of_read_buffer_end_in_py_file(0),
@@ -147,6 +152,13 @@ namespace dials { namespace util {
         }
       }
 
+      /* Objects derived from io.IOBase (files, io.BytesIO, gzip, bz2, ...)
+         accept any object with the buffer protocol, so large reads and writes
+         can be done through a memoryview of the C++ data without a copy.
+       */
+      bp::object io_base = bp::import("io").attr("IOBase");
+      is_io_object = PyObject_IsInstance(python_file_obj.ptr(), io_base.ptr()) == 1;
+
       if (py_write != bp::object()) {
         // C-like string to make debugging easier
         write_buffer = new char[buffer_size + 1];
@@ -232,6 +244,75 @@ namespace dials { namespace util {
                                                              : c;
     }
 
+    /// C.f. C++ standard section 27.5.2.4.5
+    /** Writes of at least the size of the buffer are passed to the Python
+        file object in one call, after emptying the buffer, instead of being
+        split into calls of the size of the buffer. If the file object is an
+        io object it is given a memoryview of the data, so for a real file the
+        data goes from the C++ memory straight to the system call, which io
+        makes without holding the GIL.
+    */
+    virtual std::streamsize xsputn(const char_type* s, std::streamsize n) {
+      farthest_pptr = std::max(farthest_pptr, pptr());
+      if (n < (std::streamsize)buffer_size || py_write == bp::object()
+          || pptr() != farthest_pptr) {
+        return base_t::xsputn(s, n);
+      }
+      if (pptr() > pbase()) {
+        overflow();
+      }
+      if (is_io_object) {
+        bp::object view(bp::handle<>(
+          PyMemoryView_FromMemory(const_cast<char_type*>(s), n, PyBUF_READ)));
+        py_write(view);
+        view.attr("release")();
+      } else {
+        bp::object data_bytes(bp::handle<>(PyBytes_FromStringAndSize(s, n)));
+        py_write(data_bytes);
+      }
+      pos_of_write_buffer_end_in_py_file += n;
+      return n;
+    }
+
+    /// C.f. C++ standard section 27.5.2.4.3
+    /** Reads of at least the size of the buffer take what is left in the
+        buffer and then read the rest straight into the destination with the
+        readinto method of the Python file object, which io objects do
+        without holding the GIL.
+    */
+    virtual std::streamsize xsgetn(char_type* s, std::streamsize n) {
+      if (n < (std::streamsize)buffer_size || !is_io_object
+          || py_readinto == bp::object()) {
+        return base_t::xsgetn(s, n);
+      }
+      std::streamsize done = 0;
+      if (gptr() && gptr() < egptr()) {
+        done = std::min(n, (std::streamsize)(egptr() - gptr()));
+        std::memcpy(s, gptr(), done);
+        gbump(done);
+      }
+      while (done < n) {
+        bp::object view(
+          bp::handle<>(PyMemoryView_FromMemory(s + done, n - done, PyBUF_WRITE)));
+        bp::object result = py_readinto(view);
+        view.attr("release")();
+        if (result == bp::object()) {
+          break;
+        }
+        std::streamsize n_read = bp::extract<std::streamsize>(result);
+        if (n_read == 0) {
+          break;
+        }
+        done += n_read;
+        pos_of_read_buffer_end_in_py_file += n_read;
+      }
+
+      // The read buffer no longer ends at the position of the Python file
+      read_buffer = bp::object();
+      setg(0, 0, 0);
+      return done;
+    }
+
     /// Update the python file to reflect the state of this stream buffer
     /** Empty the write buffer into the Python file object and set the seek
         position of the latter accordingly (C++ standard section 27.5.2.4.2).
@@ -325,7 +406,10 @@ namespace dials { namespace util {
     }
 
   private:
-    bp::object py_read, py_write, py_seek, py_tell;
+    bp::object py_read, py_write, py_seek, py_tell, py_readinto;
+
+    // Does the Python file object derive from io.IOBase
+    bool is_io_object;
 
     std::size_t buffer_size;
 
@@ -48,6 +48,17 @@
 )
 
 
+def _set_colors_by_id(colors, ids, palette):
+    """Colour the points of each id >= 0 with palette[(id % n) + 1], where
+    palette[0] is the colour of unindexed points, with one selection for each
+    colour of the palette rather than for each id"""
+    n = palette.size() - 1
+    assigned = ids >= 0
+    slot = ids % n
+    for i in range(n):
+        colors.set_selected(assigned & (slot == i), palette[i + 1])
+
+
 class Render3d(object):
     def __init__(self, settings=None):
         self.reflections = None
@@ -57,6 +68,7 @@ def __init__(self, settings=None):
             self.settings = settings
         self.goniometer_orig = None
         self.viewer = None
+        self.mapped_with = None
 
     def load_models(self, experiments, reflections):
         self.experiments = experiments
@@ -103,11 +115,20 @@ def load_models(self, experiments, reflections):
         self.map_points_to_reciprocal_space()
         self.set_points()
 
+    def mapping_settings(self):
+        """The settings and models that the reciprocal space points depend on"""
+        return (
+            self.settings.reverse_phi,
+            self.settings.crystal_frame,
+            tuple(tuple(expt.beam.get_s0()) for expt in self.experiments),
+        )
+
     def map_points_to_reciprocal_space(self):
         # 155 handle data from predictions *only* if that is what we have
         calculated = "xyzobs.px.value" not in self.reflections_input
         self.reflections = copy.deepcopy(self.reflections_input)
         experiments = copy.deepcopy(self.experiments)
+        self.mapped_with = self.mapping_settings()
 
         if not calculated:
             self.reflections.centroid_px_to_mm(experiments)
@@ -127,6 +148,10 @@ def map_points_to_reciprocal_space(self):
     def set_points(self):
         reflections = self.reflections
 
+        # The points are filtered with a single selection, made up one column
+        # at a time, so that only the columns that are displayed are copied
+        sel = flex.bool(len(reflections), True)
+
         if "miller_index" in reflections:
             if "flags" not in reflections:
                 reflections.set_flags(
@@ -149,26 +174,26 @@ def set_points(self):
             outlier_sel = reflections.get_flags(reflections.flags.centroid_outlier)
 
             if self.settings.outlier_display == "outliers":
-                reflections = reflections.select(outlier_sel)
+                sel &= outlier_sel
             if self.settings.outlier_display == "inliers":
-                reflections = reflections.select(~outlier_sel)
+                sel &= ~outlier_sel
 
             indexed_sel = reflections.get_flags(reflections.flags.indexed)
             strong_sel = reflections.get_flags(reflections.flags.strong)
             integrated_sel = reflections.get_flags(reflections.flags.integrated)
 
             if self.settings.display == "indexed":
-                reflections = reflections.select(indexed_sel)
+                sel &= indexed_sel
             elif self.settings.display == "unindexed":
-                reflections = reflections.select(strong_sel & ~indexed_sel)
+                sel &= strong_sel & ~indexed_sel
             elif self.settings.display == "integrated":
-                reflections = reflections.select(integrated_sel)
+                sel &= integrated_sel
 
             if self.settings.experiment_ids:
-                sel = flex.bool(len(reflections), False)
+                id_sel = flex.bool(len(reflections), False)
                 for i in self.settings.experiment_ids:
-                    sel.set_selected(reflections["id"] == i, True)
-                reflections = reflections.select(sel)
+                    id_sel.set_selected(reflections["id"] == i, True)
+                sel &= id_sel
 
         d_spacings = 1 / reflections["rlp"].norms()
 
@@ -179,50 +204,42 @@ def set_points(self):
             use_column = "xyzcal.px"
 
         if self.settings.d_min is not None:
-            reflections = reflections.select(d_spacings >= self.settings.d_min)
+            sel &= d_spacings >= self.settings.d_min
         else:
-            self.settings.d_min = flex.min(d_spacings)
+            self.settings.d_min = flex.min(d_spacings.select(sel))
+        z = reflections[use_column].parts()[2]
         if self.settings.z_min is not None:
-            z = reflections[use_column].parts()[2]
-            reflections = reflections.select(z >= self.settings.z_min)
+            sel &= z >= self.settings.z_min
         else:
-            z = reflections[use_column].parts()[2]
-            self.settings.z_min = flex.min(z)
+            self.settings.z_min = flex.min(z.select(sel))
         if self.settings.z_max is not None:
-            z = reflections[use_column].parts()[2]
-            reflections = reflections.select(z <= self.settings.z_max)
+            sel &= z <= self.settings.z_max
         else:
-            z = reflections[use_column].parts()[2]
-            self.settings.z_max = flex.max(z)
+            self.settings.z_max = flex.max(z.select(sel))
 
         if "n_signal" in reflections:
+            _ns = reflections["n_signal"]
             if self.settings.n_min is not None:
-                _ns = reflections["n_signal"]
-                reflections = reflections.select(_ns >= self.settings.n_min)
+                sel &= _ns >= self.settings.n_min
             else:
-                _ns = reflections["n_signal"]
-                self.settings.n_min = int(flex.min(_ns))
+                self.settings.n_min = int(flex.min(_ns.select(sel)))
 
             if self.settings.n_max is not None:
-                _ns = reflections["n_signal"]
-                reflections = reflections.select(_ns <= self.settings.n_max)
+                sel &= _ns <= self.settings.n_max
             else:
-                _ns = reflections["n_signal"]
-                self.settings.n_max = int(flex.max(_ns))
+                self.settings.n_max = int(flex.max(_ns.select(sel)))
 
         if "partiality" in reflections:
             p = reflections["partiality"]
             if self.settings.partiality_min is not None:
-                sel = p >= self.settings.partiality_min
-                reflections = reflections.select(sel)
-                p = p.select(sel)
+                sel &= p >= self.settings.partiality_min
             else:
-                self.settings.partiality_min = flex.min(p)
+                self.settings.partiality_min = flex.min(p.select(sel))
             if self.settings.partiality_max is not None:
-                reflections = reflections.select(p <= self.settings.partiality_max)
+                sel &= p <= self.settings.partiality_max
             else:
-                self.settings.partiality_max = flex.max(p)
-        points = reflections["rlp"] * 100
+                self.settings.partiality_max = flex.max(p.select(sel))
+        points = reflections["rlp"].select(sel) * 100
         self.viewer.set_points(points)
         colors = flex.vec3_double(len(points), (1, 1, 1))
 
@@ -254,15 +271,14 @@ def set_points(self):
                 == 0
             ):
                 if "imageset_id" in reflections:
-                    imageset_id = reflections["imageset_id"]
+                    imageset_id = reflections["imageset_id"].select(sel)
                 else:
-                    imageset_id = reflections["id"]
-                for i in range(0, flex.max(imageset_id) + 1):
-                    colors.set_selected(imageset_id == i, palette[(i % n) + 1])
+                    imageset_id = reflections["id"].select(sel)
+                _set_colors_by_id(colors, imageset_id, palette)
             else:
-                colors.set_selected(reflections["id"] == -1, palette[0])
-                for i in range(0, flex.max(reflections["id"]) + 1):
-                    colors.set_selected(reflections["id"] == i, palette[(i % n) + 1])
+                ids = reflections["id"].select(sel)
+                colors.set_selected(ids == -1, palette[0])
+                _set_colors_by_id(colors, ids, palette)
         self.viewer.set_colors(colors)
 
     def set_beam_centre(self, beam_centre):
@@ -54,6 +54,23 @@ def test_Render3d(mocker, multi_sequence_data):
     render.load_models(experiments, reflections)
     assert render.viewer.set_points.call_args[0][0].size() == 957
 
+    # Each lattice is coloured by its id
+    palette = render.viewer.set_palette.call_args[0][0]
+    colors = render.viewer.set_colors.call_args[0][0]
+    ids = reflections["id"].select(
+        (reflections["id"] == 0) | (reflections["id"] == 2) | (reflections["id"] == 3)
+    )
+    assert list(colors) == [palette[(i % 7) + 1] for i in ids]
+
+    # Only the models and these settings move the points
+    assert render.mapped_with == render.mapping_settings()
+    render.settings.d_min = 2
+    assert render.mapped_with == render.mapping_settings()
+    render.settings.reverse_phi = True
+    assert render.mapped_with != render.mapping_settings()
+    render.settings.reverse_phi = False
+    render.settings.d_min = None
+
     render.settings.black_background = False
     render.load_models(experiments, reflections)
     assert list(render.viewer.set_palette.call_args[0][0][:2]) == [
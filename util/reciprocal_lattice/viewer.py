@@ -171,7 +171,9 @@ def update_settings(self, *args, **kwds):
             if self.settings.beam_centre != beam_centre:
                 self.set_beam_centre(beam_centre)
 
-        self.map_points_to_reciprocal_space()
+        # Changing the filters alone does not move the points
+        if self.mapped_with != self.mapping_settings():
+            self.map_points_to_reciprocal_space()
         self.set_points()
         self.viewer.update_settings(*args, **kwds)
 
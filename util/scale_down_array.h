@@ -1,45 +1,98 @@
 /*
- * FIXME add a header
+ * scale_down_array.h
+ *
+ *  Copyright (C) 2013 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
  */
 
 #ifndef DIALS_UTIL_SCALED_DOWN_ARRAY_H
 #define DIALS_UTIL_SCALED_DOWN_ARRAY_H
 
+#include <algorithm>
 #include <ctime>
-#include <boost/random.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/binomial_distribution.hpp>
 #include <dials/array_family/scitbx_shared_and_versa.h>
+#include <dials/array_family/hash_join.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
 
 namespace dials { namespace util {
-  /**
-   * Calculate a randomly downscaled new image with the same dimensions
-   * as the input array.
-   */
 
-  af::shared<int> scale_down_array(const af::const_ref<int> &image,
-                                   const double scale_factor) {
-    // create the RNG
+  namespace detail {
 
-    boost::random::mt19937 gen(time(0));
-    boost::random::uniform_real_distribution<double> dist(0, 1);
+    /**
+     * The number of pixels drawn from each random number stream. The pixels
+     * are split into blocks of this size with a stream for each, so the
+     * result for a given seed does not depend on the number of threads.
+     */
+    const std::size_t scale_down_block_size = 1 << 16;
 
-    // create the target array
-
-    af::shared<int> result(image.size(), 0);
+    /**
+     * Scale down a band of blocks of pixels
+     */
+    struct ScaleDownBand {
+      af::const_ref<int> image;
+      af::ref<int> result;
+      double scale_factor;
+      boost::uint64_t seed;
 
-    // now iterate through the array & do what we need to do...
+      ScaleDownBand(const af::const_ref<int> &image_,
+                    af::ref<int> result_,
+                    double scale_factor_,
+                    boost::uint64_t seed_)
+          : image(image_), result(result_), scale_factor(scale_factor_), seed(seed_) {}
 
-    for (int j = 0; j < image.size(); ++j) {
-      if (image[j] <= 0) {
-        result[j] = image[j];
-      } else {
-        for (int k = 0; k < image[j]; k++) {
-          if (dist(gen) < scale_factor) {
-            result[j] += 1;
+      void operator()(int b0, int b1) const {
+        typedef boost::random::binomial_distribution<int> distribution;
+        distribution dist;
+        for (int b = b0; b < b1; ++b) {
+          boost::random::mt19937 gen(
+            (boost::uint32_t)af::hash_mix(seed ^ af::hash_mix((boost::uint64_t)b)));
+          std::size_t j0 = (std::size_t)b * scale_down_block_size;
+          std::size_t j1 = std::min(j0 + scale_down_block_size, image.size());
+          for (std::size_t j = j0; j < j1; ++j) {
+            if (image[j] <= 0) {
+              result[j] = image[j];
+            } else {
+              result[j] = dist(gen, distribution::param_type(image[j], scale_factor));
+            }
           }
         }
       }
-    }
+    };
 
+  }  // namespace detail
+
+  /**
+   * Calculate a randomly downscaled new image with the same dimensions
+   * as the input array. Each count of a pixel is kept with a probability of
+   * the scale factor, so each scaled pixel is drawn from the binomial
+   * distribution of its counts. Pixels which are zero or negative, which are
+   * taken to be flags, are kept as they are.
+   * @param image The pixels
+   * @param scale_factor The probability of keeping a count
+   * @param seed The random seed, or negative to seed from the time
+   * @param nthreads The number of threads to use
+   * @returns The scaled pixels
+   */
+  inline af::shared<int> scale_down_array(const af::const_ref<int> &image,
+                                          const double scale_factor,
+                                          int seed = -1,
+                                          std::size_t nthreads = 1) {
+    DIALS_ASSERT(scale_factor >= 0 && scale_factor <= 1);
+    DIALS_ASSERT(nthreads > 0);
+    boost::uint64_t base = seed < 0 ? (boost::uint64_t)time(0) : (boost::uint64_t)seed;
+    af::shared<int> result(image.size(), 0);
+    std::size_t nblocks = (image.size() + detail::scale_down_block_size - 1)
+                          / detail::scale_down_block_size;
+    dials::algorithms::for_each_band(
+      detail::ScaleDownBand(image, result.ref(), scale_factor, base),
+      (int)nblocks,
+      nthreads);
     return result;
   }
 }}  // namespace dials::util
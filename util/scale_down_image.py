@@ -6,6 +6,7 @@
 from scitbx.array_family import flex
 
 from dials.util.ext import scale_down_array
+from dials.util.mp import available_cores
 
 
 def scale_down_array_py(image, scale_factor):
@@ -76,11 +77,13 @@ def write_image_from_flex_array(out_image, pixel_values, header):
     open(out_image, "wb").write(fixed_header + start_tag + compressed + tailer)
 
 
-def scale_down_image(in_image, out_image, scale_factor):
+def scale_down_image(in_image, out_image, scale_factor, nthreads=None):
     """Read in the data from in_image, apply the statistically valid scale factor
     to the data & write this out as out_image; retain the header as we go."""
 
+    if nthreads is None:
+        nthreads = available_cores()
     image, header = read_image_to_flex_array(in_image)
-    scaled_image = scale_down_array(image.as_1d(), scale_factor)
+    scaled_image = scale_down_array(image.as_1d(), scale_factor, nthreads=nthreads)
 
     write_image_from_flex_array(out_image, scaled_image, header)
@@ -143,6 +143,43 @@ def file_content(self):
         return result
 
 
+def test_large_read_and_write(tmpdir):
+    n = 100000
+    data = b"".join(six.int2byte(ord("a") + i % 26) for i in range(n))
+    filename = tmpdir.join("large").strpath
+
+    # Large blocks are written in one call to the Python file object
+    with open(filename, "wb") as f:
+        instrumented_file = mock.Mock(spec=f, wraps=f)
+        report = ext.write_large(streambuf(instrumented_file, 1024), n)
+        assert report == b""
+        assert instrumented_file.write.call_count == 3
+    with open(filename, "rb") as f:
+        assert f.read() == b"<" + data + b">"
+
+    # And read straight into the destination
+    with open(filename, "rb") as f:
+        instrumented_file = mock.Mock(spec=f, wraps=f)
+        words = ext.read_large(streambuf(instrumented_file, 1024), n)
+        assert words == b"<" + data + b", "
+        assert instrumented_file.readinto.call_count >= 1
+        assert f.read() == b">"
+
+    # Other file-like objects are given bytes
+    class writer(object):
+        def __init__(self):
+            self.chunks = []
+
+        def write(self, chunk):
+            assert isinstance(chunk, bytes)
+            self.chunks.append(chunk)
+
+    f = writer()
+    report = ext.write_large(streambuf(f, 1024), n)
+    assert report == b""
+    assert b"".join(f.chunks) == b"<" + data + b">"
+
+
 def test_with_bytesio():
     bytesio_test_case().run()
 
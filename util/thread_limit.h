@@ -0,0 +1,93 @@
+/*
+ * thread_limit.h
+ *
+ *  Copyright (C) 2020 Diamond Light Source
+ *
+ *  This code is distributed under the BSD license, a copy of which is
+ *  included in the root directory of this package.
+ */
+#ifndef DIALS_UTIL_THREAD_LIMIT_H
+#define DIALS_UTIL_THREAD_LIMIT_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace dials { namespace util {
+
+  /**
+   * The limit on the number of threads which the threaded algorithms of an
+   * extension may run at once. It is read from the DIALS_MAX_THREADS
+   * environment variable, so that it is the same for every extension and is
+   * inherited by processes started with easy_mp.
+   * @returns The maximum number of threads or 0 if there is no limit
+   */
+  inline std::size_t max_threads() {
+    const char *value = std::getenv("DIALS_MAX_THREADS");
+    if (value == NULL) {
+      return 0;
+    }
+    long n = std::strtol(value, NULL, 10);
+    return n > 0 ? (std::size_t)n : 0;
+  }
+
+  /**
+   * Reserve threads from the limit for the lifetime of the object. Fewer
+   * threads than requested are granted if the others are in use, e.g. when a
+   * threaded algorithm is called from the jobs of another, but always at least
+   * one, so that the caller can do the work on its own thread.
+   *
+   * The count of threads in use is a static of this header, so each extension
+   * module has its own count. Nested reservations within one extension share
+   * the limit, but threaded algorithms in different extensions which run at
+   * the same time may each use up to the limit.
+   */
+  class ThreadReservation : public boost::noncopyable {
+  public:
+    /**
+     * @param n The number of threads requested
+     */
+    explicit ThreadReservation(std::size_t n) : size_(std::max(n, (std::size_t)1)) {
+      std::size_t limit = max_threads();
+      boost::lock_guard<boost::mutex> lock(mutex());
+      if (limit > 0) {
+        std::size_t free = limit > used() ? limit - used() : 0;
+        size_ = std::max(std::min(size_, free), (std::size_t)1);
+      }
+      used() += size_;
+    }
+
+    /**
+     * Return the threads to the limit
+     */
+    ~ThreadReservation() {
+      boost::lock_guard<boost::mutex> lock(mutex());
+      used() -= size_;
+    }
+
+    /**
+     * @returns The number of threads granted
+     */
+    std::size_t size() const {
+      return size_;
+    }
+
+  private:
+    static boost::mutex &mutex() {
+      static boost::mutex instance;
+      return instance;
+    }
+
+    static std::size_t &used() {
+      static std::size_t count = 0;
+      return count;
+    }
+
+    std::size_t size_;
+  };
+
+}}  // namespace dials::util
+
+#endif  // DIALS_UTIL_THREAD_LIMIT_H
@@ -11,9 +11,17 @@
 #ifndef DIALS_ARRAY_FAMILY_THREAD_POOL_H
 #define DIALS_ARRAY_FAMILY_THREAD_POOL_H
 
+#include <deque>
+#include <vector>
+#include <iterator>
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <dials/util/numa.h>
+#include <dials/util/thread_limit.h>
 
 namespace dials { namespace util {
 
@@ -55,6 +63,18 @@ namespace dials { namespace util {
       io_service_.post(FunctionRunner<Function>(function, finished_));
     }
 
+    /**
+     * Post a range of functions to the thread pool
+     * @param first The start of the range
+     * @param last The end of the range
+     */
+    template <typename Iterator>
+    void post_batch(Iterator first, Iterator last) {
+      for (; first != last; ++first) {
+        post(*first);
+      }
+    }
+
     /**
      * Wait until all posted jobs have finished
      */
@@ -98,6 +118,249 @@ namespace dials { namespace util {
     boost::atomic<std::size_t> finished_;
   };
 
+  /**
+   * A thread pool where each worker thread owns a queue of jobs. Jobs are
+   * distributed across the queues when posted. A worker takes jobs from the
+   * back of its own queue and, when that is empty, steals half of the jobs from
+   * the front of another worker's queue. This avoids the contention on a single
+   * shared queue when there are many threads and many small jobs. The workers
+   * are reserved from the thread limit of the extension, so the pool may have
+   * fewer threads than requested.
+   */
+  class WorkStealingThreadPool {
+  public:
+    typedef boost::function<void()> job_type;
+
+    /**
+     * Instantiate with the number of required threads
+     * @param N The number of threads
+     * @param cpus If not empty, pin worker i to CPU cpus[i % cpus.size()]
+     */
+    WorkStealingThreadPool(std::size_t N,
+                           const std::vector<int> &cpus = std::vector<int>())
+        : reservation_(N),
+          cpus_(cpus),
+          stop_(false),
+          next_(0),
+          pending_(0),
+          started_(0),
+          finished_(0) {
+      N = reservation_.size();
+      for (std::size_t i = 0; i < N; ++i) {
+        queues_.push_back(new WorkQueue());
+      }
+      for (std::size_t i = 0; i < N; ++i) {
+        threads_.create_thread(boost::bind(&WorkStealingThreadPool::run, this, i));
+      }
+    }
+
+    /**
+     * Destroy the thread pool and join all threads
+     */
+    ~WorkStealingThreadPool() {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      condition_.notify_all();
+      try {
+        threads_.join_all();
+      } catch (const std::exception &) {
+        // pass
+      }
+    }
+
+    /**
+     * @returns The number of threads
+     */
+    std::size_t size() const {
+      return queues_.size();
+    }
+
+    /**
+     * Post a function to the thread pool
+     * @param function The function to call
+     */
+    template <typename Function>
+    void post(Function function) {
+      started_++;
+      pending_++;
+      WorkQueue &queue = queues_[next_];
+      next_ = (next_ + 1) % queues_.size();
+      {
+        boost::lock_guard<boost::mutex> lock(queue.mutex);
+        queue.jobs.push_back(job_type(function));
+      }
+      wake(1);
+    }
+
+    /**
+     * Post a range of functions to the thread pool. The range is split into
+     * contiguous chunks, one per worker, so that each queue is locked only once
+     * and neighbouring jobs are likely to run on the same thread. If there is
+     * a chunk for every worker then chunk i always goes to worker i, so that
+     * the same part of each batch tends to run on the same thread.
+     * @param first The start of the range
+     * @param last The end of the range
+     */
+    template <typename Iterator>
+    void post_batch(Iterator first, Iterator last) {
+      std::size_t num_jobs = std::distance(first, last);
+      if (num_jobs == 0) {
+        return;
+      }
+      std::size_t num_queues = std::min(queues_.size(), num_jobs);
+      std::size_t chunk = num_jobs / num_queues;
+      std::size_t remainder = num_jobs % num_queues;
+      started_ += num_jobs;
+      pending_ += num_jobs;
+      if (num_queues == queues_.size()) {
+        next_ = 0;
+      }
+      for (std::size_t i = 0; i < num_queues; ++i) {
+        std::size_t n = chunk + (i < remainder ? 1 : 0);
+        WorkQueue &queue = queues_[next_];
+        next_ = (next_ + 1) % queues_.size();
+        {
+          boost::lock_guard<boost::mutex> lock(queue.mutex);
+          for (std::size_t j = 0; j < n; ++j, ++first) {
+            queue.jobs.push_back(job_type(*first));
+          }
+        }
+      }
+      wake(num_jobs);
+    }
+
+    /**
+     * Wait until all posted jobs have finished
+     */
+    void wait() {
+      boost::unique_lock<boost::mutex> lock(finished_mutex_);
+      while (finished_ < started_) {
+        finished_condition_.wait(lock);
+      }
+    }
+
+  protected:
+    /**
+     * A queue of jobs owned by a single worker
+     */
+    struct WorkQueue {
+      boost::mutex mutex;
+      std::deque<job_type> jobs;
+    };
+
+    /**
+     * Wake up sleeping workers
+     * @param num_jobs The number of jobs which were added
+     */
+    void wake(std::size_t num_jobs) {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+      }
+      if (num_jobs == 1) {
+        condition_.notify_one();
+      } else {
+        condition_.notify_all();
+      }
+    }
+
+    /**
+     * Take a job from the back of the worker's own queue
+     * @param index The worker index
+     * @param job The job
+     * @returns True/False a job was found
+     */
+    bool pop(std::size_t index, job_type &job) {
+      WorkQueue &queue = queues_[index];
+      boost::lock_guard<boost::mutex> lock(queue.mutex);
+      if (queue.jobs.empty()) {
+        return false;
+      }
+      job.swap(queue.jobs.back());
+      queue.jobs.pop_back();
+      pending_--;
+      return true;
+    }
+
+    /**
+     * Steal half of the jobs from the front of another worker's queue. One
+     * job is returned and the rest are moved to the worker's own queue.
+     * @param index The worker index
+     * @param job The job
+     * @returns True/False a job was found
+     */
+    bool steal(std::size_t index, job_type &job) {
+      std::vector<job_type> stolen;
+      for (std::size_t i = 1; i < queues_.size() && stolen.empty(); ++i) {
+        WorkQueue &victim = queues_[(index + i) % queues_.size()];
+        boost::lock_guard<boost::mutex> lock(victim.mutex);
+        std::size_t n = (victim.jobs.size() + 1) / 2;
+        stolen.resize(n);
+        for (std::size_t j = 0; j < n; ++j) {
+          stolen[j].swap(victim.jobs.front());
+          victim.jobs.pop_front();
+        }
+      }
+      if (stolen.empty()) {
+        return false;
+      }
+      job.swap(stolen.front());
+      pending_--;
+      if (stolen.size() > 1) {
+        WorkQueue &queue = queues_[index];
+        boost::lock_guard<boost::mutex> lock(queue.mutex);
+        queue.jobs.insert(queue.jobs.end(), stolen.begin() + 1, stolen.end());
+      }
+      return true;
+    }
+
+    /**
+     * The worker thread function
+     * @param index The worker index
+     */
+    void run(std::size_t index) {
+      if (!cpus_.empty()) {
+        numa::pin_current_thread(cpus_[index % cpus_.size()]);
+      }
+      job_type job;
+      for (;;) {
+        if (pop(index, job) || steal(index, job)) {
+          job();
+          job.clear();
+          if (++finished_ == started_) {
+            {
+              boost::lock_guard<boost::mutex> lock(finished_mutex_);
+            }
+            finished_condition_.notify_all();
+          }
+          continue;
+        }
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        if (stop_) {
+          break;
+        }
+        if (pending_ == 0) {
+          condition_.wait(lock);
+        }
+      }
+    }
+
+    ThreadReservation reservation_;
+    boost::ptr_vector<WorkQueue> queues_;
+    boost::thread_group threads_;
+    std::vector<int> cpus_;
+    boost::mutex mutex_;
+    boost::condition_variable condition_;
+    boost::mutex finished_mutex_;
+    boost::condition_variable finished_condition_;
+    bool stop_;
+    std::size_t next_;
+    boost::atomic<std::size_t> pending_;
+    boost::atomic<std::size_t> started_;
+    boost::atomic<std::size_t> finished_;
+  };
+
 }}  // namespace dials::util
 
 #endif  // DIALS_ARRAY_FAMILY_THREAD_POOL_H
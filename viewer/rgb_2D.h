@@ -11,10 +11,14 @@
 
 #ifndef DIALS_RGB_IMG_BUILDER_H
 #define DIALS_RGB_IMG_BUILDER_H
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <cmath>
 #include <scitbx/array_family/flex_types.h>
+#include <dials/algorithms/image/filter/parallel_bands.h>
+#include <dials/error.h>
 
 #include <dials/viewer/fonts_2D.h>
 #include <dials/viewer/mask_bmp_2D.h>
@@ -157,7 +161,8 @@ namespace dials { namespace viewer { namespace boost_python {
     flex_int gen_bmp(flex_double& data2d,
                      flex_double& mask2d,
                      bool show_nums,
-                     int palette_num) {
+                     int palette_num,
+                     std::size_t nthreads = 1) {
       // debugging palette number passed from Python
       /*
       std::cout << "\n show_nums =" << show_nums << "\n";
@@ -185,24 +190,7 @@ namespace dials { namespace viewer { namespace boost_python {
 
       // flex_double scaled_array(flex_grid<>(nrow, ncol),0);
 
-      if (max == -1 && min == -1) {
-        for (row = 0; row < nrow; row++) {
-          for (col = 0; col < ncol; col++) {
-            loc_cel = data2d(row, col);
-            if (row == 0 && col == 0) {
-              max = loc_cel;
-              min = loc_cel;
-            } else {
-              if (loc_cel > max) {
-                max = loc_cel;
-              }
-              if (loc_cel < min) {
-                min = loc_cel;
-              }
-            }
-          }
-        }
-      }
+      auto_min_max(data2d);
 
       dif = max - min;
 
@@ -218,6 +206,13 @@ namespace dials { namespace viewer { namespace boost_python {
 
       flex_int bmp_dat(flex_grid<>(nrow * px_scale, ncol * px_scale, 3), 0);
 
+      // Large images are painted one image pixel to one bitmap pixel, with
+      // no mask or numbers, in parallel
+      if (px_scale == 1) {
+        render(data2d, palette_num, 1, bmp_dat, nthreads);
+        return bmp_dat;
+      }
+
       int digit_val[15];
       int pix_row, pix_col;
 
@@ -241,108 +236,106 @@ namespace dials { namespace viewer { namespace boost_python {
 
           loc_cel_int = int(mask2d(row, col));
 
-          if (px_scale > 1) {
-            // painting the scaled pixel with the *hot* color convention
-            for (pix_col = col * px_scale; pix_col < col * px_scale + px_scale;
-                 pix_col++) {
-              for (pix_row = row * px_scale; pix_row < row * px_scale + px_scale;
-                   pix_row++) {
-                if (palette_num == 1) {
-                  bmp_dat(pix_row, pix_col, 0) = gray_all_rgb_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) = gray_all_rgb_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) = gray_all_rgb_byte[int(scaled_pixel)];
-                } else if (palette_num == 2) {
-                  bmp_dat(pix_row, pix_col, 0) =
-                    gray_all_rgb_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) =
-                    gray_all_rgb_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) =
-                    gray_all_rgb_byte[int(765 - scaled_pixel)];
-                } else if (palette_num == 3) {
-                  bmp_dat(pix_row, pix_col, 0) = hot_pal_red_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) = hot_pal_green_byte[int(scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) = hot_pal_blue_byte[int(scaled_pixel)];
-                } else {
-                  bmp_dat(pix_row, pix_col, 0) =
-                    hot_pal_red_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 1) =
-                    hot_pal_green_byte[int(765 - scaled_pixel)];
-                  bmp_dat(pix_row, pix_col, 2) =
-                    hot_pal_blue_byte[int(765 - scaled_pixel)];
-                }
+          // painting the scaled pixel with the *hot* color convention
+          for (pix_col = col * px_scale; pix_col < col * px_scale + px_scale;
+               pix_col++) {
+            for (pix_row = row * px_scale; pix_row < row * px_scale + px_scale;
+                 pix_row++) {
+              if (palette_num == 1) {
+                bmp_dat(pix_row, pix_col, 0) = gray_all_rgb_byte[int(scaled_pixel)];
+                bmp_dat(pix_row, pix_col, 1) = gray_all_rgb_byte[int(scaled_pixel)];
+                bmp_dat(pix_row, pix_col, 2) = gray_all_rgb_byte[int(scaled_pixel)];
+              } else if (palette_num == 2) {
+                bmp_dat(pix_row, pix_col, 0) =
+                  gray_all_rgb_byte[int(765 - scaled_pixel)];
+                bmp_dat(pix_row, pix_col, 1) =
+                  gray_all_rgb_byte[int(765 - scaled_pixel)];
+                bmp_dat(pix_row, pix_col, 2) =
+                  gray_all_rgb_byte[int(765 - scaled_pixel)];
+              } else if (palette_num == 3) {
+                bmp_dat(pix_row, pix_col, 0) = hot_pal_red_byte[int(scaled_pixel)];
+                bmp_dat(pix_row, pix_col, 1) = hot_pal_green_byte[int(scaled_pixel)];
+                bmp_dat(pix_row, pix_col, 2) = hot_pal_blue_byte[int(scaled_pixel)];
+              } else {
+                bmp_dat(pix_row, pix_col, 0) =
+                  hot_pal_red_byte[int(765 - scaled_pixel)];
+                bmp_dat(pix_row, pix_col, 1) =
+                  hot_pal_green_byte[int(765 - scaled_pixel)];
+                bmp_dat(pix_row, pix_col, 2) =
+                  hot_pal_blue_byte[int(765 - scaled_pixel)];
               }
             }
+          }
 
-            // Painting mask into the scaled pixel
-            for (mask_pix_col = 0, pix_col = col * px_scale; mask_pix_col < px_scale;
-                 pix_col++, mask_pix_col++) {
-              for (mask_pix_row = 0, pix_row = row * px_scale; mask_pix_row < px_scale;
-                   pix_row++, mask_pix_row++) {
-                if ((mask_vol[mask_pix_row][mask_pix_col][0] == 1
-                     && ((loc_cel_int & Valid) == Valid))
-                    || (mask_vol[mask_pix_row][mask_pix_col][1] == 1
-                        && ((loc_cel_int & Foreground) == Foreground))
-
-                    || (mask_vol[mask_pix_row][mask_pix_col][2] == 1
-                        && ((loc_cel_int & BackgroundUsed) == BackgroundUsed))
-                    || (mask_vol[mask_pix_row][mask_pix_col][3] == 1
-                        && ((loc_cel_int & Background) == Background))) {
-                  if (palette_num == 1 || palette_num == 2) {
-                    bmp_dat(pix_row, pix_col, 0) = 250;
-                    bmp_dat(pix_row, pix_col, 1) = 50;
-                    bmp_dat(pix_row, pix_col, 2) = 50;
-                  } else {
-                    bmp_dat(pix_row, pix_col, 0) = 150;
-                    bmp_dat(pix_row, pix_col, 1) = 150;
-                    bmp_dat(pix_row, pix_col, 2) = 150;
-                  }
+          // Painting mask into the scaled pixel
+          for (mask_pix_col = 0, pix_col = col * px_scale; mask_pix_col < px_scale;
+               pix_col++, mask_pix_col++) {
+            for (mask_pix_row = 0, pix_row = row * px_scale; mask_pix_row < px_scale;
+                 pix_row++, mask_pix_row++) {
+              if ((mask_vol[mask_pix_row][mask_pix_col][0] == 1
+                   && ((loc_cel_int & Valid) == Valid))
+                  || (mask_vol[mask_pix_row][mask_pix_col][1] == 1
+                      && ((loc_cel_int & Foreground) == Foreground))
+
+                  || (mask_vol[mask_pix_row][mask_pix_col][2] == 1
+                      && ((loc_cel_int & BackgroundUsed) == BackgroundUsed))
+                  || (mask_vol[mask_pix_row][mask_pix_col][3] == 1
+                      && ((loc_cel_int & Background) == Background))) {
+                if (palette_num == 1 || palette_num == 2) {
+                  bmp_dat(pix_row, pix_col, 0) = 250;
+                  bmp_dat(pix_row, pix_col, 1) = 50;
+                  bmp_dat(pix_row, pix_col, 2) = 50;
+                } else {
+                  bmp_dat(pix_row, pix_col, 0) = 150;
+                  bmp_dat(pix_row, pix_col, 1) = 150;
+                  bmp_dat(pix_row, pix_col, 2) = 150;
                 }
               }
             }
+          }
 
-            // Painting intensity value into the scaled pixel
-
-            if (show_nums == true) {
-              err_conv = get_digits(data2d(row, col), digit_val);
-              if (err_conv == 0) {
-                // std::cout << "data2d(row, col) = " << data2d(row, col) << "\n";
-                for (int dg_num = 0; dg_num < 12 && digit_val[dg_num] != 15; dg_num++) {
-                  for (int font_pix_col = 0, pix_col = col * px_scale + dg_num * 7;
-                       font_pix_col < 7;
-                       pix_col++, font_pix_col++) {
-                    for (int font_pix_row = 0, pix_row = row * px_scale + 14;
-                         font_pix_row < 14;
-                         pix_row++, font_pix_row++) {
-                      if (font_vol[font_pix_row][font_pix_col][digit_val[dg_num]]
-                          == 1) {
-                        if (palette_num == 1 || palette_num == 3) {
-                          if (scaled_pixel < 255) {
-                            bmp_dat(pix_row, pix_col, 0) = 255;
-                            bmp_dat(pix_row, pix_col, 1) = 255;
-                            bmp_dat(pix_row, pix_col, 2) = 0;
-                          } else if (scaled_pixel > 255 * 2) {
-                            bmp_dat(pix_row, pix_col, 0) = 0;
-                            bmp_dat(pix_row, pix_col, 1) = 0;
-                            bmp_dat(pix_row, pix_col, 2) = 0;
-                          } else {
-                            bmp_dat(pix_row, pix_col, 0) = 00;
-                            bmp_dat(pix_row, pix_col, 1) = 00;
-                            bmp_dat(pix_row, pix_col, 2) = 255;
-                          }
+          // Painting intensity value into the scaled pixel
+
+          if (show_nums == true) {
+            err_conv = get_digits(data2d(row, col), digit_val);
+            if (err_conv == 0) {
+              // std::cout << "data2d(row, col) = " << data2d(row, col) << "\n";
+              for (int dg_num = 0; dg_num < 12 && digit_val[dg_num] != 15; dg_num++) {
+                for (int font_pix_col = 0, pix_col = col * px_scale + dg_num * 7;
+                     font_pix_col < 7;
+                     pix_col++, font_pix_col++) {
+                  for (int font_pix_row = 0, pix_row = row * px_scale + 14;
+                       font_pix_row < 14;
+                       pix_row++, font_pix_row++) {
+                    if (font_vol[font_pix_row][font_pix_col][digit_val[dg_num]]
+                        == 1) {
+                      if (palette_num == 1 || palette_num == 3) {
+                        if (scaled_pixel < 255) {
+                          bmp_dat(pix_row, pix_col, 0) = 255;
+                          bmp_dat(pix_row, pix_col, 1) = 255;
+                          bmp_dat(pix_row, pix_col, 2) = 0;
+                        } else if (scaled_pixel > 255 * 2) {
+                          bmp_dat(pix_row, pix_col, 0) = 0;
+                          bmp_dat(pix_row, pix_col, 1) = 0;
+                          bmp_dat(pix_row, pix_col, 2) = 0;
                         } else {
-                          if (scaled_pixel < 255) {
-                            bmp_dat(pix_row, pix_col, 0) = 0;
-                            bmp_dat(pix_row, pix_col, 1) = 0;
-                            bmp_dat(pix_row, pix_col, 2) = 0;
-                          } else if (scaled_pixel > 255 * 2) {
-                            bmp_dat(pix_row, pix_col, 0) = 255;
-                            bmp_dat(pix_row, pix_col, 1) = 255;
-                            bmp_dat(pix_row, pix_col, 2) = 0;
-                          } else {
-                            bmp_dat(pix_row, pix_col, 0) = 00;
-                            bmp_dat(pix_row, pix_col, 1) = 00;
-                            bmp_dat(pix_row, pix_col, 2) = 255;
-                          }
+                          bmp_dat(pix_row, pix_col, 0) = 00;
+                          bmp_dat(pix_row, pix_col, 1) = 00;
+                          bmp_dat(pix_row, pix_col, 2) = 255;
+                        }
+                      } else {
+                        if (scaled_pixel < 255) {
+                          bmp_dat(pix_row, pix_col, 0) = 0;
+                          bmp_dat(pix_row, pix_col, 1) = 0;
+                          bmp_dat(pix_row, pix_col, 2) = 0;
+                        } else if (scaled_pixel > 255 * 2) {
+                          bmp_dat(pix_row, pix_col, 0) = 255;
+                          bmp_dat(pix_row, pix_col, 1) = 255;
+                          bmp_dat(pix_row, pix_col, 2) = 0;
+                        } else {
+                          bmp_dat(pix_row, pix_col, 0) = 00;
+                          bmp_dat(pix_row, pix_col, 1) = 00;
+                          bmp_dat(pix_row, pix_col, 2) = 255;
                         }
                       }
                     }
@@ -350,32 +343,172 @@ namespace dials { namespace viewer { namespace boost_python {
                 }
               }
             }
-
-          } else {
-            if (palette_num == 1) {
-              bmp_dat(row, col, 0) = gray_all_rgb_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 1) = gray_all_rgb_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 2) = gray_all_rgb_byte[int(scaled_pixel)];
-            } else if (palette_num == 2) {
-              bmp_dat(row, col, 0) = gray_all_rgb_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 1) = gray_all_rgb_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 2) = gray_all_rgb_byte[int(765 - scaled_pixel)];
-            } else if (palette_num == 3) {
-              bmp_dat(row, col, 0) = hot_pal_red_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 1) = hot_pal_green_byte[int(scaled_pixel)];
-              bmp_dat(row, col, 2) = hot_pal_blue_byte[int(scaled_pixel)];
-            } else {
-              bmp_dat(row, col, 0) = hot_pal_red_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 1) = hot_pal_green_byte[int(765 - scaled_pixel)];
-              bmp_dat(row, col, 2) = hot_pal_blue_byte[int(765 - scaled_pixel)];
-            }
           }
+
         }
       }
       // std::cout << "\n building BMP \n";
 
       return bmp_dat;
     }
+
+    /**
+     * Paint a zoomed out view of an image, with one bitmap pixel for each
+     * square of binning by binning image pixels. The brightest pixel of each
+     * square is shown so that spots stay visible. Rendering a pyramid of
+     * views, with a binning of 2, 4, 8 and so on, lets a viewer redraw a
+     * zoomed out large image from a bitmap close to the size on screen.
+     * @param data2d The image
+     * @param palette_num The palette, numbered as for gen_bmp
+     * @param binning The number of image pixels along a side of a square
+     * @param nthreads The number of threads to use
+     * @returns The (ceil(nrow / binning), ceil(ncol / binning), 3) bitmap
+     */
+    flex_int gen_binned_bmp(flex_double& data2d,
+                            int palette_num,
+                            int binning,
+                            std::size_t nthreads = 1) {
+      DIALS_ASSERT(binning > 0);
+      int nrow = data2d.accessor().all()[0];
+      int ncol = data2d.accessor().all()[1];
+      auto_min_max(data2d);
+      flex_int bmp_dat(
+        flex_grid<>((nrow + binning - 1) / binning, (ncol + binning - 1) / binning, 3),
+        0);
+      render(data2d, palette_num, binning, bmp_dat, nthreads);
+      return bmp_dat;
+    }
+
+  private:
+    /**
+     * Paint a band of rows of a bitmap, each from the brightest pixel of a
+     * square of image pixels, through a colour look up table
+     */
+    struct RenderBand {
+      const double* data;
+      int nrow;
+      int ncol;
+      int binning;
+      double min;
+      double max;
+      double scale;
+      bool reverse;
+      const unsigned char* lut;
+      int* bmp;
+
+      RenderBand(const double* data_,
+                 int nrow_,
+                 int ncol_,
+                 int binning_,
+                 double min_,
+                 double max_,
+                 double scale_,
+                 bool reverse_,
+                 const unsigned char* lut_,
+                 int* bmp_)
+          : data(data_),
+            nrow(nrow_),
+            ncol(ncol_),
+            binning(binning_),
+            min(min_),
+            max(max_),
+            scale(scale_),
+            reverse(reverse_),
+            lut(lut_),
+            bmp(bmp_) {}
+
+      void operator()(int r0, int r1) const {
+        int bmp_ncol = (ncol + binning - 1) / binning;
+        for (int r = r0; r < r1; ++r) {
+          int row0 = r * binning;
+          int row1 = std::min(row0 + binning, nrow);
+          int* out = bmp + (std::size_t)r * bmp_ncol * 3;
+          for (int c = 0; c < bmp_ncol; ++c) {
+            int col0 = c * binning;
+            int col1 = std::min(col0 + binning, ncol);
+            double loc_cel = data[(std::size_t)row0 * ncol + col0];
+            for (int row = row0; row < row1; ++row) {
+              const double* line = data + (std::size_t)row * ncol;
+              for (int col = col0; col < col1; ++col) {
+                loc_cel = std::max(loc_cel, line[col]);
+              }
+            }
+            loc_cel = std::min(std::max(loc_cel, min), max);
+            double scaled_pixel = 255.0 * 3 * ((loc_cel - min) * scale);
+            if (reverse) {
+              scaled_pixel = 765 - scaled_pixel;
+            }
+            int index = std::min(std::max(int(scaled_pixel), 0), 765);
+            out[3 * c + 0] = lut[3 * index + 0];
+            out[3 * c + 1] = lut[3 * index + 1];
+            out[3 * c + 2] = lut[3 * index + 2];
+          }
+        }
+      }
+    };
+
+    /**
+     * Set the range of the palette from an image, unless it has been set
+     */
+    void auto_min_max(flex_double& data2d) {
+      if (max == -1 && min == -1 && data2d.size() > 0) {
+        const double* data = data2d.begin();
+        max = data[0];
+        min = data[0];
+        for (std::size_t i = 1; i < data2d.size(); ++i) {
+          if (data[i] > max) {
+            max = data[i];
+          }
+          if (data[i] < min) {
+            min = data[i];
+          }
+        }
+      }
+    }
+
+    /**
+     * Paint an image into a bitmap, through an 8 bit look up table of the
+     * colours of the palette so that each pixel needs only one look up
+     */
+    void render(flex_double& data2d,
+                int palette_num,
+                int binning,
+                flex_int& bmp_dat,
+                std::size_t nthreads) {
+      DIALS_ASSERT(nthreads > 0);
+      int nrow = data2d.accessor().all()[0];
+      int ncol = data2d.accessor().all()[1];
+      if (nrow == 0 || ncol == 0) {
+        return;
+      }
+      std::vector<unsigned char> lut(766 * 3);
+      for (int i = 0; i <= 765; i++) {
+        if (palette_num == 1 || palette_num == 2) {
+          lut[3 * i + 0] = gray_all_rgb_byte[i];
+          lut[3 * i + 1] = gray_all_rgb_byte[i];
+          lut[3 * i + 2] = gray_all_rgb_byte[i];
+        } else {
+          lut[3 * i + 0] = hot_pal_red_byte[i];
+          lut[3 * i + 1] = hot_pal_green_byte[i];
+          lut[3 * i + 2] = hot_pal_blue_byte[i];
+        }
+      }
+      double dif = max - min;
+      double scale = dif > 0 ? 1.0 / dif : 0.0;
+      bool reverse = !(palette_num == 1 || palette_num == 3);
+      dials::algorithms::for_each_band(RenderBand(data2d.begin(),
+                                                  nrow,
+                                                  ncol,
+                                                  binning,
+                                                  min,
+                                                  max,
+                                                  scale,
+                                                  reverse,
+                                                  &lut[0],
+                                                  bmp_dat.begin()),
+                                       (nrow + binning - 1) / binning,
+                                       nthreads);
+    }
   };
 
 }}}  // namespace dials::viewer::boost_python